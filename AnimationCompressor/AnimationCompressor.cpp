@@ -0,0 +1,71 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "IO/Arguments.h"
+#include "IO/File.h"
+#include "IO/Log.h"
+#include "IO/StringUtils.h"
+#include "Object/AutoPtr.h"
+#include "Renderer/Animation.h"
+
+#include <cstdio>
+
+/// Return memory used by the animation's keyframes or compressed samples.
+size_t KeyFrameMemory(const Animation& animation)
+{
+    size_t memory = 0;
+
+    const std::vector<AnimationTrack>& tracks = animation.Tracks();
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+    {
+        const AnimationTrack& track = *it;
+        memory += track.keyFrames.size() * sizeof(AnimationKeyFrame);
+        memory += (track.positions.size() + track.rotations.size() + track.scales.size()) * sizeof(unsigned short);
+    }
+
+    return memory;
+}
+
+int main(int argc, char** argv)
+{
+    const std::vector<std::string>& arguments = ParseArguments(argc, argv);
+    if (arguments.size() < 3)
+    {
+        printf("Usage: AnimationCompressor <input> <output> [samples per second]\n"
+            "Converts an animation to the compressed format. Default sample rate is 30.\n");
+        return 1;
+    }
+
+    AutoPtr<Log> log(new Log());
+    float sampleRate = arguments.size() > 3 ? ParseFloat(arguments[3]) : 30.0f;
+    if (sampleRate <= 0.0f)
+    {
+        fprintf(stderr, "Sample rate must be positive\n");
+        return 1;
+    }
+
+    File source(arguments[1]);
+    if (!source.IsReadable())
+    {
+        fprintf(stderr, "Could not open %s\n", arguments[1].c_str());
+        return 1;
+    }
+
+    Animation animation;
+    animation.SetName(arguments[1]);
+    if (!animation.Load(source))
+        return 1;
+
+    size_t oldMemory = KeyFrameMemory(animation);
+    animation.Compress(sampleRate);
+    size_t newMemory = KeyFrameMemory(animation);
+
+    File dest(arguments[2], FILE_WRITE);
+    if (!dest.IsWritable() || !animation.Save(dest))
+    {
+        fprintf(stderr, "Could not write %s\n", arguments[2].c_str());
+        return 1;
+    }
+
+    printf("Compressed %d tracks, keyframe memory %d -> %d bytes\n", (int)animation.NumTracks(), (int)oldMemory, (int)newMemory);
+    return 0;
+}
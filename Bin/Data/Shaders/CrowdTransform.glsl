@@ -0,0 +1,39 @@
+// Crowd instance: world position and scale, rotation quaternion, and the clip's first frame, frame count, phase offset and phase rate
+in vec4 texCoord3;
+in vec4 texCoord4;
+in vec4 texCoord5;
+
+// Crowd time, first texel of the vertex buffer and its vertex count
+uniform vec4 crowdParameters;
+// Baked vertex positions and normals, two texels per vertex per frame, 4096 texels per row
+uniform sampler2D vertexAnimTex17;
+
+vec4 FetchCrowdTexel(int index)
+{
+    return texelFetch(vertexAnimTex17, ivec2(index & 4095, index >> 12), 0);
+}
+
+vec3 RotateCrowdVector(vec3 v)
+{
+    return v + 2.0 * cross(texCoord4.xyz, cross(texCoord4.xyz, v) + texCoord4.w * v);
+}
+
+void GetCrowdVertex(out vec3 worldPos, out vec3 worldNormal)
+{
+    // Loop the clip by the crowd time and interpolate between the two nearest baked frames
+    float lastFrame = texCoord5.y - 1.0;
+    float frame = fract(texCoord5.z + crowdParameters.x * texCoord5.w) * lastFrame;
+    float frame0 = floor(frame);
+    float frame1 = min(frame0 + 1.0, lastFrame);
+    float t = frame - frame0;
+
+    int numVertices = int(crowdParameters.z);
+    int index0 = int(crowdParameters.y) + ((int(texCoord5.x + frame0) * numVertices + gl_VertexID) << 1);
+    int index1 = int(crowdParameters.y) + ((int(texCoord5.x + frame1) * numVertices + gl_VertexID) << 1);
+
+    vec3 localPos = mix(FetchCrowdTexel(index0).xyz, FetchCrowdTexel(index1).xyz, t);
+    vec3 localNormal = mix(FetchCrowdTexel(index0 + 1).xyz, FetchCrowdTexel(index1 + 1).xyz, t);
+
+    worldPos = RotateCrowdVector(localPos * texCoord3.w) + texCoord3.xyz;
+    worldNormal = normalize(RotateCrowdVector(localNormal));
+}
@@ -0,0 +1,51 @@
+// Lights the G-buffer of deferred shading with the same directional light, light clusters and shadow maps as the forward
+// passes. The world position is reconstructed from the depth buffer, and the world normal from the view-space normal
+
+#include "Uniforms.glsl"
+
+#ifdef COMPILEVS
+
+in vec3 position;
+noperspective out vec2 vUv;
+
+#else
+
+#include "Lighting.glsl"
+
+uniform mat4 invViewProjMatrix;
+
+uniform sampler2D albedoTex0;
+uniform sampler2D normalTex1;
+uniform sampler2D depthTex2;
+
+noperspective in vec2 vUv;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(depthTex2, texel, 0).r;
+    // Leave the background as cleared
+    if (depth >= 1.0)
+        discard;
+
+    vec4 albedo = texelFetch(albedoTex0, texel, 0);
+    vec3 viewNormal = texelFetch(normalTex1, texel, 0).xyz * 2.0 - 1.0;
+    // The view matrix is orthonormal, so its transpose rotates back to world space
+    vec3 normal = normalize(mat3(viewMatrix) * viewNormal);
+
+    vec4 projWorldPos = vec4(vUv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0) * invViewProjMatrix;
+    vec4 worldPos = vec4(projWorldPos.xyz / projWorldPos.w, 1.0);
+    // Linear depth for the shadow cascades and clusters, as computed by the vertex shaders of the forward passes
+    worldPos.w = dot(depthParameters.zw, (worldPos * viewProjMatrix).zw);
+
+    fragColor = vec4(albedo.rgb * CalculateLighting(worldPos, normal, vec2(vUv.x, 1.0 - vUv.y)), albedo.a);
+}
@@ -0,0 +1,159 @@
+// Culls the static geometry instances managed by GpuCuller against the view frustum, maximum draw distance and optionally the
+// occlusion depth, selects their LOD level, and appends the static transform table index of each visible instance to the draw
+// command of its level. The commands' instance counts have been reset to zero, and each has room for all instances of its geometry
+
+layout(local_size_x = 64) in;
+
+struct CullRecord
+{
+    // Local bounding box minimum and static transform table index
+    vec4 boxMin;
+    // Local bounding box maximum and maximum draw distance
+    vec4 boxMax;
+    // First LOD level, number of LOD levels and LOD bias
+    vec4 lodParameters;
+};
+
+layout(std430, binding = 0) readonly buffer CullRecords
+{
+    CullRecord records[];
+};
+
+// Draw command index and LOD distance of each level
+layout(std430, binding = 1) readonly buffer CullLevels
+{
+    uvec2 levels[];
+};
+
+// Five values per command: index count, instance count, first index, base vertex and base instance
+layout(std430, binding = 2) buffer DrawCommands
+{
+    uint commands[];
+};
+
+layout(std430, binding = 3) writeonly buffer Instances
+{
+    float instances[];
+};
+
+uniform sampler2D staticTransformTex16;
+uniform mat4 cullViewProj;
+// View space Z axis for the distance along the view direction
+uniform vec4 cullViewZ;
+// Camera LOD bias and zoom, orthographic size or zero if perspective, and number of records
+uniform vec4 cullParameters;
+
+#ifdef OCCLUSION
+// Downsampled maximum depth of an earlier frame
+uniform sampler2D occlusionTex0;
+uniform mat4 occlusionViewProj;
+
+bool IsOccluded(vec3 boxMin, vec3 boxMax)
+{
+    vec2 minPos = vec2(1.0);
+    vec2 maxPos = vec2(-1.0);
+    float minDepth = 1.0;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = vec3((i & 1) != 0 ? boxMax.x : boxMin.x, (i & 2) != 0 ? boxMax.y : boxMin.y, (i & 4) != 0 ? boxMax.z : boxMin.z);
+        vec4 projected = vec4(corner, 1.0) * occlusionViewProj;
+        // Corners behind the near plane do not have reliable screen extents
+        if (projected.w <= 0.000001)
+            return false;
+
+        vec3 ndc = projected.xyz / projected.w;
+        minPos = min(minPos, ndc.xy);
+        maxPos = max(maxPos, ndc.xy);
+        minDepth = min(minDepth, ndc.z);
+    }
+
+    // Parts outside the depth have no occlusion information
+    if (minPos.x < -1.0 || minPos.y < -1.0 || maxPos.x > 1.0 || maxPos.y > 1.0)
+        return false;
+
+    ivec2 size = textureSize(occlusionTex0, 0);
+    ivec2 start = clamp(ivec2((minPos * 0.5 + 0.5) * vec2(size)), ivec2(0), size - 1);
+    ivec2 end = clamp(ivec2((maxPos * 0.5 + 0.5) * vec2(size)), ivec2(0), size - 1);
+    // The depth has no mip levels, so leave large rectangles untested
+    if (end.x - start.x >= 16 || end.y - start.y >= 16)
+        return false;
+
+    minDepth = minDepth * 0.5 + 0.5;
+    for (int y = start.y; y <= end.y; ++y)
+    {
+        for (int x = start.x; x <= end.x; ++x)
+        {
+            if (minDepth <= texelFetch(occlusionTex0, ivec2(x, y), 0).r)
+                return false;
+        }
+    }
+
+    return true;
+}
+#endif
+
+void comp()
+{
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= uint(cullParameters.z))
+        return;
+
+    CullRecord record = records[index];
+    uint staticIndex = floatBitsToUint(record.boxMin.w);
+
+    // World transform rows, stored like in Transform.glsl
+    ivec2 pos = ivec2(int(staticIndex & 1023u) * 3, int(staticIndex >> 10u));
+    mat3x4 transform = mat3x4(texelFetch(staticTransformTex16, pos, 0), texelFetch(staticTransformTex16, pos + ivec2(1, 0), 0), texelFetch(staticTransformTex16, pos + ivec2(2, 0), 0));
+
+    vec3 localCenter = (record.boxMin.xyz + record.boxMax.xyz) * 0.5;
+    vec3 localEdge = (record.boxMax.xyz - record.boxMin.xyz) * 0.5;
+    vec3 center = vec4(localCenter, 1.0) * transform;
+    vec3 edge = vec3(dot(abs(transform[0].xyz), localEdge), dot(abs(transform[1].xyz), localEdge), dot(abs(transform[2].xyz), localEdge));
+
+    float distance = abs(dot(cullViewZ.xyz, center) + cullViewZ.w);
+    if (record.boxMax.w > 0.0 && distance > record.boxMax.w)
+        return;
+
+    // Frustum planes from the view-projection matrix, whose columns are the rows of the engine's matrix
+    vec4 planes[6] = vec4[6](
+        cullViewProj[3] + cullViewProj[0],
+        cullViewProj[3] - cullViewProj[0],
+        cullViewProj[3] + cullViewProj[1],
+        cullViewProj[3] - cullViewProj[1],
+        cullViewProj[3] + cullViewProj[2],
+        cullViewProj[3] - cullViewProj[2]
+    );
+
+    for (int i = 0; i < 6; ++i)
+    {
+        if (dot(planes[i].xyz, center) + planes[i].w + dot(abs(planes[i].xyz), edge) < 0.0)
+            return;
+    }
+
+    #ifdef OCCLUSION
+    if (IsOccluded(center - edge, center + edge))
+        return;
+    #endif
+
+    // Same LOD selection as StaticModelDrawable, scaled by the average axis scale of the transform
+    uint firstLevel = floatBitsToUint(record.lodParameters.x);
+    uint numLevels = floatBitsToUint(record.lodParameters.y);
+    uint level = 0u;
+    if (numLevels > 1u)
+    {
+        float scale = (length(vec3(transform[0].x, transform[1].x, transform[2].x)) + length(vec3(transform[0].y, transform[1].y, transform[2].y)) +
+            length(vec3(transform[0].z, transform[1].z, transform[2].z))) / 3.0;
+        float lodDistance = (cullParameters.y > 0.0 ? cullParameters.y : distance) / max(cullParameters.x * record.lodParameters.z * scale, 0.000001);
+        for (uint i = 1u; i < numLevels; ++i)
+        {
+            if (lodDistance <= uintBitsToFloat(levels[firstLevel + i].y))
+                break;
+            level = i;
+        }
+    }
+
+    uint command = levels[firstLevel + level].x;
+    uint slot = atomicAdd(commands[command * 5u + 1u], 1u);
+    instances[commands[command * 5u + 4u] + slot] = float(staticIndex);
+}
@@ -0,0 +1,139 @@
+#ifdef COMPILEGS
+#extension GL_ARB_viewport_array : enable
+#endif
+
+#include "Uniforms.glsl"
+
+#ifdef COMPILEVS
+
+#include "Transform.glsl"
+
+in vec3 position;
+
+#ifdef STEREO
+// The geometry shader passes the outputs on to both eyes
+#define vWorldPos vsWorldPos
+#define vTexCoord vsTexCoord
+#define vNormalMatrix vsNormalMatrix
+#define vScreenPos vsScreenPos
+#endif
+
+out vec4 vWorldPos;
+out vec2 vTexCoord;
+flat out mat3 vNormalMatrix;
+noperspective out vec2 vScreenPos;
+
+#elif defined(COMPILEGS)
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 6) out;
+
+in vec4 vsWorldPos[];
+in vec2 vsTexCoord[];
+flat in mat3 vsNormalMatrix[];
+noperspective in vec2 vsScreenPos[];
+
+out vec4 vWorldPos;
+out vec2 vTexCoord;
+flat out mat3 vNormalMatrix;
+noperspective out vec2 vScreenPos;
+
+#else
+
+#include "Lighting.glsl"
+
+in vec4 vWorldPos;
+in vec2 vTexCoord;
+flat in mat3 vNormalMatrix;
+noperspective in vec2 vScreenPos;
+out vec4 fragColor[2];
+
+uniform sampler2D diffuseTex0;
+uniform sampler2D normalTex1;
+
+#endif
+
+#ifdef COMPILEVS
+vec2 SignNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Map a direction to the octahedron unfolded to a square in -1..1, matching the frame directions used when baking
+vec2 OctEncode(vec3 dir)
+{
+    dir /= abs(dir.x) + abs(dir.y) + abs(dir.z);
+    return dir.z >= 0.0 ? dir.xy : (1.0 - abs(dir.yx)) * SignNotZero(dir.xy);
+}
+
+vec3 OctDecode(vec2 oct)
+{
+    vec3 dir = vec3(oct, 1.0 - abs(oct.x) - abs(oct.y));
+    if (dir.z < 0.0)
+        dir.xy = (1.0 - abs(dir.yx)) * SignNotZero(dir.xy);
+    return normalize(dir);
+}
+#endif
+
+void vert()
+{
+    mat3x4 modelMatrix = GetWorldMatrix();
+
+    // Direction to the camera in model space, assuming uniform scale
+    vec3 viewTranslation = vec3(viewMatrix[0].w, viewMatrix[1].w, viewMatrix[2].w);
+    vec3 cameraPos = -(viewMatrix[0].xyz * viewTranslation.x + viewMatrix[1].xyz * viewTranslation.y + viewMatrix[2].xyz * viewTranslation.z);
+    vec3 toCamera = cameraPos - vec4(impostorCenter.xyz, 1.0) * modelMatrix;
+    vec3 localDir = modelMatrix[0].xyz * toCamera.x + modelMatrix[1].xyz * toCamera.y + modelMatrix[2].xyz * toCamera.z;
+
+    // Select the nearest frame and build the quad in its plane, as the frame was rendered
+    float lastFrame = impostorFrames.x - 1.0;
+    vec2 frame = floor((OctEncode(localDir) * 0.5 + 0.5) * lastFrame + 0.5);
+    vec3 frameDir = OctDecode(frame / lastFrame * 2.0 - 1.0);
+    vec3 right = normalize(cross(abs(frameDir.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0), frameDir));
+    vec3 up = cross(frameDir, right);
+
+    vec3 localPos = impostorCenter.xyz + (right * position.x + up * position.y) * impostorCenter.w;
+    vWorldPos.xyz = vec4(localPos, 1.0) * modelMatrix;
+    vTexCoord = (frame + position.xy * 0.5 + 0.5) * impostorFrames.y;
+    vNormalMatrix = mat3(modelMatrix[0].xyz, modelMatrix[1].xyz, modelMatrix[2].xyz);
+    gl_Position = vec4(vWorldPos.xyz, 1.0) * viewProjMatrix;
+    vWorldPos.w = CalculateDepth(gl_Position);
+    vScreenPos = CalculateScreenPos(gl_Position);
+#ifdef STEREO
+    gl_Position = vec4(vWorldPos.xyz, 1.0);
+#endif
+}
+
+void geom()
+{
+    // Replicate the triangle to both eyes
+    for (int eye = 0; eye < 2; ++eye)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            gl_ViewportIndex = eye;
+            gl_Position = gl_in[i].gl_Position * eyeViewProjMatrices[eye];
+            vWorldPos = vsWorldPos[i];
+            vTexCoord = vsTexCoord[i];
+            vNormalMatrix = vsNormalMatrix[i];
+            vScreenPos = vsScreenPos[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
+
+void frag()
+{
+    vec4 diffuse = texture(diffuseTex0, vTexCoord);
+    if (diffuse.a < 0.5)
+        discard;
+
+    vec3 normal = normalize((texture(normalTex1, vTexCoord).xyz * 2.0 - 1.0) * vNormalMatrix);
+#ifdef DEFERRED
+    fragColor[0] = vec4(diffuse.rgb, 1.0);
+#else
+    fragColor[0] = vec4(diffuse.rgb * CalculateLighting(vWorldPos, normal, vScreenPos), 1.0);
+#endif
+    fragColor[1] = vec4((vec4(normal, 0.0) * viewMatrix) * 0.5 + 0.5, 1.0);
+}
@@ -0,0 +1,47 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+in vec3 normal;
+in vec2 texCoord;
+
+out vec3 vNormal;
+out vec2 vTexCoord;
+
+uniform mat4 impostorViewProj;
+
+#else
+
+in vec3 vNormal;
+in vec2 vTexCoord;
+out vec4 fragColor[2];
+
+#ifdef DIFFUSEMAP
+uniform sampler2D diffuseTex0;
+#endif
+
+#endif
+
+layout(std140) uniform MaterialData3
+{
+    uniform vec4 matDiffColor;
+};
+
+void vert()
+{
+    vNormal = normal;
+    vTexCoord = texCoord;
+    gl_Position = vec4(position, 1.0) * impostorViewProj;
+}
+
+void frag()
+{
+    // Write the diffuse color with full coverage, and the model space normal
+#ifdef DIFFUSEMAP
+    vec3 diffuse = matDiffColor.rgb * texture(diffuseTex0, vTexCoord).rgb;
+#else
+    vec3 diffuse = matDiffColor.rgb;
+#endif
+    vec3 normal = dot(vNormal, vNormal) > 0.0 ? normalize(vNormal) : vec3(0.0, 1.0, 0.0);
+    fragColor[0] = vec4(diffuse, 1.0);
+    fragColor[1] = vec4(normal * 0.5 + 0.5, 1.0);
+}
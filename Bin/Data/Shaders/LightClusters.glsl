@@ -0,0 +1,245 @@
+// Builds the light cluster data on the GPU. The default pass assigns the lights to the clusters. With USEBOUNDS, the clusters
+// are clipped to the maximum opaque depth of their screen tile, which the CLEARBOUNDS and DEPTHBOUNDS passes gather first
+
+// Must match MAX_FAR_CLUSTER_LIGHTS in Renderer.h
+#define MAX_FAR_CLUSTER_LIGHTS 8
+
+#include "LightData.glsl"
+
+#ifdef DEPTHBOUNDS
+layout(local_size_x = 8, local_size_y = 8) in;
+#else
+layout(local_size_x = 64) in;
+#endif
+
+layout(binding = 0, rg32ui) uniform writeonly uimage3D clusterImage0;
+layout(binding = 1, r32ui) uniform writeonly uimage2D lightIndexImage1;
+layout(binding = 2, r32ui) uniform uimage2D boundsImage2;
+
+uniform sampler2D depthTex0;
+uniform mat3x4 viewMatrix;
+uniform mat4 projectionInverse;
+uniform vec4 clusterParameters;
+uniform vec4 clusterSliceParameters;
+uniform vec2 farClusterParameters;
+
+shared vec4 lightSpheres[64];
+shared vec4 lightCones[64];
+shared float lightIntensities[64];
+shared uint groupMaxDepth;
+
+float GetSliceZ(int slice, int numSlices, float nearClip, float farClip)
+{
+    // Match the depth slices of the CPU path and the lookup in the fragment shaders
+    float coord = float(slice) / float(numSlices);
+    if (slice == 0)
+        return nearClip;
+    else if (clusterSliceParameters.z > 0.0)
+        return exp2((coord - clusterSliceParameters.y) / clusterSliceParameters.x) * farClip;
+    else
+        return coord * coord * farClip;
+}
+
+vec3 GetViewPos(vec2 ndcPos, float ndcDepth)
+{
+    vec4 pos = vec4(ndcPos, ndcDepth, 1.0) * projectionInverse;
+    return pos.xyz / pos.w;
+}
+
+vec3 GetRayPos(vec2 ndcPos, float viewZ)
+{
+    // Interpolate along the view ray through the screen position, which works for both perspective and orthographic projection
+    vec3 nearPos = GetViewPos(ndcPos, -1.0);
+    vec3 farPos = GetViewPos(ndcPos, 1.0);
+    return mix(nearPos, farPos, (viewZ - nearPos.z) / (farPos.z - nearPos.z));
+}
+
+bool IsLightInCluster(vec4 sphere, vec4 cone, vec3 boxMin, vec3 boxMax, vec3 boxCenter, float boxRadius)
+{
+    vec3 delta = max(boxMin - sphere.xyz, 0.0) + max(sphere.xyz - boxMax, 0.0);
+    if (dot(delta, delta) > sphere.w * sphere.w)
+        return false;
+
+    // Spot lights additionally test their cone against the bounding sphere of the cluster
+    if (cone.w > 0.0)
+    {
+        vec3 lightVec = boxCenter - sphere.xyz;
+        float axisDistance = dot(lightVec, cone.xyz);
+        float sinAngle = sqrt(1.0 - cone.w * cone.w);
+        float coneDistance = cone.w * sqrt(max(dot(lightVec, lightVec) - axisDistance * axisDistance, 0.0)) - axisDistance * sinAngle;
+        if (coneDistance > boxRadius || axisDistance < -boxRadius)
+            return false;
+    }
+
+    return true;
+}
+
+ivec2 GetScreenTile(ivec2 pixel, ivec2 depthSize, ivec2 boundsSize)
+{
+    // Find the screen tile the same way as the lighting in the fragment shaders
+    vec2 screenPos = vec2((float(pixel.x) + 0.5) / float(depthSize.x), 1.0 - (float(pixel.y) + 0.5) / float(depthSize.y));
+    return min(ivec2(screenPos * vec2(boundsSize)), boundsSize - 1);
+}
+
+void StoreLightIndices(uint position, uint indices)
+{
+    // Two 16-bit indices per texel, 4096 texels per row
+    uint texel = position >> 1U;
+    imageStore(lightIndexImage1, ivec2(int(texel & 4095U), int(texel >> 12U)), uvec4(indices));
+}
+
+void comp()
+{
+#if defined(CLEARBOUNDS)
+    ivec2 boundsSize = imageSize(boundsImage2);
+    int index = int(gl_GlobalInvocationID.x);
+    if (index < boundsSize.x * boundsSize.y)
+        imageStore(boundsImage2, ivec2(index % boundsSize.x, index / boundsSize.x), uvec4(0U));
+#elif defined(DEPTHBOUNDS)
+    ivec2 depthSize = textureSize(depthTex0, 0);
+    ivec2 boundsSize = imageSize(boundsImage2);
+    ivec2 pixel = min(ivec2(gl_GlobalInvocationID.xy), depthSize - 1);
+    ivec2 tile = GetScreenTile(pixel, depthSize, boundsSize);
+    ivec2 groupTile = GetScreenTile(min(ivec2(gl_WorkGroupID.xy * gl_WorkGroupSize.xy), depthSize - 1), depthSize, boundsSize);
+
+    // Cleared background pixels reconstruct to the far plane, so that tiles with background are not clipped
+    float ndcDepth = texelFetch(depthTex0, pixel, 0).r * 2.0 - 1.0;
+    uint depthBits = floatBitsToUint(max(GetViewPos(vec2(0.0, 0.0), ndcDepth).z, 0.0));
+
+    if (gl_LocalInvocationIndex == 0U)
+        groupMaxDepth = 0U;
+    barrier();
+
+    // Reduce in shared memory first when the pixel is in the same tile as the work group's first pixel, to avoid contention
+    if (tile == groupTile)
+        atomicMax(groupMaxDepth, depthBits);
+    else
+        imageAtomicMax(boundsImage2, tile, depthBits);
+    barrier();
+
+    if (gl_LocalInvocationIndex == 0U && groupMaxDepth > 0U)
+        imageAtomicMax(boundsImage2, groupTile, groupMaxDepth);
+#else
+    ivec3 size = imageSize(clusterImage0);
+    uint numClusters = uint(size.x * size.y * size.z);
+    uint index = gl_GlobalInvocationID.x;
+    uint clusterIndex = min(index, numClusters - 1U);
+    ivec3 pos = ivec3(int(clusterIndex) % size.x, (int(clusterIndex) / size.x) % size.y, int(clusterIndex) / (size.x * size.y));
+
+    // Calculate the view space bounding box of the cluster
+    float minZ = GetSliceZ(pos.z, size.z, clusterParameters.x, clusterParameters.y);
+    float maxZ = GetSliceZ(pos.z + 1, size.z, clusterParameters.x, clusterParameters.y);
+    bool culled = false;
+
+#ifdef USEBOUNDS
+    // Alpha geometry may be anywhere in front of the opaque depth, so only clip the far end of the clusters
+    float tileMaxZ = uintBitsToFloat(imageLoad(boundsImage2, pos.xy).r);
+    culled = minZ > tileMaxZ;
+    maxZ = min(maxZ, tileMaxZ);
+#endif
+
+    vec2 tileMin = vec2(-1.0 + 2.0 * float(pos.x) / float(size.x), 1.0 - 2.0 * float(pos.y + 1) / float(size.y));
+    vec2 tileMax = vec2(-1.0 + 2.0 * float(pos.x + 1) / float(size.x), 1.0 - 2.0 * float(pos.y) / float(size.y));
+    vec3 boxMin = GetRayPos(tileMin, minZ);
+    vec3 boxMax = boxMin;
+
+    for (int i = 0; i < 8; ++i)
+    {
+        vec3 corner = GetRayPos(vec2((i & 1) != 0 ? tileMax.x : tileMin.x, (i & 2) != 0 ? tileMax.y : tileMin.y), (i & 4) != 0 ? maxZ : minZ);
+        boxMin = min(boxMin, corner);
+        boxMax = max(boxMax, corner);
+    }
+
+    vec3 boxCenter = (boxMin + boxMax) * 0.5;
+    float boxRadius = length(boxMax - boxCenter);
+
+    uint numLights = uint(clusterParameters.z);
+    uint maxLightsPerCluster = uint(clusterParameters.w);
+    // Each cluster owns a fixed range of the index list, rounded up to whole texels
+    uint start = clusterIndex * ((maxLightsPerCluster + 1U) & ~1U);
+    uint count = 0U;
+    uint pendingIndices = 0U;
+
+    // Far clusters keep only the lights with the highest estimated contribution at the cluster center
+    uint maxFarLights = minZ >= farClusterParameters.x ? uint(farClusterParameters.y) : 0U;
+    uint farIndices[MAX_FAR_CLUSTER_LIGHTS];
+    float farContributions[MAX_FAR_CLUSTER_LIGHTS];
+    uint numFarLights = 0U;
+
+    // All invocations, including those past the last cluster, take part in loading the lights to shared memory
+    for (uint base = 0U; base < numLights; base += 64U)
+    {
+        uint loadIndex = base + gl_LocalInvocationIndex;
+        if (loadIndex < numLights)
+        {
+            vec4 attenuation = GetLightData(loadIndex, LIGHT_ATTENUATION);
+            lightSpheres[gl_LocalInvocationIndex] = vec4(vec4(GetLightData(loadIndex, LIGHT_POSITION).xyz, 1.0) * viewMatrix, 1.0 / attenuation.x);
+            // The light data direction points toward the light, while the cone axis points away from it
+            lightCones[gl_LocalInvocationIndex] = vec4(-(vec4(GetLightData(loadIndex, LIGHT_DIRECTION).xyz, 0.0) * viewMatrix), attenuation.y);
+            vec3 color = GetLightData(loadIndex, LIGHT_COLOR).rgb;
+            lightIntensities[gl_LocalInvocationIndex] = color.r + color.g + color.b;
+        }
+        barrier();
+
+        if (!culled)
+        {
+            uint batchSize = min(numLights - base, 64U);
+            for (uint i = 0U; i < batchSize && count < maxLightsPerCluster; ++i)
+            {
+                if (IsLightInCluster(lightSpheres[i], lightCones[i], boxMin, boxMax, boxCenter, boxRadius))
+                {
+                    if (maxFarLights > 0U)
+                    {
+                        vec3 scaledLightVec = (boxCenter - lightSpheres[i].xyz) / lightSpheres[i].w;
+                        float contribution = lightIntensities[i] * max(1.0 - dot(scaledLightVec, scaledLightVec), 0.0);
+
+                        // Replace the lowest contribution when full
+                        uint slot = numFarLights;
+                        if (numFarLights < maxFarLights)
+                            ++numFarLights;
+                        else
+                        {
+                            slot = 0U;
+                            for (uint j = 1U; j < numFarLights; ++j)
+                            {
+                                if (farContributions[j] < farContributions[slot])
+                                    slot = j;
+                            }
+                            if (farContributions[slot] >= contribution)
+                                continue;
+                        }
+
+                        farIndices[slot] = base + i;
+                        farContributions[slot] = contribution;
+                        continue;
+                    }
+
+                    if ((count & 1U) == 0U)
+                        pendingIndices = base + i;
+                    else
+                        StoreLightIndices(start + count, pendingIndices | ((base + i) << 16U));
+                    ++count;
+                }
+            }
+        }
+        barrier();
+    }
+
+    if (index >= numClusters)
+        return;
+
+    for (uint i = 0U; i < numFarLights; ++i)
+    {
+        if ((count & 1U) == 0U)
+            pendingIndices = farIndices[i];
+        else
+            StoreLightIndices(start + count, pendingIndices | (farIndices[i] << 16U));
+        ++count;
+    }
+
+    if ((count & 1U) != 0U)
+        StoreLightIndices(start + count - 1U, pendingIndices);
+
+    imageStore(clusterImage0, pos, uvec4(start, count, 0U, 0U));
+#endif
+}
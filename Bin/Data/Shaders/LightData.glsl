@@ -0,0 +1,14 @@
+uniform sampler2D lightDataTex15;
+
+// Light data vectors, nine per light in the light data texture, 256 lights per row
+const int LIGHT_POSITION = 0;
+const int LIGHT_DIRECTION = 1;
+const int LIGHT_ATTENUATION = 2;
+const int LIGHT_COLOR = 3;
+const int LIGHT_SHADOWPARAMETERS = 4;
+const int LIGHT_SHADOWMATRIX = 5;
+
+vec4 GetLightData(uint index, int element)
+{
+    return texelFetch(lightDataTex15, ivec2(int(index & 255U) * 9 + element, int(index >> 8U)), 0);
+}
@@ -1,18 +1,104 @@
+#ifdef MOMENTSHADOW
+uniform sampler2D dirShadowTex8;
+uniform sampler2D shadowTex9;
+#else
 uniform sampler2DShadow dirShadowTex8;
 uniform sampler2DShadow shadowTex9;
+#endif
 uniform samplerCube faceSelectionTex10;
 uniform samplerCube faceSelectionTex11;
 uniform usampler3D clusterTex12;
+uniform usampler2D lightIndexTex14;
+uniform sampler2D decalDataTex18;
+uniform sampler2D decalAtlasTex19;
+uniform sampler3D lightProbeTex20;
+
+#include "LightData.glsl"
+#ifdef MOMENTSHADOW
+#include "MomentShadow.glsl"
+#endif
+
+uint GetLightIndex(uint position)
+{
+    // Two 16-bit indices per texel, 4096 texels per row
+    uint texel = position >> 1U;
+    uint indices = texelFetch(lightIndexTex14, ivec2(int(texel & 4095U), int(texel >> 12U)), 0).r;
+    return (position & 1U) != 0U ? indices >> 16U : indices & 0xffffU;
+}
 
 vec3 CalculateClusterPos(vec2 screenPos, float depth)
 {
+    // Adaptive depth slices are distributed exponentially over the visible geometry depth range
     return vec3(
         screenPos.x,
         screenPos.y,
-        sqrt(depth)
+        clusterSliceParameters.z > 0.0 ? log2(depth) * clusterSliceParameters.x + clusterSliceParameters.y : sqrt(depth)
     );
 }
 
+uvec2 GetClusterRange(vec4 worldPos, vec2 screenPos)
+{
+#ifdef STEREO
+    // The clusters are built for the camera enclosing both eyes, so find the screen position from the world position
+    // rather than interpolating it in the eye's screen space
+    vec4 clusterClipPos = vec4(worldPos.xyz, 1.0) * viewProjMatrix;
+    screenPos = vec2(clusterClipPos.x / clusterClipPos.w * 0.5 + 0.5, -clusterClipPos.y / clusterClipPos.w * 0.5 + 0.5);
+#endif
+
+    // The cluster contains the offset of its lights in the light index list, and the light count in the lower and decal count in the upper 16 bits
+    return texture(clusterTex12, CalculateClusterPos(screenPos, worldPos.w)).xy;
+}
+
+// The screen-space gradients of the world position are projected for each decal's texture sampling
+vec3 ApplyDecalsGrad(vec3 color, vec4 worldPos, vec3 normal, vec2 screenPos, vec3 worldPosDx, vec3 worldPosDy)
+{
+    uvec2 range = GetClusterRange(worldPos, screenPos);
+    uint decalStart = range.x + (range.y & 0xffffU);
+    uint decalEnd = decalStart + (range.y >> 16U);
+
+    for (uint i = decalStart; i < decalEnd; ++i)
+    {
+        // Decal data vectors, five per decal in the decal data texture, 256 decals per row
+        uint index = GetLightIndex(i);
+        ivec2 texel = ivec2(int(index & 255U) * 5, int(index >> 8U));
+        mat3x4 projection = mat3x4(texelFetch(decalDataTex18, texel, 0), texelFetch(decalDataTex18, texel + ivec2(1, 0), 0), texelFetch(decalDataTex18, texel + ivec2(2, 0), 0));
+
+        vec3 decalPos = vec4(worldPos.xyz, 1.0) * projection;
+        if (any(greaterThan(abs(decalPos), vec3(0.5))))
+            continue;
+
+        // Fade out on surfaces facing away from the projection axis
+        float facing = clamp(dot(normal, normalize(projection[1].xyz)) * 2.0, 0.0, 1.0);
+        if (facing <= 0.0)
+            continue;
+
+        vec4 textureRect = texelFetch(decalDataTex18, texel + ivec2(3, 0), 0);
+        vec4 decalColor = texelFetch(decalDataTex18, texel + ivec2(4, 0), 0);
+        vec2 uv = (decalPos.xz + 0.5) * textureRect.zw + textureRect.xy;
+        vec2 uvDx = (vec4(worldPosDx, 0.0) * projection).xz * textureRect.zw;
+        vec2 uvDy = (vec4(worldPosDy, 0.0) * projection).xz * textureRect.zw;
+        vec4 decalTexel = textureGrad(decalAtlasTex19, uv, uvDx, uvDy) * decalColor;
+        color = mix(color, decalTexel.rgb, decalTexel.a * facing);
+    }
+
+    return color;
+}
+
+#ifdef COMPILEFS
+vec3 ApplyDecals(vec3 color, vec4 worldPos, vec3 normal, vec2 screenPos)
+{
+    // The texture gradients are taken outside the decal loop
+    return ApplyDecalsGrad(color, worldPos, normal, screenPos, dFdx(worldPos.xyz), dFdy(worldPos.xyz));
+}
+#endif
+
+#ifdef MOMENTSHADOW
+float SampleShadowMap(sampler2D shadowTex, vec4 shadowPos, vec4 parameters)
+{
+    // The moments are prefiltered, so one fetch replaces the PCF taps
+    return SampleMomentShadowMap(shadowTex, shadowPos);
+}
+#else
 float SampleShadowMap(sampler2DShadow shadowTex, vec4 shadowPos, vec4 parameters)
 {
 #ifdef HQSHADOW
@@ -44,6 +130,14 @@ float SampleShadowMap(sampler2DShadow shadowTex, vec4 shadowPos, vec4 parameters
     ) * 0.25;
 #endif
 }
+#endif
+
+float SampleDirShadowMap(int cascade, vec4 worldPos, vec4 parameters)
+{
+    int matIndex = 5 + cascade * 4;
+    mat4 shadowMatrix = mat4(dirLightData[matIndex], dirLightData[matIndex+1], dirLightData[matIndex+2], dirLightData[matIndex+3]);
+    return SampleShadowMap(dirShadowTex8, vec4(worldPos.xyz, 1.0) * shadowMatrix, parameters);
+}
 
 void CalculateDirLight(vec4 worldPos, vec3 normal, inout vec3 accumulatedLight)
 {
@@ -56,14 +150,26 @@ void CalculateDirLight(vec4 worldPos, vec3 normal, inout vec3 accumulatedLight)
 
     vec4 shadowSplits = dirLightData[2];
     vec4 shadowParameters = dirLightData[3];
+    vec4 shadowFadeParameters = dirLightData[4];
 
-    if (shadowParameters.z < 1.0 && worldPos.w < shadowSplits.y)
+    if (shadowParameters.z < 1.0 && worldPos.w < shadowSplits.w)
     {
-        int matIndex = worldPos.w > shadowSplits.x ? 8 : 4;
+        // Unused cascade splits repeat the last, so the number of splits passed is the cascade index
+        int cascade = int(dot(step(shadowSplits, vec4(worldPos.w)), vec4(1.0)));
+        float shadow = SampleDirShadowMap(cascade, worldPos, shadowParameters);
 
-        mat4 shadowMatrix = mat4(dirLightData[matIndex], dirLightData[matIndex+1], dirLightData[matIndex+2], dirLightData[matIndex+3]);
-        float shadowFade = shadowParameters.z + clamp((worldPos.w - shadowSplits.z) * shadowSplits.w, 0.0, 1.0);
-        NdotL *= clamp(shadowFade + SampleShadowMap(dirShadowTex8, vec4(worldPos.xyz, 1.0) * shadowMatrix, shadowParameters), 0.0, 1.0);
+        // Blend towards the next cascade at the end of the cascade
+        if (shadowFadeParameters.z > 0.0 && cascade < int(shadowFadeParameters.w) - 1)
+        {
+            float cascadeEnd = shadowSplits[cascade];
+            float blendLength = shadowFadeParameters.z * (cascadeEnd - (cascade > 0 ? shadowSplits[cascade - 1] : 0.0));
+            float blend = (worldPos.w - cascadeEnd + blendLength) / blendLength;
+            if (blend > 0.0)
+                shadow = mix(shadow, SampleDirShadowMap(cascade + 1, worldPos, shadowParameters), blend);
+        }
+
+        float shadowFade = shadowParameters.z + clamp((worldPos.w - shadowFadeParameters.x) * shadowFadeParameters.y, 0.0, 1.0);
+        NdotL *= clamp(shadowFade + shadow, 0.0, 1.0);
     }
 
     accumulatedLight += NdotL * lightColor;
@@ -71,8 +177,8 @@ void CalculateDirLight(vec4 worldPos, vec3 normal, inout vec3 accumulatedLight)
 
 vec4 GetPointShadowPos(uint index, vec3 lightVec)
 {
-    vec4 pointParameters = lights[index].shadowMatrix[0];
-    vec4 pointParameters2 = lights[index].shadowMatrix[1];
+    vec4 pointParameters = GetLightData(index, LIGHT_SHADOWMATRIX);
+    vec4 pointParameters2 = GetLightData(index, LIGHT_SHADOWMATRIX + 1);
     float zoom = pointParameters2.x;
     float q = pointParameters2.y;
     float r = pointParameters2.z;
@@ -87,9 +193,8 @@ vec4 GetPointShadowPos(uint index, vec3 lightVec)
 
 void CalculateLight(uint index, vec4 worldPos, vec3 normal, inout vec3 accumulatedLight)
 {
-    vec3 lightPosition = lights[index].position.xyz;
-    vec4 lightAttenuation = lights[index].attenuation;
-    vec3 lightColor = lights[index].color.rgb;
+    vec3 lightPosition = GetLightData(index, LIGHT_POSITION).xyz;
+    vec4 lightAttenuation = GetLightData(index, LIGHT_ATTENUATION);
 
     vec3 lightVec = lightPosition - worldPos.xyz;
     vec3 scaledLightVec = lightVec * lightAttenuation.x;
@@ -100,11 +205,11 @@ void CalculateLight(uint index, vec4 worldPos, vec3 normal, inout vec3 accumulat
     if (atten <= 0.0 || NdotL <= 0.0)
         return;
 
-    vec4 shadowParameters = lights[index].shadowParameters;
+    vec4 shadowParameters = GetLightData(index, LIGHT_SHADOWPARAMETERS);
 
     if (lightAttenuation.y > 0.0)
     {
-        vec3 lightSpotDirection = lights[index].direction.xyz;
+        vec3 lightSpotDirection = GetLightData(index, LIGHT_DIRECTION).xyz;
         float spotEffect = dot(lightDir, lightSpotDirection);
         float spotAtten = (spotEffect - lightAttenuation.y) * lightAttenuation.z;
         if (spotAtten <= 0.0)
@@ -113,42 +218,62 @@ void CalculateLight(uint index, vec4 worldPos, vec3 normal, inout vec3 accumulat
         atten *= spotAtten;
 
         if (shadowParameters.z < 1.0)
-            atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, vec4(worldPos.xyz, 1.0) * lights[index].shadowMatrix, shadowParameters), 0.0, 1.0);
+        {
+            mat4 shadowMatrix = mat4(GetLightData(index, LIGHT_SHADOWMATRIX), GetLightData(index, LIGHT_SHADOWMATRIX + 1), GetLightData(index, LIGHT_SHADOWMATRIX + 2),
+                GetLightData(index, LIGHT_SHADOWMATRIX + 3));
+            atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, vec4(worldPos.xyz, 1.0) * shadowMatrix, shadowParameters), 0.0, 1.0);
+        }
     }
     else if (shadowParameters.z < 1.0)
         atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, GetPointShadowPos(index, lightVec), shadowParameters), 0.0, 1.0);
 
-    accumulatedLight += atten * NdotL * lightColor;
+    accumulatedLight += atten * NdotL * GetLightData(index, LIGHT_COLOR).rgb;
+}
+
+vec3 SampleLightProbes(vec3 worldPos, vec3 normal)
+{
+    // Offset along the normal to reduce leaking from behind the surface. The red, green and blue coefficients are stacked along
+    // the Z axis, so clamp to the texel centers at the edges to not filter between them
+    vec3 resolution = lightProbeData[2].xyz;
+    vec3 texel = clamp((worldPos + normal * lightProbeData[1].w) * lightProbeData[0].xyz + lightProbeData[1].xyz, vec3(0.5), resolution - 0.5);
+    vec2 uv = texel.xy / resolution.xy;
+    float depth = 3.0 * resolution.z;
+    vec4 basis = vec4(1.0, normal);
+
+    return max(vec3(
+        dot(texture(lightProbeTex20, vec3(uv, texel.z / depth)), basis),
+        dot(texture(lightProbeTex20, vec3(uv, (texel.z + resolution.z) / depth)), basis),
+        dot(texture(lightProbeTex20, vec3(uv, (texel.z + 2.0 * resolution.z) / depth)), basis)
+    ), vec3(0.0));
 }
 
 vec3 CalculateLighting(vec4 worldPos, vec3 normal, vec2 screenPos)
 {
     vec3 accumulatedLight = vec3(0.1, 0.1, 0.1);
 
+    if (lightProbeData[0].w > 0.0)
+        accumulatedLight += SampleLightProbes(worldPos.xyz, normal);
+
     CalculateDirLight(worldPos, normal, accumulatedLight);
 
-    uvec4 lightClusterData = texture(clusterTex12, CalculateClusterPos(screenPos, worldPos.w));
+    uvec2 lightRange = GetClusterRange(worldPos, screenPos);
+    uint lightEnd = lightRange.x + (lightRange.y & 0xffffU);
 
-    while (lightClusterData.x > 0U)
-    {
-        CalculateLight((lightClusterData.x & 0xffU) - 1U, worldPos, normal, accumulatedLight);
-        lightClusterData.x >>= 8U;
-    }
-    while (lightClusterData.y > 0U)
-    {
-        CalculateLight((lightClusterData.y & 0xffU) - 1U, worldPos, normal, accumulatedLight);
-        lightClusterData.y >>= 8U;
-    }
-    while (lightClusterData.z > 0U)
-    {
-        CalculateLight((lightClusterData.z & 0xffU) - 1U, worldPos, normal, accumulatedLight);
-        lightClusterData.z >>= 8U;
-    }
-    while (lightClusterData.w > 0U)
-    {
-        CalculateLight((lightClusterData.w & 0xffU) - 1U, worldPos, normal, accumulatedLight);
-        lightClusterData.w >>= 8U;
-    }
+    for (uint i = lightRange.x; i < lightEnd; ++i)
+        CalculateLight(GetLightIndex(i), worldPos, normal, accumulatedLight);
 
     return accumulatedLight;
 }
+
+#ifdef OIT
+// Return the premultiplied color and alpha of a transparent fragment multiplied by its weight for weighted blended order-independent
+// transparency. The weight falls off steeply with the linear depth, so that the nearest fragments dominate the average
+vec4 CalculateOITColor(vec4 color, float depth)
+{
+    float weight = clamp(0.03 / (1e-5 + pow(depth, 4.0)), 1e-2, 3e3);
+#ifndef PREMULALPHA
+    color.rgb *= color.a;
+#endif
+    return color * weight;
+}
+#endif
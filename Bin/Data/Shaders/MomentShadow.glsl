@@ -0,0 +1,31 @@
+// Exponential variance shadow maps store the first two moments of the exponentially warped depth, so that they can be
+// blurred once after rendering and tested with a single bilinear fetch. The exponent must match MOMENT_SHADOW_EXPONENT in
+// Renderer.cpp, which clears the maps to the moments of the far plane
+
+const float MOMENT_EXPONENT = 40.0;
+// Minimum standard deviation relative to the warped depth's derivative, to avoid acne on flat receivers
+const float MOMENT_MIN_DEVIATION = 0.0002;
+// Fraction of the visibility estimate cut off to reduce light bleeding where shadowcasters overlap
+const float MOMENT_BLEED_REDUCTION = 0.3;
+
+vec2 GetShadowMoments(float depth)
+{
+    float warpedDepth = exp(MOMENT_EXPONENT * (depth * 2.0 - 1.0));
+    return vec2(warpedDepth, warpedDepth * warpedDepth);
+}
+
+float SampleMomentShadowMap(sampler2D shadowTex, vec4 shadowPos)
+{
+    vec3 pos = shadowPos.xyz / shadowPos.w;
+    vec2 moments = textureLod(shadowTex, pos.xy, 0.0).xy;
+    float warpedDepth = exp(MOMENT_EXPONENT * (pos.z * 2.0 - 1.0));
+    if (warpedDepth <= moments.x)
+        return 1.0;
+
+    // Chebyshev's upper bound for the fraction of the filter region at or beyond the receiver depth
+    float minDeviation = MOMENT_MIN_DEVIATION * MOMENT_EXPONENT * warpedDepth;
+    float variance = max(moments.y - moments.x * moments.x, minDeviation * minDeviation);
+    float delta = warpedDepth - moments.x;
+    float visibility = variance / (variance + delta * delta);
+    return clamp((visibility - MOMENT_BLEED_REDUCTION) / (1.0 - MOMENT_BLEED_REDUCTION), 0.0, 1.0);
+}
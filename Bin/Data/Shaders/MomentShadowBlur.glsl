@@ -0,0 +1,41 @@
+// Separable Gaussian blur of the moments within one shadow map viewport. Nine taps are taken with five bilinear fetches, each
+// clamped to the viewport so that neighboring views in the atlas do not bleed into each other
+
+#ifdef COMPILEVS
+
+in vec3 position;
+
+#else
+
+uniform sampler2D momentTex0;
+// Sample step in texture coordinates in xy, inverse texture size in zw
+uniform vec4 blurParameters;
+// Viewport rectangle in texture coordinates, inset by half a texel
+uniform vec4 blurRect;
+
+out vec4 fragColor;
+
+vec2 SampleMoments(vec2 uv)
+{
+    return textureLod(momentTex0, clamp(uv, blurRect.xy, blurRect.zw), 0.0).xy;
+}
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+}
+
+void frag()
+{
+    vec2 uv = gl_FragCoord.xy * blurParameters.zw;
+    vec2 offset1 = blurParameters.xy * 1.3846153846;
+    vec2 offset2 = blurParameters.xy * 3.2307692308;
+
+    vec2 moments = SampleMoments(uv) * 0.2270270270 +
+        (SampleMoments(uv + offset1) + SampleMoments(uv - offset1)) * 0.3162162162 +
+        (SampleMoments(uv + offset2) + SampleMoments(uv - offset2)) * 0.0702702703;
+
+    fragColor = vec4(moments, 0.0, 1.0);
+}
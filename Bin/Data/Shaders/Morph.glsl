@@ -0,0 +1,113 @@
+// Applies the weighted morph target deltas of an animated model into its morphed vertex buffer. Each invocation recomputes one
+// affected vertex from the source, so the cost depends only on the number of morphed vertices. With the COPY define, copies all
+// source vertices instead, which is done once when the morphed vertex buffer is created
+
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) readonly buffer SourceVertices
+{
+    uint sourceData[];
+};
+
+layout(std430, binding = 1) buffer MorphedVertices
+{
+    uint destData[];
+};
+
+// Per affected vertex a header of vertex index, first delta and delta count, followed by the deltas as three vectors each: position
+// with the morph index in w, normal and tangent
+layout(std430, binding = 2) readonly buffer MorphDeltas
+{
+    uvec4 deltaData[];
+};
+
+layout(std430, binding = 3) readonly buffer MorphWeights
+{
+    vec4 morphWeights[];
+};
+
+// Vertex size, affected vertex count (vertex count when copying), position and normal offset in words
+uniform vec4 vertexLayout;
+// Tangent offset in words. Missing elements have a negative offset. W holds the packed 10-10-10-2 element mask: 1 = normal, 2 = tangent
+uniform vec4 elementOffsets;
+
+vec3 LoadVector3(int word)
+{
+    return uintBitsToFloat(uvec3(sourceData[word], sourceData[word + 1], sourceData[word + 2]));
+}
+
+vec3 LoadPackedVector3(int word)
+{
+    int bits = int(sourceData[word]);
+    vec3 value = vec3((bits << 22) >> 22, (bits << 12) >> 22, (bits << 2) >> 22) / 511.0;
+    return max(value, vec3(-1.0));
+}
+
+void StorePackedVector3(int word, vec3 value)
+{
+    // Keep the 2-bit w component of the source, which holds the tangent's binormal direction
+    ivec3 quantized = ivec3(round(clamp(normalize(value), -1.0, 1.0) * 511.0));
+    uvec3 bits = uvec3(quantized) & 0x3ffU;
+    destData[word] = bits.x | (bits.y << 10U) | (bits.z << 20U) | (sourceData[word] & 0xc0000000U);
+}
+
+void StoreVector3(int word, vec3 value)
+{
+    uvec3 bits = floatBitsToUint(value);
+    destData[word] = bits.x;
+    destData[word + 1] = bits.y;
+    destData[word + 2] = bits.z;
+}
+
+void comp()
+{
+    int vertexSize = int(vertexLayout.x);
+    int index = int(gl_GlobalInvocationID.x);
+    if (index >= int(vertexLayout.y))
+        return;
+
+    #ifdef COPY
+    int base = index * vertexSize;
+    for (int i = 0; i < vertexSize; ++i)
+        destData[base + i] = sourceData[base + i];
+    #else
+    uvec4 header = deltaData[index];
+    int base = int(header.x) * vertexSize;
+    int packedMask = int(elementOffsets.w);
+
+    vec3 position = vec3(0.0);
+    vec3 normal = vec3(0.0);
+    vec3 tangent = vec3(0.0);
+    for (uint i = 0U; i < header.z; ++i)
+    {
+        uint delta = header.y + i * 3U;
+        uvec4 positionDelta = deltaData[delta];
+        float weight = morphWeights[positionDelta.w >> 2U][positionDelta.w & 3U];
+        position += weight * uintBitsToFloat(positionDelta.xyz);
+        normal += weight * uintBitsToFloat(deltaData[delta + 1U].xyz);
+        tangent += weight * uintBitsToFloat(deltaData[delta + 2U].xyz);
+    }
+
+    int positionWord = base + int(vertexLayout.z);
+    StoreVector3(positionWord, LoadVector3(positionWord) + position);
+
+    if (vertexLayout.w >= 0.0)
+    {
+        int normalWord = base + int(vertexLayout.w);
+        if ((packedMask & 1) != 0)
+            StorePackedVector3(normalWord, LoadPackedVector3(normalWord) + normal);
+        else
+            StoreVector3(normalWord, normalize(LoadVector3(normalWord) + normal));
+    }
+
+    // The tangent's w component holds the binormal direction and is left as copied
+    if (elementOffsets.x >= 0.0)
+    {
+        int tangentWord = base + int(elementOffsets.x);
+        if ((packedMask & 2) != 0)
+            StorePackedVector3(tangentWord, LoadPackedVector3(tangentWord) + tangent);
+        else
+            StoreVector3(tangentWord, normalize(LoadVector3(tangentWord) + tangent));
+    }
+    #endif
+}
@@ -1,16 +1,57 @@
+#ifdef COMPILEGS
+#extension GL_ARB_viewport_array : enable
+#endif
+
 #include "Uniforms.glsl"
 
 #ifdef COMPILEVS
 
 #include "Transform.glsl"
+#ifdef CROWD
+#include "CrowdTransform.glsl"
+#endif
 
 in vec3 position;
 in vec3 normal;
 
+#ifdef STEREO
+// The geometry shader passes the outputs on to both eyes
+#define vWorldPos vsWorldPos
+#define vNormal vsNormal
+#define vViewNormal vsViewNormal
+#define vScreenPos vsScreenPos
+#define vMatDiffColor vsMatDiffColor
+#endif
+
+out vec4 vWorldPos;
+out vec3 vNormal;
+out vec3 vViewNormal;
+noperspective out vec2 vScreenPos;
+#ifdef STATICINSTANCED
+// Material instances drawn together read their diffuse color per instance
+flat out vec4 vMatDiffColor;
+#endif
+
+#elif defined(COMPILEGS)
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 6) out;
+
+in vec4 vsWorldPos[];
+in vec3 vsNormal[];
+in vec3 vsViewNormal[];
+noperspective in vec2 vsScreenPos[];
+#ifdef STATICINSTANCED
+flat in vec4 vsMatDiffColor[];
+#endif
+
 out vec4 vWorldPos;
 out vec3 vNormal;
 out vec3 vViewNormal;
 noperspective out vec2 vScreenPos;
+#ifdef STATICINSTANCED
+flat out vec4 vMatDiffColor;
+#endif
 
 #else
 
@@ -20,25 +61,79 @@ in vec4 vWorldPos;
 in vec3 vNormal;
 in vec3 vViewNormal;
 noperspective in vec2 vScreenPos;
+#ifdef STATICINSTANCED
+flat in vec4 vMatDiffColor;
+#endif
 out vec4 fragColor[2];
-
-uniform vec4 matDiffColor;
 #endif
 
 void vert()
 {
+#ifdef CROWD
+    vec3 worldPos;
+    GetCrowdVertex(worldPos, vNormal);
+    vWorldPos.xyz = worldPos;
+#else
     mat3x4 modelMatrix = GetWorldMatrix();
 
     vWorldPos.xyz = vec4(position, 1.0) * modelMatrix;
     vNormal = normalize((vec4(normal, 0.0) * modelMatrix));
+#endif
     vViewNormal = (vec4(vNormal, 0.0) * viewMatrix) * 0.5 + 0.5;
     gl_Position = vec4(vWorldPos.xyz, 1.0) * viewProjMatrix;
     vWorldPos.w = CalculateDepth(gl_Position);
     vScreenPos = CalculateScreenPos(gl_Position);
+#ifdef STATICINSTANCED
+    vMatDiffColor = GetInstanceDiffColor();
+#endif
+#ifdef STEREO
+    gl_Position = vec4(vWorldPos.xyz, 1.0);
+#endif
+}
+
+void geom()
+{
+    // Replicate the triangle to both eyes
+    for (int eye = 0; eye < 2; ++eye)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            gl_ViewportIndex = eye;
+            gl_Position = gl_in[i].gl_Position * eyeViewProjMatrices[eye];
+            vWorldPos = vsWorldPos[i];
+            vNormal = vsNormal[i];
+            vViewNormal = vsViewNormal[i];
+            vScreenPos = vsScreenPos[i];
+#ifdef STATICINSTANCED
+            vMatDiffColor = vsMatDiffColor[i];
+#endif
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
 }
 
 void frag()
 {
-    fragColor[0] = vec4(matDiffColor.rgb * CalculateLighting(vWorldPos, vNormal, vScreenPos), matDiffColor.a);
+#ifdef LODFADE
+    LodFadeDiscard();
+#endif
+#ifdef STATICINSTANCED
+    vec4 matDiffColor = vMatDiffColor;
+#endif
+    vec3 diffColor = ApplyDecals(matDiffColor.rgb, vWorldPos, vNormal, vScreenPos);
+#ifdef DEFERRED
+    // Write the G-buffer, lit afterward by the deferred lighting pass
+    fragColor[0] = vec4(diffColor, matDiffColor.a);
+#elif defined(OIT)
+    // Accumulate the weighted color and the revealage into the first target and the weight into the second
+    vec4 oitColor = CalculateOITColor(vec4(diffColor * CalculateLighting(vWorldPos, vNormal, vScreenPos), matDiffColor.a), vWorldPos.w);
+    fragColor[0] = vec4(oitColor.rgb, matDiffColor.a);
+    fragColor[1] = vec4(oitColor.a);
+#else
+    fragColor[0] = vec4(diffColor * CalculateLighting(vWorldPos, vNormal, vScreenPos), matDiffColor.a);
+#endif
+#ifndef OIT
     fragColor[1] = vec4(vViewNormal, 1.0);
+#endif
 }
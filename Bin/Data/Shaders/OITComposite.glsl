@@ -0,0 +1,34 @@
+// Resolves the weighted blended order-independent transparency, outputting the weighted average color of the transparent
+// fragments premultiplied by their total coverage for blending over the opaque color
+
+#ifdef COMPILEVS
+
+in vec3 position;
+out vec2 vUv;
+
+#else
+
+uniform sampler2D accumTex0;
+uniform sampler2D weightTex1;
+
+in vec2 vUv;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+    vec4 accum = texture(accumTex0, vUv);
+    float coverage = 1.0 - accum.a;
+    if (coverage < 1.0 / 1024.0)
+        discard;
+
+    float weight = max(texture(weightTex1, vUv).r, 1e-5);
+    fragColor = vec4(accum.rgb / weight * coverage, coverage);
+}
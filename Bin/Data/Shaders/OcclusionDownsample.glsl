@@ -0,0 +1,35 @@
+#ifdef COMPILEVS
+
+in vec3 position;
+
+#else
+
+uniform sampler2D depthTex0;
+uniform vec2 footprint;
+
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+}
+
+void frag()
+{
+    // Take the maximum of all source depth texels that the destination texel covers, so that occlusion tests stay conservative
+    ivec2 srcSize = textureSize(depthTex0, 0);
+    vec2 dest = floor(gl_FragCoord.xy);
+    ivec2 start = ivec2(floor(dest * footprint));
+    ivec2 end = min(ivec2(ceil((dest + 1.0) * footprint)), srcSize);
+
+    float maxDepth = 0.0;
+    for (int y = start.y; y < end.y; ++y)
+    {
+        for (int x = start.x; x < end.x; ++x)
+            maxDepth = max(maxDepth, texelFetch(depthTex0, ivec2(x, y), 0).r);
+    }
+
+    fragColor = vec4(maxDepth, 0.0, 0.0, 1.0);
+}
@@ -0,0 +1,117 @@
+#ifdef COMPILEGS
+#extension GL_ARB_viewport_array : enable
+#endif
+
+#include "Uniforms.glsl"
+
+// Start size, end size and lifetime
+uniform vec4 particleSize;
+
+#ifdef COMPILEVS
+
+#include "Transform.glsl"
+
+in vec3 position;
+// Particle state of the instance: position and age, velocity and random variation
+in vec4 texCoord3;
+in vec4 texCoord4;
+
+#ifdef STEREO
+// The geometry shader passes the outputs on to both eyes
+#define vWorldPos vsWorldPos
+#define vTexCoord vsTexCoord
+#define vFade vsFade
+#define vScreenPos vsScreenPos
+#endif
+
+out vec4 vWorldPos;
+out vec2 vTexCoord;
+out float vFade;
+noperspective out vec2 vScreenPos;
+
+#elif defined(COMPILEGS)
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 6) out;
+
+in vec4 vsWorldPos[];
+in vec2 vsTexCoord[];
+in float vsFade[];
+noperspective in vec2 vsScreenPos[];
+
+out vec4 vWorldPos;
+out vec2 vTexCoord;
+out float vFade;
+noperspective out vec2 vScreenPos;
+
+#else
+
+#include "Lighting.glsl"
+
+in vec4 vWorldPos;
+in vec2 vTexCoord;
+in float vFade;
+noperspective in vec2 vScreenPos;
+out vec4 fragColor[2];
+
+#endif
+
+void vert()
+{
+    float age = texCoord3.w;
+    vTexCoord = position.xy * 2.0;
+
+    // Collapse the quads of unborn and dead particles so that they are not rasterized
+    if (age < 0.0 || age >= particleSize.z)
+    {
+        vWorldPos = vec4(0.0);
+        vFade = 0.0;
+        vScreenPos = vec2(0.0);
+        gl_Position = vec4(0.0);
+        return;
+    }
+
+    // Expand the quad along the camera's right and up axes, fading in quickly after birth and out over the lifetime
+    float life = age / particleSize.z;
+    float size = mix(particleSize.x, particleSize.y, life);
+    vWorldPos.xyz = texCoord3.xyz + (viewMatrix[0].xyz * position.x + viewMatrix[1].xyz * position.y) * size;
+    vFade = min(life * 10.0, 1.0) * (1.0 - life) * (0.75 + 0.25 * texCoord4.w);
+    gl_Position = vec4(vWorldPos.xyz, 1.0) * viewProjMatrix;
+    vWorldPos.w = CalculateDepth(gl_Position);
+    vScreenPos = CalculateScreenPos(gl_Position);
+#ifdef STEREO
+    gl_Position = vec4(vWorldPos.xyz, 1.0);
+#endif
+}
+
+void geom()
+{
+    // Replicate the triangle to both eyes
+    for (int eye = 0; eye < 2; ++eye)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            gl_ViewportIndex = eye;
+            gl_Position = gl_in[i].gl_Position * eyeViewProjMatrices[eye];
+            vWorldPos = vsWorldPos[i];
+            vTexCoord = vsTexCoord[i];
+            vFade = vsFade[i];
+            vScreenPos = vsScreenPos[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
+
+void frag()
+{
+    float falloff = 1.0 - dot(vTexCoord, vTexCoord);
+    if (falloff <= 0.0)
+        discard;
+
+    // Light as a surface facing the camera
+    vec3 normal = -viewMatrix[2].xyz;
+    fragColor[0] = vec4(matDiffColor.rgb * CalculateLighting(vWorldPos, normal, vScreenPos), matDiffColor.a * falloff * vFade);
+    // Leave the normals untouched under the additive blending
+    fragColor[1] = vec4(0.0);
+}
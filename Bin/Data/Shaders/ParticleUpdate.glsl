@@ -0,0 +1,104 @@
+// Simulates the particles of an emitter in place. Each particle state is three vectors: position and age, velocity and random
+// variation, and reserved. A negative age is the time until birth, and an age at the lifetime marks a dead particle. Dead
+// particles are respawned at the emitter while it is emitting, advanced by the time elapsed since their death
+
+layout(local_size_x = 64) in;
+
+layout(std430, binding = 0) buffer ParticleStates
+{
+    vec4 states[];
+};
+
+uniform mat3x4 emitterTransform;
+// Time step, lifetime, emission radius and velocity spread
+uniform vec4 emitParameters;
+// Emission velocity in emitter space and particle count
+uniform vec4 emitVelocity;
+// Acceleration in world space and random seed
+uniform vec4 emitAcceleration;
+// Emitting flag and reset flag
+uniform vec4 emitState;
+
+uint Hash(uint x)
+{
+    x ^= x >> 16U;
+    x *= 0x7feb352dU;
+    x ^= x >> 15U;
+    x *= 0x846ca68bU;
+    x ^= x >> 16U;
+    return x;
+}
+
+float Random(inout uint rng)
+{
+    rng = Hash(rng);
+    return float(rng >> 8U) / 16777216.0;
+}
+
+vec3 RandomInSphere(inout uint rng)
+{
+    float z = Random(rng) * 2.0 - 1.0;
+    float angle = Random(rng) * 6.2831853;
+    float r = sqrt(1.0 - z * z);
+    return vec3(r * cos(angle), r * sin(angle), z) * pow(Random(rng), 1.0 / 3.0);
+}
+
+void comp()
+{
+    int index = int(gl_GlobalInvocationID.x);
+    if (index >= int(emitVelocity.w))
+        return;
+
+    int base = index * 3;
+    float timeStep = emitParameters.x;
+    float lifetime = emitParameters.y;
+    uint rng = Hash(uint(index) * 0x9e3779b9U ^ Hash(uint(emitAcceleration.w)));
+
+    vec4 posAge;
+    vec4 velRandom;
+    if (emitState.y > 0.0)
+    {
+        // Stagger the births over one lifetime, so that the emission is continuous from the start
+        posAge = vec4(0.0, 0.0, 0.0, -Random(rng) * lifetime);
+        velRandom = vec4(0.0);
+        states[base + 2] = vec4(0.0);
+    }
+    else
+    {
+        posAge = states[base];
+        velRandom = states[base + 1];
+    }
+
+    float age = posAge.w + timeStep;
+    float spawnAge = -1.0;
+    if (age < 0.0)
+        posAge.w = age;
+    else if (posAge.w < 0.0)
+        spawnAge = age;
+    else if (age >= lifetime)
+        spawnAge = mod(age - lifetime, lifetime);
+    else
+    {
+        velRandom.xyz += emitAcceleration.xyz * timeStep;
+        posAge.xyz += velRandom.xyz * timeStep;
+        posAge.w = age;
+    }
+
+    if (spawnAge >= 0.0)
+    {
+        if (emitState.x > 0.0)
+        {
+            vec3 localPos = RandomInSphere(rng) * emitParameters.z;
+            vec3 localVel = emitVelocity.xyz + RandomInSphere(rng) * emitParameters.w;
+            vec3 pos = vec4(localPos, 1.0) * emitterTransform;
+            vec3 vel = vec4(localVel, 0.0) * emitterTransform;
+            posAge = vec4(pos + vel * spawnAge + 0.5 * emitAcceleration.xyz * spawnAge * spawnAge, spawnAge);
+            velRandom = vec4(vel + emitAcceleration.xyz * spawnAge, Random(rng));
+        }
+        else
+            posAge.w = lifetime;
+    }
+
+    states[base] = posAge;
+    states[base + 1] = velRandom;
+}
@@ -1,3 +1,6 @@
+// Renders ambient occlusion at half resolution from the downsampled depth and normals. With TEMPORAL, uses half the samples with
+// a noise pattern that changes each frame, and blends with the previous frames' occlusion reprojected to the current view
+
 #ifdef COMPILEVS
 
 in vec3 position;
@@ -6,23 +9,24 @@ out vec2 vUv;
 #else
 
 uniform vec2 noiseInvSize;
+uniform vec2 noiseOffset;
 uniform vec2 screenInvSize;
 uniform vec4 frustumSize;
 uniform vec4 aoParameters;
-uniform vec2 depthReconstruct;
+#ifdef TEMPORAL
+uniform mat4 viewToPrevClip;
+uniform float temporalBlend;
+#endif
 
-uniform sampler2D depthTex0;
-uniform sampler2D normalTex1;
-uniform sampler2D noiseTex2;
+uniform sampler2D depthNormalTex0;
+uniform sampler2D noiseTex1;
+#ifdef TEMPORAL
+uniform sampler2D historyTex2;
+#endif
 
 in vec2 vUv;
 out vec4 fragColor;
 
-float GetLinearDepth(float hwDepth)
-{
-    return depthReconstruct.y / (hwDepth - depthReconstruct.x);
-}
-
 vec3 GetPosition(float depth, vec2 uv)
 {
     vec3 pos = vec3((uv - 0.5) * frustumSize.xy, frustumSize.z) * depth;
@@ -31,7 +35,7 @@ vec3 GetPosition(float depth, vec2 uv)
 
 vec3 GetPosition(vec2 uv)
 {
-    float depth = GetLinearDepth(texture(depthTex0, uv).r);
+    float depth = texture(depthNormalTex0, uv).a;
     return GetPosition(depth, uv);
 }
 
@@ -53,16 +57,16 @@ void vert()
 
 void frag()
 {
-    vec2 rand = texture(noiseTex2, vUv * noiseInvSize).rg * 2.0 - 1.0;
-    float depth = GetLinearDepth(texture(depthTex0, vUv).r);
-    vec3 pos = GetPosition(depth, vUv);
+    vec2 rand = texture(noiseTex1, vUv * noiseInvSize + noiseOffset).rg * 2.0 - 1.0;
+    vec4 depthNormal = texture(depthNormalTex0, vUv);
+    vec3 pos = GetPosition(depthNormal.a, vUv);
 
     float rad = min(aoParameters.x / pos.z, aoParameters.w);
     float ao = 0.0;
 
     if (rad > 3.5 * screenInvSize.x)
     {
-        vec3 normal = texture(normalTex1, vUv).rgb * 2.0 - 1.0;
+        vec3 normal = depthNormal.rgb;
 
         vec2 vec[4] = vec2[](
             vec2(1,0),
@@ -71,7 +75,11 @@ void frag()
             vec2(0,-1)
         );
 
-        int iterations = 4;
+        #ifdef TEMPORAL
+        const int iterations = 2;
+        #else
+        const int iterations = 4;
+        #endif
 
         for (int i = 0; i < iterations; ++i)
         {
@@ -81,7 +89,25 @@ void frag()
             ao += DoAmbientOcclusion(vUv, coord1*0.5, pos, normal);
             ao += DoAmbientOcclusion(vUv, coord2, pos, normal);
         }
+
+        ao *= 4.0 / float(iterations);
+    }
+
+    ao = clamp(ao * aoParameters.z, 0.0, 1.0);
+
+    #ifdef TEMPORAL
+    // Reproject with the full view position. Reject the history outside the previous view, and clamp it to the neighborhood
+    // of the current result less the noise, so that disocclusions do not leave trails
+    vec3 viewPos = vec3((vUv * 2.0 - 1.0) * frustumSize.xy, frustumSize.z) * depthNormal.a;
+    vec4 prevClip = vec4(viewPos, 1.0) * viewToPrevClip;
+    vec2 prevUv = prevClip.xy / prevClip.w * 0.5 + 0.5;
+    if (temporalBlend < 1.0 && prevClip.w > 0.0 && all(greaterThanEqual(prevUv, vec2(0.0))) && all(lessThanEqual(prevUv, vec2(1.0))))
+    {
+        float history = texture(historyTex2, prevUv).r;
+        float range = 0.25;
+        ao = mix(clamp(history, ao - range, ao + range), ao, temporalBlend);
     }
+    #endif
 
-    fragColor = vec4(clamp(ao * aoParameters.z, 0.0, 1.0), 1.0, 1.0, 1.0);
+    fragColor = vec4(ao, 1.0, 1.0, 1.0);
 }
@@ -0,0 +1,30 @@
+// Outputs the blurred ambient occlusion for subtracting from the lit opaque color
+
+#ifdef COMPILEVS
+
+in vec3 position;
+out vec2 vUv;
+
+#else
+
+uniform sampler2D ssaoTex0;
+
+in vec2 vUv;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+    float occ = texture(ssaoTex0, vUv).r;
+    if (occ < 1.0 / 1024.0)
+        discard;
+
+    fragColor = vec4(occ, occ, occ, 1.0);
+}
@@ -0,0 +1,72 @@
+// Separable depth-aware blur of the half resolution ambient occlusion. Each work group loads a row or column segment with an
+// apron into shared memory, so that the texels are fetched once. HORIZONTAL selects the direction, FLOAT16 the R16F format
+
+#define BLUR_RADIUS 4
+#define GROUP_SIZE 64
+
+#ifdef HORIZONTAL
+layout(local_size_x = GROUP_SIZE, local_size_y = 1) in;
+#else
+layout(local_size_x = 1, local_size_y = GROUP_SIZE) in;
+#endif
+
+#ifdef FLOAT16
+layout(binding = 0, r16f) uniform writeonly image2D destImage0;
+#else
+layout(binding = 0, r8) uniform writeonly image2D destImage0;
+#endif
+
+uniform sampler2D aoTex0;
+uniform sampler2D depthNormalTex1;
+// X: depth sharpness
+uniform vec4 blurParameters;
+
+shared float aoValues[GROUP_SIZE + 2 * BLUR_RADIUS];
+shared float depthValues[GROUP_SIZE + 2 * BLUR_RADIUS];
+
+void main()
+{
+    ivec2 size = textureSize(aoTex0, 0);
+    #ifdef HORIZONTAL
+    ivec2 direction = ivec2(1, 0);
+    int local = int(gl_LocalInvocationID.x);
+    #else
+    ivec2 direction = ivec2(0, 1);
+    int local = int(gl_LocalInvocationID.y);
+    #endif
+
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 groupStart = pixel - direction * local;
+
+    // Load the segment and the apron on both sides
+    for (int i = local; i < GROUP_SIZE + 2 * BLUR_RADIUS; i += GROUP_SIZE)
+    {
+        ivec2 pos = clamp(groupStart + direction * (i - BLUR_RADIUS), ivec2(0), size - 1);
+        aoValues[i] = texelFetch(aoTex0, pos, 0).r;
+        depthValues[i] = texelFetch(depthNormalTex1, pos, 0).a;
+    }
+
+    barrier();
+
+    if (any(greaterThanEqual(pixel, size)))
+        return;
+
+    const float weights[BLUR_RADIUS + 1] = float[](0.2, 0.18, 0.14, 0.09, 0.05);
+
+    int center = local + BLUR_RADIUS;
+    float centerDepth = depthValues[center];
+    float sum = aoValues[center] * weights[0];
+    float totalWeight = weights[0];
+
+    for (int i = 1; i <= BLUR_RADIUS; ++i)
+    {
+        float depthA = depthValues[center - i];
+        float depthB = depthValues[center + i];
+        float weightA = weights[i] * clamp(1.0 - abs(depthA - centerDepth) * blurParameters.x / max(centerDepth, 0.0001), 0.0, 1.0);
+        float weightB = weights[i] * clamp(1.0 - abs(depthB - centerDepth) * blurParameters.x / max(centerDepth, 0.0001), 0.0, 1.0);
+        sum += aoValues[center - i] * weightA + aoValues[center + i] * weightB;
+        totalWeight += weightA + weightB;
+    }
+
+    imageStore(destImage0, pixel, vec4(sum / totalWeight, 0.0, 0.0, 1.0));
+}
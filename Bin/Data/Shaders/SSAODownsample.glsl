@@ -0,0 +1,48 @@
+// Downsamples the depth and view-space normals to half resolution for ambient occlusion. Stores the normal to RGB and the
+// linear depth as a fraction of the far clip distance to A. Takes the nearest of each 2x2 texel block, so that edges stay sharp
+
+#ifdef COMPILEVS
+
+in vec3 position;
+
+#else
+
+uniform vec2 depthReconstruct;
+
+uniform sampler2D depthTex0;
+uniform sampler2D normalTex1;
+
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+}
+
+void frag()
+{
+    ivec2 srcSize = textureSize(depthTex0, 0);
+    ivec2 src = ivec2(gl_FragCoord.xy) * 2;
+
+    ivec2 nearest = src;
+    float nearestDepth = 1.0;
+    for (int y = 0; y < 2; ++y)
+    {
+        for (int x = 0; x < 2; ++x)
+        {
+            ivec2 pos = min(src + ivec2(x, y), srcSize - 1);
+            float depth = texelFetch(depthTex0, pos, 0).r;
+            if (depth < nearestDepth)
+            {
+                nearestDepth = depth;
+                nearest = pos;
+            }
+        }
+    }
+
+    vec3 normal = texelFetch(normalTex1, nearest, 0).rgb * 2.0 - 1.0;
+    float linearDepth = depthReconstruct.y / (nearestDepth - depthReconstruct.x);
+    fragColor = vec4(normal, linearDepth);
+}
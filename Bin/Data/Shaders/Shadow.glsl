@@ -1,12 +1,41 @@
+#ifdef COMPILEGS
+#extension GL_ARB_viewport_array : enable
+#endif
+
 #include "Uniforms.glsl"
 
 #ifdef COMPILEVS
 
 #include "Transform.glsl"
+#ifdef TERRAIN
+#include "TerrainTransform.glsl"
+#endif
+#ifdef CROWD
+#include "CrowdTransform.glsl"
+#endif
 
 in vec3 position;
 
+#elif defined(COMPILEGS)
+
+layout(std140) uniform CubeShadowData4
+{
+    uniform mat4x4 faceViewProjMatrices[6];
+    uniform uint faceMask;
+};
+
+layout(triangles) in;
+#ifdef STEREO
+layout(triangle_strip, max_vertices = 6) out;
 #else
+layout(triangle_strip, max_vertices = 18) out;
+#endif
+
+#else
+
+#ifdef MOMENTSHADOW
+#include "MomentShadow.glsl"
+#endif
 
 out vec4 fragColor;
 
@@ -14,13 +43,75 @@ out vec4 fragColor;
 
 void vert()
 {
+#ifdef CROWD
+    vec3 worldPos;
+    vec3 worldNormal;
+    GetCrowdVertex(worldPos, worldNormal);
+#elif defined(TERRAIN)
+    mat3x4 modelMatrix = GetWorldMatrix();
+    vec3 worldPos = vec4(GetTerrainPosition(GetTerrainSamplePos(position.xz)), 1.0) * modelMatrix;
+#else
     mat3x4 modelMatrix = GetWorldMatrix();
-
     vec3 worldPos = vec4(position, 1.0) * modelMatrix;
+#endif
+#if defined(CUBESHADOW) || defined(STEREO)
+    gl_Position = vec4(worldPos, 1.0);
+#else
     gl_Position = vec4(worldPos, 1.0) * viewProjMatrix;
+#endif
+}
+
+void geom()
+{
+#ifdef STEREO
+    // Replicate the triangle to both eyes
+    for (int eye = 0; eye < 2; ++eye)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            gl_ViewportIndex = eye;
+            gl_Position = gl_in[i].gl_Position * eyeViewProjMatrices[eye];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+#else
+    // Replicate the triangle to each point light face it may touch, skipping the faces not in view
+    for (int face = 0; face < 6; ++face)
+    {
+        if ((faceMask & (1u << uint(face))) == 0u)
+            continue;
+
+        vec4 clipPos[3];
+        for (int i = 0; i < 3; ++i)
+            clipPos[i] = gl_in[i].gl_Position * faceViewProjMatrices[face];
+
+        // Reject if all vertices are outside the same side of the face frustum
+        if ((clipPos[0].x < -clipPos[0].w && clipPos[1].x < -clipPos[1].w && clipPos[2].x < -clipPos[2].w) ||
+            (clipPos[0].x > clipPos[0].w && clipPos[1].x > clipPos[1].w && clipPos[2].x > clipPos[2].w) ||
+            (clipPos[0].y < -clipPos[0].w && clipPos[1].y < -clipPos[1].w && clipPos[2].y < -clipPos[2].w) ||
+            (clipPos[0].y > clipPos[0].w && clipPos[1].y > clipPos[1].w && clipPos[2].y > clipPos[2].w))
+            continue;
+
+        for (int i = 0; i < 3; ++i)
+        {
+            gl_ViewportIndex = face;
+            gl_Position = clipPos[i];
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+#endif
 }
 
 void frag()
 {
+#ifdef LODFADE
+    LodFadeDiscard();
+#endif
+#ifdef MOMENTSHADOW
+    fragColor = vec4(GetShadowMoments(gl_FragCoord.z), 0.0, 1.0);
+#else
     fragColor = vec4(1.0, 1.0, 1.0, 1.0);
+#endif
 }
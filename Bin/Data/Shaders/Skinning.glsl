@@ -0,0 +1,100 @@
+// Skins the vertices of an animated model into an output vertex buffer of the same layout, so that all passes can draw them as
+// static geometry. Position, normal and tangent are transformed to world space by the skin matrices, other elements are copied
+
+layout(local_size_x = 64) in;
+
+layout(std140) uniform SkinMatrixData2
+{
+    mat3x4 skinMatrices[96];
+};
+
+layout(std430, binding = 0) readonly buffer SourceVertices
+{
+    uint sourceData[];
+};
+
+layout(std430, binding = 1) writeonly buffer SkinnedVertices
+{
+    uint destData[];
+};
+
+// Vertex size, vertex count, position and normal offset in words
+uniform vec4 vertexLayout;
+// Tangent, blend weight and blend index offset in words. Missing elements have a negative offset. W holds the packed 10-10-10-2
+// element mask: 1 = normal, 2 = tangent
+uniform vec4 elementOffsets;
+
+vec3 LoadVector3(int word)
+{
+    return uintBitsToFloat(uvec3(sourceData[word], sourceData[word + 1], sourceData[word + 2]));
+}
+
+vec4 LoadVector4(int word)
+{
+    return uintBitsToFloat(uvec4(sourceData[word], sourceData[word + 1], sourceData[word + 2], sourceData[word + 3]));
+}
+
+vec3 LoadPackedVector3(int word)
+{
+    int bits = int(sourceData[word]);
+    vec3 value = vec3((bits << 22) >> 22, (bits << 12) >> 22, (bits << 2) >> 22) / 511.0;
+    return max(value, vec3(-1.0));
+}
+
+void StorePackedVector3(int word, vec3 value)
+{
+    // Keep the 2-bit w component of the source, which holds the tangent's binormal direction
+    ivec3 quantized = ivec3(round(clamp(normalize(value), -1.0, 1.0) * 511.0));
+    uvec3 bits = uvec3(quantized) & 0x3ffU;
+    destData[word] = bits.x | (bits.y << 10U) | (bits.z << 20U) | (sourceData[word] & 0xc0000000U);
+}
+
+void StoreVector3(int word, vec3 value)
+{
+    uvec3 bits = floatBitsToUint(value);
+    destData[word] = bits.x;
+    destData[word + 1] = bits.y;
+    destData[word + 2] = bits.z;
+}
+
+void comp()
+{
+    int vertexSize = int(vertexLayout.x);
+    int packedMask = int(elementOffsets.w);
+    int index = int(gl_GlobalInvocationID.x);
+    if (index >= int(vertexLayout.y))
+        return;
+
+    int base = index * vertexSize;
+    for (int i = 0; i < vertexSize; ++i)
+        destData[base + i] = sourceData[base + i];
+
+    // Blend the skin matrices the same way as vertex shader skinning, so that the result matches
+    vec4 blendWeights = LoadVector4(base + int(elementOffsets.y));
+    uint packedIndices = sourceData[base + int(elementOffsets.z)];
+    ivec4 indices = ivec4(packedIndices & 0xffU, (packedIndices >> 8U) & 0xffU, (packedIndices >> 16U) & 0xffU, packedIndices >> 24U);
+    mat3x4 skinMatrix = skinMatrices[indices.x] * blendWeights.x + skinMatrices[indices.y] * blendWeights.y +
+        skinMatrices[indices.z] * blendWeights.z + skinMatrices[indices.w] * blendWeights.w;
+
+    int positionWord = base + int(vertexLayout.z);
+    StoreVector3(positionWord, vec4(LoadVector3(positionWord), 1.0) * skinMatrix);
+
+    if (vertexLayout.w >= 0.0)
+    {
+        int normalWord = base + int(vertexLayout.w);
+        if ((packedMask & 1) != 0)
+            StorePackedVector3(normalWord, vec4(LoadPackedVector3(normalWord), 0.0) * skinMatrix);
+        else
+            StoreVector3(normalWord, vec4(LoadVector3(normalWord), 0.0) * skinMatrix);
+    }
+
+    // The tangent's w component holds the binormal direction and is left as copied
+    if (elementOffsets.x >= 0.0)
+    {
+        int tangentWord = base + int(elementOffsets.x);
+        if ((packedMask & 2) != 0)
+            StorePackedVector3(tangentWord, vec4(LoadPackedVector3(tangentWord), 0.0) * skinMatrix);
+        else
+            StoreVector3(tangentWord, vec4(LoadVector3(tangentWord), 0.0) * skinMatrix);
+    }
+}
@@ -0,0 +1,131 @@
+#ifdef COMPILEGS
+#extension GL_ARB_viewport_array : enable
+#endif
+#if defined(COMPILEFS) && defined(VIRTUALTEX0)
+#extension GL_ARB_shader_image_load_store : enable
+#endif
+
+#include "Uniforms.glsl"
+
+#ifdef COMPILEVS
+
+#include "Transform.glsl"
+#include "TerrainTransform.glsl"
+
+in vec3 position;
+
+#ifdef STEREO
+// The geometry shader passes the outputs on to both eyes
+#define vWorldPos vsWorldPos
+#define vNormal vsNormal
+#define vViewNormal vsViewNormal
+#define vScreenPos vsScreenPos
+#define vTexCoord vsTexCoord
+#endif
+
+out vec4 vWorldPos;
+out vec3 vNormal;
+out vec3 vViewNormal;
+noperspective out vec2 vScreenPos;
+#ifdef VIRTUALTEX0
+out vec2 vTexCoord;
+#endif
+
+#elif defined(COMPILEGS)
+
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 6) out;
+
+in vec4 vsWorldPos[];
+in vec3 vsNormal[];
+in vec3 vsViewNormal[];
+noperspective in vec2 vsScreenPos[];
+#ifdef VIRTUALTEX0
+in vec2 vsTexCoord[];
+#endif
+
+out vec4 vWorldPos;
+out vec3 vNormal;
+out vec3 vViewNormal;
+noperspective out vec2 vScreenPos;
+#ifdef VIRTUALTEX0
+out vec2 vTexCoord;
+#endif
+
+#else
+
+#include "Lighting.glsl"
+
+in vec4 vWorldPos;
+in vec3 vNormal;
+in vec3 vViewNormal;
+noperspective in vec2 vScreenPos;
+out vec4 fragColor[2];
+#ifdef VIRTUALTEX0
+// The terrain color is a virtual texture covering the height map
+in vec2 vTexCoord;
+uniform sampler2D diffuseTex0;
+uniform sampler2D virtualPageTable22;
+#include "VirtualTexture.glsl"
+#endif
+#endif
+
+void vert()
+{
+    mat3x4 modelMatrix = GetWorldMatrix();
+    vec2 samplePos = GetTerrainSamplePos(position.xz);
+
+    vWorldPos.xyz = vec4(GetTerrainPosition(samplePos), 1.0) * modelMatrix;
+    vNormal = normalize((vec4(GetTerrainNormal(samplePos), 0.0) * modelMatrix));
+    vViewNormal = (vec4(vNormal, 0.0) * viewMatrix) * 0.5 + 0.5;
+    gl_Position = vec4(vWorldPos.xyz, 1.0) * viewProjMatrix;
+    vWorldPos.w = CalculateDepth(gl_Position);
+    vScreenPos = CalculateScreenPos(gl_Position);
+#ifdef VIRTUALTEX0
+    vTexCoord = (samplePos + 0.5) / terrainSpacing.w;
+#endif
+#ifdef STEREO
+    gl_Position = vec4(vWorldPos.xyz, 1.0);
+#endif
+}
+
+void geom()
+{
+    // Replicate the triangle to both eyes
+    for (int eye = 0; eye < 2; ++eye)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            gl_ViewportIndex = eye;
+            gl_Position = gl_in[i].gl_Position * eyeViewProjMatrices[eye];
+            vWorldPos = vsWorldPos[i];
+            vNormal = vsNormal[i];
+            vViewNormal = vsViewNormal[i];
+            vScreenPos = vsScreenPos[i];
+#ifdef VIRTUALTEX0
+            vTexCoord = vsTexCoord[i];
+#endif
+            EmitVertex();
+        }
+        EndPrimitive();
+    }
+}
+
+void frag()
+{
+#ifdef LODFADE
+    LodFadeDiscard();
+#endif
+#ifdef VIRTUALTEX0
+    vec3 diffColor = ApplyDecals(matDiffColor.rgb * SampleVirtual(virtualPageTable22, diffuseTex0, vTexCoord).rgb, vWorldPos, vNormal, vScreenPos);
+#else
+    vec3 diffColor = ApplyDecals(matDiffColor.rgb, vWorldPos, vNormal, vScreenPos);
+#endif
+#ifdef DEFERRED
+    // Write the G-buffer, lit afterward by the deferred lighting pass
+    fragColor[0] = vec4(diffColor, matDiffColor.a);
+#else
+    fragColor[0] = vec4(diffColor * CalculateLighting(vWorldPos, vNormal, vScreenPos), matDiffColor.a);
+#endif
+    fragColor[1] = vec4(vViewNormal, 1.0);
+}
@@ -0,0 +1,40 @@
+// Terrain node of the instance: origin and sample step, grid quads per quad of the morph level, and the morph range
+in vec4 texCoord3;
+in vec4 texCoord4;
+
+// Camera position in patch space at the node selection
+uniform vec4 terrainCamera;
+// Sample spacing, height scale and height texture size
+uniform vec4 terrainSpacing;
+uniform sampler2D heightMapTex17;
+
+float SampleTerrainHeight(vec2 samplePos)
+{
+    return textureLod(heightMapTex17, (samplePos + 0.5) / terrainSpacing.w, 0.0).r * terrainSpacing.y;
+}
+
+vec3 GetTerrainPosition(vec2 samplePos)
+{
+    return vec3(samplePos.x * terrainSpacing.x, SampleTerrainHeight(samplePos), samplePos.y * terrainSpacing.z);
+}
+
+vec2 GetTerrainSamplePos(vec2 gridPos)
+{
+    // Snap to the grid of the morph level, then morph the odd vertices of that grid toward the next coarser level by distance
+    float snap = texCoord3.w;
+    vec2 pos = floor(gridPos / snap) * snap;
+    float dist = distance(GetTerrainPosition(texCoord3.xy + pos * texCoord3.z), terrainCamera.xyz);
+    float morph = clamp((dist - texCoord4.x) / (texCoord4.y - texCoord4.x), 0.0, 1.0);
+    pos -= mod(pos, 2.0 * snap) * morph;
+    return texCoord3.xy + pos * texCoord3.z;
+}
+
+vec3 GetTerrainNormal(vec2 samplePos)
+{
+    float step = texCoord3.z * texCoord3.w;
+    float left = SampleTerrainHeight(samplePos - vec2(step, 0.0));
+    float right = SampleTerrainHeight(samplePos + vec2(step, 0.0));
+    float back = SampleTerrainHeight(samplePos - vec2(0.0, step));
+    float front = SampleTerrainHeight(samplePos + vec2(0.0, step));
+    return normalize(vec3((left - right) / (2.0 * step * terrainSpacing.x), 1.0, (back - front) / (2.0 * step * terrainSpacing.z)));
+}
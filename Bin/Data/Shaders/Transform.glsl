@@ -1,4 +1,53 @@
-#if defined(INSTANCED)
+// The depth pre-pass is followed by an equal depth test, so positions must be computed identically by all shaders
+invariant gl_Position;
+
+#if defined(SKINNED) && defined(INSTANCED)
+in vec4 blendWeights;
+in vec4 blendIndices;
+in vec4 texCoord3;
+
+// Skin matrix palettes of all instances, each matrix stored in three consecutive texels, 1024 matrices per row
+uniform sampler2D skinMatrixTex13;
+
+mat3x4 GetSkinMatrix(int index)
+{
+    ivec2 pos = ivec2((index & 1023) * 3, index >> 10);
+    return mat3x4(texelFetch(skinMatrixTex13, pos, 0), texelFetch(skinMatrixTex13, pos + ivec2(1, 0), 0), texelFetch(skinMatrixTex13, pos + ivec2(2, 0), 0));
+}
+
+mat3x4 GetWorldMatrix()
+{
+    // The instance's palette offset is stored in the first instance vector
+    ivec4 indices = ivec4(blendIndices) + int(texCoord3.x);
+    return GetSkinMatrix(indices.x) * blendWeights.x + GetSkinMatrix(indices.y) * blendWeights.y +
+           GetSkinMatrix(indices.z) * blendWeights.z + GetSkinMatrix(indices.w) * blendWeights.w;
+}
+#elif defined(STATICINSTANCED)
+// The instance data is the index of the world transform in the static transform table, and the material table slot
+in vec4 texCoord3;
+
+// World transforms of static drawables, stored like the skin matrices
+uniform sampler2D staticTransformTex16;
+// Packed uniforms of all materials by material ID, three texels each, 1024 materials per row
+uniform sampler2D materialTableTex21;
+
+mat3x4 GetWorldMatrix()
+{
+    int index = int(texCoord3.x);
+    ivec2 pos = ivec2((index & 1023) * 3, index >> 10);
+    return mat3x4(texelFetch(staticTransformTex16, pos, 0), texelFetch(staticTransformTex16, pos + ivec2(1, 0), 0), texelFetch(staticTransformTex16, pos + ivec2(2, 0), 0));
+}
+
+vec4 GetInstanceDiffColor()
+{
+    // Slot zero is the bound material, otherwise a material instance's ID plus one
+    int slot = int(texCoord3.y);
+    if (slot == 0)
+        return matDiffColor;
+    int index = slot - 1;
+    return texelFetch(materialTableTex21, ivec2((index & 1023) * 3, index >> 10), 0);
+}
+#elif defined(INSTANCED)
 in vec4 texCoord3;
 in vec4 texCoord4;
 in vec4 texCoord5;
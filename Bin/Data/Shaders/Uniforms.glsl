@@ -4,25 +4,46 @@ layout(std140) uniform PerViewData0
     uniform mat4x4 projectionMatrix;
     uniform mat4x4 viewProjMatrix;
     uniform vec4 depthParameters;
-    uniform vec4 dirLightData[12];
+    uniform vec4 clusterSliceParameters;
+    uniform vec4 lightProbeData[3];
+    uniform vec4 virtualTextureData;
+    uniform vec4 dirLightData[21];
 };
 
-struct Light
+#if defined(STEREO) && defined(COMPILEGS)
+// The geometry shader replicates each triangle to the left and right eye viewports. The positions are computed identically by
+// the depth pre-pass and the other passes, as in the vertex shader
+layout(std140) uniform StereoData5
 {
-    vec4 position;
-    vec4 direction;
-    vec4 attenuation;
-    vec4 color;
-    vec4 shadowParameters;
-    mat4 shadowMatrix;
+    uniform mat4x4 eyeViewProjMatrices[2];
 };
 
-layout(std140) uniform LightData1
+invariant gl_Position;
+#endif
+
+layout(std140) uniform MaterialData3
 {
-    Light lights[255];
+    uniform vec4 matDiffColor;
+    uniform vec4 impostorCenter;
+    uniform vec4 impostorFrames;
 };
 
-#ifdef SKINNED
+#if defined(LODFADE) && defined(COMPILEFS)
+// Crossfade between LOD levels with complementary screen-door masks. A positive value keeps the pixels whose dither threshold
+// is below it, a negative value keeps the rest, so levels drawn with fade and fade - 1 cover each pixel exactly once
+uniform float lodFade;
+
+void LodFadeDiscard()
+{
+    const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+    ivec2 pos = ivec2(gl_FragCoord.xy) & 3;
+    float threshold = (bayer[pos.y * 4 + pos.x] + 0.5) / 16.0;
+    if (lodFade >= 0.0 ? threshold >= lodFade : threshold < lodFade + 1.0)
+        discard;
+}
+#endif
+
+#if defined(SKINNED) && !defined(INSTANCED)
 layout(std140) uniform SkinMatrixData2
 {
     mat3x4 skinMatrices[96];
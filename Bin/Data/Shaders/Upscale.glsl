@@ -0,0 +1,48 @@
+// Upscales a view rendered at reduced resolution to the backbuffer. Samples bilinearly and applies contrast-adaptive sharpening
+// from the four neighbors, which restores detail lost to the upscale without ringing on high contrast edges
+
+#ifdef COMPILEVS
+
+in vec3 position;
+out vec2 vUv;
+
+#else
+
+uniform vec2 sourceInvSize;
+uniform float sharpness;
+
+uniform sampler2D sourceTex0;
+
+in vec2 vUv;
+out vec4 fragColor;
+
+#endif
+
+void vert()
+{
+    gl_Position = vec4(position, 1.0);
+    vUv = vec2(position.xy) * 0.5 + 0.5;
+}
+
+void frag()
+{
+    vec3 center = texture(sourceTex0, vUv).rgb;
+
+    if (sharpness > 0.0)
+    {
+        vec3 up = texture(sourceTex0, vUv + vec2(0.0, sourceInvSize.y)).rgb;
+        vec3 down = texture(sourceTex0, vUv - vec2(0.0, sourceInvSize.y)).rgb;
+        vec3 left = texture(sourceTex0, vUv - vec2(sourceInvSize.x, 0.0)).rgb;
+        vec3 right = texture(sourceTex0, vUv + vec2(sourceInvSize.x, 0.0)).rgb;
+
+        vec3 minColor = min(center, min(min(up, down), min(left, right)));
+        vec3 maxColor = max(center, max(max(up, down), max(left, right)));
+
+        // Sharpen less where the neighborhood already has high contrast
+        vec3 amount = sqrt(clamp(min(minColor, 1.0 - maxColor) / max(maxColor, vec3(0.0001)), 0.0, 1.0));
+        vec3 weight = amount * (-1.0 / mix(8.0, 5.0, sharpness));
+        center = (center + (up + down + left + right) * weight) / (1.0 + 4.0 * weight);
+    }
+
+    fragColor = vec4(center, 1.0);
+}
@@ -0,0 +1,12 @@
+// Clears the virtual texture feedback image, so that blocks without virtual textured pixels read back as zero
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(binding = 0, rg32ui) uniform writeonly uimage2D feedbackImage0;
+
+void main()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    if (all(lessThan(texel, imageSize(feedbackImage0))))
+        imageStore(feedbackImage0, texel, uvec4(0));
+}
@@ -0,0 +1,42 @@
+// Virtual texture sampling through the page table. The page table entry of each page at each mip level holds the cache slot
+// of the finest resident page covering it, the resident page's mip level and the texture's feedback ID. The main view also
+// writes the page it needs into the feedback image, from one jittered pixel of each block
+
+#define VT_PAGE_SIZE 128.0
+#define VT_PAGE_BORDER 4.0
+#define VT_PAGE_STRIDE 136.0
+
+#ifdef GL_ARB_shader_image_load_store
+layout(rg32ui) uniform writeonly uimage2D virtualFeedback7;
+#endif
+
+vec4 SampleVirtual(sampler2D pageTable, sampler2D cache, vec2 texCoord)
+{
+    ivec2 numPages = textureSize(pageTable, 0);
+    int maxLevel = int(log2(float(min(numPages.x, numPages.y))) + 0.5);
+
+    // Choose the mip level by the texel footprint, without trilinear blending between levels
+    vec2 texelPos = clamp(texCoord, 0.0, 1.0) * vec2(numPages) * VT_PAGE_SIZE;
+    vec2 dx = dFdx(texelPos);
+    vec2 dy = dFdy(texelPos);
+    int level = clamp(int(floor(0.5 * log2(max(dot(dx, dx), dot(dy, dy))))), 0, maxLevel);
+    ivec2 page = min(ivec2(texelPos / VT_PAGE_SIZE) >> level, (numPages >> level) - 1);
+
+    vec4 entry = floor(texelFetch(pageTable, page, level) * 255.0 + 0.5);
+
+#ifdef GL_ARB_shader_image_load_store
+    if (virtualTextureData.z > 0.0)
+    {
+        int blockSize = int(virtualTextureData.z);
+        ivec2 fragPos = ivec2(gl_FragCoord.xy);
+        if (fragPos % blockSize == ivec2(virtualTextureData.xy))
+            imageStore(virtualFeedback7, fragPos / blockSize, uvec4(uint(page.x) | (uint(page.y) << 16), uint(level) | (uint(entry.a) << 8), 0u, 0u));
+    }
+#endif
+
+    // Sample the resident page, which may be coarser than the needed one until it streams in
+    vec2 levelPos = texelPos / exp2(entry.b);
+    vec2 pagePos = levelPos - floor(levelPos / VT_PAGE_SIZE) * VT_PAGE_SIZE;
+    vec2 cachePos = entry.rg * VT_PAGE_STRIDE + VT_PAGE_BORDER + pagePos;
+    return textureLod(cache, cachePos / vec2(textureSize(cache, 0)), 0.0);
+}
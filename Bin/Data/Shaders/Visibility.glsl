@@ -0,0 +1,38 @@
+// Rasterizes the static multi-draw batches of visibility buffer mode. Each pixel stores the instance's static transform table
+// index with the material bin in the upper 8 bits, and the triangle's index in the geometry's index buffer
+
+#include "Uniforms.glsl"
+
+#ifdef COMPILEVS
+
+#include "Transform.glsl"
+
+in vec3 position;
+
+// Material bin
+uniform vec4 visibilityParameters;
+
+flat out uvec2 vVisibility;
+
+#else
+
+flat in uvec2 vVisibility;
+out uvec2 fragColor;
+
+#endif
+
+void vert()
+{
+    mat3x4 modelMatrix = GetWorldMatrix();
+    vec3 worldPos = vec4(position, 1.0) * modelMatrix;
+    gl_Position = vec4(worldPos, 1.0) * viewProjMatrix;
+
+    // The instance data holds the static transform table index and the first triangle of the draw command
+    vVisibility = uvec2((uint(visibilityParameters.x) << 24U) | uint(texCoord3.x), uint(texCoord3.y));
+}
+
+void frag()
+{
+    // The primitive ID counts the triangles from the start of each command of the multi-draw
+    fragColor = uvec2(vVisibility.x, vVisibility.y + uint(gl_PrimitiveID));
+}
@@ -0,0 +1,116 @@
+// Shades the pixels of one material bin of the visibility buffer. The triangle of each pixel is fetched from the geometry's
+// vertex and index buffers and transformed with the static transform table, and its attributes are interpolated with the
+// perspective-correct barycentrics of the pixel center. The barycentric gradients across pixels replace the derivatives of
+// fragment shaders for the texture and decal sampling. With DIFFMAP, the diffuse texture is applied like in Diffuse.glsl
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+#include "Uniforms.glsl"
+#include "Lighting.glsl"
+
+layout(std430, binding = 0) readonly buffer Vertices
+{
+    float vertices[];
+};
+
+layout(std430, binding = 1) readonly buffer Indices
+{
+    uint indices[];
+};
+
+layout(binding = 0, rgba8) uniform writeonly image2D colorImage0;
+#ifdef NORMALOUTPUT
+layout(binding = 1, rgba8) uniform writeonly image2D normalImage1;
+#endif
+
+#ifdef DIFFMAP
+uniform sampler2D diffuseTex0;
+#endif
+uniform usampler2D visibilityTex1;
+uniform sampler2D depthTex2;
+uniform sampler2D staticTransformTex16;
+// Material bin, and the vertex size, normal offset and texture coordinate offset in floats
+uniform vec4 visibilityParameters;
+
+vec3 FetchVector3(uint offset)
+{
+    return vec3(vertices[offset], vertices[offset + 1U], vertices[offset + 2U]);
+}
+
+void comp()
+{
+    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+    ivec2 size = textureSize(depthTex2, 0);
+    if (texel.x >= size.x || texel.y >= size.y)
+        return;
+
+    // Pixels without visibility buffer geometry keep the depth clear value, and their visibility is undefined
+    if (texelFetch(depthTex2, texel, 0).r >= 1.0)
+        return;
+    uvec2 visibility = texelFetch(visibilityTex1, texel, 0).xy;
+    if ((visibility.x >> 24U) != uint(visibilityParameters.x))
+        return;
+
+    // World transform rows, stored like in Transform.glsl
+    uint staticIndex = visibility.x & 0xffffffU;
+    ivec2 pos = ivec2(int(staticIndex & 1023U) * 3, int(staticIndex >> 10U));
+    mat3x4 modelMatrix = mat3x4(texelFetch(staticTransformTex16, pos, 0), texelFetch(staticTransformTex16, pos + ivec2(1, 0), 0), texelFetch(staticTransformTex16, pos + ivec2(2, 0), 0));
+
+    uint vertexSize = uint(visibilityParameters.y);
+    uvec3 offsets = uvec3(indices[visibility.y * 3U], indices[visibility.y * 3U + 1U], indices[visibility.y * 3U + 2U]) * vertexSize;
+    vec3 worldPos0 = vec4(FetchVector3(offsets.x), 1.0) * modelMatrix;
+    vec3 worldPos1 = vec4(FetchVector3(offsets.y), 1.0) * modelMatrix;
+    vec3 worldPos2 = vec4(FetchVector3(offsets.z), 1.0) * modelMatrix;
+    vec4 clipPos0 = vec4(worldPos0, 1.0) * viewProjMatrix;
+    vec4 clipPos1 = vec4(worldPos1, 1.0) * viewProjMatrix;
+    vec4 clipPos2 = vec4(worldPos2, 1.0) * viewProjMatrix;
+
+    // Barycentrics and their gradients per pixel, from the screen-space edge functions weighted by the inverse W
+    vec2 invSize = 1.0 / vec2(size);
+    vec2 pixelPos = (vec2(texel) + 0.5) * invSize * 2.0 - 1.0;
+    vec3 invW = 1.0 / vec3(clipPos0.w, clipPos1.w, clipPos2.w);
+    vec2 ndc0 = clipPos0.xy * invW.x;
+    vec2 ndc1 = clipPos1.xy * invW.y;
+    vec2 ndc2 = clipPos2.xy * invW.z;
+    float invDet = 1.0 / determinant(mat2(ndc2 - ndc1, ndc0 - ndc1));
+    vec3 dx = vec3(ndc1.y - ndc2.y, ndc2.y - ndc0.y, ndc0.y - ndc1.y) * invDet * invW;
+    vec3 dy = vec3(ndc2.x - ndc1.x, ndc0.x - ndc2.x, ndc1.x - ndc0.x) * invDet * invW;
+    float dxSum = dx.x + dx.y + dx.z;
+    float dySum = dy.x + dy.y + dy.z;
+    vec2 delta = pixelPos - ndc0;
+    float interpInvW = invW.x + delta.x * dxSum + delta.y * dySum;
+    vec3 lambda = (vec3(invW.x, 0.0, 0.0) + delta.x * dx + delta.y * dy) / interpInvW;
+    dx *= 2.0 * invSize.x;
+    dy *= 2.0 * invSize.y;
+    dxSum *= 2.0 * invSize.x;
+    dySum *= 2.0 * invSize.y;
+    vec3 lambdaDx = (lambda * interpInvW + dx) / (interpInvW + dxSum) - lambda;
+    vec3 lambdaDy = (lambda * interpInvW + dy) / (interpInvW + dySum) - lambda;
+
+    mat3 worldPositions = mat3(worldPos0, worldPos1, worldPos2);
+    vec4 worldPos = vec4(worldPositions * lambda, 1.0);
+    // Linear depth for the shadow cascades and clusters, as computed by the vertex shaders of the forward passes
+    worldPos.w = dot(depthParameters.zw, (worldPos * viewProjMatrix).zw);
+
+    uvec3 normalOffsets = offsets + uint(visibilityParameters.z);
+    mat3 normals = mat3(FetchVector3(normalOffsets.x), FetchVector3(normalOffsets.y), FetchVector3(normalOffsets.z));
+    vec3 normal = normalize(vec4(normals * lambda, 0.0) * modelMatrix);
+
+    vec3 diffColor = matDiffColor.rgb;
+#ifdef DIFFMAP
+    uvec3 texCoordOffsets = offsets + uint(visibilityParameters.w);
+    mat3x2 texCoords = mat3x2(
+        vec2(vertices[texCoordOffsets.x], vertices[texCoordOffsets.x + 1U]),
+        vec2(vertices[texCoordOffsets.y], vertices[texCoordOffsets.y + 1U]),
+        vec2(vertices[texCoordOffsets.z], vertices[texCoordOffsets.z + 1U])
+    );
+    diffColor *= textureGrad(diffuseTex0, texCoords * lambda, texCoords * lambdaDx, texCoords * lambdaDy).rgb;
+#endif
+
+    vec2 screenPos = vec2(pixelPos.x * 0.5 + 0.5, -pixelPos.y * 0.5 + 0.5);
+    diffColor = ApplyDecalsGrad(diffColor, worldPos, normal, screenPos, worldPositions * lambdaDx, worldPositions * lambdaDy);
+    imageStore(colorImage0, texel, vec4(diffColor * CalculateLighting(worldPos, normal, screenPos), matDiffColor.a));
+#ifdef NORMALOUTPUT
+    imageStore(normalImage1, texel, vec4((vec4(normal, 0.0) * viewMatrix) * 0.5 + 0.5, 1.0));
+#endif
+}
@@ -0,0 +1,45 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "IO/Arguments.h"
+#include "IO/File.h"
+#include "IO/Log.h"
+#include "Object/AutoPtr.h"
+#include "Renderer/Material.h"
+
+#include <cstdio>
+
+int main(int argc, char** argv)
+{
+    const std::vector<std::string>& arguments = ParseArguments(argc, argv);
+    if (arguments.size() < 3)
+    {
+        printf("Usage: MaterialCooker <input> <output>\n"
+            "Converts a JSON material to the cooked binary format, which is loaded without JSON parsing.\n");
+        return 1;
+    }
+
+    AutoPtr<Log> log(new Log());
+
+    File source(arguments[1]);
+    if (!source.IsReadable())
+    {
+        fprintf(stderr, "Could not open %s\n", arguments[1].c_str());
+        return 1;
+    }
+
+    // Only the load-time data is needed, so the shaders and textures are not loaded
+    SharedPtr<Material> material(new Material());
+    material->SetName(arguments[1]);
+    if (!material->BeginLoad(source))
+        return 1;
+
+    File dest(arguments[2], FILE_WRITE);
+    if (!dest.IsWritable() || !material->SaveCooked(dest))
+    {
+        fprintf(stderr, "Could not write %s\n", arguments[2].c_str());
+        return 1;
+    }
+
+    printf("Cooked %s\n", arguments[1].c_str());
+    return 0;
+}
@@ -0,0 +1,89 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "IO/Arguments.h"
+#include "IO/File.h"
+#include "IO/Log.h"
+#include "IO/StringUtils.h"
+#include "Object/AutoPtr.h"
+#include "Renderer/Model.h"
+
+#include <cstdio>
+
+int main(int argc, char** argv)
+{
+    const std::vector<std::string>& arguments = ParseArguments(argc, argv);
+    if (arguments.size() < 3)
+    {
+        printf("Usage: ModelOptimizer <input> <output> [options]\n"
+            "Reorders the model's triangles for vertex cache efficiency and its vertices for fetch locality, and saves the result.\n"
+            "Options:\n"
+            "-overdraw       Also sort triangle clusters to reduce overdraw\n"
+            "-lods <count>   Generate LOD levels for geometries that have only one, including the original\n"
+            "-ratio <ratio>  Triangle count ratio between generated LOD levels. Default 0.5\n"
+            "-error <pixels> Allowed screen space error of generated LOD levels at 1080p. Default 1\n"
+            "-meshlets       Generate meshlets. Requires -cooked to be saved\n"
+            "-compress       Compress normals, tangents and texcoords. Requires -cooked\n"
+            "-cooked         Save in the cooked format, which is memory mapped and uploaded as is on load\n");
+        return 1;
+    }
+
+    AutoPtr<Log> log(new Log());
+
+    bool overdraw = false;
+    bool meshlets = false;
+    bool compress = false;
+    bool cooked = false;
+    unsigned lodLevels = 0;
+    float lodRatio = 0.5f;
+    float lodPixelError = 1.0f;
+
+    for (size_t i = 3; i < arguments.size(); ++i)
+    {
+        if (arguments[i] == "-overdraw")
+            overdraw = true;
+        else if (arguments[i] == "-meshlets")
+            meshlets = true;
+        else if (arguments[i] == "-compress")
+            compress = true;
+        else if (arguments[i] == "-cooked")
+            cooked = true;
+        else if (arguments[i] == "-lods" && i + 1 < arguments.size())
+            lodLevels = (unsigned)Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-ratio" && i + 1 < arguments.size())
+            lodRatio = ParseFloat(arguments[++i]);
+        else if (arguments[i] == "-error" && i + 1 < arguments.size())
+            lodPixelError = ParseFloat(arguments[++i]);
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arguments[i].c_str());
+            return 1;
+        }
+    }
+
+    File source(arguments[1]);
+    if (!source.IsReadable())
+    {
+        fprintf(stderr, "Could not open %s\n", arguments[1].c_str());
+        return 1;
+    }
+
+    // Only the load-time processing is needed, so the model is not uploaded to the GPU
+    Model model;
+    model.SetName(arguments[1]);
+    model.SetMeshOptimization(true, overdraw);
+    model.SetLodGeneration(lodLevels, lodRatio, lodPixelError);
+    model.SetMeshletGeneration(meshlets);
+    model.SetVertexCompression(compress);
+    if (!model.BeginLoad(source))
+        return 1;
+
+    File dest(arguments[2], FILE_WRITE);
+    if (!dest.IsWritable() || !(cooked ? model.SaveCooked(dest) : model.Save(dest)))
+    {
+        fprintf(stderr, "Could not write %s\n", arguments[2].c_str());
+        return 1;
+    }
+
+    printf("Optimized %s\n", arguments[1].c_str());
+    return 0;
+}
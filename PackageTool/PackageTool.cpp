@@ -0,0 +1,134 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "IO/Arguments.h"
+#include "IO/Compression.h"
+#include "IO/File.h"
+#include "IO/FileSystem.h"
+#include "IO/Log.h"
+#include "IO/PackageFile.h"
+#include "IO/StringUtils.h"
+#include "Object/AutoPtr.h"
+
+#include <algorithm>
+#include <cstdio>
+
+int main(int argc, char** argv)
+{
+    const std::vector<std::string>& arguments = ParseArguments(argc, argv);
+    if (arguments.size() < 3)
+    {
+        printf("Usage: PackageTool <input directory> <output> [options]\n"
+            "Stores the files of a directory and its subdirectories into a package file, which the resource cache maps into memory.\n"
+            "Options:\n"
+            "-compress       Compress the files with LZ4 where it saves space\n");
+        return 1;
+    }
+
+    AutoPtr<Log> log(new Log());
+
+    bool compress = false;
+
+    for (size_t i = 3; i < arguments.size(); ++i)
+    {
+        if (arguments[i] == "-compress")
+            compress = true;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arguments[i].c_str());
+            return 1;
+        }
+    }
+
+    std::string sourceDir = AddTrailingSlash(NormalizePath(arguments[1]));
+    if (!DirExists(sourceDir))
+    {
+        fprintf(stderr, "Could not open directory %s\n", arguments[1].c_str());
+        return 1;
+    }
+
+    std::vector<std::string> fileNames;
+    ScanDir(fileNames, sourceDir, "*.*", SCAN_FILES, true);
+
+    File dest(arguments[2], FILE_WRITE);
+    if (!dest.IsWritable())
+    {
+        fprintf(stderr, "Could not write %s\n", arguments[2].c_str());
+        return 1;
+    }
+
+    // Header with the index offset filled in after the data
+    dest.WriteFileID("TPAK");
+    dest.Write<unsigned>(0);
+
+    std::vector<PackageEntry> entries;
+    std::vector<unsigned char> data;
+    std::vector<unsigned char> compressedData;
+    size_t totalSize = 0;
+    size_t totalStoredSize = 0;
+
+    for (auto it = fileNames.begin(); it != fileNames.end(); ++it)
+    {
+        File source(sourceDir + *it);
+        if (!source.IsReadable())
+        {
+            fprintf(stderr, "Could not open %s\n", it->c_str());
+            return 1;
+        }
+
+        data.resize(source.Size());
+        if (data.size() && source.Read(&data[0], data.size()) != data.size())
+        {
+            fprintf(stderr, "Could not read %s\n", it->c_str());
+            return 1;
+        }
+
+        PackageEntry entry;
+        entry.name = ToLower(*it);
+        entry.nameHash = StringHash(entry.name);
+        entry.size = data.size();
+        entry.compressedSize = 0;
+
+        // Keep a file uncompressed unless compression saves space, so that it can be read directly from the mapping
+        if (compress && data.size())
+        {
+            compressedData.resize(CompressBound(data.size()));
+            size_t compressedSize = CompressData(&compressedData[0], compressedData.size(), &data[0], data.size());
+            if (compressedSize && compressedSize < data.size())
+                entry.compressedSize = compressedSize;
+        }
+
+        while (dest.Position() % PACKAGE_ALIGNMENT)
+            dest.Write<unsigned char>(0);
+        entry.offset = dest.Position();
+
+        size_t storedSize = entry.compressedSize ? entry.compressedSize : entry.size;
+        if (storedSize && dest.Write(entry.compressedSize ? &compressedData[0] : &data[0], storedSize) != storedSize)
+        {
+            fprintf(stderr, "Could not write %s\n", arguments[2].c_str());
+            return 1;
+        }
+
+        entries.push_back(entry);
+        totalSize += entry.size;
+        totalStoredSize += storedSize;
+    }
+
+    // Write the index sorted by name hash for binary search
+    std::sort(entries.begin(), entries.end(), [](const PackageEntry& lhs, const PackageEntry& rhs) { return lhs.nameHash < rhs.nameHash; });
+
+    size_t indexOffset = dest.Position();
+    dest.Write<unsigned>((unsigned)entries.size());
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+    {
+        dest.Write(it->name);
+        dest.Write<unsigned>((unsigned)it->offset);
+        dest.Write<unsigned>((unsigned)it->size);
+        dest.Write<unsigned>((unsigned)it->compressedSize);
+    }
+
+    dest.Seek(4);
+    dest.Write<unsigned>((unsigned)indexOffset);
+
+    printf("Packaged %d files, %d bytes stored as %d bytes\n", (int)entries.size(), (int)totalSize, (int)totalStoredSize);
+    return 0;
+}
@@ -194,9 +194,27 @@ void FrameBuffer::Define(const std::vector<Texture*>& colorTextures, Texture* de
     LOGDEBUGF("Defined MRT framebuffer width %d height %d", size.x, size.y);
 }
 
+void FrameBuffer::DefineRead(Texture* texture, size_t level)
+{
+    Bind(boundDrawBuffer, this);
+
+    unsigned glTexture = texture ? texture->GLTexture() : 0;
+    bool depth = texture && texture->Format() >= FMT_D16 && texture->Format() <= FMT_D24S8;
+    bool stencil = texture && texture->Format() == FMT_D24S8;
+
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, depth ? 0 : glTexture, depth ? 0 : (int)level);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth ? glTexture : 0, depth ? (int)level : 0);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, stencil ? glTexture : 0, stencil ? (int)level : 0);
+    glReadBuffer(glTexture && !depth ? GL_COLOR_ATTACHMENT0 : GL_NONE);
+}
+
 void FrameBuffer::Bind()
 {
-    if (!buffer || boundDrawBuffer == this)
+    if (!buffer)
+        return;
+
+    Graphics::CountStateCall(STATE_FRAMEBUFFER, boundDrawBuffer == this);
+    if (boundDrawBuffer == this)
         return;
 
     glBindFramebuffer(GL_DRAW_FRAMEBUFFER, buffer);
@@ -205,6 +223,8 @@ void FrameBuffer::Bind()
 
 void FrameBuffer::Bind(FrameBuffer* draw, FrameBuffer* read)
 {
+    Graphics::CountStateCall(STATE_FRAMEBUFFER, boundDrawBuffer == draw && boundReadBuffer == read);
+
     if (boundDrawBuffer != draw)
     {
         glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw ? draw->buffer : 0);
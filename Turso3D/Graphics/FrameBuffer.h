@@ -29,6 +29,8 @@ public:
     void Define(Texture* colorTexture, size_t cubeMapFace, Texture* depthStencilTexture);
     /// Define MRT textures to render to.
     void Define(const std::vector<Texture*>& colorTextures, Texture* depthStencilTexture);
+    /// Define a 2D texture mip level to read from, and bind as read framebuffer. Depth formats are attached as depth and color formats as color.
+    void DefineRead(Texture* texture, size_t level);
     /// Bind as draw framebuffer. No-op if already bound. Used also when defining.
     void Bind();
 
@@ -1,10 +1,17 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/FileSystem.h"
 #include "../IO/Log.h"
 #include "../Resource/ResourceCache.h"
+#include "../Time/Profiler.h"
+#include "../Time/TraceRecorder.h"
 #include "FrameBuffer.h"
 #include "Graphics.h"
 #include "IndexBuffer.h"
+#include "IndirectBuffer.h"
+#include "PipelineState.h"
+#include "Readback.h"
+#include "Sampler.h"
 #include "Shader.h"
 #include "ShaderProgram.h"
 #include "Texture.h"
@@ -14,6 +21,9 @@
 #include <SDL.h>
 #include <glew.h>
 #include <tracy/Tracy.hpp>
+#include <tracy/TracyOpenGL.hpp>
+
+#include <cstring>
 
 #ifdef WIN32
 #include <Windows.h>
@@ -24,6 +34,15 @@ extern "C" {
 }
 #endif
 
+// Maximum number of upload pieces processed per frame
+static const size_t UPLOAD_MAX_PIECES = 256;
+// Alignment of the upload pieces in the staging buffer
+static const size_t UPLOAD_ALIGNMENT = 16;
+// Number of frames an unused transient render target is kept in the pool
+static const unsigned RENDER_TARGET_KEEP_FRAMES = 60;
+// Number of frames an unused readback buffer is kept in the pool
+static const unsigned READBACK_BUFFER_KEEP_FRAMES = 60;
+
 static const unsigned glPrimitiveTypes[] =
 {
     GL_LINES,
@@ -52,7 +71,8 @@ static const unsigned glSrcBlend[] =
     GL_ONE,
     GL_ONE_MINUS_DST_ALPHA,
     GL_ONE,
-    GL_SRC_ALPHA
+    GL_SRC_ALPHA,
+    GL_ONE
 };
 
 static const unsigned glDestBlend[] =
@@ -65,9 +85,39 @@ static const unsigned glDestBlend[] =
     GL_ONE_MINUS_SRC_ALPHA,
     GL_DST_ALPHA,
     GL_ONE,
+    GL_ONE,
     GL_ONE
 };
 
+// Weighted blended transparency accumulates the color additively and multiplies the revealage in the alpha channel
+static const unsigned glSrcAlphaBlend[] =
+{
+    GL_ONE,
+    GL_ONE,
+    GL_DST_COLOR,
+    GL_SRC_ALPHA,
+    GL_SRC_ALPHA,
+    GL_ONE,
+    GL_ONE_MINUS_DST_ALPHA,
+    GL_ONE,
+    GL_SRC_ALPHA,
+    GL_ZERO
+};
+
+static const unsigned glDestAlphaBlend[] =
+{
+    GL_ZERO,
+    GL_ONE,
+    GL_ZERO,
+    GL_ONE_MINUS_SRC_ALPHA,
+    GL_ONE,
+    GL_ONE_MINUS_SRC_ALPHA,
+    GL_DST_ALPHA,
+    GL_ONE,
+    GL_ONE,
+    GL_ONE_MINUS_SRC_ALPHA
+};
+
 static const unsigned glBlendOp[] =
 {
     GL_FUNC_ADD,
@@ -78,10 +128,29 @@ static const unsigned glBlendOp[] =
     GL_FUNC_ADD,
     GL_FUNC_ADD,
     GL_FUNC_REVERSE_SUBTRACT,
-    GL_FUNC_REVERSE_SUBTRACT
+    GL_FUNC_REVERSE_SUBTRACT,
+    GL_FUNC_ADD
 };
 
-Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize) :
+unsigned Graphics::stateCalls[MAX_STATE_CALL_TYPES];
+unsigned Graphics::filteredStateCalls[MAX_STATE_CALL_TYPES];
+size_t Graphics::gpuMemoryUse[MAX_GPU_MEMORY_TYPES];
+
+/// Set the instance data pointers. Instance data is either a 3x4 matrix in texcoords 3-5, or one or two floats in texcoord 3, in which case texcoords 4 and 5 repeat it as they are not read.
+static void SetInstanceAttributes(VertexBuffer* instanceVertexBuffer, size_t instanceStart)
+{
+    unsigned instanceVertexSize = (unsigned)instanceVertexBuffer->VertexSize();
+    bool matrix = instanceVertexSize >= 3 * sizeof(Vector4);
+    GLint numComponents = matrix ? 4 : (GLint)(instanceVertexSize / sizeof(float));
+    size_t offset = instanceStart * instanceVertexSize;
+
+    instanceVertexBuffer->Bind(0);
+    glVertexAttribPointer(ATTR_TEXCOORD3, numComponents, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)offset);
+    glVertexAttribPointer(ATTR_TEXCOORD4, numComponents, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(matrix ? offset + sizeof(Vector4) : offset));
+    glVertexAttribPointer(ATTR_TEXCOORD5, numComponents, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(matrix ? offset + 2 * sizeof(Vector4) : offset));
+}
+
+Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, bool headless_) :
     window(nullptr),
     context(nullptr),
     lastBlendMode(MAX_BLEND_MODES),
@@ -90,15 +159,70 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize) :
     lastColorWrite(true),
     lastDepthWrite(true),
     lastDepthBias(false),
-    vsync(false),
+    lastConstantBias(0.0f),
+    lastSlopeScaleBias(0.0f),
+    lastViewport(IntRect::ZERO),
+    presentMode(PRESENT_IMMEDIATE),
+    frameRateLimit(0.0f),
+    frameTimeSmoothing(1),
+    jitterReporting(false),
+    lastPresentTime(-1),
+    nextFrameTime(0),
+    numFrameIntervals(0),
+    frameIntervalIndex(0),
+    frameTime(0.0f),
+    presentJitter(0.0f),
+    headless(headless_),
     hasInstancing(false),
-    instancingEnabled(false)
+    hasMultiDrawIndirect(false),
+    hasBufferStorage(false),
+    hasBindlessTextures(false),
+    hasComputeShaders(false),
+    hasViewportArray(false),
+    hasProgramBinary(false),
+    hasParallelShaderCompile(false),
+    hasSamplerObjects(false),
+    hasTimerQuery(false),
+    hasCopyImage(false),
+    gpuTimers(false),
+    gpuTimerFrame(0),
+    gpuTimerResultsFrame(0),
+    frameNumber(0),
+    drawCalls(0),
+    triangles(0),
+    lastDrawCalls(0),
+    lastTriangles(0),
+    uploadBudget(0),
+    stagingBuffer(0),
+    stagingBufferSize(0),
+    uploadWindow(nullptr),
+    uploadContext(nullptr),
+    lastUploadJobId(0),
+    uploadThreadStatus(0),
+    uploadThreadRunning(false)
 {
     RegisterSubsystem(this);
     RegisterGraphicsLibrary();
 
+    for (size_t i = 0; i < MAX_STATE_CALL_TYPES; ++i)
+    {
+        lastStateCalls[i] = 0;
+        lastFilteredStateCalls[i] = 0;
+    }
+
+    for (size_t i = 0; i < GPU_TIMER_FRAMES; ++i)
+        gpuTimerFrames[i].numQueries = 0;
+
     SDL_SetHint(SDL_HINT_WINDOWS_DPI_AWARENESS, "system");
-    SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
+    // The offscreen driver needs no display. The hint does not override the SDL_VIDEODRIVER environment variable
+    if (headless)
+        SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen");
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS) != 0 && headless)
+    {
+        // Fall back to a hidden window on the default driver
+        SDL_ResetHint(SDL_HINT_VIDEODRIVER);
+        SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS);
+    }
 
     SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
@@ -118,15 +242,53 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize) :
 
     IntVector2 initialSize = windowSize;
 
-    // If window size not specified or larger than desktop, use desktop size instead
-    if (!initialSize.x || !initialSize.y || initialSize.x > desktopMode.w || initialSize.y > desktopMode.h)
+    // If window size not specified or larger than desktop, use desktop size instead. A headless window is not limited by the desktop
+    if (!initialSize.x || !initialSize.y || (!headless && (initialSize.x > desktopMode.w || initialSize.y > desktopMode.h)))
         initialSize = IntVector2(desktopMode.w, desktopMode.h);
 
-    window = SDL_CreateWindow(windowTitle, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, initialSize.x, initialSize.y, SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI);
+    window = SDL_CreateWindow(windowTitle, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, initialSize.x, initialSize.y, SDL_WINDOW_OPENGL | SDL_WINDOW_ALLOW_HIGHDPI |
+        (headless ? SDL_WINDOW_HIDDEN : 0));
 }
 
 Graphics::~Graphics()
 {
+    renderTargetFrameBuffers.clear();
+    renderTargets.clear();
+    SetUploadThread(false);
+    pendingUploads.clear();
+    lastPipelineState.Reset();
+    for (auto it = pendingReadbacks.begin(); it != pendingReadbacks.end(); ++it)
+    {
+        glDeleteSync((GLsync)(*it)->fence);
+        (*it)->fence = nullptr;
+        (*it)->pending = false;
+    }
+    pendingReadbacks.clear();
+    for (auto it = readbackBuffers.begin(); it != readbackBuffers.end(); ++it)
+        glDeleteBuffers(1, &it->buffer);
+    readbackBuffers.clear();
+    readbackFrameBuffer.Reset();
+    copyFrameBuffers[0].Reset();
+    copyFrameBuffers[1].Reset();
+    if (stagingBuffer)
+    {
+        glDeleteBuffers(1, &stagingBuffer);
+        stagingBuffer = 0;
+    }
+
+    Sampler::ReleaseAll();
+
+    SetGpuTimers(false);
+    for (size_t i = 0; i < GPU_TIMER_FRAMES; ++i)
+    {
+        GpuTimerFrame& frame = gpuTimerFrames[i];
+        if (frame.queries.size())
+        {
+            glDeleteQueries((GLsizei)frame.queries.size(), &frame.queries[0]);
+            frame.queries.clear();
+        }
+    }
+
     if (context)
     {
         SDL_GL_DeleteContext(context);
@@ -156,88 +318,1125 @@ bool Graphics::Initialize()
         return false;
     }
 
-    context = SDL_GL_CreateContext(window);
-    if (!context)
+    context = SDL_GL_CreateContext(window);
+    if (!context)
+    {
+        LOGERROR("Could not create OpenGL 3.2 context");
+        return false;
+    }
+
+    GLenum err = glewInit();
+    if (err != GLEW_OK || !GLEW_VERSION_3_2)
+    {
+        LOGERROR("Could not initialize OpenGL 3.2");
+        return false;
+    }
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_MULTISAMPLE);
+    glClearDepth(1.0f);
+    glDepthRange(0.0f, 1.0f);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+
+    VertexBuffer::CreateDefaultVertexArray();
+
+    // Use texcoords 3-5 for instancing if supported
+    if (glVertexAttribDivisorARB)
+    {
+        hasInstancing = true;
+
+        glVertexAttribDivisorARB(ATTR_TEXCOORD3, 1);
+        glVertexAttribDivisorARB(ATTR_TEXCOORD4, 1);
+        glVertexAttribDivisorARB(ATTR_TEXCOORD5, 1);
+
+        // Multi-draw indirect needs base instances to offset the instance data per command
+        if ((GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance)) && glMultiDrawElementsIndirect)
+            hasMultiDrawIndirect = true;
+    }
+
+    if ((GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) && glBufferStorage)
+        hasBufferStorage = true;
+
+    // The bindless texture extension requires GLSL 4.00
+    if (GLEW_VERSION_4_0 && GLEW_ARB_bindless_texture && glGetTextureHandleARB && glUniformHandleui64ARB)
+        hasBindlessTextures = true;
+
+    // Compute shaders are compiled with GLSL 4.30
+    if (GLEW_VERSION_4_3 && glDispatchCompute && glBindImageTexture && glMemoryBarrier)
+        hasComputeShaders = true;
+
+    // Geometry shaders are core in the 3.2 context, the viewport index output needs the viewport array extension
+    if ((GLEW_VERSION_4_1 || GLEW_ARB_viewport_array) && glViewportIndexedf)
+        hasViewportArray = true;
+
+    if ((GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) && glProgramBinary && glGetProgramBinary)
+    {
+        int numFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+        hasProgramBinary = numFormats > 0;
+    }
+
+    // The KHR and ARB parallel shader compile extensions share the completion status token. GLEW only knows the ARB one, so look for the KHR one from the extension list
+    if (GLEW_ARB_parallel_shader_compile)
+        hasParallelShaderCompile = true;
+    else
+    {
+        int numExtensions = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+        for (int i = 0; i < numExtensions && !hasParallelShaderCompile; ++i)
+        {
+            const char* name = reinterpret_cast<const char*>(glGetStringi(GL_EXTENSIONS, i));
+            if (name && !strcmp(name, "GL_KHR_parallel_shader_compile"))
+                hasParallelShaderCompile = true;
+        }
+    }
+
+    if ((GLEW_VERSION_3_3 || GLEW_ARB_sampler_objects) && glGenSamplers && glBindSampler)
+        hasSamplerObjects = true;
+
+    if ((GLEW_VERSION_3_3 || GLEW_ARB_timer_query) && glQueryCounter && glGetQueryObjectui64v)
+    {
+        hasTimerQuery = true;
+        TracyGpuContext;
+    }
+
+    if ((GLEW_VERSION_4_3 || GLEW_ARB_copy_image) && glCopyImageSubData)
+        hasCopyImage = true;
+
+    DefineQuadVertexBuffer();
+
+    SetPresentMode(presentMode);
+    return true;
+}
+
+void Graphics::Resize(const IntVector2& size)
+{
+    SDL_SetWindowSize(window, size.x, size.y);
+}
+
+void Graphics::SetFullscreen(bool enable)
+{
+    SDL_SetWindowFullscreen(window, enable ? SDL_WINDOW_FULLSCREEN : 0);
+}
+
+void Graphics::SetVSync(bool enable)
+{
+    SetPresentMode(enable ? PRESENT_VSYNC : PRESENT_IMMEDIATE);
+}
+
+void Graphics::SetPresentMode(PresentMode mode)
+{
+    if (!IsInitialized())
+        return;
+
+    // Adaptive vsync is the negative swap interval of the swap control tear extension
+    if (mode == PRESENT_ADAPTIVE_VSYNC && SDL_GL_SetSwapInterval(-1) != 0)
+    {
+        LOGWARNING("Adaptive vsync not supported, falling back to vsync");
+        mode = PRESENT_VSYNC;
+    }
+    if (mode != PRESENT_ADAPTIVE_VSYNC)
+        SDL_GL_SetSwapInterval(mode == PRESENT_VSYNC ? 1 : 0);
+
+    presentMode = mode;
+}
+
+void Graphics::SetFrameRateLimit(float fps)
+{
+    frameRateLimit = Max(fps, 0.0f);
+    nextFrameTime = 0;
+}
+
+void Graphics::SetFrameTimeSmoothing(size_t frames)
+{
+    frameTimeSmoothing = Min(Max(frames, (size_t)1), FRAME_TIME_HISTORY);
+}
+
+void Graphics::SetJitterReporting(bool enable)
+{
+    jitterReporting = enable;
+}
+
+void Graphics::Present()
+{
+    ZoneScoped;
+
+    if (frameRateLimit > 0.0f)
+        LimitFrameRate();
+
+    // Headless rendering goes only into framebuffers, so there is nothing to show
+    if (!headless)
+        SDL_GL_SwapWindow(window);
+    ++frameNumber;
+
+    long long presentTime = presentClock.ElapsedUSec();
+    if (lastPresentTime >= 0)
+        UpdateFrameTime(presentTime - lastPresentTime);
+    lastPresentTime = presentTime;
+
+    if (gpuTimers)
+        CollectGpuTimers();
+    if (hasTimerQuery)
+    {
+        TracyGpuCollect;
+    }
+
+    UpdateRenderTargets();
+
+    lastDrawCalls = drawCalls;
+    lastTriangles = triangles;
+    drawCalls = 0;
+    triangles = 0;
+
+    for (size_t i = 0; i < MAX_STATE_CALL_TYPES; ++i)
+    {
+        lastStateCalls[i] = stateCalls[i];
+        lastFilteredStateCalls[i] = filteredStateCalls[i];
+        stateCalls[i] = 0;
+        filteredStateCalls[i] = 0;
+    }
+
+    ProcessUploads();
+    ProcessReadbacks();
+}
+
+void Graphics::LimitFrameRate()
+{
+    ZoneScoped;
+
+    long long interval = (long long)(1000000.0f / frameRateLimit);
+    long long now = presentClock.ElapsedUSec();
+
+    // Sleep while the frame is due later than the sleep granularity, then spin. A frame that is late by more than an interval starts a new schedule instead of hurrying the next frames to catch up
+    if (!nextFrameTime || now > nextFrameTime + interval)
+        nextFrameTime = now;
+    while (nextFrameTime - now > 2000)
+    {
+        Timer::Sleep(1);
+        now = presentClock.ElapsedUSec();
+    }
+    while (now < nextFrameTime)
+        now = presentClock.ElapsedUSec();
+
+    nextFrameTime += interval;
+}
+
+void Graphics::UpdateFrameTime(long long intervalUSec)
+{
+    frameIntervals[frameIntervalIndex] = intervalUSec;
+    frameIntervalIndex = (frameIntervalIndex + 1) % FRAME_TIME_HISTORY;
+    if (numFrameIntervals < FRAME_TIME_HISTORY)
+        ++numFrameIntervals;
+
+    // Average the most recent intervals for the frame time, and all kept intervals for the jitter
+    size_t numSmoothed = Min(frameTimeSmoothing, numFrameIntervals);
+    long long smoothedSum = 0;
+    long long sum = 0;
+    for (size_t i = 0; i < numFrameIntervals; ++i)
+    {
+        long long interval = frameIntervals[(frameIntervalIndex + FRAME_TIME_HISTORY - 1 - i) % FRAME_TIME_HISTORY];
+        if (i < numSmoothed)
+            smoothedSum += interval;
+        sum += interval;
+    }
+
+    double mean = (double)sum / numFrameIntervals;
+    double variance = 0.0;
+    for (size_t i = 0; i < numFrameIntervals; ++i)
+    {
+        double deviation = (double)frameIntervals[i] - mean;
+        variance += deviation * deviation;
+    }
+
+    frameTime = (float)((double)smoothedSum / numSmoothed * 0.000001);
+    presentJitter = (float)(sqrt(variance / numFrameIntervals) * 0.000001);
+
+    if (jitterReporting)
+    {
+        Profiler* profiler = Subsystem<Profiler>();
+        if (profiler)
+        {
+            profiler->SetCounter("FrameTimeUSec", (long long)(frameTime * 1000000.0f));
+            profiler->SetCounter("PresentJitterUSec", (long long)(presentJitter * 1000000.0f));
+        }
+    }
+}
+
+Texture* Graphics::AcquireRenderTarget(const IntVector2& size, ImageFormat format, int multisample)
+{
+    if (multisample < 1)
+        multisample = 1;
+
+    for (auto it = renderTargets.begin(); it != renderTargets.end(); ++it)
+    {
+        Texture* texture = it->texture;
+        if (!it->inUse && texture->Size2D() == size && texture->Format() == format && texture->Multisample() == multisample)
+        {
+            it->inUse = true;
+            it->lastUseFrame = frameNumber;
+            return texture;
+        }
+    }
+
+    ZoneScoped;
+
+    SharedPtr<Texture> texture(new Texture());
+    if (!texture->Define(TEX_2D, size, format, multisample))
+        return nullptr;
+    if (multisample == 1)
+        texture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+    PooledRenderTarget newTarget;
+    newTarget.texture = texture;
+    newTarget.inUse = true;
+    newTarget.lastUseFrame = frameNumber;
+    renderTargets.push_back(newTarget);
+
+    return texture;
+}
+
+void Graphics::ReleaseRenderTarget(Texture* texture)
+{
+    for (auto it = renderTargets.begin(); it != renderTargets.end(); ++it)
+    {
+        if (it->texture == texture)
+        {
+            it->inUse = false;
+            return;
+        }
+    }
+}
+
+FrameBuffer* Graphics::RenderTargetFrameBuffer(Texture* colorTexture, Texture* depthStencilTexture)
+{
+    for (auto it = renderTargetFrameBuffers.begin(); it != renderTargetFrameBuffers.end(); ++it)
+    {
+        if (it->colorTexture == colorTexture && it->depthStencilTexture == depthStencilTexture)
+            return it->frameBuffer;
+    }
+
+    PooledFrameBuffer newFrameBuffer;
+    newFrameBuffer.colorTexture = colorTexture;
+    newFrameBuffer.depthStencilTexture = depthStencilTexture;
+    newFrameBuffer.frameBuffer = new FrameBuffer();
+    newFrameBuffer.frameBuffer->Define(colorTexture, depthStencilTexture);
+    renderTargetFrameBuffers.push_back(newFrameBuffer);
+
+    return newFrameBuffer.frameBuffer;
+}
+
+size_t Graphics::GpuMemoryUse() const
+{
+    size_t bytes = 0;
+    for (size_t i = 0; i < MAX_GPU_MEMORY_TYPES; ++i)
+        bytes += gpuMemoryUse[i];
+    return bytes;
+}
+
+void Graphics::SetProgramCacheDir(const std::string& pathName)
+{
+    if (pathName.length() && !CreateDir(pathName))
+    {
+        LOGERROR("Could not create shader program cache directory " + pathName);
+        return;
+    }
+
+    programCacheDir = pathName;
+}
+
+void Graphics::SetGpuTimers(bool enable)
+{
+    if (enable && !hasTimerQuery)
+    {
+        LOGERROR("Timer queries not supported, can not enable GPU timers");
+        return;
+    }
+
+    if (!enable)
+    {
+        while (gpuTimerStack.size())
+            EndGpuTimer();
+        gpuTimerResults.clear();
+    }
+
+    gpuTimers = enable;
+}
+
+void Graphics::SetUploadBudget(size_t bytesPerFrame)
+{
+    uploadBudget = bytesPerFrame;
+
+    // When switching to immediate uploads, finish the queue now, unless the upload thread takes care of it
+    if (!uploadBudget && !uploadContext)
+    {
+        while (pendingUploads.size())
+        {
+            size_t numPending = pendingUploads.size();
+            ProcessUploads();
+            if (pendingUploads.size() == numPending)
+                break;
+        }
+    }
+}
+
+bool Graphics::SetUploadThread(bool enable)
+{
+    ZoneScoped;
+
+    if (enable == HasUploadThread())
+        return true;
+
+    if (enable)
+    {
+        if (!context)
+        {
+            LOGERROR("Graphics not initialized, can not start the upload thread");
+            return false;
+        }
+
+        // Use a hidden window of its own, as not all platforms allow the main window to be current on two threads
+        uploadWindow = SDL_CreateWindow("", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+        if (!uploadWindow)
+        {
+            LOGERRORF("Could not create the upload thread window: %s", SDL_GetError());
+            return false;
+        }
+
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+        uploadContext = SDL_GL_CreateContext(uploadWindow);
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+        // Creating the context made it current. Make the main context current again, which also frees the new context for the upload thread
+        SDL_GL_MakeCurrent(window, context);
+
+        if (uploadContext)
+        {
+            uploadThreadStatus = -1;
+            uploadThreadRunning = true;
+            uploadThread = std::thread(&Graphics::UploadLoop, this);
+
+            std::unique_lock<std::mutex> lock(uploadMutex);
+            uploadFinishedCondition.wait(lock, [this]() { return uploadThreadStatus >= 0; });
+        }
+
+        if (!uploadContext || !uploadThreadStatus)
+        {
+            LOGERRORF("Could not create the upload thread context: %s", SDL_GetError());
+            if (uploadThread.joinable())
+                uploadThread.join();
+            uploadThreadRunning = false;
+            if (uploadContext)
+            {
+                SDL_GL_DeleteContext(uploadContext);
+                uploadContext = nullptr;
+            }
+            SDL_DestroyWindow(uploadWindow);
+            uploadWindow = nullptr;
+            return false;
+        }
+
+        LOGINFO("Started the upload thread");
+        return true;
+    }
+    else
+    {
+        {
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            uploadThreadRunning = false;
+        }
+        uploadCondition.notify_one();
+        uploadThread.join();
+
+        // The thread performed all submitted jobs and waited for them before exiting, so all their fences have signaled
+        ProcessThreadedUploads();
+
+        SDL_GL_DeleteContext(uploadContext);
+        uploadContext = nullptr;
+        SDL_DestroyWindow(uploadWindow);
+        uploadWindow = nullptr;
+
+        // Upload the rest immediately, unless there is an upload budget
+        if (!uploadBudget)
+            SetUploadBudget(0);
+
+        return true;
+    }
+}
+
+void Graphics::QueueUpload(Texture* texture, size_t level, const ImageLevel& data, RefCounted* owner)
+{
+    if (!texture || !data.data || !data.rows)
+        return;
+
+    PendingUpload upload;
+    upload.texture = texture;
+    upload.vertexBuffer = nullptr;
+    upload.indexBuffer = nullptr;
+    upload.level = level;
+    upload.data = data;
+    upload.offset = 0;
+    upload.progress = 0;
+    upload.owner = owner;
+    upload.jobId = 0;
+    upload.fence = nullptr;
+    pendingUploads.push_back(upload);
+}
+
+void Graphics::QueueUpload(VertexBuffer* buffer, size_t firstVertex, size_t numVertices, const SharedArrayPtr<unsigned char>& data)
+{
+    if (!buffer || !buffer->GLBuffer() || !data || !numVertices)
+        return;
+
+    PendingUpload upload;
+    upload.texture = nullptr;
+    upload.vertexBuffer = buffer;
+    upload.indexBuffer = nullptr;
+    upload.level = 0;
+    upload.data.data = data.Get();
+    upload.data.dataSize = numVertices * buffer->VertexSize();
+    upload.offset = firstVertex * buffer->VertexSize();
+    upload.progress = 0;
+    upload.arrayOwner = data;
+    upload.jobId = 0;
+    upload.fence = nullptr;
+    pendingUploads.push_back(upload);
+}
+
+void Graphics::QueueUpload(IndexBuffer* buffer, size_t firstIndex, size_t numIndices, const SharedArrayPtr<unsigned char>& data)
+{
+    if (!buffer || !buffer->GLBuffer() || !data || !numIndices)
+        return;
+
+    PendingUpload upload;
+    upload.texture = nullptr;
+    upload.vertexBuffer = nullptr;
+    upload.indexBuffer = buffer;
+    upload.level = 0;
+    upload.data.data = data.Get();
+    upload.data.dataSize = numIndices * buffer->IndexSize();
+    upload.offset = firstIndex * buffer->IndexSize();
+    upload.progress = 0;
+    upload.arrayOwner = data;
+    upload.jobId = 0;
+    upload.fence = nullptr;
+    pendingUploads.push_back(upload);
+}
+
+void Graphics::ProcessUploads()
+{
+    if (pendingUploads.empty())
+        return;
+
+    if (uploadContext)
+    {
+        ProcessThreadedUploads();
+        return;
+    }
+
+    ZoneScoped;
+
+    // Take pieces from the front of the queue until the budget is used. Always make progress on at least one upload, even if its smallest piece is over the budget
+    size_t budget = uploadBudget ? uploadBudget : M_MAX_UNSIGNED;
+    size_t total = 0;
+    size_t numPieces = 0;
+    size_t pieceStarts[UPLOAD_MAX_PIECES];
+    size_t pieceEnds[UPLOAD_MAX_PIECES];
+    size_t pieceOffsets[UPLOAD_MAX_PIECES];
+
+    for (size_t i = 0; i < pendingUploads.size() && numPieces < UPLOAD_MAX_PIECES && total < budget; ++i)
+    {
+        PendingUpload& upload = pendingUploads[i];
+        size_t start = upload.progress;
+        size_t end;
+        size_t bytes;
+
+        if (upload.texture)
+        {
+            // Allocate the whole level before its first band, while no unpack buffer is bound
+            if (!start)
+            {
+                ImageLevel allocation = upload.data;
+                allocation.data = nullptr;
+                upload.texture->SetData(upload.level, IntRect(0, 0, upload.data.size.x, upload.data.size.y), allocation);
+            }
+
+            size_t rows = (budget - total) / upload.data.rowSize;
+            if (!rows)
+                rows = 1;
+            end = start + rows;
+            if (end > upload.data.rows)
+                end = upload.data.rows;
+            bytes = (end - start) * upload.data.rowSize;
+        }
+        else
+        {
+            end = upload.data.dataSize;
+            if (end - start > budget - total)
+                end = start + (budget - total);
+            bytes = end - start;
+        }
+
+        pieceStarts[numPieces] = start;
+        pieceEnds[numPieces] = end;
+        pieceOffsets[numPieces] = total;
+        ++numPieces;
+        total += (bytes + UPLOAD_ALIGNMENT - 1) & ~(UPLOAD_ALIGNMENT - 1);
+
+        // Keep the uploads in order: do not start the next before this one is complete
+        if (end < (upload.texture ? upload.data.rows : upload.data.dataSize))
+            break;
+    }
+
+    // Orphan and refill the staging buffer so that the previous frame's copies do not stall
+    if (!stagingBuffer)
+        glGenBuffers(1, &stagingBuffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+    if (total > stagingBufferSize)
+        stagingBufferSize = total;
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, stagingBufferSize, nullptr, GL_STREAM_DRAW);
+
+    unsigned char* staging = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, total, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (!staging)
+    {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        LOGERROR("Failed to map upload staging buffer");
+        return;
+    }
+
+    for (size_t i = 0; i < numPieces; ++i)
+    {
+        const PendingUpload& upload = pendingUploads[i];
+        size_t unit = upload.texture ? upload.data.rowSize : 1;
+        memcpy(staging + pieceOffsets[i], upload.data.data + pieceStarts[i] * unit, (pieceEnds[i] - pieceStarts[i]) * unit);
+    }
+
+    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+    for (size_t i = 0; i < numPieces; ++i)
+    {
+        PendingUpload& upload = pendingUploads[i];
+
+        if (upload.texture)
+        {
+            // Compressed formats are uploaded in rows of 4x4 blocks
+            int rowHeight = upload.texture->IsCompressed() ? 4 : 1;
+            ImageLevel band = upload.data;
+            band.data = reinterpret_cast<const unsigned char*>(pieceOffsets[i]);
+            band.rows = pieceEnds[i] - pieceStarts[i];
+            band.dataSize = band.rows * band.rowSize;
+            band.sliceSize = band.dataSize;
+            int top = (int)pieceStarts[i] * rowHeight;
+            int bottom = Min((int)pieceEnds[i] * rowHeight, upload.data.size.y);
+            upload.texture->SetData(upload.level, IntRect(0, top, upload.data.size.x, bottom), band);
+        }
+        else
+        {
+            unsigned destBuffer = upload.vertexBuffer ? upload.vertexBuffer->GLBuffer() : upload.indexBuffer->GLBuffer();
+            glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, destBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, pieceOffsets[i], upload.offset + pieceStarts[i], pieceEnds[i] - pieceStarts[i]);
+        }
+
+        upload.progress = pieceEnds[i];
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    // Finished uploads are always at the front of the queue. Once a texture level is complete, allow sampling from it
+    size_t numFinished = 0;
+    while (numFinished < numPieces)
+    {
+        PendingUpload& upload = pendingUploads[numFinished];
+        if (upload.progress < (upload.texture ? upload.data.rows : upload.data.dataSize))
+            break;
+        if (upload.texture)
+            upload.texture->SetBaseLevel(upload.level);
+        ++numFinished;
+    }
+
+    pendingUploads.erase(pendingUploads.begin(), pendingUploads.begin() + numFinished);
+}
+
+void Graphics::CancelUploads(const RefCounted* target)
+{
+    for (auto it = pendingUploads.begin(); it != pendingUploads.end();)
+    {
+        if (it->texture == target || it->vertexBuffer == target || it->indexBuffer == target)
+        {
+            // The upload thread may still be reading the source data or using the destination
+            if (it->jobId && !it->fence)
+                WaitUploadJob(*it);
+            if (it->fence)
+                glDeleteSync((GLsync)it->fence);
+            it = pendingUploads.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+void Graphics::ProcessThreadedUploads()
+{
+    ZoneScoped;
+
+    CollectUploadJobs();
+
+    // Jobs are submitted and performed in queue order, so their fences signal in order too. Once a texture level is complete, allow sampling from it
+    size_t numFinished = 0;
+    while (numFinished < pendingUploads.size())
+    {
+        PendingUpload& upload = pendingUploads[numFinished];
+        if (!upload.fence)
+            break;
+
+        GLenum result = glClientWaitSync((GLsync)upload.fence, 0, 0);
+        if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+            break;
+
+        glDeleteSync((GLsync)upload.fence);
+        upload.fence = nullptr;
+        if (upload.texture)
+            upload.texture->SetBaseLevel(upload.level);
+        ++numFinished;
+    }
+
+    pendingUploads.erase(pendingUploads.begin(), pendingUploads.begin() + numFinished);
+
+    if (!uploadThreadRunning)
+        return;
+
+    std::vector<UploadJob> jobs;
+    for (auto it = pendingUploads.begin(); it != pendingUploads.end(); ++it)
+    {
+        if (it->jobId)
+            continue;
+
+        // Skip zero on wraparound, as it marks an unsubmitted upload
+        if (!++lastUploadJobId)
+            ++lastUploadJobId;
+        it->jobId = lastUploadJobId;
+
+        UploadJob job;
+        job.id = it->jobId;
+        job.texture = it->texture;
+        job.buffer = it->texture ? 0 : (it->vertexBuffer ? it->vertexBuffer->GLBuffer() : it->indexBuffer->GLBuffer());
+        job.level = it->level;
+        job.data = it->data;
+        job.offset = it->offset;
+        job.fence = nullptr;
+        jobs.push_back(job);
+    }
+
+    if (jobs.size())
+    {
+        {
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            uploadJobs.insert(uploadJobs.end(), jobs.begin(), jobs.end());
+        }
+        uploadCondition.notify_one();
+    }
+}
+
+void Graphics::WaitUploadJob(PendingUpload& upload)
+{
+    ZoneScoped;
+
+    {
+        std::unique_lock<std::mutex> lock(uploadMutex);
+        uploadFinishedCondition.wait(lock, [this, &upload]() {
+            for (auto it = finishedUploadJobs.begin(); it != finishedUploadJobs.end(); ++it)
+            {
+                if (it->id == upload.jobId)
+                    return true;
+            }
+            return false;
+        });
+    }
+
+    CollectUploadJobs();
+}
+
+void Graphics::CollectUploadJobs()
+{
+    std::vector<UploadJob> jobs;
+    {
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        jobs.swap(finishedUploadJobs);
+    }
+
+    // Finished jobs and the pending uploads are both in submission order, so the search continues from the previous match
+    auto uploadIt = pendingUploads.begin();
+    for (auto it = jobs.begin(); it != jobs.end(); ++it)
+    {
+        while (uploadIt->jobId != it->id)
+            ++uploadIt;
+        uploadIt->fence = it->fence;
+    }
+}
+
+void Graphics::UploadLoop()
+{
+    bool success = SDL_GL_MakeCurrent(uploadWindow, uploadContext) == 0;
+    if (success)
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    {
+        std::lock_guard<std::mutex> lock(uploadMutex);
+        uploadThreadStatus = success ? 1 : 0;
+    }
+    uploadFinishedCondition.notify_all();
+
+    if (!success)
+        return;
+
+    std::vector<UploadJob> jobs;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(uploadMutex);
+            uploadCondition.wait(lock, [this]() { return uploadJobs.size() || !uploadThreadRunning; });
+            // Perform the remaining jobs before exiting
+            if (uploadJobs.empty())
+                break;
+            jobs.swap(uploadJobs);
+        }
+
+        {
+            ZoneScopedN("UploadJobs");
+
+            for (auto it = jobs.begin(); it != jobs.end(); ++it)
+            {
+                if (it->texture)
+                    it->texture->UploadLevel(it->level, it->data);
+                else
+                {
+                    glBindBuffer(GL_COPY_WRITE_BUFFER, it->buffer);
+                    glBufferSubData(GL_COPY_WRITE_BUFFER, it->offset, it->data.dataSize, it->data.data);
+                }
+                it->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            }
+
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            // Flush so that the fences signal without this thread waiting for them
+            glFlush();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            finishedUploadJobs.insert(finishedUploadJobs.end(), jobs.begin(), jobs.end());
+        }
+        uploadFinishedCondition.notify_all();
+        jobs.clear();
+    }
+
+    glFinish();
+    SDL_GL_MakeCurrent(uploadWindow, nullptr);
+}
+
+SharedPtr<Readback> Graphics::RequestReadback(Texture* texture, size_t level, const IntRect& rect, const ReadbackCallback& callback)
+{
+    ZoneScoped;
+
+    if (!texture || !texture->GLTexture())
+        return SharedPtr<Readback>();
+
+    if (texture->TexType() != TEX_2D || texture->Multisample() > 1 || texture->IsCompressed())
+    {
+        LOGERROR("Can only read back uncompressed, non-multisampled 2D textures");
+        return SharedPtr<Readback>();
+    }
+
+    if (level >= texture->NumLevels())
+    {
+        LOGERROR("Mipmap level to read out of bounds");
+        return SharedPtr<Readback>();
+    }
+
+    int levelWidth = Max(texture->Width() >> (int)level, 1);
+    int levelHeight = Max(texture->Height() >> (int)level, 1);
+    IntRect readRect = rect.Width() > 0 && rect.Height() > 0 ? rect : IntRect(0, 0, levelWidth, levelHeight);
+    if (readRect.left < 0 || readRect.top < 0 || readRect.right > levelWidth || readRect.bottom > levelHeight)
+    {
+        LOGERROR("Readback rectangle out of bounds");
+        return SharedPtr<Readback>();
+    }
+
+    // Transfer size follows the data type, as half-float formats are read as floats
+    ImageFormat format = texture->Format();
+    size_t components;
+    switch (Texture::glFormats[format])
+    {
+    case GL_RG:
+    case GL_RG_INTEGER:
+        components = 2;
+        break;
+    case GL_RGB:
+        components = 3;
+        break;
+    case GL_RGBA:
+    case GL_RGBA_INTEGER:
+        components = 4;
+        break;
+    default:
+        components = 1;
+        break;
+    }
+    size_t componentSize = Texture::glDataTypes[format] == GL_UNSIGNED_BYTE ? 1 : Texture::glDataTypes[format] == GL_UNSIGNED_SHORT ? 2 : 4;
+
+    SharedPtr<Readback> readback(new Readback());
+    readback->format = format;
+    readback->rect = readRect;
+    readback->dataSize = readRect.Width() * readRect.Height() * components * componentSize;
+    readback->bufferIndex = AcquireReadbackBuffer(readback->dataSize);
+
+    if (!readbackFrameBuffer)
+        readbackFrameBuffer = new FrameBuffer();
+    readbackFrameBuffer->DefineRead(texture, level);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(readRect.left, readRect.top, readRect.Width(), readRect.Height(), Texture::glFormats[format], Texture::glDataTypes[format], nullptr);
+    readbackFrameBuffer->DefineRead(nullptr, 0);
+
+    QueueReadback(readback, callback);
+    return readback;
+}
+
+SharedPtr<Readback> Graphics::RequestReadback(VertexBuffer* buffer, size_t firstVertex, size_t numVertices, const ReadbackCallback& callback)
+{
+    ZoneScoped;
+
+    if (!buffer || !buffer->GLBuffer() || !numVertices)
+        return SharedPtr<Readback>();
+
+    if (firstVertex + numVertices > buffer->NumVertices())
+    {
+        LOGERROR("Readback range out of bounds");
+        return SharedPtr<Readback>();
+    }
+
+    SharedPtr<Readback> readback(new Readback());
+    readback->dataSize = numVertices * buffer->VertexSize();
+    readback->bufferIndex = AcquireReadbackBuffer(readback->dataSize);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer->GLBuffer());
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_PIXEL_PACK_BUFFER, firstVertex * buffer->VertexSize(), 0, readback->dataSize);
+
+    QueueReadback(readback, callback);
+    return readback;
+}
+
+void Graphics::ProcessReadbacks()
+{
+    if (pendingReadbacks.empty() && readbackBuffers.empty())
+        return;
+
+    ZoneScoped;
+
+    // The GPU finishes the copies in order, so stop at the first that is still running
+    size_t numFinished = 0;
+    while (numFinished < pendingReadbacks.size())
+    {
+        Readback* readback = pendingReadbacks[numFinished];
+        GLenum result = glClientWaitSync((GLsync)readback->fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED)
+            break;
+
+        glDeleteSync((GLsync)readback->fence);
+        readback->fence = nullptr;
+        readback->pending = false;
+
+        PooledReadbackBuffer& pooled = readbackBuffers[readback->bufferIndex];
+        if (result != GL_WAIT_FAILED)
+        {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pooled.buffer);
+            void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback->dataSize, GL_MAP_READ_BIT);
+            if (mapped)
+            {
+                readback->data.resize(readback->dataSize);
+                memcpy(&readback->data[0], mapped, readback->dataSize);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                readback->ready = true;
+                readback->readyFrame = frameNumber;
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        if (!readback->ready)
+            LOGERROR("Failed to read back GPU data");
+
+        pooled.inUse = false;
+        pooled.lastUseFrame = frameNumber;
+        ++numFinished;
+    }
+
+    if (numFinished)
     {
-        LOGERROR("Could not create OpenGL 3.2 context");
-        return false;
+        // Remove the finished readbacks before the callbacks, which may request more
+        std::vector<SharedPtr<Readback> > finished(pendingReadbacks.begin(), pendingReadbacks.begin() + numFinished);
+        pendingReadbacks.erase(pendingReadbacks.begin(), pendingReadbacks.begin() + numFinished);
+
+        for (auto it = finished.begin(); it != finished.end(); ++it)
+        {
+            Readback* readback = *it;
+            if (readback->callback)
+            {
+                ReadbackCallback callback = readback->callback;
+                readback->callback = nullptr;
+                callback(readback);
+            }
+        }
     }
 
-    GLenum err = glewInit();
-    if (err != GLEW_OK || !GLEW_VERSION_3_2)
+    // Destroy the pool's trailing buffers unused for long. Pending readbacks refer to the others by index
+    while (readbackBuffers.size() && !readbackBuffers.back().inUse && frameNumber - readbackBuffers.back().lastUseFrame > READBACK_BUFFER_KEEP_FRAMES)
     {
-        LOGERROR("Could not initialize OpenGL 3.2");
-        return false;
+        glDeleteBuffers(1, &readbackBuffers.back().buffer);
+        readbackBuffers.pop_back();
     }
+}
 
-    glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_MULTISAMPLE);
-    glClearDepth(1.0f);
-    glDepthRange(0.0f, 1.0f);
-    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-    glDepthMask(GL_TRUE);
+void Graphics::Finish()
+{
+    ZoneScoped;
 
-    GLuint defaultVao;
-    glGenVertexArrays(1, &defaultVao);
-    glBindVertexArray(defaultVao);
+    glFinish();
+}
 
-    // Use texcoords 3-5 for instancing if supported
-    if (glVertexAttribDivisorARB)
+size_t Graphics::AcquireReadbackBuffer(size_t size)
+{
+    // Prefer the smallest free buffer that fits, then grow a free one, and create one only if all are in use
+    size_t bestIndex = M_MAX_UNSIGNED;
+    for (size_t i = 0; i < readbackBuffers.size(); ++i)
     {
-        hasInstancing = true;
+        const PooledReadbackBuffer& pooled = readbackBuffers[i];
+        if (pooled.inUse)
+            continue;
+        if (bestIndex == M_MAX_UNSIGNED)
+            bestIndex = i;
+        else
+        {
+            const PooledReadbackBuffer& best = readbackBuffers[bestIndex];
+            if ((pooled.size >= size && (best.size < size || pooled.size < best.size)) || (best.size < size && pooled.size > best.size))
+                bestIndex = i;
+        }
+    }
 
-        glVertexAttribDivisorARB(ATTR_TEXCOORD3, 1);
-        glVertexAttribDivisorARB(ATTR_TEXCOORD4, 1);
-        glVertexAttribDivisorARB(ATTR_TEXCOORD5, 1);
+    if (bestIndex == M_MAX_UNSIGNED)
+    {
+        PooledReadbackBuffer pooled;
+        glGenBuffers(1, &pooled.buffer);
+        pooled.size = 0;
+        pooled.inUse = false;
+        pooled.lastUseFrame = frameNumber;
+        bestIndex = readbackBuffers.size();
+        readbackBuffers.push_back(pooled);
     }
 
-    DefineQuadVertexBuffer();
+    PooledReadbackBuffer& pooled = readbackBuffers[bestIndex];
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pooled.buffer);
+    if (pooled.size < size)
+    {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+        pooled.size = size;
+    }
 
-    SetVSync(vsync);
-    return true;
+    pooled.inUse = true;
+    pooled.lastUseFrame = frameNumber;
+    return bestIndex;
 }
 
-void Graphics::Resize(const IntVector2& size)
+void Graphics::QueueReadback(Readback* readback, const ReadbackCallback& callback)
 {
-    SDL_SetWindowSize(window, size.x, size.y);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    readback->callback = callback;
+    readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback->requestFrame = frameNumber;
+    readback->pending = true;
+    pendingReadbacks.push_back(SharedPtr<Readback>(readback));
 }
 
-void Graphics::SetFullscreen(bool enable)
+void Graphics::SetFrameBuffer(FrameBuffer* buffer)
 {
-    SDL_SetWindowFullscreen(window, enable ? SDL_WINDOW_FULLSCREEN : 0);
+    if (buffer)
+        buffer->Bind();
+    else
+        FrameBuffer::Unbind();
 }
 
-void Graphics::SetVSync(bool enable)
+void Graphics::BeginGpuTimer(const char* name)
 {
-    if (IsInitialized())
+    if (!gpuTimers)
+        return;
+
+    GpuTimerFrame& frame = gpuTimerFrames[gpuTimerFrame];
+    if (frame.numQueries + 2 > frame.queries.size())
     {
-        SDL_GL_SetSwapInterval(enable ? 1 : 0);
-        vsync = enable;
+        size_t oldSize = frame.queries.size();
+        frame.queries.resize(Max(oldSize * 2, (size_t)32));
+        glGenQueries((GLsizei)(frame.queries.size() - oldSize), &frame.queries[oldSize]);
     }
-}
 
-void Graphics::Present()
-{
-    ZoneScoped;
+    GpuTimerBlock block;
+    block.name = name;
+    block.depth = gpuTimerStack.size();
+    block.query = frame.numQueries;
+    glQueryCounter(frame.queries[block.query], GL_TIMESTAMP);
+    frame.numQueries += 2;
 
-    SDL_GL_SwapWindow(window);
+    gpuTimerStack.push_back(frame.blocks.size());
+    frame.blocks.push_back(block);
+
+#ifdef TRACY_ENABLE
+    tracyGpuZones.push_back(new tracy::GpuCtxScope(__LINE__, __FILE__, strlen(__FILE__), __func__, strlen(__func__), name, strlen(name), true));
+#endif
 }
 
-void Graphics::SetFrameBuffer(FrameBuffer* buffer)
+void Graphics::EndGpuTimer()
 {
-    if (buffer)
-        buffer->Bind();
-    else
-        FrameBuffer::Unbind();
+    if (!gpuTimers || gpuTimerStack.empty())
+        return;
+
+#ifdef TRACY_ENABLE
+    delete static_cast<tracy::GpuCtxScope*>(tracyGpuZones.back());
+    tracyGpuZones.pop_back();
+#endif
+
+    GpuTimerFrame& frame = gpuTimerFrames[gpuTimerFrame];
+    glQueryCounter(frame.queries[frame.blocks[gpuTimerStack.back()].query + 1], GL_TIMESTAMP);
+    gpuTimerStack.pop_back();
 }
 
 void Graphics::SetViewport(const IntRect& viewRect)
 {
+    bool filtered = viewRect == lastViewport;
+    CountStateCall(STATE_VIEWPORT, filtered);
+    if (filtered)
+        return;
+
+    lastViewport = viewRect;
     glViewport(viewRect.left, viewRect.top, viewRect.right - viewRect.left, viewRect.bottom - viewRect.top);
 }
 
+void Graphics::SetViewports(const IntRect* viewRects, size_t count)
+{
+    if (!hasViewportArray)
+        return;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const IntRect& viewRect = viewRects[i];
+        glViewportIndexedf((GLuint)i, (float)viewRect.left, (float)viewRect.top, (float)(viewRect.right - viewRect.left), (float)(viewRect.bottom - viewRect.top));
+    }
+
+    CountStateCall(STATE_VIEWPORT, false);
+    // Force the next single viewport to be set again
+    lastViewport = IntRect::ZERO;
+}
+
 ShaderProgram* Graphics::SetProgram(const std::string& shaderName, const std::string& vsDefines, const std::string& fsDefines)
 {
     ResourceCache* cache = Subsystem<ResourceCache>();
@@ -249,6 +1448,20 @@ ShaderProgram* Graphics::SetProgram(const std::string& shaderName, const std::st
     return program->Bind() ? program : nullptr;
 }
 
+ShaderProgram* Graphics::SetComputeProgram(const std::string& shaderName, const std::string& defines)
+{
+    if (!hasComputeShaders)
+        return nullptr;
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    Shader* shader = cache->LoadResource<Shader>(shaderName);
+    if (!shader)
+        return nullptr;
+
+    ShaderProgram* program = shader->CreateComputeProgram(defines);
+    return program->Bind() ? program : nullptr;
+}
+
 void Graphics::SetUniform(ShaderProgram* program, PresetUniform uniform, float value)
 {
     if (program)
@@ -309,6 +1522,66 @@ void Graphics::SetUniform(ShaderProgram* program, PresetUniform uniform, const M
     }
 }
 
+void Graphics::SetUniform(ShaderProgram* program, UniformSlot uniform, float value)
+{
+    if (program)
+    {
+        int location = program->Uniform(uniform);
+        if (location >= 0)
+            glUniform1f(location, value);
+    }
+}
+
+void Graphics::SetUniform(ShaderProgram* program, UniformSlot uniform, const Vector2& value)
+{
+    if (program)
+    {
+        int location = program->Uniform(uniform);
+        if (location >= 0)
+            glUniform2fv(location, 1, value.Data());
+    }
+}
+
+void Graphics::SetUniform(ShaderProgram* program, UniformSlot uniform, const Vector3& value)
+{
+    if (program)
+    {
+        int location = program->Uniform(uniform);
+        if (location >= 0)
+            glUniform3fv(location, 1, value.Data());
+    }
+}
+
+void Graphics::SetUniform(ShaderProgram* program, UniformSlot uniform, const Vector4& value)
+{
+    if (program)
+    {
+        int location = program->Uniform(uniform);
+        if (location >= 0)
+            glUniform4fv(location, 1, value.Data());
+    }
+}
+
+void Graphics::SetUniform(ShaderProgram* program, UniformSlot uniform, const Matrix3x4& value)
+{
+    if (program)
+    {
+        int location = program->Uniform(uniform);
+        if (location >= 0)
+            glUniformMatrix3x4fv(location, 1, GL_FALSE, value.Data());
+    }
+}
+
+void Graphics::SetUniform(ShaderProgram* program, UniformSlot uniform, const Matrix4& value)
+{
+    if (program)
+    {
+        int location = program->Uniform(uniform);
+        if (location >= 0)
+            glUniformMatrix4fv(location, 1, GL_FALSE, value.Data());
+    }
+}
+
 void Graphics::SetUniform(ShaderProgram* program, const char* name, float value)
 {
     if (program)
@@ -385,6 +1658,28 @@ void Graphics::SetTexture(size_t index, Texture* texture)
         Texture::Unbind(index);
 }
 
+void Graphics::SetBindlessTexture(ShaderProgram* program, size_t index, Texture* texture)
+{
+    if (!program || !hasBindlessTextures)
+        return;
+
+    int location = program->SamplerUniform(index);
+    if (location < 0)
+        return;
+
+    unsigned long long handle = texture ? texture->BindlessHandle() : 0;
+    if (handle)
+        glUniformHandleui64ARB(location, handle);
+    else
+    {
+        // Fall back to the texture unit, binding the texture if it has no handle, for example a block compressed format the driver can not make resident
+        int unit = (int)index;
+        glUniform1iv(location, 1, &unit);
+        if (texture)
+            texture->Bind(index);
+    }
+}
+
 void Graphics::SetVertexBuffer(VertexBuffer* buffer, ShaderProgram* program)
 {
     if (buffer && program)
@@ -399,6 +1694,11 @@ void Graphics::SetIndexBuffer(IndexBuffer* buffer)
 
 void Graphics::SetRenderState(BlendMode blendMode, CullMode cullMode, CompareMode depthTest, bool colorWrite, bool depthWrite)
 {
+    CountStateCall(STATE_RENDERSTATE, blendMode == lastBlendMode && cullMode == lastCullMode && depthTest == lastDepthTest && colorWrite == lastColorWrite &&
+        depthWrite == lastDepthWrite);
+
+    lastPipelineState.Reset();
+
     if (blendMode != lastBlendMode)
     {
         if (blendMode == BLEND_REPLACE)
@@ -406,7 +1706,7 @@ void Graphics::SetRenderState(BlendMode blendMode, CullMode cullMode, CompareMod
         else
         {
             glEnable(GL_BLEND);
-            glBlendFunc(glSrcBlend[blendMode], glDestBlend[blendMode]);
+            glBlendFuncSeparate(glSrcBlend[blendMode], glDestBlend[blendMode], glSrcAlphaBlend[blendMode], glDestAlphaBlend[blendMode]);
             glBlendEquation(glBlendOp[blendMode]);
         }
 
@@ -448,6 +1748,22 @@ void Graphics::SetRenderState(BlendMode blendMode, CullMode cullMode, CompareMod
     }
 }
 
+bool Graphics::SetPipelineState(PipelineState* state)
+{
+    if (!state || !state->Program()->Bind())
+        return false;
+
+    if (state == lastPipelineState)
+        CountStateCall(STATE_RENDERSTATE, true);
+    else
+    {
+        SetRenderState(state->GetBlendMode(), state->GetCullMode(), state->GetDepthTest(), state->GetColorWrite(), state->GetDepthWrite());
+        lastPipelineState = state;
+    }
+
+    return true;
+}
+
 void Graphics::SetDepthBias(float constantBias, float slopeScaleBias)
 {
     if (constantBias <= 0.0f && slopeScaleBias <= 0.0f)
@@ -466,7 +1782,12 @@ void Graphics::SetDepthBias(float constantBias, float slopeScaleBias)
             lastDepthBias = true;
         }
 
-        glPolygonOffset(slopeScaleBias, constantBias);
+        if (constantBias != lastConstantBias || slopeScaleBias != lastSlopeScaleBias)
+        {
+            glPolygonOffset(slopeScaleBias, constantBias);
+            lastConstantBias = constantBias;
+            lastSlopeScaleBias = slopeScaleBias;
+        }
     }
 }
 
@@ -477,11 +1798,13 @@ void Graphics::Clear(bool clearColor, bool clearDepth, const IntRect& clearRect,
         glClearColor(backgroundColor.r, backgroundColor.g, backgroundColor.b, backgroundColor.a);
         glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
         lastColorWrite = true;
+        lastPipelineState.Reset();
     }
     if (clearDepth)
     {
         glDepthMask(GL_TRUE);
         lastDepthWrite = true;
+        lastPipelineState.Reset();
     }
 
     GLenum glClearBits = 0;
@@ -514,32 +1837,71 @@ void Graphics::Blit(FrameBuffer* dest, const IntRect& destRect, FrameBuffer* src
     glBlitFramebuffer(srcRect.left, srcRect.top, srcRect.right, srcRect.bottom, destRect.left, destRect.top, destRect.right, destRect.bottom, glBlitBits, filter == FILTER_POINT ? GL_NEAREST : GL_LINEAR);
 }
 
-void Graphics::Draw(PrimitiveType type, size_t drawStart, size_t drawCount)
+bool Graphics::CopyTexture(Texture* dest, Texture* src, const std::vector<IntRect>& rects)
 {
-    if (instancingEnabled)
+    if (!dest || !src || dest->TexType() != TEX_2D || src->TexType() != TEX_2D)
+    {
+        LOGERROR("Texture copy requires 2D source and destination textures");
+        return false;
+    }
+    if (rects.empty())
+        return true;
+
+    if (hasCopyImage && dest->Format() == src->Format())
+    {
+        for (auto it = rects.begin(); it != rects.end(); ++it)
+        {
+            glCopyImageSubData(src->GLTexture(), src->GLTarget(), 0, it->left, it->top, 0, dest->GLTexture(), dest->GLTarget(), 0, it->left, it->top, 0,
+                it->Width(), it->Height(), 1);
+        }
+        return true;
+    }
+
+    bool depth = src->Format() >= FMT_D16 && src->Format() <= FMT_D24S8;
+    if (depth != (dest->Format() >= FMT_D16 && dest->Format() <= FMT_D24S8))
+    {
+        LOGERROR("Incompatible textures for copy");
+        return false;
+    }
+
+    for (size_t i = 0; i < 2; ++i)
     {
-        glDisableVertexAttribArray(ATTR_TEXCOORD3);
-        glDisableVertexAttribArray(ATTR_TEXCOORD4);
-        glDisableVertexAttribArray(ATTR_TEXCOORD5);
-        instancingEnabled = false;
+        if (!copyFrameBuffers[i])
+            copyFrameBuffers[i] = new FrameBuffer();
     }
 
+    copyFrameBuffers[0]->Define(depth ? nullptr : dest, depth ? dest : nullptr);
+    copyFrameBuffers[1]->Define(depth ? nullptr : src, depth ? src : nullptr);
+    FrameBuffer::Bind(copyFrameBuffers[0], copyFrameBuffers[1]);
+
+    for (auto it = rects.begin(); it != rects.end(); ++it)
+        glBlitFramebuffer(it->left, it->top, it->right, it->bottom, it->left, it->top, it->right, it->bottom, depth ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    // Detach so that the textures are not kept attached to the framebuffers
+    copyFrameBuffers[0]->Define((Texture*)nullptr, (Texture*)nullptr);
+    copyFrameBuffers[1]->Define((Texture*)nullptr, (Texture*)nullptr);
+    FrameBuffer::Unbind();
+    return true;
+}
+
+void Graphics::Draw(PrimitiveType type, size_t drawStart, size_t drawCount)
+{
+    VertexBuffer::EnableInstanceAttributes(false);
+
     glDrawArrays(glPrimitiveTypes[type], (GLsizei)drawStart, (GLsizei)drawCount);
+    CountDraw(type, drawCount, 1);
 }
 
 void Graphics::DrawIndexed(PrimitiveType type, size_t drawStart, size_t drawCount)
 {
-    if (instancingEnabled)
-    {
-        glDisableVertexAttribArray(ATTR_TEXCOORD3);
-        glDisableVertexAttribArray(ATTR_TEXCOORD4);
-        glDisableVertexAttribArray(ATTR_TEXCOORD5);
-        instancingEnabled = false;
-    }
+    VertexBuffer::EnableInstanceAttributes(false);
 
     unsigned indexSize = (unsigned)IndexBuffer::BoundIndexSize();
     if (indexSize)
+    {
         glDrawElements(glPrimitiveTypes[type], (GLsizei)drawCount, indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(drawStart * indexSize));
+        CountDraw(type, drawCount, 1);
+    }
 }
 
 void Graphics::DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, VertexBuffer* instanceVertexBuffer, size_t instanceStart, size_t instanceCount)
@@ -549,21 +1911,10 @@ void Graphics::DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCo
 
     if (instanceVertexBuffer)
     {
-        if (!instancingEnabled)
-        {
-            glEnableVertexAttribArray(ATTR_TEXCOORD3);
-            glEnableVertexAttribArray(ATTR_TEXCOORD4);
-            glEnableVertexAttribArray(ATTR_TEXCOORD5);
-            instancingEnabled = true;
-        }
-
-        unsigned instanceVertexSize = (unsigned)instanceVertexBuffer->VertexSize();
-
-        instanceVertexBuffer->Bind(0);
-        glVertexAttribPointer(ATTR_TEXCOORD3, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize));
-        glVertexAttribPointer(ATTR_TEXCOORD4, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + sizeof(Vector4)));
-        glVertexAttribPointer(ATTR_TEXCOORD5, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + 2 * sizeof(Vector4)));
+        VertexBuffer::EnableInstanceAttributes(true);
+        SetInstanceAttributes(instanceVertexBuffer, instanceStart);
         glDrawArraysInstanced(glPrimitiveTypes[type], (GLint)drawStart, (GLsizei)drawCount, (GLsizei)instanceCount);
+        CountDraw(type, drawCount, instanceCount);
     }
 }
 
@@ -576,21 +1927,30 @@ void Graphics::DrawIndexedInstanced(PrimitiveType type, size_t drawStart, size_t
 
     if (indexSize && instanceVertexBuffer)
     {
-        if (!instancingEnabled)
-        {
-            glEnableVertexAttribArray(ATTR_TEXCOORD3);
-            glEnableVertexAttribArray(ATTR_TEXCOORD4);
-            glEnableVertexAttribArray(ATTR_TEXCOORD5);
-            instancingEnabled = true;
-        }
+        VertexBuffer::EnableInstanceAttributes(true);
+        SetInstanceAttributes(instanceVertexBuffer, instanceStart);
+        glDrawElementsInstanced(glPrimitiveTypes[type], (GLsizei)drawCount, indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(drawStart * indexSize), (GLsizei)instanceCount);
+        CountDraw(type, drawCount, instanceCount);
+    }
+}
 
-        unsigned instanceVertexSize = (unsigned)instanceVertexBuffer->VertexSize();
+void Graphics::MultiDrawIndexedIndirect(PrimitiveType type, VertexBuffer* instanceVertexBuffer, size_t instanceStart, IndirectBuffer* indirectBuffer, size_t commandStart, size_t commandCount)
+{
+    if (!hasMultiDrawIndirect)
+        return;
 
-        instanceVertexBuffer->Bind(0);
-        glVertexAttribPointer(ATTR_TEXCOORD3, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize));
-        glVertexAttribPointer(ATTR_TEXCOORD4, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + sizeof(Vector4)));
-        glVertexAttribPointer(ATTR_TEXCOORD5, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + 2 * sizeof(Vector4)));
-        glDrawElementsInstanced(glPrimitiveTypes[type], (GLsizei)drawCount, indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(drawStart * indexSize), (GLsizei)instanceCount);
+    unsigned indexSize = (unsigned)IndexBuffer::BoundIndexSize();
+
+    if (indexSize && instanceVertexBuffer && indirectBuffer && commandCount)
+    {
+        VertexBuffer::EnableInstanceAttributes(true);
+        SetInstanceAttributes(instanceVertexBuffer, instanceStart);
+
+        indirectBuffer->Bind();
+        glMultiDrawElementsIndirect(glPrimitiveTypes[type], indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(commandStart * sizeof(IndirectDrawCommand)),
+            (GLsizei)commandCount, 0);
+        // The draw commands are on the GPU, so the triangles can not be counted here
+        CountDraw(type, 0, 0);
     }
 }
 
@@ -600,6 +1960,55 @@ void Graphics::DrawQuad()
     Draw(PT_TRIANGLE_LIST, 0, 6);
 }
 
+void Graphics::DispatchCompute(const IntVector3& numGroups)
+{
+    if (!hasComputeShaders || numGroups.x <= 0 || numGroups.y <= 0 || numGroups.z <= 0)
+        return;
+
+    glDispatchCompute(numGroups.x, numGroups.y, numGroups.z);
+}
+
+void Graphics::ComputeBarrier()
+{
+    if (hasComputeShaders)
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void Graphics::VertexDataBarrier()
+{
+    if (hasComputeShaders)
+        glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void Graphics::StorageBarrier()
+{
+    if (hasComputeShaders)
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void Graphics::DrawCommandBarrier()
+{
+    if (hasComputeShaders)
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+void Graphics::RenderTargetBarrier()
+{
+    if (hasComputeShaders)
+        glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+bool Graphics::IsUploadPending(const RefCounted* target) const
+{
+    for (auto it = pendingUploads.begin(); it != pendingUploads.end(); ++it)
+    {
+        if (it->texture == target || it->vertexBuffer == target || it->indexBuffer == target)
+            return true;
+    }
+
+    return false;
+}
+
 IntVector2 Graphics::Size() const
 {
     IntVector2 size;
@@ -619,6 +2028,88 @@ bool Graphics::IsFullscreen() const
     return (SDL_GetWindowFlags(window) & SDL_WINDOW_FULLSCREEN) != 0;
 }
 
+void Graphics::CollectGpuTimers()
+{
+    // Close blocks left open at the end of the frame
+    while (gpuTimerStack.size())
+        EndGpuTimer();
+
+    // Move on to the oldest buffered frame, which is reused for recording the next
+    gpuTimerFrame = (gpuTimerFrame + 1) % GPU_TIMER_FRAMES;
+    GpuTimerFrame& frame = gpuTimerFrames[gpuTimerFrame];
+
+    if (frame.numQueries)
+    {
+        // Timestamps complete in order, so check only the last. If it is not available, the GPU is lagging
+        // more than the buffered frames; drop the results rather than stall
+        GLint available = 0;
+        glGetQueryObjectiv(frame.queries[frame.numQueries - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available)
+        {
+            Profiler* profiler = Subsystem<Profiler>();
+            gpuTimerResults.clear();
+            gpuTimerResultsFrame = frameNumber;
+
+            // Map the GPU timestamps to the trace recorder's clock by comparing against the current GPU time
+            TraceRecorder* traceRecorder = Subsystem<TraceRecorder>();
+            long long traceOffset = 0;
+            if (traceRecorder && traceRecorder->IsEnabled())
+            {
+                GLint64 gpuTime = 0;
+                glGetInteger64v(GL_TIMESTAMP, &gpuTime);
+                traceOffset = traceRecorder->Now() - gpuTime / 1000;
+            }
+
+            for (auto it = frame.blocks.begin(); it != frame.blocks.end(); ++it)
+            {
+                GLuint64 beginTime = 0;
+                GLuint64 endTime = 0;
+                glGetQueryObjectui64v(frame.queries[it->query], GL_QUERY_RESULT, &beginTime);
+                glGetQueryObjectui64v(frame.queries[it->query + 1], GL_QUERY_RESULT, &endTime);
+
+                GpuTimerResult result;
+                result.name = it->name;
+                result.depth = it->depth;
+                result.time = endTime > beginTime ? (long long)((endTime - beginTime) / 1000) : 0;
+                gpuTimerResults.push_back(result);
+
+                if (profiler)
+                    profiler->AddGpuTime(result.name, result.depth, result.time);
+                if (traceRecorder)
+                    traceRecorder->AddGpuEvent(result.name, (long long)(beginTime / 1000) + traceOffset, (long long)(endTime / 1000) + traceOffset);
+            }
+        }
+    }
+
+    frame.numQueries = 0;
+    frame.blocks.clear();
+}
+
+void Graphics::UpdateRenderTargets()
+{
+    for (auto it = renderTargets.begin(); it != renderTargets.end();)
+    {
+        it->inUse = false;
+
+        if (frameNumber - it->lastUseFrame > RENDER_TARGET_KEEP_FRAMES)
+        {
+            // Destroy the framebuffers referring to the texture first
+            Texture* texture = it->texture;
+            for (auto fit = renderTargetFrameBuffers.begin(); fit != renderTargetFrameBuffers.end();)
+            {
+                if (fit->colorTexture == texture || fit->depthStencilTexture == texture)
+                    fit = renderTargetFrameBuffers.erase(fit);
+                else
+                    ++fit;
+            }
+
+            it = renderTargets.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
 void Graphics::DefineQuadVertexBuffer()
 {
     float quadVertexData[] = {
@@ -5,26 +5,164 @@
 #include "../IO/JSONValue.h"
 #include "../Math/Color.h"
 #include "../Math/IntRect.h"
+#include "../Math/IntVector3.h"
 #include "../Math/Matrix3x4.h"
 #include "../Object/Object.h"
+#include "../Resource/Image.h"
+#include "../Time/Timer.h"
 #include "GraphicsDefs.h"
+#include "Readback.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 class FrameBuffer;
 class IndexBuffer;
+class IndirectBuffer;
+class PipelineState;
 class ShaderProgram;
 class Texture;
 class UniformBuffer;
 class VertexBuffer;
 struct SDL_Window;
 
+/// Texture level or buffer range waiting to be uploaded through the staging buffer.
+struct PendingUpload
+{
+    /// Destination texture, or null if uploading to a buffer.
+    Texture* texture;
+    /// Destination vertex buffer.
+    VertexBuffer* vertexBuffer;
+    /// Destination index buffer.
+    IndexBuffer* indexBuffer;
+    /// Texture mip level.
+    size_t level;
+    /// Source data. For buffers only the data pointer and size are used.
+    ImageLevel data;
+    /// Destination offset in bytes for buffers.
+    size_t offset;
+    /// Texture rows or buffer bytes uploaded so far.
+    size_t progress;
+    /// Object that owns the texture source data.
+    SharedPtr<RefCounted> owner;
+    /// Array that owns the buffer source data.
+    SharedArrayPtr<unsigned char> arrayOwner;
+    /// Job id on the upload thread, or zero if not submitted.
+    unsigned jobId;
+    /// Fence inserted by the upload thread after the upload, or null if not finished on the upload thread.
+    void* fence;
+};
+
+/// Whole upload performed by the upload thread. Holds no references, as the pending upload keeps the source data and destination alive until the job is finished.
+struct UploadJob
+{
+    /// Job id.
+    unsigned id;
+    /// Destination texture, or null if uploading to a buffer.
+    Texture* texture;
+    /// Destination buffer object.
+    unsigned buffer;
+    /// Texture mip level.
+    size_t level;
+    /// Source data. For buffers only the data pointer and size are used.
+    ImageLevel data;
+    /// Destination offset in bytes for buffers.
+    size_t offset;
+    /// Fence inserted after the upload.
+    void* fence;
+};
+
+/// Texture in the transient render target pool.
+struct PooledRenderTarget
+{
+    /// Render target texture.
+    SharedPtr<Texture> texture;
+    /// Whether is handed out for the current frame.
+    bool inUse;
+    /// Frame number of the last use.
+    unsigned lastUseFrame;
+};
+
+/// Pixel pack buffer in the readback buffer pool.
+struct PooledReadbackBuffer
+{
+    /// OpenGL buffer object identifier.
+    unsigned buffer;
+    /// Size in bytes.
+    size_t size;
+    /// Whether is holding the data of a pending readback.
+    bool inUse;
+    /// Frame number of the last use.
+    unsigned lastUseFrame;
+};
+
+/// Framebuffer cached for a combination of transient render targets.
+struct PooledFrameBuffer
+{
+    /// Color texture, or null if none.
+    Texture* colorTexture;
+    /// Depth-stencil texture, or null if none.
+    Texture* depthStencilTexture;
+    /// Framebuffer object.
+    SharedPtr<FrameBuffer> frameBuffer;
+};
+
+/// Buffer swap synchronization modes.
+enum PresentMode
+{
+    PRESENT_IMMEDIATE = 0,
+    PRESENT_VSYNC,
+    PRESENT_ADAPTIVE_VSYNC
+};
+
+/// Number of present-to-present intervals kept for frame time smoothing and jitter measurement.
+static const size_t FRAME_TIME_HISTORY = 32;
+
+/// Number of frames that GPU timer queries are buffered for, so that reading their results never stalls.
+static const size_t GPU_TIMER_FRAMES = 3;
+
+/// GPU timer block recorded in a frame.
+struct GpuTimerBlock
+{
+    /// Block name.
+    const char* name;
+    /// Nesting depth.
+    size_t depth;
+    /// Index of the begin timestamp query. The end timestamp follows.
+    size_t query;
+};
+
+/// GPU execution time of a timer block.
+struct GpuTimerResult
+{
+    /// Block name.
+    const char* name;
+    /// Nesting depth.
+    size_t depth;
+    /// Time in microseconds.
+    long long time;
+};
+
+/// Timestamp queries and timer blocks of one buffered frame.
+struct GpuTimerFrame
+{
+    /// Query objects, reused between frames.
+    std::vector<unsigned> queries;
+    /// Number of queries used.
+    size_t numQueries;
+    /// Timer blocks in begin order.
+    std::vector<GpuTimerBlock> blocks;
+};
+
 /// %Graphics rendering context and application window.
 class Graphics : public Object
 {
     OBJECT(Graphics);
 
 public:
-    /// Create window with initial size and register subsystem and object. Rendering context is not created yet.
-    Graphics(const char* windowTitle, const IntVector2& windowSize);
+    /// Create window with initial size and register subsystem and object. Rendering context is not created yet. In headless mode the window is hidden and the offscreen video driver is preferred, which creates the context on an EGL pbuffer without a display, for rendering only into framebuffers, for example on a render farm. Present() then does not swap buffers.
+    Graphics(const char* windowTitle, const IntVector2& windowSize, bool headless = false);
     /// Destruct. Closes the application window.
     ~Graphics();
 
@@ -34,17 +172,59 @@ public:
     void Resize(const IntVector2& size);
     /// Set fullscreen mode.
     void SetFullscreen(bool enable);
-    /// Set vertical sync on/off.
+    /// Set vertical sync on/off. Same as setting the present mode to vsync or immediate.
     void SetVSync(bool enable);
-    /// Present the contents of the backbuffer.
+    /// Set the buffer swap synchronization mode. Adaptive vsync waits for the vertical blank only when the frame is on time, and swaps immediately with tearing when it is late, instead of waiting for the next one and halving the frame rate. Falls back to vsync when not supported.
+    void SetPresentMode(PresentMode mode);
+    /// Set the frame rate limit, which Present() enforces by sleeping until shortly before the frame is due and spinning for the rest, as sleeping alone is too coarse. Zero (default) disables.
+    void SetFrameRateLimit(float fps);
+    /// Set the number of present-to-present intervals averaged into the frame time. One (default) returns the last interval.
+    void SetFrameTimeSmoothing(size_t frames);
+    /// Set whether to report the frame time and present-to-present jitter to the profiler as counters in microseconds.
+    void SetJitterReporting(bool enable);
+    /// Present the contents of the backbuffer. Processes the queued uploads afterward.
     void Present();
+    /// Set the number of bytes to upload per frame through the staging buffer. Zero (default) to upload immediately.
+    void SetUploadBudget(size_t bytesPerFrame);
+    /// Set whether to upload the queued data on a separate thread, which owns an OpenGL context shared with the main context and a hidden window. The thread uploads each texture level or buffer range whole and fences it, and Present() finishes the uploads whose fences have signaled, so the main thread does not block on the transfers. Textures and buffers are still created on the main thread. Return true on success, or false if the shared context could not be created, in which case the uploads stay on the main thread.
+    bool SetUploadThread(bool enable);
+    /// Set the directory for saving linked shader program binaries and their reflection data, so that later runs skip compiling and linking. The directory is created if necessary. Empty (default) to disable. Requires program binary support.
+    void SetProgramCacheDir(const std::string& pathName);
+    /// Set whether to measure GPU time of timer blocks with timestamp queries. The results are read a few frames later to not stall, and are reported to the profiler. Requires timer query support.
+    void SetGpuTimers(bool enable);
+    /// Queue a texture mip level to be uploaded in row bands under the upload budget, or whole on the upload thread. The owner keeps the source data alive.
+    void QueueUpload(Texture* texture, size_t level, const ImageLevel& data, RefCounted* owner);
+    /// Queue a range of vertices to be uploaded under the upload budget. The buffer must have been defined without data.
+    void QueueUpload(VertexBuffer* buffer, size_t firstVertex, size_t numVertices, const SharedArrayPtr<unsigned char>& data);
+    /// Queue a range of indices to be uploaded under the upload budget. The buffer must have been defined without data.
+    void QueueUpload(IndexBuffer* buffer, size_t firstIndex, size_t numIndices, const SharedArrayPtr<unsigned char>& data);
+    /// Upload queued data up to the budget, or submit it to the upload thread and finish the uploads whose fences have signaled. Called by Present().
+    void ProcessUploads();
+    /// Remove the queued uploads of a texture or buffer. Called when it is released. Waits for an upload in progress on the upload thread.
+    void CancelUploads(const RefCounted* target);
+    /// Request an asynchronous readback of a rectangle of a 2D texture mip level. An empty rectangle reads the whole level. The readback finishes a few frames later; poll it, or give a callback which is called from Present(). Return null on error.
+    SharedPtr<Readback> RequestReadback(Texture* texture, size_t level, const IntRect& rect = IntRect::ZERO, const ReadbackCallback& callback = ReadbackCallback());
+    /// Request an asynchronous readback of a range of vertices. Return null on error.
+    SharedPtr<Readback> RequestReadback(VertexBuffer* buffer, size_t firstVertex, size_t numVertices, const ReadbackCallback& callback = ReadbackCallback());
+    /// Read out the readbacks whose copies have finished on the GPU and call their callbacks. Called by Present().
+    void ProcessReadbacks();
+    /// Wait until the GPU has finished all submitted commands, so that the pending readbacks finish on the next ProcessReadbacks() call. Stalls, so meant for shutdown and batch processing.
+    void Finish();
 
     /// Bind a framebuffer for rendering. Null buffer parameter to unbind and return to backbuffer rendering. Provided for convenience.
     void SetFrameBuffer(FrameBuffer* buffer);
+    /// Begin a GPU timer block. The name must be persistent; string literals or interned strings are recommended. Blocks can be nested. No-op if GPU timers are disabled.
+    void BeginGpuTimer(const char* name);
+    /// End the current GPU timer block.
+    void EndGpuTimer();
     /// Set the viewport rectangle.
     void SetViewport(const IntRect& viewRect);
+    /// Set several viewports for layered rendering, selected by the geometry shader's viewport index. Requires viewport array support. The next SetViewport() call restores a single viewport.
+    void SetViewports(const IntRect* viewRects, size_t count);
     /// Bind a shader program for use. Return pointer on success or null otherwise. Low performance, provided for convenience.
     ShaderProgram* SetProgram(const std::string& shaderName, const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
+    /// Bind a compute shader program for use. Return pointer on success or null otherwise. Requires compute shader support. Low performance, provided for convenience.
+    ShaderProgram* SetComputeProgram(const std::string& shaderName, const std::string& defines = JSONValue::emptyString);
     /// Set float preset uniform.
     void SetUniform(ShaderProgram* program, PresetUniform uniform, float value);
     /// Set a Vector2 preset uniform.
@@ -57,6 +237,18 @@ public:
     void SetUniform(ShaderProgram* program, PresetUniform uniform, const Matrix3x4& value);
     /// Set a Matrix4 preset uniform.
     void SetUniform(ShaderProgram* program, PresetUniform uniform, const Matrix4& value);
+    /// Set float registered custom uniform.
+    void SetUniform(ShaderProgram* program, UniformSlot uniform, float value);
+    /// Set a Vector2 registered custom uniform.
+    void SetUniform(ShaderProgram* program, UniformSlot uniform, const Vector2& value);
+    /// Set a Vector3 registered custom uniform.
+    void SetUniform(ShaderProgram* program, UniformSlot uniform, const Vector3& value);
+    /// Set a Vector4 registered custom uniform.
+    void SetUniform(ShaderProgram* program, UniformSlot uniform, const Vector4& value);
+    /// Set a Matrix3x4 registered custom uniform.
+    void SetUniform(ShaderProgram* program, UniformSlot uniform, const Matrix3x4& value);
+    /// Set a Matrix4 registered custom uniform.
+    void SetUniform(ShaderProgram* program, UniformSlot uniform, const Matrix4& value);
     /// Set float uniform. Low performance, provided for convenience.
     void SetUniform(ShaderProgram* program, const char* name, float value);
     /// Set a Vector2 uniform. Low performance, provided for convenience.
@@ -73,18 +265,24 @@ public:
     void SetUniformBuffer(size_t index, UniformBuffer* buffer);
     /// Bind a texture for use in texture unit. Null texture parameter to unbind.  Provided for convenience.
     void SetTexture(size_t index, Texture* texture);
+    /// Set a shader program's sampler of a texture unit to a texture's bindless handle. Null texture parameter to return the sampler to the texture unit. A texture without a handle is bound to the texture unit instead. Requires bindless texture support.
+    void SetBindlessTexture(ShaderProgram* program, size_t index, Texture* texture);
     /// Bind a vertex buffer for use with the specified shader program's attribute bindings. Provided for convenience.
     void SetVertexBuffer(VertexBuffer* buffer, ShaderProgram* program);
     /// Bind an index buffer for use. Provided for convenience.
     void SetIndexBuffer(IndexBuffer* buffer);
     /// Set basic renderstates.
     void SetRenderState(BlendMode blendMode, CullMode cullMode = CULL_BACK, CompareMode depthTest = CMP_LESS, bool colorWrite = true, bool depthWrite = true);
+    /// Bind a pipeline state's shader program and set its render state. The render state is skipped if the same pipeline state was the last one set. Return false if the program could not be bound.
+    bool SetPipelineState(PipelineState* state);
     /// Set depth bias.
     void SetDepthBias(float constantBias = 0.0f, float slopeScaleBias = 0.0f);
     /// Clear the current framebuffer.
     void Clear(bool clearColor = true, bool clearDepth = true, const IntRect& clearRect = IntRect::ZERO, const Color& backgroundColor = Color::BLACK);
     /// Blit from one framebuffer to another. The destination framebuffer will be left bound for rendering.
     void Blit(FrameBuffer* dest, const IntRect& destRect, FrameBuffer* src, const IntRect& srcRect, bool blitColor, bool blitDepth, TextureFilterMode filter);
+    /// Copy rectangles of the first mip level from one 2D texture to the same positions in another. Uses a direct image copy when supported and the formats match, which needs no framebuffers; otherwise blits all rectangles with one pair of framebuffers. Both must be color or both depth textures. Leaves no framebuffer bound for rendering. Return true on success.
+    bool CopyTexture(Texture* dest, Texture* src, const std::vector<IntRect>& rects);
     /// Draw non-indexed geometry with the currently bound vertex buffer.
     void Draw(PrimitiveType type, size_t drawStart, size_t drawCount);
    /// Draw indexed geometry with the currently bound vertex and index buffer.
@@ -93,13 +291,97 @@ public:
     void DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, VertexBuffer* instanceVertexBuffer, size_t instanceStart, size_t instanceCount);
     /// Draw instanced indexed geometry with the currently bound vertex and index buffer, and the specified instance data vertex buffer.
     void DrawIndexedInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, VertexBuffer* instanceVertexBuffer, size_t instanceStart, size_t instanceCount);
+    /// Draw a range of indexed indirect commands with the currently bound vertex and index buffer, and the specified instance data vertex buffer. The commands' base instances are relative to the instance start. Requires multi-draw indirect support.
+    void MultiDrawIndexedIndirect(PrimitiveType type, VertexBuffer* instanceVertexBuffer, size_t instanceStart, IndirectBuffer* indirectBuffer, size_t commandStart, size_t commandCount);
     /// Draw a quad with current renderstate. The quad vertex buffer is left bound.
     void DrawQuad();
+    /// Dispatch compute work groups with the currently bound compute shader program. Requires compute shader support.
+    void DispatchCompute(const IntVector3& numGroups);
+    /// Make compute shader image writes visible to following image accesses and texture fetches.
+    void ComputeBarrier();
+    /// Make compute shader storage buffer writes visible to following vertex attribute fetches.
+    void VertexDataBarrier();
+    /// Make compute shader storage buffer writes visible to following storage buffer accesses.
+    void StorageBarrier();
+    /// Make compute shader storage buffer writes visible to following indirect draw commands and vertex attribute fetches.
+    void DrawCommandBarrier();
+    /// Make compute shader image writes visible to following rendering into the same textures and texture fetches.
+    void RenderTargetBarrier();
+    /// Return a transient render target texture for the current frame, reusing a pooled texture of the same size, format and multisampling whose use has ended. Sampled with bilinear filtering and clamp addressing unless redefined.
+    Texture* AcquireRenderTarget(const IntVector2& size, ImageFormat format, int multisample = 1);
+    /// End the use of a transient render target before the end of the frame, so that the following passes can reuse its memory. All render targets are released when the frame is presented.
+    void ReleaseRenderTarget(Texture* texture);
+    /// Return a cached framebuffer for rendering to transient render targets. Either may be null for color-only or depth-only rendering.
+    FrameBuffer* RenderTargetFrameBuffer(Texture* colorTexture, Texture* depthStencilTexture);
+    /// Record a state change call and whether it was filtered as redundant. Called by the GPU objects' bind functions.
+    static void CountStateCall(StateCallType type, bool filtered) { ++stateCalls[type]; if (filtered) ++filteredStateCalls[type]; }
+    /// Record a change in the GPU memory allocated by an object. Called by the GPU objects when they are defined or released.
+    static void CountGpuMemory(GpuMemoryType type, size_t oldBytes, size_t newBytes) { gpuMemoryUse[type] += newBytes - oldBytes; }
 
     /// Return whether is initialized.
     bool IsInitialized() const { return context != nullptr; }
     /// Return whether has instancing support.
     bool HasInstancing() const { return hasInstancing; }
+    /// Return whether has multi-draw indirect support with base instances.
+    bool HasMultiDrawIndirect() const { return hasMultiDrawIndirect; }
+    /// Return whether has persistently mapped buffer storage support.
+    bool HasBufferStorage() const { return hasBufferStorage; }
+    /// Return whether has bindless texture support. Shader programs are then compiled with the bindless texture extension enabled.
+    bool HasBindlessTextures() const { return hasBindlessTextures; }
+    /// Return whether has compute shader and image load/store support.
+    bool HasComputeShaders() const { return hasComputeShaders; }
+    /// Return whether has geometry shader viewport array support for layered rendering.
+    bool HasViewportArray() const { return hasViewportArray; }
+    /// Return whether has program binary support for the shader program cache.
+    bool HasProgramBinary() const { return hasProgramBinary; }
+    /// Return whether has parallel shader compile support, which allows polling a program for link completion without blocking.
+    bool HasParallelShaderCompile() const { return hasParallelShaderCompile; }
+    /// Return whether has sampler object support. Textures then share samplers by their sampling parameters.
+    bool HasSamplerObjects() const { return hasSamplerObjects; }
+    /// Return whether has timestamp query support for GPU timers.
+    bool HasTimerQuery() const { return hasTimerQuery; }
+    /// Return whether has direct image copy support.
+    bool HasCopyImage() const { return hasCopyImage; }
+    /// Return whether GPU timers are enabled.
+    bool GpuTimers() const { return gpuTimers; }
+    /// Return the GPU timer results of the most recent frame that has finished on the GPU.
+    const std::vector<GpuTimerResult>& GpuTimerResults() const { return gpuTimerResults; }
+    /// Return the number of frames presented when the GPU timer results were last updated, or zero if never.
+    unsigned GpuTimerResultsFrame() const { return gpuTimerResultsFrame; }
+    /// Return the shader program cache directory, or empty if not in use.
+    const std::string& ProgramCacheDir() const { return programCacheDir; }
+    /// Return number of frames presented.
+    unsigned FrameNumber() const { return frameNumber; }
+    /// Return the current viewport, or an empty rectangle after setting several viewports.
+    const IntRect& Viewport() const { return lastViewport; }
+    /// Return the number of bytes uploaded per frame, or zero if uploading immediately.
+    size_t UploadBudget() const { return uploadBudget; }
+    /// Return whether the upload thread is running.
+    bool HasUploadThread() const { return uploadContext != nullptr; }
+    /// Return whether data given to resources should be queued for upload instead of uploaded immediately.
+    bool DefersUploads() const { return uploadBudget || uploadContext; }
+    /// Return number of queued uploads.
+    size_t NumPendingUploads() const { return pendingUploads.size(); }
+    /// Return whether a texture or buffer has queued uploads.
+    bool IsUploadPending(const RefCounted* target) const;
+    /// Return number of pending readbacks.
+    size_t NumPendingReadbacks() const { return pendingReadbacks.size(); }
+    /// Return number of pixel pack buffers in the readback buffer pool.
+    size_t NumReadbackBuffers() const { return readbackBuffers.size(); }
+    /// Return number of draw calls during the last presented frame. A multi-draw call counts as one.
+    unsigned DrawCalls() const { return lastDrawCalls; }
+    /// Return number of triangles drawn during the last presented frame, including all instances. Excludes multi-draw calls, whose draw commands are on the GPU.
+    size_t Triangles() const { return lastTriangles; }
+    /// Return number of state change calls of a type during the last presented frame, including filtered calls.
+    unsigned StateCalls(StateCallType type) const { return lastStateCalls[type]; }
+    /// Return number of redundant state change calls of a type filtered during the last presented frame.
+    unsigned FilteredStateCalls(StateCallType type) const { return lastFilteredStateCalls[type]; }
+    /// Return number of textures in the transient render target pool.
+    size_t NumRenderTargets() const { return renderTargets.size(); }
+    /// Return the GPU memory allocated by one type of object, calculated from their formats and sizes.
+    size_t GpuMemoryUse(GpuMemoryType type) const { return gpuMemoryUse[type]; }
+    /// Return the GPU memory allocated by all textures, renderbuffers and buffers.
+    size_t GpuMemoryUse() const;
     /// Return current window size.
     IntVector2 Size() const;
     /// Return current window width.
@@ -114,14 +396,50 @@ public:
     int RenderHeight() const { return RenderSize().y; }
     /// Return whether is fullscreen.
     bool IsFullscreen() const;
-    /// Return whether is using vertical sync.
-    bool VSync() const { return vsync; }
+    /// Return whether is using vertical sync, adaptive or not.
+    bool VSync() const { return presentMode != PRESENT_IMMEDIATE; }
+    /// Return the buffer swap synchronization mode in use.
+    PresentMode GetPresentMode() const { return presentMode; }
+    /// Return the frame rate limit.
+    float FrameRateLimit() const { return frameRateLimit; }
+    /// Return the number of intervals averaged into the frame time.
+    size_t FrameTimeSmoothing() const { return frameTimeSmoothing; }
+    /// Return the smoothed present-to-present interval in seconds, for example to advance the simulation with. Zero before the second Present().
+    float FrameTime() const { return frameTime; }
+    /// Return the standard deviation of the present-to-present intervals in seconds.
+    float PresentJitter() const { return presentJitter; }
+    /// Return whether reports the frame time and jitter to the profiler.
+    bool IsJitterReporting() const { return jitterReporting; }
+    /// Return whether is in headless mode.
+    bool IsHeadless() const { return headless; }
     /// Return the OS-level window.
     SDL_Window* Window() const { return window; }
 
 private:
     /// Set up the vertex buffer for quad rendering.
     void DefineQuadVertexBuffer();
+    /// Release the transient render targets at the end of the frame and destroy the ones unused for long.
+    void UpdateRenderTargets();
+    /// Count a draw call and its triangles.
+    void CountDraw(PrimitiveType type, size_t count, size_t instances) { ++drawCalls; if (type == PT_TRIANGLE_LIST) triangles += count / 3 * instances; }
+    /// Wait until the frame is due according to the frame rate limit.
+    void LimitFrameRate();
+    /// Record a present-to-present interval, and update the frame time and jitter.
+    void UpdateFrameTime(long long intervalUSec);
+    /// Read the GPU timer results of the oldest buffered frame if they are available, and prepare its queries for reuse.
+    void CollectGpuTimers();
+    /// Acquire a pixel pack buffer of at least the given size from the readback buffer pool and bind it. Return its index.
+    size_t AcquireReadbackBuffer(size_t size);
+    /// Fence the copy of a requested readback and add it to the pending readbacks.
+    void QueueReadback(Readback* readback, const ReadbackCallback& callback);
+    /// Submit the unsubmitted queued uploads to the upload thread and finish the ones whose fences have signaled.
+    void ProcessThreadedUploads();
+    /// Wait for the upload thread to finish a submitted job and store its fence to the pending upload.
+    void WaitUploadJob(PendingUpload& upload);
+    /// Take the fences of the jobs finished by the upload thread.
+    void CollectUploadJobs();
+    /// Make the shared context current and report the result, then perform upload jobs until stopped. Runs in the upload thread.
+    void UploadLoop();
 
     /// OS-level rendering window.
     SDL_Window* window;
@@ -139,14 +457,143 @@ private:
     bool lastColorWrite;
     /// Last depth write.
     bool lastDepthWrite;
+    /// Last pipeline state. Reset when the render state is changed otherwise.
+    SharedPtr<PipelineState> lastPipelineState;
     /// Last depth bias enabled.
     bool lastDepthBias;
-    /// Vertical sync flag.
-    bool vsync;
+    /// Last constant depth bias.
+    float lastConstantBias;
+    /// Last slope-scaled depth bias.
+    float lastSlopeScaleBias;
+    /// Last viewport rectangle.
+    IntRect lastViewport;
+    /// Buffer swap synchronization mode.
+    PresentMode presentMode;
+    /// Frame rate limit, or zero if none.
+    float frameRateLimit;
+    /// Number of intervals averaged into the frame time.
+    size_t frameTimeSmoothing;
+    /// Jitter reporting flag.
+    bool jitterReporting;
+    /// Clock for measuring the present times.
+    HiresTimer presentClock;
+    /// Time of the last present in microseconds, or negative before the first.
+    long long lastPresentTime;
+    /// Time the next frame is due by the frame rate limit in microseconds.
+    long long nextFrameTime;
+    /// Last present-to-present intervals in microseconds, used as a ring buffer.
+    long long frameIntervals[FRAME_TIME_HISTORY];
+    /// Number of recorded intervals, up to the history size.
+    size_t numFrameIntervals;
+    /// Ring buffer position of the next interval.
+    size_t frameIntervalIndex;
+    /// Smoothed frame time in seconds.
+    float frameTime;
+    /// Present-to-present jitter in seconds.
+    float presentJitter;
+    /// Headless mode flag.
+    bool headless;
     /// Instancing support flag.
     bool hasInstancing;
-    /// Whether instance vertex elements are enabled.
-    bool instancingEnabled;
+    /// Multi-draw indirect support flag.
+    bool hasMultiDrawIndirect;
+    /// Buffer storage support flag.
+    bool hasBufferStorage;
+    /// Bindless texture support flag.
+    bool hasBindlessTextures;
+    /// Compute shader support flag.
+    bool hasComputeShaders;
+    /// Viewport array support flag.
+    bool hasViewportArray;
+    /// Program binary support flag.
+    bool hasProgramBinary;
+    /// Parallel shader compile support flag.
+    bool hasParallelShaderCompile;
+    /// Sampler object support flag.
+    bool hasSamplerObjects;
+    /// Timestamp query support flag.
+    bool hasTimerQuery;
+    /// Direct image copy support flag.
+    bool hasCopyImage;
+    /// GPU timers enabled flag.
+    bool gpuTimers;
+    /// GPU timer queries of the buffered frames.
+    GpuTimerFrame gpuTimerFrames[GPU_TIMER_FRAMES];
+    /// Index of the buffered frame being recorded.
+    size_t gpuTimerFrame;
+    /// Currently open GPU timer blocks by index.
+    std::vector<size_t> gpuTimerStack;
+    /// Tracy GPU zones of the currently open GPU timer blocks. Empty unless Tracy is enabled.
+    std::vector<void*> tracyGpuZones;
+    /// GPU timer results of the last collected frame.
+    std::vector<GpuTimerResult> gpuTimerResults;
+    /// Frame number when the GPU timer results were last updated.
+    unsigned gpuTimerResultsFrame;
+    /// Shader program cache directory.
+    std::string programCacheDir;
+    /// Number of frames presented.
+    unsigned frameNumber;
+    /// Draw calls of the current frame.
+    unsigned drawCalls;
+    /// Triangles drawn in the current frame.
+    size_t triangles;
+    /// Draw calls of the last presented frame.
+    unsigned lastDrawCalls;
+    /// Triangles drawn in the last presented frame.
+    size_t lastTriangles;
+    /// Bytes uploaded per frame, or zero to upload immediately.
+    size_t uploadBudget;
+    /// Queued uploads in order.
+    std::vector<PendingUpload> pendingUploads;
+    /// Staging buffer object for the queued uploads.
+    unsigned stagingBuffer;
+    /// Staging buffer size in bytes.
+    size_t stagingBufferSize;
+    /// Hidden window of the upload thread.
+    SDL_Window* uploadWindow;
+    /// OpenGL context of the upload thread, shared with the main context.
+    void* uploadContext;
+    /// Upload thread.
+    std::thread uploadThread;
+    /// Mutex for the upload job lists.
+    std::mutex uploadMutex;
+    /// Condition for waking up the upload thread.
+    std::condition_variable uploadCondition;
+    /// Condition for signaling finished upload jobs and the upload thread startup.
+    std::condition_variable uploadFinishedCondition;
+    /// Jobs waiting for the upload thread.
+    std::vector<UploadJob> uploadJobs;
+    /// Jobs finished by the upload thread, with their fences.
+    std::vector<UploadJob> finishedUploadJobs;
+    /// Last assigned upload job id.
+    unsigned lastUploadJobId;
+    /// Upload thread startup result: negative while starting, zero on failure and positive on success.
+    int uploadThreadStatus;
+    /// Upload thread run flag.
+    bool uploadThreadRunning;
+    /// Pending readbacks in request order.
+    std::vector<SharedPtr<Readback> > pendingReadbacks;
+    /// Readback buffer pool.
+    std::vector<PooledReadbackBuffer> readbackBuffers;
+    /// Framebuffer for reading back textures.
+    AutoPtr<FrameBuffer> readbackFrameBuffer;
+    /// Framebuffers for blitting textures that can not be copied directly.
+    AutoPtr<FrameBuffer> copyFrameBuffers[2];
+    /// Transient render target pool.
+    std::vector<PooledRenderTarget> renderTargets;
+    /// Framebuffers for the transient render targets.
+    std::vector<PooledFrameBuffer> renderTargetFrameBuffers;
+    /// State change calls of the last presented frame.
+    unsigned lastStateCalls[MAX_STATE_CALL_TYPES];
+    /// Filtered state change calls of the last presented frame.
+    unsigned lastFilteredStateCalls[MAX_STATE_CALL_TYPES];
+
+    /// State change calls of the current frame.
+    static unsigned stateCalls[MAX_STATE_CALL_TYPES];
+    /// Filtered state change calls of the current frame.
+    static unsigned filteredStateCalls[MAX_STATE_CALL_TYPES];
+    /// GPU memory allocated by each type of object.
+    static size_t gpuMemoryUse[MAX_GPU_MEMORY_TYPES];
 };
 
 /// Register Graphics related object factories and attributes.
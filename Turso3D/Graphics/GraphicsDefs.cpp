@@ -11,6 +11,8 @@ const size_t elementSizes[] =
     sizeof(Vector3),
     sizeof(Vector4),
     sizeof(unsigned),
+    sizeof(unsigned),
+    sizeof(unsigned),
 };
 
 const char* elementSemanticNames[] =
@@ -28,7 +30,10 @@ const char* elementSemanticNames[] =
 const char* presetUniformNames[] = 
 {
     "worldMatrix",
+    "lodFade",
     "matDiffColor",
+    "impostorCenter",
+    "impostorFrames",
     nullptr
 };
 
@@ -43,6 +48,7 @@ const char* blendModeNames[] =
     "invDestAlpha",
     "subtract",
     "subtractAlpha",
+    "weightedOIT",
     nullptr
 };
 
@@ -66,3 +72,16 @@ const char* compareModeNames[] =
     "always",
     nullptr
 };
+
+const char* stateCallTypeNames[] =
+{
+    "program",
+    "texture",
+    "uniformBuffer",
+    "vertexBuffer",
+    "indexBuffer",
+    "frameBuffer",
+    "viewport",
+    "renderState",
+    nullptr
+};
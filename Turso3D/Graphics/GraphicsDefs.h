@@ -8,8 +8,10 @@
 static const size_t MAX_VERTEX_STREAMS = 4;
 /// Maximum number of material textures
 static const size_t MAX_MATERIAL_TEXTURE_UNITS = 8;
+/// Maximum number of material textures that can be virtual textures. Their page tables are bound after the built-in texture units.
+static const size_t MAX_VIRTUAL_TEXTURE_UNITS = 4;
 /// Maximum number of textures in use at once.
-static const size_t MAX_TEXTURE_UNITS = 16;
+static const size_t MAX_TEXTURE_UNITS = 26;
 /// Maximum number of constant buffer slots in use at once.
 static const size_t MAX_CONSTANT_BUFFER_SLOTS = 8;
 /// Maximum number of color rendertargets in use at once.
@@ -33,6 +35,8 @@ enum ElementType
     ELEM_VECTOR3,
     ELEM_VECTOR4,
     ELEM_UBYTE4,
+    ELEM_INT2101010,
+    ELEM_HALF2,
     MAX_ELEMENT_TYPES
 };
 
@@ -96,6 +100,7 @@ enum BlendMode
     BLEND_INVDESTALPHA,
     BLEND_SUBTRACT,
     BLEND_SUBTRACTALPHA,
+    BLEND_WEIGHTEDOIT,
     MAX_BLEND_MODES
 };
 
@@ -130,13 +135,17 @@ enum TextureType
     TEX_CUBE,
 };
 
-/// Resource usage modes for buffers.
+/// Resource usage modes for buffers. Stream usage is supported by vertex buffers only, and falls back to dynamic when persistent mapping is not supported.
 enum ResourceUsage
 {
     USAGE_DEFAULT = 0,
-    USAGE_DYNAMIC
+    USAGE_DYNAMIC,
+    USAGE_STREAM
 };
 
+/// Number of frames a stream buffer keeps separate regions for.
+static const size_t NUM_STREAM_FRAMES = 3;
+
 /// Texture filtering modes.
 enum TextureFilterMode
 {
@@ -160,20 +169,53 @@ enum TextureAddressMode
     ADDRESS_MIRROR_ONCE
 };
 
+/// Image access modes for compute shaders.
+enum ImageAccess
+{
+    IMAGE_READ = 0,
+    IMAGE_WRITE,
+    IMAGE_READWRITE
+};
+
 /// Preset uniforms.
 enum PresetUniform
 {
     U_WORLDMATRIX,
+    U_LODFADE,
     U_MATDIFFCOLOR,
+    U_IMPOSTORCENTER,
+    U_IMPOSTORFRAMES,
     MAX_PRESET_UNIFORMS
 };
 
+/// Dense slot of a custom uniform name registered with ShaderProgram::RegisterUniform(). Resolved to a location once per program, so that setting it costs the same as a preset uniform.
+struct UniformSlot
+{
+    /// Construct as not registered.
+    UniformSlot() :
+        index(0xffffffff)
+    {
+    }
+
+    /// Construct with slot index.
+    explicit UniformSlot(unsigned index_) :
+        index(index_)
+    {
+    }
+
+    /// Slot index.
+    unsigned index;
+};
+
 /// Uniform buffer binding points.
 enum UniformBufferBindings
 {
     UB_PERVIEWDATA = 0,
     UB_LIGHTDATA,
-    UB_SKINMATRICES
+    UB_SKINMATRICES,
+    UB_MATERIALDATA,
+    UB_CUBESHADOWDATA,
+    UB_STEREODATA
 };
 
 /// Geometry types for vertex shader.
@@ -182,7 +224,35 @@ enum GeometryType
     GEOM_STATIC = 0,
     GEOM_SKINNED,
     GEOM_INSTANCED,
-    GEOM_CUSTOM
+    GEOM_CUSTOM,
+    GEOM_SKINNED_INSTANCED,
+    GEOM_STATIC_INSTANCED
+};
+
+/// State change call types for the redundant call statistics.
+enum StateCallType
+{
+    STATE_PROGRAM = 0,
+    STATE_TEXTURE,
+    STATE_SAMPLER,
+    STATE_UNIFORMBUFFER,
+    STATE_VERTEXBUFFER,
+    STATE_INDEXBUFFER,
+    STATE_FRAMEBUFFER,
+    STATE_VIEWPORT,
+    STATE_RENDERSTATE,
+    MAX_STATE_CALL_TYPES
+};
+
+/// Types of GPU objects for memory accounting.
+enum GpuMemoryType
+{
+    GPU_MEMORY_TEXTURE = 0,
+    GPU_MEMORY_RENDERBUFFER,
+    GPU_MEMORY_VERTEXBUFFER,
+    GPU_MEMORY_INDEXBUFFER,
+    GPU_MEMORY_UNIFORMBUFFER,
+    MAX_GPU_MEMORY_TYPES
 };
 
 /// Description of an element in a vertex declaration.
@@ -228,3 +298,5 @@ extern const char* blendModeNames[];
 extern const char* cullModeNames[];
 /// Compare mode names.
 extern const char* compareModeNames[];
+/// State change call type names.
+extern const char* stateCallTypeNames[];
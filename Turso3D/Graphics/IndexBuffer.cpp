@@ -3,6 +3,7 @@
 #include "../IO/Log.h"
 #include "Graphics.h"
 #include "IndexBuffer.h"
+#include "VertexBuffer.h"
 
 #include <glew.h>
 #include <cstring>
@@ -13,6 +14,7 @@ static size_t boundIndexSize = 0;
 
 IndexBuffer::IndexBuffer() :
     buffer(0),
+    gpuMemory(0),
     numIndices(0),
     indexSize(0),
     usage(USAGE_DEFAULT)
@@ -84,21 +86,64 @@ bool IndexBuffer::SetData(size_t firstIndex, size_t numIndices_, const void* dat
     return true;
 }
 
+bool IndexBuffer::GetData(size_t firstIndex, size_t numIndices_, void* dest)
+{
+    if (!dest)
+    {
+        LOGERROR("Null destination for reading index buffer");
+        return false;
+    }
+    if (firstIndex + numIndices_ > numIndices)
+    {
+        LOGERROR("Out of bounds range for reading index buffer");
+        return false;
+    }
+    if (!buffer)
+        return false;
+
+    Bind();
+    glGetBufferSubData(GL_ELEMENT_ARRAY_BUFFER, firstIndex * indexSize, numIndices_ * indexSize, dest);
+    return true;
+}
+
 void IndexBuffer::Bind()
 {
-    if (!buffer || boundIndexBuffer == this)
+    if (!buffer)
+        return;
+
+    Graphics::CountStateCall(STATE_INDEXBUFFER, boundIndexBuffer == this);
+    if (boundIndexBuffer == this)
         return;
 
+    // Binding would modify a cached vertex array object
+    VertexBuffer::BindDefaultVertexArray();
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
     boundIndexBuffer = this;
     boundIndexSize = indexSize;
 }
 
+void IndexBuffer::BindStorage(size_t index)
+{
+    if (buffer)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)index, buffer);
+}
+
 size_t IndexBuffer::BoundIndexSize()
 {
     return boundIndexSize;
 }
 
+IndexBuffer* IndexBuffer::BoundIndexBuffer()
+{
+    return boundIndexBuffer;
+}
+
+void IndexBuffer::SetVertexArrayBinding(IndexBuffer* buffer)
+{
+    boundIndexBuffer = buffer;
+    boundIndexSize = buffer ? buffer->indexSize : 0;
+}
+
 
 bool IndexBuffer::Create(const void* data)
 {
@@ -112,6 +157,8 @@ bool IndexBuffer::Create(const void* data)
     Bind();
 
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * indexSize, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    gpuMemory = numIndices * indexSize;
+    Graphics::CountGpuMemory(GPU_MEMORY_INDEXBUFFER, 0, gpuMemory);
     LOGDEBUGF("Created index buffer numIndices %u indexSize %u", (unsigned)numIndices, (unsigned)indexSize);
 
     return true;
@@ -121,8 +168,13 @@ void IndexBuffer::Release()
 {
     if (buffer)
     {
+        Object::Subsystem<Graphics>()->CancelUploads(this);
+
+        VertexBuffer::ReleaseVertexArrays(this);
         glDeleteBuffers(1, &buffer);
         buffer = 0;
+        Graphics::CountGpuMemory(GPU_MEMORY_INDEXBUFFER, gpuMemory, 0);
+        gpuMemory = 0;
 
         if (boundIndexBuffer == this)
         {
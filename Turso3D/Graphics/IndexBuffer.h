@@ -19,8 +19,12 @@ public:
     bool Define(ResourceUsage usage, size_t numIndices, size_t indexSize, const void* data = nullptr);
     /// Redefine buffer data either completely or partially. Return true on success.
     bool SetData(size_t firstIndex, size_t numIndices, const void* data, bool discard = false);
+    /// Read back index data synchronously, stalling until the GPU has finished writing the buffer. Intended for offline processing such as geometry merging. Return true on success.
+    bool GetData(size_t firstIndex, size_t numIndices, void* dest);
     /// Bind to use. No-op if already bound. Used also when defining or setting data.
     void Bind();
+    /// Bind as a shader storage buffer to an indexed binding point, for reading the raw index data in compute shaders. Requires compute shader support.
+    void BindStorage(size_t index);
 
     /// Return number of indices.
     size_t NumIndices() const { return numIndices; }
@@ -33,9 +37,15 @@ public:
 
     /// Return the OpenGL object identifier.
     unsigned GLBuffer() const { return buffer; }
+    /// Return the allocated GPU memory in bytes.
+    size_t GpuMemoryUse() const { return gpuMemory; }
 
     /// Return the index size of the currently bound buffer, or 0 if no buffer bound.
     static size_t BoundIndexSize();
+    /// Return the currently bound index buffer.
+    static IndexBuffer* BoundIndexBuffer();
+    /// Update the bound index buffer after a vertex array object has been bound, as the binding is part of its state. Called by VertexBuffer.
+    static void SetVertexArrayBinding(IndexBuffer* buffer);
 
 private:
     /// Create the GPU-side index buffer. Return true on success.
@@ -45,6 +55,8 @@ private:
 
     /// OpenGL object identifier.
     unsigned buffer;
+    /// Allocated GPU memory in bytes.
+    size_t gpuMemory;
     /// Number of indices.
     size_t numIndices;
     /// Size of index in bytes.
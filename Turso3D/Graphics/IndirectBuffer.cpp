@@ -0,0 +1,126 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "Graphics.h"
+#include "IndirectBuffer.h"
+
+#include <glew.h>
+#include <tracy/Tracy.hpp>
+
+static IndirectBuffer* boundIndirectBuffer = nullptr;
+
+IndirectBuffer::IndirectBuffer() :
+    buffer(0),
+    numCommands(0),
+    usage(USAGE_DEFAULT)
+{
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+}
+
+IndirectBuffer::~IndirectBuffer()
+{
+    // Context may be gone at destruction time. In this case just no-op the cleanup
+    if (!Object::Subsystem<Graphics>())
+        return;
+
+    Release();
+}
+
+bool IndirectBuffer::Define(ResourceUsage usage_, size_t numCommands_, const IndirectDrawCommand* data)
+{
+    ZoneScoped;
+
+    Release();
+
+    if (!numCommands_)
+    {
+        LOGERROR("Can not define empty indirect buffer");
+        return false;
+    }
+
+    numCommands = numCommands_;
+    usage = usage_;
+
+    return Create(data);
+}
+
+bool IndirectBuffer::SetData(size_t firstCommand, size_t numCommands_, const IndirectDrawCommand* data, bool discard)
+{
+    if (!numCommands_)
+        return true;
+
+    if (!data)
+    {
+        LOGERROR("Null source data for updating indirect buffer");
+        return false;
+    }
+    if (firstCommand + numCommands_ > numCommands)
+    {
+        LOGERROR("Out of bounds range for updating indirect buffer");
+        return false;
+    }
+
+    if (buffer)
+    {
+        size_t size = numCommands * sizeof(IndirectDrawCommand);
+        size_t offset = firstCommand * sizeof(IndirectDrawCommand);
+        size_t numBytes = numCommands_ * sizeof(IndirectDrawCommand);
+
+        Bind();
+        if (numBytes == size)
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, numBytes, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+        else if (discard)
+        {
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, size, nullptr, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, offset, numBytes, data);
+        }
+        else
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, offset, numBytes, data);
+    }
+
+    return true;
+}
+
+void IndirectBuffer::Bind()
+{
+    if (!buffer || boundIndirectBuffer == this)
+        return;
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+    boundIndirectBuffer = this;
+}
+
+void IndirectBuffer::BindStorage(size_t index)
+{
+    if (buffer)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)index, buffer);
+}
+
+bool IndirectBuffer::Create(const void* data)
+{
+    glGenBuffers(1, &buffer);
+    if (!buffer)
+    {
+        LOGERROR("Failed to create indirect buffer");
+        return false;
+    }
+
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, numCommands * sizeof(IndirectDrawCommand), data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    boundIndirectBuffer = this;
+    LOGDEBUGF("Created indirect buffer numCommands %u", (unsigned)numCommands);
+
+    return true;
+}
+
+void IndirectBuffer::Release()
+{
+    if (buffer)
+    {
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+
+        if (boundIndirectBuffer == this)
+            boundIndirectBuffer = nullptr;
+    }
+}
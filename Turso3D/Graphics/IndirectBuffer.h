@@ -0,0 +1,63 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/Ptr.h"
+#include "GraphicsDefs.h"
+
+/// Indexed indirect draw command. Matches the layout expected by OpenGL.
+struct IndirectDrawCommand
+{
+    /// Number of indices.
+    unsigned count;
+    /// Number of instances.
+    unsigned instanceCount;
+    /// First index.
+    unsigned firstIndex;
+    /// Value added to the indices.
+    int baseVertex;
+    /// First instance, which offsets the instanced vertex attributes.
+    unsigned baseInstance;
+};
+
+/// GPU buffer for indirect draw commands.
+class IndirectBuffer : public RefCounted
+{
+public:
+    /// Construct. Graphics subsystem must have been initialized.
+    IndirectBuffer();
+    /// Destruct.
+    ~IndirectBuffer();
+
+    /// Define buffer with the number of commands. Return true on success.
+    bool Define(ResourceUsage usage, size_t numCommands, const IndirectDrawCommand* data = nullptr);
+    /// Redefine buffer data either completely or partially. Return true on success.
+    bool SetData(size_t firstCommand, size_t numCommands, const IndirectDrawCommand* data, bool discard = false);
+    /// Bind as the current indirect draw buffer. No-op if already bound.
+    void Bind();
+    /// Bind as a shader storage buffer to an index, so that compute shaders can write the commands. Requires compute shader support.
+    void BindStorage(size_t index);
+
+    /// Return number of commands.
+    size_t NumCommands() const { return numCommands; }
+    /// Return resource usage type.
+    ResourceUsage Usage() const { return usage; }
+    /// Return whether is dynamic.
+    bool IsDynamic() const { return usage == USAGE_DYNAMIC; }
+
+    /// Return the OpenGL object identifier.
+    unsigned GLBuffer() const { return buffer; }
+
+private:
+    /// Create the GPU-side buffer. Return true on success.
+    bool Create(const void* data);
+    /// Release the buffer.
+    void Release();
+
+    /// OpenGL object identifier.
+    unsigned buffer;
+    /// Number of commands.
+    size_t numCommands;
+    /// Resource usage type.
+    ResourceUsage usage;
+};
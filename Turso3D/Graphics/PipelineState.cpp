@@ -0,0 +1,18 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "PipelineState.h"
+#include "ShaderProgram.h"
+
+PipelineState::PipelineState(ShaderProgram* program_, BlendMode blendMode_, CullMode cullMode_, CompareMode depthTest_, bool colorWrite_, bool depthWrite_) :
+    program(program_),
+    blendMode(colorWrite_ ? blendMode_ : BLEND_REPLACE),
+    cullMode(cullMode_),
+    depthTest(depthTest_),
+    colorWrite(colorWrite_),
+    depthWrite(depthWrite_)
+{
+}
+
+PipelineState::~PipelineState()
+{
+}
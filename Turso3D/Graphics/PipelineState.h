@@ -0,0 +1,45 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/Ptr.h"
+#include "GraphicsDefs.h"
+
+class ShaderProgram;
+
+/// Immutable pipeline state consisting of a shader program and the render state it is drawn with. Created when a material pass first meets a geometry type, so that rendering applies one pre-validated object per state change. On OpenGL the render state is applied as a cached block, which is skipped entirely when the same object is applied again.
+class PipelineState : public RefCounted
+{
+public:
+    /// Construct. Blending is disabled when color write is off, as it would have no effect.
+    PipelineState(ShaderProgram* program, BlendMode blendMode, CullMode cullMode, CompareMode depthTest, bool colorWrite, bool depthWrite);
+    /// Destruct.
+    ~PipelineState();
+
+    /// Return shader program.
+    ShaderProgram* Program() const { return program; }
+    /// Return blend mode.
+    BlendMode GetBlendMode() const { return blendMode; }
+    /// Return cull mode.
+    CullMode GetCullMode() const { return cullMode; }
+    /// Return depth test mode.
+    CompareMode GetDepthTest() const { return depthTest; }
+    /// Return color write flag.
+    bool GetColorWrite() const { return colorWrite; }
+    /// Return depth write flag.
+    bool GetDepthWrite() const { return depthWrite; }
+
+private:
+    /// Shader program.
+    SharedPtr<ShaderProgram> program;
+    /// Blend mode.
+    BlendMode blendMode;
+    /// Cull mode.
+    CullMode cullMode;
+    /// Depth test mode.
+    CompareMode depthTest;
+    /// Color write flag.
+    bool colorWrite;
+    /// Depth write flag.
+    bool depthWrite;
+};
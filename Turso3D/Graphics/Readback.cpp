@@ -0,0 +1,20 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Readback.h"
+
+Readback::Readback() :
+    format(FMT_NONE),
+    rect(IntRect::ZERO),
+    dataSize(0),
+    bufferIndex(0),
+    fence(nullptr),
+    requestFrame(0),
+    readyFrame(0),
+    pending(false),
+    ready(false)
+{
+}
+
+Readback::~Readback()
+{
+}
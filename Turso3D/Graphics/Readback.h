@@ -0,0 +1,68 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntRect.h"
+#include "../Object/Ptr.h"
+#include "../Resource/Image.h"
+
+#include <functional>
+#include <vector>
+
+class Readback;
+
+/// Function called when an asynchronous readback finishes, successfully or not.
+typedef std::function<void(Readback*)> ReadbackCallback;
+
+/// Asynchronous GPU to CPU readback of a texture rectangle or a buffer range, requested from Graphics. The data is copied into a pooled pixel pack buffer on the GPU, and read out once a fence shows the copy has finished, so that requesting or polling never stalls.
+class Readback : public RefCounted
+{
+    friend class Graphics;
+
+public:
+    /// Construct. Requested through Graphics.
+    Readback();
+    /// Destruct.
+    ~Readback();
+
+    /// Return whether is still waiting for the GPU.
+    bool IsPending() const { return pending; }
+    /// Return whether the data has arrived. False after a failed readback.
+    bool IsReady() const { return ready; }
+    /// Return the data. Texture pixels are in tightly packed rows, in the same row order and transfer data type as Texture::SetData() uses. Empty until ready.
+    const std::vector<unsigned char>& Data() const { return data; }
+    /// Return the size of the data in bytes, known already while pending.
+    size_t DataSize() const { return dataSize; }
+    /// Return the texture format, or FMT_NONE for a buffer readback.
+    ImageFormat Format() const { return format; }
+    /// Return the texture rectangle that was read.
+    const IntRect& Rect() const { return rect; }
+    /// Return the frame number when the readback was requested.
+    unsigned RequestFrame() const { return requestFrame; }
+    /// Return the frame number when the data arrived.
+    unsigned ReadyFrame() const { return readyFrame; }
+
+private:
+    /// Data.
+    std::vector<unsigned char> data;
+    /// Callback function.
+    ReadbackCallback callback;
+    /// Texture format.
+    ImageFormat format;
+    /// Texture rectangle.
+    IntRect rect;
+    /// Data size in bytes.
+    size_t dataSize;
+    /// Index of the pixel pack buffer in the pool.
+    size_t bufferIndex;
+    /// Fence that signals when the copy has finished.
+    void* fence;
+    /// Frame number when requested.
+    unsigned requestFrame;
+    /// Frame number when the data arrived.
+    unsigned readyFrame;
+    /// Pending flag.
+    bool pending;
+    /// Ready flag.
+    bool ready;
+};
@@ -10,6 +10,7 @@
 
 RenderBuffer::RenderBuffer() :
     buffer(0),
+    gpuMemory(0),
     size(IntVector2::ZERO),
     format(FMT_NONE),
     multisample(0)
@@ -81,6 +82,11 @@ bool RenderBuffer::Define(const IntVector2& size_, ImageFormat format_, int mult
         return false;
     }
 
+    ImageLevel level;
+    Image::CalculateDataSize(IntVector3(size.x, size.y, 1), format, level);
+    gpuMemory = level.dataSize * multisample;
+    Graphics::CountGpuMemory(GPU_MEMORY_RENDERBUFFER, 0, gpuMemory);
+
     LOGDEBUGF("Created renderbuffer width %d height %d format %d", size.x, size.y, (int)format);
 
     return true;
@@ -92,5 +98,7 @@ void RenderBuffer::Release()
     {
         glDeleteRenderbuffers(1, &buffer);
         buffer = 0;
+        Graphics::CountGpuMemory(GPU_MEMORY_RENDERBUFFER, gpuMemory, 0);
+        gpuMemory = 0;
     }
 }
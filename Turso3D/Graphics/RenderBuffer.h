@@ -31,6 +31,8 @@ public:
 
     /// Return the OpenGL buffer identifier.
     unsigned GLBuffer() const { return buffer; }
+    /// Return the allocated GPU memory in bytes.
+    size_t GpuMemoryUse() const { return gpuMemory; }
 
 private:
     /// Release the renderbuffer.
@@ -38,6 +40,8 @@ private:
 
     /// OpenGL object identifier.
     unsigned buffer;
+    /// Allocated GPU memory in bytes.
+    size_t gpuMemory;
     /// Texture dimensions in pixels.
     IntVector2 size;
     /// Image format.
@@ -0,0 +1,177 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "Graphics.h"
+#include "Sampler.h"
+
+#include <glew.h>
+#include <tracy/Tracy.hpp>
+
+static Sampler* boundSamplers[MAX_TEXTURE_UNITS];
+
+const unsigned Sampler::glWrapModes[] =
+{
+    GL_REPEAT,
+    GL_MIRRORED_REPEAT,
+    GL_CLAMP_TO_EDGE,
+    GL_CLAMP_TO_BORDER,
+    GL_MIRROR_CLAMP_EXT
+};
+
+std::vector<SharedPtr<Sampler> > Sampler::samplers;
+unsigned Sampler::anisotropyLimit = 16;
+
+Sampler::Sampler(const SamplerDescription& desc_) :
+    sampler(0),
+    desc(desc_),
+    immutable(false)
+{
+    glGenSamplers(1, &sampler);
+    if (!sampler)
+    {
+        LOGERROR("Failed to create sampler");
+        return;
+    }
+
+    glSamplerParameteri(sampler, GL_TEXTURE_MIN_FILTER, GLMinFilter(desc.filter, desc.mipmaps));
+    glSamplerParameteri(sampler, GL_TEXTURE_MAG_FILTER, GLMagFilter(desc.filter));
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_S, glWrapModes[desc.addressModes[0]]);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_T, glWrapModes[desc.addressModes[1]]);
+    glSamplerParameteri(sampler, GL_TEXTURE_WRAP_R, glWrapModes[desc.addressModes[2]]);
+    glSamplerParameterf(sampler, GL_TEXTURE_MIN_LOD, desc.minLod);
+    glSamplerParameterf(sampler, GL_TEXTURE_MAX_LOD, desc.maxLod);
+    glSamplerParameterfv(sampler, GL_TEXTURE_BORDER_COLOR, desc.borderColor.Data());
+
+    if (desc.filter >= COMPARE_POINT)
+    {
+        glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    }
+    else
+        glSamplerParameteri(sampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+    ApplyAnisotropy();
+}
+
+Sampler::~Sampler()
+{
+    // Context may be gone at destruction time. In this case just no-op the cleanup
+    if (!sampler || !Object::Subsystem<Graphics>())
+        return;
+
+    for (size_t i = 0; i < MAX_TEXTURE_UNITS; ++i)
+    {
+        if (boundSamplers[i] == this)
+            boundSamplers[i] = nullptr;
+    }
+
+    glDeleteSamplers(1, &sampler);
+}
+
+Sampler* Sampler::Get(const SamplerDescription& desc)
+{
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    if (!graphics || !graphics->HasSamplerObjects())
+        return nullptr;
+
+    // There are only a handful of distinct descriptions, so a linear search is enough
+    for (auto it = samplers.begin(); it != samplers.end(); ++it)
+    {
+        if ((*it)->desc == desc)
+            return it->Get();
+    }
+
+    ZoneScoped;
+
+    SharedPtr<Sampler> newSampler(new Sampler(desc));
+    if (!newSampler->sampler)
+        return nullptr;
+
+    samplers.push_back(newSampler);
+    LOGDEBUGF("Created sampler filter %d, %d samplers in total", (int)desc.filter, (int)samplers.size());
+    return newSampler.Get();
+}
+
+void Sampler::SetAnisotropyLimit(unsigned limit)
+{
+    if (!limit)
+        limit = 1;
+    if (limit == anisotropyLimit)
+        return;
+
+    anisotropyLimit = limit;
+    for (auto it = samplers.begin(); it != samplers.end(); ++it)
+        (*it)->ApplyAnisotropy();
+}
+
+void Sampler::Unbind(size_t unit)
+{
+    if (unit >= MAX_TEXTURE_UNITS || !boundSamplers[unit])
+        return;
+
+    Graphics::CountStateCall(STATE_SAMPLER, false);
+    glBindSampler((GLuint)unit, 0);
+    boundSamplers[unit] = nullptr;
+}
+
+void Sampler::ReleaseAll()
+{
+    for (auto it = samplers.begin(); it != samplers.end(); ++it)
+    {
+        Sampler* sampler = it->Get();
+        if (sampler->sampler)
+        {
+            glDeleteSamplers(1, &sampler->sampler);
+            sampler->sampler = 0;
+        }
+    }
+
+    for (size_t i = 0; i < MAX_TEXTURE_UNITS; ++i)
+        boundSamplers[i] = nullptr;
+
+    samplers.clear();
+}
+
+unsigned Sampler::GLMinFilter(TextureFilterMode filter, bool mipmaps)
+{
+    switch (filter)
+    {
+    case FILTER_POINT:
+    case COMPARE_POINT:
+        return GL_NEAREST;
+
+    case FILTER_BILINEAR:
+    case COMPARE_BILINEAR:
+        return mipmaps ? GL_LINEAR_MIPMAP_NEAREST : GL_LINEAR;
+
+    default:
+        return mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR;
+    }
+}
+
+unsigned Sampler::GLMagFilter(TextureFilterMode filter)
+{
+    return (filter == FILTER_POINT || filter == COMPARE_POINT) ? GL_NEAREST : GL_LINEAR;
+}
+
+void Sampler::Bind(size_t unit)
+{
+    if (unit >= MAX_TEXTURE_UNITS || !sampler)
+        return;
+
+    Graphics::CountStateCall(STATE_SAMPLER, boundSamplers[unit] == this);
+    if (boundSamplers[unit] == this)
+        return;
+
+    glBindSampler((GLuint)unit, sampler);
+    boundSamplers[unit] = this;
+}
+
+void Sampler::ApplyAnisotropy()
+{
+    // Bindless handles freeze the sampler state
+    if (!sampler || immutable || desc.filter != FILTER_ANISOTROPIC)
+        return;
+
+    glSamplerParameterf(sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, (float)(desc.maxAnisotropy < anisotropyLimit ? desc.maxAnisotropy : anisotropyLimit));
+}
@@ -0,0 +1,92 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Color.h"
+#include "../Object/Ptr.h"
+#include "GraphicsDefs.h"
+
+#include <vector>
+
+/// Description of texture sampling parameters.
+struct SamplerDescription
+{
+    /// Test for equality with another description.
+    bool operator == (const SamplerDescription& rhs) const { return filter == rhs.filter && addressModes[0] == rhs.addressModes[0] && addressModes[1] == rhs.addressModes[1] && addressModes[2] == rhs.addressModes[2] && maxAnisotropy == rhs.maxAnisotropy && minLod == rhs.minLod && maxLod == rhs.maxLod && borderColor == rhs.borderColor && mipmaps == rhs.mipmaps; }
+    /// Test for inequality with another description.
+    bool operator != (const SamplerDescription& rhs) const { return !(*this == rhs); }
+
+    /// Texture filtering mode.
+    TextureFilterMode filter;
+    /// Texture addressing modes for each coordinate axis.
+    TextureAddressMode addressModes[3];
+    /// Maximum anisotropy.
+    unsigned maxAnisotropy;
+    /// Minimum LOD.
+    float minLod;
+    /// Maximum LOD.
+    float maxLod;
+    /// Border color. Only effective in border addressing mode.
+    Color borderColor;
+    /// Whether the sampled texture has mipmap levels, which selects the minification filter.
+    bool mipmaps;
+};
+
+/// GPU sampler object shared by all textures with the same sampling parameters. Requires sampler object support.
+class Sampler : public RefCounted
+{
+public:
+    /// Destruct.
+    ~Sampler();
+
+    /// Return the shared sampler for a description, creating it on first use. Return null if sampler objects are not supported.
+    static Sampler* Get(const SamplerDescription& desc);
+    /// Set the maximum anisotropy of all anisotropic samplers, including existing ones. Samplers with bindless handles keep their anisotropy. Default 16.
+    static void SetAnisotropyLimit(unsigned limit);
+    /// Return the maximum anisotropy of all anisotropic samplers.
+    static unsigned AnisotropyLimit() { return anisotropyLimit; }
+    /// Return number of shared samplers.
+    static size_t NumSamplers() { return samplers.size(); }
+    /// Unbind the sampler from a texture unit, so that the texture's own sampling parameters are used. No-op if none bound.
+    static void Unbind(size_t unit);
+    /// Destroy all shared samplers. Called by the Graphics subsystem before the context is destroyed.
+    static void ReleaseAll();
+
+    /// Return the OpenGL minification filter of a filter mode.
+    static unsigned GLMinFilter(TextureFilterMode filter, bool mipmaps);
+    /// Return the OpenGL magnification filter of a filter mode.
+    static unsigned GLMagFilter(TextureFilterMode filter);
+
+    /// Bind to texture unit. No-op if already bound.
+    void Bind(size_t unit);
+    /// Mark that a bindless handle has been created with the sampler, after which its parameters can no longer be changed.
+    void SetImmutable() { immutable = true; }
+
+    /// Return the sampling parameters.
+    const SamplerDescription& Description() const { return desc; }
+    /// Return whether the parameters can no longer be changed.
+    bool IsImmutable() const { return immutable; }
+    /// Return the OpenGL object identifier.
+    unsigned GLSampler() const { return sampler; }
+
+    /// OpenGL texture wrap modes by address mode.
+    static const unsigned glWrapModes[];
+
+private:
+    /// Construct and create the OpenGL object.
+    Sampler(const SamplerDescription& desc);
+    /// Apply the anisotropy, limited by the global limit.
+    void ApplyAnisotropy();
+
+    /// OpenGL object identifier.
+    unsigned sampler;
+    /// Sampling parameters.
+    SamplerDescription desc;
+    /// Bindless handle created flag.
+    bool immutable;
+
+    /// Shared samplers.
+    static std::vector<SharedPtr<Sampler> > samplers;
+    /// Global anisotropy limit.
+    static unsigned anisotropyLimit;
+};
@@ -4,12 +4,37 @@
 #include "../IO/Log.h"
 #include "../IO/Stream.h"
 #include "../Resource/ResourceCache.h"
+#include "../Time/Profiler.h"
 #include "Shader.h"
 #include "ShaderProgram.h"
 
 #include <algorithm>
+#include <mutex>
+#include <tracy/Tracy.hpp>
 
-Shader::Shader()
+// Initial size of the shader program hash table, must be a power of two
+static const size_t INITIAL_PROGRAM_SLOTS = 16;
+
+/// Include file expanded with its own includes.
+struct CachedInclude
+{
+    /// Expanded source code.
+    std::string code;
+    /// The file itself and its nested includes, with their modification times when read.
+    std::vector<std::pair<std::string, unsigned> > dependencies;
+};
+
+static std::map<std::string, CachedInclude> includeCache;
+static std::mutex includeCacheMutex;
+
+static size_t ProgramSlotIndex(unsigned long long key, size_t mask)
+{
+    return (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+}
+
+Shader::Shader() :
+    numPrograms(0),
+    version(0)
 {
 }
 
@@ -24,42 +49,79 @@ void Shader::RegisterObject()
 
 bool Shader::BeginLoad(Stream& source)
 {
+    ZoneScoped;
+
+    // When reloading, an include may have changed within the modification time resolution, so read the previous includes again
+    if (version)
+    {
+        std::lock_guard<std::mutex> lock(includeCacheMutex);
+        for (auto it = includeFiles.begin(); it != includeFiles.end(); ++it)
+            includeCache.erase(*it);
+    }
+
     sourceCode.clear();
-    return ProcessIncludes(sourceCode, source);
+    includeFiles.clear();
+    return ProcessIncludes(sourceCode, includeFiles, source);
 }
 
 bool Shader::EndLoad()
 {
-    // Release existing variations (if any) to allow them to be recompiled with changed code
-    programs.clear();
+    // Release existing variations (if any) to allow them to be recompiled with changed code. Define normalization depends on the code, so forget the define sets too
+    programSlots.clear();
+    numPrograms = 0;
+    defineIds.clear();
+    defineStrings.clear();
+    ++version;
     return true;
 }
 
+void Shader::FileDependencies(std::vector<std::string>& dest) const
+{
+    dest.insert(dest.end(), includeFiles.begin(), includeFiles.end());
+}
+
 void Shader::Define(const std::string& code)
 {
     sourceCode = code;
+    includeFiles.clear();
     EndLoad();
 }
 
-ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::string& fsDefinesIn)
+ShaderProgram* Shader::CreateProgram(const std::string& vsDefines, const std::string& fsDefines, bool async)
 {
-    auto hashPair = std::make_pair(StringHash(vsDefinesIn), StringHash(fsDefinesIn));
+    unsigned vsId = DefinesId(vsDefines);
+    unsigned fsId = DefinesId(fsDefines);
+    unsigned long long key = ((unsigned long long)(vsId + 1) << 32) | (fsId + 1);
 
-    auto it = programs.find(hashPair);
-    if (it != programs.end())
-        return it->second;
-    
-    // If initially not found, normalize the defines and try again. Remove unused defines
-    std::string vsDefines = NormalizeDefines(vsDefinesIn);
-    std::string fsDefines = NormalizeDefines(fsDefinesIn);
-    auto normalizedHashPair = std::make_pair(StringHash(vsDefines), StringHash(fsDefines));
-    it = programs.find(normalizedHashPair);
-    if (it != programs.end())
-        return it->second;
+    ShaderProgram* program = FindProgram(key);
+    if (program)
+        return program;
+
+    Profiler* profiler = Subsystem<Profiler>();
+    if (profiler && profiler->IsHitchDetection())
+        profiler->AddEvent("Create shader program", Name() + " " + vsDefines + "/ " + fsDefines);
 
-    ShaderProgram* newVariation = new ShaderProgram(sourceCode, Name(), vsDefines, fsDefines);
-    programs[hashPair] = newVariation;
-    programs[normalizedHashPair] = newVariation;
+    ShaderProgram* newVariation = new ShaderProgram(sourceCode, Name(), defineStrings[vsId], defineStrings[fsId], async);
+    InsertProgram(key, newVariation);
+    return newVariation;
+}
+
+ShaderProgram* Shader::CreateComputeProgram(const std::string& defines)
+{
+    // The fragment shader half of the key is zero, which graphics programs never have
+    unsigned id = DefinesId(defines);
+    unsigned long long key = (unsigned long long)(id + 1) << 32;
+
+    ShaderProgram* program = FindProgram(key);
+    if (program)
+        return program;
+
+    Profiler* profiler = Subsystem<Profiler>();
+    if (profiler && profiler->IsHitchDetection())
+        profiler->AddEvent("Create compute program", Name() + " " + defines);
+
+    ShaderProgram* newVariation = new ShaderProgram(sourceCode, Name(), defineStrings[id], true);
+    InsertProgram(key, newVariation);
     return newVariation;
 }
 
@@ -103,7 +165,35 @@ std::string Shader::NormalizeDefines(const std::string& defines)
     return ret;
 }
 
-bool Shader::ProcessIncludes(std::string& code, Stream& source)
+unsigned Shader::DefinesId(const std::string& defines)
+{
+    auto it = defineIds.find(defines);
+    if (it != defineIds.end())
+        return it->second;
+
+    std::string normalized = NormalizeDefines(defines);
+    unsigned id;
+    it = defineIds.find(normalized);
+    if (it != defineIds.end())
+        id = it->second;
+    else
+    {
+        id = (unsigned)defineStrings.size();
+        defineStrings.push_back(normalized);
+        defineIds[normalized] = id;
+    }
+
+    defineIds[defines] = id;
+    return id;
+}
+
+void Shader::ClearIncludeCache()
+{
+    std::lock_guard<std::mutex> lock(includeCacheMutex);
+    includeCache.clear();
+}
+
+bool Shader::ProcessIncludes(std::string& code, std::vector<std::string>& dependencies, Stream& source)
 {
     ResourceCache* cache = Subsystem<ResourceCache>();
 
@@ -114,12 +204,7 @@ bool Shader::ProcessIncludes(std::string& code, Stream& source)
         if (StartsWith(line, "#include"))
         {
             std::string includeFileName = Trim(Path(source.Name()) + Replace(line.substr(9), "\"", ""));
-            AutoPtr<Stream> includeStream = cache->OpenResource(includeFileName);
-            if (!includeStream)
-                return false;
-
-            // Add the include file into the current code recursively
-            if (!ProcessIncludes(code, *includeStream))
+            if (!ExpandInclude(code, dependencies, cache->SanitateResourceName(includeFileName)))
                 return false;
         }
         else
@@ -134,3 +219,97 @@ bool Shader::ProcessIncludes(std::string& code, Stream& source)
 
     return true;
 }
+
+bool Shader::ExpandInclude(std::string& code, std::vector<std::string>& dependencies, const std::string& includeName)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+
+    // Record the dependency even if the file is missing, so that its appearance triggers a reload
+    dependencies.push_back(includeName);
+
+    CachedInclude cached;
+    {
+        std::lock_guard<std::mutex> lock(includeCacheMutex);
+        auto it = includeCache.find(includeName);
+        if (it != includeCache.end())
+            cached = it->second;
+    }
+
+    if (cached.dependencies.size())
+    {
+        bool current = true;
+        for (auto it = cached.dependencies.begin(); it != cached.dependencies.end() && current; ++it)
+            current = cache->LastModifiedTime(it->first) == it->second;
+
+        if (current)
+        {
+            code += cached.code;
+            for (auto it = cached.dependencies.begin() + 1; it != cached.dependencies.end(); ++it)
+                dependencies.push_back(it->first);
+            return true;
+        }
+    }
+
+    AutoPtr<Stream> includeStream = cache->OpenResource(includeName);
+    if (!includeStream)
+        return false;
+
+    // Expand the include file's own includes recursively
+    CachedInclude newInclude;
+    std::vector<std::string> nestedDependencies;
+    newInclude.dependencies.push_back(std::make_pair(includeName, cache->LastModifiedTime(includeName)));
+    if (!ProcessIncludes(newInclude.code, nestedDependencies, *includeStream))
+        return false;
+
+    for (auto it = nestedDependencies.begin(); it != nestedDependencies.end(); ++it)
+        newInclude.dependencies.push_back(std::make_pair(*it, cache->LastModifiedTime(*it)));
+
+    code += newInclude.code;
+    dependencies.insert(dependencies.end(), nestedDependencies.begin(), nestedDependencies.end());
+
+    std::lock_guard<std::mutex> lock(includeCacheMutex);
+    includeCache[includeName] = std::move(newInclude);
+    return true;
+}
+
+ShaderProgram* Shader::FindProgram(unsigned long long key) const
+{
+    if (programSlots.empty())
+        return nullptr;
+
+    size_t mask = programSlots.size() - 1;
+    for (size_t i = ProgramSlotIndex(key, mask); programSlots[i].key; i = (i + 1) & mask)
+    {
+        if (programSlots[i].key == key)
+            return programSlots[i].program;
+    }
+
+    return nullptr;
+}
+
+void Shader::InsertProgram(unsigned long long key, ShaderProgram* program)
+{
+    // Keep the load factor at most 3/4 so that probe sequences stay short
+    if ((numPrograms + 1) * 4 > programSlots.size() * 3)
+    {
+        std::vector<ShaderProgramSlot> oldSlots;
+        oldSlots.swap(programSlots);
+        programSlots.resize(oldSlots.size() ? oldSlots.size() * 2 : INITIAL_PROGRAM_SLOTS);
+        numPrograms = 0;
+
+        for (auto it = oldSlots.begin(); it != oldSlots.end(); ++it)
+        {
+            if (it->key)
+                InsertProgram(it->key, it->program);
+        }
+    }
+
+    size_t mask = programSlots.size() - 1;
+    size_t i = ProgramSlotIndex(key, mask);
+    while (programSlots[i].key)
+        i = (i + 1) & mask;
+
+    programSlots[i].key = key;
+    programSlots[i].program = program;
+    ++numPrograms;
+}
@@ -5,8 +5,25 @@
 #include "../Resource/Resource.h"
 #include "GraphicsDefs.h"
 
+#include <unordered_map>
+
 class ShaderProgram;
 
+/// Slot of the shader program hash table.
+struct ShaderProgramSlot
+{
+    /// Construct empty.
+    ShaderProgramSlot() :
+        key(0)
+    {
+    }
+
+    /// Combined define set IDs, zero if empty.
+    unsigned long long key;
+    /// %Shader program.
+    SharedPtr<ShaderProgram> program;
+};
+
 /// %Shader resource. Defines shader source code, from which shader programs can be compiled & linked by specifying defines.
 class Shader : public Resource
 {
@@ -25,24 +42,51 @@ public:
     bool BeginLoad(Stream& source) override;
     /// Finish shader loading in the main thread. Return true on success.
     bool EndLoad() override;
+    /// Return the included files.
+    void FileDependencies(std::vector<std::string>& dest) const override;
 
     /// Define shader from source code. All existing variations are destroyed.
     void Define(const std::string& code);
-    /// Create and return a shader program with defines. Existing program is returned if possible. Variations should be cached to avoid repeated query.
-    ShaderProgram* CreateProgram(const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
+    /// Create and return a shader program with defines. Existing program is returned if possible. Variations should be cached to avoid repeated query. A new program is compiled asynchronously if requested and supported.
+    ShaderProgram* CreateProgram(const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString, bool async = false);
+    /// Create and return a compute shader program with defines, compiled from the comp() function. Existing program is returned if possible. Requires compute shader support.
+    ShaderProgram* CreateComputeProgram(const std::string& defines = JSONValue::emptyString);
     
     /// Return shader source code.
     const std::string& SourceCode() const { return sourceCode; }
+    /// Return the version number, which is incremented whenever the source code changes and the existing programs are released.
+    unsigned Version() const { return version; }
 
     /// Sort the defines and strip extra spaces to prevent creation of unnecessary duplicate shader variations.
     std::string NormalizeDefines(const std::string& defines);
+    /// Return the ID of a define set, normalizing and interning it on first use. Define strings that normalize the same share an ID.
+    unsigned DefinesId(const std::string& defines);
+
+    /// Clear the cache of include files expanded with their own includes. Cached files are otherwise reused while their and their includes' modification times are unchanged.
+    static void ClearIncludeCache();
 
 private:
-    /// Process include statements in the shader source code recursively. Return true if successful.
-    bool ProcessIncludes(std::string& code, Stream& source);
+    /// Process include statements in the shader source code recursively, and add the included files to the dependencies. Return true if successful.
+    bool ProcessIncludes(std::string& code, std::vector<std::string>& dependencies, Stream& source);
+    /// Append an include file expanded with its own includes from the include cache, or read and cache it. Return true if successful.
+    bool ExpandInclude(std::string& code, std::vector<std::string>& dependencies, const std::string& includeName);
+    /// Return a shader program by combined define set IDs or null if not found.
+    ShaderProgram* FindProgram(unsigned long long key) const;
+    /// Add a shader program by combined define set IDs, growing the hash table as necessary.
+    void InsertProgram(unsigned long long key, ShaderProgram* program);
 
-    /// %Shader programs.
-    std::map<std::pair<StringHash, StringHash>, SharedPtr<ShaderProgram> > programs;
+    /// %Shader programs in an open addressing hash table. Compute programs use the vertex shader half of the key.
+    std::vector<ShaderProgramSlot> programSlots;
+    /// Number of shader programs in the hash table.
+    size_t numPrograms;
+    /// Define set IDs by both the original and normalized define strings.
+    std::unordered_map<std::string, unsigned> defineIds;
+    /// Normalized define strings by ID.
+    std::vector<std::string> defineStrings;
     /// %Shader source code.
     std::string sourceCode;
+    /// Included files.
+    std::vector<std::string> includeFiles;
+    /// Source code version.
+    unsigned version;
 };
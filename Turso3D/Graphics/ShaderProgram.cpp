@@ -1,5 +1,7 @@
 ﻿// For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/File.h"
+#include "../IO/FileSystem.h"
 #include "../IO/Log.h"
 #include "Graphics.h"
 #include "ShaderProgram.h"
@@ -7,11 +9,50 @@
 #include <glew.h>
 #include <tracy/Tracy.hpp>
 
+#include <algorithm>
 #include <cctype>
+#include <cstdio>
 
 static ShaderProgram* boundProgram = nullptr;
 
+IdAllocator ShaderProgram::idAllocator;
+
 const size_t MAX_NAME_LENGTH = 256;
+// Program cache file format version, increment when the format or reflection data changes
+const unsigned PROGRAM_CACHE_VERSION = 1;
+// 64-bit FNV-1a hash parameters for program cache keys
+const unsigned long long FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+const unsigned long long FNV_PRIME = 0x100000001b3ULL;
+
+/// Reflected uniform of a linked program.
+struct UniformReflection
+{
+    /// Name without array subscript.
+    std::string name;
+    /// Location.
+    int location;
+    /// OpenGL type.
+    unsigned type;
+    /// Number of array elements.
+    int numElements;
+};
+
+/// Reflection data of a linked program, stored in the program cache to skip the queries.
+struct ProgramReflection
+{
+    /// Construct.
+    ProgramReflection() :
+        attributes(0)
+    {
+    }
+
+    /// Used vertex attribute bitmask.
+    unsigned attributes;
+    /// Active uniforms.
+    std::vector<UniformReflection> uniforms;
+    /// Active uniform block names and indices.
+    std::vector<std::pair<std::string, int> > uniformBlocks;
+};
 
 const char* attribNames[] =
 {
@@ -26,7 +67,8 @@ const char* attribNames[] =
     "texCoord4",
     "texCoord5",
     "blendWeights",
-    "blendIndices"
+    "blendIndices",
+    nullptr
 };
 
 void CommentOutFunction(std::string& code, const std::string& signature)
@@ -54,6 +96,27 @@ void CommentOutFunction(std::string& code, const std::string& signature)
     }
 }
 
+unsigned long long HashString(unsigned long long hash, const std::string& string)
+{
+    for (size_t i = 0; i < string.length(); ++i)
+        hash = (hash ^ (unsigned char)string[i]) * FNV_PRIME;
+    return hash;
+}
+
+/// Return the registered custom uniform names by slot. Function-local so that slots can be registered during static initialization.
+static std::vector<StringHash>& CustomUniformNames()
+{
+    static std::vector<StringHash> names;
+    return names;
+}
+
+/// Return the registered custom uniform slots by name.
+static std::map<std::string, unsigned>& CustomUniformSlots()
+{
+    static std::map<std::string, unsigned> slots;
+    return slots;
+}
+
 int NumberPostfix(const std::string& string)
 {
     for (size_t i = 0; i < string.length(); ++i)
@@ -65,19 +128,53 @@ int NumberPostfix(const std::string& string)
     return -1;
 }
 
-ShaderProgram::ShaderProgram(const std::string& sourceCode, const std::string& shaderName_, const std::string& vsDefines, const std::string& fsDefines) :
+ShaderProgram::ShaderProgram(const std::string& sourceCode, const std::string& shaderName_, const std::string& vsDefines, const std::string& fsDefines, bool async_) :
     lastPerMaterialUniforms(0),
-    program(0)
+    bindlessSamplers(false),
+    program(0),
+    cacheKey(0),
+    id(idAllocator.Allocate()),
+    compute(false),
+    async(async_ && Object::Subsystem<Graphics>()->HasParallelShaderCompile()),
+    linkPending(false)
 {
     assert(Object::Subsystem<Graphics>()->IsInitialized());
 
+    for (size_t i = 0; i < 3; ++i)
+        linkShaders[i] = 0;
+
     shaderName = vsDefines.length() ? (shaderName_ + " " + vsDefines + " " + fsDefines) : (shaderName_ + " " + fsDefines);
 
     Create(sourceCode, Split(vsDefines), Split(fsDefines));
 }
 
+ShaderProgram::ShaderProgram(const std::string& sourceCode, const std::string& shaderName_, const std::string& csDefines, bool compute_) :
+    lastPerMaterialUniforms(0),
+    bindlessSamplers(false),
+    program(0),
+    cacheKey(0),
+    id(idAllocator.Allocate()),
+    compute(compute_),
+    async(false),
+    linkPending(false)
+{
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+
+    for (size_t i = 0; i < 3; ++i)
+        linkShaders[i] = 0;
+
+    shaderName = shaderName_ + " " + csDefines;
+
+    if (compute)
+        CreateCompute(sourceCode, Split(csDefines));
+    else
+        Create(sourceCode, Split(csDefines), Split(csDefines));
+}
+
 ShaderProgram::~ShaderProgram()
 {
+    idAllocator.Free(id);
+
     // Context may be gone at destruction time. In this case just no-op the cleanup
     if (!Object::Subsystem<Graphics>())
         return;
@@ -101,11 +198,36 @@ int ShaderProgram::Uniform(StringHash name) const
     return it != uniforms.end() ? it->second : -1;
 }
 
+UniformSlot ShaderProgram::RegisterUniform(const std::string& name)
+{
+    std::map<std::string, unsigned>& slots = CustomUniformSlots();
+    auto it = slots.find(name);
+    if (it != slots.end())
+        return UniformSlot(it->second);
+
+    unsigned index = (unsigned)CustomUniformNames().size();
+    CustomUniformNames().push_back(StringHash(name));
+    slots[name] = index;
+    return UniformSlot(index);
+}
+
+int ShaderProgram::ResolveUniform(UniformSlot slot) const
+{
+    const std::vector<StringHash>& names = CustomUniformNames();
+    for (size_t i = customUniforms.size(); i < names.size(); ++i)
+        customUniforms.push_back(Uniform(names[i]));
+
+    return slot.index < customUniforms.size() ? customUniforms[slot.index] : -1;
+}
+
 bool ShaderProgram::Bind()
 {
+    if (linkPending && !IsReady())
+        return false;
     if (!program)
         return false;
 
+    Graphics::CountStateCall(STATE_PROGRAM, boundProgram == this);
     if (boundProgram == this)
         return true;
 
@@ -114,12 +236,32 @@ bool ShaderProgram::Bind()
     return true;
 }
 
+bool ShaderProgram::IsReady()
+{
+    if (!linkPending)
+        return true;
+
+    int completed = 0;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_ARB, &completed);
+    if (!completed)
+        return false;
+
+    FinishLink();
+    return true;
+}
+
 void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines)
 {
     ZoneScoped;
 
+    for (size_t i = 0; i < MAX_TEXTURE_UNITS; ++i)
+        samplerUniforms[i] = -1;
+
+    // Enable bindless textures when supported, so that any sampler can also be set to a texture handle
+    const char* versionHeader = Object::Subsystem<Graphics>()->HasBindlessTextures() ? "#version 400\n#extension GL_ARB_bindless_texture : enable\n" : "#version 150\n";
+
     std::string vsSourceCode;
-    vsSourceCode += "#version 150\n";
+    vsSourceCode += versionHeader;
     vsSourceCode += "#define COMPILEVS\n";
     for (size_t i = 0; i < vsDefines.size(); ++i)
     {
@@ -128,34 +270,12 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
         vsSourceCode += "\n";
     }
     vsSourceCode += sourceCode;
+    CommentOutFunction(vsSourceCode, "void geom(");
     CommentOutFunction(vsSourceCode, "void frag(");
     ReplaceInPlace(vsSourceCode, "void vert(", "void main(");
-    const char* vsShaderStr = vsSourceCode.c_str();
-
-    int vsCompiled;
-    unsigned vs = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vs, 1, &vsShaderStr, nullptr);
-    glCompileShader(vs);
-    glGetShaderiv(vs, GL_COMPILE_STATUS, &vsCompiled);
-
-    {
-        int length, outLength;
-        std::string errorString;
-
-        glGetShaderiv(vs, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetShaderInfoLog(vs, 1024, &outLength, &errorString[0]);
-
-        if (!vsCompiled)
-            LOGERRORF("VS %s compile error: %s", shaderName.c_str(), errorString.c_str());
-#ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("VS %s compile output: %s", shaderName.c_str(), errorString.c_str());
-#endif
-    }
 
     std::string fsSourceCode;
-    fsSourceCode += "#version 150\n";
+    fsSourceCode += versionHeader;
     fsSourceCode += "#define COMPILEFS\n";
     for (size_t i = 0; i < fsDefines.size(); ++i)
     {
@@ -165,47 +285,171 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
     }
     fsSourceCode += sourceCode;
     CommentOutFunction(fsSourceCode, "void vert(");
+    CommentOutFunction(fsSourceCode, "void geom(");
     ReplaceInPlace(fsSourceCode, "void frag(", "void main(");
-    const char* fsShaderStr = fsSourceCode.c_str();
-
-    int fsCompiled;
-    unsigned fs = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fs, 1, &fsShaderStr, nullptr);
-    glCompileShader(fs);
-    glGetShaderiv(fs, GL_COMPILE_STATUS, &fsCompiled);
 
+    // The geometry shader is compiled only when requested with a define, as the same source also serves the variations without it
+    std::string gsSourceCode;
+    if (std::find(vsDefines.begin(), vsDefines.end(), "GEOMETRYSHADER") != vsDefines.end() && sourceCode.find("void geom(") != std::string::npos)
     {
-        int length, outLength;
-        std::string errorString;
+        gsSourceCode += versionHeader;
+        gsSourceCode += "#define COMPILEGS\n";
+        for (size_t i = 0; i < vsDefines.size(); ++i)
+        {
+            gsSourceCode += "#define ";
+            gsSourceCode += Replace(vsDefines[i], '=', ' ');
+            gsSourceCode += "\n";
+        }
+        gsSourceCode += sourceCode;
+        CommentOutFunction(gsSourceCode, "void vert(");
+        CommentOutFunction(gsSourceCode, "void frag(");
+        ReplaceInPlace(gsSourceCode, "void geom(", "void main(");
+    }
 
-        glGetShaderiv(fs, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetShaderInfoLog(fs, 1024, &outLength, &errorString[0]);
+    if (LoadBinary(CacheKey(vsSourceCode + fsSourceCode + gsSourceCode)))
+        return;
 
-        if (!fsCompiled)
-            LOGERRORF("FS %s compile error: %s", shaderName.c_str(), errorString.c_str());
-#ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("FS %s compile output: %s", shaderName.c_str(), errorString.c_str());
-#endif
-    }
+    unsigned vs = CompileShader(GL_VERTEX_SHADER, "VS", vsSourceCode);
+    unsigned fs = CompileShader(GL_FRAGMENT_SHADER, "FS", fsSourceCode);
+    unsigned gs = gsSourceCode.length() ? CompileShader(GL_GEOMETRY_SHADER, "GS", gsSourceCode) : 0;
 
-    if (!vsCompiled || !fsCompiled)
+    if (!vs || !fs || (gsSourceCode.length() && !gs))
     {
         glDeleteShader(vs);
         glDeleteShader(fs);
+        glDeleteShader(gs);
+        return;
+    }
+
+    Link(vs, fs, gs);
+}
+
+void ShaderProgram::CreateCompute(const std::string& sourceCode, const std::vector<std::string>& csDefines)
+{
+    ZoneScoped;
+
+    for (size_t i = 0; i < MAX_TEXTURE_UNITS; ++i)
+        samplerUniforms[i] = -1;
+
+    std::string csSourceCode;
+    csSourceCode += "#version 430\n";
+    csSourceCode += "#define COMPILECS\n";
+    for (size_t i = 0; i < csDefines.size(); ++i)
+    {
+        csSourceCode += "#define ";
+        csSourceCode += Replace(csDefines[i], '=', ' ');
+        csSourceCode += "\n";
+    }
+    csSourceCode += sourceCode;
+    CommentOutFunction(csSourceCode, "void vert(");
+    CommentOutFunction(csSourceCode, "void geom(");
+    CommentOutFunction(csSourceCode, "void frag(");
+    ReplaceInPlace(csSourceCode, "void comp(", "void main(");
+
+    if (LoadBinary(CacheKey(csSourceCode)))
+        return;
+
+    unsigned cs = CompileShader(GL_COMPUTE_SHADER, "CS", csSourceCode);
+    if (!cs)
         return;
+
+    Link(cs, 0);
+}
+
+unsigned ShaderProgram::CompileShader(unsigned type, const char* typeName, const std::string& sourceCode)
+{
+    const char* shaderStr = sourceCode.c_str();
+
+    unsigned shader = glCreateShader(type);
+    glShaderSource(shader, 1, &shaderStr, nullptr);
+    glCompileShader(shader);
+
+    // Querying the compile status would wait for the driver's compiler threads
+    if (async)
+        return shader;
+
+    if (!CheckShader(shader, typeName))
+    {
+        glDeleteShader(shader);
+        return 0;
     }
 
+    return shader;
+}
+
+bool ShaderProgram::CheckShader(unsigned shader, const char* typeName)
+{
+    int compiled;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+
+    int length, outLength;
+    std::string errorString;
+
+    glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+    errorString.resize(length);
+    glGetShaderInfoLog(shader, 1024, &outLength, &errorString[0]);
+
+    if (!compiled)
+        LOGERRORF("%s %s compile error: %s", typeName, shaderName.c_str(), errorString.c_str());
+#ifdef _DEBUG
+    else if (length > 1)
+        LOGDEBUGF("%s %s compile output: %s", typeName, shaderName.c_str(), errorString.c_str());
+#endif
+
+    return compiled != 0;
+}
+
+void ShaderProgram::Link(unsigned firstShader, unsigned secondShader, unsigned thirdShader)
+{
     program = glCreateProgram();
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
-    for (unsigned i = 0; i < MAX_VERTEX_ATTRIBUTES; ++i)
-        glBindAttribLocation(program, i, attribNames[i]);
+    glAttachShader(program, firstShader);
+    if (secondShader)
+        glAttachShader(program, secondShader);
+    if (thirdShader)
+        glAttachShader(program, thirdShader);
+    if (!compute)
+    {
+        for (unsigned i = 0; i < MAX_VERTEX_ATTRIBUTES; ++i)
+            glBindAttribLocation(program, i, attribNames[i]);
+    }
+    if (cacheKey)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
 
     glLinkProgram(program);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
+    linkShaders[0] = firstShader;
+    linkShaders[1] = secondShader;
+    linkShaders[2] = thirdShader;
+
+    // When asynchronous, finish on the first poll or bind after the driver reports completion
+    if (async)
+        linkPending = true;
+    else
+        FinishLink();
+}
+
+void ShaderProgram::FinishLink()
+{
+    ZoneScoped;
+
+    linkPending = false;
+
+    // The compile errors of an asynchronous program are more informative than the link error, so log them first
+    if (async)
+    {
+        const char* typeNames[] = { "VS", "FS", "GS" };
+        for (size_t i = 0; i < 3; ++i)
+        {
+            if (linkShaders[i])
+                CheckShader(linkShaders[i], typeNames[i]);
+        }
+    }
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        if (linkShaders[i])
+            glDeleteShader(linkShaders[i]);
+        linkShaders[i] = 0;
+    }
 
     int linked;
     glGetProgramiv(program, GL_LINK_STATUS, &linked);
@@ -234,8 +478,7 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
     char nameBuffer[MAX_NAME_LENGTH];
     int numAttributes, numUniforms, nameLength, numElements, numUniformBlocks;
     GLenum type;
-
-    attributes = 0;
+    ProgramReflection reflection;
 
     glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &numAttributes);
     for (int i = 0; i < numAttributes; ++i)
@@ -245,24 +488,53 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
         std::string name(nameBuffer, nameLength);
         size_t attribIndex = ListIndex(name.c_str(), attribNames, 0xfffffff);
         if (attribIndex < 32)
-            attributes |= (1 << attribIndex);
+            reflection.attributes |= (1 << attribIndex);
     }
 
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+    for (int i = 0; i < numUniforms; ++i)
+    {
+        glGetActiveUniform(program, i, MAX_NAME_LENGTH, &nameLength, &numElements, &type, nameBuffer);
+
+        UniformReflection uniform;
+        uniform.name = std::string(nameBuffer, nameLength);
+        uniform.location = glGetUniformLocation(program, uniform.name.c_str());
+        uniform.type = type;
+        uniform.numElements = numElements;
+        ReplaceInPlace(uniform.name, "[0]", "");
+        reflection.uniforms.push_back(uniform);
+    }
+
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numUniformBlocks);
+    for (int i = 0; i < numUniformBlocks; ++i)
+    {
+        glGetActiveUniformBlockName(program, i, MAX_NAME_LENGTH, &nameLength, nameBuffer);
+        std::string name(nameBuffer, nameLength);
+        reflection.uniformBlocks.push_back(std::make_pair(name, (int)glGetUniformBlockIndex(program, name.c_str())));
+    }
+
+    ApplyReflection(reflection);
+    SaveBinary(reflection);
+
+    LOGDEBUGF("Linked shader program %s", shaderName.c_str());
+}
+
+void ShaderProgram::ApplyReflection(const ProgramReflection& reflection)
+{
+    attributes = reflection.attributes;
     uniforms.clear();
+    customUniforms.clear();
 
     Bind();
-    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
 
     for (size_t i = 0; i < MAX_PRESET_UNIFORMS; ++i)
         presetUniforms[i] = -1;
 
-    for (int i = 0; i < numUniforms; ++i)
+    for (auto it = reflection.uniforms.begin(); it != reflection.uniforms.end(); ++it)
     {
-        glGetActiveUniform(program, i, MAX_NAME_LENGTH, &nameLength, &numElements, &type, nameBuffer);
-        std::string name(nameBuffer, nameLength);
-
-        int location = glGetUniformLocation(program, name.c_str());
-        ReplaceInPlace(name, "[0]", "");
+        const std::string& name = it->name;
+        int location = it->location;
+        unsigned type = it->type;
         uniforms[StringHash(name)] = location;
 
         // Check if uniform is a preset one for quick access
@@ -279,38 +551,179 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
                 continue;
 
             // Array samplers may have multiple elements, assign each sequentially
-            if (numElements > 1)
+            if (it->numElements > 1)
             {
                 std::vector<int> units;
-                for (int j = 0; j < numElements; ++j)
+                for (int j = 0; j < it->numElements; ++j)
                     units.push_back(unit++);
-                glUniform1iv(location, numElements, &units[0]);
+                glUniform1iv(location, it->numElements, &units[0]);
             }
             else
+            {
+                glUniform1iv(location, 1, &unit);
+                if (unit < (int)MAX_TEXTURE_UNITS)
+                    samplerUniforms[unit] = location;
+            }
+        }
+        else if (type >= GL_IMAGE_1D && type <= GL_UNSIGNED_INT_IMAGE_2D_MULTISAMPLE_ARRAY)
+        {
+            // Assign image uniforms to an image unit the same way, for shaders that cannot use the binding layout qualifier
+            int unit = NumberPostfix(name);
+            if (unit >= 0)
                 glUniform1iv(location, 1, &unit);
         }
     }
 
-    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numUniformBlocks);
-    for (int i = 0; i < numUniformBlocks; ++i)
+    for (auto it = reflection.uniformBlocks.begin(); it != reflection.uniformBlocks.end(); ++it)
     {
-        glGetActiveUniformBlockName(program, i, MAX_NAME_LENGTH, &nameLength, nameBuffer);
-        std::string name(nameBuffer, nameLength);
-
-        int blockIndex = glGetUniformBlockIndex(program, name.c_str());
-        int bindingIndex = NumberPostfix(name);
+        int blockIndex = it->second;
+        int bindingIndex = NumberPostfix(it->first);
         // If no number postfix in the name, use the block index
         if (bindingIndex < 0)
             bindingIndex = blockIndex;
 
         glUniformBlockBinding(program, blockIndex, bindingIndex);
     }
+}
 
-    LOGDEBUGF("Linked shader program %s", shaderName.c_str());
+unsigned long long ShaderProgram::CacheKey(const std::string& sourceCode)
+{
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    if (!graphics->HasProgramBinary() || graphics->ProgramCacheDir().empty())
+        return cacheKey = 0;
+
+    // Key by the final source code including defines, and the driver, as binaries are not portable between drivers or driver versions
+    std::string driver;
+    for (GLenum name : { GL_VENDOR, GL_RENDERER, GL_VERSION })
+    {
+        const char* str = reinterpret_cast<const char*>(glGetString(name));
+        if (str)
+            driver += str;
+    }
+
+    unsigned long long hash = HashString(HashString(FNV_OFFSET_BASIS, driver), sourceCode);
+
+    // Zero means no caching
+    return cacheKey = hash ? hash : 1;
+}
+
+std::string ShaderProgram::CacheFileName() const
+{
+    char hexString[17];
+    snprintf(hexString, sizeof hexString, "%016llx", cacheKey);
+    return AddTrailingSlash(Object::Subsystem<Graphics>()->ProgramCacheDir()) + hexString + ".bin";
+}
+
+bool ShaderProgram::LoadBinary(unsigned long long key)
+{
+    if (!key)
+        return false;
+
+    ZoneScoped;
+
+    File file(CacheFileName());
+    if (!file.IsReadable() || file.ReadFileID() != "TPRG" || file.Read<unsigned>() != PROGRAM_CACHE_VERSION || file.Read<unsigned long long>() != key)
+        return false;
+
+    unsigned binaryFormat = file.Read<unsigned>();
+    std::vector<unsigned char> binary = file.ReadBuffer();
+
+    ProgramReflection reflection;
+    reflection.attributes = file.Read<unsigned>();
+    reflection.uniforms.resize(file.Read<unsigned>());
+    for (auto it = reflection.uniforms.begin(); it != reflection.uniforms.end(); ++it)
+    {
+        it->name = file.Read<std::string>();
+        it->location = file.Read<int>();
+        it->type = file.Read<unsigned>();
+        it->numElements = file.Read<int>();
+    }
+    reflection.uniformBlocks.resize(file.Read<unsigned>());
+    for (auto it = reflection.uniformBlocks.begin(); it != reflection.uniformBlocks.end(); ++it)
+    {
+        it->first = file.Read<std::string>();
+        it->second = file.Read<int>();
+    }
+
+    if (binary.empty() || file.Position() != file.Size())
+        return false;
+
+    // The driver may reject the binary, for example after an update it did not change the version string for. Compile normally then
+    program = glCreateProgram();
+    glProgramBinary(program, binaryFormat, &binary[0], (GLsizei)binary.size());
+
+    int linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        glDeleteProgram(program);
+        program = 0;
+        return false;
+    }
+
+    // Uniform values and block bindings are reset by loading the binary, so the reflection is applied again
+    ApplyReflection(reflection);
+
+    LOGDEBUGF("Loaded shader program %s from the program cache", shaderName.c_str());
+    return true;
+}
+
+void ShaderProgram::SaveBinary(const ProgramReflection& reflection)
+{
+    if (!cacheKey)
+        return;
+
+    ZoneScoped;
+
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<unsigned char> binary(length);
+    GLenum binaryFormat;
+    glGetProgramBinary(program, length, &length, &binaryFormat, &binary[0]);
+    binary.resize(length);
+
+    File file(CacheFileName(), FILE_WRITE);
+    if (!file.IsWritable())
+    {
+        LOGWARNING("Could not write shader program cache file " + CacheFileName());
+        return;
+    }
+
+    file.Write("TPRG", 4);
+    file.Write<unsigned>(PROGRAM_CACHE_VERSION);
+    file.Write<unsigned long long>(cacheKey);
+    file.Write<unsigned>(binaryFormat);
+    file.WriteBuffer(binary);
+    file.Write<unsigned>(reflection.attributes);
+    file.Write<unsigned>((unsigned)reflection.uniforms.size());
+    for (auto it = reflection.uniforms.begin(); it != reflection.uniforms.end(); ++it)
+    {
+        file.Write<std::string>(it->name);
+        file.Write<int>(it->location);
+        file.Write<unsigned>(it->type);
+        file.Write<int>(it->numElements);
+    }
+    file.Write<unsigned>((unsigned)reflection.uniformBlocks.size());
+    for (auto it = reflection.uniformBlocks.begin(); it != reflection.uniformBlocks.end(); ++it)
+    {
+        file.Write<std::string>(it->first);
+        file.Write<int>(it->second);
+    }
 }
 
 void ShaderProgram::Release()
 {
+    for (size_t i = 0; i < 3; ++i)
+    {
+        if (linkShaders[i])
+            glDeleteShader(linkShaders[i]);
+        linkShaders[i] = 0;
+    }
+    linkPending = false;
+
     if (program)
     {
         glDeleteProgram(program);
@@ -4,20 +4,27 @@
 
 #include "../IO/JSONValue.h"
 #include "../IO/StringHash.h"
+#include "../Object/IdAllocator.h"
 #include "../Object/Ptr.h"
 #include "GraphicsDefs.h"
 
-/// Linked shader program consisting of vertex and fragment shaders.
+struct ProgramReflection;
+
+/// Linked shader program consisting of vertex and fragment shaders and an optional geometry shader, or a compute shader.
 class ShaderProgram : public RefCounted
 {
 public:
-    /// Construct from shader source code and defines. Graphics subsystem must have been initialized.
-    ShaderProgram(const std::string& sourceCode, const std::string& shaderName = JSONValue::emptyString, const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
+    /// Construct from shader source code and defines. Graphics subsystem must have been initialized. A geometry shader is compiled from the geom() function with the vertex shader defines if they include GEOMETRYSHADER. If asynchronous and parallel shader compile is supported, returns before the driver has finished compiling and linking; the program is not bindable until then.
+    ShaderProgram(const std::string& sourceCode, const std::string& shaderName = JSONValue::emptyString, const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString, bool async = false);
+    /// Construct a compute shader program from shader source code and defines. Requires compute shader support. If the compute flag is false, compiles vertex and fragment shaders with the same defines instead.
+    ShaderProgram(const std::string& sourceCode, const std::string& shaderName, const std::string& csDefines, bool compute);
     /// Destruct.
     ~ShaderProgram();
 
-    /// Bind for using. No-op if already bound. Return false if program is not successfully linked.
+    /// Bind for using. No-op if already bound. Return false if program is not successfully linked, or is still being linked asynchronously.
     bool Bind();
+    /// Return whether compiling and linking has finished, whether successfully or not. Polls an asynchronous link without blocking and finishes it when complete.
+    bool IsReady();
 
     /// Return shader name concatenated from parent shader name and defines.
     const std::string& ShaderName() const { return shaderName; }
@@ -33,27 +40,82 @@ public:
     int Uniform(StringHash name) const;
     /// Return preset uniform location or negative if not found.
     int Uniform(PresetUniform uniform) const { return presetUniforms[uniform]; }
+    /// Return registered custom uniform location or negative if not found. Slots registered after the last call are resolved on first use.
+    int Uniform(UniformSlot slot) const { return slot.index < customUniforms.size() ? customUniforms[slot.index] : ResolveUniform(slot); }
+    /// Return the location of the non-array sampler uniform assigned to a texture unit or negative if not found.
+    int SamplerUniform(size_t unit) const { return unit < MAX_TEXTURE_UNITS ? samplerUniforms[unit] : -1; }
+
+    /// Return whether is a compute shader program.
+    bool IsCompute() const { return compute; }
 
     /// Return the OpenGL shader program identifier. Zero if not successfully compiled and linked.
     unsigned GLProgram() const { return program; }
+    /// Return compact ID, which is stable for the lifetime of the program. Can be used to key render state caches.
+    unsigned short Id() const { return id; }
 
     /// Last per-material uniform assignment. Used by Renderer.
     unsigned lastPerMaterialUniforms;
+    /// Whether material samplers have been set to bindless handles. Used by Renderer.
+    bool bindlessSamplers;
+
+    /// Register a custom uniform name and return its slot. Registering the same name again returns the same slot. Call only from the main thread.
+    static UniformSlot RegisterUniform(const std::string& name);
 
 private:
     /// Compile & link.
     void Create(const std::string& sourceCode, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines);
+    /// Compile & link a compute shader.
+    void CreateCompute(const std::string& sourceCode, const std::vector<std::string>& csDefines);
+    /// Compile a shader stage. Return the OpenGL shader identifier, or zero on failure. When asynchronous, the compile status is checked only after linking.
+    unsigned CompileShader(unsigned type, const char* typeName, const std::string& sourceCode);
+    /// Log the compile errors or messages of a shader stage. Return true if compiled successfully.
+    bool CheckShader(unsigned shader, const char* typeName);
+    /// Start linking the compiled shaders. Finishes immediately unless asynchronous.
+    void Link(unsigned firstShader, unsigned secondShader, unsigned thirdShader = 0);
+    /// Finish linking and query the attributes and uniforms. The shaders are deleted afterward. Saves to the program cache if enabled.
+    void FinishLink();
+    /// Resolve the locations of the custom uniforms registered since the last resolve, and return the location of a slot or negative if not found.
+    int ResolveUniform(UniformSlot slot) const;
+    /// Store the attributes and uniform locations, and assign texture units and uniform block bindings.
+    void ApplyReflection(const ProgramReflection& reflection);
+    /// Calculate and store the program cache key from the final source code and the driver. Return zero if the program cache is not in use.
+    unsigned long long CacheKey(const std::string& sourceCode);
+    /// Return the program cache file name for the current key.
+    std::string CacheFileName() const;
+    /// Create the program from the program cache. Return true on success.
+    bool LoadBinary(unsigned long long key);
+    /// Save the linked program to the program cache.
+    void SaveBinary(const ProgramReflection& reflection);
     /// Release the program.
     void Release();
 
     /// OpenGL shader program identifier.
     unsigned program;
+    /// Program cache key, or zero if not cached.
+    unsigned long long cacheKey;
     /// Used vertex attribute bitmask.
     unsigned attributes;
     /// All uniform locations.
     std::map<StringHash, int> uniforms;
     /// Preset uniform locations.
     int presetUniforms[MAX_PRESET_UNIFORMS];
+    /// Sampler uniform locations by texture unit.
+    int samplerUniforms[MAX_TEXTURE_UNITS];
+    /// Registered custom uniform locations by slot, resolved on demand.
+    mutable std::vector<int> customUniforms;
     /// Shader name.
     std::string shaderName;
+    /// Compact ID.
+    unsigned short id;
+    /// Compute shader program flag.
+    bool compute;
+    /// Asynchronous compile and link flag.
+    bool async;
+    /// Asynchronous link in progress flag.
+    bool linkPending;
+    /// Shaders being linked.
+    unsigned linkShaders[3];
+
+    /// Shader program ID allocator.
+    static IdAllocator idAllocator;
 };
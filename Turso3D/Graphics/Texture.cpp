@@ -4,13 +4,26 @@
 #include "Graphics.h"
 #include "Texture.h"
 
+#include <algorithm>
 #include <glew.h>
 #include <tracy/Tracy.hpp>
 
+// Largest mip level size that is always resident when streaming
+static const int STREAMING_MIN_SIZE = 64;
+// Number of frames a streaming request keeps the finer mip levels resident
+static const unsigned STREAMING_KEEP_FRAMES = 120;
+
 static size_t activeTextureUnit = 0xffffffff;
 static unsigned activeTargets[MAX_TEXTURE_UNITS];
 static Texture* boundTextures[MAX_TEXTURE_UNITS];
 
+static const GLenum glImageAccess[] =
+{
+    GL_READ_ONLY,
+    GL_WRITE_ONLY,
+    GL_READ_WRITE
+};
+
 static const GLenum glTargets[] = 
 {
     GL_TEXTURE_2D,
@@ -44,6 +57,7 @@ const unsigned Texture::glInternalFormats[] =
     GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
     GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
     GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+    GL_COMPRESSED_RGBA_BPTC_UNORM,
     0,
     0,
     0,
@@ -51,7 +65,7 @@ const unsigned Texture::glInternalFormats[] =
     0
 };
 
-static const unsigned glFormats[] =
+const unsigned Texture::glFormats[] =
 {
     0,
     GL_RED,
@@ -77,6 +91,7 @@ static const unsigned glFormats[] =
     GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
     GL_COMPRESSED_RGBA_S3TC_DXT3_EXT,
     GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+    GL_COMPRESSED_RGBA_BPTC_UNORM,
     0,
     0,
     0,
@@ -84,7 +99,7 @@ static const unsigned glFormats[] =
     0
 };
 
-static const unsigned glDataTypes[] =
+const unsigned Texture::glDataTypes[] =
 {
     0,
     GL_UNSIGNED_BYTE,
@@ -114,30 +129,34 @@ static const unsigned glDataTypes[] =
     0,
     0,
     0,
+    0,
     0
 };
 
-static const unsigned glWrapModes[] =
-{
-    GL_REPEAT,
-    GL_MIRRORED_REPEAT,
-    GL_CLAMP_TO_EDGE,
-    GL_CLAMP_TO_BORDER,
-    GL_MIRROR_CLAMP_EXT
-};
+std::vector<Texture*> Texture::streamingTextures;
+bool Texture::mipStreamingDefault = false;
+MipFilter Texture::mipFilterDefault = MIP_FILTER_BOX;
+bool Texture::srgbMipsDefault = false;
 
 Texture::Texture() :
     texture(0),
+    gpuMemory(0),
     type(TEX_2D),
     size(IntVector3::ZERO),
     format(FMT_NONE),
     multisample(0),
-    numLevels(0)
+    numLevels(0),
+    handle(0),
+    residentLevel(0),
+    streamRequest(std::make_pair(0, 0))
 {
 }
 
 Texture::~Texture()
 {
+    if (IsStreaming())
+        streamingTextures.erase(std::find(streamingTextures.begin(), streamingTextures.end(), this));
+
     // Context may be gone at destruction time. In this case just no-op the cleanup
     if (!Object::Subsystem<Graphics>())
         return;
@@ -150,6 +169,17 @@ void Texture::RegisterObject()
     RegisterFactory<Texture>();
 }
 
+void Texture::SetDefaultMipStreaming(bool enable)
+{
+    mipStreamingDefault = enable;
+}
+
+void Texture::SetDefaultMipFilter(MipFilter filter, bool srgb)
+{
+    mipFilterDefault = filter;
+    srgbMipsDefault = srgb;
+}
+
 bool Texture::BeginLoad(Stream& source)
 {
     ZoneScoped;
@@ -179,7 +209,7 @@ bool Texture::BeginLoad(Stream& source)
         while (mipImage->Width() > 1 || mipImage->Height() > 1)
         {
             loadImages.push_back(new Image());
-            mipImage->GenerateMipImage(*loadImages.back());
+            mipImage->GenerateMipImage(*loadImages.back(), mipFilterDefault, srgbMipsDefault);
             mipImage = loadImages.back();
         }
     }
@@ -203,6 +233,60 @@ bool Texture::EndLoad()
     }
 
     Image* image = loadImages[0];
+    Graphics* graphics = Object::Subsystem<Graphics>();
+
+    // When streaming, keep the images and define the texture with only the coarse levels
+    if (mipStreamingDefault && initialData.size() > 1)
+    {
+        if (!IsStreaming())
+            streamingTextures.push_back(this);
+
+        streamImages.swap(loadImages);
+        streamLevels.swap(initialData);
+        loadImages.clear();
+        streamRequest = std::make_pair(0, 0);
+
+        filter = FILTER_TRILINEAR;
+        addressModes[0] = addressModes[1] = addressModes[2] = ADDRESS_WRAP;
+        maxAnisotropy = 16;
+        minLod = -M_MAX_FLOAT;
+        maxLod = M_MAX_FLOAT;
+        borderColor = Color::BLACK;
+        return DefineStreamingLevels(MinResidentLevel());
+    }
+    else if (IsStreaming())
+    {
+        streamingTextures.erase(std::find(streamingTextures.begin(), streamingTextures.end(), this));
+        streamImages.clear();
+        streamLevels.clear();
+        residentLevel = 0;
+    }
+
+    // With an upload budget or the upload thread, define the texture empty and queue the levels from the smallest up. The queue takes over the images
+    if (graphics->DefersUploads())
+    {
+        bool success = Define(TEX_2D, image->Size(), image->Format(), 1, initialData.size());
+        success &= DefineSampler(FILTER_TRILINEAR, ADDRESS_WRAP, ADDRESS_WRAP, ADDRESS_WRAP);
+        if (success)
+        {
+            SetBaseLevel(numLevels - 1);
+
+            std::vector<SharedPtr<Image> > owners;
+            for (size_t i = 0; i < loadImages.size(); ++i)
+            {
+                SharedPtr<Image> owner(loadImages[i].Detach());
+                for (size_t j = 0; j < owner->NumLevels(); ++j)
+                    owners.push_back(owner);
+            }
+
+            for (size_t i = initialData.size() - 1; i < initialData.size(); --i)
+                graphics->QueueUpload(this, i, initialData[i], owners[i]);
+        }
+
+        loadImages.clear();
+        return success;
+    }
+
     bool success = Define(TEX_2D, image->Size(), image->Format(), 1, initialData.size(), &initialData[0]);
     /// \todo Read a parameter file for the sampling parameters
     success &= DefineSampler(FILTER_TRILINEAR, ADDRESS_WRAP, ADDRESS_WRAP, ADDRESS_WRAP);
@@ -222,7 +306,7 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
 
     Release();
 
-    if (format_ > FMT_DXT5)
+    if (format_ > FMT_BC7)
     {
         LOGERROR("ETC1 and PVRTC formats are unsupported");
         return false;
@@ -330,6 +414,16 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
 
     glTexParameteri(glTarget, GL_TEXTURE_BASE_LEVEL, 0);
     glTexParameteri(glTarget, GL_TEXTURE_MAX_LEVEL, type != TEX_3D ? (unsigned)numLevels - 1 : 0);
+
+    ImageLevel levelSize;
+    for (size_t i = 0; i < numLevels; ++i)
+    {
+        // Only 3D textures halve their depth on each level
+        Image::CalculateDataSize(IntVector3(Max(size.x >> i, 1), Max(size.y >> i, 1), type == TEX_3D ? Max(size.z >> i, 1) : size.z), format, levelSize);
+        gpuMemory += levelSize.dataSize * multisample;
+    }
+    Graphics::CountGpuMemory(GPU_MEMORY_TEXTURE, 0, gpuMemory);
+
     LOGDEBUGF("Created texture width %d height %d depth %d format %d numLevels %d", size.x, size.y, size.z, (int)format, numLevels);
 
     return true;
@@ -353,48 +447,40 @@ bool Texture::DefineSampler(TextureFilterMode filter_, TextureAddressMode u, Tex
         LOGERROR("Texture must be defined before defining sampling parameters");
         return false;
     }
+    if (handle)
+    {
+        LOGERROR("Can not change sampling parameters of a texture with a bindless handle");
+        return false;
+    }
 
+    SamplerDescription desc;
+    desc.filter = filter;
+    desc.addressModes[0] = u;
+    desc.addressModes[1] = v;
+    desc.addressModes[2] = w;
+    desc.maxAnisotropy = maxAnisotropy;
+    desc.minLod = minLod;
+    desc.maxLod = maxLod;
+    desc.borderColor = borderColor;
+    desc.mipmaps = numLevels > 1;
+
+    sampler = Sampler::Get(desc);
+    if (sampler)
+        return true;
+
+    // Without sampler object support, set the parameters on the texture object
     ForceBind();
 
     GLenum glTarget = glTargets[type];
 
-    switch (filter)
-    {
-    case FILTER_POINT:
-    case COMPARE_POINT:
-        glTexParameteri(glTarget, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(glTarget, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        break;
-
-    case FILTER_BILINEAR:
-    case COMPARE_BILINEAR:
-        if (numLevels < 2)
-            glTexParameteri(glTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        else
-            glTexParameteri(glTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_NEAREST);
-        glTexParameteri(glTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        break;
-
-    case FILTER_ANISOTROPIC:
-    case FILTER_TRILINEAR:
-    case COMPARE_ANISOTROPIC:
-    case COMPARE_TRILINEAR:
-        if (numLevels < 2)
-            glTexParameteri(glTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        else
-            glTexParameteri(glTarget, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(glTarget, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        break;
-
-    default:
-        break;
-    }
+    glTexParameteri(glTarget, GL_TEXTURE_MIN_FILTER, Sampler::GLMinFilter(filter, numLevels > 1));
+    glTexParameteri(glTarget, GL_TEXTURE_MAG_FILTER, Sampler::GLMagFilter(filter));
 
-    glTexParameteri(glTarget, GL_TEXTURE_WRAP_S, glWrapModes[addressModes[0]]);
-    glTexParameteri(glTarget, GL_TEXTURE_WRAP_T, glWrapModes[addressModes[1]]);
-    glTexParameteri(glTarget, GL_TEXTURE_WRAP_R, glWrapModes[addressModes[2]]);
+    glTexParameteri(glTarget, GL_TEXTURE_WRAP_S, Sampler::glWrapModes[addressModes[0]]);
+    glTexParameteri(glTarget, GL_TEXTURE_WRAP_T, Sampler::glWrapModes[addressModes[1]]);
+    glTexParameteri(glTarget, GL_TEXTURE_WRAP_R, Sampler::glWrapModes[addressModes[2]]);
 
-    glTexParameterf(glTarget, GL_TEXTURE_MAX_ANISOTROPY_EXT, filter == FILTER_ANISOTROPIC ? maxAnisotropy : 1.0f);
+    glTexParameterf(glTarget, GL_TEXTURE_MAX_ANISOTROPY_EXT, filter == FILTER_ANISOTROPIC ? (float)(maxAnisotropy < Sampler::AnisotropyLimit() ? maxAnisotropy : Sampler::AnisotropyLimit()) : 1.0f);
 
     glTexParameterf(glTarget, GL_TEXTURE_MIN_LOD, minLod);
     glTexParameterf(glTarget, GL_TEXTURE_MAX_LOD, maxLod);
@@ -487,9 +573,61 @@ bool Texture::SetData(size_t level, const IntBox& box, const ImageLevel& data)
     return true;
 }
 
+void Texture::UploadLevel(size_t level, const ImageLevel& data) const
+{
+    if (!texture || type != TEX_2D)
+        return;
+
+    GLenum glTarget = glTargets[type];
+    glBindTexture(glTarget, texture);
+
+    if (!IsCompressed())
+        glTexImage2D(glTarget, (int)level, glInternalFormats[format], data.size.x, data.size.y, 0, glFormats[format], glDataTypes[format], data.data);
+    else
+        glCompressedTexImage2D(glTarget, (int)level, glInternalFormats[format], data.size.x, data.size.y, 0, (GLsizei)data.dataSize, data.data);
+
+    glBindTexture(glTarget, 0);
+}
+
+bool Texture::GetData(size_t level, void* dest)
+{
+    ZoneScoped;
+
+    if (!texture || !dest)
+        return false;
+
+    if (type != TEX_2D || multisample > 1 || IsCompressed())
+    {
+        LOGERROR("Can only read back uncompressed, non-multisampled 2D textures");
+        return false;
+    }
+
+    if (level >= numLevels)
+    {
+        LOGERROR("Mipmap level to read out of bounds");
+        return false;
+    }
+
+    ForceBind();
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glGetTexImage(GL_TEXTURE_2D, (int)level, glFormats[format], glDataTypes[format], dest);
+
+    return true;
+}
+
 void Texture::Bind(size_t unit)
 {
-    if (unit >= MAX_TEXTURE_UNITS || !texture || boundTextures[unit] == this)
+    if (unit >= MAX_TEXTURE_UNITS || !texture)
+        return;
+
+    // The sampler overrides the texture's own sampling parameters, so unbind any previous one when the texture does not use a shared sampler
+    if (sampler)
+        sampler->Bind(unit);
+    else
+        Sampler::Unbind(unit);
+
+    Graphics::CountStateCall(STATE_TEXTURE, boundTextures[unit] == this);
+    if (boundTextures[unit] == this)
         return;
 
     if (activeTextureUnit != unit)
@@ -508,6 +646,14 @@ void Texture::Bind(size_t unit)
     boundTextures[unit] = this;
 }
 
+void Texture::BindImage(size_t unit, ImageAccess access)
+{
+    if (!texture || !Object::Subsystem<Graphics>()->HasComputeShaders())
+        return;
+
+    glBindImageTexture((GLuint)unit, texture, 0, type != TEX_2D ? GL_TRUE : GL_FALSE, 0, glImageAccess[access], glInternalFormats[format]);
+}
+
 void Texture::Unbind(size_t unit)
 {
     if (boundTextures[unit])
@@ -523,11 +669,144 @@ void Texture::Unbind(size_t unit)
     }
 }
 
+unsigned long long Texture::BindlessHandle()
+{
+    if (handle || !texture || !Object::Subsystem<Graphics>()->HasBindlessTextures())
+        return handle;
+    // The base level can not be changed after the handle is created, so wait for queued uploads
+    if (!IsReady())
+        return 0;
+
+    // With a shared sampler the handle is created from it, which freezes the sampler's parameters
+    if (sampler)
+    {
+        handle = glGetTextureSamplerHandleARB(texture, sampler->GLSampler());
+        sampler->SetImmutable();
+    }
+    else
+        handle = glGetTextureHandleARB(texture);
+    if (handle)
+        glMakeTextureHandleResidentARB(handle);
+    else
+        LOGERROR("Failed to create bindless texture handle");
+
+    return handle;
+}
+
+void Texture::RequestStreamingSize(unsigned frameNumber, float pixels)
+{
+    if (streamLevels.empty())
+        return;
+
+    // Find the level whose size best matches the screen size. Races between worker threads are benign, as the worst case is a coarser level for one frame
+    const IntVector3& fullSize = streamLevels[0].size;
+    float texels = (float)Max(fullSize.x, fullSize.y);
+    size_t level = 0;
+    while (level + 1 < streamLevels.size() && texels >= 2.0f * pixels)
+    {
+        texels *= 0.5f;
+        ++level;
+    }
+
+    if (streamRequest.first != frameNumber || streamRequest.second > level)
+    {
+        streamRequest.first = frameNumber;
+        streamRequest.second = level;
+    }
+}
+
+size_t Texture::UpdateStreaming(unsigned frameNumber)
+{
+    if (streamLevels.empty())
+        return 0;
+
+    size_t minResident = MinResidentLevel();
+    size_t targetLevel = minResident;
+    if (streamRequest.first && frameNumber - streamRequest.first <= STREAMING_KEEP_FRAMES && streamRequest.second < targetLevel)
+        targetLevel = streamRequest.second;
+
+    if (targetLevel == residentLevel)
+        return 0;
+
+    // Increase detail one level at a time to spread out the uploads, but drop detail at once
+    if (targetLevel < residentLevel)
+        targetLevel = residentLevel - 1;
+
+    if (!DefineStreamingLevels(targetLevel))
+        return 0;
+
+    size_t bytes = 0;
+    for (size_t i = targetLevel; i < streamLevels.size(); ++i)
+        bytes += streamLevels[i].dataSize;
+    return bytes;
+}
+
+size_t Texture::EvictStreamingLevels()
+{
+    if (streamLevels.empty())
+        return 0;
+
+    size_t minResident = MinResidentLevel();
+    if (residentLevel >= minResident)
+        return 0;
+
+    size_t oldBytes = gpuMemory;
+    streamRequest = std::make_pair(0u, streamLevels.size());
+    if (!DefineStreamingLevels(minResident))
+        return 0;
+
+    return oldBytes > gpuMemory ? oldBytes - gpuMemory : 0;
+}
+
+void Texture::SetBaseLevel(size_t level)
+{
+    if (!texture || handle || level >= numLevels)
+        return;
+
+    ForceBind();
+    glTexParameteri(glTargets[type], GL_TEXTURE_BASE_LEVEL, (int)level);
+}
+
+bool Texture::IsReady() const
+{
+    return !texture || !Object::Subsystem<Graphics>()->IsUploadPending(this);
+}
+
+size_t Texture::CpuMemoryUse() const
+{
+    size_t bytes = 0;
+    for (auto it = streamLevels.begin(); it != streamLevels.end(); ++it)
+        bytes += it->dataSize;
+    return bytes;
+}
+
+size_t Texture::GpuMemoryUse() const
+{
+    return gpuMemory;
+}
+
 unsigned Texture::GLTarget() const
 {
     return glTargets[type];
 }
 
+bool Texture::DefineStreamingLevels(size_t level)
+{
+    const ImageLevel& data = streamLevels[level];
+    bool success = Define(TEX_2D, IntVector2(data.size.x, data.size.y), streamImages[0]->Format(), 1, streamLevels.size() - level, &data);
+    success &= DefineSampler(filter, addressModes[0], addressModes[1], addressModes[2], maxAnisotropy, minLod, maxLod, borderColor);
+    residentLevel = level;
+    return success;
+}
+
+size_t Texture::MinResidentLevel() const
+{
+    size_t level = 0;
+    while (level + 1 < streamLevels.size() && Max(streamLevels[level].size.x, streamLevels[level].size.y) > STREAMING_MIN_SIZE)
+        ++level;
+    return level;
+}
+
 void Texture::ForceBind()
 {
     boundTextures[0] = nullptr;
@@ -538,8 +817,19 @@ void Texture::Release()
 {
     if (texture)
     {
+        Object::Subsystem<Graphics>()->CancelUploads(this);
+
+        if (handle)
+        {
+            glMakeTextureHandleNonResidentARB(handle);
+            handle = 0;
+        }
+
         glDeleteTextures(1, &texture);
         texture = 0;
+        sampler.Reset();
+        Graphics::CountGpuMemory(GPU_MEMORY_TEXTURE, gpuMemory, 0);
+        gpuMemory = 0;
 
         for (size_t i = 0; i < MAX_TEXTURE_UNITS; ++i)
         {
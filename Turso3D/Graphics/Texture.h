@@ -7,6 +7,7 @@
 #include "../Math/IntRect.h"
 #include "../Resource/Image.h"
 #include "GraphicsDefs.h"
+#include "Sampler.h"
 
 class Image;
 
@@ -23,6 +24,12 @@ public:
 
     /// Register object factory.
     static void RegisterObject();
+    /// Set whether textures loaded from now on keep their mip levels in memory and stream the finer levels to the GPU on request. Default off.
+    static void SetDefaultMipStreaming(bool enable);
+    /// Set the filter used when generating mip levels for uncompressed textures loaded from now on, and whether to filter the color channels of RGBA8 images in linear space. Default box filter without sRGB conversion.
+    static void SetDefaultMipFilter(MipFilter filter, bool srgb = false);
+    /// Return the textures that stream mip levels.
+    static const std::vector<Texture*>& StreamingTextures() { return streamingTextures; }
 
     /// Load the texture image data from a stream. Return true on success.
     bool BeginLoad(Stream& source) override;
@@ -33,14 +40,30 @@ public:
     bool Define(TextureType type, const IntVector2& size, ImageFormat format, int multisample = 1, size_t numLevels = 1, const ImageLevel* initialData = 0);
     /// Define texture type and dimensions and set initial data. Return true on success.
     bool Define(TextureType type, const IntVector3& size, ImageFormat format, int multisample = 1, size_t numLevels = 1, const ImageLevel* initialData = 0);
-    /// Define sampling parameters. Return true on success.
+    /// Define sampling parameters. Uses a sampler shared with other textures of the same parameters if supported. Return true on success.
     bool DefineSampler(TextureFilterMode filter = FILTER_TRILINEAR, TextureAddressMode u = ADDRESS_WRAP, TextureAddressMode v = ADDRESS_WRAP, TextureAddressMode w = ADDRESS_WRAP, unsigned maxAnisotropy = 16, float minLod = -M_MAX_FLOAT, float maxLod = M_MAX_FLOAT, const Color& borderColor = Color::BLACK);
     /// Set data for a mipmap level. Return true on success.
     bool SetData(size_t level, const IntRect& rect, const ImageLevel& data);
     /// Set data for a mipmap level. Return true on success.
     bool SetData(size_t level, const IntBox& box, const ImageLevel& data);
+    /// Specify a whole 2D texture mipmap level with data on the current context, binding the texture directly without the state tracking. Used by the upload thread.
+    void UploadLevel(size_t level, const ImageLevel& data) const;
+    /// Read back data of a 2D texture mipmap level to a buffer large enough to hold it. Waits for rendering to the texture to finish. Return true on success.
+    bool GetData(size_t level, void* dest);
     /// Bind to texture unit. No-op if already bound.
     void Bind(size_t unit);
+    /// Bind the first mipmap level to an image unit for compute shader access. All layers of array and 3D textures are bound. Requires compute shader support.
+    void BindImage(size_t unit, ImageAccess access);
+    /// Return a resident bindless handle, creating it on first use. After that the sampling parameters can no longer be changed until the texture is redefined. Return zero if not supported.
+    unsigned long long BindlessHandle();
+    /// Request the mip level detail needed to draw the texture across a number of screen pixels this frame. Called by the renderer's worker threads; the smallest level requested in a frame wins.
+    void RequestStreamingSize(unsigned frameNumber, float pixels);
+    /// Redefine the texture with the finer mip levels requested recently, or drop the levels no longer requested. Detail is increased by one level per call. Return the number of bytes uploaded.
+    size_t UpdateStreaming(unsigned frameNumber);
+    /// Drop the streamed mip levels finer than the coarsest resident level, and forget the request so that they are streamed again only when requested again. Return the number of GPU memory bytes freed.
+    size_t EvictStreamingLevels();
+    /// Set the finest mipmap level to sample from. Used while the levels are uploaded from the smallest up. No-op if a bindless handle exists.
+    void SetBaseLevel(size_t level);
 
     /// Return texture type.
     TextureType TexType() const { return type; }
@@ -74,26 +97,53 @@ public:
     float MaxLod() const { return maxLod; }
     /// Return border color.
     const Color& BorderColor() const { return borderColor; }
+    /// Return the shared sampler, or null if sampler objects are not supported or sampling parameters have not been defined.
+    Sampler* GetSampler() const { return sampler; }
+
+    /// Return whether streams mip levels.
+    bool IsStreaming() const { return !streamLevels.empty(); }
+    /// Return the finest mip level of the full image that is resident on the GPU when streaming.
+    size_t ResidentLevel() const { return residentLevel; }
+    /// Return the renderer frame number of the last mip level request when streaming, or zero if not requested.
+    unsigned LastStreamingRequest() const { return streamRequest.first; }
+    /// Return whether all mipmap levels have been uploaded.
+    bool IsReady() const override;
+    /// Return the size of the mip levels kept in CPU memory for streaming.
+    size_t CpuMemoryUse() const override;
+    /// Return the size of the defined mip levels in GPU memory, calculated from the format.
+    size_t GpuMemoryUse() const override;
 
     /// Return the OpenGL object identifier.
     unsigned GLTexture() const { return texture; }
     /// Return the OpenGL binding target of the texture.
     unsigned GLTarget() const;
+    /// Return whether has a bindless handle.
+    bool HasBindlessHandle() const { return handle != 0; }
 
     /// Unbind a texture unit.
     static void Unbind(size_t unit);
 
     /// OpenGL texture internal formats by image format.
     static const unsigned glInternalFormats[];
+    /// OpenGL pixel transfer formats by image format.
+    static const unsigned glFormats[];
+    /// OpenGL pixel transfer data types by image format. Half-float formats are transferred as floats.
+    static const unsigned glDataTypes[];
 
 private:
     /// Force bind to the first texture unit. Used when editing.
     void ForceBind();
     /// Release the texture.
     void Release();
+    /// Define the texture from a streamed mip level downward. Return true on success.
+    bool DefineStreamingLevels(size_t level);
+    /// Return the coarsest mip level that is kept resident when streaming.
+    size_t MinResidentLevel() const;
 
     /// OpenGL object identifier.
     unsigned texture;
+    /// Allocated GPU memory in bytes.
+    size_t gpuMemory;
     /// Texture type.
     TextureType type;
     /// Texture dimensions in pixels.
@@ -116,6 +166,27 @@ private:
     float maxLod;
     /// Border color. Only effective in border addressing mode.
     Color borderColor;
+    /// Shared sampler.
+    SharedPtr<Sampler> sampler;
     /// Images used for loading.
     std::vector<AutoPtr<Image> > loadImages;
+    /// Bindless handle, or zero if not created.
+    unsigned long long handle;
+    /// Images holding the mip levels when streaming.
+    std::vector<AutoPtr<Image> > streamImages;
+    /// All mip levels of the full image when streaming.
+    std::vector<ImageLevel> streamLevels;
+    /// Finest resident mip level of the full image when streaming.
+    size_t residentLevel;
+    /// Last frame number and the finest mip level requested on it.
+    std::pair<unsigned, size_t> streamRequest;
+
+    /// Streaming textures.
+    static std::vector<Texture*> streamingTextures;
+    /// Mip streaming default for loaded textures.
+    static bool mipStreamingDefault;
+    /// Mip generation filter default for loaded textures.
+    static MipFilter mipFilterDefault;
+    /// Mip generation sRGB conversion default for loaded textures.
+    static bool srgbMipsDefault;
 };
@@ -12,6 +12,7 @@ static UniformBuffer* boundUniformBuffers[MAX_CONSTANT_BUFFER_SLOTS];
 
 UniformBuffer::UniformBuffer() :
     buffer(0),
+    gpuMemory(0),
     size(0),
     usage(USAGE_DEFAULT)
 {
@@ -80,7 +81,11 @@ bool UniformBuffer::SetData(size_t offset, size_t numBytes, const void* data, bo
 
 void UniformBuffer::Bind(size_t index)
 {
-    if (!buffer || boundUniformBuffers[index] == this)
+    if (!buffer)
+        return;
+
+    Graphics::CountStateCall(STATE_UNIFORMBUFFER, boundUniformBuffers[index] == this);
+    if (boundUniformBuffers[index] == this)
         return;
 
     glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)index, buffer, 0, size);
@@ -107,6 +112,8 @@ bool UniformBuffer::Create(const void* data)
 
     glBindBuffer(GL_UNIFORM_BUFFER, buffer);
     glBufferData(GL_UNIFORM_BUFFER, size, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    gpuMemory = size;
+    Graphics::CountGpuMemory(GPU_MEMORY_UNIFORMBUFFER, 0, gpuMemory);
     LOGDEBUGF("Created constant buffer size %u", (unsigned)size);
 
     return true;
@@ -118,6 +125,8 @@ void UniformBuffer::Release()
     {
         glDeleteBuffers(1, &buffer);
         buffer = 0;
+        Graphics::CountGpuMemory(GPU_MEMORY_UNIFORMBUFFER, gpuMemory, 0);
+        gpuMemory = 0;
 
         for (size_t i = 0; i < MAX_CONSTANT_BUFFER_SLOTS; ++i)
         {
@@ -31,6 +31,8 @@ public:
 
     /// Return the OpenGL object identifier.
     unsigned GLBuffer() const { return buffer; }
+    /// Return the allocated GPU memory in bytes.
+    size_t GpuMemoryUse() const { return gpuMemory; }
 
     /// Unbind a slot.
     static void Unbind(size_t index);
@@ -43,6 +45,8 @@ private:
 
     /// OpenGL object identifier.
     unsigned buffer;
+    /// Allocated GPU memory in bytes.
+    size_t gpuMemory;
     /// Buffer size in bytes.
     size_t size;
     /// Resource usage type.
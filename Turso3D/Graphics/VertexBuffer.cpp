@@ -2,15 +2,22 @@
 
 #include "../IO/Log.h"
 #include "Graphics.h"
+#include "IndexBuffer.h"
 #include "VertexBuffer.h"
 
 #include <glew.h>
+#include <algorithm>
 #include <cstring>
 #include <tracy/Tracy.hpp>
 
 static unsigned boundAttributes = 0;
 static VertexBuffer* boundVertexBuffer = nullptr;
 static VertexBuffer* boundVertexAttribSource = nullptr;
+static unsigned defaultVertexArray = 0;
+static unsigned boundVertexArray = 0;
+static IndexBuffer* defaultIndexBuffer = nullptr;
+static bool instanceAttributesEnabled = false;
+static std::vector<VertexBuffer*> vertexArrayOwners;
 
 static const unsigned baseAttributeIndex[] = {
     0,
@@ -29,7 +36,9 @@ static const unsigned elementGLSizes[] =
     2,
     3,
     4,
-    4
+    4,
+    4,
+    2
 };
 
 static const unsigned elementGLTypes[] =
@@ -40,16 +49,26 @@ static const unsigned elementGLTypes[] =
     GL_FLOAT,
     GL_FLOAT,
     GL_UNSIGNED_BYTE,
+    GL_INT_2_10_10_10_REV,
+    GL_HALF_FLOAT
 };
 
 VertexBuffer::VertexBuffer() :
     buffer(0),
+    gpuMemory(0),
     numVertices(0),
     vertexSize(0),
     attributes(0),
-    usage(USAGE_DEFAULT)
+    usage(USAGE_DEFAULT),
+    mappedData(nullptr),
+    streamRegion(0),
+    streamCursor(0),
+    streamFrameNumber(0)
 {
     assert(Object::Subsystem<Graphics>()->IsInitialized());
+
+    for (size_t i = 0; i < NUM_STREAM_FRAMES; ++i)
+        streamFences[i] = nullptr;
 }
 
 VertexBuffer::~VertexBuffer()
@@ -75,6 +94,8 @@ bool VertexBuffer::Define(ResourceUsage usage_, size_t numVertices_, const std::
 
     numVertices = numVertices_;
     usage = usage_;
+    if (usage == USAGE_STREAM && !Object::Subsystem<Graphics>()->HasBufferStorage())
+        usage = USAGE_DYNAMIC;
 
     // Determine offset of elements and the vertex size
     vertexSize = 0;
@@ -104,7 +125,12 @@ bool VertexBuffer::SetData(size_t firstVertex, size_t numVertices_, const void*
         return false;
     }
 
-    if (buffer)
+    if (mappedData)
+    {
+        BeginStreamFrame();
+        memcpy(mappedData + (streamRegion * numVertices + firstVertex) * vertexSize, data, numVertices_ * vertexSize);
+    }
+    else if (buffer)
     {
         Bind(0);
 
@@ -122,6 +148,53 @@ bool VertexBuffer::SetData(size_t firstVertex, size_t numVertices_, const void*
     return true;
 }
 
+bool VertexBuffer::GetData(size_t firstVertex, size_t numVertices_, void* dest)
+{
+    if (!dest)
+    {
+        LOGERROR("Null destination for reading vertex buffer");
+        return false;
+    }
+    if (firstVertex + numVertices_ > numVertices)
+    {
+        LOGERROR("Out of bounds range for reading vertex buffer");
+        return false;
+    }
+    if (!buffer || mappedData)
+    {
+        LOGERROR("Vertex buffer can not be read back");
+        return false;
+    }
+
+    Bind(0);
+    glGetBufferSubData(GL_ARRAY_BUFFER, firstVertex * vertexSize, numVertices_ * vertexSize, dest);
+    return true;
+}
+
+bool VertexBuffer::StreamData(size_t numVertices_, const void* data, size_t& firstVertex)
+{
+    if (!mappedData)
+    {
+        LOGERROR("Vertex buffer is not a stream buffer");
+        return false;
+    }
+    if (!data)
+    {
+        LOGERROR("Null source data for updating vertex buffer");
+        return false;
+    }
+
+    BeginStreamFrame();
+
+    if (streamCursor + numVertices_ > numVertices)
+        return false;
+
+    firstVertex = streamRegion * numVertices + streamCursor;
+    memcpy(mappedData + firstVertex * vertexSize, data, numVertices_ * vertexSize);
+    streamCursor += numVertices_;
+    return true;
+}
+
 void VertexBuffer::Bind(unsigned attributeMask)
 {
     if (!buffer)
@@ -130,6 +203,7 @@ void VertexBuffer::Bind(unsigned attributeMask)
     // Special case attributeMask 0 used when binding for setting buffer content only or for instancing
     if (!attributeMask)
     {
+        Graphics::CountStateCall(STATE_VERTEXBUFFER, boundVertexBuffer == this);
         if (boundVertexBuffer != this)
         {
             glBindBuffer(GL_ARRAY_BUFFER, buffer);
@@ -142,9 +216,13 @@ void VertexBuffer::Bind(unsigned attributeMask)
     attributeMask &= attributes;
 
     // If attributes already bound from this buffer, no-op
-    if (attributeMask == boundAttributes && boundVertexAttribSource == this)
+    bool filtered = attributeMask == boundAttributes && boundVertexAttribSource == this && !boundVertexArray;
+    Graphics::CountStateCall(STATE_VERTEXBUFFER, filtered);
+    if (filtered)
         return;
 
+    BindDefaultVertexArray();
+
     if (boundVertexBuffer != this)
     {
         glBindBuffer(GL_ARRAY_BUFFER, buffer);
@@ -165,7 +243,7 @@ void VertexBuffer::Bind(unsigned attributeMask)
         if (!(boundAttributes & attributeBit))
             glEnableVertexAttribArray(attributeIdx);
 
-        glVertexAttribPointer(attributeIdx, elementGLSizes[element.type], elementGLTypes[element.type], element.semantic == SEM_COLOR ? GL_TRUE : GL_FALSE, 
+        glVertexAttribPointer(attributeIdx, elementGLSizes[element.type], elementGLTypes[element.type], (element.semantic == SEM_COLOR || element.type == ELEM_INT2101010) ? GL_TRUE : GL_FALSE, 
             (GLsizei)vertexSize, reinterpret_cast<void*>(element.offset));
 
         usedAttributes |= attributeBit;
@@ -187,6 +265,98 @@ void VertexBuffer::Bind(unsigned attributeMask)
     boundVertexAttribSource = this;
 }
 
+void VertexBuffer::BindVertexArray(unsigned attributeMask, IndexBuffer* indexBuffer, bool instanced)
+{
+    if (!buffer)
+        return;
+
+    attributeMask &= attributes;
+
+    unsigned vertexArray = 0;
+    for (auto it = vertexArrays.begin(); it != vertexArrays.end(); ++it)
+    {
+        if (it->indexBuffer == indexBuffer && it->attributeMask == attributeMask && it->instanced == instanced)
+        {
+            vertexArray = it->vertexArray;
+            break;
+        }
+    }
+
+    bool filtered = vertexArray && vertexArray == boundVertexArray;
+    Graphics::CountStateCall(STATE_VERTEXBUFFER, filtered);
+    if (filtered)
+        return;
+
+    // Remember the default vertex array object's index buffer for switching back
+    if (!boundVertexArray)
+        defaultIndexBuffer = IndexBuffer::BoundIndexBuffer();
+
+    if (vertexArray)
+        glBindVertexArray(vertexArray);
+    else
+    {
+        glGenVertexArrays(1, &vertexArray);
+        if (!vertexArray)
+        {
+            LOGERROR("Failed to create vertex array object");
+            return;
+        }
+
+        glBindVertexArray(vertexArray);
+
+        if (boundVertexBuffer != this)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, buffer);
+            boundVertexBuffer = this;
+        }
+
+        for (size_t i = 0; i < elements.size(); ++i)
+        {
+            const VertexElement& element = elements[i];
+
+            unsigned attributeIdx = baseAttributeIndex[element.semantic] + element.index;
+            if (!(attributeMask & (1 << attributeIdx)))
+                continue;
+
+            glEnableVertexAttribArray(attributeIdx);
+            glVertexAttribPointer(attributeIdx, elementGLSizes[element.type], elementGLTypes[element.type], (element.semantic == SEM_COLOR || element.type == ELEM_INT2101010) ? GL_TRUE : GL_FALSE,
+                (GLsizei)vertexSize, reinterpret_cast<void*>(element.offset));
+        }
+
+        if (indexBuffer)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer->GLBuffer());
+
+        // The instance data pointers are set on each instanced draw, as they depend on the instance start
+        if (instanced)
+        {
+            for (unsigned i = ATTR_TEXCOORD3; i <= ATTR_TEXCOORD5; ++i)
+            {
+                glEnableVertexAttribArray(i);
+                glVertexAttribDivisorARB(i, 1);
+            }
+        }
+
+        if (vertexArrays.empty())
+            vertexArrayOwners.push_back(this);
+
+        VertexArrayEntry entry;
+        entry.indexBuffer = indexBuffer;
+        entry.attributeMask = attributeMask;
+        entry.instanced = instanced;
+        entry.vertexArray = vertexArray;
+        vertexArrays.push_back(entry);
+    }
+
+    boundVertexArray = vertexArray;
+    IndexBuffer::SetVertexArrayBinding(indexBuffer);
+}
+
+void VertexBuffer::BindStorage(size_t index)
+{
+    if (buffer)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, (GLuint)index, buffer);
+}
+
 unsigned VertexBuffer::CalculateAttributeMask(const std::vector<VertexElement>& elements)
 {
     unsigned attributes = 0;
@@ -206,6 +376,50 @@ size_t VertexBuffer::VertexElementSize(const VertexElement& element)
     return elementSizes[element.type];
 }
 
+void VertexBuffer::CreateDefaultVertexArray()
+{
+    glGenVertexArrays(1, &defaultVertexArray);
+    glBindVertexArray(defaultVertexArray);
+    boundVertexArray = 0;
+}
+
+void VertexBuffer::BindDefaultVertexArray()
+{
+    if (!boundVertexArray)
+        return;
+
+    glBindVertexArray(defaultVertexArray);
+    boundVertexArray = 0;
+    IndexBuffer::SetVertexArrayBinding(defaultIndexBuffer);
+}
+
+void VertexBuffer::EnableInstanceAttributes(bool enable)
+{
+    if (boundVertexArray || enable == instanceAttributesEnabled)
+        return;
+
+    for (unsigned i = ATTR_TEXCOORD3; i <= ATTR_TEXCOORD5; ++i)
+    {
+        if (enable)
+            glEnableVertexAttribArray(i);
+        else
+            glDisableVertexAttribArray(i);
+    }
+
+    instanceAttributesEnabled = enable;
+}
+
+void VertexBuffer::ReleaseVertexArrays(IndexBuffer* indexBuffer)
+{
+    if (defaultIndexBuffer == indexBuffer)
+        defaultIndexBuffer = nullptr;
+
+    // Copy the owners, as they remove themselves when they have no vertex array objects left
+    std::vector<VertexBuffer*> owners = vertexArrayOwners;
+    for (auto it = owners.begin(); it != owners.end(); ++it)
+        (*it)->DeleteVertexArrays(indexBuffer);
+}
+
 bool VertexBuffer::Create(const void* data)
 {
     glGenBuffers(1, &buffer);
@@ -217,7 +431,32 @@ bool VertexBuffer::Create(const void* data)
 
     Bind(0);
 
-    glBufferData(GL_ARRAY_BUFFER, numVertices * vertexSize, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    if (usage == USAGE_STREAM)
+    {
+        // Allocate a region for each frame in flight and keep all of them mapped. Coherent mapping makes the writes visible without explicit flushes
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        size_t regionSize = numVertices * vertexSize;
+        glBufferStorage(GL_ARRAY_BUFFER, regionSize * NUM_STREAM_FRAMES, nullptr, flags);
+        mappedData = (unsigned char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, regionSize * NUM_STREAM_FRAMES, flags);
+        if (!mappedData)
+        {
+            LOGERROR("Failed to map stream vertex buffer");
+            Release();
+            return false;
+        }
+
+        streamRegion = 0;
+        streamCursor = 0;
+        streamFrameNumber = Object::Subsystem<Graphics>()->FrameNumber();
+        if (data)
+            memcpy(mappedData, data, regionSize);
+    }
+    else
+        glBufferData(GL_ARRAY_BUFFER, numVertices * vertexSize, data, usage == USAGE_DYNAMIC ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+
+    gpuMemory = numVertices * vertexSize * (usage == USAGE_STREAM ? NUM_STREAM_FRAMES : 1);
+    Graphics::CountGpuMemory(GPU_MEMORY_VERTEXBUFFER, 0, gpuMemory);
+
     LOGDEBUGF("Created vertex buffer numVertices %u vertexSize %u", (unsigned)numVertices, (unsigned)vertexSize);
 
     if (boundVertexAttribSource == this)
@@ -230,8 +469,29 @@ void VertexBuffer::Release()
 {
     if (buffer)
     {
+        Object::Subsystem<Graphics>()->CancelUploads(this);
+
+        if (mappedData)
+        {
+            Bind(0);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            mappedData = nullptr;
+        }
+
+        for (size_t i = 0; i < NUM_STREAM_FRAMES; ++i)
+        {
+            if (streamFences[i])
+            {
+                glDeleteSync((GLsync)streamFences[i]);
+                streamFences[i] = nullptr;
+            }
+        }
+
+        DeleteVertexArrays(nullptr);
         glDeleteBuffers(1, &buffer);
         buffer = 0;
+        Graphics::CountGpuMemory(GPU_MEMORY_VERTEXBUFFER, gpuMemory, 0);
+        gpuMemory = 0;
 
         if (boundVertexBuffer == this)
             boundVertexBuffer = nullptr;
@@ -239,3 +499,60 @@ void VertexBuffer::Release()
             boundVertexAttribSource = nullptr;
     }
 }
+
+void VertexBuffer::DeleteVertexArrays(IndexBuffer* indexBuffer)
+{
+    if (vertexArrays.empty())
+        return;
+
+    for (auto it = vertexArrays.begin(); it != vertexArrays.end();)
+    {
+        if (!indexBuffer || it->indexBuffer == indexBuffer)
+        {
+            // Deleting the bound vertex array object would revert to no vertex array object at all
+            if (it->vertexArray == boundVertexArray)
+                BindDefaultVertexArray();
+
+            glDeleteVertexArrays(1, &it->vertexArray);
+            it = vertexArrays.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    if (vertexArrays.empty())
+        vertexArrayOwners.erase(std::find(vertexArrayOwners.begin(), vertexArrayOwners.end(), this));
+}
+
+void VertexBuffer::BeginStreamFrame()
+{
+    unsigned frameNumber = Object::Subsystem<Graphics>()->FrameNumber();
+    if (frameNumber == streamFrameNumber)
+        return;
+
+    ZoneScoped;
+
+    // All draws of the earlier frames have been submitted, so the fence covers the region's use
+    if (streamCursor)
+        streamFences[streamRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    streamRegion = (streamRegion + 1) % NUM_STREAM_FRAMES;
+    streamCursor = 0;
+    streamFrameNumber = frameNumber;
+
+    GLsync fence = (GLsync)streamFences[streamRegion];
+    if (fence)
+    {
+        GLbitfield waitFlags = 0;
+        for (;;)
+        {
+            GLenum result = glClientWaitSync(fence, waitFlags, 1000000);
+            if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED)
+                break;
+            waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+        }
+
+        glDeleteSync(fence);
+        streamFences[streamRegion] = nullptr;
+    }
+}
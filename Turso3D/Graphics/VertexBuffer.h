@@ -8,6 +8,21 @@
 
 #include <vector>
 
+class IndexBuffer;
+
+/// Cached vertex array object of a vertex buffer.
+struct VertexArrayEntry
+{
+    /// Index buffer bound to the vertex array object.
+    IndexBuffer* indexBuffer;
+    /// Vertex attributes enabled from the vertex buffer.
+    unsigned attributeMask;
+    /// Whether the instancing attributes are enabled.
+    bool instanced;
+    /// OpenGL object identifier.
+    unsigned vertexArray;
+};
+
 /// GPU buffer for vertex data.
 class VertexBuffer : public RefCounted
 {
@@ -19,12 +34,20 @@ public:
 
     /// Define buffer. Return true on success.
     bool Define(ResourceUsage usage, size_t numVertices, const std::vector<VertexElement>& elements, const void* data = nullptr);
-    /// Redefine buffer data either completely or partially. Return true on success.
+    /// Redefine buffer data either completely or partially. Return true on success. For a stream buffer, writes to the current frame's region.
     bool SetData(size_t firstVertex, size_t numVertices, const void* data, bool discard = false);
+    /// Append vertices to the current frame's region of a stream buffer, which stays persistently mapped. The region of a new frame is waited on until the GPU has finished reading it. Return true and the absolute index of the first vertex on success, or false if the region has no room left.
+    bool StreamData(size_t numVertices, const void* data, size_t& firstVertex);
+    /// Read back vertex data synchronously, stalling until the GPU has finished writing the buffer. Not supported for stream buffers. Intended for offline processing such as geometry merging. Return true on success.
+    bool GetData(size_t firstVertex, size_t numVertices, void* dest);
     /// Bind to use with the specified vertex attributes. No-op if already bound. Used also when defining or setting data.
     void Bind(unsigned attributeMask);
+    /// Bind a cached vertex array object holding the specified vertex attributes, the index buffer and optionally the instancing attributes, creating it on first use. The index buffer must not be bound separately while the vertex array object is in use.
+    void BindVertexArray(unsigned attributeMask, IndexBuffer* indexBuffer, bool instanced);
+    /// Bind as a shader storage buffer to an indexed binding point, for reading or writing the raw vertex data in compute shaders. Requires compute shader support.
+    void BindStorage(size_t index);
 
-    /// Return number of vertices.
+    /// Return number of vertices. For a stream buffer, the capacity of one frame's region.
     size_t NumVertices() const { return numVertices; }
     /// Return number of vertex elements.
     size_t NumElements() const { return elements.size(); }
@@ -38,23 +61,41 @@ public:
     ResourceUsage Usage() const { return usage; }
     /// Return whether is dynamic.
     bool IsDynamic() const { return usage == USAGE_DYNAMIC; }
+    /// Return whether is a persistently mapped stream buffer.
+    bool IsStream() const { return usage == USAGE_STREAM; }
 
     /// Return the OpenGL object identifier.
     unsigned GLBuffer() const { return buffer; }
+    /// Return the allocated GPU memory in bytes.
+    size_t GpuMemoryUse() const { return gpuMemory; }
 
     /// Calculate a vertex attribute mask from elements.
     static unsigned CalculateAttributeMask(const std::vector<VertexElement>& elements);
     /// Return size of vertex element.
     static size_t VertexElementSize(const VertexElement& element);
+    /// Create and bind the default vertex array object, which is used by the non-cached bindings. Called by Graphics.
+    static void CreateDefaultVertexArray();
+    /// Bind the default vertex array object if a cached vertex array object is bound.
+    static void BindDefaultVertexArray();
+    /// Enable or disable the instancing attributes in the default vertex array object. Cached vertex array objects have them fixed on creation.
+    static void EnableInstanceAttributes(bool enable);
+    /// Release the cached vertex array objects that refer to an index buffer. Called by IndexBuffer.
+    static void ReleaseVertexArrays(IndexBuffer* indexBuffer);
 
 private:
     /// Create the GPU-side vertex buffer. Return true on success.
     bool Create(const void* data);
     /// Release the vertex buffer and CPU shadow data.
     void Release();
+    /// Advance to the next frame's region of a stream buffer if the frame has changed.
+    void BeginStreamFrame();
+    /// Delete the cached vertex array objects that refer to an index buffer, or all if null.
+    void DeleteVertexArrays(IndexBuffer* indexBuffer);
 
     /// OpenGL object identifier.
     unsigned buffer;
+    /// Allocated GPU memory in bytes.
+    size_t gpuMemory;
     /// Number of vertices.
     size_t numVertices;
     /// Size of vertex in bytes.
@@ -65,4 +106,16 @@ private:
     ResourceUsage usage;
     /// Vertex elements.
     std::vector<VertexElement> elements;
+    /// Persistently mapped data of a stream buffer.
+    unsigned char* mappedData;
+    /// Region in use for a stream buffer.
+    size_t streamRegion;
+    /// Number of vertices written to the region in use.
+    size_t streamCursor;
+    /// Graphics frame number the region in use was started on.
+    unsigned streamFrameNumber;
+    /// Fences for the GPU finishing with each region.
+    void* streamFences[NUM_STREAM_FRAMES];
+    /// Cached vertex array objects.
+    std::vector<VertexArrayEntry> vertexArrays;
 };
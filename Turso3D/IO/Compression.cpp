@@ -0,0 +1,203 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Compression.h"
+
+#include <cstring>
+#include <vector>
+
+// Shortest match encoded by LZ4
+static const size_t LZ4_MIN_MATCH = 4;
+// Number of bytes at the end of a block that must be literals
+static const size_t LZ4_LAST_LITERALS = 5;
+// Distance from the end of a block after which no match may start
+static const size_t LZ4_MATCH_LIMIT = 12;
+// Largest match offset
+static const size_t LZ4_MAX_OFFSET = 65535;
+// Bits of the match finder hash
+static const unsigned LZ4_HASH_BITS = 16;
+
+/// Read 4 bytes from an unaligned address.
+static unsigned Read32(const unsigned char* ptr)
+{
+    unsigned ret;
+    memcpy(&ret, ptr, sizeof ret);
+    return ret;
+}
+
+/// Write an LZ4 length continuation after the 4-bit token field. Return the advanced destination pointer.
+static unsigned char* WriteLength(unsigned char* dest, size_t length)
+{
+    while (length >= 255)
+    {
+        *dest++ = 255;
+        length -= 255;
+    }
+    *dest++ = (unsigned char)length;
+    return dest;
+}
+
+/// Write a sequence of literals and an optional match. Return the advanced destination pointer, or null if it does not fit.
+static unsigned char* WriteSequence(unsigned char* dest, unsigned char* destEnd, const unsigned char* literals, size_t numLiterals, size_t offset, size_t matchLength)
+{
+    if ((size_t)(destEnd - dest) < 1 + numLiterals / 255 + 1 + numLiterals + 2 + matchLength / 255 + 1)
+        return nullptr;
+
+    unsigned char* token = dest++;
+    if (numLiterals >= 15)
+    {
+        *token = 15 << 4;
+        dest = WriteLength(dest, numLiterals - 15);
+    }
+    else
+        *token = (unsigned char)(numLiterals << 4);
+
+    memcpy(dest, literals, numLiterals);
+    dest += numLiterals;
+
+    if (matchLength)
+    {
+        *dest++ = (unsigned char)(offset & 0xff);
+        *dest++ = (unsigned char)(offset >> 8);
+
+        matchLength -= LZ4_MIN_MATCH;
+        if (matchLength >= 15)
+        {
+            *token |= 15;
+            dest = WriteLength(dest, matchLength - 15);
+        }
+        else
+            *token |= (unsigned char)matchLength;
+    }
+
+    return dest;
+}
+
+size_t CompressBound(size_t srcSize)
+{
+    return srcSize + srcSize / 255 + 16;
+}
+
+size_t CompressData(void* dest_, size_t destSize, const void* src_, size_t srcSize)
+{
+    unsigned char* dest = (unsigned char*)dest_;
+    unsigned char* destEnd = dest + destSize;
+    const unsigned char* src = (const unsigned char*)src_;
+    const unsigned char* srcEnd = src + srcSize;
+    const unsigned char* anchor = src;
+    unsigned char* out = dest;
+
+    // Greedy matching with a hash table of the last position of each 4-byte sequence
+    if (srcSize > LZ4_MATCH_LIMIT)
+    {
+        std::vector<unsigned> table(1 << LZ4_HASH_BITS, 0);
+        const unsigned char* matchEnd = srcEnd - LZ4_LAST_LITERALS;
+        const unsigned char* searchEnd = srcEnd - LZ4_MATCH_LIMIT;
+        const unsigned char* ptr = src + 1;
+
+        while (ptr <= searchEnd)
+        {
+            unsigned sequence = Read32(ptr);
+            unsigned hash = (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS);
+            const unsigned char* ref = src + table[hash];
+            table[hash] = (unsigned)(ptr - src);
+
+            if (ref >= ptr || (size_t)(ptr - ref) > LZ4_MAX_OFFSET || Read32(ref) != sequence)
+            {
+                ++ptr;
+                continue;
+            }
+
+            const unsigned char* end = ptr + LZ4_MIN_MATCH;
+            const unsigned char* refEnd = ref + LZ4_MIN_MATCH;
+            while (end < matchEnd && *end == *refEnd)
+            {
+                ++end;
+                ++refEnd;
+            }
+            while (ptr > anchor && ref > src && ptr[-1] == ref[-1])
+            {
+                --ptr;
+                --ref;
+            }
+
+            out = WriteSequence(out, destEnd, anchor, ptr - anchor, ptr - ref, end - ptr);
+            if (!out)
+                return 0;
+
+            ptr = end;
+            anchor = ptr;
+        }
+    }
+
+    out = WriteSequence(out, destEnd, anchor, srcEnd - anchor, 0, 0);
+    return out ? out - dest : 0;
+}
+
+bool DecompressData(void* dest_, size_t destSize, const void* src_, size_t srcSize)
+{
+    unsigned char* dest = (unsigned char*)dest_;
+    unsigned char* destEnd = dest + destSize;
+    unsigned char* out = dest;
+    const unsigned char* src = (const unsigned char*)src_;
+    const unsigned char* srcEnd = src + srcSize;
+
+    while (src < srcEnd)
+    {
+        unsigned token = *src++;
+
+        size_t numLiterals = token >> 4;
+        if (numLiterals == 15)
+        {
+            unsigned char byte;
+            do
+            {
+                if (src >= srcEnd)
+                    return false;
+                byte = *src++;
+                numLiterals += byte;
+            } while (byte == 255);
+        }
+
+        if (numLiterals > (size_t)(srcEnd - src) || numLiterals > (size_t)(destEnd - out))
+            return false;
+        memcpy(out, src, numLiterals);
+        src += numLiterals;
+        out += numLiterals;
+
+        // The last sequence has only literals
+        if (src == srcEnd)
+            break;
+
+        if (srcEnd - src < 2)
+            return false;
+        size_t offset = src[0] | (src[1] << 8);
+        src += 2;
+        if (!offset || offset > (size_t)(out - dest))
+            return false;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15)
+        {
+            unsigned char byte;
+            do
+            {
+                if (src >= srcEnd)
+                    return false;
+                byte = *src++;
+                matchLength += byte;
+            } while (byte == 255);
+        }
+        matchLength += LZ4_MIN_MATCH;
+
+        if (matchLength > (size_t)(destEnd - out))
+            return false;
+
+        // Matches may overlap the output, so copy bytewise
+        const unsigned char* match = out - offset;
+        for (size_t i = 0; i < matchLength; ++i)
+            out[i] = match[i];
+        out += matchLength;
+    }
+
+    return out == destEnd;
+}
@@ -0,0 +1,12 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <cstddef>
+
+/// Return the worst case size of data compressed with CompressData().
+size_t CompressBound(size_t srcSize);
+/// Compress data into the LZ4 block format. Return the compressed size, or zero if it would not fit into the destination.
+size_t CompressData(void* dest, size_t destSize, const void* src, size_t srcSize);
+/// Decompress LZ4 block format data, which must decompress to exactly the destination size. Return true on success.
+bool DecompressData(void* dest, size_t destSize, const void* src, size_t srcSize);
@@ -138,7 +138,7 @@ size_t File::Write(const void* data, size_t numBytes)
     if (position > size)
         size = position;
 
-    return size;
+    return numBytes;
 }
 
 bool File::IsReadable() const
@@ -0,0 +1,233 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "FileSystem.h"
+#include "FileWatcher.h"
+#include "Log.h"
+#include "StringUtils.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+#include <vector>
+
+// Buffer size for reading the notifications
+static const size_t NOTIFY_BUFFER_SIZE = 16384;
+#ifdef __linux__
+// Timeout in milliseconds for checking whether the background thread should exit
+static const int POLL_TIMEOUT = 100;
+#endif
+
+FileWatcher::FileWatcher() :
+    shouldRun(false),
+    watchSubDirs(false),
+    delay(0.1f),
+#ifdef _WIN32
+    dirHandle(nullptr)
+#else
+    watchHandle(-1)
+#endif
+{
+}
+
+FileWatcher::~FileWatcher()
+{
+    StopWatching();
+}
+
+bool FileWatcher::StartWatching(const std::string& pathName, bool watchSubDirs_)
+{
+    StopWatching();
+
+    if (!DirExists(pathName))
+    {
+        LOGERROR("Directory " + pathName + " not found for watching");
+        return false;
+    }
+
+    path = AddTrailingSlash(pathName);
+    watchSubDirs = watchSubDirs_;
+
+#ifdef _WIN32
+    HANDLE handle = CreateFile(NativePath(path).c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+    {
+        LOGERROR("Failed to start watching directory " + path);
+        return false;
+    }
+    dirHandle = handle;
+#elif defined(__linux__)
+    watchHandle = inotify_init1(IN_NONBLOCK);
+    if (watchHandle < 0)
+    {
+        LOGERROR("Failed to start watching directory " + path);
+        return false;
+    }
+
+    // Inotify is not recursive, so each subdirectory needs its own watch
+    std::vector<std::string> subDirs;
+    subDirs.push_back(std::string());
+    if (watchSubDirs)
+    {
+        ScanDir(subDirs, path, "*.*", SCAN_DIRS, true);
+        for (size_t i = 1; i < subDirs.size(); ++i)
+            subDirs[i] = AddTrailingSlash(subDirs[i]);
+    }
+
+    for (auto it = subDirs.begin(); it != subDirs.end(); ++it)
+    {
+        if (EndsWith(*it, "./"))
+            continue;
+
+        int wd = inotify_add_watch(watchHandle, (path + *it).c_str(), IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd >= 0)
+            dirHandles[wd] = *it;
+    }
+#else
+    LOGERROR("File watching is not supported on this platform");
+    return false;
+#endif
+
+    shouldRun = true;
+    thread = std::thread(&FileWatcher::ThreadFunction, this);
+
+    LOGINFO("Started watching directory " + path);
+    return true;
+}
+
+void FileWatcher::StopWatching()
+{
+    if (!thread.joinable())
+        return;
+
+    shouldRun = false;
+
+#ifdef _WIN32
+    // Interrupt the blocking read of the background thread. Repeat in case the thread had not yet entered the read
+    HANDLE threadHandle = (HANDLE)thread.native_handle();
+    do
+        CancelSynchronousIo(threadHandle);
+    while (WaitForSingleObject(threadHandle, 10) == WAIT_TIMEOUT);
+    thread.join();
+    CloseHandle((HANDLE)dirHandle);
+    dirHandle = nullptr;
+#else
+    thread.join();
+    close(watchHandle);
+    watchHandle = -1;
+    dirHandles.clear();
+#endif
+
+    std::lock_guard<std::mutex> lock(changesMutex);
+    changes.clear();
+
+    LOGINFO("Stopped watching directory " + path);
+}
+
+void FileWatcher::SetDelay(float seconds)
+{
+    delay = seconds > 0.0f ? seconds : 0.0f;
+}
+
+bool FileWatcher::NextChange(std::string& dest)
+{
+    std::lock_guard<std::mutex> lock(changesMutex);
+
+    unsigned delayMSec = (unsigned)(delay * 1000.0f);
+    for (auto it = changes.begin(); it != changes.end(); ++it)
+    {
+        if (it->second.ElapsedMSec() >= delayMSec)
+        {
+            dest = it->first;
+            changes.erase(it);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void FileWatcher::ThreadFunction()
+{
+#ifdef _WIN32
+    std::vector<DWORD> buffer(NOTIFY_BUFFER_SIZE / sizeof(DWORD));
+
+    while (shouldRun)
+    {
+        DWORD bytesFilled = 0;
+        if (!ReadDirectoryChangesW((HANDLE)dirHandle, &buffer[0], (DWORD)NOTIFY_BUFFER_SIZE, watchSubDirs, FILE_NOTIFY_CHANGE_FILE_NAME |
+            FILE_NOTIFY_CHANGE_LAST_WRITE, &bytesFilled, nullptr, nullptr))
+            break;
+
+        // Zero bytes means that the buffer overflowed and the changes were lost
+        size_t offset = 0;
+        while (bytesFilled)
+        {
+            const FILE_NOTIFY_INFORMATION* record = reinterpret_cast<const FILE_NOTIFY_INFORMATION*>(reinterpret_cast<const unsigned char*>(&buffer[0]) + offset);
+            if (record->Action == FILE_ACTION_MODIFIED || record->Action == FILE_ACTION_ADDED || record->Action == FILE_ACTION_RENAMED_NEW_NAME)
+            {
+                int nameLength = (int)(record->FileNameLength / sizeof(WCHAR));
+                int length = WideCharToMultiByte(CP_UTF8, 0, record->FileName, nameLength, nullptr, 0, nullptr, nullptr);
+                std::string fileName((size_t)length, 0);
+                if (length)
+                    WideCharToMultiByte(CP_UTF8, 0, record->FileName, nameLength, &fileName[0], length, nullptr, nullptr);
+                AddChange(Replace(fileName, '\\', '/'));
+            }
+
+            if (!record->NextEntryOffset)
+                break;
+            offset += record->NextEntryOffset;
+        }
+    }
+#elif defined(__linux__)
+    std::vector<inotify_event> buffer(NOTIFY_BUFFER_SIZE / sizeof(inotify_event));
+    char* data = reinterpret_cast<char*>(&buffer[0]);
+
+    while (shouldRun)
+    {
+        pollfd descriptor;
+        descriptor.fd = watchHandle;
+        descriptor.events = POLLIN;
+        descriptor.revents = 0;
+        if (poll(&descriptor, 1, POLL_TIMEOUT) <= 0)
+            continue;
+
+        ssize_t length = read(watchHandle, data, buffer.size() * sizeof(inotify_event));
+        if (length <= 0)
+            continue;
+
+        for (ssize_t offset = 0; offset < length;)
+        {
+            const inotify_event* event = reinterpret_cast<const inotify_event*>(data + offset);
+            auto it = dirHandles.find(event->wd);
+            if (event->len && it != dirHandles.end())
+            {
+                std::string fileName = it->second + event->name;
+                if (!(event->mask & IN_ISDIR))
+                    AddChange(fileName);
+                else if (watchSubDirs && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+                {
+                    int wd = inotify_add_watch(watchHandle, (path + fileName).c_str(), IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO);
+                    if (wd >= 0)
+                        dirHandles[wd] = fileName + "/";
+                }
+            }
+
+            offset += sizeof(inotify_event) + event->len;
+        }
+    }
+#endif
+}
+
+void FileWatcher::AddChange(const std::string& fileName)
+{
+    std::lock_guard<std::mutex> lock(changesMutex);
+
+    // Restart the delay on each change
+    changes[fileName].Reset();
+}
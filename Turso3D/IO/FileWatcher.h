@@ -0,0 +1,68 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/Ptr.h"
+#include "../Time/Timer.h"
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Watches a directory and its subdirectories for file changes using operating system notifications in a background thread. Supported on Windows and Linux.
+class FileWatcher : public RefCounted
+{
+public:
+    /// Construct.
+    FileWatcher();
+    /// Destruct. Stop watching.
+    ~FileWatcher();
+
+    /// Start watching a directory. Return true on success.
+    bool StartWatching(const std::string& pathName, bool watchSubDirs = true);
+    /// Stop watching the directory.
+    void StopWatching();
+    /// Set the time in seconds that a changed file must stay unchanged before it is reported, so that a burst of writes is reported as one change. Default 0.1.
+    void SetDelay(float seconds);
+    /// Return the next changed file name relative to the watched directory. Return false if none.
+    bool NextChange(std::string& dest);
+
+    /// Return the watched directory.
+    const std::string& Path() const { return path; }
+    /// Return the change report delay in seconds.
+    float Delay() const { return delay; }
+    /// Return whether is watching a directory.
+    bool IsWatching() const { return thread.joinable(); }
+
+private:
+    /// Wait for notifications in the background thread.
+    void ThreadFunction();
+    /// Add or update a changed file.
+    void AddChange(const std::string& fileName);
+
+    /// Watched directory.
+    std::string path;
+    /// Changed files and the time since their last change.
+    std::map<std::string, Timer> changes;
+    /// Mutex for the changed files.
+    std::mutex changesMutex;
+    /// Background thread.
+    std::thread thread;
+    /// Background thread run flag.
+    std::atomic<bool> shouldRun;
+    /// Subdirectories watch flag.
+    bool watchSubDirs;
+    /// Change report delay in seconds.
+    float delay;
+#ifdef _WIN32
+    /// Directory handle.
+    void* dirHandle;
+#else
+    /// Inotify instance.
+    int watchHandle;
+    /// Subdirectories relative to the watched directory by watch descriptor.
+    std::map<int, std::string> dirHandles;
+#endif
+};
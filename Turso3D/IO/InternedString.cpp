@@ -0,0 +1,58 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "InternedString.h"
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+static std::mutex& InternMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+static std::unordered_map<std::string, std::unique_ptr<InternedStringData> >& InternTable()
+{
+    static std::unordered_map<std::string, std::unique_ptr<InternedStringData> > table;
+    return table;
+}
+
+const std::string& InternedString::Str() const
+{
+    static const std::string empty;
+    return data ? data->str : empty;
+}
+
+InternedString InternedString::Find(const char* str)
+{
+    InternedString ret;
+    ret.data = Intern(str, false);
+    return ret;
+}
+
+size_t InternedString::NumInterned()
+{
+    std::lock_guard<std::mutex> lock(InternMutex());
+    return InternTable().size();
+}
+
+const InternedStringData* InternedString::Intern(const char* str, bool add)
+{
+    if (!str || !*str)
+        return nullptr;
+
+    std::string key(str);
+
+    std::lock_guard<std::mutex> lock(InternMutex());
+    auto& table = InternTable();
+    auto it = table.find(key);
+    if (it != table.end())
+        return it->second.get();
+    else if (!add)
+        return nullptr;
+
+    InternedStringData* newData = new InternedStringData(key);
+    table[key].reset(newData);
+    return newData;
+}
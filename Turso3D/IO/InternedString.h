@@ -0,0 +1,72 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "StringHash.h"
+
+/// String stored once in the global intern table, with its case-insensitive hash.
+struct InternedStringData
+{
+    /// Construct.
+    InternedStringData(const std::string& str_) :
+        str(str_),
+        hash(str_)
+    {
+    }
+
+    /// The string.
+    std::string str;
+    /// Hash of the string.
+    StringHash hash;
+};
+
+/// Handle to a string stored once in a global, threadsafe intern table. The handle is pointer-sized and compares by pointer. The stored strings are never freed, so the handles and C string pointers remain valid for the rest of the program.
+class InternedString
+{
+public:
+    /// Construct as empty.
+    InternedString() :
+        data(nullptr)
+    {
+    }
+
+    /// Construct by interning a string.
+    explicit InternedString(const std::string& str) :
+        data(Intern(str.c_str(), true))
+    {
+    }
+
+    /// Construct by interning a C string.
+    explicit InternedString(const char* str) :
+        data(Intern(str, true))
+    {
+    }
+
+    /// Test for equality with another interned string.
+    bool operator == (const InternedString& rhs) const { return data == rhs.data; }
+    /// Test for inequality with another interned string.
+    bool operator != (const InternedString& rhs) const { return data != rhs.data; }
+    /// Return true if not empty.
+    explicit operator bool () const { return data != nullptr; }
+
+    /// Return the string.
+    const std::string& Str() const;
+    /// Return the string as a stable C string.
+    const char* CString() const { return Str().c_str(); }
+    /// Return the case-insensitive hash of the string.
+    const StringHash& Hash() const { return data ? data->hash : StringHash::ZERO; }
+    /// Return whether is empty.
+    bool Empty() const { return data == nullptr; }
+
+    /// Return an already interned string without adding it to the table, or empty if not found. Use for lookups, since a string that has not been interned can not match any handle.
+    static InternedString Find(const char* str);
+    /// Return number of interned strings.
+    static size_t NumInterned();
+
+private:
+    /// Return the table entry of a string, optionally adding it. The empty string has no entry.
+    static const InternedStringData* Intern(const char* str, bool add);
+
+    /// Table entry, or null if empty.
+    const InternedStringData* data;
+};
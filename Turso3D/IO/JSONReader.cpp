@@ -0,0 +1,379 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "JSONReader.h"
+#include "JSONValue.h"
+#include "Stream.h"
+
+#include <cctype>
+#include <cstdlib>
+
+// Block size for reading streams that are not memory backed
+static const size_t JSON_READ_BUFFER_SIZE = 65536;
+// Maximum length of a number in characters
+static const size_t MAX_NUMBER_LENGTH = 64;
+
+JSONReader::JSONReader(Stream& source_) :
+    source(source_),
+    pos(nullptr),
+    end(nullptr),
+    token(JSON_TOKEN_NONE),
+    numberValue(0.0),
+    boolValue(false),
+    line(1),
+    afterValue(false),
+    expectKey(false),
+    justOpened(false)
+{
+    // Parse memory backed streams in place
+    if (source.IsMemoryBacked())
+    {
+        const char* data = reinterpret_cast<const char*>(source.MemoryData());
+        pos = data + source.Position();
+        end = data + source.Size();
+        source.Seek(source.Size());
+    }
+}
+
+JSONToken JSONReader::Next()
+{
+    if (token == JSON_TOKEN_END || token == JSON_TOKEN_ERROR)
+        return token;
+
+    // Data after the root value is not read
+    if (afterValue && stack.empty())
+    {
+        token = JSON_TOKEN_END;
+        return token;
+    }
+
+    char c;
+    if (!NextSignificantChar(c))
+        return Error();
+
+    if (afterValue)
+    {
+        char open = stack.back();
+        if ((c == '}' && open == '{') || (c == ']' && open == '['))
+        {
+            // The closed object or array is itself a complete value
+            stack.pop_back();
+            token = c == '}' ? JSON_TOKEN_END_OBJECT : JSON_TOKEN_END_ARRAY;
+            return token;
+        }
+        if (c != ',' || !NextSignificantChar(c))
+            return Error();
+
+        afterValue = false;
+        expectKey = open == '{';
+    }
+    else if (justOpened && ((c == '}' && stack.back() == '{') || (c == ']' && stack.back() == '[')))
+    {
+        stack.pop_back();
+        justOpened = false;
+        expectKey = false;
+        afterValue = true;
+        token = c == '}' ? JSON_TOKEN_END_OBJECT : JSON_TOKEN_END_ARRAY;
+        return token;
+    }
+
+    justOpened = false;
+
+    if (expectKey)
+    {
+        if (c != '\"' || !ReadString(stringValue))
+            return Error();
+        if (!NextSignificantChar(c) || c != ':')
+            return Error();
+
+        expectKey = false;
+        token = JSON_TOKEN_KEY;
+        return token;
+    }
+
+    return ReadValueToken(c);
+}
+
+bool JSONReader::SkipValue()
+{
+    if (token != JSON_TOKEN_BEGIN_OBJECT && token != JSON_TOKEN_BEGIN_ARRAY)
+        return !HasError();
+
+    return SkipToEnd();
+}
+
+bool JSONReader::SkipToEnd()
+{
+    size_t depth = 1;
+    while (depth)
+    {
+        switch (Next())
+        {
+        case JSON_TOKEN_BEGIN_OBJECT:
+        case JSON_TOKEN_BEGIN_ARRAY:
+            ++depth;
+            break;
+
+        case JSON_TOKEN_END_OBJECT:
+        case JSON_TOKEN_END_ARRAY:
+            --depth;
+            break;
+
+        case JSON_TOKEN_END:
+        case JSON_TOKEN_ERROR:
+            return false;
+
+        default:
+            break;
+        }
+    }
+
+    return true;
+}
+
+bool JSONReader::ReadValue(JSONValue& dest)
+{
+    switch (token)
+    {
+    case JSON_TOKEN_NULL:
+        dest.SetNull();
+        return true;
+
+    case JSON_TOKEN_BOOL:
+        dest = boolValue;
+        return true;
+
+    case JSON_TOKEN_NUMBER:
+        dest = numberValue;
+        return true;
+
+    case JSON_TOKEN_STRING:
+        dest = stringValue;
+        return true;
+
+    case JSON_TOKEN_BEGIN_ARRAY:
+        dest.SetEmptyArray();
+        for (;;)
+        {
+            if (Next() == JSON_TOKEN_END_ARRAY)
+                return true;
+            dest.Push(JSONValue());
+            if (!ReadValue(dest[dest.Size() - 1]))
+                return false;
+        }
+
+    case JSON_TOKEN_BEGIN_OBJECT:
+        dest.SetEmptyObject();
+        for (;;)
+        {
+            JSONToken next = Next();
+            if (next == JSON_TOKEN_END_OBJECT)
+                return true;
+            if (next != JSON_TOKEN_KEY)
+                return false;
+
+            JSONValue& member = dest[stringValue];
+            Next();
+            if (!ReadValue(member))
+                return false;
+        }
+
+    default:
+        return false;
+    }
+}
+
+bool JSONReader::Refill()
+{
+    if (source.Position() >= source.Size())
+        return false;
+
+    if (buffer.empty())
+        buffer.resize(JSON_READ_BUFFER_SIZE);
+
+    size_t numRead = source.Read(&buffer[0], buffer.size());
+    pos = &buffer[0];
+    end = pos + numRead;
+    return numRead > 0;
+}
+
+bool JSONReader::NextSignificantChar(char& dest)
+{
+    for (;;)
+    {
+        if (!NextChar(dest))
+            return false;
+        if (dest <= 0x20 && dest >= 0)
+            continue;
+        if (dest != '/')
+            return true;
+
+        // Skip comments
+        char c;
+        if (!NextChar(c))
+            return false;
+        if (c == '/')
+        {
+            do
+            {
+                if (!NextChar(c))
+                    return false;
+            }
+            while (c != '\n');
+        }
+        else if (c == '*')
+        {
+            char prev = 0;
+            for (;;)
+            {
+                if (!NextChar(c))
+                    return false;
+                if (prev == '*' && c == '/')
+                    break;
+                prev = c;
+            }
+        }
+        else
+            return false;
+    }
+}
+
+bool JSONReader::ReadString(std::string& dest)
+{
+    dest.clear();
+
+    char c;
+    for (;;)
+    {
+        if (!NextChar(c))
+            return false;
+        if (c == '\"')
+            return true;
+        else if (c != '\\')
+            dest += c;
+        else
+        {
+            if (!NextChar(c))
+                return false;
+
+            switch (c)
+            {
+            case 'b':
+                dest += '\b';
+                break;
+
+            case 'f':
+                dest += '\f';
+                break;
+
+            case 'n':
+                dest += '\n';
+                break;
+
+            case 'r':
+                dest += '\r';
+                break;
+
+            case 't':
+                dest += '\t';
+                break;
+
+            case 'u':
+                {
+                    /// \todo Doesn't handle unicode
+                    char hex[5];
+                    for (size_t i = 0; i < 4; ++i)
+                    {
+                        if (!NextChar(hex[i]))
+                            return false;
+                    }
+                    hex[4] = 0;
+                    dest += (char)strtoul(hex, nullptr, 16);
+                }
+                break;
+
+            default:
+                dest += c;
+                break;
+            }
+        }
+    }
+}
+
+JSONToken JSONReader::ReadValueToken(char c)
+{
+    const char* literal = nullptr;
+
+    switch (c)
+    {
+    case '{':
+        stack.push_back(c);
+        expectKey = true;
+        justOpened = true;
+        token = JSON_TOKEN_BEGIN_OBJECT;
+        return token;
+
+    case '[':
+        stack.push_back(c);
+        justOpened = true;
+        token = JSON_TOKEN_BEGIN_ARRAY;
+        return token;
+
+    case '\"':
+        if (!ReadString(stringValue))
+            return Error();
+        token = JSON_TOKEN_STRING;
+        break;
+
+    case 'n':
+        literal = "ull";
+        token = JSON_TOKEN_NULL;
+        break;
+
+    case 't':
+        literal = "rue";
+        boolValue = true;
+        token = JSON_TOKEN_BOOL;
+        break;
+
+    case 'f':
+        literal = "alse";
+        boolValue = false;
+        token = JSON_TOKEN_BOOL;
+        break;
+
+    default:
+        if (isdigit((unsigned char)c) || c == '-')
+        {
+            char number[MAX_NUMBER_LENGTH + 1];
+            size_t length = 0;
+            number[length++] = c;
+            for (;;)
+            {
+                char next = PeekChar();
+                if (!isdigit((unsigned char)next) && next != '.' && next != 'e' && next != 'E' && next != '-' && next != '+')
+                    break;
+                if (length >= MAX_NUMBER_LENGTH)
+                    return Error();
+                number[length++] = *pos++;
+            }
+            number[length] = 0;
+            numberValue = strtod(number, nullptr);
+            token = JSON_TOKEN_NUMBER;
+        }
+        else
+            return Error();
+        break;
+    }
+
+    if (literal)
+    {
+        for (; *literal; ++literal)
+        {
+            if (!NextChar(c) || c != *literal)
+                return Error();
+        }
+    }
+
+    afterValue = true;
+    return token;
+}
@@ -0,0 +1,112 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+class JSONValue;
+class Stream;
+
+/// Token returned by the JSON pull parser.
+enum JSONToken
+{
+    JSON_TOKEN_NONE = 0,
+    JSON_TOKEN_BEGIN_OBJECT,
+    JSON_TOKEN_END_OBJECT,
+    JSON_TOKEN_BEGIN_ARRAY,
+    JSON_TOKEN_END_ARRAY,
+    JSON_TOKEN_KEY,
+    JSON_TOKEN_STRING,
+    JSON_TOKEN_NUMBER,
+    JSON_TOKEN_BOOL,
+    JSON_TOKEN_NULL,
+    JSON_TOKEN_END,
+    JSON_TOKEN_ERROR
+};
+
+/// Streaming JSON pull parser. Returns one token at a time without building a value tree, reading the source in fixed-size blocks unless it is memory backed. Accepts the same comments as JSONValue.
+class JSONReader
+{
+public:
+    /// Construct with the source stream, starting from its current position.
+    JSONReader(Stream& source);
+
+    /// Advance to the next token and return it. After the root value has ended, returns JSON_TOKEN_END.
+    JSONToken Next();
+    /// Skip the rest of the value that the current token begins. No-op for single-token values. Return true on success.
+    bool SkipValue();
+    /// Skip the remaining members of the innermost open object or array, including its end token. Return true on success.
+    bool SkipToEnd();
+    /// Read the value that the current token begins into a value tree. Return true on success.
+    bool ReadValue(JSONValue& dest);
+
+    /// Return the current token.
+    JSONToken Token() const { return token; }
+    /// Return the current key or string value.
+    const std::string& String() const { return stringValue; }
+    /// Return the current number value.
+    double Number() const { return numberValue; }
+    /// Return the current bool value.
+    bool Bool() const { return boolValue; }
+    /// Return the line number of the current position, starting from 1.
+    size_t Line() const { return line; }
+    /// Return whether a syntax error has occurred.
+    bool HasError() const { return token == JSON_TOKEN_ERROR; }
+
+private:
+    /// Get the next char, refilling the buffer as necessary. Return false at the end of data.
+    bool NextChar(char& dest)
+    {
+        if (pos >= end && !Refill())
+            return false;
+        dest = *pos++;
+        if (dest == '\n')
+            ++line;
+        return true;
+    }
+    /// Return the next char without consuming it, or 0 at the end of data.
+    char PeekChar()
+    {
+        if (pos >= end && !Refill())
+            return 0;
+        return *pos;
+    }
+    /// Read the next block from the source. Return true if got any data.
+    bool Refill();
+    /// Get the next char that is not white space or inside a comment. Return false at the end of data or on a malformed comment.
+    bool NextSignificantChar(char& dest);
+    /// Read a string after the opening quote. Return true on success.
+    bool ReadString(std::string& dest);
+    /// Parse a value beginning with a char. Return the token.
+    JSONToken ReadValueToken(char c);
+    /// Set the error token and return it.
+    JSONToken Error() { token = JSON_TOKEN_ERROR; return token; }
+
+    /// Source stream.
+    Stream& source;
+    /// Read buffer for streams that are not memory backed.
+    std::vector<char> buffer;
+    /// Current read position.
+    const char* pos;
+    /// End of the readable data.
+    const char* end;
+    /// Open objects and arrays as their opening chars.
+    std::vector<char> stack;
+    /// Current token.
+    JSONToken token;
+    /// Current key or string value.
+    std::string stringValue;
+    /// Current number value.
+    double numberValue;
+    /// Current bool value.
+    bool boolValue;
+    /// Current line number.
+    size_t line;
+    /// A complete value or key precedes the next token.
+    bool afterValue;
+    /// The next token in an object must be a key.
+    bool expectKey;
+    /// An object or array has just opened, so that it may close without a value.
+    bool justOpened;
+};
@@ -40,6 +40,7 @@ struct JSONData
 class JSONValue
 {
     friend class JSONFile;
+    friend class JSONWriter;
     
 public:
     /// Construct a null value.
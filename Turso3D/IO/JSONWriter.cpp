@@ -0,0 +1,163 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "JSONValue.h"
+#include "JSONWriter.h"
+#include "Stream.h"
+#include "StringUtils.h"
+
+// Buffered text size at which the buffer is flushed to the stream
+static const size_t JSON_WRITE_BUFFER_SIZE = 65536;
+
+JSONWriter::JSONWriter(Stream& dest_, int spacing_) :
+    dest(dest_),
+    spacing(spacing_),
+    indent(0),
+    afterKey(false),
+    success(true)
+{
+    buffer.reserve(JSON_WRITE_BUFFER_SIZE + JSON_WRITE_BUFFER_SIZE / 4);
+}
+
+JSONWriter::~JSONWriter()
+{
+    Flush();
+}
+
+void JSONWriter::BeginObject()
+{
+    BeginContainer('{');
+}
+
+void JSONWriter::EndObject()
+{
+    EndContainer('}');
+}
+
+void JSONWriter::BeginArray()
+{
+    BeginContainer('[');
+}
+
+void JSONWriter::EndArray()
+{
+    EndContainer(']');
+}
+
+void JSONWriter::Key(const std::string& key)
+{
+    Key(key.c_str());
+}
+
+void JSONWriter::Key(const char* key)
+{
+    if (buffer.length() >= JSON_WRITE_BUFFER_SIZE)
+        Flush();
+
+    if (hasMembers.size())
+    {
+        if (hasMembers.back())
+            buffer += ',';
+        hasMembers.back() = true;
+    }
+
+    buffer += '\n';
+    JSONValue::WriteIndent(buffer, indent);
+    JSONValue::WriteJSONString(buffer, key);
+    buffer += ": ";
+    afterKey = true;
+}
+
+void JSONWriter::Null()
+{
+    BeginValue();
+    buffer += "null";
+}
+
+void JSONWriter::Value(bool value)
+{
+    BeginValue();
+    buffer += ToString(value);
+}
+
+void JSONWriter::Value(double value)
+{
+    BeginValue();
+    buffer += ToString(value);
+}
+
+void JSONWriter::Value(const std::string& value)
+{
+    BeginValue();
+    JSONValue::WriteJSONString(buffer, value);
+}
+
+void JSONWriter::Value(const char* value)
+{
+    BeginValue();
+    JSONValue::WriteJSONString(buffer, value);
+}
+
+void JSONWriter::Value(const JSONValue& value)
+{
+    BeginValue();
+    value.ToString(buffer, spacing, indent);
+    if (buffer.length() >= JSON_WRITE_BUFFER_SIZE)
+        Flush();
+}
+
+bool JSONWriter::Flush()
+{
+    if (buffer.length())
+    {
+        if (dest.Write(&buffer[0], buffer.length()) != buffer.length())
+            success = false;
+        buffer.clear();
+    }
+
+    return success;
+}
+
+void JSONWriter::BeginValue()
+{
+    // Object members have been separated by the key
+    if (afterKey)
+    {
+        afterKey = false;
+        return;
+    }
+
+    if (hasMembers.size())
+    {
+        if (hasMembers.back())
+            buffer += ',';
+        hasMembers.back() = true;
+        buffer += '\n';
+        JSONValue::WriteIndent(buffer, indent);
+    }
+}
+
+void JSONWriter::BeginContainer(char c)
+{
+    BeginValue();
+    buffer += c;
+    hasMembers.push_back(false);
+    indent += spacing;
+}
+
+void JSONWriter::EndContainer(char c)
+{
+    if (hasMembers.empty())
+        return;
+
+    indent -= spacing;
+    if (hasMembers.back())
+    {
+        buffer += '\n';
+        JSONValue::WriteIndent(buffer, indent);
+    }
+    hasMembers.pop_back();
+    buffer += c;
+
+    if (buffer.length() >= JSON_WRITE_BUFFER_SIZE)
+        Flush();
+}
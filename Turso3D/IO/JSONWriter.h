@@ -0,0 +1,73 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+class JSONValue;
+class Stream;
+
+/// Streaming JSON writer. Writes objects and arrays member by member in the same text format as JSONValue, flushing to the destination stream in blocks, so that no value tree needs to be built.
+class JSONWriter
+{
+public:
+    /// Construct with the destination stream and the number of spaces per indent level.
+    JSONWriter(Stream& dest, int spacing = 2);
+    /// Destruct. Flush the remaining text.
+    ~JSONWriter();
+
+    /// Begin an object.
+    void BeginObject();
+    /// End the current object.
+    void EndObject();
+    /// Begin an array.
+    void BeginArray();
+    /// End the current array.
+    void EndArray();
+    /// Write the key of the next object member.
+    void Key(const std::string& key);
+    /// Write the key of the next object member.
+    void Key(const char* key);
+    /// Write a null value.
+    void Null();
+    /// Write a bool value.
+    void Value(bool value);
+    /// Write a number value.
+    void Value(double value);
+    /// Write a number value.
+    void Value(int value) { Value((double)value); }
+    /// Write a number value.
+    void Value(unsigned value) { Value((double)value); }
+    /// Write a string value.
+    void Value(const std::string& value);
+    /// Write a string value.
+    void Value(const char* value);
+    /// Write a value tree.
+    void Value(const JSONValue& value);
+    /// Write the buffered text to the stream. Return true if all text has been written successfully.
+    bool Flush();
+
+private:
+    /// Begin a value, writing the separator and indent if inside an array.
+    void BeginValue();
+    /// Begin an object or array.
+    void BeginContainer(char c);
+    /// End an object or array.
+    void EndContainer(char c);
+
+    /// Destination stream.
+    Stream& dest;
+    /// Text not yet written to the stream.
+    std::string buffer;
+    /// Whether the open objects and arrays have members.
+    std::vector<bool> hasMembers;
+    /// Spaces per indent level.
+    int spacing;
+    /// Current indent.
+    int indent;
+    /// A key has been written, so that the value follows on the same line.
+    bool afterKey;
+    /// All writes have succeeded.
+    bool success;
+};
@@ -1,11 +1,13 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../IO/File.h"
+#include "../Object/EventQueue.h"
 #include "../Time/TimeUtils.h"
 #include "../Thread/ThreadUtils.h"
 #include "Log.h"
 
 #include <cstdio>
+#include <cstring>
 #include <ctime>
 
 const char* logLevelPrefixes[] =
@@ -17,6 +19,52 @@ const char* logLevelPrefixes[] =
     nullptr
 };
 
+/// Header of a message record in a log ring.
+struct LogRecordHeader
+{
+    /// Text length in bytes, or LOG_RECORD_WRAP for the padding at the end of the ring.
+    unsigned length;
+    /// Message level, or LOG_RAW.
+    short level;
+    /// Error flag for raw messages.
+    short error;
+};
+
+static const unsigned LOG_RECORD_WRAP = 0xffffffff;
+/// Largest record that is queued to a ring. Larger messages go through the mutex-protected list.
+static const size_t MAX_LOG_RECORD_SIZE = LOG_RING_SIZE / 4;
+/// Time the writer thread sleeps between checking the rings, unless woken up earlier.
+static const int LOG_WRITER_INTERVAL_MS = 10;
+
+static thread_local LogRing* threadRing = nullptr;
+static thread_local unsigned threadRingGeneration = 0;
+
+std::atomic<unsigned> Log::ringGeneration(1);
+
+/// Return a timestamp string, which unlike TimeStamp() is safe to call from the writer thread.
+static std::string ThreadSafeTimeStamp()
+{
+    time_t sysTime;
+    time(&sysTime);
+
+    char buffer[64];
+    #ifdef _WIN32
+    ctime_s(buffer, sizeof buffer, &sysTime);
+    #else
+    ctime_r(&sysTime, buffer);
+    #endif
+
+    std::string ret(buffer);
+    return Replace(ret, "\n", "");
+}
+
+LogRing::LogRing() :
+    data(LOG_RING_SIZE),
+    writePos(0),
+    readPos(0)
+{
+}
+
 Log::Log() :
 #ifdef _DEBUG
     level(LOG_DEBUG),
@@ -25,13 +73,17 @@ Log::Log() :
 #endif
     timeStamp(false),
     inWrite(false),
-    quiet(false)
+    quiet(false),
+    writerShouldRun(false),
+    async(false),
+    asyncWriters(0)
 {
     RegisterSubsystem(this);
 }
 
 Log::~Log()
 {
+    SetAsync(false);
     Close();
     RemoveSubsystem(this);
 }
@@ -49,18 +101,24 @@ void Log::Open(const std::string& fileName)
             Close();
     }
 
-    logFile = new File();
-    if (logFile->Open(fileName, FILE_WRITE))
+    AutoPtr<File> newFile(new File());
+    bool success = newFile->Open(fileName, FILE_WRITE);
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        if (success)
+            logFile = newFile;
+    }
+
+    if (success)
         LOGINFO("Opened log file " + fileName);
     else
-    {
-        logFile.Reset();
         LOGERROR("Failed to create log file " + fileName);
-    }
 }
 
 void Log::Close()
 {
+    std::lock_guard<std::mutex> lock(ringsMutex);
+
     if (logFile && logFile->IsOpen())
     {
         logFile->Close();
@@ -85,8 +143,45 @@ void Log::SetQuiet(bool enable)
     quiet = enable;
 }
 
+void Log::SetAsync(bool enable)
+{
+    if (enable == IsAsync())
+        return;
+
+    if (enable)
+    {
+        ++ringGeneration;
+        writerShouldRun = true;
+        writerThread = std::thread(&Log::WriterLoop, this);
+        async = true;
+    }
+    else
+    {
+        // Let the threads already inside WriteAsync() finish, while the writer still drains the rings they may be waiting on
+        async = false;
+        while (asyncWriters.load())
+        {
+            writerCondition.notify_one();
+            std::this_thread::yield();
+        }
+
+        writerShouldRun = false;
+        writerCondition.notify_one();
+        writerThread.join();
+
+        // Output what was queued after the writer's last round, then make the threads register new rings if enabled again
+        WriteQueued();
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.clear();
+        ++ringGeneration;
+    }
+}
+
 void Log::EndFrame()
 {
+    if (IsAsync())
+        return;
+
     std::lock_guard<std::mutex> lock(logMutex);
 
     // Process messages accumulated from other threads (if any)
@@ -111,11 +206,46 @@ void Log::Write(int msgLevel, const std::string& message)
     if (!instance)
         return;
 
-    // If not in the main thread, store message for later processing
+    if (instance->IsAsync())
+    {
+        if (instance->level > msgLevel)
+            return;
+
+        // Asynchronous logging may be disabled meanwhile, in which case the message is written synchronously below
+        if (instance->WriteAsync(msgLevel, message, false))
+        {
+            // The event is sent only in the main thread, and formatted only if someone is listening
+            if (IsMainThread() && !instance->inWrite)
+            {
+                instance->lastMessage = message;
+
+                LogMessageEvent& event = instance->logMessageEvent;
+                if (event.HasReceivers())
+                {
+                    instance->inWrite = true;
+                    event.message = std::string(logLevelPrefixes[msgLevel]) + ": " + message;
+                    if (instance->timeStamp)
+                        event.message = "[" + ThreadSafeTimeStamp() + "] " + event.message;
+                    event.level = msgLevel;
+                    instance->SendEvent(event);
+                    instance->inWrite = false;
+                }
+            }
+            return;
+        }
+    }
+
+    // If not in the main thread, post or store message for later processing
     if (!IsMainThread())
     {
-        std::lock_guard<std::mutex> lock(instance->logMutex);
-        instance->threadMessages.push_back(StoredLogMessage(message, msgLevel, false));
+        EventQueue* queue = Subsystem<EventQueue>();
+        if (queue)
+            queue->PostCall([msgLevel, message]() { Write(msgLevel, message); });
+        else
+        {
+            std::lock_guard<std::mutex> lock(instance->logMutex);
+            instance->threadMessages.push_back(StoredLogMessage(message, msgLevel, false));
+        }
         return;
     }
 
@@ -161,11 +291,37 @@ void Log::WriteRaw(const std::string& message, bool error)
     if (!instance)
         return;
 
-    // If not in the main thread, store message for later processing
+    // Asynchronous logging may be disabled meanwhile, in which case the message is written synchronously below
+    if (instance->IsAsync() && instance->WriteAsync(LOG_RAW, message, error))
+    {
+        if (IsMainThread() && !instance->inWrite)
+        {
+            instance->lastMessage = message;
+
+            LogMessageEvent& event = instance->logMessageEvent;
+            if (event.HasReceivers())
+            {
+                instance->inWrite = true;
+                event.message = message;
+                event.level = error ? LOG_ERROR : LOG_INFO;
+                instance->SendEvent(event);
+                instance->inWrite = false;
+            }
+        }
+        return;
+    }
+
+    // If not in the main thread, post or store message for later processing
     if (!IsMainThread())
     {
-        std::lock_guard<std::mutex> lock(instance->logMutex);
-        instance->threadMessages.push_back(StoredLogMessage(message, LOG_RAW, error));
+        EventQueue* queue = Subsystem<EventQueue>();
+        if (queue)
+            queue->PostCall([message, error]() { WriteRaw(message, error); });
+        else
+        {
+            std::lock_guard<std::mutex> lock(instance->logMutex);
+            instance->threadMessages.push_back(StoredLogMessage(message, LOG_RAW, error));
+        }
         return;
     }
     
@@ -199,3 +355,189 @@ void Log::WriteRaw(const std::string& message, bool error)
 
     instance->inWrite = false;
 }
+
+bool Log::WriteAsync(int msgLevel, const std::string& message, bool error)
+{
+    // Announce the write before checking the flag, so that disabling either sees this thread or is seen by it
+    ++asyncWriters;
+    if (!async.load())
+    {
+        --asyncWriters;
+        return false;
+    }
+
+    const char* prefix = msgLevel != LOG_RAW ? logLevelPrefixes[msgLevel] : "";
+    size_t prefixLength = msgLevel != LOG_RAW ? strlen(prefix) + 2 : 0;
+    size_t length = prefixLength + message.length();
+    size_t recordSize = (sizeof(LogRecordHeader) + length + 7) & ~(size_t)7;
+
+    if (recordSize > MAX_LOG_RECORD_SIZE)
+    {
+        {
+            std::lock_guard<std::mutex> lock(logMutex);
+            threadMessages.push_back(StoredLogMessage(message, msgLevel, error));
+        }
+        --asyncWriters;
+        return true;
+    }
+
+    // Register a ring for the thread on its first message
+    if (!threadRing || threadRingGeneration != ringGeneration.load())
+    {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.push_back(new LogRing());
+        threadRing = rings.back().Get();
+        threadRingGeneration = ringGeneration.load();
+    }
+
+    LogRing& ring = *threadRing;
+    size_t writePos = ring.writePos.load(std::memory_order_relaxed);
+    size_t offset = writePos & (LOG_RING_SIZE - 1);
+    size_t contiguous = LOG_RING_SIZE - offset;
+    // A record that does not fit before the end of the ring is preceded by a wrap record filling the rest
+    size_t needed = recordSize <= contiguous ? recordSize : contiguous + recordSize;
+
+    // Wait for the writer thread if the ring is full. If the writer has stopped, store to the list, which is output last
+    while (LOG_RING_SIZE - (writePos - ring.readPos.load(std::memory_order_acquire)) < needed)
+    {
+        if (!writerShouldRun)
+        {
+            {
+                std::lock_guard<std::mutex> lock(logMutex);
+                threadMessages.push_back(StoredLogMessage(message, msgLevel, error));
+            }
+            --asyncWriters;
+            return true;
+        }
+
+        writerCondition.notify_one();
+        std::this_thread::yield();
+    }
+
+    if (recordSize > contiguous)
+    {
+        LogRecordHeader* wrap = reinterpret_cast<LogRecordHeader*>(&ring.data[offset]);
+        wrap->length = LOG_RECORD_WRAP;
+        writePos += contiguous;
+        offset = 0;
+    }
+
+    LogRecordHeader* header = reinterpret_cast<LogRecordHeader*>(&ring.data[offset]);
+    header->length = (unsigned)length;
+    header->level = (short)msgLevel;
+    header->error = error ? 1 : 0;
+    char* text = reinterpret_cast<char*>(header + 1);
+    if (prefixLength)
+    {
+        memcpy(text, prefix, prefixLength - 2);
+        text[prefixLength - 2] = ':';
+        text[prefixLength - 1] = ' ';
+    }
+    memcpy(text + prefixLength, message.data(), message.length());
+
+    size_t newWritePos = writePos + recordSize;
+    ring.writePos.store(newWritePos, std::memory_order_release);
+
+    // Wake up the writer early for errors, or when the ring is filling up
+    if (msgLevel == LOG_ERROR || error || newWritePos - ring.readPos.load(std::memory_order_relaxed) > LOG_RING_SIZE / 2)
+        writerCondition.notify_one();
+
+    --asyncWriters;
+    return true;
+}
+
+void Log::WriterLoop()
+{
+    while (writerShouldRun)
+    {
+        {
+            std::unique_lock<std::mutex> lock(writerMutex);
+            writerCondition.wait_for(lock, std::chrono::milliseconds(LOG_WRITER_INTERVAL_MS));
+        }
+
+        WriteQueued();
+    }
+}
+
+bool Log::WriteQueued()
+{
+    std::lock_guard<std::mutex> lock(ringsMutex);
+
+    bool written = false;
+
+    for (auto it = rings.begin(); it != rings.end(); ++it)
+    {
+        LogRing& ring = **it;
+        size_t readPos = ring.readPos.load(std::memory_order_relaxed);
+        size_t writePos = ring.writePos.load(std::memory_order_acquire);
+
+        while (readPos < writePos)
+        {
+            size_t offset = readPos & (LOG_RING_SIZE - 1);
+            const LogRecordHeader* header = reinterpret_cast<const LogRecordHeader*>(&ring.data[offset]);
+            if (header->length == LOG_RECORD_WRAP)
+            {
+                readPos += LOG_RING_SIZE - offset;
+                continue;
+            }
+
+            Output(header->level, reinterpret_cast<const char*>(header + 1), header->length, header->error != 0);
+            readPos += (sizeof(LogRecordHeader) + header->length + 7) & ~(size_t)7;
+            written = true;
+        }
+
+        ring.readPos.store(readPos, std::memory_order_release);
+    }
+
+    {
+        std::lock_guard<std::mutex> messagesLock(logMutex);
+        while (!threadMessages.empty())
+        {
+            const StoredLogMessage& stored = threadMessages.front();
+            if (stored.level != LOG_RAW)
+            {
+                std::string formattedMessage = std::string(logLevelPrefixes[stored.level]) + ": " + stored.message;
+                Output(stored.level, formattedMessage.c_str(), formattedMessage.length(), false);
+            }
+            else
+                Output(LOG_RAW, stored.message.c_str(), stored.message.length(), stored.error);
+
+            threadMessages.pop_front();
+            written = true;
+        }
+    }
+
+    // Flush once per batch instead of per message
+    if (written)
+    {
+        fflush(stdout);
+        if (logFile)
+            logFile->Flush();
+    }
+
+    return written;
+}
+
+void Log::Output(int msgLevel, const char* text, size_t length, bool error)
+{
+    bool raw = msgLevel == LOG_RAW;
+    if (!raw)
+        error = msgLevel == LOG_ERROR;
+
+    std::string timeStampText;
+    if (!raw && timeStamp)
+        timeStampText = "[" + ThreadSafeTimeStamp() + "] ";
+
+    // If in quiet mode, still print the error messages to the standard error stream
+    if (!quiet || error)
+        fprintf(error ? stderr : stdout, "%s%.*s\n", timeStampText.c_str(), (int)length, text);
+
+    if (logFile)
+    {
+        if (timeStampText.length())
+            logFile->Write(timeStampText.c_str(), timeStampText.length());
+        logFile->Write(text, length);
+        if (!raw)
+            logFile->Write("\n", 1);
+    }
+}
@@ -6,8 +6,11 @@
 #include "../Object/Object.h"
 #include "StringUtils.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <list>
 #include <mutex>
+#include <thread>
 
 #define USE_LOG
 
@@ -24,6 +27,18 @@ static const int LOG_ERROR = 3;
 /// Disable all log messages.
 static const int LOG_NONE = 4;
 
+/// Lowest message level compiled in. The macros of the levels below it expand to nothing, so that their arguments are not evaluated. Can be set with the TURSO3D_MIN_LOG_LEVEL CMake option; by default debug messages are compiled only in debug mode.
+#ifndef TURSO3D_MIN_LOG_LEVEL
+#ifdef _DEBUG
+#define TURSO3D_MIN_LOG_LEVEL 0
+#else
+#define TURSO3D_MIN_LOG_LEVEL 1
+#endif
+#endif
+
+/// Size in bytes of the per-thread message ring in asynchronous logging. Must be a power of two.
+static const size_t LOG_RING_SIZE = 64 * 1024;
+
 class File;
 
 /// Stored log message from another thread.
@@ -50,6 +65,20 @@ struct StoredLogMessage
     bool error;
 };
 
+/// Single-producer single-consumer ring of preformatted log messages from one thread, read by the log writer thread in asynchronous logging.
+struct LogRing
+{
+    /// Construct.
+    LogRing();
+
+    /// Message records, each a header of text length and level followed by the text, padded to 8 bytes.
+    std::vector<unsigned char> data;
+    /// Total bytes written, advanced by the producing thread.
+    std::atomic<size_t> writePos;
+    /// Total bytes read, advanced by the writer thread.
+    std::atomic<size_t> readPos;
+};
+
 /// %Log message event.
 class LogMessageEvent : public Event
 {
@@ -81,13 +110,17 @@ public:
     void SetTimeStamp(bool enable);
     /// Set quiet mode, ie. only output error messages to the standard error stream.
     void SetQuiet(bool enable);
-    /// Process threaded log messages at the end of a frame.
+    /// Set asynchronous logging. When enabled, each thread formats its messages into its own lock-free ring, and a writer thread outputs them to the console and the log file, which it flushes once per batch of messages. Messages stay in order per thread. %Log message events are sent only for the messages of the main thread. When disabled, the threads already queuing messages are waited for before the rings are freed.
+    void SetAsync(bool enable);
+    /// Process threaded log messages at the end of a frame. No-op in asynchronous logging.
     void EndFrame();
 
     /// Return logging level.
     int Level() const { return level; }
     /// Return whether log messages are timestamped.
     bool HasTimeStamp() const { return timeStamp; }
+    /// Return whether asynchronous logging is enabled.
+    bool IsAsync() const { return async.load(); }
     /// Return last log message.
     const std::string& LastMessage() const { return lastMessage; }
 
@@ -100,6 +133,15 @@ public:
     LogMessageEvent logMessageEvent;
 
 private:
+    /// Queue a message to the calling thread's ring in asynchronous logging. Messages too large for the ring, or written while the writer thread is stopping, are stored to the mutex-protected list instead. Return false if asynchronous logging was disabled meanwhile, in which case nothing was queued.
+    bool WriteAsync(int msgLevel, const std::string& message, bool error);
+    /// Output the queued messages in the writer thread.
+    void WriterLoop();
+    /// Output the messages of the rings and the stored list. Return whether any were output.
+    bool WriteQueued();
+    /// Output one message to the console and the log file.
+    void Output(int msgLevel, const char* text, size_t length, bool error);
+
     /// Mutex for threaded operation.
     std::mutex logMutex;
     /// %Log messages from other threads.
@@ -109,18 +151,37 @@ private:
     /// Last log message.
     std::string lastMessage;
     /// Logging level.
-    int level;
+    std::atomic<int> level;
     /// Use timestamps flag.
-    bool timeStamp;
+    std::atomic<bool> timeStamp;
     /// In write flag to prevent recursion.
     bool inWrite;
     /// Quite mode flag.
-    bool quiet;
+    std::atomic<bool> quiet;
+    /// Message rings of the threads in asynchronous logging.
+    std::vector<AutoPtr<LogRing> > rings;
+    /// Mutex for the rings and the log file in asynchronous logging.
+    std::mutex ringsMutex;
+    /// Writer thread in asynchronous logging.
+    std::thread writerThread;
+    /// Writer thread run flag.
+    std::atomic<bool> writerShouldRun;
+    /// Mutex for waking up the writer thread.
+    std::mutex writerMutex;
+    /// Condition for waking up the writer thread.
+    std::condition_variable writerCondition;
+    /// Asynchronous logging flag.
+    std::atomic<bool> async;
+    /// Number of threads inside WriteAsync(). Disabling asynchronous logging waits for them before freeing the rings.
+    std::atomic<unsigned> asyncWriters;
+
+    /// Generation of the rings, advanced when asynchronous logging starts or stops so that the threads register new rings.
+    static std::atomic<unsigned> ringGeneration;
 };
 
 #ifdef USE_LOG
 
-#ifdef _DEBUG
+#if TURSO3D_MIN_LOG_LEVEL <= 0
 #define LOGDEBUG(message) Log::Write(LOG_DEBUG, message)
 #define LOGDEBUGF(format, ...) Log::Write(LOG_DEBUG, FormatString(format, ##__VA_ARGS__))
 #else
@@ -128,13 +189,31 @@ private:
 #define LOGDEBUGF(format, ...)
 #endif
 
+#if TURSO3D_MIN_LOG_LEVEL <= 1
 #define LOGINFO(message) Log::Write(LOG_INFO, message)
-#define LOGWARNING(message) Log::Write(LOG_WARNING, message)
-#define LOGERROR(message) Log::Write(LOG_ERROR, message)
-#define LOGRAW(message) Log::WriteRaw(message)
 #define LOGINFOF(format, ...) Log::Write(LOG_INFO, FormatString(format, ##__VA_ARGS__))
+#else
+#define LOGINFO(message)
+#define LOGINFOF(format, ...)
+#endif
+
+#if TURSO3D_MIN_LOG_LEVEL <= 2
+#define LOGWARNING(message) Log::Write(LOG_WARNING, message)
 #define LOGWARNINGF(format, ...) Log::Write(LOG_WARNING, FormatString(format, ##__VA_ARGS__))
+#else
+#define LOGWARNING(message)
+#define LOGWARNINGF(format, ...)
+#endif
+
+#if TURSO3D_MIN_LOG_LEVEL <= 3
+#define LOGERROR(message) Log::Write(LOG_ERROR, message)
 #define LOGERRORF(format, ...) Log::Write(LOG_ERROR, FormatString(format, ##__VA_ARGS__))
+#else
+#define LOGERROR(message)
+#define LOGERRORF(format, ...)
+#endif
+
+#define LOGRAW(message) Log::WriteRaw(message)
 #define LOGRAWF(format, ...) Log::WriteRaw(FormatString(format, ##__VA_ARGS__))
 
 #else
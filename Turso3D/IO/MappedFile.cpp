@@ -0,0 +1,178 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "FileSystem.h"
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include <cstring>
+
+MappedFile::MappedFile() :
+    data(nullptr),
+    size(0),
+    mappingHandle(nullptr)
+{
+}
+
+MappedFile::MappedFile(const std::string& fileName) :
+    data(nullptr),
+    size(0),
+    mappingHandle(nullptr)
+{
+    Open(fileName);
+}
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+bool MappedFile::Open(const std::string& fileName)
+{
+    Close();
+
+    if (fileName.empty())
+        return false;
+
+    #ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(NativePath(fileName).c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fileHandle, &fileSize) || !fileSize.QuadPart)
+    {
+        CloseHandle(fileHandle);
+        return false;
+    }
+
+    // The mapping keeps the file open, so the file handle is not needed afterward
+    HANDLE mapping = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(fileHandle);
+    if (!mapping)
+        return false;
+
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+    {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    mappingHandle = mapping;
+    data = (const unsigned char*)view;
+    size = (size_t)fileSize.QuadPart;
+    #else
+    int fd = open(NativePath(fileName).c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // The mapping stays valid after the descriptor is closed
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return false;
+
+    data = (const unsigned char*)view;
+    size = (size_t)st.st_size;
+    #endif
+
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (!data)
+        return;
+
+    #ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle((HANDLE)mappingHandle);
+    mappingHandle = nullptr;
+    #else
+    munmap((void*)data, size);
+    #endif
+
+    data = nullptr;
+    size = 0;
+}
+
+MappedFileStream::MappedFileStream()
+{
+}
+
+MappedFileStream::MappedFileStream(const std::string& fileName)
+{
+    Open(fileName);
+}
+
+size_t MappedFileStream::Read(void* dest, size_t numBytes)
+{
+    if (numBytes + position > size)
+        numBytes = size - position;
+    if (!numBytes)
+        return 0;
+
+    memcpy(dest, file.Data() + position, numBytes);
+    position += numBytes;
+    return numBytes;
+}
+
+size_t MappedFileStream::Seek(size_t newPosition)
+{
+    if (newPosition > size)
+        newPosition = size;
+
+    position = newPosition;
+    return position;
+}
+
+size_t MappedFileStream::Write(const void*, size_t)
+{
+    return 0;
+}
+
+bool MappedFileStream::IsReadable() const
+{
+    return file.IsOpen();
+}
+
+bool MappedFileStream::IsWritable() const
+{
+    return false;
+}
+
+bool MappedFileStream::Open(const std::string& fileName)
+{
+    Close();
+
+    if (!file.Open(fileName))
+        return false;
+
+    name = fileName;
+    size = file.Size();
+    memoryData = file.Data();
+    return true;
+}
+
+void MappedFileStream::Close()
+{
+    file.Close();
+    position = 0;
+    size = 0;
+    memoryData = nullptr;
+}
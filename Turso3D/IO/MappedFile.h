@@ -0,0 +1,78 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Stream.h"
+
+/// Read-only memory mapping of a whole file.
+class MappedFile
+{
+public:
+    /// Construct.
+    MappedFile();
+    /// Construct and map a file.
+    MappedFile(const std::string& fileName);
+    /// Destruct. Unmap the file if mapped.
+    ~MappedFile();
+
+    /// Map a file. Return true on success.
+    bool Open(const std::string& fileName);
+    /// Unmap the file.
+    void Close();
+
+    /// Return whether is mapped.
+    bool IsOpen() const { return data != nullptr; }
+    /// Return the mapped data, or null if not mapped.
+    const unsigned char* Data() const { return data; }
+    /// Return the file size in bytes.
+    size_t Size() const { return size; }
+
+private:
+    /// Prevent copy construction.
+    MappedFile(const MappedFile& file);
+    /// Prevent assignment.
+    MappedFile& operator = (const MappedFile& rhs);
+
+    /// Mapped data.
+    const unsigned char* data;
+    /// File size.
+    size_t size;
+    /// File mapping handle on Windows.
+    void* mappingHandle;
+};
+
+/// Read-only stream over a memory mapped file. Reads are copies from the mapping, and primitive value reads are inlined.
+class MappedFileStream : public Stream
+{
+public:
+    /// Construct.
+    MappedFileStream();
+    /// Construct and map a file.
+    MappedFileStream(const std::string& fileName);
+
+    /// Read bytes from the mapping. Return number of bytes actually read.
+    size_t Read(void* dest, size_t numBytes) override;
+    /// Set position in bytes from the beginning of the file.
+    size_t Seek(size_t newPosition) override;
+    /// Write bytes. Not supported, returns zero.
+    size_t Write(const void* data, size_t numBytes) override;
+    /// Return whether read operations are allowed.
+    bool IsReadable() const override;
+    /// Return whether write operations are allowed. Always false.
+    bool IsWritable() const override;
+
+    /// Map a file. Return true on success.
+    bool Open(const std::string& fileName);
+    /// Unmap the file.
+    void Close();
+
+    /// Return the mapped data, or null if not mapped.
+    const unsigned char* Data() const { return file.Data(); }
+
+    using Stream::Read;
+    using Stream::Write;
+
+private:
+    /// Memory mapping.
+    MappedFile file;
+};
@@ -9,6 +9,7 @@ MemoryBuffer::MemoryBuffer(void* data, size_t numBytes) :
     buffer((unsigned char*)data),
     readOnly(false)
 {
+    memoryData = buffer;
 }
 
 MemoryBuffer::MemoryBuffer(const void* data, size_t numBytes) :
@@ -16,6 +17,7 @@ MemoryBuffer::MemoryBuffer(const void* data, size_t numBytes) :
     buffer((unsigned char*)data),
     readOnly(true)
 {
+    memoryData = buffer;
 }
 
 MemoryBuffer::MemoryBuffer(std::vector<unsigned char>& data) :
@@ -23,6 +25,7 @@ MemoryBuffer::MemoryBuffer(std::vector<unsigned char>& data) :
     buffer(&*data.begin()),
     readOnly(false)
 {
+    memoryData = buffer;
 }
 
 MemoryBuffer::MemoryBuffer(const std::vector<unsigned char>& data) :
@@ -30,6 +33,7 @@ MemoryBuffer::MemoryBuffer(const std::vector<unsigned char>& data) :
     buffer((const_cast<unsigned char*>(&*data.begin()))),
     readOnly(true)
 {
+    memoryData = buffer;
 }
 
 size_t MemoryBuffer::Read(void* dest, size_t numBytes)
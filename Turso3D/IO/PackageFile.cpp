@@ -0,0 +1,187 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Compression.h"
+#include "Log.h"
+#include "MemoryBuffer.h"
+#include "PackageFile.h"
+#include "StringUtils.h"
+
+#include <algorithm>
+#include <cstring>
+
+PackageFile::PackageFile()
+{
+}
+
+PackageFile::PackageFile(const std::string& fileName)
+{
+    Open(fileName);
+}
+
+bool PackageFile::Open(const std::string& fileName_)
+{
+    entries.clear();
+    fileName = fileName_;
+
+    if (!file.Open(fileName))
+    {
+        LOGERROR("Could not open package file " + fileName);
+        return false;
+    }
+
+    // The header has the file ID and the offset of the index, which follows the entry data
+    MemoryBuffer source(file.Data(), file.Size());
+    size_t indexOffset = 0;
+    if (source.ReadFileID() == "TPAK")
+        indexOffset = source.Read<unsigned>();
+    if (indexOffset < 8 || indexOffset >= file.Size())
+    {
+        LOGERROR(fileName + " is not a valid package file");
+        file.Close();
+        return false;
+    }
+
+    // Each entry takes at least a null terminated name and three offsets
+    source.Seek(indexOffset);
+    size_t numEntries = source.Read<unsigned>();
+    if (numEntries > (source.Size() - source.Position()) / (1 + 3 * sizeof(unsigned)))
+    {
+        LOGERROR(fileName + " has a corrupt package index");
+        file.Close();
+        return false;
+    }
+    entries.resize(numEntries);
+
+    for (size_t i = 0; i < numEntries; ++i)
+    {
+        PackageEntry& entry = entries[i];
+        entry.name = source.Read<std::string>();
+        entry.nameHash = StringHash(entry.name);
+
+        bool valid = source.Size() - source.Position() >= 3 * sizeof(unsigned);
+        if (valid)
+        {
+            entry.offset = source.Read<unsigned>();
+            entry.size = source.Read<unsigned>();
+            entry.compressedSize = source.Read<unsigned>();
+            size_t storedSize = entry.compressedSize ? entry.compressedSize : entry.size;
+            valid = entry.offset <= indexOffset && storedSize <= indexOffset - entry.offset;
+        }
+
+        if (!valid)
+        {
+            LOGERROR(fileName + " has a corrupt package index");
+            entries.clear();
+            file.Close();
+            return false;
+        }
+    }
+
+    // The packager writes the index sorted, but sort if necessary to allow binary search
+    auto compareEntries = [](const PackageEntry& lhs, const PackageEntry& rhs) { return lhs.nameHash < rhs.nameHash; };
+    if (!std::is_sorted(entries.begin(), entries.end(), compareEntries))
+        std::sort(entries.begin(), entries.end(), compareEntries);
+
+    LOGINFOF("Opened package file %s with %d entries", fileName.c_str(), (int)entries.size());
+    return true;
+}
+
+AutoPtr<Stream> PackageFile::OpenFile(const std::string& name)
+{
+    const PackageEntry* entry = FindEntry(name);
+    if (!entry)
+        return AutoPtr<Stream>();
+
+    AutoPtr<Stream> ret(new PackageStream(this, *entry));
+    ret->SetName(name);
+    return ret;
+}
+
+const PackageEntry* PackageFile::FindEntry(const std::string& name) const
+{
+    StringHash nameHash(name);
+    std::string lowerName;
+
+    PackageEntry key;
+    key.nameHash = nameHash;
+    auto it = std::lower_bound(entries.begin(), entries.end(), key, [](const PackageEntry& lhs, const PackageEntry& rhs) { return lhs.nameHash < rhs.nameHash; });
+
+    // Compare the names in case of hash collisions
+    for (; it != entries.end() && it->nameHash == nameHash; ++it)
+    {
+        if (lowerName.empty())
+            lowerName = ToLower(name);
+        if (it->name == lowerName)
+            return &(*it);
+    }
+
+    return nullptr;
+}
+
+PackageStream::PackageStream(PackageFile* package_, const PackageEntry& entry) :
+    Stream(entry.size),
+    package(package_),
+    storedData(package_->Data() + entry.offset),
+    storedSize(entry.compressedSize),
+    data(entry.compressedSize ? nullptr : storedData),
+    failed(false)
+{
+    memoryData = data;
+}
+
+size_t PackageStream::Read(void* dest, size_t numBytes)
+{
+    if (numBytes + position > size)
+        numBytes = size - position;
+    if (!numBytes || !Data())
+        return 0;
+
+    memcpy(dest, data + position, numBytes);
+    position += numBytes;
+    return numBytes;
+}
+
+size_t PackageStream::Seek(size_t newPosition)
+{
+    if (newPosition > size)
+        newPosition = size;
+
+    position = newPosition;
+    return position;
+}
+
+size_t PackageStream::Write(const void*, size_t)
+{
+    return 0;
+}
+
+bool PackageStream::IsReadable() const
+{
+    return !failed;
+}
+
+bool PackageStream::IsWritable() const
+{
+    return false;
+}
+
+const unsigned char* PackageStream::Data()
+{
+    if (data || failed)
+        return data;
+
+    decompressedData = new unsigned char[size];
+    if (DecompressData(decompressedData.Get(), size, storedData, storedSize))
+    {
+        data = decompressedData.Get();
+        memoryData = data;
+    }
+    else
+    {
+        LOGERROR("Failed to decompress " + name + " from package " + package->Name());
+        decompressedData.Reset();
+        failed = true;
+    }
+
+    return data;
+}
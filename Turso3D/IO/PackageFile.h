@@ -0,0 +1,102 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Object/Ptr.h"
+#include "MappedFile.h"
+#include "Stream.h"
+#include "StringHash.h"
+
+/// Alignment of the entry data in a package file.
+static const size_t PACKAGE_ALIGNMENT = 16;
+
+/// Description of a file stored in a package.
+struct PackageEntry
+{
+    /// Lowercase file name.
+    std::string name;
+    /// File name hash.
+    StringHash nameHash;
+    /// Data offset from the beginning of the package.
+    size_t offset;
+    /// Uncompressed size.
+    size_t size;
+    /// LZ4 compressed size, or zero if stored uncompressed.
+    size_t compressedSize;
+};
+
+/// Memory mapped package of resource files. The entries are indexed by name hash and read without copying unless compressed.
+class PackageFile : public RefCounted
+{
+public:
+    /// Construct.
+    PackageFile();
+    /// Construct and open a package.
+    PackageFile(const std::string& fileName);
+
+    /// Open and map a package. Return true on success.
+    bool Open(const std::string& fileName);
+    /// Open a stream for reading a file. The stream keeps the package alive. Return null if not found.
+    AutoPtr<Stream> OpenFile(const std::string& name);
+
+    /// Return the package file name.
+    const std::string& Name() const { return fileName; }
+    /// Return whether is open.
+    bool IsOpen() const { return file.IsOpen(); }
+    /// Return the entry of a file, or null if not found.
+    const PackageEntry* FindEntry(const std::string& name) const;
+    /// Return whether the package contains a file.
+    bool Exists(const std::string& name) const { return FindEntry(name) != nullptr; }
+    /// Return the entries sorted by name hash.
+    const std::vector<PackageEntry>& Entries() const { return entries; }
+    /// Return the mapped package data.
+    const unsigned char* Data() const { return file.Data(); }
+
+private:
+    /// Memory mapping of the package.
+    MappedFile file;
+    /// Package file name.
+    std::string fileName;
+    /// Entries sorted by name hash.
+    std::vector<PackageEntry> entries;
+};
+
+/// Read-only stream of a file in a package. Compressed files are decompressed on first access.
+class PackageStream : public Stream
+{
+public:
+    /// Construct from a package and its entry.
+    PackageStream(PackageFile* package, const PackageEntry& entry);
+
+    /// Read bytes from the file. Return number of bytes actually read.
+    size_t Read(void* dest, size_t numBytes) override;
+    /// Set position in bytes from the beginning of the file.
+    size_t Seek(size_t newPosition) override;
+    /// Write bytes. Not supported, returns zero.
+    size_t Write(const void* data, size_t numBytes) override;
+    /// Return whether read operations are allowed.
+    bool IsReadable() const override;
+    /// Return whether write operations are allowed. Always false.
+    bool IsWritable() const override;
+
+    /// Return the uncompressed file data, decompressing it if necessary. Return null if decompression fails.
+    const unsigned char* Data();
+
+    using Stream::Read;
+    using Stream::Write;
+
+private:
+    /// Package, kept alive while the stream exists.
+    SharedPtr<PackageFile> package;
+    /// Stored data in the mapping.
+    const unsigned char* storedData;
+    /// Stored data size.
+    size_t storedSize;
+    /// Uncompressed data, pointing into the mapping if not compressed.
+    const unsigned char* data;
+    /// Decompressed data of a compressed file.
+    SharedArrayPtr<unsigned char> decompressedData;
+    /// Decompression failed flag.
+    bool failed;
+};
@@ -8,13 +8,15 @@
 
 Stream::Stream() :
     position(0),
-    size(0)
+    size(0),
+    memoryData(nullptr)
 {
 }
 
 Stream::Stream(size_t numBytes) :
     position(0),
-    size(numBytes)
+    size(numBytes),
+    memoryData(nullptr)
 {
 }
 
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include <cstring>
 #include <string>
 #include <vector>
 
@@ -57,11 +58,17 @@ public:
     /// Write a value, template version.
     template <class T> void Write(const T& value) { Write(&value, sizeof value); }
 
-    /// Read a value, template version.
+    /// Read a value, template version. Memory backed streams are read inline without a virtual call.
     template <class T> T Read()
     {
         T ret;
-        Read(&ret, sizeof ret);
+        if (memoryData && sizeof ret <= size - position)
+        {
+            memcpy((void*)&ret, memoryData + position, sizeof ret);
+            position += sizeof ret;
+        }
+        else
+            Read(&ret, sizeof ret);
         return ret;
     }
     
@@ -73,12 +80,18 @@ public:
     size_t Size() const { return size; }
     /// Return whether the end of stream has been reached.
     bool IsEof() const { return position >= size; }
+    /// Return whether the stream reads from memory, in which case value reads are inlined.
+    bool IsMemoryBacked() const { return memoryData != nullptr; }
+    /// Return the readable data of a memory backed stream, or null.
+    const unsigned char* MemoryData() const { return memoryData; }
     
 protected:
     /// Stream position.
     size_t position;
     /// Stream size.
     size_t size;
+    /// Readable data of a memory backed stream for inline reads, or null.
+    const unsigned char* memoryData;
     /// Stream name.
     std::string name;
 };
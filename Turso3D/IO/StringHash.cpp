@@ -3,7 +3,6 @@
 #include "StringHash.h"
 #include "StringUtils.h"
 
-#include <cctype>
 #include <cstdio>
 
 const StringHash StringHash::ZERO;
@@ -18,7 +17,7 @@ unsigned StringHash::Calculate(const char* str)
     unsigned hash = 0;
     while (*str)
     {
-        hash = (tolower(*str)) + (hash << 6) + (hash << 16) - hash;
+        hash = HashChar(hash, *str);
         ++str;
     }
 
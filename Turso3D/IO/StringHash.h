@@ -9,19 +9,19 @@ class StringHash
 {
 public:
     /// Construct with zero value.
-    StringHash() :
+    constexpr StringHash() :
         value(0)
     {
     }
     
     /// Copy-construct.
-    StringHash(const StringHash& hash) :
+    constexpr StringHash(const StringHash& hash) :
         value(hash.value)
     {
     }
     
     /// Construct with an initial value.
-    explicit StringHash(unsigned value_) :
+    constexpr explicit StringHash(unsigned value_) :
         value(value_)
     {
     }
@@ -32,9 +32,9 @@ public:
     {
     }
     
-    /// Construct from a C string case-insensitively.
-    explicit StringHash(const char* str) :
-        value(Calculate(str))
+    /// Construct from a C string case-insensitively. Is evaluated at compile time for string literals in constant expressions, such as static constant hashes.
+    constexpr explicit StringHash(const char* str) :
+        value(CalculateConstexpr(str, 0))
     {
     }
     
@@ -98,7 +98,7 @@ public:
     /// Return true if nonzero hash value.
     operator bool () const { return value != 0; }
     /// Return hash value.
-    unsigned Value() const { return value; }
+    constexpr unsigned Value() const { return value; }
     /// Return as string.
     std::string ToString() const;
     /// Return hash value for HashSet & HashMap.
@@ -106,6 +106,10 @@ public:
     
     /// Calculate hash value case-insensitively from a C string.
     static unsigned Calculate(const char* str);
+    /// Calculate hash value case-insensitively from a C string, continuing from a partial hash. Can be evaluated at compile time.
+    static constexpr unsigned CalculateConstexpr(const char* str, unsigned hash) { return *str ? CalculateConstexpr(str + 1, HashChar(hash, *str)) : hash; }
+    /// Add one character to a hash value, lowercasing ASCII characters.
+    static constexpr unsigned HashChar(unsigned hash, char c) { return (unsigned)(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c) + (hash << 6) + (hash << 16) - hash; }
     
     /// Zero hash.
     static const StringHash ZERO;
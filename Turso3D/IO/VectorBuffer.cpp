@@ -23,6 +23,26 @@ VectorBuffer::VectorBuffer(Stream& source, size_t numBytes)
     SetData(source, numBytes);
 }
 
+VectorBuffer::VectorBuffer(const VectorBuffer& source) :
+    Stream(source),
+    buffer(source.buffer)
+{
+    memoryData = buffer.data();
+}
+
+VectorBuffer& VectorBuffer::operator = (const VectorBuffer& rhs)
+{
+    if (&rhs != this)
+    {
+        buffer = rhs.buffer;
+        position = rhs.position;
+        size = rhs.size;
+        name = rhs.name;
+        memoryData = buffer.data();
+    }
+    return *this;
+}
+
 size_t VectorBuffer::Read(void* dest, size_t numBytes)
 {
     if (numBytes + position > size)
@@ -51,7 +71,7 @@ size_t VectorBuffer::Read(void* dest, size_t numBytes)
     if (copySize & 1)
         *destPtr = *srcPtr;
     
-    return size;
+    return numBytes;
 }
 
 size_t VectorBuffer::Seek(size_t newPosition)
@@ -73,6 +93,7 @@ size_t VectorBuffer::Write(const void* data, size_t numBytes)
     {
         size = position + numBytes;
         buffer.resize(size);
+        memoryData = buffer.data();
     }
     
     unsigned char* srcPtr = (unsigned char*)data;
@@ -114,6 +135,7 @@ void VectorBuffer::SetData(const std::vector<unsigned char>& data)
     buffer = data;
     position = 0;
     size = data.size();
+    memoryData = buffer.data();
 }
 
 void VectorBuffer::SetData(const void* data, size_t numBytes)
@@ -127,17 +149,19 @@ void VectorBuffer::SetData(const void* data, size_t numBytes)
     
     position = 0;
     size = numBytes;
+    memoryData = buffer.data();
 }
 
 void VectorBuffer::SetData(Stream& source, size_t numBytes)
 {
     buffer.resize(numBytes);
-    size_t actualSize = source.Read(&buffer[0], numBytes);
+    size_t actualSize = numBytes ? source.Read(&buffer[0], numBytes) : 0;
     if (actualSize != numBytes)
         buffer.resize(actualSize);
     
     position = 0;
     size = actualSize;
+    memoryData = buffer.data();
 }
 
 void VectorBuffer::Clear()
@@ -145,12 +169,14 @@ void VectorBuffer::Clear()
     buffer.clear();
     position = 0;
     size = 0;
+    memoryData = buffer.data();
 }
 
 void VectorBuffer::Resize(size_t newSize)
 {
     buffer.resize(newSize);
     size = newSize;
+    memoryData = buffer.data();
     if (position > size)
         position = size;
 }
@@ -16,6 +16,11 @@ public:
     VectorBuffer(const void* data, size_t numBytes);
     /// Construct from a stream.
     VectorBuffer(Stream& source, size_t numBytes);
+    /// Copy-construct. The memory backed read pointer refers to the own copy of the data.
+    VectorBuffer(const VectorBuffer& source);
+
+    /// Assign from another buffer, including the position and name.
+    VectorBuffer& operator = (const VectorBuffer& rhs);
     
     /// Read bytes from the buffer. Return number of bytes actually read.
     size_t Read(void* dest, size_t size) override;
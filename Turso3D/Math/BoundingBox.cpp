@@ -257,3 +257,77 @@ std::string BoundingBox::ToString() const
 {
     return min.ToString() + " " + max.ToString();
 }
+
+void TransformBoundingBoxes(const BoundingBox* src, const Matrix3x4* transforms, BoundingBox* dest, size_t count)
+{
+#ifdef TURSO3D_SIMD
+    SimdFloat4 half = SimdSplat(0.5f);
+    SimdFloat4 zero = SimdSplat(0.0f);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const BoundingBox& box = src[i];
+        const Matrix3x4& transform = transforms[i];
+
+        // Transpose the rows to columns, the last of which is the translation
+        SimdFloat4 c0 = SimdLoad(&transform.m00);
+        SimdFloat4 c1 = SimdLoad(&transform.m10);
+        SimdFloat4 c2 = SimdLoad(&transform.m20);
+        SimdFloat4 c3 = zero;
+        SimdTranspose(c0, c1, c2, c3);
+
+        SimdFloat4 boxMin = SimdSet(box.min.x, box.min.y, box.min.z, 0.0f);
+        SimdFloat4 boxMax = SimdSet(box.max.x, box.max.y, box.max.z, 0.0f);
+        SimdFloat4 oldCenter = SimdMul(SimdAdd(boxMin, boxMax), half);
+        SimdFloat4 oldEdge = SimdSub(boxMax, oldCenter);
+
+        SimdFloat4 newCenter = SimdAdd(SimdAdd(SimdMul(c0, SimdSplatLane<0>(oldCenter)), SimdMul(c1, SimdSplatLane<1>(oldCenter))),
+            SimdAdd(SimdMul(c2, SimdSplatLane<2>(oldCenter)), c3));
+        SimdFloat4 newEdge = SimdAdd(SimdAdd(SimdMul(SimdAbs(c0), SimdSplatLane<0>(oldEdge)), SimdMul(SimdAbs(c1), SimdSplatLane<1>(oldEdge))),
+            SimdMul(SimdAbs(c2), SimdSplatLane<2>(oldEdge)));
+
+        // Vector3 is 12 bytes, so store through a temporary to not write past the box
+        float result[8];
+        SimdStore(&result[0], SimdSub(newCenter, newEdge));
+        SimdStore(&result[4], SimdAdd(newCenter, newEdge));
+        dest[i].min = Vector3(result[0], result[1], result[2]);
+        dest[i].max = Vector3(result[4], result[5], result[6]);
+    }
+#else
+    for (size_t i = 0; i < count; ++i)
+        dest[i] = src[i].Transformed(transforms[i]);
+#endif
+}
+
+void MergeBoundingBoxes(BoundingBox& dest, const BoundingBox* src, size_t count)
+{
+    if (!count)
+        return;
+
+    // If undefined, set initial dimensions from the first box
+    if (!dest.IsDefined())
+    {
+        dest = *src++;
+        --count;
+    }
+
+#ifdef TURSO3D_SIMD
+    SimdFloat4 newMin = SimdSet(dest.min.x, dest.min.y, dest.min.z, 0.0f);
+    SimdFloat4 newMax = SimdSet(dest.max.x, dest.max.y, dest.max.z, 0.0f);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        newMin = SimdMin(newMin, SimdSet(src[i].min.x, src[i].min.y, src[i].min.z, 0.0f));
+        newMax = SimdMax(newMax, SimdSet(src[i].max.x, src[i].max.y, src[i].max.z, 0.0f));
+    }
+
+    float result[8];
+    SimdStore(&result[0], newMin);
+    SimdStore(&result[4], newMax);
+    dest.min = Vector3(result[0], result[1], result[2]);
+    dest.max = Vector3(result[4], result[5], result[6]);
+#else
+    for (size_t i = 0; i < count; ++i)
+        dest.Merge(src[i]);
+#endif
+}
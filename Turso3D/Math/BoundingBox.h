@@ -302,3 +302,8 @@ public:
     /// Return as string.
     std::string ToString() const;
 };
+
+/// Transform an array of bounding boxes, each by its own 3x4 matrix. The destination may be the same array as the source.
+void TransformBoundingBoxes(const BoundingBox* src, const Matrix3x4* transforms, BoundingBox* dest, size_t count);
+/// Merge an array of bounding boxes into a bounding box.
+void MergeBoundingBoxes(BoundingBox& dest, const BoundingBox* src, size_t count);
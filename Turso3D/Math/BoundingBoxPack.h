@@ -0,0 +1,46 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "BoundingBox.h"
+
+/// Number of bounding boxes in a pack.
+static const size_t BOUNDING_BOX_PACK_SIZE = 8;
+
+/// Bounding boxes stored in structure-of-arrays form for batched SIMD culling tests.
+struct alignas(16) BoundingBoxPack
+{
+    /// Store a bounding box to an index in the pack.
+    void Set(size_t index, const BoundingBox& box)
+    {
+        minX[index] = box.min.x;
+        minY[index] = box.min.y;
+        minZ[index] = box.min.z;
+        maxX[index] = box.max.x;
+        maxY[index] = box.max.y;
+        maxZ[index] = box.max.z;
+    }
+
+    /// Return the bounding box at an index in the pack.
+    BoundingBox Get(size_t index) const { return BoundingBox(Vector3(minX[index], minY[index], minZ[index]), Vector3(maxX[index], maxY[index], maxZ[index])); }
+
+    /// Fill the indices from count onward with empty boxes at the origin, so that unused lanes contain defined values.
+    void ClearFrom(size_t count)
+    {
+        for (size_t i = count; i < BOUNDING_BOX_PACK_SIZE; ++i)
+            minX[i] = minY[i] = minZ[i] = maxX[i] = maxY[i] = maxZ[i] = 0.0f;
+    }
+
+    /// Minimum X coordinates.
+    float minX[BOUNDING_BOX_PACK_SIZE];
+    /// Minimum Y coordinates.
+    float minY[BOUNDING_BOX_PACK_SIZE];
+    /// Minimum Z coordinates.
+    float minZ[BOUNDING_BOX_PACK_SIZE];
+    /// Maximum X coordinates.
+    float maxX[BOUNDING_BOX_PACK_SIZE];
+    /// Maximum Y coordinates.
+    float maxY[BOUNDING_BOX_PACK_SIZE];
+    /// Maximum Z coordinates.
+    float maxZ[BOUNDING_BOX_PACK_SIZE];
+};
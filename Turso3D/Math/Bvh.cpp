@@ -0,0 +1,218 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Bvh.h"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+static_assert(sizeof(BvhNode) == 32, "Unexpected BvhNode size");
+
+static const size_t NUM_SAH_BINS = 16;
+static const float SAH_TRAVERSAL_COST = 1.0f;
+
+/// Pending node in the construction stack.
+struct BvhBuildEntry
+{
+    /// Node index.
+    unsigned node;
+    /// Object index range start.
+    unsigned start;
+    /// Object index range end.
+    unsigned end;
+    /// Depth from the root.
+    unsigned depth;
+};
+
+/// Surface area heuristic bin.
+struct SahBin
+{
+    /// Bounds of the objects in the bin.
+    BoundingBox box;
+    /// Number of objects in the bin.
+    unsigned count;
+};
+
+static float SurfaceArea(const BoundingBox& box)
+{
+    if (!box.IsDefined())
+        return 0.0f;
+
+    Vector3 size = box.Size();
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+static unsigned BinIndex(float value, float min, float scale)
+{
+    int bin = (int)((value - min) * scale);
+    return (unsigned)Clamp(bin, 0, (int)NUM_SAH_BINS - 1);
+}
+
+void Bvh::Build(const std::vector<BoundingBox>& boxes, size_t maxLeafSize)
+{
+    ZoneScoped;
+
+    Clear();
+    if (boxes.empty())
+        return;
+
+    maxLeafSize = maxLeafSize ? maxLeafSize : 1;
+
+    std::vector<Vector3> centers(boxes.size());
+    objectIndices.resize(boxes.size());
+    for (size_t i = 0; i < boxes.size(); ++i)
+    {
+        centers[i] = boxes[i].Center();
+        objectIndices[i] = (unsigned)i;
+    }
+
+    nodes.reserve(boxes.size() * 2);
+    nodes.push_back(BvhNode());
+
+    std::vector<BvhBuildEntry> stack;
+    BvhBuildEntry rootEntry;
+    rootEntry.node = 0;
+    rootEntry.start = 0;
+    rootEntry.end = (unsigned)boxes.size();
+    rootEntry.depth = 0;
+    stack.push_back(rootEntry);
+
+    while (stack.size())
+    {
+        BvhBuildEntry entry = stack.back();
+        stack.pop_back();
+
+        BoundingBox box;
+        BoundingBox centerBox;
+        for (unsigned i = entry.start; i < entry.end; ++i)
+        {
+            box.Merge(boxes[objectIndices[i]]);
+            centerBox.Merge(centers[objectIndices[i]]);
+        }
+
+        nodes[entry.node].min = box.min;
+        nodes[entry.node].max = box.max;
+
+        unsigned count = entry.end - entry.start;
+        unsigned mid = entry.start;
+
+        if (count > 1 && entry.depth < BVH_MAX_DEPTH)
+        {
+            // Find the cheapest split plane between the bins of each axis
+            float leafCost = SurfaceArea(box) * count;
+            float bestCost = M_INFINITY;
+            int bestAxis = -1;
+            unsigned bestSplit = 0;
+            Vector3 centerSize = centerBox.Size();
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float axisMin = centerBox.min.Data()[axis];
+                float axisSize = centerSize.Data()[axis];
+                if (axisSize <= M_EPSILON)
+                    continue;
+
+                float scale = (float)NUM_SAH_BINS / axisSize;
+                SahBin bins[NUM_SAH_BINS];
+                for (size_t i = 0; i < NUM_SAH_BINS; ++i)
+                    bins[i].count = 0;
+
+                for (unsigned i = entry.start; i < entry.end; ++i)
+                {
+                    unsigned index = objectIndices[i];
+                    SahBin& bin = bins[BinIndex(centers[index].Data()[axis], axisMin, scale)];
+                    bin.box.Merge(boxes[index]);
+                    ++bin.count;
+                }
+
+                // Sweep from the right to get the cost of each right side, then from the left to combine
+                float rightCosts[NUM_SAH_BINS];
+                BoundingBox rightBox;
+                unsigned rightCount = 0;
+                for (size_t i = NUM_SAH_BINS - 1; i > 0; --i)
+                {
+                    rightBox.Merge(bins[i].box);
+                    rightCount += bins[i].count;
+                    rightCosts[i] = SurfaceArea(rightBox) * rightCount;
+                }
+
+                BoundingBox leftBox;
+                unsigned leftCount = 0;
+                for (size_t i = 1; i < NUM_SAH_BINS; ++i)
+                {
+                    leftBox.Merge(bins[i - 1].box);
+                    leftCount += bins[i - 1].count;
+                    if (!leftCount || leftCount == count)
+                        continue;
+
+                    float cost = SurfaceArea(leftBox) * leftCount + rightCosts[i];
+                    if (cost < bestCost)
+                    {
+                        bestCost = cost;
+                        bestAxis = axis;
+                        bestSplit = (unsigned)i;
+                    }
+                }
+            }
+
+            bool split = count > maxLeafSize || (bestAxis >= 0 && SAH_TRAVERSAL_COST * SurfaceArea(box) + bestCost < leafCost);
+            if (split)
+            {
+                if (bestAxis >= 0)
+                {
+                    float axisMin = centerBox.min.Data()[bestAxis];
+                    float scale = (float)NUM_SAH_BINS / centerSize.Data()[bestAxis];
+                    mid = (unsigned)(std::partition(objectIndices.begin() + entry.start, objectIndices.begin() + entry.end, [&](unsigned index)
+                    {
+                        return BinIndex(centers[index].Data()[bestAxis], axisMin, scale) < bestSplit;
+                    }) - objectIndices.begin());
+                }
+
+                // If the centers coincide, fall back to a median split to keep the leaves small
+                if (mid == entry.start || mid == entry.end)
+                {
+                    Vector3 size = box.Size();
+                    int axis = (size.x >= size.y && size.x >= size.z) ? 0 : (size.y >= size.z ? 1 : 2);
+                    mid = entry.start + count / 2;
+                    std::nth_element(objectIndices.begin() + entry.start, objectIndices.begin() + mid, objectIndices.begin() + entry.end, [&](unsigned lhs, unsigned rhs)
+                    {
+                        return centers[lhs].Data()[axis] < centers[rhs].Data()[axis];
+                    });
+                }
+            }
+        }
+
+        if (mid > entry.start && mid < entry.end)
+        {
+            unsigned firstChild = (unsigned)nodes.size();
+            nodes.push_back(BvhNode());
+            nodes.push_back(BvhNode());
+            nodes[entry.node].index = firstChild;
+            nodes[entry.node].count = 0;
+
+            BvhBuildEntry left;
+            left.node = firstChild;
+            left.start = entry.start;
+            left.end = mid;
+            left.depth = entry.depth + 1;
+            BvhBuildEntry right = left;
+            right.node = firstChild + 1;
+            right.start = mid;
+            right.end = entry.end;
+            stack.push_back(right);
+            stack.push_back(left);
+        }
+        else
+        {
+            nodes[entry.node].index = (unsigned)leafStarts.size();
+            nodes[entry.node].count = count;
+            leafStarts.push_back(entry.start);
+        }
+    }
+}
+
+void Bvh::Clear()
+{
+    nodes.clear();
+    objectIndices.clear();
+    leafStarts.clear();
+}
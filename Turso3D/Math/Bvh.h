@@ -0,0 +1,58 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "BoundingBox.h"
+
+#include <vector>
+
+static const size_t BVH_MAX_LEAF_SIZE = 16;
+static const size_t BVH_MAX_DEPTH = 48;
+static const size_t BVH_STACK_SIZE = BVH_MAX_DEPTH + 2;
+
+/// Compact 32-byte bounding volume hierarchy node.
+struct BvhNode
+{
+    /// Return the bounding box.
+    BoundingBox Box() const { return BoundingBox(min, max); }
+    /// Return whether is a leaf.
+    bool IsLeaf() const { return count != 0; }
+
+    /// Bounding box minimum.
+    Vector3 min;
+    /// Index of the first child node if internal, the second child follows it. Leaf index if leaf.
+    unsigned index;
+    /// Bounding box maximum.
+    Vector3 max;
+    /// Number of objects if leaf, zero if internal.
+    unsigned count;
+};
+
+/// Binary bounding volume hierarchy over bounding boxes, built with the binned surface area heuristic. Leaves refer to ranges of the reordered object indices.
+class Bvh
+{
+public:
+    /// Build from object bounding boxes. Previous data is discarded.
+    void Build(const std::vector<BoundingBox>& boxes, size_t maxLeafSize = BVH_MAX_LEAF_SIZE);
+    /// Discard the data.
+    void Clear();
+
+    /// Return the nodes. The first is the root.
+    const std::vector<BvhNode>& Nodes() const { return nodes; }
+    /// Return the object indices in leaf order.
+    const std::vector<unsigned>& ObjectIndices() const { return objectIndices; }
+    /// Return number of leaves.
+    size_t NumLeaves() const { return leafStarts.size(); }
+    /// Return the start of a leaf's range in the object indices.
+    unsigned LeafStart(size_t leafIndex) const { return leafStarts[leafIndex]; }
+    /// Return whether has no nodes.
+    bool IsEmpty() const { return nodes.empty(); }
+
+private:
+    /// Nodes.
+    std::vector<BvhNode> nodes;
+    /// Object indices, reordered so that each leaf refers to a contiguous range.
+    std::vector<unsigned> objectIndices;
+    /// Object index range starts for leaves.
+    std::vector<unsigned> leafStarts;
+};
@@ -2,6 +2,17 @@
 
 #include "Frustum.h"
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TURSO3D_FRUSTUM_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TURSO3D_FRUSTUM_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TURSO3D_FRUSTUM_NEON
+#endif
+
 inline Vector3 ClipEdgeZ(const Vector3& v0, const Vector3& v1, float clipZ)
 {
     return Vector3(
@@ -184,3 +195,129 @@ void Frustum::UpdatePlanes()
         }
     }
 }
+
+unsigned Frustum::IsInsideMaskedFast(const BoundingBoxPack& boxes, unsigned char planeMask) const
+{
+    #if defined(TURSO3D_FRUSTUM_AVX)
+    __m256 half = _mm256_set1_ps(0.5f);
+    __m256 minX = _mm256_loadu_ps(boxes.minX);
+    __m256 minY = _mm256_loadu_ps(boxes.minY);
+    __m256 minZ = _mm256_loadu_ps(boxes.minZ);
+    __m256 maxX = _mm256_loadu_ps(boxes.maxX);
+    __m256 maxY = _mm256_loadu_ps(boxes.maxY);
+    __m256 maxZ = _mm256_loadu_ps(boxes.maxZ);
+    __m256 centerX = _mm256_mul_ps(_mm256_add_ps(minX, maxX), half);
+    __m256 centerY = _mm256_mul_ps(_mm256_add_ps(minY, maxY), half);
+    __m256 centerZ = _mm256_mul_ps(_mm256_add_ps(minZ, maxZ), half);
+    __m256 edgeX = _mm256_sub_ps(centerX, minX);
+    __m256 edgeY = _mm256_sub_ps(centerY, minY);
+    __m256 edgeZ = _mm256_sub_ps(centerZ, minZ);
+    __m256 outside = _mm256_setzero_ps();
+
+    for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+    {
+        if (!(planeMask & (1 << i)))
+            continue;
+
+        const Plane& plane = planes[i];
+        __m256 dist = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.normal.x), centerX), _mm256_mul_ps(_mm256_set1_ps(plane.normal.y), centerY)),
+            _mm256_mul_ps(_mm256_set1_ps(plane.normal.z), centerZ)), _mm256_set1_ps(plane.d));
+        __m256 absDist = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.absNormal.x), edgeX), _mm256_mul_ps(_mm256_set1_ps(plane.absNormal.y), edgeY)),
+            _mm256_mul_ps(_mm256_set1_ps(plane.absNormal.z), edgeZ));
+        outside = _mm256_or_ps(outside, _mm256_cmp_ps(dist, _mm256_sub_ps(_mm256_setzero_ps(), absDist), _CMP_LT_OQ));
+    }
+
+    return ~(unsigned)_mm256_movemask_ps(outside) & 0xff;
+
+    #elif defined(TURSO3D_FRUSTUM_SSE)
+    unsigned result = 0;
+    __m128 half = _mm_set1_ps(0.5f);
+
+    for (size_t j = 0; j < BOUNDING_BOX_PACK_SIZE; j += 4)
+    {
+        __m128 minX = _mm_load_ps(boxes.minX + j);
+        __m128 minY = _mm_load_ps(boxes.minY + j);
+        __m128 minZ = _mm_load_ps(boxes.minZ + j);
+        __m128 maxX = _mm_load_ps(boxes.maxX + j);
+        __m128 maxY = _mm_load_ps(boxes.maxY + j);
+        __m128 maxZ = _mm_load_ps(boxes.maxZ + j);
+        __m128 centerX = _mm_mul_ps(_mm_add_ps(minX, maxX), half);
+        __m128 centerY = _mm_mul_ps(_mm_add_ps(minY, maxY), half);
+        __m128 centerZ = _mm_mul_ps(_mm_add_ps(minZ, maxZ), half);
+        __m128 edgeX = _mm_sub_ps(centerX, minX);
+        __m128 edgeY = _mm_sub_ps(centerY, minY);
+        __m128 edgeZ = _mm_sub_ps(centerZ, minZ);
+        __m128 outside = _mm_setzero_ps();
+
+        for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+        {
+            if (!(planeMask & (1 << i)))
+                continue;
+
+            const Plane& plane = planes[i];
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.normal.x), centerX), _mm_mul_ps(_mm_set1_ps(plane.normal.y), centerY)),
+                _mm_mul_ps(_mm_set1_ps(plane.normal.z), centerZ)), _mm_set1_ps(plane.d));
+            __m128 absDist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.absNormal.x), edgeX), _mm_mul_ps(_mm_set1_ps(plane.absNormal.y), edgeY)),
+                _mm_mul_ps(_mm_set1_ps(plane.absNormal.z), edgeZ));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, _mm_sub_ps(_mm_setzero_ps(), absDist)));
+        }
+
+        result |= (~(unsigned)_mm_movemask_ps(outside) & 0xf) << j;
+    }
+
+    return result;
+
+    #elif defined(TURSO3D_FRUSTUM_NEON)
+    static const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+    unsigned result = 0;
+    float32x4_t half = vdupq_n_f32(0.5f);
+    uint32x4_t bits = vld1q_u32(laneBits);
+
+    for (size_t j = 0; j < BOUNDING_BOX_PACK_SIZE; j += 4)
+    {
+        float32x4_t minX = vld1q_f32(boxes.minX + j);
+        float32x4_t minY = vld1q_f32(boxes.minY + j);
+        float32x4_t minZ = vld1q_f32(boxes.minZ + j);
+        float32x4_t maxX = vld1q_f32(boxes.maxX + j);
+        float32x4_t maxY = vld1q_f32(boxes.maxY + j);
+        float32x4_t maxZ = vld1q_f32(boxes.maxZ + j);
+        float32x4_t centerX = vmulq_f32(vaddq_f32(minX, maxX), half);
+        float32x4_t centerY = vmulq_f32(vaddq_f32(minY, maxY), half);
+        float32x4_t centerZ = vmulq_f32(vaddq_f32(minZ, maxZ), half);
+        float32x4_t edgeX = vsubq_f32(centerX, minX);
+        float32x4_t edgeY = vsubq_f32(centerY, minY);
+        float32x4_t edgeZ = vsubq_f32(centerZ, minZ);
+        uint32x4_t outside = vdupq_n_u32(0);
+
+        for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+        {
+            if (!(planeMask & (1 << i)))
+                continue;
+
+            const Plane& plane = planes[i];
+            float32x4_t dist = vaddq_f32(vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(centerX, plane.normal.x), centerY, plane.normal.y), centerZ, plane.normal.z), vdupq_n_f32(plane.d));
+            float32x4_t absDist = vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(edgeX, plane.absNormal.x), edgeY, plane.absNormal.y), edgeZ, plane.absNormal.z);
+            outside = vorrq_u32(outside, vcltq_f32(dist, vnegq_f32(absDist)));
+        }
+
+        uint32x4_t outsideBits = vandq_u32(outside, bits);
+        uint32x2_t sum = vpadd_u32(vget_low_u32(outsideBits), vget_high_u32(outsideBits));
+        sum = vpadd_u32(sum, sum);
+        result |= (~vget_lane_u32(sum, 0) & 0xf) << j;
+    }
+
+    return result;
+
+    #else
+    unsigned result = 0;
+
+    for (size_t j = 0; j < BOUNDING_BOX_PACK_SIZE; ++j)
+    {
+        BoundingBox box(Vector3(boxes.minX[j], boxes.minY[j], boxes.minZ[j]), Vector3(boxes.maxX[j], boxes.maxY[j], boxes.maxZ[j]));
+        if (IsInsideMaskedFast(box, planeMask))
+            result |= 1 << j;
+    }
+
+    return result;
+    #endif
+}
@@ -2,7 +2,7 @@
 
 #pragma once
 
-#include "BoundingBox.h"
+#include "BoundingBoxPack.h"
 #include "Matrix3x4.h"
 #include "Plane.h"
 #include "Sphere.h"
@@ -182,6 +182,9 @@ public:
         return INSIDE;
     }
     
+    /// Test a pack of bounding boxes, using a mask to skip unnecessary planes. Return a bitmask of the boxes that are (partially) inside. Uses SSE, AVX or NEON when available.
+    unsigned IsInsideMaskedFast(const BoundingBoxPack& boxes, unsigned char planeMask = 0x3f) const;
+
     /// Return distance of a point to the frustum, or 0 if inside.
     float Distance(const Vector3& point) const
     {
@@ -0,0 +1,40 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Half.h"
+
+#if !defined(TURSO3D_NO_SIMD) && (defined(__F16C__) || defined(__AVX2__))
+#include <immintrin.h>
+#define TURSO3D_F16C
+#endif
+
+void FloatsToHalfs(const float* src, unsigned short* dest, size_t count)
+{
+    size_t i = 0;
+
+#if defined(TURSO3D_F16C)
+    for (; i + 4 <= count; i += 4)
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + i), _mm_cvtps_ph(_mm_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT));
+#elif defined(TURSO3D_NEON) && defined(__aarch64__)
+    for (; i + 4 <= count; i += 4)
+        vst1_u16(dest + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(src + i))));
+#endif
+
+    for (; i < count; ++i)
+        dest[i] = FloatToHalf(src[i]);
+}
+
+void HalfsToFloats(const unsigned short* src, float* dest, size_t count)
+{
+    size_t i = 0;
+
+#if defined(TURSO3D_F16C)
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(dest + i, _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src + i))));
+#elif defined(TURSO3D_NEON) && defined(__aarch64__)
+    for (; i + 4 <= count; i += 4)
+        vst1q_f32(dest + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(src + i))));
+#endif
+
+    for (; i < count; ++i)
+        dest[i] = HalfToFloat(src[i]);
+}
@@ -0,0 +1,89 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Color.h"
+
+/// 16-bit floating point number.
+class Half
+{
+public:
+    /// Bit pattern.
+    unsigned short value;
+
+    /// Construct undefined.
+    Half()
+    {
+    }
+
+    /// Construct from a float, rounding to nearest.
+    explicit Half(float value_) :
+        value(FloatToHalf(value_))
+    {
+    }
+
+    /// Test for equality with another half.
+    bool operator == (const Half& rhs) const { return value == rhs.value; }
+    /// Test for inequality with another half.
+    bool operator != (const Half& rhs) const { return value != rhs.value; }
+
+    /// Return as a float.
+    float ToFloat() const { return HalfToFloat(value); }
+
+    /// Construct from a bit pattern.
+    static Half FromBits(unsigned short bits) { Half ret; ret.value = bits; return ret; }
+};
+
+/// Four-dimensional vector with 16-bit floating point components.
+class Vector4Half
+{
+public:
+    /// X coordinate.
+    Half x;
+    /// Y coordinate.
+    Half y;
+    /// Z coordinate.
+    Half z;
+    /// W coordinate.
+    Half w;
+
+    /// Construct undefined.
+    Vector4Half()
+    {
+    }
+
+    /// Construct from a vector.
+    explicit Vector4Half(const Vector4& vector) :
+        x(vector.x),
+        y(vector.y),
+        z(vector.z),
+        w(vector.w)
+    {
+    }
+
+    /// Construct from a color.
+    explicit Vector4Half(const Color& color) :
+        x(color.r),
+        y(color.g),
+        z(color.b),
+        w(color.a)
+    {
+    }
+
+    /// Test for equality with another vector.
+    bool operator == (const Vector4Half& rhs) const { return x == rhs.x && y == rhs.y && z == rhs.z && w == rhs.w; }
+    /// Test for inequality with another vector.
+    bool operator != (const Vector4Half& rhs) const { return !(*this == rhs); }
+
+    /// Return as a vector.
+    Vector4 ToVector4() const { return Vector4(x.ToFloat(), y.ToFloat(), z.ToFloat(), w.ToFloat()); }
+    /// Return as a color.
+    Color ToColor() const { return Color(x.ToFloat(), y.ToFloat(), z.ToFloat(), w.ToFloat()); }
+    /// Return the bit patterns.
+    const unsigned short* Data() const { return &x.value; }
+};
+
+/// Convert an array of floats to half floats. Uses F16C or NEON conversion when available, which rounds ties to even.
+void FloatsToHalfs(const float* src, unsigned short* dest, size_t count);
+/// Convert an array of half floats to floats. Uses F16C or NEON conversion when available.
+void HalfsToFloats(const unsigned short* src, float* dest, size_t count);
@@ -4,8 +4,18 @@
 
 #include <cstdlib>
 #include <cmath>
+#include <cstring>
 #include <limits>
 
+// Use SSE or NEON in the inline matrix and quaternion math unless disabled with the TURSO3D_SIMD build option
+#if !defined(TURSO3D_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define TURSO3D_SSE
+#elif !defined(TURSO3D_NO_SIMD) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define TURSO3D_NEON
+#endif
+
 #undef M_PI
 static const float M_PI = 3.14159265358979323846264338327950288f;
 static const float M_HALF_PI = M_PI * 0.5f;
@@ -21,6 +31,125 @@ static const float M_DEGTORAD = (float)M_PI / 180.0f;
 static const float M_DEGTORAD_2 = (float)M_PI / 360.0f; // M_DEGTORAD / 2.f
 static const float M_RADTODEG = 1.0f / M_DEGTORAD;
 
+#if defined(TURSO3D_SSE) || defined(TURSO3D_NEON)
+#define TURSO3D_SIMD
+
+#if defined(TURSO3D_SSE)
+/// Four floats in a SIMD register.
+typedef __m128 SimdFloat4;
+/// Four lane masks in a SIMD register.
+typedef __m128 SimdMask4;
+
+/// Load four floats from unaligned memory.
+inline SimdFloat4 SimdLoad(const float* data) { return _mm_loadu_ps(data); }
+/// Store four floats to unaligned memory.
+inline void SimdStore(float* dest, SimdFloat4 value) { _mm_storeu_ps(dest, value); }
+/// Construct from four floats in memory order.
+inline SimdFloat4 SimdSet(float x, float y, float z, float w) { return _mm_setr_ps(x, y, z, w); }
+/// Construct with the same float in all lanes.
+inline SimdFloat4 SimdSplat(float value) { return _mm_set1_ps(value); }
+/// Add.
+inline SimdFloat4 SimdAdd(SimdFloat4 lhs, SimdFloat4 rhs) { return _mm_add_ps(lhs, rhs); }
+/// Multiply.
+inline SimdFloat4 SimdMul(SimdFloat4 lhs, SimdFloat4 rhs) { return _mm_mul_ps(lhs, rhs); }
+/// Subtract.
+inline SimdFloat4 SimdSub(SimdFloat4 lhs, SimdFloat4 rhs) { return _mm_sub_ps(lhs, rhs); }
+/// Return per-lane minimum.
+inline SimdFloat4 SimdMin(SimdFloat4 lhs, SimdFloat4 rhs) { return _mm_min_ps(lhs, rhs); }
+/// Return per-lane maximum.
+inline SimdFloat4 SimdMax(SimdFloat4 lhs, SimdFloat4 rhs) { return _mm_max_ps(lhs, rhs); }
+/// Return per-lane absolute value.
+inline SimdFloat4 SimdAbs(SimdFloat4 value) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), value); }
+/// Return lane 0, 1, 2 or 3 in all lanes.
+template <int Lane> inline SimdFloat4 SimdSplatLane(SimdFloat4 value) { return _mm_shuffle_ps(value, value, _MM_SHUFFLE(Lane, Lane, Lane, Lane)); }
+/// Transpose a 4x4 matrix given as four rows.
+inline void SimdTranspose(SimdFloat4& r0, SimdFloat4& r1, SimdFloat4& r2, SimdFloat4& r3) { _MM_TRANSPOSE4_PS(r0, r1, r2, r3); }
+/// Divide.
+inline SimdFloat4 SimdDiv(SimdFloat4 lhs, SimdFloat4 rhs) { return _mm_div_ps(lhs, rhs); }
+/// Return the lanes where the left value is greater or equal.
+inline SimdMask4 SimdGreaterEqual(SimdFloat4 lhs, SimdFloat4 rhs) { return _mm_cmpge_ps(lhs, rhs); }
+/// Return the lanes set in both masks.
+inline SimdMask4 SimdAnd(SimdMask4 lhs, SimdMask4 rhs) { return _mm_and_ps(lhs, rhs); }
+/// Select per lane from the first value where the mask is set and from the second otherwise.
+inline SimdFloat4 SimdSelect(SimdMask4 mask, SimdFloat4 ifSet, SimdFloat4 ifClear) { return _mm_or_ps(_mm_and_ps(mask, ifSet), _mm_andnot_ps(mask, ifClear)); }
+/// Multiply a row vector by a matrix given as four rows.
+inline SimdFloat4 SimdTransformRow(SimdFloat4 row, SimdFloat4 r0, SimdFloat4 r1, SimdFloat4 r2, SimdFloat4 r3)
+{
+    SimdFloat4 ret = _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(0, 0, 0, 0)), r0);
+    ret = _mm_add_ps(ret, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(1, 1, 1, 1)), r1));
+    ret = _mm_add_ps(ret, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(2, 2, 2, 2)), r2));
+    return _mm_add_ps(ret, _mm_mul_ps(_mm_shuffle_ps(row, row, _MM_SHUFFLE(3, 3, 3, 3)), r3));
+}
+#else
+/// Four floats in a SIMD register.
+typedef float32x4_t SimdFloat4;
+/// Four lane masks in a SIMD register.
+typedef uint32x4_t SimdMask4;
+
+/// Load four floats from unaligned memory.
+inline SimdFloat4 SimdLoad(const float* data) { return vld1q_f32(data); }
+/// Store four floats to unaligned memory.
+inline void SimdStore(float* dest, SimdFloat4 value) { vst1q_f32(dest, value); }
+/// Construct from four floats in memory order.
+inline SimdFloat4 SimdSet(float x, float y, float z, float w) { float data[4] = { x, y, z, w }; return vld1q_f32(data); }
+/// Construct with the same float in all lanes.
+inline SimdFloat4 SimdSplat(float value) { return vdupq_n_f32(value); }
+/// Add.
+inline SimdFloat4 SimdAdd(SimdFloat4 lhs, SimdFloat4 rhs) { return vaddq_f32(lhs, rhs); }
+/// Multiply.
+inline SimdFloat4 SimdMul(SimdFloat4 lhs, SimdFloat4 rhs) { return vmulq_f32(lhs, rhs); }
+/// Subtract.
+inline SimdFloat4 SimdSub(SimdFloat4 lhs, SimdFloat4 rhs) { return vsubq_f32(lhs, rhs); }
+/// Return per-lane minimum.
+inline SimdFloat4 SimdMin(SimdFloat4 lhs, SimdFloat4 rhs) { return vminq_f32(lhs, rhs); }
+/// Return per-lane maximum.
+inline SimdFloat4 SimdMax(SimdFloat4 lhs, SimdFloat4 rhs) { return vmaxq_f32(lhs, rhs); }
+/// Return per-lane absolute value.
+inline SimdFloat4 SimdAbs(SimdFloat4 value) { return vabsq_f32(value); }
+/// Return lane 0, 1, 2 or 3 in all lanes.
+template <int Lane> inline SimdFloat4 SimdSplatLane(SimdFloat4 value) { return vdupq_n_f32(vgetq_lane_f32(value, Lane)); }
+/// Transpose a 4x4 matrix given as four rows.
+inline void SimdTranspose(SimdFloat4& r0, SimdFloat4& r1, SimdFloat4& r2, SimdFloat4& r3)
+{
+    float32x4x2_t t01 = vtrnq_f32(r0, r1);
+    float32x4x2_t t23 = vtrnq_f32(r2, r3);
+    r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+    r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+    r2 = vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0]));
+    r3 = vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1]));
+}
+/// Divide.
+inline SimdFloat4 SimdDiv(SimdFloat4 lhs, SimdFloat4 rhs)
+{
+#if defined(__aarch64__) || defined(_M_ARM64)
+    return vdivq_f32(lhs, rhs);
+#else
+    // Reciprocal estimate refined with two Newton-Raphson steps
+    float32x4_t reciprocal = vrecpeq_f32(rhs);
+    reciprocal = vmulq_f32(vrecpsq_f32(rhs, reciprocal), reciprocal);
+    reciprocal = vmulq_f32(vrecpsq_f32(rhs, reciprocal), reciprocal);
+    return vmulq_f32(lhs, reciprocal);
+#endif
+}
+/// Return the lanes where the left value is greater or equal.
+inline SimdMask4 SimdGreaterEqual(SimdFloat4 lhs, SimdFloat4 rhs) { return vcgeq_f32(lhs, rhs); }
+/// Return the lanes set in both masks.
+inline SimdMask4 SimdAnd(SimdMask4 lhs, SimdMask4 rhs) { return vandq_u32(lhs, rhs); }
+/// Select per lane from the first value where the mask is set and from the second otherwise.
+inline SimdFloat4 SimdSelect(SimdMask4 mask, SimdFloat4 ifSet, SimdFloat4 ifClear) { return vbslq_f32(mask, ifSet, ifClear); }
+/// Multiply a row vector by a matrix given as four rows.
+inline SimdFloat4 SimdTransformRow(SimdFloat4 row, SimdFloat4 r0, SimdFloat4 r1, SimdFloat4 r2, SimdFloat4 r3)
+{
+    float32x2_t low = vget_low_f32(row);
+    float32x2_t high = vget_high_f32(row);
+    SimdFloat4 ret = vmulq_lane_f32(r0, low, 0);
+    ret = vmlaq_lane_f32(ret, r1, low, 1);
+    ret = vmlaq_lane_f32(ret, r2, high, 0);
+    return vmlaq_lane_f32(ret, r3, high, 1);
+}
+#endif
+#endif
+
 /// Intersection test result.
 enum Intersection
 {
@@ -77,6 +206,35 @@ inline float Atan(float x) { return M_RADTODEG * atanf(x); }
 /// Return arc tangent of y/x in degrees.
 inline float Atan2(float y, float x) { return M_RADTODEG * atan2f(y, x); }
 
+/// Return an approximate inverse square root with about 1e-5 relative error. The value must be positive.
+inline float InvSqrtFast(float x)
+{
+#ifdef TURSO3D_SSE
+    float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+    // Bit-level initial estimate, which needs one more Newton-Raphson step than the hardware estimate
+    union { float f; unsigned u; } bits;
+    bits.f = x;
+    bits.u = 0x5f375a86 - (bits.u >> 1);
+    float y = bits.f;
+    y = y * (1.5f - 0.5f * x * y * y);
+#endif
+    return y * (1.5f - 0.5f * x * y * y);
+}
+
+/// Return approximate sine of an angle in degrees, within about 0.001 of the exact value.
+inline float SinFast(float angle)
+{
+    // Wrap to -180..180 degrees, then refine a parabolic fit of the half wave
+    float x = angle * (1.0f / 360.0f);
+    x -= floorf(x + 0.5f);
+    float y = 8.0f * x - 16.0f * x * Abs(x);
+    return 0.225f * (y * Abs(y) - y) + y;
+}
+
+/// Return approximate cosine of an angle in degrees, within about 0.001 of the exact value.
+inline float CosFast(float angle) { return SinFast(angle + 90.0f); }
+
 /// Return the smaller of two integer values.
 inline int Min(int lhs, int rhs) { return lhs < rhs ? lhs : rhs; }
 /// Return the larger of two integer values.
@@ -118,3 +276,65 @@ inline unsigned NextPowerOfTwo(unsigned value)
         ret <<= 1;
     return ret;
 }
+
+/// Convert a float to a half float, rounding to nearest.
+inline unsigned short FloatToHalf(float value)
+{
+    unsigned bits;
+    memcpy(&bits, &value, sizeof bits);
+    unsigned short sign = (unsigned short)((bits >> 16) & 0x8000);
+    int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+    unsigned mantissa = bits & 0x7fffff;
+
+    if (exponent >= 31)
+        return sign | 0x7c00;
+    if (exponent <= 0)
+    {
+        // Denormal or too small to represent
+        if (exponent < -10)
+            return sign;
+        mantissa |= 0x800000;
+        unsigned shift = (unsigned)(14 - exponent);
+        unsigned short half = (unsigned short)(mantissa >> shift);
+        if ((mantissa >> (shift - 1)) & 1)
+            ++half;
+        return sign | half;
+    }
+
+    // Rounding may carry into the exponent, which is the correct result
+    unsigned short half = (unsigned short)((exponent << 10) | (mantissa >> 13));
+    if (mantissa & 0x1000)
+        ++half;
+    return sign | half;
+}
+
+/// Convert a half float to a float.
+inline float HalfToFloat(unsigned short value)
+{
+    unsigned sign = (unsigned)(value & 0x8000) << 16;
+    unsigned exponent = (value >> 10) & 0x1f;
+    unsigned mantissa = value & 0x3ff;
+    unsigned bits;
+
+    if (exponent == 31)
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    else if (exponent)
+        bits = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    else if (mantissa)
+    {
+        // Normalize the denormal
+        exponent = 127 - 15 + 1;
+        while (!(mantissa & 0x400))
+        {
+            mantissa <<= 1;
+            --exponent;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    else
+        bits = sign;
+
+    float ret;
+    memcpy(&ret, &bits, sizeof ret);
+    return ret;
+}
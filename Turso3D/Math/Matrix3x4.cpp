@@ -88,3 +88,71 @@ std::string Matrix3x4::ToString() const
         m10, m11, m12, m13, 
         m20, m21, m22, m23);
 }
+
+void MultiplyMatrices(const Matrix3x4& lhs, const Matrix3x4* src, Matrix3x4* dest, size_t count)
+{
+#ifdef TURSO3D_SIMD
+    // Each result row is a combination of the source rows weighted by a left-hand row
+    SimdFloat4 l0 = SimdLoad(&lhs.m00);
+    SimdFloat4 l1 = SimdLoad(&lhs.m10);
+    SimdFloat4 l2 = SimdLoad(&lhs.m20);
+    SimdFloat4 r3 = SimdSet(0.0f, 0.0f, 0.0f, 1.0f);
+    for (size_t i = 0; i < count; ++i)
+    {
+        SimdFloat4 r0 = SimdLoad(&src[i].m00);
+        SimdFloat4 r1 = SimdLoad(&src[i].m10);
+        SimdFloat4 r2 = SimdLoad(&src[i].m20);
+        SimdStore(&dest[i].m00, SimdTransformRow(l0, r0, r1, r2, r3));
+        SimdStore(&dest[i].m10, SimdTransformRow(l1, r0, r1, r2, r3));
+        SimdStore(&dest[i].m20, SimdTransformRow(l2, r0, r1, r2, r3));
+    }
+#else
+    for (size_t i = 0; i < count; ++i)
+        dest[i] = lhs * src[i];
+#endif
+}
+
+void MultiplyMatrices(const Matrix3x4* lhs, const Matrix3x4* rhs, Matrix3x4* dest, size_t count)
+{
+#ifdef TURSO3D_SIMD
+    SimdFloat4 r3 = SimdSet(0.0f, 0.0f, 0.0f, 1.0f);
+    for (size_t i = 0; i < count; ++i)
+    {
+        SimdFloat4 l0 = SimdLoad(&lhs[i].m00);
+        SimdFloat4 l1 = SimdLoad(&lhs[i].m10);
+        SimdFloat4 l2 = SimdLoad(&lhs[i].m20);
+        SimdFloat4 r0 = SimdLoad(&rhs[i].m00);
+        SimdFloat4 r1 = SimdLoad(&rhs[i].m10);
+        SimdFloat4 r2 = SimdLoad(&rhs[i].m20);
+        SimdStore(&dest[i].m00, SimdTransformRow(l0, r0, r1, r2, r3));
+        SimdStore(&dest[i].m10, SimdTransformRow(l1, r0, r1, r2, r3));
+        SimdStore(&dest[i].m20, SimdTransformRow(l2, r0, r1, r2, r3));
+    }
+#else
+    for (size_t i = 0; i < count; ++i)
+        dest[i] = lhs[i] * rhs[i];
+#endif
+}
+
+void TransformPoints(const Matrix3x4& transform, const Vector3* src, Vector3* dest, size_t count)
+{
+#ifdef TURSO3D_SIMD
+    // Transpose to columns so that a point transforms as a weighted sum of them
+    SimdFloat4 c0 = SimdSet(transform.m00, transform.m10, transform.m20, 0.0f);
+    SimdFloat4 c1 = SimdSet(transform.m01, transform.m11, transform.m21, 0.0f);
+    SimdFloat4 c2 = SimdSet(transform.m02, transform.m12, transform.m22, 0.0f);
+    SimdFloat4 c3 = SimdSet(transform.m03, transform.m13, transform.m23, 0.0f);
+    for (size_t i = 0; i < count; ++i)
+    {
+        SimdFloat4 ret = SimdAdd(SimdAdd(SimdMul(SimdSplat(src[i].x), c0), SimdMul(SimdSplat(src[i].y), c1)),
+            SimdAdd(SimdMul(SimdSplat(src[i].z), c2), c3));
+        // Vector3 is 12 bytes, so store through a temporary to not write past the element
+        float result[4];
+        SimdStore(result, ret);
+        dest[i] = Vector3(result[0], result[1], result[2]);
+    }
+#else
+    for (size_t i = 0; i < count; ++i)
+        dest[i] = transform * src[i];
+#endif
+}
@@ -184,6 +184,17 @@ public:
     /// Multiply a matrix.
     Matrix3x4 operator * (const Matrix3x4& rhs) const
     {
+    #ifdef TURSO3D_SIMD
+        SimdFloat4 r0 = SimdLoad(&rhs.m00);
+        SimdFloat4 r1 = SimdLoad(&rhs.m10);
+        SimdFloat4 r2 = SimdLoad(&rhs.m20);
+        SimdFloat4 r3 = SimdSet(0.0f, 0.0f, 0.0f, 1.0f);
+        Matrix3x4 ret;
+        SimdStore(&ret.m00, SimdTransformRow(SimdLoad(&m00), r0, r1, r2, r3));
+        SimdStore(&ret.m10, SimdTransformRow(SimdLoad(&m10), r0, r1, r2, r3));
+        SimdStore(&ret.m20, SimdTransformRow(SimdLoad(&m20), r0, r1, r2, r3));
+        return ret;
+    #else
         return Matrix3x4(
             m00 * rhs.m00 + m01 * rhs.m10 + m02 * rhs.m20,
             m00 * rhs.m01 + m01 * rhs.m11 + m02 * rhs.m21,
@@ -198,11 +209,24 @@ public:
             m20 * rhs.m02 + m21 * rhs.m12 + m22 * rhs.m22,
             m20 * rhs.m03 + m21 * rhs.m13 + m22 * rhs.m23 + m23
         );
+    #endif
     }
     
     /// Multiply a 4x4 matrix.
     Matrix4 operator * (const Matrix4& rhs) const
     {
+    #ifdef TURSO3D_SIMD
+        SimdFloat4 r0 = SimdLoad(&rhs.m00);
+        SimdFloat4 r1 = SimdLoad(&rhs.m10);
+        SimdFloat4 r2 = SimdLoad(&rhs.m20);
+        SimdFloat4 r3 = SimdLoad(&rhs.m30);
+        Matrix4 ret;
+        SimdStore(&ret.m00, SimdTransformRow(SimdLoad(&m00), r0, r1, r2, r3));
+        SimdStore(&ret.m10, SimdTransformRow(SimdLoad(&m10), r0, r1, r2, r3));
+        SimdStore(&ret.m20, SimdTransformRow(SimdLoad(&m20), r0, r1, r2, r3));
+        SimdStore(&ret.m30, r3);
+        return ret;
+    #else
         return Matrix4(
             m00 * rhs.m00 + m01 * rhs.m10 + m02 * rhs.m20 + m03 * rhs.m30,
             m00 * rhs.m01 + m01 * rhs.m11 + m02 * rhs.m21 + m03 * rhs.m31,
@@ -221,6 +245,7 @@ public:
             rhs.m32,
             rhs.m33
         );
+    #endif
     }
     
     /// Set translation elements.
@@ -387,6 +412,18 @@ inline Matrix3x4 operator * (float lhs, const Matrix3x4& rhs) { return rhs * lhs
 /// Multiply a 3x4 matrix with a 4x4 matrix.
 inline Matrix4 operator * (const Matrix4& lhs, const Matrix3x4& rhs)
 {
+#ifdef TURSO3D_SIMD
+    SimdFloat4 r0 = SimdLoad(&rhs.m00);
+    SimdFloat4 r1 = SimdLoad(&rhs.m10);
+    SimdFloat4 r2 = SimdLoad(&rhs.m20);
+    SimdFloat4 r3 = SimdSet(0.0f, 0.0f, 0.0f, 1.0f);
+    Matrix4 ret;
+    SimdStore(&ret.m00, SimdTransformRow(SimdLoad(&lhs.m00), r0, r1, r2, r3));
+    SimdStore(&ret.m10, SimdTransformRow(SimdLoad(&lhs.m10), r0, r1, r2, r3));
+    SimdStore(&ret.m20, SimdTransformRow(SimdLoad(&lhs.m20), r0, r1, r2, r3));
+    SimdStore(&ret.m30, SimdTransformRow(SimdLoad(&lhs.m30), r0, r1, r2, r3));
+    return ret;
+#else
     return Matrix4(
         lhs.m00 * rhs.m00 + lhs.m01 * rhs.m10 + lhs.m02 * rhs.m20,
         lhs.m00 * rhs.m01 + lhs.m01 * rhs.m11 + lhs.m02 * rhs.m21,
@@ -405,4 +442,12 @@ inline Matrix4 operator * (const Matrix4& lhs, const Matrix3x4& rhs)
         lhs.m30 * rhs.m02 + lhs.m31 * rhs.m12 + lhs.m32 * rhs.m22,
         lhs.m30 * rhs.m03 + lhs.m31 * rhs.m13 + lhs.m32 * rhs.m23 + lhs.m33
     );
+#endif
 }
+
+/// Multiply an array of 3x4 matrices by a common left-hand matrix. The destination may be the same array as the source.
+void MultiplyMatrices(const Matrix3x4& lhs, const Matrix3x4* src, Matrix3x4* dest, size_t count);
+/// Multiply arrays of 3x4 matrices pairwise. The destination may be the same array as either source.
+void MultiplyMatrices(const Matrix3x4* lhs, const Matrix3x4* rhs, Matrix3x4* dest, size_t count);
+/// Transform an array of points by a 3x4 matrix. The destination may be the same array as the source.
+void TransformPoints(const Matrix3x4& transform, const Vector3* src, Vector3* dest, size_t count);
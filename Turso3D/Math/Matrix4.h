@@ -175,6 +175,18 @@ public:
     /// Multiply a matrix.
     Matrix4 operator * (const Matrix4& rhs) const
     {
+    #ifdef TURSO3D_SIMD
+        SimdFloat4 r0 = SimdLoad(&rhs.m00);
+        SimdFloat4 r1 = SimdLoad(&rhs.m10);
+        SimdFloat4 r2 = SimdLoad(&rhs.m20);
+        SimdFloat4 r3 = SimdLoad(&rhs.m30);
+        Matrix4 ret;
+        SimdStore(&ret.m00, SimdTransformRow(SimdLoad(&m00), r0, r1, r2, r3));
+        SimdStore(&ret.m10, SimdTransformRow(SimdLoad(&m10), r0, r1, r2, r3));
+        SimdStore(&ret.m20, SimdTransformRow(SimdLoad(&m20), r0, r1, r2, r3));
+        SimdStore(&ret.m30, SimdTransformRow(SimdLoad(&m30), r0, r1, r2, r3));
+        return ret;
+    #else
         return Matrix4(
             m00 * rhs.m00 + m01 * rhs.m10 + m02 * rhs.m20 + m03 * rhs.m30,
             m00 * rhs.m01 + m01 * rhs.m11 + m02 * rhs.m21 + m03 * rhs.m31,
@@ -193,6 +205,7 @@ public:
             m30 * rhs.m02 + m31 * rhs.m12 + m32 * rhs.m22 + m33 * rhs.m32,
             m30 * rhs.m03 + m31 * rhs.m13 + m32 * rhs.m23 + m33 * rhs.m33
         );
+    #endif
     }
     
     /// Set translation elements.
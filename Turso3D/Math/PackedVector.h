@@ -0,0 +1,121 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Color.h"
+
+/// Four-dimensional vector with 8-bit unsigned normalized components in the range 0-1, for example colors and blend weights.
+class UNorm8Vector4
+{
+public:
+    /// X coordinate.
+    unsigned char x;
+    /// Y coordinate.
+    unsigned char y;
+    /// Z coordinate.
+    unsigned char z;
+    /// W coordinate.
+    unsigned char w;
+
+    /// Construct undefined.
+    UNorm8Vector4()
+    {
+    }
+
+    /// Construct from a vector. Components are clamped to the range.
+    explicit UNorm8Vector4(const Vector4& vector) :
+        x(Pack(vector.x)),
+        y(Pack(vector.y)),
+        z(Pack(vector.z)),
+        w(Pack(vector.w))
+    {
+    }
+
+    /// Construct from a color. Components are clamped to the range.
+    explicit UNorm8Vector4(const Color& color) :
+        x(Pack(color.r)),
+        y(Pack(color.g)),
+        z(Pack(color.b)),
+        w(Pack(color.a))
+    {
+    }
+
+    /// Test for equality with another vector.
+    bool operator == (const UNorm8Vector4& rhs) const { return x == rhs.x && y == rhs.y && z == rhs.z && w == rhs.w; }
+    /// Test for inequality with another vector.
+    bool operator != (const UNorm8Vector4& rhs) const { return !(*this == rhs); }
+
+    /// Return as a vector.
+    Vector4 ToVector4() const { return Vector4(x * (1.0f / 255.0f), y * (1.0f / 255.0f), z * (1.0f / 255.0f), w * (1.0f / 255.0f)); }
+    /// Return as a color.
+    Color ToColor() const { return Color(x * (1.0f / 255.0f), y * (1.0f / 255.0f), z * (1.0f / 255.0f), w * (1.0f / 255.0f)); }
+    /// Return as a 32-bit value in memory order.
+    unsigned ToUInt() const { unsigned ret; memcpy(&ret, &x, sizeof ret); return ret; }
+
+private:
+    /// Pack one component.
+    static unsigned char Pack(float value) { return (unsigned char)(Clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f); }
+};
+
+/// Four-dimensional vector with 16-bit signed normalized components in the range -1-1, for example normals and tangents.
+class SNorm16Vector4
+{
+public:
+    /// X coordinate.
+    short x;
+    /// Y coordinate.
+    short y;
+    /// Z coordinate.
+    short z;
+    /// W coordinate.
+    short w;
+
+    /// Construct undefined.
+    SNorm16Vector4()
+    {
+    }
+
+    /// Construct from a vector. Components are clamped to the range.
+    explicit SNorm16Vector4(const Vector4& vector) :
+        x(Pack(vector.x)),
+        y(Pack(vector.y)),
+        z(Pack(vector.z)),
+        w(Pack(vector.w))
+    {
+    }
+
+    /// Test for equality with another vector.
+    bool operator == (const SNorm16Vector4& rhs) const { return x == rhs.x && y == rhs.y && z == rhs.z && w == rhs.w; }
+    /// Test for inequality with another vector.
+    bool operator != (const SNorm16Vector4& rhs) const { return !(*this == rhs); }
+
+    /// Return as a vector.
+    Vector4 ToVector4() const { return Vector4(Unpack(x), Unpack(y), Unpack(z), Unpack(w)); }
+
+private:
+    /// Pack one component.
+    static short Pack(float value) { return (short)roundf(Clamp(value, -1.0f, 1.0f) * 32767.0f); }
+    /// Unpack one component. The most negative value is clamped, so that zero and both ends of the range are exact.
+    static float Unpack(short value) { return Max(value * (1.0f / 32767.0f), -1.0f); }
+};
+
+/// Pack a vector to 10-bit signed normalized XYZ components and the sign of W in the 2-bit component, as in GL_INT_2_10_10_10_REV. Suitable for normals and tangents.
+inline unsigned PackSNorm1010102(const Vector4& vector)
+{
+    unsigned packedX = (unsigned)(int)roundf(Clamp(vector.x, -1.0f, 1.0f) * 511.0f) & 0x3ff;
+    unsigned packedY = (unsigned)(int)roundf(Clamp(vector.y, -1.0f, 1.0f) * 511.0f) & 0x3ff;
+    unsigned packedZ = (unsigned)(int)roundf(Clamp(vector.z, -1.0f, 1.0f) * 511.0f) & 0x3ff;
+    unsigned packedW = vector.w < 0.0f ? 3 : 1;
+    return packedX | (packedY << 10) | (packedZ << 20) | (packedW << 30);
+}
+
+/// Unpack a vector packed with PackSNorm1010102().
+inline Vector4 UnpackSNorm1010102(unsigned packed)
+{
+    // Sign-extend each component by shifting it to the top of a signed value
+    int x = (int)(packed << 22) >> 22;
+    int y = (int)(packed << 12) >> 22;
+    int z = (int)(packed << 2) >> 22;
+    int w = (int)packed >> 30;
+    return Vector4(Max(x * (1.0f / 511.0f), -1.0f), Max(y * (1.0f / 511.0f), -1.0f), Max(z * (1.0f / 511.0f), -1.0f), (float)w);
+}
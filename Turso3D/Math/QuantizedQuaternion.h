@@ -0,0 +1,75 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Quaternion.h"
+
+/// Largest magnitude of the three smallest components of a unit quaternion.
+static const float QUATERNION_COMPONENT_RANGE = 0.70710678f;
+
+/// Rotation quantized into 48 bits with the smallest three encoding: the index of the largest component in the high bits of the first two values, and the other three components in 15 bits each. The largest component is reconstructed from unit length.
+class QuantizedQuaternion
+{
+public:
+    /// Quantized values.
+    unsigned short data[3];
+
+    /// Construct undefined.
+    QuantizedQuaternion()
+    {
+    }
+
+    /// Construct from a rotation, which is normalized first.
+    explicit QuantizedQuaternion(Quaternion value)
+    {
+        value.Normalize();
+        float components[4] = { value.w, value.x, value.y, value.z };
+
+        size_t largest = 0;
+        for (size_t i = 1; i < 4; ++i)
+        {
+            if (Abs(components[i]) > Abs(components[largest]))
+                largest = i;
+        }
+
+        // The quaternion and its negation are the same rotation, so the largest component can always be positive
+        float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+        for (size_t i = 0, j = 0; i < 4; ++i)
+        {
+            if (i != largest)
+            {
+                float unit = (sign * components[i] / QUATERNION_COMPONENT_RANGE) * 0.5f + 0.5f;
+                data[j++] = (unsigned short)Clamp((int)(unit * 32767.0f + 0.5f), 0, 32767);
+            }
+        }
+
+        data[0] |= (unsigned short)((largest & 1) << 15);
+        data[1] |= (unsigned short)((largest >> 1) << 15);
+    }
+
+    /// Test for equality with another quantized quaternion.
+    bool operator == (const QuantizedQuaternion& rhs) const { return data[0] == rhs.data[0] && data[1] == rhs.data[1] && data[2] == rhs.data[2]; }
+    /// Test for inequality with another quantized quaternion.
+    bool operator != (const QuantizedQuaternion& rhs) const { return !(*this == rhs); }
+
+    /// Return as a unit quaternion.
+    Quaternion ToQuaternion() const
+    {
+        size_t largest = (data[0] >> 15) | ((data[1] >> 15) << 1);
+        float components[4];
+        float sumSquares = 0.0f;
+
+        for (size_t i = 0, j = 0; i < 4; ++i)
+        {
+            if (i != largest)
+            {
+                float value = ((data[j++] & 0x7fff) * (2.0f / 32767.0f) - 1.0f) * QUATERNION_COMPONENT_RANGE;
+                components[i] = value;
+                sumSquares += value * value;
+            }
+        }
+
+        components[largest] = sqrtf(Max(1.0f - sumSquares, 0.0f));
+        return Quaternion(components[0], components[1], components[2], components[3]);
+    }
+};
@@ -263,6 +263,27 @@ Quaternion Quaternion::Nlerp(Quaternion rhs, float t, bool shortestPath) const
     return result;
 }
 
+Quaternion Quaternion::SlerpFast(Quaternion rhs, float t) const
+{
+    float cosAngle = DotProduct(rhs);
+    if (cosAngle < 0.0f)
+    {
+        cosAngle = -cosAngle;
+        rhs = -rhs;
+    }
+
+    // Correct the interpolation factor with a polynomial fit of the slerp angular velocity to the angle cosine
+    // From "Approximating slerp" by Arseny Kapoulkine
+    float a = 1.0904f + cosAngle * (-3.2452f + cosAngle * (3.55645f - cosAngle * 1.43519f));
+    float b = 0.848013f + cosAngle * (-1.06021f + cosAngle * 0.215638f);
+    float k = a * (t - 0.5f) * (t - 0.5f) + b;
+    float correctedT = t + t * (t - 0.5f) * (t - 1.0f) * k;
+
+    Quaternion result = *this + (rhs - *this) * correctedT;
+    float lenSquared = result.LengthSquared();
+    return lenSquared > 0.0f ? result * InvSqrtFast(lenSquared) : result;
+}
+
 std::string Quaternion::ToString() const
 {
     return FormatString("%g %g %g %g", w, x, y, z);
@@ -130,12 +130,26 @@ public:
     /// Multiply a quaternion.
     Quaternion operator * (const Quaternion& rhs) const
     {
+    #ifdef TURSO3D_SSE
+        // Lanes are w, x, y, z. The sign of the w lane differs in the middle terms
+        __m128 q1 = _mm_loadu_ps(&w);
+        __m128 q2 = _mm_loadu_ps(&rhs.w);
+        __m128 a = _mm_mul_ps(_mm_shuffle_ps(q1, q1, _MM_SHUFFLE(0, 0, 0, 0)), q2);
+        __m128 b = _mm_mul_ps(_mm_shuffle_ps(q1, q1, _MM_SHUFFLE(3, 2, 1, 1)), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(0, 0, 0, 1)));
+        __m128 c = _mm_mul_ps(_mm_shuffle_ps(q1, q1, _MM_SHUFFLE(1, 3, 2, 2)), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(2, 1, 3, 2)));
+        __m128 d = _mm_mul_ps(_mm_shuffle_ps(q1, q1, _MM_SHUFFLE(2, 1, 3, 3)), _mm_shuffle_ps(q2, q2, _MM_SHUFFLE(1, 3, 2, 3)));
+        __m128 signW = _mm_setr_ps(-0.0f, 0.0f, 0.0f, 0.0f);
+        Quaternion ret;
+        _mm_storeu_ps(&ret.w, _mm_sub_ps(_mm_add_ps(a, _mm_xor_ps(_mm_add_ps(b, c), signW)), d));
+        return ret;
+    #else
         return Quaternion(
             w * rhs.w - x * rhs.x - y * rhs.y - z * rhs.z,
             w * rhs.x + x * rhs.w + y * rhs.z - z * rhs.y,
             w * rhs.y + y * rhs.w + z * rhs.x - x * rhs.z,
             w * rhs.z + z * rhs.w + x * rhs.y - y * rhs.x
         );
+    #endif
     }
     
     /// Multiply a Vector3.
@@ -244,6 +258,8 @@ public:
     Quaternion Slerp(Quaternion rhs, float t) const;
     /// Normalized linear interpolation with another quaternion.
     Quaternion Nlerp(Quaternion rhs, float t, bool shortestPath = false) const;
+    /// Approximate spherical interpolation with another quaternion along the shortest path. Uses normalized linear interpolation with a corrected interpolation factor, which stays within 0.001 of Slerp().
+    Quaternion SlerpFast(Quaternion rhs, float t) const;
     /// Return float data.
     const float* Data() const { return &w; }
     /// Return as string.
@@ -5,6 +5,17 @@
 #include "Polyhedron.h"
 #include "Sphere.h"
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TURSO3D_SPHERE_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TURSO3D_SPHERE_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TURSO3D_SPHERE_NEON
+#endif
+
 void Sphere::Define(const Vector3* vertices, size_t count)
 {
     Undefine();
@@ -117,3 +128,76 @@ Vector3 Sphere::LocalPoint(float theta, float phi) const
         radius * Cos(theta) * Sin(phi)
     );
 }
+
+unsigned Sphere::IsInsideFast(const BoundingBoxPack& boxes) const
+{
+    // Distance from the center to the closest point of each box is the sum of the distances outside the box on each axis
+    #if defined(TURSO3D_SPHERE_AVX)
+    __m256 zero = _mm256_setzero_ps();
+    __m256 centerX = _mm256_set1_ps(center.x);
+    __m256 centerY = _mm256_set1_ps(center.y);
+    __m256 centerZ = _mm256_set1_ps(center.z);
+    __m256 dx = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(boxes.minX), centerX), zero), _mm256_max_ps(_mm256_sub_ps(centerX, _mm256_loadu_ps(boxes.maxX)), zero));
+    __m256 dy = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(boxes.minY), centerY), zero), _mm256_max_ps(_mm256_sub_ps(centerY, _mm256_loadu_ps(boxes.maxY)), zero));
+    __m256 dz = _mm256_add_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_loadu_ps(boxes.minZ), centerZ), zero), _mm256_max_ps(_mm256_sub_ps(centerZ, _mm256_loadu_ps(boxes.maxZ)), zero));
+    __m256 distSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+
+    return (unsigned)_mm256_movemask_ps(_mm256_cmp_ps(distSquared, _mm256_set1_ps(radius * radius), _CMP_LT_OQ));
+
+    #elif defined(TURSO3D_SPHERE_SSE)
+    unsigned result = 0;
+    __m128 zero = _mm_setzero_ps();
+    __m128 centerX = _mm_set1_ps(center.x);
+    __m128 centerY = _mm_set1_ps(center.y);
+    __m128 centerZ = _mm_set1_ps(center.z);
+    __m128 radiusSquared = _mm_set1_ps(radius * radius);
+
+    for (size_t j = 0; j < BOUNDING_BOX_PACK_SIZE; j += 4)
+    {
+        __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(boxes.minX + j), centerX), zero), _mm_max_ps(_mm_sub_ps(centerX, _mm_load_ps(boxes.maxX + j)), zero));
+        __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(boxes.minY + j), centerY), zero), _mm_max_ps(_mm_sub_ps(centerY, _mm_load_ps(boxes.maxY + j)), zero));
+        __m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(_mm_load_ps(boxes.minZ + j), centerZ), zero), _mm_max_ps(_mm_sub_ps(centerZ, _mm_load_ps(boxes.maxZ + j)), zero));
+        __m128 distSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+        result |= (unsigned)_mm_movemask_ps(_mm_cmplt_ps(distSquared, radiusSquared)) << j;
+    }
+
+    return result;
+
+    #elif defined(TURSO3D_SPHERE_NEON)
+    static const uint32_t laneBits[4] = { 1, 2, 4, 8 };
+    unsigned result = 0;
+    float32x4_t zero = vdupq_n_f32(0.0f);
+    float32x4_t centerX = vdupq_n_f32(center.x);
+    float32x4_t centerY = vdupq_n_f32(center.y);
+    float32x4_t centerZ = vdupq_n_f32(center.z);
+    float32x4_t radiusSquared = vdupq_n_f32(radius * radius);
+    uint32x4_t bits = vld1q_u32(laneBits);
+
+    for (size_t j = 0; j < BOUNDING_BOX_PACK_SIZE; j += 4)
+    {
+        float32x4_t dx = vaddq_f32(vmaxq_f32(vsubq_f32(vld1q_f32(boxes.minX + j), centerX), zero), vmaxq_f32(vsubq_f32(centerX, vld1q_f32(boxes.maxX + j)), zero));
+        float32x4_t dy = vaddq_f32(vmaxq_f32(vsubq_f32(vld1q_f32(boxes.minY + j), centerY), zero), vmaxq_f32(vsubq_f32(centerY, vld1q_f32(boxes.maxY + j)), zero));
+        float32x4_t dz = vaddq_f32(vmaxq_f32(vsubq_f32(vld1q_f32(boxes.minZ + j), centerZ), zero), vmaxq_f32(vsubq_f32(centerZ, vld1q_f32(boxes.maxZ + j)), zero));
+        float32x4_t distSquared = vmlaq_f32(vmlaq_f32(vmulq_f32(dx, dx), dy, dy), dz, dz);
+
+        uint32x4_t insideBits = vandq_u32(vcltq_f32(distSquared, radiusSquared), bits);
+        uint32x2_t sum = vpadd_u32(vget_low_u32(insideBits), vget_high_u32(insideBits));
+        sum = vpadd_u32(sum, sum);
+        result |= vget_lane_u32(sum, 0) << j;
+    }
+
+    return result;
+
+    #else
+    unsigned result = 0;
+
+    for (size_t j = 0; j < BOUNDING_BOX_PACK_SIZE; ++j)
+    {
+        if (IsInsideFast(boxes.Get(j)))
+            result |= 1 << j;
+    }
+
+    return result;
+    #endif
+}
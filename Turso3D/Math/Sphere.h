@@ -2,7 +2,7 @@
 
 #pragma once
 
-#include "BoundingBox.h"
+#include "BoundingBoxPack.h"
 
 class Polyhedron;
 class Frustum;
@@ -213,6 +213,9 @@ public:
         return ((closest - center).LengthSquared() >= radiusSquared) ? OUTSIDE : INSIDE;
     }
 
+    /// Test a pack of bounding boxes. Return a bitmask of the boxes that are (partially) inside. Uses SSE, AVX or NEON when available.
+    unsigned IsInsideFast(const BoundingBoxPack& boxes) const;
+
     /// Return distance of a point to the surface, or 0 if inside.
     float Distance(const Vector3& point) const { return Max((point - center).Length() - radius, 0.0f); }
 };
@@ -0,0 +1,246 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Ray.h"
+#include "TriangleBvh.h"
+
+#include <utility>
+#include <tracy/Tracy.hpp>
+
+static const size_t TRIANGLE_BVH_LEAF_SIZE = 4;
+
+/// Return the inverse of a ray direction component. Avoid infinities from axis-aligned directions, which fast math does not handle.
+static float InverseDirection(float d)
+{
+    if (Abs(d) > M_EPSILON)
+        return 1.0f / d;
+    return d >= 0.0f ? 1.0f / M_EPSILON : -1.0f / M_EPSILON;
+}
+
+/// Return ray hit distance to a node's box using the precalculated inverse direction, or infinity if no hit.
+static float HitDistance(const BvhNode& node, const Vector3& origin, const Vector3& invDirection)
+{
+    float t1 = (node.min.x - origin.x) * invDirection.x;
+    float t2 = (node.max.x - origin.x) * invDirection.x;
+    float tMin = Min(t1, t2);
+    float tMax = Max(t1, t2);
+    t1 = (node.min.y - origin.y) * invDirection.y;
+    t2 = (node.max.y - origin.y) * invDirection.y;
+    tMin = Max(tMin, Min(t1, t2));
+    tMax = Min(tMax, Max(t1, t2));
+    t1 = (node.min.z - origin.z) * invDirection.z;
+    t2 = (node.max.z - origin.z) * invDirection.z;
+    tMin = Max(tMin, Min(t1, t2));
+    tMax = Min(tMax, Max(t1, t2));
+
+    if (tMax < 0.0f || tMin > tMax)
+        return M_INFINITY;
+    return Max(tMin, 0.0f);
+}
+
+/// Test a ray against the triangles of a pack and write the hit distances, or infinity for no hit. Follows Ray::HitDistance() for a single triangle.
+static void HitDistances(const TrianglePack& pack, const Ray& ray, float* dest)
+{
+#ifdef TURSO3D_SIMD
+    SimdFloat4 dx = SimdSplat(ray.direction.x);
+    SimdFloat4 dy = SimdSplat(ray.direction.y);
+    SimdFloat4 dz = SimdSplat(ray.direction.z);
+    SimdFloat4 e1x = SimdLoad(pack.e1x);
+    SimdFloat4 e1y = SimdLoad(pack.e1y);
+    SimdFloat4 e1z = SimdLoad(pack.e1z);
+    SimdFloat4 e2x = SimdLoad(pack.e2x);
+    SimdFloat4 e2y = SimdLoad(pack.e2y);
+    SimdFloat4 e2z = SimdLoad(pack.e2z);
+
+    // Calculate determinant
+    SimdFloat4 px = SimdSub(SimdMul(dy, e2z), SimdMul(dz, e2y));
+    SimdFloat4 py = SimdSub(SimdMul(dz, e2x), SimdMul(dx, e2z));
+    SimdFloat4 pz = SimdSub(SimdMul(dx, e2y), SimdMul(dy, e2x));
+    SimdFloat4 det = SimdAdd(SimdAdd(SimdMul(e1x, px), SimdMul(e1y, py)), SimdMul(e1z, pz));
+
+    // Calculate u & v parameters
+    SimdFloat4 tx = SimdSub(SimdSplat(ray.origin.x), SimdLoad(pack.v0x));
+    SimdFloat4 ty = SimdSub(SimdSplat(ray.origin.y), SimdLoad(pack.v0y));
+    SimdFloat4 tz = SimdSub(SimdSplat(ray.origin.z), SimdLoad(pack.v0z));
+    SimdFloat4 u = SimdAdd(SimdAdd(SimdMul(tx, px), SimdMul(ty, py)), SimdMul(tz, pz));
+    SimdFloat4 qx = SimdSub(SimdMul(ty, e1z), SimdMul(tz, e1y));
+    SimdFloat4 qy = SimdSub(SimdMul(tz, e1x), SimdMul(tx, e1z));
+    SimdFloat4 qz = SimdSub(SimdMul(tx, e1y), SimdMul(ty, e1x));
+    SimdFloat4 v = SimdAdd(SimdAdd(SimdMul(dx, qx), SimdMul(dy, qy)), SimdMul(dz, qz));
+    SimdFloat4 distance = SimdDiv(SimdAdd(SimdAdd(SimdMul(e2x, qx), SimdMul(e2y, qy)), SimdMul(e2z, qz)), SimdMax(det, SimdSplat(M_EPSILON)));
+
+    SimdFloat4 zero = SimdSplat(0.0f);
+    SimdMask4 hit = SimdGreaterEqual(det, SimdSplat(M_EPSILON));
+    hit = SimdAnd(hit, SimdGreaterEqual(u, zero));
+    hit = SimdAnd(hit, SimdGreaterEqual(v, zero));
+    hit = SimdAnd(hit, SimdGreaterEqual(det, SimdAdd(u, v)));
+    hit = SimdAnd(hit, SimdGreaterEqual(distance, zero));
+    SimdStore(dest, SimdSelect(hit, distance, SimdSplat(M_INFINITY)));
+#else
+    for (size_t i = 0; i < TRIANGLE_PACK_SIZE; ++i)
+    {
+        Vector3 v0(pack.v0x[i], pack.v0y[i], pack.v0z[i]);
+        dest[i] = ray.HitDistance(v0, v0 + Vector3(pack.e1x[i], pack.e1y[i], pack.e1z[i]), v0 + Vector3(pack.e2x[i], pack.e2y[i], pack.e2z[i]));
+    }
+#endif
+}
+
+TriangleBvh::TriangleBvh() :
+    numTriangles(0)
+{
+}
+
+void TriangleBvh::Build(const Vector3* positions, const void* indexData, size_t indexSize, size_t start, size_t count)
+{
+    ZoneScoped;
+
+    Clear();
+    if (!positions)
+        return;
+
+    numTriangles = count / 3;
+    if (!numTriangles)
+        return;
+
+    std::vector<Vector3> vertices(numTriangles * 3);
+    for (size_t i = 0; i < vertices.size(); ++i)
+    {
+        size_t index = start + i;
+        if (indexData)
+            index = indexSize == sizeof(unsigned short) ? ((const unsigned short*)indexData)[index] : ((const unsigned*)indexData)[index];
+        vertices[i] = positions[index];
+    }
+
+    std::vector<BoundingBox> boxes(numTriangles);
+    for (size_t i = 0; i < numTriangles; ++i)
+        boxes[i].Define(&vertices[i * 3], 3);
+
+    bvh.Build(boxes, TRIANGLE_BVH_LEAF_SIZE);
+
+    // Pack the triangles of each leaf, filling unused slots with degenerate triangles that are never hit
+    const std::vector<BvhNode>& nodes = bvh.Nodes();
+    const std::vector<unsigned>& triangleIndices = bvh.ObjectIndices();
+    leafPacks.resize(bvh.NumLeaves());
+
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        if (!it->IsLeaf())
+            continue;
+
+        unsigned leafStart = bvh.LeafStart(it->index);
+        leafPacks[it->index] = (unsigned)packs.size();
+
+        for (unsigned i = 0; i < it->count; i += TRIANGLE_PACK_SIZE)
+        {
+            packs.push_back(TrianglePack());
+            TrianglePack& pack = packs.back();
+
+            for (size_t j = 0; j < TRIANGLE_PACK_SIZE; ++j)
+            {
+                Vector3 v0, e1, e2;
+                if (i + j < it->count)
+                {
+                    const Vector3* triangle = &vertices[triangleIndices[leafStart + i + j] * 3];
+                    v0 = triangle[0];
+                    e1 = triangle[1] - triangle[0];
+                    e2 = triangle[2] - triangle[0];
+                }
+                else
+                    v0 = e1 = e2 = Vector3::ZERO;
+
+                pack.v0x[j] = v0.x;
+                pack.v0y[j] = v0.y;
+                pack.v0z[j] = v0.z;
+                pack.e1x[j] = e1.x;
+                pack.e1y[j] = e1.y;
+                pack.e1z[j] = e1.z;
+                pack.e2x[j] = e2.x;
+                pack.e2y[j] = e2.y;
+                pack.e2z[j] = e2.z;
+            }
+        }
+    }
+}
+
+void TriangleBvh::Clear()
+{
+    bvh.Clear();
+    packs.clear();
+    leafPacks.clear();
+    numTriangles = 0;
+}
+
+float TriangleBvh::HitDistance(const Ray& ray, Vector3* outNormal) const
+{
+    const std::vector<BvhNode>& nodes = bvh.Nodes();
+    if (nodes.empty())
+        return M_INFINITY;
+
+    Vector3 invDirection(InverseDirection(ray.direction.x), InverseDirection(ray.direction.y), InverseDirection(ray.direction.z));
+
+    float nearest = M_INFINITY;
+    const TrianglePack* nearestPack = nullptr;
+    size_t nearestIndex = 0;
+
+    // Nodes are pushed with their box distance, so that they can be skipped if a nearer hit was found meanwhile
+    std::pair<unsigned, float> stack[BVH_STACK_SIZE];
+    size_t stackSize = 0;
+    float rootDistance = ::HitDistance(nodes[0], ray.origin, invDirection);
+    if (rootDistance < M_INFINITY)
+        stack[stackSize++] = std::make_pair(0u, rootDistance);
+
+    while (stackSize)
+    {
+        const std::pair<unsigned, float>& entry = stack[--stackSize];
+        if (entry.second >= nearest)
+            continue;
+
+        const BvhNode& node = nodes[entry.first];
+
+        if (node.IsLeaf())
+        {
+            const TrianglePack* pack = &packs[leafPacks[node.index]];
+            const TrianglePack* packEnd = pack + (node.count + TRIANGLE_PACK_SIZE - 1) / TRIANGLE_PACK_SIZE;
+            for (; pack < packEnd; ++pack)
+            {
+                float distances[TRIANGLE_PACK_SIZE];
+                HitDistances(*pack, ray, distances);
+                for (size_t i = 0; i < TRIANGLE_PACK_SIZE; ++i)
+                {
+                    if (distances[i] < nearest)
+                    {
+                        nearest = distances[i];
+                        nearestPack = pack;
+                        nearestIndex = i;
+                    }
+                }
+            }
+        }
+        else
+        {
+            // Visit the nearer child first, and skip children farther than the nearest hit so far
+            float leftDistance = ::HitDistance(nodes[node.index], ray.origin, invDirection);
+            float rightDistance = ::HitDistance(nodes[node.index + 1], ray.origin, invDirection);
+            unsigned nearChild = node.index;
+            unsigned farChild = node.index + 1;
+            if (rightDistance < leftDistance)
+            {
+                std::swap(leftDistance, rightDistance);
+                std::swap(nearChild, farChild);
+            }
+
+            if (rightDistance < nearest)
+                stack[stackSize++] = std::make_pair(farChild, rightDistance);
+            if (leftDistance < nearest)
+                stack[stackSize++] = std::make_pair(nearChild, leftDistance);
+        }
+    }
+
+    if (nearestPack && outNormal)
+    {
+        Vector3 e1(nearestPack->e1x[nearestIndex], nearestPack->e1y[nearestIndex], nearestPack->e1z[nearestIndex]);
+        Vector3 e2(nearestPack->e2x[nearestIndex], nearestPack->e2y[nearestIndex], nearestPack->e2z[nearestIndex]);
+        *outNormal = e1.CrossProduct(e2);
+    }
+
+    return nearest;
+}
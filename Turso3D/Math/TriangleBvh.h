@@ -0,0 +1,63 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Bvh.h"
+
+class Ray;
+
+/// Number of triangles in a pack.
+static const size_t TRIANGLE_PACK_SIZE = 4;
+
+/// Triangles stored in structure-of-arrays form as a vertex and two edges, for the batched ray test.
+struct alignas(16) TrianglePack
+{
+    /// First vertex X coordinates.
+    float v0x[TRIANGLE_PACK_SIZE];
+    /// First vertex Y coordinates.
+    float v0y[TRIANGLE_PACK_SIZE];
+    /// First vertex Z coordinates.
+    float v0z[TRIANGLE_PACK_SIZE];
+    /// First edge X coordinates.
+    float e1x[TRIANGLE_PACK_SIZE];
+    /// First edge Y coordinates.
+    float e1y[TRIANGLE_PACK_SIZE];
+    /// First edge Z coordinates.
+    float e1z[TRIANGLE_PACK_SIZE];
+    /// Second edge X coordinates.
+    float e2x[TRIANGLE_PACK_SIZE];
+    /// Second edge Y coordinates.
+    float e2y[TRIANGLE_PACK_SIZE];
+    /// Second edge Z coordinates.
+    float e2z[TRIANGLE_PACK_SIZE];
+};
+
+/// Bounding volume hierarchy over the triangles of a mesh for ray queries. The triangles of each leaf are stored in packs tested several at a time.
+class TriangleBvh
+{
+public:
+    /// Construct empty.
+    TriangleBvh();
+
+    /// Build from vertex positions and optional 16- or 32-bit indices. Without indices, the start and count refer to vertices. Previous data is discarded.
+    void Build(const Vector3* positions, const void* indexData, size_t indexSize, size_t start, size_t count);
+    /// Discard the data.
+    void Clear();
+
+    /// Return the distance to the nearest front-facing triangle hit by a ray, or infinity if no hit. Optionally return the unnormalized triangle normal.
+    float HitDistance(const Ray& ray, Vector3* outNormal = nullptr) const;
+    /// Return number of triangles.
+    size_t NumTriangles() const { return numTriangles; }
+    /// Return whether has no triangles.
+    bool IsEmpty() const { return bvh.IsEmpty(); }
+
+private:
+    /// Hierarchy over the triangle bounding boxes.
+    Bvh bvh;
+    /// Triangle packs in leaf order.
+    std::vector<TrianglePack> packs;
+    /// First pack of each leaf.
+    std::vector<unsigned> leafPacks;
+    /// Number of triangles.
+    size_t numTriangles;
+};
@@ -224,6 +224,20 @@ public:
             return *this;
     }
     
+    /// Return normalized to unit length using the approximate inverse square root.
+    Vector3 NormalizedFast() const
+    {
+        float lenSquared = LengthSquared();
+        return lenSquared > 0.0f ? *this * InvSqrtFast(lenSquared) : *this;
+    }
+    
+    /// Return approximate length using the approximate inverse square root.
+    float LengthFast() const
+    {
+        float lenSquared = LengthSquared();
+        return lenSquared > 0.0f ? lenSquared * InvSqrtFast(lenSquared) : 0.0f;
+    }
+    
     /// Return float data.
     const float* Data() const { return &x; }
     /// Return as string.
@@ -1,9 +1,52 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "Allocator.h"
+#include "MemoryTracker.h"
+
+#include <algorithm>
+#include <vector>
+
+// Marker in the next pointer of allocated nodes, to tell them apart from free nodes
+static AllocatorNode* const ALLOCATED_NODE = reinterpret_cast<AllocatorNode*>(1);
+
+/// Return the first node of a block.
+static AllocatorNode* FirstNode(AllocatorBlock* block)
+{
+    return reinterpret_cast<AllocatorNode*>(reinterpret_cast<unsigned char*>(block) + sizeof(AllocatorBlock));
+}
+
+/// Chain the nodes of a block in order, with the last node chained to a given node. Return the first node.
+static AllocatorNode* ChainNodes(AllocatorBlock* block, size_t capacity, AllocatorNode* last)
+{
+    size_t stride = sizeof(AllocatorNode) + block->nodeSize;
+    unsigned char* nodePtr = reinterpret_cast<unsigned char*>(FirstNode(block));
+
+    for (size_t i = 0; i < capacity - 1; ++i)
+    {
+        reinterpret_cast<AllocatorNode*>(nodePtr)->next = reinterpret_cast<AllocatorNode*>(nodePtr + stride);
+        nodePtr += stride;
+    }
+    reinterpret_cast<AllocatorNode*>(nodePtr)->next = last;
+
+    return FirstNode(block);
+}
+
+/// Return the index of the block that contains a node, in blocks sorted by address, or the number of blocks if none does.
+static size_t FindBlock(const std::vector<AllocatorBlock*>& blocks, AllocatorNode* node, size_t stride)
+{
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), reinterpret_cast<AllocatorBlock*>(node));
+    if (it == blocks.begin())
+        return blocks.size();
+
+    --it;
+    unsigned char* end = reinterpret_cast<unsigned char*>(FirstNode(*it)) + (*it)->capacity * stride;
+    return reinterpret_cast<unsigned char*>(node) < end ? (size_t)(it - blocks.begin()) : blocks.size();
+}
 
 static AllocatorBlock* AllocatorGetBlock(AllocatorBlock* allocator, size_t nodeSize, size_t capacity)
 {
+    MEMORY_SCOPE(MEMORY_ALLOCATOR);
+
     if (!capacity)
         capacity = 1;
     
@@ -11,6 +54,7 @@ static AllocatorBlock* AllocatorGetBlock(AllocatorBlock* allocator, size_t nodeS
     AllocatorBlock* newBlock = reinterpret_cast<AllocatorBlock*>(blockPtr);
     newBlock->nodeSize = nodeSize;
     newBlock->capacity = capacity;
+    newBlock->used = 0;
     newBlock->free = nullptr;
     newBlock->next = nullptr;
     
@@ -23,22 +67,7 @@ static AllocatorBlock* AllocatorGetBlock(AllocatorBlock* allocator, size_t nodeS
     }
     
     // Initialize the nodes. Free nodes are always chained to the first (parent) allocator
-    unsigned char* nodePtr = blockPtr + sizeof(AllocatorBlock);
-    AllocatorNode* firstNewNode = reinterpret_cast<AllocatorNode*>(nodePtr);
-    
-    for (size_t i = 0; i < capacity - 1; ++i)
-    {
-        AllocatorNode* newNode = reinterpret_cast<AllocatorNode*>(nodePtr);
-        newNode->next = reinterpret_cast<AllocatorNode*>(nodePtr + sizeof(AllocatorNode) + nodeSize);
-        nodePtr += sizeof(AllocatorNode) + nodeSize;
-    }
-    // i == capacity - 1
-    {
-        AllocatorNode* newNode = reinterpret_cast<AllocatorNode*>(nodePtr);
-        newNode->next = nullptr;
-    }
-    
-    allocator->free = firstNewNode;
+    allocator->free = ChainNodes(newBlock, capacity, nullptr);
     return newBlock;
 }
 
@@ -75,7 +104,8 @@ void* AllocatorGet(AllocatorBlock* allocator)
     AllocatorNode* freeNode = allocator->free;
     void* ptr = (reinterpret_cast<unsigned char*>(freeNode)) + sizeof(AllocatorNode);
     allocator->free = freeNode->next;
-    freeNode->next = nullptr;
+    freeNode->next = ALLOCATED_NODE;
+    ++allocator->used;
     
     return ptr;
 }
@@ -91,4 +121,106 @@ void AllocatorFree(AllocatorBlock* allocator, void* ptr)
     // Chain the node back to free nodes
     node->next = allocator->free;
     allocator->free = node;
+    --allocator->used;
+}
+
+void AllocatorFreeAll(AllocatorBlock* allocator, void (*function)(void*))
+{
+    if (!allocator)
+        return;
+
+    size_t stride = sizeof(AllocatorNode) + allocator->nodeSize;
+
+    // The first block's own capacity is what remains after the other blocks
+    size_t firstCapacity = allocator->capacity;
+    for (AllocatorBlock* block = allocator->next; block; block = block->next)
+        firstCapacity -= block->capacity;
+
+    AllocatorNode* free = nullptr;
+    for (AllocatorBlock* block = allocator; block; block = block->next)
+    {
+        size_t capacity = block == allocator ? firstCapacity : block->capacity;
+
+        if (function && allocator->used)
+        {
+            unsigned char* nodePtr = reinterpret_cast<unsigned char*>(FirstNode(block));
+            for (size_t i = 0; i < capacity; ++i, nodePtr += stride)
+            {
+                if (reinterpret_cast<AllocatorNode*>(nodePtr)->next == ALLOCATED_NODE)
+                    function(nodePtr + sizeof(AllocatorNode));
+            }
+        }
+
+        free = ChainNodes(block, capacity, free);
+    }
+
+    allocator->free = free;
+    allocator->used = 0;
+}
+
+size_t AllocatorTrim(AllocatorBlock* allocator)
+{
+    if (!allocator || !allocator->next)
+        return 0;
+
+    size_t stride = sizeof(AllocatorNode) + allocator->nodeSize;
+
+    // Count the free nodes of each block other than the first. The blocks are sorted by address to find the block of a node
+    std::vector<AllocatorBlock*> blocks;
+    for (AllocatorBlock* block = allocator->next; block; block = block->next)
+        blocks.push_back(block);
+    std::sort(blocks.begin(), blocks.end());
+
+    std::vector<size_t> freeCounts(blocks.size(), 0);
+    for (AllocatorNode* node = allocator->free; node; node = node->next)
+    {
+        size_t index = FindBlock(blocks, node, stride);
+        if (index < blocks.size())
+            ++freeCounts[index];
+    }
+
+    std::vector<bool> removed(blocks.size(), false);
+    bool anyRemoved = false;
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        if (freeCounts[i] == blocks[i]->capacity)
+        {
+            removed[i] = true;
+            anyRemoved = true;
+        }
+    }
+    if (!anyRemoved)
+        return 0;
+
+    // Unchain the free nodes of the removed blocks
+    AllocatorNode** prev = &allocator->free;
+    for (AllocatorNode* node = allocator->free; node; node = node->next)
+    {
+        size_t index = FindBlock(blocks, node, stride);
+        if (index == blocks.size() || !removed[index])
+        {
+            *prev = node;
+            prev = &node->next;
+        }
+    }
+    *prev = nullptr;
+
+    // Unlink and free the removed blocks
+    size_t freedBytes = 0;
+    for (size_t i = 0; i < blocks.size(); ++i)
+    {
+        if (!removed[i])
+            continue;
+
+        AllocatorBlock* prevBlock = allocator;
+        while (prevBlock->next != blocks[i])
+            prevBlock = prevBlock->next;
+        prevBlock->next = blocks[i]->next;
+
+        allocator->capacity -= blocks[i]->capacity;
+        freedBytes += sizeof(AllocatorBlock) + blocks[i]->capacity * stride;
+        delete[] reinterpret_cast<unsigned char*>(blocks[i]);
+    }
+
+    return freedBytes;
 }
@@ -4,6 +4,7 @@
 
 #include <cstddef>
 #include <new>
+#include <type_traits>
 
 struct AllocatorBlock;
 struct AllocatorNode;
@@ -15,8 +16,10 @@ struct AllocatorBlock
 {
     /// Size of a node.
     size_t nodeSize;
-    /// Number of nodes in this block.
+    /// Number of nodes in this block. In the first block, number of nodes in all blocks.
     size_t capacity;
+    /// Number of allocated nodes in all blocks. Used in the first block only.
+    size_t used;
     /// First free node.
     AllocatorNode* free;
     /// Next allocator block.
@@ -40,6 +43,10 @@ void AllocatorUninitialize(AllocatorBlock* allocator);
 void* AllocatorGet(AllocatorBlock* allocator);
 /// Free a node. Does not free any blocks.
 void AllocatorFree(AllocatorBlock* allocator, void* node);
+/// Free all nodes at once without freeing any blocks. Optionally call a function for each allocated node before, for example to destruct it.
+void AllocatorFreeAll(AllocatorBlock* allocator, void (*function)(void*) = nullptr);
+/// Free the blocks other than the first that have no allocated nodes. Return the number of bytes freed.
+size_t AllocatorTrim(AllocatorBlock* allocator);
 
 /// %Allocator template class. Allocates objects of a specific class.
 template <class T> class Allocator
@@ -95,6 +102,18 @@ public:
         AllocatorFree(allocator, object);
     }
     
+    /// Destruct and free all objects at once, keeping the memory for reuse. Faster than freeing the objects one by one, but any pointers to them must no longer be used.
+    void FreeAll()
+    {
+        AllocatorFreeAll(allocator, std::is_trivially_destructible<T>::value ? nullptr : &Destruct);
+    }
+    
+    /// Free the memory blocks that have no objects, except the first. Return the number of bytes freed.
+    size_t Trim()
+    {
+        return AllocatorTrim(allocator);
+    }
+    
     /// Free the allocator. All objects reserved from this allocator should be freed before this is called.
     void Reset()
     {
@@ -102,7 +121,15 @@ public:
         allocator = nullptr;
     }
     
+    /// Return number of allocated objects.
+    size_t NumUsed() const { return allocator ? allocator->used : 0; }
+    /// Return number of objects that fit in the memory blocks.
+    size_t Capacity() const { return allocator ? allocator->capacity : 0; }
+    
 private:
+    /// Destruct an object for FreeAll().
+    static void Destruct(void* object) { static_cast<T*>(object)->~T(); }
+    
     /// Prevent copy construction.
     Allocator(const Allocator<T>& rhs);
     /// Prevent assignment.
@@ -9,6 +9,7 @@
 #include "../Math/IntRect.h"
 #include "../Math/IntBox.h"
 #include "../Math/Matrix3x4.h"
+#include "../Math/Rect.h"
 #include "Attribute.h"
 
 const std::string Attribute::typeNames[] =
@@ -76,10 +77,17 @@ AttributeAccessor::~AttributeAccessor()
 Attribute::Attribute(const char* name_, AttributeAccessor* accessor_, const char** enumNames_) :
     name(name_),
     accessor(accessor_),
-    enumNames(enumNames_)
+    enumNames(enumNames_),
+    memberOffset(NO_MEMBER_OFFSET)
 {
 }
 
+void Attribute::SetMemberOffset(size_t offset)
+{
+    assert(ByteSize());
+    memberOffset = offset;
+}
+
 void Attribute::FromValue(Serializable* instance, const void* source)
 {
     accessor->Set(instance, source);
@@ -430,6 +438,11 @@ template<> AttributeType AttributeImpl<Color>::Type() const
     return ATTR_COLOR;
 }
 
+template<> AttributeType AttributeImpl<Rect>::Type() const
+{
+    return ATTR_RECT;
+}
+
 template<> AttributeType AttributeImpl<BoundingBox>::Type() const
 {
     return ATTR_BOUNDINGBOX;
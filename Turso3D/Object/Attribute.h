@@ -40,6 +40,9 @@ enum AttributeType
     MAX_ATTR_TYPES
 };
 
+/// Member offset of an attribute that is not accessed directly as a class member.
+static const size_t NO_MEMBER_OFFSET = (size_t)-1;
+
 /// Helper class for accessing serializable variables via getter and setter functions.
 class AttributeAccessor
 {
@@ -68,6 +71,8 @@ public:
     virtual void FromJSON(Serializable* instance, const JSONValue& source) = 0;
     /// Serialize to JSON.
     virtual void ToJSON(Serializable* instance, JSONValue& dest) = 0;
+    /// Copy the value from one instance to another through the accessor.
+    virtual void Copy(Serializable* source, Serializable* dest) = 0;
     /// Return type.
     virtual AttributeType Type() const = 0;
     /// Return whether is default value.
@@ -86,6 +91,10 @@ public:
     const std::string& TypeName() const;
     /// Return byte size of the attribute data, or 0 if it can be variable.
     size_t ByteSize() const;
+    /// Return byte offset of the variable from the Serializable base, or NO_MEMBER_OFFSET if accessed through functions.
+    size_t MemberOffset() const { return memberOffset; }
+    /// Set byte offset of the variable from the Serializable base. Only allowed for fixed-size types, whose binary data is then copied directly.
+    void SetMemberOffset(size_t offset);
     
     /// Skip binary data of an attribute.
     static void Skip(AttributeType type, Stream& source);
@@ -110,6 +119,8 @@ protected:
     AutoPtr<AttributeAccessor> accessor;
     /// Enum names.
     const char** enumNames;
+    /// Member variable offset for direct binary copy.
+    size_t memberOffset;
 
 private:
     /// Prevent copy construction.
@@ -163,6 +174,14 @@ public:
         Attribute::ToJSON(Type(), dest, &value);
     }
 
+    /// Copy the value from one instance to another through the accessor.
+    void Copy(Serializable* source, Serializable* dest) override
+    {
+        T value;
+        accessor->Get(source, &value);
+        accessor->Set(dest, &value);
+    }
+
     /// Return type.
     AttributeType Type() const override;
     
@@ -230,6 +249,45 @@ private:
     SetFunctionPtr set;
 };
 
+/// Template implementation for accessing serializable variables directly as class members. The class is notified after setting.
+template <class T, class U> class MemberAttributeAccessorImpl : public AttributeAccessor
+{
+public:
+    typedef U T::*MemberPtr;
+
+    /// Construct with member pointer.
+    MemberAttributeAccessorImpl(MemberPtr memberPtr) :
+        member(memberPtr)
+    {
+        assert(member);
+    }
+
+    /// Get current value of the variable.
+    void Get(const Serializable* instance, void* dest) override
+    {
+        assert(instance);
+
+        U& value = *(reinterpret_cast<U*>(dest));
+        const T* classPtr = static_cast<const T*>(instance);
+        value = classPtr->*member;
+    }
+
+    /// Set new value for the variable.
+    void Set(Serializable* instance, const void* source) override
+    {
+        assert(instance);
+
+        const U& value = *(reinterpret_cast<const U*>(source));
+        T* classPtr = static_cast<T*>(instance);
+        classPtr->*member = value;
+        classPtr->OnMemberAttributesSet();
+    }
+
+private:
+    /// Member pointer.
+    MemberPtr member;
+};
+
 /// Template implementation for accessing serializable variables via functions that use references.
 template <class T, class U> class RefAttributeAccessorImpl : public AttributeAccessor
 {
@@ -115,7 +115,7 @@ public:
     /// Assign from a pointer. Existing array is deleted and ownership is transferred from the source pointer, which becomes null.
     AutoArrayPtr<T>& operator = (AutoArrayPtr<T>& rhs)
     {
-        delete array;
+        delete[] array;
         array = rhs.array;
         rhs.array = nullptr;
         return *this;
@@ -124,7 +124,7 @@ public:
     /// Assign a new array. Existing array is deleted.
     AutoArrayPtr<T>& operator = (T* rhs)
     {
-        delete array;
+        delete[] array;
         array = rhs;
         return *this;
     }
@@ -0,0 +1,108 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Thread/WorkQueue.h"
+#include "EventQueue.h"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+EventQueue::EventQueue()
+{
+    for (unsigned i = 0; i < MAX_EVENT_QUEUE_THREADS; ++i)
+        heads[i].store(nullptr, std::memory_order_relaxed);
+
+    RegisterSubsystem(this);
+}
+
+EventQueue::~EventQueue()
+{
+    for (unsigned i = 0; i < MAX_EVENT_QUEUE_THREADS; ++i)
+    {
+        PostedEvent* posted = heads[i].exchange(nullptr, std::memory_order_acquire);
+        while (posted)
+        {
+            PostedEvent* next = posted->next;
+            delete posted;
+            posted = next;
+        }
+    }
+
+    RemoveSubsystem(this);
+}
+
+void EventQueue::Post(Event& event, RefCounted* sender)
+{
+    PostEvent(&event, sender, std::function<void(Event*)>());
+}
+
+void EventQueue::PostCall(const std::function<void()>& function)
+{
+    if (function)
+        PostEvent(nullptr, nullptr, [function](Event*) { function(); });
+}
+
+size_t EventQueue::Dispatch()
+{
+    ZoneScoped;
+
+    // Take all lists at once. Each list is newest first, so reverse it to get the post order
+    dispatching.clear();
+    for (unsigned i = 0; i < MAX_EVENT_QUEUE_THREADS; ++i)
+    {
+        size_t start = dispatching.size();
+        for (PostedEvent* posted = heads[i].exchange(nullptr, std::memory_order_acquire); posted; posted = posted->next)
+            dispatching.push_back(posted);
+        std::reverse(dispatching.begin() + start, dispatching.end());
+    }
+
+    if (dispatching.empty())
+        return 0;
+
+    // Group by event so that the same handlers run consecutively. Function calls come first. An event has one handler per receiver and is sent whole, so the handlers are not sorted by receiver across events
+    std::less<Event*> eventOrder;
+    std::stable_sort(dispatching.begin(), dispatching.end(), [&eventOrder](PostedEvent* lhs, PostedEvent* rhs) { return eventOrder(lhs->event, rhs->event); });
+
+    // Handlers may post more, which go to the lists again, so iterate a local copy
+    std::vector<PostedEvent*> posts;
+    posts.swap(dispatching);
+
+    for (auto it = posts.begin(); it != posts.end(); ++it)
+    {
+        PostedEvent* posted = *it;
+        if (posted->function)
+            posted->function(posted->event);
+        if (posted->event)
+            posted->event->Send(posted->sender);
+        delete posted;
+    }
+
+    size_t numPosts = posts.size();
+    posts.clear();
+    dispatching.swap(posts);
+    return numPosts;
+}
+
+bool EventQueue::HasPending() const
+{
+    for (unsigned i = 0; i < MAX_EVENT_QUEUE_THREADS; ++i)
+    {
+        if (heads[i].load(std::memory_order_relaxed))
+            return true;
+    }
+
+    return false;
+}
+
+void EventQueue::PostEvent(Event* event, RefCounted* sender, const std::function<void(Event*)>& function)
+{
+    PostedEvent* posted = new PostedEvent();
+    posted->event = event;
+    posted->sender = sender;
+    posted->function = function;
+
+    // Threads outside the work queue share the main thread's list; the compare-exchange keeps it safe
+    std::atomic<PostedEvent*>& head = heads[WorkQueue::ThreadIndex() % MAX_EVENT_QUEUE_THREADS];
+    posted->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(posted->next, posted, std::memory_order_release, std::memory_order_relaxed))
+        ;
+}
@@ -0,0 +1,61 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Event.h"
+#include "Object.h"
+
+#include <atomic>
+#include <functional>
+
+/// Number of separate post lists in the event queue. Work queue threads beyond share the lists.
+static const unsigned MAX_EVENT_QUEUE_THREADS = 32;
+
+/// Event or function call posted to the event queue.
+struct PostedEvent
+{
+    /// Event to send, or null for a function call.
+    Event* event;
+    /// Sender of the event.
+    RefCounted* sender;
+    /// Function that fills the event data before sending, or the function to call.
+    std::function<void(Event*)> function;
+    /// Next post in the same list.
+    PostedEvent* next;
+};
+
+/// Event queue subsystem for deferred dispatch. Events and function calls can be posted from any thread without locking, and are dispatched in the main thread in batches grouped by event, so that each event's handlers are run consecutively. The handlers are not reordered by receiver, as each event is sent to all its receivers at once.
+class EventQueue : public Object
+{
+    OBJECT(EventQueue);
+
+public:
+    /// Construct and register subsystem.
+    EventQueue();
+    /// Destruct. Discards undispatched posts.
+    ~EventQueue();
+
+    /// Post an event to be sent on the next dispatch. Can be called from any thread. The event and sender must stay alive until dispatched.
+    void Post(Event& event, RefCounted* sender);
+    /// Post an event to be sent on the next dispatch, with a function that fills the event data in the main thread just before sending. Can be called from any thread. The event and sender must stay alive until dispatched.
+    template <class T, class U> void Post(T& event, RefCounted* sender, const U& setup)
+    {
+        PostEvent(&event, sender, [setup](Event* posted) { setup(*static_cast<T*>(posted)); });
+    }
+    /// Post a function to be called in the main thread on the next dispatch. Can be called from any thread.
+    void PostCall(const std::function<void()>& function);
+    /// Send the posted events and call the posted functions. Posts from the same thread to the same event keep their order. Posts made during dispatch are deferred to the next call. Call from the main thread at a defined point in the frame. Return number of posts dispatched.
+    size_t Dispatch();
+
+    /// Return whether there are undispatched posts. Approximate while other threads post.
+    bool HasPending() const;
+
+private:
+    /// Add a post to the calling thread's list.
+    void PostEvent(Event* event, RefCounted* sender, const std::function<void(Event*)>& function);
+
+    /// Most recent post of each thread, linked to older posts.
+    std::atomic<PostedEvent*> heads[MAX_EVENT_QUEUE_THREADS];
+    /// Posts being dispatched, reused between dispatches.
+    std::vector<PostedEvent*> dispatching;
+};
@@ -0,0 +1,47 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "IdAllocator.h"
+
+#include <algorithm>
+#include <functional>
+
+IdAllocator::IdAllocator() :
+    nextId(0)
+{
+}
+
+unsigned short IdAllocator::Allocate()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (freeIds.size())
+    {
+        std::pop_heap(freeIds.begin(), freeIds.end(), std::greater<unsigned short>());
+        unsigned short id = freeIds.back();
+        freeIds.pop_back();
+        return id;
+    }
+
+    if (nextId >= ID_OVERFLOW)
+        return ID_OVERFLOW;
+
+    return (unsigned short)nextId++;
+}
+
+void IdAllocator::Free(unsigned short id)
+{
+    if (id == ID_OVERFLOW)
+        return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    freeIds.push_back(id);
+    std::push_heap(freeIds.begin(), freeIds.end(), std::greater<unsigned short>());
+}
+
+size_t IdAllocator::NumAllocated() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    return nextId - freeIds.size();
+}
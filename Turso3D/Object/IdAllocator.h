@@ -0,0 +1,32 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+/// ID returned when all IDs are in use.
+static const unsigned short ID_OVERFLOW = 0xffff;
+
+/// Allocator for compact 16-bit identifiers. Freed IDs are recycled smallest first, so that IDs are deterministic for the same sequence of allocations and stay small. Threadsafe.
+class IdAllocator
+{
+public:
+    /// Construct.
+    IdAllocator();
+
+    /// Allocate an ID. Return ID_OVERFLOW if all are in use.
+    unsigned short Allocate();
+    /// Free an ID for reuse.
+    void Free(unsigned short id);
+    /// Return number of IDs in use.
+    size_t NumAllocated() const;
+
+private:
+    /// Mutex for allocation.
+    mutable std::mutex mutex;
+    /// Freed IDs as a min-heap.
+    std::vector<unsigned short> freeIds;
+    /// Next never allocated ID.
+    unsigned nextId;
+};
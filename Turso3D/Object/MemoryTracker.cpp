@@ -0,0 +1,157 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "MemoryTracker.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <tracy/Tracy.hpp>
+
+/// Size of the header stored before each tracked allocation. Keeps the alignment of malloc.
+static const size_t MEMORY_HEADER_SIZE = 16;
+
+static const char* memoryTagNames[] =
+{
+    "General",
+    "Octree",
+    "Renderer",
+    "Animation",
+    "Resources",
+    "Allocator",
+    "FrameArena"
+};
+
+static thread_local MemoryTag currentTag = MEMORY_GENERAL;
+
+#ifdef TURSO3D_MEMORY_TRACKING
+
+/// Bytes currently allocated by tag.
+static std::atomic<long long> tagBytes[MAX_MEMORY_TAGS];
+/// Allocation counts by tag.
+static std::atomic<long long> tagAllocations[MAX_MEMORY_TAGS];
+/// Free counts by tag.
+static std::atomic<long long> tagFrees[MAX_MEMORY_TAGS];
+
+/// Allocate memory with a header that records the size and tag.
+static void* TrackedAllocate(size_t size)
+{
+    unsigned char* block = static_cast<unsigned char*>(malloc(size + MEMORY_HEADER_SIZE));
+    if (!block)
+        return nullptr;
+
+    MemoryTag tag = currentTag;
+    *reinterpret_cast<size_t*>(block) = size;
+    *reinterpret_cast<unsigned*>(block + sizeof(size_t)) = tag;
+    tagBytes[tag].fetch_add((long long)size, std::memory_order_relaxed);
+    tagAllocations[tag].fetch_add(1, std::memory_order_relaxed);
+
+    void* ptr = block + MEMORY_HEADER_SIZE;
+    TracyAllocN(ptr, size, memoryTagNames[tag]);
+    return ptr;
+}
+
+/// Free memory allocated with TrackedAllocate().
+static void TrackedFree(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    unsigned char* block = static_cast<unsigned char*>(ptr) - MEMORY_HEADER_SIZE;
+    size_t size = *reinterpret_cast<size_t*>(block);
+    unsigned tag = *reinterpret_cast<unsigned*>(block + sizeof(size_t));
+    tagBytes[tag].fetch_add(-(long long)size, std::memory_order_relaxed);
+    tagFrees[tag].fetch_add(1, std::memory_order_relaxed);
+
+    TracyFreeN(ptr, memoryTagNames[tag]);
+    free(block);
+}
+
+void* operator new(size_t size)
+{
+    void* ptr = TrackedAllocate(size);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new[](size_t size)
+{
+    void* ptr = TrackedAllocate(size);
+    if (!ptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return TrackedAllocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return TrackedAllocate(size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    TrackedFree(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    TrackedFree(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    TrackedFree(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    TrackedFree(ptr);
+}
+
+#endif
+
+bool IsMemoryTracking()
+{
+#ifdef TURSO3D_MEMORY_TRACKING
+    return true;
+#else
+    return false;
+#endif
+}
+
+MemoryTag SetMemoryTag(MemoryTag tag)
+{
+    MemoryTag previous = currentTag;
+    currentTag = tag;
+    return previous;
+}
+
+MemoryTag CurrentMemoryTag()
+{
+    return currentTag;
+}
+
+MemoryStats GetMemoryStats(MemoryTag tag)
+{
+    MemoryStats stats;
+#ifdef TURSO3D_MEMORY_TRACKING
+    stats.bytes = tagBytes[tag].load(std::memory_order_relaxed);
+    stats.allocations = tagAllocations[tag].load(std::memory_order_relaxed);
+    stats.frees = tagFrees[tag].load(std::memory_order_relaxed);
+#else
+    (void)tag;
+    stats.bytes = 0;
+    stats.allocations = 0;
+    stats.frees = 0;
+#endif
+    return stats;
+}
+
+const char* MemoryTagName(MemoryTag tag)
+{
+    return memoryTagNames[tag];
+}
@@ -0,0 +1,65 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+/// Subsystems that heap allocations are attributed to.
+enum MemoryTag
+{
+    MEMORY_GENERAL = 0,
+    MEMORY_OCTREE,
+    MEMORY_RENDERER,
+    MEMORY_ANIMATION,
+    MEMORY_RESOURCES,
+    MEMORY_ALLOCATOR,
+    MEMORY_FRAMEARENA,
+    MAX_MEMORY_TAGS
+};
+
+/// Heap statistics of one memory tag.
+struct MemoryStats
+{
+    /// Bytes currently allocated.
+    long long bytes;
+    /// Allocations since start.
+    long long allocations;
+    /// Frees since start.
+    long long frees;
+};
+
+/// Return whether heap allocations are tracked. Requires building with the TURSO3D_MEMORY_TRACKING option, which replaces the global operator new and delete.
+bool IsMemoryTracking();
+/// Set the tag of the calling thread's allocations. Return the previous tag.
+MemoryTag SetMemoryTag(MemoryTag tag);
+/// Return the tag of the calling thread's allocations.
+MemoryTag CurrentMemoryTag();
+/// Return the heap statistics of a tag. Zero if not tracking. Frees are attributed to the tag the memory was allocated with.
+MemoryStats GetMemoryStats(MemoryTag tag);
+/// Return the name of a tag.
+const char* MemoryTagName(MemoryTag tag);
+
+/// Helper class for tagging the allocations of the calling thread within a scope.
+class MemoryScope
+{
+public:
+    /// Construct and set the tag.
+    MemoryScope(MemoryTag tag) :
+        previous(SetMemoryTag(tag))
+    {
+    }
+
+    /// Destruct. Restore the previous tag.
+    ~MemoryScope()
+    {
+        SetMemoryTag(previous);
+    }
+
+private:
+    /// Previous tag.
+    MemoryTag previous;
+};
+
+#ifdef TURSO3D_MEMORY_TRACKING
+#define MEMORY_SCOPE(tag) MemoryScope memoryScope_(tag)
+#else
+#define MEMORY_SCOPE(tag)
+#endif
@@ -2,11 +2,72 @@
 
 #include "Object.h"
 #include "../IO/JSONValue.h"
+#include "../IO/Log.h"
 
-std::map<StringHash, Object*> Object::subsystems;
+#include <cassert>
+#include <mutex>
+#include <vector>
+
+/// Factory entry in the type lookup table.
+struct FactoryEntry
+{
+    /// Object type, valid if factory is non-null.
+    StringHash type;
+    /// Factory.
+    ObjectFactory* factory;
+};
+
+/// Derived and base type pair entry in the type lookup table.
+struct DerivedTypeEntry
+{
+    /// Derived type in the high bits and base type in the low bits.
+    unsigned long long key;
+    /// Whether the entry is in use.
+    bool used;
+};
+
+/// Open addressing lookup table of factories and derived types. Immutable once published.
+struct TypeTable
+{
+    /// Factories, power of two size.
+    std::vector<FactoryEntry> factories;
+    /// Derived type pairs, power of two size.
+    std::vector<DerivedTypeEntry> derivedTypes;
+};
+
+std::atomic<Object*> Object::subsystemSlots[MAX_SUBSYSTEMS];
+std::atomic<unsigned> Object::subsystemTypes[MAX_SUBSYSTEMS];
+std::atomic<size_t> Object::numSubsystemTypes;
 std::map<StringHash, AutoPtr<ObjectFactory> > Object::factories;
 std::set<std::pair<StringHash, StringHash> > Object::derivedTypes;
 std::map<StringHash, StringHash> Object::baseTypes;
+std::atomic<TypeTable*> Object::typeTable;
+
+/// Lock for registration.
+static std::mutex registryMutex;
+/// Replaced type tables, kept alive as lookups from other threads may still be using them.
+static std::vector<AutoPtr<TypeTable> > typeTables;
+
+/// Return the key of a derived type pair.
+static unsigned long long DerivedTypeKey(StringHash derived, StringHash base)
+{
+    return ((unsigned long long)derived.Value() << 32) | base.Value();
+}
+
+/// Return the starting index of a hash in an open addressing table.
+static size_t TableIndex(unsigned long long hash, size_t mask)
+{
+    return (size_t)(hash ^ (hash >> 29)) & mask;
+}
+
+/// Return table size for a number of entries, so that the load factor is at most one half.
+static size_t TableSize(size_t count)
+{
+    size_t size = 8;
+    while (size < count * 2)
+        size <<= 1;
+    return size;
+}
 
 ObjectFactory::~ObjectFactory()
 {
@@ -37,7 +98,14 @@ void Object::RegisterSubsystem(Object* subsystem)
     if (!subsystem)
         return;
     
-    subsystems[subsystem->Type()] = subsystem;
+    size_t index = AllocateSubsystemIndex(subsystem->Type());
+    if (index >= MAX_SUBSYSTEMS)
+    {
+        LOGERROR("Too many subsystem types, could not register " + subsystem->TypeName());
+        return;
+    }
+
+    subsystemSlots[index].store(subsystem, std::memory_order_release);
 }
 
 void Object::RemoveSubsystem(Object* subsystem)
@@ -45,20 +113,55 @@ void Object::RemoveSubsystem(Object* subsystem)
     if (!subsystem)
         return;
     
-    auto it = subsystems.find(subsystem->Type());
-    if (it != subsystems.end() && it->second == subsystem)
-        subsystems.erase(it);
+    size_t index = SubsystemIndex(subsystem->Type());
+    if (index >= MAX_SUBSYSTEMS)
+        return;
+
+    Object* expected = subsystem;
+    subsystemSlots[index].compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel);
 }
 
 void Object::RemoveSubsystem(StringHash type)
 {
-    subsystems.erase(type);
+    size_t index = SubsystemIndex(type);
+    if (index < MAX_SUBSYSTEMS)
+        subsystemSlots[index].store(nullptr, std::memory_order_release);
 }
 
 Object* Object::Subsystem(StringHash type)
 {
-    auto it = subsystems.find(type);
-    return it != subsystems.end() ? it->second : nullptr;
+    size_t index = SubsystemIndex(type);
+    return index < MAX_SUBSYSTEMS ? subsystemSlots[index].load(std::memory_order_acquire) : nullptr;
+}
+
+size_t Object::SubsystemIndex(StringHash type)
+{
+    size_t count = numSubsystemTypes.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (subsystemTypes[i].load(std::memory_order_relaxed) == type.Value())
+            return i;
+    }
+
+    return MAX_SUBSYSTEMS;
+}
+
+size_t Object::AllocateSubsystemIndex(StringHash type)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+
+    size_t index = SubsystemIndex(type);
+    if (index < MAX_SUBSYSTEMS)
+        return index;
+
+    index = numSubsystemTypes.load(std::memory_order_relaxed);
+    if (index >= MAX_SUBSYSTEMS)
+        return MAX_SUBSYSTEMS;
+
+    // Publish the type before the count, so that lock-free lookups never see an unwritten slot
+    subsystemTypes[index].store(type.Value(), std::memory_order_relaxed);
+    numSubsystemTypes.store(index + 1, std::memory_order_release);
+    return index;
 }
 
 void Object::RegisterFactory(ObjectFactory* factory)
@@ -66,28 +169,64 @@ void Object::RegisterFactory(ObjectFactory* factory)
     if (!factory)
         return;
     
+    std::lock_guard<std::mutex> lock(registryMutex);
     factories[factory->Type()] = factory;
+    UpdateTypeTable();
 }
 
 Object* Object::Create(StringHash type)
 {
-    auto it = factories.find(type);
-    return it != factories.end() ? it->second->Create() : nullptr;
+    const TypeTable* table = typeTable.load(std::memory_order_acquire);
+    if (!table)
+        return nullptr;
+
+    size_t mask = table->factories.size() - 1;
+    for (size_t i = TableIndex(type.Value(), mask); table->factories[i].factory; i = (i + 1) & mask)
+    {
+        if (table->factories[i].type == type)
+            return table->factories[i].factory->Create();
+    }
+
+    return nullptr;
 }
 
 const std::string& Object::TypeNameFromType(StringHash type)
 {
-    auto it = factories.find(type);
-    return it != factories.end() ? it->second->TypeName() : JSONValue::emptyString;
+    const TypeTable* table = typeTable.load(std::memory_order_acquire);
+    if (!table)
+        return JSONValue::emptyString;
+
+    size_t mask = table->factories.size() - 1;
+    for (size_t i = TableIndex(type.Value(), mask); table->factories[i].factory; i = (i + 1) & mask)
+    {
+        if (table->factories[i].type == type)
+            return table->factories[i].factory->TypeName();
+    }
+
+    return JSONValue::emptyString;
 }
 
 bool Object::DerivedFrom(StringHash derived, StringHash base)
 {
-    return derivedTypes.find(std::make_pair(derived, base)) != derivedTypes.end();
+    const TypeTable* table = typeTable.load(std::memory_order_acquire);
+    if (!table)
+        return false;
+
+    unsigned long long key = DerivedTypeKey(derived, base);
+    size_t mask = table->derivedTypes.size() - 1;
+    for (size_t i = TableIndex(key, mask); table->derivedTypes[i].used; i = (i + 1) & mask)
+    {
+        if (table->derivedTypes[i].key == key)
+            return true;
+    }
+
+    return false;
 }
 
 void Object::RegisterDerivedType(StringHash derived, StringHash base)
 {
+    std::lock_guard<std::mutex> lock(registryMutex);
+
     baseTypes[derived] = base;
 
     derivedTypes.insert(std::make_pair(derived, base));
@@ -100,4 +239,41 @@ void Object::RegisterDerivedType(StringHash derived, StringHash base)
         derivedTypes.insert(std::make_pair(derived, base));
         it = baseTypes.find(base);
     }
+
+    UpdateTypeTable();
+}
+
+void Object::UpdateTypeTable()
+{
+    TypeTable* newTable = new TypeTable();
+
+    newTable->factories.resize(TableSize(factories.size()));
+    for (size_t i = 0; i < newTable->factories.size(); ++i)
+        newTable->factories[i].factory = nullptr;
+    size_t mask = newTable->factories.size() - 1;
+    for (auto it = factories.begin(); it != factories.end(); ++it)
+    {
+        size_t i = TableIndex(it->first.Value(), mask);
+        while (newTable->factories[i].factory)
+            i = (i + 1) & mask;
+        newTable->factories[i].type = it->first;
+        newTable->factories[i].factory = it->second.Get();
+    }
+
+    newTable->derivedTypes.resize(TableSize(derivedTypes.size()));
+    for (size_t i = 0; i < newTable->derivedTypes.size(); ++i)
+        newTable->derivedTypes[i].used = false;
+    mask = newTable->derivedTypes.size() - 1;
+    for (auto it = derivedTypes.begin(); it != derivedTypes.end(); ++it)
+    {
+        unsigned long long key = DerivedTypeKey(it->first, it->second);
+        size_t i = TableIndex(key, mask);
+        while (newTable->derivedTypes[i].used)
+            i = (i + 1) & mask;
+        newTable->derivedTypes[i].key = key;
+        newTable->derivedTypes[i].used = true;
+    }
+
+    typeTables.push_back(newTable);
+    typeTable.store(newTable, std::memory_order_release);
 }
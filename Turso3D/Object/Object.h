@@ -5,11 +5,16 @@
 #include "../IO/StringHash.h"
 #include "Event.h"
 
+#include <atomic>
 #include <map>
 #include <set>
 
 class ObjectFactory;
 template <class T> class ObjectFactoryImpl;
+struct TypeTable;
+
+/// Maximum number of distinct subsystem types.
+static const size_t MAX_SUBSYSTEMS = 64;
 
 /// Base class for objects with type identification and possibility to create through a factory.
 class Object : public RefCounted
@@ -36,7 +41,7 @@ public:
     /// Return whether is subscribed to an event.
     bool SubscribedToEvent(const Event& event) const;
     
-    /// Register an object as a subsystem that can be accessed globally. Note that the subsystems container does not own the objects.
+    /// Register an object as a subsystem that can be accessed globally. Note that the subsystems container does not own the objects. Subsystems and types should be registered from the main thread, but may be looked up from any thread without locking. At most MAX_SUBSYSTEMS distinct types can be registered; registering more fails with an error.
     static void RegisterSubsystem(Object* subsystem);
     /// Remove a subsystem by object pointer.
     static void RemoveSubsystem(Object* subsystem);
@@ -54,8 +59,23 @@ public:
     static const std::string& TypeNameFromType(StringHash type);
     /// Return whether type is derived from another type.
     static bool DerivedFrom(StringHash derived, StringHash base);
-    /// Return a subsystem, template version.
-    template <class T> static T* Subsystem() { return static_cast<T*>(Subsystem(T::TypeStatic())); }
+    /// Return the slot index of a subsystem type without locking, or MAX_SUBSYSTEMS if the type has never been registered.
+    static size_t SubsystemIndex(StringHash type);
+    /// Return a subsystem, template version. Loads from the slot of the type, which is resolved once the type has been registered.
+    template <class T> static T* Subsystem()
+    {
+        // Slot indices never change once assigned, so the index can be cached
+        static std::atomic<size_t> cachedIndex(MAX_SUBSYSTEMS);
+        size_t index = cachedIndex.load(std::memory_order_relaxed);
+        if (index >= MAX_SUBSYSTEMS)
+        {
+            index = SubsystemIndex(T::TypeStatic());
+            if (index >= MAX_SUBSYSTEMS)
+                return nullptr;
+            cachedIndex.store(index, std::memory_order_relaxed);
+        }
+        return static_cast<T*>(subsystemSlots[index].load(std::memory_order_acquire));
+    }
     /// Register an object factory, template version.
     template <class T> static void RegisterFactory() { RegisterFactory(new ObjectFactoryImpl<T>()); }
     /// Register a derived type, template version.
@@ -64,10 +84,21 @@ public:
     template <class T> static T* Create() { return static_cast<T*>(Create(T::TypeStatic())); }
     
 private:
-    /// Registered subsystems.
-    static std::map<StringHash, Object*> subsystems;
+    /// Rebuild the lookup table of factories and derived types after a registration.
+    static void UpdateTypeTable();
+    /// Return the slot index of a subsystem type, allocating a new slot if the type has none yet. Return MAX_SUBSYSTEMS if the slots are exhausted.
+    static size_t AllocateSubsystemIndex(StringHash type);
+
+    /// Registered subsystems by slot index.
+    static std::atomic<Object*> subsystemSlots[MAX_SUBSYSTEMS];
+    /// Subsystem type of each allocated slot. Written once before the slot count is advanced.
+    static std::atomic<unsigned> subsystemTypes[MAX_SUBSYSTEMS];
+    /// Number of allocated subsystem slots.
+    static std::atomic<size_t> numSubsystemTypes;
     /// Registered object factories.
     static std::map<StringHash, AutoPtr<ObjectFactory> > factories;
+    /// Open addressing lookup table of the factories and derived types, replaced as a whole on registration so that lookups need no locking.
+    static std::atomic<TypeTable*> typeTable;
     /// Registered derived types.
     static std::set<std::pair<StringHash, StringHash> > derivedTypes;
     /// Registered immediate base types.
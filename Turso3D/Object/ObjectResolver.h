@@ -2,7 +2,7 @@
 
 #pragma once
 
-#include <map>
+#include <unordered_map>
 #include <vector>
 
 class Attribute;
@@ -47,9 +47,12 @@ public:
     /// Resolve the object ref attributes.
     void Resolve();
 
+    /// Return the stored object ref attributes.
+    const std::vector<StoredObjectRef>& ObjectRefs() const { return objectRefs; }
+
 private:
     /// Mapping of old id's to objects.
-    std::map<unsigned, Serializable*> objects;
+    std::unordered_map<unsigned, Serializable*> objects;
     /// Stored object ref attributes.
     std::vector<StoredObjectRef> objectRefs;
 };
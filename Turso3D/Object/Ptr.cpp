@@ -3,15 +3,18 @@
 #include "Ptr.h"
 
 RefCounted::RefCounted() :
+    refs(0),
+    atomicRefs(false),
     refCount(nullptr)
 {
 }
 
 RefCounted::~RefCounted()
 {
+    assert(refs.load(std::memory_order_relaxed) == 0);
+
     if (refCount)
     {
-        assert(refCount->refs == 0);
         if (refCount->weakRefs == 0)
             delete refCount;
         else
@@ -19,22 +22,6 @@ RefCounted::~RefCounted()
     }
 }
 
-void RefCounted::AddRef()
-{
-    if (!refCount)
-        refCount = new RefCount();
-
-    ++(refCount->refs);
-}
-
-void RefCounted::ReleaseRef()
-{
-    assert(refCount && refCount->refs > 0);
-    --(refCount->refs);
-    if (refCount->refs == 0)
-        delete this;
-}
-
 RefCount* RefCounted::RefCountPtr()
 {
     if (!refCount)
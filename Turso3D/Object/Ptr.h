@@ -2,13 +2,14 @@
 
 #pragma once
 
+#include <atomic>
 #include <cassert>
 #include <cstddef>
 
 class RefCounted;
 template <class T> class WeakPtr;
 
-/// Reference count structure. Used in both intrusive and non-intrusive reference counting.
+/// Reference count structure. Used in non-intrusive reference counting, and for the weak references of RefCounted objects.
 struct RefCount
 {
     /// Construct with zero refcounts.
@@ -19,7 +20,7 @@ struct RefCount
     {
     }
 
-    /// Number of strong references. These keep the object alive.
+    /// Number of strong references. These keep the object alive. Not used for RefCounted objects, which count their strong references intrusively.
     unsigned refs;
     /// Number of weak references.
     unsigned weakRefs;
@@ -27,35 +28,66 @@ struct RefCount
     bool expired;
 };
 
-/// Base class for intrusively reference counted objects that can be pointed to with SharedPtr and WeakPtr. These are not copy-constructible and not assignable.
+/// Base class for intrusively reference counted objects that can be pointed to with SharedPtr and WeakPtr. These are not copy-constructible and not assignable. The strong reference count is stored in the object, so that objects without weak references need no other allocation. By default the count is not threadsafe; types that are shared between work queue threads enable atomic reference counting in their constructor. Weak references are not threadsafe in either mode.
 class RefCounted
 {
 public:
-    /// Construct. The reference count is not allocated yet; it will be allocated on demand.
+    /// Construct. The weak reference count structure is not allocated yet; it will be allocated on demand.
     RefCounted();
 
-    /// Destruct. If no weak references, destroy also the reference count, else mark it expired.
+    /// Destruct. If no weak references, destroy also the weak reference count, else mark it expired.
     virtual ~RefCounted();
 
-    /// Add a strong reference. Allocate the reference count structure first if necessary.
-    void AddRef();
+    /// Add a strong reference.
+    void AddRef()
+    {
+        if (atomicRefs)
+            refs.fetch_add(1, std::memory_order_relaxed);
+        else
+            refs.store(refs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
     /// Release a strong reference. Destroy the object when the last strong reference is gone.
-    void ReleaseRef();
+    void ReleaseRef()
+    {
+        unsigned oldRefs;
+        if (atomicRefs)
+            oldRefs = refs.fetch_sub(1, std::memory_order_acq_rel);
+        else
+        {
+            oldRefs = refs.load(std::memory_order_relaxed);
+            refs.store(oldRefs - 1, std::memory_order_relaxed);
+        }
+
+        assert(oldRefs > 0);
+        if (oldRefs == 1)
+            delete this;
+    }
 
     /// Return the number of strong references.
-    unsigned Refs() const { return refCount ? refCount->refs : 0; }
+    unsigned Refs() const { return refs.load(std::memory_order_relaxed); }
     /// Return the number of weak references.
     unsigned WeakRefs() const { return refCount ? refCount->weakRefs : 0; }
-    /// Return pointer to the reference count structure. Allocate if not allocated yet.
+    /// Return whether strong references are counted atomically.
+    bool IsAtomicRefs() const { return atomicRefs; }
+    /// Return pointer to the weak reference count structure. Allocate if not allocated yet.
     RefCount* RefCountPtr();
 
+protected:
+    /// Set atomic reference counting, so that strong references can be added and released from several threads at once. Call in the constructor before references exist.
+    void SetAtomicRefs(bool enable) { atomicRefs = enable; }
+
 private:
     /// Prevent copy construction.
     RefCounted(const RefCounted& rhs);
     /// Prevent assignment.
     RefCounted& operator = (const RefCounted& rhs);
 
-    /// Reference count structure, allocated on demand.
+    /// Number of strong references.
+    std::atomic<unsigned> refs;
+    /// Atomic reference counting flag.
+    bool atomicRefs;
+    /// Weak reference count structure, allocated on demand.
     RefCount* refCount;
 };
 
@@ -311,7 +343,7 @@ public:
     }
 
     /// Return the number of strong references.
-    unsigned Refs() const { return refCount ? refCount->refs : 0; }
+    unsigned Refs() const { T* object = Get(); return object ? object->Refs() : 0; }
     /// Return the number of weak references.
     unsigned WeakRefs() const { return refCount ? refCount->weakRefs : 0; }
     /// Return whether is a null pointer.
@@ -1,6 +1,7 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../IO/JSONValue.h"
+#include "../IO/JSONWriter.h"
 #include "../IO/ObjectRef.h"
 #include "../IO/Stream.h"
 #include "ObjectResolver.h"
@@ -14,6 +15,9 @@ void Serializable::Load(Stream& source, ObjectResolver& resolver)
     if (!attributes)
         return; // Nothing to do
     
+    unsigned char* base = reinterpret_cast<unsigned char*>(this);
+    bool membersSet = false;
+
     size_t numAttrs = source.ReadVLE();
     for (size_t i = 0; i < numAttrs; ++i)
     {
@@ -26,8 +30,14 @@ void Serializable::Load(Stream& source, ObjectResolver& resolver)
             Attribute* attr = attributes->at(i);
             if (attr->Type() == type)
             {
-                // Store object refs to the resolver instead of immediately setting
-                if (type != ATTR_OBJECTREF)
+                // Copy member attributes directly and notify once at the end. Store object refs to the resolver instead of immediately setting
+                size_t offset = attr->MemberOffset();
+                if (offset != NO_MEMBER_OFFSET)
+                {
+                    source.Read(base + offset, Attribute::byteSizes[type]);
+                    membersSet = true;
+                }
+                else if (type != ATTR_OBJECTREF)
                     attr->FromBinary(this, source);
                 else
                     resolver.StoreObjectRef(this, attr, source.Read<ObjectRef>());
@@ -39,6 +49,9 @@ void Serializable::Load(Stream& source, ObjectResolver& resolver)
         if (skip)
             Attribute::Skip(type, source);
     }
+
+    if (membersSet)
+        OnMemberAttributesSet();
 }
 
 void Serializable::Save(Stream& dest)
@@ -47,12 +60,20 @@ void Serializable::Save(Stream& dest)
     if (!attributes)
         return;
     
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(this);
+
     dest.WriteVLE(attributes->size());
     for (auto it = attributes->begin(); it != attributes->end(); ++it)
     {
         Attribute* attr = *it;
-        dest.Write<unsigned char>((unsigned char)attr->Type());
-        attr->ToBinary(this, dest);
+        AttributeType type = attr->Type();
+        dest.Write<unsigned char>((unsigned char)type);
+
+        size_t offset = attr->MemberOffset();
+        if (offset != NO_MEMBER_OFFSET)
+            dest.Write(base + offset, Attribute::byteSizes[type]);
+        else
+            attr->ToBinary(this, dest);
     }
 }
 
@@ -63,6 +84,8 @@ void Serializable::LoadJSON(const JSONValue& source, ObjectResolver& resolver)
         return;
     
     const JSONObject& object = source.GetObject();
+    unsigned char* base = reinterpret_cast<unsigned char*>(this);
+    bool membersSet = false;
     
     for (auto it = attributes->begin(); it != attributes->end(); ++it)
     {
@@ -70,13 +93,21 @@ void Serializable::LoadJSON(const JSONValue& source, ObjectResolver& resolver)
         auto jsonIt = object.find(attr->Name());
         if (jsonIt != object.end())
         {
-            // Store object refs to the resolver instead of immediately setting
-            if (attr->Type() != ATTR_OBJECTREF)
+            // Write member attributes directly and notify once at the end. Store object refs to the resolver instead of immediately setting
+            if (attr->MemberOffset() != NO_MEMBER_OFFSET)
+            {
+                Attribute::FromJSON(attr->Type(), base + attr->MemberOffset(), jsonIt->second);
+                membersSet = true;
+            }
+            else if (attr->Type() != ATTR_OBJECTREF)
                 attr->FromJSON(this, jsonIt->second);
             else
                 resolver.StoreObjectRef(this, attr, ObjectRef((unsigned)jsonIt->second.GetNumber()));
         }
     }
+
+    if (membersSet)
+        OnMemberAttributesSet();
 }
 
 void Serializable::SaveJSON(JSONValue& dest)
@@ -94,10 +125,113 @@ void Serializable::SaveJSON(JSONValue& dest)
     }
 }
 
+void Serializable::SaveJSONAttributes(JSONWriter& dest)
+{
+    const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+    if (!attributes)
+        return;
+
+    for (size_t i = 0; i < attributes->size(); ++i)
+    {
+        Attribute* attr = attributes->at(i);
+        // For better readability, do not save default-valued attributes to JSON
+        if (!attr->IsDefault(this))
+        {
+            JSONValue value;
+            attr->ToJSON(this, value);
+            dest.Key(attr->Name());
+            dest.Value(value);
+        }
+    }
+}
+
+void Serializable::SaveDirtyAttributes(Stream& dest)
+{
+    const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+    if (!attributes || !dirtyAttributes)
+    {
+        dest.WriteVLE(0);
+        dirtyAttributes = 0;
+        return;
+    }
+
+    const unsigned char* base = reinterpret_cast<const unsigned char*>(this);
+    size_t numAttrs = attributes->size();
+    size_t numDirty = 0;
+    for (size_t i = 0; i < numAttrs; ++i)
+    {
+        if (dirtyAttributes & (1ULL << (i < MAX_DIRTY_ATTRIBUTES ? i : MAX_DIRTY_ATTRIBUTES - 1)))
+            ++numDirty;
+    }
+
+    dest.WriteVLE(numDirty);
+    for (size_t i = 0; i < numAttrs; ++i)
+    {
+        if (!(dirtyAttributes & (1ULL << (i < MAX_DIRTY_ATTRIBUTES ? i : MAX_DIRTY_ATTRIBUTES - 1))))
+            continue;
+
+        Attribute* attr = attributes->at(i);
+        AttributeType type = attr->Type();
+        dest.WriteVLE(i);
+        dest.Write<unsigned char>((unsigned char)type);
+
+        size_t offset = attr->MemberOffset();
+        if (offset != NO_MEMBER_OFFSET)
+            dest.Write(base + offset, Attribute::byteSizes[type]);
+        else
+            attr->ToBinary(this, dest);
+    }
+
+    dirtyAttributes = 0;
+}
+
+void Serializable::LoadDirtyAttributes(Stream& source, ObjectResolver& resolver)
+{
+    const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+    unsigned char* base = reinterpret_cast<unsigned char*>(this);
+    bool membersSet = false;
+
+    size_t numDirty = source.ReadVLE();
+    for (size_t i = 0; i < numDirty; ++i)
+    {
+        size_t index = source.ReadVLE();
+        AttributeType type = (AttributeType)source.Read<unsigned char>();
+        Attribute* attr = attributes && index < attributes->size() ? attributes->at(index).Get() : nullptr;
+
+        // Skip attribute if unknown or wrong type
+        if (!attr || attr->Type() != type)
+        {
+            Attribute::Skip(type, source);
+            continue;
+        }
+
+        size_t offset = attr->MemberOffset();
+        if (offset != NO_MEMBER_OFFSET)
+        {
+            source.Read(base + offset, Attribute::byteSizes[type]);
+            membersSet = true;
+        }
+        else if (type != ATTR_OBJECTREF)
+            attr->FromBinary(this, source);
+        else
+            resolver.StoreObjectRef(this, attr, source.Read<ObjectRef>());
+    }
+
+    if (membersSet)
+        OnMemberAttributesSet();
+}
+
 void Serializable::SetAttributeValue(Attribute* attr, const void* source)
 {
     if (attr)
+    {
         attr->FromValue(this, source);
+
+        size_t index = AttributeIndex(attr);
+        const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+        if (attributes && index < attributes->size())
+            MarkAttributeDirty(index);
+    }
 }
 
 void Serializable::AttributeValue(Attribute* attr, void* dest)
@@ -112,6 +246,21 @@ const std::vector<SharedPtr<Attribute> >* Serializable::Attributes() const
     return it != classAttributes.end() ? &it->second : nullptr;
 }
 
+size_t Serializable::AttributeIndex(Attribute* attr) const
+{
+    const std::vector<SharedPtr<Attribute> >* attributes = Attributes();
+    if (!attributes)
+        return 0;
+
+    for (size_t i = 0; i < attributes->size(); ++i)
+    {
+        if (attributes->at(i) == attr)
+            return i;
+    }
+
+    return attributes->size();
+}
+
 Attribute* Serializable::FindAttribute(const std::string& name) const
 {
     return FindAttribute(name.c_str());
@@ -185,3 +334,14 @@ void Serializable::Skip(Stream& source)
         Attribute::Skip(type, source);
     }
 }
+
+void Serializable::SkipDirtyAttributes(Stream& source)
+{
+    size_t numDirty = source.ReadVLE();
+    for (size_t i = 0; i < numDirty; ++i)
+    {
+        source.ReadVLE(); // size_t index
+        AttributeType type = (AttributeType)source.Read<unsigned char>();
+        Attribute::Skip(type, source);
+    }
+}
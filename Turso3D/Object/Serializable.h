@@ -5,12 +5,22 @@
 #include "Attribute.h"
 #include "Object.h"
 
+class JSONWriter;
 class ObjectResolver;
 
+/// Number of attribute changed marks. Attributes from the last index upward share the last mark.
+static const size_t MAX_DIRTY_ATTRIBUTES = 64;
+
 /// Base class for objects with automatic serialization using attributes.
 class Serializable : public Object
 {
 public:
+    /// Construct.
+    Serializable() :
+        dirtyAttributes(0)
+    {
+    }
+
     /// Load from binary stream. Store object ref attributes to be resolved later.
     virtual void Load(Stream& source, ObjectResolver& resolver);
     /// Save to binary stream.
@@ -19,21 +29,47 @@ public:
     virtual void LoadJSON(const JSONValue& source, ObjectResolver& resolver);
     /// Save as JSON data.
     virtual void SaveJSON(JSONValue& dest);
+    /// Write the attributes that are not default to a streaming JSON writer as object members.
+    void SaveJSONAttributes(JSONWriter& dest);
     /// Return id for referring to the object in serialization.
     virtual unsigned Id() const { return 0; }
+    /// Handle member attributes having been written directly. Called once after loading, or after setting each member attribute otherwise.
+    virtual void OnMemberAttributesSet() {}
+
+    /// Save the attributes marked changed to a binary stream as index and value pairs, then clear the marks.
+    void SaveDirtyAttributes(Stream& dest);
+    /// Load attributes saved with SaveDirtyAttributes(). Store object ref attributes to be resolved later.
+    void LoadDirtyAttributes(Stream& source, ObjectResolver& resolver);
+
+    /// Mark an attribute changed since the marks were last cleared, by index. Called by the attribute setters.
+    void MarkAttributeDirty(size_t index) { MarkAttributesDirty(1ULL << (index < MAX_DIRTY_ATTRIBUTES ? index : MAX_DIRTY_ATTRIBUTES - 1)); }
+    /// Mark attributes changed by a bitmask of indices.
+    void MarkAttributesDirty(unsigned long long mask)
+    {
+        bool wasClean = !dirtyAttributes;
+        dirtyAttributes |= mask;
+        if (wasClean && mask)
+            OnAttributesDirty();
+    }
+    /// Mark all attributes changed.
+    void MarkAttributesDirty() { MarkAttributesDirty(~0ULL); }
+    /// Clear the attribute changed marks.
+    void ClearDirtyAttributes() { dirtyAttributes = 0; }
+    /// Return the attribute changed marks as a bitmask of indices.
+    unsigned long long DirtyAttributes() const { return dirtyAttributes; }
 
-    /// Set attribute value from memory.
+    /// Set attribute value from memory and mark it changed.
     void SetAttributeValue(Attribute* attr, const void* source);
     /// Copy attribute value to memory.
     void AttributeValue(Attribute* attr, void* dest);
     
-    /// Set attribute value, template version. Return true if value was right type.
+    /// Set attribute value and mark it changed, template version. Return true if value was right type.
     template <class T> bool SetAttributeValue(Attribute* attr, const T& source)
     {
         AttributeImpl<T>* typedAttr = dynamic_cast<AttributeImpl<T>*>(attr);
         if (typedAttr)
         {
-            typedAttr->SetValue(this, source);
+            SetAttributeValue(attr, static_cast<const void*>(&source));
             return true;
         }
         else
@@ -62,6 +98,8 @@ public:
     
     /// Return the attribute descriptions. Default implementation uses per-class registration.
     virtual const std::vector<SharedPtr<Attribute> >* Attributes() const;
+    /// Return index of an attribute description, or the number of attributes if not found.
+    size_t AttributeIndex(Attribute* attr) const;
     /// Return an attribute description by name, or null if does not exist.
     Attribute* FindAttribute(const std::string& name) const;
     /// Return an attribute description by name, or null if does not exist.
@@ -75,6 +113,8 @@ public:
     static void CopyBaseAttribute(StringHash type, StringHash baseType, const std::string& name);
     /// Skip binary data of an object's all attributes.
     static void Skip(Stream& source);
+    /// Skip binary data saved with SaveDirtyAttributes().
+    static void SkipDirtyAttributes(Stream& source);
     
     /// Register a per-class attribute, template version. Should not be used for base class attributes unless the type is explicitly specified, as by default the attribute will be re-registered to the base class redundantly.
     template <class T, class U> static void RegisterAttribute(const char* name, U (T::*getFunction)() const, void (T::*setFunction)(U), const U& defaultValue = U(), const char** enumNames = 0)
@@ -94,6 +134,19 @@ public:
         RegisterAttribute(T::TypeStatic(), new AttributeImpl<U>(name, new MixedRefAttributeAccessorImpl<T, U>(getFunction, setFunction), defaultValue, enumNames));
     }
 
+    /// Register a per-class attribute accessed directly as a class member, template version. Binary load and save copy fixed-size members without going through the accessor, after which OnMemberAttributesSet() is called once. Should not be used for base class attributes unless the type is explicitly specified.
+    template <class T, class U> static void RegisterMemberAttribute(const char* name, U T::*member, const U& defaultValue = U(), const char** enumNames = 0)
+    {
+        Attribute* attr = new AttributeImpl<U>(name, new MemberAttributeAccessorImpl<T, U>(member), defaultValue, enumNames);
+        assert(attr->ByteSize() == sizeof(U));
+
+        // Offset from the Serializable base, which may differ from the class offset with multiple inheritance
+        alignas(T) static unsigned char dummy[sizeof(T)];
+        T* instance = reinterpret_cast<T*>(dummy);
+        attr->SetMemberOffset((size_t)(reinterpret_cast<unsigned char*>(&(instance->*member)) - reinterpret_cast<unsigned char*>(static_cast<Serializable*>(instance))));
+        RegisterAttribute(T::TypeStatic(), attr);
+    }
+
     /// Copy all base class attributes, template version.
     template <class T, class U> static void CopyBaseAttributes()
     {
@@ -106,7 +159,14 @@ public:
         CopyBaseAttribute(T::TypeStatic(), U::TypeStatic(), name);
     }
     
+protected:
+    /// Handle the first attribute being marked changed after the marks were cleared. Default implementation does nothing.
+    virtual void OnAttributesDirty() {}
+
 private:
+    /// Attribute changed marks.
+    unsigned long long dirtyAttributes;
+
     /// Per-class attributes.
     static std::map<StringHash, std::vector<SharedPtr<Attribute> > > classAttributes;
 };
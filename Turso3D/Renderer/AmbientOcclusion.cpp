@@ -0,0 +1,252 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Graphics.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/Texture.h"
+#include "../Math/Random.h"
+#include "AmbientOcclusion.h"
+#include "Camera.h"
+#include "FrameGraph.h"
+
+static const UniformSlot U_NOISEINVSIZE = ShaderProgram::RegisterUniform("noiseInvSize");
+static const UniformSlot U_NOISEOFFSET = ShaderProgram::RegisterUniform("noiseOffset");
+static const UniformSlot U_SCREENINVSIZE = ShaderProgram::RegisterUniform("screenInvSize");
+static const UniformSlot U_FRUSTUMSIZE = ShaderProgram::RegisterUniform("frustumSize");
+static const UniformSlot U_AOPARAMETERS = ShaderProgram::RegisterUniform("aoParameters");
+static const UniformSlot U_DEPTHRECONSTRUCT = ShaderProgram::RegisterUniform("depthReconstruct");
+static const UniformSlot U_VIEWTOPREVCLIP = ShaderProgram::RegisterUniform("viewToPrevClip");
+static const UniformSlot U_TEMPORALBLEND = ShaderProgram::RegisterUniform("temporalBlend");
+static const UniformSlot U_BLURPARAMETERS = ShaderProgram::RegisterUniform("blurParameters");
+static const UniformSlot U_BLURINVSIZE = ShaderProgram::RegisterUniform("blurInvSize");
+
+/// Work group size of the blur compute shader along the blur direction.
+static const int BLUR_GROUP_SIZE = 64;
+/// Weight of the current frame when accumulating over frames.
+static const float TEMPORAL_BLEND = 0.25f;
+/// Depth difference scale that stops the blur across edges.
+static const float BLUR_DEPTH_SHARPNESS = 20.0f;
+
+AmbientOcclusion::AmbientOcclusion() :
+    graphics(Object::Subsystem<Graphics>()),
+    parameters(0.15f, 1.0f, 0.015f, 0.15f),
+    lastViewProj(Matrix4::IDENTITY),
+    format(FMT_R8),
+    historyIndex(0),
+    frameNumber(0),
+    temporalAccumulation(false),
+    historyValid(false)
+{
+    assert(graphics && graphics->IsInitialized());
+
+    unsigned char noiseData[4 * 4 * 4];
+    for (int i = 0; i < 4 * 4; ++i)
+    {
+        Vector3 noiseVec(Random() * 2.0f - 1.0f, Random() * 2.0f - 1.0f, Random() * 2.0f - 1.0f);
+        noiseVec.Normalize();
+
+        noiseData[i * 4 + 0] = (unsigned char)(noiseVec.x * 127.0f + 128.0f);
+        noiseData[i * 4 + 1] = (unsigned char)(noiseVec.y * 127.0f + 128.0f);
+        noiseData[i * 4 + 2] = (unsigned char)(noiseVec.z * 127.0f + 128.0f);
+        noiseData[i * 4 + 3] = 0;
+    }
+
+    ImageLevel noiseDataLevel(IntVector2(4, 4), FMT_RGBA8, &noiseData[0]);
+    noiseTexture = new Texture();
+    noiseTexture->Define(TEX_2D, IntVector2(4, 4), FMT_RGBA8, 1, 1, &noiseDataLevel);
+    noiseTexture->DefineSampler(FILTER_POINT);
+}
+
+AmbientOcclusion::~AmbientOcclusion()
+{
+}
+
+unsigned AmbientOcclusion::AddPasses(FrameGraph* frameGraph, Camera* camera, unsigned color, unsigned depth, unsigned normal)
+{
+    const IntVector2& screenSize = frameGraph->Resources()[color].size;
+    IntVector2 halfSize(Max(screenSize.x / 2, 1), Max(screenSize.y / 2, 1));
+
+    float farClip = camera->FarClip();
+    float nearClip = camera->NearClip();
+    Vector3 nearVec, farVec;
+    camera->FrustumSize(nearVec, farVec);
+    Vector4 frustumSize(farVec, (float)screenSize.y / (float)screenSize.x);
+    Vector2 depthReconstruct(farClip / (farClip - nearClip), -nearClip / (farClip - nearClip));
+    Vector2 screenInvSize(1.0f / screenSize.x, 1.0f / screenSize.y);
+
+    // The depth and normals are linearized and downsampled once, the occlusion and blur passes then sample only the small texture
+    unsigned depthNormal = frameGraph->AddTexture("SSAODepthNormal", halfSize, FMT_RGBA16F);
+    unsigned downsamplePass = frameGraph->AddPass("SSAODownsample", [this, frameGraph, depth, normal, depthReconstruct]()
+    {
+        ShaderProgram* program = graphics->SetProgram("Shaders/SSAODownsample.glsl");
+        graphics->SetUniform(program, U_DEPTHRECONSTRUCT, depthReconstruct);
+        graphics->SetTexture(0, frameGraph->GetTexture(depth));
+        graphics->SetTexture(1, frameGraph->GetTexture(normal));
+        graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+        graphics->DrawQuad();
+        graphics->SetTexture(0, nullptr);
+        graphics->SetTexture(1, nullptr);
+    });
+    frameGraph->Read(downsamplePass, depth);
+    frameGraph->Read(downsamplePass, normal);
+    frameGraph->SetRenderTargets(downsamplePass, std::vector<unsigned>(1, depthNormal), FRAMEGRAPH_NONE, LOAD_DISCARD);
+
+    // With temporal accumulation the occlusion is rendered into the history texture of this frame, blending in the previous
+    unsigned ao;
+    unsigned history = FRAMEGRAPH_NONE;
+    float temporalBlend = 1.0f;
+    Matrix4 viewToPrevClip = Matrix4::IDENTITY;
+    Vector2 noiseOffset = Vector2::ZERO;
+    Matrix4 viewProj = camera->ProjectionMatrix() * camera->ViewMatrix();
+
+    if (temporalAccumulation)
+    {
+        DefineHistory(halfSize);
+        historyIndex ^= 1;
+        ao = frameGraph->ImportTexture("SSAOHistory", historyTextures[historyIndex]);
+        history = frameGraph->ImportTexture("SSAOPrevHistory", historyTextures[historyIndex ^ 1]);
+
+        if (historyValid)
+        {
+            temporalBlend = TEMPORAL_BLEND;
+            viewToPrevClip = lastViewProj * camera->ViewMatrix().Inverse();
+        }
+
+        // Cycle through the 16 offsets of the noise texture
+        noiseOffset = Vector2((frameNumber & 3) * 0.25f, ((frameNumber >> 2) & 3) * 0.25f);
+        ++frameNumber;
+        lastViewProj = viewProj;
+        historyValid = true;
+    }
+    else
+    {
+        ao = frameGraph->AddTexture("SSAO", halfSize, format);
+        historyValid = false;
+    }
+
+    std::string aoDefines = temporalAccumulation ? "TEMPORAL" : "";
+    unsigned aoPass = frameGraph->AddPass("SSAO", [this, frameGraph, depthNormal, history, halfSize, screenInvSize, frustumSize,
+        noiseOffset, viewToPrevClip, temporalBlend, aoDefines]()
+    {
+        ShaderProgram* program = graphics->SetProgram("Shaders/SSAO.glsl", "", aoDefines);
+        graphics->SetUniform(program, U_NOISEINVSIZE, Vector2(halfSize.x / 4.0f, halfSize.y / 4.0f));
+        graphics->SetUniform(program, U_NOISEOFFSET, noiseOffset);
+        graphics->SetUniform(program, U_SCREENINVSIZE, screenInvSize);
+        graphics->SetUniform(program, U_FRUSTUMSIZE, frustumSize);
+        graphics->SetUniform(program, U_AOPARAMETERS, parameters);
+        graphics->SetTexture(0, frameGraph->GetTexture(depthNormal));
+        graphics->SetTexture(1, noiseTexture);
+        if (history != FRAMEGRAPH_NONE)
+        {
+            graphics->SetUniform(program, U_VIEWTOPREVCLIP, viewToPrevClip);
+            graphics->SetUniform(program, U_TEMPORALBLEND, temporalBlend);
+            graphics->SetTexture(2, frameGraph->GetTexture(history));
+        }
+        graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+        graphics->DrawQuad();
+        graphics->SetTexture(0, nullptr);
+        graphics->SetTexture(1, nullptr);
+        graphics->SetTexture(2, nullptr);
+    });
+    frameGraph->Read(aoPass, depthNormal);
+    if (history != FRAMEGRAPH_NONE)
+        frameGraph->Read(aoPass, history);
+    frameGraph->SetRenderTargets(aoPass, std::vector<unsigned>(1, ao), FRAMEGRAPH_NONE, LOAD_DISCARD);
+
+    // Separable depth-aware blur in two compute passes. Without compute shader support, the apply pass blurs with a small box filter instead
+    unsigned blurred = ao;
+    if (graphics->HasComputeShaders())
+    {
+        std::string blurDefines = format == FMT_R16F ? "FLOAT16" : "";
+        unsigned blurX = frameGraph->AddTexture("SSAOBlurX", halfSize, format);
+        unsigned blurY = frameGraph->AddTexture("SSAOBlurY", halfSize, format);
+
+        for (unsigned i = 0; i < 2; ++i)
+        {
+            bool horizontal = i == 0;
+            unsigned src = horizontal ? ao : blurX;
+            unsigned dest = horizontal ? blurX : blurY;
+            std::string defines = horizontal ? blurDefines + " HORIZONTAL" : blurDefines;
+
+            unsigned blurPass = frameGraph->AddPass(horizontal ? "SSAOBlurX" : "SSAOBlurY", [this, frameGraph, src, dest, depthNormal, halfSize,
+                horizontal, defines]()
+            {
+                ShaderProgram* program = graphics->SetComputeProgram("Shaders/SSAOBilateral.glsl", defines);
+                if (!program)
+                    return;
+
+                graphics->SetUniform(program, U_BLURPARAMETERS, Vector4(BLUR_DEPTH_SHARPNESS, 0.0f, 0.0f, 0.0f));
+                graphics->SetTexture(0, frameGraph->GetTexture(src));
+                graphics->SetTexture(1, frameGraph->GetTexture(depthNormal));
+                frameGraph->GetTexture(dest)->BindImage(0, IMAGE_WRITE);
+                if (horizontal)
+                    graphics->DispatchCompute(IntVector3((halfSize.x + BLUR_GROUP_SIZE - 1) / BLUR_GROUP_SIZE, halfSize.y, 1));
+                else
+                    graphics->DispatchCompute(IntVector3(halfSize.x, (halfSize.y + BLUR_GROUP_SIZE - 1) / BLUR_GROUP_SIZE, 1));
+                graphics->SetTexture(0, nullptr);
+                graphics->SetTexture(1, nullptr);
+
+                // The result is sampled by the next pass
+                graphics->ComputeBarrier();
+            });
+            frameGraph->Read(blurPass, src);
+            frameGraph->Read(blurPass, depthNormal);
+            frameGraph->Write(blurPass, dest);
+        }
+
+        blurred = blurY;
+    }
+
+    // Darken the opaque geometry. The depth buffer stays bound so that the alpha pass can continue on the same targets
+    bool boxBlur = blurred == ao;
+    unsigned applyPass = frameGraph->AddPass("SSAOApply", [this, frameGraph, blurred, boxBlur]()
+    {
+        Texture* aoTexture = frameGraph->GetTexture(blurred);
+        ShaderProgram* program = graphics->SetProgram(boxBlur ? "Shaders/SSAOBlur.glsl" : "Shaders/SSAOApply.glsl");
+        if (boxBlur)
+            graphics->SetUniform(program, U_BLURINVSIZE, Vector2(1.0f / aoTexture->Width(), 1.0f / aoTexture->Height()));
+        graphics->SetTexture(0, aoTexture);
+        graphics->SetRenderState(BLEND_SUBTRACT, CULL_NONE, CMP_ALWAYS, true, false);
+        graphics->DrawQuad();
+        graphics->SetTexture(0, nullptr);
+    });
+    frameGraph->Read(applyPass, blurred);
+    frameGraph->SetRenderTargets(applyPass, std::vector<unsigned>(1, color), depth);
+
+    return applyPass;
+}
+
+void AmbientOcclusion::SetParameters(const Vector4& parameters_)
+{
+    parameters = parameters_;
+}
+
+void AmbientOcclusion::SetFormat(ImageFormat format_)
+{
+    format = format_ == FMT_R16F ? FMT_R16F : FMT_R8;
+}
+
+void AmbientOcclusion::SetTemporalAccumulation(bool enable)
+{
+    temporalAccumulation = enable;
+    historyValid = false;
+}
+
+void AmbientOcclusion::ResetHistory()
+{
+    historyValid = false;
+}
+
+void AmbientOcclusion::DefineHistory(const IntVector2& size)
+{
+    for (size_t i = 0; i < 2; ++i)
+    {
+        if (historyTextures[i] && historyTextures[i]->Size2D() == size && historyTextures[i]->Format() == format)
+            continue;
+
+        if (!historyTextures[i])
+            historyTextures[i] = new Texture();
+        historyTextures[i]->Define(TEX_2D, size, format);
+        historyTextures[i]->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+        historyValid = false;
+    }
+}
@@ -0,0 +1,67 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntVector2.h"
+#include "../Math/Matrix4.h"
+#include "../Math/Vector4.h"
+#include "../Object/Ptr.h"
+#include "../Resource/Image.h"
+
+class Camera;
+class FrameGraph;
+class Graphics;
+class Texture;
+
+/// Screen-space ambient occlusion post-process stage. Downsamples the depth and view-space normals to half resolution once, renders the occlusion from them, blurs it with a separable depth-aware compute blur and subtracts it from the opaque color. Optionally accumulates the occlusion over frames to use fewer samples per frame.
+class AmbientOcclusion : public RefCounted
+{
+public:
+    /// Construct. Graphics subsystem must have been initialized.
+    AmbientOcclusion();
+    /// Destruct.
+    ~AmbientOcclusion();
+
+    /// Add the passes to a frame graph, to execute after the opaque pass has written the color, depth and normal resources. The camera is the one the opaque pass was rendered with. Return the last pass index.
+    unsigned AddPasses(FrameGraph* frameGraph, Camera* camera, unsigned color, unsigned depth, unsigned normal);
+    /// Set the occlusion parameters: sampling radius in view units, depth falloff, strength and maximum screen-space radius.
+    void SetParameters(const Vector4& parameters);
+    /// Set the occlusion texture format, FMT_R8 (default) or FMT_R16F.
+    void SetFormat(ImageFormat format);
+    /// Set whether to accumulate the occlusion over frames, halving the samples per frame. Disabled by default.
+    void SetTemporalAccumulation(bool enable);
+    /// Discard the accumulated occlusion, for example after a camera cut.
+    void ResetHistory();
+
+    /// Return the occlusion parameters.
+    const Vector4& Parameters() const { return parameters; }
+    /// Return the occlusion texture format.
+    ImageFormat Format() const { return format; }
+    /// Return whether accumulates the occlusion over frames.
+    bool TemporalAccumulation() const { return temporalAccumulation; }
+
+private:
+    /// Define the history textures for the half resolution size if necessary.
+    void DefineHistory(const IntVector2& size);
+
+    /// Graphics subsystem.
+    Graphics* graphics;
+    /// Random noise texture for rotating the samples.
+    AutoPtr<Texture> noiseTexture;
+    /// Occlusion of the current and previous frame for temporal accumulation, used in turns.
+    AutoPtr<Texture> historyTextures[2];
+    /// Occlusion parameters.
+    Vector4 parameters;
+    /// View-projection matrix of the previous frame.
+    Matrix4 lastViewProj;
+    /// Occlusion texture format.
+    ImageFormat format;
+    /// Index of the history texture written this frame.
+    unsigned historyIndex;
+    /// Frame counter for varying the noise.
+    unsigned frameNumber;
+    /// Temporal accumulation flag.
+    bool temporalAccumulation;
+    /// Whether the previous frame's history is valid.
+    bool historyValid;
+};
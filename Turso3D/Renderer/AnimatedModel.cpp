@@ -1,22 +1,93 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
-#include "../Graphics/GraphicsDefs.h"
+#include "../Graphics/Graphics.h"
+#include "../Graphics/ShaderProgram.h"
 #include "../Graphics/UniformBuffer.h"
+#include "../Graphics/VertexBuffer.h"
 #include "../IO/Log.h"
 #include "../Math/Ray.h"
 #include "../Resource/ResourceCache.h"
 #include "AnimatedModel.h"
 #include "Animation.h"
 #include "AnimationState.h"
+#include "Camera.h"
 #include "DebugRenderer.h"
 #include "Model.h"
 #include "Octree.h"
 
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 #include <tracy/Tracy.hpp>
 
+static const UniformSlot U_VERTEXLAYOUT = ShaderProgram::RegisterUniform("vertexLayout");
+static const UniformSlot U_ELEMENTOFFSETS = ShaderProgram::RegisterUniform("elementOffsets");
+
+static Vector3 DOT_SCALE(1 / 3.0f, 1 / 3.0f, 1 / 3.0f);
+static const size_t BONE_BOX_BATCH_SIZE = 64;
+
 static Allocator<AnimatedModelDrawable> drawableAllocator;
 
+bool AnimatedModelDrawable::computeSkinning = false;
+bool AnimatedModelDrawable::verticesSkinned = false;
+
+/// Pose evaluated once per frame and shared by the animated models with the same animation states in animation sharing mode.
+struct SharedAnimationPose
+{
+    /// Animation state key.
+    std::vector<size_t> key;
+    /// Local bone transforms.
+    AnimationPose pose;
+    /// Model space bone transforms.
+    std::vector<Matrix3x4> boneTransforms;
+    /// Evaluation finished flag.
+    std::atomic<bool> ready;
+};
+
+static std::mutex sharedPoseMutex;
+static std::unordered_map<size_t, SharedAnimationPose*> sharedPoses;
+static std::vector<AutoPtr<SharedAnimationPose> > sharedPosePool;
+static size_t numSharedPoses = 0;
+static unsigned short sharedPoseFrameNumber = 0;
+
+/// Return the shared pose of an animation state key on this frame if already evaluated, or claim a new one for the caller to evaluate. Return null if another model is still evaluating it, or on a hash collision.
+static SharedAnimationPose* AcquireSharedPose(const std::vector<size_t>& key, unsigned short frameNumber, bool& claimed)
+{
+    size_t hash = 0;
+    for (auto it = key.begin(); it != key.end(); ++it)
+        hash ^= *it + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+    claimed = false;
+
+    std::lock_guard<std::mutex> lock(sharedPoseMutex);
+
+    // Animation is updated only during view preparation, so the poses of the previous frame are no longer in use
+    if (frameNumber != sharedPoseFrameNumber)
+    {
+        sharedPoses.clear();
+        numSharedPoses = 0;
+        sharedPoseFrameNumber = frameNumber;
+    }
+
+    auto it = sharedPoses.find(hash);
+    if (it != sharedPoses.end())
+    {
+        SharedAnimationPose* sharedPose = it->second;
+        return sharedPose->ready.load(std::memory_order_acquire) && sharedPose->key == key ? sharedPose : nullptr;
+    }
+
+    if (numSharedPoses == sharedPosePool.size())
+        sharedPosePool.push_back(new SharedAnimationPose());
+
+    SharedAnimationPose* sharedPose = sharedPosePool[numSharedPoses++];
+    sharedPose->key = key;
+    sharedPose->ready.store(false, std::memory_order_relaxed);
+    sharedPoses[hash] = sharedPose;
+    claimed = true;
+    return sharedPose;
+}
+
 Bone::Bone() :
     drawable(nullptr),
     animationEnabled(true),
@@ -61,9 +132,9 @@ void Bone::OnTransformChanged()
 {
     SpatialNode::OnTransformChanged();
 
-    // Avoid duplicate dirtying calls if model's skinning is already dirty. Do not signal changes either during animation update,
+    // Avoid duplicate dirtying calls if the model's bone transforms are already dirty. Do not signal changes either during animation update,
     // as the model will set the hierarchy dirty when finished. This is also used to optimize when only the model node moves.
-    if (drawable && !(drawable->AnimatedModelFlags() & (AMF_IN_ANIMATION_UPDATE | AMF_SKINNING_DIRTY)))
+    if (drawable && !(drawable->AnimatedModelFlags() & (AMF_IN_ANIMATION_UPDATE | AMF_BONE_TRANSFORMS_DIRTY)))
         drawable->OnBoneTransformChanged();
 }
 
@@ -76,9 +147,21 @@ AnimatedModelDrawable::AnimatedModelDrawable() :
     animatedModelFlags(0),
     numBones(0),
     octree(nullptr),
-    rootBone(nullptr)
+    rootBone(nullptr),
+    animationLodDistance(0.0f),
+    animationLodLevel(0),
+    lodInterpolationFrames(0),
+    lodInterpolationFrame(0),
+    lodFrameNumber(0),
+    lodFramePhase((unsigned short)((size_t)this / sizeof(AnimatedModelDrawable))),
+    computeSkinned(false),
+    morphWeightsDirty(false),
+    crowdLodDistance(0.0f),
+    crowdLodFrameNumber(0)
 {
     SetFlag(DF_SKINNED_GEOMETRY | DF_OCTREE_UPDATE_CALL, true);
+    // Animated models have their own preparation
+    drawableType = DT_OTHER;
 }
 
 void AnimatedModelDrawable::OnWorldBoundingBoxUpdate() const
@@ -89,23 +172,37 @@ void AnimatedModelDrawable::OnWorldBoundingBoxUpdate() const
         if (animatedModelFlags & AMF_BONE_BOUNDING_BOX_DIRTY)
         {
             const std::vector<ModelBone>& modelBones = model->Bones();
+            const BoundingBox* localBoxes = model->BoneBoundingBoxes().data();
+            bool allActive = model->AllBonesActive();
 
-            if (modelBones[0].active)
-                worldBoundingBox = modelBones[0].boundingBox.Transformed(bones[0]->WorldTransform());
-            else
-                worldBoundingBox.Undefine();
+            if (animatedModelFlags & AMF_BONE_TRANSFORMS_DIRTY)
+                UpdateBoneTransforms(false);
 
-            for (size_t i = 1; i < numBones; ++i)
+            boneBoundingBox.Undefine();
+
+            // Transform and merge in batches that fit on the stack
+            BoundingBox boneBoxes[BONE_BOX_BATCH_SIZE];
+            for (size_t start = 0; start < numBones; start += BONE_BOX_BATCH_SIZE)
             {
-                if (modelBones[i].active)
-                    worldBoundingBox.Merge(modelBones[i].boundingBox.Transformed(bones[i]->WorldTransform()));
+                size_t count = numBones - start < BONE_BOX_BATCH_SIZE ? numBones - start : BONE_BOX_BATCH_SIZE;
+                TransformBoundingBoxes(localBoxes + start, boneTransforms.Get() + start, boneBoxes, count);
+
+                if (allActive)
+                    MergeBoundingBoxes(boneBoundingBox, boneBoxes, count);
+                else
+                {
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        if (modelBones[start + i].active)
+                            boneBoundingBox.Merge(boneBoxes[i]);
+                    }
+                }
             }
 
-            boneBoundingBox = worldBoundingBox.Transformed(WorldTransform().Inverse());
             animatedModelFlags &= ~AMF_BONE_BOUNDING_BOX_DIRTY;
         }
-        else
-            worldBoundingBox = boneBoundingBox.Transformed(WorldTransform());
+
+        worldBoundingBox = boneBoundingBox.Transformed(WorldTransform());
 
         SetFlag(DF_BOUNDING_BOX_DIRTY, false);
     }
@@ -113,12 +210,19 @@ void AnimatedModelDrawable::OnWorldBoundingBoxUpdate() const
         Drawable::OnWorldBoundingBoxUpdate();
 }
 
+const BoundingBox* AnimatedModelDrawable::LocalBoundingBox() const
+{
+    return (model && numBones && !(animatedModelFlags & AMF_BONE_BOUNDING_BOX_DIRTY)) ? &boneBoundingBox : nullptr;
+}
+
 void AnimatedModelDrawable::OnOctreeUpdate(unsigned short frameNumber)
 {
+    MEMORY_SCOPE(MEMORY_ANIMATION);
+
     if (TestFlag(DF_UPDATE_INVISIBLE) || WasInView(frameNumber))
     {
-        if (animatedModelFlags & AMF_ANIMATION_DIRTY)
-            UpdateAnimation();
+        if (animatedModelFlags & (AMF_ANIMATION_DIRTY | AMF_ANIMATION_LOD_INTERPOLATION))
+            UpdateAnimationLod(frameNumber);
 
         if (animatedModelFlags & AMF_SKINNING_DIRTY)
             UpdateSkinning();
@@ -127,12 +231,53 @@ void AnimatedModelDrawable::OnOctreeUpdate(unsigned short frameNumber)
 
 bool AnimatedModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
 {
+    // Beyond the crowd LOD distance, hand over to the crowd without animating or rendering. Shadow casters may be prepared again in the same view
+    if (crowdLodDistance > 0.0f && crowdLod)
+    {
+        if (crowdLodFrameNumber == frameNumber)
+            return false;
+
+        float crowdDistance = camera->Distance(WorldBoundingBox().Center());
+        if ((maxDistance <= 0.0f || crowdDistance <= maxDistance) && camera->LodDistance(crowdDistance, WorldScale().DotProduct(DOT_SCALE), lodBias) > crowdLodDistance &&
+            static_cast<CrowdDrawable*>(crowdLod->GetDrawable())->AddLodInstance(WorldTransform(), animationStates))
+        {
+            distance = crowdDistance;
+            crowdLodFrameNumber = frameNumber;
+            return false;
+        }
+    }
+
+    // Let the LOD level check see the source geometries, then switch to their compute skinned or morphed versions
+    if (skinnedGeometries.size())
+        SetReplacedGeometries(skinnedGeometries, false);
+    if (morphedGeometries.size())
+        SetReplacedGeometries(morphedGeometries, false);
+
     if (!StaticModelDrawable::OnPrepareRender(frameNumber, camera))
         return false;
 
-    // Update animation here too if just came into view and animation / skinning is still dirty
-    if (animatedModelFlags & AMF_ANIMATION_DIRTY)
-        UpdateAnimation();
+    // LOD crossfade is not supported, as the faded out level would have no skinning
+    SetFlag(DF_LOD_FADE, false);
+
+    if (computeSkinned)
+        SetReplacedGeometries(skinnedGeometries, true);
+    else if (morphedGeometries.size())
+        SetReplacedGeometries(morphedGeometries, true);
+
+    // Choose the animation LOD level. It takes effect for the next update
+    if (animationLodDistance > 0.0f)
+    {
+        float lodDistance = camera->LodDistance(distance, WorldScale().DotProduct(DOT_SCALE), lodBias);
+        animationLodLevel = 0;
+        for (float levelDistance = animationLodDistance; lodDistance > levelDistance && animationLodLevel < MAX_ANIMATION_LOD_LEVEL; levelDistance *= 2.0f)
+            ++animationLodLevel;
+    }
+    else
+        animationLodLevel = 0;
+
+    // Update animation here too if just came into view and animation / skinning is still dirty, or if interpolating
+    if (animatedModelFlags & (AMF_ANIMATION_DIRTY | AMF_ANIMATION_LOD_INTERPOLATION))
+        UpdateAnimationLod(frameNumber);
 
     if (animatedModelFlags & AMF_SKINNING_DIRTY)
         UpdateSkinning();
@@ -140,8 +285,17 @@ bool AnimatedModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera*
     return true;
 }
 
-void AnimatedModelDrawable::OnRender(ShaderProgram*, size_t)
+void AnimatedModelDrawable::OnUpdateGPUData()
 {
+    // Morph before skinning, as compute skinning reads the morphed vertices
+    if (morphWeightsDirty)
+    {
+        MorphVertices();
+        morphWeightsDirty = false;
+        if (computeSkinned)
+            animatedModelFlags |= AMF_SKINNING_BUFFER_DIRTY;
+    }
+
     if (!skinMatrixBuffer || !numBones)
         return;
 
@@ -149,9 +303,42 @@ void AnimatedModelDrawable::OnRender(ShaderProgram*, size_t)
     {
         skinMatrixBuffer->SetData(0, numBones * sizeof(Matrix3x4), skinMatrices);
         animatedModelFlags &= ~AMF_SKINNING_BUFFER_DIRTY;
+
+        // The batches were collected with the current mode, so skin for them before switching
+        if (computeSkinned)
+            SkinVertices();
+    }
+
+    // Switch skinning mode. The batches pick up the change on the next frame, so the output vertices must be valid already
+    if (computeSkinned != computeSkinning)
+    {
+        computeSkinned = computeSkinning && CreateSkinnedGeometries();
+        if (computeSkinned)
+            SkinVertices();
+
+        SetFlag(DF_GEOMETRY_TYPE_BITS, false);
+        SetFlag(computeSkinned ? DF_CUSTOM_GEOMETRY : DF_SKINNED_GEOMETRY, true);
     }
+}
+
+void AnimatedModelDrawable::OnRender(ShaderProgram* program, size_t)
+{
+    // Skin matrices were already uploaded when the view was captured, so that next frame's animation does not race with rendering
+    if (!skinMatrixBuffer || !numBones)
+        return;
 
     skinMatrixBuffer->Bind(UB_SKINMATRICES);
+
+    // Compute skinned vertices are already in world space. The uniform only exists in the programs of custom geometry type, which the
+    // batches may still use on the frame after switching mode
+    if (skinnedVertexBuffers.size())
+        Object::Subsystem<Graphics>()->SetUniform(program, U_WORLDMATRIX, Matrix3x4::IDENTITY);
+}
+
+const Matrix3x4* AnimatedModelDrawable::SkinMatrices(size_t& numMatrices) const
+{
+    numMatrices = numBones;
+    return numBones ? skinMatrices.Get() : nullptr;
 }
 
 void AnimatedModelDrawable::OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance_)
@@ -163,13 +350,14 @@ void AnimatedModelDrawable::OnRaycast(std::vector<RaycastResult>& dest, const Ra
 
         // Perform raycast against each bone in its local space
         const std::vector<ModelBone>& modelBones = model->Bones();
+        const Matrix3x4& modelTransform = WorldTransform();
 
         for (size_t i = 0; i < numBones; ++i)
         {
             if (!modelBones[i].active)
                 continue;
 
-            const Matrix3x4& transform = bones[i]->WorldTransform();
+            Matrix3x4 transform = modelTransform * BoneTransform(i);
             Ray localRay = ray.Transformed(transform.Inverse());
             float localDistance = localRay.HitDistance(modelBones[i].boundingBox);
 
@@ -196,16 +384,26 @@ void AnimatedModelDrawable::OnRaycast(std::vector<RaycastResult>& dest, const Ra
     }
 }
 
+void AnimatedModelDrawable::OnRasterizeOcclusion(OcclusionRasterizer*, unsigned)
+{
+}
+
 void AnimatedModelDrawable::OnRenderDebug(DebugRenderer* debug)
 {
     debug->AddBoundingBox(WorldBoundingBox(), Color::GREEN, false);
 
+    if (!model)
+        return;
+
+    const std::vector<ModelBone>& modelBones = model->Bones();
+    const Matrix3x4& modelTransform = WorldTransform();
+
     for (size_t i = 0; i < numBones; ++i)
     {
         // Skip the root bone, as it has no sensible connection point
-        Bone* bone = bones[i];
-        if (bone != rootBone)
-            debug->AddLine(bone->WorldPosition(), bone->SpatialParent()->WorldPosition(), Color::WHITE, false);
+        size_t parentIndex = modelBones[i].parentIndex;
+        if (parentIndex != i)
+            debug->AddLine(modelTransform * BoneTransform(i).Translation(), modelTransform * BoneTransform(parentIndex).Translation(), Color::WHITE, false);
     }
 }
 
@@ -213,6 +411,22 @@ void AnimatedModelDrawable::CreateBones()
 {
     ZoneScoped;
 
+    // The compute skinning buffers refer to the previous model's geometries. They are recreated on the next GPU data update
+    skinnedVertexBuffers.clear();
+    skinnedGeometries.clear();
+    if (computeSkinned)
+    {
+        computeSkinned = false;
+        SetFlag(DF_GEOMETRY_TYPE_BITS, false);
+        SetFlag(DF_SKINNED_GEOMETRY, true);
+    }
+
+    morphedVertexBuffers.clear();
+    morphedGeometries.clear();
+    morphWeightBuffer.Reset();
+    morphWeights.assign(model ? (model->Morphs().size() + 3) & ~(size_t)3 : 0, 0.0f);
+    morphWeightsDirty = false;
+
     if (!model)
     {
         skinMatrixBuffer.Reset();
@@ -227,7 +441,12 @@ void AnimatedModelDrawable::CreateBones()
     numBones = (unsigned short)modelBones.size();
 
     bones = new Bone*[numBones];
+    boneOrder = new unsigned short[numBones];
+    boneTransforms = new Matrix3x4[numBones];
+    lodBoneTransforms.Reset();
+    animatedModelFlags &= ~AMF_ANIMATION_LOD_INTERPOLATION;
     skinMatrices = new Matrix3x4[numBones];
+    poseBuffer.Resize(numBones);
 
     for (size_t i = 0; i < modelBones.size(); ++i)
     {
@@ -265,9 +484,41 @@ void AnimatedModelDrawable::CreateBones()
     for (size_t i = 0; i < modelBones.size(); ++i)
         bones[i]->CountChildBones();
 
-    if (!skinMatrixBuffer)
-        skinMatrixBuffer = new UniformBuffer();
-    skinMatrixBuffer->Define(USAGE_DYNAMIC, numBones * sizeof(Matrix3x4));
+    // Order the bones parents first for the flat hierarchy pass. Usually the model already is, in which case one round suffices
+    std::vector<bool> ordered(numBones, false);
+    size_t numOrdered = 0;
+    while (numOrdered < numBones)
+    {
+        size_t oldNumOrdered = numOrdered;
+
+        for (size_t i = 0; i < numBones; ++i)
+        {
+            size_t parentIndex = modelBones[i].parentIndex;
+            if (!ordered[i] && (parentIndex == i || ordered[parentIndex]))
+            {
+                ordered[i] = true;
+                boneOrder[numOrdered++] = (unsigned short)i;
+            }
+        }
+
+        // Bail out of a malformed (cyclic) skeleton by appending the rest as is
+        if (numOrdered == oldNumOrdered)
+        {
+            for (size_t i = 0; i < numBones; ++i)
+            {
+                if (!ordered[i])
+                    boneOrder[numOrdered++] = (unsigned short)i;
+            }
+        }
+    }
+
+    // Without the Graphics subsystem the animation and skin matrices are still updated, but nothing is uploaded
+    if (Object::Subsystem<Graphics>())
+    {
+        if (!skinMatrixBuffer)
+            skinMatrixBuffer = new UniformBuffer();
+        skinMatrixBuffer->Define(USAGE_DYNAMIC, numBones * sizeof(Matrix3x4));
+    }
 
     // Set initial bone bounding box recalculation and skinning dirty
     OnBoneTransformChanged();
@@ -280,32 +531,75 @@ void AnimatedModelDrawable::UpdateAnimation()
     if (animatedModelFlags & AMF_ANIMATION_ORDER_DIRTY)
         std::sort(animationStates.begin(), animationStates.end(), CompareAnimationStates);
 
-    animatedModelFlags |= AMF_IN_ANIMATION_UPDATE | AMF_BONE_BOUNDING_BOX_DIRTY;
+    // At low animation LOD keep the previous bone bounding box
+    animatedModelFlags |= AMF_IN_ANIMATION_UPDATE;
+    if (animationLodLevel < 2)
+        animatedModelFlags |= AMF_BONE_BOUNDING_BOX_DIRTY;
+    poseBuffer.skipLeafBones = animationLodLevel >= 2;
+
+    // In animation sharing mode, copy the pose if another model with the same animation states has already evaluated it on this frame
+    AnimationPose& pose = poseBuffer.pose;
+    SharedAnimationPose* sharedPose = nullptr;
+    bool claimed = false;
+    if (poseBuffer.timeStep > 0.0f && BuildSharedPoseKey())
+        sharedPose = AcquireSharedPose(sharedPoseKey, lodFrameNumber, claimed);
+
+    if (sharedPose && !claimed)
+        pose.data = sharedPose->pose.data;
+    else
+    {
+        // Reset the flat pose to initial, or to the programmatic transform of bones with animation disabled, then apply animations
+        const std::vector<ModelBone>& modelBones = model->Bones();
+
+        for (size_t i = 0; i < numBones; ++i)
+        {
+            Bone* bone = bones[i];
+            const ModelBone& modelBone = modelBones[i];
+            if (bone->AnimationEnabled())
+                pose.SetTransform(i, modelBone.initialPosition, modelBone.initialRotation, modelBone.initialScale);
+            else
+                pose.SetTransform(i, bone->Position(), bone->Rotation(), bone->Scale());
+        }
 
-    // Reset bones to initial pose, then apply animations
-    const std::vector<ModelBone>& modelBones = model->Bones();
+        for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+        {
+            AnimationState* state = *it;
+            if (state->Enabled())
+                state->ApplyToPose(poseBuffer);
+        }
+    }
 
+    // Write the pose back to the bone nodes and dirty the bone hierarchy now. This will also dirty and queue reinsertion for attached models.
+    // The bone nodes' own world transforms are evaluated lazily only if queried
     for (size_t i = 0; i < numBones; ++i)
     {
         Bone* bone = bones[i];
-        const ModelBone& modelBone = modelBones[i];
         if (bone->AnimationEnabled())
-            bone->SetTransformSilent(modelBone.initialPosition, modelBone.initialRotation, modelBone.initialScale);
+            bone->SetTransformSilent(pose.Position(i), pose.Rotation(i), pose.Scale(i));
     }
 
-    for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+    SetBoneTransformsDirty();
+
+    if (sharedPose && !claimed)
     {
-        AnimationState* state = *it;
-        if (state->Enabled())
-            state->Apply();
+        std::copy(sharedPose->boneTransforms.begin(), sharedPose->boneTransforms.end(), boneTransforms.Get());
+        animatedModelFlags &= ~AMF_BONE_TRANSFORMS_DIRTY;
     }
+    else
+    {
+        UpdateBoneTransforms(true);
 
-    // Dirty the bone hierarchy now. This will also dirty and queue reinsertion for attached models
-    SetBoneTransformsDirty();
+        if (sharedPose)
+        {
+            sharedPose->pose.data = pose.data;
+            sharedPose->boneTransforms.assign(boneTransforms.Get(), boneTransforms.Get() + numBones);
+            sharedPose->ready.store(true, std::memory_order_release);
+        }
+    }
 
     animatedModelFlags &= ~(AMF_ANIMATION_ORDER_DIRTY | AMF_ANIMATION_DIRTY | AMF_IN_ANIMATION_UPDATE);
 
-    // Update bounding box already here to take advantage of threaded update, and also to update bone world transforms for skinning
+    // Update bounding box already here to take advantage of threaded update
     OnWorldBoundingBoxUpdate();
 
     // If updating only when visible, queue octree reinsertion for next frame. This also ensures shadowmap rendering happens correctly
@@ -319,19 +613,125 @@ void AnimatedModelDrawable::UpdateAnimation()
     animatedModelFlags |= AMF_SKINNING_DIRTY;
 }
 
+bool AnimatedModelDrawable::BuildSharedPoseKey()
+{
+    for (size_t i = 0; i < numBones; ++i)
+    {
+        if (!bones[i]->AnimationEnabled())
+            return false;
+    }
+
+    // The result depends on the model's skeleton, whether leaf bones are skipped, and the states in blending order
+    sharedPoseKey.clear();
+    sharedPoseKey.push_back((size_t)model.Get());
+    sharedPoseKey.push_back(poseBuffer.skipLeafBones ? 1 : 0);
+
+    for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+    {
+        AnimationState* state = *it;
+        if (!state->Enabled())
+            continue;
+        if (!state->IsShareable())
+            return false;
+
+        sharedPoseKey.push_back((size_t)state->GetAnimation());
+        sharedPoseKey.push_back((size_t)floorf(state->Time() / poseBuffer.timeStep + 0.5f) * 2 + (state->Looped() ? 1 : 0));
+        sharedPoseKey.push_back((size_t)(state->Weight() * 255.0f + 0.5f));
+    }
+
+    return true;
+}
+
+void AnimatedModelDrawable::UpdateAnimationLod(unsigned short frameNumber)
+{
+    // May be called both from octree update and render preparation
+    if (lodFrameNumber == frameNumber)
+        return;
+    lodFrameNumber = frameNumber;
+
+    if (animatedModelFlags & AMF_ANIMATION_DIRTY)
+    {
+        unsigned short interval = (unsigned short)(1 << animationLodLevel);
+
+        if (interval == 1)
+        {
+            UpdateAnimation();
+            animatedModelFlags &= ~AMF_ANIMATION_LOD_INTERPOLATION;
+            return;
+        }
+        else if (!((frameNumber + lodFramePhase) & (interval - 1)))
+        {
+            // Interpolate from the currently shown bone transforms to the new animation over the update interval
+            if (!lodBoneTransforms)
+                lodBoneTransforms = new Matrix3x4[numBones * 2];
+
+            if (animatedModelFlags & AMF_BONE_TRANSFORMS_DIRTY)
+                UpdateBoneTransforms(false);
+            for (size_t i = 0; i < numBones; ++i)
+                lodBoneTransforms[i] = boneTransforms[i];
+
+            UpdateAnimation();
+
+            for (size_t i = 0; i < numBones; ++i)
+                lodBoneTransforms[numBones + i] = boneTransforms[i];
+
+            lodInterpolationFrames = (unsigned char)interval;
+            lodInterpolationFrame = 0;
+            animatedModelFlags |= AMF_ANIMATION_LOD_INTERPOLATION;
+        }
+    }
+
+    if (animatedModelFlags & AMF_ANIMATION_LOD_INTERPOLATION)
+    {
+        ++lodInterpolationFrame;
+        float t = (float)lodInterpolationFrame / (float)lodInterpolationFrames;
+
+        for (size_t i = 0; i < numBones; ++i)
+            boneTransforms[i] = lodBoneTransforms[i] * (1.0f - t) + lodBoneTransforms[numBones + i] * t;
+
+        if (lodInterpolationFrame >= lodInterpolationFrames)
+            animatedModelFlags &= ~AMF_ANIMATION_LOD_INTERPOLATION;
+
+        animatedModelFlags |= AMF_SKINNING_DIRTY;
+    }
+}
+
 void AnimatedModelDrawable::UpdateSkinning()
 {
     ZoneScoped;
 
+    if (animatedModelFlags & AMF_BONE_TRANSFORMS_DIRTY)
+        UpdateBoneTransforms(false);
+
     const std::vector<ModelBone>& modelBones = model->Bones();
+    const Matrix3x4& modelTransform = WorldTransform();
 
     for (size_t i = 0; i < numBones; ++i)
-        skinMatrices[i] = bones[i]->WorldTransform() * modelBones[i].offsetMatrix;
+        skinMatrices[i] = modelTransform * (boneTransforms[i] * modelBones[i].offsetMatrix);
 
     animatedModelFlags &= ~AMF_SKINNING_DIRTY;
     animatedModelFlags |= AMF_SKINNING_BUFFER_DIRTY;
 }
 
+void AnimatedModelDrawable::UpdateBoneTransforms(bool fromPose) const
+{
+    const std::vector<ModelBone>& modelBones = model->Bones();
+    const AnimationPose& pose = poseBuffer.pose;
+
+    // Parents come first in the bone order, so each bone can be concatenated to its parent's already calculated transform
+    for (size_t j = 0; j < numBones; ++j)
+    {
+        size_t i = boneOrder[j];
+        size_t parentIndex = modelBones[i].parentIndex;
+        Matrix3x4 localTransform = fromPose ? Matrix3x4(pose.Position(i), pose.Rotation(i), pose.Scale(i)) :
+            Matrix3x4(bones[i]->Position(), bones[i]->Rotation(), bones[i]->Scale());
+
+        boneTransforms[i] = parentIndex == i ? localTransform : boneTransforms[parentIndex] * localTransform;
+    }
+
+    animatedModelFlags &= ~AMF_BONE_TRANSFORMS_DIRTY;
+}
+
 void AnimatedModelDrawable::SetBoneTransformsDirty()
 {
     for (size_t i = 0; i < numBones; ++i)
@@ -360,11 +760,333 @@ void AnimatedModelDrawable::RemoveBones()
     }
 
     bones.Reset();
+    boneOrder.Reset();
+    boneTransforms.Reset();
+    lodBoneTransforms.Reset();
     skinMatrices.Reset();
     skinMatrixBuffer.Reset();
     numBones = 0;
 }
 
+bool AnimatedModelDrawable::CreateSkinnedGeometries()
+{
+    if (skinnedGeometries.size())
+        return true;
+
+    size_t numGeometries = batches.NumGeometries();
+    skinnedGeometries.resize(numGeometries);
+
+    for (size_t i = 0; i < numGeometries; ++i)
+    {
+        const std::vector<SharedPtr<Geometry> >& lodGeometries = model->LodGeometries(i);
+
+        for (size_t j = 0; j < lodGeometries.size(); ++j)
+        {
+            Geometry* source = lodGeometries[j];
+            VertexBuffer* sourceBuffer = source->vertexBuffer;
+            if (!sourceBuffer)
+            {
+                skinnedVertexBuffers.clear();
+                skinnedGeometries.clear();
+                return false;
+            }
+
+            // Skin the morphed vertices if the buffer has morph targets
+            for (auto it = morphedVertexBuffers.begin(); it != morphedVertexBuffers.end(); ++it)
+            {
+                if (it->source == sourceBuffer)
+                {
+                    sourceBuffer = it->dest;
+                    break;
+                }
+            }
+
+            // The LOD levels may share a vertex buffer
+            SkinnedVertexBuffer* skinned = nullptr;
+            for (auto it = skinnedVertexBuffers.begin(); it != skinnedVertexBuffers.end(); ++it)
+            {
+                if (it->source == sourceBuffer)
+                {
+                    skinned = &(*it);
+                    break;
+                }
+            }
+
+            if (!skinned)
+            {
+                int position = -1, normal = -1, tangent = -1, blendWeights = -1, blendIndices = -1, packedMask = 0;
+                const std::vector<VertexElement>& elements = sourceBuffer->Elements();
+
+                for (auto it = elements.begin(); it != elements.end(); ++it)
+                {
+                    int offset = (int)(it->offset / sizeof(float));
+                    if (it->semantic == SEM_POSITION && it->type == ELEM_VECTOR3)
+                        position = offset;
+                    else if (it->semantic == SEM_NORMAL && (it->type == ELEM_VECTOR3 || it->type == ELEM_INT2101010))
+                    {
+                        normal = offset;
+                        if (it->type == ELEM_INT2101010)
+                            packedMask |= 1;
+                    }
+                    else if (it->semantic == SEM_TANGENT && (it->type == ELEM_VECTOR4 || it->type == ELEM_INT2101010))
+                    {
+                        tangent = offset;
+                        if (it->type == ELEM_INT2101010)
+                            packedMask |= 2;
+                    }
+                    else if (it->semantic == SEM_BLENDWEIGHTS && it->type == ELEM_VECTOR4)
+                        blendWeights = offset;
+                    else if (it->semantic == SEM_BLENDINDICES && it->type == ELEM_UBYTE4)
+                        blendIndices = offset;
+                }
+
+                if (position < 0 || blendWeights < 0 || blendIndices < 0)
+                {
+                    skinnedVertexBuffers.clear();
+                    skinnedGeometries.clear();
+                    return false;
+                }
+
+                SkinnedVertexBuffer newSkinned;
+                newSkinned.source = sourceBuffer;
+                newSkinned.dest = new VertexBuffer();
+                newSkinned.dest->Define(USAGE_DEFAULT, sourceBuffer->NumVertices(), elements);
+                newSkinned.layout = Vector4((float)(sourceBuffer->VertexSize() / sizeof(float)), (float)sourceBuffer->NumVertices(), (float)position, (float)normal);
+                newSkinned.offsets = Vector4((float)tangent, (float)blendWeights, (float)blendIndices, (float)packedMask);
+                skinnedVertexBuffers.push_back(newSkinned);
+                skinned = &skinnedVertexBuffers.back();
+            }
+
+            SharedPtr<Geometry> geometry(new Geometry());
+            geometry->vertexBuffer = skinned->dest;
+            geometry->indexBuffer = source->indexBuffer;
+            geometry->drawStart = source->drawStart;
+            geometry->drawCount = source->drawCount;
+            geometry->lodDistance = source->lodDistance;
+            geometry->cpuPositionData = source->cpuPositionData;
+            geometry->cpuIndexData = source->cpuIndexData;
+            geometry->cpuIndexSize = source->cpuIndexSize;
+            geometry->cpuDrawStart = source->cpuDrawStart;
+            skinnedGeometries[i].push_back(geometry);
+        }
+    }
+
+    return true;
+}
+
+void AnimatedModelDrawable::SetReplacedGeometries(const std::vector<std::vector<SharedPtr<Geometry> > >& replaced, bool enable)
+{
+    size_t numGeometries = batches.NumGeometries();
+
+    for (size_t i = 0; i < numGeometries && i < replaced.size(); ++i)
+    {
+        const std::vector<SharedPtr<Geometry> >& lodGeometries = model->LodGeometries(i);
+        const std::vector<SharedPtr<Geometry> >& lodReplacedGeometries = replaced[i];
+        Geometry* current = batches.GetGeometry(i);
+
+        for (size_t j = 0; j < lodReplacedGeometries.size(); ++j)
+        {
+            if (enable && current == lodGeometries[j])
+            {
+                batches.SetGeometry(i, lodReplacedGeometries[j]);
+                break;
+            }
+            else if (!enable && current == lodReplacedGeometries[j])
+            {
+                batches.SetGeometry(i, lodGeometries[j]);
+                break;
+            }
+        }
+    }
+}
+
+void AnimatedModelDrawable::SkinVertices()
+{
+    ZoneScoped;
+
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    ShaderProgram* program = graphics->SetComputeProgram("Shaders/Skinning.glsl");
+    if (!program)
+        return;
+
+    skinMatrixBuffer->Bind(UB_SKINMATRICES);
+
+    // Renderer issues the barrier for vertex fetches once all the models in view have been skinned
+    verticesSkinned = true;
+    for (auto it = skinnedVertexBuffers.begin(); it != skinnedVertexBuffers.end(); ++it)
+    {
+        graphics->SetUniform(program, U_VERTEXLAYOUT, it->layout);
+        graphics->SetUniform(program, U_ELEMENTOFFSETS, it->offsets);
+        it->source->BindStorage(0);
+        it->dest->BindStorage(1);
+        graphics->DispatchCompute(IntVector3((int)(it->source->NumVertices() + 63) / 64, 1, 1));
+    }
+}
+
+bool AnimatedModelDrawable::CreateMorphedGeometries()
+{
+    ZoneScoped;
+
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    if (!graphics || !model || model->MorphStreams().empty() || !graphics->HasComputeShaders())
+        return false;
+
+    ShaderProgram* program = graphics->SetComputeProgram("Shaders/Morph.glsl", "COPY");
+    if (!program)
+        return false;
+
+    const std::vector<MorphStream>& morphStreams = model->MorphStreams();
+    for (auto it = morphStreams.begin(); it != morphStreams.end(); ++it)
+    {
+        VertexBuffer* sourceBuffer = it->vertexBuffer;
+        int position = -1, normal = -1, tangent = -1, packedMask = 0;
+        const std::vector<VertexElement>& elements = sourceBuffer->Elements();
+
+        for (auto eIt = elements.begin(); eIt != elements.end(); ++eIt)
+        {
+            int offset = (int)(eIt->offset / sizeof(float));
+            if (eIt->semantic == SEM_POSITION && eIt->type == ELEM_VECTOR3)
+                position = offset;
+            else if (eIt->semantic == SEM_NORMAL && (eIt->type == ELEM_VECTOR3 || eIt->type == ELEM_INT2101010))
+            {
+                normal = offset;
+                if (eIt->type == ELEM_INT2101010)
+                    packedMask |= 1;
+            }
+            else if (eIt->semantic == SEM_TANGENT && (eIt->type == ELEM_VECTOR4 || eIt->type == ELEM_INT2101010))
+            {
+                tangent = offset;
+                if (eIt->type == ELEM_INT2101010)
+                    packedMask |= 2;
+            }
+        }
+
+        if (position < 0)
+        {
+            morphedVertexBuffers.clear();
+            return false;
+        }
+
+        MorphedVertexBuffer newMorphed;
+        newMorphed.source = sourceBuffer;
+        newMorphed.dest = new VertexBuffer();
+        newMorphed.dest->Define(USAGE_DEFAULT, sourceBuffer->NumVertices(), elements);
+        newMorphed.deltaBuffer = it->deltaBuffer;
+        newMorphed.layout = Vector4((float)(sourceBuffer->VertexSize() / sizeof(float)), (float)it->numVertices, (float)position, (float)normal);
+        newMorphed.offsets = Vector4((float)tangent, 0.0f, 0.0f, (float)packedMask);
+        morphedVertexBuffers.push_back(newMorphed);
+
+        // Start from a copy of the source, as only the affected vertices are written by the morph pass
+        graphics->SetUniform(program, U_VERTEXLAYOUT, Vector4(newMorphed.layout.x, (float)sourceBuffer->NumVertices(), newMorphed.layout.z, newMorphed.layout.w));
+        sourceBuffer->BindStorage(0);
+        newMorphed.dest->BindStorage(1);
+        graphics->DispatchCompute(IntVector3((int)(sourceBuffer->NumVertices() + 63) / 64, 1, 1));
+    }
+
+    graphics->StorageBarrier();
+
+    size_t numGeometries = batches.NumGeometries();
+    morphedGeometries.resize(numGeometries);
+
+    for (size_t i = 0; i < numGeometries; ++i)
+    {
+        const std::vector<SharedPtr<Geometry> >& lodGeometries = model->LodGeometries(i);
+
+        for (size_t j = 0; j < lodGeometries.size(); ++j)
+        {
+            Geometry* source = lodGeometries[j];
+            VertexBuffer* morphedBuffer = nullptr;
+            for (auto it = morphedVertexBuffers.begin(); it != morphedVertexBuffers.end(); ++it)
+            {
+                if (it->source == source->vertexBuffer)
+                {
+                    morphedBuffer = it->dest;
+                    break;
+                }
+            }
+
+            // Geometries without morph targets keep drawing the source
+            if (!morphedBuffer)
+            {
+                morphedGeometries[i].push_back(SharedPtr<Geometry>(source));
+                continue;
+            }
+
+            SharedPtr<Geometry> geometry(new Geometry());
+            geometry->vertexBuffer = morphedBuffer;
+            geometry->indexBuffer = source->indexBuffer;
+            geometry->drawStart = source->drawStart;
+            geometry->drawCount = source->drawCount;
+            geometry->lodDistance = source->lodDistance;
+            geometry->cpuPositionData = source->cpuPositionData;
+            geometry->cpuIndexData = source->cpuIndexData;
+            geometry->cpuIndexSize = source->cpuIndexSize;
+            geometry->cpuDrawStart = source->cpuDrawStart;
+            morphedGeometries[i].push_back(geometry);
+        }
+    }
+
+    // Compute skinning already in use skins the morphed vertices from now on
+    for (auto it = skinnedVertexBuffers.begin(); it != skinnedVertexBuffers.end(); ++it)
+    {
+        for (auto mIt = morphedVertexBuffers.begin(); mIt != morphedVertexBuffers.end(); ++mIt)
+        {
+            if (it->source == mIt->source)
+                it->source = mIt->dest;
+        }
+    }
+
+    std::vector<VertexElement> weightElements;
+    weightElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD));
+    morphWeightBuffer = new VertexBuffer();
+    morphWeightBuffer->Define(USAGE_DYNAMIC, morphWeights.size() / 4, weightElements);
+
+    return true;
+}
+
+void AnimatedModelDrawable::MorphVertices()
+{
+    ZoneScoped;
+
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    ShaderProgram* program = graphics->SetComputeProgram("Shaders/Morph.glsl");
+    if (!program)
+        return;
+
+    morphWeightBuffer->SetData(0, morphWeights.size() / 4, morphWeights.data());
+    morphWeightBuffer->BindStorage(3);
+
+    for (auto it = morphedVertexBuffers.begin(); it != morphedVertexBuffers.end(); ++it)
+    {
+        graphics->SetUniform(program, U_VERTEXLAYOUT, it->layout);
+        graphics->SetUniform(program, U_ELEMENTOFFSETS, it->offsets);
+        it->source->BindStorage(0);
+        it->dest->BindStorage(1);
+        it->deltaBuffer->BindStorage(2);
+        graphics->DispatchCompute(IntVector3((int)(it->layout.y + 63.0f) / 64, 1, 1));
+    }
+
+    // Compute skinning reads the morphed vertices as storage, and Renderer issues the barrier for vertex fetches
+    graphics->StorageBarrier();
+    verticesSkinned = true;
+}
+
+void AnimatedModelDrawable::SetMorphWeight(size_t index, float weight)
+{
+    if (!model || index >= model->Morphs().size() || morphWeights[index] == weight)
+        return;
+
+    // Create the morphed geometries already here in the main thread, as the batches of the source geometries may be instanced, which
+    // skips the GPU data update
+    morphWeights[index] = weight;
+    morphWeightsDirty = morphedGeometries.size() || CreateMorphedGeometries();
+}
+
+void AnimatedModelDrawable::SetComputeSkinning(bool enable)
+{
+    computeSkinning = enable;
+}
+
 AnimatedModel::AnimatedModel()
 {
     drawable = drawableAllocator.Allocate();
@@ -387,6 +1109,8 @@ void AnimatedModel::RegisterObject()
     RegisterMixedRefAttribute("model", &AnimatedModel::ModelAttr, &AnimatedModel::SetModelAttr, ResourceRef(Model::TypeStatic()));
     CopyBaseAttribute<AnimatedModel, StaticModel>("materials");
     CopyBaseAttribute<AnimatedModel, StaticModel>("lodBias");
+    RegisterAttribute("animationLodDistance", &AnimatedModel::AnimationLodDistance, &AnimatedModel::SetAnimationLodDistance, 0.0f);
+    RegisterAttribute("animationSharingStep", &AnimatedModel::AnimationSharingStep, &AnimatedModel::SetAnimationSharingStep, 0.0f);
     RegisterMixedRefAttribute("animationStates", &AnimatedModel::AnimationStatesAttr, &AnimatedModel::SetAnimationStatesAttr);
 }
 
@@ -483,6 +1207,62 @@ void AnimatedModel::RemoveAllAnimationStates()
     }
 }
 
+void AnimatedModel::SetAnimationLodDistance(float distance)
+{
+    AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
+    modelDrawable->animationLodDistance = Max(distance, 0.0f);
+}
+
+void AnimatedModel::SetAnimationSharingStep(float step)
+{
+    AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
+    modelDrawable->poseBuffer.timeStep = Max(step, 0.0f);
+    modelDrawable->OnAnimationChanged();
+}
+
+void AnimatedModel::SetCrowdLod(Crowd* crowd, float distance)
+{
+    AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
+    if (modelDrawable->crowdLod && modelDrawable->crowdLod != crowd)
+        modelDrawable->crowdLod->RemoveLodModel(this);
+
+    modelDrawable->crowdLod = crowd;
+    modelDrawable->crowdLodDistance = Max(distance, 0.0f);
+    modelDrawable->crowdLodFrameNumber = 0;
+    if (crowd)
+        crowd->AddLodModel(this);
+}
+
+void AnimatedModel::SetMorphWeight(size_t index, float weight)
+{
+    static_cast<AnimatedModelDrawable*>(drawable)->SetMorphWeight(index, weight);
+}
+
+void AnimatedModel::SetMorphWeight(const std::string& name, float weight)
+{
+    Model* model = GetModel();
+    if (model)
+        SetMorphWeight(model->FindMorph(name), weight);
+}
+
+void AnimatedModel::ResetMorphWeights()
+{
+    for (size_t i = 0; i < NumMorphs(); ++i)
+        SetMorphWeight(i, 0.0f);
+}
+
+size_t AnimatedModel::NumMorphs() const
+{
+    Model* model = GetModel();
+    return model ? model->Morphs().size() : 0;
+}
+
+float AnimatedModel::MorphWeight(const std::string& name) const
+{
+    Model* model = GetModel();
+    return model ? MorphWeight(model->FindMorph(name)) : 0.0f;
+}
+
 AnimationState* AnimatedModel::FindAnimationState(Animation* animation) const
 {
     AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
@@ -535,8 +1315,9 @@ void AnimatedModel::OnTransformChanged()
 {
     AnimatedModelDrawable* modelDrawable = static_cast<AnimatedModelDrawable*>(drawable);
 
-    // To improve performance set skinning dirty now, so the bone nodes will not redundantly signal transform changes back
-    modelDrawable->animatedModelFlags |= AMF_SKINNING_DIRTY;
+    // Only the model node moved, so the model space bone transforms stay valid. Suppress the bone nodes signaling transform changes back while dirtying them
+    unsigned char inAnimationUpdate = modelDrawable->animatedModelFlags & AMF_IN_ANIMATION_UPDATE;
+    modelDrawable->animatedModelFlags |= AMF_SKINNING_DIRTY | AMF_IN_ANIMATION_UPDATE;
 
     // If have other children than the root bone, dirty the hierarchy normally. Otherwise optimize
     if (children.size() > 1)
@@ -544,9 +1325,11 @@ void AnimatedModel::OnTransformChanged()
     else
     {
         modelDrawable->SetBoneTransformsDirty();
-        SetFlag(NF_WORLD_TRANSFORM_DIRTY, true);
+        SetWorldTransformDirty();
     }
 
+    modelDrawable->animatedModelFlags = (modelDrawable->animatedModelFlags & ~AMF_IN_ANIMATION_UPDATE) | inAnimationUpdate;
+
     modelDrawable->SetFlag(DF_BOUNDING_BOX_DIRTY, true);
     if (octree && modelDrawable->octant && !modelDrawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
         octree->QueueUpdate(modelDrawable);
@@ -3,14 +3,16 @@
 #pragma once
 
 #include "../IO/JSONValue.h"
+#include "AnimationState.h"
+#include "Crowd.h"
 #include "Octree.h"
 #include "StaticModel.h"
 
 class AnimatedModel;
 class AnimatedModelDrawable;
 class Animation;
-class AnimationState;
 class UniformBuffer;
+class VertexBuffer;
 struct ModelBone;
 
 static const unsigned char AMF_ANIMATION_ORDER_DIRTY = 0x1;
@@ -19,6 +21,38 @@ static const unsigned char AMF_SKINNING_DIRTY = 0x4;
 static const unsigned char AMF_SKINNING_BUFFER_DIRTY = 0x8;
 static const unsigned char AMF_BONE_BOUNDING_BOX_DIRTY = 0x10;
 static const unsigned char AMF_IN_ANIMATION_UPDATE = 0x20;
+static const unsigned char AMF_BONE_TRANSFORMS_DIRTY = 0x40;
+static const unsigned char AMF_ANIMATION_LOD_INTERPOLATION = 0x80;
+
+static const unsigned char MAX_ANIMATION_LOD_LEVEL = 3;
+
+/// Source and output vertex buffer of compute skinning, with the element layout for the skinning shader.
+struct SkinnedVertexBuffer
+{
+    /// Source vertex buffer in bind pose.
+    VertexBuffer* source;
+    /// Output vertex buffer with the skinned vertices in world space.
+    SharedPtr<VertexBuffer> dest;
+    /// Vertex size, vertex count, position and normal offset in 32-bit words.
+    Vector4 layout;
+    /// Tangent, blend weight and blend index offset in 32-bit words. Missing normal or tangent is negative.
+    Vector4 offsets;
+};
+
+/// Source and output vertex buffer of morphing, with the deltas and element layout for the morph shader.
+struct MorphedVertexBuffer
+{
+    /// Source vertex buffer of the model.
+    VertexBuffer* source;
+    /// Output vertex buffer with the morphed vertices in model space.
+    SharedPtr<VertexBuffer> dest;
+    /// Morph deltas of the source vertex buffer.
+    SharedPtr<VertexBuffer> deltaBuffer;
+    /// Vertex size, affected vertex count, position and normal offset in 32-bit words.
+    Vector4 layout;
+    /// Tangent offset in 32-bit words and packed element mask. Missing normal or tangent is negative.
+    Vector4 offsets;
+};
 
 /// %Bone scene node for AnimatedModel skinning.
 class Bone : public SpatialNode
@@ -82,14 +116,22 @@ public:
 
     /// Recalculate the world space bounding box.
     void OnWorldBoundingBoxUpdate() const override;
+    /// Return the combined bone bounding box if it is up to date, or null otherwise.
+    const BoundingBox* LocalBoundingBox() const override;
     /// Do animation processing before octree reinsertion, if should update without regard to visibility. Called by Octree in worker threads. Must be opted-in by setting NF_OCTREE_UPDATE_CALL flag.
     void OnOctreeUpdate(unsigned short frameNumber) override;
     /// Prepare object for rendering. Reset framenumber and calculate distance from camera, check for LOD level changes, and update animation / skinning if necessary. Called by Renderer in worker threads. Return false if should not render.
     bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
-    /// Update GPU resources and set uniforms for rendering. Called by Renderer when geometry type is not static.
+    /// Apply changed morph weights, upload skin matrices if changed, and skin the vertices with a compute shader in compute skinning mode. Called by Renderer in the main thread once view preparation has finished.
+    void OnUpdateGPUData() override;
+    /// Bind the skin matrices for rendering, or set identity world transform for compute skinned vertices. Called by Renderer when geometry type is not static.
     void OnRender(ShaderProgram* program, size_t geomIndex) override;
+    /// Return the skin matrices for instanced skinning.
+    const Matrix3x4* SkinMatrices(size_t& numMatrices) const override;
     /// Perform ray test on self and add possible hit to the result vector.
     void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
+    /// Do not add occluder triangles, as the bind pose mesh does not match the animated shape.
+    void OnRasterizeOcclusion(OcclusionRasterizer* rasterizer, unsigned threadIndex) override;
     /// Add debug geometry to be rendered.
     void OnRenderDebug(DebugRenderer* debug) override;
 
@@ -100,7 +142,7 @@ public:
         if (octree && octant && !TestFlag(DF_OCTREE_REINSERT_QUEUED))
             octree->QueueUpdate(this);
 
-        animatedModelFlags |= AMF_SKINNING_DIRTY | AMF_BONE_BOUNDING_BOX_DIRTY;
+        animatedModelFlags |= AMF_SKINNING_DIRTY | AMF_BONE_BOUNDING_BOX_DIRTY | AMF_BONE_TRANSFORMS_DIRTY;
     }
 
     /// Set animation order dirty when animation state changes layer order and queue octree reinsertion. Note: bounding box will only be dirtied once animation actually updates.
@@ -125,12 +167,37 @@ public:
     void SetBoneTransformsDirty();
     /// Apply animation states and recalculate bounding box.
     void UpdateAnimation();
+    /// Build the key of the current animation states for animation sharing. Return false if the pose can not be shared.
+    bool BuildSharedPoseKey();
+    /// Apply animation states if due according to the animation LOD level, or interpolate the bone transforms toward the last applied animation.
+    void UpdateAnimationLod(unsigned short frameNumber);
     /// Update skin matrices for rendering.
     void UpdateSkinning();
+    /// Recalculate the model space bone transforms in one linear pass, from either the animated pose or the bone nodes' local transforms.
+    void UpdateBoneTransforms(bool fromPose) const;
     /// Create bone scene nodes based on the model. If compatible bones already exist in the scene hierarchy, they are taken into use instead of creating new.
     void CreateBones();
     /// Remove existing bones.
     void RemoveBones();
+    /// Create the compute skinning output vertex buffers and geometries for all LOD levels. Return true on success, or false if the vertex format is not supported.
+    bool CreateSkinnedGeometries();
+    /// Switch the batches between the source geometries and their compute skinned or morphed versions of the current LOD levels.
+    void SetReplacedGeometries(const std::vector<std::vector<SharedPtr<Geometry> > >& replaced, bool enable);
+    /// Skin the vertices into the output vertex buffers with a compute shader.
+    void SkinVertices();
+    /// Create the morphed vertex buffers and geometries for all LOD levels, initialized with a copy of the source vertices. Return true on success, or false if compute shaders or the vertex format are not supported.
+    bool CreateMorphedGeometries();
+    /// Upload the morph weights and apply the morph deltas into the morphed vertex buffers with a compute shader.
+    void MorphVertices();
+    /// Set morph target weight by index and queue the morphed vertices for update. Creates the morphed geometries on first use, so must be called in the main thread.
+    void SetMorphWeight(size_t index, float weight);
+
+    /// Set compute skinning mode for all animated models. Called by Renderer.
+    static void SetComputeSkinning(bool enable);
+    /// Return whether compute skinning mode is enabled.
+    static bool ComputeSkinning() { return computeSkinning; }
+    /// Return whether any model has skinned vertices with a compute shader since the last call, and reset the status.
+    static bool CheckVerticesSkinned() { bool ret = verticesSkinned; verticesSkinned = false; return ret; }
     
     /// Return the root bone.
     Bone* RootBone() const { return rootBone; }
@@ -138,10 +205,26 @@ public:
     size_t NumBones() const { return numBones; }
     /// Return all bone scene nodes.
     const AutoArrayPtr<Bone*>& Bones() const { return bones; }
+    /// Return a bone's transform in model space. Cheaper than querying the bone node's world transform, which is evaluated lazily through the scene hierarchy.
+    const Matrix3x4& BoneTransform(size_t index) const { if (animatedModelFlags & AMF_BONE_TRANSFORMS_DIRTY) UpdateBoneTransforms(false); return boneTransforms[index]; }
     /// Return all animation states.
     const std::vector<SharedPtr<AnimationState> >& AnimationStates() const { return animationStates; }
     /// Return the internal dirty status flags.
     unsigned char AnimatedModelFlags() { return animatedModelFlags; }
+    /// Return animation LOD distance.
+    float AnimationLodDistance() const { return animationLodDistance; }
+    /// Return current animation LOD level. Animation is applied every 2^level frames.
+    unsigned char AnimationLodLevel() const { return animationLodLevel; }
+    /// Return animation sharing time step.
+    float AnimationSharingStep() const { return poseBuffer.timeStep; }
+    /// Return whether the vertices are currently skinned by a compute shader.
+    bool IsComputeSkinned() const { return computeSkinned; }
+    /// Return the crowd to hand over to as LOD.
+    Crowd* CrowdLod() const { return crowdLod; }
+    /// Return the crowd LOD distance.
+    float CrowdLodDistance() const { return crowdLodDistance; }
+    /// Return morph target weight by index.
+    float MorphWeight(size_t index) const { return index < morphWeights.size() ? morphWeights[index] : 0.0f; }
 
 protected:
     /// Combined bounding box of the bones in model space, used for quick updates when only the node moves without animation
@@ -156,12 +239,61 @@ protected:
     Bone* rootBone;
     /// Bone scene nodes.
     AutoArrayPtr<Bone*> bones;
+    /// Bone indices ordered so that parents come before their children, for the flat hierarchy pass.
+    AutoArrayPtr<unsigned short> boneOrder;
+    /// Bone transforms in model space.
+    mutable AutoArrayPtr<Matrix3x4> boneTransforms;
+    /// Flat animation evaluation buffers.
+    AnimationPoseBuffer poseBuffer;
+    /// Model space bone transforms to interpolate from and to when the animation is applied at a reduced rate.
+    AutoArrayPtr<Matrix3x4> lodBoneTransforms;
+    /// Animation LOD distance, beyond which the animation update rate is halved for each doubling of distance. 0 disables.
+    float animationLodDistance;
+    /// Current animation LOD level.
+    unsigned char animationLodLevel;
+    /// Number of frames to interpolate over after applying the animation at a reduced rate.
+    unsigned char lodInterpolationFrames;
+    /// Frames interpolated so far.
+    unsigned char lodInterpolationFrame;
+    /// Frame number of the last animation LOD update.
+    unsigned short lodFrameNumber;
+    /// Frame offset to spread the reduced rate updates of many models evenly.
+    unsigned short lodFramePhase;
+    /// Key of the animation states for animation sharing.
+    std::vector<size_t> sharedPoseKey;
     /// Skinning matrices.
     AutoArrayPtr<Matrix3x4> skinMatrices;
     /// Skinning uniform buffer.
     AutoPtr<UniformBuffer> skinMatrixBuffer;
+    /// Compute skinning vertex buffers. Kept when compute skinning is disabled, as the captured view may still refer to them.
+    std::vector<SkinnedVertexBuffer> skinnedVertexBuffers;
+    /// Compute skinned geometries by geometry index and LOD level.
+    std::vector<std::vector<SharedPtr<Geometry> > > skinnedGeometries;
+    /// Compute skinning in use flag.
+    bool computeSkinned;
+    /// Morphed vertex buffers. Compute skinning reads them as its source.
+    std::vector<MorphedVertexBuffer> morphedVertexBuffers;
+    /// Morphed geometries by geometry index and LOD level.
+    std::vector<std::vector<SharedPtr<Geometry> > > morphedGeometries;
+    /// Morph target weights, padded to a multiple of 4.
+    std::vector<float> morphWeights;
+    /// Morph weight storage buffer.
+    AutoPtr<VertexBuffer> morphWeightBuffer;
+    /// Morph weights changed flag.
+    bool morphWeightsDirty;
     /// Animation states.
     std::vector<SharedPtr<AnimationState> > animationStates;
+    /// Crowd to hand over to as LOD.
+    WeakPtr<Crowd> crowdLod;
+    /// Distance beyond which the model is handed over to the crowd. 0 disables.
+    float crowdLodDistance;
+    /// Frame number of the last handover, so that the model is added once per view.
+    unsigned short crowdLodFrameNumber;
+
+    /// Compute skinning mode flag.
+    static bool computeSkinning;
+    /// Vertices skinned with a compute shader since last check flag.
+    static bool verticesSkinned;
 };
 
 /// %Scene node that renders a skeletally animated (skinned) model.
@@ -194,6 +326,18 @@ public:
     void RemoveAnimationState(size_t index);
     /// Remove all animations.
     void RemoveAllAnimationStates();
+    /// Set animation LOD distance. Beyond it, animation is applied every 2nd frame, and for each further doubling of distance at half the rate again, down to every 8th frame. In between the bone transforms are interpolated. From every 4th frame onward leaf bones are not animated and the bone bounding box is not recalculated. 0 disables (default.)
+    void SetAnimationLodDistance(float distance);
+    /// Set animation sharing time step. When nonzero, the animation states are sampled at their time positions rounded to the step, and models of the same model resource whose animation states round to the same times and weights evaluate the pose once per frame and copy it, so that the cost of crowds scales with the number of unique poses. Models with per-bone weights, start bones or bones with animation disabled always evaluate their own pose. 0 disables (default.)
+    void SetAnimationSharingStep(float step);
+    /// Set morph target weight by index. The morph targets are applied with a compute shader into a copy of the model's vertices, when the weights have changed and the model is in view. Requires compute shaders.
+    void SetMorphWeight(size_t index, float weight);
+    /// Set morph target weight by name.
+    void SetMorphWeight(const std::string& name, float weight);
+    /// Reset all morph target weights to zero.
+    void ResetMorphWeights();
+    /// Set a crowd to hand the model over to beyond a distance. The crowd then draws the model as one of its instances by the clip and time of the strongest animation state, which must have been baked into the crowd's vertex animation, and the model skips its animation and skinning. Only the uniform scale of the model is kept. The crowd must be updated each frame to follow the bounds of the models. Null crowd or zero distance disables (default.)
+    void SetCrowdLod(Crowd* crowd, float distance);
 
     /// Return the root bone.
     Bone* RootBone() const { return static_cast<AnimatedModelDrawable*>(drawable)->RootBone(); }
@@ -205,6 +349,20 @@ public:
     const std::vector<SharedPtr<AnimationState> >& AnimationStates() const { return static_cast<AnimatedModelDrawable*>(drawable)->AnimationStates(); }
     /// Return number of animation states.
     size_t NumAnimationStates() const { return static_cast<AnimatedModelDrawable*>(drawable)->animationStates.size(); }
+    /// Return animation LOD distance.
+    float AnimationLodDistance() const { return static_cast<AnimatedModelDrawable*>(drawable)->AnimationLodDistance(); }
+    /// Return animation sharing time step.
+    float AnimationSharingStep() const { return static_cast<AnimatedModelDrawable*>(drawable)->AnimationSharingStep(); }
+    /// Return the crowd to hand over to as LOD.
+    Crowd* CrowdLod() const { return static_cast<AnimatedModelDrawable*>(drawable)->CrowdLod(); }
+    /// Return the crowd LOD distance.
+    float CrowdLodDistance() const { return static_cast<AnimatedModelDrawable*>(drawable)->CrowdLodDistance(); }
+    /// Return number of morph targets in the model.
+    size_t NumMorphs() const;
+    /// Return morph target weight by index.
+    float MorphWeight(size_t index) const { return static_cast<AnimatedModelDrawable*>(drawable)->MorphWeight(index); }
+    /// Return morph target weight by name.
+    float MorphWeight(const std::string& name) const;
     /// Return animation state by index.
     AnimationState* GetAnimationState(size_t index) const;
     /// Return animation state by animation pointer.
@@ -3,9 +3,48 @@
 #include "../IO/Log.h"
 #include "../IO/Stream.h"
 #include "Animation.h"
+#include "Model.h"
 
+#include <algorithm>
+#include <cmath>
 #include <tracy/Tracy.hpp>
 
+static const float CONSTANT_EPSILON = 0.0001f;
+
+inline bool CompareTrackHash(const AnimationTrack& lhs, StringHash rhs)
+{
+    return lhs.nameHash < rhs;
+}
+
+inline unsigned short QuantizeUnit(float value, float maxValue)
+{
+    return (unsigned short)Clamp((int)(value * maxValue + 0.5f), 0, (int)maxValue);
+}
+
+inline void QuantizeVector(const Vector3& value, const Vector3& min, const Vector3& range, unsigned short* dest)
+{
+    dest[0] = range.x > 0.0f ? QuantizeUnit((value.x - min.x) / range.x, 65535.0f) : 0;
+    dest[1] = range.y > 0.0f ? QuantizeUnit((value.y - min.y) / range.y, 65535.0f) : 0;
+    dest[2] = range.z > 0.0f ? QuantizeUnit((value.z - min.z) / range.z, 65535.0f) : 0;
+}
+
+inline Vector3 DequantizeVector(const unsigned short* src, const Vector3& min, const Vector3& range)
+{
+    return Vector3(
+        min.x + range.x * (src[0] * (1.0f / 65535.0f)),
+        min.y + range.y * (src[1] * (1.0f / 65535.0f)),
+        min.z + range.z * (src[2] * (1.0f / 65535.0f))
+    );
+}
+
+AnimationTrack::AnimationTrack() :
+    channelMask(0),
+    constantMask(0),
+    numSamples(0),
+    sampleRate(0.0f)
+{
+}
+
 void AnimationTrack::FindKeyFrameIndex(float time, size_t& index) const
 {
     if (time < 0.0f)
@@ -23,6 +62,138 @@ void AnimationTrack::FindKeyFrameIndex(float time, size_t& index) const
         ++index;
 }
 
+void AnimationTrack::Sample(float time, float length, bool looped, size_t& index, AnimationKeyFrame& keyFrame, AnimationKeyFrame& nextKeyFrame, float& t) const
+{
+    if (numSamples)
+    {
+        // Compressed samples are at a fixed rate, so the lookup is constant time. Looping needs no special handling, as there is a sample at the animation end
+        if (numSamples == 1)
+        {
+            index = 0;
+            t = 0.0f;
+            DecompressSample(0, keyFrame);
+            nextKeyFrame = keyFrame;
+            return;
+        }
+
+        float position = Clamp(time, 0.0f, length) * sampleRate;
+        index = Min((size_t)position, numSamples - 2);
+        t = Min(position - (float)index, 1.0f);
+        DecompressSample(index, keyFrame);
+        DecompressSample(index + 1, nextKeyFrame);
+        return;
+    }
+
+    FindKeyFrameIndex(time, index);
+    keyFrame = keyFrames[index];
+    t = 0.0f;
+
+    // Check if next frame to interpolate to is valid, or if wrapping is needed (looping animation only)
+    size_t nextFrame = index + 1;
+    if (nextFrame >= keyFrames.size())
+        nextFrame = looped ? 0 : index;
+
+    nextKeyFrame = keyFrames[nextFrame];
+    if (nextFrame != index)
+    {
+        float timeInterval = nextKeyFrame.time - keyFrame.time;
+        if (timeInterval < 0.0f)
+            timeInterval += length;
+        t = timeInterval > 0.0f ? (time - keyFrame.time) / timeInterval : 1.0f;
+    }
+}
+
+void AnimationTrack::Compress(float length, float sampleRate_)
+{
+    if (numSamples || keyFrames.empty())
+        return;
+
+    // Resample the keyframes at the fixed rate, with the last sample exactly at the animation end
+    size_t numIntervals = length > 0.0f ? Max((size_t)ceilf(length * sampleRate_), (size_t)1) : 1;
+    std::vector<AnimationKeyFrame> samples(numIntervals + 1);
+    size_t hint = 0;
+
+    for (size_t i = 0; i <= numIntervals; ++i)
+    {
+        AnimationKeyFrame keyFrame;
+        AnimationKeyFrame nextKeyFrame;
+        float t;
+        float time = length * i / numIntervals;
+
+        Sample(time, length, false, hint, keyFrame, nextKeyFrame, t);
+
+        AnimationKeyFrame& sample = samples[i];
+        sample.time = time;
+        sample.position = (channelMask & CHANNEL_POSITION) ? keyFrame.position.Lerp(nextKeyFrame.position, t) : Vector3::ZERO;
+        sample.rotation = (channelMask & CHANNEL_ROTATION) ? keyFrame.rotation.Slerp(nextKeyFrame.rotation, t) : Quaternion::IDENTITY;
+        sample.scale = (channelMask & CHANNEL_SCALE) ? keyFrame.scale.Lerp(nextKeyFrame.scale, t) : Vector3::ONE;
+    }
+
+    // Find value ranges, and eliminate channels that do not change
+    Vector3 positionMax = samples[0].position;
+    Vector3 scaleMax = samples[0].scale;
+    positionMin = samples[0].position;
+    scaleMin = samples[0].scale;
+    constantRotation = samples[0].rotation;
+    constantMask = CHANNEL_POSITION | CHANNEL_ROTATION | CHANNEL_SCALE;
+
+    for (size_t i = 1; i < samples.size(); ++i)
+    {
+        const AnimationKeyFrame& sample = samples[i];
+        positionMin = Vector3(Min(positionMin.x, sample.position.x), Min(positionMin.y, sample.position.y), Min(positionMin.z, sample.position.z));
+        positionMax = Vector3(Max(positionMax.x, sample.position.x), Max(positionMax.y, sample.position.y), Max(positionMax.z, sample.position.z));
+        scaleMin = Vector3(Min(scaleMin.x, sample.scale.x), Min(scaleMin.y, sample.scale.y), Min(scaleMin.z, sample.scale.z));
+        scaleMax = Vector3(Max(scaleMax.x, sample.scale.x), Max(scaleMax.y, sample.scale.y), Max(scaleMax.z, sample.scale.z));
+        if (Abs(constantRotation.DotProduct(sample.rotation)) < 1.0f - CONSTANT_EPSILON * CONSTANT_EPSILON)
+            constantMask &= ~CHANNEL_ROTATION;
+    }
+
+    positionRange = positionMax - positionMin;
+    scaleRange = scaleMax - scaleMin;
+    if (Max(Max(positionRange.x, positionRange.y), positionRange.z) > CONSTANT_EPSILON)
+        constantMask &= ~CHANNEL_POSITION;
+    else
+        positionRange = Vector3::ZERO;
+    if (Max(Max(scaleRange.x, scaleRange.y), scaleRange.z) > CONSTANT_EPSILON)
+        constantMask &= ~CHANNEL_SCALE;
+    else
+        scaleRange = Vector3::ZERO;
+
+    // A fully constant track needs just one sample
+    numSamples = constantMask == (CHANNEL_POSITION | CHANNEL_ROTATION | CHANNEL_SCALE) ? 1 : samples.size();
+    sampleRate = length > 0.0f ? numIntervals / length : 0.0f;
+
+    positions.clear();
+    rotations.clear();
+    scales.clear();
+    if (!(constantMask & CHANNEL_POSITION))
+        positions.resize(numSamples * 3);
+    if (!(constantMask & CHANNEL_ROTATION))
+        rotations.resize(numSamples);
+    if (!(constantMask & CHANNEL_SCALE))
+        scales.resize(numSamples * 3);
+
+    for (size_t i = 0; i < numSamples; ++i)
+    {
+        if (positions.size())
+            QuantizeVector(samples[i].position, positionMin, positionRange, &positions[i * 3]);
+        if (rotations.size())
+            rotations[i] = QuantizedQuaternion(samples[i].rotation);
+        if (scales.size())
+            QuantizeVector(samples[i].scale, scaleMin, scaleRange, &scales[i * 3]);
+    }
+
+    std::vector<AnimationKeyFrame>().swap(keyFrames);
+}
+
+void AnimationTrack::DecompressSample(size_t index, AnimationKeyFrame& dest) const
+{
+    dest.time = sampleRate > 0.0f ? index / sampleRate : 0.0f;
+    dest.position = positions.size() ? DequantizeVector(&positions[index * 3], positionMin, positionRange) : positionMin;
+    dest.rotation = rotations.size() ? rotations[index].ToQuaternion() : constantRotation;
+    dest.scale = scales.size() ? DequantizeVector(&scales[index * 3], scaleMin, scaleRange) : scaleMin;
+}
+
 Animation::Animation() :
     length(0.0f)
 {
@@ -41,8 +212,8 @@ bool Animation::BeginLoad(Stream& source)
 {
     ZoneScoped;
 
-    /// \todo Develop own format for Turso3D
-    if (source.ReadFileID() != "UANI")
+    std::string fileID = source.ReadFileID();
+    if (fileID != "UANI" && fileID != "TANI")
     {
         LOGERROR(source.Name() + " is not a valid animation file");
         return false;
@@ -53,8 +224,47 @@ bool Animation::BeginLoad(Stream& source)
     animationNameHash = animationName;
     length = source.Read<float>();
     tracks.clear();
+    skeletonBindings.clear();
 
     size_t numTracks = source.Read<unsigned>();
+    tracks.reserve(numTracks);
+
+    if (fileID == "TANI")
+    {
+        // Read compressed tracks
+        for (size_t i = 0; i < numTracks; ++i)
+        {
+            AnimationTrack* newTrack = CreateTrack(source.Read<std::string>());
+            newTrack->channelMask = source.Read<unsigned char>();
+            newTrack->constantMask = source.Read<unsigned char>();
+            newTrack->numSamples = source.Read<unsigned>();
+            newTrack->sampleRate = source.Read<float>();
+            newTrack->positionMin = source.Read<Vector3>();
+            newTrack->positionRange = source.Read<Vector3>();
+            newTrack->scaleMin = source.Read<Vector3>();
+            newTrack->scaleRange = source.Read<Vector3>();
+            newTrack->constantRotation = source.Read<Quaternion>();
+
+            size_t numValues = newTrack->numSamples * 3;
+            if (!(newTrack->constantMask & CHANNEL_POSITION))
+            {
+                newTrack->positions.resize(numValues);
+                source.Read(&newTrack->positions[0], numValues * sizeof(unsigned short));
+            }
+            if (!(newTrack->constantMask & CHANNEL_ROTATION))
+            {
+                newTrack->rotations.resize(newTrack->numSamples);
+                source.Read(&newTrack->rotations[0], newTrack->numSamples * sizeof(QuantizedQuaternion));
+            }
+            if (!(newTrack->constantMask & CHANNEL_SCALE))
+            {
+                newTrack->scales.resize(numValues);
+                source.Read(&newTrack->scales[0], numValues * sizeof(unsigned short));
+            }
+        }
+
+        return true;
+    }
 
     // Read tracks
     for (size_t i = 0; i < numTracks; ++i)
@@ -82,6 +292,68 @@ bool Animation::BeginLoad(Stream& source)
     return true;
 }
 
+bool Animation::Save(Stream& dest)
+{
+    ZoneScoped;
+
+    // Write in the compressed format if any of the tracks are compressed. Compress the rest with the same rate so that the file is consistent
+    float compressedRate = 0.0f;
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+    {
+        if (it->IsCompressed())
+            compressedRate = Max(compressedRate, it->sampleRate);
+    }
+    if (compressedRate > 0.0f)
+        Compress(compressedRate);
+
+    dest.WriteFileID(compressedRate > 0.0f ? "TANI" : "UANI");
+    dest.Write(animationName);
+    dest.Write(length);
+    dest.Write((unsigned)tracks.size());
+
+    for (auto it = tracks.begin(); it != tracks.end(); ++it)
+    {
+        const AnimationTrack& track = *it;
+        dest.Write(track.name);
+        dest.Write(track.channelMask);
+
+        if (compressedRate > 0.0f)
+        {
+            dest.Write(track.constantMask);
+            dest.Write((unsigned)track.numSamples);
+            dest.Write(track.sampleRate);
+            dest.Write(track.positionMin);
+            dest.Write(track.positionRange);
+            dest.Write(track.scaleMin);
+            dest.Write(track.scaleRange);
+            dest.Write(track.constantRotation);
+            if (track.positions.size())
+                dest.Write(&track.positions[0], track.positions.size() * sizeof(unsigned short));
+            if (track.rotations.size())
+                dest.Write(&track.rotations[0], track.rotations.size() * sizeof(QuantizedQuaternion));
+            if (track.scales.size())
+                dest.Write(&track.scales[0], track.scales.size() * sizeof(unsigned short));
+        }
+        else
+        {
+            dest.Write((unsigned)track.keyFrames.size());
+
+            for (auto kIt = track.keyFrames.begin(); kIt != track.keyFrames.end(); ++kIt)
+            {
+                dest.Write(kIt->time);
+                if (track.channelMask & CHANNEL_POSITION)
+                    dest.Write(kIt->position);
+                if (track.channelMask & CHANNEL_ROTATION)
+                    dest.Write(kIt->rotation);
+                if (track.channelMask & CHANNEL_SCALE)
+                    dest.Write(kIt->scale);
+            }
+        }
+    }
+
+    return true;
+}
+
 void Animation::SetAnimationName(const std::string& name_)
 {
     animationName = name_;
@@ -96,52 +368,119 @@ void Animation::SetLength(float length_)
 AnimationTrack* Animation::CreateTrack(const std::string& name_)
 {
     StringHash nameHash_(name_);
-    AnimationTrack* oldTrack = FindTrack(nameHash_);
-    if (oldTrack)
-        return oldTrack;
+    auto it = std::lower_bound(tracks.begin(), tracks.end(), nameHash_, CompareTrackHash);
+    if (it != tracks.end() && it->nameHash == nameHash_)
+        return &(*it);
 
-    AnimationTrack& newTrack = tracks[nameHash_];
-    newTrack.name = name_;
-    newTrack.nameHash = nameHash_;
-    return &newTrack;
+    it = tracks.insert(it, AnimationTrack());
+    it->name = name_;
+    it->nameHash = nameHash_;
+    skeletonBindings.clear();
+    return &(*it);
 }
 
 void Animation::RemoveTrack(const std::string& name_)
 {
-    auto it = tracks.find(StringHash(name_));
-    if (it != tracks.end())
-        tracks.erase(it);
+    size_t index = FindTrackIndex(StringHash(name_));
+    if (index < tracks.size())
+    {
+        tracks.erase(tracks.begin() + index);
+        skeletonBindings.clear();
+    }
 }
 
 void Animation::RemoveAllTracks()
 {
     tracks.clear();
+    skeletonBindings.clear();
 }
 
-AnimationTrack* Animation::Track(size_t index) const
+void Animation::Compress(float sampleRate)
 {
-    if (index >= tracks.size())
-        return nullptr;
+    if (sampleRate <= 0.0f)
+        return;
 
-    size_t j = 0;
     for (auto it = tracks.begin(); it != tracks.end(); ++it)
-    {
-        if (j == index)
-            return const_cast<AnimationTrack*>(&(it->second));
-        ++j;
-    }
-
-    return nullptr;
+        it->Compress(length, sampleRate);
 }
 
 AnimationTrack* Animation::FindTrack(const std::string& name_) const
 {
-    auto it = tracks.find(StringHash(name_));
-    return it != tracks.end() ? const_cast<AnimationTrack*>(&(it->second)) : nullptr;
+    return Track(FindTrackIndex(StringHash(name_)));
 }
 
 AnimationTrack* Animation::FindTrack(StringHash nameHash_) const
 {
-    auto it = tracks.find(nameHash_);
-    return it != tracks.end() ? const_cast<AnimationTrack*>(&(it->second)) : nullptr;
+    return Track(FindTrackIndex(nameHash_));
+}
+
+size_t Animation::FindTrackIndex(StringHash nameHash_) const
+{
+    auto it = std::lower_bound(tracks.begin(), tracks.end(), nameHash_, CompareTrackHash);
+    return (it != tracks.end() && it->nameHash == nameHash_) ? (size_t)(it - tracks.begin()) : M_MAX_UNSIGNED;
+}
+
+const std::vector<AnimationBoneBinding>& Animation::BoneBindings(Model* model) const
+{
+    for (auto it = skeletonBindings.begin(); it != skeletonBindings.end();)
+    {
+        if (it->model == model)
+            return it->bindings;
+
+        // Clean up the bindings of destroyed models
+        if (!it->model)
+            it = skeletonBindings.erase(it);
+        else
+            ++it;
+    }
+
+    skeletonBindings.push_back(AnimationSkeletonBinding());
+    AnimationSkeletonBinding& newBinding = skeletonBindings.back();
+    newBinding.model = model;
+
+    const std::vector<ModelBone>& modelBones = model->Bones();
+    size_t numBones = modelBones.size();
+
+    // The last parentless bone becomes the root bone, like in AnimatedModel
+    size_t rootIndex = M_MAX_UNSIGNED;
+    for (size_t i = 0; i < numBones; ++i)
+    {
+        if (modelBones[i].parentIndex == i)
+            rootIndex = i;
+    }
+
+    // Sort the bones by name hash to match them with the tracks in one pass
+    std::vector<std::pair<StringHash, size_t> > sortedBones;
+    sortedBones.reserve(numBones);
+    for (size_t i = 0; i < numBones; ++i)
+        sortedBones.push_back(std::make_pair(modelBones[i].nameHash, i));
+    std::sort(sortedBones.begin(), sortedBones.end());
+
+    auto boneIt = sortedBones.begin();
+    for (size_t i = 0; i < tracks.size(); ++i)
+    {
+        StringHash nameHash_ = tracks[i].nameHash;
+        while (boneIt != sortedBones.end() && boneIt->first < nameHash_)
+            ++boneIt;
+        if (boneIt == sortedBones.end())
+            break;
+        if (boneIt->first != nameHash_)
+            continue;
+
+        // Bind only the bones under the root bone
+        size_t boneIndex = boneIt->second;
+        size_t index = boneIndex;
+        while (index != rootIndex && modelBones[index].parentIndex != index && modelBones[index].parentIndex < numBones)
+            index = modelBones[index].parentIndex;
+
+        if (index == rootIndex)
+        {
+            AnimationBoneBinding binding;
+            binding.trackIndex = i;
+            binding.boneIndex = boneIndex;
+            newBinding.bindings.push_back(binding);
+        }
+    }
+
+    return newBinding.bindings;
 }
@@ -2,9 +2,11 @@
 
 #pragma once
 
-#include "../Math/Quaternion.h"
+#include "../Math/QuantizedQuaternion.h"
 #include "../Resource/Resource.h"
 
+class Model;
+
 static const unsigned char CHANNEL_POSITION = 1;
 static const unsigned char CHANNEL_ROTATION = 2;
 static const unsigned char CHANNEL_SCALE = 4;
@@ -29,11 +31,25 @@ struct AnimationKeyFrame
     Vector3 scale;
 };
 
-/// Skeletal animation track, stores keyframes of a single bone.
+/// Skeletal animation track, stores keyframes of a single bone. May alternatively be compressed: resampled at a fixed rate for constant time lookup, with constant channels stored once, positions and scales range-quantized to 16 bits per component and rotations quantized to 48 bits with the smallest three encoding.
 struct AnimationTrack
 {
-    /// Adjust keyframe index by time.
+    /// Construct.
+    AnimationTrack();
+
+    /// Adjust keyframe index by time. Not used by compressed tracks.
     void FindKeyFrameIndex(float time, size_t& index) const;
+    /// Return the keyframes to interpolate between at time, and the interpolation factor. Index is the last keyframe index, used as a search hint for uncompressed tracks.
+    void Sample(float time, float length, bool looped, size_t& index, AnimationKeyFrame& keyFrame, AnimationKeyFrame& nextKeyFrame, float& t) const;
+    /// Compress by resampling at a fixed rate. Animation length is needed to place the samples.
+    void Compress(float length, float sampleRate);
+    /// Return whether is compressed.
+    bool IsCompressed() const { return numSamples > 0; }
+    /// Return number of keyframes or compressed samples.
+    size_t NumKeyFrames() const { return numSamples ? numSamples : keyFrames.size(); }
+
+    /// Decompress a sample.
+    void DecompressSample(size_t index, AnimationKeyFrame& dest) const;
 
     /// Bone or scene node name.
     std::string name;
@@ -41,8 +57,48 @@ struct AnimationTrack
     StringHash nameHash;
     /// Bitmask of included data (position, rotation, scale.)
     unsigned char channelMask;
-    /// Keyframes.
+    /// Keyframes. Empty when compressed.
     std::vector<AnimationKeyFrame> keyFrames;
+    /// Bitmask of compressed channels that are constant, and stored only in the range minimum or constant rotation.
+    unsigned char constantMask;
+    /// Number of compressed samples, or 0 if not compressed.
+    size_t numSamples;
+    /// Compressed samples per second of animation.
+    float sampleRate;
+    /// Compressed position range minimum, or the constant position.
+    Vector3 positionMin;
+    /// Compressed position range size.
+    Vector3 positionRange;
+    /// Compressed scale range minimum, or the constant scale.
+    Vector3 scaleMin;
+    /// Compressed scale range size.
+    Vector3 scaleRange;
+    /// Constant rotation.
+    Quaternion constantRotation;
+    /// Quantized positions, 3 values per sample.
+    std::vector<unsigned short> positions;
+    /// Quantized rotations, one per sample.
+    std::vector<QuantizedQuaternion> rotations;
+    /// Quantized scales, 3 values per sample.
+    std::vector<unsigned short> scales;
+};
+
+/// Binding of an animation track to a model bone.
+struct AnimationBoneBinding
+{
+    /// Track index.
+    size_t trackIndex;
+    /// Bone index in the model.
+    size_t boneIndex;
+};
+
+/// Track to bone bindings of an animation for one model's skeleton.
+struct AnimationSkeletonBinding
+{
+    /// Model resource.
+    WeakPtr<Model> model;
+    /// Bindings in track order.
+    std::vector<AnimationBoneBinding> bindings;
 };
 
 /// Skeletal animation resource.
@@ -61,17 +117,21 @@ public:
 
     /// Load animation from a stream. Return true on success.
     bool BeginLoad(Stream& source) override;
-    
+    /// Save animation to a stream. Compressed animations are written in the compressed format. Return true on success.
+    bool Save(Stream& dest) override;
+
     /// Set animation name.
     void SetAnimationName(const std::string& name);
     /// Set animation length.
     void SetLength(float length);
-    /// Create and return a track by name. If track by same name already exists, returns the existing.
+    /// Create and return a track by name. If track by same name already exists, returns the existing. Invalidates previously returned track pointers, so this is unsafe if the animation is currently used in playback.
     AnimationTrack* CreateTrack(const std::string& name);
     /// Remove a track by name. This is unsafe if the animation is currently used in playback.
     void RemoveTrack(const std::string& name);
     /// Remove all tracks. This is unsafe if the animation is currently used in playback.
     void RemoveAllTracks();
+    /// Compress all tracks by resampling at a fixed rate. This is unsafe if the animation is currently used in playback.
+    void Compress(float sampleRate = 30.0f);
 
     /// Return animation name.
     const std::string& AnimationName() const { return animationName; }
@@ -79,16 +139,20 @@ public:
     StringHash AnimationNameHash() const { return animationNameHash; }
     /// Return animation length.
     float Length() const { return length; }
-    /// Return all animation tracks.
-    const std::map<StringHash, AnimationTrack>& Tracks() const { return tracks; }
+    /// Return all animation tracks, sorted by name hash.
+    const std::vector<AnimationTrack>& Tracks() const { return tracks; }
     /// Return number of animation tracks.
     size_t NumTracks() const { return tracks.size(); }
     /// Return animation track by index.
-    AnimationTrack* Track(size_t index) const;
+    AnimationTrack* Track(size_t index) const { return index < tracks.size() ? const_cast<AnimationTrack*>(&tracks[index]) : nullptr; }
     /// Return animation track by name.
     AnimationTrack* FindTrack(const std::string& name) const;
     /// Return animation track by name hash.
     AnimationTrack* FindTrack(StringHash nameHash) const;
+    /// Return track index by name hash, or M_MAX_UNSIGNED if not found.
+    size_t FindTrackIndex(StringHash nameHash) const;
+    /// Return the bindings of the tracks to the bones of a model's skeleton under its root bone, in track order. Cached per model on first use.
+    const std::vector<AnimationBoneBinding>& BoneBindings(Model* model) const;
 
 private:
     /// Animation name.
@@ -97,6 +161,8 @@ private:
     StringHash animationNameHash;
     /// Animation length.
     float length;
-    /// Animation tracks.
-    std::map<StringHash, AnimationTrack> tracks;
+    /// Animation tracks sorted by name hash.
+    std::vector<AnimationTrack> tracks;
+    /// Cached track to bone bindings per model.
+    mutable std::vector<AnimationSkeletonBinding> skeletonBindings;
 };
@@ -4,10 +4,251 @@
 #include "AnimatedModel.h"
 #include "Animation.h"
 #include "AnimationState.h"
+#include "Model.h"
+
+#include <cstring>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define TURSO3D_ANIMATION_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TURSO3D_ANIMATION_SSE
+#endif
+
+bool AnimationState::fastMath = false;
+
+#if defined(TURSO3D_ANIMATION_AVX)
+/// Return inverse lengths from squared lengths. In fast mode, refine the reciprocal square root estimate with one Newton step instead of dividing.
+static inline __m256 InverseLength(__m256 lenSq, bool fast)
+{
+    lenSq = _mm256_max_ps(lenSq, _mm256_set1_ps(M_EPSILON));
+    if (!fast)
+        return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(lenSq));
+
+    __m256 y = _mm256_rsqrt_ps(lenSq);
+    __m256 yy = _mm256_mul_ps(y, y);
+    return _mm256_mul_ps(y, _mm256_sub_ps(_mm256_set1_ps(1.5f), _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), lenSq), yy)));
+}
+#elif defined(TURSO3D_ANIMATION_SSE)
+/// Return inverse lengths from squared lengths. In fast mode, refine the reciprocal square root estimate with one Newton step instead of dividing.
+static inline __m128 InverseLength(__m128 lenSq, bool fast)
+{
+    lenSq = _mm_max_ps(lenSq, _mm_set1_ps(M_EPSILON));
+    if (!fast)
+        return _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(lenSq));
+
+    __m128 y = _mm_rsqrt_ps(lenSq);
+    __m128 yy = _mm_mul_ps(y, y);
+    return _mm_mul_ps(y, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), lenSq), yy)));
+}
+#endif
+
+/// Interpolate the keyframes of each bone, then blend the result onto the pose by the per-channel weights. Rotations use normalized lerp along the shortest path, normalized with reciprocal square root estimates in fast mode.
+static void BlendPose(AnimationPoseBuffer& buffer, size_t numBones, bool fast)
+{
+    AnimationPose& pose = buffer.pose;
+    const size_t stride = pose.stride;
+    float* dest[POSE_CHANNELS];
+    const float* keys[POSE_CHANNELS];
+    const float* nextKeys[POSE_CHANNELS];
+    for (size_t c = 0; c < POSE_CHANNELS; ++c)
+    {
+        dest[c] = pose.Channel(c);
+        keys[c] = buffer.keys.Channel(c);
+        nextKeys[c] = buffer.nextKeys.Channel(c);
+    }
+    const float* times = &buffer.times[0];
+    const float* weights[3] = { &buffer.weights[0], &buffer.weights[stride], &buffer.weights[2 * stride] };
+
+    size_t i = 0;
+
+    #if defined(TURSO3D_ANIMATION_AVX)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+    for (; i < numBones; i += 8)
+    {
+        __m256 t = _mm256_loadu_ps(times + i);
+
+        for (size_t c = 0; c < POSE_CHANNELS; c += (c == POSE_ROTATION ? 4 : 1))
+        {
+            if (c == POSE_ROTATION)
+            {
+                __m256 k0[4], k1[4], p[4];
+                for (size_t j = 0; j < 4; ++j)
+                {
+                    k0[j] = _mm256_loadu_ps(keys[c + j] + i);
+                    k1[j] = _mm256_loadu_ps(nextKeys[c + j] + i);
+                    p[j] = _mm256_loadu_ps(dest[c + j] + i);
+                }
+
+                // Flip the target to the shortest path by xoring the sign bit of the dot product, then lerp and normalize
+                __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(k0[0], k1[0]), _mm256_mul_ps(k0[1], k1[1])), _mm256_add_ps(_mm256_mul_ps(k0[2], k1[2]), _mm256_mul_ps(k0[3], k1[3])));
+                __m256 sign = _mm256_and_ps(dot, signMask);
+                __m256 s[4];
+                for (size_t j = 0; j < 4; ++j)
+                    s[j] = _mm256_add_ps(k0[j], _mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(k1[j], sign), k0[j]), t));
+                __m256 lenSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(s[0], s[0]), _mm256_mul_ps(s[1], s[1])), _mm256_add_ps(_mm256_mul_ps(s[2], s[2]), _mm256_mul_ps(s[3], s[3])));
+                __m256 invLen = InverseLength(lenSq, fast);
+
+                __m256 w = _mm256_loadu_ps(weights[1] + i);
+                dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p[0], s[0]), _mm256_mul_ps(p[1], s[1])), _mm256_add_ps(_mm256_mul_ps(p[2], s[2]), _mm256_mul_ps(p[3], s[3])));
+                sign = _mm256_and_ps(dot, signMask);
+                __m256 r[4];
+                for (size_t j = 0; j < 4; ++j)
+                    r[j] = _mm256_add_ps(p[j], _mm256_mul_ps(_mm256_sub_ps(_mm256_xor_ps(_mm256_mul_ps(s[j], invLen), sign), p[j]), w));
+                lenSq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r[0], r[0]), _mm256_mul_ps(r[1], r[1])), _mm256_add_ps(_mm256_mul_ps(r[2], r[2]), _mm256_mul_ps(r[3], r[3])));
+                invLen = InverseLength(lenSq, fast);
+
+                // Leave untouched bones bit-exact
+                __m256 touched = _mm256_cmp_ps(w, zero, _CMP_GT_OQ);
+                for (size_t j = 0; j < 4; ++j)
+                    _mm256_storeu_ps(dest[c + j] + i, _mm256_blendv_ps(p[j], _mm256_mul_ps(r[j], invLen), touched));
+            }
+            else
+            {
+                __m256 w = _mm256_loadu_ps(weights[c < POSE_ROTATION ? 0 : 2] + i);
+                __m256 k0 = _mm256_loadu_ps(keys[c] + i);
+                __m256 s = _mm256_add_ps(k0, _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(nextKeys[c] + i), k0), t));
+                __m256 p = _mm256_loadu_ps(dest[c] + i);
+                _mm256_storeu_ps(dest[c] + i, _mm256_add_ps(p, _mm256_mul_ps(_mm256_sub_ps(s, p), w)));
+            }
+        }
+    }
+    #elif defined(TURSO3D_ANIMATION_SSE)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    for (; i < numBones; i += 4)
+    {
+        __m128 t = _mm_loadu_ps(times + i);
+
+        for (size_t c = 0; c < POSE_CHANNELS; c += (c == POSE_ROTATION ? 4 : 1))
+        {
+            if (c == POSE_ROTATION)
+            {
+                __m128 k0[4], k1[4], p[4];
+                for (size_t j = 0; j < 4; ++j)
+                {
+                    k0[j] = _mm_loadu_ps(keys[c + j] + i);
+                    k1[j] = _mm_loadu_ps(nextKeys[c + j] + i);
+                    p[j] = _mm_loadu_ps(dest[c + j] + i);
+                }
+
+                // Flip the target to the shortest path by xoring the sign bit of the dot product, then lerp and normalize
+                __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(k0[0], k1[0]), _mm_mul_ps(k0[1], k1[1])), _mm_add_ps(_mm_mul_ps(k0[2], k1[2]), _mm_mul_ps(k0[3], k1[3])));
+                __m128 sign = _mm_and_ps(dot, signMask);
+                __m128 s[4];
+                for (size_t j = 0; j < 4; ++j)
+                    s[j] = _mm_add_ps(k0[j], _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(k1[j], sign), k0[j]), t));
+                __m128 lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], s[0]), _mm_mul_ps(s[1], s[1])), _mm_add_ps(_mm_mul_ps(s[2], s[2]), _mm_mul_ps(s[3], s[3])));
+                __m128 invLen = InverseLength(lenSq, fast);
+
+                __m128 w = _mm_loadu_ps(weights[1] + i);
+                dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p[0], s[0]), _mm_mul_ps(p[1], s[1])), _mm_add_ps(_mm_mul_ps(p[2], s[2]), _mm_mul_ps(p[3], s[3])));
+                sign = _mm_and_ps(dot, signMask);
+                __m128 r[4];
+                for (size_t j = 0; j < 4; ++j)
+                    r[j] = _mm_add_ps(p[j], _mm_mul_ps(_mm_sub_ps(_mm_xor_ps(_mm_mul_ps(s[j], invLen), sign), p[j]), w));
+                lenSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r[0], r[0]), _mm_mul_ps(r[1], r[1])), _mm_add_ps(_mm_mul_ps(r[2], r[2]), _mm_mul_ps(r[3], r[3])));
+                invLen = InverseLength(lenSq, fast);
+
+                // Leave untouched bones bit-exact
+                __m128 touched = _mm_cmpgt_ps(w, zero);
+                for (size_t j = 0; j < 4; ++j)
+                {
+                    __m128 result = _mm_mul_ps(r[j], invLen);
+                    _mm_storeu_ps(dest[c + j] + i, _mm_or_ps(_mm_and_ps(touched, result), _mm_andnot_ps(touched, p[j])));
+                }
+            }
+            else
+            {
+                __m128 w = _mm_loadu_ps(weights[c < POSE_ROTATION ? 0 : 2] + i);
+                __m128 k0 = _mm_loadu_ps(keys[c] + i);
+                __m128 s = _mm_add_ps(k0, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(nextKeys[c] + i), k0), t));
+                __m128 p = _mm_loadu_ps(dest[c] + i);
+                _mm_storeu_ps(dest[c] + i, _mm_add_ps(p, _mm_mul_ps(_mm_sub_ps(s, p), w)));
+            }
+        }
+    }
+    #else
+    for (; i < numBones; ++i)
+    {
+        float t = times[i];
+
+        for (size_t c = 0; c < POSE_CHANNELS; ++c)
+        {
+            if (c >= POSE_ROTATION && c < POSE_SCALE)
+                continue;
+            float s = keys[c][i] + (nextKeys[c][i] - keys[c][i]) * t;
+            dest[c][i] += (s - dest[c][i]) * weights[c < POSE_ROTATION ? 0 : 2][i];
+        }
+
+        float w = weights[1][i];
+        if (w > 0.0f)
+        {
+            Quaternion key(keys[3][i], keys[4][i], keys[5][i], keys[6][i]);
+            Quaternion nextKey(nextKeys[3][i], nextKeys[4][i], nextKeys[5][i], nextKeys[6][i]);
+            Quaternion current(dest[3][i], dest[4][i], dest[5][i], dest[6][i]);
+            Quaternion result = current.Nlerp(key.Nlerp(nextKey, t, true), w, true);
+            dest[3][i] = result.w;
+            dest[4][i] = result.x;
+            dest[5][i] = result.y;
+            dest[6][i] = result.z;
+        }
+    }
+    #endif
+}
+
+AnimationPose::AnimationPose() :
+    stride(0)
+{
+}
+
+void AnimationPose::Resize(size_t numBones)
+{
+    stride = (numBones + POSE_LANES - 1) & ~(POSE_LANES - 1);
+    data.resize(POSE_CHANNELS * stride);
+
+    // Keep the padding lanes identity so that normalization in the SIMD blend stays finite
+    for (size_t i = 0; i < stride; ++i)
+        SetTransform(i, Vector3::ZERO, Quaternion::IDENTITY, Vector3::ONE);
+}
+
+void AnimationPose::SetTransform(size_t index, const Vector3& position, const Quaternion& rotation, const Vector3& scale)
+{
+    data[index] = position.x;
+    data[stride + index] = position.y;
+    data[2 * stride + index] = position.z;
+    data[3 * stride + index] = rotation.w;
+    data[4 * stride + index] = rotation.x;
+    data[5 * stride + index] = rotation.y;
+    data[6 * stride + index] = rotation.z;
+    data[7 * stride + index] = scale.x;
+    data[8 * stride + index] = scale.y;
+    data[9 * stride + index] = scale.z;
+}
+
+AnimationPoseBuffer::AnimationPoseBuffer() :
+    timeStep(0.0f),
+    skipLeafBones(false)
+{
+}
+
+void AnimationPoseBuffer::Resize(size_t numBones)
+{
+    pose.Resize(numBones);
+    keys.Resize(numBones);
+    nextKeys.Resize(numBones);
+    times.resize(pose.stride);
+    weights.resize(3 * pose.stride);
+}
 
 AnimationStateTrack::AnimationStateTrack() :
     track(nullptr),
     node(nullptr),
+    boneIndex(0),
     weight(1.0f),
     keyFrame(0)
 {
@@ -23,7 +264,8 @@ AnimationState::AnimationState(AnimatedModelDrawable* drawable_, Animation* anim
     looped(false),
     weight(0.0f),
     time(0.0f),
-    blendLayer(0)
+    blendLayer(0),
+    boneWeightsSet(false)
 {
     assert(drawable);
     assert(animation);
@@ -39,31 +281,32 @@ AnimationState::AnimationState(SpatialNode* node, Animation* animation_) :
     looped(false),
     weight(1.0f),
     time(0.0f),
-    blendLayer(0)
+    blendLayer(0),
+    boneWeightsSet(false)
 {
     assert(node);
     assert(animation);
 
-    const std::map<StringHash, AnimationTrack>& tracks = animation->Tracks();
+    const std::vector<AnimationTrack>& tracks = animation->Tracks();
     stateTracks.clear();
 
     for (auto it = tracks.begin(); it != tracks.end(); ++it)
     {
-        if (it->second.keyFrames.empty())
+        if (!it->NumKeyFrames())
             continue;
 
         AnimationStateTrack stateTrack;
-        stateTrack.track = &it->second;
+        stateTrack.track = &(*it);
 
-        if (node->NameHash() == it->second.nameHash || tracks.size() == 1)
+        if (node->NameHash() == it->nameHash || tracks.size() == 1)
             stateTrack.node = node;
         else
         {
-            SpatialNode* targetNode = node->FindChild<SpatialNode>(it->second.nameHash, true);
+            SpatialNode* targetNode = node->FindChild<SpatialNode>(it->nameHash, true);
             if (targetNode)
                 stateTrack.node = targetNode;
             else
-                LOGWARNING("Node " + it->second.name + " not found for node animation " + animation->Name());
+                LOGWARNING("Node " + it->name + " not found for node animation " + animation->Name());
         }
 
         if (stateTrack.node)
@@ -88,20 +331,46 @@ void AnimationState::SetStartBone(Bone* startBone_)
         return;
 
     startBone = startBone_;
+    boneWeightsSet = false;
 
-    const std::map<StringHash, AnimationTrack>& tracks = animation->Tracks();
+    const std::vector<AnimationTrack>& tracks = animation->Tracks();
+    const AutoArrayPtr<Bone*>& bones = drawable->Bones();
     stateTracks.clear();
 
+    // With the default start bone, use the track to bone bindings cached for the model to avoid searching the bone hierarchy
+    Model* model = drawable->GetModel();
+    if (startBone == drawable->RootBone() && model && model->Bones().size() == drawable->NumBones())
+    {
+        const std::vector<AnimationBoneBinding>& bindings = animation->BoneBindings(model);
+        stateTracks.reserve(bindings.size());
+
+        for (auto it = bindings.begin(); it != bindings.end(); ++it)
+        {
+            const AnimationTrack& track = tracks[it->trackIndex];
+            if (!track.NumKeyFrames())
+                continue;
+
+            AnimationStateTrack stateTrack;
+            stateTrack.track = &track;
+            stateTrack.node = bones[it->boneIndex];
+            stateTrack.boneIndex = it->boneIndex;
+            stateTracks.push_back(stateTrack);
+        }
+
+        drawable->OnAnimationOrderChanged();
+        return;
+    }
+
     for (auto it  = tracks.begin(); it != tracks.end(); ++it)
     {
-        if (it->second.keyFrames.empty())
+        if (!it->NumKeyFrames())
             continue;
 
         AnimationStateTrack stateTrack;
-        stateTrack.track = &it->second;
+        stateTrack.track = &(*it);
 
         // Include those tracks that are either the start bone itself, or its children
-        const StringHash& nameHash = it->second.nameHash;
+        const StringHash& nameHash = it->nameHash;
 
         if (nameHash == startBone->NameHash())
             stateTrack.node = startBone;
@@ -109,7 +378,17 @@ void AnimationState::SetStartBone(Bone* startBone_)
             stateTrack.node = startBone->FindChild<Bone>(nameHash, true);
 
         if (stateTrack.node)
-            stateTracks.push_back(stateTrack);
+        {
+            for (size_t i = 0; i < drawable->NumBones(); ++i)
+            {
+                if (bones[i] == stateTrack.node)
+                {
+                    stateTrack.boneIndex = i;
+                    stateTracks.push_back(stateTrack);
+                    break;
+                }
+            }
+        }
     }
 
     drawable->OnAnimationOrderChanged();
@@ -155,6 +434,7 @@ void AnimationState::SetBoneWeight(size_t index, float weight_, bool recursive)
     if (weight_ != stateTracks[index].weight)
     {
         stateTracks[index].weight = weight_;
+        boneWeightsSet = true;
         if (drawable)
             drawable->OnAnimationChanged();
     }
@@ -275,6 +555,16 @@ float AnimationState::Length() const
     return animation->Length();
 }
 
+bool AnimationState::IsShareable() const
+{
+    return drawable && startBone == drawable->RootBone() && !boneWeightsSet;
+}
+
+void AnimationState::SetFastMath(bool enable)
+{
+    fastMath = enable;
+}
+
 void AnimationState::Apply()
 {
     if (drawable)
@@ -296,51 +586,21 @@ void AnimationState::ApplyToModel()
         if (Equals(finalWeight, 0.0f) || !bone->AnimationEnabled())
             continue;
 
-        track->FindKeyFrameIndex(time, stateTrack.keyFrame);
-        const AnimationKeyFrame& keyFrame = track->keyFrames[stateTrack.keyFrame];
-
-        // Check if next frame to interpolate to is valid, or if wrapping is needed (looping animation only)
-        size_t nextFrame = stateTrack.keyFrame + 1;
-        bool interpolate = true;
-        if (nextFrame >= track->keyFrames.size())
-        {
-            if (!looped)
-            {
-                nextFrame = stateTrack.keyFrame;
-                interpolate = false;
-            }
-            else
-                nextFrame = 0;
-        }
+        AnimationKeyFrame keyFrame;
+        AnimationKeyFrame nextKeyFrame;
+        float t;
+        track->Sample(time, animation->Length(), looped, stateTrack.keyFrame, keyFrame, nextKeyFrame, t);
 
         Vector3 newPosition = bone->Position();
         Quaternion newRotation = bone->Rotation();
         Vector3 newScale = bone->Scale();
 
-        if (interpolate)
-        {
-            const AnimationKeyFrame& nextKeyFrame = track->keyFrames[nextFrame];
-            float timeInterval = nextKeyFrame.time - keyFrame.time;
-            if (timeInterval < 0.0f)
-                timeInterval += animation->Length();
-            float t = timeInterval > 0.0f ? (time - keyFrame.time) / timeInterval : 1.0f;
-
-            if (track->channelMask & CHANNEL_POSITION)
-                newPosition = keyFrame.position.Lerp(nextKeyFrame.position, t);
-            if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = keyFrame.rotation.Slerp(nextKeyFrame.rotation, t);
-            if (track->channelMask & CHANNEL_SCALE)
-                newScale = keyFrame.scale.Lerp(nextKeyFrame.scale, t);
-        }
-        else
-        {
-            if (track->channelMask & CHANNEL_POSITION)
-                newPosition = keyFrame.position;
-            if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = keyFrame.rotation;
-            if (track->channelMask & CHANNEL_SCALE)
-                newScale = keyFrame.scale;
-        }
+        if (track->channelMask & CHANNEL_POSITION)
+            newPosition = keyFrame.position.Lerp(nextKeyFrame.position, t);
+        if (track->channelMask & CHANNEL_ROTATION)
+            newRotation = fastMath ? keyFrame.rotation.SlerpFast(nextKeyFrame.rotation, t) : keyFrame.rotation.Slerp(nextKeyFrame.rotation, t);
+        if (track->channelMask & CHANNEL_SCALE)
+            newScale = keyFrame.scale.Lerp(nextKeyFrame.scale, t);
 
         // If not full weight, blend
         if (weight < 1.0f)
@@ -348,7 +608,7 @@ void AnimationState::ApplyToModel()
             if (track->channelMask & CHANNEL_POSITION)
                 newPosition = bone->Position().Lerp(newPosition, weight);
             if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = bone->Rotation().Slerp(newRotation, weight);
+                newRotation = fastMath ? bone->Rotation().SlerpFast(newRotation, weight) : bone->Rotation().Slerp(newRotation, weight);
             if (track->channelMask & CHANNEL_SCALE)
                 newScale = bone->Scale().Lerp(newScale, weight);
         }
@@ -357,6 +617,46 @@ void AnimationState::ApplyToModel()
     }
 }
 
+void AnimationState::ApplyToPose(AnimationPoseBuffer& buffer)
+{
+    size_t numBones = drawable->NumBones();
+    const AutoArrayPtr<Bone*>& bones = drawable->Bones();
+
+    memset(&buffer.weights[0], 0, buffer.weights.size() * sizeof(float));
+
+    // Round the time for animation sharing, so that all models sharing the pose see the same result regardless of which one evaluated it
+    float sampleTime = time;
+    if (buffer.timeStep > 0.0f)
+        sampleTime = Min(floorf(time / buffer.timeStep + 0.5f) * buffer.timeStep, animation->Length());
+
+    // Sample the keyframe pair of each track. The interpolation itself is left to the SIMD blend
+    for (auto it = stateTracks.begin(); it != stateTracks.end(); ++it)
+    {
+        AnimationStateTrack& stateTrack = *it;
+        const AnimationTrack* track = stateTrack.track;
+        float finalWeight = weight * stateTrack.weight;
+        size_t index = stateTrack.boneIndex;
+
+        // Do not apply if zero effective weight or the bone has animation disabled
+        if (Equals(finalWeight, 0.0f) || !bones[index]->AnimationEnabled() || (buffer.skipLeafBones && !bones[index]->NumChildBones()))
+            continue;
+
+        AnimationKeyFrame keyFrame;
+        AnimationKeyFrame nextKeyFrame;
+        float t;
+        track->Sample(sampleTime, animation->Length(), looped, stateTrack.keyFrame, keyFrame, nextKeyFrame, t);
+
+        buffer.keys.SetTransform(index, keyFrame.position, keyFrame.rotation, keyFrame.scale);
+        buffer.nextKeys.SetTransform(index, nextKeyFrame.position, nextKeyFrame.rotation, nextKeyFrame.scale);
+        buffer.times[index] = t;
+        buffer.weights[index] = (track->channelMask & CHANNEL_POSITION) ? finalWeight : 0.0f;
+        buffer.weights[buffer.pose.stride + index] = (track->channelMask & CHANNEL_ROTATION) ? finalWeight : 0.0f;
+        buffer.weights[2 * buffer.pose.stride + index] = (track->channelMask & CHANNEL_SCALE) ? finalWeight : 0.0f;
+    }
+
+    BlendPose(buffer, numBones, fastMath);
+}
+
 void AnimationState::ApplyToNodes()
 {
     // When applying to a node hierarchy, can only use full weight (nothing to blend to)
@@ -366,51 +666,21 @@ void AnimationState::ApplyToNodes()
         const AnimationTrack* track = stateTrack.track;
         SpatialNode* node = stateTrack.node;
 
-        track->FindKeyFrameIndex(time, stateTrack.keyFrame);
-        const AnimationKeyFrame& keyFrame = track->keyFrames[stateTrack.keyFrame];
-
-        // Check if next frame to interpolate to is valid, or if wrapping is needed (looping animation only)
-        size_t nextFrame = stateTrack.keyFrame + 1;
-        bool interpolate = true;
-        if (nextFrame >= track->keyFrames.size())
-        {
-            if (!looped)
-            {
-                nextFrame = stateTrack.keyFrame;
-                interpolate = false;
-            }
-            else
-                nextFrame = 0;
-        }
+        AnimationKeyFrame keyFrame;
+        AnimationKeyFrame nextKeyFrame;
+        float t;
+        track->Sample(time, animation->Length(), looped, stateTrack.keyFrame, keyFrame, nextKeyFrame, t);
 
         Vector3 newPosition = node->Position();
         Quaternion newRotation = node->Rotation();
         Vector3 newScale = node->Scale();
 
-        if (interpolate)
-        {
-            const AnimationKeyFrame& nextKeyFrame = track->keyFrames[nextFrame];
-            float timeInterval = nextKeyFrame.time - keyFrame.time;
-            if (timeInterval < 0.0f)
-                timeInterval += animation->Length();
-            float t = timeInterval > 0.0f ? (time - keyFrame.time) / timeInterval : 1.0f;
-
-            if (track->channelMask & CHANNEL_POSITION)
-                newPosition = keyFrame.position.Lerp(nextKeyFrame.position, t);
-            if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = keyFrame.rotation.Slerp(nextKeyFrame.rotation, t);
-            if (track->channelMask & CHANNEL_SCALE)
-                newScale = keyFrame.scale.Lerp(nextKeyFrame.scale, t);
-        }
-        else
-        {
-            if (track->channelMask & CHANNEL_POSITION)
-                newPosition = keyFrame.position;
-            if (track->channelMask & CHANNEL_ROTATION)
-                newRotation = keyFrame.rotation;
-            if (track->channelMask & CHANNEL_SCALE)
-                newScale = keyFrame.scale;
-        }
+        if (track->channelMask & CHANNEL_POSITION)
+            newPosition = keyFrame.position.Lerp(nextKeyFrame.position, t);
+        if (track->channelMask & CHANNEL_ROTATION)
+            newRotation = fastMath ? keyFrame.rotation.SlerpFast(nextKeyFrame.rotation, t) : keyFrame.rotation.Slerp(nextKeyFrame.rotation, t);
+        if (track->channelMask & CHANNEL_SCALE)
+            newScale = keyFrame.scale.Lerp(nextKeyFrame.scale, t);
 
         node->SetTransform(newPosition, newRotation, newScale);
     }
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "../IO/StringHash.h"
+#include "../Math/Quaternion.h"
 #include "../Object/Ptr.h"
 
 #include <vector>
@@ -13,6 +14,70 @@ class Bone;
 class SpatialNode;
 struct AnimationTrack;
 
+/// First float channel of bone positions in an animation pose.
+static const size_t POSE_POSITION = 0;
+/// First float channel of bone rotations in an animation pose.
+static const size_t POSE_ROTATION = 3;
+/// First float channel of bone scales in an animation pose.
+static const size_t POSE_SCALE = 7;
+/// Number of float channels in an animation pose.
+static const size_t POSE_CHANNELS = 10;
+/// Bone count granularity of animation poses, so that the widest SIMD blend never reads past the end.
+static const size_t POSE_LANES = 8;
+
+/// Skeleton local pose stored as structure-of-arrays, one float channel per transform component, so that several bones can be sampled and blended at once.
+struct AnimationPose
+{
+    /// Construct.
+    AnimationPose();
+
+    /// Resize for a number of bones. The channels are padded to a multiple of POSE_LANES.
+    void Resize(size_t numBones);
+    /// Set a bone's transform.
+    void SetTransform(size_t index, const Vector3& position, const Quaternion& rotation, const Vector3& scale);
+
+    /// Return a float channel.
+    float* Channel(size_t channel) { return &data[channel * stride]; }
+    /// Return a float channel.
+    const float* Channel(size_t channel) const { return &data[channel * stride]; }
+    /// Return a bone's position.
+    Vector3 Position(size_t index) const { return Vector3(data[index], data[stride + index], data[2 * stride + index]); }
+    /// Return a bone's rotation.
+    Quaternion Rotation(size_t index) const { return Quaternion(data[3 * stride + index], data[4 * stride + index], data[5 * stride + index], data[6 * stride + index]); }
+    /// Return a bone's scale.
+    Vector3 Scale(size_t index) const { return Vector3(data[7 * stride + index], data[8 * stride + index], data[9 * stride + index]); }
+
+    /// Channel data.
+    std::vector<float> data;
+    /// Padded number of bones per channel.
+    size_t stride;
+};
+
+/// Flat animation evaluation buffers of an animated model. Animation states sample their keyframes here, then blend them onto the pose in SIMD groups.
+struct AnimationPoseBuffer
+{
+    /// Construct.
+    AnimationPoseBuffer();
+
+    /// Resize for a number of bones.
+    void Resize(size_t numBones);
+
+    /// Blended local pose.
+    AnimationPose pose;
+    /// Sampled keyframes to interpolate from.
+    AnimationPose keys;
+    /// Sampled keyframes to interpolate to.
+    AnimationPose nextKeys;
+    /// Keyframe interpolation factors.
+    std::vector<float> times;
+    /// Blend weights of position, rotation and scale, one channel each. Zero for bones the animation state does not touch.
+    std::vector<float> weights;
+    /// Time step to round the animation states' time positions to when sampling, for animation sharing. 0 samples at the exact time.
+    float timeStep;
+    /// Whether to leave bones without child bones unanimated, for animation LOD.
+    bool skipLeafBones;
+};
+
 /// %Animation instance per-track data.
 struct AnimationStateTrack
 {
@@ -25,6 +90,8 @@ struct AnimationStateTrack
     const AnimationTrack* track;
     /// %Scene node. May be a model's bone or a plain scene node.
     SpatialNode* node;
+    /// Bone index in the animated model (model mode.)
+    size_t boneIndex;
     /// Blending weight.
     float weight;
     /// Last key frame.
@@ -91,9 +158,18 @@ public:
     float Length() const;
     /// Return blending layer.
     unsigned char BlendLayer() const { return blendLayer; }
+    /// Return whether the result depends only on the animation, time position, weight and looping, so that it can be shared by models in animation sharing mode. False if a start bone or per-bone weights have been set.
+    bool IsShareable() const;
 
     /// Apply the animation at the current time position. Called by AnimatedModel. Needs to be called manually for node hierarchies.
     void Apply();
+    /// Sample and blend the animation onto a flat skeleton pose at the current time position. Called by AnimatedModel instead of Apply().
+    void ApplyToPose(AnimationPoseBuffer& buffer);
+
+    /// Set fast approximate math for all animation states: rotations are interpolated with a corrected normalized lerp instead of slerp. Called by Renderer.
+    static void SetFastMath(bool enable);
+    /// Return whether fast approximate math is enabled.
+    static bool FastMath() { return fastMath; }
 
 private:
     /// Apply animation to a skeleton. Transform changes are applied silently, so the model needs to dirty its root model afterward.
@@ -119,4 +195,9 @@ private:
     float time;
     /// Blending layer.
     unsigned char blendLayer;
+    /// Per-bone weights set flag.
+    bool boneWeightsSet;
+
+    /// Fast approximate math flag.
+    static bool fastMath;
 };
@@ -1,20 +1,187 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../Graphics/IndirectBuffer.h"
+#include "../Thread/WorkQueue.h"
 #include "Batch.h"
 #include "GeometryNode.h"
 #include "Material.h"
+#include "OcclusionBuffer.h"
 
 #include <algorithm>
+#include <cstring>
 #include <tracy/Tracy.hpp>
 
-inline bool CompareBatchKeys(const Batch& lhs, const Batch& rhs)
+static_assert(sizeof(Batch) == 32, "Unexpected Batch size");
+
+static const size_t RADIX_BITS = 8;
+static const size_t RADIX_BUCKETS = 1 << RADIX_BITS;
+static const size_t RADIX_PASSES = 64 / RADIX_BITS;
+static const size_t MIN_SORT_CHUNK_SIZE = 4096;
+
+/// Convert a float to unsigned bits that sort in the same order.
+static inline unsigned FloatSortBits(float value)
+{
+    unsigned bits;
+    memcpy(&bits, &value, sizeof bits);
+    return (bits & 0x80000000) ? ~bits : (bits | 0x80000000);
+}
+
+/// Return the program bits for sorting, with the batches that use the static transform table kept apart from the rest, so that they form their own instancing runs.
+static inline unsigned long long SortProgramBits(const Batch& batch)
+{
+    return batch.programBits | (batch.staticIndex != M_MAX_UNSIGNED ? 0x80 : 0);
+}
+
+/// Return whether a static batch is instanced by its static transform table index.
+static inline bool UseStaticIndex(const Batch& batch, const std::vector<Vector2>* staticInstances)
+{
+    return staticInstances && !batch.programBits && batch.staticIndex != M_MAX_UNSIGNED;
+}
+
+/// Return whether two batches can be drawn in the same instancing run. Batches using the static transform table compare the base pass, so that the instances of one material are drawn together.
+static inline bool SamePass(const Batch& batch, const Batch& other, bool indexed)
+{
+    return batch.passId == other.passId || (indexed && batch.GetPass()->BaseId() == other.GetPass()->BaseId());
+}
+
+/// Append a static transform table instance. The material table slot is zero when the batch uses the material bound for the run, otherwise the material ID plus one.
+static inline void AddStaticInstance(const Batch& batch, const Batch& runBatch, std::vector<Vector2>& staticInstances)
+{
+    Material* material = batch.GetPass()->Parent();
+    float slot = (batch.passId == runBatch.passId || material->Id() == ID_OVERFLOW) ? 0.0f : (float)(material->Id() + 1);
+    staticInstances.push_back(Vector2((float)batch.staticIndex, slot));
+}
+
+Pass* Batch::GetPass() const
+{
+    return Pass::FromId(passId);
+}
+
+void Batch::SetPass(Pass* pass)
+{
+    passId = pass ? pass->Id() : ID_OVERFLOW;
+}
+
+static inline unsigned long long BatchSortKey(const Batch& batch, BatchSortMode sortMode)
+{
+    switch (sortMode)
+    {
+    case SORT_STATE:
+        // The passes of material instances sort by their base pass, so that they can be instanced together from the static transform table
+        return ((unsigned long long)batch.GetPass()->BaseId() << 48) | ((unsigned long long)batch.geometry->Id() << 32) | (SortProgramBits(batch) << 24) |
+            ((unsigned long long)batch.passId << 8);
+
+    case SORT_STATE_AND_DISTANCE:
+        {
+            // Passes and geometries are ordered by their closest batch, using the distance keys stored during batch collection. The IDs keep states with equal distance keys apart
+            Pass* basePass = batch.GetPass()->Base();
+            unsigned long long passDistance = basePass->lastSortKey.second >> 4;
+            unsigned long long geomDistance = batch.geometry->lastSortKey.second >> 4;
+            return (passDistance << 52) | ((unsigned long long)basePass->Id() << 36) | (geomDistance << 24) | ((unsigned long long)batch.geometry->Id() << 8) |
+                SortProgramBits(batch);
+        }
+
+    default:
+        // Back to front
+        return (unsigned)~FloatSortBits(batch.distance);
+    }
+}
+
+static inline size_t RadixDigit(unsigned long long key, size_t pass)
+{
+    return (size_t)(key >> (pass * RADIX_BITS)) & (RADIX_BUCKETS - 1);
+}
+
+/// Append a drawable's skin matrices to the palette, and an instance that refers to them. The palette offset is stored in the first element of the instance data.
+static void AddSkinnedInstance(GeometryDrawable* drawable, std::vector<Matrix3x4>& instanceTransforms, std::vector<Matrix3x4>& skinMatrices)
 {
-    return lhs.sortKey < rhs.sortKey;
+    Matrix3x4 instance(Matrix3x4::IDENTITY);
+    instance.m00 = (float)skinMatrices.size();
+    instanceTransforms.push_back(instance);
+
+    size_t numMatrices;
+    const Matrix3x4* matrices = drawable->SkinMatrices(numMatrices);
+    if (matrices)
+        skinMatrices.insert(skinMatrices.end(), matrices, matrices + numMatrices);
+}
+
+/// Append draw commands for one instance of a geometry with meshlets, covering the runs of adjacent meshlets that pass culling. The instance transform, or the static transform table instance if static instances are provided, is appended only if any meshlet is visible. The run batch is the first batch of the multi-draw batch.
+static void AddMeshletCommands(const Batch& batch, const Batch& runBatch, const MeshletCullData& cull, std::vector<Matrix3x4>& instanceTransforms, std::vector<IndirectDrawCommand>& drawCommands,
+    std::vector<Vector2>* staticInstances)
+{
+    const Geometry* geometry = batch.geometry;
+    const Matrix3x4& transform = *batch.worldTransform;
+
+    // The normal cones can only be transformed under uniform scale
+    Vector3 scale = transform.Scale();
+    float maxScale = Max(scale.x, Max(scale.y, scale.z));
+    float minScale = Min(scale.x, Min(scale.y, scale.z));
+    bool backfaceCulling = cull.backfaceCulling && batch.GetPass()->Parent()->GetCullMode() == CULL_BACK && maxScale - minScale <= maxScale * 0.01f;
+    bool occlusion = cull.occlusionBuffer && cull.occlusionBuffer->HasData();
+
+    size_t firstCommand = drawCommands.size();
+    unsigned instanceIndex = (unsigned)(staticInstances ? staticInstances->size() : instanceTransforms.size());
+
+    for (auto it = geometry->meshlets.begin(); it != geometry->meshlets.end(); ++it)
+    {
+        Vector3 center = transform * it->center;
+        float radius = it->radius * maxScale;
+
+        if (cull.frustum.IsInsideFast(Sphere(center, radius)) == OUTSIDE)
+            continue;
+
+        if (backfaceCulling)
+        {
+            Vector3 axis = transform * Vector4(it->coneAxis, 0.0f) / maxScale;
+            Vector3 offset = center - cull.viewPosition;
+            float distance = cull.fastMath ? offset.LengthFast() : offset.Length();
+            if (offset.DotProduct(axis) >= it->coneCutoff * distance + radius)
+                continue;
+        }
+
+        if (occlusion && !cull.occlusionBuffer->IsVisible(BoundingBox(center - Vector3(radius, radius, radius), center + Vector3(radius, radius, radius))))
+            continue;
+
+        unsigned firstIndex = (unsigned)geometry->drawStart + it->indexStart;
+        if (drawCommands.size() > firstCommand && drawCommands.back().firstIndex + drawCommands.back().count == firstIndex)
+        {
+            drawCommands.back().count += it->indexCount;
+            continue;
+        }
+
+        if (drawCommands.size() == firstCommand)
+        {
+            if (staticInstances)
+                AddStaticInstance(batch, runBatch, *staticInstances);
+            else
+                instanceTransforms.push_back(transform);
+        }
+
+        IndirectDrawCommand command;
+        command.count = it->indexCount;
+        command.instanceCount = 1;
+        command.firstIndex = firstIndex;
+        command.baseVertex = 0;
+        command.baseInstance = instanceIndex;
+        drawCommands.push_back(command);
+    }
 }
 
-inline bool CompareBatchDistance(const Batch& lhs, const Batch& rhs)
+template <class T> static void ForEachChunk(WorkQueue* workQueue, size_t numChunks, const T& functor)
 {
-    return lhs.distance > rhs.distance;
+    if (numChunks > 1 && workQueue)
+    {
+        workQueue->ParallelFor(0, numChunks, 1, [&](size_t start, size_t end, unsigned)
+        {
+            for (size_t i = start; i < end; ++i)
+                functor(i);
+        });
+    }
+    else
+    {
+        for (size_t i = 0; i < numChunks; ++i)
+            functor(i);
+    }
 }
 
 void BatchQueue::Clear()
@@ -22,72 +189,312 @@ void BatchQueue::Clear()
     batches.clear();
 }
 
-void BatchQueue::Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced)
+void BatchQueue::Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced, std::vector<IndirectDrawCommand>* drawCommands, WorkQueue* workQueue,
+    std::vector<Matrix3x4>* skinMatrices, const MeshletCullData* meshletCull, std::vector<Vector2>* staticInstances)
 {
     ZoneScoped;
 
-    switch (sortMode)
+    if (batches.size() > 1)
     {
-    case SORT_STATE:
-        for (auto it = batches.begin(); it < batches.end(); ++it)
+        BatchRange range;
+        range.batches = &batches[0];
+        range.count = batches.size();
+        RadixSort(&range, 1, sortMode, workQueue);
+    }
+
+    if (convertToInstanced)
+        ConvertToInstanced(instanceTransforms, drawCommands, skinMatrices, meshletCull, staticInstances);
+}
+
+void BatchQueue::SortRanges(const std::vector<BatchRange>& ranges, std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced,
+    std::vector<IndirectDrawCommand>* drawCommands, WorkQueue* workQueue, std::vector<Matrix3x4>* skinMatrices, const MeshletCullData* meshletCull, std::vector<Vector2>* staticInstances)
+{
+    ZoneScoped;
+
+    size_t numBatches = 0;
+    for (auto it = ranges.begin(); it != ranges.end(); ++it)
+        numBatches += it->count;
+
+    // A single batch needs no sorting, only copying
+    if (numBatches > 1)
+        RadixSort(&ranges[0], ranges.size(), sortMode, workQueue);
+    else
+    {
+        batches.clear();
+        for (auto it = ranges.begin(); it != ranges.end(); ++it)
+            batches.insert(batches.end(), it->batches, it->batches + it->count);
+    }
+
+    if (convertToInstanced)
+        ConvertToInstanced(instanceTransforms, drawCommands, skinMatrices, meshletCull, staticInstances);
+}
+
+void BatchQueue::RadixSort(const BatchRange* ranges, size_t numRanges, BatchSortMode sortMode, WorkQueue* workQueue)
+{
+    size_t numBatches = 0;
+    for (size_t i = 0; i < numRanges; ++i)
+        numBatches += ranges[i].count;
+
+    // Split into fixed chunks, so that the histograms of each chunk can be turned into scatter offsets. Chunks do not cross range boundaries
+    size_t numThreadChunks = 1;
+    if (workQueue)
+        numThreadChunks = Max(Min(numBatches / MIN_SORT_CHUNK_SIZE, (size_t)workQueue->NumThreads()), (size_t)1);
+    size_t chunkSize = (numBatches + numThreadChunks - 1) / numThreadChunks;
+    // Small sorts run on the calling thread, even if split by the ranges
+    if (numThreadChunks == 1)
+        workQueue = nullptr;
+
+    sortChunks.clear();
+    unsigned offset = 0;
+    for (size_t i = 0; i < numRanges; ++i)
+    {
+        for (size_t start = 0; start < ranges[i].count; start += chunkSize)
         {
-            unsigned short materialId = (unsigned short)((size_t)it->pass / sizeof(Pass));
-            unsigned short geomId = (unsigned short)((size_t)it->geometry / sizeof(Geometry));
+            BatchSortChunk chunk;
+            chunk.range = (unsigned)i;
+            chunk.start = (unsigned)start;
+            chunk.end = (unsigned)Min(start + chunkSize, ranges[i].count);
+            chunk.offset = offset;
+            sortChunks.push_back(chunk);
+            offset += chunk.end - chunk.start;
+        }
+    }
+
+    size_t numChunks = sortChunks.size();
+    sortEntries.resize(numBatches);
+    sortTemp.resize(numBatches);
+    sortHistograms.assign(numChunks * RADIX_PASSES * RADIX_BUCKETS, 0);
+
+    // Build the keys and the digit histograms of all passes at once
+    ForEachChunk(workQueue, numChunks, [&](size_t chunkIndex)
+    {
+        const BatchSortChunk& chunk = sortChunks[chunkIndex];
+        const Batch* rangeBatches = ranges[chunk.range].batches;
+        BatchSortEntry* entries = &sortEntries[chunk.offset];
+        unsigned* histograms = &sortHistograms[chunkIndex * RADIX_PASSES * RADIX_BUCKETS];
 
-            it->sortKey = (((unsigned)materialId) << 16) | geomId;
+        for (unsigned i = chunk.start; i < chunk.end; ++i)
+        {
+            unsigned long long key = BatchSortKey(rangeBatches[i], sortMode);
+            entries->key = key;
+            entries->index = i;
+            entries->range = chunk.range;
+            ++entries;
+
+            for (size_t pass = 0; pass < RADIX_PASSES; ++pass)
+                ++histograms[pass * RADIX_BUCKETS + RadixDigit(key, pass)];
         }
-        std::sort(batches.begin(), batches.end(), CompareBatchKeys);
-        break;
+    });
 
-    case SORT_STATE_AND_DISTANCE:
-        for (auto it = batches.begin(); it < batches.end(); ++it)
+    BatchSortEntry* src = &sortEntries[0];
+    BatchSortEntry* dest = &sortTemp[0];
+    bool histogramsValid = true;
+
+    for (size_t pass = 0; pass < RADIX_PASSES; ++pass)
+    {
+        // Skip passes where all keys have the same digit. The total counts do not depend on the order
+        size_t firstDigit = RadixDigit(src[0].key, pass);
+        size_t sameDigitCount = 0;
+        for (size_t chunk = 0; chunk < numChunks; ++chunk)
+            sameDigitCount += sortHistograms[(chunk * RADIX_PASSES + pass) * RADIX_BUCKETS + firstDigit];
+        if (sameDigitCount == numBatches)
+            continue;
+
+        // After the first scatter, the per-chunk histograms no longer match the chunks' contents
+        if (!histogramsValid && numChunks > 1)
+        {
+            ForEachChunk(workQueue, numChunks, [&](size_t chunkIndex)
+            {
+                const BatchSortChunk& chunk = sortChunks[chunkIndex];
+                size_t start = chunk.offset;
+                size_t end = start + chunk.end - chunk.start;
+                unsigned* histogram = &sortHistograms[(chunkIndex * RADIX_PASSES + pass) * RADIX_BUCKETS];
+
+                memset(histogram, 0, RADIX_BUCKETS * sizeof(unsigned));
+                for (size_t i = start; i < end; ++i)
+                    ++histogram[RadixDigit(src[i].key, pass)];
+            });
+        }
+
+        // Convert the counts to destination offsets, ordered by digit, then by chunk
+        unsigned digitOffset = 0;
+        for (size_t digit = 0; digit < RADIX_BUCKETS; ++digit)
         {
-            unsigned short materialId = it->pass->lastSortKey.second;
-            unsigned short geomId = it->geometry->lastSortKey.second;
-            
-            it->sortKey = (((unsigned)materialId) << 16) | geomId;
+            for (size_t chunk = 0; chunk < numChunks; ++chunk)
+            {
+                unsigned& count = sortHistograms[(chunk * RADIX_PASSES + pass) * RADIX_BUCKETS + digit];
+                unsigned chunkCount = count;
+                count = digitOffset;
+                digitOffset += chunkCount;
+            }
         }
-        std::sort(batches.begin(), batches.end(), CompareBatchKeys);
-        break;
 
-    case SORT_DISTANCE:
-        std::sort(batches.begin(), batches.end(), CompareBatchDistance);
-        break;
+        ForEachChunk(workQueue, numChunks, [&](size_t chunkIndex)
+        {
+            const BatchSortChunk& chunk = sortChunks[chunkIndex];
+            size_t start = chunk.offset;
+            size_t end = start + chunk.end - chunk.start;
+            unsigned* offsets = &sortHistograms[(chunkIndex * RADIX_PASSES + pass) * RADIX_BUCKETS];
+
+            for (size_t i = start; i < end; ++i)
+                dest[offsets[RadixDigit(src[i].key, pass)]++] = src[i];
+        });
+
+        std::swap(src, dest);
+        histogramsValid = false;
+    }
+
+    // Gather the batches from the ranges to their sorted positions once
+    sortedBatches.resize(numBatches);
+    ForEachChunk(workQueue, numChunks, [&](size_t chunkIndex)
+    {
+        const BatchSortChunk& chunk = sortChunks[chunkIndex];
+        size_t start = chunk.offset;
+        size_t end = start + chunk.end - chunk.start;
+
+        for (size_t i = start; i < end; ++i)
+            sortedBatches[i] = ranges[src[i].range].batches[src[i].index];
+    });
+    batches.swap(sortedBatches);
+}
+
+void BatchQueue::ConvertToInstanced(std::vector<Matrix3x4>& instanceTransforms, std::vector<IndirectDrawCommand>* drawCommands, std::vector<Matrix3x4>* skinMatrices,
+    const MeshletCullData* meshletCull, std::vector<Vector2>* staticInstances)
+{
+    // With draw commands all indexed static batches are instanced, and multi-draw batches refer to the draw commands with their instance start and count
+    if (drawCommands)
+    {
+        BuildDrawCommands(instanceTransforms, *drawCommands, skinMatrices, meshletCull, staticInstances);
+        return;
     }
 
-    if (!convertToInstanced || batches.size() < 2)
+    if (batches.size() < 2)
         return;
 
     for (auto it = batches.begin(); it < batches.end() - 1; ++it)
     {
-        // Check if batch is static geometry and can be converted to instanced
-        if (it->programBits)
+        // Check if batch is static or skinned geometry and can be converted to instanced
+        unsigned char programBits = it->programBits;
+        bool skinned = programBits == SP_SKINNED && skinMatrices;
+        if (programBits && !skinned)
             continue;
 
-        size_t start = instanceTransforms.size();
+        bool indexed = UseStaticIndex(*it, staticInstances);
+        size_t start = indexed ? staticInstances->size() : instanceTransforms.size();
         auto next = it + 1;
 
-        if (next->pass == it->pass && next->geometry == it->geometry && !next->programBits)
+        if (SamePass(*next, *it, indexed) && next->geometry == it->geometry && next->programBits == programBits && UseStaticIndex(*next, staticInstances) == indexed)
         {
             // Convert to instances if at least one batch with same state found, then loop for more of the same
             it->instanceStart = (unsigned)start;
-            it->programBits = SP_INSTANCED;
-            instanceTransforms.push_back(*it->worldTransform);
-            instanceTransforms.push_back(*next->worldTransform);
-            ++next;
+            it->programBits = skinned ? SP_SKINNEDINSTANCED : (indexed ? SP_STATICINSTANCED : SP_INSTANCED);
 
-            for (; next < batches.end(); ++next)
+            for (auto batch = it; batch < batches.end(); ++batch)
             {
-                if (next->pass == it->pass && next->geometry == it->geometry && !next->programBits)
-                    instanceTransforms.push_back(*next->worldTransform);
-                else
+                if (batch != it && (!SamePass(*batch, *it, indexed) || batch->geometry != it->geometry || batch->programBits != programBits ||
+                    UseStaticIndex(*batch, staticInstances) != indexed))
                     break;
+
+                if (skinned)
+                    AddSkinnedInstance(batch->drawable, instanceTransforms, *skinMatrices);
+                else if (indexed)
+                    AddStaticInstance(*batch, *it, *staticInstances);
+                else
+                    instanceTransforms.push_back(*batch->worldTransform);
             }
 
             // Finalize the conversion by writing instance count
-            size_t count = instanceTransforms.size() - start;
+            size_t count = (indexed ? staticInstances->size() : instanceTransforms.size()) - start;
             it->instanceCount = (unsigned)count;
             it += count - 1;
         }
     }
 }
+
+void BatchQueue::BuildDrawCommands(std::vector<Matrix3x4>& instanceTransforms, std::vector<IndirectDrawCommand>& drawCommands, std::vector<Matrix3x4>* skinMatrices,
+    const MeshletCullData* meshletCull, std::vector<Vector2>* staticInstances)
+{
+    size_t numBatches = batches.size();
+    size_t dest = 0;
+
+    for (size_t i = 0; i < numBatches;)
+    {
+        Batch batch = batches[i];
+        Geometry* geometry = batch.geometry;
+
+        // Skinned batches are drawn with regular instancing, with the drawables' skin matrices copied to the palette. The instanced batch replaces the batches it consumes, like a multi-draw batch
+        if (batch.programBits == SP_SKINNED && skinMatrices)
+        {
+            size_t end = i + 1;
+            while (end < numBatches && batches[end].programBits == SP_SKINNED && batches[end].passId == batch.passId && batches[end].geometry == geometry)
+                ++end;
+
+            if (end - i > 1)
+            {
+                unsigned instanceStart = (unsigned)instanceTransforms.size();
+                for (; i < end; ++i)
+                    AddSkinnedInstance(batches[i].drawable, instanceTransforms, *skinMatrices);
+
+                batch.programBits = SP_SKINNEDINSTANCED;
+                batch.instanceStart = instanceStart;
+                batch.instanceCount = (unsigned)instanceTransforms.size() - instanceStart;
+                batches[dest++] = batch;
+                continue;
+            }
+        }
+
+        // Non-indexed geometry can not be drawn with indexed commands, leave it as is
+        if (batch.programBits || !geometry->indexBuffer)
+        {
+            batches[dest++] = batch;
+            ++i;
+            continue;
+        }
+
+        // The multi-draw batch is written only after the batches it consumes have been read, as it may overwrite them
+        size_t drawIndex = dest++;
+        unsigned commandStart = (unsigned)drawCommands.size();
+        // Batches using the static transform table get their own multi-draw batches, as their instance data is only the table index and material table slot. Their runs may mix the instances of one material
+        bool indexed = UseStaticIndex(batch, staticInstances);
+
+        while (i < numBatches && !batches[i].programBits && UseStaticIndex(batches[i], staticInstances) == indexed && SamePass(batches[i], batch, indexed) &&
+            batches[i].geometry->vertexBuffer == geometry->vertexBuffer && batches[i].geometry->indexBuffer == geometry->indexBuffer)
+        {
+            Geometry* commandGeometry = batches[i].geometry;
+
+            // Geometries with meshlets get their own commands per instance, so that each instance draws only its visible meshlets
+            if (meshletCull && commandGeometry->meshlets.size())
+            {
+                AddMeshletCommands(batches[i], batch, *meshletCull, instanceTransforms, drawCommands, indexed ? staticInstances : nullptr);
+                ++i;
+                continue;
+            }
+
+            unsigned instanceStart = (unsigned)(indexed ? staticInstances->size() : instanceTransforms.size());
+
+            for (; i < numBatches && !batches[i].programBits && UseStaticIndex(batches[i], staticInstances) == indexed && SamePass(batches[i], batch, indexed) &&
+                batches[i].geometry == commandGeometry; ++i)
+            {
+                if (indexed)
+                    AddStaticInstance(batches[i], batch, *staticInstances);
+                else
+                    instanceTransforms.push_back(*batches[i].worldTransform);
+            }
+
+            IndirectDrawCommand command;
+            command.count = (unsigned)commandGeometry->drawCount;
+            command.instanceCount = (unsigned)(indexed ? staticInstances->size() : instanceTransforms.size()) - instanceStart;
+            command.firstIndex = (unsigned)commandGeometry->drawStart;
+            command.baseVertex = 0;
+            command.baseInstance = instanceStart;
+            drawCommands.push_back(command);
+        }
+
+        batch.programBits = indexed ? SP_STATICINSTANCED : SP_INSTANCED;
+        batch.instanceStart = commandStart;
+        batch.instanceCount = (unsigned)drawCommands.size() - commandStart;
+        batches[drawIndex] = batch;
+    }
+
+    batches.resize(dest);
+}
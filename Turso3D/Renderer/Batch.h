@@ -3,14 +3,19 @@
 #pragma once
 
 #include "../Math/AreaAllocator.h"
+#include "../Math/Frustum.h"
 #include "../Math/Matrix3x4.h"
+#include "../Math/Vector2.h"
 #include "../Object/Ptr.h"
 
 #include <vector>
 
 class GeometryDrawable;
+class OcclusionBuffer;
 class Pass;
+class WorkQueue;
 struct Geometry;
+struct IndirectDrawCommand;
 
 /// Sorting modes for batches.
 enum BatchSortMode
@@ -20,27 +25,27 @@ enum BatchSortMode
     SORT_DISTANCE
 };
 
-/// Stored draw call.
+/// Stored draw call. Kept at 32 bytes by referring to the pass by its compact ID, so that sorting and the per-thread batch queues move less memory.
 struct Batch
 {
+    /// Return the material pass.
+    Pass* GetPass() const;
+    /// Set the material pass.
+    void SetPass(Pass* pass);
+
     union
     {
-        /// State sorting key.
-        unsigned sortKey;
         /// Distance for alpha batches.
         float distance;
         /// Start position in the instance vertex buffer if instanced.
         unsigned instanceStart;
     };
 
-    /// %Material pass.
-    Pass* pass;
+    /// Index in the octree's static transform table, or M_MAX_UNSIGNED to instance with copied world transforms. Used for static geometry.
+    unsigned staticIndex;
+
     /// %Geometry.
     Geometry* geometry;
-    /// %Shader variation bits.
-    unsigned char programBits;
-    /// Geometry index.
-    unsigned char geomIndex;
 
     union
     {
@@ -51,6 +56,63 @@ struct Batch
         /// Instance count if instanced.
         unsigned instanceCount;
     };
+
+    /// Signed LOD crossfade value, used if the program bits include SP_LODFADE.
+    float lodFade;
+    /// %Material pass compact ID.
+    unsigned short passId;
+    /// %Shader variation bits.
+    unsigned char programBits;
+    /// Geometry index.
+    unsigned char geomIndex;
+};
+
+/// View data for culling the meshlets of static geometries when building multi-draw commands.
+struct MeshletCullData
+{
+    /// World space view frustum.
+    Frustum frustum;
+    /// World space view position for backface culling.
+    Vector3 viewPosition;
+    /// Whether backface culling is valid, which it is not when the view reverses culling.
+    bool backfaceCulling;
+    /// Whether to use fast approximate distances.
+    bool fastMath;
+    /// Occlusion buffer to test against, or null to not test.
+    const OcclusionBuffer* occlusionBuffer;
+};
+
+/// Contiguous range of batches to be sorted into a queue, such as the collection results of one worker thread.
+struct BatchRange
+{
+    /// First batch.
+    const Batch* batches;
+    /// Number of batches.
+    size_t count;
+};
+
+/// Sort key of a batch and its position in the source ranges.
+struct BatchSortEntry
+{
+    /// 64-bit sort key.
+    unsigned long long key;
+    /// Batch index within the range.
+    unsigned index;
+    /// Source range index.
+    unsigned range;
+};
+
+/// Part of the batches sorted by one thread.
+struct BatchSortChunk
+{
+    /// Source range index.
+    unsigned range;
+    /// Start index within the range.
+    unsigned start;
+    /// End index within the range.
+    unsigned end;
+    /// Position of the first batch in the sort entries.
+    unsigned offset;
 };
 
 /// Collection of draw calls with sorting and instancing functionality.
@@ -58,11 +120,35 @@ struct BatchQueue
 {
     /// Clear for the next frame.
     void Clear();
-    /// Sort batches and setup instancing groups.
-    void Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced);
+    /// Sort batches and setup instancing groups, using the work queue's threads for large queues if provided. If draw commands are provided, the instanced batches are combined into multi-draw batches.
+    void Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced, std::vector<IndirectDrawCommand>* drawCommands = nullptr, WorkQueue* workQueue = nullptr,
+        std::vector<Matrix3x4>* skinMatrices = nullptr, const MeshletCullData* meshletCull = nullptr, std::vector<Vector2>* staticInstances = nullptr);
+    /// Sort batches from source ranges into the queue, replacing its previous batches. The ranges are read directly by the sorting threads instead of being concatenated first. Otherwise same as Sort().
+    void SortRanges(const std::vector<BatchRange>& ranges, std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced, std::vector<IndirectDrawCommand>* drawCommands = nullptr,
+        WorkQueue* workQueue = nullptr, std::vector<Matrix3x4>* skinMatrices = nullptr, const MeshletCullData* meshletCull = nullptr, std::vector<Vector2>* staticInstances = nullptr);
     /// Return whether has batches added.
     bool HasBatches() const { return batches.size(); }
 
     /// Batches.
     std::vector<Batch> batches;
+    /// Sort keys and batch indices.
+    std::vector<BatchSortEntry> sortEntries;
+    /// Radix sort scratch entries.
+    std::vector<BatchSortEntry> sortTemp;
+    /// Sort chunks.
+    std::vector<BatchSortChunk> sortChunks;
+    /// Radix sort digit histograms per chunk.
+    std::vector<unsigned> sortHistograms;
+    /// Batches in sorted order, swapped in after sorting.
+    std::vector<Batch> sortedBatches;
+
+private:
+    /// Radix sort the batches of the source ranges into the queue.
+    void RadixSort(const BatchRange* ranges, size_t numRanges, BatchSortMode sortMode, WorkQueue* workQueue);
+    /// Setup instancing groups or multi-draw batches after sorting.
+    void ConvertToInstanced(std::vector<Matrix3x4>& instanceTransforms, std::vector<IndirectDrawCommand>* drawCommands, std::vector<Matrix3x4>* skinMatrices, const MeshletCullData* meshletCull,
+        std::vector<Vector2>* staticInstances);
+    /// Combine sorted static batches that share the pass, vertex buffer and index buffer into multi-draw batches, with one draw command per run of the same geometry, or per run of visible meshlets of one instance.
+    void BuildDrawCommands(std::vector<Matrix3x4>& instanceTransforms, std::vector<IndirectDrawCommand>& drawCommands, std::vector<Matrix3x4>* skinMatrices, const MeshletCullData* meshletCull,
+        std::vector<Vector2>* staticInstances);
 };
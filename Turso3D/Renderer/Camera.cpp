@@ -93,6 +93,22 @@ Frustum Camera::WorldSplitFrustum(float nearClip_, float farClip_) const
     return ret;
 }
 
+Frustum Camera::WorldExpandedFrustum(float degrees) const
+{
+    if (orthographic || degrees <= 0.0f)
+        return WorldFrustum();
+
+    // Widen the half angles separately, as the horizontal one is larger with a wide aspect ratio
+    float halfViewSize = tanf(fov * M_DEGTORAD_2) / zoom;
+    float halfHeight = tanf(Min(atanf(halfViewSize) + degrees * M_DEGTORAD, 89.0f * M_DEGTORAD));
+    float halfWidth = tanf(Min(atanf(halfViewSize * aspectRatio) + degrees * M_DEGTORAD, 89.0f * M_DEGTORAD));
+    float nearClip_ = NearClip();
+
+    Frustum ret;
+    ret.Define(Vector3(halfWidth * nearClip_, halfHeight * nearClip_, nearClip_), Vector3(halfWidth * farClip, halfHeight * farClip, farClip), EffectiveWorldTransform());
+    return ret;
+}
+
 Frustum Camera::ViewSpaceFrustum() const
 {
     Frustum ret;
@@ -278,6 +294,19 @@ float Camera::Distance(const Vector3& worldPos) const
     return Abs(WorldDirection().DotProduct(worldPos - WorldPosition()));
 }
 
+void Camera::Distances(const BoundingBoxPack& boxes, float* dest) const
+{
+    // Fold the camera position into a single offset so that the loop is a plain multiply-add over the packed coordinates
+    Vector3 direction = WorldDirection();
+    float offset = direction.DotProduct(WorldPosition()) * 2.0f;
+
+    for (size_t i = 0; i < BOUNDING_BOX_PACK_SIZE; ++i)
+    {
+        float dist = direction.x * (boxes.minX[i] + boxes.maxX[i]) + direction.y * (boxes.minY[i] + boxes.maxY[i]) + direction.z * (boxes.minZ[i] + boxes.maxZ[i]) - offset;
+        dest[i] = Abs(dist) * 0.5f;
+    }
+}
+
 float Camera::LodDistance(float distance, float scale_, float bias) const
 {
     float d = Max(lodBias * bias * scale_ * zoom, M_EPSILON);
@@ -94,6 +94,8 @@ class Camera : public SpatialNode
     Frustum WorldFrustum() const;
     /// Return world space frustum split by custom near and far clip distances.
     Frustum WorldSplitFrustum(float nearClip, float farClip) const;
+    /// Return world space frustum widened by an angle in degrees on each side, which encloses the frustums of the camera turned by up to that angle in yaw and pitch. Same as WorldFrustum() in orthographic mode.
+    Frustum WorldExpandedFrustum(float degrees) const;
     /// Return frustum in view space.
     Frustum ViewSpaceFrustum() const;
     /// Return split frustum in view space.
@@ -116,6 +118,8 @@ class Camera : public SpatialNode
     Vector3 ScreenToWorldPoint(const Vector3& screenPos) const;
     /// Return depth distance (in camera's forward direction) to position.
     float Distance(const Vector3& worldPos) const;
+    /// Calculate the depth distances to the centers of a pack of bounding boxes at once.
+    void Distances(const BoundingBoxPack& boxes, float* dest) const;
     /// Return a scene node's LOD scaled distance.
     float LodDistance(float distance, float scale, float bias) const;
     /// Return a world rotation for facing a camera on certain axes based on the existing world rotation.
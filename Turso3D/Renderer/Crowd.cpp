@@ -0,0 +1,414 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Graphics.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/Texture.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/StringUtils.h"
+#include "../Object/Allocator.h"
+#include "AnimatedModel.h"
+#include "Crowd.h"
+#include "Material.h"
+#include "Model.h"
+#include "Renderer.h"
+#include "VertexAnimation.h"
+
+#include <tracy/Tracy.hpp>
+
+static const UniformSlot U_CROWDPARAMETERS = ShaderProgram::RegisterUniform("crowdParameters");
+
+static const size_t MIN_CROWD_INSTANCES = 64;
+
+static Allocator<CrowdDrawable> drawableAllocator;
+
+/// Return the bounding box of an instance in crowd space.
+static BoundingBox InstanceBoundingBox(const BoundingBox& animatedBox, const CrowdInstance& instance)
+{
+    return animatedBox.Transformed(Matrix3x4(instance.position, instance.rotation, instance.scale));
+}
+
+CrowdDrawable::CrowdDrawable() :
+    numLodInstances(0),
+    maxLodInstances(0),
+    time(0.0),
+    lodLevel(0),
+    uploadFrameNumber(0),
+    instancesDirty(false)
+{
+    SetFlag(DF_CUSTOM_GEOMETRY, true);
+}
+
+void CrowdDrawable::OnWorldBoundingBoxUpdate() const
+{
+    worldBoundingBox.Undefine();
+    if (instanceBoundingBox.IsDefined())
+        worldBoundingBox = instanceBoundingBox.Transformed(WorldTransform());
+    worldBoundingBox.Merge(lodBoundingBox);
+
+    if (!worldBoundingBox.IsDefined())
+        worldBoundingBox.Define(WorldPosition());
+
+    SetFlag(DF_BOUNDING_BOX_DIRTY, false);
+}
+
+bool CrowdDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    if (!instanceBuffer || (instances.empty() && !maxLodInstances))
+        return false;
+
+    return Drawable::OnPrepareRender(frameNumber, camera);
+}
+
+void CrowdDrawable::OnUpdateGPUData()
+{
+    // The crowd may be in several passes and views, but the instances are uploaded by the first
+    if (!instanceBuffer || uploadFrameNumber == lastFrameNumber)
+        return;
+
+    ZoneScoped;
+
+    uploadFrameNumber = lastFrameNumber;
+
+    size_t numLod = Min(numLodInstances.load(), maxLodInstances);
+    size_t numTotal = instances.size() + numLod;
+
+    if (instanceBuffer->NumVertices() < numTotal)
+    {
+        std::vector<VertexElement> instanceElements;
+        instanceElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 3));
+        instanceElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 4));
+        instanceElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 5));
+        instanceBuffer->Define(USAGE_DYNAMIC, NextPowerOfTwo((unsigned)numTotal), instanceElements);
+        instancesDirty = true;
+    }
+
+    if (instancesDirty && instances.size())
+    {
+        std::vector<Vector4> instanceData(instances.size() * 3);
+        const Matrix3x4& transform = WorldTransform();
+        Quaternion worldRotation = transform.Rotation();
+        float worldScale = transform.Scale().x;
+
+        for (size_t i = 0; i < instances.size(); ++i)
+        {
+            const CrowdInstance& instance = instances[i];
+            WriteInstance(&instanceData[i * 3], transform * instance.position, worldRotation * instance.rotation, worldScale * instance.scale, instance.clip,
+                instance.time, instance.speed);
+        }
+
+        instanceBuffer->SetData(0, instances.size(), &instanceData[0]);
+    }
+    instancesDirty = false;
+
+    if (numLod)
+        instanceBuffer->SetData(instances.size(), numLod, &lodInstanceData[0]);
+    numLodInstances.store(0);
+
+    // A zero instance count would draw the whole buffer, so draw nothing instead
+    for (size_t i = 0; i < geometries.size(); ++i)
+    {
+        geometries[i]->instanceCount = numTotal;
+        geometries[i]->drawCount = numTotal ? drawCounts[i] : 0;
+    }
+}
+
+void CrowdDrawable::OnRender(ShaderProgram* program, size_t geomIndex)
+{
+    if (!vertexAnimation || geomIndex >= geometries.size())
+        return;
+
+    size_t texelOffset = vertexAnimation->TexelOffset(geometries[geomIndex]->vertexBuffer);
+    size_t numVertices = geometries[geomIndex]->vertexBuffer->NumVertices();
+    Object::Subsystem<Graphics>()->SetUniform(program, U_CROWDPARAMETERS, Vector4((float)time, (float)texelOffset, (float)numVertices, 0.0f));
+    vertexAnimation->GetTexture()->Bind(TU_VERTEXANIMATION);
+}
+
+bool CrowdDrawable::AddLodInstance(const Matrix3x4& worldTransform, const std::vector<SharedPtr<AnimationState> >& animationStates)
+{
+    if (!vertexAnimation || !maxLodInstances)
+        return false;
+
+    AnimationState* strongest = nullptr;
+    for (auto it = animationStates.begin(); it != animationStates.end(); ++it)
+    {
+        AnimationState* state = *it;
+        if (state->Weight() > (strongest ? strongest->Weight() : 0.0f))
+            strongest = state;
+    }
+    if (!strongest)
+        return false;
+
+    size_t clip = vertexAnimation->FindClip(strongest->GetAnimation());
+    if (clip == M_MAX_UNSIGNED)
+        return false;
+
+    size_t index = numLodInstances.fetch_add(1);
+    if (index >= maxLodInstances)
+        return false;
+
+    // The LOD instances stand still at the state's time, as the animated model advances it
+    WriteInstance(&lodInstanceData[index * 3], worldTransform.Translation(), worldTransform.Rotation(), worldTransform.Scale().x, (unsigned)clip, strongest->Time(), 0.0f);
+    return true;
+}
+
+void CrowdDrawable::WriteInstance(Vector4* dest, const Vector3& position, const Quaternion& rotation, float scale, unsigned clip, float timeOffset, float speed) const
+{
+    // Time and speed are stored as portions of the clip length, so that the shader only needs the fractional part of the phase
+    const VertexAnimationClip& clipDesc = vertexAnimation->Clip(Min((size_t)clip, vertexAnimation->NumClips() - 1));
+    float invLength = clipDesc.length > 0.0f ? 1.0f / clipDesc.length : 0.0f;
+    float phaseOffset = timeOffset * invLength;
+    if (speed == 0.0f)
+        phaseOffset = Clamp(phaseOffset, 0.0f, 0.9999f);
+
+    dest[0] = Vector4(position, scale);
+    dest[1] = Vector4(rotation.x, rotation.y, rotation.z, rotation.w);
+    dest[2] = Vector4((float)clipDesc.firstFrame, (float)clipDesc.numFrames, phaseOffset, speed * invLength);
+}
+
+Crowd::Crowd()
+{
+    drawable = drawableAllocator.Allocate();
+    drawable->SetOwner(this);
+}
+
+Crowd::~Crowd()
+{
+    RemoveFromOctree();
+    drawableAllocator.Free(static_cast<CrowdDrawable*>(drawable));
+    drawable = nullptr;
+}
+
+void Crowd::RegisterObject()
+{
+    RegisterFactory<Crowd>();
+    CopyBaseAttributes<Crowd, GeometryNode>();
+    RegisterDerivedType<Crowd, GeometryNode>();
+    RegisterAttribute("lodLevel", &Crowd::LodLevel, &Crowd::SetLodLevel, 0U);
+}
+
+void Crowd::Update(float timeStep)
+{
+    CrowdDrawable* crowdDrawable = static_cast<CrowdDrawable*>(drawable);
+    crowdDrawable->time += timeStep;
+    // LOD instances collected while the crowd was out of view are discarded
+    crowdDrawable->numLodInstances.store(0);
+
+    if (lodModels.empty() && !crowdDrawable->maxLodInstances)
+        return;
+
+    BoundingBox lodBox;
+    for (auto it = lodModels.begin(); it != lodModels.end();)
+    {
+        if (!*it)
+            it = lodModels.erase(it);
+        else
+        {
+            lodBox.Merge((*it)->GetDrawable()->WorldBoundingBox());
+            ++it;
+        }
+    }
+
+    crowdDrawable->maxLodInstances = lodModels.size();
+    crowdDrawable->lodInstanceData.resize(lodModels.size() * 3);
+
+    if (lodBox != crowdDrawable->lodBoundingBox)
+    {
+        crowdDrawable->lodBoundingBox = lodBox;
+        OnBoundingBoxChanged();
+    }
+}
+
+void Crowd::SetVertexAnimation(VertexAnimation* vertexAnimation)
+{
+    CrowdDrawable* crowdDrawable = static_cast<CrowdDrawable*>(drawable);
+    crowdDrawable->vertexAnimation = vertexAnimation;
+    crowdDrawable->geometries.clear();
+    crowdDrawable->drawCounts.clear();
+
+    Graphics* graphics = Subsystem<Graphics>();
+    Model* model = vertexAnimation ? vertexAnimation->GetModel() : nullptr;
+    if (!model || !graphics || !graphics->HasInstancing())
+    {
+        crowdDrawable->instanceBuffer.Reset();
+        SetNumGeometries(0);
+        OnBoundingBoxChanged();
+        return;
+    }
+
+    if (!crowdDrawable->instanceBuffer)
+    {
+        std::vector<VertexElement> instanceElements;
+        instanceElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 3));
+        instanceElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 4));
+        instanceElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 5));
+        crowdDrawable->instanceBuffer = new VertexBuffer();
+        crowdDrawable->instanceBuffer->Define(USAGE_DYNAMIC, MIN_CROWD_INSTANCES, instanceElements);
+    }
+
+    size_t numGeometries = model->NumGeometries();
+    for (size_t i = 0; i < numGeometries; ++i)
+    {
+        Geometry* source = model->GetGeometry(i, Min((size_t)crowdDrawable->lodLevel, model->NumLodLevels(i) - 1));
+
+        // The draw count is set on upload, when the number of instances is known
+        SharedPtr<Geometry> geometry(new Geometry());
+        geometry->vertexBuffer = source->vertexBuffer;
+        geometry->indexBuffer = source->indexBuffer;
+        geometry->instanceBuffer = crowdDrawable->instanceBuffer;
+        geometry->drawStart = source->drawStart;
+        geometry->drawCount = 0;
+        crowdDrawable->geometries.push_back(geometry);
+        crowdDrawable->drawCounts.push_back(source->drawCount);
+    }
+
+    if (NumGeometries() != numGeometries)
+    {
+        SetNumGeometries(numGeometries);
+        SetMaterial(DefaultMaterial());
+    }
+    for (size_t i = 0; i < numGeometries; ++i)
+        SetGeometry(i, crowdDrawable->geometries[i]);
+
+    // The instance bounds depend on the animated bounding box
+    crowdDrawable->instanceBoundingBox.Undefine();
+    for (auto it = crowdDrawable->instances.begin(); it != crowdDrawable->instances.end(); ++it)
+        crowdDrawable->instanceBoundingBox.Merge(InstanceBoundingBox(vertexAnimation->AnimatedBoundingBox(), *it));
+
+    crowdDrawable->instancesDirty = true;
+    OnBoundingBoxChanged();
+}
+
+void Crowd::SetLodLevel(unsigned level)
+{
+    CrowdDrawable* crowdDrawable = static_cast<CrowdDrawable*>(drawable);
+    if (level == crowdDrawable->lodLevel)
+        return;
+
+    crowdDrawable->lodLevel = level;
+    if (crowdDrawable->vertexAnimation)
+        SetVertexAnimation(crowdDrawable->vertexAnimation);
+}
+
+size_t Crowd::AddInstance(const Vector3& position, const Quaternion& rotation, float scale, unsigned clip, float time, float speed)
+{
+    CrowdDrawable* crowdDrawable = static_cast<CrowdDrawable*>(drawable);
+
+    CrowdInstance instance;
+    instance.position = position;
+    instance.rotation = rotation;
+    instance.scale = scale;
+    instance.clip = clip;
+    instance.time = time;
+    instance.speed = speed;
+    crowdDrawable->instances.push_back(instance);
+
+    if (crowdDrawable->vertexAnimation)
+        crowdDrawable->instanceBoundingBox.Merge(InstanceBoundingBox(crowdDrawable->vertexAnimation->AnimatedBoundingBox(), instance));
+
+    crowdDrawable->instancesDirty = true;
+    OnBoundingBoxChanged();
+    return crowdDrawable->instances.size() - 1;
+}
+
+void Crowd::SetInstance(size_t index, const CrowdInstance& instance)
+{
+    CrowdDrawable* crowdDrawable = static_cast<CrowdDrawable*>(drawable);
+    if (index >= crowdDrawable->instances.size())
+        return;
+
+    // The bounding box only grows, until the instances are removed
+    crowdDrawable->instances[index] = instance;
+    if (crowdDrawable->vertexAnimation)
+        crowdDrawable->instanceBoundingBox.Merge(InstanceBoundingBox(crowdDrawable->vertexAnimation->AnimatedBoundingBox(), instance));
+
+    crowdDrawable->instancesDirty = true;
+    OnBoundingBoxChanged();
+}
+
+void Crowd::RemoveAllInstances()
+{
+    CrowdDrawable* crowdDrawable = static_cast<CrowdDrawable*>(drawable);
+    crowdDrawable->instances.clear();
+    crowdDrawable->instanceBoundingBox.Undefine();
+    crowdDrawable->instancesDirty = true;
+    OnBoundingBoxChanged();
+}
+
+void Crowd::AddLodModel(AnimatedModel* model)
+{
+    if (!model)
+        return;
+
+    for (auto it = lodModels.begin(); it != lodModels.end(); ++it)
+    {
+        if (*it == model)
+            return;
+    }
+
+    lodModels.push_back(WeakPtr<AnimatedModel>(model));
+}
+
+void Crowd::RemoveLodModel(AnimatedModel* model)
+{
+    for (auto it = lodModels.begin(); it != lodModels.end(); ++it)
+    {
+        if (*it == model)
+        {
+            lodModels.erase(it);
+            return;
+        }
+    }
+}
+
+VertexAnimation* Crowd::GetVertexAnimation() const
+{
+    return static_cast<CrowdDrawable*>(drawable)->vertexAnimation;
+}
+
+SharedPtr<Material> Crowd::CreateMaterial(Material* source)
+{
+    if (!source)
+        source = Material::DefaultMaterial();
+
+    SharedPtr<Material> material(new Material());
+    for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+        material->SetTexture(i, source->GetTexture(i));
+
+    const std::map<PresetUniform, Vector4>& uniformValues = source->UniformValues();
+    for (auto it = uniformValues.begin(); it != uniformValues.end(); ++it)
+        material->SetUniform(it->first, it->second);
+
+    material->SetCullMode(source->GetCullMode());
+
+    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+    {
+        Pass* sourcePass = source->GetPass((PassType)i);
+        if (!sourcePass)
+            continue;
+
+        Pass* pass = material->CreatePass((PassType)i);
+        pass->SetShader(sourcePass->GetShader(), Trim(sourcePass->VSDefines()), Trim(sourcePass->FSDefines()));
+        pass->SetRenderState(sourcePass->GetBlendMode(), sourcePass->GetDepthTest(), sourcePass->GetColorWrite(), sourcePass->GetDepthWrite());
+    }
+
+    material->SetShaderDefines(source->VSDefines() + "CROWD", Trim(source->FSDefines()));
+    return material;
+}
+
+Material* Crowd::DefaultMaterial()
+{
+    // Constructed on first use, so that it is destroyed before the material registry at exit
+    static SharedPtr<Material> defaultMaterial;
+    if (!defaultMaterial)
+        defaultMaterial = CreateMaterial(Material::DefaultMaterial());
+
+    return defaultMaterial;
+}
+
+void Crowd::OnTransformChanged()
+{
+    GeometryNode::OnTransformChanged();
+
+    CrowdDrawable* crowdDrawable = static_cast<CrowdDrawable*>(drawable);
+    crowdDrawable->instancesDirty = true;
+}
@@ -0,0 +1,143 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "GeometryNode.h"
+
+#include <atomic>
+
+class AnimatedModel;
+class AnimationState;
+class Material;
+class Texture;
+class VertexAnimation;
+
+/// Instance of a crowd, playing a clip of the crowd's vertex animation.
+struct CrowdInstance
+{
+    /// Position in crowd space.
+    Vector3 position;
+    /// Rotation in crowd space.
+    Quaternion rotation;
+    /// Uniform scale.
+    float scale;
+    /// Clip index in the vertex animation.
+    unsigned clip;
+    /// Time position in the clip at crowd time zero.
+    float time;
+    /// Playback speed.
+    float speed;
+};
+
+/// Crowd drawable. Draws all instances of each geometry with a single instanced call, fetching the animated vertices from the vertex animation texture in the vertex shader by the clip and time in the instance data.
+class CrowdDrawable : public GeometryDrawable
+{
+    friend class Crowd;
+
+public:
+    /// Construct.
+    CrowdDrawable();
+
+    /// Recalculate the world space bounding box from the instances and the animated models handed over as LOD.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Prepare object for rendering. Reset framenumber and calculate distance from camera. Return false if there is nothing to draw.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Upload the instances if changed, and the animated models handed over as LOD in the view. Called by Renderer in the main thread once view preparation has finished.
+    void OnUpdateGPUData() override;
+    /// Set the crowd time and vertex buffer uniforms and bind the vertex animation texture. Called by Renderer when geometry type is not static.
+    void OnRender(ShaderProgram* program, size_t geomIndex) override;
+
+    /// Add an animated model handed over as LOD for the view being prepared, by the clip and time of its strongest animation state. Called by AnimatedModel in worker threads. Return false if the clip has not been baked or the LOD capacity is full.
+    bool AddLodInstance(const Matrix3x4& worldTransform, const std::vector<SharedPtr<AnimationState> >& animationStates);
+
+private:
+    /// Write the instance data of one instance in world space.
+    void WriteInstance(Vector4* dest, const Vector3& position, const Quaternion& rotation, float scale, unsigned clip, float timeOffset, float speed) const;
+
+    /// Vertex animation.
+    SharedPtr<VertexAnimation> vertexAnimation;
+    /// Geometries drawing the model's vertex buffers with the instances.
+    std::vector<SharedPtr<Geometry> > geometries;
+    /// Draw counts of the source geometries.
+    std::vector<size_t> drawCounts;
+    /// Instance buffer shared by the geometries. The own instances come first, followed by the LOD instances.
+    SharedPtr<VertexBuffer> instanceBuffer;
+    /// Own instances.
+    std::vector<CrowdInstance> instances;
+    /// Instance data of the LOD instances being collected.
+    std::vector<Vector4> lodInstanceData;
+    /// Number of LOD instances collected.
+    std::atomic<size_t> numLodInstances;
+    /// Maximum number of LOD instances, which is the number of animated models registered for LOD.
+    size_t maxLodInstances;
+    /// Bounding box of the own instances in crowd space.
+    BoundingBox instanceBoundingBox;
+    /// Bounding box of the animated models registered for LOD in world space.
+    BoundingBox lodBoundingBox;
+    /// Crowd time.
+    double time;
+    /// Model LOD level to draw.
+    unsigned lodLevel;
+    /// Frame number of the last upload.
+    unsigned short uploadFrameNumber;
+    /// Own instances need to be uploaded flag.
+    bool instancesDirty;
+};
+
+/// %Scene node that renders tens of thousands of animated instances of a model without bones, from the vertex animation baked from its clips. Each instance has its own transform, clip, time and speed in the instance data, and the clips loop by the crowd time, so no per-instance work is done on the CPU after the instances have been set. Animated models can also hand themselves over to a crowd beyond a distance as an LOD, see AnimatedModel::SetCrowdLod(). The instances are culled as a whole by the crowd's bounding box, so large crowds should be split into several nodes by area. Requires instancing support. Call Update() once per frame to advance the crowd time.
+class Crowd : public GeometryNode
+{
+    OBJECT(Crowd);
+
+public:
+    /// Construct.
+    Crowd();
+    /// Destruct.
+    ~Crowd();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Advance the crowd time, and refresh the bounds of the animated models registered for LOD. Should be called once per frame from the main thread before the octree update.
+    void Update(float timeStep);
+    /// Set the vertex animation to draw and create the geometries from its model. Materials that are not set use the crowd version of the default material.
+    void SetVertexAnimation(VertexAnimation* vertexAnimation);
+    /// Set the model LOD level to draw. Clamped to the levels of each geometry. Default 0.
+    void SetLodLevel(unsigned level);
+    /// Add an instance and return its index.
+    size_t AddInstance(const Vector3& position, const Quaternion& rotation, float scale, unsigned clip, float time = 0.0f, float speed = 1.0f);
+    /// Set an instance by index.
+    void SetInstance(size_t index, const CrowdInstance& instance);
+    /// Remove all instances.
+    void RemoveAllInstances();
+    /// Register an animated model that may hand itself over as LOD. Called by AnimatedModel.
+    void AddLodModel(AnimatedModel* model);
+    /// Unregister an animated model. Called by AnimatedModel.
+    void RemoveLodModel(AnimatedModel* model);
+
+    /// Return the vertex animation.
+    VertexAnimation* GetVertexAnimation() const;
+    /// Return the model LOD level to draw.
+    unsigned LodLevel() const { return static_cast<CrowdDrawable*>(drawable)->lodLevel; }
+    /// Return number of instances.
+    size_t NumInstances() const { return static_cast<CrowdDrawable*>(drawable)->instances.size(); }
+    /// Return instance by index.
+    const CrowdInstance& Instance(size_t index) const { return static_cast<CrowdDrawable*>(drawable)->instances[index]; }
+    /// Return the crowd time.
+    float Time() const { return (float)static_cast<CrowdDrawable*>(drawable)->time; }
+    /// Return number of animated models registered for LOD.
+    size_t NumLodModels() const { return lodModels.size(); }
+
+    /// Return a copy of a material that renders crowds. The textures, uniforms, cull mode and passes are copied, and the CROWD define is added to the vertex shaders, which the shaders need to support.
+    static SharedPtr<Material> CreateMaterial(Material* source);
+    /// Return the crowd version of the default material.
+    static Material* DefaultMaterial();
+
+protected:
+    /// Handle the transform matrix changing. Queue the instances for upload in world space.
+    void OnTransformChanged() override;
+
+private:
+    /// Animated models registered for LOD.
+    std::vector<WeakPtr<AnimatedModel> > lodModels;
+};
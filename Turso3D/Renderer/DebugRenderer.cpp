@@ -1,7 +1,6 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../Graphics/Graphics.h"
-#include "../Graphics/IndexBuffer.h"
 #include "../Graphics/ShaderProgram.h"
 #include "../Graphics/VertexBuffer.h"
 #include "../Math/Polyhedron.h"
@@ -10,15 +9,20 @@
 
 #include <tracy/Tracy.hpp>
 
+static const UniformSlot U_VIEWPROJMATRIX = ShaderProgram::RegisterUniform("viewProjMatrix");
+
 DebugRenderer::DebugRenderer()
 {
     RegisterSubsystem(this);
     
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    size_t numThreads = workQueue ? workQueue->NumThreads() : 1;
+    geometries.resize(numThreads);
+    captures.resize(numThreads);
+
     vertexBuffer = new VertexBuffer();
     vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
     vertexElements.push_back(VertexElement(ELEM_UBYTE4, SEM_COLOR));
-
-    indexBuffer = new IndexBuffer();
 }
 
 DebugRenderer::~DebugRenderer()
@@ -42,179 +46,54 @@ void DebugRenderer::AddLine(const Vector3& start, const Vector3& end, const Colo
 
 void DebugRenderer::AddLine(const Vector3& start, const Vector3& end, unsigned color, bool depthTest)
 {
-    unsigned startVertex = (unsigned)vertices.size();
+    DebugGeometry& geometry = ThreadGeometry();
+    std::vector<DebugVertex>& dest = depthTest ? geometry.vertices : geometry.noDepthVertices;
 
-    vertices.push_back(DebugVertex(start, color));
-    vertices.push_back(DebugVertex(end, color));
-
-    std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 1);
+    dest.push_back(DebugVertex(start, color));
+    dest.push_back(DebugVertex(end, color));
 }
 
 void DebugRenderer::AddBoundingBox(const BoundingBox& box, const Color& color, bool depthTest)
 {
-    unsigned startVertex = (unsigned)vertices.size();
-    unsigned uintColor = color.ToUInt();
-
     const Vector3& min = box.min;
     const Vector3& max = box.max;
 
-    vertices.push_back(DebugVertex(min, uintColor));
-    vertices.push_back(DebugVertex(Vector3(max.x, min.y, min.z), uintColor));
-    vertices.push_back(DebugVertex(Vector3(max.x, max.y, min.z), uintColor));
-    vertices.push_back(DebugVertex(Vector3(min.x, max.y, min.z), uintColor));
-    vertices.push_back(DebugVertex(Vector3(min.x, min.y, max.z), uintColor));
-    vertices.push_back(DebugVertex(Vector3(max.x, min.y, max.z), uintColor));
-    vertices.push_back(DebugVertex(Vector3(min.x, max.y, max.z), uintColor));
-    vertices.push_back(DebugVertex(max, uintColor));
-
-    std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
-
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 1);
-
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 2);
-
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 3);
-
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex);
-
-    dest.push_back(startVertex + 4);
-    dest.push_back(startVertex + 5);
-
-    dest.push_back(startVertex + 5);
-    dest.push_back(startVertex + 7);
-
-    dest.push_back(startVertex + 7);
-    dest.push_back(startVertex + 6);
-
-    dest.push_back(startVertex + 6);
-    dest.push_back(startVertex + 4);
-
-    dest.push_back(startVertex + 0);
-    dest.push_back(startVertex + 4);
-
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 5);
-
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 7);
-
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex + 6);
+    Vector3 corners[8] = {
+        min,
+        Vector3(max.x, min.y, min.z),
+        Vector3(max.x, max.y, min.z),
+        Vector3(min.x, max.y, min.z),
+        Vector3(min.x, min.y, max.z),
+        Vector3(max.x, min.y, max.z),
+        max,
+        Vector3(min.x, max.y, max.z)
+    };
+
+    AddCorners(corners, color.ToUInt(), depthTest);
 }
 
 void DebugRenderer::AddBoundingBox(const BoundingBox& box, const Matrix3x4& transform, const Color& color, bool depthTest)
 {
-    unsigned startVertex = (unsigned)vertices.size();
-    unsigned uintColor = color.ToUInt();
-
     const Vector3& min = box.min;
     const Vector3& max = box.max;
 
-    vertices.push_back(DebugVertex(Vector3(transform * min), uintColor));
-    vertices.push_back(DebugVertex(Vector3(transform * Vector3(max.x, min.y, min.z)), uintColor));
-    vertices.push_back(DebugVertex(Vector3(transform * Vector3(max.x, max.y, min.z)), uintColor));
-    vertices.push_back(DebugVertex(Vector3(transform * Vector3(min.x, max.y, min.z)), uintColor));
-    vertices.push_back(DebugVertex(Vector3(transform * Vector3(min.x, min.y, max.z)), uintColor));
-    vertices.push_back(DebugVertex(Vector3(transform * Vector3(max.x, min.y, max.z)), uintColor));
-    vertices.push_back(DebugVertex(Vector3(transform * Vector3(min.x, max.y, max.z)), uintColor));
-    vertices.push_back(DebugVertex(Vector3(transform * max), uintColor));
-
-    std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
-
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 1);
-
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 2);
-
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 3);
-
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex);
-
-    dest.push_back(startVertex + 4);
-    dest.push_back(startVertex + 5);
-
-    dest.push_back(startVertex + 5);
-    dest.push_back(startVertex + 7);
-
-    dest.push_back(startVertex + 7);
-    dest.push_back(startVertex + 6);
-
-    dest.push_back(startVertex + 6);
-    dest.push_back(startVertex + 4);
-
-    dest.push_back(startVertex + 0);
-    dest.push_back(startVertex + 4);
-
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 5);
-
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 7);
-
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex + 6);
+    Vector3 corners[8] = {
+        transform * min,
+        transform * Vector3(max.x, min.y, min.z),
+        transform * Vector3(max.x, max.y, min.z),
+        transform * Vector3(min.x, max.y, min.z),
+        transform * Vector3(min.x, min.y, max.z),
+        transform * Vector3(max.x, min.y, max.z),
+        transform * max,
+        transform * Vector3(min.x, max.y, max.z)
+    };
+
+    AddCorners(corners, color.ToUInt(), depthTest);
 }
 
 void DebugRenderer::AddFrustum(const Frustum& frustum_, const Color& color, bool depthTest)
 {
-    unsigned startVertex = (unsigned)vertices.size();
-    unsigned uintColor = color.ToUInt();
-
-    vertices.push_back(DebugVertex(frustum_.vertices[0], uintColor));
-    vertices.push_back(DebugVertex(frustum_.vertices[1], uintColor));
-    vertices.push_back(DebugVertex(frustum_.vertices[2], uintColor));
-    vertices.push_back(DebugVertex(frustum_.vertices[3], uintColor));
-    vertices.push_back(DebugVertex(frustum_.vertices[4], uintColor));
-    vertices.push_back(DebugVertex(frustum_.vertices[5], uintColor));
-    vertices.push_back(DebugVertex(frustum_.vertices[6], uintColor));
-    vertices.push_back(DebugVertex(frustum_.vertices[7], uintColor));
-
-    std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
-
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 1);
-
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 2);
-
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 3);
-
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex);
-
-    dest.push_back(startVertex + 4);
-    dest.push_back(startVertex + 5);
-
-    dest.push_back(startVertex + 5);
-    dest.push_back(startVertex + 6);
-
-    dest.push_back(startVertex + 6);
-    dest.push_back(startVertex + 7);
-
-    dest.push_back(startVertex + 7);
-    dest.push_back(startVertex + 4);
-
-    dest.push_back(startVertex);
-    dest.push_back(startVertex + 4);
-
-    dest.push_back(startVertex + 1);
-    dest.push_back(startVertex + 5);
-
-    dest.push_back(startVertex + 2);
-    dest.push_back(startVertex + 6);
-
-    dest.push_back(startVertex + 3);
-    dest.push_back(startVertex + 7);
+    AddCorners(frustum_.vertices, color.ToUInt(), depthTest);
 }
 
 void DebugRenderer::AddPolyhedron(const Polyhedron& poly, const Color& color, bool depthTest)
@@ -240,26 +119,15 @@ void DebugRenderer::AddSphere(const Sphere& sphere, const Color& color, bool dep
     {
         for (float i = 0.0f; i < 360.0f; i += 45.0f)
         {
-            unsigned startVertex = (unsigned)vertices.size();
-
-            vertices.push_back(DebugVertex(sphere.Point(i, j), uintColor));
-            vertices.push_back(DebugVertex(sphere.Point(i + 45.0f, j), uintColor));
-            vertices.push_back(DebugVertex(sphere.Point(i, j + 45.0f), uintColor));
-            vertices.push_back(DebugVertex(sphere.Point(i + 45.0f, j + 45.0f), uintColor));
-
-            std::vector<unsigned>& dest = depthTest ? indices : noDepthIndices;
-
-            dest.push_back(startVertex);
-            dest.push_back(startVertex + 1);
-
-            dest.push_back(startVertex + 2);
-            dest.push_back(startVertex + 3);
-
-            dest.push_back(startVertex);
-            dest.push_back(startVertex + 2);
-
-            dest.push_back(startVertex + 1);
-            dest.push_back(startVertex + 3);
+            Vector3 p1 = sphere.Point(i, j);
+            Vector3 p2 = sphere.Point(i + 45.0f, j);
+            Vector3 p3 = sphere.Point(i, j + 45.0f);
+            Vector3 p4 = sphere.Point(i + 45.0f, j + 45.0f);
+
+            AddLine(p1, p2, uintColor, depthTest);
+            AddLine(p3, p4, uintColor, depthTest);
+            AddLine(p1, p3, uintColor, depthTest);
+            AddLine(p2, p4, uintColor, depthTest);
         }
     }
 }
@@ -285,49 +153,129 @@ void DebugRenderer::AddCylinder(const Vector3& position, float radius, float hei
     AddLine(position - offsetZVec, position + heightVec - offsetZVec, color, depthTest);
 }
 
+void DebugRenderer::AddGeometry(const DebugGeometry& geometry)
+{
+    DebugGeometry& dest = ThreadGeometry();
+    dest.vertices.insert(dest.vertices.end(), geometry.vertices.begin(), geometry.vertices.end());
+    dest.noDepthVertices.insert(dest.noDepthVertices.end(), geometry.noDepthVertices.begin(), geometry.noDepthVertices.end());
+}
+
+void DebugRenderer::BeginCapture(DebugGeometry& dest)
+{
+    dest.Clear();
+    captures[WorkQueue::ThreadIndex()] = &dest;
+}
+
+void DebugRenderer::EndCapture()
+{
+    captures[WorkQueue::ThreadIndex()] = nullptr;
+}
+
 void DebugRenderer::Render()
 {
     ZoneScoped;
 
+    size_t numVertices = 0;
+    size_t numNoDepthVertices = 0;
+    for (auto it = geometries.begin(); it != geometries.end(); ++it)
+    {
+        numVertices += it->vertices.size();
+        numNoDepthVertices += it->noDepthVertices.size();
+    }
+
     // Early-out if no geometry to render
-    if (!vertices.size())
+    size_t totalVertices = numVertices + numNoDepthVertices;
+    if (!totalVertices)
         return;
 
-    if (vertexBuffer->NumVertices() < vertices.size())
-        vertexBuffer->Define(USAGE_DYNAMIC, vertices.size(), vertexElements);
-
-    if (vertices.size())
-        vertexBuffer->SetData(0, vertices.size(), &vertices[0]);
+    Graphics* graphics = Subsystem<Graphics>();
+    size_t firstVertex = 0;
+    bool streamed = false;
 
-    size_t totalIndices = indices.size() + noDepthIndices.size();
-    
-    if (indexBuffer->NumIndices() < totalIndices)
-        indexBuffer->Define(USAGE_DYNAMIC, totalIndices, sizeof(unsigned));
+    // With a persistently mapped buffer, the lines are appended to the frame's region without implicit synchronization
+    if (graphics->HasBufferStorage())
+    {
+        streamed = vertexBuffer->IsStream() && StreamVertices(firstVertex);
+        if (!streamed)
+        {
+            vertexBuffer->Define(USAGE_STREAM, Max(totalVertices, vertexBuffer->NumVertices() * 2), vertexElements);
+            streamed = StreamVertices(firstVertex);
+        }
+    }
 
-    if (indices.size())
-        indexBuffer->SetData(0, indices.size(), &indices[0]);
-    if (noDepthIndices.size())
-        indexBuffer->SetData(indices.size(), noDepthIndices.size(), &noDepthIndices[0]);
+    if (!streamed)
+    {
+        combinedVertices.clear();
+        for (auto it = geometries.begin(); it != geometries.end(); ++it)
+            combinedVertices.insert(combinedVertices.end(), it->vertices.begin(), it->vertices.end());
+        for (auto it = geometries.begin(); it != geometries.end(); ++it)
+            combinedVertices.insert(combinedVertices.end(), it->noDepthVertices.begin(), it->noDepthVertices.end());
+
+        if (vertexBuffer->NumVertices() < totalVertices || vertexBuffer->IsStream())
+            vertexBuffer->Define(USAGE_DYNAMIC, totalVertices, vertexElements, &combinedVertices[0]);
+        else
+            vertexBuffer->SetData(0, totalVertices, &combinedVertices[0]);
+        firstVertex = 0;
+    }
 
-    Graphics* graphics = Subsystem<Graphics>();
     ShaderProgram* program = graphics->SetProgram("Shaders/DebugLines.glsl");
-    graphics->SetUniform(program, "viewProjMatrix", projection * view);
+    graphics->SetUniform(program, U_VIEWPROJMATRIX, projection * view);
     graphics->SetVertexBuffer(vertexBuffer, program);
-    graphics->SetIndexBuffer(indexBuffer);
 
-    if (indices.size())
+    if (numVertices)
     {
         graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_LESS, true, false);
-        graphics->DrawIndexed(PT_LINE_LIST, 0, indices.size());
+        graphics->Draw(PT_LINE_LIST, firstVertex, numVertices);
     }
 
-    if (noDepthIndices.size())
+    if (numNoDepthVertices)
     {
         graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
-        graphics->DrawIndexed(PT_LINE_LIST, indices.size(), noDepthIndices.size());
+        graphics->Draw(PT_LINE_LIST, firstVertex + numVertices, numNoDepthVertices);
+    }
+
+    for (auto it = geometries.begin(); it != geometries.end(); ++it)
+        it->Clear();
+}
+
+void DebugRenderer::AddCorners(const Vector3* corners, unsigned color, bool depthTest)
+{
+    static const unsigned char edges[24] = {
+        0, 1, 1, 2, 2, 3, 3, 0,
+        4, 5, 5, 6, 6, 7, 7, 4,
+        0, 4, 1, 5, 2, 6, 3, 7
+    };
+
+    DebugGeometry& geometry = ThreadGeometry();
+    std::vector<DebugVertex>& dest = depthTest ? geometry.vertices : geometry.noDepthVertices;
+
+    for (size_t i = 0; i < 24; ++i)
+        dest.push_back(DebugVertex(corners[edges[i]], color));
+}
+
+bool DebugRenderer::StreamVertices(size_t& firstVertex)
+{
+    // Consecutive appends to the frame's region are contiguous, so the lines of all threads can be drawn with one call per depth mode
+    bool first = true;
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        for (auto it = geometries.begin(); it != geometries.end(); ++it)
+        {
+            const std::vector<DebugVertex>& source = i == 0 ? it->vertices : it->noDepthVertices;
+            if (source.empty())
+                continue;
+
+            size_t start;
+            if (!vertexBuffer->StreamData(source.size(), &source[0], start))
+                return false;
+            if (first)
+            {
+                firstVertex = start;
+                first = false;
+            }
+        }
     }
 
-    vertices.clear();
-    indices.clear();
-    noDepthIndices.clear();
+    return true;
 }
@@ -6,10 +6,10 @@
 #include "../Math/Color.h"
 #include "../Math/Frustum.h"
 #include "../Object/Object.h"
+#include "../Thread/WorkQueue.h"
 
 class BoundingBox;
 class Camera;
-class IndexBuffer;
 class Polyhedron;
 class Matrix3x4;
 class Sphere;
@@ -31,13 +31,25 @@ struct DebugVertex
     unsigned color;
 };
 
-/// Debug line geometry rendering subsystem.
+/// Debug geometry as line list vertices, either recorded by one thread or cached by the caller.
+struct DebugGeometry
+{
+    /// Remove all vertices.
+    void Clear() { vertices.clear(); noDepthVertices.clear(); }
+
+    /// Line list vertices rendered with depth test.
+    std::vector<DebugVertex> vertices;
+    /// Line list vertices rendered without depth test.
+    std::vector<DebugVertex> noDepthVertices;
+};
+
+/// Debug line geometry rendering subsystem. Geometry can be added concurrently from the main thread and the work queue's worker threads, as each thread records into its own buffers.
 class DebugRenderer : public Object
 {
     OBJECT(DebugRenderer);
 
 public:
-    /// Construct. Register subsystem. Graphics subsystem must have been initialized.
+    /// Construct. Register subsystem. Graphics subsystem must have been initialized, and the WorkQueue subsystem if geometry is to be added from the worker threads.
     DebugRenderer();
     /// Destruct.
     ~DebugRenderer();
@@ -60,19 +72,32 @@ public:
     void AddSphere(const Sphere& sphere, const Color& color, bool depthTest = true);
     /// Add a cylinder.
     void AddCylinder(const Vector3& position, float radius, float height, const Color& color, bool depthTest = true);
-    /// Update vertex buffer and render all debug lines to the currently set framebuffer and viewport. Then clear the lines for the next frame.
+    /// Add previously captured geometry.
+    void AddGeometry(const DebugGeometry& geometry);
+    /// Redirect the geometry added from the calling thread into a cache, which is cleared first, until EndCapture() is called. Used to cache the debug geometry of objects that do not change.
+    void BeginCapture(DebugGeometry& dest);
+    /// Stop redirecting the geometry added from the calling thread.
+    void EndCapture();
+    /// Stream the vertices of all threads to the vertex buffer and render all debug lines to the currently set framebuffer and viewport. Then clear the lines for the next frame. Must not be called while other threads are adding geometry.
     void Render();
 
     /// Check whether a bounding box is inside the view frustum.
     bool IsInside(const BoundingBox& box) const { return frustum.IsInsideFast(box) == INSIDE; }
 
 private:
-    /// Debug geometry vertices.
-    std::vector<DebugVertex> vertices;
-    /// Indices rendered with depth test.
-    std::vector<unsigned> indices;
-    /// Indices rendered without depth test.
-    std::vector<unsigned> noDepthIndices;
+    /// Return the geometry the calling thread records into.
+    DebugGeometry& ThreadGeometry() { unsigned index = WorkQueue::ThreadIndex(); return captures[index] ? *captures[index] : geometries[index]; }
+    /// Add the 12 edges of a box or frustum from its corners, ordered as in Frustum.
+    void AddCorners(const Vector3* corners, unsigned color, bool depthTest);
+    /// Append the vertices of all threads contiguously to the stream vertex buffer. Return false if there was not enough room.
+    bool StreamVertices(size_t& firstVertex);
+
+    /// Geometry recorded by each thread.
+    std::vector<DebugGeometry> geometries;
+    /// Capture destination of each thread, or null if not capturing.
+    std::vector<DebugGeometry*> captures;
+    /// Vertices of all threads combined for uploading, when persistently mapped buffers are not supported.
+    std::vector<DebugVertex> combinedVertices;
     /// View transform.
     Matrix3x4 view;
     /// Projection transform.
@@ -81,8 +106,6 @@ private:
     Frustum frustum;
     /// Vertex buffer for the debug geometry.
     SharedPtr<VertexBuffer> vertexBuffer;
-    /// Index buffer for the debug geometry.
-    SharedPtr<IndexBuffer> indexBuffer;
     /// Vertex elements for the debug vertices.
     std::vector<VertexElement> vertexElements;
 };
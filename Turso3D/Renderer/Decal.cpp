@@ -0,0 +1,96 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Object/Allocator.h"
+#include "Camera.h"
+#include "Decal.h"
+
+static const Color DEFAULT_DECAL_COLOR = Color::WHITE;
+static const Rect DEFAULT_TEXTURE_RECT = Rect(0.0f, 0.0f, 1.0f, 1.0f);
+static const float DEFAULT_FADE_START = 0.9f;
+static const BoundingBox unitBox(-0.5f, 0.5f);
+
+static Allocator<DecalDrawable> drawableAllocator;
+
+DecalDrawable::DecalDrawable() :
+    color(DEFAULT_DECAL_COLOR),
+    textureRect(DEFAULT_TEXTURE_RECT),
+    fadeStart(DEFAULT_FADE_START)
+{
+    SetFlag(DF_DECAL, true);
+}
+
+void DecalDrawable::OnWorldBoundingBoxUpdate() const
+{
+    worldBoundingBox = unitBox.Transformed(WorldTransform());
+    SetFlag(DF_BOUNDING_BOX_DIRTY, false);
+}
+
+const BoundingBox* DecalDrawable::LocalBoundingBox() const
+{
+    return &unitBox;
+}
+
+bool DecalDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    distance = camera->Distance(WorldPosition());
+
+    if (maxDistance > 0.0f && distance > maxDistance)
+        return false;
+
+    lastFrameNumber = frameNumber;
+    return true;
+}
+
+Color DecalDrawable::EffectiveColor() const
+{
+    if (maxDistance > 0.0f)
+    {
+        float scaledDistance = distance / maxDistance;
+        if (scaledDistance >= fadeStart)
+            return Color(color.r, color.g, color.b, color.a * Max(1.0f - (scaledDistance - fadeStart) / (1.0f - fadeStart), 0.0f));
+    }
+
+    return color;
+}
+
+Decal::Decal()
+{
+    drawable = drawableAllocator.Allocate();
+    drawable->SetOwner(this);
+}
+
+Decal::~Decal()
+{
+    RemoveFromOctree();
+    drawableAllocator.Free(static_cast<DecalDrawable*>(drawable));
+    drawable = nullptr;
+}
+
+void Decal::RegisterObject()
+{
+    RegisterFactory<Decal>();
+
+    CopyBaseAttributes<Decal, OctreeNode>();
+    RegisterDerivedType<Decal, OctreeNode>();
+    RegisterRefAttribute("color", &Decal::GetColor, &Decal::SetColor, DEFAULT_DECAL_COLOR);
+    RegisterRefAttribute("textureRect", &Decal::TextureRect, &Decal::SetTextureRect, DEFAULT_TEXTURE_RECT);
+    RegisterAttribute("fadeStart", &Decal::FadeStart, &Decal::SetFadeStart, DEFAULT_FADE_START);
+}
+
+void Decal::SetColor(const Color& color_)
+{
+    DecalDrawable* decalDrawable = static_cast<DecalDrawable*>(drawable);
+    decalDrawable->color = color_;
+}
+
+void Decal::SetTextureRect(const Rect& rect)
+{
+    DecalDrawable* decalDrawable = static_cast<DecalDrawable*>(drawable);
+    decalDrawable->textureRect = rect;
+}
+
+void Decal::SetFadeStart(float start)
+{
+    DecalDrawable* decalDrawable = static_cast<DecalDrawable*>(drawable);
+    decalDrawable->fadeStart = Clamp(start, 0.0f, 1.0f - M_EPSILON);
+}
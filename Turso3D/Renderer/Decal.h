@@ -0,0 +1,70 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Color.h"
+#include "../Math/Rect.h"
+#include "OctreeNode.h"
+
+/// %Decal drawable.
+class DecalDrawable : public Drawable
+{
+    friend class Decal;
+
+public:
+    /// Construct.
+    DecalDrawable();
+
+    /// Recalculate the world space bounding box.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Return the local space bounding box, which is the unit box of the projector.
+    const BoundingBox* LocalBoundingBox() const override;
+    /// Prepare object for rendering. Reset framenumber and calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+
+    /// Return color.
+    const Color& GetColor() const { return color; }
+    /// Return effective color taking distance fade into account.
+    Color EffectiveColor() const;
+    /// Return texture rectangle within the decal atlas.
+    const Rect& TextureRect() const { return textureRect; }
+    /// Return fade start as a function of max draw distance.
+    float FadeStart() const { return fadeStart; }
+
+private:
+    /// Decal color.
+    Color color;
+    /// Texture rectangle within the decal atlas.
+    Rect textureRect;
+    /// Fade start as a function of max distance.
+    float fadeStart;
+};
+
+/// %Decal scene node. Projects a rectangle of the renderer's decal atlas onto the opaque geometry inside its unit box along the node's local Y axis; scale the node to size the box. The decals in view are binned into the light clusters and applied to the material color by the lit shaders, so they need no geometry or draw calls of their own. Fades out on surfaces facing away from the projection axis.
+class Decal : public OctreeNode
+{
+    OBJECT(Decal);
+
+public:
+    /// Construct.
+    Decal();
+    /// Destruct.
+    ~Decal();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Set color, which multiplies the atlas texels. Alpha is the opacity.
+    void SetColor(const Color& color);
+    /// Set texture rectangle within the decal atlas in normalized texture coordinates. Default the whole atlas.
+    void SetTextureRect(const Rect& rect);
+    /// Set fade start distance, where 1 represents max draw distance. Only has effect when max draw distance has been defined.
+    void SetFadeStart(float start);
+
+    /// Return color.
+    const Color& GetColor() const { return static_cast<DecalDrawable*>(drawable)->color; }
+    /// Return texture rectangle within the decal atlas.
+    const Rect& TextureRect() const { return static_cast<DecalDrawable*>(drawable)->textureRect; }
+    /// Return fade start as a function of max draw distance.
+    float FadeStart() const { return static_cast<DecalDrawable*>(drawable)->fadeStart; }
+};
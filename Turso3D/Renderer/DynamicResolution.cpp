@@ -0,0 +1,144 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Graphics.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/Texture.h"
+#include "../Math/Math.h"
+#include "../Time/Profiler.h"
+#include "DynamicResolution.h"
+
+#include <tracy/Tracy.hpp>
+
+static const UniformSlot U_SOURCEINVSIZE = ShaderProgram::RegisterUniform("sourceInvSize");
+static const UniformSlot U_SHARPNESS = ShaderProgram::RegisterUniform("sharpness");
+
+/// Scale is changed in steps of this size, so that the render targets are not redefined for small fluctuations.
+static const float SCALE_STEP = 0.05f;
+/// Frames to wait after a scale change, so that the GPU timer results are from the new scale.
+static const unsigned SCALE_CHANGE_FRAMES = GPU_TIMER_FRAMES + 2;
+/// Smoothing factor of the GPU frame time.
+static const float FRAME_TIME_SMOOTHING = 0.2f;
+/// Fraction of the target frame time to aim for when changing the scale.
+static const float TARGET_HEADROOM = 0.9f;
+/// Fraction of the target frame time above which the scale is decreased.
+static const float DECREASE_THRESHOLD = 0.95f;
+/// Fraction of the target frame time below which the scale is increased.
+static const float INCREASE_THRESHOLD = 0.8f;
+/// Maximum number of steps to increase at once, to avoid overshooting.
+static const float MAX_INCREASE_STEPS = 2.0f;
+
+DynamicResolution::DynamicResolution() :
+    graphics(Object::Subsystem<Graphics>()),
+    targetFrameTime(1000.0f / 60.0f),
+    minScale(0.5f),
+    maxScale(1.0f),
+    sharpness(0.5f),
+    scale(1.0f),
+    gpuFrameTime(0.0f),
+    lastResultsFrame(0),
+    lastChangeFrame(0),
+    enabled(false)
+{
+    assert(graphics && graphics->IsInitialized());
+}
+
+DynamicResolution::~DynamicResolution()
+{
+}
+
+void DynamicResolution::SetEnabled(bool enable)
+{
+    enabled = enable;
+    scale = enabled ? maxScale : 1.0f;
+    gpuFrameTime = 0.0f;
+    lastChangeFrame = graphics->FrameNumber();
+}
+
+void DynamicResolution::SetTargetFrameTime(float milliseconds)
+{
+    targetFrameTime = Max(milliseconds, 0.1f);
+}
+
+void DynamicResolution::SetScaleRange(float minScale_, float maxScale_)
+{
+    maxScale = Clamp(maxScale_, 0.1f, 1.0f);
+    minScale = Clamp(minScale_, 0.1f, maxScale);
+    if (enabled)
+        scale = Clamp(scale, minScale, maxScale);
+}
+
+void DynamicResolution::SetSharpness(float sharpness_)
+{
+    sharpness = Clamp(sharpness_, 0.0f, 1.0f);
+}
+
+void DynamicResolution::Update()
+{
+    if (!enabled || !graphics->GpuTimers())
+        return;
+
+    // Use each set of results once, and skip those that may still include frames rendered before the last change
+    unsigned resultsFrame = graphics->GpuTimerResultsFrame();
+    if (resultsFrame == lastResultsFrame || resultsFrame - lastChangeFrame < SCALE_CHANGE_FRAMES)
+        return;
+    lastResultsFrame = resultsFrame;
+
+    const std::vector<GpuTimerResult>& results = graphics->GpuTimerResults();
+    long long frameTime = 0;
+    for (auto it = results.begin(); it != results.end(); ++it)
+    {
+        if (!it->depth)
+            frameTime += it->time;
+    }
+    if (!frameTime)
+        return;
+
+    float frameTimeMs = frameTime * 0.001f;
+    gpuFrameTime = gpuFrameTime > 0.0f ? Lerp(gpuFrameTime, frameTimeMs, FRAME_TIME_SMOOTHING) : frameTimeMs;
+
+    // Assume the GPU time is proportional to the pixel count, and aim for a scale that leaves some headroom
+    float newScale = scale;
+    float desiredScale = scale * sqrtf(targetFrameTime * TARGET_HEADROOM / gpuFrameTime);
+    if (gpuFrameTime > targetFrameTime * DECREASE_THRESHOLD)
+        newScale = floorf(desiredScale / SCALE_STEP) * SCALE_STEP;
+    else if (gpuFrameTime < targetFrameTime * INCREASE_THRESHOLD)
+        newScale = Min(floorf(desiredScale / SCALE_STEP) * SCALE_STEP, scale + MAX_INCREASE_STEPS * SCALE_STEP);
+    newScale = Clamp(newScale, minScale, maxScale);
+
+    if (fabsf(newScale - scale) >= SCALE_STEP * 0.5f)
+    {
+        // Predict the frame time at the new scale until it has been measured
+        gpuFrameTime *= (newScale * newScale) / (scale * scale);
+        scale = newScale;
+        lastChangeFrame = graphics->FrameNumber();
+    }
+
+    Profiler* profiler = Object::Subsystem<Profiler>();
+    if (profiler)
+        profiler->SetCounter("RenderScale", (long long)(scale * 100.0f + 0.5f));
+    TracyPlot("RenderScale", (double)scale);
+}
+
+void DynamicResolution::Upscale(Texture* source, const IntVector2& nativeSize)
+{
+    ZoneScoped;
+
+    graphics->SetFrameBuffer(nullptr);
+    graphics->SetViewport(IntRect(0, 0, nativeSize.x, nativeSize.y));
+
+    ShaderProgram* program = graphics->SetProgram("Shaders/Upscale.glsl");
+    graphics->SetUniform(program, U_SOURCEINVSIZE, Vector2(1.0f / source->Width(), 1.0f / source->Height()));
+    graphics->SetUniform(program, U_SHARPNESS, sharpness);
+    graphics->SetTexture(0, source);
+    graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+    graphics->DrawQuad();
+    graphics->SetTexture(0, nullptr);
+}
+
+IntVector2 DynamicResolution::RenderSize(const IntVector2& nativeSize) const
+{
+    if (scale >= 1.0f)
+        return nativeSize;
+
+    return IntVector2(Max((int)(nativeSize.x * scale + 0.5f), 1), Max((int)(nativeSize.y * scale + 0.5f), 1));
+}
@@ -0,0 +1,71 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntVector2.h"
+#include "../Object/Ptr.h"
+
+class Graphics;
+class Texture;
+
+/// Dynamic resolution controller. Adjusts the scale of the main view render targets from the measured GPU frame time to hold a target frame rate, and upscales the scaled view to the backbuffer with contrast-adaptive sharpening. Requires GPU timers to be enabled. Disabled by default.
+class DynamicResolution : public RefCounted
+{
+public:
+    /// Construct. Graphics subsystem must have been initialized.
+    DynamicResolution();
+    /// Destruct.
+    ~DynamicResolution();
+
+    /// Enable or disable. Disabling returns to full resolution.
+    void SetEnabled(bool enable);
+    /// Set the GPU frame time to hold in milliseconds. Default 16.67 for 60 Hz.
+    void SetTargetFrameTime(float milliseconds);
+    /// Set the minimum and maximum scale of the render size. Default 0.5 and 1.
+    void SetScaleRange(float minScale, float maxScale);
+    /// Set the upscale sharpening amount from 0 (off) to 1. Default 0.5.
+    void SetSharpness(float sharpness);
+    /// Update the scale from the latest GPU timer results. Call once per frame after presenting.
+    void Update();
+    /// Draw a view rendered at the scaled size to the backbuffer at the native size. Anything drawn to the backbuffer afterward, such as UI, is at native resolution.
+    void Upscale(Texture* source, const IntVector2& nativeSize);
+
+    /// Return whether is enabled.
+    bool IsEnabled() const { return enabled; }
+    /// Return the target GPU frame time in milliseconds.
+    float TargetFrameTime() const { return targetFrameTime; }
+    /// Return the minimum scale.
+    float MinScale() const { return minScale; }
+    /// Return the maximum scale.
+    float MaxScale() const { return maxScale; }
+    /// Return the sharpening amount.
+    float Sharpness() const { return sharpness; }
+    /// Return the current scale.
+    float Scale() const { return scale; }
+    /// Return the smoothed GPU frame time in milliseconds.
+    float GpuFrameTime() const { return gpuFrameTime; }
+    /// Return the render size for a native size at the current scale.
+    IntVector2 RenderSize(const IntVector2& nativeSize) const;
+
+private:
+    /// Graphics subsystem.
+    Graphics* graphics;
+    /// Target GPU frame time.
+    float targetFrameTime;
+    /// Minimum scale.
+    float minScale;
+    /// Maximum scale.
+    float maxScale;
+    /// Sharpening amount.
+    float sharpness;
+    /// Current scale.
+    float scale;
+    /// Smoothed GPU frame time, or zero if not measured yet at the current scale.
+    float gpuFrameTime;
+    /// Graphics frame number of the last used GPU timer results.
+    unsigned lastResultsFrame;
+    /// Graphics frame number of the last scale change.
+    unsigned lastChangeFrame;
+    /// Enabled flag.
+    bool enabled;
+};
@@ -0,0 +1,474 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/FrameBuffer.h"
+#include "../Graphics/Graphics.h"
+#include "../Graphics/Texture.h"
+#include "../IO/InternedString.h"
+#include "../IO/Log.h"
+#include "FrameGraph.h"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+FrameGraph::FrameGraph() :
+    graphics(Object::Subsystem<Graphics>()),
+    numCulled(0),
+    currentPass(FRAMEGRAPH_NONE)
+{
+    assert(graphics && graphics->IsInitialized());
+}
+
+FrameGraph::~FrameGraph()
+{
+    // Context may be gone at destruction time. In this case just no-op the cleanup
+    if (!Object::Subsystem<Graphics>())
+        return;
+
+    Reset();
+}
+
+unsigned FrameGraph::AddTexture(const std::string& name, const IntVector2& size, ImageFormat format, int multisample)
+{
+    FrameGraphResource resource;
+    resource.name = name;
+    resource.size = size;
+    resource.format = format;
+    resource.multisample = multisample > 1 ? multisample : 1;
+    resource.imported = nullptr;
+    resource.texture = nullptr;
+    resource.resolved = nullptr;
+    resource.resolveValid = false;
+    resource.written = false;
+    resource.output = false;
+    resource.firstUse = FRAMEGRAPH_NONE;
+    resource.lastUse = FRAMEGRAPH_NONE;
+
+    resources.push_back(resource);
+    return (unsigned)resources.size() - 1;
+}
+
+unsigned FrameGraph::ImportTexture(const std::string& name, Texture* texture)
+{
+    if (!texture)
+    {
+        LOGERROR("Null texture can not be imported to frame graph");
+        return FRAMEGRAPH_NONE;
+    }
+
+    unsigned index = AddTexture(name, texture->Size2D(), texture->Format(), texture->Multisample());
+    FrameGraphResource& resource = resources[index];
+    resource.imported = texture;
+    resource.texture = texture;
+    // The contents of external textures are always defined
+    resource.written = true;
+    return index;
+}
+
+void FrameGraph::SetOutput(unsigned resource)
+{
+    if (resource < resources.size())
+        resources[resource].output = true;
+}
+
+unsigned FrameGraph::AddPass(const std::string& name, const std::function<void()>& execute)
+{
+    FrameGraphPass pass;
+    pass.name = name;
+    pass.execute = execute;
+    pass.depthTarget = FRAMEGRAPH_NONE;
+    pass.load = LOAD_PRESERVE;
+    pass.clearColor = Color::BLACK;
+    pass.sideEffects = false;
+    pass.culled = false;
+
+    passes.push_back(pass);
+    return (unsigned)passes.size() - 1;
+}
+
+void FrameGraph::Read(unsigned pass, unsigned resource)
+{
+    if (pass < passes.size() && resource < resources.size())
+        passes[pass].reads.push_back(resource);
+}
+
+void FrameGraph::Write(unsigned pass, unsigned resource)
+{
+    if (pass < passes.size() && resource < resources.size())
+        passes[pass].writes.push_back(resource);
+}
+
+void FrameGraph::SetRenderTargets(unsigned pass, const std::vector<unsigned>& colorTargets, unsigned depthTarget, RenderTargetLoad load, const Color& clearColor)
+{
+    if (pass >= passes.size())
+        return;
+
+    FrameGraphPass& dest = passes[pass];
+    dest.colorTargets.clear();
+    for (auto it = colorTargets.begin(); it != colorTargets.end(); ++it)
+    {
+        if (*it < resources.size())
+        {
+            dest.colorTargets.push_back(*it);
+            dest.writes.push_back(*it);
+        }
+    }
+
+    dest.depthTarget = depthTarget < resources.size() ? depthTarget : FRAMEGRAPH_NONE;
+    if (dest.depthTarget != FRAMEGRAPH_NONE)
+        dest.writes.push_back(dest.depthTarget);
+
+    dest.load = load;
+    dest.clearColor = clearColor;
+}
+
+void FrameGraph::SetSideEffects(unsigned pass)
+{
+    if (pass < passes.size())
+        passes[pass].sideEffects = true;
+}
+
+bool FrameGraph::Compile()
+{
+    ZoneScoped;
+
+    order.clear();
+    numCulled = 0;
+
+    // Cull backward from the outputs: a pass is needed if a later needed pass reads the contents it leaves in a resource
+    std::vector<bool> live(resources.size());
+    for (size_t i = 0; i < resources.size(); ++i)
+        live[i] = resources[i].output;
+
+    for (size_t i = passes.size() - 1; i < passes.size(); --i)
+    {
+        FrameGraphPass& pass = passes[i];
+
+        pass.culled = !pass.sideEffects;
+        for (auto it = pass.writes.begin(); it != pass.writes.end() && pass.culled; ++it)
+        {
+            if (live[*it])
+                pass.culled = false;
+        }
+
+        if (pass.culled)
+        {
+            ++numCulled;
+            continue;
+        }
+
+        for (auto it = pass.writes.begin(); it != pass.writes.end(); ++it)
+            live[*it] = ReadsPrevious(pass, *it);
+        for (auto it = pass.reads.begin(); it != pass.reads.end(); ++it)
+            live[*it] = true;
+    }
+
+    // Dependencies between the remaining passes from the declaration order of their accesses
+    std::vector<std::vector<unsigned> > dependents(passes.size());
+    std::vector<unsigned> numDependencies(passes.size(), 0);
+    std::vector<unsigned> lastWriters(resources.size(), FRAMEGRAPH_NONE);
+    std::vector<std::vector<unsigned> > readers(resources.size());
+
+    auto addDependency = [&](unsigned from, unsigned to)
+    {
+        if (from != FRAMEGRAPH_NONE && from != to)
+        {
+            dependents[from].push_back(to);
+            ++numDependencies[to];
+        }
+    };
+
+    for (unsigned i = 0; i < passes.size(); ++i)
+    {
+        const FrameGraphPass& pass = passes[i];
+        if (pass.culled)
+            continue;
+
+        for (auto it = pass.reads.begin(); it != pass.reads.end(); ++it)
+            addDependency(lastWriters[*it], i);
+        for (auto it = pass.writes.begin(); it != pass.writes.end(); ++it)
+        {
+            addDependency(lastWriters[*it], i);
+            for (auto rIt = readers[*it].begin(); rIt != readers[*it].end(); ++rIt)
+                addDependency(*rIt, i);
+        }
+
+        for (auto it = pass.reads.begin(); it != pass.reads.end(); ++it)
+            readers[*it].push_back(i);
+        for (auto it = pass.writes.begin(); it != pass.writes.end(); ++it)
+        {
+            lastWriters[*it] = i;
+            readers[*it].clear();
+        }
+    }
+
+    // Order the passes topologically. Prefer continuing with the same render targets to avoid framebuffer changes, then the declaration order
+    std::vector<unsigned> ready;
+    for (unsigned i = 0; i < passes.size(); ++i)
+    {
+        if (!passes[i].culled && !numDependencies[i])
+            ready.push_back(i);
+    }
+
+    while (ready.size())
+    {
+        size_t best = 0;
+        for (size_t i = 1; i < ready.size(); ++i)
+        {
+            if (ready[i] < ready[best])
+                best = i;
+        }
+
+        if (order.size())
+        {
+            const FrameGraphPass& last = passes[order.back()];
+            if (last.colorTargets.size() || last.depthTarget != FRAMEGRAPH_NONE)
+            {
+                for (size_t i = 0; i < ready.size(); ++i)
+                {
+                    const FrameGraphPass& candidate = passes[ready[i]];
+                    if (candidate.colorTargets == last.colorTargets && candidate.depthTarget == last.depthTarget && candidate.load != LOAD_CLEAR)
+                    {
+                        best = i;
+                        break;
+                    }
+                }
+            }
+        }
+
+        unsigned index = ready[best];
+        ready.erase(ready.begin() + best);
+        order.push_back(index);
+
+        for (auto it = dependents[index].begin(); it != dependents[index].end(); ++it)
+        {
+            if (!--numDependencies[*it])
+                ready.push_back(*it);
+        }
+    }
+
+    if (order.size() != passes.size() - numCulled)
+    {
+        LOGERROR("Frame graph has cyclic dependencies");
+        order.clear();
+        return false;
+    }
+
+    // Resource lifetimes in execution order
+    for (auto it = resources.begin(); it != resources.end(); ++it)
+    {
+        it->firstUse = FRAMEGRAPH_NONE;
+        it->lastUse = FRAMEGRAPH_NONE;
+    }
+
+    for (unsigned i = 0; i < order.size(); ++i)
+    {
+        const FrameGraphPass& pass = passes[order[i]];
+        for (size_t j = 0; j < pass.reads.size() + pass.writes.size(); ++j)
+        {
+            FrameGraphResource& resource = resources[j < pass.reads.size() ? pass.reads[j] : pass.writes[j - pass.reads.size()]];
+            if (resource.firstUse == FRAMEGRAPH_NONE)
+                resource.firstUse = i;
+            resource.lastUse = i;
+        }
+    }
+
+    return true;
+}
+
+void FrameGraph::Execute()
+{
+    ZoneScoped;
+
+    for (unsigned i = 0; i < order.size(); ++i)
+    {
+        currentPass = order[i];
+        const FrameGraphPass& pass = passes[currentPass];
+
+        ZoneScopedN("FrameGraphPass");
+        ZoneName(pass.name.c_str(), pass.name.length());
+
+        // Pass names are rebuilt each frame, so intern them for the GPU timer, which reads its results later
+        if (graphics->GpuTimers())
+            graphics->BeginGpuTimer(InternedString(pass.name).CString());
+
+        // Allocate the transient textures on first use
+        for (size_t j = 0; j < pass.reads.size() + pass.writes.size(); ++j)
+        {
+            FrameGraphResource& resource = resources[j < pass.reads.size() ? pass.reads[j] : pass.writes[j - pass.reads.size()]];
+            if (!resource.texture)
+            {
+                resource.texture = graphics->AcquireRenderTarget(resource.size, resource.format, resource.multisample);
+                resource.written = false;
+                resource.resolveValid = false;
+            }
+        }
+
+        for (auto it = pass.reads.begin(); it != pass.reads.end(); ++it)
+        {
+            FrameGraphResource& resource = resources[*it];
+            if (resource.multisample > 1 && !resource.resolveValid)
+                Resolve(resource);
+        }
+
+        if (pass.colorTargets.size() || pass.depthTarget != FRAMEGRAPH_NONE)
+        {
+            const FrameGraphResource& first = resources[pass.colorTargets.size() ? pass.colorTargets[0] : pass.depthTarget];
+            graphics->SetFrameBuffer(PassFrameBuffer(pass));
+            graphics->SetViewport(IntRect(0, 0, first.size.x, first.size.y));
+
+            // Clear when requested, or when rendering on top of undefined contents
+            bool clearColor = pass.load == LOAD_CLEAR && pass.colorTargets.size();
+            bool clearDepth = pass.load == LOAD_CLEAR && pass.depthTarget != FRAMEGRAPH_NONE;
+            if (pass.load == LOAD_PRESERVE)
+            {
+                for (auto it = pass.colorTargets.begin(); it != pass.colorTargets.end(); ++it)
+                    clearColor |= !resources[*it].written;
+                clearDepth = pass.depthTarget != FRAMEGRAPH_NONE && !resources[pass.depthTarget].written;
+            }
+
+            if (clearColor || clearDepth)
+                graphics->Clear(clearColor, clearDepth, IntRect::ZERO, pass.clearColor);
+        }
+
+        if (pass.execute)
+            pass.execute();
+
+        graphics->EndGpuTimer();
+
+        for (auto it = pass.writes.begin(); it != pass.writes.end(); ++it)
+        {
+            resources[*it].written = true;
+            resources[*it].resolveValid = false;
+        }
+
+        // Return the transient textures no longer needed, so that the following passes can reuse their memory
+        for (auto it = resources.begin(); it != resources.end(); ++it)
+        {
+            if (it->lastUse == i && !it->output)
+                ReleaseTextures(*it);
+        }
+    }
+
+    currentPass = FRAMEGRAPH_NONE;
+
+    // Destroy framebuffers not used this time, as their textures may have been redefined or destroyed
+    for (auto it = frameBuffers.begin(); it != frameBuffers.end();)
+    {
+        if (!it->used)
+            it = frameBuffers.erase(it);
+        else
+        {
+            it->used = false;
+            ++it;
+        }
+    }
+}
+
+void FrameGraph::Reset()
+{
+    for (auto it = resources.begin(); it != resources.end(); ++it)
+        ReleaseTextures(*it);
+
+    resources.clear();
+    passes.clear();
+    order.clear();
+    numCulled = 0;
+}
+
+Texture* FrameGraph::GetTexture(unsigned resource) const
+{
+    if (resource >= resources.size())
+        return nullptr;
+
+    const FrameGraphResource& src = resources[resource];
+    if (src.resolved && src.resolveValid && currentPass < passes.size())
+    {
+        const std::vector<unsigned>& reads = passes[currentPass].reads;
+        if (std::find(reads.begin(), reads.end(), resource) != reads.end())
+            return src.resolved;
+    }
+
+    return src.texture;
+}
+
+bool FrameGraph::ReadsPrevious(const FrameGraphPass& pass, unsigned resource) const
+{
+    if (pass.load != LOAD_PRESERVE)
+        return false;
+
+    return resource == pass.depthTarget || std::find(pass.colorTargets.begin(), pass.colorTargets.end(), resource) != pass.colorTargets.end();
+}
+
+FrameBuffer* FrameGraph::PassFrameBuffer(const FrameGraphPass& pass)
+{
+    std::vector<Texture*> colorTextures;
+    for (auto it = pass.colorTargets.begin(); it != pass.colorTargets.end(); ++it)
+        colorTextures.push_back(resources[*it].texture);
+
+    return CachedFrameBuffer(colorTextures, pass.depthTarget != FRAMEGRAPH_NONE ? resources[pass.depthTarget].texture : nullptr);
+}
+
+FrameBuffer* FrameGraph::TextureFrameBuffer(Texture* texture)
+{
+    if (texture->Format() >= FMT_D16 && texture->Format() <= FMT_D24S8)
+        return CachedFrameBuffer(std::vector<Texture*>(), texture);
+    else
+        return CachedFrameBuffer(std::vector<Texture*>(1, texture), nullptr);
+}
+
+FrameBuffer* FrameGraph::CachedFrameBuffer(const std::vector<Texture*>& colorTextures, Texture* depthStencilTexture)
+{
+    std::vector<Texture*> textures(colorTextures);
+    textures.push_back(depthStencilTexture);
+
+    std::vector<unsigned> glTextures(textures.size());
+    for (size_t i = 0; i < textures.size(); ++i)
+        glTextures[i] = textures[i] ? textures[i]->GLTexture() : 0;
+
+    for (auto it = frameBuffers.begin(); it != frameBuffers.end(); ++it)
+    {
+        if (it->textures == textures && it->glTextures == glTextures)
+        {
+            it->used = true;
+            return it->frameBuffer;
+        }
+    }
+
+    FrameGraphFrameBuffer newFrameBuffer;
+    newFrameBuffer.textures = textures;
+    newFrameBuffer.glTextures = glTextures;
+    newFrameBuffer.frameBuffer = new FrameBuffer();
+    newFrameBuffer.frameBuffer->Define(colorTextures, depthStencilTexture);
+    newFrameBuffer.used = true;
+    frameBuffers.push_back(newFrameBuffer);
+
+    return newFrameBuffer.frameBuffer;
+}
+
+void FrameGraph::Resolve(FrameGraphResource& resource)
+{
+    if (!resource.texture)
+        return;
+
+    if (!resource.resolved)
+        resource.resolved = graphics->AcquireRenderTarget(resource.size, resource.format, 1);
+    if (!resource.resolved)
+        return;
+
+    bool depth = resource.format >= FMT_D16 && resource.format <= FMT_D24S8;
+    IntRect rect(0, 0, resource.size.x, resource.size.y);
+    graphics->Blit(TextureFrameBuffer(resource.resolved), rect, TextureFrameBuffer(resource.texture), rect, !depth, depth, FILTER_POINT);
+    resource.resolveValid = true;
+}
+
+void FrameGraph::ReleaseTextures(FrameGraphResource& resource)
+{
+    if (resource.texture && !resource.imported)
+        graphics->ReleaseRenderTarget(resource.texture);
+    if (resource.resolved)
+        graphics->ReleaseRenderTarget(resource.resolved);
+
+    resource.texture = resource.imported;
+    resource.resolved = nullptr;
+    resource.resolveValid = false;
+}
@@ -0,0 +1,170 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Color.h"
+#include "../Math/IntVector2.h"
+#include "../Object/Ptr.h"
+#include "../Resource/Image.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class FrameBuffer;
+class Graphics;
+class Texture;
+
+/// Invalid frame graph resource or pass index.
+static const unsigned FRAMEGRAPH_NONE = 0xffffffff;
+
+/// How a frame graph pass treats the previous contents of its render targets.
+enum RenderTargetLoad
+{
+    /// Render on top of the previous contents. Undefined contents of transient render targets are cleared.
+    LOAD_PRESERVE = 0,
+    /// Clear before rendering.
+    LOAD_CLEAR,
+    /// The pass overwrites the whole render target, so the previous contents are neither kept nor cleared.
+    LOAD_DISCARD
+};
+
+/// Virtual texture resource of the frame graph.
+struct FrameGraphResource
+{
+    /// Name for debugging.
+    std::string name;
+    /// Dimensions in pixels.
+    IntVector2 size;
+    /// Image format.
+    ImageFormat format;
+    /// Multisampling level.
+    int multisample;
+    /// External texture, or null if allocated from the transient render target pool.
+    Texture* imported;
+    /// Texture during execution.
+    Texture* texture;
+    /// Single-sampled copy during execution for sampling a multisampled resource.
+    Texture* resolved;
+    /// Whether the resolved copy is up to date.
+    bool resolveValid;
+    /// Whether has been written during execution.
+    bool written;
+    /// Whether is needed after the graph has executed.
+    bool output;
+    /// First pass in execution order to use the resource.
+    unsigned firstUse;
+    /// Last pass in execution order to use the resource.
+    unsigned lastUse;
+};
+
+/// Render pass of the frame graph.
+struct FrameGraphPass
+{
+    /// Name for debugging and profiling.
+    std::string name;
+    /// Function that renders the pass. The render targets have been bound and cleared before.
+    std::function<void()> execute;
+    /// Resources sampled by the pass.
+    std::vector<unsigned> reads;
+    /// Resources written by the pass, including the render targets.
+    std::vector<unsigned> writes;
+    /// Color render targets.
+    std::vector<unsigned> colorTargets;
+    /// Depth-stencil render target, or none.
+    unsigned depthTarget;
+    /// Render target load operation.
+    RenderTargetLoad load;
+    /// Clear color when clearing.
+    Color clearColor;
+    /// Whether is executed even if nothing reads its results.
+    bool sideEffects;
+    /// Whether was culled as unused.
+    bool culled;
+};
+
+/// Framebuffer cached for a combination of render targets.
+struct FrameGraphFrameBuffer
+{
+    /// Attached textures, with the depth-stencil texture last.
+    std::vector<Texture*> textures;
+    /// OpenGL objects of the attached textures when defined, to detect redefinition.
+    std::vector<unsigned> glTextures;
+    /// Framebuffer object.
+    SharedPtr<FrameBuffer> frameBuffer;
+    /// Used during the last execution flag.
+    bool used;
+};
+
+/// Declarative render pass schedule. Passes declare the virtual resources they read and write; the graph culls passes whose results are not needed, orders them, allocates the transient textures from the Graphics render target pool for the duration of their use, and binds, clears and resolves the render targets. Declared again each frame.
+class FrameGraph : public RefCounted
+{
+public:
+    /// Construct. Graphics subsystem must have been initialized.
+    FrameGraph();
+    /// Destruct.
+    ~FrameGraph();
+
+    /// Declare a transient texture allocated from the render target pool only for the passes that use it. Return the resource index.
+    unsigned AddTexture(const std::string& name, const IntVector2& size, ImageFormat format, int multisample = 1);
+    /// Declare an external texture. Return the resource index.
+    unsigned ImportTexture(const std::string& name, Texture* texture);
+    /// Mark a resource as needed after the graph has executed, so that the passes producing it are not culled. Transient outputs stay allocated until reset.
+    void SetOutput(unsigned resource);
+    /// Add a pass. Return the pass index.
+    unsigned AddPass(const std::string& name, const std::function<void()>& execute);
+    /// Declare that a pass samples a resource.
+    void Read(unsigned pass, unsigned resource);
+    /// Declare that a pass writes a resource other than by rendering to it, for example a compute pass or one that binds its own framebuffers.
+    void Write(unsigned pass, unsigned resource);
+    /// Set the render targets of a pass and how their previous contents are treated.
+    void SetRenderTargets(unsigned pass, const std::vector<unsigned>& colorTargets, unsigned depthTarget, RenderTargetLoad load = LOAD_PRESERVE, const Color& clearColor = Color::BLACK);
+    /// Set a pass to execute even if nothing reads its results.
+    void SetSideEffects(unsigned pass);
+    /// Cull the unused passes, order the rest and compute the resource lifetimes. Return true on success, false if the dependencies are cyclic.
+    bool Compile();
+    /// Execute the compiled passes.
+    void Execute();
+    /// Release the transient textures and remove all passes and resources to declare the next frame.
+    void Reset();
+
+    /// Return the texture of a resource during execution, or the resolved copy of a multisampled resource during passes that sample it.
+    Texture* GetTexture(unsigned resource) const;
+    /// Return the resources.
+    const std::vector<FrameGraphResource>& Resources() const { return resources; }
+    /// Return the passes.
+    const std::vector<FrameGraphPass>& Passes() const { return passes; }
+    /// Return the compiled pass execution order.
+    const std::vector<unsigned>& Order() const { return order; }
+    /// Return number of passes culled in the last compile.
+    size_t NumCulledPasses() const { return numCulled; }
+
+private:
+    /// Return whether a pass reads the previous contents of a resource.
+    bool ReadsPrevious(const FrameGraphPass& pass, unsigned resource) const;
+    /// Return a framebuffer for the render targets of a pass.
+    FrameBuffer* PassFrameBuffer(const FrameGraphPass& pass);
+    /// Return a framebuffer for a single texture.
+    FrameBuffer* TextureFrameBuffer(Texture* texture);
+    /// Return a cached framebuffer for attachments, defining it if necessary.
+    FrameBuffer* CachedFrameBuffer(const std::vector<Texture*>& colorTextures, Texture* depthStencilTexture);
+    /// Copy a multisampled resource to its single-sampled copy.
+    void Resolve(FrameGraphResource& resource);
+    /// Return the transient textures of a resource to the pool.
+    void ReleaseTextures(FrameGraphResource& resource);
+
+    /// Graphics subsystem.
+    Graphics* graphics;
+    /// Resources.
+    std::vector<FrameGraphResource> resources;
+    /// Passes.
+    std::vector<FrameGraphPass> passes;
+    /// Compiled execution order.
+    std::vector<unsigned> order;
+    /// Cached framebuffers.
+    std::vector<FrameGraphFrameBuffer> frameBuffers;
+    /// Number of culled passes.
+    size_t numCulled;
+    /// Pass currently executing, or none.
+    unsigned currentPass;
+};
@@ -9,6 +9,14 @@
 #include "GeometryNode.h"
 #include "Material.h"
 
+#include <mutex>
+
+// Minimum number of triangles for building a triangle hierarchy for ray queries
+static const size_t TRIANGLE_BVH_MIN_TRIANGLES = 64;
+
+IdAllocator Geometry::idAllocator;
+static std::mutex triangleBvhMutex;
+
 SourceBatches::SourceBatches()
 {
     numGeometries = 0;
@@ -66,24 +74,45 @@ void SourceBatches::SetNumGeometries(size_t num)
 }
 
 Geometry::Geometry() :
+    instanceCount(0),
     drawStart(0),
     drawCount(0),
     lodDistance(0.0f),
+    cpuIndexSize(0),
     cpuDrawStart(0),
-    cpuIndexSize(0)
+    triangleBvhChecked(false),
+    id(idAllocator.Allocate())
 {
 }
 
 Geometry::~Geometry()
 {
+    idAllocator.Free(id);
 }
 
 float Geometry::HitDistance(const Ray& ray, Vector3* outNormal) const
 {
     if (!cpuPositionData)
         return M_INFINITY;
-    
-    if (cpuIndexData)
+
+    // Raycasts may run in worker threads, so build the hierarchy under a lock
+    if (!triangleBvhChecked.load(std::memory_order_acquire))
+    {
+        std::lock_guard<std::mutex> lock(triangleBvhMutex);
+        if (!triangleBvhChecked.load(std::memory_order_relaxed))
+        {
+            if (drawCount / 3 >= TRIANGLE_BVH_MIN_TRIANGLES)
+            {
+                triangleBvh = new TriangleBvh();
+                triangleBvh->Build(cpuPositionData, cpuIndexData, cpuIndexSize, cpuDrawStart, drawCount);
+            }
+            triangleBvhChecked.store(true, std::memory_order_release);
+        }
+    }
+
+    if (triangleBvh)
+        return triangleBvh->HitDistance(ray, outNormal);
+    else if (cpuIndexData)
         return ray.HitDistance(cpuPositionData, sizeof(Vector3), cpuIndexData, cpuIndexSize, cpuDrawStart, drawCount, outNormal);
     else
         return ray.HitDistance(cpuPositionData, sizeof(Vector3), cpuDrawStart, drawCount, outNormal);
@@ -105,10 +134,36 @@ bool GeometryDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camer
     return true;
 }
 
+void GeometryDrawable::OnUpdateGPUData()
+{
+}
+
 void GeometryDrawable::OnRender(ShaderProgram*, size_t)
 {
 }
 
+const Matrix3x4* GeometryDrawable::SkinMatrices(size_t& numMatrices) const
+{
+    numMatrices = 0;
+    return nullptr;
+}
+
+Geometry* GeometryDrawable::LodFadeGeometry(size_t, float& fade) const
+{
+    fade = 0.0f;
+    return nullptr;
+}
+
+const SourceBatches* GeometryDrawable::ImpostorBatches() const
+{
+    return nullptr;
+}
+
+Geometry* GeometryDrawable::LodGeometry(size_t index, Camera*, float) const
+{
+    return batches.GetGeometry(index);
+}
+
 void GeometryNode::RegisterObject()
 {
     RegisterDerivedType<GeometryNode, OctreeNode>();
@@ -121,6 +176,7 @@ void GeometryNode::SetNumGeometries(size_t num)
 {
     GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
     geomDrawable->batches.SetNumGeometries(num);
+    Material::MarkBatchesChanged();
 }
 
 void GeometryNode::SetGeometry(size_t index, Geometry* geometry)
@@ -133,7 +189,10 @@ void GeometryNode::SetGeometry(size_t index, Geometry* geometry)
 
     GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
     if (index < geomDrawable->batches.NumGeometries())
+    {
         geomDrawable->batches.SetGeometry(index, geometry);
+        Material::MarkBatchesChanged();
+    }
 }
 
 void GeometryNode::SetMaterial(Material* material)
@@ -144,6 +203,7 @@ void GeometryNode::SetMaterial(Material* material)
     GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
     for (size_t i = 0; i < geomDrawable->batches.NumGeometries(); ++i)
         geomDrawable->batches.SetMaterial(i, material);
+    Material::MarkBatchesChanged();
 }
 
 void GeometryNode::SetMaterial(size_t index, Material* material)
@@ -153,7 +213,10 @@ void GeometryNode::SetMaterial(size_t index, Material* material)
 
     GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
     if (index < geomDrawable->batches.NumGeometries())
+    {
         geomDrawable->batches.SetMaterial(index, material);
+        Material::MarkBatchesChanged();
+    }
 }
 
 void GeometryNode::SetMaterialsAttr(const ResourceRefList& value)
@@ -4,8 +4,14 @@
 
 #include "../Graphics/GraphicsDefs.h"
 #include "../IO/ResourceRef.h"
+#include "../Math/TriangleBvh.h"
+#include "../Object/AutoPtr.h"
+#include "../Object/IdAllocator.h"
 #include "OctreeNode.h"
 
+#include <atomic>
+#include <vector>
+
 class GeometryNode;
 class IndexBuffer;
 class Material;
@@ -13,6 +19,23 @@ class Pass;
 class ShaderProgram;
 class VertexBuffer;
 
+/// Cluster of spatially close triangles within a geometry's draw range, with bounds for culling.
+struct Meshlet
+{
+    /// Bounding sphere center in model space.
+    Vector3 center;
+    /// Bounding sphere radius.
+    float radius;
+    /// Normal cone axis in model space.
+    Vector3 coneAxis;
+    /// Sine of the normal cone's half angle, or 1 if the triangles face too many directions for backface culling.
+    float coneCutoff;
+    /// Index start relative to the geometry's draw start.
+    unsigned indexStart;
+    /// Number of indices.
+    unsigned indexCount;
+};
+
 /// Description of geometry to be rendered. %Scene nodes that render the same object can share these to reduce memory load and allow instancing.
 struct Geometry : public RefCounted
 {
@@ -21,16 +44,24 @@ struct Geometry : public RefCounted
     /// Destruct.
     ~Geometry();
 
-    /// Return ray hit distance if has CPU-side data, or infinity if no hit or no data.
+    /// Return ray hit distance if has CPU-side data, or infinity if no hit or no data. A triangle hierarchy is built on the first call for large geometries, after which the CPU-side data should not be modified.
     float HitDistance(const Ray& ray, Vector3* outNormal = nullptr) const;
+    /// Return compact ID, which is stable for the lifetime of the geometry. Used for sorting.
+    unsigned short Id() const { return id; }
 
     /// Last sort key for combined distance and state sorting. Used by Renderer.
     std::pair<unsigned short, unsigned short> lastSortKey;
 
     /// %Geometry vertex buffer.
     SharedPtr<VertexBuffer> vertexBuffer;
+    /// Optional position-only vertex buffer in the same vertex order, used by passes whose programs only read position.
+    SharedPtr<VertexBuffer> positionBuffer;
     /// %Geometry index buffer.
     SharedPtr<IndexBuffer> indexBuffer;
+    /// Optional instance data of three vectors per instance owned by the geometry, such as particle states or terrain nodes. When defined, the geometry is drawn once per instance in one instanced call. Used by custom geometry drawables.
+    SharedPtr<VertexBuffer> instanceBuffer;
+    /// Number of instances drawn from the instance buffer, or zero to draw one per vertex of the buffer.
+    size_t instanceCount;
     /// Draw range start. Specifies index start if index buffer defined, vertex start otherwise.
     size_t drawStart;
     /// Draw range count. Specifies number of indices if index buffer defined, number of vertices otherwise.
@@ -45,6 +76,19 @@ struct Geometry : public RefCounted
     size_t cpuIndexSize;
     /// Optional draw range start for the CPU data. May be different in case combined vertex and index buffers are in use.
     size_t cpuDrawStart;
+    /// Optional meshlets that partition the draw range, for culling parts of large geometries in multi-draw mode.
+    std::vector<Meshlet> meshlets;
+
+private:
+    /// Triangle hierarchy for ray queries, built on demand.
+    mutable AutoPtr<TriangleBvh> triangleBvh;
+    /// Whether the need for the triangle hierarchy has been checked.
+    mutable std::atomic<bool> triangleBvhChecked;
+    /// Compact ID.
+    unsigned short id;
+
+    /// Geometry ID allocator.
+    static IdAllocator idAllocator;
 };
 
 /// Draw call source data with optimal memory storage. 
@@ -68,7 +112,7 @@ public:
             *(reinterpret_cast<Geometry**>(geomPtr) + index * 2) = geometry;
     } 
 
-    /// Set material at index. %Materials hold strong refs and should not be changed from worker threads in OnPrepareRender().
+    /// Set material at index. %Materials hold strong refs, which are counted atomically, so they may be changed from worker threads in OnPrepareRender() if the materials stay referenced elsewhere, for example by the resource cache, so that none is destroyed outside the main thread.
     void SetMaterial(size_t index, Material* material)
     {
         if (numGeometries < 2)
@@ -116,8 +160,18 @@ public:
 
     /// Prepare object for rendering. Reset framenumber and calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
     bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
-    /// Update GPU resources and set uniforms for rendering. Called by Renderer when geometry type is not static.
+    /// Update GPU resources for the prepared view. Called by Renderer in the main thread once view preparation has finished, when geometry type is not static.
+    virtual void OnUpdateGPUData();
+    /// Set uniforms and bind GPU resources for rendering. Called by Renderer when geometry type is not static. In pipelined mode, this may happen while the next view is already being prepared.
     virtual void OnRender(ShaderProgram* program, size_t geomIndex);
+    /// Return skin matrices for instanced skinning and write their count, or null if not skinned. Called by Renderer in worker threads when sorting batches.
+    virtual const Matrix3x4* SkinMatrices(size_t& numMatrices) const;
+    /// Return the LOD level being faded out at geometry index and write the crossfade value of the current level, or null if not crossfading. Called by Renderer in worker threads when the DF_LOD_FADE flag is set.
+    virtual Geometry* LodFadeGeometry(size_t index, float& fade) const;
+    /// Return the draw call source data to use instead of the geometries, or null if none. Called by Renderer in worker threads when the DF_IMPOSTOR flag is set.
+    virtual const SourceBatches* ImpostorBatches() const;
+    /// Return the geometry at index for a camera with an additional LOD bias, without changing the LOD level in use. Called by Renderer in worker threads for secondary views, possibly while the main view is being prepared.
+    virtual Geometry* LodGeometry(size_t index, Camera* camera, float lodBias) const;
 
     /// Return geometry type.
     GeometryType GetGeometryType() const { return (GeometryType)(Flags() & DF_GEOMETRY_TYPE_BITS); }
@@ -0,0 +1,346 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Graphics.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/Texture.h"
+#include "../Graphics/VertexBuffer.h"
+#include "Camera.h"
+#include "GpuCulling.h"
+#include "Material.h"
+#include "Model.h"
+#include "Octree.h"
+#include "StaticModel.h"
+
+#include <algorithm>
+#include <map>
+#include <tracy/Tracy.hpp>
+
+static const UniformSlot U_CULLVIEWPROJ = ShaderProgram::RegisterUniform("cullViewProj");
+static const UniformSlot U_CULLVIEWZ = ShaderProgram::RegisterUniform("cullViewZ");
+static const UniformSlot U_CULLPARAMETERS = ShaderProgram::RegisterUniform("cullParameters");
+static const UniformSlot U_OCCLUSIONVIEWPROJ = ShaderProgram::RegisterUniform("occlusionViewProj");
+
+/// LOD levels of a model geometry with one material, drawn with one command per level.
+struct GpuCullChain
+{
+    /// LOD level geometries.
+    const std::vector<SharedPtr<Geometry> >* geometries;
+    /// Opaque pass of the material.
+    Pass* pass;
+    /// Number of instance records, which is the instance capacity of each level's command.
+    unsigned numRecords;
+    /// First LOD level in the level data.
+    unsigned firstLevel;
+};
+
+/// Return whether all drawables of a BVH leaf can be culled and drawn on the GPU: plain opaque static models with indexed geometries in the static transform table, without an impostor or HLOD proxy.
+static bool IsGpuCullable(const Octant* leaf)
+{
+    if (leaf->drawables.empty())
+        return false;
+
+    for (size_t i = 0; i < leaf->drawables.size(); ++i)
+    {
+        unsigned short flags = leaf->drawableFlags[i];
+        Drawable* drawable = leaf->drawables[i];
+        if (!(flags & DF_GEOMETRY) || !(flags & DF_STATIC) || (flags & (DF_GEOMETRY_TYPE_BITS | DF_HLOD)) || drawable->DrawableType() != DT_STATICMODEL ||
+            drawable->StaticIndex() == M_MAX_UNSIGNED)
+            return false;
+
+        StaticModelDrawable* modelDrawable = static_cast<StaticModelDrawable*>(drawable);
+        Model* model = modelDrawable->GetModel();
+        if (!model || modelDrawable->ImpostorBatches())
+            return false;
+
+        const SourceBatches& batches = modelDrawable->batches;
+        for (size_t j = 0; j < batches.NumGeometries(); ++j)
+        {
+            Material* material = batches.GetMaterial(j);
+            if (!material || !material->GetPass(PASS_OPAQUE))
+                return false;
+
+            const std::vector<SharedPtr<Geometry> >& geometries = model->LodGeometries(j);
+            if (geometries.empty())
+                return false;
+            for (auto it = geometries.begin(); it != geometries.end(); ++it)
+            {
+                Geometry* geometry = *it;
+                if (!geometry || !geometry->vertexBuffer || !geometry->indexBuffer || geometry->instanceBuffer)
+                    return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+GpuCuller::GpuCuller() :
+    graphics(Object::Subsystem<Graphics>()),
+    numInstanceSlots(0),
+    octree(nullptr),
+    bvhVersion(0),
+    materialVersion(0),
+    viewMask(0),
+    uploadPending(false),
+    numCapturedRecords(0)
+{
+    assert(graphics && graphics->IsInitialized());
+}
+
+GpuCuller::~GpuCuller()
+{
+}
+
+bool GpuCuller::Update(Octree* octree_, unsigned viewMask_)
+{
+    if (octree_ == octree && octree_->BvhVersion() == bvhVersion && Material::BatchVersion() == materialVersion && viewMask_ == viewMask)
+        return false;
+
+    ZoneScoped;
+
+    Clear();
+
+    octree = octree_;
+    bvhVersion = octree->BvhVersion();
+    materialVersion = Material::BatchVersion();
+    viewMask = viewMask_;
+    uploadPending = true;
+
+    const std::vector<BvhNode>& nodes = octree->BvhNodes();
+    managedNodes.assign(nodes.size(), 0);
+
+    std::vector<GpuCullChain> chains;
+    std::map<std::pair<const void*, Pass*>, unsigned> chainIndices;
+    std::vector<unsigned> recordChains;
+
+    // The children of a node come after it, so a backward pass sees them first. A node is managed when both of its children are
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        const BvhNode& node = nodes[i];
+        if (!node.IsLeaf())
+        {
+            managedNodes[i] = managedNodes[node.index] && managedNodes[node.index + 1];
+            continue;
+        }
+
+        const Octant* leaf = octree->BvhLeaf(node.index);
+        if (!IsGpuCullable(leaf))
+            continue;
+
+        managedNodes[i] = 1;
+
+        for (size_t j = 0; j < leaf->drawables.size(); ++j)
+        {
+            if (!(leaf->drawableLayerMasks[j] & viewMask))
+                continue;
+
+            StaticModelDrawable* drawable = static_cast<StaticModelDrawable*>(leaf->drawables[j]);
+            Model* model = drawable->GetModel();
+            const SourceBatches& batches = drawable->batches;
+            const BoundingBox& localBox = model->LocalBoundingBox();
+            bounds.Merge(drawable->WorldBoundingBox());
+
+            for (size_t k = 0; k < batches.NumGeometries(); ++k)
+            {
+                const std::vector<SharedPtr<Geometry> >* geometries = &model->LodGeometries(k);
+                Pass* pass = batches.GetMaterial(k)->GetPass(PASS_OPAQUE);
+
+                std::pair<const void*, Pass*> key(geometries, pass);
+                auto cIt = chainIndices.find(key);
+                if (cIt == chainIndices.end())
+                {
+                    GpuCullChain newChain;
+                    newChain.geometries = geometries;
+                    newChain.pass = pass;
+                    newChain.numRecords = 0;
+                    newChain.firstLevel = 0;
+                    cIt = chainIndices.insert(std::make_pair(key, (unsigned)chains.size())).first;
+                    chains.push_back(newChain);
+                }
+                ++chains[cIt->second].numRecords;
+
+                GpuCullRecord record;
+                record.boxMin = localBox.min;
+                record.staticIndex = drawable->StaticIndex();
+                record.boxMax = localBox.max;
+                record.maxDistance = drawable->MaxDistance();
+                record.firstLevel = 0;
+                record.numLevels = (unsigned)geometries->size();
+                record.lodBias = drawable->LodBias();
+                record.padding = 0.0f;
+                records.push_back(record);
+                recordChains.push_back(cIt->second);
+            }
+        }
+    }
+
+    if (records.empty())
+        return true;
+
+    // One command per LOD level of each chain, sorted so that the commands sharing the pass and geometry buffers can be drawn with one multi-draw call
+    std::vector<std::pair<unsigned, unsigned> > entries;
+    unsigned numLevels = 0;
+    for (size_t i = 0; i < chains.size(); ++i)
+    {
+        chains[i].firstLevel = numLevels;
+        for (unsigned j = 0; j < chains[i].geometries->size(); ++j)
+            entries.push_back(std::make_pair((unsigned)i, j));
+        numLevels += (unsigned)chains[i].geometries->size();
+    }
+
+    std::sort(entries.begin(), entries.end(), [&](const std::pair<unsigned, unsigned>& lhs, const std::pair<unsigned, unsigned>& rhs)
+    {
+        const GpuCullChain& lhsChain = chains[lhs.first];
+        const GpuCullChain& rhsChain = chains[rhs.first];
+        Geometry* lhsGeometry = (*lhsChain.geometries)[lhs.second];
+        Geometry* rhsGeometry = (*rhsChain.geometries)[rhs.second];
+        if (lhsChain.pass != rhsChain.pass)
+            return lhsChain.pass < rhsChain.pass;
+        if (lhsGeometry->vertexBuffer != rhsGeometry->vertexBuffer)
+            return lhsGeometry->vertexBuffer < rhsGeometry->vertexBuffer;
+        if (lhsGeometry->indexBuffer != rhsGeometry->indexBuffer)
+            return lhsGeometry->indexBuffer < rhsGeometry->indexBuffer;
+        return lhs < rhs;
+    });
+
+    levels.resize(numLevels);
+
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        const GpuCullChain& chain = chains[entries[i].first];
+        Geometry* geometry = (*chain.geometries)[entries[i].second];
+
+        IndirectDrawCommand command;
+        command.count = (unsigned)geometry->drawCount;
+        command.instanceCount = 0;
+        command.firstIndex = (unsigned)geometry->drawStart;
+        command.baseVertex = 0;
+        command.baseInstance = (unsigned)numInstanceSlots;
+        commands.push_back(command);
+        numInstanceSlots += chain.numRecords;
+
+        GpuCullLevel& level = levels[chain.firstLevel + entries[i].second];
+        level.command = (unsigned)i;
+        level.lodDistance = geometry->lodDistance;
+
+        Batch* last = batches.size() ? &batches.back() : nullptr;
+        if (last && last->GetPass() == chain.pass && last->geometry->vertexBuffer == geometry->vertexBuffer && last->geometry->indexBuffer == geometry->indexBuffer)
+            ++last->instanceCount;
+        else
+        {
+            Batch newBatch;
+            newBatch.SetPass(chain.pass);
+            newBatch.instanceStart = (unsigned)i;
+            newBatch.staticIndex = GPU_CULLED_INDEX;
+            newBatch.geometry = geometry;
+            newBatch.instanceCount = 1;
+            newBatch.lodFade = 0.0f;
+            newBatch.programBits = SP_STATICINSTANCED;
+            newBatch.geomIndex = 0;
+            batches.push_back(newBatch);
+        }
+    }
+
+    for (size_t i = 0; i < records.size(); ++i)
+        records[i].firstLevel = chains[recordChains[i]].firstLevel;
+
+    return true;
+}
+
+bool GpuCuller::Clear()
+{
+    bool hadDrawables = managedNodes.size() > 0;
+
+    records.clear();
+    levels.clear();
+    commands.clear();
+    batches.clear();
+    managedNodes.clear();
+    bounds.Undefine();
+    numInstanceSlots = 0;
+    octree = nullptr;
+    uploadPending = true;
+
+    return hadDrawables;
+}
+
+void GpuCuller::Capture(Camera* camera)
+{
+    if (uploadPending)
+        Upload();
+
+    const Matrix3x4& view = camera->ViewMatrix();
+    viewZ = Vector4(view.m20, view.m21, view.m22, view.m23);
+    cullParameters = Vector4(camera->LodBias() * camera->Zoom(), camera->IsOrthographic() ? camera->OrthoSize() : 0.0f, (float)numCapturedRecords, 0.0f);
+}
+
+void GpuCuller::Cull(const Matrix4& viewProj, Texture* occlusionDepth, const Matrix4& occlusionViewProj)
+{
+    ZoneScoped;
+
+    if (!numCapturedRecords)
+        return;
+
+    ShaderProgram* program = graphics->SetComputeProgram("Shaders/GpuCull.glsl", occlusionDepth ? "OCCLUSION" : "");
+    if (!program)
+        return;
+
+    // Reset the instance counts written by the previous cull
+    commandBuffer->SetData(0, capturedCommands.size(), &capturedCommands[0]);
+
+    graphics->SetUniform(program, U_CULLVIEWPROJ, viewProj);
+    graphics->SetUniform(program, U_CULLVIEWZ, viewZ);
+    graphics->SetUniform(program, U_CULLPARAMETERS, cullParameters);
+    if (occlusionDepth)
+    {
+        graphics->SetUniform(program, U_OCCLUSIONVIEWPROJ, occlusionViewProj);
+        graphics->SetTexture(0, occlusionDepth);
+    }
+
+    recordBuffer->BindStorage(0);
+    levelBuffer->BindStorage(1);
+    commandBuffer->BindStorage(2);
+    instanceBuffer->BindStorage(3);
+    graphics->DispatchCompute(IntVector3((int)(numCapturedRecords + 63) / 64, 1, 1));
+
+    if (occlusionDepth)
+        graphics->SetTexture(0, nullptr);
+
+    graphics->DrawCommandBarrier();
+}
+
+void GpuCuller::Upload()
+{
+    ZoneScoped;
+
+    uploadPending = false;
+    numCapturedRecords = records.size();
+    capturedCommands = commands;
+    capturedBatches.batches = batches;
+
+    if (records.empty())
+        return;
+
+    if (!recordBuffer)
+    {
+        recordBuffer = new VertexBuffer();
+        levelBuffer = new VertexBuffer();
+        instanceBuffer = new VertexBuffer();
+        commandBuffer = new IndirectBuffer();
+    }
+
+    std::vector<VertexElement> recordElements;
+    recordElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 0));
+    recordElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 1));
+    recordElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 2));
+    std::vector<VertexElement> levelElements;
+    levelElements.push_back(VertexElement(ELEM_VECTOR2, SEM_TEXCOORD));
+    // The static transform table index only. The material table slot of the renderer's static instance data reads as zero, the bound material
+    std::vector<VertexElement> instanceElements;
+    instanceElements.push_back(VertexElement(ELEM_FLOAT, SEM_TEXCOORD, 3));
+
+    recordBuffer->Define(USAGE_DEFAULT, records.size(), recordElements, &records[0]);
+    levelBuffer->Define(USAGE_DEFAULT, levels.size(), levelElements, &levels[0]);
+    instanceBuffer->Define(USAGE_DEFAULT, numInstanceSlots, instanceElements);
+    commandBuffer->Define(USAGE_DYNAMIC, commands.size(), &commands[0]);
+}
@@ -0,0 +1,132 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Graphics/IndirectBuffer.h"
+#include "../Math/BoundingBox.h"
+#include "../Math/Matrix4.h"
+#include "../Math/Vector4.h"
+#include "../Object/AutoPtr.h"
+#include "Batch.h"
+
+#include <vector>
+
+class Camera;
+class Graphics;
+class Octree;
+class Texture;
+class VertexBuffer;
+
+/// Static transform table index that marks the batches of GpuCuller, which draw the commands written by culling.
+static const unsigned GPU_CULLED_INDEX = 0xfffffffe;
+
+/// Static geometry instance culled on the GPU. Matches the storage buffer layout of the culling shader.
+struct GpuCullRecord
+{
+    /// Local space bounding box minimum.
+    Vector3 boxMin;
+    /// Index in the static transform table.
+    unsigned staticIndex;
+    /// Local space bounding box maximum.
+    Vector3 boxMax;
+    /// Maximum draw distance, or zero if unlimited.
+    float maxDistance;
+    /// First LOD level in the level data.
+    unsigned firstLevel;
+    /// Number of LOD levels.
+    unsigned numLevels;
+    /// LOD bias of the drawable.
+    float lodBias;
+    /// Padding to a whole number of vectors.
+    float padding;
+};
+
+/// LOD level of a GPU culled geometry. Matches the storage buffer layout of the culling shader.
+struct GpuCullLevel
+{
+    /// Draw command index.
+    unsigned command;
+    /// LOD distance from which the level is used.
+    float lodDistance;
+};
+
+/// GPU-driven culling of the static geometries in an octree's static BVH. The drawables of the BVH leaves that hold only plain opaque static models are uploaded once as instance records with their local bounding boxes. On each frame a compute shader tests them against the view frustum, the maximum draw distance and optionally the GPU occlusion depth, using the world transforms of the static transform table, selects their LOD levels and appends the visible instances to a draw command per LOD level and material, so that the CPU cost does not depend on the number of these drawables. The managed BVH subtrees are skipped by the CPU culling of the view.
+class GpuCuller
+{
+public:
+    /// Construct. Graphics subsystem must have been initialized.
+    GpuCuller();
+    /// Destruct.
+    ~GpuCuller();
+
+    /// Update the managed drawables from an octree's static BVH for the view being prepared if the BVH, material assignments or view mask have changed. Return true if changed.
+    bool Update(Octree* octree, unsigned viewMask);
+    /// Release the managed drawables from the view being prepared. Return true if there were any.
+    bool Clear();
+    /// Take the managed drawables into use for rendering, uploading them if changed, and store the camera's distance and LOD parameters for culling. Call when the view is captured.
+    void Capture(Camera* camera);
+    /// Cull the captured drawables into the draw commands with the view-projection matrix, and optionally against an occlusion depth texture rendered with another view-projection matrix. The static transform texture must be bound to its texture unit.
+    void Cull(const Matrix4& viewProj, Texture* occlusionDepth, const Matrix4& occlusionViewProj);
+
+    /// Return whether a static BVH node and its whole subtree are managed in the view being prepared.
+    bool IsManaged(size_t nodeIndex) const { return nodeIndex < managedNodes.size() && managedNodes[nodeIndex]; }
+    /// Return whether has managed drawables in the view being prepared.
+    bool HasDrawables() const { return records.size() > 0; }
+    /// Return the world bounding box of the managed drawables in the view being prepared.
+    const BoundingBox& Bounds() const { return bounds; }
+    /// Return the batches of the captured drawables. Each draws a range of the commands that share the pass and geometry buffers.
+    const BatchQueue& Batches() const { return capturedBatches; }
+    /// Return the instance buffer written by culling.
+    VertexBuffer* InstanceBuffer() const { return instanceBuffer; }
+    /// Return the draw command buffer written by culling.
+    IndirectBuffer* CommandBuffer() const { return commandBuffer; }
+
+private:
+    /// Upload the managed drawables and copy their batches for rendering.
+    void Upload();
+
+    /// Graphics subsystem.
+    Graphics* graphics;
+    /// Instance records in the view being prepared.
+    std::vector<GpuCullRecord> records;
+    /// LOD levels of the geometries in the view being prepared.
+    std::vector<GpuCullLevel> levels;
+    /// Draw commands with zero instances in the view being prepared.
+    std::vector<IndirectDrawCommand> commands;
+    /// Batches in the view being prepared.
+    std::vector<Batch> batches;
+    /// Managed subtree flag per BVH node.
+    std::vector<unsigned char> managedNodes;
+    /// World bounding box of the managed drawables.
+    BoundingBox bounds;
+    /// Number of instance slots of the draw commands.
+    size_t numInstanceSlots;
+    /// Octree the drawables were taken from.
+    Octree* octree;
+    /// BVH version of the octree at the last update.
+    unsigned bvhVersion;
+    /// Material batch version at the last update.
+    unsigned materialVersion;
+    /// View mask at the last update.
+    unsigned viewMask;
+    /// Whether the managed drawables have changed since the last capture.
+    bool uploadPending;
+    /// Instance record storage buffer.
+    AutoPtr<VertexBuffer> recordBuffer;
+    /// LOD level storage buffer.
+    AutoPtr<VertexBuffer> levelBuffer;
+    /// Static transform table indices of the visible instances, written by culling.
+    AutoPtr<VertexBuffer> instanceBuffer;
+    /// Draw commands, whose instance counts are written by culling.
+    AutoPtr<IndirectBuffer> commandBuffer;
+    /// Draw commands with zero instances for resetting before culling.
+    std::vector<IndirectDrawCommand> capturedCommands;
+    /// Batches of the captured drawables.
+    BatchQueue capturedBatches;
+    /// Number of captured instance records.
+    size_t numCapturedRecords;
+    /// View space Z axis of the captured camera, for the distances.
+    Vector4 viewZ;
+    /// LOD bias and zoom of the captured camera, its orthographic size or zero if perspective, and the number of captured records.
+    Vector4 cullParameters;
+};
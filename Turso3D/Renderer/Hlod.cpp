@@ -0,0 +1,360 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/IndexBuffer.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/Log.h"
+#include "Hlod.h"
+#include "Material.h"
+#include "MeshSimplifier.h"
+#include "Octree.h"
+#include "StaticModel.h"
+
+#include <cstring>
+#include <tracy/Tracy.hpp>
+
+// Smallest triangle count worth simplifying
+static const size_t HLOD_MIN_TRIANGLES = 64;
+
+/// World space geometry being merged for one material and vertex layout.
+struct HlodGroup
+{
+    /// Material.
+    Material* material;
+    /// Vertex declaration.
+    std::vector<VertexElement> elements;
+    /// Size of one vertex.
+    size_t vertexSize;
+    /// Vertex data.
+    std::vector<unsigned char> vertexData;
+    /// Triangle list indices.
+    std::vector<unsigned> indices;
+};
+
+/// Return the offset of a vertex element with the given semantic and type, or M_MAX_UNSIGNED if not found.
+static size_t ElementOffset(const std::vector<VertexElement>& elements, ElementSemantic semantic, ElementType type)
+{
+    for (auto it = elements.begin(); it != elements.end(); ++it)
+    {
+        if (it->semantic == semantic && !it->index)
+            return it->type == type ? it->offset : M_MAX_UNSIGNED;
+    }
+
+    return M_MAX_UNSIGNED;
+}
+
+/// Return whether a geometry's vertices can be transformed to world space and merged.
+static bool IsMergeable(Geometry* geometry)
+{
+    if (!geometry || !geometry->vertexBuffer || !geometry->indexBuffer || !geometry->drawCount)
+        return false;
+
+    const std::vector<VertexElement>& elements = geometry->vertexBuffer->Elements();
+    bool hasPosition = false;
+
+    for (auto it = elements.begin(); it != elements.end(); ++it)
+    {
+        if (it->semantic == SEM_POSITION && !it->index && it->type == ELEM_VECTOR3)
+            hasPosition = true;
+        // Packed normals and tangents would need repacking after the transform, and skinned vertices are not static
+        else if ((it->semantic == SEM_NORMAL && it->type != ELEM_VECTOR3) || (it->semantic == SEM_TANGENT && it->type != ELEM_VECTOR4) ||
+            it->semantic == SEM_BLENDWEIGHTS || it->semantic == SEM_BLENDINDICES)
+            return false;
+    }
+
+    return hasPosition;
+}
+
+/// Return whether two vertex declarations match.
+static bool SameElements(const std::vector<VertexElement>& lhs, const std::vector<VertexElement>& rhs)
+{
+    if (lhs.size() != rhs.size())
+        return false;
+
+    for (size_t i = 0; i < lhs.size(); ++i)
+    {
+        if (lhs[i].type != rhs[i].type || lhs[i].semantic != rhs[i].semantic || lhs[i].index != rhs[i].index)
+            return false;
+    }
+
+    return true;
+}
+
+/// Read a geometry's triangles and referenced vertices, transform them to world space and append to a group. Return false if the data could not be read.
+static bool AppendGeometry(HlodGroup& group, Geometry* geometry, const Matrix3x4& worldTransform)
+{
+    IndexBuffer* ib = geometry->indexBuffer;
+    VertexBuffer* vb = geometry->vertexBuffer;
+    size_t indexSize = ib->IndexSize();
+
+    std::vector<unsigned char> indexData(geometry->drawCount * indexSize);
+    if (!ib->GetData(geometry->drawStart, geometry->drawCount, &indexData[0]))
+        return false;
+
+    std::vector<unsigned> indices(geometry->drawCount);
+    unsigned minVertex = M_MAX_UNSIGNED;
+    unsigned maxVertex = 0;
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        indices[i] = indexSize == sizeof(unsigned) ? reinterpret_cast<unsigned*>(&indexData[0])[i] : reinterpret_cast<unsigned short*>(&indexData[0])[i];
+        if (indices[i] < minVertex)
+            minVertex = indices[i];
+        if (indices[i] > maxVertex)
+            maxVertex = indices[i];
+    }
+
+    size_t numVertices = maxVertex - minVertex + 1;
+    size_t vertexSize = group.vertexSize;
+    size_t vertexStart = group.vertexData.size() / vertexSize;
+    group.vertexData.resize((vertexStart + numVertices) * vertexSize);
+    unsigned char* vertexData = &group.vertexData[vertexStart * vertexSize];
+    if (!vb->GetData(minVertex, numVertices, vertexData))
+    {
+        group.vertexData.resize(vertexStart * vertexSize);
+        return false;
+    }
+
+    size_t positionOffset = ElementOffset(group.elements, SEM_POSITION, ELEM_VECTOR3);
+    size_t normalOffset = ElementOffset(group.elements, SEM_NORMAL, ELEM_VECTOR3);
+    size_t tangentOffset = ElementOffset(group.elements, SEM_TANGENT, ELEM_VECTOR4);
+    Matrix3 rotation = worldTransform.ToMatrix3();
+    Matrix3 normalMatrix = worldTransform.Inverse().ToMatrix3().Transpose();
+
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        unsigned char* vertex = vertexData + i * vertexSize;
+        Vector3& position = *reinterpret_cast<Vector3*>(vertex + positionOffset);
+        position = worldTransform * position;
+        if (normalOffset != M_MAX_UNSIGNED)
+        {
+            Vector3& normal = *reinterpret_cast<Vector3*>(vertex + normalOffset);
+            normal = (normalMatrix * normal).Normalized();
+        }
+        if (tangentOffset != M_MAX_UNSIGNED)
+        {
+            Vector3& tangent = *reinterpret_cast<Vector3*>(vertex + tangentOffset);
+            tangent = (rotation * tangent).Normalized();
+        }
+    }
+
+    // A mirroring transform flips the triangle winding
+    Vector3 axisX(rotation.m00, rotation.m10, rotation.m20);
+    Vector3 axisY(rotation.m01, rotation.m11, rotation.m21);
+    Vector3 axisZ(rotation.m02, rotation.m12, rotation.m22);
+    bool mirrored = axisX.CrossProduct(axisY).DotProduct(axisZ) < 0.0f;
+
+    unsigned offset = (unsigned)vertexStart - minVertex;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        group.indices.push_back(indices[i] + offset);
+        group.indices.push_back(indices[mirrored ? i + 2 : i + 1] + offset);
+        group.indices.push_back(indices[mirrored ? i + 1 : i + 2] + offset);
+    }
+
+    return true;
+}
+
+HlodProxy::HlodProxy() :
+    lastSubstituteFrame(0),
+    octant(nullptr),
+    layerMask(0),
+    numTriangles(0),
+    dirty(false)
+{
+}
+
+HlodProxy::~HlodProxy()
+{
+    Release();
+}
+
+bool HlodProxy::Build(const std::vector<Drawable*>& drawables_, float triangleRatio)
+{
+    ZoneScoped;
+
+    Release();
+    drawables.clear();
+    worldBoundingBox.Undefine();
+    layerMask = 0;
+    numTriangles = 0;
+
+    std::vector<HlodGroup> groups;
+
+    for (auto it = drawables_.begin(); it != drawables_.end(); ++it)
+    {
+        Drawable* drawable = *it;
+        if (!drawable->TestFlag(DF_GEOMETRY) || !drawable->TestFlag(DF_STATIC) || (drawable->Flags() & DF_GEOMETRY_TYPE_BITS) || drawable->TestFlag(DF_HLOD) ||
+            drawable->Owner()->Type() != StaticModel::TypeStatic())
+            continue;
+
+        StaticModelDrawable* modelDrawable = static_cast<StaticModelDrawable*>(drawable);
+        Model* model = modelDrawable->GetModel();
+        if (!model || !model->IsReady() || model->NumGeometries() != modelDrawable->batches.NumGeometries())
+            continue;
+
+        // Merge the drawable only if all its geometries can be merged, as it is skipped as a whole when substituted
+        size_t numGeometries = model->NumGeometries();
+        bool mergeable = numGeometries > 0;
+        for (size_t i = 0; i < numGeometries && mergeable; ++i)
+        {
+            Material* material = modelDrawable->batches.GetMaterial(i);
+            mergeable = material && material->GetPass(PASS_OPAQUE) && IsMergeable(model->GetGeometry(i, 0));
+        }
+        if (!mergeable)
+            continue;
+
+        const Matrix3x4& worldTransform = drawable->WorldTransform();
+
+        for (size_t i = 0; i < numGeometries; ++i)
+        {
+            Material* material = modelDrawable->batches.GetMaterial(i);
+            Geometry* geometry = model->GetGeometry(i, 0);
+            const std::vector<VertexElement>& elements = geometry->vertexBuffer->Elements();
+
+            HlodGroup* group = nullptr;
+            for (auto gIt = groups.begin(); gIt != groups.end(); ++gIt)
+            {
+                if (gIt->material == material && SameElements(gIt->elements, elements) && gIt->vertexData.size() / gIt->vertexSize + geometry->drawCount <= COMBINEDBUFFER_VERTICES &&
+                    gIt->indices.size() + geometry->drawCount <= COMBINEDBUFFER_INDICES)
+                {
+                    group = &*gIt;
+                    break;
+                }
+            }
+
+            if (!group)
+            {
+                groups.resize(groups.size() + 1);
+                group = &groups.back();
+                group->material = material;
+                group->elements = elements;
+                group->vertexSize = geometry->vertexBuffer->VertexSize();
+            }
+
+            if (!AppendGeometry(*group, geometry, worldTransform))
+            {
+                LOGERROR("Failed to read geometry data for HLOD proxy");
+                drawables.clear();
+                return false;
+            }
+        }
+
+        drawables.push_back(drawable);
+        worldBoundingBox.Merge(drawable->WorldBoundingBox());
+        layerMask |= drawable->LayerMask();
+    }
+
+    for (auto it = groups.begin(); it != groups.end();)
+    {
+        if (it->indices.empty())
+            it = groups.erase(it);
+        else
+            ++it;
+    }
+
+    batches.SetNumGeometries(groups.size());
+
+    for (size_t i = 0; i < groups.size(); ++i)
+    {
+        HlodGroup& group = groups[i];
+        size_t vertexSize = group.vertexSize;
+        size_t numVertices = group.vertexData.size() / vertexSize;
+        std::vector<unsigned>& indices = group.indices;
+
+        if (triangleRatio < 1.0f && indices.size() / 3 >= HLOD_MIN_TRIANGLES)
+        {
+            size_t positionOffset = ElementOffset(group.elements, SEM_POSITION, ELEM_VECTOR3);
+            size_t normalOffset = ElementOffset(group.elements, SEM_NORMAL, ELEM_VECTOR3);
+            size_t texCoordOffset = ElementOffset(group.elements, SEM_TEXCOORD, ELEM_VECTOR2);
+
+            std::vector<Vector3> positions(numVertices);
+            std::vector<Vector3> normals(normalOffset != M_MAX_UNSIGNED ? numVertices : 0);
+            std::vector<Vector2> texCoords(texCoordOffset != M_MAX_UNSIGNED ? numVertices : 0);
+            for (size_t j = 0; j < numVertices; ++j)
+            {
+                const unsigned char* vertex = &group.vertexData[j * vertexSize];
+                positions[j] = *reinterpret_cast<const Vector3*>(vertex + positionOffset);
+                if (normals.size())
+                    normals[j] = *reinterpret_cast<const Vector3*>(vertex + normalOffset);
+                if (texCoords.size())
+                    texCoords[j] = *reinterpret_cast<const Vector2*>(vertex + texCoordOffset);
+            }
+
+            MeshSimplifier simplifier;
+            simplifier.SetMesh(&indices[0], indices.size(), &positions[0], normals.size() ? &normals[0] : nullptr, texCoords.size() ? &texCoords[0] : nullptr, numVertices);
+            simplifier.Simplify(Max((size_t)(indices.size() / 3 * triangleRatio), (size_t)1));
+            simplifier.GetIndices(indices);
+        }
+
+        // Keep only the vertices still referenced, in order of first use
+        std::vector<unsigned> remap(numVertices, M_MAX_UNSIGNED);
+        std::vector<unsigned char> vertexData;
+        unsigned numUsed = 0;
+        for (auto iIt = indices.begin(); iIt != indices.end(); ++iIt)
+        {
+            if (remap[*iIt] == M_MAX_UNSIGNED)
+            {
+                remap[*iIt] = numUsed++;
+                vertexData.insert(vertexData.end(), group.vertexData.begin() + *iIt * vertexSize, group.vertexData.begin() + (*iIt + 1) * vertexSize);
+            }
+            *iIt = remap[*iIt];
+        }
+
+        size_t vertexStart;
+        size_t indexStart;
+        CombinedBuffer* combinedBuffer = CombinedBuffer::Allocate(group.elements, numUsed, indices.size(), false, vertexStart, indexStart);
+        for (auto iIt = indices.begin(); iIt != indices.end(); ++iIt)
+            *iIt += (unsigned)vertexStart;
+        combinedBuffer->FillVertices(vertexStart, numUsed, &vertexData[0]);
+        combinedBuffer->FillIndices(indexStart, indices.size(), &indices[0]);
+
+        combinedBuffers.push_back(SharedPtr<CombinedBuffer>(combinedBuffer));
+        combinedVertices.push_back(BufferRange(vertexStart, numUsed));
+        combinedIndices.push_back(BufferRange(indexStart, indices.size()));
+
+        SharedPtr<Geometry> geometry(new Geometry());
+        geometry->vertexBuffer = combinedBuffer->GetVertexBuffer();
+        geometry->indexBuffer = combinedBuffer->GetIndexBuffer();
+        geometry->drawStart = indexStart;
+        geometry->drawCount = indices.size();
+        geometry->lodDistance = 0.0f;
+        geometries.push_back(geometry);
+
+        batches.SetGeometry(i, geometry);
+        batches.SetMaterial(i, group.material);
+        numTriangles += indices.size() / 3;
+    }
+
+    if (geometries.empty())
+    {
+        drawables.clear();
+        return false;
+    }
+
+    LOGDEBUGF("Merged %d drawables into HLOD proxy with %d geometries and %d triangles", (int)drawables.size(), (int)geometries.size(), (int)numTriangles);
+    return true;
+}
+
+void HlodProxy::Invalidate()
+{
+    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+        (*it)->SetFlag(DF_HLOD, false);
+    drawables.clear();
+
+    if (octant)
+    {
+        octant->hlod = nullptr;
+        octant = nullptr;
+    }
+}
+
+void HlodProxy::Release()
+{
+    for (size_t i = 0; i < combinedBuffers.size(); ++i)
+        combinedBuffers[i]->Free(combinedVertices[i].start, combinedVertices[i].count, combinedIndices[i].start, combinedIndices[i].count);
+
+    combinedBuffers.clear();
+    combinedVertices.clear();
+    combinedIndices.clear();
+    geometries.clear();
+    batches.SetNumGeometries(0);
+}
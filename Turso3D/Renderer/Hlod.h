@@ -0,0 +1,71 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Model.h"
+
+#include <atomic>
+
+struct Octant;
+
+/// Hierarchical LOD proxy of an octree cell. Merges the static models in an octant and its children per material into world space geometries in combined buffers, simplified to a ratio of the original triangles, so that Renderer can draw the whole cell with one batch per material when it is small on screen. Built by Octree::BuildHlod().
+class HlodProxy : public RefCounted
+{
+    friend class Octree;
+
+public:
+    /// Construct.
+    HlodProxy();
+    /// Destruct. Free the combined buffer ranges.
+    ~HlodProxy();
+
+    /// Merge the non-skinned static models among the drawables with the first LOD levels of their geometries. Geometries that are not opaque, or whose normals or tangents are compressed, are left out along with their drawables. Reads back the vertex and index data from the GPU, so should be called in the main thread after the models have been uploaded. Return true if any geometry was merged.
+    bool Build(const std::vector<Drawable*>& drawables, float triangleRatio);
+    /// Stop substituting for the source drawables and clear their merged flag. Called by Octree when a source drawable moves or is removed.
+    void Invalidate();
+
+    /// Return whether can substitute for the source drawables.
+    bool IsValid() const { return octant != nullptr; }
+    /// Return the merged world bounding box of the source drawables.
+    const BoundingBox& WorldBoundingBox() const { return worldBoundingBox; }
+    /// Return the draw call source data, which consists of one merged geometry per material.
+    const SourceBatches& Batches() const { return batches; }
+    /// Return the drawables merged into the proxy.
+    const std::vector<Drawable*>& SourceDrawables() const { return drawables; }
+    /// Return the octant the proxy substitutes for, or null if invalidated.
+    Octant* GetOctant() const { return octant; }
+    /// Return the combined layer mask of the source drawables.
+    unsigned LayerMask() const { return layerMask; }
+    /// Return the total triangle count of the merged geometries.
+    size_t NumTriangles() const { return numTriangles; }
+
+    /// Frame number when last substituted for the source drawables. Used by Renderer.
+    unsigned short lastSubstituteFrame;
+
+private:
+    /// Free the combined buffer ranges.
+    void Release();
+
+    /// Merged geometries.
+    std::vector<SharedPtr<Geometry> > geometries;
+    /// Combined buffers of the merged geometries.
+    std::vector<SharedPtr<CombinedBuffer> > combinedBuffers;
+    /// Vertex ranges allocated from the combined buffers.
+    std::vector<BufferRange> combinedVertices;
+    /// Index ranges allocated from the combined buffers.
+    std::vector<BufferRange> combinedIndices;
+    /// Draw call source data.
+    SourceBatches batches;
+    /// Merged drawables.
+    std::vector<Drawable*> drawables;
+    /// Merged world bounding box.
+    BoundingBox worldBoundingBox;
+    /// Octant substituted for.
+    Octant* octant;
+    /// Combined layer mask.
+    unsigned layerMask;
+    /// Total triangle count.
+    size_t numTriangles;
+    /// Set when a source drawable has moved during a threaded octree update. Checked at the end of the update.
+    std::atomic<bool> dirty;
+};
@@ -0,0 +1,178 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/FrameBuffer.h"
+#include "../Graphics/Graphics.h"
+#include "../Graphics/IndexBuffer.h"
+#include "../Graphics/Shader.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/Texture.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/Log.h"
+#include "../Math/Matrix4.h"
+#include "../Resource/ResourceCache.h"
+#include "Impostor.h"
+#include "Material.h"
+#include "Model.h"
+
+#include <tracy/Tracy.hpp>
+
+// Number of frames per atlas side
+static const int IMPOSTOR_FRAMES = 8;
+// Enlargement of the bounding sphere so that bilinear filtering does not bleed between frames
+static const float IMPOSTOR_MARGIN = 1.05f;
+
+/// Return the direction of an atlas frame by unfolding the octahedron from the frame's position in -1..1.
+static Vector3 FrameDirection(int x, int y)
+{
+    float octX = (float)x / (float)(IMPOSTOR_FRAMES - 1) * 2.0f - 1.0f;
+    float octY = (float)y / (float)(IMPOSTOR_FRAMES - 1) * 2.0f - 1.0f;
+    Vector3 dir(octX, octY, 1.0f - Abs(octX) - Abs(octY));
+    if (dir.z < 0.0f)
+    {
+        float foldX = (1.0f - Abs(dir.y)) * (dir.x >= 0.0f ? 1.0f : -1.0f);
+        float foldY = (1.0f - Abs(dir.x)) * (dir.y >= 0.0f ? 1.0f : -1.0f);
+        dir.x = foldX;
+        dir.y = foldY;
+    }
+    return dir.Normalized();
+}
+
+Impostor::Impostor()
+{
+}
+
+Impostor::~Impostor()
+{
+}
+
+bool Impostor::Bake(Model* model, const std::vector<Material*>& materials, int frameSize)
+{
+    ZoneScoped;
+
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    if (!model || !graphics || !graphics->IsInitialized() || !cache || frameSize < 1)
+        return false;
+
+    const BoundingBox& box = model->LocalBoundingBox();
+    Vector3 center = box.Center();
+    float radius = box.Size().Length() * 0.5f * IMPOSTOR_MARGIN;
+    if (!box.IsDefined() || radius <= 0.0f)
+    {
+        LOGERROR("Can not bake impostor for model " + model->Name() + " without a bounding box");
+        return false;
+    }
+
+    int atlasSize = frameSize * IMPOSTOR_FRAMES;
+    diffuseTexture = new Texture();
+    normalTexture = new Texture();
+    SharedPtr<Texture> depthTexture(new Texture());
+    if (!diffuseTexture->Define(TEX_2D, IntVector2(atlasSize, atlasSize), FMT_RGBA8) || !normalTexture->Define(TEX_2D, IntVector2(atlasSize, atlasSize), FMT_RGBA8) ||
+        !depthTexture->Define(TEX_2D, IntVector2(atlasSize, atlasSize), FMT_D24S8))
+        return false;
+    diffuseTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    normalTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+    std::vector<Texture*> colorTextures;
+    colorTextures.push_back(diffuseTexture);
+    colorTextures.push_back(normalTexture);
+    SharedPtr<FrameBuffer> frameBuffer(new FrameBuffer());
+    frameBuffer->Define(colorTextures, depthTexture);
+
+    graphics->SetFrameBuffer(frameBuffer);
+    graphics->SetViewport(IntRect(0, 0, atlasSize, atlasSize));
+    graphics->Clear(true, true, IntRect::ZERO, Color(0.0f, 0.0f, 0.0f, 0.0f));
+    // Winding is not known to match the frame views, so draw both sides
+    graphics->SetRenderState(BLEND_REPLACE, CULL_NONE);
+
+    for (int y = 0; y < IMPOSTOR_FRAMES; ++y)
+    {
+        for (int x = 0; x < IMPOSTOR_FRAMES; ++x)
+        {
+            // Orthographic view of the bounding sphere from the frame direction, using the same basis as the impostor vertex shader
+            Vector3 dir = FrameDirection(x, y);
+            Vector3 right = (Abs(dir.y) > 0.999f ? Vector3::FORWARD : Vector3::UP).CrossProduct(dir).Normalized();
+            Vector3 up = dir.CrossProduct(right);
+            float invRadius = 1.0f / radius;
+
+            Matrix4 viewProj(
+                right.x * invRadius, right.y * invRadius, right.z * invRadius, -right.DotProduct(center) * invRadius,
+                up.x * invRadius, up.y * invRadius, up.z * invRadius, -up.DotProduct(center) * invRadius,
+                -dir.x * invRadius, -dir.y * invRadius, -dir.z * invRadius, dir.DotProduct(center) * invRadius,
+                0.0f, 0.0f, 0.0f, 1.0f
+            );
+
+            graphics->SetViewport(IntRect(x * frameSize, y * frameSize, (x + 1) * frameSize, (y + 1) * frameSize));
+
+            for (size_t i = 0; i < model->NumGeometries(); ++i)
+            {
+                Geometry* geom = model->GetGeometry(i, 0);
+                Material* geomMaterial = i < materials.size() && materials[i] ? materials[i] : Material::DefaultMaterial();
+                if (!geom || !geom->vertexBuffer)
+                    continue;
+
+                Texture* texture = geomMaterial->GetTexture(0);
+                ShaderProgram* program = graphics->SetProgram("Shaders/ImpostorBake.glsl", "", texture ? "DIFFUSEMAP" : "");
+                if (!program)
+                    return false;
+
+                graphics->SetUniform(program, "impostorViewProj", viewProj);
+                graphics->SetUniformBuffer(UB_MATERIALDATA, geomMaterial->GetUniformBuffer());
+                graphics->SetTexture(0, texture);
+                graphics->SetVertexBuffer(geom->vertexBuffer, program);
+
+                if (geom->indexBuffer)
+                {
+                    graphics->SetIndexBuffer(geom->indexBuffer);
+                    graphics->DrawIndexed(PT_TRIANGLE_LIST, geom->drawStart, geom->drawCount);
+                }
+                else
+                    graphics->Draw(PT_TRIANGLE_LIST, geom->drawStart, geom->drawCount);
+            }
+        }
+    }
+
+    graphics->SetFrameBuffer(nullptr);
+    graphics->SetTexture(0, nullptr);
+
+    // Quad with corners in -1..1, expanded to the frame plane by the vertex shader
+    static const float quadVertices[] = {
+        -1.0f, -1.0f, 0.0f,
+        1.0f, -1.0f, 0.0f,
+        1.0f, 1.0f, 0.0f,
+        -1.0f, 1.0f, 0.0f
+    };
+    static const unsigned short quadIndices[] = {
+        0, 1, 2,
+        2, 3, 0
+    };
+
+    std::vector<VertexElement> vertexElements;
+    vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+
+    geometry = new Geometry();
+    geometry->vertexBuffer = new VertexBuffer();
+    geometry->vertexBuffer->Define(USAGE_DEFAULT, 4, vertexElements, quadVertices);
+    geometry->indexBuffer = new IndexBuffer();
+    geometry->indexBuffer->Define(USAGE_DEFAULT, 6, sizeof(unsigned short), quadIndices);
+    geometry->drawStart = 0;
+    geometry->drawCount = 6;
+
+    material = new Material();
+    material->SetTexture(0, diffuseTexture);
+    material->SetTexture(1, normalTexture);
+    material->SetUniform(U_MATDIFFCOLOR, Vector4::ONE);
+    material->SetUniform(U_IMPOSTORCENTER, Vector4(center, radius));
+    material->SetUniform(U_IMPOSTORFRAMES, Vector4((float)IMPOSTOR_FRAMES, 1.0f / (float)IMPOSTOR_FRAMES, 0.0f, 0.0f));
+    material->SetCullMode(CULL_NONE);
+
+    Pass* pass = material->CreatePass(PASS_OPAQUE);
+    pass->SetShader(cache->LoadResource<Shader>("Shaders/Impostor.glsl"), "", "");
+    pass->SetRenderState(BLEND_REPLACE, CMP_LESS, true, true);
+
+    batches.SetNumGeometries(1);
+    batches.SetGeometry(0, geometry);
+    batches.SetMaterial(0, material);
+
+    return true;
+}
@@ -0,0 +1,45 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "GeometryNode.h"
+
+class Material;
+class Model;
+class Texture;
+
+/// Octahedral impostor of a model, to be drawn as a camera-facing quad at far distances. Stores the model's diffuse color and normals rendered from directions over the whole sphere in texture atlases, and selects the frame closest to the view direction per instance in the vertex shader. Static models using the same impostor are instanced into a single draw call.
+class Impostor : public RefCounted
+{
+public:
+    /// Construct.
+    Impostor();
+    /// Destruct.
+    ~Impostor();
+
+    /// Render the atlases from the first LOD levels of a model with materials per geometry. Requires the graphics subsystem and should be called in the main thread. Return true on success.
+    bool Bake(Model* model, const std::vector<Material*>& materials, int frameSize = 128);
+
+    /// Return the quad geometry.
+    Geometry* GetGeometry() const { return geometry; }
+    /// Return the material that renders the atlases.
+    Material* GetMaterial() const { return material; }
+    /// Return the diffuse color atlas, with coverage in the alpha channel.
+    Texture* DiffuseTexture() const { return diffuseTexture; }
+    /// Return the model space normal atlas.
+    Texture* NormalTexture() const { return normalTexture; }
+    /// Return the draw call source data, which consists of the quad geometry and the material.
+    const SourceBatches& Batches() const { return batches; }
+
+private:
+    /// Quad geometry.
+    SharedPtr<Geometry> geometry;
+    /// Impostor material.
+    SharedPtr<Material> material;
+    /// Diffuse color atlas.
+    SharedPtr<Texture> diffuseTexture;
+    /// Normal atlas.
+    SharedPtr<Texture> normalTexture;
+    /// Draw call source data.
+    SourceBatches batches;
+};
@@ -19,6 +19,10 @@ static const float DEFAULT_RANGE = 10.0f;
 static const float DEFAULT_SPOT_FOV = 30.0f;
 static const int DEFAULT_SHADOWMAP_SIZE = 512;
 static const float DEFAULT_SHADOW_CASCADE_SPLIT = 0.25f;
+static const int DEFAULT_SHADOW_CASCADES = 2;
+static const float DEFAULT_SHADOW_CASCADE_BLEND = 0.0f;
+static const Vector4 DEFAULT_SHADOW_CASCADE_RESOLUTIONS = Vector4::ONE;
+static const float MIN_SHADOW_CASCADE_RESOLUTION = 0.0625f;
 static const float DEFAULT_FADE_START = 0.9f;
 static const float DEFAULT_SHADOW_MAX_DISTANCE = 250.0f;
 static const float DEFAULT_SHADOW_MAX_STRENGTH = 0.0f;
@@ -26,6 +30,7 @@ static const float DEFAULT_SHADOW_QUANTIZE = 0.5f;
 static const float DEFAULT_SHADOW_MIN_VIEW = 10.0f;
 static const float DEFAULT_DEPTH_BIAS = 2.0f;
 static const float DEFAULT_SLOPESCALE_BIAS = 1.5f;
+static const int DIR_SHADOW_CACHE_STEPS = 8;
 
 static const Quaternion pointLightFaceRotations[] = {
     Quaternion(0.0f, 90.0f, 0.0f),
@@ -46,7 +51,21 @@ static const char* lightTypeNames[] =
 
 static Allocator<LightDrawable> drawableAllocator;
 
+ShadowView::ShadowView() :
+    lastViewport(IntRect::ZERO),
+    lastRenderFrameNumber(0),
+    pendingRenderMode(RENDER_STATIC_LIGHT_CACHED),
+    cubeFaceMask(0)
+{
+}
+
+ShadowView::~ShadowView()
+{
+}
+
 LightDrawable::LightDrawable() :
+    staticCasterRemovalVersion(0),
+    staticCasterSerial(0),
     color(DEFAULT_COLOR),
     lightType(DEFAULT_LIGHTTYPE),
     range(DEFAULT_RANGE),
@@ -55,12 +74,16 @@ LightDrawable::LightDrawable() :
     shadowMapSize(DEFAULT_SHADOWMAP_SIZE),
     shadowFadeStart(DEFAULT_FADE_START),
     shadowCascadeSplit(DEFAULT_SHADOW_CASCADE_SPLIT),
+    shadowCascades(DEFAULT_SHADOW_CASCADES),
+    shadowCascadeBlend(DEFAULT_SHADOW_CASCADE_BLEND),
+    shadowCascadeResolutions(DEFAULT_SHADOW_CASCADE_RESOLUTIONS),
     shadowMaxDistance(DEFAULT_SHADOW_MAX_DISTANCE),
     shadowMaxStrength(DEFAULT_SHADOW_MAX_STRENGTH),
     shadowQuantize(DEFAULT_SHADOW_QUANTIZE),
     shadowMinView(DEFAULT_SHADOW_MIN_VIEW),
     depthBias(DEFAULT_DEPTH_BIAS),
     slopeScaleBias(DEFAULT_SLOPESCALE_BIAS),
+    baked(false),
     shadowMap(nullptr)
 {
     SetFlag(DF_LIGHT, true);
@@ -159,14 +182,14 @@ void LightDrawable::OnRenderDebug(DebugRenderer* debug)
         debug->AddSphere(WorldSphere(), color, false);
 }
 
-IntVector2 LightDrawable::TotalShadowMapSize() const
+IntVector2 LightDrawable::TotalShadowMapSize(int faceSize) const
 {
     if (lightType == LIGHT_DIRECTIONAL)
-        return IntVector2(shadowMapSize * 2, shadowMapSize);
+        return IntVector2(faceSize * Min(shadowCascades, 2), faceSize * ((shadowCascades + 1) / 2));
     else if (lightType == LIGHT_POINT)
-        return IntVector2(shadowMapSize * 3, shadowMapSize * 2);
+        return IntVector2(faceSize * 3, faceSize * 2);
     else
-        return IntVector2(shadowMapSize, shadowMapSize);
+        return IntVector2(faceSize, faceSize);
 }
 
 Color LightDrawable::EffectiveColor() const
@@ -196,9 +219,34 @@ float LightDrawable::ShadowStrength() const
     return shadowMaxStrength;
 }
 
-Vector2 LightDrawable::ShadowCascadeSplits() const
+Vector4 LightDrawable::ShadowCascadeSplits() const
 {
-    return Vector2(shadowCascadeSplit * shadowMaxDistance, shadowMaxDistance);
+    // Each cascade ends at the split fraction of the next cascade's end
+    float splits[MAX_SHADOW_CASCADES];
+    float end = shadowMaxDistance;
+
+    for (int i = MAX_SHADOW_CASCADES - 1; i >= 0; --i)
+    {
+        if (i >= shadowCascades)
+            splits[i] = shadowMaxDistance;
+        else
+        {
+            splits[i] = end;
+            end *= shadowCascadeSplit;
+        }
+    }
+
+    return Vector4(splits[0], splits[1], splits[2], splits[3]);
+}
+
+int LightDrawable::ActualShadowMapSize() const
+{
+    if (lightType == LIGHT_DIRECTIONAL)
+        return shadowRect.Width() / Min(shadowCascades, 2);
+    else if (lightType == LIGHT_POINT)
+        return shadowRect.Height() / 2;
+    else
+        return shadowRect.Height();
 }
 
 size_t LightDrawable::NumShadowViews() const
@@ -206,7 +254,7 @@ size_t LightDrawable::NumShadowViews() const
     if (!TestFlag(DF_CAST_SHADOWS))
         return 0;
     else if (lightType == LIGHT_DIRECTIONAL)
-        return 2;
+        return shadowCascades;
     else if (lightType == LIGHT_POINT)
         return 6;
     else
@@ -257,7 +305,7 @@ void LightDrawable::InitShadowViews()
     shadowParameters = Vector4(0.5f / (float)shadowMap->Width(), 0.5f / (float)shadowMap->Height(), ShadowStrength(), 0.0f);
 }
 
-bool LightDrawable::SetupShadowView(size_t viewIndex, Camera* mainCamera, const BoundingBox* geometryBounds)
+bool LightDrawable::SetupShadowView(size_t viewIndex, Camera* mainCamera, const BoundingBox* geometryBounds, bool stableCascade)
 {
     ZoneScoped;
 
@@ -269,14 +317,24 @@ bool LightDrawable::SetupShadowView(size_t viewIndex, Camera* mainCamera, const
     {
     case LIGHT_DIRECTIONAL:
     {
+        // Cascades are placed two per row, and may use only part of their cell
         IntVector2 topLeft(shadowRect.left, shadowRect.top);
         if (viewIndex & 1)
             topLeft.x += actualShadowMapSize;
-        view.viewport = IntRect(topLeft.x, topLeft.y, topLeft.x + actualShadowMapSize, topLeft.y + actualShadowMapSize);
-        Vector2 cascadeSplits = ShadowCascadeSplits();
+        topLeft.y += ((unsigned)viewIndex >> 1) * actualShadowMapSize;
+        int faceSize = Min((int)NextPowerOfTwo((unsigned)(actualShadowMapSize * shadowCascadeResolutions.Data()[viewIndex])), actualShadowMapSize);
+        view.viewport = IntRect(topLeft.x, topLeft.y, topLeft.x + faceSize, topLeft.y + faceSize);
+
+        Vector4 cascadeSplits = ShadowCascadeSplits();
+        const float* splits = cascadeSplits.Data();
+        float splitStart = viewIndex ? splits[viewIndex - 1] : 0.0f;
 
-        view.splitMinZ = Max(mainCamera->NearClip(), (viewIndex == 0) ? 0.0f : cascadeSplits.x);
-        view.splitMaxZ = Min(mainCamera->FarClip(), (viewIndex == 0) ? cascadeSplits.x : cascadeSplits.y);
+        // With cascade blending, start earlier to also cover the blend range at the end of the previous cascade
+        if (viewIndex && shadowCascadeBlend > 0.0f)
+            splitStart -= shadowCascadeBlend * (splitStart - (viewIndex > 1 ? splits[viewIndex - 2] : 0.0f));
+
+        view.splitMinZ = Max(mainCamera->NearClip(), splitStart);
+        view.splitMaxZ = Min(mainCamera->FarClip(), splits[viewIndex]);
         float extrusionDistance = mainCamera->FarClip();
 
         // Calculate initial position & rotation
@@ -309,43 +367,77 @@ bool LightDrawable::SetupShadowView(size_t viewIndex, Camera* mainCamera, const
             shadowBox.Define(splitFrustum.Transformed(shadowCamera->ViewMatrix()));
         }
 
-        // If shadow camera is far away from the frustum, can bring it closer for better depth precision
-        /// \todo The minimum distance is somewhat arbitrary
-        float minDistance = mainCamera->FarClip() * 0.25f;
-        if (shadowBox.min.z > minDistance)
+        if (stableCascade)
         {
-            float move = shadowBox.min.z - minDistance;
-            shadowCamera->Translate(Vector3(0.0f, 0.f, move));
-            shadowBox.min.z -= move,
-                shadowBox.max.z -= move;
+            // Fit a bounding sphere of the split frustum, which keeps its size when the main camera rotates, and snap the view to a coarse grid.
+            // The shadow camera then stays in place until the main camera moves a grid step, so that the static shadowcasters can be cached
+            Vector3 center(Vector3::ZERO);
+            for (size_t i = 0; i < NUM_FRUSTUM_VERTICES; ++i)
+                center += splitFrustum.vertices[i];
+            center /= (float)NUM_FRUSTUM_VERTICES;
+
+            float radius = 0.0f;
+            for (size_t i = 0; i < NUM_FRUSTUM_VERTICES; ++i)
+                radius = Max(radius, (splitFrustum.vertices[i] - center).Length());
+
+            // The view is one grid step larger than the sphere, so that the sphere fits wherever its center is snapped
+            float sphereSize = Max(ceilf(2.0f * radius / shadowQuantize) * shadowQuantize, shadowMinView);
+            float viewSize = sphereSize * (float)DIR_SHADOW_CACHE_STEPS / (float)(DIR_SHADOW_CACHE_STEPS - 1);
+            float step = viewSize / (float)DIR_SHADOW_CACHE_STEPS;
+            float minDistance = mainCamera->FarClip() * 0.25f;
+
+            Quaternion rot(WorldRotation());
+            Vector3 viewCenter(rot.Inverse() * center);
+            viewCenter.x = floorf(viewCenter.x / step + 0.5f) * step;
+            viewCenter.y = floorf(viewCenter.y / step + 0.5f) * step;
+            viewCenter.z = floorf(viewCenter.z / step + 0.5f) * step;
+
+            shadowCamera->SetTransform(rot * Vector3(viewCenter.x, viewCenter.y, viewCenter.z - 0.5f * viewSize - minDistance), rot);
+            shadowCamera->SetOrthographic(true);
+            shadowCamera->SetFarClip(minDistance + viewSize);
+            shadowCamera->SetOrthoSize(Vector2(viewSize, viewSize));
+            shadowCamera->SetZoom(1.0f);
         }
-
-        shadowCamera->SetOrthographic(true);
-        shadowCamera->SetFarClip(shadowBox.max.z);
-
-        Vector3 center = shadowBox.Center();
-        Vector3 size = shadowBox.Size();
-
-        size.x = ceilf(sqrtf(size.x / shadowQuantize));
-        size.y = ceilf(sqrtf(size.y / shadowQuantize));
-        size.x = Max(size.x * size.x * shadowQuantize, shadowMinView);
-        size.y = Max(size.y * size.y * shadowQuantize, shadowMinView);
-
-        shadowCamera->SetOrthoSize(Vector2(size.x, size.y));
-        shadowCamera->SetZoom(1.0f);
-
-        // Center shadow camera to the view space bounding box
-        Quaternion rot(shadowCamera->WorldRotation());
-        Vector3 adjust(center.x, center.y, 0.0f);
-        shadowCamera->Translate(rot * adjust, TS_WORLD);
-
-        // Snap to whole texels
+        else
         {
-            Vector3 viewPos(rot.Inverse() * shadowCamera->WorldPosition());
-            float invSize = 4.0f / actualShadowMapSize;
-            Vector2 texelSize(size.x * invSize, size.y * invSize);
-            Vector3 snap(-fmodf(viewPos.x, texelSize.x), -fmodf(viewPos.y, texelSize.y), 0.0f);
-            shadowCamera->Translate(rot * snap, TS_WORLD);
+            // If shadow camera is far away from the frustum, can bring it closer for better depth precision
+            /// \todo The minimum distance is somewhat arbitrary
+            float minDistance = mainCamera->FarClip() * 0.25f;
+            if (shadowBox.min.z > minDistance)
+            {
+                float move = shadowBox.min.z - minDistance;
+                shadowCamera->Translate(Vector3(0.0f, 0.f, move));
+                shadowBox.min.z -= move,
+                    shadowBox.max.z -= move;
+            }
+
+            shadowCamera->SetOrthographic(true);
+            shadowCamera->SetFarClip(shadowBox.max.z);
+
+            Vector3 center = shadowBox.Center();
+            Vector3 size = shadowBox.Size();
+
+            size.x = ceilf(sqrtf(size.x / shadowQuantize));
+            size.y = ceilf(sqrtf(size.y / shadowQuantize));
+            size.x = Max(size.x * size.x * shadowQuantize, shadowMinView);
+            size.y = Max(size.y * size.y * shadowQuantize, shadowMinView);
+
+            shadowCamera->SetOrthoSize(Vector2(size.x, size.y));
+            shadowCamera->SetZoom(1.0f);
+
+            // Center shadow camera to the view space bounding box
+            Quaternion rot(shadowCamera->WorldRotation());
+            Vector3 adjust(center.x, center.y, 0.0f);
+            shadowCamera->Translate(rot * adjust, TS_WORLD);
+
+            // Snap to whole texels
+            {
+                Vector3 viewPos(rot.Inverse() * shadowCamera->WorldPosition());
+                float invSize = 4.0f / faceSize;
+                Vector2 texelSize(size.x * invSize, size.y * invSize);
+                Vector3 snap(-fmodf(viewPos.x, texelSize.x), -fmodf(viewPos.y, texelSize.y), 0.0f);
+                shadowCamera->Translate(rot * snap, TS_WORLD);
+            }
         }
     }
     break;
@@ -464,12 +556,16 @@ void Light::RegisterObject()
     RegisterAttribute("shadowMapSize", &Light::ShadowMapSize, &Light::SetShadowMapSize, DEFAULT_SHADOWMAP_SIZE);
     RegisterAttribute("shadowFadeStart", &Light::ShadowFadeStart, &Light::SetShadowFadeStart, DEFAULT_FADE_START);
     RegisterAttribute("shadowCascadeSplit", &Light::ShadowCascadeSplit, &Light::SetShadowCascadeSplit, DEFAULT_SHADOW_CASCADE_SPLIT);
+    RegisterAttribute("shadowCascades", &Light::ShadowCascades, &Light::SetShadowCascades, DEFAULT_SHADOW_CASCADES);
+    RegisterAttribute("shadowCascadeBlend", &Light::ShadowCascadeBlend, &Light::SetShadowCascadeBlend, DEFAULT_SHADOW_CASCADE_BLEND);
+    RegisterRefAttribute("shadowCascadeResolutions", &Light::ShadowCascadeResolutions, &Light::SetShadowCascadeResolutions, DEFAULT_SHADOW_CASCADE_RESOLUTIONS);
     RegisterAttribute("shadowMaxDistance", &Light::ShadowMaxDistance, &Light::SetShadowMaxDistance, DEFAULT_SHADOW_MAX_DISTANCE);
     RegisterAttribute("shadowMaxStrength", &Light::ShadowMaxStrength, &Light::SetShadowMaxStrength, DEFAULT_SHADOW_MAX_STRENGTH);
     RegisterAttribute("shadowQuantize", &Light::ShadowQuantize, &Light::SetShadowQuantize, DEFAULT_SHADOW_QUANTIZE);
     RegisterAttribute("shadowMinView", &Light::ShadowMinView, &Light::SetShadowMinView, DEFAULT_SHADOW_MIN_VIEW);
     RegisterAttribute("depthBias", &Light::DepthBias, &Light::SetDepthBias, DEFAULT_DEPTH_BIAS);
     RegisterAttribute("slopeScaleBias", &Light::SlopeScaleBias, &Light::SetSlopeScaleBias, DEFAULT_SLOPESCALE_BIAS);
+    RegisterAttribute("baked", &Light::IsBaked, &Light::SetBaked, false);
 }
 
 void Light::SetLightType(LightType type)
@@ -537,6 +633,29 @@ void Light::SetShadowCascadeSplit(float split)
     lightDrawable->shadowCascadeSplit = Clamp(split, M_EPSILON, 1.0f - M_EPSILON);
 }
 
+void Light::SetShadowCascades(int cascades)
+{
+    LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
+    lightDrawable->shadowCascades = Clamp(cascades, 1, MAX_SHADOW_CASCADES);
+}
+
+void Light::SetShadowCascadeBlend(float blend)
+{
+    LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
+    lightDrawable->shadowCascadeBlend = Clamp(blend, 0.0f, 1.0f);
+}
+
+void Light::SetShadowCascadeResolutions(const Vector4& resolutions)
+{
+    LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
+    lightDrawable->shadowCascadeResolutions = Vector4(
+        Clamp(resolutions.x, MIN_SHADOW_CASCADE_RESOLUTION, 1.0f),
+        Clamp(resolutions.y, MIN_SHADOW_CASCADE_RESOLUTION, 1.0f),
+        Clamp(resolutions.z, MIN_SHADOW_CASCADE_RESOLUTION, 1.0f),
+        Clamp(resolutions.w, MIN_SHADOW_CASCADE_RESOLUTION, 1.0f)
+    );
+}
+
 void Light::SetShadowMaxDistance(float distance_)
 {
     LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
@@ -574,6 +693,12 @@ void Light::SetSlopeScaleBias(float bias)
     lightDrawable->slopeScaleBias = Max(bias, 0.0f);
 }
 
+void Light::SetBaked(bool enable)
+{
+    LightDrawable* lightDrawable = static_cast<LightDrawable*>(drawable);
+    lightDrawable->baked = enable;
+}
+
 void Light::SetLightTypeAttr(int type)
 {
     if (type <= LIGHT_SPOT)
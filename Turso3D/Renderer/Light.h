@@ -15,6 +15,8 @@ class LightDrawable;
 class Texture;
 struct ShadowView;
 
+static const int MAX_SHADOW_CASCADES = 4;
+
 /// %Light types.
 enum LightType
 {
@@ -36,10 +38,9 @@ enum ShadowRenderMode
 struct ShadowView
 {
     /// Default construct.
-    ShadowView() :
-        lastViewport(IntRect::ZERO)
-    {
-    }
+    ShadowView();
+    /// Destruct. Defined out of line, as the shadow camera is an incomplete type here.
+    ~ShadowView();
 
     /// %Light drawable associated with the view.
     LightDrawable* light;
@@ -69,6 +70,12 @@ struct ShadowView
     Matrix4 lastShadowMatrix;
     /// Last amount of geometries passed in for shadow map render.
     size_t lastNumGeometries;
+    /// Framenumber of the last shadow map render.
+    unsigned short lastRenderFrameNumber;
+    /// Render mode postponed by time slicing, to be combined with the next render.
+    ShadowRenderMode pendingRenderMode;
+    /// Point light faces rendered by this view in one pass. Zero when the view renders only itself.
+    unsigned char cubeFaceMask;
 };
 
 /// %Light drawable.
@@ -103,12 +110,18 @@ public:
     float FadeStart() const { return fadeStart; }
     /// Return shadow map face resolution in pixels.
     int ShadowMapSize() const { return shadowMapSize; }
-    /// Return directional light shadow cascade absolute end distances.
-    Vector2 ShadowCascadeSplits() const;
+    /// Return directional light shadow cascade absolute end distances. Components beyond the cascade count repeat the last end distance.
+    Vector4 ShadowCascadeSplits() const;
     /// Return light shadow fade start as a function of max shadow distance.
     float ShadowFadeStart() const { return shadowFadeStart; }
-    /// Return directional light cascade split distance as a function of max shadow distance.
+    /// Return directional light cascade split distance as a function of the next cascade's end distance.
     float ShadowCascadeSplit() const { return shadowCascadeSplit; }
+    /// Return directional light shadow cascade count.
+    int ShadowCascades() const { return shadowCascades; }
+    /// Return directional light shadow cascade blend range as a function of cascade length.
+    float ShadowCascadeBlend() const { return shadowCascadeBlend; }
+    /// Return directional light shadow cascade resolutions as a function of shadow map size.
+    const Vector4& ShadowCascadeResolutions() const { return shadowCascadeResolutions; }
     /// Return maximum distance for shadow rendering.
     float ShadowMaxDistance() const { return shadowMaxDistance; }
     /// Return maximum shadow strength.
@@ -123,10 +136,14 @@ public:
     float DepthBias() const { return depthBias; }
     /// Return slope-scaled depth bias.
     float SlopeScaleBias() const { return slopeScaleBias; }
+    /// Return whether is baked into light probes.
+    bool IsBaked() const { return baked; }
     /// Return total requested shadow map size, accounting for multiple faces / splits for directional and point lights.
-    IntVector2 TotalShadowMapSize() const;
-    /// Return actual shadow map face size.
-    int ActualShadowMapSize() const { return lightType == LIGHT_POINT ? shadowRect.Height() / 2 : shadowRect.Height(); }
+    IntVector2 TotalShadowMapSize() const { return TotalShadowMapSize(shadowMapSize); }
+    /// Return total shadow map size for a given face size.
+    IntVector2 TotalShadowMapSize(int faceSize) const;
+    /// Return actual shadow map face size. For directional lights, the size of the cell each cascade is placed in.
+    int ActualShadowMapSize() const;
     /// Return number of required shadow views / cameras.
     size_t NumShadowViews() const;
     /// Return spotlight world space frustum.
@@ -138,8 +155,8 @@ public:
     void SetShadowMap(Texture* shadowMap, const IntRect& shadowRect = IntRect::ZERO);
     /// Init the correct number of shadow views but do not setup them yet. Called by Renderer. Must be called from the same thread for all lights because new Camera nodes are allocated on first call, which uses the non-threadsafe NodeImpl allocator.
     void InitShadowViews();
-    /// Setup the camera and parameters for a shadow view. Directional light shadow view should be supplied the scene bounds for focusing. Return false if the view is empty and should not render. Called by Renderer.
-    bool SetupShadowView(size_t viewIndex, Camera* mainCamera, const BoundingBox* geometryBounds = nullptr);
+    /// Setup the camera and parameters for a shadow view. Directional light shadow view should be supplied the scene bounds for focusing. With a stable cascade, the directional light shadow view is instead fitted to the split frustum's bounding sphere and snapped to a coarse grid, so that it stays unchanged over small camera movements. Return false if the view is empty and should not render. Called by Renderer.
+    bool SetupShadowView(size_t viewIndex, Camera* mainCamera, const BoundingBox* geometryBounds = nullptr, bool stableCascade = false);
     /// Return shadow map.
     Texture* ShadowMap() const { return shadowMap; }
     /// Return the shadow views.
@@ -149,6 +166,15 @@ public:
     /// Return shadow map offset and depth parameters.
     const Vector4& ShadowParameters() const { return shadowParameters; }
 
+    /// Static shadowcasters cached by Renderer for a static light.
+    std::vector<Drawable*> staticCasters;
+    /// World bounding box of the light when the static shadowcasters were queried.
+    BoundingBox staticCasterBox;
+    /// Octree removal version when the static shadowcasters were queried.
+    unsigned staticCasterRemovalVersion;
+    /// Renderer static change serial when the static shadowcasters were last validated. Zero if not cached.
+    unsigned staticCasterSerial;
+
 private:
     /// Light type.
     LightType lightType;
@@ -164,8 +190,14 @@ private:
     int shadowMapSize;
     /// Shadow fade start as a function of max distance.
     float shadowFadeStart;
-    /// Directional light shadow cascade split as a function of max distance.
+    /// Directional light shadow cascade split as a function of the next cascade's end distance.
     float shadowCascadeSplit;
+    /// Directional light shadow cascade count.
+    int shadowCascades;
+    /// Directional light shadow cascade blend range as a function of cascade length.
+    float shadowCascadeBlend;
+    /// Directional light shadow cascade resolutions as a function of shadow map size.
+    Vector4 shadowCascadeResolutions;
     /// Shadow rendering max distance.
     float shadowMaxDistance;
     /// Shadow max strength when not faded.
@@ -178,6 +210,8 @@ private:
     float depthBias;
     /// Slope-sclaed depth bias for shadows.
     float slopeScaleBias;
+    /// Baked into light probes flag.
+    bool baked;
     /// Current shadow map texture.
     Texture* shadowMap;
     /// Rectangle within the shadow map.
@@ -216,8 +250,14 @@ public:
     void SetShadowMapSize(int size);
     /// Set light shadow fade start distance, where 1 represents shadow max distance.
     void SetShadowFadeStart(float start);
-    /// Set the directional light cascade split distance, where 1 represents shadow max distance.
+    /// Set the directional light cascade split distance, where 1 represents the next cascade's end distance. The last cascade ends at shadow max distance.
     void SetShadowCascadeSplit(float split);
+    /// Set directional light shadow cascade count, from 1 to MAX_SHADOW_CASCADES. Cascades are placed in the shadow map two per row.
+    void SetShadowCascades(int cascades);
+    /// Set directional light shadow cascade blend range, where 1 represents the whole cascade length. Within the range at the end of a cascade, the shadow is blended towards the next cascade. Zero disables.
+    void SetShadowCascadeBlend(float blend);
+    /// Set directional light shadow cascade resolutions, where 1 represents the shadow map face size. Rounded up to power of two fractions.
+    void SetShadowCascadeResolutions(const Vector4& resolutions);
     /// Set maximum distance for shadow rendering.
     void SetShadowMaxDistance(float distance);
     /// Set maximum (when not faded) shadow strength (default 0 = fully dark).
@@ -230,6 +270,8 @@ public:
     void SetDepthBias(float bias);
     /// Set slope-scaled depth bias for shadows.
     void SetSlopeScaleBias(float bias);
+    /// Set whether the light is baked. A baked static light is included by LightProbeGrid::Bake() and not rendered dynamically while the renderer has baked light probes.
+    void SetBaked(bool enable);
 
     /// Return light type.
     LightType GetLightType() const { return static_cast<LightDrawable*>(drawable)->lightType; }
@@ -243,12 +285,18 @@ public:
     float FadeStart() const { return static_cast<LightDrawable*>(drawable)->fadeStart; }
     /// Return shadow map face resolution in pixels.
     int ShadowMapSize() const { return static_cast<LightDrawable*>(drawable)->shadowMapSize; }
-    /// Return directional light shadow cascade absolute end distances.
-    Vector2 ShadowCascadeSplits() const { return static_cast<LightDrawable*>(drawable)->ShadowCascadeSplits(); }
+    /// Return directional light shadow cascade absolute end distances. Components beyond the cascade count repeat the last end distance.
+    Vector4 ShadowCascadeSplits() const { return static_cast<LightDrawable*>(drawable)->ShadowCascadeSplits(); }
     /// Return light shadow fade start as a function of max shadow distance.
     float ShadowFadeStart() const { return static_cast<LightDrawable*>(drawable)->shadowFadeStart; }
-    /// Return directional light cascade split distance as a function of max shadow distance.
+    /// Return directional light cascade split distance as a function of the next cascade's end distance.
     float ShadowCascadeSplit() const { return static_cast<LightDrawable*>(drawable)->shadowCascadeSplit; }
+    /// Return directional light shadow cascade count.
+    int ShadowCascades() const { return static_cast<LightDrawable*>(drawable)->shadowCascades; }
+    /// Return directional light shadow cascade blend range as a function of cascade length.
+    float ShadowCascadeBlend() const { return static_cast<LightDrawable*>(drawable)->shadowCascadeBlend; }
+    /// Return directional light shadow cascade resolutions as a function of shadow map size.
+    const Vector4& ShadowCascadeResolutions() const { return static_cast<LightDrawable*>(drawable)->shadowCascadeResolutions; }
     /// Return maximum distance for shadow rendering.
     float ShadowMaxDistance() const { return static_cast<LightDrawable*>(drawable)->shadowMaxDistance; }
     /// Return maximum shadow strength.
@@ -261,6 +309,8 @@ public:
     float DepthBias() const { return static_cast<LightDrawable*>(drawable)->depthBias; }
     /// Return slope-scaled depth bias.
     float SlopeScaleBias() const { return static_cast<LightDrawable*>(drawable)->slopeScaleBias; }
+    /// Return whether is baked.
+    bool IsBaked() const { return static_cast<LightDrawable*>(drawable)->baked; }
     /// Return spotlight world space frustum.
     Frustum WorldFrustum() const { return static_cast<LightDrawable*>(drawable)->WorldFrustum(); }
     /// Return point light world space sphere.
@@ -0,0 +1,190 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Texture.h"
+#include "../IO/Log.h"
+#include "../Math/Ray.h"
+#include "Light.h"
+#include "LightProbeGrid.h"
+#include "Octree.h"
+
+#include <tracy/Tracy.hpp>
+
+/// Light reaching a probe, pending the visibility test.
+struct ProbeLightSample
+{
+    /// Probe index.
+    size_t probe;
+    /// Direction toward the light.
+    Vector3 direction;
+    /// Attenuated light color.
+    Color color;
+    /// Distance to the light.
+    float distance;
+};
+
+LightProbeGrid::LightProbeGrid() :
+    resolution(IntVector3::ZERO),
+    numBakedLights(0)
+{
+    shaderParameters[0] = Vector4::ZERO;
+    shaderParameters[1] = Vector4::ZERO;
+    shaderParameters[2] = Vector4::ZERO;
+}
+
+LightProbeGrid::~LightProbeGrid()
+{
+}
+
+bool LightProbeGrid::Bake(Octree* octree, const BoundingBox& area_, const IntVector3& resolution_)
+{
+    ZoneScoped;
+
+    Vector3 areaSize = area_.Size();
+    if (!octree || !area_.IsDefined() || areaSize.x <= 0.0f || areaSize.y <= 0.0f || areaSize.z <= 0.0f)
+    {
+        LOGERROR("Invalid light probe grid area");
+        return false;
+    }
+
+    IntVector3 newResolution(Clamp(resolution_.x, 2, MAX_LIGHT_PROBE_RESOLUTION), Clamp(resolution_.y, 2, MAX_LIGHT_PROBE_RESOLUTION),
+        Clamp(resolution_.z, 2, MAX_LIGHT_PROBE_RESOLUTION));
+    Vector3 spacing = areaSize / Vector3((float)(newResolution.x - 1), (float)(newResolution.y - 1), (float)(newResolution.z - 1));
+    // Start the visibility rays slightly off the probe, so that probes on a surface are not occluded by it
+    float rayOffset = 0.01f * Min(Min(spacing.x, spacing.y), spacing.z);
+
+    std::vector<Drawable*> drawables;
+    std::vector<LightDrawable*> lights;
+    octree->FindDrawables(drawables, area_, DF_LIGHT);
+    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    {
+        Drawable* drawable = *it;
+        if ((drawable->Flags() & DF_DECAL) == DF_DECAL || !drawable->IsStatic() || !static_cast<LightDrawable*>(drawable)->IsBaked())
+            continue;
+        lights.push_back(static_cast<LightDrawable*>(drawable));
+    }
+
+    size_t numProbes = (size_t)newResolution.x * newResolution.y * newResolution.z;
+    std::vector<ProbeLightSample> samples;
+    std::vector<ProbeLightSample> occludableSamples;
+    std::vector<Ray> rays;
+    float maxRayDistance = 0.0f;
+
+    for (int z = 0; z < newResolution.z; ++z)
+    {
+        for (int y = 0; y < newResolution.y; ++y)
+        {
+            for (int x = 0; x < newResolution.x; ++x)
+            {
+                size_t probe = ((size_t)z * newResolution.y + y) * newResolution.x + x;
+                Vector3 position = area_.min + spacing * Vector3((float)x, (float)y, (float)z);
+
+                for (auto it = lights.begin(); it != lights.end(); ++it)
+                {
+                    LightDrawable* light = *it;
+                    ProbeLightSample sample;
+                    sample.probe = probe;
+
+                    // Same attenuation as in the lit shaders
+                    if (light->GetLightType() == LIGHT_DIRECTIONAL)
+                    {
+                        sample.direction = -light->WorldDirection();
+                        sample.color = light->GetColor();
+                        sample.distance = M_INFINITY;
+                    }
+                    else
+                    {
+                        Vector3 lightVec = light->WorldPosition() - position;
+                        float distance = lightVec.Length();
+                        float scaledDistance = distance / Max(light->Range(), M_EPSILON);
+                        float atten = 1.0f - scaledDistance * scaledDistance;
+                        if (atten <= 0.0f || distance < M_EPSILON)
+                            continue;
+
+                        sample.direction = lightVec / distance;
+                        sample.distance = distance;
+
+                        if (light->GetLightType() == LIGHT_SPOT)
+                        {
+                            float cutoff = cosf(light->Fov() * 0.5f * M_DEGTORAD);
+                            float spotAtten = (sample.direction.DotProduct(-light->WorldDirection()) - cutoff) / (1.0f - cutoff);
+                            if (spotAtten <= 0.0f)
+                                continue;
+                            atten *= spotAtten;
+                        }
+
+                        sample.color = light->GetColor() * atten;
+                    }
+
+                    if (light->TestFlag(DF_CAST_SHADOWS))
+                    {
+                        rays.push_back(Ray(position + rayOffset * sample.direction, sample.direction));
+                        occludableSamples.push_back(sample);
+                        maxRayDistance = Max(maxRayDistance, sample.distance);
+                    }
+                    else
+                        samples.push_back(sample);
+                }
+            }
+        }
+    }
+
+    // Keep the lights that the static shadowcasters do not block
+    if (rays.size())
+    {
+        std::vector<RaycastResult> hits;
+        octree->RaycastBatch(hits, rays, DF_GEOMETRY | DF_STATIC | DF_CAST_SHADOWS, maxRayDistance);
+        for (size_t i = 0; i < hits.size(); ++i)
+        {
+            if (hits[i].distance >= occludableSamples[i].distance - rayOffset)
+                samples.push_back(occludableSamples[i]);
+        }
+    }
+
+    // Project each light's clamped cosine lobe into L1 spherical harmonics, stored so that the irradiance for normal N is
+    // dot(coefficients, vec4(1, N)) for each color channel
+    std::vector<float> coefficients(numProbes * 12);
+    for (auto it = samples.begin(); it != samples.end(); ++it)
+    {
+        const ProbeLightSample& sample = *it;
+        for (size_t c = 0; c < 3; ++c)
+        {
+            float value = sample.color.Data()[c];
+            float* dest = &coefficients[(c * numProbes + sample.probe) * 4];
+            dest[0] += 0.25f * value;
+            dest[1] += 0.5f * value * sample.direction.x;
+            dest[2] += 0.5f * value * sample.direction.y;
+            dest[3] += 0.5f * value * sample.direction.z;
+        }
+    }
+
+    // The half float format is uploaded from floats
+    IntVector3 textureSize(newResolution.x, newResolution.y, newResolution.z * 3);
+    ImageLevel level(textureSize, FMT_RGBA16F, &coefficients[0]);
+    AutoPtr<Texture> newTexture(new Texture());
+    if (!newTexture->Define(TEX_3D, textureSize, FMT_RGBA16F, 1, 1, &level))
+        return false;
+    newTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+    texture = newTexture;
+    area = area_;
+    resolution = newResolution;
+    numBakedLights = lights.size();
+
+    Vector3 scale = Vector3((float)(resolution.x - 1), (float)(resolution.y - 1), (float)(resolution.z - 1)) / areaSize;
+    shaderParameters[0] = Vector4(scale, 1.0f);
+    shaderParameters[1] = Vector4(Vector3(0.5f, 0.5f, 0.5f) - area.min * scale, 0.5f * Min(Min(spacing.x, spacing.y), spacing.z));
+    shaderParameters[2] = Vector4((float)resolution.x, (float)resolution.y, (float)resolution.z, 0.0f);
+
+    LOGINFOF("Baked %d lights into %dx%dx%d light probes", (int)numBakedLights, resolution.x, resolution.y, resolution.z);
+    return true;
+}
+
+void LightProbeGrid::Clear()
+{
+    texture.Reset();
+    resolution = IntVector3::ZERO;
+    numBakedLights = 0;
+    shaderParameters[0] = Vector4::ZERO;
+    shaderParameters[1] = Vector4::ZERO;
+    shaderParameters[2] = Vector4::ZERO;
+}
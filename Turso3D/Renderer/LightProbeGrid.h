@@ -0,0 +1,55 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/BoundingBox.h"
+#include "../Math/IntVector3.h"
+#include "../Math/Vector4.h"
+#include "../Object/AutoPtr.h"
+#include "../Object/Ptr.h"
+
+class Octree;
+class Texture;
+
+/// Maximum light probe grid resolution on each axis.
+static const int MAX_LIGHT_PROBE_RESOLUTION = 256;
+
+/// Regular grid of light probes that store the direct lighting of baked static lights as L1 spherical harmonics irradiance, sampled per pixel by the lit shaders of both static and dynamic geometry. Set to Renderer with Renderer::SetLightProbes(), after which the baked lights are left out of the dynamic light processing, clusters and shadow maps.
+class LightProbeGrid : public RefCounted
+{
+public:
+    /// Construct with no probes.
+    LightProbeGrid();
+    /// Destruct.
+    ~LightProbeGrid();
+
+    /// Bake the static lights marked as baked that reach the area into a grid of probes with the given resolution, which includes the probes at the area's edges. Visibility to the lights is tested with raycasts against the static geometry of the octree. Positions outside the area use the nearest probes. Call between frames from the main thread after the drawables have been inserted into the octree. Return true on success.
+    bool Bake(Octree* octree, const BoundingBox& area, const IntVector3& resolution);
+    /// Remove the probes.
+    void Clear();
+
+    /// Return whether has been baked.
+    bool IsBaked() const { return texture.Get() != nullptr; }
+    /// Return the area covered by the probes.
+    const BoundingBox& Area() const { return area; }
+    /// Return the probe count on each axis.
+    const IntVector3& Resolution() const { return resolution; }
+    /// Return the number of lights baked.
+    size_t NumBakedLights() const { return numBakedLights; }
+    /// Return the probe texture. The red, green and blue coefficients are stacked along the Z axis.
+    Texture* ProbeTexture() const { return texture; }
+    /// Return the shader parameters: probe space scale, offset and normal offset distance, and resolution.
+    const Vector4* ShaderParameters() const { return shaderParameters; }
+
+private:
+    /// Area covered by the probes.
+    BoundingBox area;
+    /// Probe count on each axis.
+    IntVector3 resolution;
+    /// Number of lights baked.
+    size_t numBakedLights;
+    /// Probe texture.
+    AutoPtr<Texture> texture;
+    /// Shader parameters.
+    Vector4 shaderParameters[3];
+};
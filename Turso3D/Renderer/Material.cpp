@@ -1,19 +1,23 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../Graphics/Texture.h"
+#include "../Graphics/UniformBuffer.h"
+#include "../IO/Log.h"
+#include "../IO/Stream.h"
 #include "../IO/StringUtils.h"
 #include "../Resource/JSONFile.h"
 #include "../Resource/ResourceCache.h"
 #include "Material.h"
+#include "VirtualTexture.h"
 
+#include <algorithm>
 #include <tracy/Tracy.hpp>
 
 const char* passNames[] = {
     "shadow",
     "opaque",
-    "opaqueadd",
     "alpha",
-    "alphaadd",
+    "depth",
     nullptr
 };
 
@@ -22,41 +26,56 @@ const char* geometryDefines[] = {
     "SKINNED ",
     "INSTANCED ",
     "",
+    "SKINNED INSTANCED ",
+    "STATICINSTANCED ",
     nullptr
 };
 
+IdAllocator Pass::idAllocator;
+Pass* Pass::passTable[ID_OVERFLOW];
+IdAllocator Material::idAllocator;
 std::set<Material*> Material::allMaterials;
 SharedPtr<Material> Material::defaultMaterial;
 std::string Material::globalVSDefines;
 std::string Material::globalFSDefines;
+bool Material::asyncShaderCompile = false;
+unsigned Material::batchVersion = 0;
+unsigned Material::uniformVersion = 0;
 
-Pass::Pass(Material* parent_) :
+static const unsigned COOKED_MATERIAL_VERSION = 1;
+static const unsigned char VIRTUAL_TEXTURE_UNIT_FLAG = 0x80;
+
+/// Parse a pass description from JSON.
+static void ParsePassDesc(PassDesc& dest, const JSONValue& source)
+{
+    dest.shaderName = source["shader"].GetString();
+    dest.vsDefines = source["vsDefines"].GetString();
+    dest.fsDefines = source["fsDefines"].GetString();
+    dest.blendMode = (BlendMode)ListIndex(source["blendMode"].GetString(), blendModeNames, BLEND_REPLACE);
+    dest.depthTest = (CompareMode)ListIndex(source["depthTest"].GetString(), compareModeNames, CMP_LESS);
+    dest.colorWrite = source.Contains("colorWrite") ? source["colorWrite"].GetBool() : true;
+    dest.depthWrite = source.Contains("depthWrite") ? source["depthWrite"].GetBool() : true;
+}
+
+Pass::Pass(Material* parent_, Pass* basePass_) :
     parent(parent_),
+    basePass(basePass_),
     blendMode(BLEND_REPLACE),
     depthTest(CMP_LESS),
     colorWrite(true),
-    depthWrite(true)
+    depthWrite(true),
+    shaderVersion(0),
+    id(idAllocator.Allocate())
 {
+    if (id < ID_OVERFLOW)
+        passTable[id] = this;
 }
 
 Pass::~Pass()
 {
-}
-
-void Pass::LoadJSON(const JSONValue& source)
-{
-    ZoneScoped;
-
-    ResourceCache* cache = Object::Subsystem<ResourceCache>();
-
-    SetShader(cache->LoadResource<Shader>(source["shader"].GetString()), source["vsDefines"].GetString(), source["fsDefines"].GetString());
-
-    SetRenderState(
-        (BlendMode)ListIndex(source["blendMode"].GetString(), blendModeNames, BLEND_REPLACE), 
-        (CompareMode)ListIndex(source["depthTest"].GetString(), compareModeNames, CMP_LESS),
-        source.Contains("colorWrite") ? source["colorWrite"].GetBool() : true, 
-        source.Contains("depthWrite") ? source["depthWrite"].GetBool() : true
-    );
+    if (id < ID_OVERFLOW)
+        passTable[id] = nullptr;
+    idAllocator.Free(id);
 }
 
 void Pass::SetShader(Shader* shader_, const std::string& vsDefines_, const std::string& fsDefines_)
@@ -70,6 +89,7 @@ void Pass::SetShader(Shader* shader_, const std::string& vsDefines_, const std::
         fsDefines += " ";
 
     ResetShaderPrograms();
+    parent->UpdateInstances();
 }
 
 void Pass::SetRenderState(BlendMode blendMode_, CompareMode depthTest_, bool colorWrite_, bool depthWrite_)
@@ -78,23 +98,110 @@ void Pass::SetRenderState(BlendMode blendMode_, CompareMode depthTest_, bool col
     depthTest = depthTest_;
     colorWrite = colorWrite_;
     depthWrite = depthWrite_;
+    ResetPipelineStates();
+    parent->UpdateInstances();
+}
+
+void Pass::UpdateFromBase()
+{
+    if (!basePass)
+        return;
+
+    shader = basePass->shader;
+    vsDefines = basePass->vsDefines;
+    fsDefines = basePass->fsDefines;
+    blendMode = basePass->blendMode;
+    depthTest = basePass->depthTest;
+    colorWrite = basePass->colorWrite;
+    depthWrite = basePass->depthWrite;
 }
 
 void Pass::ResetShaderPrograms()
 {
     for (size_t i = 0; i < MAX_SHADER_VARIATIONS; ++i)
         shaderPrograms[i].Reset();
+    shaderVersion = shader ? shader->Version() : 0;
+    ResetPipelineStates();
+}
+
+PipelineState* Pass::GetPipelineState(unsigned char programBits, unsigned char variant)
+{
+    if (basePass)
+        return basePass->GetPipelineState(programBits, variant);
+
+    ShaderProgram* program = GetShaderProgram(programBits);
+    if (!program)
+        return nullptr;
+
+    SharedPtr<PipelineState>& state = pipelineStates[programBits * MAX_PIPELINE_VARIANTS + variant];
+    if (!state)
+    {
+        CullMode cullMode = parent->GetCullMode();
+        if (variant & PV_REVERSECULLING)
+        {
+            if (cullMode == CULL_BACK)
+                cullMode = CULL_FRONT;
+            else if (cullMode == CULL_FRONT)
+                cullMode = CULL_BACK;
+        }
+
+        // Shadow passes write the moments as color into moment shadow maps
+        bool writeColor = colorWrite || ((programBits & SP_MOMENTSHADOW) && parent->GetPass(PASS_SHADOW) == this);
+
+        // Weighted blended transparency accumulates without depth write. The depth pre-pass has already written the closest depth
+        if ((programBits & SP_OIT) && IsOrderIndependent())
+            state = new PipelineState(program, BLEND_WEIGHTEDOIT, cullMode, depthTest, writeColor, false);
+        else if (variant & PV_AFTERPREPASS)
+            state = new PipelineState(program, blendMode, cullMode, CMP_EQUAL, writeColor, false);
+        else
+            state = new PipelineState(program, blendMode, cullMode, depthTest, writeColor, depthWrite);
+    }
+
+    return state;
+}
+
+void Pass::ResetPipelineStates()
+{
+    for (size_t i = 0; i < MAX_SHADER_VARIATIONS * MAX_PIPELINE_VARIANTS; ++i)
+        pipelineStates[i].Reset();
+}
+
+bool Pass::ShaderProgramsReady() const
+{
+    if (basePass)
+        return basePass->ShaderProgramsReady();
+
+    // Poll all programs rather than stopping at the first pending one, so that each finished program is finalized
+    bool ready = true;
+    for (size_t i = 0; i < MAX_SHADER_VARIATIONS; ++i)
+    {
+        if (shaderPrograms[i] && !shaderPrograms[i]->IsReady())
+            ready = false;
+    }
+
+    return ready;
 }
 
 Material::Material() :
-    cullMode(CULL_BACK)
+    cullMode(CULL_BACK),
+    id(idAllocator.Allocate()),
+    uniformsDirty(true)
 {
     allMaterials.insert(this);
+    // The ID may have been used by a destroyed material
+    ++uniformVersion;
 }
 
 Material::~Material()
 {
+    if (parent)
+    {
+        std::vector<Material*>& siblings = parent->instances;
+        siblings.erase(std::find(siblings.begin(), siblings.end(), this));
+    }
+
     allMaterials.erase(this);
+    idAllocator.Free(id);
 }
 
 void Material::RegisterObject()
@@ -106,13 +213,62 @@ bool Material::BeginLoad(Stream& source)
 {
     ZoneScoped;
 
-    loadJSON = new JSONFile();
-    if (!loadJSON->Load(source))
+    loadDesc = new MaterialDesc();
+    uniformValues.clear();
+    uniformsDirty = true;
+    ++uniformVersion;
+
+    if (source.ReadFileID() == "TMAT")
+    {
+        if (source.Read<unsigned>() != COOKED_MATERIAL_VERSION)
+        {
+            LOGERROR(source.Name() + " has an unsupported cooked material version");
+            return false;
+        }
+
+        cullMode = (CullMode)source.Read<unsigned char>();
+        loadDesc->vsDefines = source.Read<std::string>();
+        loadDesc->fsDefines = source.Read<std::string>();
+
+        size_t numUniforms = source.ReadVLE();
+        for (size_t i = 0; i < numUniforms; ++i)
+        {
+            PresetUniform uniform = (PresetUniform)source.Read<unsigned char>();
+            Vector4 value = source.Read<Vector4>();
+            if (uniform < MAX_PRESET_UNIFORMS)
+                uniformValues[uniform] = value;
+        }
+
+        loadDesc->passes.resize(source.ReadVLE());
+        for (auto it = loadDesc->passes.begin(); it != loadDesc->passes.end(); ++it)
+        {
+            it->type = (PassType)source.Read<unsigned char>();
+            it->shaderName = source.Read<std::string>();
+            it->vsDefines = source.Read<std::string>();
+            it->fsDefines = source.Read<std::string>();
+            it->blendMode = (BlendMode)source.Read<unsigned char>();
+            it->depthTest = (CompareMode)source.Read<unsigned char>();
+            it->colorWrite = source.Read<bool>();
+            it->depthWrite = source.Read<bool>();
+        }
+
+        loadDesc->textures.resize(source.ReadVLE());
+        for (auto it = loadDesc->textures.begin(); it != loadDesc->textures.end(); ++it)
+        {
+            it->first = source.Read<unsigned char>();
+            it->second = source.Read<std::string>();
+        }
+
+        return true;
+    }
+
+    source.Seek(0);
+    JSONFile json;
+    if (!json.Load(source))
         return false;
 
-    const JSONValue& root = loadJSON->Root();
+    const JSONValue& root = json.Root();
 
-    uniformValues.clear();
     if (root.Contains("uniformValues"))
     {
         const JSONObject& jsonUniformValues = root["uniformValues"].GetObject();
@@ -129,19 +285,8 @@ bool Material::BeginLoad(Stream& source)
     else
         cullMode = CULL_BACK;
 
-    return true;
-}
-
-bool Material::EndLoad()
-{
-    ZoneScoped;
-
-    const JSONValue& root = loadJSON->Root();
-
-    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
-        passes[i].Reset();
-
-    SetShaderDefines(root["vsDefines"].GetString(), root["fsDefines"].GetString());
+    loadDesc->vsDefines = root["vsDefines"].GetString();
+    loadDesc->fsDefines = root["fsDefines"].GetString();
 
     if (root.Contains("passes"))
     {
@@ -151,49 +296,209 @@ bool Material::EndLoad()
             PassType type = (PassType)ListIndex(it->first.c_str(), passNames, MAX_PASS_TYPES);
             if (type != MAX_PASS_TYPES)
             {
-                Pass* newPass = CreatePass(type);
-                newPass->LoadJSON(it->second);
+                PassDesc passDesc;
+                passDesc.type = type;
+                ParsePassDesc(passDesc, it->second);
+                loadDesc->passes.push_back(passDesc);
             }
         }
     }
-    
-    /// \todo Queue texture loads during BeginLoad()
-    ResetTextures();
+
     if (root.Contains("textures"))
     {
-        ResourceCache* cache = Subsystem<ResourceCache>();
         const JSONObject& jsonTextures = root["textures"].GetObject();
         for (auto it = jsonTextures.begin(); it != jsonTextures.end(); ++it)
-            SetTexture(ParseInt(it->first), cache->LoadResource<Texture>(it->second.GetString()));
+        {
+            int unit = ParseInt(it->first);
+            if (unit >= 0 && unit < (int)MAX_MATERIAL_TEXTURE_UNITS)
+                loadDesc->textures.push_back(std::make_pair((unsigned char)unit, it->second.GetString()));
+        }
+    }
+
+    if (root.Contains("virtualTextures"))
+    {
+        const JSONObject& jsonTextures = root["virtualTextures"].GetObject();
+        for (auto it = jsonTextures.begin(); it != jsonTextures.end(); ++it)
+        {
+            int unit = ParseInt(it->first);
+            if (unit >= 0 && unit < (int)MAX_VIRTUAL_TEXTURE_UNITS)
+                loadDesc->textures.push_back(std::make_pair((unsigned char)(unit | VIRTUAL_TEXTURE_UNIT_FLAG), it->second.GetString()));
+        }
+    }
+
+    return true;
+}
+
+bool Material::EndLoad()
+{
+    ZoneScoped;
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
+
+    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+        passes[i].Reset();
+    MarkBatchesChanged();
+
+    SetShaderDefines(loadDesc->vsDefines, loadDesc->fsDefines);
+
+    for (auto it = loadDesc->passes.begin(); it != loadDesc->passes.end(); ++it)
+    {
+        Pass* newPass = CreatePass(it->type);
+        if (!newPass)
+            continue;
+
+        newPass->SetShader(cache->LoadResource<Shader>(it->shaderName), it->vsDefines, it->fsDefines);
+        newPass->SetRenderState(it->blendMode, it->depthTest, it->colorWrite, it->depthWrite);
+    }
+
+    ResetTextures();
+    for (auto it = loadDesc->textures.begin(); it != loadDesc->textures.end(); ++it)
+    {
+        if (it->first & VIRTUAL_TEXTURE_UNIT_FLAG)
+            SetVirtualTexture(it->first & ~VIRTUAL_TEXTURE_UNIT_FLAG, cache->LoadResource<VirtualTexture>(it->second));
+        else
+            SetTexture(it->first, cache->LoadResource<Texture>(it->second));
+    }
+
+    loadDesc.Reset();
+    UpdateInstances();
+    return true;
+}
+
+void Material::Dependencies(std::vector<ResourceRef>& dest) const
+{
+    if (!loadDesc)
+        return;
+
+    for (auto it = loadDesc->passes.begin(); it != loadDesc->passes.end(); ++it)
+        dest.push_back(ResourceRef(Shader::TypeStatic(), it->shaderName));
+
+    for (auto it = loadDesc->textures.begin(); it != loadDesc->textures.end(); ++it)
+        dest.push_back(ResourceRef((it->first & VIRTUAL_TEXTURE_UNIT_FLAG) ? VirtualTexture::TypeStatic() : Texture::TypeStatic(), it->second));
+}
+
+bool Material::SaveCooked(Stream& dest)
+{
+    ZoneScoped;
+
+    if (!loadDesc)
+    {
+        LOGERROR("Material " + Name() + " has no load-time data to save");
+        return false;
+    }
+
+    dest.WriteFileID("TMAT");
+    dest.Write(COOKED_MATERIAL_VERSION);
+    dest.Write((unsigned char)cullMode);
+    dest.Write(loadDesc->vsDefines);
+    dest.Write(loadDesc->fsDefines);
+
+    dest.WriteVLE(uniformValues.size());
+    for (auto it = uniformValues.begin(); it != uniformValues.end(); ++it)
+    {
+        dest.Write((unsigned char)it->first);
+        dest.Write(it->second);
+    }
+
+    dest.WriteVLE(loadDesc->passes.size());
+    for (auto it = loadDesc->passes.begin(); it != loadDesc->passes.end(); ++it)
+    {
+        dest.Write((unsigned char)it->type);
+        dest.Write(it->shaderName);
+        dest.Write(it->vsDefines);
+        dest.Write(it->fsDefines);
+        dest.Write((unsigned char)it->blendMode);
+        dest.Write((unsigned char)it->depthTest);
+        dest.Write(it->colorWrite);
+        dest.Write(it->depthWrite);
+    }
+
+    dest.WriteVLE(loadDesc->textures.size());
+    for (auto it = loadDesc->textures.begin(); it != loadDesc->textures.end(); ++it)
+    {
+        dest.Write(it->first);
+        dest.Write(it->second);
     }
 
-    loadJSON.Reset();
     return true;
 }
 
+SharedPtr<Material> Material::CreateInstance()
+{
+    Material* root = parent ? parent.Get() : this;
+
+    SharedPtr<Material> instance(new Material());
+    instance->parent = root;
+    if (parent)
+        instance->uniformValues = uniformValues;
+    root->instances.push_back(instance);
+    instance->UpdateFromParent();
+    return instance;
+}
+
 Pass* Material::CreatePass(PassType type)
 {
     if (!passes[type])
-        passes[type] = new Pass(this);
+    {
+        // Batches refer to the passes by ID, so a pass without one can not be rendered
+        SharedPtr<Pass> newPass(new Pass(this));
+        if (newPass->Id() == ID_OVERFLOW)
+        {
+            LOGERROR("Out of pass IDs, can not create pass");
+            return nullptr;
+        }
+
+        passes[type] = newPass;
+        MarkBatchesChanged();
+        UpdateInstances();
+    }
     
     return passes[type];
 }
 
 void Material::RemovePass(PassType type)
 {
-    passes[type].Reset();
+    if (passes[type])
+    {
+        passes[type].Reset();
+        MarkBatchesChanged();
+        UpdateInstances();
+    }
 }
 
 void Material::SetTexture(size_t index, Texture* texture)
 {
     if (index < MAX_MATERIAL_TEXTURE_UNITS)
+    {
         textures[index] = texture;
+        if (index < MAX_VIRTUAL_TEXTURE_UNITS && virtualTextures[index])
+        {
+            virtualTextures[index].Reset();
+            UpdateVirtualDefines();
+        }
+        UpdateInstances();
+    }
+}
+
+void Material::SetVirtualTexture(size_t index, VirtualTexture* texture)
+{
+    if (index < MAX_VIRTUAL_TEXTURE_UNITS)
+    {
+        virtualTextures[index] = texture;
+        textures[index] = texture ? texture->CacheTexture() : nullptr;
+        UpdateVirtualDefines();
+        UpdateInstances();
+    }
 }
 
 void Material::ResetTextures()
 {
     for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
         textures[i].Reset();
+    for (size_t i = 0; i < MAX_VIRTUAL_TEXTURE_UNITS; ++i)
+        virtualTextures[i].Reset();
+    UpdateVirtualDefines();
+    UpdateInstances();
 }
 
 void Material::SetShaderDefines(const std::string& vsDefines_, const std::string& fsDefines_)
@@ -210,6 +515,8 @@ void Material::SetShaderDefines(const std::string& vsDefines_, const std::string
         if (passes[i])
             passes[i]->ResetShaderPrograms();
     }
+
+    UpdateInstances();
 }
 
 void Material::SetGlobalShaderDefines(const std::string& vsDefines_, const std::string& fsDefines_)
@@ -236,11 +543,126 @@ void Material::SetGlobalShaderDefines(const std::string& vsDefines_, const std::
 void Material::SetUniform(PresetUniform uniform, const Vector4& value)
 {
     uniformValues[uniform] = value;
+    uniformsDirty = true;
+    ++uniformVersion;
+
+    for (auto it = instances.begin(); it != instances.end(); ++it)
+        (*it)->uniformsDirty = true;
+}
+
+void Material::PackUniforms(Vector4* dest) const
+{
+    if (parent)
+        parent->PackUniforms(dest);
+    else
+    {
+        for (size_t i = 0; i < NUM_MATERIAL_UNIFORMS; ++i)
+            dest[i] = Vector4::ZERO;
+    }
+
+    for (auto it = uniformValues.begin(); it != uniformValues.end(); ++it)
+    {
+        if (it->first >= FIRST_MATERIAL_UNIFORM)
+            dest[it->first - FIRST_MATERIAL_UNIFORM] = it->second;
+    }
+}
+
+UniformBuffer* Material::GetUniformBuffer()
+{
+    if (uniformsDirty || !uniformBuffer)
+    {
+        Vector4 data[NUM_MATERIAL_UNIFORMS];
+        PackUniforms(data);
+
+        if (!uniformBuffer)
+        {
+            uniformBuffer = new UniformBuffer();
+            uniformBuffer->Define(USAGE_DEFAULT, sizeof data, data);
+        }
+        else
+            uniformBuffer->SetData(0, sizeof data, data);
+
+        uniformsDirty = false;
+    }
+
+    return uniformBuffer;
 }
 
 void Material::SetCullMode(CullMode mode)
 {
     cullMode = mode;
+
+    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+    {
+        if (passes[i])
+            passes[i]->ResetPipelineStates();
+    }
+
+    UpdateInstances();
+}
+
+void Material::PrecompileShaderPrograms(bool cubeShadows, bool lodFade)
+{
+    ZoneScoped;
+
+    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+    {
+        Pass* pass = passes[i];
+        if (!pass)
+            continue;
+
+        for (unsigned geomBits = SP_STATIC; geomBits <= SP_STATICINSTANCED; ++geomBits)
+        {
+            // Custom geometry uses the same defines as static, so the program would be shared
+            if (geomBits == SP_CUSTOMGEOM)
+                continue;
+
+            for (unsigned extraBits = 0; extraBits <= (SP_CUBESHADOW | SP_LODFADE); extraBits += SP_CUBESHADOW)
+            {
+                if ((extraBits & SP_CUBESHADOW) && (!cubeShadows || i != PASS_SHADOW))
+                    continue;
+                if ((extraBits & SP_LODFADE) && !lodFade)
+                    continue;
+
+                pass->GetShaderProgram((unsigned char)(geomBits | extraBits));
+            }
+        }
+    }
+}
+
+bool Material::ShaderProgramsReady() const
+{
+    bool ready = true;
+    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+    {
+        if (passes[i] && !passes[i]->ShaderProgramsReady())
+            ready = false;
+    }
+
+    return ready;
+}
+
+void Material::SetAsyncShaderCompile(bool enable)
+{
+    asyncShaderCompile = enable;
+}
+
+void Material::PrecompileAllShaderPrograms(bool cubeShadows, bool lodFade)
+{
+    for (auto it = allMaterials.begin(); it != allMaterials.end(); ++it)
+        (*it)->PrecompileShaderPrograms(cubeShadows, lodFade);
+}
+
+bool Material::AllShaderProgramsReady()
+{
+    bool ready = true;
+    for (auto it = allMaterials.begin(); it != allMaterials.end(); ++it)
+    {
+        if (!(*it)->ShaderProgramsReady())
+            ready = false;
+    }
+
+    return ready;
 }
 
 Material* Material::DefaultMaterial()
@@ -260,7 +682,83 @@ Material* Material::DefaultMaterial()
         pass = defaultMaterial->CreatePass(PASS_OPAQUE);
         pass->SetShader(cache->LoadResource<Shader>("Shaders/NoTexture.glsl"), "", "");
         pass->SetRenderState(BLEND_REPLACE, CMP_LESS, true, true);
+
+        pass = defaultMaterial->CreatePass(PASS_DEPTH);
+        pass->SetShader(cache->LoadResource<Shader>("Shaders/Shadow.glsl"), "", "");
+        pass->SetRenderState(BLEND_REPLACE, CMP_LESS, false, true);
     }
 
     return defaultMaterial;
 }
+
+void Material::UpdateFromParent()
+{
+    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+    {
+        Pass* basePass = parent->passes[i];
+        if (!basePass)
+        {
+            if (passes[i])
+            {
+                passes[i].Reset();
+                MarkBatchesChanged();
+            }
+            continue;
+        }
+
+        // The instance's own pass IDs let batches refer to the instance, while the programs and pipeline states come from the base pass
+        if (!passes[i] || passes[i]->Base() != basePass)
+        {
+            SharedPtr<Pass> newPass(new Pass(this, basePass));
+            if (newPass->Id() == ID_OVERFLOW)
+            {
+                LOGERROR("Out of pass IDs, can not create material instance pass");
+                newPass.Reset();
+            }
+
+            passes[i] = newPass;
+            MarkBatchesChanged();
+        }
+
+        if (passes[i])
+            passes[i]->UpdateFromBase();
+    }
+
+    for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+        textures[i] = parent->textures[i];
+    for (size_t i = 0; i < MAX_VIRTUAL_TEXTURE_UNITS; ++i)
+        virtualTextures[i] = parent->virtualTextures[i];
+
+    cullMode = parent->cullMode;
+    vsDefines = parent->vsDefines;
+    fsDefines = parent->fsDefines;
+    virtualDefines = parent->virtualDefines;
+    uniformsDirty = true;
+    ++uniformVersion;
+}
+
+void Material::UpdateVirtualDefines()
+{
+    std::string newDefines;
+    for (size_t i = 0; i < MAX_VIRTUAL_TEXTURE_UNITS; ++i)
+    {
+        if (virtualTextures[i])
+            newDefines += "VIRTUALTEX" + std::to_string(i) + " ";
+    }
+
+    if (newDefines != virtualDefines)
+    {
+        virtualDefines = newDefines;
+        for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+        {
+            if (passes[i])
+                passes[i]->ResetShaderPrograms();
+        }
+    }
+}
+
+void Material::UpdateInstances()
+{
+    for (auto it = instances.begin(); it != instances.end(); ++it)
+        (*it)->UpdateFromParent();
+}
@@ -5,22 +5,32 @@
 #include "../Math/Vector4.h"
 #include "../Object/AutoPtr.h"
 #include "../Graphics/GraphicsDefs.h"
+#include "../Graphics/PipelineState.h"
 #include "../Graphics/Shader.h"
 #include "../Graphics/ShaderProgram.h"
+#include "../Object/IdAllocator.h"
 #include "../Resource/Resource.h"
 
 #include <set>
 
-class JSONFile;
+class UniformBuffer;
+
+/// First preset uniform that is a material uniform. Material uniform buffers hold a Vector4 for each from this on.
+static const PresetUniform FIRST_MATERIAL_UNIFORM = U_MATDIFFCOLOR;
+/// Number of material uniforms in the material uniform buffers.
+static const size_t NUM_MATERIAL_UNIFORMS = MAX_PRESET_UNIFORMS - FIRST_MATERIAL_UNIFORM;
+
 class JSONValue;
 class Material;
 class Texture;
+class VirtualTexture;
 
 enum PassType
 {
     PASS_SHADOW = 0,
     PASS_OPAQUE,
     PASS_ALPHA,
+    PASS_DEPTH,
     MAX_PASS_TYPES
 };
 
@@ -29,42 +39,117 @@ static const unsigned SP_STATIC = 0x0;
 static const unsigned SP_SKINNED = 0x1;
 static const unsigned SP_INSTANCED = 0x2;
 static const unsigned SP_CUSTOMGEOM = 0x3;
-static const unsigned SP_GEOMETRYBITS = 0x3;
+static const unsigned SP_SKINNEDINSTANCED = 0x4;
+static const unsigned SP_STATICINSTANCED = 0x5;
+static const unsigned SP_GEOMETRYBITS = 0x7;
+static const unsigned SP_CUBESHADOW = 0x8;
+static const unsigned SP_LODFADE = 0x10;
+static const unsigned SP_STEREO = 0x20;
+static const unsigned SP_DEFERRED = 0x40;
+// Weighted blended transparency output shares the bit with deferred output, as it only applies to passes with alpha blending
+static const unsigned SP_OIT = 0x40;
+// Moment shadow maps: shadow passes output the moments as color, and lit passes sample them. Only set on the view, as batches use the bit in their sort key
+static const unsigned SP_MOMENTSHADOW = 0x80;
+
+static const size_t MAX_SHADER_VARIATIONS = (SP_MOMENTSHADOW | SP_DEFERRED | SP_STEREO | SP_LODFADE | SP_CUBESHADOW | SP_STATICINSTANCED) + 1;
+
+static const unsigned char PV_REVERSECULLING = 0x1;
+static const unsigned char PV_AFTERPREPASS = 0x2;
+
+static const size_t MAX_PIPELINE_VARIANTS = (PV_REVERSECULLING | PV_AFTERPREPASS) + 1;
+
+/// Load-time description of a pass, parsed from JSON or the cooked format.
+struct PassDesc
+{
+    /// Pass type.
+    PassType type;
+    /// Shader resource name.
+    std::string shaderName;
+    /// Vertex shader defines.
+    std::string vsDefines;
+    /// Fragment shader defines.
+    std::string fsDefines;
+    /// Blend mode.
+    BlendMode blendMode;
+    /// Depth test mode.
+    CompareMode depthTest;
+    /// Color write flag.
+    bool colorWrite;
+    /// Depth write flag.
+    bool depthWrite;
+};
 
-static const size_t MAX_SHADER_VARIATIONS = 4;
+/// Load-time description of the passes, shader defines and textures of a material, applied in the main thread.
+struct MaterialDesc
+{
+    /// Vertex shader defines for all passes.
+    std::string vsDefines;
+    /// Fragment shader defines for all passes.
+    std::string fsDefines;
+    /// Passes.
+    std::vector<PassDesc> passes;
+    /// Texture resource names by texture unit. Virtual textures have the high bit of the unit set.
+    std::vector<std::pair<unsigned char, std::string> > textures;
+};
 
 /// Render pass, which defines render state and shaders. A material may define several of these.
 class Pass : public RefCounted
 {
 public:
-    /// Construct.
-    Pass(Material* parent);
+    /// Construct. A base pass is given for the passes of material instances, which share its shader programs and pipeline states.
+    Pass(Material* parent, Pass* basePass = nullptr);
     /// Destruct.
     ~Pass();
 
-    /// Load from JSON data.
-    void LoadJSON(const JSONValue& source);
     /// Set shader and shader defines. Existing shader programs will be cleared.
     void SetShader(Shader* shader, const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
     /// Reset existing shader programs.
     void ResetShaderPrograms();
     /// Set render state.
     void SetRenderState(BlendMode blendMode, CompareMode depthTest = CMP_LESS, bool colorWrite = true, bool depthWrite = true);
+    /// Copy the shader and render state from the base pass. Called by the parent material instance when its parent changes.
+    void UpdateFromBase();
     /// Get a shader program and cache for later use.
     ShaderProgram* GetShaderProgram(unsigned char programBits);
+    /// Return a shader program if already created, or null. Does not create, so can be called from worker threads.
+    ShaderProgram* FindShaderProgram(unsigned char programBits) const { return basePass ? basePass->FindShaderProgram(programBits) : shaderPrograms[programBits].Get(); }
+    /// Get a pipeline state of a shader variation and view variant bits and cache for later use. Reverse culling swaps the material's cull mode, and after a depth pre-pass the depth test becomes equal without depth write. Order-independent transparency variations use the weighted blended accumulation without depth write. Return null if the shader program can not be created.
+    PipelineState* GetPipelineState(unsigned char programBits, unsigned char variant);
+    /// Return a pipeline state if already created, or null. Does not create, so can be called from worker threads.
+    PipelineState* FindPipelineState(unsigned char programBits, unsigned char variant) const { return basePass ? basePass->FindPipelineState(programBits, variant) :
+        pipelineStates[programBits * MAX_PIPELINE_VARIANTS + variant].Get(); }
+    /// Reset existing pipeline states. Called when the render state or the parent material's cull mode changes.
+    void ResetPipelineStates();
+    /// Return whether all created shader programs have finished compiling and linking.
+    bool ShaderProgramsReady() const;
 
     /// Return parent material.
     Material* Parent() const { return parent; }
+    /// Return the pass of the parent material that a material instance's pass shares the shader programs with, or this pass if not an instance pass.
+    Pass* Base() { return basePass ? basePass.Get() : this; }
+    /// Return compact ID of the base pass. Batches of the instances of one material are instanced together by it when drawn from the static transform table.
+    unsigned short BaseId() const { return basePass ? basePass->id : id; }
     /// Return shader.
     Shader* GetShader() const { return shader; }
+    /// Return vertex shader defines.
+    const std::string& VSDefines() const { return vsDefines; }
+    /// Return fragment shader defines.
+    const std::string& FSDefines() const { return fsDefines; }
     /// Return blend mode.
     BlendMode GetBlendMode() const { return blendMode; }
+    /// Return whether the blend mode is alpha or premultiplied alpha, which weighted blended order-independent transparency can replace.
+    bool IsOrderIndependent() const { return blendMode == BLEND_ALPHA || blendMode == BLEND_PREMULALPHA; }
     /// Return depth test mode.
     CompareMode GetDepthTest() const { return depthTest; }
     /// Return color write flag.
     bool GetColorWrite() const { return colorWrite; }
     /// Return depth write flag.
     bool GetDepthWrite() const { return depthWrite; }
+    /// Return compact ID, which is stable for the lifetime of the pass. Used for sorting and for referring to the pass from batches.
+    unsigned short Id() const { return id; }
+
+    /// Return a pass by compact ID, or null if none. Safe to call from worker threads for passes that are alive.
+    static Pass* FromId(unsigned short id) { return id < ID_OVERFLOW ? passTable[id] : nullptr; }
 
     /// Last sort key for combined distance and state sorting. Used by Renderer.
     std::pair<unsigned short, unsigned short> lastSortKey;
@@ -72,6 +157,8 @@ public:
 private:
     /// Parent material.
     Material* parent;
+    /// Base pass of a material instance's pass.
+    SharedPtr<Pass> basePass;
     /// Blend mode.
     BlendMode blendMode;
     /// Depth test mode.
@@ -82,12 +169,23 @@ private:
     bool depthWrite;
     /// Cached shader variations.
     SharedPtr<ShaderProgram> shaderPrograms[MAX_SHADER_VARIATIONS];
+    /// Cached pipeline states by shader variation and view variant.
+    SharedPtr<PipelineState> pipelineStates[MAX_SHADER_VARIATIONS * MAX_PIPELINE_VARIANTS];
     /// Shader resource.
     SharedPtr<Shader> shader;
+    /// Shader version of the cached variations.
+    unsigned shaderVersion;
     /// Vertex shader defines.
     std::string vsDefines;
     /// Fragment shader defines.
     std::string fsDefines;
+    /// Compact ID.
+    unsigned short id;
+
+    /// Pass ID allocator.
+    static IdAllocator idAllocator;
+    /// Passes by compact ID. Fixed size, so that the entries can be read by worker threads while passes are created.
+    static Pass* passTable[ID_OVERFLOW];
 };
 
 /// %Material resource, which describes how to render 3D geometry and refers to textures. A material can contain several passes (for example normal rendering, and depth only.)
@@ -95,6 +193,8 @@ class Material : public Resource
 {
     OBJECT(Material);
 
+    friend class Pass;
+
 public:
     /// Construct.
     Material();
@@ -104,72 +204,144 @@ public:
     /// Register object factory.
     static void RegisterObject();
 
-    /// Load material from a stream. Return true on success.
+    /// Load material from a stream, either JSON or the cooked binary format. Return true on success.
     bool BeginLoad(Stream& source) override;
     /// Finalize material loading in the main thread. Return true on success.
     bool EndLoad() override;
+    /// Return the shaders and textures to be loaded in EndLoad().
+    void Dependencies(std::vector<ResourceRef>& dest) const override;
 
-    /// Create and return a new pass. If pass with same name exists, it will be returned.
+    /// Save the load-time data after BeginLoad() in the cooked binary format, which is loaded without JSON parsing. Return true on success.
+    bool SaveCooked(Stream& dest);
+    /// Create a lightweight instance that shares the passes, shader programs, pipeline states, textures and cull mode of this material, and overrides uniform values with SetUniform(). When drawn from the renderer's static transform table, the instances of one material are instanced together, with the diffuse color read per instance. Instancing an instance creates another instance of the same parent with the same overrides.
+    SharedPtr<Material> CreateInstance();
+
+    /// Create and return a new pass. If pass with same name exists, it will be returned. Return null if out of pass IDs.
     Pass* CreatePass(PassType type);
     /// Remove a pass.
     void RemovePass(PassType type);
-    /// Set a texture.
+    /// Set a texture. Replaces a virtual texture on the same unit.
     void SetTexture(size_t index, Texture* texture);
+    /// Set a loaded virtual texture on one of the first MAX_VIRTUAL_TEXTURE_UNITS texture units, or null to remove. The texture unit is assigned the virtual texture's cache texture, its page table is bound on the unit TU_VIRTUALPAGETABLE + index, and the passes are compiled with the define VIRTUALTEX followed by the index. The renderer's virtual texturing mode must be enabled for the pages to stream in beyond the coarsest mip level.
+    void SetVirtualTexture(size_t index, VirtualTexture* texture);
     /// Reset all texture assignments.
     void ResetTextures();
     /// Set shader defines for all passes.
     void SetShaderDefines(const std::string& vsDefines, const std::string& fsDefines);
-    /// Set an uniform value. For simplicity and performance, all material uniforms are Vector4's.
+    /// Set an uniform value. For simplicity and performance, all material uniforms are Vector4's. On a material instance, overrides the parent's value.
     void SetUniform(PresetUniform uniform, const Vector4& value);
     /// Set culling mode, shared by all passes.
     void SetCullMode(CullMode mode);
+    /// Create the shader programs of all passes for each geometry type ahead of rendering, so that they do not stall the frame they are first needed on. Optionally include the shadow pass cube shadow variations and the LOD fade variations.
+    void PrecompileShaderPrograms(bool cubeShadows = false, bool lodFade = false);
 
     /// Return pass by index or null if not found.
     Pass* GetPass(PassType type) const { return passes[type]; }
     /// Return texture by texture unit.
     Texture* GetTexture(size_t index) const { return textures[index]; }
+    /// Return virtual texture by texture unit, or null if none.
+    VirtualTexture* GetVirtualTexture(size_t index) const { return index < MAX_VIRTUAL_TEXTURE_UNITS ? virtualTextures[index].Get() : nullptr; }
+    /// Return whether has virtual textures.
+    bool HasVirtualTextures() const { return !virtualDefines.empty(); }
+    /// Return the shader defines of the virtual texture units, for both vertex and fragment shaders.
+    const std::string& VirtualDefines() const { return virtualDefines; }
     /// Return vertex shader defines.
     const std::string& VSDefines() const { return vsDefines; }
     /// Return fragment shader defines.
     const std::string& FSDefines() const { return fsDefines; }
-    /// Return uniform values.
+    /// Return uniform values. On a material instance, only the overridden values.
     const std::map<PresetUniform, Vector4>& UniformValues() const { return uniformValues; }
+    /// Write the packed material uniforms, NUM_MATERIAL_UNIFORMS values. Uniforms without a value are zero. A material instance's values override its parent's.
+    void PackUniforms(Vector4* dest) const;
+    /// Return the uniform buffer holding the packed material uniforms, creating or updating it first if the values have changed. Call only from the main thread.
+    UniformBuffer* GetUniformBuffer();
     /// Return culling mode.
     CullMode GetCullMode() const { return cullMode; }
+    /// Return compact ID, which is stable for the lifetime of the material.
+    unsigned short Id() const { return id; }
+    /// Return whether all created shader programs of all passes have finished compiling and linking.
+    bool ShaderProgramsReady() const;
+    /// Return the parent material if this is a material instance, or null.
+    Material* Parent() const { return parent; }
 
     /// Set global (lighting-related) shader defines. Resets all loaded pass shaders.
     static void SetGlobalShaderDefines(const std::string& vsDefines, const std::string& fsDefines);
+    /// Set whether pass shader programs are compiled asynchronously when parallel shader compile is supported. Draws using a program are skipped until it is ready. Default false.
+    static void SetAsyncShaderCompile(bool enable);
+    /// Create the shader programs of all loaded materials ahead of rendering, for example after loading a scene.
+    static void PrecompileAllShaderPrograms(bool cubeShadows = false, bool lodFade = false);
+    /// Return whether the shader programs of all loaded materials have finished compiling and linking.
+    static bool AllShaderProgramsReady();
     /// Return a default opaque untextured material.
     static Material* DefaultMaterial();
     /// Return global vertex shader defines.
     static const std::string& GlobalVSDefines() { return globalVSDefines; }
     /// Return global fragment shader defines.
     static const std::string& GlobalFSDefines() { return globalFSDefines; }
+    /// Return whether pass shader programs are compiled asynchronously.
+    static bool IsAsyncShaderCompile() { return asyncShaderCompile; }
+    /// Mark that the batches built from drawables' geometries and materials have changed, for example when a pass is created or removed, or a drawable is assigned another geometry or material. Call from the main thread.
+    static void MarkBatchesChanged() { ++batchVersion; }
+    /// Return a counter that changes whenever batches built from materials may have changed. Used for detecting stale cached batches.
+    static unsigned BatchVersion() { return batchVersion; }
+    /// Return a counter that changes whenever the uniform values of any material may have changed.
+    static unsigned UniformVersion() { return uniformVersion; }
+    /// Return all materials, including material instances.
+    static const std::set<Material*>& AllMaterials() { return allMaterials; }
 
 private:
+    /// Copy the passes, textures, shader defines and cull mode from the parent material.
+    void UpdateFromParent();
+    /// Rebuild the virtual texture shader defines and reset the shader programs if they changed.
+    void UpdateVirtualDefines();
+    /// Update the material instances after a change to this material.
+    void UpdateInstances();
+
     /// Culling mode.
     CullMode cullMode;
+    /// Compact ID.
+    unsigned short id;
     /// Passes.
     SharedPtr<Pass> passes[MAX_PASS_TYPES];
     /// Material textures.
     SharedPtr<Texture> textures[MAX_MATERIAL_TEXTURE_UNITS];
+    /// Virtual textures.
+    SharedPtr<VirtualTexture> virtualTextures[MAX_VIRTUAL_TEXTURE_UNITS];
     /// Uniform values.
     std::map<PresetUniform, Vector4> uniformValues;
+    /// Packed material uniforms on the GPU.
+    AutoPtr<UniformBuffer> uniformBuffer;
+    /// Whether the uniform buffer needs to be updated.
+    bool uniformsDirty;
     /// Vertex shader defines for all passes.
     std::string vsDefines;
     /// Fragment shader defines for all passes.
     std::string fsDefines;
-    /// JSON data used for loading.
-    AutoPtr<JSONFile> loadJSON;
+    /// Virtual texture unit shader defines.
+    std::string virtualDefines;
+    /// Parent material of a material instance.
+    SharedPtr<Material> parent;
+    /// Material instances created from this material.
+    std::vector<Material*> instances;
+    /// Passes, shader defines and textures used for loading.
+    AutoPtr<MaterialDesc> loadDesc;
 
     /// Default material.
     static SharedPtr<Material> defaultMaterial;
     /// All materials.
     static std::set<Material*> allMaterials;
+    /// Material ID allocator.
+    static IdAllocator idAllocator;
     /// Global vertex shader defines.
     static std::string globalVSDefines;
     /// Global fragment shader defines.
     static std::string globalFSDefines;
+    /// Asynchronous shader compile flag.
+    static bool asyncShaderCompile;
+    /// Batch change counter.
+    static unsigned batchVersion;
+    /// Uniform value change counter.
+    static unsigned uniformVersion;
 };
 
 extern const char* geometryDefines[];
@@ -178,6 +350,13 @@ extern const char* dirLightDefines[];
 
 inline ShaderProgram* Pass::GetShaderProgram(unsigned char programBits)
 {
+    if (basePass)
+        return basePass->GetShaderProgram(programBits);
+
+    // Recreate the variations if the shader has been reloaded
+    if (shader && shaderVersion != shader->Version())
+        ResetShaderPrograms();
+
     if (shaderPrograms[programBits])
         return shaderPrograms[programBits];
     else
@@ -188,8 +367,12 @@ inline ShaderProgram* Pass::GetShaderProgram(unsigned char programBits)
         unsigned char geomBits = programBits & SP_GEOMETRYBITS;
 
         ShaderProgram* newShaderProgram = shader->CreateProgram(
-            Material::GlobalVSDefines() + parent->VSDefines() + vsDefines + geometryDefines[geomBits],
-            Material::GlobalFSDefines() + parent->FSDefines() + fsDefines
+            Material::GlobalVSDefines() + parent->VSDefines() + parent->VirtualDefines() + vsDefines + geometryDefines[geomBits] + ((programBits & SP_CUBESHADOW) ? "CUBESHADOW GEOMETRYSHADER " : "") +
+                ((programBits & SP_STEREO) ? "STEREO GEOMETRYSHADER " : ""),
+            Material::GlobalFSDefines() + parent->FSDefines() + parent->VirtualDefines() + fsDefines + ((programBits & SP_LODFADE) ? "LODFADE " : "") + ((programBits & SP_STEREO) ? "STEREO " : "") +
+                ((programBits & SP_DEFERRED) ? (IsOrderIndependent() ? (blendMode == BLEND_PREMULALPHA ? "OIT PREMULALPHA " : "OIT ") : "DEFERRED ") : "") +
+                ((programBits & SP_MOMENTSHADOW) ? "MOMENTSHADOW " : "") + (geomBits == SP_STATICINSTANCED ? "STATICINSTANCED " : ""),
+            Material::IsAsyncShaderCompile()
         );
 
         shaderPrograms[programBits] = newShaderProgram;
@@ -0,0 +1,237 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Math.h"
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+// Vertex cache size assumed by the triangle reordering
+static const unsigned TIPSIFY_CACHE_SIZE = 16;
+
+/// Cluster of triangles with its overdraw sort key.
+struct TriangleCluster
+{
+    /// First triangle.
+    unsigned start;
+    /// End triangle.
+    unsigned end;
+    /// Sort key, larger is drawn first.
+    float key;
+};
+
+/// Convert indices to a compact 0-based vertex range, so that working data does not depend on the vertex buffer size. Return the number of vertices.
+static size_t CompactIndices(const unsigned* indices, size_t numIndices, std::vector<unsigned>& dest)
+{
+    std::vector<unsigned> vertices(indices, indices + numIndices);
+    std::sort(vertices.begin(), vertices.end());
+    vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+    dest.resize(numIndices);
+    for (size_t i = 0; i < numIndices; ++i)
+        dest[i] = (unsigned)(std::lower_bound(vertices.begin(), vertices.end(), indices[i]) - vertices.begin());
+
+    return vertices.size();
+}
+
+void OptimizeVertexCache(unsigned* indices, size_t numIndices, std::vector<unsigned>* clusterStarts)
+{
+    ZoneScoped;
+
+    if (clusterStarts)
+        clusterStarts->clear();
+
+    size_t numTriangles = numIndices / 3;
+    if (!numTriangles)
+        return;
+
+    std::vector<unsigned> local;
+    size_t numVertices = CompactIndices(indices, numTriangles * 3, local);
+
+    // Vertex to triangle adjacency and live triangle counts
+    std::vector<unsigned> liveTriangles(numVertices, 0);
+    for (size_t i = 0; i < local.size(); ++i)
+        ++liveTriangles[local[i]];
+
+    std::vector<unsigned> adjacencyOffsets(numVertices + 1, 0);
+    for (size_t i = 0; i < numVertices; ++i)
+        adjacencyOffsets[i + 1] = adjacencyOffsets[i] + liveTriangles[i];
+    std::vector<unsigned> adjacentTriangles(local.size());
+    std::vector<unsigned> fillOffsets(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < local.size(); ++i)
+        adjacentTriangles[fillOffsets[local[i]]++] = (unsigned)(i / 3);
+
+    std::vector<unsigned> cacheTimes(numVertices, 0);
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<unsigned> deadEnds;
+    std::vector<unsigned> candidates;
+    std::vector<unsigned> newIndices;
+    newIndices.reserve(numTriangles * 3);
+
+    unsigned time = TIPSIFY_CACHE_SIZE + 1;
+    unsigned cursor = 0;
+    unsigned fanning = local[0];
+
+    if (clusterStarts)
+        clusterStarts->push_back(0);
+
+    while (fanning != M_MAX_UNSIGNED)
+    {
+        // Emit all remaining triangles around the fanning vertex
+        candidates.clear();
+        for (unsigned i = adjacencyOffsets[fanning]; i < adjacencyOffsets[fanning + 1]; ++i)
+        {
+            unsigned triangle = adjacentTriangles[i];
+            if (emitted[triangle])
+                continue;
+
+            for (size_t j = 0; j < 3; ++j)
+            {
+                unsigned vertex = local[triangle * 3 + j];
+                newIndices.push_back(indices[triangle * 3 + j]);
+                deadEnds.push_back(vertex);
+                candidates.push_back(vertex);
+                --liveTriangles[vertex];
+                if (time - cacheTimes[vertex] > TIPSIFY_CACHE_SIZE)
+                    cacheTimes[vertex] = time++;
+            }
+            emitted[triangle] = true;
+        }
+
+        // Continue from the emitted vertex that stays longest in the cache after its remaining triangles, preferring ones that would be evicted otherwise
+        unsigned next = M_MAX_UNSIGNED;
+        int bestPriority = -1;
+        for (auto it = candidates.begin(); it != candidates.end(); ++it)
+        {
+            unsigned vertex = *it;
+            if (!liveTriangles[vertex])
+                continue;
+
+            int priority = 0;
+            if (time - cacheTimes[vertex] + 2 * liveTriangles[vertex] <= TIPSIFY_CACHE_SIZE)
+                priority = (int)(time - cacheTimes[vertex]);
+            if (priority > bestPriority)
+            {
+                bestPriority = priority;
+                next = vertex;
+            }
+        }
+
+        // In a dead end, backtrack through the recently emitted vertices, then scan for any vertex with triangles left
+        if (next == M_MAX_UNSIGNED)
+        {
+            while (deadEnds.size())
+            {
+                unsigned vertex = deadEnds.back();
+                deadEnds.pop_back();
+                if (liveTriangles[vertex])
+                {
+                    next = vertex;
+                    break;
+                }
+            }
+        }
+        if (next == M_MAX_UNSIGNED)
+        {
+            while (cursor < numVertices && !liveTriangles[cursor])
+                ++cursor;
+            if (cursor < numVertices)
+                next = cursor;
+        }
+
+        if (clusterStarts && next != M_MAX_UNSIGNED && time - cacheTimes[next] > TIPSIFY_CACHE_SIZE)
+            clusterStarts->push_back((unsigned)(newIndices.size() / 3));
+
+        fanning = next;
+    }
+
+    std::copy(newIndices.begin(), newIndices.end(), indices);
+}
+
+void OptimizeOverdraw(unsigned* indices, size_t numIndices, const Vector3* positions, const std::vector<unsigned>& clusterStarts)
+{
+    ZoneScoped;
+
+    size_t numTriangles = numIndices / 3;
+    if (clusterStarts.size() < 2)
+        return;
+
+    std::vector<TriangleCluster> clusters(clusterStarts.size());
+    std::vector<Vector3> centroids(clusters.size());
+    std::vector<Vector3> normals(clusters.size());
+    Vector3 meshCentroid(Vector3::ZERO);
+    float meshArea = 0.0f;
+
+    // Area weighted centroid and normal of each cluster
+    for (size_t i = 0; i < clusters.size(); ++i)
+    {
+        TriangleCluster& cluster = clusters[i];
+        cluster.start = clusterStarts[i];
+        cluster.end = i + 1 < clusterStarts.size() ? clusterStarts[i + 1] : (unsigned)numTriangles;
+
+        Vector3 centroid(Vector3::ZERO);
+        Vector3 normal(Vector3::ZERO);
+        float area = 0.0f;
+
+        for (unsigned j = cluster.start; j < cluster.end; ++j)
+        {
+            const Vector3& v0 = positions[indices[j * 3]];
+            const Vector3& v1 = positions[indices[j * 3 + 1]];
+            const Vector3& v2 = positions[indices[j * 3 + 2]];
+            Vector3 cross = (v1 - v0).CrossProduct(v2 - v0);
+            float triangleArea = cross.Length();
+
+            centroid += (v0 + v1 + v2) * (triangleArea / 3.0f);
+            normal += cross;
+            area += triangleArea;
+        }
+
+        meshCentroid += centroid;
+        meshArea += area;
+        centroids[i] = area > 0.0f ? centroid / area : positions[indices[cluster.start * 3]];
+        normals[i] = normal.Normalized();
+    }
+
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+
+    // Clusters facing away from the mesh center are likely to occlude the rest, so draw them first
+    for (size_t i = 0; i < clusters.size(); ++i)
+        clusters[i].key = (centroids[i] - meshCentroid).DotProduct(normals[i]);
+
+    std::stable_sort(clusters.begin(), clusters.end(), [](const TriangleCluster& lhs, const TriangleCluster& rhs) { return lhs.key > rhs.key; });
+
+    std::vector<unsigned> newIndices;
+    newIndices.reserve(numTriangles * 3);
+    for (auto it = clusters.begin(); it != clusters.end(); ++it)
+        newIndices.insert(newIndices.end(), indices + it->start * 3, indices + it->end * 3);
+
+    std::copy(newIndices.begin(), newIndices.end(), indices);
+}
+
+float VertexCacheMissRatio(const unsigned* indices, size_t numIndices, size_t cacheSize)
+{
+    size_t numTriangles = numIndices / 3;
+    if (!numTriangles || !cacheSize)
+        return 0.0f;
+
+    std::vector<unsigned> local;
+    size_t numVertices = CompactIndices(indices, numTriangles * 3, local);
+
+    // FIFO cache simulated with insertion timestamps
+    std::vector<size_t> cacheTimes(numVertices, 0);
+    size_t time = cacheSize + 1;
+    size_t misses = 0;
+
+    for (size_t i = 0; i < local.size(); ++i)
+    {
+        unsigned vertex = local[i];
+        if (time - cacheTimes[vertex] > cacheSize)
+        {
+            cacheTimes[vertex] = time++;
+            ++misses;
+        }
+    }
+
+    return (float)misses / (float)numTriangles;
+}
@@ -0,0 +1,14 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Vector3.h"
+
+#include <vector>
+
+/// Reorder a triangle list for post-transform vertex cache efficiency using the Tipsify algorithm. Optionally return the triangle indices where the simulated cache was flushed, which are free cluster boundaries for overdraw optimization.
+void OptimizeVertexCache(unsigned* indices, size_t numIndices, std::vector<unsigned>* clusterStarts = nullptr);
+/// Reorder the clusters of a cache optimized triangle list so that outward facing clusters are drawn first, to reduce overdraw without loss of cache efficiency.
+void OptimizeOverdraw(unsigned* indices, size_t numIndices, const Vector3* positions, const std::vector<unsigned>& clusterStarts);
+/// Return the average number of vertex cache misses per triangle, simulating a FIFO cache.
+float VertexCacheMissRatio(const unsigned* indices, size_t numIndices, size_t cacheSize = 16);
@@ -0,0 +1,488 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/BoundingBox.h"
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+// Weight of the planes that keep open borders in place, relative to the triangle planes
+static const float BORDER_PLANE_WEIGHT = 10.0f;
+// Attribute error weights relative to the squared model extent. A normal difference of 1 (60 degrees) or a texcoord difference of 0.1 costs as much as moving 1% of the extent
+static const float NORMAL_ERROR_WEIGHT = 0.0001f;
+static const float TEXCOORD_ERROR_WEIGHT = 0.01f;
+
+enum VertexKind
+{
+    KIND_MANIFOLD = 0,
+    KIND_BORDER,
+    KIND_LOCKED,
+    KIND_REMOVED
+};
+
+static inline bool CompareCollapses(const EdgeCollapse& lhs, const EdgeCollapse& rhs)
+{
+    return lhs.cost > rhs.cost;
+}
+
+static inline unsigned long long EdgeKey(unsigned from, unsigned to)
+{
+    return ((unsigned long long)from << 32) | to;
+}
+
+Quadric::Quadric() :
+    a2(0.0), ab(0.0), ac(0.0), ad(0.0), b2(0.0), bc(0.0), bd(0.0), c2(0.0), cd(0.0), d2(0.0), weight(0.0)
+{
+}
+
+void Quadric::AddPlane(const Vector3& normal, float d, float planeWeight)
+{
+    double a = normal.x, b = normal.y, c = normal.z;
+
+    a2 += a * a * planeWeight;
+    ab += a * b * planeWeight;
+    ac += a * c * planeWeight;
+    ad += a * d * planeWeight;
+    b2 += b * b * planeWeight;
+    bc += b * c * planeWeight;
+    bd += b * d * planeWeight;
+    c2 += c * c * planeWeight;
+    cd += c * d * planeWeight;
+    d2 += (double)d * d * planeWeight;
+    weight += planeWeight;
+}
+
+Quadric& Quadric::operator += (const Quadric& rhs)
+{
+    a2 += rhs.a2;
+    ab += rhs.ab;
+    ac += rhs.ac;
+    ad += rhs.ad;
+    b2 += rhs.b2;
+    bc += rhs.bc;
+    bd += rhs.bd;
+    c2 += rhs.c2;
+    cd += rhs.cd;
+    d2 += rhs.d2;
+    weight += rhs.weight;
+    return *this;
+}
+
+float Quadric::Evaluate(const Vector3& point) const
+{
+    double x = point.x, y = point.y, z = point.z;
+    double result = a2 * x * x + 2.0 * ab * x * y + 2.0 * ac * x * z + 2.0 * ad * x + b2 * y * y + 2.0 * bc * y * z + 2.0 * bd * y + c2 * z * z + 2.0 * cd * z + d2;
+    return (result > 0.0 && weight > 0.0) ? (float)(result / weight) : 0.0f;
+}
+
+MeshSimplifier::MeshSimplifier() :
+    positions(nullptr),
+    normals(nullptr),
+    texCoords(nullptr),
+    attributeScale(0.0f),
+    maxError(0.0f),
+    numTriangles(0)
+{
+}
+
+void MeshSimplifier::SetMesh(const unsigned* indices_, size_t numIndices, const Vector3* positions_, const Vector3* normals_, const Vector2* texCoords_, size_t numVertices)
+{
+    ZoneScoped;
+
+    positions = positions_;
+    normals = normals_;
+    texCoords = texCoords_;
+    maxError = 0.0f;
+    numTriangles = 0;
+
+    indices.assign(indices_, indices_ + numIndices / 3 * 3);
+    vertexTriangles.clear();
+    vertexTriangles.resize(numVertices);
+    quadrics.clear();
+    quadrics.resize(numVertices);
+    kinds.assign(numVertices, KIND_REMOVED);
+    remap.assign(numVertices, M_MAX_UNSIGNED);
+    borderNext.assign(numVertices, M_MAX_UNSIGNED);
+    borderPrev.assign(numVertices, M_MAX_UNSIGNED);
+    versions.assign(numVertices, 0);
+    queue.clear();
+
+    // Degenerate triangles are dropped from the start
+    std::vector<unsigned> usedVertices;
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        unsigned* tri = &indices[i];
+        if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2])
+        {
+            tri[0] = M_MAX_UNSIGNED;
+            continue;
+        }
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            if (kinds[tri[j]] == KIND_REMOVED)
+            {
+                kinds[tri[j]] = KIND_MANIFOLD;
+                usedVertices.push_back(tri[j]);
+            }
+            vertexTriangles[tri[j]].push_back((unsigned)(i / 3));
+        }
+        ++numTriangles;
+    }
+
+    // Weld the used vertices by position. Vertices that share a position with different attributes form a seam and are locked
+    std::sort(usedVertices.begin(), usedVertices.end(), [&](unsigned lhs, unsigned rhs)
+    {
+        const Vector3& a = positions[lhs];
+        const Vector3& b = positions[rhs];
+        if (a.x != b.x)
+            return a.x < b.x;
+        if (a.y != b.y)
+            return a.y < b.y;
+        if (a.z != b.z)
+            return a.z < b.z;
+        return lhs < rhs;
+    });
+
+    BoundingBox box;
+    for (size_t i = 0; i < usedVertices.size();)
+    {
+        size_t end = i + 1;
+        while (end < usedVertices.size() && positions[usedVertices[end]] == positions[usedVertices[i]])
+            ++end;
+
+        for (size_t j = i; j < end; ++j)
+        {
+            remap[usedVertices[j]] = usedVertices[i];
+            if (end - i > 1)
+                kinds[usedVertices[j]] = KIND_LOCKED;
+        }
+
+        box.Merge(positions[usedVertices[i]]);
+        i = end;
+    }
+
+    attributeScale = usedVertices.size() ? box.Size().LengthSquared() : 0.0f;
+
+    // Find the open borders from the welded directed edges that have no opposite edge. An edge used twice in the same direction is not manifold
+    std::vector<unsigned long long> edges;
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        const unsigned* tri = &indices[i];
+        if (tri[0] == M_MAX_UNSIGNED)
+            continue;
+
+        for (size_t j = 0; j < 3; ++j)
+            edges.push_back(EdgeKey(remap[tri[j]], remap[tri[(j + 1) % 3]]));
+    }
+    std::sort(edges.begin(), edges.end());
+
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        const unsigned* tri = &indices[i];
+        if (tri[0] == M_MAX_UNSIGNED)
+            continue;
+
+        const Vector3& v0 = positions[tri[0]];
+        Vector3 normal = (positions[tri[1]] - v0).CrossProduct(positions[tri[2]] - v0);
+        float length = normal.Length();
+        if (length < M_EPSILON)
+            continue;
+        normal /= length;
+
+        for (size_t j = 0; j < 3; ++j)
+            quadrics[tri[j]].AddPlane(normal, -normal.DotProduct(v0), 1.0f);
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            unsigned from = remap[tri[j]];
+            unsigned to = remap[tri[(j + 1) % 3]];
+            auto range = std::equal_range(edges.begin(), edges.end(), EdgeKey(from, to));
+            if (range.second - range.first > 1)
+            {
+                kinds[from] = KIND_LOCKED;
+                kinds[to] = KIND_LOCKED;
+                continue;
+            }
+            if (std::binary_search(edges.begin(), edges.end(), EdgeKey(to, from)))
+                continue;
+
+            // A vertex on several borders is locked
+            if (borderNext[from] != M_MAX_UNSIGNED || borderPrev[to] != M_MAX_UNSIGNED)
+            {
+                kinds[from] = KIND_LOCKED;
+                kinds[to] = KIND_LOCKED;
+            }
+            borderNext[from] = to;
+            borderPrev[to] = from;
+
+            // Keep the border in place with a plane through it, perpendicular to the triangle
+            const Vector3& p0 = positions[from];
+            Vector3 borderNormal = (positions[to] - p0).CrossProduct(normal).Normalized();
+            float d = -borderNormal.DotProduct(p0);
+            quadrics[from].AddPlane(borderNormal, d, BORDER_PLANE_WEIGHT);
+            quadrics[to].AddPlane(borderNormal, d, BORDER_PLANE_WEIGHT);
+        }
+    }
+
+    for (auto it = usedVertices.begin(); it != usedVertices.end(); ++it)
+    {
+        unsigned vertex = *it;
+        if (kinds[vertex] != KIND_MANIFOLD)
+            continue;
+
+        unsigned welded = remap[vertex];
+        bool hasNext = borderNext[welded] != M_MAX_UNSIGNED;
+        bool hasPrev = borderPrev[welded] != M_MAX_UNSIGNED;
+        if (hasNext && hasPrev)
+            kinds[vertex] = KIND_BORDER;
+        else if (hasNext || hasPrev)
+            kinds[vertex] = KIND_LOCKED;
+    }
+
+    for (auto it = usedVertices.begin(); it != usedVertices.end(); ++it)
+        QueueCollapse(*it);
+}
+
+size_t MeshSimplifier::Simplify(size_t targetTriangles)
+{
+    ZoneScoped;
+
+    while (numTriangles > targetTriangles && queue.size())
+    {
+        std::pop_heap(queue.begin(), queue.end(), CompareCollapses);
+        EdgeCollapse collapse = queue.back();
+        queue.pop_back();
+
+        if (kinds[collapse.from] == KIND_REMOVED || collapse.version != versions[collapse.from])
+            continue;
+
+        // The neighbourhood may have changed since queuing without requeuing this vertex, so check again
+        if (!IsValidCollapse(collapse.from, collapse.to))
+        {
+            QueueCollapse(collapse.from);
+            continue;
+        }
+
+        maxError = Max(maxError, collapse.error);
+        Collapse(collapse.from, collapse.to);
+    }
+
+    return numTriangles;
+}
+
+void MeshSimplifier::GetIndices(std::vector<unsigned>& dest) const
+{
+    dest.clear();
+    dest.reserve(numTriangles * 3);
+
+    for (size_t i = 0; i < indices.size(); i += 3)
+    {
+        if (indices[i] != M_MAX_UNSIGNED)
+            dest.insert(dest.end(), indices.begin() + i, indices.begin() + i + 3);
+    }
+}
+
+float MeshSimplifier::Error() const
+{
+    return sqrtf(maxError);
+}
+
+void MeshSimplifier::QueueCollapse(unsigned vertex)
+{
+    ++versions[vertex];
+
+    unsigned char kind = kinds[vertex];
+    if (kind != KIND_MANIFOLD && kind != KIND_BORDER)
+        return;
+
+    EdgeCollapse best;
+    best.cost = M_INFINITY;
+
+    const std::vector<unsigned>& triangles = vertexTriangles[vertex];
+    for (auto it = triangles.begin(); it != triangles.end(); ++it)
+    {
+        const unsigned* tri = &indices[*it * 3];
+        for (size_t i = 0; i < 3; ++i)
+        {
+            unsigned to = tri[i];
+            if (to == vertex || !IsValidCollapse(vertex, to))
+                continue;
+
+            float error;
+            float cost = CollapseCost(vertex, to, error);
+            if (cost < best.cost)
+            {
+                best.cost = cost;
+                best.error = error;
+                best.to = to;
+            }
+        }
+    }
+
+    if (best.cost < M_INFINITY)
+    {
+        best.from = vertex;
+        best.version = versions[vertex];
+        queue.push_back(best);
+        std::push_heap(queue.begin(), queue.end(), CompareCollapses);
+    }
+}
+
+bool MeshSimplifier::IsValidCollapse(unsigned from, unsigned to) const
+{
+    unsigned char kind = kinds[from];
+    if ((kind != KIND_MANIFOLD && kind != KIND_BORDER) || kinds[to] == KIND_REMOVED)
+        return false;
+
+    // A border vertex may only move along its border
+    unsigned weldedFrom = remap[from];
+    unsigned weldedTo = remap[to];
+    if (kind == KIND_BORDER && borderNext[weldedFrom] != weldedTo && borderPrev[weldedFrom] != weldedTo)
+        return false;
+
+    // The vertices may only share the neighbours of the triangles on the edge, or the result would not be manifold. Triangles must not flip
+    const std::vector<unsigned>& fromTriangles = vertexTriangles[from];
+    const std::vector<unsigned>& toTriangles = vertexTriangles[to];
+    unsigned edgeTriangles = 0;
+    unsigned sharedNeighbours = 0;
+
+    for (auto it = fromTriangles.begin(); it != fromTriangles.end(); ++it)
+    {
+        const unsigned* tri = &indices[*it * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+        {
+            ++edgeTriangles;
+            continue;
+        }
+
+        Vector3 v[3];
+        for (size_t i = 0; i < 3; ++i)
+            v[i] = positions[tri[i]];
+        Vector3 oldNormal = (v[1] - v[0]).CrossProduct(v[2] - v[0]);
+        for (size_t i = 0; i < 3; ++i)
+        {
+            if (tri[i] == from)
+                v[i] = positions[to];
+        }
+        Vector3 newNormal = (v[1] - v[0]).CrossProduct(v[2] - v[0]);
+        if (oldNormal.DotProduct(newNormal) <= 0.0f)
+            return false;
+
+        for (size_t i = 0; i < 3; ++i)
+        {
+            unsigned neighbour = tri[i];
+            if (neighbour == from)
+                continue;
+
+            for (auto jt = toTriangles.begin(); jt != toTriangles.end(); ++jt)
+            {
+                const unsigned* toTri = &indices[*jt * 3];
+                if (remap[toTri[0]] == remap[neighbour] || remap[toTri[1]] == remap[neighbour] || remap[toTri[2]] == remap[neighbour])
+                {
+                    ++sharedNeighbours;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Each non-edge triangle visits its two other vertices, and the neighbours next to the edge triangles are visited twice
+    if (!edgeTriangles)
+        return false;
+    return sharedNeighbours <= edgeTriangles * 2;
+}
+
+float MeshSimplifier::CollapseCost(unsigned from, unsigned to, float& error) const
+{
+    error = quadrics[from].Evaluate(positions[to]);
+
+    float attributeError = 0.0f;
+    if (normals)
+        attributeError += (normals[from] - normals[to]).LengthSquared() * NORMAL_ERROR_WEIGHT;
+    if (texCoords)
+        attributeError += (texCoords[from] - texCoords[to]).LengthSquared() * TEXCOORD_ERROR_WEIGHT;
+
+    return error + attributeError * attributeScale;
+}
+
+void MeshSimplifier::Collapse(unsigned from, unsigned to)
+{
+    std::vector<unsigned> triangles;
+    triangles.swap(vertexTriangles[from]);
+
+    for (auto it = triangles.begin(); it != triangles.end(); ++it)
+    {
+        unsigned* tri = &indices[*it * 3];
+        if (tri[0] == to || tri[1] == to || tri[2] == to)
+        {
+            for (size_t i = 0; i < 3; ++i)
+            {
+                if (tri[i] != from)
+                    RemoveVertexTriangle(tri[i], *it);
+            }
+            tri[0] = M_MAX_UNSIGNED;
+            --numTriangles;
+        }
+        else
+        {
+            for (size_t i = 0; i < 3; ++i)
+            {
+                if (tri[i] == from)
+                    tri[i] = to;
+            }
+            vertexTriangles[to].push_back(*it);
+        }
+    }
+
+    quadrics[to] += quadrics[from];
+
+    // Shorten the border by the removed vertex
+    if (kinds[from] == KIND_BORDER)
+    {
+        unsigned weldedFrom = remap[from];
+        unsigned weldedTo = remap[to];
+        if (borderNext[weldedFrom] == weldedTo)
+        {
+            unsigned prev = borderPrev[weldedFrom];
+            borderNext[prev] = weldedTo;
+            borderPrev[weldedTo] = prev;
+        }
+        else
+        {
+            unsigned next = borderNext[weldedFrom];
+            borderPrev[next] = weldedTo;
+            borderNext[weldedTo] = next;
+        }
+    }
+
+    kinds[from] = KIND_REMOVED;
+
+    // The collapse target's quadric and all its neighbours' triangles have changed
+    const std::vector<unsigned>& toTriangles = vertexTriangles[to];
+    std::vector<unsigned> affected;
+    affected.push_back(to);
+    for (auto it = toTriangles.begin(); it != toTriangles.end(); ++it)
+    {
+        const unsigned* tri = &indices[*it * 3];
+        for (size_t i = 0; i < 3; ++i)
+        {
+            if (std::find(affected.begin(), affected.end(), tri[i]) == affected.end())
+                affected.push_back(tri[i]);
+        }
+    }
+
+    for (auto it = affected.begin(); it != affected.end(); ++it)
+        QueueCollapse(*it);
+}
+
+void MeshSimplifier::RemoveVertexTriangle(unsigned vertex, unsigned triangle)
+{
+    std::vector<unsigned>& triangles = vertexTriangles[vertex];
+    auto it = std::find(triangles.begin(), triangles.end(), triangle);
+    if (it != triangles.end())
+    {
+        *it = triangles.back();
+        triangles.pop_back();
+    }
+}
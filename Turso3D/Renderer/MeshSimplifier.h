@@ -0,0 +1,105 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Vector2.h"
+#include "../Math/Vector3.h"
+
+#include <vector>
+
+/// Symmetric 4x4 error quadric of a set of planes.
+struct Quadric
+{
+    /// Construct as zero.
+    Quadric();
+
+    /// Add a plane with weight.
+    void AddPlane(const Vector3& normal, float d, float planeWeight);
+    /// Add another quadric.
+    Quadric& operator += (const Quadric& rhs);
+    /// Return the weighted average of squared distances of a point to the planes.
+    float Evaluate(const Vector3& point) const;
+
+    /// Matrix elements in row order, upper triangle only.
+    double a2, ab, ac, ad, b2, bc, bd, c2, cd, d2;
+    /// Sum of plane weights.
+    double weight;
+};
+
+/// Candidate edge collapse in the simplifier's queue.
+struct EdgeCollapse
+{
+    /// Total cost including the attribute error, used for ordering.
+    float cost;
+    /// Geometric part of the cost as squared distance.
+    float error;
+    /// Vertex to remove.
+    unsigned from;
+    /// Vertex to collapse onto.
+    unsigned to;
+    /// Version of the removed vertex's candidate when queued.
+    unsigned version;
+};
+
+/// Quadric error metric mesh simplifier. Collapses vertices onto their neighbours, so that the simplified triangle lists refer to the original vertices and can share the vertex buffer. Can be run repeatedly with decreasing targets to build a LOD chain. Vertices on texture or normal seams, and vertices that are not manifold, are kept in place. Open borders are only collapsed along themselves.
+class MeshSimplifier
+{
+public:
+    /// Construct.
+    MeshSimplifier();
+
+    /// Set the source triangle list and vertex data. Normals and texcoords are optional, and add an attribute error to the collapse cost when given.
+    void SetMesh(const unsigned* indices, size_t numIndices, const Vector3* positions, const Vector3* normals, const Vector2* texCoords, size_t numVertices);
+    /// Collapse edges in order of cost until at most the target number of triangles remains, or no valid collapse is left. Return the remaining triangle count.
+    size_t Simplify(size_t targetTriangles);
+    /// Return the current triangle list.
+    void GetIndices(std::vector<unsigned>& dest) const;
+
+    /// Return the current triangle count.
+    size_t NumTriangles() const { return numTriangles; }
+    /// Return the largest geometric error of the collapses so far as a model space distance.
+    float Error() const;
+
+private:
+    /// Find the cheapest valid collapse of a vertex and queue it. Invalidates the vertex's earlier queued collapse.
+    void QueueCollapse(unsigned vertex);
+    /// Return whether a collapse is valid with the current triangles.
+    bool IsValidCollapse(unsigned from, unsigned to) const;
+    /// Return the total and geometric cost of a collapse.
+    float CollapseCost(unsigned from, unsigned to, float& error) const;
+    /// Collapse a vertex onto another and requeue the affected vertices.
+    void Collapse(unsigned from, unsigned to);
+    /// Remove a triangle from a vertex's triangle list.
+    void RemoveVertexTriangle(unsigned vertex, unsigned triangle);
+
+    /// Vertex positions.
+    const Vector3* positions;
+    /// Optional vertex normals.
+    const Vector3* normals;
+    /// Optional vertex texcoords.
+    const Vector2* texCoords;
+    /// Triangle indices. Removed triangles have their first index set to M_MAX_UNSIGNED.
+    std::vector<unsigned> indices;
+    /// Triangles using each vertex.
+    std::vector<std::vector<unsigned> > vertexTriangles;
+    /// Quadric of each vertex.
+    std::vector<Quadric> quadrics;
+    /// Vertex kinds.
+    std::vector<unsigned char> kinds;
+    /// Position-welded vertex of each vertex, shared by the vertices on a seam.
+    std::vector<unsigned> remap;
+    /// Next welded vertex along an open border, or M_MAX_UNSIGNED.
+    std::vector<unsigned> borderNext;
+    /// Previous welded vertex along an open border, or M_MAX_UNSIGNED.
+    std::vector<unsigned> borderPrev;
+    /// Collapse candidate version of each vertex.
+    std::vector<unsigned> versions;
+    /// Queued collapses as a min-heap on cost.
+    std::vector<EdgeCollapse> queue;
+    /// Scale applied to the attribute error to bring it to squared model space distance.
+    float attributeScale;
+    /// Largest geometric error of the collapses so far as squared distance.
+    float maxError;
+    /// Current triangle count.
+    size_t numTriangles;
+};
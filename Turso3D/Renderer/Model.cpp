@@ -1,25 +1,200 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
 #include "../IO/Log.h"
+#include "../IO/MappedFile.h"
+#include "../Graphics/Graphics.h"
 #include "../Graphics/IndexBuffer.h"
 #include "../Graphics/VertexBuffer.h"
+#include "../Math/Half.h"
+#include "../Math/PackedVector.h"
 #include "../Scene/Node.h"
 #include "GeometryNode.h"
+#include "Impostor.h"
 #include "Material.h"
+#include "MeshOptimizer.h"
+#include "MeshSimplifier.h"
 #include "Model.h"
 
+#include <algorithm>
+#include <cstring>
 #include <tracy/Tracy.hpp>
 
-// Vertex and index allocation for the combined model buffers
-static const size_t COMBINEDBUFFER_VERTICES = 384 * 1024;
-static const size_t COMBINEDBUFFER_INDICES = 1024 * 1024;
-
 // Bone bounding box size required to contribute to bounding box recalculation
 static const float BONE_SIZE_THRESHOLD = 0.05f;
 
+// Meshlet size limits, matching common mesh shader limits
+static const size_t MESHLET_MAX_VERTICES = 64;
+static const size_t MESHLET_MAX_TRIANGLES = 124;
+// Smallest geometry in triangles that is partitioned into meshlets
+static const size_t MESHLET_MIN_TRIANGLES = 4 * MESHLET_MAX_TRIANGLES;
+
+// Smallest triangle count to generate LOD levels for
+static const size_t LOD_MIN_TRIANGLES = 64;
+// A generated LOD level must reduce the triangle count at least this much from the previous level to be kept
+static const float LOD_MIN_REDUCTION = 0.9f;
+// Pixels per unit of world space size at unit distance for 1080 pixels vertical resolution and the default 45 degree FOV, to convert simplification error to LOD distance
+static const float LOD_REFERENCE_PIXELS = 1080.0f / (2.0f * 0.41421356f);
+
+// Vertex elements of the model format in element mask bit order
+static const VertexElement modelElements[] =
+{
+    VertexElement(ELEM_VECTOR3, SEM_POSITION),
+    VertexElement(ELEM_VECTOR3, SEM_NORMAL),
+    VertexElement(ELEM_UBYTE4, SEM_COLOR),
+    VertexElement(ELEM_VECTOR2, SEM_TEXCOORD),
+    VertexElement(ELEM_VECTOR2, SEM_TEXCOORD, 1),
+    VertexElement(ELEM_VECTOR3, SEM_TEXCOORD),
+    VertexElement(ELEM_VECTOR3, SEM_TEXCOORD, 1),
+    VertexElement(ELEM_VECTOR4, SEM_TANGENT),
+    VertexElement(ELEM_VECTOR4, SEM_BLENDWEIGHTS),
+    VertexElement(ELEM_UBYTE4, SEM_BLENDINDICES)
+};
+
+static const size_t NUM_MODEL_ELEMENTS = sizeof(modelElements) / sizeof(modelElements[0]);
+
+// Cooked model format version
+static const unsigned COOKED_VERSION = 2;
+// Morph delta element mask bits, matching the vertex element mask bits of the model format
+static const unsigned MORPH_POSITION = 0x1;
+static const unsigned MORPH_NORMAL = 0x2;
+static const unsigned MORPH_TANGENT = 0x80;
+// Alignment of the vertex, index and meshlet blobs in a cooked model
+static const size_t COOKED_ALIGNMENT = 16;
+// Size of the cooked model header before the first blob
+static const size_t COOKED_HEADER_SIZE = 16;
+
 std::map<unsigned, std::vector<WeakPtr<CombinedBuffer> > > CombinedBuffer::buffers;
+bool Model::defaultVertexCompression = false;
+bool Model::defaultPositionStreams = false;
+bool Model::defaultMeshletGeneration = false;
+bool Model::defaultMeshOptimization = false;
+bool Model::defaultOverdrawOptimization = false;
+unsigned Model::defaultLodGenerationLevels = 0;
+float Model::defaultLodGenerationRatio = 0.5f;
+float Model::defaultLodGenerationPixelError = 1.0f;
+
+/// Read a range of index data as 32-bit indices. Return false if the range or an index is out of bounds.
+static bool ReadIndices(const IndexBufferDesc& ibDesc, size_t start, size_t count, size_t numVertices, std::vector<unsigned>& dest)
+{
+    if (start + count > ibDesc.numIndices)
+        return false;
+
+    dest.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (ibDesc.indexSize == sizeof(unsigned short))
+            dest[i] = ((const unsigned short*)ibDesc.indexData.Get())[start + i];
+        else
+            dest[i] = ((const unsigned*)ibDesc.indexData.Get())[start + i];
+
+        if (dest[i] >= numVertices)
+            return false;
+    }
+
+    return true;
+}
+
+/// Write 32-bit indices to index data at a position, converting to its index size.
+static void WriteIndices(IndexBufferDesc& ibDesc, size_t start, const std::vector<unsigned>& indices)
+{
+    for (size_t i = 0; i < indices.size(); ++i)
+    {
+        if (ibDesc.indexSize == sizeof(unsigned short))
+            ((unsigned short*)ibDesc.indexData.Get())[start + i] = (unsigned short)indices[i];
+        else
+            ((unsigned*)ibDesc.indexData.Get())[start + i] = indices[i];
+    }
+}
+
+/// Round up a cooked model blob offset to the blob alignment.
+static size_t AlignCookedOffset(size_t offset)
+{
+    return (offset + COOKED_ALIGNMENT - 1) & ~(COOKED_ALIGNMENT - 1);
+}
+
+/// Write zero bytes to advance a stream to a target position.
+static void WritePadding(Stream& dest, size_t& position, size_t target)
+{
+    static const unsigned char zeros[COOKED_ALIGNMENT] = { 0 };
+
+    while (position < target)
+    {
+        size_t numBytes = Min(target - position, COOKED_ALIGNMENT);
+        dest.Write(zeros, numBytes);
+        position += numBytes;
+    }
+}
+
+static bool SameElementTypes(const std::vector<VertexElement>& lhs, const std::vector<VertexElement>& rhs)
+{
+    if (lhs.size() != rhs.size())
+        return false;
+
+    for (size_t i = 0; i < lhs.size(); ++i)
+    {
+        if (lhs[i].type != rhs[i].type)
+            return false;
+    }
+
+    return true;
+}
+
+/// Find the smallest free range that fits a count. Return its index, or M_MAX_UNSIGNED if none fits.
+static size_t FindFreeRange(const std::vector<BufferRange>& freeRanges, size_t count)
+{
+    size_t best = M_MAX_UNSIGNED;
+    for (size_t i = 0; i < freeRanges.size(); ++i)
+    {
+        if (freeRanges[i].count >= count && (best == M_MAX_UNSIGNED || freeRanges[i].count < freeRanges[best].count))
+        {
+            best = i;
+            if (freeRanges[i].count == count)
+                break;
+        }
+    }
+
+    return best;
+}
+
+/// Take a count from the start of a free range found with FindFreeRange(). Return the start of the taken range.
+static size_t TakeFreeRange(std::vector<BufferRange>& freeRanges, size_t index, size_t count)
+{
+    BufferRange& range = freeRanges[index];
+    size_t start = range.start;
+    range.start += count;
+    range.count -= count;
+    if (!range.count)
+        freeRanges.erase(freeRanges.begin() + index);
+    return start;
+}
+
+/// Return a range to a free list sorted by start, merging it with the adjacent free ranges.
+static void ReturnFreeRange(std::vector<BufferRange>& freeRanges, size_t start, size_t count)
+{
+    if (!count)
+        return;
+
+    auto it = std::lower_bound(freeRanges.begin(), freeRanges.end(), start, [](const BufferRange& range, size_t value) { return range.start < value; });
+    it = freeRanges.insert(it, BufferRange(start, count));
+
+    auto next = it + 1;
+    if (next != freeRanges.end() && it->start + it->count == next->start)
+    {
+        it->count += next->count;
+        freeRanges.erase(next);
+    }
+    if (it != freeRanges.begin())
+    {
+        auto prev = it - 1;
+        if (prev->start + prev->count == it->start)
+        {
+            prev->count += it->count;
+            freeRanges.erase(it);
+        }
+    }
+}
 
-CombinedBuffer::CombinedBuffer(const std::vector<VertexElement>& elements) :
+CombinedBuffer::CombinedBuffer(const std::vector<VertexElement>& elements, bool positionStream) :
     usedVertices(0),
     usedIndices(0)
 {
@@ -27,30 +202,65 @@ CombinedBuffer::CombinedBuffer(const std::vector<VertexElement>& elements) :
     vertexBuffer->Define(USAGE_DEFAULT, COMBINEDBUFFER_VERTICES, elements);
     indexBuffer = new IndexBuffer();
     indexBuffer->Define(USAGE_DEFAULT, COMBINEDBUFFER_INDICES, sizeof(unsigned));
+
+    if (positionStream)
+    {
+        std::vector<VertexElement> positionElements;
+        positionElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+        positionBuffer = new VertexBuffer();
+        positionBuffer->Define(USAGE_DEFAULT, COMBINEDBUFFER_VERTICES, positionElements);
+    }
+
+    freeVertices.push_back(BufferRange(0, COMBINEDBUFFER_VERTICES));
+    freeIndices.push_back(BufferRange(0, COMBINEDBUFFER_INDICES));
 }
 
-bool CombinedBuffer::FillVertices(size_t numVertices, const void* data)
+bool CombinedBuffer::FillVertices(size_t vertexStart, size_t numVertices, const void* data, const Vector3* positionData)
 {
-    if (usedVertices + numVertices > vertexBuffer->NumVertices())
+    if (vertexStart + numVertices > vertexBuffer->NumVertices())
         return false;
 
-    vertexBuffer->SetData(usedVertices, numVertices, data);
-    usedVertices += numVertices;
+    vertexBuffer->SetData(vertexStart, numVertices, data);
+    if (positionBuffer && positionData)
+        positionBuffer->SetData(vertexStart, numVertices, positionData);
+    return true;
+}
+
+bool CombinedBuffer::FillIndices(size_t indexStart, size_t numIndices, const void* data)
+{
+    if (indexStart + numIndices > indexBuffer->NumIndices())
+        return false;
+
+    indexBuffer->SetData(indexStart, numIndices, data);
     return true;
 }
 
-bool CombinedBuffer::FillIndices(size_t numIndices, const void* data)
+void CombinedBuffer::Free(size_t vertexStart, size_t numVertices, size_t indexStart, size_t numIndices)
 {
-    if (usedIndices + numIndices > indexBuffer->NumIndices())
+    ReturnFreeRange(freeVertices, vertexStart, numVertices);
+    ReturnFreeRange(freeIndices, indexStart, numIndices);
+    usedVertices -= numVertices;
+    usedIndices -= numIndices;
+}
+
+bool CombinedBuffer::Reserve(size_t numVertices, size_t numIndices, size_t& vertexStart, size_t& indexStart)
+{
+    // Empty ranges need no space
+    size_t vertexRange = numVertices ? FindFreeRange(freeVertices, numVertices) : 0;
+    size_t indexRange = numIndices ? FindFreeRange(freeIndices, numIndices) : 0;
+    if (vertexRange == M_MAX_UNSIGNED || indexRange == M_MAX_UNSIGNED)
         return false;
 
-    indexBuffer->SetData(usedIndices, numIndices, data);
+    vertexStart = numVertices ? TakeFreeRange(freeVertices, vertexRange, numVertices) : 0;
+    indexStart = numIndices ? TakeFreeRange(freeIndices, indexRange, numIndices) : 0;
+    usedVertices += numVertices;
     usedIndices += numIndices;
     return true;
 }
 
-CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& elements, size_t numVertices, size_t numIndices)
+CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& elements, size_t numVertices, size_t numIndices, bool positionStream, size_t& vertexStart, size_t& indexStart)
 {
+    // Compressed and uncompressed vertices share the attribute mask, so also compare the element types
     unsigned key = VertexBuffer::CalculateAttributeMask(elements);
     auto it = buffers.find(key);
     if (it != buffers.end())
@@ -67,7 +277,7 @@ CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& eleme
                 continue;
             }
 
-            if (buffer->usedVertices + numVertices <= buffer->vertexBuffer->NumVertices() && buffer->usedIndices + numIndices <= buffer->indexBuffer->NumIndices())
+            if (SameElementTypes(buffer->vertexBuffer->Elements(), elements) && (buffer->positionBuffer.Get() != nullptr) == positionStream && buffer->Reserve(numVertices, numIndices, vertexStart, indexStart))
                 return buffer;
 
             ++i;
@@ -76,7 +286,7 @@ CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& eleme
 
     // No existing buffer, make new
     LOGDEBUGF("Creating new combined buffer for attribute mask %d", key);
-    CombinedBuffer* buffer = new CombinedBuffer(elements);
+    CombinedBuffer* buffer = new CombinedBuffer(elements, positionStream);
 
 #ifdef _DEBUG
     if (it != buffers.end())
@@ -84,11 +294,13 @@ CombinedBuffer* CombinedBuffer::Allocate(const std::vector<VertexElement>& eleme
         for (auto vIt = it->second.begin(); vIt != it->second.end(); ++vIt)
         {
             CombinedBuffer* prevBuffer = vIt->Get();
-            LOGDEBUGF("Previous buffer use %d/%d %d/%d", prevBuffer->usedVertices, prevBuffer->vertexBuffer->NumVertices(), prevBuffer->usedIndices, prevBuffer->indexBuffer->NumIndices());
+            LOGDEBUGF("Previous buffer use %d/%d %d/%d in %d/%d free ranges", prevBuffer->usedVertices, prevBuffer->vertexBuffer->NumVertices(), prevBuffer->usedIndices, prevBuffer->indexBuffer->NumIndices(),
+                prevBuffer->freeVertices.size(), prevBuffer->freeIndices.size());
         }
     }
 #endif
 
+    buffer->Reserve(numVertices, numIndices, vertexStart, indexStart);
     buffers[key].push_back(buffer);
     return buffer;
 }
@@ -109,12 +321,24 @@ ModelBone::~ModelBone()
 {
 }
 
-Model::Model()
+Model::Model() :
+    allBonesActive(true),
+    cpuDataSize(0),
+    occluderMeshValid(false),
+    vertexCompression(defaultVertexCompression),
+    positionStreams(defaultPositionStreams),
+    meshletGeneration(defaultMeshletGeneration),
+    meshOptimization(defaultMeshOptimization),
+    overdrawOptimization(defaultOverdrawOptimization),
+    lodGenerationLevels(defaultLodGenerationLevels),
+    lodGenerationRatio(defaultLodGenerationRatio),
+    lodGenerationPixelError(defaultLodGenerationPixelError)
 {
 }
 
 Model::~Model()
 {
+    ReleaseCombinedBuffer();
 }
 
 void Model::RegisterObject()
@@ -126,17 +350,24 @@ bool Model::BeginLoad(Stream& source)
 {
     ZoneScoped;
 
-    /// \todo Develop own format for Turso3D
-    if (source.ReadFileID() != "UMDL")
+    vbDescs.clear();
+    ibDescs.clear();
+    geomDescs.clear();
+    morphDescs.clear();
+    morphs.clear();
+    cookedFile.Reset();
+    cookedData.Reset();
+
+    std::string fileID = source.ReadFileID();
+    if (fileID == "TMDL")
+        return BeginLoadCooked(source);
+
+    if (fileID != "UMDL")
     {
         LOGERROR(source.Name() + " is not a valid model file");
         return false;
     }
 
-    vbDescs.clear();
-    ibDescs.clear();
-    geomDescs.clear();
-
     size_t numVertexBuffers = source.Read<unsigned>();
     vbDescs.resize(numVertexBuffers);
     for (size_t i = 0; i < numVertexBuffers; ++i)
@@ -149,58 +380,17 @@ bool Model::BeginLoad(Stream& source)
         source.Read<unsigned>(); // morphRangeCount
 
         size_t vertexSize = 0;
-        if (elementMask & 1)
-        {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
-            vertexSize += sizeof(Vector3);
-        }
-        if (elementMask & 2)
-        {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_NORMAL));
-            vertexSize += sizeof(Vector3);
-        }
-        if (elementMask & 4)
-        {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_UBYTE4, SEM_COLOR));
-            vertexSize += 4;
-        }
-        if (elementMask & 8)
-        {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_VECTOR2, SEM_TEXCOORD));
-            vertexSize += sizeof(Vector2);
-        }
-        if (elementMask & 16)
-        {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_VECTOR2, SEM_TEXCOORD, 1));
-            vertexSize += sizeof(Vector2);
-        }
-        if (elementMask & 32)
+        for (size_t j = 0; j < NUM_MODEL_ELEMENTS; ++j)
         {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_TEXCOORD));
-            vertexSize += sizeof(Vector3);
-        }
-        if (elementMask & 64)
-        {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_TEXCOORD, 1));
-            vertexSize += sizeof(Vector3);
-        }
-        if (elementMask & 128)
-        {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TANGENT));
-            vertexSize += sizeof(Vector4);
-        }
-        if (elementMask & 256)
-        {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_BLENDWEIGHTS));
-            vertexSize += sizeof(Vector4);
-        }
-        if (elementMask & 512)
-        {
-            vbDesc.vertexElements.push_back(VertexElement(ELEM_UBYTE4, SEM_BLENDINDICES));
-            vertexSize += 4;
+            if (elementMask & (1 << j))
+            {
+                vbDesc.vertexElements.push_back(modelElements[j]);
+                vertexSize += VertexBuffer::VertexElementSize(modelElements[j]);
+            }
         }
 
         vbDesc.vertexSize = vertexSize;
+        vbDesc.cookedVertexData = nullptr;
         vbDesc.vertexData = new unsigned char[vbDesc.numVertices * vertexSize];
         source.Read(&vbDesc.vertexData[0], vbDesc.numVertices * vertexSize);
 
@@ -260,12 +450,67 @@ bool Model::BeginLoad(Stream& source)
         }
     }
 
-    // Read (skip) morphs
-    size_t numMorphs = source.Read<unsigned>();
-    if (numMorphs)
-    {
-        LOGERROR("Models with vertex morphs are not supported for now");
+    // Read morphs before the load-time processing, as reordering the vertices remaps them
+    if (!ReadMorphs(source))
         return false;
+
+    if (lodGenerationLevels > 1)
+    {
+        for (size_t i = 0; i < geomDescs.size(); ++i)
+        {
+            if (geomDescs[i].size() == 1)
+                GenerateLodLevels(geomDescs[i]);
+        }
+    }
+
+    if (meshOptimization)
+        OptimizeIndices();
+
+    if (meshletGeneration)
+    {
+        std::vector<const GeometryDesc*> processedDescs;
+
+        for (size_t i = 0; i < geomDescs.size(); ++i)
+        {
+            for (size_t j = 0; j < geomDescs[i].size(); ++j)
+            {
+                GeometryDesc& geomDesc = geomDescs[i][j];
+
+                // A draw range shared with an earlier geometry has already been reordered, so reuse its meshlets
+                const GeometryDesc* sameRange = nullptr;
+                for (auto it = processedDescs.begin(); it != processedDescs.end(); ++it)
+                {
+                    const GeometryDesc* other = *it;
+                    if (other->vbRef == geomDesc.vbRef && other->ibRef == geomDesc.ibRef && other->drawStart == geomDesc.drawStart && other->drawCount == geomDesc.drawCount)
+                    {
+                        sameRange = other;
+                        break;
+                    }
+                }
+
+                if (sameRange)
+                    geomDesc.meshlets = sameRange->meshlets;
+                else
+                {
+                    BuildMeshlets(geomDesc);
+                    processedDescs.push_back(&geomDesc);
+                }
+            }
+        }
+    }
+
+    // Reorder vertices after all triangle reordering is done
+    if (meshOptimization)
+    {
+        for (size_t i = 0; i < vbDescs.size(); ++i)
+            OptimizeVertexFetch((unsigned)i);
+    }
+
+    // Compress last, as the LOD and meshlet generation read the uncompressed vertices
+    if (vertexCompression)
+    {
+        for (size_t i = 0; i < vbDescs.size(); ++i)
+            CompressVertices(vbDescs[i]);
     }
 
     // Read skeleton
@@ -297,12 +542,204 @@ bool Model::BeginLoad(Stream& source)
         }
     }
 
+    UpdateBoneBoundingBoxes();
+
     // Read bounding box
     boundingBox = source.Read<BoundingBox>();
 
     return true;
 }
 
+bool Model::BeginLoadCooked(Stream& source)
+{
+    size_t version = source.Read<unsigned>();
+    size_t metadataOffset = source.Read<unsigned>();
+    if (version != COOKED_VERSION)
+    {
+        LOGERROR(source.Name() + " has unsupported cooked model version");
+        return false;
+    }
+    if (metadataOffset < COOKED_HEADER_SIZE || metadataOffset > source.Size())
+    {
+        LOGERROR(source.Name() + " is not a valid cooked model file");
+        return false;
+    }
+
+    // Map the file so that vertex data can be uploaded without copying. If the stream is not a file, read the whole blob area at once instead
+    const unsigned char* blobs = nullptr;
+    cookedFile = new MappedFile(source.Name());
+    if (cookedFile->IsOpen() && cookedFile->Size() == source.Size())
+        blobs = cookedFile->Data();
+    else
+    {
+        cookedFile.Reset();
+        cookedData = new unsigned char[metadataOffset];
+        source.Seek(0);
+        if (source.Read(cookedData.Get(), metadataOffset) != metadataOffset)
+        {
+            LOGERROR("Failed to read cooked model data from " + source.Name());
+            return false;
+        }
+        blobs = cookedData.Get();
+    }
+
+    source.Seek(metadataOffset);
+
+    // Check that a blob is aligned and within the blob area
+    auto validBlob = [metadataOffset](size_t offset, size_t numBytes)
+    {
+        return offset % COOKED_ALIGNMENT == 0 && offset >= COOKED_HEADER_SIZE && offset <= metadataOffset && numBytes <= metadataOffset - offset;
+    };
+
+    size_t numVertexBuffers = source.Read<unsigned>();
+    vbDescs.resize(numVertexBuffers);
+    for (size_t i = 0; i < numVertexBuffers; ++i)
+    {
+        VertexBufferDesc& vbDesc = vbDescs[i];
+
+        vbDesc.numVertices = source.Read<unsigned>();
+        size_t numElements = source.Read<unsigned>();
+        if (numElements > MAX_VERTEX_ATTRIBUTES)
+        {
+            LOGERROR(source.Name() + " has too many vertex elements");
+            return false;
+        }
+
+        size_t vertexSize = 0;
+        for (size_t j = 0; j < numElements; ++j)
+        {
+            unsigned char type = source.Read<unsigned char>();
+            unsigned char semantic = source.Read<unsigned char>();
+            unsigned char index = source.Read<unsigned char>();
+            source.Read<unsigned char>(); // Padding
+            if (type >= MAX_ELEMENT_TYPES || semantic >= MAX_ELEMENT_SEMANTICS)
+            {
+                LOGERROR(source.Name() + " has invalid vertex elements");
+                return false;
+            }
+
+            vbDesc.vertexElements.push_back(VertexElement((ElementType)type, (ElementSemantic)semantic, index));
+            vertexSize += VertexBuffer::VertexElementSize(vbDesc.vertexElements.back());
+        }
+
+        size_t dataOffset = source.Read<unsigned>();
+        if (!validBlob(dataOffset, vbDesc.numVertices * vertexSize))
+        {
+            LOGERROR(source.Name() + " has vertex data out of bounds");
+            return false;
+        }
+
+        vbDesc.vertexSize = vertexSize;
+        vbDesc.cookedVertexData = blobs + dataOffset;
+
+        if (numElements && vbDesc.vertexElements[0].type == ELEM_VECTOR3 && vbDesc.vertexElements[0].semantic == SEM_POSITION)
+        {
+            vbDesc.cpuPositionData = new Vector3[vbDesc.numVertices];
+            for (size_t j = 0; j < vbDesc.numVertices; ++j)
+                vbDesc.cpuPositionData[j] = *reinterpret_cast<const Vector3*>(vbDesc.cookedVertexData + j * vertexSize);
+        }
+    }
+
+    // Index data is retained on the CPU, so it is copied
+    size_t numIndexBuffers = source.Read<unsigned>();
+    ibDescs.resize(numIndexBuffers);
+    for (size_t i = 0; i < numIndexBuffers; ++i)
+    {
+        IndexBufferDesc& ibDesc = ibDescs[i];
+
+        ibDesc.numIndices = source.Read<unsigned>();
+        ibDesc.indexSize = source.Read<unsigned>();
+        size_t dataOffset = source.Read<unsigned>();
+        if ((ibDesc.indexSize != sizeof(unsigned short) && ibDesc.indexSize != sizeof(unsigned)) || !validBlob(dataOffset, ibDesc.numIndices * ibDesc.indexSize))
+        {
+            LOGERROR(source.Name() + " has invalid index data");
+            return false;
+        }
+
+        ibDesc.indexData = new unsigned char[ibDesc.numIndices * ibDesc.indexSize];
+        memcpy(ibDesc.indexData.Get(), blobs + dataOffset, ibDesc.numIndices * ibDesc.indexSize);
+    }
+
+    size_t numGeometries = source.Read<unsigned>();
+    geomDescs.resize(numGeometries);
+    for (size_t i = 0; i < numGeometries; ++i)
+    {
+        size_t numLodLevels = source.Read<unsigned>();
+        geomDescs[i].resize(numLodLevels);
+
+        for (size_t j = 0; j < numLodLevels; ++j)
+        {
+            GeometryDesc& geomDesc = geomDescs[i][j];
+
+            geomDesc.lodDistance = source.Read<float>();
+            geomDesc.vbRef = source.Read<unsigned>();
+            geomDesc.ibRef = source.Read<unsigned>();
+            geomDesc.drawStart = source.Read<unsigned>();
+            geomDesc.drawCount = source.Read<unsigned>();
+            size_t numMeshlets = source.Read<unsigned>();
+            size_t meshletOffset = source.Read<unsigned>();
+
+            if (geomDesc.vbRef >= numVertexBuffers || geomDesc.ibRef >= numIndexBuffers || (size_t)geomDesc.drawStart + geomDesc.drawCount > ibDescs[geomDesc.ibRef].numIndices)
+            {
+                LOGERROR(source.Name() + " has invalid geometry draw range");
+                return false;
+            }
+
+            if (numMeshlets)
+            {
+                if (!validBlob(meshletOffset, numMeshlets * sizeof(Meshlet)))
+                {
+                    LOGERROR(source.Name() + " has meshlet data out of bounds");
+                    return false;
+                }
+
+                const Meshlet* meshlets = reinterpret_cast<const Meshlet*>(blobs + meshletOffset);
+                geomDesc.meshlets.assign(meshlets, meshlets + numMeshlets);
+                for (auto it = geomDesc.meshlets.begin(); it != geomDesc.meshlets.end(); ++it)
+                {
+                    if ((size_t)it->indexStart + it->indexCount > geomDesc.drawCount)
+                    {
+                        LOGERROR(source.Name() + " has invalid meshlet index range");
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+
+    if (!ReadMorphs(source))
+        return false;
+
+    size_t numBones = source.Read<unsigned>();
+    bones.resize(numBones);
+    for (size_t i = 0; i < numBones; ++i)
+    {
+        ModelBone& bone = bones[i];
+        bone.name = source.Read<std::string>();
+        bone.nameHash = StringHash(bone.name);
+        bone.parentIndex = source.Read<unsigned>();
+        bone.initialPosition = source.Read<Vector3>();
+        bone.initialRotation = source.Read<Quaternion>();
+        bone.initialScale = source.Read<Vector3>();
+        bone.offsetMatrix = source.Read<Matrix3x4>();
+        bone.radius = source.Read<float>();
+        bone.boundingBox = source.Read<BoundingBox>();
+        bone.active = source.Read<unsigned char>() != 0;
+
+        if (bone.parentIndex >= numBones)
+        {
+            LOGERROR(source.Name() + " has invalid bone parent index");
+            return false;
+        }
+    }
+
+    UpdateBoneBoundingBoxes();
+
+    boundingBox = source.Read<BoundingBox>();
+
+    return true;
+}
+
 void Model::ApplyBoneMappings(const GeometryDesc& geomDesc, const std::vector<unsigned>& boneMappings, std::set<std::pair<unsigned, unsigned> >& processedVertices)
 {
     ZoneScoped;
@@ -366,35 +803,312 @@ void Model::ApplyBoneMappings(const GeometryDesc& geomDesc, const std::vector<un
     }
 }
 
-bool Model::EndLoad()
+bool Model::Save(Stream& dest)
 {
     ZoneScoped;
 
-    bool hasWeights = false;
-    bool hasSameIndexSize = true;
-    size_t totalIndices = 0;
-
-    for (size_t i = 0; i < ibDescs.size(); ++i)
+    if (vbDescs.empty() && ibDescs.empty())
     {
-        totalIndices += ibDescs[i].numIndices;
-        if (ibDescs[i].indexSize != ibDescs[0].indexSize)
-            hasSameIndexSize = false;
+        LOGERROR("Model " + Name() + " has no load-time data to save");
+        return false;
     }
 
+    dest.WriteFileID("UMDL");
+
+    dest.Write((unsigned)vbDescs.size());
     for (auto it = vbDescs.begin(); it != vbDescs.end(); ++it)
     {
-        for (auto vIt = it->vertexElements.begin(); vIt != it->vertexElements.end(); ++vIt)
+        const VertexBufferDesc& vbDesc = *it;
+
+        unsigned elementMask = 0;
+        for (auto eIt = vbDesc.vertexElements.begin(); eIt != vbDesc.vertexElements.end(); ++eIt)
         {
-            if (vIt->semantic == SEM_BLENDWEIGHTS || vIt->semantic == SEM_BLENDINDICES)
+            unsigned bit = 0;
+            for (size_t i = 0; i < NUM_MODEL_ELEMENTS; ++i)
             {
-                hasWeights = true;
-                break;
+                if (modelElements[i].type == eIt->type && modelElements[i].semantic == eIt->semantic && modelElements[i].index == eIt->index)
+                {
+                    bit = 1 << i;
+                    break;
+                }
             }
-        }
+            if (!bit || bit <= elementMask)
+            {
+                LOGERROR("Model " + Name() + " has vertex elements that can not be saved, such as compressed elements");
+                return false;
+            }
+            elementMask |= bit;
+        }
+
+        // The morph range is the span of vertices affected by the morphs, which the format uses to limit copying
+        unsigned vbRef = (unsigned)(it - vbDescs.begin());
+        unsigned morphRangeStart = M_MAX_UNSIGNED;
+        unsigned morphRangeEnd = 0;
+        for (auto mIt = morphDescs.begin(); mIt != morphDescs.end(); ++mIt)
+        {
+            if (mIt->vbRef != vbRef)
+                continue;
+            for (auto vIt = mIt->vertices.begin(); vIt != mIt->vertices.end(); ++vIt)
+            {
+                if (*vIt < morphRangeStart)
+                    morphRangeStart = *vIt;
+                if (*vIt + 1 > morphRangeEnd)
+                    morphRangeEnd = *vIt + 1;
+            }
+        }
+
+        dest.Write((unsigned)vbDesc.numVertices);
+        dest.Write(elementMask);
+        dest.Write(morphRangeEnd ? morphRangeStart : 0u);
+        dest.Write(morphRangeEnd ? morphRangeEnd - morphRangeStart : 0u);
+        dest.Write(vbDesc.Data(), vbDesc.numVertices * vbDesc.vertexSize);
+    }
+
+    dest.Write((unsigned)ibDescs.size());
+    for (auto it = ibDescs.begin(); it != ibDescs.end(); ++it)
+    {
+        dest.Write((unsigned)it->numIndices);
+        dest.Write((unsigned)it->indexSize);
+        dest.Write(it->indexData.Get(), it->numIndices * it->indexSize);
+    }
+
+    // Bone mappings have been applied to the vertices on load
+    dest.Write((unsigned)geomDescs.size());
+    for (auto it = geomDescs.begin(); it != geomDescs.end(); ++it)
+    {
+        dest.Write(0u);
+        dest.Write((unsigned)it->size());
+
+        for (auto lIt = it->begin(); lIt != it->end(); ++lIt)
+        {
+            dest.Write(lIt->lodDistance);
+            dest.Write(0u); // Primitive type
+            dest.Write(lIt->vbRef);
+            dest.Write(lIt->ibRef);
+            dest.Write(lIt->drawStart);
+            dest.Write(lIt->drawCount);
+        }
+    }
+
+    WriteMorphs(dest);
+
+    dest.Write((unsigned)bones.size());
+    for (auto it = bones.begin(); it != bones.end(); ++it)
+    {
+        const ModelBone& bone = *it;
+        dest.Write(bone.name);
+        dest.Write((unsigned)bone.parentIndex);
+        dest.Write(bone.initialPosition);
+        dest.Write(bone.initialRotation);
+        dest.Write(bone.initialScale);
+        dest.Write(bone.offsetMatrix);
+
+        // Write only the collision shapes that are set, so that the bone stays active after reload. An inactive bone writes both to stay inactive
+        unsigned char boneCollisionType = bone.active ? 0 : 3;
+        if (bone.radius != 0.0f)
+            boneCollisionType |= 1;
+        if (bone.boundingBox.min != Vector3::ZERO || bone.boundingBox.max != Vector3::ZERO)
+            boneCollisionType |= 2;
+        dest.Write(boneCollisionType);
+        if (boneCollisionType & 1)
+            dest.Write(bone.radius);
+        if (boneCollisionType & 2)
+            dest.Write(bone.boundingBox);
+    }
+
+    dest.Write(boundingBox);
+
+    return true;
+}
+
+bool Model::SaveCooked(Stream& dest)
+{
+    ZoneScoped;
+
+    if (vbDescs.empty() && ibDescs.empty())
+    {
+        LOGERROR("Model " + Name() + " has no load-time data to save");
+        return false;
+    }
+
+    // Lay out the blobs first, so that the metadata after them can refer to them by offset
+    size_t offset = COOKED_HEADER_SIZE;
+    std::vector<size_t> vbOffsets;
+    for (auto it = vbDescs.begin(); it != vbDescs.end(); ++it)
+    {
+        offset = AlignCookedOffset(offset);
+        vbOffsets.push_back(offset);
+        offset += it->numVertices * it->vertexSize;
+    }
+
+    std::vector<size_t> ibOffsets;
+    for (auto it = ibDescs.begin(); it != ibDescs.end(); ++it)
+    {
+        offset = AlignCookedOffset(offset);
+        ibOffsets.push_back(offset);
+        offset += it->numIndices * it->indexSize;
+    }
+
+    std::vector<size_t> meshletOffsets;
+    for (auto it = geomDescs.begin(); it != geomDescs.end(); ++it)
+    {
+        for (auto lIt = it->begin(); lIt != it->end(); ++lIt)
+        {
+            offset = AlignCookedOffset(offset);
+            meshletOffsets.push_back(offset);
+            offset += lIt->meshlets.size() * sizeof(Meshlet);
+        }
+    }
+
+    size_t metadataOffset = AlignCookedOffset(offset);
+    if (metadataOffset > M_MAX_UNSIGNED)
+    {
+        LOGERROR("Model " + Name() + " is too large for the cooked format");
+        return false;
+    }
+
+    dest.WriteFileID("TMDL");
+    dest.Write(COOKED_VERSION);
+    dest.Write((unsigned)metadataOffset);
+    dest.Write(0u);
+
+    size_t position = COOKED_HEADER_SIZE;
+    for (size_t i = 0; i < vbDescs.size(); ++i)
+    {
+        WritePadding(dest, position, vbOffsets[i]);
+        dest.Write(vbDescs[i].Data(), vbDescs[i].numVertices * vbDescs[i].vertexSize);
+        position += vbDescs[i].numVertices * vbDescs[i].vertexSize;
+    }
+    for (size_t i = 0; i < ibDescs.size(); ++i)
+    {
+        WritePadding(dest, position, ibOffsets[i]);
+        dest.Write(ibDescs[i].indexData.Get(), ibDescs[i].numIndices * ibDescs[i].indexSize);
+        position += ibDescs[i].numIndices * ibDescs[i].indexSize;
+    }
+    size_t meshletIndex = 0;
+    for (auto it = geomDescs.begin(); it != geomDescs.end(); ++it)
+    {
+        for (auto lIt = it->begin(); lIt != it->end(); ++lIt)
+        {
+            WritePadding(dest, position, meshletOffsets[meshletIndex++]);
+            if (lIt->meshlets.size())
+                dest.Write(&lIt->meshlets[0], lIt->meshlets.size() * sizeof(Meshlet));
+            position += lIt->meshlets.size() * sizeof(Meshlet);
+        }
+    }
+    WritePadding(dest, position, metadataOffset);
+
+    dest.Write((unsigned)vbDescs.size());
+    for (size_t i = 0; i < vbDescs.size(); ++i)
+    {
+        const VertexBufferDesc& vbDesc = vbDescs[i];
+
+        dest.Write((unsigned)vbDesc.numVertices);
+        dest.Write((unsigned)vbDesc.vertexElements.size());
+        for (auto it = vbDesc.vertexElements.begin(); it != vbDesc.vertexElements.end(); ++it)
+        {
+            dest.Write((unsigned char)it->type);
+            dest.Write((unsigned char)it->semantic);
+            dest.Write(it->index);
+            dest.Write((unsigned char)0);
+        }
+        dest.Write((unsigned)vbOffsets[i]);
+    }
+
+    dest.Write((unsigned)ibDescs.size());
+    for (size_t i = 0; i < ibDescs.size(); ++i)
+    {
+        dest.Write((unsigned)ibDescs[i].numIndices);
+        dest.Write((unsigned)ibDescs[i].indexSize);
+        dest.Write((unsigned)ibOffsets[i]);
+    }
+
+    // Bone mappings have been applied to the vertices on load
+    meshletIndex = 0;
+    dest.Write((unsigned)geomDescs.size());
+    for (auto it = geomDescs.begin(); it != geomDescs.end(); ++it)
+    {
+        dest.Write((unsigned)it->size());
+
+        for (auto lIt = it->begin(); lIt != it->end(); ++lIt)
+        {
+            dest.Write(lIt->lodDistance);
+            dest.Write(lIt->vbRef);
+            dest.Write(lIt->ibRef);
+            dest.Write(lIt->drawStart);
+            dest.Write(lIt->drawCount);
+            dest.Write((unsigned)lIt->meshlets.size());
+            dest.Write((unsigned)meshletOffsets[meshletIndex++]);
+        }
+    }
+
+    WriteMorphs(dest);
+
+    dest.Write((unsigned)bones.size());
+    for (auto it = bones.begin(); it != bones.end(); ++it)
+    {
+        const ModelBone& bone = *it;
+        dest.Write(bone.name);
+        dest.Write((unsigned)bone.parentIndex);
+        dest.Write(bone.initialPosition);
+        dest.Write(bone.initialRotation);
+        dest.Write(bone.initialScale);
+        dest.Write(bone.offsetMatrix);
+        dest.Write(bone.radius);
+        dest.Write(bone.boundingBox);
+        dest.Write((unsigned char)(bone.active ? 1 : 0));
+    }
+
+    dest.Write(boundingBox);
+
+    return true;
+}
+
+bool Model::EndLoad()
+{
+    ZoneScoped;
+
+    ReleaseCombinedBuffer();
+    impostor.Reset();
+    morphStreams.clear();
+
+    bool hasWeights = false;
+    bool hasSameIndexSize = true;
+    size_t totalIndices = 0;
+
+    for (size_t i = 0; i < ibDescs.size(); ++i)
+    {
+        totalIndices += ibDescs[i].numIndices;
+        if (ibDescs[i].indexSize != ibDescs[0].indexSize)
+            hasSameIndexSize = false;
+    }
+
+    for (auto it = vbDescs.begin(); it != vbDescs.end(); ++it)
+    {
+        for (auto vIt = it->vertexElements.begin(); vIt != it->vertexElements.end(); ++vIt)
+        {
+            if (vIt->semantic == SEM_BLENDWEIGHTS || vIt->semantic == SEM_BLENDINDICES)
+            {
+                hasWeights = true;
+                break;
+            }
+        }
         if (hasWeights)
             break;
     }
 
+    cpuDataSize = 0;
+    for (auto it = vbDescs.begin(); it != vbDescs.end(); ++it)
+    {
+        if (it->cpuPositionData)
+            cpuDataSize += it->numVertices * sizeof(Vector3);
+    }
+    for (auto it = ibDescs.begin(); it != ibDescs.end(); ++it)
+    {
+        if (it->indexData)
+            cpuDataSize += it->numIndices * it->indexSize;
+    }
+
     // Create the geometry structure early and fill the CPU-side data first. Fill actual vertex and index buffers later
     geometries.resize(geomDescs.size());
     for (size_t i = 0; i < geomDescs.size(); ++i)
@@ -412,47 +1126,55 @@ bool Model::EndLoad()
             geom->cpuIndexData = ibDescs[geomDesc.ibRef].indexData;
             geom->cpuIndexSize = ibDescs[geomDesc.ibRef].indexSize;
             geom->cpuDrawStart = geomDesc.drawStart;
+            geom->meshlets = geomDesc.meshlets;
 
             geometries[i][j] = geom;
         }
     }
 
     // Check if can use combined vertex / index buffers
-    if (vbDescs.size() == 1 && vbDescs[0].numVertices < COMBINEDBUFFER_VERTICES && totalIndices < COMBINEDBUFFER_INDICES && hasSameIndexSize && !hasWeights)
+    if (vbDescs.size() == 1 && vbDescs[0].numVertices < COMBINEDBUFFER_VERTICES && totalIndices < COMBINEDBUFFER_INDICES && hasSameIndexSize && !hasWeights &&
+        morphDescs.empty())
     {
-        combinedBuffer = CombinedBuffer::Allocate(vbDescs[0].vertexElements, vbDescs[0].numVertices, totalIndices);
-        unsigned vertexStart = (unsigned)combinedBuffer->UsedVertices();
+        bool positionStream = positionStreams && vbDescs[0].cpuPositionData;
+        combinedBuffer = CombinedBuffer::Allocate(vbDescs[0].vertexElements, vbDescs[0].numVertices, totalIndices, positionStream, combinedVertices.start, combinedIndices.start);
+        combinedVertices.count = vbDescs[0].numVertices;
+        combinedIndices.count = totalIndices;
+        unsigned vertexStart = (unsigned)combinedVertices.start;
 
+        // Convert to new index data, as the geometries retain the original for CPU-side raycasts
         for (size_t i = 0; i < ibDescs.size(); ++i)
         {
             IndexBufferDesc& ibDesc = ibDescs[i];
+            SharedArrayPtr<unsigned char> newIndices(new unsigned char[sizeof(unsigned) * ibDesc.numIndices]);
+            unsigned* newIndexData = (unsigned*)newIndices.Get();
 
             if (ibDesc.indexSize == sizeof(unsigned short))
             {
                 unsigned short* oldIndexData = (unsigned short*)&ibDesc.indexData[0];
-                SharedArrayPtr<unsigned char> newIndices(new unsigned char[sizeof(unsigned) * ibDesc.numIndices]);
-                unsigned* newIndexData = (unsigned*)newIndices.Get();
                 for (size_t j = 0; j < ibDescs[i].numIndices; ++j)
                     newIndexData[j] = (unsigned)oldIndexData[j] + vertexStart;
-                
-                ibDesc.indexData = newIndices;
-                ibDesc.indexSize = sizeof(unsigned);
             }
             else
             {
-                unsigned* indexData = (unsigned*)&ibDesc.indexData[0];
+                unsigned* oldIndexData = (unsigned*)&ibDesc.indexData[0];
                 for (size_t j = 0; j < ibDescs[i].numIndices; ++j)
-                    indexData[j] += vertexStart;
+                    newIndexData[j] = oldIndexData[j] + vertexStart;
             }
+
+            ibDesc.indexData = newIndices;
+            ibDesc.indexSize = sizeof(unsigned);
         }
 
         std::vector<size_t> indexStarts;
+        size_t indexStart = combinedIndices.start;
 
-        combinedBuffer->FillVertices(vbDescs[0].numVertices, vbDescs[0].vertexData);
+        combinedBuffer->FillVertices(combinedVertices.start, vbDescs[0].numVertices, vbDescs[0].Data(), vbDescs[0].cpuPositionData);
         for (size_t i = 0; i < ibDescs.size(); ++i)
         {
-            indexStarts.push_back(combinedBuffer->UsedIndices());
-            combinedBuffer->FillIndices(ibDescs[i].numIndices, ibDescs[i].indexData);
+            indexStarts.push_back(indexStart);
+            combinedBuffer->FillIndices(indexStart, ibDescs[i].numIndices, ibDescs[i].indexData);
+            indexStart += ibDescs[i].numIndices;
         }
 
         for (size_t i = 0; i < geomDescs.size(); ++i)
@@ -463,6 +1185,7 @@ bool Model::EndLoad()
                 Geometry* geom = geometries[i][j];
 
                 geom->vertexBuffer = combinedBuffer->GetVertexBuffer();
+                geom->positionBuffer = combinedBuffer->GetPositionBuffer();
                 geom->indexBuffer = combinedBuffer->GetIndexBuffer();
                 geom->drawStart = geomDesc.drawStart + indexStarts[geomDesc.ibRef];
             }
@@ -471,19 +1194,48 @@ bool Model::EndLoad()
         vbDescs.clear();
         ibDescs.clear();
         geomDescs.clear();
+        cookedFile.Reset();
+        cookedData.Reset();
 
         return true;
     }
 
-    // If not, create individual buffers for this model and set them to the geometries
+    // If not, create individual buffers for this model and set them to the geometries. With an upload budget or the upload thread, data owned by the load is queued for upload instead
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    bool queueUploads = graphics && graphics->DefersUploads();
+
     std::vector<SharedPtr<VertexBuffer> > vbs;
+    std::vector<SharedPtr<VertexBuffer> > positionVbs;
     for (size_t i = 0; i < vbDescs.size(); ++i)
     {
         const VertexBufferDesc& vbDesc = vbDescs[i];
         SharedPtr<VertexBuffer> vb(new VertexBuffer());
 
-        vb->Define(USAGE_DEFAULT, vbDesc.numVertices, vbDesc.vertexElements, vbDesc.vertexData);
+        if (queueUploads && !vbDesc.cookedVertexData)
+        {
+            vb->Define(USAGE_DEFAULT, vbDesc.numVertices, vbDesc.vertexElements);
+            graphics->QueueUpload(vb, 0, vbDesc.numVertices, vbDesc.vertexData);
+        }
+        else
+            vb->Define(USAGE_DEFAULT, vbDesc.numVertices, vbDesc.vertexElements, vbDesc.Data());
         vbs.push_back(vb);
+
+        // Skinned geometries need the blend attributes in all passes, so they get no position-only buffer
+        SharedPtr<VertexBuffer> positionVb;
+        if (positionStreams && !hasWeights && vbDesc.cpuPositionData)
+        {
+            std::vector<VertexElement> positionElements;
+            positionElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+            positionVb = new VertexBuffer();
+            if (queueUploads)
+            {
+                positionVb->Define(USAGE_DEFAULT, vbDesc.numVertices, positionElements);
+                graphics->QueueUpload(positionVb, 0, vbDesc.numVertices, ReinterpretCast<unsigned char>(vbDesc.cpuPositionData));
+            }
+            else
+                positionVb->Define(USAGE_DEFAULT, vbDesc.numVertices, positionElements, vbDesc.cpuPositionData);
+        }
+        positionVbs.push_back(positionVb);
     }
 
     std::vector<SharedPtr<IndexBuffer> > ibs;
@@ -492,7 +1244,13 @@ bool Model::EndLoad()
         const IndexBufferDesc& ibDesc = ibDescs[i];
         SharedPtr<IndexBuffer> ib(new IndexBuffer());
 
-        ib->Define(USAGE_DEFAULT, ibDesc.numIndices, ibDesc.indexSize, ibDesc.indexData);
+        if (queueUploads)
+        {
+            ib->Define(USAGE_DEFAULT, ibDesc.numIndices, ibDesc.indexSize);
+            graphics->QueueUpload(ib, 0, ibDesc.numIndices, ibDesc.indexData);
+        }
+        else
+            ib->Define(USAGE_DEFAULT, ibDesc.numIndices, ibDesc.indexSize, ibDesc.indexData);
         ibs.push_back(ib);
     }
 
@@ -506,19 +1264,97 @@ bool Model::EndLoad()
             Geometry* geom = geometries[i][j];
 
             geom->vertexBuffer = vbs[geomDesc.vbRef];
+            geom->positionBuffer = positionVbs[geomDesc.vbRef];
             geom->indexBuffer = ibs[geomDesc.ibRef];
         }
     }
 
+    CreateMorphStreams(vbs);
+
     vbDescs.clear();
     ibDescs.clear();
     geomDescs.clear();
+    morphDescs.clear();
+    cookedFile.Reset();
+    cookedData.Reset();
+
+    occluderMeshValid = false;
+
+    return true;
+}
+
+bool Model::IsReady() const
+{
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    if (!graphics || !graphics->NumPendingUploads())
+        return true;
+
+    for (auto it = geometries.begin(); it != geometries.end(); ++it)
+    {
+        for (auto lodIt = it->begin(); lodIt != it->end(); ++lodIt)
+        {
+            const Geometry* geom = *lodIt;
+            if (graphics->IsUploadPending(geom->vertexBuffer) || graphics->IsUploadPending(geom->positionBuffer) || graphics->IsUploadPending(geom->indexBuffer))
+                return false;
+        }
+    }
 
     return true;
 }
 
+size_t Model::CpuMemoryUse() const
+{
+    return cpuDataSize + occluderMesh.vertices.size() * sizeof(Vector3) + occluderMesh.indices.size() * sizeof(unsigned);
+}
+
+size_t Model::GpuMemoryUse() const
+{
+    if (combinedBuffer)
+    {
+        size_t bytes = combinedVertices.count * combinedBuffer->GetVertexBuffer()->VertexSize() + combinedIndices.count * combinedBuffer->GetIndexBuffer()->IndexSize();
+        if (combinedBuffer->GetPositionBuffer())
+            bytes += combinedVertices.count * sizeof(Vector3);
+        return bytes;
+    }
+
+    // The LOD levels share buffers, so count each buffer once
+    std::set<const void*> counted;
+    size_t bytes = 0;
+
+    for (auto it = geometries.begin(); it != geometries.end(); ++it)
+    {
+        for (auto lodIt = it->begin(); lodIt != it->end(); ++lodIt)
+        {
+            const Geometry* geom = *lodIt;
+            if (geom->vertexBuffer && counted.insert(geom->vertexBuffer.Get()).second)
+                bytes += geom->vertexBuffer->NumVertices() * geom->vertexBuffer->VertexSize();
+            if (geom->positionBuffer && counted.insert(geom->positionBuffer.Get()).second)
+                bytes += geom->positionBuffer->NumVertices() * geom->positionBuffer->VertexSize();
+            if (geom->indexBuffer && counted.insert(geom->indexBuffer.Get()).second)
+                bytes += geom->indexBuffer->NumIndices() * geom->indexBuffer->IndexSize();
+        }
+    }
+
+    for (auto it = morphStreams.begin(); it != morphStreams.end(); ++it)
+        bytes += it->deltaBuffer->NumVertices() * it->deltaBuffer->VertexSize();
+
+    return bytes;
+}
+
+void Model::ReleaseCombinedBuffer()
+{
+    if (!combinedBuffer)
+        return;
+
+    combinedBuffer->Free(combinedVertices.start, combinedVertices.count, combinedIndices.start, combinedIndices.count);
+    combinedBuffer.Reset();
+    combinedVertices = BufferRange();
+    combinedIndices = BufferRange();
+}
+
 void Model::SetNumGeometries(size_t num)
 {
+    occluderMeshValid = false;
     geometries.resize(num);
     // Ensure that each geometry has at least 1 LOD level
     for (size_t i = 0; i < geometries.size(); ++i)
@@ -536,6 +1372,7 @@ void Model::SetNumLodLevels(size_t index, size_t num)
         return;
     }
 
+    occluderMeshValid = false;
     geometries[index].resize(num);
     // Ensure that a valid geometry object exists at each index
     for (auto it = geometries[index].begin(); it != geometries[index].end(); ++it)
@@ -553,6 +1390,105 @@ void Model::SetLocalBoundingBox(const BoundingBox& box)
 void Model::SetBones(const std::vector<ModelBone>& bones_)
 {
     bones = bones_;
+    UpdateBoneBoundingBoxes();
+}
+
+void Model::UpdateBoneBoundingBoxes()
+{
+    // Inactive bones get an empty box so that batch transforms on them stay finite
+    boneBoundingBoxes.resize(bones.size());
+    allBonesActive = true;
+    for (size_t i = 0; i < bones.size(); ++i)
+    {
+        if (bones[i].active)
+            boneBoundingBoxes[i] = bones[i].boundingBox;
+        else
+        {
+            boneBoundingBoxes[i] = BoundingBox(Vector3::ZERO, Vector3::ZERO);
+            allBonesActive = false;
+        }
+    }
+}
+
+void Model::SetOccluderMesh(const OccluderMesh& mesh)
+{
+    occluderMesh = mesh;
+    occluderMeshValid = true;
+}
+
+void Model::PrepareOccluderMesh()
+{
+    if (!occluderMeshValid)
+        GenerateOccluderMesh();
+}
+
+Impostor* Model::GetImpostor(const std::vector<Material*>& materials)
+{
+    if (!impostor)
+    {
+        SharedPtr<Impostor> newImpostor(new Impostor());
+        if (!newImpostor->Bake(this, materials))
+            return nullptr;
+        impostor = newImpostor;
+    }
+
+    return impostor;
+}
+
+void Model::SetVertexCompression(bool enable)
+{
+    vertexCompression = enable;
+}
+
+void Model::SetPositionStreams(bool enable)
+{
+    positionStreams = enable;
+}
+
+void Model::SetMeshletGeneration(bool enable)
+{
+    meshletGeneration = enable;
+}
+
+void Model::SetMeshOptimization(bool enable, bool overdraw)
+{
+    meshOptimization = enable;
+    overdrawOptimization = overdraw;
+}
+
+void Model::SetLodGeneration(unsigned numLevels, float ratio, float pixelError)
+{
+    lodGenerationLevels = numLevels;
+    lodGenerationRatio = Clamp(ratio, 0.0f, 1.0f);
+    lodGenerationPixelError = Max(pixelError, M_EPSILON);
+}
+
+void Model::SetDefaultVertexCompression(bool enable)
+{
+    defaultVertexCompression = enable;
+}
+
+void Model::SetDefaultPositionStreams(bool enable)
+{
+    defaultPositionStreams = enable;
+}
+
+void Model::SetDefaultMeshletGeneration(bool enable)
+{
+    defaultMeshletGeneration = enable;
+}
+
+void Model::SetDefaultMeshOptimization(bool enable, bool overdraw)
+{
+    defaultMeshOptimization = enable;
+    defaultOverdrawOptimization = overdraw;
+}
+
+void Model::SetDefaultLodGeneration(unsigned numLevels, float ratio, float pixelError)
+{
+    defaultLodGenerationLevels = numLevels;
+    defaultLodGenerationRatio = Clamp(ratio, 0.0f, 1.0f);
+    defaultLodGenerationPixelError = Max(pixelError, M_EPSILON);
 }
 
 size_t Model::NumLodLevels(size_t index) const
@@ -564,3 +1500,653 @@ Geometry* Model::GetGeometry(size_t index, size_t lodLevel) const
 {
     return (index < geometries.size() && lodLevel < geometries[index].size()) ? geometries[index][lodLevel] : nullptr;
 }
+
+size_t Model::FindMorph(const std::string& name) const
+{
+    StringHash nameHash(name);
+    for (size_t i = 0; i < morphs.size(); ++i)
+    {
+        if (morphs[i].nameHash == nameHash)
+            return i;
+    }
+
+    return M_MAX_UNSIGNED;
+}
+
+bool Model::ReadMorphs(Stream& source)
+{
+    size_t numMorphs = source.Read<unsigned>();
+    morphs.resize(numMorphs);
+
+    for (size_t i = 0; i < numMorphs; ++i)
+    {
+        ModelMorph& morph = morphs[i];
+        morph.name = source.Read<std::string>();
+        morph.nameHash = StringHash(morph.name);
+
+        size_t numBuffers = source.Read<unsigned>();
+        for (size_t j = 0; j < numBuffers; ++j)
+        {
+            MorphBufferDesc morphDesc;
+            morphDesc.morphIndex = (unsigned)i;
+            morphDesc.vbRef = source.Read<unsigned>();
+            unsigned elementMask = source.Read<unsigned>();
+            size_t numVertices = source.Read<unsigned>();
+
+            if (morphDesc.vbRef >= vbDescs.size())
+            {
+                LOGERROR(source.Name() + " has morph data for an invalid vertex buffer");
+                return false;
+            }
+
+            morphDesc.vertices.resize(numVertices);
+            if (elementMask & MORPH_POSITION)
+                morphDesc.positionDeltas.resize(numVertices);
+            if (elementMask & MORPH_NORMAL)
+                morphDesc.normalDeltas.resize(numVertices);
+            if (elementMask & MORPH_TANGENT)
+                morphDesc.tangentDeltas.resize(numVertices);
+
+            for (size_t k = 0; k < numVertices; ++k)
+            {
+                morphDesc.vertices[k] = source.Read<unsigned>();
+                if (morphDesc.vertices[k] >= vbDescs[morphDesc.vbRef].numVertices)
+                {
+                    LOGERROR(source.Name() + " has morph data for an invalid vertex");
+                    return false;
+                }
+
+                if (elementMask & MORPH_POSITION)
+                    morphDesc.positionDeltas[k] = source.Read<Vector3>();
+                if (elementMask & MORPH_NORMAL)
+                    morphDesc.normalDeltas[k] = source.Read<Vector3>();
+                if (elementMask & MORPH_TANGENT)
+                    morphDesc.tangentDeltas[k] = source.Read<Vector3>();
+            }
+
+            if (numVertices)
+                morphDescs.push_back(morphDesc);
+        }
+    }
+
+    return true;
+}
+
+void Model::WriteMorphs(Stream& dest) const
+{
+    dest.Write((unsigned)morphs.size());
+    for (size_t i = 0; i < morphs.size(); ++i)
+    {
+        dest.Write(morphs[i].name);
+
+        unsigned numBuffers = 0;
+        for (auto it = morphDescs.begin(); it != morphDescs.end(); ++it)
+        {
+            if (it->morphIndex == i)
+                ++numBuffers;
+        }
+        dest.Write(numBuffers);
+
+        for (auto it = morphDescs.begin(); it != morphDescs.end(); ++it)
+        {
+            if (it->morphIndex != i)
+                continue;
+
+            unsigned elementMask = (it->positionDeltas.size() ? MORPH_POSITION : 0) | (it->normalDeltas.size() ? MORPH_NORMAL : 0) |
+                (it->tangentDeltas.size() ? MORPH_TANGENT : 0);
+            dest.Write(it->vbRef);
+            dest.Write(elementMask);
+            dest.Write((unsigned)it->vertices.size());
+
+            for (size_t j = 0; j < it->vertices.size(); ++j)
+            {
+                dest.Write(it->vertices[j]);
+                if (elementMask & MORPH_POSITION)
+                    dest.Write(it->positionDeltas[j]);
+                if (elementMask & MORPH_NORMAL)
+                    dest.Write(it->normalDeltas[j]);
+                if (elementMask & MORPH_TANGENT)
+                    dest.Write(it->tangentDeltas[j]);
+            }
+        }
+    }
+}
+
+void Model::CreateMorphStreams(const std::vector<SharedPtr<VertexBuffer> >& vertexBuffers)
+{
+    ZoneScoped;
+
+    for (size_t i = 0; i < vertexBuffers.size(); ++i)
+    {
+        // Group the deltas of all morphs by vertex, so that each vertex is morphed by one shader invocation without write conflicts
+        std::map<unsigned, std::vector<std::pair<const MorphBufferDesc*, size_t> > > vertexDeltas;
+        for (auto it = morphDescs.begin(); it != morphDescs.end(); ++it)
+        {
+            if (it->vbRef != i)
+                continue;
+            for (size_t j = 0; j < it->vertices.size(); ++j)
+                vertexDeltas[it->vertices[j]].push_back(std::make_pair(&(*it), j));
+        }
+
+        if (vertexDeltas.empty())
+            continue;
+
+        size_t numDeltas = 0;
+        for (auto it = vertexDeltas.begin(); it != vertexDeltas.end(); ++it)
+            numDeltas += it->second.size();
+
+        // Indices are stored as their float bit patterns, as the buffer is read as raw words
+        std::vector<Vector4> data(vertexDeltas.size() + numDeltas * 3, Vector4::ZERO);
+        unsigned* words = reinterpret_cast<unsigned*>(&data[0]);
+        size_t header = 0;
+        size_t delta = vertexDeltas.size();
+
+        for (auto it = vertexDeltas.begin(); it != vertexDeltas.end(); ++it, ++header)
+        {
+            words[header * 4] = it->first;
+            words[header * 4 + 1] = (unsigned)delta;
+            words[header * 4 + 2] = (unsigned)it->second.size();
+
+            for (auto dIt = it->second.begin(); dIt != it->second.end(); ++dIt, delta += 3)
+            {
+                const MorphBufferDesc& morphDesc = *dIt->first;
+                size_t index = dIt->second;
+                if (morphDesc.positionDeltas.size())
+                    data[delta] = Vector4(morphDesc.positionDeltas[index], 0.0f);
+                if (morphDesc.normalDeltas.size())
+                    data[delta + 1] = Vector4(morphDesc.normalDeltas[index], 0.0f);
+                if (morphDesc.tangentDeltas.size())
+                    data[delta + 2] = Vector4(morphDesc.tangentDeltas[index], 0.0f);
+                words[delta * 4 + 3] = morphDesc.morphIndex;
+            }
+        }
+
+        std::vector<VertexElement> elements;
+        elements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD));
+
+        MorphStream stream;
+        stream.vertexBuffer = vertexBuffers[i];
+        stream.deltaBuffer = new VertexBuffer();
+        stream.deltaBuffer->Define(USAGE_DEFAULT, data.size(), elements, &data[0]);
+        stream.numVertices = vertexDeltas.size();
+        stream.numDeltas = numDeltas;
+        morphStreams.push_back(stream);
+    }
+}
+
+void Model::GenerateOccluderMesh()
+{
+    ZoneScoped;
+
+    occluderMesh.vertices.clear();
+    occluderMesh.indices.clear();
+
+    std::map<unsigned, unsigned> vertexMapping;
+
+    for (size_t i = 0; i < geometries.size(); ++i)
+    {
+        if (geometries[i].empty())
+            continue;
+
+        // Use the lowest LOD level, as the rasterization resolution is low
+        const Geometry* geom = geometries[i].back();
+        if (!geom->cpuPositionData || !geom->cpuIndexData || (geom->cpuIndexSize != sizeof(unsigned short) && geom->cpuIndexSize != sizeof(unsigned)))
+            continue;
+
+        // Copy only the referenced vertices
+        vertexMapping.clear();
+        const unsigned char* indexData = geom->cpuIndexData.Get();
+        size_t numTriangles = geom->drawCount / 3;
+
+        for (size_t j = geom->cpuDrawStart; j < geom->cpuDrawStart + numTriangles * 3; ++j)
+        {
+            unsigned index = geom->cpuIndexSize == sizeof(unsigned) ? reinterpret_cast<const unsigned*>(indexData)[j] : reinterpret_cast<const unsigned short*>(indexData)[j];
+            auto it = vertexMapping.find(index);
+            if (it == vertexMapping.end())
+            {
+                it = vertexMapping.insert(std::make_pair(index, (unsigned)occluderMesh.vertices.size())).first;
+                occluderMesh.vertices.push_back(geom->cpuPositionData[index]);
+            }
+
+            occluderMesh.indices.push_back(it->second);
+        }
+    }
+
+    occluderMeshValid = true;
+}
+
+void Model::CompressVertices(VertexBufferDesc& vbDesc)
+{
+    ZoneScoped;
+
+    std::vector<VertexElement> newElements = vbDesc.vertexElements;
+    size_t newVertexSize = 0;
+    bool compressed = false;
+
+    for (auto it = newElements.begin(); it != newElements.end(); ++it)
+    {
+        if ((it->semantic == SEM_NORMAL && it->type == ELEM_VECTOR3) || (it->semantic == SEM_TANGENT && it->type == ELEM_VECTOR4))
+        {
+            it->type = ELEM_INT2101010;
+            compressed = true;
+        }
+        else if (it->semantic == SEM_TEXCOORD && it->type == ELEM_VECTOR2)
+        {
+            it->type = ELEM_HALF2;
+            compressed = true;
+        }
+
+        newVertexSize += VertexBuffer::VertexElementSize(*it);
+    }
+
+    if (!compressed)
+        return;
+
+    SharedArrayPtr<unsigned char> newVertexData(new unsigned char[vbDesc.numVertices * newVertexSize]);
+
+    for (size_t i = 0; i < vbDesc.numVertices; ++i)
+    {
+        const unsigned char* src = vbDesc.vertexData + i * vbDesc.vertexSize;
+        unsigned char* dest = newVertexData + i * newVertexSize;
+
+        for (size_t j = 0; j < newElements.size(); ++j)
+        {
+            ElementType oldType = vbDesc.vertexElements[j].type;
+            ElementType newType = newElements[j].type;
+            const float* srcFloats = reinterpret_cast<const float*>(src);
+
+            if (newType == ELEM_INT2101010)
+                *reinterpret_cast<unsigned*>(dest) = PackSNorm1010102(Vector4(srcFloats[0], srcFloats[1], srcFloats[2], oldType == ELEM_VECTOR4 ? srcFloats[3] : 1.0f));
+            else if (newType == ELEM_HALF2)
+                FloatsToHalfs(srcFloats, reinterpret_cast<unsigned short*>(dest), 2);
+            else
+                memcpy(dest, src, elementSizes[oldType]);
+
+            src += elementSizes[oldType];
+            dest += elementSizes[newType];
+        }
+    }
+
+    vbDesc.vertexElements = newElements;
+    vbDesc.vertexSize = newVertexSize;
+    vbDesc.vertexData = newVertexData;
+}
+
+void Model::BuildMeshlets(GeometryDesc& geomDesc)
+{
+    ZoneScoped;
+
+    if (geomDesc.vbRef >= vbDescs.size() || geomDesc.ibRef >= ibDescs.size())
+        return;
+
+    const VertexBufferDesc& vbDesc = vbDescs[geomDesc.vbRef];
+    IndexBufferDesc& ibDesc = ibDescs[geomDesc.ibRef];
+    size_t numTriangles = geomDesc.drawCount / 3;
+    size_t numVertices = vbDesc.numVertices;
+
+    // Skinned geometries move their triangles, so the bounds would not hold
+    for (auto it = vbDesc.vertexElements.begin(); it != vbDesc.vertexElements.end(); ++it)
+    {
+        if (it->semantic == SEM_BLENDWEIGHTS || it->semantic == SEM_BLENDINDICES)
+            return;
+    }
+
+    if (!vbDesc.cpuPositionData || numTriangles < MESHLET_MIN_TRIANGLES)
+        return;
+
+    std::vector<unsigned> indices;
+    if (!ReadIndices(ibDesc, geomDesc.drawStart, numTriangles * 3, numVertices, indices))
+        return;
+
+    // Build the vertex to triangle adjacency for growing the meshlets across shared vertices
+    std::vector<unsigned> adjacencyOffsets(numVertices + 1, 0);
+    std::vector<unsigned> adjacentTriangles(indices.size());
+    for (size_t i = 0; i < indices.size(); ++i)
+        ++adjacencyOffsets[indices[i] + 1];
+    for (size_t i = 0; i < numVertices; ++i)
+        adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+    std::vector<unsigned> fillOffsets(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i)
+        adjacentTriangles[fillOffsets[indices[i]]++] = (unsigned)(i / 3);
+
+    const Vector3* positions = vbDesc.cpuPositionData.Get();
+    std::vector<unsigned> newIndices;
+    std::vector<bool> emitted(numTriangles, false);
+    std::vector<unsigned> vertexMeshlet(numVertices, M_MAX_UNSIGNED);
+    std::vector<unsigned> candidates;
+    std::vector<unsigned> meshletVertices;
+    size_t nextSeed = 0;
+
+    newIndices.reserve(indices.size());
+    geomDesc.meshlets.clear();
+
+    while (newIndices.size() < indices.size())
+    {
+        unsigned meshletIndex = (unsigned)geomDesc.meshlets.size();
+        size_t meshletStart = newIndices.size();
+        size_t candidateIndex = 0;
+        candidates.clear();
+        meshletVertices.clear();
+
+        // Grow breadth-first from a seed triangle. When the connected triangles run out, continue from the next unused triangle in index order
+        while (newIndices.size() - meshletStart < MESHLET_MAX_TRIANGLES * 3)
+        {
+            if (candidateIndex >= candidates.size())
+            {
+                while (nextSeed < numTriangles && emitted[nextSeed])
+                    ++nextSeed;
+                if (nextSeed >= numTriangles)
+                    break;
+                candidates.push_back((unsigned)nextSeed);
+            }
+
+            unsigned triangle = candidates[candidateIndex++];
+            if (emitted[triangle])
+                continue;
+
+            const unsigned* tri = &indices[triangle * 3];
+            size_t newVertices = 0;
+            for (size_t i = 0; i < 3; ++i)
+            {
+                if (vertexMeshlet[tri[i]] != meshletIndex && (i < 1 || tri[i] != tri[0]) && (i < 2 || tri[i] != tri[1]))
+                    ++newVertices;
+            }
+            if (meshletVertices.size() + newVertices > MESHLET_MAX_VERTICES)
+            {
+                // A seed that does not fit ends the meshlet. Skipped neighbours are picked up by later meshlets
+                if (candidateIndex >= candidates.size())
+                    break;
+                continue;
+            }
+
+            emitted[triangle] = true;
+            for (size_t i = 0; i < 3; ++i)
+            {
+                unsigned vertex = tri[i];
+                newIndices.push_back(vertex);
+                if (vertexMeshlet[vertex] != meshletIndex)
+                {
+                    vertexMeshlet[vertex] = meshletIndex;
+                    meshletVertices.push_back(vertex);
+                }
+                for (unsigned j = adjacencyOffsets[vertex]; j < adjacencyOffsets[vertex + 1]; ++j)
+                {
+                    if (!emitted[adjacentTriangles[j]])
+                        candidates.push_back(adjacentTriangles[j]);
+                }
+            }
+        }
+
+        // Bounding sphere around the center of the vertices' bounding box
+        BoundingBox box;
+        for (auto it = meshletVertices.begin(); it != meshletVertices.end(); ++it)
+            box.Merge(positions[*it]);
+
+        Meshlet meshlet;
+        meshlet.center = box.Center();
+        meshlet.radius = 0.0f;
+        for (auto it = meshletVertices.begin(); it != meshletVertices.end(); ++it)
+            meshlet.radius = Max(meshlet.radius, (positions[*it] - meshlet.center).Length());
+
+        // Normal cone from the average triangle normal and the widest angle to it
+        Vector3 normalSum(Vector3::ZERO);
+        for (size_t i = meshletStart; i < newIndices.size(); i += 3)
+        {
+            const Vector3& v0 = positions[newIndices[i]];
+            Vector3 normal = (positions[newIndices[i + 1]] - v0).CrossProduct(positions[newIndices[i + 2]] - v0);
+            float length = normal.Length();
+            if (length > M_EPSILON)
+                normalSum += normal / length;
+        }
+
+        meshlet.coneAxis = Vector3::ZERO;
+        meshlet.coneCutoff = 1.0f;
+        float axisLength = normalSum.Length();
+        if (axisLength > M_EPSILON)
+        {
+            meshlet.coneAxis = normalSum / axisLength;
+            float minDot = 1.0f;
+            for (size_t i = meshletStart; i < newIndices.size(); i += 3)
+            {
+                const Vector3& v0 = positions[newIndices[i]];
+                Vector3 normal = (positions[newIndices[i + 1]] - v0).CrossProduct(positions[newIndices[i + 2]] - v0);
+                float length = normal.Length();
+                if (length > M_EPSILON)
+                    minDot = Min(minDot, meshlet.coneAxis.DotProduct(normal / length));
+            }
+            if (minDot > 0.0f)
+                meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+        }
+
+        // Meshlets keep their triangles, so optimize for the vertex cache within each
+        if (meshOptimization)
+        {
+            std::vector<unsigned> meshletIndices(newIndices.begin() + meshletStart, newIndices.end());
+            OptimizeVertexCache(&meshletIndices[0], meshletIndices.size());
+            if (VertexCacheMissRatio(&meshletIndices[0], meshletIndices.size()) < VertexCacheMissRatio(&newIndices[meshletStart], meshletIndices.size()))
+                std::copy(meshletIndices.begin(), meshletIndices.end(), newIndices.begin() + meshletStart);
+        }
+
+        meshlet.indexStart = (unsigned)meshletStart;
+        meshlet.indexCount = (unsigned)(newIndices.size() - meshletStart);
+        geomDesc.meshlets.push_back(meshlet);
+    }
+
+    WriteIndices(ibDesc, geomDesc.drawStart, newIndices);
+}
+
+void Model::GenerateLodLevels(std::vector<GeometryDesc>& lodDescs)
+{
+    ZoneScoped;
+
+    const GeometryDesc& baseDesc = lodDescs[0];
+    if (baseDesc.vbRef >= vbDescs.size() || baseDesc.ibRef >= ibDescs.size())
+        return;
+
+    const VertexBufferDesc& vbDesc = vbDescs[baseDesc.vbRef];
+    const IndexBufferDesc& baseIbDesc = ibDescs[baseDesc.ibRef];
+    size_t numTriangles = baseDesc.drawCount / 3;
+    size_t indexSize = baseIbDesc.indexSize;
+
+    if (!vbDesc.cpuPositionData || numTriangles < LOD_MIN_TRIANGLES)
+        return;
+
+    std::vector<unsigned> indices;
+    if (!ReadIndices(baseIbDesc, baseDesc.drawStart, numTriangles * 3, vbDesc.numVertices, indices))
+        return;
+
+    // Gather the attributes that should resist collapsing
+    std::vector<Vector3> normals;
+    std::vector<Vector2> texCoords;
+    size_t offset = 0;
+    for (auto it = vbDesc.vertexElements.begin(); it != vbDesc.vertexElements.end(); ++it)
+    {
+        if (it->semantic == SEM_NORMAL && it->type == ELEM_VECTOR3 && normals.empty())
+        {
+            normals.resize(vbDesc.numVertices);
+            for (size_t i = 0; i < vbDesc.numVertices; ++i)
+                normals[i] = *reinterpret_cast<const Vector3*>(vbDesc.vertexData + i * vbDesc.vertexSize + offset);
+        }
+        else if (it->semantic == SEM_TEXCOORD && it->index == 0 && it->type == ELEM_VECTOR2 && texCoords.empty())
+        {
+            texCoords.resize(vbDesc.numVertices);
+            for (size_t i = 0; i < vbDesc.numVertices; ++i)
+                texCoords[i] = *reinterpret_cast<const Vector2*>(vbDesc.vertexData + i * vbDesc.vertexSize + offset);
+        }
+
+        offset += VertexBuffer::VertexElementSize(*it);
+    }
+
+    MeshSimplifier simplifier;
+    simplifier.SetMesh(&indices[0], indices.size(), vbDesc.cpuPositionData.Get(), normals.size() ? &normals[0] : nullptr,
+        texCoords.size() ? &texCoords[0] : nullptr, vbDesc.numVertices);
+
+    std::vector<unsigned> lodIndices;
+    size_t prevTriangles = numTriangles;
+    float targetTriangles = (float)numTriangles;
+
+    for (unsigned i = 1; i < lodGenerationLevels; ++i)
+    {
+        targetTriangles *= lodGenerationRatio;
+        size_t remaining = simplifier.Simplify((size_t)targetTriangles);
+        if (!remaining || remaining > prevTriangles * LOD_MIN_REDUCTION)
+            break;
+        prevTriangles = remaining;
+
+        // Each level gets its own index buffer, which is merged into the combined buffer like authored LOD levels
+        simplifier.GetIndices(lodIndices);
+        IndexBufferDesc newIbDesc;
+        newIbDesc.indexSize = indexSize;
+        newIbDesc.numIndices = lodIndices.size();
+        newIbDesc.indexData = new unsigned char[newIbDesc.numIndices * indexSize];
+        WriteIndices(newIbDesc, 0, lodIndices);
+        ibDescs.push_back(newIbDesc);
+
+        // Switch when the simplification error projects to the allowed pixel error at the reference resolution
+        GeometryDesc newDesc;
+        newDesc.vbRef = lodDescs[0].vbRef;
+        newDesc.ibRef = (unsigned)(ibDescs.size() - 1);
+        newDesc.drawStart = 0;
+        newDesc.drawCount = (unsigned)lodIndices.size();
+        newDesc.lodDistance = Max(lodDescs.back().lodDistance, simplifier.Error() * LOD_REFERENCE_PIXELS / lodGenerationPixelError);
+        lodDescs.push_back(newDesc);
+    }
+}
+
+void Model::OptimizeIndices()
+{
+    ZoneScoped;
+
+    std::set<std::pair<unsigned, std::pair<unsigned, unsigned> > > processedRanges;
+    std::vector<unsigned> indices;
+    std::vector<unsigned> clusterStarts;
+
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        for (size_t j = 0; j < geomDescs[i].size(); ++j)
+        {
+            const GeometryDesc& geomDesc = geomDescs[i][j];
+            if (geomDesc.vbRef >= vbDescs.size() || geomDesc.ibRef >= ibDescs.size() || geomDesc.drawCount < 3)
+                continue;
+
+            // Draw ranges may be shared by several geometries
+            if (!processedRanges.insert(std::make_pair(geomDesc.ibRef, std::make_pair(geomDesc.drawStart, geomDesc.drawCount))).second)
+                continue;
+
+            const VertexBufferDesc& vbDesc = vbDescs[geomDesc.vbRef];
+            IndexBufferDesc& ibDesc = ibDescs[geomDesc.ibRef];
+            if (!ReadIndices(ibDesc, geomDesc.drawStart, geomDesc.drawCount / 3 * 3, vbDesc.numVertices, indices))
+                continue;
+
+            // Exported meshes may already be optimized by a better method, so keep the new order only if it is an improvement
+            float oldMissRatio = VertexCacheMissRatio(&indices[0], indices.size());
+            OptimizeVertexCache(&indices[0], indices.size(), overdrawOptimization ? &clusterStarts : nullptr);
+            if (VertexCacheMissRatio(&indices[0], indices.size()) >= oldMissRatio)
+                continue;
+
+            if (overdrawOptimization && vbDesc.cpuPositionData)
+                OptimizeOverdraw(&indices[0], indices.size(), vbDesc.cpuPositionData.Get(), clusterStarts);
+
+            WriteIndices(ibDesc, geomDesc.drawStart, indices);
+        }
+    }
+}
+
+void Model::OptimizeVertexFetch(unsigned vbRef)
+{
+    ZoneScoped;
+
+    VertexBufferDesc& vbDesc = vbDescs[vbRef];
+    size_t numVertices = vbDesc.numVertices;
+
+    // The index buffers drawn with this vertex buffer are remapped whole, so they must not be drawn with other vertex buffers
+    std::vector<unsigned> ibRefs;
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        for (size_t j = 0; j < geomDescs[i].size(); ++j)
+        {
+            const GeometryDesc& geomDesc = geomDescs[i][j];
+            if (geomDesc.vbRef == vbRef && geomDesc.ibRef < ibDescs.size() && std::find(ibRefs.begin(), ibRefs.end(), geomDesc.ibRef) == ibRefs.end())
+                ibRefs.push_back(geomDesc.ibRef);
+        }
+    }
+
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        for (size_t j = 0; j < geomDescs[i].size(); ++j)
+        {
+            const GeometryDesc& geomDesc = geomDescs[i][j];
+            if (geomDesc.vbRef != vbRef && std::find(ibRefs.begin(), ibRefs.end(), geomDesc.ibRef) != ibRefs.end())
+                return;
+        }
+    }
+
+    std::vector<std::vector<unsigned> > ibIndices(ibRefs.size());
+    for (size_t i = 0; i < ibRefs.size(); ++i)
+    {
+        if (!ReadIndices(ibDescs[ibRefs[i]], 0, ibDescs[ibRefs[i]].numIndices, numVertices, ibIndices[i]))
+            return;
+    }
+
+    // Number the vertices in order of first use by the geometries, then the unused vertices
+    std::vector<unsigned> remap(numVertices, M_MAX_UNSIGNED);
+    std::vector<unsigned> indices;
+    unsigned nextVertex = 0;
+
+    for (size_t i = 0; i < geomDescs.size(); ++i)
+    {
+        for (size_t j = 0; j < geomDescs[i].size(); ++j)
+        {
+            const GeometryDesc& geomDesc = geomDescs[i][j];
+            if (geomDesc.vbRef != vbRef || !ReadIndices(ibDescs[geomDesc.ibRef], geomDesc.drawStart, geomDesc.drawCount, numVertices, indices))
+                continue;
+
+            for (auto it = indices.begin(); it != indices.end(); ++it)
+            {
+                if (remap[*it] == M_MAX_UNSIGNED)
+                    remap[*it] = nextVertex++;
+            }
+        }
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < numVertices; ++i)
+    {
+        if (remap[i] == M_MAX_UNSIGNED)
+            remap[i] = nextVertex++;
+        if (remap[i] != i)
+            changed = true;
+    }
+
+    if (!changed)
+        return;
+
+    SharedArrayPtr<unsigned char> newVertexData(new unsigned char[numVertices * vbDesc.vertexSize]);
+    for (size_t i = 0; i < numVertices; ++i)
+        memcpy(newVertexData + remap[i] * vbDesc.vertexSize, vbDesc.vertexData + i * vbDesc.vertexSize, vbDesc.vertexSize);
+    vbDesc.vertexData = newVertexData;
+
+    if (vbDesc.cpuPositionData)
+    {
+        SharedArrayPtr<Vector3> newPositionData(new Vector3[numVertices]);
+        for (size_t i = 0; i < numVertices; ++i)
+            newPositionData[remap[i]] = vbDesc.cpuPositionData[i];
+        vbDesc.cpuPositionData = newPositionData;
+    }
+
+    for (size_t i = 0; i < ibRefs.size(); ++i)
+    {
+        std::vector<unsigned>& ibIndex = ibIndices[i];
+        for (auto it = ibIndex.begin(); it != ibIndex.end(); ++it)
+            *it = remap[*it];
+        WriteIndices(ibDescs[ibRefs[i]], 0, ibIndex);
+    }
+
+    for (auto it = morphDescs.begin(); it != morphDescs.end(); ++it)
+    {
+        if (it->vbRef != vbRef)
+            continue;
+        for (auto vIt = it->vertices.begin(); vIt != it->vertices.end(); ++vIt)
+            *vIt = remap[*vIt];
+    }
+}
@@ -4,11 +4,20 @@
 
 #include "../Graphics/GraphicsDefs.h"
 #include "../Math/BoundingBox.h"
+#include "../Math/Matrix3x4.h"
 #include "../Resource/Resource.h"
+#include "GeometryNode.h"
 
+class Impostor;
+class MappedFile;
+class Material;
 class VertexBuffer;
 class IndexBuffer;
-struct Geometry;
+
+/// Number of vertices in a combined buffer. Larger vertex ranges can not be allocated from one.
+static const size_t COMBINEDBUFFER_VERTICES = 384 * 1024;
+/// Number of indices in a combined buffer. Larger index ranges can not be allocated from one.
+static const size_t COMBINEDBUFFER_INDICES = 1024 * 1024;
 
 /// Load-time description of a vertex buffer, to be uploaded on the GPU later.
 struct VertexBufferDesc
@@ -21,8 +30,13 @@ struct VertexBufferDesc
     size_t vertexSize;
     /// Vertex data.
     SharedArrayPtr<unsigned char> vertexData;
+    /// Vertex data in the blob area of a cooked model, used instead of the vertex data if set.
+    const unsigned char* cookedVertexData;
     /// Position only version of the vertex data, to be retained after load.
     SharedArrayPtr<Vector3> cpuPositionData;
+
+    /// Return the vertex data to use.
+    const unsigned char* Data() const { return cookedVertexData ? cookedVertexData : vertexData.Get(); }
 };
 
 /// Load-time description of an index buffer, to be uploaded on the GPU later.
@@ -49,6 +63,47 @@ struct GeometryDesc
     unsigned drawStart;
     /// Draw range element count.
     unsigned drawCount;
+    /// Meshlets built for the draw range.
+    std::vector<Meshlet> meshlets;
+};
+
+/// Load-time description of a morph target's deltas in one vertex buffer.
+struct MorphBufferDesc
+{
+    /// Morph index.
+    unsigned morphIndex;
+    /// Vertex buffer ref.
+    unsigned vbRef;
+    /// Affected vertex indices.
+    std::vector<unsigned> vertices;
+    /// Position deltas per affected vertex, or empty if none.
+    std::vector<Vector3> positionDeltas;
+    /// Normal deltas per affected vertex, or empty if none.
+    std::vector<Vector3> normalDeltas;
+    /// Tangent deltas per affected vertex, or empty if none.
+    std::vector<Vector3> tangentDeltas;
+};
+
+/// Sparse deltas of all morph targets of a vertex buffer on the GPU, grouped by vertex. The storage buffer begins with a header of vertex index, first delta and delta count per affected vertex, followed by three 4-component vectors per delta: the position with the morph index in w, the normal and the tangent.
+struct MorphStream
+{
+    /// Source vertex buffer.
+    SharedPtr<VertexBuffer> vertexBuffer;
+    /// Storage buffer of the headers and deltas.
+    SharedPtr<VertexBuffer> deltaBuffer;
+    /// Number of vertices affected by any morph target.
+    size_t numVertices;
+    /// Number of deltas.
+    size_t numDeltas;
+};
+
+/// %Model's morph target description.
+struct ModelMorph
+{
+    /// Name.
+    std::string name;
+    /// Name hash.
+    StringHash nameHash;
 };
 
 /// %Model's bone description.
@@ -81,38 +136,87 @@ struct ModelBone
     bool active;
 };
 
-/// Combined vertex and index buffers for static models.
+/// Simplified triangle mesh for software occlusion rasterization.
+struct OccluderMesh
+{
+    /// Local space vertex positions.
+    std::vector<Vector3> vertices;
+    /// Triangle list indices.
+    std::vector<unsigned> indices;
+};
+
+/// Range of vertices or indices in a combined buffer.
+struct BufferRange
+{
+    /// Default-construct.
+    BufferRange() :
+        start(0),
+        count(0)
+    {
+    }
+
+    /// Construct with start and count.
+    BufferRange(size_t start_, size_t count_) :
+        start(start_),
+        count(count_)
+    {
+    }
+
+    /// First vertex or index.
+    size_t start;
+    /// Number of vertices or indices.
+    size_t count;
+};
+
+/// Combined vertex and index buffers for static models. Vertex and index ranges are allocated with best fit from free lists, and freed ranges are merged with their neighbours for reuse.
 class CombinedBuffer : public RefCounted
 {
 public:
-    /// Construct with the specified vertex elements.
-    CombinedBuffer(const std::vector<VertexElement>& elements);
+    /// Construct with the specified vertex elements and whether to have a position-only vertex buffer.
+    CombinedBuffer(const std::vector<VertexElement>& elements, bool positionStream);
 
-    /// Update vertex data at current position and advance use counter. Return true if data fit the buffer.
-    bool FillVertices(size_t numVertices, const void* data);
-    /// Update index data at current position and advance use counter. Return true if data fit the buffer. Note that index data should be 32-bit.
-    bool FillIndices(size_t numIndices, const void* data);
+    /// Update vertex data in an allocated range. Return true if data fit the buffer. Position data is required if the position-only vertex buffer exists.
+    bool FillVertices(size_t vertexStart, size_t numVertices, const void* data, const Vector3* positionData = nullptr);
+    /// Update index data in an allocated range. Return true if data fit the buffer. Note that index data should be 32-bit.
+    bool FillIndices(size_t indexStart, size_t numIndices, const void* data);
+    /// Free vertex and index ranges returned by Allocate() for reuse.
+    void Free(size_t vertexStart, size_t numVertices, size_t indexStart, size_t numIndices);
 
-    /// Return vertex use count so far.
+    /// Return the number of allocated vertices.
     size_t UsedVertices() const { return usedVertices; }
-    /// Return index use count so far.
+    /// Return the number of allocated indices.
     size_t UsedIndices() const { return usedIndices; }
+    /// Return the free vertex ranges sorted by start.
+    const std::vector<BufferRange>& FreeVertices() const { return freeVertices; }
+    /// Return the free index ranges sorted by start.
+    const std::vector<BufferRange>& FreeIndices() const { return freeIndices; }
     /// Return the large vertex buffer.
     VertexBuffer* GetVertexBuffer() const { return vertexBuffer; }
     /// Return the large index buffer.
     IndexBuffer* GetIndexBuffer() const { return indexBuffer; }
+    /// Return the large position-only vertex buffer, or null if not in use.
+    VertexBuffer* GetPositionBuffer() const { return positionBuffer; }
 
-    /// Allocate space from a buffer and return it for use. New buffers will be created as necessary.
-    static CombinedBuffer* Allocate(const std::vector<VertexElement>& vertexElements, size_t numVertices, size_t numIndices);
+    /// Allocate vertex and index ranges from a buffer with the same vertex layout and return the buffer with the range starts. New buffers will be created as necessary.
+    static CombinedBuffer* Allocate(const std::vector<VertexElement>& vertexElements, size_t numVertices, size_t numIndices, bool positionStream, size_t& vertexStart, size_t& indexStart);
 
 private:
+    /// Allocate vertex and index ranges if both fit. Return true on success.
+    bool Reserve(size_t numVertices, size_t numIndices, size_t& vertexStart, size_t& indexStart);
+
     /// Large vertex buffer.
     SharedPtr<VertexBuffer> vertexBuffer;
     /// Large index buffer.
     SharedPtr<IndexBuffer> indexBuffer;
-    /// Vertex buffer use count so far.
+    /// Large position-only vertex buffer.
+    SharedPtr<VertexBuffer> positionBuffer;
+    /// Free vertex ranges sorted by start.
+    std::vector<BufferRange> freeVertices;
+    /// Free index ranges sorted by start.
+    std::vector<BufferRange> freeIndices;
+    /// Allocated vertex count.
     size_t usedVertices;
-    /// Index buffer use count so far.
+    /// Allocated index count.
     size_t usedIndices;
 
     /// Current buffers.
@@ -133,10 +237,14 @@ public:
     /// Register object factory.
     static void RegisterObject();
 
-    /// Load model from a stream. Return true on success.
+    /// Load model from a stream. Return true on success. Cooked models are loaded as is, without the load-time processing.
     bool BeginLoad(Stream& source) override;
     /// Finalize model loading in the main thread. Return true on success.
     bool EndLoad() override;
+    /// Save the load-time data after BeginLoad() in the same format, including the results of load-time processing such as generated LOD levels and reordering. Fails if vertex compression was used. Return true on success.
+    bool Save(Stream& dest) override;
+    /// Save the load-time data after BeginLoad() in the cooked format, whose 16-byte aligned vertex data is uploaded directly from a memory mapping on load. Supports compressed vertices. Return true on success.
+    bool SaveCooked(Stream& dest);
 
     /// Set number of geometries.
     void SetNumGeometries(size_t num);
@@ -146,7 +254,29 @@ public:
     void SetLocalBoundingBox(const BoundingBox& box);
     /// Set bone descriptions.
     void SetBones(const std::vector<ModelBone>& bones);
+    /// Set the simplified mesh used when rendering occlusion. If not set, it is generated from the lowest LOD levels of the geometries.
+    void SetOccluderMesh(const OccluderMesh& mesh);
+    /// Generate the occluder mesh if not set or generated yet. Should be called in the main thread before rendering occlusion.
+    void PrepareOccluderMesh();
+    /// Return the impostor, baking it with materials per geometry on first use. Should be called in the main thread. Return null if baking fails.
+    Impostor* GetImpostor(const std::vector<Material*>& materials);
+    /// Set whether to store normals and tangents as packed 10-10-10-2 and 2-component texcoords as half floats. Takes effect on next load.
+    void SetVertexCompression(bool enable);
+    /// Set whether to create position-only vertex buffers for non-skinned geometries, to reduce vertex fetch in shadow and depth passes. Takes effect on next load.
+    void SetPositionStreams(bool enable);
+    /// Set whether to partition large non-skinned geometries into meshlets for culling. Reorders their triangles so that each meshlet is a contiguous index range. Takes effect on next load.
+    void SetMeshletGeneration(bool enable);
+    /// Set whether to reorder triangles for vertex cache efficiency and vertices for fetch locality, and optionally sort triangle clusters to reduce overdraw. Takes effect on next load.
+    void SetMeshOptimization(bool enable, bool overdraw = false);
+    /// Set the number of LOD levels including the original to generate by mesh simplification for geometries that have only one level, the triangle count ratio between levels, and the allowed screen space error in pixels at 1080p vertical resolution and default FOV, which determines the LOD distances. Zero or one levels disables. Takes effect on next load.
+    void SetLodGeneration(unsigned numLevels, float ratio = 0.5f, float pixelError = 1.0f);
 
+    /// Return whether the vertex and index data queued under the upload budget has been uploaded.
+    bool IsReady() const override;
+    /// Return the size of the CPU-side geometry data kept for raycasts and occlusion.
+    size_t CpuMemoryUse() const override;
+    /// Return the size of the vertex and index data in GPU buffers. For a combined buffer, only the model's own ranges are counted.
+    size_t GpuMemoryUse() const override;
     /// Return number of geometries.
     size_t NumGeometries() const { return geometries.size(); }
     /// Return number of LOD levels in a geometry.
@@ -159,23 +289,155 @@ public:
     const BoundingBox& LocalBoundingBox() const { return boundingBox; }
     /// Return the model's bone descriptions.
     const std::vector<ModelBone>& Bones() const { return bones; }
+    /// Return the model's morph target descriptions.
+    const std::vector<ModelMorph>& Morphs() const { return morphs; }
+    /// Return morph target index by name, or M_MAX_UNSIGNED if not found.
+    size_t FindMorph(const std::string& name) const;
+    /// Return the GPU morph deltas per vertex buffer.
+    const std::vector<MorphStream>& MorphStreams() const { return morphStreams; }
+    /// Return the bone bounding boxes as a contiguous array for batch transforms. Inactive bones have empty boxes at the origin.
+    const std::vector<BoundingBox>& BoneBoundingBoxes() const { return boneBoundingBoxes; }
+    /// Return whether all bones contribute to bounding boxes.
+    bool AllBonesActive() const { return allBonesActive; }
+    /// Return the occluder mesh. PrepareOccluderMesh() must have been called.
+    const OccluderMesh& GetOccluderMesh() const { return occluderMesh; }
+    /// Return whether vertex compression is used on load.
+    bool VertexCompression() const { return vertexCompression; }
+    /// Return whether position-only vertex buffers are created on load.
+    bool PositionStreams() const { return positionStreams; }
+    /// Return whether meshlets are generated on load.
+    bool MeshletGeneration() const { return meshletGeneration; }
+    /// Return whether triangles and vertices are reordered on load.
+    bool MeshOptimization() const { return meshOptimization; }
+    /// Return whether triangle clusters are sorted to reduce overdraw on load.
+    bool OverdrawOptimization() const { return overdrawOptimization; }
+    /// Return the number of LOD levels to generate on load.
+    unsigned LodGenerationLevels() const { return lodGenerationLevels; }
+    /// Return the triangle count ratio between generated LOD levels.
+    float LodGenerationRatio() const { return lodGenerationRatio; }
+    /// Return the allowed screen space error in pixels for generated LOD levels.
+    float LodGenerationPixelError() const { return lodGenerationPixelError; }
+
+    /// Set vertex compression default for new models.
+    static void SetDefaultVertexCompression(bool enable);
+    /// Return vertex compression default for new models.
+    static bool DefaultVertexCompression() { return defaultVertexCompression; }
+    /// Set position-only vertex buffer default for new models.
+    static void SetDefaultPositionStreams(bool enable);
+    /// Return position-only vertex buffer default for new models.
+    static bool DefaultPositionStreams() { return defaultPositionStreams; }
+    /// Set meshlet generation default for new models.
+    static void SetDefaultMeshletGeneration(bool enable);
+    /// Return meshlet generation default for new models.
+    static bool DefaultMeshletGeneration() { return defaultMeshletGeneration; }
+    /// Set mesh optimization defaults for new models.
+    static void SetDefaultMeshOptimization(bool enable, bool overdraw = false);
+    /// Return mesh optimization default for new models.
+    static bool DefaultMeshOptimization() { return defaultMeshOptimization; }
+    /// Set LOD generation defaults for new models.
+    static void SetDefaultLodGeneration(unsigned numLevels, float ratio = 0.5f, float pixelError = 1.0f);
+    /// Return the default number of LOD levels to generate for new models.
+    static unsigned DefaultLodGenerationLevels() { return defaultLodGenerationLevels; }
 
 private:
+    /// Load the rest of a cooked model after the file ID.
+    bool BeginLoadCooked(Stream& source);
     /// Apply per-geometry bone mappings (legacy feature, not needed anymore.)
     void ApplyBoneMappings(const GeometryDesc& geomDesc, const std::vector<unsigned>& boneMappings, std::set<std::pair<unsigned, unsigned> >& processedVertices);
+    /// Generate the occluder mesh from the CPU-side data of the lowest LOD levels.
+    void GenerateOccluderMesh();
+    /// Convert the normals, tangents and 2-component texcoords of a vertex buffer to compressed element types.
+    void CompressVertices(VertexBufferDesc& vbDesc);
+    /// Partition the triangles of a geometry into meshlets, rewriting its index range in meshlet order.
+    void BuildMeshlets(GeometryDesc& geomDesc);
+    /// Reorder the triangles of each draw range for the vertex cache, and optionally to reduce overdraw.
+    void OptimizeIndices();
+    /// Reorder the vertices of a vertex buffer in order of first use and remap its index buffers.
+    void OptimizeVertexFetch(unsigned vbRef);
+    /// Generate simplified LOD levels for a geometry that has only the original level. Appends index buffers for the new levels.
+    void GenerateLodLevels(std::vector<GeometryDesc>& lodDescs);
+    /// Free the model's ranges in the combined buffer, if in use.
+    void ReleaseCombinedBuffer();
+    /// Copy the bone bounding boxes to a contiguous array.
+    void UpdateBoneBoundingBoxes();
+    /// Read the morph targets of the model format. Return true on success.
+    bool ReadMorphs(Stream& source);
+    /// Write the morph targets in the model format.
+    void WriteMorphs(Stream& dest) const;
+    /// Create the GPU morph deltas from the load-time descriptions for the created vertex buffers.
+    void CreateMorphStreams(const std::vector<SharedPtr<VertexBuffer> >& vertexBuffers);
 
     /// Local space bounding box.
     BoundingBox boundingBox;
     /// %Model's bone descriptions.
     std::vector<ModelBone> bones;
+    /// Bone bounding boxes for batch transforms.
+    std::vector<BoundingBox> boneBoundingBoxes;
+    /// %Model's morph target descriptions.
+    std::vector<ModelMorph> morphs;
+    /// GPU morph deltas per vertex buffer.
+    std::vector<MorphStream> morphStreams;
+    /// Whether all bones are active.
+    bool allBonesActive;
     /// Geometry LOD levels.
     std::vector<std::vector<SharedPtr<Geometry> > > geometries;
     /// Combined buffer if in use.
     SharedPtr<CombinedBuffer> combinedBuffer;
+    /// Vertex range allocated from the combined buffer.
+    BufferRange combinedVertices;
+    /// Index range allocated from the combined buffer.
+    BufferRange combinedIndices;
     /// Vertex buffer data for loading.
     std::vector<VertexBufferDesc> vbDescs;
     /// Index buffer data for loading.
     std::vector<IndexBufferDesc> ibDescs;
     /// Geometry descriptions for loading.
     std::vector<std::vector<GeometryDesc> > geomDescs;
+    /// Morph target deltas for loading.
+    std::vector<MorphBufferDesc> morphDescs;
+    /// Memory mapping of a cooked model for loading.
+    AutoPtr<MappedFile> cookedFile;
+    /// Blob area of a cooked model for loading, if could not be memory mapped.
+    SharedArrayPtr<unsigned char> cookedData;
+    /// Occluder mesh.
+    OccluderMesh occluderMesh;
+    /// Far distance impostor, baked on demand.
+    SharedPtr<Impostor> impostor;
+    /// Size of the CPU-side position and index data.
+    size_t cpuDataSize;
+    /// Occluder mesh valid flag.
+    bool occluderMeshValid;
+    /// Vertex compression flag.
+    bool vertexCompression;
+    /// Position-only vertex buffers flag.
+    bool positionStreams;
+    /// Meshlet generation flag.
+    bool meshletGeneration;
+    /// Mesh optimization flag.
+    bool meshOptimization;
+    /// Overdraw optimization flag.
+    bool overdrawOptimization;
+    /// Number of LOD levels to generate.
+    unsigned lodGenerationLevels;
+    /// Triangle count ratio between generated LOD levels.
+    float lodGenerationRatio;
+    /// Allowed screen space error in pixels for generated LOD levels.
+    float lodGenerationPixelError;
+
+    /// Vertex compression default for new models.
+    static bool defaultVertexCompression;
+    /// Position-only vertex buffer default for new models.
+    static bool defaultPositionStreams;
+    /// Meshlet generation default for new models.
+    static bool defaultMeshletGeneration;
+    /// Mesh optimization default for new models.
+    static bool defaultMeshOptimization;
+    /// Overdraw optimization default for new models.
+    static bool defaultOverdrawOptimization;
+    /// Number of LOD levels to generate default for new models.
+    static unsigned defaultLodGenerationLevels;
+    /// LOD generation triangle count ratio default for new models.
+    static float defaultLodGenerationRatio;
+    /// LOD generation pixel error default for new models.
+    static float defaultLodGenerationPixelError;
 };
@@ -0,0 +1,131 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "OcclusionBuffer.h"
+
+#include <tracy/Tracy.hpp>
+
+OcclusionBuffer::OcclusionBuffer() :
+    viewProj(Matrix4::IDENTITY)
+{
+}
+
+void OcclusionBuffer::SetData(const float* depthData, int width, int height, const Matrix4& viewProj_)
+{
+    ZoneScoped;
+
+    if (!depthData || width <= 0 || height <= 0)
+    {
+        Reset();
+        return;
+    }
+
+    viewProj = viewProj_;
+
+    size_t numLevels = 1;
+    for (int size = Max(width, height); size > 1; size = (size + 1) / 2)
+        ++numLevels;
+
+    levels.resize(numLevels);
+    levelSizes.resize(numLevels);
+
+    levels[0].assign(depthData, depthData + width * height);
+    levelSizes[0] = IntVector2(width, height);
+
+    // Each texel of the next level holds the maximum of the 2x2 texels below it. Odd edges are clamped
+    for (size_t i = 1; i < numLevels; ++i)
+    {
+        const std::vector<float>& src = levels[i - 1];
+        IntVector2 srcSize = levelSizes[i - 1];
+        IntVector2 size((srcSize.x + 1) / 2, (srcSize.y + 1) / 2);
+        std::vector<float>& dest = levels[i];
+        dest.resize(size.x * size.y);
+        levelSizes[i] = size;
+
+        for (int y = 0; y < size.y; ++y)
+        {
+            const float* row0 = &src[(y * 2) * srcSize.x];
+            const float* row1 = &src[Min(y * 2 + 1, srcSize.y - 1) * srcSize.x];
+            float* destRow = &dest[y * size.x];
+
+            for (int x = 0; x < size.x; ++x)
+            {
+                int x0 = x * 2;
+                int x1 = Min(x0 + 1, srcSize.x - 1);
+                destRow[x] = Max(Max(row0[x0], row0[x1]), Max(row1[x0], row1[x1]));
+            }
+        }
+    }
+}
+
+void OcclusionBuffer::Reset()
+{
+    levels.clear();
+    levelSizes.clear();
+}
+
+bool OcclusionBuffer::IsVisible(const BoundingBox& box) const
+{
+    if (levels.empty())
+        return true;
+
+    Vector2 minPos(M_INFINITY, M_INFINITY);
+    Vector2 maxPos(-M_INFINITY, -M_INFINITY);
+    float minDepth = M_INFINITY;
+
+    for (size_t i = 0; i < 8; ++i)
+    {
+        Vector4 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z, 1.0f);
+        Vector4 projected = viewProj * corner;
+
+        // If any corner is behind the near plane, can not reliably determine the screen extents
+        if (projected.w <= M_EPSILON)
+            return true;
+
+        float invW = 1.0f / projected.w;
+        float x = projected.x * invW;
+        float y = projected.y * invW;
+        minPos.x = Min(minPos.x, x);
+        minPos.y = Min(minPos.y, y);
+        maxPos.x = Max(maxPos.x, x);
+        maxPos.y = Max(maxPos.y, y);
+        minDepth = Min(minDepth, projected.z * invW);
+    }
+
+    // Parts outside the depth buffer have no occlusion information
+    if (minPos.x < -1.0f || minPos.y < -1.0f || maxPos.x > 1.0f || maxPos.y > 1.0f)
+        return true;
+
+    // Convert from normalized device coordinates to the 0-1 depth range
+    minDepth = minDepth * 0.5f + 0.5f;
+
+    const IntVector2& size = levelSizes[0];
+    int left = Clamp((int)((minPos.x * 0.5f + 0.5f) * size.x), 0, size.x - 1);
+    int right = Clamp((int)((maxPos.x * 0.5f + 0.5f) * size.x), 0, size.x - 1);
+    int bottom = Clamp((int)((minPos.y * 0.5f + 0.5f) * size.y), 0, size.y - 1);
+    int top = Clamp((int)((maxPos.y * 0.5f + 0.5f) * size.y), 0, size.y - 1);
+
+    // Go up the pyramid until the rectangle covers at most 2x2 texels
+    size_t level = 0;
+    while (level + 1 < levels.size() && (right - left > 1 || top - bottom > 1))
+    {
+        left >>= 1;
+        right >>= 1;
+        bottom >>= 1;
+        top >>= 1;
+        ++level;
+    }
+
+    const std::vector<float>& depth = levels[level];
+    int width = levelSizes[level].x;
+
+    for (int y = bottom; y <= top; ++y)
+    {
+        for (int x = left; x <= right; ++x)
+        {
+            if (minDepth <= depth[y * width + x])
+                return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,35 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/BoundingBox.h"
+#include "../Math/IntVector2.h"
+#include "../Math/Matrix4.h"
+
+#include <vector>
+
+/// CPU-side hierarchical depth buffer for occlusion testing. Built from a downsampled depth buffer readback, storing the maximum depth on each level.
+class OcclusionBuffer
+{
+public:
+    /// Construct with no data.
+    OcclusionBuffer();
+
+    /// Build the depth pyramid from depth values in the 0-1 range, with the first row at the bottom. The view-projection matrix is the one the depth was rendered with.
+    void SetData(const float* depthData, int width, int height, const Matrix4& viewProj);
+    /// Discard the data. All tests will then pass.
+    void Reset();
+
+    /// Test whether a world space bounding box may be visible. Returns true also when there is no data, or when the box extends outside the depth buffer or behind the near plane.
+    bool IsVisible(const BoundingBox& box) const;
+    /// Return whether has data for testing.
+    bool HasData() const { return levels.size() > 0; }
+
+private:
+    /// Depth pyramid levels, starting from the full size.
+    std::vector<std::vector<float> > levels;
+    /// Depth pyramid level sizes.
+    std::vector<IntVector2> levelSizes;
+    /// View-projection matrix of the depth data.
+    Matrix4 viewProj;
+};
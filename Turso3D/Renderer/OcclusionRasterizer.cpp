@@ -0,0 +1,170 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Matrix3x4.h"
+#include "../Math/Quaternion.h"
+#include "Model.h"
+#include "OcclusionRasterizer.h"
+
+#include <tracy/Tracy.hpp>
+
+OcclusionRasterizer::OcclusionRasterizer() :
+    width(0),
+    height(0),
+    viewProj(Matrix4::IDENTITY)
+{
+}
+
+void OcclusionRasterizer::SetSize(int width_, int height_, unsigned numThreads)
+{
+    width = Max(width_, 1);
+    height = Max(height_, 1);
+    depth.resize(width * height);
+    threadTriangles.resize(numThreads ? numThreads : 1);
+}
+
+void OcclusionRasterizer::BeginView(const Matrix4& viewProj_)
+{
+    viewProj = viewProj_;
+
+    for (auto it = threadTriangles.begin(); it != threadTriangles.end(); ++it)
+        it->clear();
+}
+
+void OcclusionRasterizer::AddOccluder(const OccluderMesh& mesh, const Matrix3x4& worldTransform, unsigned threadIndex)
+{
+    if (threadIndex >= threadTriangles.size() || mesh.indices.size() < 3)
+        return;
+
+    Matrix4 worldViewProj = viewProj * worldTransform;
+    std::vector<OccluderTriangle>& triangles = threadTriangles[threadIndex];
+    float halfWidth = 0.5f * width;
+    float halfHeight = 0.5f * height;
+
+    for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+    {
+        OccluderTriangle tri;
+        bool reject = false;
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            Vector4 projected = worldViewProj * Vector4(mesh.vertices[mesh.indices[i + j]], 1.0f);
+
+            // Triangles crossing the near plane would need clipping. Skip them instead, which only loses some occlusion
+            if (projected.w <= M_EPSILON || projected.z < -projected.w)
+            {
+                reject = true;
+                break;
+            }
+
+            float invW = 1.0f / projected.w;
+            tri.v[j] = Vector3((projected.x * invW + 1.0f) * halfWidth, (projected.y * invW + 1.0f) * halfHeight, Min(projected.z * invW * 0.5f + 0.5f, 1.0f));
+        }
+
+        if (reject)
+            continue;
+
+        // Keep only the faces that would be drawn with back face culling, which are clockwise in window coordinates. Store them counterclockwise
+        float area = (tri.v[1].x - tri.v[0].x) * (tri.v[2].y - tri.v[0].y) - (tri.v[1].y - tri.v[0].y) * (tri.v[2].x - tri.v[0].x);
+        if (area >= 0.0f)
+            continue;
+        std::swap(tri.v[1], tri.v[2]);
+
+        float minX = Min(Min(tri.v[0].x, tri.v[1].x), tri.v[2].x);
+        float maxX = Max(Max(tri.v[0].x, tri.v[1].x), tri.v[2].x);
+        float minY = Min(Min(tri.v[0].y, tri.v[1].y), tri.v[2].y);
+        float maxY = Max(Max(tri.v[0].y, tri.v[1].y), tri.v[2].y);
+        if (maxX < 0.0f || minX > (float)width || maxY < 0.0f || minY > (float)height)
+            continue;
+
+        // Pixels are sampled at their centers
+        tri.minY = Max((int)ceilf(minY - 0.5f), 0);
+        tri.maxY = Min((int)floorf(maxY - 0.5f), height - 1);
+        if (tri.minY > tri.maxY)
+            continue;
+
+        triangles.push_back(tri);
+    }
+}
+
+void OcclusionRasterizer::Rasterize(int startRow, int endRow)
+{
+    ZoneScoped;
+
+    startRow = Max(startRow, 0);
+    endRow = Min(endRow, height);
+    if (startRow >= endRow)
+        return;
+
+    for (int y = startRow; y < endRow; ++y)
+    {
+        float* row = &depth[y * width];
+        for (int x = 0; x < width; ++x)
+            row[x] = 1.0f;
+    }
+
+    for (auto it = threadTriangles.begin(); it != threadTriangles.end(); ++it)
+    {
+        for (auto tIt = it->begin(); tIt != it->end(); ++tIt)
+        {
+            const OccluderTriangle& tri = *tIt;
+            if (tri.maxY < startRow || tri.minY >= endRow)
+                continue;
+
+            const Vector3& v0 = tri.v[0];
+            const Vector3& v1 = tri.v[1];
+            const Vector3& v2 = tri.v[2];
+
+            float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+            if (area <= 0.0f)
+                continue;
+
+            // Depth is linear in screen space after the perspective divide
+            float invArea = 1.0f / area;
+            float dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * invArea;
+            float dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) * invArea;
+
+            int minX = Max((int)ceilf(Min(Min(v0.x, v1.x), v2.x) - 0.5f), 0);
+            int maxX = Min((int)floorf(Max(Max(v0.x, v1.x), v2.x) - 0.5f), width - 1);
+            int minY = Max(tri.minY, startRow);
+            int maxY = Min(tri.maxY, endRow - 1);
+            float maxZ = Max(Max(v0.z, v1.z), v2.z);
+            // Store the farthest depth within the pixel footprint, not at the center, to stay conservative
+            float zBias = 0.5f * (Abs(dzdx) + Abs(dzdy));
+
+            for (int y = minY; y <= maxY; ++y)
+            {
+                float py = y + 0.5f;
+                float px = minX + 0.5f;
+                // Edge functions, positive inside. Step along the row
+                float e0 = (v1.x - v0.x) * (py - v0.y) - (v1.y - v0.y) * (px - v0.x);
+                float e1 = (v2.x - v1.x) * (py - v1.y) - (v2.y - v1.y) * (px - v1.x);
+                float e2 = (v0.x - v2.x) * (py - v2.y) - (v0.y - v2.y) * (px - v2.x);
+                float z = v0.z + dzdx * (px - v0.x) + dzdy * (py - v0.y) + zBias;
+                float* row = &depth[y * width];
+
+                for (int x = minX; x <= maxX; ++x)
+                {
+                    if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f)
+                    {
+                        float pixelZ = Min(z, maxZ);
+                        if (pixelZ < row[x])
+                            row[x] = pixelZ;
+                    }
+
+                    e0 -= v1.y - v0.y;
+                    e1 -= v2.y - v1.y;
+                    e2 -= v0.y - v2.y;
+                    z += dzdx;
+                }
+            }
+        }
+    }
+}
+
+size_t OcclusionRasterizer::NumTriangles() const
+{
+    size_t ret = 0;
+    for (auto it = threadTriangles.begin(); it != threadTriangles.end(); ++it)
+        ret += it->size();
+    return ret;
+}
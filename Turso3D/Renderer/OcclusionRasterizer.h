@@ -0,0 +1,59 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Matrix3x4.h"
+#include "../Math/Matrix4.h"
+
+#include <vector>
+
+struct OccluderMesh;
+
+/// Screen space occluder triangle. X and Y are in pixels and Z is depth in the 0-1 range.
+struct OccluderTriangle
+{
+    /// Vertices.
+    Vector3 v[3];
+    /// Pixel row range covered.
+    int minY, maxY;
+};
+
+/// Software depth rasterizer for occluder meshes. Triangles can be added from several threads, after which row ranges are rasterized in parallel. The result is suitable for building an OcclusionBuffer.
+class OcclusionRasterizer
+{
+public:
+    /// Construct.
+    OcclusionRasterizer();
+
+    /// Set buffer size and the number of threads that will add occluders.
+    void SetSize(int width, int height, unsigned numThreads);
+    /// Begin a new view. Clears the triangles added so far.
+    void BeginView(const Matrix4& viewProj);
+    /// Transform and add an occluder mesh's front-facing triangles. Threadsafe as long as each thread uses its own index.
+    void AddOccluder(const OccluderMesh& mesh, const Matrix3x4& worldTransform, unsigned threadIndex);
+    /// Clear and rasterize a range of rows. Threadsafe as long as the ranges do not overlap.
+    void Rasterize(int startRow, int endRow);
+
+    /// Return the depth data, with the first row at the bottom.
+    const float* DepthData() const { return depth.size() ? &depth[0] : nullptr; }
+    /// Return width.
+    int Width() const { return width; }
+    /// Return height.
+    int Height() const { return height; }
+    /// Return the view-projection matrix of the current view.
+    const Matrix4& ViewProj() const { return viewProj; }
+    /// Return the number of triangles added for the current view.
+    size_t NumTriangles() const;
+
+private:
+    /// Buffer width.
+    int width;
+    /// Buffer height.
+    int height;
+    /// View-projection matrix.
+    Matrix4 viewProj;
+    /// Screen space triangles per thread.
+    std::vector<std::vector<OccluderTriangle> > threadTriangles;
+    /// Depth data.
+    std::vector<float> depth;
+};
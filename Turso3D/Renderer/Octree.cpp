@@ -3,6 +3,7 @@
 #include "../IO/Log.h"
 #include "../Math/Ray.h"
 #include "DebugRenderer.h"
+#include "Hlod.h"
 #include "Octree.h"
 
 #include <cassert>
@@ -12,8 +13,36 @@
 static const float DEFAULT_OCTREE_SIZE = 1000.0f;
 static const int DEFAULT_OCTREE_LEVELS = 8;
 static const int MAX_OCTREE_LEVELS = 255;
+static const int DEFAULT_MAX_AUTO_RESIZE_LEVELS = 16;
 
 static const size_t MIN_THREADED_UPDATE = 16;
+static const size_t MIN_THREADED_RAYCASTS = 16;
+static const size_t BOUNDING_BOX_BATCH_SIZE = 64;
+static const size_t MIN_BULK_INSERT = 1024;
+static const unsigned MAX_BULK_INSERT_DEPTH = 21;
+
+/// Drawable with its target octant in a bulk insertion.
+struct BulkInsertion
+{
+    /// Sort by octant, then lights first.
+    bool operator < (const BulkInsertion& rhs) const
+    {
+        if (path != rhs.path)
+            return path < rhs.path;
+        if (depth != rhs.depth)
+            return depth < rhs.depth;
+        return light > rhs.light;
+    }
+
+    /// Child indices from the root, three bits per level from the most significant bits. This is the Morton code of the box center truncated to the octant's depth, which the box size decides.
+    unsigned long long path;
+    /// Depth below the root.
+    unsigned depth;
+    /// Light flag.
+    bool light;
+    /// Drawable.
+    Drawable* drawable;
+};
 
 bool CompareRaycastResults(const RaycastResult& lhs, const RaycastResult& rhs)
 {
@@ -25,16 +54,6 @@ bool CompareDrawableDistances(const std::pair<Drawable*, float>& lhs, const std:
     return lhs.second < rhs.second;
 }
 
-bool CompareDrawables(Drawable* lhs, Drawable* rhs)
-{
-    unsigned short lhsFlags = lhs->Flags() & (DF_LIGHT | DF_GEOMETRY);
-    unsigned short rhsFlags = rhs->Flags() & (DF_LIGHT | DF_GEOMETRY);
-    if (lhsFlags != rhsFlags)
-        return lhsFlags < rhsFlags;
-    else
-        return lhs < rhs;
-}
-
 void Octant::Initialize(Octant* parent_, const BoundingBox& boundingBox, unsigned char level_, unsigned char childIndex_)
 {
     BoundingBox worldBoundingBox = boundingBox;
@@ -45,8 +64,28 @@ void Octant::Initialize(Octant* parent_, const BoundingBox& boundingBox, unsigne
     level = level_;
     numChildren = 0;
     childIndex = childIndex_;
-    sortDirty = false;
     parent = parent_;
+    staticBatchVersion = 0;
+    hlod = nullptr;
+    debugGeometryDirty = true;
+
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+        children[i] = nullptr;
+}
+
+void Octant::InitializeLeaf(const BoundingBox& boundingBox)
+{
+    center = boundingBox.Center();
+    halfSize = boundingBox.HalfSize();
+    cullingBox = boundingBox;
+
+    level = 0;
+    numChildren = 0;
+    childIndex = 0;
+    parent = nullptr;
+    staticBatchVersion = 0;
+    hlod = nullptr;
+    debugGeometryDirty = true;
 
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
         children[i] = nullptr;
@@ -71,41 +110,114 @@ bool Octant::FitBoundingBox(const BoundingBox& box, const Vector3& boxSize) cons
     return false;
 }
 
+BoundingBox Octant::ChildBounds(unsigned char index) const
+{
+    // Remove the culling extra from the bounding box before splitting
+    Vector3 newMin = cullingBox.min + halfSize;
+    Vector3 newMax = cullingBox.max - halfSize;
+
+    if (index & 1)
+        newMin.x = center.x;
+    else
+        newMax.x = center.x;
+
+    if (index & 2)
+        newMin.y = center.y;
+    else
+        newMax.y = center.y;
+
+    if (index & 4)
+        newMin.z = center.z;
+    else
+        newMax.z = center.z;
+
+    return BoundingBox(newMin, newMax);
+}
+
 void Octant::OnRenderDebug(DebugRenderer* debug)
 {
     debug->AddBoundingBox(cullingBox, Color::GRAY, true);
 }
 
+void Octant::EraseDrawable(size_t index)
+{
+    size_t last = drawables.size() - 1;
+
+    // When removing a light, fill its place with the last light first so that the lights stay contiguous
+    if (drawableFlags[index] & DF_LIGHT)
+    {
+        size_t lastLight = index;
+        while (lastLight < last && (drawableFlags[lastLight + 1] & DF_LIGHT))
+            ++lastLight;
+        if (lastLight != index)
+            MoveDrawable(lastLight, index);
+        index = lastLight;
+    }
+
+    if (index != last)
+        MoveDrawable(last, index);
+
+    staticBatchVersion = 0;
+    debugGeometryDirty = true;
+    drawables.pop_back();
+    drawableFlags.pop_back();
+    drawableLayerMasks.pop_back();
+
+    if (drawables.size() % BOUNDING_BOX_PACK_SIZE == 0)
+        drawableBoxes.pop_back();
+}
+
 Octree::Octree() :
     threadedUpdate(false),
+    updating(false),
+    drawableVersion(0),
+    removalVersion(0),
+    structureVersion(0),
+    bvhVersion(0),
     frameNumber(0),
+    autoResize(false),
+    maxAutoResizeLevels(DEFAULT_MAX_AUTO_RESIZE_LEVELS),
+    staticBvh(false),
+    bvhDirty(false),
     workQueue(Subsystem<WorkQueue>())
 {
     assert(workQueue);
 
     root.Initialize(nullptr, BoundingBox(-DEFAULT_OCTREE_SIZE, DEFAULT_OCTREE_SIZE), DEFAULT_OCTREE_LEVELS, 0);
 
-    // Have at least 1 task for reinsert processing
-    reinsertTasks.push_back(new ReinsertDrawablesTask(this, &Octree::CheckReinsertWork));
+    updateQueues.resize(workQueue->NumThreads());
     reinsertQueues.resize(workQueue->NumThreads());
+    staticChanges.resize(workQueue->NumThreads());
+    staticTransformChanges.resize(workQueue->NumThreads(), std::make_pair(M_MAX_UNSIGNED, 0u));
+    raycastScratch.resize(workQueue->NumThreads());
 }
 
 Octree::~Octree()
 {
+    ClearHlod();
+
     // Clear octree association from nodes that were never inserted
     // Note: the threaded queues cannot have nodes that were never inserted, only nodes that should be moved
-    for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
+    for (auto it = updateQueues.begin(); it != updateQueues.end(); ++it)
     {
-        Drawable* drawable = *it;
-        if (drawable)
+        for (auto dIt = it->begin(); dIt != it->end(); ++dIt)
         {
-            drawable->octant = nullptr;
-            drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
-            drawable->Owner()->octree = nullptr;
+            Drawable* drawable = *dIt;
+            if (drawable)
+            {
+                drawable->octant = nullptr;
+                RemoveDrawableFromQueue(drawable);
+                drawable->Owner()->octree = nullptr;
+            }
         }
     }
 
     DeleteChildOctants(&root, true);
+    for (auto it = bvhLeaves.begin(); it != bvhLeaves.end(); ++it)
+    {
+        DeleteChildOctants(*it, true);
+        allocator.Free(*it);
+    }
 }
 
 void Octree::RegisterObject()
@@ -114,78 +226,145 @@ void Octree::RegisterObject()
     CopyBaseAttributes<Octree, Node>();
     RegisterRefAttribute("boundingBox", &Octree::BoundingBoxAttr, &Octree::SetBoundingBoxAttr);
     RegisterAttribute("numLevels", &Octree::NumLevelsAttr, &Octree::SetNumLevelsAttr);
+    RegisterAttribute("autoResize", &Octree::AutoResize, &Octree::SetAutoResize, false);
+    RegisterAttribute("maxAutoResizeLevels", &Octree::MaxAutoResizeLevels, &Octree::SetMaxAutoResizeLevels, DEFAULT_MAX_AUTO_RESIZE_LEVELS);
+    RegisterAttribute("staticBvh", &Octree::StaticBvh, &Octree::SetStaticBvh, false);
 }
 
 void Octree::Update(unsigned short frameNumber_)
 {
     ZoneScoped;
+    MEMORY_SCOPE(MEMORY_OCTREE);
 
     frameNumber = frameNumber_;
+    updating = true;
 
-    // Avoid overhead of threaded update if only a small number of objects to update / reinsert
-    if (updateQueue.size() >= MIN_THREADED_UPDATE)
+    // Combine the per-thread queues for splitting the checks evenly
+    updateQueue.clear();
+    for (auto it = updateQueues.begin(); it != updateQueues.end(); ++it)
     {
-        SetThreadedUpdate(true);
-
-        // Split into smaller tasks to encourage work stealing in case some thread is slower
-        size_t nodesPerTask = Max(MIN_THREADED_UPDATE, updateQueue.size() / workQueue->NumThreads() / 4);
-        size_t taskIdx = 0;
-
-        for (size_t start = 0; start < updateQueue.size(); start += nodesPerTask)
+        for (auto dIt = it->begin(); dIt != it->end(); ++dIt)
         {
-            size_t end = start + nodesPerTask;
-            if (end > updateQueue.size())
-                end = updateQueue.size();
-
-            if (reinsertTasks.size() <= taskIdx)
-                reinsertTasks.push_back(new ReinsertDrawablesTask(this, &Octree::CheckReinsertWork));
-            reinsertTasks[taskIdx]->start = &updateQueue[0] + start;
-            reinsertTasks[taskIdx]->end = &updateQueue[0] + end;
-            ++taskIdx;
+            Drawable* drawable = *dIt;
+            if (drawable)
+                AddDrawableToQueue(drawable, updateQueue);
         }
+        it->clear();
+    }
 
-        workQueue->QueueTasks(taskIdx, reinterpret_cast<Task**>(&reinsertTasks[0]));
-        workQueue->Complete();
-
+    if (updateQueue.size())
+    {
+        // Reinsertions found during the update go to per-thread queues. Small queues will be processed in the calling thread only
+        SetThreadedUpdate(true);
+        workQueue->ParallelFor(0, updateQueue.size(), MIN_THREADED_UPDATE, [this](size_t start, size_t end, unsigned threadIndex)
+        {
+            CheckReinsert(start, end, threadIndex);
+        });
         SetThreadedUpdate(false);
+    }
 
+    // Process also the reinsertions left over from threaded mode outside the update. Combine the queues when there are enough for inserting the new drawables in bulk
+    size_t numReinserts = 0;
+    for (auto it = reinsertQueues.begin(); it != reinsertQueues.end(); ++it)
+        numReinserts += it->size();
+    if (numReinserts >= MIN_BULK_INSERT)
+    {
+        updateQueue.clear();
+        updateQueue.reserve(numReinserts);
         for (auto it = reinsertQueues.begin(); it != reinsertQueues.end(); ++it)
-            ReinsertDrawables(*it);
+        {
+            for (auto dIt = it->begin(); dIt != it->end(); ++dIt)
+            {
+                Drawable* drawable = *dIt;
+                if (drawable)
+                    AddDrawableToQueue(drawable, updateQueue);
+            }
+            it->clear();
+        }
+        ReinsertDrawables(updateQueue);
     }
-    else if (updateQueue.size())
+    else
     {
-        // Execute a complete queue reinsert manually
-        reinsertTasks[0]->start = &updateQueue[0];
-        reinsertTasks[0]->end = &updateQueue[0] + updateQueue.size();
-        reinsertTasks[0]->Complete(0);
-        ReinsertDrawables(reinsertQueues[0]);
+        for (auto it = reinsertQueues.begin(); it != reinsertQueues.end(); ++it)
+            ReinsertDrawables(*it);
     }
 
+    if (hlodProxies.size())
+        InvalidateDirtyHlod();
+
     updateQueue.clear();
 
-    // Sort octants' nodes by address and put lights first
-    for (auto it = sortDirtyOctants.begin(); it != sortDirtyOctants.end(); ++it)
+    if (rootOverflow.IsDefined())
     {
-        Octant* octant = *it;
-        std::sort(octant->drawables.begin(), octant->drawables.end(), CompareDrawables);
-        octant->sortDirty = false;
+        if (autoResize)
+            Grow();
+        rootOverflow.Undefine();
     }
 
-    sortDirtyOctants.clear();
+    if (bvhDirty)
+        RebuildBvh();
+
+    updating = false;
+}
+
+void Octree::SortTransforms()
+{
+    ZoneScoped;
+
+    std::vector<Drawable*> drawables;
+    CollectDrawables(drawables, &root);
+    for (auto it = bvhLeaves.begin(); it != bvhLeaves.end(); ++it)
+        CollectDrawables(drawables, *it);
+
+    std::vector<SpatialNode*> order;
+    order.reserve(drawables.size());
+    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+        order.push_back((*it)->Owner());
+
+    SpatialNode::ReorderWorldTransforms(order);
 }
 
 void Octree::Resize(const BoundingBox& boundingBox, int numLevels)
 {
     ZoneScoped;
 
-    // Collect nodes to the root and delete all child octants
-    updateQueue.clear();
-    CollectDrawables(updateQueue, &root);
+    // The proxies refer to the octants being deleted
+    ClearHlod();
+
+    // Collect nodes and delete all child octants
+    bool wasUpdating = updating;
+    updating = true;
+    ++drawableVersion;
+    std::vector<Drawable*> drawables;
+    CollectDrawables(drawables, &root);
     DeleteChildOctants(&root, false);
+    for (auto it = bvhLeaves.begin(); it != bvhLeaves.end(); ++it)
+    {
+        CollectDrawables(drawables, *it);
+        DeleteChildOctants(*it, false);
+        allocator.Free(*it);
+    }
+    bvhLeaves.clear();
+    bvh.Clear();
+    bvhDirty = false;
     allocator.Reset();
     root.Initialize(nullptr, boundingBox, (unsigned char)Clamp(numLevels, 1, MAX_OCTREE_LEVELS), 0);
 
     // Nodes will be reinserted on next update
+    std::vector<Drawable*>& queue = updateQueues[WorkQueue::ThreadIndex()];
+    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+        AddDrawableToQueue(*it, queue);
+    updating = wasUpdating;
+}
+
+void Octree::SetAutoResize(bool enable)
+{
+    autoResize = enable;
+}
+
+void Octree::SetMaxAutoResizeLevels(int numLevels)
+{
+    maxAutoResizeLevels = Clamp(numLevels, 1, MAX_OCTREE_LEVELS);
 }
 
 void Octree::Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask) const
@@ -194,6 +373,7 @@ void Octree::Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigne
 
     result.clear();
     CollectDrawables(result, const_cast<Octant*>(&root), ray, nodeFlags, maxDistance, layerMask);
+    CollectBvhDrawables(result, ray, nodeFlags, maxDistance, layerMask);
     std::sort(result.begin(), result.end(), CompareRaycastResults);
 }
 
@@ -201,9 +381,32 @@ RaycastResult Octree::RaycastSingle(const Ray& ray, unsigned short nodeFlags, fl
 {
     ZoneScoped;
 
+    return RaycastSingle(ray, nodeFlags, maxDistance, layerMask, raycastScratch[WorkQueue::ThreadIndex()]);
+}
+
+void Octree::RaycastBatch(std::vector<RaycastResult>& result, const std::vector<Ray>& rays, unsigned short nodeFlags, float maxDistance, unsigned layerMask) const
+{
+    ZoneScoped;
+
+    result.resize(rays.size());
+
+    workQueue->ParallelFor(0, rays.size(), MIN_THREADED_RAYCASTS, [&](size_t start, size_t end, unsigned threadIndex)
+    {
+        RaycastScratch& scratch = raycastScratch[threadIndex];
+        for (size_t i = start; i < end; ++i)
+            result[i] = RaycastSingle(rays[i], nodeFlags, maxDistance, layerMask, scratch);
+    });
+}
+
+RaycastResult Octree::RaycastSingle(const Ray& ray, unsigned short nodeFlags, float maxDistance, unsigned layerMask, RaycastScratch& scratch) const
+{
+    std::vector<std::pair<Drawable*, float> >& initialRayResult = scratch.initialResult;
+    std::vector<RaycastResult>& finalRayResult = scratch.finalResult;
+
     // Get first the potential hits
     initialRayResult.clear();
     CollectDrawables(initialRayResult, const_cast<Octant*>(&root), ray, nodeFlags, maxDistance, layerMask);
+    CollectBvhDrawables(initialRayResult, ray, nodeFlags, maxDistance, layerMask);
     std::sort(initialRayResult.begin(), initialRayResult.end(), CompareDrawableDistances);
 
     // Then perform actual per-node ray tests and early-out when possible
@@ -238,34 +441,47 @@ RaycastResult Octree::RaycastSingle(const Ray& ray, unsigned short nodeFlags, fl
     }
 }
 
-void Octree::FindDrawablesMasked(std::vector<Drawable*>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask) const
-{
-    ZoneScoped;
-
-    CollectDrawablesMasked(result, const_cast<Octant*>(&root), frustum, drawableFlags, layerMask);
-}
-
 void Octree::QueueUpdate(Drawable* drawable)
 {
     assert(drawable);
 
+    drawableVersion.fetch_add(1, std::memory_order_relaxed);
+
+    // A drawable is in at most one queue, which will check or perform the reinsertion
     if (!threadedUpdate)
     {
-        updateQueue.push_back(drawable);
-        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
+        if (!drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+            AddDrawableToQueue(drawable, updateQueues[WorkQueue::ThreadIndex()]);
     }
     else
     {
-        drawable->lastUpdateFrameNumber = frameNumber;
-
-        // Do nothing if still fits the current octant
+        // Refresh the culling data in the current octant, as the reinsertion happens only on the next update. Do nothing else if still fits the current octant
         const BoundingBox& box = drawable->WorldBoundingBox();
         Octant* oldOctant = drawable->GetOctant();
-        if (!oldOctant || oldOctant->cullingBox.IsInside(box) != INSIDE)
-        {
-            reinsertQueues[WorkQueue::ThreadIndex()].push_back(drawable);
-            drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
-        }
+        if (oldOctant && drawable->lastUpdateFrameNumber != frameNumber)
+            AddStaticChange(drawable, oldOctant->cullingBox, WorkQueue::ThreadIndex());
+
+        drawable->lastUpdateFrameNumber = frameNumber;
+        if (oldOctant)
+            oldOctant->SetDrawableData(drawable->octantIndex, drawable);
+        UpdateStaticTransform(drawable, WorkQueue::ThreadIndex());
+        if (!drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED) && (!oldOctant || oldOctant->cullingBox.IsInside(box) != INSIDE || InWrongStructure(drawable, oldOctant)))
+            AddDrawableToQueue(drawable, reinsertQueues[WorkQueue::ThreadIndex()]);
+    }
+}
+
+void Octree::QueueInsertions(const std::vector<Drawable*>& drawables)
+{
+    assert(!updating);
+
+    drawableVersion.fetch_add(1, std::memory_order_relaxed);
+
+    std::vector<Drawable*>& queue = updateQueues[WorkQueue::ThreadIndex()];
+    queue.reserve(queue.size() + drawables.size());
+    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    {
+        if (!(*it)->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+            AddDrawableToQueue(*it, queue);
     }
 }
 
@@ -274,19 +490,115 @@ void Octree::RemoveDrawable(Drawable* drawable)
     if (!drawable)
         return;
 
-    RemoveDrawable(drawable, drawable->GetOctant());
-    if (drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+    ++drawableVersion;
+    ++removalVersion;
+    Octant* octant = drawable->GetOctant();
+    if (octant)
+        AddStaticChange(drawable, octant->cullingBox, WorkQueue::ThreadIndex());
+    if (drawable->TestFlag(DF_HLOD))
     {
-        RemoveDrawableFromQueue(drawable, updateQueue);
+        HlodProxy* proxy = FindHlod(octant);
+        if (proxy)
+            proxy->Invalidate();
+    }
+    // Let the BVH shrink when static drawables are removed
+    if (octant && IsBvhLeaf(octant))
+        bvhDirty = true;
+    RemoveDrawable(drawable, octant, drawable->octantIndex);
+    RemoveDrawableFromQueue(drawable);
+    FreeStaticTransform(drawable);
+    drawable->octant = nullptr;
+}
 
-        // Remove also from threaded queues if was left over before next update
-        for (size_t i = 0; i < reinsertQueues.size(); ++i)
-            RemoveDrawableFromQueue(drawable, reinsertQueues[i]);
+void Octree::BuildHlod(int cellLevel, float triangleRatio)
+{
+    ZoneScoped;
 
-        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
+    ClearHlod();
+    if (cellLevel > 0 && cellLevel <= root.level)
+        BuildHlod(&root, cellLevel, triangleRatio);
+}
+
+void Octree::ClearHlod()
+{
+    for (auto it = hlodProxies.begin(); it != hlodProxies.end(); ++it)
+        (*it)->Invalidate();
+    hlodProxies.clear();
+}
+
+void Octree::CollectStaticChanges(std::vector<BoundingBox>& dest)
+{
+    for (auto it = staticChanges.begin(); it != staticChanges.end(); ++it)
+    {
+        dest.insert(dest.end(), it->begin(), it->end());
+        it->clear();
     }
+}
 
-    drawable->octant = nullptr;
+bool Octree::CollectStaticTransformChanges(unsigned& start, unsigned& end)
+{
+    start = M_MAX_UNSIGNED;
+    end = 0;
+
+    for (auto it = staticTransformChanges.begin(); it != staticTransformChanges.end(); ++it)
+    {
+        if (it->first < start)
+            start = it->first;
+        if (it->second > end)
+            end = it->second;
+        *it = std::make_pair(M_MAX_UNSIGNED, 0u);
+    }
+
+    return start < end;
+}
+
+void Octree::SetStaticBvh(bool enable)
+{
+    if (enable == staticBvh)
+        return;
+
+    staticBvh = enable;
+    updating = true;
+    ++drawableVersion;
+
+    // Queue the drawables that are in the wrong structure now. They are moved on the next update
+    std::vector<Drawable*>& queue = updateQueues[WorkQueue::ThreadIndex()];
+
+    if (enable)
+    {
+        bvhPending.clear();
+        CollectDrawables(bvhPending, &root);
+        for (auto it = bvhPending.begin(); it != bvhPending.end(); ++it)
+        {
+            Drawable* drawable = *it;
+            if (drawable->TestFlag(DF_STATIC) && !drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+                AddDrawableToQueue(drawable, queue);
+        }
+        bvhPending.clear();
+    }
+    else
+    {
+        for (auto it = bvhLeaves.begin(); it != bvhLeaves.end(); ++it)
+        {
+            Octant* leaf = *it;
+            for (auto dIt = leaf->drawables.begin(); dIt != leaf->drawables.end(); ++dIt)
+            {
+                Drawable* drawable = *dIt;
+                drawable->octant = nullptr;
+                if (!drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+                    AddDrawableToQueue(drawable, queue);
+            }
+            allocator.Free(leaf);
+        }
+
+        ++structureVersion;
+        ++bvhVersion;
+        bvhLeaves.clear();
+        bvh.Clear();
+        bvhDirty = false;
+    }
+
+    updating = false;
 }
 
 void Octree::SetBoundingBoxAttr(const BoundingBox& value)
@@ -310,14 +622,43 @@ int Octree::NumLevelsAttr() const
     return root.level;
 }
 
-void Octree::ReinsertDrawables(std::vector<Drawable*>& drawables)
+void Octree::ReinsertDrawables(std::vector<Drawable*>& drawables, bool moved)
 {
+    InsertDrawablesBulk(drawables, moved);
+
     for (auto it = drawables.begin(); it != drawables.end(); ++it)
     {
+        // If drawable was removed before reinsertion could happen, a null pointer will be in its place
         Drawable* drawable = *it;
+        if (!drawable)
+            continue;
+
+        drawable->reinsertQueue = nullptr;
+        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
 
         const BoundingBox& box = drawable->WorldBoundingBox();
         Octant* oldOctant = drawable->GetOctant();
+        size_t oldIndex = drawable->octantIndex;
+
+        // The static flag may have changed since the last insertion
+        AllocateStaticTransform(drawable);
+        UpdateStaticTransform(drawable, WorkQueue::ThreadIndex());
+
+        // The old position was recorded when the move was checked, so only the new position is needed
+        if (moved)
+            AddStaticChange(drawable, box, WorkQueue::ThreadIndex());
+
+        // Static drawables are collected for the BVH rebuild at the end of the update
+        if (staticBvh && drawable->TestFlag(DF_STATIC))
+        {
+            if (oldOctant)
+                RemoveDrawable(drawable, oldOctant, oldIndex);
+            drawable->octant = nullptr;
+            bvhPending.push_back(drawable);
+            bvhDirty = true;
+            continue;
+        }
+
         Octant* newOctant = &root;
         Vector3 boxSize = box.Size();
 
@@ -328,6 +669,11 @@ void Octree::ReinsertDrawables(std::vector<Drawable*>& drawables)
                 (newOctant->cullingBox.IsInside(box) != INSIDE || newOctant->FitBoundingBox(box, boxSize)) :
                 newOctant->FitBoundingBox(box, boxSize);
 
+            // Remember drawables that would fit a child octant by size but lie outside the root, so that the octree can grow. Do not count the ones larger than the whole octree, like directional lights
+            if (newOctant == &root && newOctant->cullingBox.IsInside(box) != INSIDE && boxSize.x < root.halfSize.x && boxSize.y < root.halfSize.y &&
+                boxSize.z < root.halfSize.z)
+                rootOverflow.Merge(box);
+
             if (insertHere)
             {
                 if (newOctant != oldOctant)
@@ -335,59 +681,295 @@ void Octree::ReinsertDrawables(std::vector<Drawable*>& drawables)
                     // Add first, then remove, because drawable count going to zero deletes the octree branch in question
                     AddDrawable(drawable, newOctant);
                     if (oldOctant)
-                        RemoveDrawable(drawable, oldOctant);
+                        RemoveDrawable(drawable, oldOctant, oldIndex);
                 }
+                else
+                    newOctant->SetDrawableData(oldIndex, drawable);
                 break;
             }
             else
                 newOctant = CreateChildOctant(newOctant, newOctant->ChildIndex(box.Center()));
         }
-
-        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
     }
 
     drawables.clear();
 }
 
-void Octree::RemoveDrawableFromQueue(Drawable* drawable, std::vector<Drawable*>& drawables)
+void Octree::InsertDrawablesBulk(std::vector<Drawable*>& drawables, bool moved)
 {
+    // The path of the deepest octants would not fit in the sort key
+    if (drawables.size() < MIN_BULK_INSERT || root.level > MAX_BULK_INSERT_DEPTH + 1)
+        return;
+
+    ZoneScoped;
+
+    // Static drawables going to the BVH are left to the regular reinsertion
+    std::vector<BulkInsertion> insertions;
+    insertions.reserve(drawables.size());
     for (auto it = drawables.begin(); it != drawables.end(); ++it)
     {
-        if ((*it) == drawable)
+        Drawable* drawable = *it;
+        if (!drawable || drawable->GetOctant() || (staticBvh && drawable->TestFlag(DF_STATIC)))
+            continue;
+
+        BulkInsertion insertion;
+        insertion.light = drawable->TestFlag(DF_LIGHT);
+        insertion.drawable = drawable;
+        insertions.push_back(insertion);
+        *it = nullptr;
+    }
+
+    if (insertions.empty())
+        return;
+
+    // Descend like the regular reinsertion, but with scratch octants instead of creating them
+    workQueue->ParallelFor(0, insertions.size(), MIN_THREADED_UPDATE, [&](size_t start, size_t end, unsigned)
+    {
+        Octant scratch;
+
+        for (size_t i = start; i < end; ++i)
         {
-            *it = nullptr;
-            break;
+            BulkInsertion& insertion = insertions[i];
+            const BoundingBox& box = insertion.drawable->WorldBoundingBox();
+            Vector3 boxSize = box.Size();
+            insertion.path = 0;
+            insertion.depth = 0;
+
+            if (root.cullingBox.IsInside(box) != INSIDE || root.FitBoundingBox(box, boxSize))
+                continue;
+
+            Vector3 boxCenter = box.Center();
+            const Octant* octant = &root;
+            do
+            {
+                unsigned char index = octant->ChildIndex(boxCenter);
+                insertion.path |= (unsigned long long)index << (3 * (MAX_BULK_INSERT_DEPTH - 1 - insertion.depth));
+                ++insertion.depth;
+                scratch.Initialize(nullptr, octant->ChildBounds(index), octant->level - 1, index);
+                octant = &scratch;
+            } while (!octant->FitBoundingBox(box, boxSize));
         }
+    });
+
+    std::sort(insertions.begin(), insertions.end());
+
+    for (size_t start = 0; start < insertions.size();)
+    {
+        const BulkInsertion& first = insertions[start];
+        size_t end = start + 1;
+        while (end < insertions.size() && insertions[end].path == first.path && insertions[end].depth == first.depth)
+            ++end;
+
+        Octant* octant = &root;
+        for (unsigned i = 0; i < first.depth; ++i)
+            octant = CreateChildOctant(octant, (unsigned char)((first.path >> (3 * (MAX_BULK_INSERT_DEPTH - 1 - i))) & 7));
+
+        size_t newSize = octant->drawables.size() + end - start;
+        octant->drawables.reserve(newSize);
+        octant->drawableBoxes.reserve((newSize + BOUNDING_BOX_PACK_SIZE - 1) / BOUNDING_BOX_PACK_SIZE);
+        octant->drawableFlags.reserve(newSize);
+        octant->drawableLayerMasks.reserve(newSize);
+
+        for (size_t i = start; i < end; ++i)
+        {
+            Drawable* drawable = insertions[i].drawable;
+            const BoundingBox& box = drawable->WorldBoundingBox();
+
+            drawable->reinsertQueue = nullptr;
+            drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
+            AllocateStaticTransform(drawable);
+            UpdateStaticTransform(drawable, WorkQueue::ThreadIndex());
+            if (moved)
+                AddStaticChange(drawable, box, WorkQueue::ThreadIndex());
+
+            // Remember drawables that would fit a child octant by size but lie outside the root, so that the octree can grow
+            if (octant == &root && root.cullingBox.IsInside(box) != INSIDE)
+            {
+                Vector3 boxSize = box.Size();
+                if (boxSize.x < root.halfSize.x && boxSize.y < root.halfSize.y && boxSize.z < root.halfSize.z)
+                    rootOverflow.Merge(box);
+            }
+
+            AddDrawable(drawable, octant);
+        }
+
+        start = end;
     }
 }
 
-Octant* Octree::CreateChildOctant(Octant* octant, unsigned char index)
+void Octree::MarkHlodDirty(Drawable* drawable)
 {
-    if (octant->children[index])
-        return octant->children[index];
+    HlodProxy* proxy = FindHlod(drawable->GetOctant());
+    if (proxy)
+        proxy->dirty.store(true, std::memory_order_relaxed);
+}
 
-    // Remove the culling extra from the bounding box before splitting
-    Vector3 newMin = octant->cullingBox.min + octant->halfSize;
-    Vector3 newMax = octant->cullingBox.max - octant->halfSize;
-    const Vector3& oldCenter = octant->center;
+void Octree::InvalidateDirtyHlod()
+{
+    for (auto it = hlodProxies.begin(); it != hlodProxies.end();)
+    {
+        HlodProxy* proxy = *it;
+        if (proxy->dirty.load(std::memory_order_relaxed) || !proxy->IsValid())
+        {
+            proxy->Invalidate();
+            it = hlodProxies.erase(it);
+        }
+        else
+            ++it;
+    }
+}
 
-    if (index & 1)
-        newMin.x = oldCenter.x;
-    else
-        newMax.x = oldCenter.x;
+void Octree::BuildHlod(Octant* octant, int cellLevel, float triangleRatio)
+{
+    if (octant->level == cellLevel)
+    {
+        std::vector<Drawable*> drawables;
+        CollectDrawables(drawables, octant);
 
-    if (index & 2)
-        newMin.y = oldCenter.y;
-    else
-        newMax.y = oldCenter.y;
+        SharedPtr<HlodProxy> proxy(new HlodProxy());
+        if (!proxy->Build(drawables, triangleRatio))
+            return;
 
-    if (index & 4)
-        newMin.z = oldCenter.z;
+        // Mark the source drawables, also in their octants' flags, so that batch collection can skip them
+        const std::vector<Drawable*>& sources = proxy->SourceDrawables();
+        for (auto it = sources.begin(); it != sources.end(); ++it)
+        {
+            Drawable* drawable = *it;
+            drawable->SetFlag(DF_HLOD, true);
+            drawable->octant->drawableFlags[drawable->octantIndex] |= DF_HLOD;
+        }
+
+        proxy->octant = octant;
+        octant->hlod = proxy;
+        hlodProxies.push_back(proxy);
+        return;
+    }
+
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        if (octant->children[i])
+            BuildHlod(octant->children[i], cellLevel, triangleRatio);
+    }
+}
+
+void Octree::Grow()
+{
+    ZoneScoped;
+
+    // Double the root around its center until its unexpanded bounds contain the overflowing drawables. This keeps the smallest octant size
+    Vector3 center = root.center;
+    Vector3 halfSize = root.halfSize;
+    Vector3 maxDistance = (rootOverflow.max - center).Abs();
+    Vector3 minDistance = (rootOverflow.min - center).Abs();
+    Vector3 required(Max(maxDistance.x, minDistance.x), Max(maxDistance.y, minDistance.y), Max(maxDistance.z, minDistance.z));
+    int numLevels = root.level;
+
+    while (numLevels < maxAutoResizeLevels && (halfSize.x < required.x || halfSize.y < required.y || halfSize.z < required.z))
+    {
+        halfSize *= 2.0f;
+        ++numLevels;
+    }
+
+    if (numLevels == root.level)
+        return;
+
+    LOGDEBUGF("Growing octree to %d levels", numLevels);
+
+    // The BVH leaves are independent of the root and stay as they are. The proxies refer to the root's octants
+    ClearHlod();
+    updateQueue.clear();
+    CollectDrawables(updateQueue, &root);
+    DeleteChildOctants(&root, false);
+    worldBoundingBox = BoundingBox(center - halfSize, center + halfSize);
+    root.Initialize(nullptr, worldBoundingBox, (unsigned char)numLevels, 0);
+    ReinsertDrawables(updateQueue, false);
+}
+
+void Octree::RebuildBvh()
+{
+    ZoneScoped;
+
+    // The drawables remaining in the old leaves are built into the new hierarchy along with the pending ones
+    for (auto it = bvhLeaves.begin(); it != bvhLeaves.end(); ++it)
+    {
+        Octant* leaf = *it;
+        bvhPending.insert(bvhPending.end(), leaf->drawables.begin(), leaf->drawables.end());
+        allocator.Free(leaf);
+    }
+
+    ++structureVersion;
+    ++bvhVersion;
+    bvhLeaves.clear();
+
+    bvhBoxes.resize(bvhPending.size());
+    for (size_t i = 0; i < bvhPending.size(); ++i)
+        bvhBoxes[i] = bvhPending[i]->WorldBoundingBox();
+
+    bvh.Build(bvhBoxes);
+
+    const std::vector<BvhNode>& nodes = bvh.Nodes();
+    const std::vector<unsigned>& objectIndices = bvh.ObjectIndices();
+    bvhLeaves.resize(bvh.NumLeaves());
+
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        if (!it->IsLeaf())
+            continue;
+
+        Octant* leaf = allocator.Allocate();
+        leaf->InitializeLeaf(it->Box());
+        bvhLeaves[it->index] = leaf;
+
+        unsigned start = bvh.LeafStart(it->index);
+        for (unsigned i = start; i < start + it->count; ++i)
+            AddDrawable(bvhPending[objectIndices[i]], leaf);
+    }
+
+    bvhPending.clear();
+    bvhDirty = false;
+}
+
+void Octree::AllocateStaticTransform(Drawable* drawable)
+{
+    bool useTable = drawable->TestFlag(DF_STATIC) && drawable->TestFlag(DF_GEOMETRY) && (drawable->Flags() & DF_GEOMETRY_TYPE_BITS) == DF_STATIC_GEOMETRY;
+    if (useTable == (drawable->staticIndex != M_MAX_UNSIGNED))
+        return;
+
+    if (!useTable)
+    {
+        FreeStaticTransform(drawable);
+        return;
+    }
+
+    if (freeStaticTransforms.size())
+    {
+        drawable->staticIndex = freeStaticTransforms.back();
+        freeStaticTransforms.pop_back();
+    }
     else
-        newMax.z = oldCenter.z;
+    {
+        drawable->staticIndex = (unsigned)staticTransforms.size();
+        staticTransforms.push_back(Matrix3x4::IDENTITY);
+    }
+}
+
+void Octree::FreeStaticTransform(Drawable* drawable)
+{
+    if (drawable->staticIndex != M_MAX_UNSIGNED)
+    {
+        freeStaticTransforms.push_back(drawable->staticIndex);
+        drawable->staticIndex = M_MAX_UNSIGNED;
+    }
+}
+
+Octant* Octree::CreateChildOctant(Octant* octant, unsigned char index)
+{
+    if (octant->children[index])
+        return octant->children[index];
 
+    ++structureVersion;
     Octant* child = allocator.Allocate();
-    child->Initialize(octant, BoundingBox(newMin, newMax), octant->level - 1, index);
+    child->Initialize(octant, octant->ChildBounds(index), octant->level - 1, index);
     octant->children[index] = child;
     ++octant->numChildren;
 
@@ -396,6 +978,7 @@ Octant* Octree::CreateChildOctant(Octant* octant, unsigned char index)
 
 void Octree::DeleteChildOctant(Octant* octant, unsigned char index)
 {
+    ++structureVersion;
     allocator.Free(octant->children[index]);
     octant->children[index] = nullptr;
     --octant->numChildren;
@@ -403,15 +986,23 @@ void Octree::DeleteChildOctant(Octant* octant, unsigned char index)
 
 void Octree::DeleteChildOctants(Octant* octant, bool deletingOctree)
 {
+    ++structureVersion;
     for (auto it = octant->drawables.begin(); it != octant->drawables.end(); ++it)
     {
         Drawable* drawable = *it;
         drawable->octant = nullptr;
-        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
+        RemoveDrawableFromQueue(drawable);
         if (deletingOctree)
+        {
             drawable->Owner()->octree = nullptr;
+            drawable->staticIndex = M_MAX_UNSIGNED;
+        }
     }
+    octant->MarkStaticBatchesDirty();
     octant->drawables.clear();
+    octant->drawableBoxes.clear();
+    octant->drawableFlags.clear();
+    octant->drawableLayerMasks.clear();
 
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
     {
@@ -436,25 +1027,28 @@ void Octree::CollectDrawables(std::vector<Drawable*>& result, Octant* octant) co
     }
 }
 
-void Octree::CollectDrawables(std::vector<Drawable*>& result, Octant* octant, unsigned short drawableFlags, unsigned layerMask) const
+void Octree::CollectDrawables(std::vector<RaycastResult>& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
 {
+    float octantDist = ray.HitDistance(octant->cullingBox);
+    if (octantDist >= maxDistance)
+        return;
+
     std::vector<Drawable*>& drawables = octant->drawables;
 
-    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    for (size_t i = 0; i < drawables.size(); ++i)
     {
-        Drawable* drawable = *it;
-        if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask))
-            result.push_back(drawable);
+        if ((octant->drawableFlags[i] & drawableFlags) == drawableFlags && (octant->drawableLayerMasks[i] & layerMask))
+            drawables[i]->OnRaycast(result, ray, maxDistance);
     }
 
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
     {
         if (octant->children[i])
-            CollectDrawables(result, octant->children[i], drawableFlags, layerMask);
+            CollectDrawables(result, octant->children[i], ray, drawableFlags, maxDistance, layerMask);
     }
 }
 
-void Octree::CollectDrawables(std::vector<RaycastResult>& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
+void Octree::CollectDrawables(std::vector<std::pair<Drawable*, float> >& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
 {
     float octantDist = ray.HitDistance(octant->cullingBox);
     if (octantDist >= maxDistance)
@@ -462,11 +1056,14 @@ void Octree::CollectDrawables(std::vector<RaycastResult>& result, Octant* octant
 
     std::vector<Drawable*>& drawables = octant->drawables;
 
-    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    for (size_t i = 0; i < drawables.size(); ++i)
     {
-        Drawable* drawable = *it;
-        if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask))
-            drawable->OnRaycast(result, ray, maxDistance);
+        if ((octant->drawableFlags[i] & drawableFlags) == drawableFlags && (octant->drawableLayerMasks[i] & layerMask))
+        {
+            float distance = ray.HitDistance(octant->DrawableBox(i));
+            if (distance < maxDistance)
+                result.push_back(std::make_pair(drawables[i], distance));
+        }
     }
 
     for (size_t i = 0; i < NUM_OCTANTS; ++i)
@@ -476,45 +1073,67 @@ void Octree::CollectDrawables(std::vector<RaycastResult>& result, Octant* octant
     }
 }
 
-void Octree::CollectDrawables(std::vector<std::pair<Drawable*, float> >& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
+template <class R> void Octree::CollectBvhDrawables(std::vector<R>& result, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
 {
-    float octantDist = ray.HitDistance(octant->cullingBox);
-    if (octantDist >= maxDistance)
+    const std::vector<BvhNode>& nodes = bvh.Nodes();
+    if (nodes.empty())
         return;
 
-    std::vector<Drawable*>& drawables = octant->drawables;
+    unsigned stack[BVH_STACK_SIZE];
+    size_t stackSize = 0;
+    stack[stackSize++] = 0;
 
-    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    while (stackSize)
     {
-        Drawable* drawable = *it;
-        if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask))
+        const BvhNode& node = nodes[stack[--stackSize]];
+        if (ray.HitDistance(node.Box()) >= maxDistance)
+            continue;
+
+        if (node.IsLeaf())
+            CollectDrawables(result, bvhLeaves[node.index], ray, drawableFlags, maxDistance, layerMask);
+        else
         {
-            float distance = ray.HitDistance(drawable->WorldBoundingBox());
-            if (distance < maxDistance)
-                result.push_back(std::make_pair(drawable, distance));
+            stack[stackSize++] = node.index + 1;
+            stack[stackSize++] = node.index;
         }
     }
+}
 
-    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+void Octree::CheckReinsert(size_t start, size_t end, unsigned threadIndex_)
+{
+    ZoneScoped;
+
+    std::vector<Drawable*>& reinsertQueue = reinsertQueues[threadIndex_];
+
+    for (size_t batchStart = start; batchStart < end; batchStart += BOUNDING_BOX_BATCH_SIZE)
     {
-        if (octant->children[i])
-            CollectDrawables(result, octant->children[i], ray, drawableFlags, maxDistance, layerMask);
+        size_t batchEnd = end - batchStart < BOUNDING_BOX_BATCH_SIZE ? end : batchStart + BOUNDING_BOX_BATCH_SIZE;
+        UpdateBoundingBoxes(batchStart, batchEnd);
+
+        for (size_t i = batchStart; i < batchEnd; ++i)
+        {
+            Drawable* drawable = updateQueue[i];
+            if (drawable)
+                CheckReinsert(drawable, reinsertQueue, threadIndex_);
+        }
     }
 }
 
-void Octree::CheckReinsertWork(Task* task_, unsigned threadIndex_)
+void Octree::UpdateBoundingBoxes(size_t start, size_t end)
 {
-    ZoneScoped;
+    // The caller batches the range to fit the stack arrays
+    assert(end - start <= BOUNDING_BOX_BATCH_SIZE);
 
-    ReinsertDrawablesTask* task = static_cast<ReinsertDrawablesTask*>(task_);
-    Drawable** start = task->start;
-    Drawable** end = task->end;
-    std::vector<Drawable*>& reinsertQueue = reinsertQueues[threadIndex_];
+    BoundingBox localBoxes[BOUNDING_BOX_BATCH_SIZE];
+    Matrix3x4 transforms[BOUNDING_BOX_BATCH_SIZE];
+    BoundingBox worldBoxes[BOUNDING_BOX_BATCH_SIZE];
+    Drawable* batchDrawables[BOUNDING_BOX_BATCH_SIZE];
+    size_t count = 0;
 
-    for (; start != end; ++start)
+    for (size_t i = start; i < end; ++i)
     {
         // If drawable was removed before reinsertion could happen, a null pointer will be in its place
-        Drawable* drawable = *start;
+        Drawable* drawable = updateQueue[i];
         if (!drawable)
             continue;
 
@@ -523,12 +1142,48 @@ void Octree::CheckReinsertWork(Task* task_, unsigned threadIndex_)
 
         drawable->lastUpdateFrameNumber = frameNumber;
 
-        // Do nothing if still fits the current octant
-        const BoundingBox& box = drawable->WorldBoundingBox();
-        Octant* oldOctant = drawable->GetOctant();
-        if (!oldOctant || oldOctant->cullingBox.IsInside(box) != INSIDE)
-            reinsertQueue.push_back(drawable);
-        else
-            drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
+        // Gather the bounding boxes that are plain transforms of a local box, the rest update on demand
+        if (drawable->TestFlag(DF_BOUNDING_BOX_DIRTY))
+        {
+            const BoundingBox* localBox = drawable->LocalBoundingBox();
+            if (localBox)
+            {
+                localBoxes[count] = *localBox;
+                transforms[count] = drawable->WorldTransform();
+                batchDrawables[count] = drawable;
+                ++count;
+            }
+        }
+    }
+
+    if (!count)
+        return;
+
+    TransformBoundingBoxes(localBoxes, transforms, worldBoxes, count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        batchDrawables[i]->worldBoundingBox = worldBoxes[i];
+        batchDrawables[i]->SetFlag(DF_BOUNDING_BOX_DIRTY, false);
+    }
+}
+
+void Octree::CheckReinsert(Drawable* drawable, std::vector<Drawable*>& reinsertQueue, unsigned threadIndex_)
+{
+    // Do nothing if still fits the current octant
+    const BoundingBox& box = drawable->WorldBoundingBox();
+    Octant* oldOctant = drawable->GetOctant();
+    if (oldOctant)
+        AddStaticChange(drawable, oldOctant->cullingBox, threadIndex_);
+    if (drawable->TestFlag(DF_HLOD))
+        MarkHlodDirty(drawable);
+    if (!oldOctant || oldOctant->cullingBox.IsInside(box) != INSIDE || InWrongStructure(drawable, oldOctant))
+        AddDrawableToQueue(drawable, reinsertQueue);
+    else
+    {
+        oldOctant->SetDrawableData(drawable->octantIndex, drawable);
+        UpdateStaticTransform(drawable, threadIndex_);
+        drawable->reinsertQueue = nullptr;
+        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
     }
 }
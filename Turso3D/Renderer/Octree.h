@@ -2,18 +2,24 @@
 
 #pragma once
 
+#include "../Math/Bvh.h"
 #include "../Math/Frustum.h"
 #include "../Object/Allocator.h"
 #include "../Thread/WorkQueue.h"
+#include "Batch.h"
+#include "DebugRenderer.h"
 #include "OctreeNode.h"
 
+#include <cassert>
+
 static const size_t NUM_OCTANTS = 8;
+static const size_t NUM_QUERY_BRANCHES = NUM_OCTANTS + 2;
 
+class HlodProxy;
 class Octree;
 class OctreeNode;
 class Ray;
 class WorkQueue;
-struct ReinsertDrawablesTask;
 
 /// Structure for raycast query results.
 struct RaycastResult
@@ -30,22 +36,68 @@ struct RaycastResult
     size_t subObject;
 };
 
+/// Per-thread intermediate results for closest hit raycasts.
+struct RaycastScratch
+{
+    /// Coarse results from bounding box tests with hit distances.
+    std::vector<std::pair<Drawable*, float> > initialResult;
+    /// Results from the drawables' own raycast tests.
+    std::vector<RaycastResult> finalResult;
+};
+
 /// %Octree cell, contains up to 8 child octants.
 struct Octant
 {
     /// Initialize parent and bounds.
     void Initialize(Octant* parent, const BoundingBox& boundingBox, unsigned char level, unsigned char childIndex);
+    /// Initialize as a static BVH leaf, which has no parent and uses the bounds as is for culling.
+    void InitializeLeaf(const BoundingBox& boundingBox);
     /// Test if a drawable should be inserted in this octant or if a smaller child octant should be created.
     bool FitBoundingBox(const BoundingBox& box, const Vector3& boxSize) const;
     /// Return child octant index based on position.
     unsigned char ChildIndex(const Vector3& position) const { unsigned char ret = position.x < center.x ? 0 : 1; ret += position.y < center.y ? 0 : 2; ret += position.z < center.z ? 0 : 4; return ret; }
+    /// Return the bounds of a child octant before the culling expansion.
+    BoundingBox ChildBounds(unsigned char index) const;
     /// Add debug geometry to be rendered.
     void OnRenderDebug(DebugRenderer* debug);
+    /// Copy a drawable's world bounding box, flags and layer mask to the culling data at index.
+    void SetDrawableData(size_t index, Drawable* drawable)
+    {
+        staticBatchVersion = 0;
+        if ((drawable->Flags() | drawableFlags[index]) & DF_STATIC)
+            debugGeometryDirty = true;
+        drawableBoxes[index / BOUNDING_BOX_PACK_SIZE].Set(index % BOUNDING_BOX_PACK_SIZE, drawable->WorldBoundingBox());
+        drawableFlags[index] = drawable->Flags();
+        drawableLayerMasks[index] = drawable->LayerMask();
+    }
+    /// Return a drawable's world bounding box from the culling data.
+    BoundingBox DrawableBox(size_t index) const { return drawableBoxes[index / BOUNDING_BOX_PACK_SIZE].Get(index % BOUNDING_BOX_PACK_SIZE); }
+    /// Move the drawable and culling data at an index to another index, overwriting it.
+    void MoveDrawable(size_t from, size_t to)
+    {
+        staticBatchVersion = 0;
+        debugGeometryDirty = true;
+        drawables[to] = drawables[from];
+        drawableBoxes[to / BOUNDING_BOX_PACK_SIZE].Set(to % BOUNDING_BOX_PACK_SIZE, DrawableBox(from));
+        drawableFlags[to] = drawableFlags[from];
+        drawableLayerMasks[to] = drawableLayerMasks[from];
+        drawables[to]->octantIndex = (unsigned)to;
+    }
+    /// Remove the drawable at index by moving the last drawable in its place. Keeps the lights first.
+    void EraseDrawable(size_t index);
+    /// Mark the cached static batches and debug geometry to be rebuilt.
+    void MarkStaticBatchesDirty() { staticBatchVersion = 0; debugGeometryDirty = true; }
 
-    /// Expanded (loose) bounding box used for culling the octant and the drawables within it.
+    /// Expanded (loose) bounding box used for culling the octant and the drawables within it. For BVH leaves, the tight bounds of the drawables.
     BoundingBox cullingBox;
-    /// Drawables contained in the octant.
+    /// Drawables contained in the octant. Lights are kept first, otherwise the order is arbitrary.
     std::vector<Drawable*> drawables;
+    /// World bounding boxes of the drawables in the same order, for culling without accessing the drawables. Updated on insertion and octree update.
+    std::vector<BoundingBoxPack> drawableBoxes;
+    /// Flags of the drawables in the same order. Only the type and shadow casting flags are kept up to date.
+    std::vector<unsigned short> drawableFlags;
+    /// Layer masks of the drawables in the same order.
+    std::vector<unsigned> drawableLayerMasks;
     /// Bounding box center.
     Vector3 center;
     /// Bounding box half size.
@@ -56,15 +108,34 @@ struct Octant
     unsigned char numChildren;
     /// The child index of this octant.
     unsigned char childIndex;
-    /// Drawable sort order dirty flag.
-    bool sortDirty;
     /// Child octants.
     Octant* children[NUM_OCTANTS];
     /// Parent octant.
     Octant* parent;
+    /// Cached opaque batches of the drawables that have only static geometry without LOD levels, impostor or maximum distance. Built by Renderer for octants fully inside the view.
+    std::vector<Batch> staticBatches;
+    /// Drawables whose batches are cached.
+    std::vector<Drawable*> staticBatchDrawables;
+    /// Whether the drawable at the same index has its batches cached.
+    std::vector<unsigned char> staticBatchCached;
+    /// Merged world bounding box of the drawables whose batches are cached.
+    BoundingBox staticBatchBounds;
+    /// Smallest bounding box half-size length of the drawables with cached batches, for conservative screen size culling.
+    float staticBatchMinRadius;
+    /// View mask the cached batches were built with.
+    unsigned staticBatchViewMask;
+    /// Renderer's cache version the batches were built at, or zero if they need to be rebuilt.
+    unsigned staticBatchVersion;
+    /// HLOD proxy of the drawables in this octant and its children, or null if none.
+    HlodProxy* hlod;
+    /// Cached debug geometry of the static drawables with static geometry. Built by Renderer.
+    DebugGeometry debugGeometry;
+    /// Cached debug geometry needs to be rebuilt flag.
+    bool debugGeometryDirty;
 };
 
 /// Acceleration structure for rendering. Should be created as a child of the scene root.
+/// Queries may run concurrently from any thread between updates, as the octants are only created and deleted in Update(), Resize() and SetStaticBvh(). Drawables moved meanwhile keep their octant and refresh its culling data in place, so a query may see either their old or new bounds. Octant pointers obtained from queries stay valid while StructureVersion() is unchanged.
 class Octree : public Node
 {
     OBJECT(Octree);
@@ -78,30 +149,176 @@ public:
     /// Register factory and attributes.
     static void RegisterObject();
     
-    /// Process the queue of nodes to be reinserted. Then sort nodes inside changed octants. This will utilize worker threads.
+    /// Process the queue of nodes to be reinserted. Then rebuild the static BVH if it has changed. This will utilize worker threads.
     void Update(unsigned short frameNumber);
     /// Resize the octree.
     void Resize(const BoundingBox& boundingBox, int numLevels);
+    /// Enable or disable growing the octree automatically on update when drawables do not fit inside the root. The size of the smallest octants is preserved by adding levels. Default false.
+    void SetAutoResize(bool enable);
+    /// Set the maximum number of levels automatic growth may reach. Default 16.
+    void SetMaxAutoResizeLevels(int numLevels);
+    /// Reorder the world transform matrices of all spatial nodes so that those of the drawables are contiguous in octant order, which speeds up batch collection. Call between frames from the main thread, as the matrices move in memory.
+    void SortTransforms();
     /// Enable or disable threaded update mode. In threaded mode reinsertions go to per-thread queues.
     void SetThreadedUpdate(bool enable) { threadedUpdate = enable; }
-    /// Queue octree reinsertion for a drawable.
+    /// Queue octree reinsertion for a drawable. Lock-free and callable from the main thread and worker threads at any time except during Update(), as each thread has its own queue. Does nothing more if already queued.
     void QueueUpdate(Drawable* drawable);
+    /// Queue new drawables for insertion in bulk. Call from the main thread outside Update().
+    void QueueInsertions(const std::vector<Drawable*>& drawables);
     /// Remove a drawable from the octree.
     void RemoveDrawable(Drawable* drawable);
+    /// Enable or disable keeping static drawables in a separate bounding volume hierarchy. It is rebuilt on update when static drawables are added, removed or move outside their leaf.
+    void SetStaticBvh(bool enable);
+    /// Merge the static models in each octant of the given subdivision level, along with its children, into HLOD proxies that replace the earlier ones. The root is at the octree's number of levels and each child level is one lower. A proxy is invalidated when any of its source drawables moves or is removed, and all are cleared when the octree is resized. Drawables in the static BVH are not merged. Call between frames from the main thread after the models have been uploaded.
+    void BuildHlod(int cellLevel, float triangleRatio = 0.25f);
+    /// Remove the HLOD proxies.
+    void ClearHlod();
+    /// Move the regions where static shadowcasters have been added, removed or moved since the last call to the destination vector. A moved drawable's old position is covered by the culling box of the octant it was in. Call between updates from the main thread.
+    void CollectStaticChanges(std::vector<BoundingBox>& dest);
+    /// Return the range of static transform table entries changed since the last call, and reset it. Return false if nothing changed. Call between updates from the main thread.
+    bool CollectStaticTransformChanges(unsigned& start, unsigned& end);
 
     /// Query for drawables with a raycast and return all results.
     void Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigned short nodeFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
-    /// Query for drawables with a raycast and return the closest result.
+    /// Query for drawables with a raycast and return the closest result. Threadsafe from the main thread and worker threads, as long as the octree is not being modified.
     RaycastResult RaycastSingle(const Ray& ray, unsigned short drawableFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for drawables with a batch of raycasts and return the closest result for each ray. The rays are split over worker threads. Call from the main thread.
+    void RaycastBatch(std::vector<RaycastResult>& result, const std::vector<Ray>& rays, unsigned short drawableFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
     /// Query for drawables using a volume such as frustum or sphere.
-    template <class T> void FindDrawables(std::vector<Drawable*>& result, const T& volume, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const { CollectDrawables(result, const_cast<Octant*>(&root), volume, drawableFlags, layerMask); }
+    template <class T, class A> void FindDrawables(std::vector<Drawable*, A>& result, const T& volume, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const
+    {
+        CollectDrawables(result, const_cast<Octant*>(&root), volume, drawableFlags, layerMask);
+        CollectBvhDrawables(result, volume, drawableFlags, layerMask);
+    }
+    /// Query for drawables using a volume such as frustum or sphere, splitting the traversal of the octree branches and the static BVH over worker threads. The calling thread participates. Must not overlap an update.
+    template <class T, class A> void FindDrawablesParallel(std::vector<Drawable*, A>& result, const T& volume, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const
+    {
+        assert(!updating);
+
+        std::vector<Drawable*> branchResults[NUM_QUERY_BRANCHES];
+        workQueue->ParallelFor(0, NUM_QUERY_BRANCHES, 1, [&](size_t start, size_t end, unsigned)
+        {
+            for (size_t i = start; i < end; ++i)
+            {
+                if (i < NUM_OCTANTS)
+                {
+                    if (root.children[i])
+                        CollectDrawables(branchResults[i], root.children[i], volume, drawableFlags, layerMask);
+                }
+                else if (i == NUM_OCTANTS)
+                {
+                    if (volume.IsInside(root.cullingBox) == OUTSIDE)
+                        continue;
+
+                    for (size_t j = 0; j < root.drawables.size(); ++j)
+                    {
+                        if ((root.drawableFlags[j] & drawableFlags) == drawableFlags && (root.drawableLayerMasks[j] & layerMask) && volume.IsInsideFast(root.DrawableBox(j)) != OUTSIDE)
+                            branchResults[i].push_back(root.drawables[j]);
+                    }
+                }
+                else
+                    CollectBvhDrawables(branchResults[i], volume, drawableFlags, layerMask);
+            }
+        });
+
+        for (size_t i = 0; i < NUM_QUERY_BRANCHES; ++i)
+            result.insert(result.end(), branchResults[i].begin(), branchResults[i].end());
+    }
     /// Query for drawables using a frustum and masked testing.
-    void FindDrawablesMasked(std::vector<Drawable*>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const;
+    template <class A> void FindDrawablesMasked(std::vector<Drawable*, A>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const
+    {
+        CollectDrawablesMasked(result, const_cast<Octant*>(&root), frustum, drawableFlags, layerMask);
+        CollectBvhDrawablesMasked(result, frustum, drawableFlags, layerMask);
+    }
+    /// Query for non-static drawables using a volume such as frustum or sphere. With the static BVH, only the octree is traversed.
+    template <class T, class A> void FindDynamicDrawables(std::vector<Drawable*, A>& result, const T& volume, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const
+    {
+        size_t start = result.size();
+        CollectDrawables(result, const_cast<Octant*>(&root), volume, drawableFlags, layerMask);
+        RemoveStatic(result, start);
+    }
+    /// Query for non-static drawables using a frustum and masked testing. With the static BVH, only the octree is traversed.
+    template <class A> void FindDynamicDrawablesMasked(std::vector<Drawable*, A>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const
+    {
+        size_t start = result.size();
+        CollectDrawablesMasked(result, const_cast<Octant*>(&root), frustum, drawableFlags, layerMask);
+        RemoveStatic(result, start);
+    }
+    /// Query for drawables using a frustum and masked testing, splitting the traversal over worker threads. The calling thread participates. Must not overlap an update.
+    template <class A> void FindDrawablesMaskedParallel(std::vector<Drawable*, A>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const
+    {
+        assert(!updating);
+
+        std::vector<Drawable*> branchResults[NUM_QUERY_BRANCHES];
+        workQueue->ParallelFor(0, NUM_QUERY_BRANCHES, 1, [&](size_t start, size_t end, unsigned)
+        {
+            for (size_t i = start; i < end; ++i)
+            {
+                if (i < NUM_OCTANTS)
+                {
+                    if (root.children[i])
+                        CollectDrawablesMasked(branchResults[i], root.children[i], frustum, drawableFlags, layerMask);
+                }
+                else if (i == NUM_OCTANTS)
+                {
+                    if (frustum.IsInside(root.cullingBox) == OUTSIDE)
+                        continue;
+
+                    for (size_t j = 0; j < root.drawables.size(); ++j)
+                    {
+                        if ((root.drawableFlags[j] & drawableFlags) == drawableFlags && (root.drawableLayerMasks[j] & layerMask) && frustum.IsInsideFast(root.DrawableBox(j)) != OUTSIDE)
+                            branchResults[i].push_back(root.drawables[j]);
+                    }
+                }
+                else
+                    CollectBvhDrawablesMasked(branchResults[i], frustum, drawableFlags, layerMask);
+            }
+        });
+
+        for (size_t i = 0; i < NUM_QUERY_BRANCHES; ++i)
+            result.insert(result.end(), branchResults[i].begin(), branchResults[i].end());
+    }
 
     /// Return whether threaded update is enabled.
     bool ThreadedUpdate() const { return threadedUpdate; }
+    /// Return whether the octants are being modified, during which queries are not allowed.
+    bool IsUpdating() const { return updating; }
+    /// Return a counter that changes whenever drawables are queued for update or removed. Used for detecting an unchanged octree.
+    unsigned DrawableVersion() const { return drawableVersion.load(std::memory_order_relaxed); }
+    /// Return a counter that changes whenever drawables are removed. While unchanged, pointers to the drawables stay valid.
+    unsigned RemovalVersion() const { return removalVersion; }
+    /// Return a counter that changes whenever octants are created or deleted. While unchanged, pointers to the octants stay valid. Can be stored along with query results to detect that they refer to an older octree state.
+    unsigned StructureVersion() const { return structureVersion; }
+    /// Return a counter that changes whenever the static BVH is rebuilt or removed. While unchanged, the BVH nodes, their leaf octants and the drawables in them stay the same.
+    unsigned BvhVersion() const { return bvhVersion; }
     /// Return the root octant.
     Octant* Root() const { return const_cast<Octant*>(&root); }
+    /// Return whether automatic growth is enabled.
+    bool AutoResize() const { return autoResize; }
+    /// Return the maximum number of levels for automatic growth.
+    int MaxAutoResizeLevels() const { return maxAutoResizeLevels; }
+    /// Return whether static drawables are kept in the BVH.
+    bool StaticBvh() const { return staticBvh; }
+    /// Return the static BVH nodes. Empty if disabled or there are no static drawables.
+    const std::vector<BvhNode>& BvhNodes() const { return bvh.Nodes(); }
+    /// Return the octant holding the drawables of a BVH leaf.
+    Octant* BvhLeaf(size_t index) const { return bvhLeaves[index]; }
+    /// Return whether an octant is a static BVH leaf.
+    bool IsBvhLeaf(Octant* octant) const { return !octant->parent && octant != &root; }
+    /// Return the HLOD proxies.
+    const std::vector<SharedPtr<HlodProxy> >& HlodProxies() const { return hlodProxies; }
+    /// Return the HLOD proxy covering an octant, found from it or its parents, or null if none.
+    HlodProxy* FindHlod(Octant* octant) const
+    {
+        for (; octant; octant = octant->parent)
+        {
+            if (octant->hlod)
+                return octant->hlod;
+        }
+        return nullptr;
+    }
+    /// Return the world transforms of static, non-skinned geometry drawables, indexed by the drawables' static index. Entries are assigned on insertion and updated when the drawables move. Unused entries may contain stale data.
+    const std::vector<Matrix3x4>& StaticTransforms() const { return staticTransforms; }
 
 private:
     /// Set bounding box. Used in serialization.
@@ -112,45 +329,113 @@ private:
     void SetNumLevelsAttr(int numLevels);
     /// Return number of levels. Used in serialization.
     int NumLevelsAttr() const;
-    /// Process a list of drawables to be reinserted. Clear the list afterward.
-    void ReinsertDrawables(std::vector<Drawable*>& drawables);
-    /// Remove a drawable from a reinsert queue.
-    void RemoveDrawableFromQueue(Drawable* drawable, std::vector<Drawable*>& drawables);
+    /// Process a list of drawables to be reinserted. Clear the list afterward. Record the new positions of static shadowcasters if they have moved.
+    void ReinsertDrawables(std::vector<Drawable*>& drawables, bool moved = true);
+    /// Insert the drawables of a reinsertion list that are not in the octree yet, such as on scene load, in bulk and leave null pointers in their place. Their octants are found in parallel from the root without creating them, then sorted so that each octant is created once and its arrays filled with exact reservations. Does nothing if there are too few of them.
+    void InsertDrawablesBulk(std::vector<Drawable*>& drawables, bool moved);
+    /// Add a drawable to a reinsert queue and store its position for constant time removal.
+    void AddDrawableToQueue(Drawable* drawable, std::vector<Drawable*>& queue)
+    {
+        drawable->reinsertQueue = &queue;
+        drawable->reinsertQueueIndex = (unsigned)queue.size();
+        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
+        queue.push_back(drawable);
+    }
+    /// Remove a drawable from the reinsert queue it is in, leaving a null pointer in its place.
+    void RemoveDrawableFromQueue(Drawable* drawable)
+    {
+        if (drawable->reinsertQueue)
+        {
+            assert((*drawable->reinsertQueue)[drawable->reinsertQueueIndex] == drawable);
+            (*drawable->reinsertQueue)[drawable->reinsertQueueIndex] = nullptr;
+            drawable->reinsertQueue = nullptr;
+        }
+        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
+    }
+    /// Mark the HLOD proxy of a moved drawable to be invalidated at the end of the update. Can be called from worker threads.
+    void MarkHlodDirty(Drawable* drawable);
+    /// Invalidate the HLOD proxies marked during the update.
+    void InvalidateDirtyHlod();
+    /// Build HLOD proxies for the octants of a subdivision level found below an octant.
+    void BuildHlod(Octant* octant, int cellLevel, float triangleRatio);
+    /// Grow the root to contain the drawables that did not fit, and reinsert the drawables immediately.
+    void Grow();
+    /// Rebuild the static BVH from the drawables in the current leaves and the pending static drawables.
+    void RebuildBvh();
+    /// Record a region changed by a static shadowcaster. Other drawables are ignored.
+    void AddStaticChange(Drawable* drawable, const BoundingBox& region, unsigned threadIndex)
+    {
+        if (drawable->TestFlag(DF_STATIC) && drawable->TestFlag(DF_CAST_SHADOWS))
+            staticChanges[threadIndex].push_back(region);
+    }
+    /// Copy a drawable's world transform to its static transform table entry, if it has one, and record the change.
+    void UpdateStaticTransform(Drawable* drawable, unsigned threadIndex)
+    {
+        unsigned index = drawable->staticIndex;
+        if (index == M_MAX_UNSIGNED)
+            return;
+
+        staticTransforms[index] = drawable->WorldTransform();
+        std::pair<unsigned, unsigned>& range = staticTransformChanges[threadIndex];
+        if (index < range.first)
+            range.first = index;
+        if (index >= range.second)
+            range.second = index + 1;
+    }
+    /// Assign or free a drawable's static transform table entry according to whether it is a static, non-skinned geometry. Must be called from the main thread.
+    void AllocateStaticTransform(Drawable* drawable);
+    /// Free a drawable's static transform table entry, if it has one. Must be called from the main thread.
+    void FreeStaticTransform(Drawable* drawable);
+    /// Return whether a drawable is in the wrong structure and should be reinserted regardless of its bounds.
+    bool InWrongStructure(Drawable* drawable, Octant* octant) const { return (staticBvh && drawable->TestFlag(DF_STATIC)) != IsBvhLeaf(octant); }
     
     /// Add drawable to a specific octant.
     void AddDrawable(Drawable* drawable, Octant* octant)
     {
+        size_t index = octant->drawables.size();
+        if (index % BOUNDING_BOX_PACK_SIZE == 0)
+        {
+            octant->drawableBoxes.push_back(BoundingBoxPack());
+            octant->drawableBoxes.back().ClearFrom(0);
+        }
+
         octant->drawables.push_back(drawable);
+        octant->drawableFlags.push_back(0);
+        octant->drawableLayerMasks.push_back(0);
         drawable->octant = octant;
 
-        if (!octant->sortDirty)
+        // Keep the lights first by moving the first non-light to the end
+        if (drawable->TestFlag(DF_LIGHT))
         {
-            octant->sortDirty = true;
-            sortDirtyOctants.push_back(octant);
+            size_t firstNonLight = 0;
+            while (firstNonLight < index && (octant->drawableFlags[firstNonLight] & DF_LIGHT))
+                ++firstNonLight;
+            if (firstNonLight < index)
+            {
+                octant->MoveDrawable(firstNonLight, index);
+                index = firstNonLight;
+            }
         }
+
+        octant->drawables[index] = drawable;
+        octant->SetDrawableData(index, drawable);
+        drawable->octantIndex = (unsigned)index;
     }
 
-    /// Remove drawable from an octant.
-    void RemoveDrawable(Drawable* drawable, Octant* octant)
+    /// Remove drawable from an octant, using its index within the octant.
+    void RemoveDrawable(Drawable* drawable, Octant* octant, size_t index)
     {
-        if (!octant)
+        if (!octant || index >= octant->drawables.size() || octant->drawables[index] != drawable)
             return;
 
         // Do not set the drawable's octant pointer to zero, as the drawable may already be added into another octant. Just remove from octant
-        for (auto it = octant->drawables.begin(); it != octant->drawables.end(); ++it)
-        {
-            if ((*it) == drawable)
-            {
-                octant->drawables.erase(it);
+        octant->EraseDrawable(index);
 
-                // Erase empty octants as necessary
-                while (!octant->drawables.size() && !octant->numChildren && octant->parent)
-                {
-                    DeleteChildOctant(octant->parent, octant->childIndex);
-                    octant = octant->parent;
-                }
-                return;
-            }
+        // Erase empty octants as necessary
+        while (!octant->drawables.size() && !octant->numChildren && octant->parent)
+        {
+            DeleteChildOctant(octant->parent, octant->childIndex);
+            octant = octant->parent;
         }
     }
 
@@ -160,19 +445,53 @@ private:
     void DeleteChildOctant(Octant* octant, unsigned char index);
     /// Delete a child octant hierarchy. If not deleting the octree for good, moves any nodes back to the root octant.
     void DeleteChildOctants(Octant* octant, bool deletingOctree);
+    /// Remove the static drawables from query results, starting from an index. Without the static BVH, the octree query also finds the static drawables.
+    template <class A> void RemoveStatic(std::vector<Drawable*, A>& result, size_t start) const
+    {
+        size_t dest = start;
+        for (size_t i = start; i < result.size(); ++i)
+        {
+            if (!result[i]->TestFlag(DF_STATIC))
+                result[dest++] = result[i];
+        }
+        result.resize(dest);
+    }
     /// Get all drawables from an octant recursively.
     void CollectDrawables(std::vector<Drawable*>& result, Octant* octant) const;
     /// Get all drawables matching flags from an octant recursively.
-    void CollectDrawables(std::vector<Drawable*>& result, Octant* octant, unsigned short drawableFlags, unsigned layerMask) const;
+    template <class A> void CollectDrawables(std::vector<Drawable*, A>& result, Octant* octant, unsigned short drawableFlags, unsigned layerMask) const
+    {
+        std::vector<Drawable*>& drawables = octant->drawables;
+
+        for (size_t i = 0; i < drawables.size(); ++i)
+        {
+            if ((octant->drawableFlags[i] & drawableFlags) == drawableFlags && (octant->drawableLayerMasks[i] & layerMask))
+                result.push_back(drawables[i]);
+        }
+
+        for (size_t i = 0; i < NUM_OCTANTS; ++i)
+        {
+            if (octant->children[i])
+                CollectDrawables(result, octant->children[i], drawableFlags, layerMask);
+        }
+    }
     /// Get all drawables matching flags along a ray.
     void CollectDrawables(std::vector<RaycastResult>& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const;
     /// Get all visible nodes matching flags that could be potential raycast hits.
     void CollectDrawables(std::vector<std::pair<Drawable*, float> >& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const;
-    /// Work function to check reinsertion of nodes.
-    void CheckReinsertWork(Task* task, unsigned threadIndex);
+    /// Query for the closest raycast result using the given intermediate result storage.
+    RaycastResult RaycastSingle(const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask, RaycastScratch& scratch) const;
+    /// Get all drawables matching flags along a ray from the static BVH.
+    template <class R> void CollectBvhDrawables(std::vector<R>& result, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const;
+    /// Check reinsertion of nodes in a range of the update queue.
+    void CheckReinsert(size_t start, size_t end, unsigned threadIndex);
+    /// Call the octree updates of drawables in a range of the update queue and update their dirty bounding boxes in a batch where possible.
+    void UpdateBoundingBoxes(size_t start, size_t end);
+    /// Check reinsertion of a drawable whose octree update has been called.
+    void CheckReinsert(Drawable* drawable, std::vector<Drawable*>& reinsertQueue, unsigned threadIndex);
 
     /// Collect nodes matching flags using a volume such as frustum or sphere.
-    template <class T> void CollectDrawables(std::vector<Drawable*>& result, Octant* octant, const T& volume, unsigned short drawableFlags, unsigned layerMask) const
+    template <class T, class A> void CollectDrawables(std::vector<Drawable*, A>& result, Octant* octant, const T& volume, unsigned short drawableFlags, unsigned layerMask) const
     {
         Intersection res = volume.IsInside(octant->cullingBox);
         if (res == OUTSIDE)
@@ -185,11 +504,10 @@ private:
         {
             std::vector<Drawable*>& drawables = octant->drawables;
 
-            for (auto it = drawables.begin(); it != drawables.end(); ++it)
+            for (size_t i = 0; i < drawables.size(); ++i)
             {
-                Drawable* drawable = *it;
-                if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask) && volume.IsInsideFast(drawable->WorldBoundingBox()) != OUTSIDE)
-                    result.push_back(drawable);
+                if ((octant->drawableFlags[i] & drawableFlags) == drawableFlags && (octant->drawableLayerMasks[i] & layerMask) && volume.IsInsideFast(octant->DrawableBox(i)) != OUTSIDE)
+                    result.push_back(drawables[i]);
             }
             
             for (size_t i = 0; i < NUM_OCTANTS; ++i)
@@ -201,7 +519,7 @@ private:
     }
 
     /// Collect nodes using a frustum and masked testing.
-    void CollectDrawablesMasked(std::vector<Drawable*>& result, Octant* octant, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask, unsigned char planeMask = 0x3f) const
+    template <class A> void CollectDrawablesMasked(std::vector<Drawable*, A>& result, Octant* octant, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask, unsigned char planeMask = 0x3f) const
     {
         if (planeMask)
         {
@@ -211,12 +529,18 @@ private:
         }
 
         std::vector<Drawable*>& drawables = octant->drawables;
-     
-        for (auto it = drawables.begin(); it != drawables.end(); ++it)
+
+        // Test the drawables' bounding boxes a pack at a time
+        for (size_t i = 0; i < drawables.size(); i += BOUNDING_BOX_PACK_SIZE)
         {
-            Drawable* drawable = *it;
-            if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask) && (!planeMask || frustum.IsInsideMaskedFast(drawable->WorldBoundingBox(), planeMask) != OUTSIDE))
-                result.push_back(drawable);
+            size_t count = Min(drawables.size() - i, BOUNDING_BOX_PACK_SIZE);
+            unsigned visible = planeMask ? frustum.IsInsideMaskedFast(octant->drawableBoxes[i / BOUNDING_BOX_PACK_SIZE], planeMask) : 0xff;
+
+            for (size_t j = 0; j < count; ++j)
+            {
+                if ((visible & (1 << j)) && (octant->drawableFlags[i + j] & drawableFlags) == drawableFlags && (octant->drawableLayerMasks[i + j] & layerMask))
+                    result.push_back(drawables[i + j]);
+            }
         }
 
         for (size_t i = 0; i < NUM_OCTANTS; ++i)
@@ -226,43 +550,137 @@ private:
         }
     }
 
+    /// Collect nodes from the static BVH using a volume such as frustum or sphere.
+    template <class T, class A> void CollectBvhDrawables(std::vector<Drawable*, A>& result, const T& volume, unsigned short drawableFlags, unsigned layerMask) const
+    {
+        const std::vector<BvhNode>& nodes = bvh.Nodes();
+        if (nodes.empty())
+            return;
+
+        // Nodes found completely inside the volume are marked so that their subtrees are not tested further
+        std::pair<unsigned, bool> stack[BVH_STACK_SIZE];
+        size_t stackSize = 0;
+        stack[stackSize++] = std::make_pair(0u, false);
+
+        while (stackSize)
+        {
+            std::pair<unsigned, bool> entry = stack[--stackSize];
+            const BvhNode& node = nodes[entry.first];
+            bool inside = entry.second;
+
+            if (!inside)
+            {
+                Intersection res = volume.IsInside(node.Box());
+                if (res == OUTSIDE)
+                    continue;
+                inside = res == INSIDE;
+            }
+
+            if (node.IsLeaf())
+            {
+                if (inside)
+                    CollectDrawables(result, bvhLeaves[node.index], drawableFlags, layerMask);
+                else
+                    CollectDrawables(result, bvhLeaves[node.index], volume, drawableFlags, layerMask);
+            }
+            else
+            {
+                stack[stackSize++] = std::make_pair(node.index + 1, inside);
+                stack[stackSize++] = std::make_pair(node.index, inside);
+            }
+        }
+    }
+
+    /// Collect nodes from the static BVH using a frustum and masked testing.
+    template <class A> void CollectBvhDrawablesMasked(std::vector<Drawable*, A>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask) const
+    {
+        const std::vector<BvhNode>& nodes = bvh.Nodes();
+        if (nodes.empty())
+            return;
+
+        std::pair<unsigned, unsigned char> stack[BVH_STACK_SIZE];
+        size_t stackSize = 0;
+        stack[stackSize++] = std::make_pair(0u, (unsigned char)0x3f);
+
+        while (stackSize)
+        {
+            std::pair<unsigned, unsigned char> entry = stack[--stackSize];
+            const BvhNode& node = nodes[entry.first];
+            unsigned char planeMask = entry.second;
+
+            if (planeMask)
+            {
+                planeMask = frustum.IsInsideMasked(node.Box(), planeMask);
+                if (planeMask == 0xff)
+                    continue;
+            }
+
+            if (node.IsLeaf())
+                CollectDrawablesMasked(result, bvhLeaves[node.index], frustum, drawableFlags, layerMask, planeMask);
+            else
+            {
+                stack[stackSize++] = std::make_pair(node.index + 1, planeMask);
+                stack[stackSize++] = std::make_pair(node.index, planeMask);
+            }
+        }
+    }
+
     /// Threaded update flag. During threaded update moved OctreeNodes should go directly to thread-specific reinsert queues.
     volatile bool threadedUpdate;
+    /// Octant modification in progress flag.
+    volatile bool updating;
+    /// Drawable change counter. Incremented also from worker threads during threaded update.
+    std::atomic<unsigned> drawableVersion;
+    /// Drawable removal counter.
+    unsigned removalVersion;
+    /// Octant creation and deletion counter.
+    unsigned structureVersion;
+    /// Static BVH rebuild counter.
+    unsigned bvhVersion;
     /// Current framenumber.
     unsigned short frameNumber;
-    /// Queue of nodes to be reinserted.
+    /// Automatic growth flag.
+    bool autoResize;
+    /// Maximum number of levels for automatic growth.
+    int maxAutoResizeLevels;
+    /// Bounds of the drawables that were left in the root because they did not fit inside it.
+    BoundingBox rootOverflow;
+    /// Static BVH enabled flag.
+    bool staticBvh;
+    /// Static BVH rebuild needed flag.
+    bool bvhDirty;
+    /// Per-thread queues of drawables to be checked for reinsertion on the next update.
+    std::vector<std::vector<Drawable*> > updateQueues;
+    /// Update queues combined for the update.
     std::vector<Drawable*> updateQueue;
-    /// Octants which need to have their drawables sorted.
-    std::vector<Octant*> sortDirtyOctants;
     /// Extents of the octree root level box.
     BoundingBox worldBoundingBox;
     /// Root octant.
     Octant root;
-    /// Allocator for child octants.
+    /// Allocator for child octants and BVH leaves.
     Allocator<Octant> allocator;
+    /// Static drawable BVH.
+    Bvh bvh;
+    /// Octants for the BVH leaves, indexed by leaf index.
+    std::vector<Octant*> bvhLeaves;
+    /// Static drawables waiting for the BVH rebuild.
+    std::vector<Drawable*> bvhPending;
+    /// Static drawable bounding boxes for the BVH build.
+    std::vector<BoundingBox> bvhBoxes;
     /// Cached %WorkQueue subsystem.
     WorkQueue* workQueue;
-    /// Tasks for threaded reinsert execution.
-    std::vector<AutoPtr<ReinsertDrawablesTask> > reinsertTasks;
     /// Intermediate reinsert queues for threaded execution.
     std::vector<std::vector<Drawable*> > reinsertQueues;
-    /// RaycastSingle initial coarse result.
-    mutable std::vector<std::pair<Drawable*, float> > initialRayResult;
-    /// RaycastSingle final result.
-    mutable std::vector<RaycastResult> finalRayResult;
-};
-
-/// Task for octree drawables reinsertion.
-struct ReinsertDrawablesTask : public MemberFunctionTask<Octree>
-{
-    /// Construct.
-    ReinsertDrawablesTask(Octree* object_, MemberWorkFunctionPtr function_) :
-        MemberFunctionTask<Octree>(object_, function_)
-    {
-    }
-
-    /// Start pointer.
-    Drawable** start;
-    /// End pointer.
-    Drawable** end;
+    /// Per-thread regions changed by static shadowcasters since the last collection.
+    std::vector<std::vector<BoundingBox> > staticChanges;
+    /// Per-thread RaycastSingle intermediate results.
+    mutable std::vector<RaycastScratch> raycastScratch;
+    /// World transforms of static geometry drawables.
+    std::vector<Matrix3x4> staticTransforms;
+    /// Free static transform table entries.
+    std::vector<unsigned> freeStaticTransforms;
+    /// Per-thread start and end of the static transform table entries changed since the last collection.
+    std::vector<std::pair<unsigned, unsigned> > staticTransformChanges;
+    /// HLOD proxies.
+    std::vector<SharedPtr<HlodProxy> > hlodProxies;
 };
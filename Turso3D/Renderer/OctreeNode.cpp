@@ -10,8 +10,13 @@
 Drawable::Drawable() :
     owner(nullptr),
     octant(nullptr),
+    octantIndex(0),
+    reinsertQueue(nullptr),
+    reinsertQueueIndex(0),
+    staticIndex(M_MAX_UNSIGNED),
     flags(0),
     layer(LAYER_DEFAULT),
+    drawableType(DT_OTHER),
     lastFrameNumber(0),
     lastUpdateFrameNumber(0),
     distance(0.0f),
@@ -61,6 +66,10 @@ void Drawable::OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float
     }
 }
 
+void Drawable::OnRasterizeOcclusion(OcclusionRasterizer*, unsigned)
+{
+}
+
 void Drawable::OnRenderDebug(DebugRenderer* debug)
 {
     debug->AddBoundingBox(WorldBoundingBox(), Color::GREEN, false);
@@ -117,6 +126,8 @@ void OctreeNode::SetUpdateInvisible(bool enable)
 void OctreeNode::SetMaxDistance(float distance_)
 {
     drawable->maxDistance = Max(distance_, 0.0f);
+    if (drawable->octant)
+        drawable->octant->MarkStaticBatchesDirty();
 }
 
 void OctreeNode::OnSceneSet(Scene* newScene, Scene*)
@@ -143,6 +154,12 @@ void OctreeNode::OnTransformChanged()
         octree->QueueUpdate(drawable);
 }
 
+void OctreeNode::OnWorldTransformMoved()
+{
+    if (drawable)
+        drawable->worldTransform = worldTransform;
+}
+
 void OctreeNode::OnBoundingBoxChanged()
 {
     drawable->SetFlag(DF_BOUNDING_BOX_DIRTY, true);
@@ -173,4 +190,6 @@ void OctreeNode::OnEnabledChanged(bool newEnabled)
 void OctreeNode::OnLayerChanged(unsigned char newLayer)
 {
     drawable->layer = newLayer;
+    if (drawable->GetOctant() && !drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+        octree->QueueUpdate(drawable);
 }
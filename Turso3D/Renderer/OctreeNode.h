@@ -7,6 +7,7 @@
 
 class Camera;
 class DebugRenderer;
+class OcclusionRasterizer;
 class Octree;
 class OctreeNode;
 class Ray;
@@ -28,10 +29,21 @@ static const unsigned short DF_OCTREE_UPDATE_CALL = 0x100;
 static const unsigned short DF_WORLD_TRANSFORM_DIRTY = 0x200;
 static const unsigned short DF_BOUNDING_BOX_DIRTY = 0x400;
 static const unsigned short DF_OCTREE_REINSERT_QUEUED = 0x800;
+static const unsigned short DF_OCCLUDER = 0x1000;
+static const unsigned short DF_LOD_FADE = 0x2000;
+static const unsigned short DF_IMPOSTOR = 0x4000;
+static const unsigned short DF_HLOD = 0x8000;
+/// Decals are kept with the lights in the octants and marked by a geometry type, which lights do not use otherwise. Test all bits.
+static const unsigned short DF_DECAL = DF_LIGHT | DF_SKINNED_GEOMETRY;
+
+/// Drawable types that Renderer prepares for rendering in batches without virtual calls. Other drawables are prepared individually through OnPrepareRender().
+static const unsigned char DT_OTHER = 0;
+static const unsigned char DT_STATICMODEL = 1;
 
 /// Base class for drawables that are inserted to the octree. These are managed by their scene node.
 class Drawable
 {
+    friend struct Octant;
     friend class Octree;
     friend class OctreeNode;
 
@@ -43,12 +55,16 @@ public:
 
     /// Recalculate the world space bounding box.
     virtual void OnWorldBoundingBoxUpdate() const;
+    /// Return the local space bounding box if the world space bounding box is currently just it transformed by the world transform, or null otherwise. Used by the octree to update the bounding boxes in batches.
+    virtual const BoundingBox* LocalBoundingBox() const { return nullptr; }
     /// Do processing before octree reinsertion, e.g. animation. Called by Octree in worker threads. Must be opted-in by setting DF_OCTREE_UPDATE_CALL flag.
     virtual void OnOctreeUpdate(unsigned short frameNumber);
     /// Prepare object for rendering. Reset framenumber and calculate distance from camera. Called by Renderer in worker threads. Return false if should not render.
     virtual bool OnPrepareRender(unsigned short frameNumber, Camera* camera);
     /// Perform ray test on self and add possible hit to the result vector.
     virtual void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance);
+    /// Add occluder triangles for software occlusion. Called by Renderer in worker threads for drawables with the DF_OCCLUDER flag. Default implementation does nothing.
+    virtual void OnRasterizeOcclusion(OcclusionRasterizer* rasterizer, unsigned threadIndex);
     /// Add debug geometry to be rendered. Default implementation draws the bounding box.
     virtual void OnRenderDebug(DebugRenderer* debug);
 
@@ -61,6 +77,8 @@ public:
     unsigned short Flags() const { return flags; }
     /// Return bitmask corresponding to layer.
     unsigned LayerMask() const { return 1 << layer; }
+    /// Return the type for batched preparation.
+    unsigned char DrawableType() const { return drawableType; }
     /// Return the owner node.
     OctreeNode* Owner() const { return owner; }
     /// Return current octree octant this drawable resides in.
@@ -71,12 +89,16 @@ public:
     float MaxDistance() const { return maxDistance; }
     /// Return whether is static.
     bool IsStatic() const { return TestFlag(DF_STATIC); }
+    /// Return the index of the world transform in the octree's static transform table, or M_MAX_UNSIGNED if not in the table.
+    unsigned StaticIndex() const { return staticIndex; }
     /// Return last frame number when was visible. The frames are counted by Renderer internally and have no significance outside it.
     unsigned short LastFrameNumber() const { return lastFrameNumber; }
     /// Return last frame number when was reinserted to octree (moved or animated.) The frames are counted by Renderer internally and have no significance outside it.
     unsigned short LastUpdateFrameNumber() const { return lastUpdateFrameNumber; }
     /// Check whether is marked in view this frame.
     bool InView(unsigned short frameNumber) { return lastFrameNumber == frameNumber; }
+    /// Mark in view without preparing for rendering. Used by Renderer for drawables whose batches are cached, which need no per-frame preparation.
+    void MarkInView(unsigned short frameNumber) { lastFrameNumber = frameNumber; }
     /// Return position in world space.
     Vector3 WorldPosition() const { return WorldTransform().Translation(); }
     /// Return rotation in world space.
@@ -120,10 +142,20 @@ protected:
     Matrix3x4* worldTransform;
     /// Current octree octant.
     Octant* octant;
+    /// Index in the current octant's drawables.
+    unsigned octantIndex;
+    /// Octree reinsertion queue the drawable is in, or null if not queued.
+    std::vector<Drawable*>* reinsertQueue;
+    /// Index in the reinsertion queue.
+    unsigned reinsertQueueIndex;
+    /// Index in the octree's static transform table.
+    unsigned staticIndex;
     /// %Drawable flags. Used to hold several boolean values to reduce memory use.
     mutable unsigned short flags;
     /// Layer number. Copy of the node layer.
     unsigned char layer;
+    /// Type for batched preparation. Subclasses that override OnPrepareRender() of a batched type should reset it to DT_OTHER.
+    unsigned char drawableType;
     /// Last frame number when was visible.
     unsigned short lastFrameNumber;
     /// Last frame number when was reinserted to octree or other change (LOD etc.) happened.
@@ -189,11 +221,13 @@ protected:
     void OnSceneSet(Scene* newScene, Scene* oldScene) override;
     /// Handle the transform matrix changing. Queue octree reinsertion for the drawable.
     void OnTransformChanged() override;
+    /// Handle the world transform matrix moving in memory. Update the drawable's pointer to it.
+    void OnWorldTransformMoved() override;
     /// Handle the bounding box changing. Only queue octree reinsertion, does not dirty the node hierarchy.
     void OnBoundingBoxChanged();
     /// Handle the enabled status changing.
     void OnEnabledChanged(bool newEnabled) override;
-    /// Handle the layer changing.
+    /// Handle the layer changing. Queue octree reinsertion so that the octant's culling data is updated.
     void OnLayerChanged(unsigned char newLayer) override;
     /// Remove from the current octree.
     void RemoveFromOctree();
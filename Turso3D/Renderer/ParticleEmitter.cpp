@@ -0,0 +1,307 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Graphics.h"
+#include "../Graphics/IndexBuffer.h"
+#include "../Graphics/Shader.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../Object/Allocator.h"
+#include "../Resource/ResourceCache.h"
+#include "Camera.h"
+#include "Material.h"
+#include "ParticleEmitter.h"
+
+#include <tracy/Tracy.hpp>
+
+static const UniformSlot U_EMITTERTRANSFORM = ShaderProgram::RegisterUniform("emitterTransform");
+static const UniformSlot U_EMITPARAMETERS = ShaderProgram::RegisterUniform("emitParameters");
+static const UniformSlot U_EMITVELOCITY = ShaderProgram::RegisterUniform("emitVelocity");
+static const UniformSlot U_EMITACCELERATION = ShaderProgram::RegisterUniform("emitAcceleration");
+static const UniformSlot U_EMITSTATE = ShaderProgram::RegisterUniform("emitState");
+static const UniformSlot U_PARTICLESIZE = ShaderProgram::RegisterUniform("particleSize");
+
+static Allocator<ParticleEmitterDrawable> drawableAllocator;
+
+bool ParticleEmitterDrawable::particlesSimulated = false;
+SharedPtr<Material> ParticleEmitter::defaultMaterial;
+
+/// Extend a range by the extremes of ballistic travel v * x + a * x^2 / 2 over 0..t, which are at the ends or at the turning point.
+static void ExtendTravelRange(float v, float a, float t, float& minValue, float& maxValue)
+{
+    float end = v * t + 0.5f * a * t * t;
+    minValue = Min(minValue, end);
+    maxValue = Max(maxValue, end);
+
+    if (a != 0.0f)
+    {
+        float turn = -v / a;
+        if (turn > 0.0f && turn < t)
+        {
+            float value = v * turn + 0.5f * a * turn * turn;
+            minValue = Min(minValue, value);
+            maxValue = Max(maxValue, value);
+        }
+    }
+}
+
+ParticleEmitterDrawable::ParticleEmitterDrawable() :
+    maxParticles(DEFAULT_MAX_PARTICLES),
+    lifetime(DEFAULT_PARTICLE_LIFETIME),
+    velocity(Vector3::UP),
+    velocitySpread(0.5f),
+    acceleration(Vector3::ZERO),
+    emitRadius(0.0f),
+    particleSize(0.1f, 0.1f),
+    pendingTime(0.0f),
+    seed(0),
+    emitting(true),
+    resetPending(true)
+{
+    SetFlag(DF_CUSTOM_GEOMETRY, true);
+}
+
+void ParticleEmitterDrawable::OnWorldBoundingBoxUpdate() const
+{
+    const Matrix3x4& transform = WorldTransform();
+    Vector3 scale = transform.Scale();
+    float maxScale = Max(scale.x, Max(scale.y, scale.z));
+    Vector3 worldVelocity = transform * Vector4(velocity, 0.0f);
+    float spread = velocitySpread * maxScale;
+
+    Vector3 minOffset(Vector3::ZERO);
+    Vector3 maxOffset(Vector3::ZERO);
+    float* minData = &minOffset.x;
+    float* maxData = &maxOffset.x;
+    for (size_t i = 0; i < 3; ++i)
+    {
+        // Travel is linear in the velocity, so the extremes come from the extremes of the spread
+        ExtendTravelRange(worldVelocity.Data()[i] - spread, acceleration.Data()[i], lifetime, minData[i], maxData[i]);
+        ExtendTravelRange(worldVelocity.Data()[i] + spread, acceleration.Data()[i], lifetime, minData[i], maxData[i]);
+    }
+
+    // Add the emission sphere and the half diagonal of the largest quad
+    float margin = emitRadius * maxScale + 0.7072f * Max(particleSize.x, particleSize.y);
+    Vector3 center = transform.Translation();
+    worldBoundingBox.Define(center + minOffset - margin * Vector3::ONE, center + maxOffset + margin * Vector3::ONE);
+    SetFlag(DF_BOUNDING_BOX_DIRTY, false);
+}
+
+bool ParticleEmitterDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    if (!geometry)
+        return false;
+
+    return Drawable::OnPrepareRender(frameNumber, camera);
+}
+
+void ParticleEmitterDrawable::OnUpdateGPUData()
+{
+    // The emitter may be in several views and passes, but the time is consumed by the first
+    if (geometry && (pendingTime > 0.0f || resetPending))
+        Simulate();
+}
+
+void ParticleEmitterDrawable::OnRender(ShaderProgram* program, size_t)
+{
+    Object::Subsystem<Graphics>()->SetUniform(program, U_PARTICLESIZE, Vector4(particleSize.x, particleSize.y, lifetime, 0.0f));
+}
+
+bool ParticleEmitterDrawable::CreateBuffers()
+{
+    geometry.Reset();
+
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    if (!graphics || !graphics->IsInitialized() || !graphics->HasComputeShaders() || !graphics->HasInstancing() || !maxParticles)
+        return false;
+
+    static const float quadVertices[] = {
+        -0.5f, -0.5f, 0.0f,
+        0.5f, -0.5f, 0.0f,
+        0.5f, 0.5f, 0.0f,
+        -0.5f, 0.5f, 0.0f
+    };
+    static const unsigned short quadIndices[] = {
+        0, 1, 2,
+        2, 3, 0
+    };
+
+    std::vector<VertexElement> vertexElements;
+    vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+
+    // Each particle state is three vectors, matching the layout of instance transforms: position and age, velocity and
+    // random variation, and reserved
+    std::vector<VertexElement> stateElements;
+    stateElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 3));
+    stateElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 4));
+    stateElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 5));
+
+    SharedPtr<Geometry> newGeometry(new Geometry());
+    newGeometry->vertexBuffer = new VertexBuffer();
+    newGeometry->indexBuffer = new IndexBuffer();
+    newGeometry->instanceBuffer = new VertexBuffer();
+    newGeometry->drawStart = 0;
+    newGeometry->drawCount = 6;
+    if (!newGeometry->vertexBuffer->Define(USAGE_DEFAULT, 4, vertexElements, quadVertices) ||
+        !newGeometry->indexBuffer->Define(USAGE_DEFAULT, 6, sizeof(unsigned short), quadIndices) ||
+        !newGeometry->instanceBuffer->Define(USAGE_DEFAULT, maxParticles, stateElements))
+        return false;
+
+    geometry = newGeometry;
+    resetPending = true;
+    return true;
+}
+
+void ParticleEmitterDrawable::Simulate()
+{
+    ZoneScoped;
+
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    ShaderProgram* program = graphics->SetComputeProgram("Shaders/ParticleUpdate.glsl");
+    if (!program)
+        return;
+
+    // The seed is kept exactly representable as a float
+    seed = (seed + 1) & 0xffffff;
+
+    graphics->SetUniform(program, U_EMITTERTRANSFORM, WorldTransform());
+    graphics->SetUniform(program, U_EMITPARAMETERS, Vector4(pendingTime, lifetime, emitRadius, velocitySpread));
+    graphics->SetUniform(program, U_EMITVELOCITY, Vector4(velocity, (float)maxParticles));
+    graphics->SetUniform(program, U_EMITACCELERATION, Vector4(acceleration, (float)seed));
+    graphics->SetUniform(program, U_EMITSTATE, Vector4(emitting ? 1.0f : 0.0f, resetPending ? 1.0f : 0.0f, 0.0f, 0.0f));
+    geometry->instanceBuffer->BindStorage(0);
+    graphics->DispatchCompute(IntVector3((int)(maxParticles + 63) / 64, 1, 1));
+
+    // Renderer issues the barrier for vertex fetches once all the emitters in view have been simulated
+    particlesSimulated = true;
+    pendingTime = 0.0f;
+    resetPending = false;
+}
+
+ParticleEmitter::ParticleEmitter()
+{
+    drawable = drawableAllocator.Allocate();
+    drawable->SetOwner(this);
+
+    static_cast<ParticleEmitterDrawable*>(drawable)->CreateBuffers();
+    UpdateBatches();
+}
+
+ParticleEmitter::~ParticleEmitter()
+{
+    RemoveFromOctree();
+    drawableAllocator.Free(static_cast<ParticleEmitterDrawable*>(drawable));
+    drawable = nullptr;
+}
+
+void ParticleEmitter::RegisterObject()
+{
+    RegisterFactory<ParticleEmitter>();
+    CopyBaseAttributes<ParticleEmitter, GeometryNode>();
+    RegisterDerivedType<ParticleEmitter, GeometryNode>();
+    RegisterAttribute("maxParticles", &ParticleEmitter::MaxParticles, &ParticleEmitter::SetMaxParticles, DEFAULT_MAX_PARTICLES);
+    RegisterAttribute("lifetime", &ParticleEmitter::Lifetime, &ParticleEmitter::SetLifetime, DEFAULT_PARTICLE_LIFETIME);
+    RegisterRefAttribute("velocity", &ParticleEmitter::Velocity, &ParticleEmitter::SetVelocity, Vector3::UP);
+    RegisterAttribute("velocitySpread", &ParticleEmitter::VelocitySpread, &ParticleEmitter::SetVelocitySpread, 0.5f);
+    RegisterRefAttribute("acceleration", &ParticleEmitter::Acceleration, &ParticleEmitter::SetAcceleration, Vector3::ZERO);
+    RegisterAttribute("emitRadius", &ParticleEmitter::EmitRadius, &ParticleEmitter::SetEmitRadius, 0.0f);
+    RegisterRefAttribute("particleSize", &ParticleEmitter::ParticleSize, &ParticleEmitter::SetParticleSize, Vector2(0.1f, 0.1f));
+    RegisterAttribute("emitting", &ParticleEmitter::IsEmitting, &ParticleEmitter::SetEmitting, true);
+}
+
+void ParticleEmitter::Update(float timeStep)
+{
+    ParticleEmitterDrawable* emitterDrawable = static_cast<ParticleEmitterDrawable*>(drawable);
+    emitterDrawable->pendingTime = Min(emitterDrawable->pendingTime + timeStep, emitterDrawable->lifetime);
+}
+
+void ParticleEmitter::SetMaxParticles(unsigned num)
+{
+    ParticleEmitterDrawable* emitterDrawable = static_cast<ParticleEmitterDrawable*>(drawable);
+    if (num == emitterDrawable->maxParticles)
+        return;
+
+    emitterDrawable->maxParticles = num;
+    emitterDrawable->CreateBuffers();
+    UpdateBatches();
+}
+
+void ParticleEmitter::SetLifetime(float time)
+{
+    static_cast<ParticleEmitterDrawable*>(drawable)->lifetime = Max(time, M_EPSILON);
+    OnBoundingBoxChanged();
+}
+
+void ParticleEmitter::SetVelocity(const Vector3& velocity)
+{
+    static_cast<ParticleEmitterDrawable*>(drawable)->velocity = velocity;
+    OnBoundingBoxChanged();
+}
+
+void ParticleEmitter::SetVelocitySpread(float spread)
+{
+    static_cast<ParticleEmitterDrawable*>(drawable)->velocitySpread = Max(spread, 0.0f);
+    OnBoundingBoxChanged();
+}
+
+void ParticleEmitter::SetAcceleration(const Vector3& acceleration)
+{
+    static_cast<ParticleEmitterDrawable*>(drawable)->acceleration = acceleration;
+    OnBoundingBoxChanged();
+}
+
+void ParticleEmitter::SetEmitRadius(float radius)
+{
+    static_cast<ParticleEmitterDrawable*>(drawable)->emitRadius = Max(radius, 0.0f);
+    OnBoundingBoxChanged();
+}
+
+void ParticleEmitter::SetParticleSize(const Vector2& size)
+{
+    static_cast<ParticleEmitterDrawable*>(drawable)->particleSize = size;
+    OnBoundingBoxChanged();
+}
+
+void ParticleEmitter::SetEmitting(bool enable)
+{
+    static_cast<ParticleEmitterDrawable*>(drawable)->emitting = enable;
+}
+
+void ParticleEmitter::Reset()
+{
+    static_cast<ParticleEmitterDrawable*>(drawable)->resetPending = true;
+}
+
+void ParticleEmitter::UpdateBatches()
+{
+    // Without the buffers there is no batch, so that nothing refers to a destroyed geometry
+    Geometry* geometry = static_cast<ParticleEmitterDrawable*>(drawable)->geometry;
+    if (geometry)
+    {
+        if (!NumGeometries())
+        {
+            SetNumGeometries(1);
+            SetMaterial(DefaultMaterial());
+        }
+        SetGeometry(0, geometry);
+    }
+    else
+        SetNumGeometries(0);
+}
+
+Material* ParticleEmitter::DefaultMaterial()
+{
+    if (!defaultMaterial)
+    {
+        ResourceCache* cache = Subsystem<ResourceCache>();
+
+        defaultMaterial = new Material();
+        defaultMaterial->SetUniform(U_MATDIFFCOLOR, Vector4::ONE);
+        defaultMaterial->SetCullMode(CULL_NONE);
+
+        Pass* pass = defaultMaterial->CreatePass(PASS_ALPHA);
+        pass->SetShader(cache->LoadResource<Shader>("Shaders/Particle.glsl"), "", "");
+        pass->SetRenderState(BLEND_ADDALPHA, CMP_LESS, true, false);
+    }
+
+    return defaultMaterial;
+}
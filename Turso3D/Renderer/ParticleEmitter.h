@@ -0,0 +1,129 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "GeometryNode.h"
+
+class Material;
+
+static const unsigned DEFAULT_MAX_PARTICLES = 1000;
+static const float DEFAULT_PARTICLE_LIFETIME = 2.0f;
+
+/// Particle emitter drawable. The particle states live in a GPU buffer, which a compute shader simulates and respawns, and which is drawn as the instance data of a quad in one instanced call.
+class ParticleEmitterDrawable : public GeometryDrawable
+{
+    friend class ParticleEmitter;
+
+public:
+    /// Construct.
+    ParticleEmitterDrawable();
+
+    /// Recalculate the world space bounding box from the estimated reach of the particles.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Prepare object for rendering. Calculate distance from camera to the bounding box center. Return false if should not render.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Simulate the particles by the time elapsed since the last simulation, once per frame regardless of the number of views. Called by Renderer in the main thread once view preparation has finished.
+    void OnUpdateGPUData() override;
+    /// Set the particle size and lifetime uniform. The particle states are already in world space. Called by Renderer when geometry type is not static.
+    void OnRender(ShaderProgram* program, size_t geomIndex) override;
+
+    /// Return whether any emitter has simulated particles since the last call, and reset the status.
+    static bool CheckParticlesSimulated() { bool ret = particlesSimulated; particlesSimulated = false; return ret; }
+
+private:
+    /// Create the quad geometry and the particle state buffer for the maximum particle count. Return true on success.
+    bool CreateBuffers();
+    /// Dispatch the simulation compute shader.
+    void Simulate();
+
+    /// Quad geometry, with the particle states as its instance data.
+    SharedPtr<Geometry> geometry;
+    /// Maximum particle count.
+    unsigned maxParticles;
+    /// Particle lifetime in seconds.
+    float lifetime;
+    /// Emission velocity in node local space.
+    Vector3 velocity;
+    /// Radius of the random velocity added to the emission velocity.
+    float velocitySpread;
+    /// Acceleration in world space.
+    Vector3 acceleration;
+    /// Radius of the emission sphere in node local space.
+    float emitRadius;
+    /// Particle size at birth and at the end of the lifetime.
+    Vector2 particleSize;
+    /// Time elapsed since the last simulation.
+    float pendingTime;
+    /// Random seed of the next simulation.
+    unsigned seed;
+    /// Emitting flag.
+    bool emitting;
+    /// Particle states need to be initialized flag.
+    bool resetPending;
+
+    /// Whether any emitter has simulated particles since the last check.
+    static bool particlesSimulated;
+};
+
+/// %Scene node that emits and renders particles simulated entirely on the GPU, without per-particle work on the CPU. The particles are emitted continuously at the rate of the maximum count per lifetime, move ballistically under the acceleration, and are drawn as camera-facing quads lit by the Forward+ light clusters. Particles that have been emitted stay in world space when the node moves. The bounding box is estimated from the motion over the lifetime, so it does not cover the trail left by a moving emitter. Requires compute shader support. Call Update() once per frame to advance the simulation.
+class ParticleEmitter : public GeometryNode
+{
+    OBJECT(ParticleEmitter);
+
+public:
+    /// Construct.
+    ParticleEmitter();
+    /// Destruct.
+    ~ParticleEmitter();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Advance the simulation time. The simulation runs when the emitter is next rendered, catching up at most one lifetime.
+    void Update(float timeStep);
+    /// Set maximum number of particles. Restarts the emission. Default 1000.
+    void SetMaxParticles(unsigned num);
+    /// Set particle lifetime in seconds. Default 2.
+    void SetLifetime(float time);
+    /// Set emission velocity in node local space. Default upward at 1 unit per second.
+    void SetVelocity(const Vector3& velocity);
+    /// Set the radius of the random velocity added to the emission velocity. Default 0.5.
+    void SetVelocitySpread(float spread);
+    /// Set acceleration in world space, for example gravity. Default zero.
+    void SetAcceleration(const Vector3& acceleration);
+    /// Set the radius of the emission sphere in node local space. Default 0.
+    void SetEmitRadius(float radius);
+    /// Set particle size at birth and at the end of the lifetime. Default 0.1 for both.
+    void SetParticleSize(const Vector2& size);
+    /// Set whether new particles are emitted. The existing particles live out their lifetime. Default true.
+    void SetEmitting(bool enable);
+    /// Kill all particles and restart the emission.
+    void Reset();
+
+    /// Return maximum number of particles.
+    unsigned MaxParticles() const { return static_cast<ParticleEmitterDrawable*>(drawable)->maxParticles; }
+    /// Return particle lifetime.
+    float Lifetime() const { return static_cast<ParticleEmitterDrawable*>(drawable)->lifetime; }
+    /// Return emission velocity.
+    const Vector3& Velocity() const { return static_cast<ParticleEmitterDrawable*>(drawable)->velocity; }
+    /// Return the radius of the random velocity.
+    float VelocitySpread() const { return static_cast<ParticleEmitterDrawable*>(drawable)->velocitySpread; }
+    /// Return acceleration.
+    const Vector3& Acceleration() const { return static_cast<ParticleEmitterDrawable*>(drawable)->acceleration; }
+    /// Return the radius of the emission sphere.
+    float EmitRadius() const { return static_cast<ParticleEmitterDrawable*>(drawable)->emitRadius; }
+    /// Return particle size at birth and at the end of the lifetime.
+    const Vector2& ParticleSize() const { return static_cast<ParticleEmitterDrawable*>(drawable)->particleSize; }
+    /// Return whether new particles are emitted.
+    bool IsEmitting() const { return static_cast<ParticleEmitterDrawable*>(drawable)->emitting; }
+
+    /// Return the default particle material, which draws the particles as soft additive round sprites tinted by the diffuse color.
+    static Material* DefaultMaterial();
+
+private:
+    /// Assign the quad geometry to the batch, or remove the batch if the buffers could not be created. The material is kept unless the batch was removed.
+    void UpdateBatches();
+
+    /// Default particle material.
+    static SharedPtr<Material> defaultMaterial;
+};
@@ -0,0 +1,242 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "PortalCells.h"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+PortalCells::PortalCells()
+{
+    // The exterior's portal list is kept last
+    cellPortals.resize(1);
+}
+
+unsigned PortalCells::AddCell(const BoundingBox& box)
+{
+    cellBoxes.push_back(box);
+    cellPortals.insert(cellPortals.end() - 1, std::vector<unsigned>());
+    return (unsigned)cellBoxes.size() - 1;
+}
+
+unsigned PortalCells::AddPortal(unsigned cell1, unsigned cell2, const Vector3& v0, const Vector3& v1, const Vector3& v2, const Vector3& v3)
+{
+    if ((cell1 >= cellBoxes.size() && cell1 != PORTAL_EXTERIOR) || (cell2 >= cellBoxes.size() && cell2 != PORTAL_EXTERIOR) || cell1 == cell2)
+    {
+        LOGERROR("Invalid cells for portal");
+        return M_MAX_UNSIGNED;
+    }
+
+    Portal newPortal;
+    newPortal.vertices[0] = v0;
+    newPortal.vertices[1] = v1;
+    newPortal.vertices[2] = v2;
+    newPortal.vertices[3] = v3;
+    newPortal.box.Define(v0);
+    newPortal.box.Merge(v1);
+    newPortal.box.Merge(v2);
+    newPortal.box.Merge(v3);
+    newPortal.cells[0] = cell1;
+    newPortal.cells[1] = cell2;
+
+    unsigned index = (unsigned)portals.size();
+    portals.push_back(newPortal);
+    cellPortals[cell1 == PORTAL_EXTERIOR ? cellBoxes.size() : cell1].push_back(index);
+    cellPortals[cell2 == PORTAL_EXTERIOR ? cellBoxes.size() : cell2].push_back(index);
+    return index;
+}
+
+void PortalCells::Clear()
+{
+    cellBoxes.clear();
+    portals.clear();
+    cellPortals.clear();
+    cellPortals.resize(1);
+}
+
+unsigned PortalCells::FindCell(const Vector3& position) const
+{
+    for (size_t i = 0; i < cellBoxes.size(); ++i)
+    {
+        if (cellBoxes[i].IsInside(position) != OUTSIDE)
+            return (unsigned)i;
+    }
+
+    return PORTAL_EXTERIOR;
+}
+
+void PortalCells::FindReachableCells(std::vector<unsigned>& result, unsigned cell, const BoundingBox& bounds) const
+{
+    result.clear();
+    result.push_back(cell);
+
+    // The result doubles as the traversal queue
+    for (size_t i = 0; i < result.size(); ++i)
+    {
+        const std::vector<unsigned>& portalIndices = CellPortals(result[i]);
+        for (auto it = portalIndices.begin(); it != portalIndices.end(); ++it)
+        {
+            const Portal& portal = portals[*it];
+            if (bounds.IsInsideFast(portal.box) == OUTSIDE)
+                continue;
+
+            unsigned other = portal.cells[0] == result[i] ? portal.cells[1] : portal.cells[0];
+            if (std::find(result.begin(), result.end(), other) == result.end())
+                result.push_back(other);
+        }
+    }
+}
+
+PortalCuller::PortalCuller() :
+    cells(nullptr),
+    viewCell(PORTAL_EXTERIOR)
+{
+}
+
+void PortalCuller::Update(const PortalCells* cells_, const Vector3& viewPosition, const Frustum& frustum, const Matrix3x4& view)
+{
+    ZoneScoped;
+
+    Reset();
+
+    if (!cells_ || !cells_->NumCells())
+        return;
+
+    viewCell = cells_->FindCell(viewPosition);
+    nearSize = view * frustum.vertices[0];
+    farSize = view * frustum.vertices[4];
+    if (viewCell == PORTAL_EXTERIOR || farSize.z <= nearSize.z)
+        return;
+
+    cells = cells_;
+    viewFrustum = frustum;
+    viewMatrix = view;
+
+    size_t exteriorIdx = cells->NumCells();
+    cellRects.resize(exteriorIdx + 1);
+    cellRects[viewCell] = Rect::FULL;
+    pendingCells.push_back(viewCell);
+
+    // Propagate the screen rectangles through the portals, clipped by the rectangle of the cell they are seen from. A cell is traversed again only when its rectangle grows
+    while (pendingCells.size())
+    {
+        unsigned cell = pendingCells.back();
+        pendingCells.pop_back();
+        Rect cellRect = cellRects[cell == PORTAL_EXTERIOR ? exteriorIdx : cell];
+
+        const std::vector<unsigned>& portalIndices = cells->CellPortals(cell);
+        for (auto it = portalIndices.begin(); it != portalIndices.end(); ++it)
+        {
+            const Portal& portal = cells->Portals()[*it];
+            Rect portalRect;
+            if (!ProjectPortal(portal, portalRect))
+                continue;
+
+            portalRect.min.x = Max(portalRect.min.x, cellRect.min.x);
+            portalRect.min.y = Max(portalRect.min.y, cellRect.min.y);
+            portalRect.max.x = Min(portalRect.max.x, cellRect.max.x);
+            portalRect.max.y = Min(portalRect.max.y, cellRect.max.y);
+            if (portalRect.min.x >= portalRect.max.x || portalRect.min.y >= portalRect.max.y)
+                continue;
+
+            unsigned other = portal.cells[0] == cell ? portal.cells[1] : portal.cells[0];
+            Rect& otherRect = cellRects[other == PORTAL_EXTERIOR ? exteriorIdx : other];
+            if (otherRect.IsDefined() && portalRect.min.x >= otherRect.min.x && portalRect.min.y >= otherRect.min.y && portalRect.max.x <= otherRect.max.x &&
+                portalRect.max.y <= otherRect.max.y)
+                continue;
+
+            otherRect.Merge(portalRect);
+            pendingCells.push_back(other);
+        }
+    }
+
+    for (size_t i = 0; i < cellRects.size(); ++i)
+    {
+        if (!cellRects[i].IsDefined())
+            continue;
+
+        visibleCells.push_back(i == exteriorIdx ? PORTAL_EXTERIOR : (unsigned)i);
+        cellFrustums.push_back(cellRects[i] == Rect::FULL ? viewFrustum : RectFrustum(cellRects[i]));
+    }
+}
+
+void PortalCuller::Reset()
+{
+    cells = nullptr;
+    cellRects.clear();
+    pendingCells.clear();
+    visibleCells.clear();
+    cellFrustums.clear();
+    viewCell = PORTAL_EXTERIOR;
+}
+
+bool PortalCuller::IsVisible(const BoundingBox& box) const
+{
+    if (visibleCells.empty())
+        return true;
+
+    for (size_t i = 0; i < visibleCells.size(); ++i)
+    {
+        unsigned cell = visibleCells[i];
+        if (cell != PORTAL_EXTERIOR && cells->CellBox(cell).IsInsideFast(box) == OUTSIDE)
+            continue;
+        if (cellFrustums[i].IsInsideFast(box) != OUTSIDE)
+            return true;
+    }
+
+    return false;
+}
+
+bool PortalCuller::ProjectPortal(const Portal& portal, Rect& dest) const
+{
+    bool inFront = false;
+    bool clipped = false;
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        Vector3 viewPos = viewMatrix * portal.vertices[i];
+        if (viewPos.z < nearSize.z)
+        {
+            clipped = true;
+            continue;
+        }
+
+        // The half size of the view volume changes linearly with depth in both perspective and orthographic views
+        float t = (viewPos.z - nearSize.z) / (farSize.z - nearSize.z);
+        dest.Merge(Vector2(viewPos.x / Lerp(nearSize.x, farSize.x, t), viewPos.y / Lerp(nearSize.y, farSize.y, t)));
+        inFront = true;
+    }
+
+    // A portal crossing the near plane can not be bounded by its projected vertices, so use the whole screen
+    if (inFront && clipped)
+        dest = Rect::FULL;
+
+    return inFront;
+}
+
+Frustum PortalCuller::RectFrustum(const Rect& rect) const
+{
+    // Same vertex order as in Frustum::Define(): the +X+Y, +X-Y, -X-Y and -X+Y corners of the near plane, then the far plane
+    Vector2 corners[4] = {
+        Vector2(rect.max.x, rect.max.y),
+        Vector2(rect.max.x, rect.min.y),
+        Vector2(rect.min.x, rect.min.y),
+        Vector2(rect.min.x, rect.max.y)
+    };
+
+    Frustum ret;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        float u = (corners[i].x + 1.0f) * 0.5f;
+        float v = (corners[i].y + 1.0f) * 0.5f;
+
+        for (size_t j = 0; j < NUM_FRUSTUM_VERTICES; j += 4)
+        {
+            const Vector3* src = &viewFrustum.vertices[j];
+            ret.vertices[j + i] = src[2].Lerp(src[1], u).Lerp(src[3].Lerp(src[0], u), v);
+        }
+    }
+
+    ret.UpdatePlanes();
+    return ret;
+}
@@ -0,0 +1,109 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Frustum.h"
+#include "../Math/Rect.h"
+#include "../Object/Ptr.h"
+
+#include <vector>
+
+/// Cell index of the space outside all cells.
+static const unsigned PORTAL_EXTERIOR = 0xffffffff;
+
+/// Convex quad opening between two cells, or a cell and the exterior.
+struct Portal
+{
+    /// World space vertices in winding order.
+    Vector3 vertices[4];
+    /// Bounding box of the vertices.
+    BoundingBox box;
+    /// Connected cells.
+    unsigned cells[2];
+};
+
+/// Cell-and-portal description of interior spaces, such as the rooms of a building, layered on the octree. Cells are world space boxes and portals the openings between them. Set to Renderer with Renderer::SetPortalCells() to restrict the culling when the camera is inside a cell. Should not be modified while a view is being prepared.
+class PortalCells : public RefCounted
+{
+public:
+    /// Construct with no cells.
+    PortalCells();
+
+    /// Add a cell and return its index. Where cells overlap, a position belongs to the first added.
+    unsigned AddCell(const BoundingBox& box);
+    /// Add a convex quad portal between two cells, or a cell and PORTAL_EXTERIOR, and return its index.
+    unsigned AddPortal(unsigned cell1, unsigned cell2, const Vector3& v0, const Vector3& v1, const Vector3& v2, const Vector3& v3);
+    /// Remove all cells and portals.
+    void Clear();
+
+    /// Return the index of the cell containing a position, or PORTAL_EXTERIOR if none.
+    unsigned FindCell(const Vector3& position) const;
+    /// Find the cells reachable from a cell through portals that intersect a bounding box, including the cell itself. PORTAL_EXTERIOR is included if reached. Replaces the result.
+    void FindReachableCells(std::vector<unsigned>& result, unsigned cell, const BoundingBox& bounds) const;
+
+    /// Return number of cells.
+    size_t NumCells() const { return cellBoxes.size(); }
+    /// Return the bounding box of a cell.
+    const BoundingBox& CellBox(unsigned cell) const { return cellBoxes[cell]; }
+    /// Return the portals.
+    const std::vector<Portal>& Portals() const { return portals; }
+    /// Return the portal indices of a cell, or of the exterior with PORTAL_EXTERIOR.
+    const std::vector<unsigned>& CellPortals(unsigned cell) const { return cellPortals[cell == PORTAL_EXTERIOR ? cellBoxes.size() : cell]; }
+
+private:
+    /// Cell bounding boxes.
+    std::vector<BoundingBox> cellBoxes;
+    /// Portals.
+    std::vector<Portal> portals;
+    /// Portal indices of each cell, with the exterior last.
+    std::vector<std::vector<unsigned> > cellPortals;
+};
+
+/// Per-view result of portal traversal from the camera's cell. Each visible cell stores the screen rectangle of the portals it was seen through, as a narrowed frustum for testing. Built on the main thread before culling; the tests can then be run from any thread.
+class PortalCuller
+{
+public:
+    /// Construct with no data.
+    PortalCuller();
+
+    /// Traverse the portals from the cell containing the view position, narrowing the view frustum through each portal. The view matrix must match the frustum. With the view position outside all cells, no data is produced and all tests pass.
+    void Update(const PortalCells* cells, const Vector3& viewPosition, const Frustum& frustum, const Matrix3x4& view);
+    /// Discard the data. All tests will then pass.
+    void Reset();
+
+    /// Test whether a world space bounding box may be visible through the portals. Returns true also when there is no data.
+    bool IsVisible(const BoundingBox& box) const;
+    /// Return whether has data for testing.
+    bool HasData() const { return visibleCells.size() > 0; }
+    /// Return the cell containing the view position, or PORTAL_EXTERIOR.
+    unsigned ViewCell() const { return viewCell; }
+    /// Return the visible cells. PORTAL_EXTERIOR is included if seen through a portal.
+    const std::vector<unsigned>& VisibleCells() const { return visibleCells; }
+
+private:
+    /// Project a portal to a normalized screen rectangle. Return false if behind the near plane.
+    bool ProjectPortal(const Portal& portal, Rect& dest) const;
+    /// Return the part of the view frustum within a normalized screen rectangle.
+    Frustum RectFrustum(const Rect& rect) const;
+
+    /// Cells the data was built from.
+    const PortalCells* cells;
+    /// View frustum.
+    Frustum viewFrustum;
+    /// View matrix.
+    Matrix3x4 viewMatrix;
+    /// View space half size of the near plane, with the near distance in Z.
+    Vector3 nearSize;
+    /// View space half size of the far plane, with the far distance in Z.
+    Vector3 farSize;
+    /// Screen rectangle of each cell, with the exterior last. Undefined when not visible.
+    std::vector<Rect> cellRects;
+    /// Cells pending traversal.
+    std::vector<unsigned> pendingCells;
+    /// Visible cells.
+    std::vector<unsigned> visibleCells;
+    /// Narrowed frustums of the visible cells.
+    std::vector<Frustum> cellFrustums;
+    /// Cell containing the view position.
+    unsigned viewCell;
+};
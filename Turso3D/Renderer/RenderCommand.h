@@ -0,0 +1,74 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/Matrix3x4.h"
+
+#include <vector>
+
+class GeometryDrawable;
+class Material;
+class Pass;
+class PipelineState;
+struct Geometry;
+
+/// Render command types.
+enum RenderCommandType
+{
+    /// Apply a pipeline state.
+    RCMD_PIPELINE = 0,
+    /// Apply a pass's pipeline state that had not been created yet at recording time.
+    RCMD_PASSPIPELINE,
+    /// Bind a material's textures. Material uniforms are assigned to each program on its first draw after.
+    RCMD_MATERIAL,
+    /// Set the world transform uniform.
+    RCMD_WORLDTRANSFORM,
+    /// Set the LOD crossfade uniform.
+    RCMD_LODFADE,
+    /// Let a drawable set its own uniforms.
+    RCMD_DRAWABLE,
+    /// Bind a geometry's buffers and draw it.
+    RCMD_DRAW,
+    /// Bind a geometry's buffers and draw it instanced.
+    RCMD_DRAWINSTANCED,
+    /// Bind a geometry's buffers and draw a range of indirect commands.
+    RCMD_MULTIDRAW,
+    /// Bind a geometry's buffers and draw a range of the indirect commands written by GPU culling.
+    RCMD_GPUMULTIDRAW
+};
+
+/// Compact, API-agnostic render command, recorded from batches and replayed into the graphics API.
+struct RenderCommand
+{
+    /// Command type.
+    unsigned char type;
+    /// %Shader variation bits for finding the pipeline state of a pass.
+    unsigned char programBits;
+    /// Pipeline variant bits for finding the pipeline state of a pass.
+    unsigned char variant;
+    /// Geometry index for drawables, or instance or indirect command start for draws.
+    unsigned start;
+    /// Instance or indirect command count for draws.
+    unsigned count;
+
+    union
+    {
+        /// Pipeline state.
+        PipelineState* pipeline;
+        /// %Material pass.
+        Pass* pass;
+        /// %Material.
+        Material* material;
+        /// World transform.
+        const Matrix3x4* worldTransform;
+        /// LOD crossfade value.
+        float lodFade;
+        /// Drawable.
+        GeometryDrawable* drawable;
+        /// %Geometry.
+        Geometry* geometry;
+    };
+};
+
+/// Render commands recorded from one segment of a batch queue.
+typedef std::vector<RenderCommand> RenderCommandList;
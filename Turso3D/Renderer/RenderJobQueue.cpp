@@ -0,0 +1,247 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/FrameBuffer.h"
+#include "../Graphics/Graphics.h"
+#include "../Graphics/Texture.h"
+#include "../IO/File.h"
+#include "../IO/Log.h"
+#include "../Thread/WorkQueue.h"
+#include "Camera.h"
+#include "RenderJobQueue.h"
+#include "Renderer.h"
+
+#include <cstring>
+#include <tracy/Tracy.hpp>
+
+RenderJobQueue::RenderJobQueue(Renderer* renderer_) :
+    graphics(Object::Subsystem<Graphics>()),
+    renderer(renderer_ ? renderer_ : Object::Subsystem<Renderer>()),
+    workQueue(Object::Subsystem<WorkQueue>()),
+    maxJobsPerUpdate(DEFAULT_MAX_RENDER_JOBS_PER_UPDATE),
+    maxTargets(DEFAULT_MAX_RENDER_JOB_TARGETS),
+    numInFlight(0),
+    numCompleted(0),
+    numFailed(0)
+{
+    assert(graphics && graphics->IsInitialized());
+    assert(renderer);
+    assert(workQueue);
+}
+
+RenderJobQueue::~RenderJobQueue()
+{
+    // The readback callbacks and encoding tasks refer to the queue
+    Finish();
+}
+
+void RenderJobQueue::AddJob(Scene* scene, Camera* camera, const IntVector2& size, const std::string& fileName, bool drawShadows)
+{
+    if (!scene || !camera || size.x < 1 || size.y < 1)
+    {
+        LOGERROR("Invalid render job for " + fileName);
+        ++numFailed;
+        return;
+    }
+
+    RenderJob job;
+    job.scene = scene;
+    job.camera = camera;
+    job.size = size;
+    job.fileName = fileName;
+    job.drawShadows = drawShadows;
+    pendingJobs.push_back(job);
+}
+
+void RenderJobQueue::Update()
+{
+    ZoneScoped;
+
+    if (pendingJobs.empty())
+        return;
+
+    if (renderer->IsPipelined() || renderer->IsDeferredShading())
+    {
+        LOGERROR("Render jobs require the renderer to not be in pipelined or deferred shading mode");
+        return;
+    }
+
+    size_t numRendered = 0;
+    for (auto it = pendingJobs.begin(); it != pendingJobs.end() && numRendered < maxJobsPerUpdate; )
+    {
+        RenderJobTarget* target = AcquireTarget(it->size);
+        if (!target)
+        {
+            ++it;
+            continue;
+        }
+
+        RenderJobToTarget(*it, target);
+        it = pendingJobs.erase(it);
+        ++numRendered;
+    }
+}
+
+void RenderJobQueue::Finish()
+{
+    ZoneScoped;
+
+    // The GPU finishes the readbacks in order, so after waiting for it all of them arrive at once
+    if (numInFlight.load())
+    {
+        graphics->Finish();
+        graphics->ProcessReadbacks();
+    }
+
+    workQueue->Complete();
+}
+
+void RenderJobQueue::SetMaxJobsPerUpdate(size_t num)
+{
+    maxJobsPerUpdate = num ? num : 1;
+}
+
+void RenderJobQueue::SetMaxTargets(size_t num)
+{
+    maxTargets = num ? num : 1;
+}
+
+RenderJobTarget* RenderJobQueue::AcquireTarget(const IntVector2& size)
+{
+    RenderJobTarget* freeTarget = nullptr;
+
+    for (auto it = targets.begin(); it != targets.end(); ++it)
+    {
+        RenderJobTarget* target = *it;
+        if (target->readback)
+            continue;
+        if (target->colorTexture->Size2D() == size)
+            return target;
+        if (!freeTarget)
+            freeTarget = target;
+    }
+
+    // Create a new target while the pool is not full, otherwise redefine a free target of another size
+    RenderJobTarget* target = nullptr;
+    if (targets.size() < maxTargets)
+    {
+        target = new RenderJobTarget();
+        target->frameBuffer = new FrameBuffer();
+        target->colorTexture = new Texture();
+        target->depthTexture = new Texture();
+        targets.push_back(target);
+    }
+    else if (freeTarget)
+        target = freeTarget;
+    else
+        return nullptr;
+
+    target->colorTexture->Define(TEX_2D, size, FMT_RGBA8);
+    target->colorTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    target->depthTexture->Define(TEX_2D, size, FMT_D32);
+    target->depthTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    target->frameBuffer->Define(target->colorTexture, target->depthTexture);
+    return target;
+}
+
+void RenderJobQueue::RenderJobToTarget(const RenderJob& job, RenderJobTarget* target)
+{
+    ZoneScoped;
+
+    IntRect viewRect(0, 0, job.size.x, job.size.y);
+    job.camera->SetAspectRatio((float)job.size.x / (float)job.size.y);
+
+    // The jobs may be of different scenes, so the cached shadow map contents can not be reused
+    renderer->ResetShadowMaps();
+    renderer->PrepareView(job.scene, job.camera, job.drawShadows);
+    renderer->RenderShadowMaps();
+
+    graphics->SetFrameBuffer(target->frameBuffer);
+    graphics->SetViewport(viewRect);
+    graphics->Clear(true, true, IntRect::ZERO, Color::BLACK);
+    renderer->RenderOpaque(target->depthTexture);
+
+    if (renderer->IsOrderIndependentTransparency())
+    {
+        Texture* accumTexture = graphics->AcquireRenderTarget(job.size, FMT_RGBA16F);
+        Texture* weightTexture = graphics->AcquireRenderTarget(job.size, FMT_R16F);
+        if (!oitFrameBuffer)
+            oitFrameBuffer = new FrameBuffer();
+        oitFrameBuffer->Define(std::vector<Texture*>{ accumTexture, weightTexture }, target->depthTexture);
+
+        // The revealage in the accumulation alpha starts from fully revealed
+        graphics->SetFrameBuffer(oitFrameBuffer);
+        graphics->SetViewport(viewRect);
+        graphics->Clear(true, false, IntRect::ZERO, Color(0.0f, 0.0f, 0.0f, 1.0f));
+        renderer->RenderAlpha();
+
+        graphics->SetFrameBuffer(target->frameBuffer);
+        graphics->SetViewport(viewRect);
+        renderer->RenderAlphaComposite(accumTexture, weightTexture);
+
+        graphics->ReleaseRenderTarget(accumTexture);
+        graphics->ReleaseRenderTarget(weightTexture);
+    }
+    else
+        renderer->RenderAlpha();
+
+    graphics->SetFrameBuffer(nullptr);
+
+    ++numInFlight;
+    std::string fileName = job.fileName;
+    target->readback = graphics->RequestReadback(target->colorTexture, 0, viewRect, [this, target, fileName](Readback* readback)
+    {
+        OnReadback(readback, target, fileName);
+    });
+
+    if (!target->readback)
+    {
+        LOGERROR("Failed to request readback for render job " + fileName);
+        --numInFlight;
+        ++numFailed;
+    }
+}
+
+void RenderJobQueue::OnReadback(Readback* readback, RenderJobTarget* target, const std::string& fileName)
+{
+    // The target can be reused as soon as the data has been read out
+    target->readback.Reset();
+
+    if (!readback->IsReady())
+    {
+        LOGERROR("Failed to read back render job " + fileName);
+        --numInFlight;
+        ++numFailed;
+        return;
+    }
+
+    IntVector2 size = readback->Rect().Size();
+    std::vector<unsigned char> data = readback->Data();
+
+    LambdaTask* task = new LambdaTask([this, size, data, fileName](unsigned)
+    {
+        ZoneScopedN("EncodeRenderJob");
+
+        // The rows are read back from the bottom up, while the image is stored from the top down
+        size_t rowSize = size.x * 4;
+        AutoPtr<Image> image = new Image();
+        image->SetSize(size, FMT_RGBA8);
+        std::vector<unsigned char> flipped(data.size());
+        for (int y = 0; y < size.y; ++y)
+            memcpy(&flipped[y * rowSize], &data[(size.y - 1 - y) * rowSize], rowSize);
+        image->SetData(&flipped[0]);
+
+        File file(fileName, FILE_WRITE);
+        if (file.IsWritable() && image->Save(file))
+            ++numCompleted;
+        else
+        {
+            LOGERROR("Failed to write render job image " + fileName);
+            ++numFailed;
+        }
+
+        --numInFlight;
+    });
+
+    task->deleteOnComplete = true;
+    workQueue->QueueTask(task);
+}
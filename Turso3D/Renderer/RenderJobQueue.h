@@ -0,0 +1,116 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntVector2.h"
+#include "../Object/AutoPtr.h"
+#include "../Object/Ptr.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+class Camera;
+class FrameBuffer;
+class Graphics;
+class Readback;
+class Renderer;
+class Scene;
+class Texture;
+class WorkQueue;
+
+static const size_t DEFAULT_MAX_RENDER_JOBS_PER_UPDATE = 4;
+static const size_t DEFAULT_MAX_RENDER_JOB_TARGETS = 8;
+
+/// Offscreen render job.
+struct RenderJob
+{
+    /// Scene to render.
+    Scene* scene;
+    /// Camera to render with. Its aspect ratio is set from the image size.
+    Camera* camera;
+    /// Image size in pixels.
+    IntVector2 size;
+    /// PNG file to write.
+    std::string fileName;
+    /// Shadow rendering flag.
+    bool drawShadows;
+};
+
+/// Pooled offscreen render target of a job queue.
+struct RenderJobTarget
+{
+    /// Framebuffer.
+    SharedPtr<FrameBuffer> frameBuffer;
+    /// Color texture.
+    SharedPtr<Texture> colorTexture;
+    /// Depth texture.
+    SharedPtr<Texture> depthTexture;
+    /// Readback of the rendered image in progress.
+    SharedPtr<Readback> readback;
+};
+
+/// Queue of independent offscreen render jobs, for producing images such as thumbnails in batch, typically with Graphics in headless mode. Each update renders a number of jobs, each a scene and camera pair, into render targets pooled by size, and requests an asynchronous readback of each. The images that have arrived are encoded to PNG files on worker threads. The scenes are rendered with the renderer's current settings, forward lit, and their shadow maps are rendered fully for each job. Order-independent transparency is accumulated into pooled render targets when enabled in the renderer. Requires the renderer to not be in pipelined or deferred shading mode.
+class RenderJobQueue : public RefCounted
+{
+public:
+    /// Construct with the renderer to use, or the Renderer subsystem if null. A dedicated renderer keeps the view state of the subsystem intact. Graphics and WorkQueue subsystems must exist.
+    RenderJobQueue(Renderer* renderer = nullptr);
+    /// Destruct. Finish the rendered jobs.
+    ~RenderJobQueue();
+
+    /// Add a job. The scene and camera must stay valid until the job has been rendered by Update().
+    void AddJob(Scene* scene, Camera* camera, const IntVector2& size, const std::string& fileName, bool drawShadows = true);
+    /// Render the next pending jobs up to the maximum per update, and request their readbacks. Call once per frame before Graphics::Present(), which processes the readbacks that have arrived. Jobs wait while all render targets of their size are in use.
+    void Update();
+    /// Wait for the GPU and the encoding of all rendered jobs. Stalls.
+    void Finish();
+    /// Set maximum number of jobs rendered per update. Default 4.
+    void SetMaxJobsPerUpdate(size_t num);
+    /// Set maximum number of pooled render targets, which limits the readbacks in flight. Default 8.
+    void SetMaxTargets(size_t num);
+
+    /// Return maximum number of jobs rendered per update.
+    size_t MaxJobsPerUpdate() const { return maxJobsPerUpdate; }
+    /// Return maximum number of pooled render targets.
+    size_t MaxTargets() const { return maxTargets; }
+    /// Return number of jobs waiting to be rendered.
+    size_t NumPendingJobs() const { return pendingJobs.size(); }
+    /// Return number of jobs rendered and waiting for the readback or encoding.
+    size_t NumInFlight() const { return numInFlight.load(std::memory_order_relaxed); }
+    /// Return number of images written since construction.
+    size_t NumCompleted() const { return numCompleted.load(std::memory_order_relaxed); }
+    /// Return number of jobs failed since construction.
+    size_t NumFailed() const { return numFailed.load(std::memory_order_relaxed); }
+
+private:
+    /// Return a free render target of the given size, creating one if the pool is not full, or null if none available.
+    RenderJobTarget* AcquireTarget(const IntVector2& size);
+    /// Render a job into a render target and request its readback.
+    void RenderJobToTarget(const RenderJob& job, RenderJobTarget* target);
+    /// Handle a finished readback by queuing the encoding task.
+    void OnReadback(Readback* readback, RenderJobTarget* target, const std::string& fileName);
+
+    /// Graphics subsystem.
+    Graphics* graphics;
+    /// Renderer used for the jobs.
+    Renderer* renderer;
+    /// Work queue subsystem.
+    WorkQueue* workQueue;
+    /// Jobs waiting to be rendered.
+    std::vector<RenderJob> pendingJobs;
+    /// Pooled render targets. Stored by pointer so that readback callbacks can refer to them.
+    std::vector<AutoPtr<RenderJobTarget> > targets;
+    /// Framebuffer for accumulating order-independent transparency.
+    SharedPtr<FrameBuffer> oitFrameBuffer;
+    /// Maximum jobs per update.
+    size_t maxJobsPerUpdate;
+    /// Maximum pooled render targets.
+    size_t maxTargets;
+    /// Jobs rendered and not yet written or failed.
+    std::atomic<size_t> numInFlight;
+    /// Images written.
+    std::atomic<size_t> numCompleted;
+    /// Jobs failed.
+    std::atomic<size_t> numFailed;
+};
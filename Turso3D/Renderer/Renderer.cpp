@@ -3,6 +3,7 @@
 #include "../Graphics/FrameBuffer.h"
 #include "../Graphics/Graphics.h"
 #include "../Graphics/IndexBuffer.h"
+#include "../Graphics/IndirectBuffer.h"
 #include "../Graphics/RenderBuffer.h"
 #include "../Graphics/Shader.h"
 #include "../Graphics/ShaderProgram.h"
@@ -10,39 +11,413 @@
 #include "../Graphics/UniformBuffer.h"
 #include "../Graphics/VertexBuffer.h"
 #include "../IO/Log.h"
+#include "../IO/Stream.h"
 #include "../Math/Random.h"
 #include "../Resource/ResourceCache.h"
 #include "../Scene/Scene.h"
+#include "../Time/Profiler.h"
 #include "AnimatedModel.h"
 #include "Animation.h"
+#include "AnimationState.h"
 #include "Batch.h"
 #include "Camera.h"
+#include "Crowd.h"
+#include "Decal.h"
 #include "DebugRenderer.h"
+#include "Hlod.h"
 #include "Light.h"
 #include "Material.h"
 #include "Model.h"
 #include "Octree.h"
+#include "ParticleEmitter.h"
 #include "Renderer.h"
+#include "SecondaryView.h"
 #include "StaticModel.h"
+#include "Terrain.h"
+#include "VirtualTexture.h"
 
 #include <algorithm>
 #include <cstring>
+#include <map>
 #include <tracy/Tracy.hpp>
 
 static const size_t DRAWABLES_PER_BATCH_TASK = 128;
+static const size_t MIN_COMMAND_SEGMENT_SIZE = 1024;
+static const size_t LIGHT_DATA_TEXELS = sizeof(LightData) / sizeof(Vector4);
+static const size_t DECAL_DATA_TEXELS = sizeof(DecalData) / sizeof(Vector4);
+static const unsigned FRAME_CAPTURE_VERSION = 3;
+static const size_t DEBUG_OCTANTS_PER_TASK = 16;
+static const unsigned short DEBUG_CACHE_FLAG_MASK = DF_GEOMETRY | DF_STATIC | DF_GEOMETRY_TYPE_BITS;
+static const unsigned short DEBUG_CACHE_FLAGS = DF_GEOMETRY | DF_STATIC | DF_STATIC_GEOMETRY;
+// Depth warp exponent of moment shadow maps. Must match MOMENT_EXPONENT in MomentShadow.glsl
+static const float MOMENT_SHADOW_EXPONENT = 40.0f;
+
+static const UniformSlot U_FOOTPRINT = ShaderProgram::RegisterUniform("footprint");
+static const UniformSlot U_VIEWMATRIX = ShaderProgram::RegisterUniform("viewMatrix");
+static const UniformSlot U_PROJECTIONINVERSE = ShaderProgram::RegisterUniform("projectionInverse");
+static const UniformSlot U_CLUSTERSLICEPARAMETERS = ShaderProgram::RegisterUniform("clusterSliceParameters");
+static const UniformSlot U_CLUSTERPARAMETERS = ShaderProgram::RegisterUniform("clusterParameters");
+static const UniformSlot U_FARCLUSTERPARAMETERS = ShaderProgram::RegisterUniform("farClusterParameters");
+static const UniformSlot U_INVVIEWPROJMATRIX = ShaderProgram::RegisterUniform("invViewProjMatrix");
+static const UniformSlot U_BLURPARAMETERS = ShaderProgram::RegisterUniform("blurParameters");
+static const UniformSlot U_BLURRECT = ShaderProgram::RegisterUniform("blurRect");
+static const UniformSlot U_VISIBILITYPARAMETERS = ShaderProgram::RegisterUniform("visibilityParameters");
 
 inline bool CompareLights(LightDrawable* lhs, LightDrawable* rhs)
 {
     return lhs->Distance() < rhs->Distance();
 }
 
+inline bool CompareDecals(DecalDrawable* lhs, DecalDrawable* rhs)
+{
+    return lhs->Distance() < rhs->Distance();
+}
+
+inline bool CompareDecalIds(DecalDrawable* lhs, DecalDrawable* rhs)
+{
+    return lhs->Owner()->Id() < rhs->Owner()->Id();
+}
+
+inline bool CompareShadowBudgetEntries(const ShadowBudgetEntry& lhs, const ShadowBudgetEntry& rhs)
+{
+    return lhs.priority > rhs.priority;
+}
+
+inline size_t ShadowMapArea(LightDrawable* light, int faceSize)
+{
+    IntVector2 size = light->TotalShadowMapSize(faceSize);
+    return (size_t)size.x * (size_t)size.y;
+}
+
+inline bool HasShadowRect(LightDrawable* light, int faceSize)
+{
+    return faceSize && light->ShadowRect() != IntRect::ZERO && light->ShadowRect().Size() == light->TotalShadowMapSize(faceSize);
+}
+
+inline bool IsInstanced(unsigned char geometryBits)
+{
+    return geometryBits == GEOM_INSTANCED || geometryBits == GEOM_SKINNED_INSTANCED || geometryBits == GEOM_STATIC_INSTANCED;
+}
+
+/// Add the shadow pass batches of a shadowcaster to a queue. Optionally store the drawable's static transform table index in the batches.
+static void AddShadowBatches(Drawable* drawable, BatchQueue& dest, bool staticIndices)
+{
+    GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
+    const SourceBatches& batches = geomDrawable->batches;
+    size_t numGeometries = batches.NumGeometries();
+    bool lodFade = drawable->TestFlag(DF_LOD_FADE);
+
+    Batch newBatch;
+
+    for (size_t j = 0; j < numGeometries; ++j)
+    {
+        Material* material = batches.GetMaterial(j);
+        Pass* pass = material->GetPass(PASS_SHADOW);
+        if (!pass)
+            continue;
+        newBatch.SetPass(pass);
+
+        Geometry* fadeGeometry = lodFade ? geomDrawable->LodFadeGeometry(j, newBatch.lodFade) : nullptr;
+
+        newBatch.geometry = batches.GetGeometry(j);
+        newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
+        newBatch.geomIndex = (unsigned char)j;
+        newBatch.staticIndex = staticIndices ? drawable->StaticIndex() : M_MAX_UNSIGNED;
+
+        if (!newBatch.programBits)
+            newBatch.worldTransform = &drawable->WorldTransform();
+        else
+            newBatch.drawable = geomDrawable;
+
+        if (fadeGeometry)
+            newBatch.programBits |= SP_LODFADE;
+
+        dest.batches.push_back(newBatch);
+
+        // The level being faded out is drawn with the complementary mask
+        if (fadeGeometry)
+        {
+            newBatch.geometry = fadeGeometry;
+            newBatch.lodFade -= 1.0f;
+            dest.batches.push_back(newBatch);
+        }
+    }
+}
+
+/// Upload texels to a 2D texture with fixed width row by row starting from the given row, the last row possibly partial. Grow the texture height if necessary.
+static void SetTextureRows(Texture* texture, int width, ImageFormat format, const void* data, size_t numTexels, int firstRow = 0)
+{
+    int fullRows = (int)(numTexels / width);
+    int lastRowTexels = (int)(numTexels % width);
+    int numRows = firstRow + fullRows + (lastRowTexels ? 1 : 0);
+
+    if (texture->Height() < numRows)
+    {
+        texture->Define(TEX_2D, IntVector2(width, Max(numRows, texture->Height() * 2)), format);
+        texture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    }
+
+    if (fullRows)
+        texture->SetData(0, IntRect(0, firstRow, width, firstRow + fullRows), ImageLevel(IntVector2(width, fullRows), format, data));
+    if (lastRowTexels)
+    {
+        const unsigned char* lastRow = reinterpret_cast<const unsigned char*>(data) + fullRows * width * Image::pixelByteSizes[format];
+        texture->SetData(0, IntRect(0, firstRow + fullRows, lastRowTexels, numRows), ImageLevel(IntVector2(lastRowTexels, 1), format, lastRow));
+    }
+}
+
+/// Model geometry referenced by a frame capture.
+struct CaptureGeometry
+{
+    /// Model index.
+    unsigned model;
+    /// Geometry index within the model.
+    unsigned index;
+    /// LOD level.
+    unsigned lodLevel;
+};
+
+/// Resources gathered for saving a frame capture.
+struct CaptureTables
+{
+    /// Named models in the resource cache.
+    std::vector<Model*> loadedModels;
+    /// Geometries of the loaded models, referring to the loaded model index.
+    std::map<Geometry*, CaptureGeometry> modelGeometries;
+    /// Capture model indices by loaded model index.
+    std::map<unsigned, unsigned> modelIndices;
+    /// Capture material indices.
+    std::map<Material*, unsigned> materialIndices;
+    /// Capture geometry indices.
+    std::map<Geometry*, unsigned> geometryIndices;
+    /// Names of the captured models.
+    std::vector<std::string> modelNames;
+    /// Names of the captured materials. Empty for the default material.
+    std::vector<std::string> materialNames;
+    /// Captured geometries.
+    std::vector<CaptureGeometry> geometries;
+};
+
+/// Return whether a batch has been gathered for a frame capture.
+static bool IsCaptured(const Batch& batch, const CaptureTables& tables)
+{
+    unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
+
+    // Drawables that render themselves can not be replayed without the scene
+    if (geometryBits && !IsInstanced(geometryBits))
+        return false;
+
+    return tables.materialIndices.find(batch.GetPass()->Parent()) != tables.materialIndices.end() && tables.geometryIndices.find(batch.geometry) != tables.geometryIndices.end();
+}
+
+/// Add the resources of a batch to the frame capture tables if they can be referenced by name. Return whether the batch can be captured.
+static bool GatherCaptureBatch(const Batch& batch, CaptureTables& tables)
+{
+    unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
+    if (geometryBits && !IsInstanced(geometryBits))
+        return false;
+
+    Material* material = batch.GetPass()->Parent();
+    bool defaultMaterial = material == Material::DefaultMaterial();
+    if (!defaultMaterial && material->Name().empty())
+        return false;
+
+    auto gIt = tables.modelGeometries.find(batch.geometry);
+    if (gIt == tables.modelGeometries.end())
+        return false;
+
+    if (tables.materialIndices.find(material) == tables.materialIndices.end())
+    {
+        tables.materialIndices[material] = (unsigned)tables.materialNames.size();
+        tables.materialNames.push_back(defaultMaterial ? std::string() : material->Name());
+    }
+
+    if (tables.geometryIndices.find(batch.geometry) == tables.geometryIndices.end())
+    {
+        CaptureGeometry geometry = gIt->second;
+        auto mIt = tables.modelIndices.find(geometry.model);
+        if (mIt == tables.modelIndices.end())
+        {
+            mIt = tables.modelIndices.insert(std::make_pair(geometry.model, (unsigned)tables.modelNames.size())).first;
+            tables.modelNames.push_back(tables.loadedModels[geometry.model]->Name());
+        }
+
+        geometry.model = mIt->second;
+        tables.geometryIndices[batch.geometry] = (unsigned)tables.geometries.size();
+        tables.geometries.push_back(geometry);
+    }
+
+    return true;
+}
+
+/// Gather the resources and non-instanced world transforms of a batch queue for a frame capture. Return the number of batches that can not be captured.
+static size_t GatherCaptureBatches(const BatchQueue& queue, bool multiDraw, CaptureTables& tables, std::vector<Matrix3x4>& worldTransforms)
+{
+    size_t numSkipped = 0;
+
+    for (size_t i = 0; i < queue.batches.size(); ++i)
+    {
+        const Batch& batch = queue.batches[i];
+        bool instanced = IsInstanced(batch.programBits & SP_GEOMETRYBITS);
+        size_t count = (instanced && !multiDraw) ? batch.instanceCount : 1;
+
+        if (GatherCaptureBatch(batch, tables))
+        {
+            if (!instanced)
+                worldTransforms.push_back(*batch.worldTransform);
+        }
+        else
+            numSkipped += count;
+
+        i += count - 1;
+    }
+
+    return numSkipped;
+}
+
+/// Write the gathered batches of a queue to a frame capture. Instanced batches are written without the batches they consumed. The world transform index counts the non-instanced batches written so far.
+static void WriteCaptureBatches(Stream& dest, const BatchQueue& queue, bool multiDraw, const CaptureTables& tables, size_t& worldTransformIdx)
+{
+    size_t numBatches = 0;
+    for (size_t i = 0; i < queue.batches.size(); ++i)
+    {
+        const Batch& batch = queue.batches[i];
+        if (IsCaptured(batch, tables))
+            ++numBatches;
+        if (IsInstanced(batch.programBits & SP_GEOMETRYBITS) && !multiDraw)
+            i += batch.instanceCount - 1;
+    }
+
+    dest.WriteVLE(numBatches);
+
+    for (size_t i = 0; i < queue.batches.size(); ++i)
+    {
+        const Batch& batch = queue.batches[i];
+        bool instanced = IsInstanced(batch.programBits & SP_GEOMETRYBITS);
+        if (instanced && !multiDraw)
+            i += batch.instanceCount - 1;
+        if (!IsCaptured(batch, tables))
+            continue;
+
+        Pass* pass = batch.GetPass();
+        Material* material = pass->Parent();
+        unsigned char passType = 0;
+        while (passType < MAX_PASS_TYPES - 1 && material->GetPass((PassType)passType) != pass)
+            ++passType;
+
+        dest.Write(batch.programBits);
+        dest.WriteVLE(tables.materialIndices.find(material)->second);
+        dest.Write(passType);
+        dest.WriteVLE(tables.geometryIndices.find(batch.geometry)->second);
+        dest.Write(batch.geomIndex);
+        dest.Write(batch.lodFade);
+        dest.Write(batch.instanceStart);
+        if (instanced)
+            dest.Write(batch.instanceCount);
+        else
+            dest.WriteVLE(worldTransformIdx++);
+    }
+}
+
+/// Read batches written by WriteCaptureBatches() into a queue, repeating instanced batches to stand for the batches they consumed. Return true on success.
+static bool ReadCaptureBatches(Stream& source, BatchQueue& queue, bool multiDraw, const std::vector<Material*>& materials, const std::vector<Geometry*>& geometries,
+    const std::vector<Matrix3x4>& worldTransforms)
+{
+    queue.Clear();
+
+    size_t numBatches = source.ReadVLE();
+    if (numBatches > source.Size() - source.Position())
+        return false;
+
+    for (size_t i = 0; i < numBatches; ++i)
+    {
+        Batch batch;
+        batch.programBits = source.Read<unsigned char>();
+        size_t materialIdx = source.ReadVLE();
+        unsigned char passType = source.Read<unsigned char>();
+        size_t geometryIdx = source.ReadVLE();
+        batch.geomIndex = source.Read<unsigned char>();
+        batch.lodFade = source.Read<float>();
+        batch.instanceStart = source.Read<unsigned>();
+        batch.staticIndex = M_MAX_UNSIGNED;
+
+        if (materialIdx >= materials.size() || geometryIdx >= geometries.size() || passType >= MAX_PASS_TYPES)
+            return false;
+
+        Pass* pass = materials[materialIdx]->GetPass((PassType)passType);
+        if (!pass)
+            return false;
+        batch.SetPass(pass);
+        batch.geometry = geometries[geometryIdx];
+
+        if (IsInstanced(batch.programBits & SP_GEOMETRYBITS))
+        {
+            batch.instanceCount = source.Read<unsigned>();
+            if (!batch.instanceCount)
+                return false;
+            queue.batches.insert(queue.batches.end(), multiDraw ? 1 : batch.instanceCount, batch);
+        }
+        else
+        {
+            size_t worldTransformIdx = source.ReadVLE();
+            if (worldTransformIdx >= worldTransforms.size())
+                return false;
+            batch.worldTransform = &worldTransforms[worldTransformIdx];
+            queue.batches.push_back(batch);
+        }
+    }
+
+    return true;
+}
+
+/// Write the parameters of a view to a frame capture.
+static void WriteCaptureView(Stream& dest, const RenderView& view)
+{
+    dest.Write(view.perViewData);
+    dest.Write((unsigned)view.perViewDataSize);
+    dest.Write(view.reverseCulling);
+    dest.Write(view.programBits);
+}
+
+/// Read the parameters of a view from a frame capture.
+static void ReadCaptureView(Stream& source, RenderView& view)
+{
+    view.perViewData = source.Read<PerViewUniforms>();
+    view.perViewDataSize = Min((size_t)source.Read<unsigned>(), sizeof(PerViewUniforms));
+    view.reverseCulling = source.Read<bool>();
+    view.programBits = source.Read<unsigned char>();
+}
+
+/// Write a vector of plain data to a frame capture.
+template <class T> static void WriteCaptureVector(Stream& dest, const std::vector<T>& values)
+{
+    dest.WriteVLE(values.size());
+    if (values.size())
+        dest.Write(&values[0], values.size() * sizeof(T));
+}
+
+/// Read a vector of plain data from a frame capture. Return true on success.
+template <class T> static bool ReadCaptureVector(Stream& source, std::vector<T>& values)
+{
+    size_t count = source.ReadVLE();
+    if (count > (source.Size() - source.Position()) / sizeof(T))
+        return false;
+
+    values.resize(count);
+    return !count || source.Read(&values[0], count * sizeof(T)) == count * sizeof(T);
+}
+
 void ThreadOctantResult::Clear()
 {
     drawableAcc = 0;
     taskOctantIdx = 0;
     batchTaskIdx = 0;
-    lights.clear();
-    octants.clear();
+    ResetFrameVector(lights);
+    ResetFrameVector(decals);
+    ResetFrameVector(octants);
+
+    for (auto it = collectBatchesTasks.begin(); it != collectBatchesTasks.end(); ++it)
+        ResetFrameVector((*it)->octants);
 }
 
 void ThreadBatchResult::Clear()
@@ -50,8 +425,8 @@ void ThreadBatchResult::Clear()
     minZ = M_MAX_FLOAT;
     maxZ = 0.0f;
     geometryBounds.Undefine();
-    opaqueBatches.clear();
-    alphaBatches.clear();
+    ResetFrameVector(opaqueBatches);
+    ResetFrameVector(alphaBatches);
 }
 
 ShadowMap::ShadowMap()
@@ -72,28 +447,126 @@ void ShadowMap::Clear()
     allocator.Reset(texture->Width(), texture->Height(), 0, 0, false);
     shadowViews.clear();
     instanceTransforms.clear();
+    staticInstances.clear();
+    skinMatrices.clear();
+    drawCommands.clear();
 
     for (auto it = shadowBatches.begin(); it != shadowBatches.end(); ++it)
         it->Clear();
     for (auto it = shadowCasters.begin(); it != shadowCasters.end(); ++it)
-        it->clear();
+        ResetFrameVector(*it);
+}
+
+PreparedView::PreparedView() :
+    numLights(0),
+    numDecals(0),
+    stereo(false),
+    orderIndependent(false),
+    gpuCulling(false),
+    visibilityBuffer(false)
+{
+    mainView.perViewDataSize = 0;
+    mainView.reverseCulling = false;
 }
 
 Renderer::Renderer() :
+    scene(nullptr),
+    cacheOctree(nullptr),
+    coherenceOctree(nullptr),
+    coherenceCamera(nullptr),
+    cacheStructureVersion(0),
+    coherenceDrawableVersion(0),
+    coherenceTransformVersion(0),
+    coherenceViewMask(0),
+    coherenceThreshold(1.0f),
+    minViewPixels(0.0f),
+    minShadowPixels(0.0f),
+    screenSizeScale(0.0f),
+    maxTimeSlicedPixels(0.0f),
+    textureStreamingBudget(DEFAULT_STREAMING_BUDGET),
+    textureStreamingCursor(0),
+    textureMemoryBudget(0),
+    textureEvictFrames(DEFAULT_TEXTURE_EVICT_FRAMES),
+    fastMath(0),
+    lastStreamingFrame(0),
+    virtualTexturingBudget(DEFAULT_STREAMING_BUDGET),
+    lastVirtualTextureFrame(0),
+    shadowUpdateInterval(1),
     graphics(Subsystem<Graphics>()),
     workQueue(Subsystem<WorkQueue>()),
     frameNumber(0),
     clusterFrustumsDirty(true),
+    stereo(false),
+    stereoRequested(false),
+    pipelined(false),
+    multiDraw(false),
+    meshletCulling(false),
+    bindlessTextures(false),
+    depthPrePass(false),
+    deferredShading(false),
+    visibilityBuffer(false),
+    orderIndependentTransparency(false),
+    orderIndependent(false),
+    computeClustering(false),
+    computeSkinning(false),
+    adaptiveClusterSlices(false),
+    lightHierarchy(false),
+    shadowBudget(false),
+    dirShadowCaching(false),
+    singlePassPointShadows(false),
+    momentShadows(false),
+    textureStreaming(false),
+    virtualTexturing(false),
+    staticInstanceTable(false),
+    staticBatchCaching(false),
+    gpuCulling(false),
+    gpuCullingActive(false),
+    hlodPixels(0.0f),
+    lateLatchAngle(0.0f),
+    staticBatchVersion(1),
+    staticBatchMaterialVersion(0),
+    staticBatchTransformVersion(0),
+    staticCasterCaching(false),
+    staticChangeSerial(1),
+    viewPending(false),
+    temporalCoherence(false),
+    octantCacheValid(false),
+    rebuildOctantCache(false),
+    viewReusable(false),
+    coherenceDrawShadows(false),
+    occlusionMode(OCCLUSION_NONE),
+    nextOcclusionBufferReady(false),
+    occlusionDirty(false),
+    minShadowMapSize(DEFAULT_MIN_SHADOW_MAP_SIZE),
+    lastView(nullptr),
     lastPerMaterialUniforms(0),
     depthBiasMul(1.0f),
-    slopeScaleBiasMul(1.0f)
+    slopeScaleBiasMul(1.0f),
+    mainInstanceBase(0),
+    mainStaticInstanceBase(0),
+    staticTransformOctree(nullptr),
+    materialTableVersion(M_MAX_UNSIGNED),
+    clusterSliceParameters(Vector4::ZERO),
+    clusterNearSplit(DEFAULT_CLUSTER_NEAR_SPLIT),
+    farClusterLightDistance(0.0f),
+    maxFarClusterLights(0),
+    clusterSize(DEFAULT_CLUSTER_X, DEFAULT_CLUSTER_Y, DEFAULT_CLUSTER_Z),
+    numClusters(0),
+    maxLights(DEFAULT_MAX_LIGHTS),
+    maxLightsPerCluster(DEFAULT_MAX_LIGHTS_CLUSTER),
+    clusterPacksPerRow(0),
+    maxDecals(DEFAULT_MAX_DECALS),
+    maxDecalsPerCluster(DEFAULT_MAX_DECALS_CLUSTER)
 {
     assert(graphics && graphics->IsInitialized());
     assert(workQueue);
 
-    RegisterSubsystem(this);
+    // Additional renderers for independent views, such as a minimap or offscreen render jobs, leave the first one as the subsystem. Each owns its view state, and shares the shader programs and render targets through Graphics
+    if (!Subsystem<Renderer>())
+        RegisterSubsystem(this);
     RegisterRendererLibrary();
 
+
     hasInstancing = graphics->HasInstancing();
     if (hasInstancing)
     {
@@ -101,33 +574,69 @@ Renderer::Renderer() :
         instanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 3));
         instanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 4));
         instanceVertexElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 5));
+        skinMatrixTexture = new Texture();
+        staticInstanceBuffer = new VertexBuffer();
+        staticInstanceElements.push_back(VertexElement(ELEM_VECTOR2, SEM_TEXCOORD, 3));
+        staticTransformTexture = new Texture();
+        materialTableTexture = new Texture();
+
+        if (graphics->HasMultiDrawIndirect())
+        {
+            indirectBuffer = new IndirectBuffer();
+            visibilityInstanceBuffer = new VertexBuffer();
+            visibilityInstanceElements.push_back(VertexElement(ELEM_VECTOR2, SEM_TEXCOORD, 3));
+            multiDraw = true;
+        }
     }
 
-    clusterTexture = new Texture();
-    clusterTexture->Define(TEX_3D, IntVector3(NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), FMT_RGBA32U, 1);
-    clusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    bindlessTextures = graphics->HasBindlessTextures();
 
-    clusterFrustums = new Frustum[NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
-    clusterBoundingBoxes = new BoundingBox[NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
-    clusterData = new unsigned char[MAX_LIGHTS_CLUSTER * NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
-    lightData = new LightData[MAX_LIGHTS + 1];
+    clusterTexture = new Texture();
+    lightIndexTexture = new Texture();
+    lightDataTexture = new Texture();
+    decalDataTexture = new Texture();
+    clusterBoundsTexture = new Texture();
+    DefineLightClusters();
+
+    secondaryClusterTexture = new Texture();
+    secondaryClusterTexture->Define(TEX_3D, IntVector3(1, 1, 1), FMT_RG32U, 1);
+    secondaryClusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    secondaryLightIndexTexture = new Texture();
+    secondaryLightDataTexture = new Texture();
 
     perViewDataBuffer = new UniformBuffer();
     perViewDataBuffer->Define(USAGE_DYNAMIC, sizeof(PerViewUniforms));
+    cubeShadowDataBuffer = new UniformBuffer();
+    cubeShadowDataBuffer->Define(USAGE_DYNAMIC, sizeof(CubeShadowUniforms));
+    stereoDataBuffer = new UniformBuffer();
+    stereoDataBuffer->Define(USAGE_DYNAMIC, sizeof(StereoUniforms));
+    stereoCamera = new Camera();
 
-    lightDataBuffer = new UniformBuffer();
-    lightDataBuffer->Define(USAGE_DYNAMIC, MAX_LIGHTS * sizeof(LightData));
+    // Intermediate results are allocated from the arenas, which are reset on each view preparation
+    frameArenas = new FrameArenas(workQueue->NumThreads());
 
-    octantResults.resize(NUM_OCTANTS + 1);
+    octantResults.resize(NUM_OCTANT_TASKS);
     batchResults.resize(workQueue->NumThreads());
+    threadStats.resize(workQueue->NumThreads());
+    stats.Clear();
 
-    for (size_t i = 0; i < NUM_OCTANTS + 1; ++i)
-        collectOctantsTasks[i] = new CollectOctantsTask(this, &Renderer::CollectOctantsWork);
+    for (auto it = octantResults.begin(); it != octantResults.end(); ++it)
+    {
+        it->octants = FrameVector<std::pair<Octant*, unsigned char> >(FrameAllocator<std::pair<Octant*, unsigned char> >(frameArenas));
+        it->lights = FrameVector<LightDrawable*>(FrameAllocator<LightDrawable*>(frameArenas));
+        it->decals = FrameVector<DecalDrawable*>(FrameAllocator<DecalDrawable*>(frameArenas));
+    }
+    for (auto it = batchResults.begin(); it != batchResults.end(); ++it)
+    {
+        it->opaqueBatches = FrameVector<Batch>(FrameAllocator<Batch>(frameArenas));
+        it->alphaBatches = FrameVector<Batch>(FrameAllocator<Batch>(frameArenas));
+    }
 
-    for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
+    // Main view octant and batch collection is the critical path to main batch sorting, so run it before shadow work
+    for (size_t i = 0; i < NUM_OCTANT_TASKS; ++i)
     {
-        cullLightsTasks[z] = new CullLightsTask(this, &Renderer::CullLightsToFrustumWork);
-        cullLightsTasks[z]->z = z;
+        collectOctantsTasks[i] = new CollectOctantsTask(this, &Renderer::CollectOctantsWork);
+        collectOctantsTasks[i]->priority = TASK_HIGH;
     }
 
     processLightsTask = new MemberFunctionTask<Renderer>(this, &Renderer::ProcessLightsWork);
@@ -136,575 +645,3292 @@ Renderer::Renderer() :
 
 Renderer::~Renderer()
 {
+    // Do not leave tasks referring to the renderer in flight
+    if (viewPending)
+        workQueue->Complete();
+
     RemoveSubsystem(this);
 }
 
-void Renderer::SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format)
+void Renderer::SetPipelined(bool enable)
 {
-    shadowMaps.resize(2);
+    if (enable == pipelined)
+        return;
 
-    for (size_t i = 0; i < shadowMaps.size(); ++i)
-    {
-        ShadowMap& shadowMap = shadowMaps[i];
+    // Worker tasks check the mode, so it can not change during preparation
+    FinishView();
+    pipelined = enable;
+}
 
-        shadowMap.texture->Define(TEX_2D, i == 0 ? IntVector2(dirLightSize * 2, dirLightSize) : IntVector2(lightAtlasSize, lightAtlasSize), format, 1);
-        shadowMap.texture->DefineSampler(COMPARE_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1);
-        shadowMap.fbo->Define(nullptr, shadowMap.texture);
-    }
+void Renderer::SetTemporalCoherence(bool enable, float threshold)
+{
+    // The octant cache is used by worker tasks, so finish any preparation first
+    FinishView();
 
-    staticObjectShadowBuffer = new RenderBuffer();
-    staticObjectShadowBuffer->Define(IntVector2(lightAtlasSize, lightAtlasSize), format, 1);
-    staticObjectShadowFbo = new FrameBuffer();
-    staticObjectShadowFbo->Define(nullptr, staticObjectShadowBuffer);
+    temporalCoherence = enable;
+    coherenceThreshold = Max(threshold, 0.0f);
+    octantCacheValid = false;
+    viewReusable = false;
+}
 
-    DefineFaceSelectionTextures();
+void Renderer::SetMultiDraw(bool enable)
+{
+    // The prepared batches have been combined according to the mode, so can not be rendered after a change
+    FinishView();
+    DiscardPreparedView();
 
-    shadowMapsDirty = true;
+    multiDraw = enable && indirectBuffer;
 }
 
-void Renderer::SetShadowDepthBiasMul(float depthBiasMul_, float slopeScaleBiasMul_)
+void Renderer::SetMeshletCulling(bool enable)
 {
-    depthBiasMul = depthBiasMul_;
-    slopeScaleBiasMul = slopeScaleBiasMul_;
-    
-    // Need to rerender all shadow maps with changed bias
-    shadowMapsDirty = true;
+    FinishView();
+
+    meshletCulling = enable;
+    viewReusable = false;
 }
 
-void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_)
+void Renderer::SetDepthPrePass(bool enable)
 {
-    ZoneScoped;
+    depthPrePass = enable;
+}
 
-    if (!scene_ || !camera_)
-        return;
+void Renderer::SetDeferredShading(bool enable)
+{
+    deferredShading = enable;
+}
 
-    scene = scene_;
-    camera = camera_;
-    octree = scene->FindChild<Octree>();
-    if (!octree)
-        return;
+void Renderer::SetVisibilityBuffer(bool enable)
+{
+    // Applies to the opaque multi-draw batches of static geometry with 32-bit indices whose material uses the plain Diffuse or NoTexture shader, and requires the static instance table, multi-draw and compute shaders. Takes precedence over deferred shading, and is not used in stereo
+    // The visibility batches are split from the opaque batches when the view is captured, so the prepared view can not be rendered after a change
+    FinishView();
+    DiscardPreparedView();
 
-    // Framenumber is never 0
-    ++frameNumber;
-    if (!frameNumber)
-        ++frameNumber;
+    visibilityBuffer = enable;
+}
 
-    drawShadows = shadowMaps.size() ? drawShadows_ : false;
-    frustum = camera->WorldFrustum();
-    viewMask = camera->ViewMask();
+void Renderer::SetOrderIndependentTransparency(bool enable)
+{
+    if (enable != orderIndependentTransparency)
+    {
+        orderIndependentTransparency = enable;
+        viewReusable = false;
+    }
+}
 
-    // Clear results from last frame
-    dirLight = nullptr;
-    lastCamera = nullptr;
-    rootLevelOctants.clear();
-    opaqueBatches.Clear();
-    alphaBatches.Clear();
-    lights.clear();
-    instanceTransforms.clear();
-    
-    minZ = M_MAX_FLOAT;
-    maxZ = 0.0f;
-    geometryBounds.Undefine();
+void Renderer::SetBindlessTextures(bool enable)
+{
+    bindlessTextures = enable && graphics->HasBindlessTextures();
 
-    for (size_t i = 0; i < octantResults.size(); ++i)
-        octantResults[i].Clear();
-    for (size_t i = 0; i < batchResults.size(); ++i)
-        batchResults[i].Clear();
-    for (auto it = shadowMaps.begin(); it != shadowMaps.end(); ++it)
-        it->Clear();
+    // Force material uniforms, including the samplers, to be assigned again to all programs
+    lastMaterial = nullptr;
+    ++lastPerMaterialUniforms;
+    if (!lastPerMaterialUniforms)
+        ++lastPerMaterialUniforms;
+}
 
-    // First process moved / animated objects' octree reinsertions
-    octree->Update(frameNumber);
+void Renderer::SetLightClusters(const IntVector3& size, size_t maxLights_, size_t maxLightsPerCluster_)
+{
+    // The prepared view refers to the cluster data, so it can not be rendered after a change
+    FinishView();
+    DiscardPreparedView();
+
+    clusterSize = IntVector3(Max(size.x, 1), Max(size.y, 1), Max(size.z, 1));
+    maxLights = Min(Max(maxLights_, (size_t)1), MAX_LIGHTS);
+    maxLightsPerCluster = Min(Max(maxLightsPerCluster_, (size_t)1), maxLights);
+    DefineLightClusters();
+}
 
-    // Enable threaded update during geometry / light gathering in case nodes' OnPrepareRender() causes further reinsertion queuing
-    octree->SetThreadedUpdate(workQueue->NumThreads() > 1);
+void Renderer::SetAdaptiveClusterSlices(bool enable, float nearSplit)
+{
+    // The slices are calculated during view preparation
+    FinishView();
 
-    // Find the starting points for octree traversal. Include the root if it contains nodes that didn't fit elsewhere
-    Octant* rootOctant = octree->Root();
-    if (rootOctant->drawables.size())
-        rootLevelOctants.push_back(rootOctant);
+    adaptiveClusterSlices = enable;
+    clusterNearSplit = Max(nearSplit, 0.0f);
+}
 
-    for (size_t i = 0; i < NUM_OCTANTS; ++i)
-    {
-        if (rootOctant->children[i])
-            rootLevelOctants.push_back(rootOctant->children[i]);
-    }
+void Renderer::SetFarClusterLightLimit(float distance, size_t maxLights_)
+{
+    // The clusters are built during view preparation, or by the compute shader at render time
+    FinishView();
 
-    // Keep track of both batch + octant task progress before main batches can be sorted (batch tasks will add to the counter when queued)
-    numPendingBatchTasks.store((int)rootLevelOctants.size());
-    numPendingShadowViews[0].store(0);
-    numPendingShadowViews[1].store(0);
+    farClusterLightDistance = Max(distance, 0.0f);
+    maxFarClusterLights = Min(maxLights_, MAX_FAR_CLUSTER_LIGHTS);
+}
 
-    // Find octants in view and their plane masks for node frustum culling. At the same time, find lights and process them
-    // When octant collection tasks complete, they queue tasks for collecting batches from those octants.
-    for (size_t i = 0; i < rootLevelOctants.size(); ++i)
-    {
-        collectOctantsTasks[i]->startOctant = rootLevelOctants[i];
-        collectOctantsTasks[i]->subtreeIdx = i;
-        processLightsTask->AddDependency(collectOctantsTasks[i]);
-    }
+void Renderer::SetLightHierarchy(bool enable)
+{
+    // The lights are selected and clustered during view preparation
+    FinishView();
 
-    // Ensure shadow view processing doesn't happen before lights have been found and processed
-    processShadowCastersTask->AddDependency(processLightsTask);
+    lightHierarchy = enable;
+}
 
-    workQueue->QueueTasks(rootLevelOctants.size(), reinterpret_cast<Task**>(&collectOctantsTasks[0]));
+void Renderer::SetComputeClustering(bool enable)
+{
+    // The prepared view may lack the CPU cluster data, so it can not be rendered after a change
+    FinishView();
+    DiscardPreparedView();
 
-    // Execute tasks until can sort the main batches. Perform that in the main thread to potentially run faster
-    while (numPendingBatchTasks.load() > 0)
-        workQueue->TryComplete();
+    computeClustering = enable && graphics->HasComputeShaders();
+    DefineLightClusters();
+}
 
-    SortMainBatches();
+void Renderer::SetDecalAtlas(Texture* texture)
+{
+    // The decals are collected during view preparation
+    FinishView();
 
-    // Finish remaining view preparation tasks (shadowcaster batches, light culling to frustum grid)
-    workQueue->Complete();
+    decalAtlas = texture;
+}
 
-    // No more threaded reinsertion will take place
-    octree->SetThreadedUpdate(false);
+void Renderer::SetDecalLimits(size_t maxDecals_, size_t maxDecalsPerCluster_)
+{
+    // The prepared view refers to the cluster data, so it can not be rendered after a change
+    FinishView();
+    DiscardPreparedView();
+
+    maxDecals = Min(Max(maxDecals_, (size_t)1), MAX_DECALS);
+    maxDecalsPerCluster = Min(Max(maxDecalsPerCluster_, (size_t)1), maxDecals);
+    DefineLightClusters();
 }
 
-void Renderer::RenderShadowMaps()
+void Renderer::SetComputeSkinning(bool enable)
 {
-    ZoneScoped;
+    // The models switch when their skinning data is next uploaded, so the view must be captured again
+    FinishView();
 
-    // Unbind shadow textures before rendering to
-    Texture::Unbind(TU_DIRLIGHTSHADOW);
-    Texture::Unbind(TU_SHADOWATLAS);
+    computeSkinning = enable && graphics->HasComputeShaders();
+    AnimatedModelDrawable::SetComputeSkinning(computeSkinning);
+    viewReusable = false;
+}
 
-    for (size_t i = 0; i < shadowMaps.size(); ++i)
+void Renderer::SetShadowBudget(bool enable, int minShadowMapSize_)
+{
+    FinishView();
+
+    shadowBudget = enable;
+    minShadowMapSize = NextPowerOfTwo(Max(minShadowMapSize_, 1));
+    viewReusable = false;
+}
+
+void Renderer::SetDirShadowCaching(bool enable)
+{
+    FinishView();
+
+    dirShadowCaching = enable;
+    // The cascades are fitted differently, so the cached shadow content is not valid
+    shadowMapsDirty = true;
+    viewReusable = false;
+}
+
+void Renderer::SetSinglePassPointShadows(bool enable)
+{
+    FinishView();
+
+    singlePassPointShadows = enable && graphics->HasViewportArray();
+    viewReusable = false;
+}
+
+void Renderer::SetMomentShadows(bool enable)
+{
+    FinishView();
+
+    if (enable == momentShadows)
+        return;
+
+    momentShadows = enable;
+    DefineMomentTextures();
+
+    // The moments of the cached shadow maps have not been rendered
+    shadowMapsDirty = true;
+    viewReusable = false;
+}
+
+void Renderer::SetStaticInstanceTable(bool enable)
+{
+    // The prepared batches have been instanced according to the mode, so can not be rendered after a change
+    FinishView();
+    DiscardPreparedView();
+
+    staticInstanceTable = enable && hasInstancing;
+    staticTransformOctree = nullptr;
+    materialTableVersion = M_MAX_UNSIGNED;
+    // The cached batches refer to the static transform table according to the mode
+    InvalidateStaticBatches();
+}
+
+void Renderer::SetGpuCulling(bool enable)
+{
+    // The prepared view may have skipped the GPU culled drawables, so it can not be rendered after a change
+    FinishView();
+    DiscardPreparedView();
+
+    gpuCulling = enable;
+    viewReusable = false;
+}
+
+void Renderer::SetStaticBatchCaching(bool enable)
+{
+    // The octants' caches are built during view preparation
+    FinishView();
+
+    staticBatchCaching = enable;
+}
+
+void Renderer::SetStaticCasterCaching(bool enable)
+{
+    // The shadowcasters are collected during view preparation
+    FinishView();
+
+    staticCasterCaching = enable;
+}
+
+void Renderer::SetHlodThreshold(float pixels)
+{
+    FinishView();
+
+    hlodPixels = Max(pixels, 0.0f);
+    viewReusable = false;
+}
+
+void Renderer::SetPortalCells(PortalCells* cells)
+{
+    FinishView();
+
+    portalCells = cells;
+    viewReusable = false;
+}
+
+void Renderer::SetLightProbes(LightProbeGrid* probes)
+{
+    FinishView();
+    DiscardPreparedView();
+
+    lightProbes = probes;
+    viewReusable = false;
+}
+
+void Renderer::SetLateLatching(float degrees)
+{
+    FinishView();
+
+    lateLatchAngle = Clamp(degrees, 0.0f, 45.0f);
+    viewReusable = false;
+}
+
+void Renderer::SetShadowTimeSlicing(int interval, float maxPixels)
+{
+    FinishView();
+
+    shadowUpdateInterval = Clamp(interval, 1, 0xffff);
+    maxTimeSlicedPixels = Max(maxPixels, 0.0f);
+    viewReusable = false;
+}
+
+void Renderer::SetScreenSizeCulling(float viewPixels, float shadowPixels)
+{
+    FinishView();
+
+    minViewPixels = Max(viewPixels, 0.0f);
+    minShadowPixels = Max(shadowPixels, 0.0f);
+    viewReusable = false;
+}
+
+void Renderer::SetTextureStreaming(bool enable, size_t bytesPerFrame)
+{
+    FinishView();
+
+    textureStreaming = enable;
+    textureStreamingBudget = bytesPerFrame;
+    viewReusable = false;
+}
+
+void Renderer::SetVirtualTexturing(bool enable, size_t bytesPerFrame)
+{
+    if (enable && !graphics->HasComputeShaders())
+    {
+        LOGERROR("Virtual texturing requires compute shader support");
+        enable = false;
+    }
+
+    FinishView();
+
+    virtualTexturing = enable;
+    virtualTexturingBudget = bytesPerFrame;
+    if (!virtualTexturing)
+    {
+        virtualFeedbackTexture.Reset();
+        virtualFeedbackReadback.Reset();
+    }
+    viewReusable = false;
+}
+
+void Renderer::SetTextureMemoryBudget(size_t bytes, unsigned evictFrames)
+{
+    textureMemoryBudget = bytes;
+    textureEvictFrames = evictFrames;
+}
+
+void Renderer::SetFastMath(unsigned subsystems)
+{
+    // Animation is applied by worker threads during view preparation
+    FinishView();
+
+    fastMath = subsystems;
+    AnimationState::SetFastMath((fastMath & FAST_MATH_ANIMATION) != 0);
+    viewReusable = false;
+}
+
+void Renderer::SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format, int dirLightCascades)
+{
+    shadowMaps.resize(2);
+    dirLightCascades = Clamp(dirLightCascades, 1, MAX_SHADOW_CASCADES);
+    IntVector2 dirLightMapSize(dirLightSize * Min(dirLightCascades, 2), dirLightSize * ((dirLightCascades + 1) / 2));
+
+    for (size_t i = 0; i < shadowMaps.size(); ++i)
+    {
+        ShadowMap& shadowMap = shadowMaps[i];
+
+        shadowMap.texture->Define(TEX_2D, i == 0 ? dirLightMapSize : IntVector2(lightAtlasSize, lightAtlasSize), format, 1);
+        shadowMap.texture->DefineSampler(COMPARE_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1);
+
+        shadowMap.staticTexture = new Texture();
+        shadowMap.staticTexture->Define(TEX_2D, shadowMap.texture->Size2D(), format, 1);
+    }
+
+    DefineMomentTextures();
+    DefineFaceSelectionTextures();
+
+    shadowMapsDirty = true;
+    viewReusable = false;
+}
+
+void Renderer::SetShadowDepthBiasMul(float depthBiasMul_, float slopeScaleBiasMul_)
+{
+    depthBiasMul = depthBiasMul_;
+    slopeScaleBiasMul = slopeScaleBiasMul_;
+    
+    // Need to rerender all shadow maps with changed bias
+    shadowMapsDirty = true;
+    viewReusable = false;
+}
+
+void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_)
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    if (!scene_ || !camera_)
+        return;
+
+    // Previous preparation must be captured before its results are reused
+    FinishView();
+    UpdateStats();
+
+    stereo = stereoRequested;
+    stereoRequested = false;
+    orderIndependent = orderIndependentTransparency;
+
+    if (textureStreaming)
+        UpdateTextureStreaming();
+    if (virtualTexturing)
+        UpdateVirtualTextures();
+
+    // Take the latest occlusion data into use. Discard it if the scene changed
+    if (occlusionDirty || scene_ != scene)
+    {
+        occlusionBuffer.Reset();
+        nextOcclusionBufferReady = false;
+        occlusionDirty = false;
+    }
+    else if (nextOcclusionBufferReady)
+    {
+        std::swap(occlusionBuffer, nextOcclusionBuffer);
+        nextOcclusionBufferReady = false;
+    }
+
+    scene = scene_;
+    camera = camera_;
+    // Compute the dirty world transforms in advance, so that the octree update and culling only read them
+    scene->UpdateTransforms();
+    octree = scene->FindChild<Octree>();
+    if (!octree)
+    {
+        requestedSecondaryViews.clear();
+        return;
+    }
+
+    // If nothing has changed, keep the previously prepared view. The framenumber is not advanced, as the drawables were not visited
+    // The secondary views may have moved, so prepare them on their own
+    if (temporalCoherence && CheckTemporalCoherence(drawShadows_))
+    {
+        if (requestedSecondaryViews.size())
+        {
+            QueueSecondaryViews();
+            workQueue->Complete();
+            CaptureSecondaryViews();
+        }
+        return;
+    }
+
+    if (temporalCoherence)
+    {
+        coherenceOctree = octree;
+        coherenceCamera = camera;
+        coherenceView = camera->ViewMatrix();
+        coherenceProjection = camera->ProjectionMatrix();
+        coherenceViewMask = camera->ViewMask();
+        coherenceDrawShadows = drawShadows_;
+    }
+
+    // Framenumber is never 0
+    ++frameNumber;
+    if (!frameNumber)
+        ++frameNumber;
+
+    drawShadows = shadowMaps.size() ? drawShadows_ : false;
+    frustum = lateLatchAngle > 0.0f ? camera->WorldExpandedFrustum(lateLatchAngle) : camera->WorldFrustum();
+    viewMask = camera->ViewMask();
+    meshletCullData.frustum = frustum;
+    meshletCullData.viewPosition = camera->WorldPosition();
+    meshletCullData.backfaceCulling = !camera->UseReverseCulling();
+    meshletCullData.fastMath = (fastMath & FAST_MATH_DISTANCES) != 0;
+    meshletCullData.occlusionBuffer = &occlusionBuffer;
+    screenSizeScale = 0.5f * graphics->RenderHeight() * camera->ProjectionMatrix(false).m11 * camera->LodBias();
+
+    // The eyes of a stereo view see through the portals differently, so only the main camera's view is narrowed
+    if (portalCells && !stereo)
+        portalCuller.Update(portalCells, camera->WorldPosition(), frustum, camera->ViewMatrix());
+    else
+        portalCuller.Reset();
+
+    // Clear results from last frame
+    dirLight = nullptr;
+    rootLevelOctants.clear();
+    opaqueBatches.Clear();
+    alphaBatches.Clear();
+    lights.clear();
+    decals.clear();
+    instanceTransforms.clear();
+    staticInstances.clear();
+    skinMatrices.clear();
+    drawCommands.clear();
+    
+    minZ = M_MAX_FLOAT;
+    maxZ = 0.0f;
+    geometryBounds.Undefine();
+
+    for (auto it = shadowMaps.begin(); it != shadowMaps.end(); ++it)
+        it->Clear();
+
+    ResetFrameArenas();
+
+    // First process moved / animated objects' octree reinsertions
+    octree->Update(frameNumber);
+
+    // Cached static batches refer to the passes, geometries and world transform matrices
+    if (Material::BatchVersion() != staticBatchMaterialVersion || SpatialNode::WorldTransformVersion() != staticBatchTransformVersion)
+    {
+        staticBatchMaterialVersion = Material::BatchVersion();
+        staticBatchTransformVersion = SpatialNode::WorldTransformVersion();
+        InvalidateStaticBatches();
+    }
+
+    // Static shadow maps in the changed regions need to be rendered again
+    staticChanges.clear();
+    octree->CollectStaticChanges(staticChanges);
+    if (!++staticChangeSerial)
+        staticChangeSerial = 1;
+
+    // Software occlusion needs the final octree state, and must be ready before any octants are tested
+    if (occlusionMode == OCCLUSION_SOFTWARE)
+        RasterizeOcclusion();
+
+    // Choose the HLOD proxies before batch collection, which skips their source drawables
+    if (hlodPixels > 0.0f && octree->HlodProxies().size())
+        CollectHlodProxies();
+
+    // The BVH subtrees taken over by GPU culling are skipped by the traversal, also when building the octant cache
+    UpdateGpuCulling();
+
+    // Enable threaded update during geometry / light gathering in case nodes' OnPrepareRender() causes further reinsertion queuing
+    octree->SetThreadedUpdate(workQueue->NumThreads() > 1);
+
+    // Find the starting points for octree traversal. Include the root if it contains nodes that didn't fit elsewhere
+    Octant* rootOctant = octree->Root();
+    if (rootOctant->drawables.size())
+        rootLevelOctants.push_back(rootOctant);
+
+    for (size_t i = 0; i < NUM_OCTANTS; ++i)
+    {
+        if (rootOctant->children[i])
+            rootLevelOctants.push_back(rootOctant->children[i]);
+    }
+
+    // The static BVH is traversed as its own branch, marked with a null octant
+    if (octree->BvhNodes().size())
+        rootLevelOctants.push_back(nullptr);
+
+    // Rebuild the octant cache if the octants have changed, or if the frustum has moved too far from the one the cache was built with
+    rebuildOctantCache = false;
+    if (temporalCoherence)
+    {
+        bool cacheValid = octantCacheValid && octree == cacheOctree && octree->StructureVersion() == cacheStructureVersion && rootLevelOctants == cacheRootLevelOctants;
+        float thresholdSquared = coherenceThreshold * coherenceThreshold;
+        for (size_t i = 0; i < NUM_FRUSTUM_VERTICES && cacheValid; ++i)
+        {
+            if ((frustum.vertices[i] - cacheReferenceFrustum.vertices[i]).LengthSquared() > thresholdSquared)
+                cacheValid = false;
+        }
+
+        if (!cacheValid)
+        {
+            // When every frustum corner stays within the threshold, the frustum stays within the expanded planes, so no visible octant is missed
+            cacheReferenceFrustum = frustum;
+            cacheFrustum = frustum;
+            for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+                cacheFrustum.planes[i].d += coherenceThreshold;
+
+            cacheRootLevelOctants = rootLevelOctants;
+            cacheOctree = octree;
+            cacheStructureVersion = octree->StructureVersion();
+            octantCacheValid = true;
+            rebuildOctantCache = true;
+        }
+    }
+
+    // Keep track of both batch + octant task progress before main batches can be sorted (batch tasks will add to the counter when queued)
+    numPendingBatchTasks.store((int)rootLevelOctants.size());
+    numPendingShadowViews[0].store(0);
+    numPendingShadowViews[1].store(0);
+
+    // Find octants in view and their plane masks for node frustum culling. At the same time, find lights and process them
+    // When octant collection tasks complete, they queue tasks for collecting batches from those octants.
+    for (size_t i = 0; i < rootLevelOctants.size(); ++i)
+    {
+        collectOctantsTasks[i]->startOctant = rootLevelOctants[i];
+        collectOctantsTasks[i]->subtreeIdx = i;
+        processLightsTask->AddDependency(collectOctantsTasks[i]);
+    }
+
+    // Ensure shadow view processing doesn't happen before lights have been found and processed
+    processShadowCastersTask->AddDependency(processLightsTask);
+
+    workQueue->QueueTasks(rootLevelOctants.size(), reinterpret_cast<Task**>(&collectOctantsTasks[0]));
+    QueueSecondaryViews();
+    viewPending = true;
+
+    // In pipelined mode, leave the main thread free to render the previous view while worker threads continue
+    if (!pipelined)
+        FinishView();
+}
+
+void Renderer::PrepareStereoView(Scene* scene_, Camera* leftEye, Camera* rightEye, bool drawShadows_)
+{
+    if (!leftEye || !rightEye)
+        return;
+
+    if (!graphics->HasViewportArray())
+    {
+        PrepareView(scene_, leftEye, drawShadows_);
+        return;
+    }
+
+    // Move the enclosing camera back from the eye midpoint until its side planes pass through the outer side planes of the eyes
+    Vector3 leftPos = leftEye->WorldPosition();
+    Vector3 rightPos = rightEye->WorldPosition();
+    float halfSeparation = (rightPos - leftPos).Length() * 0.5f;
+    float tanHalfFov = tanf(leftEye->Fov() * 0.5f * M_DEGTORAD) * leftEye->AspectRatio();
+    float pullBack = tanHalfFov > M_EPSILON ? halfSeparation / tanHalfFov : 0.0f;
+
+    stereoCamera->SetTransform((leftPos + rightPos) * 0.5f - leftEye->WorldDirection() * pullBack, leftEye->WorldRotation());
+    stereoCamera->SetFov(leftEye->Fov());
+    stereoCamera->SetAspectRatio(leftEye->AspectRatio());
+    stereoCamera->SetNearClip(leftEye->NearClip() + pullBack);
+    stereoCamera->SetFarClip(leftEye->FarClip() + pullBack);
+    stereoCamera->SetLodBias(leftEye->LodBias());
+    stereoCamera->SetViewMask(leftEye->ViewMask());
+
+    // The eye matrices are captured with the view, which in pipelined mode happens on the next preparation
+    FinishView();
+    stereoData.eyeViewProjMatrices[0] = leftEye->ProjectionMatrix() * leftEye->ViewMatrix();
+    stereoData.eyeViewProjMatrices[1] = rightEye->ProjectionMatrix() * rightEye->ViewMatrix();
+    stereoRequested = true;
+
+    PrepareView(scene_, stereoCamera, drawShadows_);
+}
+
+void Renderer::PrepareSecondaryView(SecondaryView* view, Camera* camera_)
+{
+    if (!view || !camera_)
+        return;
+
+    // Skip the frames between updates
+    if (view->framesUntilUpdate > 0)
+    {
+        --view->framesUntilUpdate;
+        return;
+    }
+
+    view->framesUntilUpdate = view->updateInterval - 1;
+    view->camera = camera_;
+    requestedSecondaryViews.push_back(SharedPtr<SecondaryView>(view));
+}
+
+void Renderer::FinishView()
+{
+    if (!viewPending)
+        return;
+
+    ZoneScoped;
+
+    // Execute tasks until can sort the main batches. Perform that in the main thread to potentially run faster
+    // In pipelined mode the last batch collection task sorts instead, as the main thread was busy rendering
+    if (!pipelined)
+    {
+        while (numPendingBatchTasks.load() > 0)
+            workQueue->TryComplete();
+
+        SortMainBatches();
+    }
+
+    // Finish remaining view preparation tasks (shadowcaster batches, light culling to frustum grid)
+    workQueue->Complete();
+
+    // No more threaded reinsertion will take place
+    octree->SetThreadedUpdate(false);
+
+    CaptureView();
+    viewPending = false;
+
+    // Store the octree state, including changes made during the preparation, to detect when the view can be reused
+    if (temporalCoherence)
+    {
+        coherenceDrawableVersion = octree->DrawableVersion();
+        coherenceTransformVersion = SpatialNode::WorldTransformVersion();
+        viewReusable = true;
+    }
+}
+
+void Renderer::DiscardPreparedView()
+{
+    preparedView.opaqueBatches.Clear();
+    preparedView.alphaBatches.Clear();
+    preparedView.visibilityBatches.Clear();
+    preparedView.visibilityBatchBins.clear();
+    preparedView.visibilityBins.clear();
+    preparedView.visibilityInstances.clear();
+    preparedView.visibilityBuffer = false;
+
+    for (auto it = preparedSecondaryViews.begin(); it != preparedSecondaryViews.end(); ++it)
+    {
+        SecondaryView* view = *it;
+        view->preparedOpaqueBatches.Clear();
+        view->preparedAlphaBatches.Clear();
+        view->renderPending = false;
+    }
+    preparedSecondaryViews.clear();
+    preparedView.numLights = 0;
+    preparedView.numDecals = 0;
+    preparedView.gpuCulling = false;
+    preparedView.clusterRanges.assign(numClusters * 2, 0);
+    preparedView.lightIndices.clear();
+
+    for (size_t i = 0; i < 2; ++i)
+        preparedView.shadowMaps[i].views.clear();
+
+    viewReusable = false;
+
+    // The depth of earlier frames no longer corresponds to the scene. A pipelined preparation may still be using the occlusion buffer, so reset it later
+    occlusionDirty = true;
+    nextOcclusionBufferReady = false;
+    occlusionReadback.Reset();
+}
+
+void Renderer::SetOcclusionMode(OcclusionMode mode)
+{
+    if (mode == occlusionMode)
+        return;
+
+    occlusionMode = mode;
+    viewReusable = false;
+
+    // Data from the previous mode is not used
+    occlusionDirty = true;
+    nextOcclusionBufferReady = false;
+    occlusionReadback.Reset();
+}
+
+void Renderer::RenderOcclusionDepth(Texture* depthTexture)
+{
+    ZoneScoped;
+
+    // A stereo view's depth buffer holds both eyes, which do not match the culling camera
+    if (occlusionMode != OCCLUSION_GPU || !depthTexture || !depthTexture->Width() || !depthTexture->Height() || preparedView.stereo)
+        return;
+
+    IntVector2 size(OCCLUSION_BUFFER_WIDTH, Max(OCCLUSION_BUFFER_WIDTH * depthTexture->Height() / depthTexture->Width(), 1));
+
+    // Take the depth downsampled on an earlier call into use once it has arrived. While it is still pending, the GPU is behind, so do not queue more
+    if (occlusionReadback)
+    {
+        if (occlusionReadback->IsPending())
+            return;
+
+        if (occlusionReadback->IsReady())
+        {
+            const IntRect& rect = occlusionReadback->Rect();
+            nextOcclusionBuffer.SetData(reinterpret_cast<const float*>(&occlusionReadback->Data()[0]), rect.Width(), rect.Height(), occlusionViewProj);
+            nextOcclusionBufferReady = true;
+        }
+        occlusionReadback.Reset();
+    }
+
+    if (!occlusionTexture)
+    {
+        occlusionTexture = new Texture();
+        occlusionFbo = new FrameBuffer();
+    }
+
+    if (occlusionTexture->Width() != size.x || occlusionTexture->Height() != size.y)
+    {
+        occlusionTexture->Define(TEX_2D, size, FMT_R32F);
+        occlusionTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+        occlusionFbo->Define(occlusionTexture, nullptr);
+    }
+
+    ShaderProgram* program = graphics->SetProgram("Shaders/OcclusionDownsample.glsl");
+    graphics->SetFrameBuffer(occlusionFbo);
+    graphics->SetViewport(IntRect(0, 0, size.x, size.y));
+    graphics->SetUniform(program, U_FOOTPRINT, Vector2((float)depthTexture->Width() / size.x, (float)depthTexture->Height() / size.y));
+    graphics->SetTexture(0, depthTexture);
+    graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+    graphics->DrawQuad();
+    graphics->SetTexture(0, nullptr);
+
+    occlusionViewProj = preparedView.mainView.perViewData.viewProjMatrix;
+    occlusionReadback = graphics->RequestReadback(occlusionTexture, 0);
+}
+
+void Renderer::RasterizeOcclusion()
+{
+    ZoneScoped;
+
+    occluders.clear();
+    octree->FindDrawablesMasked(occluders, frustum, DF_GEOMETRY | DF_OCCLUDER, viewMask);
+
+    if (occluders.empty())
+    {
+        occlusionBuffer.Reset();
+        return;
+    }
+
+    int height = Max((int)(OCCLUSION_BUFFER_WIDTH / camera->AspectRatio()), 1);
+    occlusionRasterizer.SetSize(OCCLUSION_BUFFER_WIDTH, height, workQueue->NumThreads());
+    occlusionRasterizer.BeginView(camera->ProjectionMatrix() * camera->ViewMatrix());
+
+    workQueue->ParallelFor(0, occluders.size(), 1, [this](size_t start, size_t end, unsigned threadIndex)
+    {
+        for (size_t i = start; i < end; ++i)
+            occluders[i]->OnRasterizeOcclusion(&occlusionRasterizer, threadIndex);
+    });
+
+    // Each thread rasterizes a band of rows, so that no synchronization is needed on the depth data
+    workQueue->ParallelFor(0, (size_t)height, 8, [this](size_t start, size_t end, unsigned)
+    {
+        occlusionRasterizer.Rasterize((int)start, (int)end);
+    });
+
+    Profiler* profiler = Subsystem<Profiler>();
+    if (profiler)
+        profiler->SetCounter("OccluderTriangles", (long long)occlusionRasterizer.NumTriangles());
+
+    occlusionBuffer.SetData(occlusionRasterizer.DepthData(), occlusionRasterizer.Width(), occlusionRasterizer.Height(), occlusionRasterizer.ViewProj());
+}
+
+void Renderer::RenderShadowMaps()
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    // Unbind shadow textures before rendering to
+    Texture::Unbind(TU_DIRLIGHTSHADOW);
+    Texture::Unbind(TU_SHADOWATLAS);
+
+    // Moment shadow maps are cleared to the moments of the far plane
+    float farMoment = expf(MOMENT_SHADOW_EXPONENT);
+    Color momentClearColor(farMoment, farMoment * farMoment, 0.0f, 1.0f);
+
+    for (size_t i = 0; i < shadowMaps.size(); ++i)
+    {
+        ShadowMap& shadowMap = shadowMaps[i];
+        PreparedShadowMap& prepared = preparedView.shadowMaps[i];
+        if (prepared.views.empty())
+            continue;
+
+        size_t instanceBase = UpdateInstanceTransforms(prepared.instanceTransforms);
+        size_t staticInstanceBase = UpdateStaticInstances(prepared.staticInstances);
+        UpdateSkinMatrices(prepared.skinMatrices);
+        UpdateDrawCommands(prepared.drawCommands);
+
+        shadowMap.fbo->Bind();
+
+        // First render static objects for those shadowmaps that need to store static objects. Do all of them to avoid FBO changes.
+        // Clear first, as a point light rendered in one pass also draws into the viewports of its other faces
+        for (size_t j = 0; j < prepared.views.size(); ++j)
+        {
+            const ShadowRenderView& view = prepared.views[j];
+
+            if (view.renderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
+                graphics->Clear(momentShadows, true, view.viewport, momentClearColor);
+        }
+
+        for (size_t j = 0; j < prepared.views.size(); ++j)
+        {
+            const ShadowRenderView& view = prepared.views[j];
+
+            if (view.renderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
+            {
+                BatchQueue& batchQueue = prepared.shadowBatches[view.staticQueueIdx];
+                if (batchQueue.HasBatches())
+                {
+                    SetShadowViewport(prepared, view);
+                    graphics->SetDepthBias(view.depthBias, view.slopeScaleBias);
+                    RenderBatches(view, batchQueue, instanceBase, staticInstanceBase);
+                }
+            }
+        }
+
+        // Now do the shadowmap -> static shadowmap storage copies as necessary, all viewports at once
+        shadowCopyRects.clear();
+        for (size_t j = 0; j < prepared.views.size(); ++j)
+        {
+            const ShadowRenderView& view = prepared.views[j];
+
+            if (view.renderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
+                shadowCopyRects.push_back(view.viewport);
+        }
+        if (shadowCopyRects.size())
+        {
+            graphics->CopyTexture(shadowMap.staticTexture, shadowMap.texture, shadowCopyRects);
+            if (momentShadows)
+                graphics->CopyTexture(shadowMap.staticMomentTexture, shadowMap.momentTexture, shadowCopyRects);
+        }
+
+        // Then the static shadowmap -> shadowmap restore copies
+        shadowCopyRects.clear();
+        for (size_t j = 0; j < prepared.views.size(); ++j)
+        {
+            const ShadowRenderView& view = prepared.views[j];
+
+            if (view.renderMode == RENDER_STATIC_LIGHT_RESTORE_STATIC)
+                shadowCopyRects.push_back(view.viewport);
+        }
+        if (shadowCopyRects.size())
+        {
+            graphics->CopyTexture(shadowMap.texture, shadowMap.staticTexture, shadowCopyRects);
+            if (momentShadows)
+                graphics->CopyTexture(shadowMap.momentTexture, shadowMap.staticMomentTexture, shadowCopyRects);
+        }
+
+        // Rebind shadowmap and do the clears
+        shadowMap.fbo->Bind();
+
+        for (size_t j = 0; j < prepared.views.size(); ++j)
+        {
+            const ShadowRenderView& view = prepared.views[j];
+
+            if (view.renderMode == RENDER_DYNAMIC_LIGHT)
+                graphics->Clear(momentShadows, true, view.viewport, momentClearColor);
+        }
+
+        // Finally render the dynamic objects
+        for (size_t j = 0; j < prepared.views.size(); ++j)
+        {
+            const ShadowRenderView& view = prepared.views[j];
+
+            if (view.renderMode == RENDER_STATIC_LIGHT_CACHED)
+                ++ThreadStats().shadowViewsCached;
+            else
+            {
+                ++ThreadStats().shadowViewsRendered;
+                BatchQueue& batchQueue = prepared.shadowBatches[view.dynamicQueueIdx];
+                if (batchQueue.HasBatches())
+                {
+                    SetShadowViewport(prepared, view);
+                    graphics->SetDepthBias(view.depthBias, view.slopeScaleBias);
+                    RenderBatches(view, batchQueue, instanceBase, staticInstanceBase);
+                }
+            }
+        }
+
+        if (momentShadows)
+            BlurMomentShadowMap(shadowMap, prepared);
+    }
+
+    graphics->SetDepthBias(0.0f, 0.0f);
+}
+
+void Renderer::BlurMomentShadowMap(ShadowMap& shadowMap, const PreparedShadowMap& prepared)
+{
+    ZoneScoped;
+
+    Texture* momentTexture = shadowMap.momentTexture;
+    IntVector2 size = momentTexture->Size2D();
+    Vector2 invSize(1.0f / size.x, 1.0f / size.y);
+    Texture* blurTexture = graphics->AcquireRenderTarget(size, FMT_RG32F);
+
+    graphics->SetDepthBias(0.0f, 0.0f);
+    graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+    ShaderProgram* program = graphics->SetProgram("Shaders/MomentShadowBlur.glsl");
+
+    // Blur horizontally into the transient texture and back vertically, clamping the samples within each view's viewport
+    for (size_t pass = 0; pass < 2; ++pass)
+    {
+        if (pass == 0)
+            graphics->RenderTargetFrameBuffer(blurTexture, nullptr)->Bind();
+        else
+            shadowMap.momentFbo->Bind();
+
+        graphics->SetTexture(0, pass == 0 ? momentTexture : blurTexture);
+        graphics->SetUniform(program, U_BLURPARAMETERS, Vector4(pass == 0 ? invSize.x : 0.0f, pass == 0 ? 0.0f : invSize.y, invSize.x, invSize.y));
+
+        for (size_t i = 0; i < prepared.views.size(); ++i)
+        {
+            const ShadowRenderView& view = prepared.views[i];
+            if (view.renderMode == RENDER_STATIC_LIGHT_CACHED)
+                continue;
+
+            const IntRect& rect = view.viewport;
+            graphics->SetUniform(program, U_BLURRECT, Vector4((rect.left + 0.5f) * invSize.x, (rect.top + 0.5f) * invSize.y, (rect.right - 0.5f) * invSize.x,
+                (rect.bottom - 0.5f) * invSize.y));
+            graphics->SetViewport(rect);
+            graphics->DrawQuad();
+        }
+    }
+
+    graphics->SetTexture(0, nullptr);
+    graphics->ReleaseRenderTarget(blurTexture);
+}
+
+void Renderer::DefineMomentTextures()
+{
+    for (size_t i = 0; i < shadowMaps.size(); ++i)
+    {
+        ShadowMap& shadowMap = shadowMaps[i];
+        if (!shadowMap.texture->GLTexture())
+            continue;
+
+        if (momentShadows)
+        {
+            IntVector2 size = shadowMap.texture->Size2D();
+            shadowMap.momentTexture = new Texture();
+            shadowMap.momentTexture->Define(TEX_2D, size, FMT_RG32F, 1);
+            shadowMap.momentTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1);
+            shadowMap.staticMomentTexture = new Texture();
+            shadowMap.staticMomentTexture->Define(TEX_2D, size, FMT_RG32F, 1);
+            shadowMap.momentFbo = new FrameBuffer();
+            shadowMap.momentFbo->Define(shadowMap.momentTexture, nullptr);
+        }
+        else
+        {
+            shadowMap.momentTexture.Reset();
+            shadowMap.staticMomentTexture.Reset();
+            shadowMap.momentFbo.Reset();
+        }
+
+        shadowMap.fbo->Define(shadowMap.momentTexture, shadowMap.texture);
+    }
+}
+
+void Renderer::SetShadowViewport(const PreparedShadowMap& prepared, const ShadowRenderView& view)
+{
+    if (view.cubeShadowIdx >= 0)
+    {
+        const CubeShadowView& cubeShadow = prepared.cubeShadows[view.cubeShadowIdx];
+        graphics->SetViewports(cubeShadow.faceViewports, 6);
+        cubeShadowDataBuffer->SetData(0, sizeof(CubeShadowUniforms), &cubeShadow.uniforms);
+        cubeShadowDataBuffer->Bind(UB_CUBESHADOWDATA);
+    }
+    else
+        graphics->SetViewport(view.viewport);
+}
+
+void Renderer::SetStereoViewports(bool enable)
+{
+    if (!preparedView.stereo)
+        return;
+
+    if (enable)
+    {
+        stereoViewport = graphics->Viewport();
+        int halfWidth = stereoViewport.Width() / 2;
+        IntRect eyeViewports[2] = {
+            IntRect(stereoViewport.left, stereoViewport.top, stereoViewport.left + halfWidth, stereoViewport.bottom),
+            IntRect(stereoViewport.left + halfWidth, stereoViewport.top, stereoViewport.right, stereoViewport.bottom)
+        };
+
+        graphics->SetViewports(eyeViewports, 2);
+        stereoDataBuffer->SetData(0, sizeof(StereoUniforms), &preparedView.stereoData);
+        stereoDataBuffer->Bind(UB_STEREODATA);
+    }
+    else
+        graphics->SetViewport(stereoViewport);
+}
+
+void Renderer::BindLightingTextures()
+{
+    if (shadowMaps.size())
+        BindShadowMaps();
+
+    clusterTexture->Bind(TU_LIGHTCLUSTERDATA);
+    lightIndexTexture->Bind(TU_LIGHTINDICES);
+    lightDataTexture->Bind(TU_LIGHTDATA);
+
+    if (preparedView.numDecals)
+    {
+        decalDataTexture->Bind(TU_DECALDATA);
+        decalAtlas->Bind(TU_DECALATLAS);
+    }
+
+    if (lightProbes && lightProbes->IsBaked())
+        lightProbes->ProbeTexture()->Bind(TU_LIGHTPROBES);
+}
+
+void Renderer::BindShadowMaps()
+{
+    // Moment shadow maps are sampled through their moment textures, filtered instead of compared
+    if (momentShadows)
+    {
+        shadowMaps[0].momentTexture->Bind(TU_DIRLIGHTSHADOW);
+        shadowMaps[1].momentTexture->Bind(TU_SHADOWATLAS);
+    }
+    else
+    {
+        shadowMaps[0].texture->Bind(TU_DIRLIGHTSHADOW);
+        shadowMaps[1].texture->Bind(TU_SHADOWATLAS);
+    }
+    faceSelectionTexture1->Bind(TU_FACESELECTION1);
+    faceSelectionTexture2->Bind(TU_FACESELECTION2);
+}
+
+void Renderer::LatchCamera(Camera* camera_)
+{
+    if (!camera_ || preparedView.stereo)
+        return;
+
+    PerViewUniforms& perViewData = preparedView.mainView.perViewData;
+    perViewData.projectionMatrix = camera_->ProjectionMatrix();
+    perViewData.viewMatrix = camera_->ViewMatrix();
+    perViewData.viewProjMatrix = perViewData.projectionMatrix * perViewData.viewMatrix;
+
+    // Upload the main view uniforms again on next use
+    if (lastView == &preparedView.mainView)
+        lastView = nullptr;
+}
+
+void Renderer::RenderOpaque(Texture* depthTexture)
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    // Clip the compute clusters by depth only when the pre-pass has filled the depth texture. In visibility buffer mode the data has
+    // already been uploaded and the clusters built for shading the visibility buffer
+    bool clusterDepthBounds = computeClustering && depthPrePass && depthTexture && depthTexture->Multisample() == 1 && !preparedView.stereo &&
+        !preparedView.visibilityBuffer;
+    if (!preparedView.visibilityBuffer)
+        UpdateViewData(!clusterDepthBounds);
+
+    BindLightingTextures();
+
+    // Feedback is written from the main view only, whose per-view data enables it
+    bool virtualFeedback = virtualTexturing && preparedView.mainView.perViewData.virtualTextureData.z > 0.0f;
+    if (virtualFeedback)
+        BeginVirtualFeedback();
+
+    SetStereoViewports(true);
+
+    bool deferred = IsDeferredShading();
+    // The GPU culled batches are drawn after the others in each pass
+    const BatchQueue* gpuBatches = preparedView.gpuCulling ? &gpuCuller.Batches() : nullptr;
+    if (depthPrePass)
+    {
+        RenderBatches(preparedView.mainView, preparedView.opaqueBatches, mainInstanceBase, mainStaticInstanceBase, DEPTH_PREPASS);
+        if (gpuBatches)
+            RenderBatches(preparedView.mainView, *gpuBatches, 0, 0, DEPTH_PREPASS);
+        if (clusterDepthBounds)
+            BuildLightClusters(depthTexture);
+        RenderBatches(preparedView.mainView, preparedView.opaqueBatches, mainInstanceBase, mainStaticInstanceBase, DEPTH_AFTERPREPASS, deferred);
+        if (gpuBatches)
+            RenderBatches(preparedView.mainView, *gpuBatches, 0, 0, DEPTH_AFTERPREPASS, deferred);
+    }
+    else
+    {
+        RenderBatches(preparedView.mainView, preparedView.opaqueBatches, mainInstanceBase, mainStaticInstanceBase, DEPTH_NORMAL, deferred);
+        if (gpuBatches)
+            RenderBatches(preparedView.mainView, *gpuBatches, 0, 0, DEPTH_NORMAL, deferred);
+    }
+
+    SetStereoViewports(false);
+
+    if (virtualFeedback)
+        EndVirtualFeedback();
+}
+
+void Renderer::RenderVisibility()
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    if (!preparedView.visibilityBuffer)
+        return;
+
+    UpdateViewData(true);
+
+    if (preparedView.visibilityBatches.batches.empty())
+        return;
+
+    // One geometry pass writes only the instance, material bin and triangle of each pixel, so that the shading cost does not depend on overdraw or triangle density
+    const std::vector<float>& instances = preparedView.visibilityInstances;
+    size_t instanceBase = UpdateInstanceData(visibilityInstanceBuffer, visibilityInstanceOverflow, visibilityInstanceElements, &instances[0], instances.size() / 2);
+    VertexBuffer* instanceBuffer = InstanceSource(visibilityInstanceBuffer, visibilityInstanceOverflow, instanceBase);
+
+    const RenderView& view = preparedView.mainView;
+    if (&view != lastView)
+    {
+        perViewDataBuffer->SetData(0, view.perViewDataSize, &view.perViewData);
+        lastView = &view;
+    }
+    perViewDataBuffer->Bind(UB_PERVIEWDATA);
+
+    ShaderProgram* program = graphics->SetProgram("Shaders/Visibility.glsl", "STATICINSTANCED");
+    if (!program)
+        return;
+
+    staticTransformTexture->Bind(TU_STATICTRANSFORMS);
+
+    const std::vector<Batch>& batches = preparedView.visibilityBatches.batches;
+    for (size_t i = 0; i < batches.size(); ++i)
+    {
+        const Batch& batch = batches[i];
+        const VisibilityBin& bin = preparedView.visibilityBins[preparedView.visibilityBatchBins[i]];
+        Material* material = batch.GetPass()->Parent();
+        CullMode cullMode = material->GetCullMode();
+        if (view.reverseCulling && cullMode != CULL_NONE)
+            cullMode = cullMode == CULL_BACK ? CULL_FRONT : CULL_BACK;
+
+        graphics->SetRenderState(BLEND_REPLACE, cullMode, batch.GetPass()->GetDepthTest(), true, true);
+        graphics->SetUniform(program, U_VISIBILITYPARAMETERS, Vector4((float)preparedView.visibilityBatchBins[i], 0.0f, 0.0f, 0.0f));
+
+        Geometry* geometry = batch.geometry;
+        VertexBuffer* vb = geometry->positionBuffer ? geometry->positionBuffer.Get() : bin.vertexBuffer;
+        vb->BindVertexArray(program->Attributes(), bin.indexBuffer, true);
+        graphics->MultiDrawIndexedIndirect(PT_TRIANGLE_LIST, instanceBuffer, instanceBase, indirectBuffer, batch.instanceStart, batch.instanceCount);
+    }
+
+    lastMaterial = nullptr;
+}
+
+void Renderer::RenderVisibilityShading(Texture* visibilityTexture, Texture* depthTexture, Texture* colorTexture, Texture* normalTexture)
+{
+    ZoneScoped;
+
+    if (!preparedView.visibilityBuffer || preparedView.visibilityBins.empty() || !visibilityTexture || !depthTexture || !colorTexture)
+        return;
+
+    BindLightingTextures();
+
+    const RenderView& view = preparedView.mainView;
+    if (&view != lastView)
+    {
+        perViewDataBuffer->SetData(0, view.perViewDataSize, &view.perViewData);
+        lastView = &view;
+    }
+    perViewDataBuffer->Bind(UB_PERVIEWDATA);
+
+    graphics->SetTexture(1, visibilityTexture);
+    graphics->SetTexture(2, depthTexture);
+    staticTransformTexture->Bind(TU_STATICTRANSFORMS);
+    colorTexture->BindImage(0, IMAGE_WRITE);
+    if (normalTexture)
+        normalTexture->BindImage(1, IMAGE_WRITE);
+
+    std::string baseDefines = Material::GlobalFSDefines() + (momentShadows ? "MOMENTSHADOW " : "") + (normalTexture ? "NORMALOUTPUT " : "");
+    IntVector2 size = depthTexture->Size2D();
+    IntVector3 numGroups((size.x + 7) / 8, (size.y + 7) / 8, 1);
+
+    // Each material bin tests all pixels, but returns early from the pixels of other bins. The triangles are fetched from the vertex and index buffers
+    for (auto it = preparedView.visibilityBins.begin(); it != preparedView.visibilityBins.end(); ++it)
+    {
+        const VisibilityBin& bin = *it;
+        ShaderProgram* program = graphics->SetComputeProgram("Shaders/VisibilityShading.glsl", baseDefines + (bin.diffuseMap ? "DIFFMAP" : ""));
+        if (!program)
+            continue;
+
+        Material* material = bin.pass->Parent();
+        if (bin.diffuseMap)
+            graphics->SetTexture(0, material->GetTexture(0));
+        UniformBuffer* materialUniforms = material->GetUniformBuffer();
+        if (materialUniforms)
+            materialUniforms->Bind(UB_MATERIALDATA);
+
+        graphics->SetUniform(program, U_VISIBILITYPARAMETERS, bin.parameters);
+        bin.vertexBuffer->BindStorage(0);
+        bin.indexBuffer->BindStorage(1);
+        graphics->DispatchCompute(numGroups);
+    }
+
+    graphics->SetTexture(0, nullptr);
+    graphics->SetTexture(1, nullptr);
+    graphics->SetTexture(2, nullptr);
+    graphics->RenderTargetBarrier();
+
+    lastMaterial = nullptr;
+}
+
+void Renderer::RenderDeferredLighting(Texture* albedoTexture, Texture* normalTexture, Texture* depthTexture)
+{
+    ZoneScoped;
+
+    if (!IsDeferredShading() || !albedoTexture || !normalTexture || !depthTexture)
+        return;
+
+    BindLightingTextures();
+
+    const RenderView& view = preparedView.mainView;
+    if (&view != lastView)
+    {
+        perViewDataBuffer->SetData(0, view.perViewDataSize, &view.perViewData);
+        lastView = &view;
+    }
+    perViewDataBuffer->Bind(UB_PERVIEWDATA);
+
+    ShaderProgram* program = graphics->SetProgram("Shaders/DeferredLighting.glsl", Material::GlobalVSDefines(), Material::GlobalFSDefines() +
+        (momentShadows ? "MOMENTSHADOW" : ""));
+    if (!program)
+        return;
+
+    graphics->SetUniform(program, U_INVVIEWPROJMATRIX, view.perViewData.viewProjMatrix.Inverse());
+    graphics->SetTexture(0, albedoTexture);
+    graphics->SetTexture(1, normalTexture);
+    graphics->SetTexture(2, depthTexture);
+    graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+    graphics->DrawQuad();
+    graphics->SetTexture(0, nullptr);
+    graphics->SetTexture(1, nullptr);
+    graphics->SetTexture(2, nullptr);
+
+    lastMaterial = nullptr;
+}
+
+void Renderer::RenderAlpha()
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    BindLightingTextures();
+
+    SetStereoViewports(true);
+    RenderBatches(preparedView.mainView, preparedView.alphaBatches, mainInstanceBase, mainStaticInstanceBase, preparedView.orderIndependent ? DEPTH_OIT : DEPTH_NORMAL);
+    SetStereoViewports(false);
+}
+
+void Renderer::RenderAlphaComposite(Texture* accumTexture, Texture* weightTexture)
+{
+    ZoneScoped;
+
+    if (!preparedView.orderIndependent || !accumTexture || !weightTexture)
+        return;
+
+    // The accumulated color is the weighted average of the transparent fragments, covering the opaque color by one minus the revealage
+    ShaderProgram* program = graphics->SetProgram("Shaders/OITComposite.glsl");
+    if (program)
+    {
+        graphics->SetTexture(0, accumTexture);
+        graphics->SetTexture(1, weightTexture);
+        graphics->SetRenderState(BLEND_PREMULALPHA, CULL_NONE, CMP_ALWAYS, true, false);
+        graphics->DrawQuad();
+        graphics->SetTexture(0, nullptr);
+        graphics->SetTexture(1, nullptr);
+    }
+
+    BindLightingTextures();
+
+    SetStereoViewports(true);
+    RenderBatches(preparedView.mainView, preparedView.alphaBatches, mainInstanceBase, mainStaticInstanceBase, DEPTH_OITEXCLUDED);
+    SetStereoViewports(false);
+}
+
+bool Renderer::RenderSecondaryView(SecondaryView* view)
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RENDERER);
+
+    if (!view || !view->renderPending)
+        return false;
+
+    view->renderPending = false;
+
+    size_t instanceBase = UpdateInstanceTransforms(view->preparedInstanceTransforms);
+    UpdateDrawCommands(view->preparedDrawCommands);
+
+    // The lights are not clustered, but listed in one cluster that covers the whole view
+    unsigned numLights = (unsigned)view->preparedLightData.size();
+    unsigned clusterRange[2] = { 0, numLights };
+    secondaryClusterTexture->SetData(0, IntBox(0, 0, 0, 1, 1, 1), ImageLevel(IntVector3(1, 1, 1), FMT_RG32U, clusterRange));
+    if (numLights)
+    {
+        SetTextureRows(secondaryLightDataTexture, LIGHTS_PER_ROW * LIGHT_DATA_TEXELS, FMT_RGBA32F, &view->preparedLightData[0], numLights * LIGHT_DATA_TEXELS);
+
+        // Pad the index list to a whole number of texels
+        std::vector<unsigned short> indices((numLights + 1) & ~1U);
+        for (unsigned i = 0; i < numLights; ++i)
+            indices[i] = (unsigned short)i;
+        SetTextureRows(secondaryLightIndexTexture, LIGHT_INDEX_TEXTURE_WIDTH, FMT_R32U, &indices[0], indices.size() / 2);
+    }
+
+    if (shadowMaps.size())
+        BindShadowMaps();
+
+    secondaryClusterTexture->Bind(TU_LIGHTCLUSTERDATA);
+    secondaryLightIndexTexture->Bind(TU_LIGHTINDICES);
+    secondaryLightDataTexture->Bind(TU_LIGHTDATA);
+
+    RenderBatches(view->renderView, view->preparedOpaqueBatches, instanceBase, 0);
+    RenderBatches(view->renderView, view->preparedAlphaBatches, instanceBase, 0);
+
+    return true;
+}
+
+void Renderer::RenderDebug()
+{
+    ZoneScoped;
+
+    DebugRenderer* debug = Subsystem<DebugRenderer>();
+    if (!debug || viewPending)
+        return;
+
+    for (auto it = lights.begin(); it != lights.end(); ++it)
+        (*it)->OnRenderDebug(debug);
+
+    debugOctants.clear();
+    for (auto it = octantResults.begin(); it != octantResults.end(); ++it)
+    {
+        for (auto oIt = it->octants.begin(); oIt != it->octants.end(); ++oIt)
+            debugOctants.push_back(oIt->first);
+    }
+
+    // Each thread records into its own buffers in DebugRenderer
+    workQueue->ParallelFor(0, debugOctants.size(), DEBUG_OCTANTS_PER_TASK, [&](size_t start, size_t end, unsigned)
+    {
+        for (size_t i = start; i < end; ++i)
+            AddOctantDebug(debug, debugOctants[i]);
+    });
+}
+
+void Renderer::AddOctantDebug(DebugRenderer* debug, Octant* octant)
+{
+    octant->OnRenderDebug(debug);
+
+    // Static drawables with static geometry do not change their debug geometry unless they move or change, which marks the cache dirty
+    if (octant->debugGeometryDirty)
+    {
+        debug->BeginCapture(octant->debugGeometry);
+        for (size_t i = 0; i < octant->drawables.size(); ++i)
+        {
+            if ((octant->drawableFlags[i] & DEBUG_CACHE_FLAG_MASK) == DEBUG_CACHE_FLAGS)
+                octant->drawables[i]->OnRenderDebug(debug);
+        }
+        debug->EndCapture();
+        octant->debugGeometryDirty = false;
+    }
+
+    debug->AddGeometry(octant->debugGeometry);
+
+    for (size_t i = 0; i < octant->drawables.size(); ++i)
+    {
+        unsigned short flags = octant->drawableFlags[i];
+        if ((flags & DF_GEOMETRY) && (flags & DEBUG_CACHE_FLAG_MASK) != DEBUG_CACHE_FLAGS && octant->drawables[i]->LastFrameNumber() == frameNumber)
+            octant->drawables[i]->OnRenderDebug(debug);
+    }
+}
+
+void Renderer::ResetShadowMaps()
+{
+    FinishView();
+
+    shadowMapsDirty = true;
+    viewReusable = false;
+}
+
+bool Renderer::SaveFrameCapture(Stream& dest) const
+{
+    ZoneScoped;
+
+    // The static transform table is not captured
+    bool hasStaticInstances = preparedView.staticInstances.size() > 0;
+    for (size_t i = 0; i < 2; ++i)
+        hasStaticInstances |= preparedView.shadowMaps[i].staticInstances.size() > 0;
+    if (hasStaticInstances)
+    {
+        LOGERROR("Frame capture is not supported in static instance table mode");
+        return false;
+    }
+
+    CaptureTables tables;
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    if (cache)
+    {
+        std::vector<Model*> models;
+        cache->ResourcesByType<Model>(models);
+
+        for (auto it = models.begin(); it != models.end(); ++it)
+        {
+            Model* model = *it;
+            if (model->Name().empty())
+                continue;
+
+            CaptureGeometry geometry;
+            geometry.model = (unsigned)tables.loadedModels.size();
+            tables.loadedModels.push_back(model);
+
+            for (size_t i = 0; i < model->NumGeometries(); ++i)
+            {
+                for (size_t j = 0; j < model->NumLodLevels(i); ++j)
+                {
+                    geometry.index = (unsigned)i;
+                    geometry.lodLevel = (unsigned)j;
+                    tables.modelGeometries[model->GetGeometry(i, j)] = geometry;
+                }
+            }
+        }
+    }
+
+    // Gather the referenced resources first, so that they can be written before the batches
+    std::vector<Matrix3x4> worldTransforms[3];
+    size_t numSkipped = GatherCaptureBatches(preparedView.opaqueBatches, multiDraw, tables, worldTransforms[0]);
+    numSkipped += GatherCaptureBatches(preparedView.alphaBatches, multiDraw, tables, worldTransforms[0]);
+
+    size_t numCachedViews = 0;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const PreparedShadowMap& prepared = preparedView.shadowMaps[i];
+        for (auto it = prepared.shadowBatches.begin(); it != prepared.shadowBatches.end(); ++it)
+            numSkipped += GatherCaptureBatches(*it, multiDraw, tables, worldTransforms[i + 1]);
+        for (auto it = prepared.views.begin(); it != prepared.views.end(); ++it)
+        {
+            // Views without a viewport are not rendered at all
+            if ((it->renderMode == RENDER_STATIC_LIGHT_RESTORE_STATIC || it->renderMode == RENDER_STATIC_LIGHT_CACHED) && it->viewport != IntRect::ZERO)
+                ++numCachedViews;
+        }
+    }
+
+    dest.WriteFileID("TCAP");
+    dest.Write(FRAME_CAPTURE_VERSION);
+    dest.Write(multiDraw);
+    dest.Write(computeClustering);
+    dest.Write(clusterSize);
+    dest.Write((unsigned)maxLights);
+    dest.Write((unsigned)maxLightsPerCluster);
+    for (size_t i = 0; i < 2; ++i)
+        dest.Write(i < shadowMaps.size() ? shadowMaps[i].texture->Size2D() : IntVector2::ZERO);
+    dest.Write((unsigned char)(shadowMaps.size() ? shadowMaps[0].texture->Format() : FMT_NONE));
+
+    dest.WriteVLE(tables.materialNames.size());
+    for (auto it = tables.materialNames.begin(); it != tables.materialNames.end(); ++it)
+        dest.Write(*it);
+    dest.WriteVLE(tables.modelNames.size());
+    for (auto it = tables.modelNames.begin(); it != tables.modelNames.end(); ++it)
+        dest.Write(*it);
+    dest.WriteVLE(tables.geometries.size());
+    for (auto it = tables.geometries.begin(); it != tables.geometries.end(); ++it)
+    {
+        dest.WriteVLE(it->model);
+        dest.WriteVLE(it->index);
+        dest.WriteVLE(it->lodLevel);
+    }
+
+    size_t worldTransformIdx = 0;
+    WriteCaptureView(dest, preparedView.mainView);
+    WriteCaptureVector(dest, worldTransforms[0]);
+    WriteCaptureBatches(dest, preparedView.opaqueBatches, multiDraw, tables, worldTransformIdx);
+    WriteCaptureBatches(dest, preparedView.alphaBatches, multiDraw, tables, worldTransformIdx);
+    WriteCaptureVector(dest, preparedView.instanceTransforms);
+    WriteCaptureVector(dest, preparedView.skinMatrices);
+    WriteCaptureVector(dest, preparedView.drawCommands);
+    dest.WriteVLE(preparedView.numLights);
+    WriteCaptureVector(dest, preparedView.lightData);
+    // Decals are not captured, so leave out their counts
+    std::vector<unsigned> clusterRanges(preparedView.clusterRanges);
+    for (size_t i = 1; i < clusterRanges.size(); i += 2)
+        clusterRanges[i] &= 0xffff;
+    WriteCaptureVector(dest, clusterRanges);
+    WriteCaptureVector(dest, preparedView.lightIndices);
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const PreparedShadowMap& prepared = preparedView.shadowMaps[i];
+
+        dest.WriteVLE(prepared.views.size());
+        for (auto it = prepared.views.begin(); it != prepared.views.end(); ++it)
+        {
+            const ShadowRenderView& view = *it;
+            WriteCaptureView(dest, view);
+            dest.Write(view.viewport);
+            dest.Write((unsigned char)view.renderMode);
+            dest.WriteVLE(view.staticQueueIdx);
+            dest.WriteVLE(view.dynamicQueueIdx);
+            dest.Write(view.depthBias);
+            dest.Write(view.slopeScaleBias);
+            dest.Write(view.cubeShadowIdx);
+        }
+
+        worldTransformIdx = 0;
+        WriteCaptureVector(dest, prepared.cubeShadows);
+        WriteCaptureVector(dest, worldTransforms[i + 1]);
+        dest.WriteVLE(prepared.shadowBatches.size());
+        for (auto it = prepared.shadowBatches.begin(); it != prepared.shadowBatches.end(); ++it)
+            WriteCaptureBatches(dest, *it, multiDraw, tables, worldTransformIdx);
+        WriteCaptureVector(dest, prepared.instanceTransforms);
+        WriteCaptureVector(dest, prepared.skinMatrices);
+        WriteCaptureVector(dest, prepared.drawCommands);
+    }
+
+    if (numSkipped)
+        LOGWARNINGF("Left out %u batches that can not be replayed from the frame capture", (unsigned)numSkipped);
+    if (numCachedViews)
+        LOGWARNINGF("%u shadow views reuse cached contents and are incomplete in the frame capture", (unsigned)numCachedViews);
+
+    return true;
+}
+
+bool Renderer::LoadFrameCapture(Stream& source)
+{
+    ZoneScoped;
+
+    FinishView();
+
+    if (source.ReadFileID() != "TCAP" || source.Read<unsigned>() != FRAME_CAPTURE_VERSION)
+    {
+        LOGERROR(source.Name() + " is not a valid frame capture file");
+        return false;
+    }
+
+    bool captureMultiDraw = source.Read<bool>();
+    bool captureComputeClustering = source.Read<bool>();
+    IntVector3 captureClusterSize = source.Read<IntVector3>();
+    size_t captureMaxLights = source.Read<unsigned>();
+    size_t captureMaxLightsPerCluster = source.Read<unsigned>();
+    IntVector2 shadowMapSizes[2];
+    for (size_t i = 0; i < 2; ++i)
+        shadowMapSizes[i] = source.Read<IntVector2>();
+    ImageFormat shadowMapFormat = (ImageFormat)source.Read<unsigned char>();
+
+    // The batches have been instanced and the clusters filled according to the capture's modes
+    if (captureMultiDraw != multiDraw)
+        SetMultiDraw(captureMultiDraw);
+    if (captureComputeClustering != computeClustering)
+        SetComputeClustering(captureComputeClustering);
+    if (captureMultiDraw != multiDraw || captureComputeClustering != computeClustering)
+    {
+        LOGERROR("Multi-draw or compute clustering mode of frame capture " + source.Name() + " is not supported");
+        return false;
+    }
+
+    if (captureClusterSize != clusterSize || captureMaxLights != maxLights || captureMaxLightsPerCluster != maxLightsPerCluster)
+        SetLightClusters(captureClusterSize, captureMaxLights, captureMaxLightsPerCluster);
+
+    if (shadowMapSizes[0] != IntVector2::ZERO && (shadowMaps.empty() || shadowMaps[0].texture->Size2D() != shadowMapSizes[0] ||
+        shadowMaps[1].texture->Size2D() != shadowMapSizes[1] || shadowMaps[0].texture->Format() != shadowMapFormat))
+    {
+        // A square directional light shadow map is the same for one or four cascades
+        SetupShadowMaps(shadowMapSizes[0].y, shadowMapSizes[1].x, shadowMapFormat, shadowMapSizes[0].x > shadowMapSizes[0].y ? 2 : 1);
+    }
+
+    DiscardPreparedView();
+    captureResources.clear();
+
+    if (!ReadFrameCapture(source))
+    {
+        LOGERROR("Could not load frame capture " + source.Name());
+        DiscardPreparedView();
+        captureResources.clear();
+        return false;
+    }
+
+    lastView = nullptr;
+    return true;
+}
+
+Texture* Renderer::ShadowMapTexture(size_t index) const
+{
+    return index < shadowMaps.size() ? shadowMaps[index].texture : nullptr;
+}
+
+void Renderer::ResetFrameArenas()
+{
+    Profiler* profiler = Subsystem<Profiler>();
+    if (profiler)
+        profiler->SetCounter("FrameArenaBytes", (long long)frameArenas->UsedBytes());
+
+    // All containers using the arenas must release their memory before the reset. Shadow maps have been cleared already
+    for (size_t i = 0; i < octantResults.size(); ++i)
+        octantResults[i].Clear();
+    for (size_t i = 0; i < batchResults.size(); ++i)
+        batchResults[i].Clear();
+
+    frameArenas->Reset();
+}
+
+void Renderer::UpdateStats()
+{
+    stats.Clear();
+    for (auto it = threadStats.begin(); it != threadStats.end(); ++it)
+    {
+        stats.Merge(*it);
+        it->Clear();
+    }
+
+    stats.drawCalls = graphics->DrawCalls();
+    stats.triangles = graphics->Triangles();
+    for (size_t i = 0; i < MAX_STATE_CALL_TYPES; ++i)
+    {
+        stats.stateCalls += graphics->StateCalls((StateCallType)i);
+        stats.filteredStateCalls += graphics->FilteredStateCalls((StateCallType)i);
+    }
+
+    Profiler* profiler = Subsystem<Profiler>();
+    if (profiler)
+    {
+        profiler->SetCounter("DrawCalls", stats.drawCalls);
+        profiler->SetCounter("Triangles", (long long)stats.triangles);
+        profiler->SetCounter("StateCalls", stats.stateCalls);
+        profiler->SetCounter("InstancedBatches", stats.instancedBatches);
+        profiler->SetCounter("NonInstancedBatches", stats.nonInstancedBatches);
+        profiler->SetCounter("SortedBatches", (long long)stats.sortedBatches);
+        profiler->SetCounter("ShadowViewsRendered", stats.shadowViewsRendered);
+        profiler->SetCounter("ShadowViewsCached", stats.shadowViewsCached);
+        profiler->SetCounter("LightsAccepted", stats.lightsAccepted);
+        profiler->SetCounter("ClusterLightOverflows", stats.clusterLightOverflows);
+        profiler->SetCounter("DecalsAccepted", stats.decalsAccepted);
+    }
+}
+
+bool Renderer::IsBelowScreenSize(const BoundingBox& box, float minPixels) const
+{
+    return ScreenSize(box) < minPixels;
+}
+
+float Renderer::ScreenSize(const BoundingBox& box) const
+{
+    Vector3 halfSize = box.HalfSize();
+    float pixels = ((fastMath & FAST_MATH_DISTANCES) ? halfSize.LengthFast() : halfSize.Length()) * screenSizeScale;
+    if (!camera->IsOrthographic())
+        pixels /= Max(camera->Distance(box.Center()), M_EPSILON);
+
+    return pixels;
+}
+
+void Renderer::UpdateTextureStreaming()
+{
+    ZoneScoped;
+
+    // With several views per frame, update once using the requests gathered so far
+    if (lastStreamingFrame == graphics->FrameNumber())
+        return;
+    lastStreamingFrame = graphics->FrameNumber();
+
+    const std::vector<Texture*>& textures = Texture::StreamingTextures();
+    if (textures.empty())
+        return;
+
+    // Continue round-robin from where the budget ran out last frame, so that all textures get their turn
+    size_t uploaded = 0;
+    for (size_t i = 0; i < textures.size() && uploaded < textureStreamingBudget; ++i)
+    {
+        if (textureStreamingCursor >= textures.size())
+            textureStreamingCursor = 0;
+        uploaded += textures[textureStreamingCursor++]->UpdateStreaming(frameNumber);
+    }
+
+    if (textureMemoryBudget)
+        EvictTextures();
+}
+
+void Renderer::UpdateVirtualTextures()
+{
+    ZoneScoped;
+
+    if (lastVirtualTextureFrame == graphics->FrameNumber())
+        return;
+    lastVirtualTextureFrame = graphics->FrameNumber();
+
+    // Request the pages of the feedback once it has arrived
+    if (virtualFeedbackReadback && !virtualFeedbackReadback->IsPending())
+    {
+        if (virtualFeedbackReadback->IsReady())
+        {
+            const std::vector<unsigned char>& data = virtualFeedbackReadback->Data();
+            VirtualTexture::ProcessFeedback(reinterpret_cast<const unsigned*>(&data[0]), data.size() / (2 * sizeof(unsigned)), virtualFeedbackReadback->RequestFrame());
+        }
+        virtualFeedbackReadback.Reset();
+    }
+
+    // The textures share the budget in order. Each still uploads at least one page to make progress
+    const std::vector<VirtualTexture*>& textures = VirtualTexture::AllVirtualTextures();
+    size_t uploaded = 0;
+    for (auto it = textures.begin(); it != textures.end(); ++it)
+        uploaded += (*it)->Update(virtualTexturingBudget > uploaded ? virtualTexturingBudget - uploaded : 0);
+}
+
+void Renderer::BeginVirtualFeedback()
+{
+    const IntRect& viewport = graphics->Viewport();
+    IntVector2 size((viewport.right + VIRTUAL_FEEDBACK_SCALE - 1) / VIRTUAL_FEEDBACK_SCALE, (viewport.bottom + VIRTUAL_FEEDBACK_SCALE - 1) / VIRTUAL_FEEDBACK_SCALE);
+    if (size.x <= 0 || size.y <= 0)
+        return;
+
+    if (!virtualFeedbackTexture)
+        virtualFeedbackTexture = new Texture();
+    if (virtualFeedbackTexture->Width() != size.x || virtualFeedbackTexture->Height() != size.y)
+    {
+        virtualFeedbackTexture->Define(TEX_2D, size, FMT_RG32U);
+        virtualFeedbackTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    }
+
+    // The opaque pass overwrites only the blocks with virtual textured pixels
+    if (graphics->SetComputeProgram("Shaders/VirtualFeedbackClear.glsl"))
+    {
+        virtualFeedbackTexture->BindImage(0, IMAGE_WRITE);
+        graphics->DispatchCompute(IntVector3((size.x + 7) / 8, (size.y + 7) / 8, 1));
+        graphics->ComputeBarrier();
+    }
+
+    virtualFeedbackTexture->BindImage(IU_VIRTUALFEEDBACK, IMAGE_WRITE);
+}
+
+void Renderer::EndVirtualFeedback()
+{
+    if (!virtualFeedbackTexture || !virtualFeedbackTexture->Width())
+        return;
+
+    graphics->RenderTargetBarrier();
+    // While the previous feedback is still pending, the GPU is behind, so do not queue more
+    if (!virtualFeedbackReadback)
+        virtualFeedbackReadback = graphics->RequestReadback(virtualFeedbackTexture, 0);
+}
+
+void Renderer::EvictTextures()
+{
+    const std::vector<Texture*>& textures = Texture::StreamingTextures();
+
+    size_t used = 0;
+    evictCandidates.clear();
+    for (auto it = textures.begin(); it != textures.end(); ++it)
+    {
+        Texture* texture = *it;
+        used += texture->GpuMemoryUse();
+
+        // The frame number wraps around, so compare the age in the same width
+        unsigned lastRequest = texture->LastStreamingRequest();
+        if (!lastRequest || (unsigned short)(frameNumber - lastRequest) >= textureEvictFrames)
+            evictCandidates.push_back(texture);
+    }
+
+    if (used <= textureMemoryBudget)
+        return;
+
+    // Least recently requested first. Never requested textures have the oldest request
+    unsigned short currentFrame = frameNumber;
+    std::sort(evictCandidates.begin(), evictCandidates.end(), [currentFrame](Texture* lhs, Texture* rhs) {
+        unsigned short lhsAge = lhs->LastStreamingRequest() ? (unsigned short)(currentFrame - lhs->LastStreamingRequest()) : 0xffff;
+        unsigned short rhsAge = rhs->LastStreamingRequest() ? (unsigned short)(currentFrame - rhs->LastStreamingRequest()) : 0xffff;
+        return lhsAge > rhsAge;
+    });
+
+    for (auto it = evictCandidates.begin(); it != evictCandidates.end() && used > textureMemoryBudget; ++it)
+        used -= (*it)->EvictStreamingLevels();
+}
+
+float Renderer::LightScreenRadius(LightDrawable* light) const
+{
+    float pixels = light->Range() * screenSizeScale;
+    if (!camera->IsOrthographic())
+        pixels /= Max(light->Distance(), M_EPSILON);
+
+    return pixels;
+}
+
+void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& result, bool threaded, bool recursive, unsigned char planeMask)
+{
+    if (planeMask)
+    {
+        planeMask = frustum.IsInsideMasked(octant->cullingBox, planeMask);
+        if (planeMask == 0xff)
+            return;
+    }
+
+    // Skip occluded octants along with their children, which are contained in the culling box
+    if (!occlusionBuffer.IsVisible(octant->cullingBox) || !portalCuller.IsVisible(octant->cullingBox))
+        return;
+
+    CollectOctant(octant, result, threaded, planeMask);
+
+    if (recursive)
+    {
+        for (size_t i = 0; i < NUM_OCTANTS; ++i)
+        {
+            if (octant->children[i])
+                CollectOctantsAndLights(octant->children[i], result, threaded, true, planeMask);
+        }
+    }
+}
+
+void Renderer::CollectBvhOctantsAndLights(ThreadOctantResult& result, bool threaded)
+{
+    const std::vector<BvhNode>& nodes = octree->BvhNodes();
+
+    std::pair<unsigned, unsigned char> stack[BVH_STACK_SIZE];
+    size_t stackSize = 0;
+    stack[stackSize++] = std::make_pair(0u, (unsigned char)0x3f);
+
+    while (stackSize)
+    {
+        std::pair<unsigned, unsigned char> entry = stack[--stackSize];
+        if (gpuCuller.IsManaged(entry.first))
+            continue;
+
+        const BvhNode& node = nodes[entry.first];
+        unsigned char planeMask = entry.second;
+        BoundingBox box = node.Box();
+
+        if (planeMask)
+        {
+            planeMask = frustum.IsInsideMasked(box, planeMask);
+            if (planeMask == 0xff)
+                continue;
+        }
+
+        if (!occlusionBuffer.IsVisible(box) || !portalCuller.IsVisible(box))
+            continue;
+
+        if (node.IsLeaf())
+            CollectOctant(octree->BvhLeaf(node.index), result, threaded, planeMask);
+        else
+        {
+            stack[stackSize++] = std::make_pair(node.index + 1, planeMask);
+            stack[stackSize++] = std::make_pair(node.index, planeMask);
+        }
+    }
+}
+
+void Renderer::CollectCachedOctantsAndLights(ThreadOctantResult& result, bool threaded)
+{
+    const std::vector<CachedOctant>& cache = result.octantCache;
+
+    for (size_t i = 0; i < cache.size();)
+    {
+        const CachedOctant& entry = cache[i];
+        Octant* octant = entry.octant;
+        unsigned char planeMask = entry.planeMask;
+
+        // Octants fully inside the expanded frustum are accepted as is. Retest the ones that were intersecting against the actual frustum
+        if (planeMask)
+        {
+            planeMask = frustum.IsInsideMasked(octant->cullingBox);
+            if (planeMask == 0xff)
+            {
+                i = entry.subtreeEnd;
+                continue;
+            }
+        }
+
+        if (!occlusionBuffer.IsVisible(octant->cullingBox) || !portalCuller.IsVisible(octant->cullingBox))
+        {
+            i = entry.subtreeEnd;
+            continue;
+        }
+
+        CollectOctant(octant, result, threaded, planeMask);
+        ++i;
+    }
+}
+
+void Renderer::CollectOctant(Octant* octant, ThreadOctantResult& result, bool threaded, unsigned char planeMask)
+{
+    for (size_t i = 0; i < octant->drawables.size(); ++i)
+    {
+        if (octant->drawableFlags[i] & DF_LIGHT)
+        {
+            if ((octant->drawableLayerMasks[i] & viewMask) && (!planeMask || frustum.IsInsideMaskedFast(octant->DrawableBox(i), planeMask)) &&
+                portalCuller.IsVisible(octant->DrawableBox(i)))
+            {
+                Drawable* drawable = octant->drawables[i];
+                if ((octant->drawableFlags[i] & DF_DECAL) == DF_DECAL)
+                {
+                    if (decalAtlas && drawable->OnPrepareRender(frameNumber, camera))
+                        result.decals.push_back(static_cast<DecalDrawable*>(drawable));
+                }
+                else if (!IsBakedLight(static_cast<LightDrawable*>(drawable)) && drawable->OnPrepareRender(frameNumber, camera))
+                {
+                    LightDrawable* light = static_cast<LightDrawable*>(drawable);
+                    result.lights.push_back(light);
+                }
+            }
+        }
+        // Lights and decals are kept first in octants, so break when first geometry encountered. Store the octant for batch collecting
+        else
+        {
+            result.octants.push_back(std::make_pair(octant, planeMask));
+            result.drawableAcc += octant->drawables.size() - i;
+            break;
+        }
+    }
+
+    // Setup and queue batches collection task if over the drawable limit now. Note: if not threaded, defer to the end
+    if (threaded && result.drawableAcc >= DRAWABLES_PER_BATCH_TASK)
+    {
+        if (result.collectBatchesTasks.size() <= result.batchTaskIdx)
+        {
+            result.collectBatchesTasks.push_back(new CollectBatchesTask(this, &Renderer::CollectBatchesWork));
+            result.collectBatchesTasks.back()->priority = TASK_HIGH;
+            result.collectBatchesTasks.back()->octants = FrameVector<std::pair<Octant*, unsigned char> >(FrameAllocator<std::pair<Octant*, unsigned char> >(frameArenas));
+        }
+
+        CollectBatchesTask* batchTask = result.collectBatchesTasks[result.batchTaskIdx];
+        batchTask->octants.clear();
+        batchTask->octants.insert(batchTask->octants.end(), result.octants.begin() + result.taskOctantIdx, result.octants.end());
+        processShadowCastersTask->AddDependency(batchTask);
+        numPendingBatchTasks.fetch_add(1);
+        workQueue->QueueTask(batchTask);
+
+        result.drawableAcc = 0;
+        result.taskOctantIdx = result.octants.size();
+        ++result.batchTaskIdx;
+    }
+}
+
+void Renderer::BuildOctantCache(Octant* octant, std::vector<CachedOctant>& cache, bool recursive, unsigned char planeMask)
+{
+    if (planeMask)
+    {
+        planeMask = cacheFrustum.IsInsideMasked(octant->cullingBox, planeMask);
+        if (planeMask == 0xff)
+            return;
+    }
+
+    // Occlusion is not cached, as it changes also when the camera does not move
+    size_t index = cache.size();
+    CachedOctant entry;
+    entry.octant = octant;
+    entry.planeMask = planeMask;
+    cache.push_back(entry);
+
+    if (recursive)
+    {
+        for (size_t i = 0; i < NUM_OCTANTS; ++i)
+        {
+            if (octant->children[i])
+                BuildOctantCache(octant->children[i], cache, true, planeMask);
+        }
+    }
+
+    cache[index].subtreeEnd = cache.size();
+}
+
+void Renderer::BuildBvhOctantCache(std::vector<CachedOctant>& cache)
+{
+    const std::vector<BvhNode>& nodes = octree->BvhNodes();
+
+    std::pair<unsigned, unsigned char> stack[BVH_STACK_SIZE];
+    size_t stackSize = 0;
+    stack[stackSize++] = std::make_pair(0u, (unsigned char)0x3f);
+
+    while (stackSize)
+    {
+        std::pair<unsigned, unsigned char> entry = stack[--stackSize];
+        if (gpuCuller.IsManaged(entry.first))
+            continue;
+
+        const BvhNode& node = nodes[entry.first];
+        unsigned char planeMask = entry.second;
+
+        if (planeMask)
+        {
+            planeMask = cacheFrustum.IsInsideMasked(node.Box(), planeMask);
+            if (planeMask == 0xff)
+                continue;
+        }
+
+        // Only the leaves are stored, so each entry is its own subtree
+        if (node.IsLeaf())
+        {
+            CachedOctant cached;
+            cached.octant = octree->BvhLeaf(node.index);
+            cached.planeMask = planeMask;
+            cached.subtreeEnd = cache.size() + 1;
+            cache.push_back(cached);
+        }
+        else
+        {
+            stack[stackSize++] = std::make_pair(node.index + 1, planeMask);
+            stack[stackSize++] = std::make_pair(node.index, planeMask);
+        }
+    }
+}
+
+bool Renderer::CheckTemporalCoherence(bool drawShadows_)
+{
+    if (!viewReusable || octree != coherenceOctree || camera != coherenceCamera || drawShadows_ != coherenceDrawShadows ||
+        camera->ViewMask() != coherenceViewMask || octree->DrawableVersion() != coherenceDrawableVersion ||
+        SpatialNode::WorldTransformVersion() != coherenceTransformVersion)
+        return false;
+
+    // Occlusion data read back from the GPU keeps changing after the camera stops
+    if (occlusionMode == OCCLUSION_GPU)
+        return false;
+
+    return camera->ViewMatrix().Equals(coherenceView) && camera->ProjectionMatrix().Equals(coherenceProjection);
+}
+
+bool Renderer::AllocateShadowMap(LightDrawable* light, int faceSize, int minFaceSize)
+{
+    size_t index = light->GetLightType() == LIGHT_DIRECTIONAL ? 0 : 1;
+    ShadowMap& shadowMap = shadowMaps[index];
+
+    IntVector2 request = light->TotalShadowMapSize(faceSize);
+
+    // If light already has its preferred shadow rect from the previous frame, try to reallocate it for shadow map caching
+    IntRect oldRect = light->ShadowRect();
+    if (request.x == oldRect.Width() && request.y == oldRect.Height())
+    {
+        if (shadowMap.allocator.AllocateSpecific(oldRect))
+        {
+            light->SetShadowMap(shadowMaps[index].texture, light->ShadowRect());
+            return true;
+        }
+    }
+
+    minFaceSize = Max(Min(minFaceSize, faceSize), 1);
+
+    while (faceSize >= minFaceSize)
+    {
+        int x, y;
+        if (shadowMap.allocator.Allocate(request.x, request.y, x, y))
+        {
+            light->SetShadowMap(shadowMaps[index].texture, IntRect(x, y, x + request.x, y + request.y));
+            return true;
+        }
+
+        faceSize /= 2;
+        request = light->TotalShadowMapSize(faceSize);
+    }
+
+    // No room in atlas
+    light->SetShadowMap(nullptr);
+    return false;
+}
+
+void Renderer::AllocateLightShadowMaps()
+{
+    ZoneScoped;
+
+    shadowBudgetEntries.clear();
+
+    for (auto it = lights.begin(); it != lights.end(); ++it)
+    {
+        LightDrawable* light = *it;
+        if (!drawShadows || light->ShadowStrength() >= 1.0f)
+            continue;
+
+        ShadowBudgetEntry entry;
+        entry.light = light;
+        entry.priority = 0.0f;
+        entry.faceSize = light->ShadowMapSize();
+        shadowBudgetEntries.push_back(entry);
+    }
+
+    if (shadowBudget && shadowBudgetEntries.size())
+    {
+        const Texture* atlas = shadowMaps[1].texture;
+        size_t atlasArea = (size_t)atlas->Width() * (size_t)atlas->Height();
+        size_t usedArea = 0;
+
+        for (auto it = shadowBudgetEntries.begin(); it != shadowBudgetEntries.end(); ++it)
+        {
+            LightDrawable* light = it->light;
+
+            float pixels = LightScreenRadius(light);
+            it->priority = pixels * light->EffectiveColor().Average() * (1.0f - light->ShadowStrength());
+
+            // Shadow map faces larger than the projected light volume would not show more detail
+            int maxFaceSize = light->ShadowMapSize();
+            int faceSize = Min(Max((int)NextPowerOfTwo((unsigned)Min(2.0f * pixels, (float)maxFaceSize)), minShadowMapSize), maxFaceSize);
+
+            // Keep the previous size while within one step, so that the cached shadow map is not thrown away on small camera movements
+            if (light->ShadowRect() != IntRect::ZERO)
+            {
+                int oldFaceSize = light->ActualShadowMapSize();
+                if (oldFaceSize >= minShadowMapSize && oldFaceSize <= maxFaceSize && (oldFaceSize == faceSize * 2 || oldFaceSize * 2 == faceSize))
+                    faceSize = oldFaceSize;
+            }
+
+            it->faceSize = faceSize;
+            usedArea += ShadowMapArea(light, faceSize);
+        }
+
+        std::stable_sort(shadowBudgetEntries.begin(), shadowBudgetEntries.end(), CompareShadowBudgetEntries);
+
+        // If the atlas is overcommitted, shrink the least important lights to the minimum size first, then drop their shadows
+        for (auto it = shadowBudgetEntries.rbegin(); it != shadowBudgetEntries.rend() && usedArea > atlasArea; ++it)
+        {
+            while (it->faceSize > minShadowMapSize && usedArea > atlasArea)
+            {
+                usedArea -= ShadowMapArea(it->light, it->faceSize);
+                it->faceSize /= 2;
+                usedArea += ShadowMapArea(it->light, it->faceSize);
+            }
+        }
+
+        for (auto it = shadowBudgetEntries.rbegin(); it != shadowBudgetEntries.rend() && usedArea > atlasArea; ++it)
+        {
+            usedArea -= ShadowMapArea(it->light, it->faceSize);
+            it->faceSize = 0;
+        }
+    }
+
+    // Reallocate the shadow map rectangles that keep their size first, so that their cached content stays valid
+    for (auto it = shadowBudgetEntries.begin(); it != shadowBudgetEntries.end(); ++it)
     {
-        ShadowMap& shadowMap = shadowMaps[i];
-        if (shadowMap.shadowViews.empty())
-            continue;
+        if (HasShadowRect(it->light, it->faceSize))
+            AllocateShadowMap(it->light, it->faceSize, it->faceSize);
+    }
 
-        UpdateInstanceTransforms(shadowMap.instanceTransforms);
+    // Then allocate the rest in order. Without the budget, retry at most two smaller sizes
+    for (auto it = shadowBudgetEntries.begin(); it != shadowBudgetEntries.end(); ++it)
+    {
+        if (!it->faceSize)
+            it->light->SetShadowMap(nullptr);
+        else if (!HasShadowRect(it->light, it->faceSize))
+            AllocateShadowMap(it->light, it->faceSize, shadowBudget ? minShadowMapSize : it->faceSize / 4);
+    }
+}
 
-        shadowMap.fbo->Bind();
+void Renderer::SortMainBatches()
+{
+    ZoneScoped;
 
-        // First render static objects for those shadowmaps that need to store static objects. Do all of them to avoid FBO changes
-        for (size_t j = 0; j < shadowMap.shadowViews.size(); ++j)
+    // The per-thread results are read directly by the sort instead of being concatenated first
+    opaqueBatchRanges.clear();
+    alphaBatchRanges.clear();
+    for (auto it = batchResults.begin(); it != batchResults.end(); ++it)
+    {
+        BatchRange range;
+        if (it->opaqueBatches.size())
         {
-            ShadowView* view = shadowMap.shadowViews[j];
-            LightDrawable* light = view->light;
+            range.batches = &it->opaqueBatches[0];
+            range.count = it->opaqueBatches.size();
+            opaqueBatchRanges.push_back(range);
+        }
+        if (it->alphaBatches.size())
+        {
+            range.batches = &it->alphaBatches[0];
+            range.count = it->alphaBatches.size();
+            alphaBatchRanges.push_back(range);
+        }
+    }
 
-            if (view->renderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
-            {
-                graphics->Clear(false, true, view->viewport);
+    std::vector<IndirectDrawCommand>* commands = multiDraw ? &drawCommands : nullptr;
+    std::vector<Matrix3x4>* skinPalettes = hasInstancing ? &skinMatrices : nullptr;
+    const MeshletCullData* meshletCull = meshletCulling ? &meshletCullData : nullptr;
+    std::vector<Vector2>* staticIndices = staticInstanceTable ? &staticInstances : nullptr;
+    opaqueBatches.SortRanges(opaqueBatchRanges, instanceTransforms, SORT_STATE_AND_DISTANCE, hasInstancing, commands, workQueue, skinPalettes, meshletCull, staticIndices);
+    // Order-independent transparency does not need the back to front order, so the alpha batches can be state sorted and instanced too
+    alphaBatches.SortRanges(alphaBatchRanges, instanceTransforms, orderIndependent ? SORT_STATE : SORT_DISTANCE, hasInstancing, commands, workQueue, skinPalettes,
+        meshletCull, staticIndices);
 
-                BatchQueue& batchQueue = shadowMap.shadowBatches[view->staticQueueIdx];
-                if (batchQueue.HasBatches())
-                {
-                    graphics->SetViewport(view->viewport);
-                    graphics->SetDepthBias(light->DepthBias() * depthBiasMul, light->SlopeScaleBias() * slopeScaleBiasMul);
-                    RenderBatches(view->shadowCamera, batchQueue);
-                }
-            }
-        }
+    ThreadStats().sortedBatches += opaqueBatches.batches.size() + alphaBatches.batches.size();
+}
 
-        // Now do the shadowmap -> static shadowmap storage blits as necessary
-        for (size_t j = 0; j < shadowMap.shadowViews.size(); ++j)
-        {
-            ShadowView* view = shadowMap.shadowViews[j];
+void Renderer::SortShadowBatches(ShadowMap& shadowMap)
+{
+    ZoneScoped;
 
-            if (view->renderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
-                graphics->Blit(staticObjectShadowFbo, view->viewport, shadowMap.fbo, view->viewport, false, true, FILTER_POINT);
-        }
+    for (size_t i = 0; i < shadowMap.shadowViews.size(); ++i)
+    {
+        ShadowView& view = *shadowMap.shadowViews[i];
+        LightDrawable* light = view.light;
 
-        // Rebind shadowmap
-        shadowMap.fbo->Bind();
+        // Check if view was discarded during shadowcaster collecting
+        if (!light)
+            continue;
 
-        // First do all the clears or static shadowmap -> shadowmap blits
-        for (size_t j = 0; j < shadowMap.shadowViews.size(); ++j)
+        BatchQueue* destStatic = (view.renderMode == RENDER_STATIC_LIGHT_STORE_STATIC) ? &shadowMap.shadowBatches[view.staticQueueIdx] : nullptr;
+        BatchQueue* destDynamic = &shadowMap.shadowBatches[view.dynamicQueueIdx];
+
+        std::vector<IndirectDrawCommand>* commands = multiDraw ? &shadowMap.drawCommands : nullptr;
+        std::vector<Matrix3x4>* skinPalettes = hasInstancing ? &shadowMap.skinMatrices : nullptr;
+        std::vector<Vector2>* staticIndices = staticInstanceTable ? &shadowMap.staticInstances : nullptr;
+
+        if (destStatic && destStatic->HasBatches())
+            destStatic->Sort(shadowMap.instanceTransforms, SORT_STATE, hasInstancing, commands, workQueue, skinPalettes, nullptr, staticIndices);
+
+        if (destDynamic->HasBatches())
+            destDynamic->Sort(shadowMap.instanceTransforms, SORT_STATE, hasInstancing, commands, workQueue, skinPalettes, nullptr, staticIndices);
+
+        ThreadStats().sortedBatches += (destStatic ? destStatic->batches.size() : 0) + destDynamic->batches.size();
+    }
+}
+
+size_t Renderer::UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms)
+{
+    if (!hasInstancing || transforms.empty())
+        return 0;
+
+    return UpdateInstanceData(instanceVertexBuffer, instanceOverflow, instanceVertexElements, &transforms[0], transforms.size());
+}
+
+size_t Renderer::UpdateStaticInstances(const std::vector<Vector2>& indices)
+{
+    if (!staticInstanceTable || indices.empty())
+        return 0;
+
+    return UpdateInstanceData(staticInstanceBuffer, staticInstanceOverflow, staticInstanceElements, &indices[0], indices.size());
+}
+
+size_t Renderer::UpdateInstanceData(VertexBuffer* buffer, InstanceOverflow& overflow, const std::vector<VertexElement>& elements, const void* data, size_t numVertices)
+{
+    // With a persistently mapped buffer, each upload is appended to the frame's region without implicit synchronization
+    if (graphics->HasBufferStorage())
+    {
+        // The positions handed out earlier in the frame must stay valid, so the stream buffer is only redefined before the frame's first upload
+        unsigned frameNumber = graphics->FrameNumber();
+        if (overflow.frameNumber != frameNumber || !buffer->IsStream())
         {
-            ShadowView* view = shadowMap.shadowViews[j];
+            if (!buffer->IsStream() || overflow.frameVertices > buffer->NumVertices())
+                buffer->Define(USAGE_STREAM, Max(Max(numVertices, overflow.frameVertices), buffer->NumVertices() * 2), elements);
 
-            if (view->renderMode == RENDER_DYNAMIC_LIGHT)
-                graphics->Clear(false, true, view->viewport);
-            else if (view->renderMode == RENDER_STATIC_LIGHT_RESTORE_STATIC)
-                graphics->Blit(shadowMap.fbo, view->viewport, staticObjectShadowFbo, view->viewport, false, true, FILTER_POINT);
+            overflow.numVertices = 0;
+            overflow.frameVertices = 0;
+            overflow.frameNumber = frameNumber;
         }
 
-        // Finally render the dynamic objects
-        for (size_t j = 0; j < shadowMap.shadowViews.size(); ++j)
-        {
-            ShadowView* view = shadowMap.shadowViews[j];
-            LightDrawable* light = view->light;
+        overflow.frameVertices += numVertices;
 
-            if (view->renderMode != RENDER_STATIC_LIGHT_CACHED)
-            {
-                BatchQueue& batchQueue = shadowMap.shadowBatches[view->dynamicQueueIdx];
-                if (batchQueue.HasBatches())
-                {
-                    graphics->SetViewport(view->viewport);
-                    graphics->SetDepthBias(light->DepthBias() * depthBiasMul, light->SlopeScaleBias() * slopeScaleBiasMul);
-                    RenderBatches(view->shadowCamera, batchQueue);
-                }
-            }
+        size_t firstVertex;
+        if (buffer->StreamData(numVertices, data, firstVertex))
+            return firstVertex;
+
+        // Out of room in the region. Append to the overflow buffer, whose positions follow the stream buffer's regions
+        size_t start = overflow.numVertices;
+        size_t vertexSize = buffer->VertexSize();
+        overflow.numVertices += numVertices;
+        if (!overflow.buffer)
+            overflow.buffer = new VertexBuffer();
+
+        if (overflow.buffer->NumVertices() < overflow.numVertices)
+        {
+            // Growing replaces the buffer, so upload the frame's earlier overflow data along with the new
+            size_t capacity = Max(overflow.numVertices, overflow.buffer->NumVertices() * 2);
+            overflow.data.resize(capacity * vertexSize);
+            memcpy(&overflow.data[start * vertexSize], data, numVertices * vertexSize);
+            overflow.buffer->Define(USAGE_DYNAMIC, capacity, elements, &overflow.data[0]);
+        }
+        else
+        {
+            memcpy(&overflow.data[start * vertexSize], data, numVertices * vertexSize);
+            overflow.buffer->SetData(start, numVertices, &overflow.data[start * vertexSize], start == 0);
         }
+
+        return buffer->NumVertices() * NUM_STREAM_FRAMES + start;
     }
 
-    graphics->SetDepthBias(0.0f, 0.0f);
+    if (buffer->NumVertices() < numVertices || buffer->IsStream())
+        buffer->Define(USAGE_DYNAMIC, numVertices, elements, data);
+    else
+        buffer->SetData(0, numVertices, data);
+
+    return 0;
+}
+
+VertexBuffer* Renderer::InstanceSource(VertexBuffer* buffer, const InstanceOverflow& overflow, size_t& base) const
+{
+    if (!buffer || !buffer->IsStream())
+        return buffer;
+
+    size_t streamVertices = buffer->NumVertices() * NUM_STREAM_FRAMES;
+    if (base < streamVertices)
+        return buffer;
+
+    base -= streamVertices;
+    return overflow.buffer.Get();
 }
 
-void Renderer::RenderOpaque()
+void Renderer::UpdateStaticTransforms()
 {
     ZoneScoped;
 
-    // Update main batches' instance transforms & light data
-    UpdateInstanceTransforms(instanceTransforms);
-    ImageLevel clusterLevel(IntVector3(NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), FMT_RG32U, clusterData);
-    clusterTexture->SetData(0, IntBox(0, 0, 0, NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), clusterLevel);
-    lightDataBuffer->SetData(0, lights.size() * sizeof(LightData), lightData);
+    if (!staticInstanceTable || !octree)
+        return;
 
-    if (shadowMaps.size())
+    const std::vector<Matrix3x4>& transforms = octree->StaticTransforms();
+    unsigned start, end;
+    bool changed = octree->CollectStaticTransformChanges(start, end);
+    if (transforms.empty())
+        return;
+
+    int numRows = (int)((transforms.size() + STATIC_TRANSFORMS_PER_ROW - 1) / STATIC_TRANSFORMS_PER_ROW);
+    if (octree != staticTransformOctree || staticTransformTexture->Height() < numRows)
     {
-        shadowMaps[0].texture->Bind(TU_DIRLIGHTSHADOW);
-        shadowMaps[1].texture->Bind(TU_SHADOWATLAS);
-        faceSelectionTexture1->Bind(TU_FACESELECTION1);
-        faceSelectionTexture2->Bind(TU_FACESELECTION2);
+        // Full upload, which may grow the texture
+        SetTextureRows(staticTransformTexture, STATIC_TRANSFORMS_PER_ROW * 3, FMT_RGBA32F, &transforms[0], transforms.size() * 3);
+        staticTransformOctree = octree;
+    }
+    else if (changed)
+    {
+        // Upload the whole rows touched by the changed range
+        int firstRow = (int)(start / STATIC_TRANSFORMS_PER_ROW);
+        size_t firstEntry = (size_t)firstRow * STATIC_TRANSFORMS_PER_ROW;
+        SetTextureRows(staticTransformTexture, STATIC_TRANSFORMS_PER_ROW * 3, FMT_RGBA32F, &transforms[firstEntry], (end - firstEntry) * 3, firstRow);
     }
 
-    clusterTexture->Bind(TU_LIGHTCLUSTERDATA);
-    lightDataBuffer->Bind(UB_LIGHTDATA);
-
-    RenderBatches(camera, opaqueBatches);
+    staticTransformTexture->Bind(TU_STATICTRANSFORMS);
 }
 
-void Renderer::RenderAlpha()
+void Renderer::UpdateMaterialTable()
 {
     ZoneScoped;
 
-    if (shadowMaps.size())
+    if (!staticInstanceTable)
+        return;
+
+    if (Material::UniformVersion() != materialTableVersion)
     {
-        shadowMaps[0].texture->Bind(TU_DIRLIGHTSHADOW);
-        shadowMaps[1].texture->Bind(TU_SHADOWATLAS);
-        faceSelectionTexture1->Bind(TU_FACESELECTION1);
-        faceSelectionTexture2->Bind(TU_FACESELECTION2);
+        const std::set<Material*>& materials = Material::AllMaterials();
+        size_t numEntries = 1;
+        for (auto it = materials.begin(); it != materials.end(); ++it)
+        {
+            if ((*it)->Id() != ID_OVERFLOW)
+                numEntries = Max(numEntries, (size_t)(*it)->Id() + 1);
+        }
+
+        materialTableData.assign(numEntries * NUM_MATERIAL_UNIFORMS, Vector4::ZERO);
+        for (auto it = materials.begin(); it != materials.end(); ++it)
+        {
+            if ((*it)->Id() != ID_OVERFLOW)
+                (*it)->PackUniforms(&materialTableData[(*it)->Id() * NUM_MATERIAL_UNIFORMS]);
+        }
+
+        SetTextureRows(materialTableTexture, MATERIAL_TABLE_ENTRIES_PER_ROW * NUM_MATERIAL_UNIFORMS, FMT_RGBA32F, &materialTableData[0], materialTableData.size());
+        materialTableVersion = Material::UniformVersion();
     }
 
-    clusterTexture->Bind(TU_LIGHTCLUSTERDATA);
-    lightDataBuffer->Bind(UB_LIGHTDATA);
+    materialTableTexture->Bind(TU_MATERIALTABLE);
+}
+
+void Renderer::UpdateSkinMatrices(const std::vector<Matrix3x4>& matrices)
+{
+    if (!hasInstancing || matrices.empty())
+        return;
 
-    RenderBatches(camera, alphaBatches);
+    // Each matrix takes three texels, so that the palette can be copied in whole rows without rearranging
+    SetTextureRows(skinMatrixTexture, SKIN_MATRICES_PER_ROW * 3, FMT_RGBA32F, &matrices[0], matrices.size() * 3);
+    skinMatrixTexture->Bind(TU_SKINMATRICES);
 }
 
-void Renderer::RenderDebug()
+void Renderer::UpdateDrawCommands(const std::vector<IndirectDrawCommand>& commands)
+{
+    if (indirectBuffer && commands.size())
+    {
+        if (indirectBuffer->NumCommands() < commands.size())
+            indirectBuffer->Define(USAGE_DYNAMIC, commands.size(), &commands[0]);
+        else
+            indirectBuffer->SetData(0, commands.size(), &commands[0]);
+    }
+}
+
+void Renderer::UpdateViewData(bool buildClusters)
+{
+    // Update main batches' instance transforms & light data
+    mainInstanceBase = UpdateInstanceTransforms(preparedView.instanceTransforms);
+    mainStaticInstanceBase = UpdateStaticInstances(preparedView.staticInstances);
+    UpdateSkinMatrices(preparedView.skinMatrices);
+    UpdateDrawCommands(preparedView.drawCommands);
+
+    // Cull the GPU managed static geometries against the frustum and their draw distance into their draw commands, also against the occlusion depth of an earlier frame if available
+    if (preparedView.gpuCulling)
+    {
+        Texture* occlusionDepth = occlusionMode == OCCLUSION_GPU ? occlusionTexture.Get() : nullptr;
+        staticTransformTexture->Bind(TU_STATICTRANSFORMS);
+        gpuCuller.Cull(preparedView.mainView.perViewData.viewProjMatrix, occlusionDepth, occlusionViewProj);
+    }
+
+    if (preparedView.numLights)
+        SetTextureRows(lightDataTexture, LIGHTS_PER_ROW * LIGHT_DATA_TEXELS, FMT_RGBA32F, &preparedView.lightData[0], preparedView.numLights * LIGHT_DATA_TEXELS);
+    if (preparedView.numDecals)
+        SetTextureRows(decalDataTexture, DECALS_PER_ROW * DECAL_DATA_TEXELS, FMT_RGBA32F, &preparedView.decalData[0], preparedView.numDecals * DECAL_DATA_TEXELS);
+
+    if (computeClustering && buildClusters)
+        BuildLightClusters(nullptr);
+    else if (!computeClustering)
+    {
+        ImageLevel clusterLevel(clusterSize, FMT_RG32U, &preparedView.clusterRanges[0]);
+        clusterTexture->SetData(0, IntBox(0, 0, 0, clusterSize.x, clusterSize.y, clusterSize.z), clusterLevel);
+        // The index list has been padded to a whole number of texels
+        if (preparedView.lightIndices.size())
+            SetTextureRows(lightIndexTexture, LIGHT_INDEX_TEXTURE_WIDTH, FMT_R32U, &preparedView.lightIndices[0], preparedView.lightIndices.size() / 2);
+    }
+}
+
+void Renderer::FinishBatchTask()
+{
+    if (numPendingBatchTasks.fetch_add(-1) == 1 && pipelined)
+        SortMainBatches();
+}
+
+void Renderer::CaptureView()
 {
     ZoneScoped;
 
-    DebugRenderer* debug = Subsystem<DebugRenderer>();
-    if (!debug)
-        return;
+    // Swap batch queues and instance transforms, so that the next preparation reuses the previous capture's storage
+    preparedView.opaqueBatches.batches.swap(opaqueBatches.batches);
+    preparedView.alphaBatches.batches.swap(alphaBatches.batches);
+    preparedView.instanceTransforms.swap(instanceTransforms);
+    preparedView.staticInstances.swap(staticInstances);
+    preparedView.skinMatrices.swap(skinMatrices);
+    preparedView.drawCommands.swap(drawCommands);
+
+    preparedView.numLights = lights.size();
+    preparedView.lightData.assign(lightData.Get(), lightData.Get() + lights.size());
+    preparedView.clusterRanges.swap(clusterRanges);
+    preparedView.lightIndices.swap(lightIndices);
+    preparedView.numDecals = decals.size();
+    preparedView.decalData.assign(decalData.Get(), decalData.Get() + decals.size());
+
+    SetupRenderView(preparedView.mainView, camera, dirLight);
+    preparedView.mainView.perViewData.clusterSliceParameters = clusterSliceParameters;
+    if (virtualTexturing)
+    {
+        // Each frame writes the feedback of a different pixel in each block, so that all pixels are covered over time
+        unsigned jitter = (graphics->FrameNumber() * 37) % (VIRTUAL_FEEDBACK_SCALE * VIRTUAL_FEEDBACK_SCALE);
+        preparedView.mainView.perViewData.virtualTextureData = Vector4((float)(jitter % VIRTUAL_FEEDBACK_SCALE), (float)(jitter / VIRTUAL_FEEDBACK_SCALE),
+            (float)VIRTUAL_FEEDBACK_SCALE, 0.0f);
+    }
+    preparedView.stereo = stereo;
+    preparedView.orderIndependent = orderIndependent;
+    preparedView.gpuCulling = gpuCullingActive;
+    if (gpuCullingActive)
+        gpuCuller.Capture(camera);
+    if (stereo)
+    {
+        preparedView.mainView.programBits = SP_STEREO;
+        preparedView.stereoData = stereoData;
+    }
 
-    for (auto it = lights.begin(); it != lights.end(); ++it)
-        (*it)->OnRenderDebug(debug);
+    // In pipelined mode the scene will be modified before rendering, so copy the world transforms of non-instanced static batches
+    std::vector<Matrix3x4>* worldTransforms = nullptr;
+    if (pipelined)
+    {
+        worldTransforms = &preparedView.worldTransforms;
+        worldTransforms->clear();
+        worldTransforms->reserve(preparedView.opaqueBatches.batches.size() + preparedView.alphaBatches.batches.size());
+    }
 
-    for (auto it = octantResults.begin(); it != octantResults.end(); ++it)
+    PrepareBatchesForRender(preparedView.opaqueBatches, worldTransforms);
+    PrepareBatchesForRender(preparedView.alphaBatches, worldTransforms);
+    SplitVisibilityBatches();
+    // The scene may be modified before rendering, so upload the static transforms as they were during preparation
+    UpdateStaticTransforms();
+    UpdateMaterialTable();
+
+    for (size_t i = 0; i < 2; ++i)
     {
-        for (auto oIt = it->octants.begin(); oIt != it->octants.end(); ++oIt)
+        PreparedShadowMap& prepared = preparedView.shadowMaps[i];
+        prepared.views.clear();
+        prepared.cubeShadows.clear();
+
+        if (i >= shadowMaps.size())
+            continue;
+
+        ShadowMap& shadowMap = shadowMaps[i];
+        prepared.shadowBatches.swap(shadowMap.shadowBatches);
+        prepared.instanceTransforms.swap(shadowMap.instanceTransforms);
+        prepared.staticInstances.swap(shadowMap.staticInstances);
+        prepared.skinMatrices.swap(shadowMap.skinMatrices);
+        prepared.drawCommands.swap(shadowMap.drawCommands);
+
+        for (auto it = shadowMap.shadowViews.begin(); it != shadowMap.shadowViews.end(); ++it)
         {
-            Octant* octant = oIt->first;
-            octant->OnRenderDebug(debug);
+            ShadowView* view = *it;
+            LightDrawable* light = view->light;
+
+            // Check if view was discarded during shadowcaster collecting
+            if (!light)
+                continue;
 
-            for (auto dIt = octant->drawables.begin(); dIt != octant->drawables.end(); ++dIt)
+            prepared.views.push_back(ShadowRenderView());
+            ShadowRenderView& dest = prepared.views.back();
+            SetupRenderView(dest, view->shadowCamera, nullptr);
+            dest.viewport = view->viewport;
+            dest.renderMode = view->renderMode;
+            dest.staticQueueIdx = view->staticQueueIdx;
+            dest.dynamicQueueIdx = view->dynamicQueueIdx;
+            dest.depthBias = light->DepthBias() * depthBiasMul;
+            dest.slopeScaleBias = light->SlopeScaleBias() * slopeScaleBiasMul;
+            dest.cubeShadowIdx = -1;
+
+            // Capture the faces of a point light rendered in one pass
+            if (view->cubeFaceMask)
             {
-                Drawable* drawable = *dIt;
-                if (drawable->TestFlag(DF_GEOMETRY) && drawable->LastFrameNumber() == frameNumber)
-                    drawable->OnRenderDebug(debug);
+                const std::vector<ShadowView>& faceViews = light->ShadowViews();
+
+                dest.programBits = SP_CUBESHADOW;
+                dest.cubeShadowIdx = (int)prepared.cubeShadows.size();
+                prepared.cubeShadows.push_back(CubeShadowView());
+                CubeShadowView& cubeShadow = prepared.cubeShadows.back();
+                cubeShadow.uniforms.faceMask = view->cubeFaceMask;
+
+                for (size_t k = 0; k < faceViews.size(); ++k)
+                {
+                    Camera* faceCamera = faceViews[k].shadowCamera;
+                    cubeShadow.uniforms.faceViewProjMatrices[k] = faceCamera->ProjectionMatrix() * faceCamera->ViewMatrix();
+                    cubeShadow.faceViewports[k] = faceViews[k].viewport;
+                }
             }
         }
+
+        worldTransforms = nullptr;
+        if (pipelined)
+        {
+            size_t numBatches = 0;
+            for (size_t j = 0; j < shadowMap.freeQueueIdx; ++j)
+                numBatches += prepared.shadowBatches[j].batches.size();
+
+            worldTransforms = &prepared.worldTransforms;
+            worldTransforms->clear();
+            worldTransforms->reserve(numBatches);
+        }
+
+        for (size_t j = 0; j < shadowMap.freeQueueIdx; ++j)
+            PrepareBatchesForRender(prepared.shadowBatches[j], worldTransforms);
     }
+
+    CaptureSecondaryViews();
+
+    // Make the compute skinned vertices of the models and the simulated particles visible to the draws. Both statuses are reset
+    bool verticesSkinned = AnimatedModelDrawable::CheckVerticesSkinned();
+    if (ParticleEmitterDrawable::CheckParticlesSimulated() || verticesSkinned)
+        graphics->VertexDataBarrier();
+
+    lastView = nullptr;
 }
 
-Texture* Renderer::ShadowMapTexture(size_t index) const
+void Renderer::QueueSecondaryViews()
 {
-    return index < shadowMaps.size() ? shadowMaps[index].texture : nullptr;
+    pendingSecondaryViews.swap(requestedSecondaryViews);
+    requestedSecondaryViews.clear();
+
+    for (size_t i = 0; i < pendingSecondaryViews.size(); ++i)
+    {
+        SecondaryView* view = pendingSecondaryViews[i];
+        view->frustum = view->camera->WorldFrustum();
+        view->preparedViewMask = view->viewMask & view->camera->ViewMask();
+
+        if (collectSecondaryViewTasks.size() <= i)
+        {
+            // Secondary views are not needed until the main view has been rendered
+            collectSecondaryViewTasks.push_back(new CollectSecondaryViewTask(this, &Renderer::CollectSecondaryViewWork));
+            collectSecondaryViewTasks.back()->priority = TASK_LOW;
+        }
+
+        collectSecondaryViewTasks[i]->view = view;
+    }
+
+    if (pendingSecondaryViews.size())
+        workQueue->QueueTasks(pendingSecondaryViews.size(), reinterpret_cast<Task**>(&collectSecondaryViewTasks[0]));
 }
 
-void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& result, bool threaded, bool recursive, unsigned char planeMask)
+void Renderer::CaptureSecondaryViews()
 {
-    if (planeMask)
+    for (auto it = pendingSecondaryViews.begin(); it != pendingSecondaryViews.end(); ++it)
     {
-        planeMask = frustum.IsInsideMasked(octant->cullingBox, planeMask);
-        if (planeMask == 0xff)
-            return;
+        SecondaryView* view = *it;
+
+        view->preparedOpaqueBatches.batches.swap(view->opaqueBatches.batches);
+        view->preparedAlphaBatches.batches.swap(view->alphaBatches.batches);
+        view->preparedInstanceTransforms.swap(view->instanceTransforms);
+        view->preparedDrawCommands.swap(view->drawCommands);
+        view->preparedLightData.swap(view->lightData);
+
+        // Use the main view's directional light, and its shadow cascades if they were rendered
+        SetupRenderView(view->renderView, view->camera, dirLight);
+        if (view->shadowMode == SECONDARY_SHADOWS_NONE || !dirLight || !dirLight->ShadowMap())
+            view->renderView.perViewData.dirLightData[3] = Vector4::ONE;
+
+        std::vector<Matrix3x4>* worldTransforms = nullptr;
+        if (pipelined)
+        {
+            worldTransforms = &view->worldTransforms;
+            worldTransforms->clear();
+            worldTransforms->reserve(view->preparedOpaqueBatches.batches.size() + view->preparedAlphaBatches.batches.size());
+        }
+
+        PrepareBatchesForRender(view->preparedOpaqueBatches, worldTransforms);
+        PrepareBatchesForRender(view->preparedAlphaBatches, worldTransforms);
+
+        view->renderPending = true;
+        if (std::find(preparedSecondaryViews.begin(), preparedSecondaryViews.end(), *it) == preparedSecondaryViews.end())
+            preparedSecondaryViews.push_back(*it);
+    }
+
+    pendingSecondaryViews.clear();
+    lastView = nullptr;
+}
+
+void Renderer::SetupRenderView(RenderView& dest, Camera* camera_, LightDrawable* dirLight_)
+{
+    PerViewUniforms& perViewData = dest.perViewData;
+
+    perViewData.projectionMatrix = camera_->ProjectionMatrix();
+    perViewData.viewMatrix = camera_->ViewMatrix();
+    perViewData.viewProjMatrix = perViewData.projectionMatrix * perViewData.viewMatrix;
+    perViewData.depthParameters = Vector4(camera_->NearClip(), camera_->FarClip(), camera_->IsOrthographic() ? 0.5f : 0.0f, camera_->IsOrthographic() ? 0.5f : 1.0f / camera_->FarClip());
+    perViewData.clusterSliceParameters = Vector4::ZERO;
+    if (lightProbes && lightProbes->IsBaked())
+    {
+        for (size_t i = 0; i < 3; ++i)
+            perViewData.lightProbeData[i] = lightProbes->ShaderParameters()[i];
     }
+    else
+        perViewData.lightProbeData[0] = Vector4::ZERO;
 
-    for (auto it = octant->drawables.begin(); it != octant->drawables.end(); ++it)
+    perViewData.virtualTextureData = Vector4::ZERO;
+
+    dest.perViewDataSize = sizeof(Matrix3x4) + 2 * sizeof(Matrix4) + 11 * sizeof(Vector4);
+    dest.reverseCulling = camera_->UseReverseCulling();
+    dest.programBits = 0;
+
+    // Set the dir light parameters only in the main view
+    if (!dirLight_)
     {
-        Drawable* drawable = *it;
+        perViewData.dirLightData[0] = Vector4::ZERO;
+        perViewData.dirLightData[1] = Vector4::ZERO;
+        perViewData.dirLightData[3] = Vector4::ONE;
+    }
+    else
+    {
+        perViewData.dirLightData[0] = Vector4(-dirLight_->WorldDirection(), 0.0f);
+        perViewData.dirLightData[1] = dirLight_->GetColor().Data();
 
-        if (drawable->TestFlag(DF_LIGHT))
+        if (dirLight_->ShadowMap())
         {
-            if ((drawable->LayerMask() & viewMask) && (!planeMask || frustum.IsInsideMaskedFast(drawable->WorldBoundingBox(), planeMask)))
+            Vector4 cascadeSplits = dirLight_->ShadowCascadeSplits() / camera_->FarClip();
+            size_t numCascades = dirLight_->ShadowCascades();
+            float fadeStart = dirLight_->ShadowFadeStart() * cascadeSplits.w;
+
+            perViewData.dirLightData[2] = cascadeSplits;
+            perViewData.dirLightData[3] = dirLight_->ShadowParameters();
+            perViewData.dirLightData[4] = Vector4(fadeStart, 1.0f / (cascadeSplits.w - fadeStart), dirLight_->ShadowCascadeBlend(), (float)numCascades);
+            if (dirLight_->ShadowViews().size() >= numCascades)
             {
-                if (drawable->OnPrepareRender(frameNumber, camera))
-                {
-                    LightDrawable* light = static_cast<LightDrawable*>(drawable);
-                    result.lights.push_back(light);
-                }
+                for (size_t i = 0; i < numCascades; ++i)
+                    *reinterpret_cast<Matrix4*>(&perViewData.dirLightData[5 + i * 4]) = dirLight_->ShadowViews()[i].shadowMatrix;
+                dest.perViewDataSize += numCascades * 4 * sizeof(Vector4);
             }
         }
-        // Lights are sorted first in octants, so break when first geometry encountered. Store the octant for batch collecting
         else
+            perViewData.dirLightData[3] = Vector4::ONE;
+    }
+}
+
+/// Return whether a multi-draw batch has instances of other materials than the bound one, read from the material table.
+static bool HasMaterialTableInstances(const Batch& batch, const std::vector<IndirectDrawCommand>& drawCommands, const std::vector<Vector2>& staticInstances)
+{
+    for (unsigned i = 0; i < batch.instanceCount; ++i)
+    {
+        const IndirectDrawCommand& command = drawCommands[batch.instanceStart + i];
+        for (unsigned j = 0; j < command.instanceCount; ++j)
         {
-            result.octants.push_back(std::make_pair(octant, planeMask));
-            result.drawableAcc += octant->drawables.end() - it;
-            break;
+            if (staticInstances[command.baseInstance + j].y != 0.0f)
+                return true;
         }
     }
 
-    // Setup and queue batches collection task if over the drawable limit now. Note: if not threaded, defer to the end
-    if (threaded && result.drawableAcc >= DRAWABLES_PER_BATCH_TASK)
+    return false;
+}
+
+void Renderer::SplitVisibilityBatches()
+{
+    preparedView.visibilityBatches.Clear();
+    preparedView.visibilityBatchBins.clear();
+    preparedView.visibilityBins.clear();
+    preparedView.visibilityInstances.clear();
+    preparedView.visibilityBuffer = visibilityBuffer && !stereo && staticInstanceTable && multiDraw && graphics->HasComputeShaders();
+    if (!preparedView.visibilityBuffer)
+        return;
+
+    std::vector<Batch>& batches = preparedView.opaqueBatches.batches;
+    std::vector<VisibilityBin>& bins = preparedView.visibilityBins;
+    std::vector<IndirectDrawCommand>& drawCommands = preparedView.drawCommands;
+    std::vector<float>& instances = preparedView.visibilityInstances;
+    size_t dest = 0;
+
+    for (size_t i = 0; i < batches.size(); ++i)
     {
-        if (result.collectBatchesTasks.size() <= result.batchTaskIdx)
-            result.collectBatchesTasks.push_back(new CollectBatchesTask(this, &Renderer::CollectBatchesWork));
+        const Batch& batch = batches[i];
+        Pass* pass = batch.GetPass();
+        Geometry* geometry = batch.geometry;
+        VertexBuffer* vb = geometry->vertexBuffer;
+        IndexBuffer* ib = geometry->indexBuffer;
+        size_t binIndex = 0;
 
-        CollectBatchesTask* batchTask = result.collectBatchesTasks[result.batchTaskIdx];
-        batchTask->octants.clear();
-        batchTask->octants.insert(batchTask->octants.end(), result.octants.begin() + result.taskOctantIdx, result.octants.end());
-        processShadowCastersTask->AddDependency(batchTask);
-        numPendingBatchTasks.fetch_add(1);
-        workQueue->QueueTask(batchTask);
+        // The first triangle of each command is passed to the geometry pass as a float instance attribute, so it must be exact. The bins
+        // shade with the material's uniforms, so material instances read from the material table are left to the forward pass
+        if (batch.programBits == SP_STATICINSTANCED && vb && ib && ib->IndexSize() == sizeof(unsigned) && ib->NumIndices() / 3 <= (1 << 24) &&
+            !geometry->instanceBuffer && !HasMaterialTableInstances(batch, drawCommands, preparedView.staticInstances))
+        {
+            for (; binIndex < bins.size(); ++binIndex)
+            {
+                const VisibilityBin& bin = bins[binIndex];
+                if (bin.pass == pass && bin.vertexBuffer == vb && bin.indexBuffer == ib)
+                    break;
+            }
 
-        result.drawableAcc = 0;
-        result.taskOctantIdx = result.octants.size();
-        ++result.batchTaskIdx;
-    }
+            if (binIndex == bins.size() && bins.size() < MAX_VISIBILITY_BINS)
+            {
+                // The compute shading replicates the Diffuse and NoTexture shaders with the material's uniforms and opaque render state
+                Material* material = pass->Parent();
+                const std::string& shaderName = ResourceName(pass->GetShader());
+                bool diffuseMap = shaderName == "Shaders/Diffuse.glsl";
+                bool supported = (diffuseMap ? material->GetTexture(0) != nullptr : shaderName == "Shaders/NoTexture.glsl") &&
+                    !material->HasVirtualTextures() && pass->VSDefines().empty() && pass->FSDefines().empty() && material->VSDefines().empty() && material->FSDefines().empty() &&
+                    pass->GetBlendMode() == BLEND_REPLACE && pass->GetColorWrite() && pass->GetDepthWrite() &&
+                    (pass->GetDepthTest() == CMP_LESS || pass->GetDepthTest() == CMP_LESS_EQUAL);
+
+                // The vertices are read from a float array, so the attributes must be float aligned
+                size_t positionOffset = M_MAX_UNSIGNED;
+                size_t normalOffset = M_MAX_UNSIGNED;
+                size_t texCoordOffset = diffuseMap ? M_MAX_UNSIGNED : 0;
+                const std::vector<VertexElement>& elements = vb->Elements();
+                for (auto it = elements.begin(); it != elements.end(); ++it)
+                {
+                    if (it->semantic == SEM_POSITION && it->index == 0 && it->type == ELEM_VECTOR3)
+                        positionOffset = it->offset;
+                    else if (it->semantic == SEM_NORMAL && it->index == 0 && it->type == ELEM_VECTOR3)
+                        normalOffset = it->offset;
+                    else if (diffuseMap && it->semantic == SEM_TEXCOORD && it->index == 0 && it->type == ELEM_VECTOR2)
+                        texCoordOffset = it->offset;
+                }
+
+                if (supported && positionOffset == 0 && normalOffset != M_MAX_UNSIGNED && texCoordOffset != M_MAX_UNSIGNED &&
+                    !((vb->VertexSize() | normalOffset | texCoordOffset) & 3))
+                {
+                    VisibilityBin newBin;
+                    newBin.pass = pass;
+                    newBin.vertexBuffer = vb;
+                    newBin.indexBuffer = ib;
+                    newBin.parameters = Vector4((float)bins.size(), (float)(vb->VertexSize() / sizeof(float)), (float)(normalOffset / sizeof(float)),
+                        (float)(texCoordOffset / sizeof(float)));
+                    newBin.diffuseMap = diffuseMap;
+                    bins.push_back(newBin);
+                }
+                else
+                    binIndex = MAX_VISIBILITY_BINS;
+            }
+        }
+        else
+            binIndex = MAX_VISIBILITY_BINS;
+
+        if (binIndex < bins.size())
+        {
+            // The triangle counter of the geometry pass restarts for each command, and meshlet commands may share an instance, so copy
+            // the commands with instances of their own that also hold the command's first triangle
+            Batch visibilityBatch = batch;
+            visibilityBatch.instanceStart = (unsigned)drawCommands.size();
+            for (unsigned j = 0; j < batch.instanceCount; ++j)
+            {
+                IndirectDrawCommand command = drawCommands[batch.instanceStart + j];
+                unsigned staticInstanceStart = command.baseInstance;
+                command.baseInstance = (unsigned)(instances.size() / 2);
+                for (unsigned k = 0; k < command.instanceCount; ++k)
+                {
+                    instances.push_back(preparedView.staticInstances[staticInstanceStart + k].x);
+                    instances.push_back((float)(command.firstIndex / 3));
+                }
+                drawCommands.push_back(command);
+            }
 
-    if (recursive)
-    {
-        for (size_t i = 0; i < NUM_OCTANTS; ++i)
-        {
-            if (octant->children[i])
-                CollectOctantsAndLights(octant->children[i], result, threaded, true, planeMask);
+            preparedView.visibilityBatches.batches.push_back(visibilityBatch);
+            preparedView.visibilityBatchBins.push_back((unsigned char)binIndex);
         }
+        else
+            batches[dest++] = batch;
     }
+
+    batches.resize(dest);
 }
 
-bool Renderer::AllocateShadowMap(LightDrawable* light)
+void Renderer::PrepareBatchesForRender(BatchQueue& queue, std::vector<Matrix3x4>* worldTransforms)
 {
-    size_t index = light->GetLightType() == LIGHT_DIRECTIONAL ? 0 : 1;
-    ShadowMap& shadowMap = shadowMaps[index];
-
-    IntVector2 request = light->TotalShadowMapSize();
-
-    // If light already has its preferred shadow rect from the previous frame, try to reallocate it for shadow map caching
-    IntRect oldRect = light->ShadowRect();
-    if (request.x == oldRect.Width() && request.y == oldRect.Height())
+    for (auto it = queue.batches.begin(); it != queue.batches.end(); ++it)
     {
-        if (shadowMap.allocator.AllocateSpecific(oldRect))
+        Batch& batch = *it;
+        unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
+
+        // In multi-draw mode instanced batches stand for all the batches they combined
+        if (IsInstanced(geometryBits))
         {
-            light->SetShadowMap(shadowMaps[index].texture, light->ShadowRect());
-            return true;
+            if (!multiDraw)
+                it += batch.instanceCount - 1;
         }
-    }
-
-    IntRect shadowRect;
-    size_t retries = 3;
-
-    while (retries--)
-    {
-        int x, y;
-        if (shadowMap.allocator.Allocate(request.x, request.y, x, y))
+        else if (geometryBits)
+            batch.drawable->OnUpdateGPUData();
+        else if (worldTransforms)
         {
-            light->SetShadowMap(shadowMaps[index].texture, IntRect(x, y, x + request.x, y + request.y));
-            return true;
+            // Storage has been reserved in advance, so the pointer stays valid
+            worldTransforms->push_back(*batch.worldTransform);
+            batch.worldTransform = &worldTransforms->back();
         }
-
-        request.x /= 2;
-        request.y /= 2;
     }
-
-    // No room in atlas
-    light->SetShadowMap(nullptr);
-    return false;
 }
 
-void Renderer::SortMainBatches()
+void Renderer::RenderBatches(const RenderView& view, const BatchQueue& queue, size_t instanceBase, size_t staticInstanceBase, BatchDepthMode depthMode, bool deferred)
 {
     ZoneScoped;
 
-    for (auto it = batchResults.begin(); it != batchResults.end(); ++it)
+    if (&view != lastView)
     {
-        if (it->opaqueBatches.size())
-            opaqueBatches.batches.insert(opaqueBatches.batches.end(), it->opaqueBatches.begin(), it->opaqueBatches.end());
-        if (it->alphaBatches.size())
-            alphaBatches.batches.insert(alphaBatches.batches.end(), it->alphaBatches.begin(), it->alphaBatches.end());
+        perViewDataBuffer->SetData(0, view.perViewDataSize, &view.perViewData);
+        lastView = &view;
     }
 
-    opaqueBatches.Sort(instanceTransforms, SORT_STATE_AND_DISTANCE, hasInstancing);
-    alphaBatches.Sort(instanceTransforms, SORT_DISTANCE, hasInstancing);
-}
+    perViewDataBuffer->Bind(UB_PERVIEWDATA);
 
-void Renderer::SortShadowBatches(ShadowMap& shadowMap)
-{
-    ZoneScoped;
+    size_t numBatches = queue.batches.size();
+    if (!numBatches)
+        return;
 
-    for (size_t i = 0; i < shadowMap.shadowViews.size(); ++i)
+    // Split into segments, which must not start inside the batches consumed by instancing
+    size_t numSegments = Min(numBatches / MIN_COMMAND_SEGMENT_SIZE, (size_t)workQueue->NumThreads());
+    commandSegmentStarts.clear();
+    commandSegmentStarts.push_back(0);
+    if (numSegments > 1)
     {
-        ShadowView& view = *shadowMap.shadowViews[i];
-        LightDrawable* light = view.light;
-
-        // Check if view was discarded during shadowcaster collecting
-        if (!light)
-            continue;
-
-        BatchQueue* destStatic = (view.renderMode == RENDER_STATIC_LIGHT_STORE_STATIC) ? &shadowMap.shadowBatches[view.staticQueueIdx] : nullptr;
-        BatchQueue* destDynamic = &shadowMap.shadowBatches[view.dynamicQueueIdx];
+        size_t segmentSize = (numBatches + numSegments - 1) / numSegments;
+        size_t nextStart = segmentSize;
 
-        if (destStatic && destStatic->HasBatches())
-            destStatic->Sort(shadowMap.instanceTransforms, SORT_STATE, hasInstancing);
+        for (size_t i = 0; i < numBatches;)
+        {
+            if (i >= nextStart)
+            {
+                commandSegmentStarts.push_back(i);
+                nextStart = i + segmentSize;
+            }
 
-        if (destDynamic->HasBatches())
-            destDynamic->Sort(shadowMap.instanceTransforms, SORT_STATE, hasInstancing);
+            const Batch& batch = queue.batches[i];
+            i += (IsInstanced(batch.programBits & SP_GEOMETRYBITS) && !multiDraw) ? batch.instanceCount : 1;
+        }
     }
-}
+    commandSegmentStarts.push_back(numBatches);
 
-void Renderer::UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms)
-{
-    if (hasInstancing && transforms.size())
+    numSegments = commandSegmentStarts.size() - 1;
+    if (renderCommands.size() < numSegments)
+        renderCommands.resize(numSegments);
+
+    if (numSegments > 1)
     {
-        if (instanceVertexBuffer->NumVertices() < transforms.size())
-            instanceVertexBuffer->Define(USAGE_DYNAMIC, transforms.size(), instanceVertexElements, &transforms[0]);
-        else
-            instanceVertexBuffer->SetData(0, transforms.size(), &transforms[0]);
+        workQueue->ParallelFor(0, numSegments, 1, [&](size_t start, size_t end, unsigned)
+        {
+            for (size_t i = start; i < end; ++i)
+                RecordCommands(view, queue, commandSegmentStarts[i], commandSegmentStarts[i + 1], depthMode, deferred, renderCommands[i]);
+        });
     }
+    else
+        RecordCommands(view, queue, 0, numBatches, depthMode, deferred, renderCommands[0]);
+
+    lastMaterial = nullptr;
+
+    for (size_t i = 0; i < numSegments; ++i)
+        ReplayCommands(renderCommands[i], instanceBase, staticInstanceBase);
 }
 
-void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
+void Renderer::RecordCommands(const RenderView& view, const BatchQueue& queue, size_t start, size_t end, BatchDepthMode depthMode, bool deferred, RenderCommandList& dest) const
 {
     ZoneScoped;
 
-    lastMaterial = nullptr;
-    lastPass = nullptr;
+    dest.clear();
+
+    Pass* lastPass = nullptr;
+    Material* lastMaterial = nullptr;
+    unsigned char lastProgramBits = 0;
+    RenderCommand command = RenderCommand();
+    unsigned numInstanced = 0;
+    unsigned numNonInstanced = 0;
 
-    if (camera_ != lastCamera)
+    for (size_t i = start; i < end; ++i)
     {
-        perViewData.projectionMatrix = camera_->ProjectionMatrix();
-        perViewData.viewMatrix = camera_->ViewMatrix();
-        perViewData.viewProjMatrix = perViewData.projectionMatrix * perViewData.viewMatrix;
-        perViewData.depthParameters = Vector4(camera_->NearClip(), camera_->FarClip(), camera_->IsOrthographic() ? 0.5f : 0.0f, camera_->IsOrthographic() ? 0.5f : 1.0f / camera_->FarClip());
+        const Batch& batch = queue.batches[i];
+        unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
 
-        size_t dataSize = sizeof(Matrix3x4) + 2 * sizeof(Matrix4) + 5 * sizeof(Vector4);
+        Pass* pass = batch.GetPass();
+        if (depthMode == DEPTH_PREPASS)
+            pass = pass->Parent()->GetPass(PASS_DEPTH);
+        else if ((depthMode == DEPTH_OIT || depthMode == DEPTH_OITEXCLUDED) && pass->IsOrderIndependent() != (depthMode == DEPTH_OIT))
+            pass = nullptr;
 
-        // Set the dir light parameters only in the main view
-        if (!dirLight || camera_ != camera)
+        if (!pass)
         {
-            perViewData.dirLightData[0] = Vector4::ZERO;
-            perViewData.dirLightData[1] = Vector4::ZERO;
-            perViewData.dirLightData[3] = Vector4::ONE;
+            if (IsInstanced(geometryBits) && !multiDraw)
+                i += batch.instanceCount - 1;
+            continue;
         }
-        else
+
+        unsigned char programBits = batch.programBits | view.programBits;
+        if (deferred)
+            programBits |= SP_DEFERRED;
+        else if (depthMode == DEPTH_OIT)
+            programBits |= SP_OIT;
+        if (momentShadows && depthMode != DEPTH_PREPASS)
+            programBits |= SP_MOMENTSHADOW;
+        if (pass != lastPass || programBits != lastProgramBits)
         {
-            perViewData.dirLightData[0] = Vector4(-dirLight->WorldDirection(), 0.0f);
-            perViewData.dirLightData[1] = dirLight->GetColor().Data();
+            Material* material = pass->Parent();
+            if (material != lastMaterial)
+            {
+                command.type = RCMD_MATERIAL;
+                command.material = material;
+                dest.push_back(command);
+
+                lastMaterial = material;
+            }
 
-            if (dirLight->ShadowMap())
+            unsigned char variant = view.reverseCulling ? PV_REVERSECULLING : 0;
+            CompareMode depthTest = pass->GetDepthTest();
+            if (depthMode == DEPTH_AFTERPREPASS && pass->GetDepthWrite() && (depthTest == CMP_LESS || depthTest == CMP_LESS_EQUAL) && material->GetPass(PASS_DEPTH))
+                variant |= PV_AFTERPREPASS;
+
+            // Pipeline states can only be created on the main thread, so leave the ones missing for playback
+            PipelineState* pipeline = pass->FindPipelineState(programBits, variant);
+            command.programBits = programBits;
+            command.variant = variant;
+            if (pipeline)
             {
-                Vector2 cascadeSplits = dirLight->ShadowCascadeSplits();
-                float farClip = camera->FarClip();
-                float firstSplit = cascadeSplits.x / farClip;
-                float secondSplit = cascadeSplits.y / farClip;
-
-                perViewData.dirLightData[2] = Vector4(firstSplit, secondSplit, dirLight->ShadowFadeStart() * secondSplit, 1.0f / (secondSplit - dirLight->ShadowFadeStart() * secondSplit));
-                perViewData.dirLightData[3] = dirLight->ShadowParameters();
-                if (dirLight->ShadowViews().size() >= 2)
-                {
-                    *reinterpret_cast<Matrix4*>(&perViewData.dirLightData[4]) = dirLight->ShadowViews()[0].shadowMatrix;
-                    *reinterpret_cast<Matrix4*>(&perViewData.dirLightData[8]) = dirLight->ShadowViews()[1].shadowMatrix;
-                    dataSize += 8 * sizeof(Vector4);
-                }
+                command.type = RCMD_PIPELINE;
+                command.pipeline = pipeline;
+            }
+            else
+            {
+                command.type = RCMD_PASSPIPELINE;
+                command.pass = pass;
             }
+            dest.push_back(command);
+
+            lastPass = pass;
+            lastProgramBits = programBits;
+        }
+
+        if (IsInstanced(geometryBits))
+        {
+            // Skinned instances refer to their palettes, so they are always drawn with regular instancing. GPU culled batches draw the commands written by culling
+            if (batch.staticIndex == GPU_CULLED_INDEX)
+                command.type = RCMD_GPUMULTIDRAW;
             else
-                perViewData.dirLightData[3] = Vector4::ONE;
+                command.type = (multiDraw && geometryBits != GEOM_SKINNED_INSTANCED) ? RCMD_MULTIDRAW : RCMD_DRAWINSTANCED;
+            command.geometry = batch.geometry;
+            command.start = batch.instanceStart;
+            command.count = batch.instanceCount;
+            dest.push_back(command);
+            ++numInstanced;
+
+            if (!multiDraw)
+                i += batch.instanceCount - 1;
         }
+        else
+        {
+            if (!geometryBits)
+            {
+                command.type = RCMD_WORLDTRANSFORM;
+                command.worldTransform = batch.worldTransform;
+            }
+            else
+            {
+                command.type = RCMD_DRAWABLE;
+                command.drawable = batch.drawable;
+                command.start = batch.geomIndex;
+            }
+            dest.push_back(command);
 
-        perViewDataBuffer->SetData(0, dataSize, &perViewData);
+            if (batch.programBits & SP_LODFADE)
+            {
+                command.type = RCMD_LODFADE;
+                command.lodFade = batch.lodFade;
+                dest.push_back(command);
+            }
 
-        lastCamera = camera_;
+            command.type = RCMD_DRAW;
+            command.geometry = batch.geometry;
+            dest.push_back(command);
+            ++numNonInstanced;
+        }
     }
 
-    perViewDataBuffer->Bind(UB_PERVIEWDATA);
+    RenderStats& threadStats = ThreadStats();
+    threadStats.instancedBatches += numInstanced;
+    threadStats.nonInstancedBatches += numNonInstanced;
+}
 
-    for (auto it = queue.batches.begin(); it != queue.batches.end(); ++it)
-    {
-        const Batch& batch = *it;
-        unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
+void Renderer::ReplayCommands(const RenderCommandList& commands, size_t instanceBase, size_t staticInstanceBase)
+{
+    ZoneScoped;
 
-        ShaderProgram* program = batch.pass->GetShaderProgram(batch.programBits);
-        if (!program->Bind())
-            continue;
+    ShaderProgram* program = nullptr;
+
+    for (auto it = commands.begin(); it != commands.end(); ++it)
+    {
+        const RenderCommand& command = *it;
 
-        Material* material = batch.pass->Parent();
-        if (batch.pass != lastPass)
+        switch (command.type)
         {
-            if (material != lastMaterial)
+        case RCMD_PIPELINE:
+        case RCMD_PASSPIPELINE:
             {
-                for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+                PipelineState* pipeline = command.type == RCMD_PIPELINE ? command.pipeline : command.pass->GetPipelineState(command.programBits, command.variant);
+                // Skip the draws until the next pipeline state if binding fails
+                program = graphics->SetPipelineState(pipeline) ? pipeline->Program() : nullptr;
+            }
+            break;
+
+        case RCMD_MATERIAL:
+            if (command.material != lastMaterial)
+            {
+                if (!bindlessTextures)
                 {
-                    Texture* texture = material->GetTexture(i);
-                    if (texture)
-                        texture->Bind(i);
+                    for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+                    {
+                        Texture* texture = command.material->GetTexture(i);
+                        if (texture)
+                            texture->Bind(i);
+                    }
                 }
 
-                lastMaterial = material;
+                if (command.material->HasVirtualTextures())
+                {
+                    for (size_t i = 0; i < MAX_VIRTUAL_TEXTURE_UNITS; ++i)
+                    {
+                        VirtualTexture* texture = command.material->GetVirtualTexture(i);
+                        if (texture && texture->PageTableTexture())
+                            texture->PageTableTexture()->Bind(TU_VIRTUALPAGETABLE + i);
+                    }
+                }
+
+                command.material->GetUniformBuffer()->Bind(UB_MATERIALDATA);
+
+                lastMaterial = command.material;
                 ++lastPerMaterialUniforms;
                 if (!lastPerMaterialUniforms)
                     ++lastPerMaterialUniforms;
             }
+            break;
+
+        case RCMD_WORLDTRANSFORM:
+            graphics->SetUniform(program, U_WORLDMATRIX, *command.worldTransform);
+            break;
 
-            CullMode cullMode = material->GetCullMode();
-            if (camera_->UseReverseCulling())
+        case RCMD_LODFADE:
+            graphics->SetUniform(program, U_LODFADE, command.lodFade);
+            break;
+
+        case RCMD_DRAWABLE:
+            if (program)
+                command.drawable->OnRender(program, command.start);
+            break;
+
+        default:
             {
-                if (cullMode == CULL_BACK)
-                    cullMode = CULL_FRONT;
-                else if (cullMode == CULL_FRONT)
-                    cullMode = CULL_BACK;
-            }
+                if (!program)
+                    break;
+
+                if (program->lastPerMaterialUniforms != lastPerMaterialUniforms)
+                {
+                    // Material textures are assigned as handles, or the samplers returned to their texture units if bindless mode has been disabled
+                    if (bindlessTextures || program->bindlessSamplers)
+                    {
+                        for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+                            graphics->SetBindlessTexture(program, i, bindlessTextures ? lastMaterial->GetTexture(i) : nullptr);
+                        program->bindlessSamplers = bindlessTextures;
+                    }
 
-            graphics->SetRenderState(batch.pass->GetBlendMode(), cullMode, batch.pass->GetDepthTest(), batch.pass->GetColorWrite(), batch.pass->GetDepthWrite());
+                    program->lastPerMaterialUniforms = lastPerMaterialUniforms;
+                }
 
-            lastPass = batch.pass;
+                Geometry* geometry = command.geometry;
+                IndexBuffer* ib = geometry->indexBuffer;
+                VertexBuffer* vb = geometry->vertexBuffer;
+                // Fetch from the position-only buffer if the program reads nothing else from the geometry, as in shadow and depth passes
+                if (geometry->positionBuffer && !(program->Attributes() & vb->Attributes() & ~geometry->positionBuffer->Attributes()))
+                    vb = geometry->positionBuffer;
+                VertexBuffer* ownInstances = geometry->instanceBuffer;
+                vb->BindVertexArray(program->Attributes(), ib, command.type != RCMD_DRAW || ownInstances);
+
+                // Batches instanced from the static transform table read only the table index per instance
+                bool staticInstanced = (command.programBits & SP_GEOMETRYBITS) == GEOM_STATIC_INSTANCED;
+                size_t base = staticInstanced ? staticInstanceBase : instanceBase;
+                VertexBuffer* instanceBuffer = staticInstanced ? InstanceSource(staticInstanceBuffer, staticInstanceOverflow, base) :
+                    InstanceSource(instanceVertexBuffer, instanceOverflow, base);
+
+                if (command.type == RCMD_GPUMULTIDRAW)
+                    graphics->MultiDrawIndexedIndirect(PT_TRIANGLE_LIST, gpuCuller.InstanceBuffer(), 0, gpuCuller.CommandBuffer(), command.start, command.count);
+                else if (command.type == RCMD_MULTIDRAW)
+                    graphics->MultiDrawIndexedIndirect(PT_TRIANGLE_LIST, instanceBuffer, base, indirectBuffer, command.start, command.count);
+                else if (command.type == RCMD_DRAWINSTANCED)
+                {
+                    if (ib)
+                        graphics->DrawIndexedInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceBuffer, base + command.start, command.count);
+                    else
+                        graphics->DrawInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceBuffer, base + command.start, command.count);
+                }
+                else if (ownInstances)
+                {
+                    // The geometry's own instance data, such as particle states, is drawn whole unless a count is given
+                    size_t numInstances = geometry->instanceCount ? geometry->instanceCount : ownInstances->NumVertices();
+                    if (ib)
+                        graphics->DrawIndexedInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, ownInstances, 0, numInstances);
+                    else
+                        graphics->DrawInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, ownInstances, 0, numInstances);
+                }
+                else
+                {
+                    if (ib)
+                        graphics->DrawIndexed(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount);
+                    else
+                        graphics->Draw(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount);
+                }
+            }
+            break;
         }
+    }
+}
 
-        if (program->lastPerMaterialUniforms != lastPerMaterialUniforms)
-        {
-            const std::map<PresetUniform, Vector4>& uniformValues = material->UniformValues();
-            for (auto uIt = uniformValues.begin(); uIt != uniformValues.end(); ++uIt)
-                graphics->SetUniform(program, uIt->first, uIt->second);
+bool Renderer::ReadFrameCapture(Stream& source)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
 
-            program->lastPerMaterialUniforms = lastPerMaterialUniforms;
-        }
+    std::vector<Material*> materials(source.ReadVLE());
+    for (size_t i = 0; i < materials.size(); ++i)
+    {
+        std::string name = source.Read<std::string>();
+        materials[i] = name.empty() ? Material::DefaultMaterial() : cache ? cache->LoadResource<Material>(name) : nullptr;
+        if (!materials[i])
+            return false;
+        captureResources.push_back(SharedPtr<Resource>(materials[i]));
+    }
 
-        Geometry* geometry = batch.geometry;
-        VertexBuffer* vb = geometry->vertexBuffer;
-        IndexBuffer* ib = geometry->indexBuffer;
-        vb->Bind(program->Attributes());
-        if (ib)
-            ib->Bind();
+    std::vector<Model*> models(source.ReadVLE());
+    for (size_t i = 0; i < models.size(); ++i)
+    {
+        std::string name = source.Read<std::string>();
+        models[i] = cache ? cache->LoadResource<Model>(name) : nullptr;
+        if (!models[i])
+            return false;
+        captureResources.push_back(SharedPtr<Resource>(models[i]));
+    }
+
+    std::vector<Geometry*> geometries(source.ReadVLE());
+    for (size_t i = 0; i < geometries.size(); ++i)
+    {
+        size_t modelIdx = source.ReadVLE();
+        size_t index = source.ReadVLE();
+        size_t lodLevel = source.ReadVLE();
 
-        if (geometryBits == GEOM_INSTANCED)
+        geometries[i] = modelIdx < models.size() ? models[modelIdx]->GetGeometry(index, lodLevel) : nullptr;
+        if (!geometries[i])
         {
-            if (ib)
-                graphics->DrawIndexedInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceVertexBuffer, batch.instanceStart, batch.instanceCount);
-            else
-                graphics->DrawInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceVertexBuffer, batch.instanceStart, batch.instanceCount);
+            LOGERROR("Frame capture refers to a missing geometry, the model loading settings may differ");
+            return false;
+        }
+    }
+
+    ReadCaptureView(source, preparedView.mainView);
+    // The light probes are not captured, so the replay is lit without them
+    preparedView.mainView.perViewData.lightProbeData[0] = Vector4::ZERO;
+    // Nor is the virtual texture feedback written
+    preparedView.mainView.perViewData.virtualTextureData = Vector4::ZERO;
+    // The eye matrices of a stereo view are not captured, so it is replayed through the camera that enclosed both eyes
+    preparedView.mainView.programBits &= ~SP_STEREO;
+    preparedView.stereo = false;
+    preparedView.orderIndependent = false;
+    preparedView.gpuCulling = false;
+    preparedView.visibilityBatches.Clear();
+    preparedView.visibilityBatchBins.clear();
+    preparedView.visibilityBins.clear();
+    preparedView.visibilityInstances.clear();
+    preparedView.visibilityBuffer = false;
+    if (!ReadCaptureVector(source, preparedView.worldTransforms) ||
+        !ReadCaptureBatches(source, preparedView.opaqueBatches, multiDraw, materials, geometries, preparedView.worldTransforms) ||
+        !ReadCaptureBatches(source, preparedView.alphaBatches, multiDraw, materials, geometries, preparedView.worldTransforms) ||
+        !ReadCaptureVector(source, preparedView.instanceTransforms) ||
+        !ReadCaptureVector(source, preparedView.skinMatrices) ||
+        !ReadCaptureVector(source, preparedView.drawCommands))
+        return false;
+
+    preparedView.staticInstances.clear();
+    preparedView.numLights = source.ReadVLE();
+    preparedView.numDecals = 0;
+    if (!ReadCaptureVector(source, preparedView.lightData) || !ReadCaptureVector(source, preparedView.clusterRanges) ||
+        !ReadCaptureVector(source, preparedView.lightIndices))
+        return false;
+    if (preparedView.numLights > preparedView.lightData.size() || preparedView.numLights > maxLights || preparedView.clusterRanges.size() != numClusters * 2)
+        return false;
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        PreparedShadowMap& prepared = preparedView.shadowMaps[i];
+
+        prepared.views.resize(source.ReadVLE());
+        if (prepared.views.size() && i >= shadowMaps.size())
+            return false;
 
-            it += batch.instanceCount - 1;
+        for (auto it = prepared.views.begin(); it != prepared.views.end(); ++it)
+        {
+            ShadowRenderView& view = *it;
+            ReadCaptureView(source, view);
+            view.viewport = source.Read<IntRect>();
+            view.renderMode = (ShadowRenderMode)source.Read<unsigned char>();
+            view.staticQueueIdx = source.ReadVLE();
+            view.dynamicQueueIdx = source.ReadVLE();
+            view.depthBias = source.Read<float>();
+            view.slopeScaleBias = source.Read<float>();
+            view.cubeShadowIdx = source.Read<int>();
         }
-        else
+
+        if (!ReadCaptureVector(source, prepared.cubeShadows) || !ReadCaptureVector(source, prepared.worldTransforms))
+            return false;
+
+        prepared.shadowBatches.resize(source.ReadVLE());
+        for (auto it = prepared.shadowBatches.begin(); it != prepared.shadowBatches.end(); ++it)
         {
-            if (!geometryBits)
-                graphics->SetUniform(program, U_WORLDMATRIX, *batch.worldTransform);
-            else
-                batch.drawable->OnRender(program, batch.geomIndex);
+            if (!ReadCaptureBatches(source, *it, multiDraw, materials, geometries, prepared.worldTransforms))
+                return false;
+        }
 
-            if (ib)
-                graphics->DrawIndexed(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount);
-            else
-                graphics->Draw(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount);
+        if (!ReadCaptureVector(source, prepared.instanceTransforms) || !ReadCaptureVector(source, prepared.skinMatrices) ||
+            !ReadCaptureVector(source, prepared.drawCommands))
+            return false;
+        prepared.staticInstances.clear();
+
+        // The static queue index is only valid when storing the static casters
+        for (auto it = prepared.views.begin(); it != prepared.views.end(); ++it)
+        {
+            if ((it->renderMode == RENDER_STATIC_LIGHT_STORE_STATIC && it->staticQueueIdx >= prepared.shadowBatches.size()) ||
+                it->dynamicQueueIdx >= prepared.shadowBatches.size() || it->cubeShadowIdx >= (int)prepared.cubeShadows.size())
+                return false;
         }
     }
+
+    return true;
 }
 
 void Renderer::DefineFaceSelectionTextures()
@@ -749,10 +3975,87 @@ void Renderer::DefineFaceSelectionTextures()
     faceSelectionTexture2->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
 }
 
+void Renderer::DefineLightClusters()
+{
+    numClusters = (size_t)clusterSize.x * clusterSize.y * clusterSize.z;
+    clusterFrustums = new Frustum[numClusters];
+    clusterPacksPerRow = (clusterSize.x + BOUNDING_BOX_PACK_SIZE - 1) / BOUNDING_BOX_PACK_SIZE;
+    clusterBoxPacks.resize(clusterPacksPerRow * clusterSize.y * clusterSize.z);
+    clusterColumnPlanes.resize(clusterSize.x * 2);
+    clusterRowPlanes.resize(clusterSize.y * 2);
+    numClusterLights = new unsigned short[numClusters];
+    clusterLights = new unsigned short[numClusters * maxLightsPerCluster];
+    lightData = new LightData[maxLights];
+    numClusterDecals = new unsigned short[numClusters];
+    clusterDecals = new unsigned short[numClusters * maxDecalsPerCluster];
+    decalData = new DecalData[maxDecals];
+    clusterFrustumsDirty = true;
+
+    clusterRanges.assign(numClusters * 2, 0);
+    lightIndices.clear();
+    preparedView.clusterRanges.assign(numClusters * 2, 0);
+    preparedView.lightIndices.clear();
+
+    clusterTexture->Define(TEX_3D, clusterSize, FMT_RG32U, 1);
+    clusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+    // The compute shader gives each cluster a fixed range of the light index list, rounded up to whole texels
+    if (computeClustering)
+    {
+        size_t numIndexTexels = numClusters * ((maxLightsPerCluster + 1) & ~(size_t)1) / 2;
+        int numRows = (int)((numIndexTexels + LIGHT_INDEX_TEXTURE_WIDTH - 1) / LIGHT_INDEX_TEXTURE_WIDTH);
+        lightIndexTexture->Define(TEX_2D, IntVector2(LIGHT_INDEX_TEXTURE_WIDTH, numRows), FMT_R32U);
+        lightIndexTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+        clusterBoundsTexture->Define(TEX_2D, IntVector2(clusterSize.x, clusterSize.y), FMT_R32U);
+        clusterBoundsTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+    }
+}
+
+void Renderer::DefineClusterSlices()
+{
+    clusterSliceParameters = Vector4::ZERO;
+    if (!adaptiveClusterSlices)
+        return;
+
+    float cameraNearClip = camera->NearClip();
+    float cameraFarClip = camera->FarClip();
+    float sliceMinZ = minZ;
+    float sliceMaxZ = Min(maxZ, cameraFarClip);
+    if (sliceMinZ >= sliceMaxZ)
+    {
+        sliceMinZ = cameraNearClip;
+        sliceMaxZ = cameraFarClip;
+    }
+
+    // Use a separate near slice only when the split distance divides the geometry depth range
+    int numSlices = clusterSize.z;
+    int nearSlices = (numSlices > 1 && clusterNearSplit > sliceMinZ && clusterNearSplit < sliceMaxZ) ? 1 : 0;
+    float start = (nearSlices ? clusterNearSplit : sliceMinZ) / cameraFarClip;
+    float end = Max(sliceMaxZ / cameraFarClip, start * 1.001f);
+    float logRange = log2f(end / start);
+
+    // The slice texture coordinate is log2(depth) * scale + bias, with depth relative to the far clip distance as in the shaders
+    float scale = (float)(numSlices - nearSlices) / (numSlices * logRange);
+    float bias = (nearSlices - (numSlices - nearSlices) * log2f(start) / logRange) / numSlices;
+    clusterSliceParameters = Vector4(scale, bias, 1.0f, 0.0f);
+}
+
+float Renderer::ClusterSliceZ(size_t slice) const
+{
+    if (!slice)
+        return camera->NearClip();
+
+    float coord = (float)slice / clusterSize.z;
+    if (clusterSliceParameters.z > 0.0f)
+        return exp2f((coord - clusterSliceParameters.y) / clusterSliceParameters.x) * camera->FarClip();
+    else
+        return coord * coord * camera->FarClip();
+}
+
 void Renderer::DefineClusterFrustums()
 {
     Matrix4 cameraProj = camera->ProjectionMatrix(false);
-    if (lastClusterFrustumProj != cameraProj)
+    if (lastClusterFrustumProj != cameraProj || lastClusterSliceParameters != clusterSliceParameters)
         clusterFrustumsDirty = true;
 
     if (clusterFrustumsDirty)
@@ -760,45 +4063,110 @@ void Renderer::DefineClusterFrustums()
         ZoneScoped;
 
         Matrix4 cameraProjInverse = cameraProj.Inverse();
-        float cameraNearClip = camera->NearClip();
-        float cameraFarClip = camera->FarClip();
-        size_t idx = 0;
 
-        float xStep = 2.0f / NUM_CLUSTER_X;
-        float yStep = 2.0f / NUM_CLUSTER_Y;
-        float zStep = 1.0f / NUM_CLUSTER_Z;
+        float xStep = 2.0f / clusterSize.x;
+        float yStep = 2.0f / clusterSize.y;
 
-        for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
+        // Adaptive slices change on most frames, so build the slices in parallel
+        workQueue->ParallelFor(0, clusterSize.z, 1, [&](size_t start, size_t end, unsigned)
         {
-            Vector4 nearVec = cameraProj * Vector4(0.0f, 0.0f, z > 0 ? powf(z * zStep, 2.0f) * cameraFarClip : cameraNearClip, 1.0f);
-            Vector4 farVec = cameraProj * Vector4(0.0f, 0.0f, powf((z + 1) * zStep, 2.0f) * cameraFarClip, 1.0f);
-            float near = nearVec.z / nearVec.w;
-            float far = farVec.z / farVec.w;
-
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
+            for (size_t z = start; z < end; ++z)
             {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
+                Vector4 nearVec = cameraProj * Vector4(0.0f, 0.0f, ClusterSliceZ(z), 1.0f);
+                Vector4 farVec = cameraProj * Vector4(0.0f, 0.0f, ClusterSliceZ(z + 1), 1.0f);
+                float near = nearVec.z / nearVec.w;
+                float far = farVec.z / farVec.w;
+                size_t idx = z * clusterSize.x * clusterSize.y;
+
+                for (size_t y = 0; y < (size_t)clusterSize.y; ++y)
                 {
-                    clusterFrustums[idx].vertices[0] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * y, near);
-                    clusterFrustums[idx].vertices[1] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * (y + 1), near);
-                    clusterFrustums[idx].vertices[2] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * (y + 1), near);
-                    clusterFrustums[idx].vertices[3] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, near);
-                    clusterFrustums[idx].vertices[4] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * y, far);
-                    clusterFrustums[idx].vertices[5] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * (y + 1), far);
-                    clusterFrustums[idx].vertices[6] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * (y + 1), far);
-                    clusterFrustums[idx].vertices[7] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, far);
-                    clusterFrustums[idx].UpdatePlanes();
-                    clusterBoundingBoxes[idx].Define(clusterFrustums[idx]);
-                    ++idx;
+                    for (size_t x = 0; x < (size_t)clusterSize.x; ++x)
+                    {
+                        clusterFrustums[idx].vertices[0] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * y, near);
+                        clusterFrustums[idx].vertices[1] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * (y + 1), near);
+                        clusterFrustums[idx].vertices[2] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * (y + 1), near);
+                        clusterFrustums[idx].vertices[3] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, near);
+                        clusterFrustums[idx].vertices[4] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * y, far);
+                        clusterFrustums[idx].vertices[5] = cameraProjInverse * Vector3(-1.0f + xStep * (x + 1), 1.0f - yStep * (y + 1), far);
+                        clusterFrustums[idx].vertices[6] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * (y + 1), far);
+                        clusterFrustums[idx].vertices[7] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, far);
+                        clusterFrustums[idx].UpdatePlanes();
+                        clusterBoxPacks[(z * clusterSize.y + y) * clusterPacksPerRow + x / BOUNDING_BOX_PACK_SIZE].Set(x % BOUNDING_BOX_PACK_SIZE, BoundingBox(clusterFrustums[idx]));
+                        ++idx;
+                    }
+
+                    clusterBoxPacks[(z * clusterSize.y + y + 1) * clusterPacksPerRow - 1].ClearFrom(clusterSize.x % BOUNDING_BOX_PACK_SIZE);
                 }
             }
+        });
+
+        // The side planes of the clusters do not depend on the slice, so store them once per column and row for light range tests
+        for (size_t x = 0; x < (size_t)clusterSize.x; ++x)
+        {
+            clusterColumnPlanes[x * 2] = clusterFrustums[x].planes[PLANE_LEFT];
+            clusterColumnPlanes[x * 2 + 1] = clusterFrustums[x].planes[PLANE_RIGHT];
+        }
+        for (size_t y = 0; y < (size_t)clusterSize.y; ++y)
+        {
+            clusterRowPlanes[y * 2] = clusterFrustums[y * clusterSize.x].planes[PLANE_UP];
+            clusterRowPlanes[y * 2 + 1] = clusterFrustums[y * clusterSize.x].planes[PLANE_DOWN];
         }
 
         lastClusterFrustumProj = cameraProj;
+        lastClusterSliceParameters = clusterSliceParameters;
         clusterFrustumsDirty = false;
     }
 }
 
+void Renderer::BuildLightClusters(Texture* depthTexture)
+{
+    ZoneScoped;
+
+    const PerViewUniforms& perViewData = preparedView.mainView.perViewData;
+    Matrix4 projectionInverse = perViewData.projectionMatrix.Inverse();
+    bool useBounds = false;
+
+    // Gather the maximum view depth of each screen tile, then use it to cull and shorten the clusters behind the opaque geometry
+    if (depthTexture)
+    {
+        ShaderProgram* clearProgram = graphics->SetComputeProgram("Shaders/LightClusters.glsl", "CLEARBOUNDS");
+        if (clearProgram)
+        {
+            clusterBoundsTexture->BindImage(2, IMAGE_READWRITE);
+            graphics->DispatchCompute(IntVector3((clusterSize.x * clusterSize.y + 63) / 64, 1, 1));
+            graphics->ComputeBarrier();
+        }
+
+        ShaderProgram* boundsProgram = clearProgram ? graphics->SetComputeProgram("Shaders/LightClusters.glsl", "DEPTHBOUNDS") : nullptr;
+        if (boundsProgram)
+        {
+            graphics->SetUniform(boundsProgram, U_PROJECTIONINVERSE, projectionInverse);
+            graphics->SetTexture(0, depthTexture);
+            graphics->DispatchCompute(IntVector3((depthTexture->Width() + 7) / 8, (depthTexture->Height() + 7) / 8, 1));
+            graphics->SetTexture(0, nullptr);
+            graphics->ComputeBarrier();
+            useBounds = true;
+        }
+    }
+
+    ShaderProgram* program = graphics->SetComputeProgram("Shaders/LightClusters.glsl", useBounds ? "USEBOUNDS" : "");
+    if (!program)
+        return;
+
+    graphics->SetUniform(program, U_VIEWMATRIX, perViewData.viewMatrix);
+    graphics->SetUniform(program, U_PROJECTIONINVERSE, projectionInverse);
+    graphics->SetUniform(program, U_CLUSTERSLICEPARAMETERS, perViewData.clusterSliceParameters);
+    graphics->SetUniform(program, U_CLUSTERPARAMETERS, Vector4(perViewData.depthParameters.x, perViewData.depthParameters.y, (float)preparedView.numLights, (float)maxLightsPerCluster));
+    graphics->SetUniform(program, U_FARCLUSTERPARAMETERS, Vector2(farClusterLightDistance, (float)Min(maxFarClusterLights, maxLightsPerCluster)));
+    clusterTexture->BindImage(0, IMAGE_WRITE);
+    lightIndexTexture->BindImage(1, IMAGE_WRITE);
+    lightDataTexture->Bind(TU_LIGHTDATA);
+    graphics->DispatchCompute(IntVector3((int)((numClusters + 63) / 64), 1, 1));
+
+    // The cluster and light index textures are sampled by the following draws
+    graphics->ComputeBarrier();
+}
+
 void Renderer::CollectOctantsWork(Task* task_, unsigned)
 {
     ZoneScoped;
@@ -808,15 +4176,37 @@ void Renderer::CollectOctantsWork(Task* task_, unsigned)
     // Go through octants in this task's octree branch
     Octant* octant = task->startOctant;
     ThreadOctantResult& result = octantResults[task->subtreeIdx];
-    
-    CollectOctantsAndLights(octant, result, workQueue->NumThreads() > 1, octant != octree->Root());
+    bool threaded = workQueue->NumThreads() > 1;
+    bool recursive = octant != octree->Root();
+
+    if (temporalCoherence)
+    {
+        if (rebuildOctantCache)
+        {
+            result.octantCache.clear();
+            if (octant)
+                BuildOctantCache(octant, result.octantCache, recursive);
+            else
+                BuildBvhOctantCache(result.octantCache);
+        }
+
+        CollectCachedOctantsAndLights(result, threaded);
+    }
+    else if (octant)
+        CollectOctantsAndLights(octant, result, threaded, recursive);
+    else
+        CollectBvhOctantsAndLights(result, threaded);
 
     // Queue final batch task for leftover nodes if needed
     if (result.drawableAcc)
     {
         if (result.collectBatchesTasks.size() <= result.batchTaskIdx)
+        {
             result.collectBatchesTasks.push_back(new CollectBatchesTask(this, &Renderer::CollectBatchesWork));
-            
+            result.collectBatchesTasks.back()->priority = TASK_HIGH;
+            result.collectBatchesTasks.back()->octants = FrameVector<std::pair<Octant*, unsigned char> >(FrameAllocator<std::pair<Octant*, unsigned char> >(frameArenas));
+        }
+
         CollectBatchesTask* batchTask = result.collectBatchesTasks[result.batchTaskIdx];
         batchTask->octants.clear();
         batchTask->octants.insert(batchTask->octants.end(), result.octants.begin() + result.taskOctantIdx, result.octants.end());
@@ -825,7 +4215,7 @@ void Renderer::CollectOctantsWork(Task* task_, unsigned)
         workQueue->QueueTask(batchTask);
     }
 
-    numPendingBatchTasks.fetch_add(-1);
+    FinishBatchTask();
 }
 
 void Renderer::ProcessLightsWork(Task*, unsigned)
@@ -850,23 +4240,67 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
             ++it;
     }
 
+    RenderStats& threadStats = ThreadStats();
+    threadStats.lightsInView += (unsigned)lights.size();
+
+    // In light hierarchy mode, keep the most important lights when over the maximum. The importance is negated to select the highest first
+    if (lightHierarchy && lights.size() > maxLights)
+    {
+        lightImportances.resize(lights.size());
+        for (size_t i = 0; i < lights.size(); ++i)
+        {
+            LightDrawable* light = lights[i];
+            float pixels = LightScreenRadius(light);
+            lightImportances[i] = std::make_pair(-light->EffectiveColor().SumRGB() * pixels * pixels, light);
+        }
+
+        std::nth_element(lightImportances.begin(), lightImportances.begin() + maxLights, lightImportances.end());
+        for (size_t i = 0; i < maxLights; ++i)
+            lights[i] = lightImportances[i].second;
+        lights.resize(maxLights);
+    }
+
     // Sort localized lights by increasing distance
     std::sort(lights.begin(), lights.end(), CompareLights);
 
     // Clamp to maximum supported
-    if (lights.size() > MAX_LIGHTS)
-        lights.resize(MAX_LIGHTS);
+    if (lights.size() > maxLights)
+        lights.resize(maxLights);
+    threadStats.lightsAccepted += (unsigned)lights.size();
 
-    // Pre-step for shadow map caching: reallocate all lights' shadow map rectangles which are non-zero at this point.
-    // If shadow maps were dirtied (size or bias change) reset all allocations instead
-    for (auto it = lights.begin(); it != lights.end(); ++it)
+    // Merge the decals and keep the closest when over the maximum. Overlapping decals blend in a fixed order, so sort them by node ID
+    for (size_t i = 0; i < rootLevelOctants.size(); ++i)
+        decals.insert(decals.end(), octantResults[i].decals.begin(), octantResults[i].decals.end());
+    if (decals.size() > maxDecals)
     {
-        LightDrawable* light = *it;
-        if (shadowMapsDirty)
-            light->SetShadowMap(nullptr);
-        else if (drawShadows && light->ShadowStrength() < 1.0f && light->ShadowRect() != IntRect::ZERO)
-            AllocateShadowMap(light);
+        std::nth_element(decals.begin(), decals.begin() + maxDecals, decals.end(), CompareDecals);
+        decals.resize(maxDecals);
     }
+    std::sort(decals.begin(), decals.end(), CompareDecalIds);
+    threadStats.decalsAccepted += (unsigned)decals.size();
+
+    for (size_t i = 0; i < decals.size(); ++i)
+    {
+        DecalDrawable* decal = decals[i];
+        const Rect& rect = decal->TextureRect();
+        decalData[i].projection = decal->WorldTransform().Inverse();
+        decalData[i].textureRect = Vector4(rect.min.x, rect.min.y, rect.max.x - rect.min.x, rect.max.y - rect.min.y);
+        decalData[i].color = decal->EffectiveColor();
+    }
+
+    // If shadow maps were dirtied (size or bias change) reset all allocations, so that no cached content is reused
+    if (shadowMapsDirty)
+    {
+        Profiler* profiler = Subsystem<Profiler>();
+        if (profiler && profiler->IsHitchDetection())
+            profiler->AddEvent("Reallocate shadow maps", std::to_string(lights.size()) + " lights");
+
+        for (auto it = lights.begin(); it != lights.end(); ++it)
+            (*it)->SetShadowMap(nullptr);
+    }
+
+    // Allocate localized light shadow maps from the atlas, reallocating the previous rectangles for shadow map caching where possible
+    AllocateLightShadowMaps();
 
     // Check if directional light needs shadows
     if (dirLight)
@@ -874,7 +4308,7 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         if (shadowMapsDirty)
             dirLight->SetShadowMap(nullptr);
 
-        if (!drawShadows || dirLight->ShadowStrength() >= 1.0f || !AllocateShadowMap(dirLight))
+        if (!drawShadows || dirLight->ShadowStrength() >= 1.0f || !AllocateShadowMap(dirLight, dirLight->ShadowMapSize(), dirLight->ShadowMapSize() / 4))
             dirLight->SetShadowMap(nullptr);
     }
 
@@ -888,7 +4322,9 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         ShadowMap& shadowMap = shadowMaps[1];
 
         LightDrawable* light = lights[i];
-        float cutoff = light->GetLightType() == LIGHT_SPOT ? cosf(light->Fov() * 0.5f * M_DEGTORAD) : 0.0f;
+        float cutoff = 0.0f;
+        if (light->GetLightType() == LIGHT_SPOT)
+            cutoff = (fastMath & FAST_MATH_LIGHTS) ? CosFast(light->Fov() * 0.5f) : cosf(light->Fov() * 0.5f * M_DEGTORAD);
 
         lightData[i].position = Vector4(light->WorldPosition(), 1.0f);
         lightData[i].direction = Vector4(-light->WorldDirection(), 0.0f);
@@ -903,12 +4339,11 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
             continue;
         }
 
-        // Now retry shadow map allocation if necessary. If it's a new allocation, must rerender the shadow map
+        // Shadow map may not have fit in the atlas
         if (!light->ShadowMap())
-        {
-            if (!AllocateShadowMap(light))
-                continue;
-        }
+            continue;
+
+        ++threadStats.shadowedLights;
 
         light->InitShadowViews();
         std::vector<ShadowView>& shadowViews = light->ShadowViews();
@@ -916,7 +4351,7 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         // Preallocate shadowcaster list
         size_t casterListIdx = shadowMap.freeCasterListIdx++;
         if (shadowMap.shadowCasters.size() < shadowMap.freeCasterListIdx)
-            shadowMap.shadowCasters.resize(shadowMap.freeCasterListIdx);
+            shadowMap.shadowCasters.resize(shadowMap.freeCasterListIdx, FrameVector<Drawable*>(FrameAllocator<Drawable*>(frameArenas)));
 
         for (size_t j = 0; j < shadowViews.size(); ++j)
         {
@@ -924,6 +4359,7 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
 
             // Preallocate shadow batch queues
             view.casterListIdx = casterListIdx;
+            view.cubeFaceMask = 0;
 
             if (light->IsStatic())
             {
@@ -940,7 +4376,11 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         }
 
         if (collectShadowCastersTasks.size() <= lightTaskIdx)
+        {
+            // Shadowcaster queries are not needed until main batches have been collected
             collectShadowCastersTasks.push_back(new CollectShadowCastersTask(this, &Renderer::CollectShadowCastersWork));
+            collectShadowCastersTasks.back()->priority = TASK_LOW;
+        }
 
         collectShadowCastersTasks[lightTaskIdx]->light = light;
         processShadowCastersTask->AddDependency(collectShadowCastersTasks[lightTaskIdx]);
@@ -950,6 +4390,7 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
     if (dirLight && dirLight->ShadowMap())
     {
         ShadowMap& shadowMap = shadowMaps[0];
+        ++threadStats.shadowedLights;
 
         dirLight->InitShadowViews();
         std::vector<ShadowView>& shadowViews = dirLight->ShadowViews();
@@ -962,8 +4403,10 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
             // But queries are only performed later when the shadow map can be focused to visible scene
             view.casterListIdx = shadowMap.freeCasterListIdx++;
             if (shadowMap.shadowCasters.size() < shadowMap.freeCasterListIdx)
-                shadowMap.shadowCasters.resize(shadowMap.freeCasterListIdx);
+                shadowMap.shadowCasters.resize(shadowMap.freeCasterListIdx, FrameVector<Drawable*>(FrameAllocator<Drawable*>(frameArenas)));
 
+            if (dirShadowCaching && dirLight->IsStatic())
+                view.staticQueueIdx = shadowMap.freeQueueIdx++;
             view.dynamicQueueIdx = shadowMap.freeQueueIdx++;
             if (shadowMap.shadowBatches.size() < shadowMap.freeQueueIdx)
                 shadowMap.shadowBatches.resize(shadowMap.freeQueueIdx);
@@ -983,97 +4426,553 @@ void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
 
     CollectBatchesTask* task = static_cast<CollectBatchesTask*>(task_);
     ThreadBatchResult& result = batchResults[threadIndex];
-    bool threaded = workQueue->NumThreads() > 1;
 
-    std::vector<std::pair<Octant*, unsigned char> >& octants = task->octants;
-    std::vector<Batch>& opaqueQueue = threaded ? result.opaqueBatches : opaqueBatches.batches;
-    std::vector<Batch>& alphaQueue = threaded ? result.alphaBatches : alphaBatches.batches;
+    FrameVector<std::pair<Octant*, unsigned char> >& octants = task->octants;
+    FrameVector<Batch>& opaqueQueue = result.opaqueBatches;
+    FrameVector<Batch>& alphaQueue = result.alphaBatches;
 
     const Matrix3x4& viewMatrix = camera->ViewMatrix();
     Vector3 viewZ = Vector3(viewMatrix.m20, viewMatrix.m21, viewMatrix.m22);
     Vector3 absViewZ = viewZ.Abs();
     float farClipMul = 32767.0f / camera->FarClip();
 
-    // Scan octants for geometries
+    auto addBatches = [&](Drawable* drawable, bool prepared)
+    {
+        if (prepared || ((minViewPixels <= 0.0f || !IsBelowScreenSize(drawable->WorldBoundingBox(), minViewPixels)) && drawable->OnPrepareRender(frameNumber, camera)))
+        {
+            const BoundingBox& geometryBox = drawable->WorldBoundingBox();
+            result.geometryBounds.Merge(geometryBox);
+
+            Vector3 center = geometryBox.Center();
+            Vector3 edge = geometryBox.Size() * 0.5f;
+
+            float viewCenterZ = viewZ.DotProduct(center) + viewMatrix.m23;
+            float viewEdgeZ = absViewZ.DotProduct(edge);
+            result.minZ = Min(result.minZ, viewCenterZ - viewEdgeZ);
+            result.maxZ = Max(result.maxZ, viewCenterZ + viewEdgeZ);
+ 
+            Batch newBatch;
+
+            unsigned short distance = (unsigned short)(drawable->Distance() * farClipMul);
+            GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
+            float screenSize = textureStreaming ? ScreenSize(geometryBox) * 2.0f : 0.0f;
+            // Far drawables can substitute an impostor for their geometries
+            const SourceBatches& batches = drawable->TestFlag(DF_IMPOSTOR) ? *geomDrawable->ImpostorBatches() : geomDrawable->batches;
+            size_t numGeometries = batches.NumGeometries();
+            bool lodFade = drawable->TestFlag(DF_LOD_FADE);
+
+            for (size_t j = 0; j < numGeometries; ++j)
+            {
+                Material* material = batches.GetMaterial(j);
+                Geometry* fadeGeometry = lodFade ? geomDrawable->LodFadeGeometry(j, newBatch.lodFade) : nullptr;
+
+                if (textureStreaming)
+                {
+                    for (size_t k = 0; k < MAX_MATERIAL_TEXTURE_UNITS; ++k)
+                    {
+                        Texture* texture = material->GetTexture(k);
+                        if (texture && texture->IsStreaming())
+                            texture->RequestStreamingSize(frameNumber, screenSize);
+                    }
+                }
+
+                // Assume opaque first
+                Pass* pass = material->GetPass(PASS_OPAQUE);
+                newBatch.geometry = batches.GetGeometry(j);
+                newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
+                newBatch.geomIndex = (unsigned char)j;
+                newBatch.staticIndex = staticInstanceTable ? drawable->StaticIndex() : M_MAX_UNSIGNED;
+
+                if (!newBatch.programBits)
+                    newBatch.worldTransform = &drawable->WorldTransform();
+                else
+                    newBatch.drawable = geomDrawable;
+
+                if (fadeGeometry)
+                    newBatch.programBits |= SP_LODFADE;
+
+                if (pass)
+                {
+                    // Perform distance sort in addition to state sort
+                    if (pass->Base()->lastSortKey.first != frameNumber || pass->Base()->lastSortKey.second > distance)
+                    {
+                        pass->Base()->lastSortKey.first = frameNumber;
+                        pass->Base()->lastSortKey.second = distance;
+                    }
+
+                    if (newBatch.geometry->lastSortKey.first != frameNumber || newBatch.geometry->lastSortKey.second > distance + (unsigned short)j)
+                    {
+                        newBatch.geometry->lastSortKey.first = frameNumber;
+                        newBatch.geometry->lastSortKey.second = distance + (unsigned short)j;
+                    }
+
+                    newBatch.SetPass(pass);
+                    opaqueQueue.push_back(newBatch);
+
+                    // The level being faded out is drawn with the complementary mask
+                    if (fadeGeometry)
+                    {
+                        if (fadeGeometry->lastSortKey.first != frameNumber || fadeGeometry->lastSortKey.second > distance + (unsigned short)j)
+                        {
+                            fadeGeometry->lastSortKey.first = frameNumber;
+                            fadeGeometry->lastSortKey.second = distance + (unsigned short)j;
+                        }
+
+                        newBatch.geometry = fadeGeometry;
+                        newBatch.lodFade -= 1.0f;
+                        opaqueQueue.push_back(newBatch);
+                    }
+                }
+                else
+                {
+                    // If not opaque, try transparent
+                    pass = material->GetPass(PASS_ALPHA);
+                    if (!pass)
+                        continue;
+                    newBatch.SetPass(pass);
+
+                    newBatch.distance = drawable->Distance();
+                    alphaQueue.push_back(newBatch);
+                    if (fadeGeometry)
+                    {
+                        newBatch.geometry = fadeGeometry;
+                        newBatch.lodFade -= 1.0f;
+                        alphaQueue.push_back(newBatch);
+                    }
+                }
+            }
+        }
+    };
+
+    bool hasOcclusion = occlusionBuffer.HasData();
+    bool hasPortals = portalCuller.HasData();
+    bool useStaticBatches = staticBatchCaching && !hasOcclusion && !hasPortals && !textureStreaming;
+
+    // Scan octants for geometries. Octants fully inside the frustum need no further tests, otherwise test the octant's bounding box packs
     for (auto it = octants.begin(); it != octants.end(); ++it)
     {
         Octant* octant = it->first;
         unsigned char planeMask = it->second;
         std::vector<Drawable*>& drawables = octant->drawables;
 
-        for (auto dIt = drawables.begin(); dIt != drawables.end(); ++dIt)
+        // Drawables merged into a substituted HLOD proxy are skipped
+        bool hlodSkip = false;
+        if (hlodPixels > 0.0f)
+        {
+            HlodProxy* proxy = octree->FindHlod(octant);
+            hlodSkip = proxy && proxy->lastSubstituteFrame == frameNumber;
+        }
+
+        // Fully inside octants append their cached static batches as a whole
+        bool cached = useStaticBatches && !planeMask && !hlodSkip;
+        if (cached)
         {
-            Drawable* drawable = *dIt;
+            if (octant->staticBatchVersion != staticBatchVersion || octant->staticBatchViewMask != viewMask)
+                BuildStaticBatches(octant);
 
-            if (drawable->TestFlag(DF_GEOMETRY) && (drawable->LayerMask() & viewMask) && (!planeMask || frustum.IsInsideMaskedFast(drawable->WorldBoundingBox(), planeMask)))
+            // With screen size culling, the smallest cached drawable at the far edge of the bounds must pass, otherwise the drawables are tested individually
+            if (minViewPixels > 0.0f && octant->staticBatches.size())
             {
-                if (drawable->OnPrepareRender(frameNumber, camera))
-                {
-                    const BoundingBox& geometryBox = drawable->WorldBoundingBox();
-                    result.geometryBounds.Merge(geometryBox);
+                float pixels = octant->staticBatchMinRadius * screenSizeScale;
+                if (!camera->IsOrthographic())
+                    pixels /= Max(camera->Distance(octant->staticBatchBounds.Center()) + octant->staticBatchBounds.HalfSize().Length(), M_EPSILON);
+                cached = pixels >= minViewPixels;
+            }
+        }
 
-                    Vector3 center = geometryBox.Center();
-                    Vector3 edge = geometryBox.Size() * 0.5f;
+        if (cached)
+        {
+            if (octant->staticBatches.size())
+            {
+                for (auto dIt = octant->staticBatchDrawables.begin(); dIt != octant->staticBatchDrawables.end(); ++dIt)
+                    (*dIt)->MarkInView(frameNumber);
 
-                    float viewCenterZ = viewZ.DotProduct(center) + viewMatrix.m23;
-                    float viewEdgeZ = absViewZ.DotProduct(edge);
-                    result.minZ = Min(result.minZ, viewCenterZ - viewEdgeZ);
-                    result.maxZ = Max(result.maxZ, viewCenterZ + viewEdgeZ);
- 
-                    Batch newBatch;
+                const BoundingBox& geometryBox = octant->staticBatchBounds;
+                result.geometryBounds.Merge(geometryBox);
 
-                    unsigned short distance = (unsigned short)(drawable->Distance() * farClipMul);
-                    const SourceBatches& batches = static_cast<GeometryDrawable*>(drawable)->batches;
-                    size_t numGeometries = batches.NumGeometries();
-        
-                    for (size_t j = 0; j < numGeometries; ++j)
-                    {
-                        Material* material = batches.GetMaterial(j);
+                Vector3 center = geometryBox.Center();
+                Vector3 edge = geometryBox.Size() * 0.5f;
 
-                        // Assume opaque first
-                        newBatch.pass = material->GetPass(PASS_OPAQUE);
-                        newBatch.geometry = batches.GetGeometry(j);
-                        newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
-                        newBatch.geomIndex = (unsigned char)j;
+                float viewCenterZ = viewZ.DotProduct(center) + viewMatrix.m23;
+                float viewEdgeZ = absViewZ.DotProduct(edge);
+                result.minZ = Min(result.minZ, viewCenterZ - viewEdgeZ);
+                result.maxZ = Max(result.maxZ, viewCenterZ + viewEdgeZ);
 
-                        if (!newBatch.programBits)
-                            newBatch.worldTransform = &drawable->WorldTransform();
-                        else
-                            newBatch.drawable = static_cast<GeometryDrawable*>(drawable);
+                // Use the closest point of the cached geometries' bounds for the distance sort
+                unsigned short distance = (unsigned short)(Max(camera->Distance(center) - edge.Length(), 0.0f) * farClipMul);
+                unsigned short lastPassId = ID_OVERFLOW;
+                Geometry* lastGeometry = nullptr;
 
-                        if (newBatch.pass)
+                // The cached batches are sorted by pass and geometry, so the sort keys need updating only when they change
+                for (auto bIt = octant->staticBatches.begin(); bIt != octant->staticBatches.end(); ++bIt)
+                {
+                    if (bIt->passId != lastPassId)
+                    {
+                        lastPassId = bIt->passId;
+                        Pass* lastPass = bIt->GetPass()->Base();
+                        if (lastPass->lastSortKey.first != frameNumber || lastPass->lastSortKey.second > distance)
                         {
-                            // Perform distance sort in addition to state sort
-                            if (newBatch.pass->lastSortKey.first != frameNumber || newBatch.pass->lastSortKey.second > distance)
-                            {
-                                newBatch.pass->lastSortKey.first = frameNumber;
-                                newBatch.pass->lastSortKey.second = distance;
-                            }
-                            if (newBatch.geometry->lastSortKey.first != frameNumber || newBatch.geometry->lastSortKey.second > distance + (unsigned short)j)
-                            {
-                                newBatch.geometry->lastSortKey.first = frameNumber;
-                                newBatch.geometry->lastSortKey.second = distance + (unsigned short)j;
-                            }
-
-                            opaqueQueue.push_back(newBatch);
+                            lastPass->lastSortKey.first = frameNumber;
+                            lastPass->lastSortKey.second = distance;
                         }
-                        else
+                    }
+                    if (bIt->geometry != lastGeometry)
+                    {
+                        lastGeometry = bIt->geometry;
+                        if (lastGeometry->lastSortKey.first != frameNumber || lastGeometry->lastSortKey.second > distance + (unsigned short)bIt->geomIndex)
                         {
-                            // If not opaque, try transparent
-                            newBatch.pass = material->GetPass(PASS_ALPHA);
-                            if (!newBatch.pass)
-                                continue;
+                            lastGeometry->lastSortKey.first = frameNumber;
+                            lastGeometry->lastSortKey.second = distance + (unsigned short)bIt->geomIndex;
+                        }
+                    }
+                }
+
+                opaqueQueue.insert(opaqueQueue.end(), octant->staticBatches.begin(), octant->staticBatches.end());
+            }
+        }
+
+        for (size_t i = 0; i < drawables.size(); i += BOUNDING_BOX_PACK_SIZE)
+        {
+            size_t count = Min(drawables.size() - i, BOUNDING_BOX_PACK_SIZE);
+
+            // Lights are kept first, so skip packs that contain no geometries
+            if (!(octant->drawableFlags[i + count - 1] & DF_GEOMETRY))
+                continue;
+
+            const BoundingBoxPack& boxes = octant->drawableBoxes[i / BOUNDING_BOX_PACK_SIZE];
+            unsigned visible = planeMask ? frustum.IsInsideMaskedFast(boxes, planeMask) : 0xff;
+            StaticModelDrawable* staticModels[BOUNDING_BOX_PACK_SIZE];
+            unsigned char staticModelIndices[BOUNDING_BOX_PACK_SIZE];
+            size_t numStaticModels = 0;
 
-                            newBatch.distance = drawable->Distance();
-                            alphaQueue.push_back(newBatch);
+            for (size_t j = 0; j < count; ++j)
+            {
+                if ((cached && octant->staticBatchCached[i + j]) || (hlodSkip && (octant->drawableFlags[i + j] & DF_HLOD)))
+                    continue;
+
+                if ((visible & (1 << j)) && (octant->drawableFlags[i + j] & DF_GEOMETRY) && (octant->drawableLayerMasks[i + j] & viewMask) &&
+                    (!hasOcclusion || occlusionBuffer.IsVisible(octant->DrawableBox(i + j))) && (!hasPortals || portalCuller.IsVisible(octant->DrawableBox(i + j))))
+                {
+                    // Static models are prepared together after the rest of the pack, with their distances calculated from the packed bounding boxes
+                    Drawable* drawable = drawables[i + j];
+                    if (drawable->DrawableType() == DT_STATICMODEL)
+                    {
+                        if (minViewPixels <= 0.0f || !IsBelowScreenSize(drawable->WorldBoundingBox(), minViewPixels))
+                        {
+                            staticModels[numStaticModels] = static_cast<StaticModelDrawable*>(drawable);
+                            staticModelIndices[numStaticModels++] = (unsigned char)j;
                         }
                     }
+                    else
+                        addBatches(drawable, false);
+                }
+            }
+
+            if (numStaticModels)
+            {
+                float packDistances[BOUNDING_BOX_PACK_SIZE];
+                float distances[BOUNDING_BOX_PACK_SIZE];
+                camera->Distances(boxes, packDistances);
+                for (size_t j = 0; j < numStaticModels; ++j)
+                    distances[j] = packDistances[staticModelIndices[j]];
+
+                unsigned prepared = StaticModelDrawable::PrepareRender(staticModels, distances, numStaticModels, frameNumber, camera);
+                for (size_t j = 0; j < numStaticModels; ++j)
+                {
+                    if (prepared & (1 << j))
+                        addBatches(staticModels[j], true);
                 }
             }
         }
     }
 
-    numPendingBatchTasks.fetch_add(-1);
+    FinishBatchTask();
+}
+
+void Renderer::BuildStaticBatches(Octant* octant)
+{
+    ZoneScoped;
+
+    std::vector<Drawable*>& drawables = octant->drawables;
+
+    octant->staticBatches.clear();
+    octant->staticBatchDrawables.clear();
+    octant->staticBatchCached.assign(drawables.size(), 0);
+    octant->staticBatchBounds.Undefine();
+    octant->staticBatchMinRadius = M_INFINITY;
+    octant->staticBatchViewMask = viewMask;
+    octant->staticBatchVersion = staticBatchVersion;
+
+    for (size_t i = 0; i < drawables.size(); ++i)
+    {
+        Drawable* drawable = drawables[i];
+        unsigned flags = octant->drawableFlags[i];
+
+        // Only plain static geometries without per-frame LOD, impostor or distance decisions can be cached
+        if (!(flags & DF_GEOMETRY) || !(flags & DF_STATIC) || (flags & (DF_GEOMETRY_TYPE_BITS | DF_HAS_LOD_LEVELS | DF_LOD_FADE | DF_IMPOSTOR)) ||
+            !(octant->drawableLayerMasks[i] & viewMask) || drawable->MaxDistance() > 0.0f)
+            continue;
+
+        GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
+        if (geomDrawable->ImpostorBatches())
+            continue;
+
+        // All geometries must be opaque, as transparent batches need the per-frame distance
+        const SourceBatches& batches = geomDrawable->batches;
+        size_t numGeometries = batches.NumGeometries();
+        bool allOpaque = true;
+        for (size_t j = 0; j < numGeometries; ++j)
+        {
+            Material* material = batches.GetMaterial(j);
+            if (!material || !material->GetPass(PASS_OPAQUE))
+            {
+                allOpaque = false;
+                break;
+            }
+        }
+        if (!allOpaque)
+            continue;
+
+        for (size_t j = 0; j < numGeometries; ++j)
+        {
+            Batch newBatch;
+            newBatch.SetPass(batches.GetMaterial(j)->GetPass(PASS_OPAQUE));
+            newBatch.geometry = batches.GetGeometry(j);
+            newBatch.programBits = 0;
+            newBatch.geomIndex = (unsigned char)j;
+            newBatch.lodFade = 0.0f;
+            newBatch.staticIndex = staticInstanceTable ? drawable->StaticIndex() : M_MAX_UNSIGNED;
+            newBatch.worldTransform = &drawable->WorldTransform();
+            octant->staticBatches.push_back(newBatch);
+        }
+
+        octant->staticBatchDrawables.push_back(drawable);
+        octant->staticBatchCached[i] = 1;
+        octant->staticBatchBounds.Merge(drawable->WorldBoundingBox());
+        octant->staticBatchMinRadius = Min(octant->staticBatchMinRadius, drawable->WorldBoundingBox().HalfSize().Length());
+    }
+
+    std::sort(octant->staticBatches.begin(), octant->staticBatches.end(), [](const Batch& lhs, const Batch& rhs)
+    {
+        return lhs.passId != rhs.passId ? lhs.passId < rhs.passId : lhs.geometry < rhs.geometry;
+    });
+}
+
+void Renderer::UpdateGpuCulling()
+{
+    // Takes over the static BVH leaves that hold only opaque static models without an impostor or HLOD proxy. Those are not crossfaded, screen size culled, marked in view or captured, and shadow maps still collect them on the CPU
+    if (!gpuCulling || stereo || !staticInstanceTable || !multiDraw || textureStreaming || !graphics->HasComputeShaders() || octree->BvhNodes().empty())
+    {
+        gpuCullingActive = false;
+        if (gpuCuller.Clear())
+            octantCacheValid = false;
+        return;
+    }
+
+    if (gpuCuller.Update(octree, viewMask))
+        octantCacheValid = false;
+
+    gpuCullingActive = gpuCuller.HasDrawables();
+    const BoundingBox& bounds = gpuCuller.Bounds();
+    if (!gpuCullingActive || frustum.IsInsideFast(bounds) == OUTSIDE)
+        return;
+
+    // The culling results are not known on the CPU, so the depth range covers all the GPU culled drawables within the frustum
+    BoundingBox box(frustum);
+    box.Clip(bounds);
+
+    ThreadBatchResult& result = batchResults[0];
+    result.geometryBounds.Merge(box);
+
+    const Matrix3x4& viewMatrix = camera->ViewMatrix();
+    Vector3 viewZ = Vector3(viewMatrix.m20, viewMatrix.m21, viewMatrix.m22);
+    float viewCenterZ = viewZ.DotProduct(box.Center()) + viewMatrix.m23;
+    float viewEdgeZ = viewZ.Abs().DotProduct(box.Size() * 0.5f);
+    result.minZ = Min(result.minZ, viewCenterZ - viewEdgeZ);
+    result.maxZ = Max(result.maxZ, viewCenterZ + viewEdgeZ);
+}
+
+void Renderer::CollectHlodProxies()
+{
+    ZoneScoped;
+
+    // Added to the main thread's results before the batch collection tasks are queued
+    ThreadBatchResult& result = batchResults[0];
+    const std::vector<SharedPtr<HlodProxy> >& proxies = octree->HlodProxies();
+
+    const Matrix3x4& viewMatrix = camera->ViewMatrix();
+    Vector3 viewZ = Vector3(viewMatrix.m20, viewMatrix.m21, viewMatrix.m22);
+    Vector3 absViewZ = viewZ.Abs();
+    float farClipMul = 32767.0f / camera->FarClip();
+
+    for (auto it = proxies.begin(); it != proxies.end(); ++it)
+    {
+        HlodProxy* proxy = *it;
+        const BoundingBox& box = proxy->WorldBoundingBox();
+
+        // All the source drawables' layers must be in view, as the proxy is drawn as a whole
+        if (!proxy->IsValid() || (proxy->LayerMask() & viewMask) != proxy->LayerMask() || !IsBelowScreenSize(box, hlodPixels))
+            continue;
+
+        // Substitute even if not visible, so that the source drawables are not drawn through the octants that reach further than the proxy bounds
+        proxy->lastSubstituteFrame = frameNumber;
+        if (frustum.IsInsideFast(box) == OUTSIDE || !occlusionBuffer.IsVisible(box) || !portalCuller.IsVisible(box))
+            continue;
+
+        result.geometryBounds.Merge(box);
+
+        Vector3 center = box.Center();
+        Vector3 edge = box.Size() * 0.5f;
+
+        float viewCenterZ = viewZ.DotProduct(center) + viewMatrix.m23;
+        float viewEdgeZ = absViewZ.DotProduct(edge);
+        result.minZ = Min(result.minZ, viewCenterZ - viewEdgeZ);
+        result.maxZ = Max(result.maxZ, viewCenterZ + viewEdgeZ);
+
+        unsigned short distance = (unsigned short)(camera->Distance(center) * farClipMul);
+        const SourceBatches& batches = proxy->Batches();
+        size_t numGeometries = batches.NumGeometries();
+
+        for (size_t i = 0; i < numGeometries; ++i)
+        {
+            Batch newBatch;
+            Pass* pass = batches.GetMaterial(i)->GetPass(PASS_OPAQUE);
+            newBatch.SetPass(pass);
+            newBatch.geometry = batches.GetGeometry(i);
+            newBatch.programBits = 0;
+            newBatch.geomIndex = (unsigned char)i;
+            newBatch.lodFade = 0.0f;
+            newBatch.staticIndex = M_MAX_UNSIGNED;
+            newBatch.worldTransform = &Matrix3x4::IDENTITY;
+            if (!pass)
+                continue;
+
+            if (pass->Base()->lastSortKey.first != frameNumber || pass->Base()->lastSortKey.second > distance)
+            {
+                pass->Base()->lastSortKey.first = frameNumber;
+                pass->Base()->lastSortKey.second = distance;
+            }
+            if (newBatch.geometry->lastSortKey.first != frameNumber || newBatch.geometry->lastSortKey.second > distance + (unsigned short)i)
+            {
+                newBatch.geometry->lastSortKey.first = frameNumber;
+                newBatch.geometry->lastSortKey.second = distance + (unsigned short)i;
+            }
+
+            result.opaqueBatches.push_back(newBatch);
+        }
+    }
+}
+
+void Renderer::InvalidateStaticBatches()
+{
+    // Zero is reserved for octants that have never been built or have been modified
+    if (!++staticBatchVersion)
+        ++staticBatchVersion;
+}
+
+void Renderer::CollectSecondaryViewWork(Task* task, unsigned)
+{
+    ZoneScoped;
+
+    SecondaryView* view = static_cast<CollectSecondaryViewTask*>(task)->view;
+    Camera* viewCamera = view->camera;
+
+    view->opaqueBatches.Clear();
+    view->alphaBatches.Clear();
+    view->instanceTransforms.clear();
+    view->drawCommands.clear();
+    view->lightData.clear();
+
+    // The main view may be changing the drawables' LOD levels and animations at the same time, so only static geometries are drawn, with their LOD levels selected here
+    view->geometries.clear();
+    octree->FindDrawablesMasked(view->geometries, view->frustum, DF_GEOMETRY, view->preparedViewMask);
+
+    for (auto it = view->geometries.begin(); it != view->geometries.end(); ++it)
+    {
+        Drawable* drawable = *it;
+        if (drawable->Flags() & DF_GEOMETRY_TYPE_BITS)
+            continue;
+
+        float distance = viewCamera->Distance(drawable->WorldBoundingBox().Center());
+        if (drawable->MaxDistance() > 0.0f && distance > drawable->MaxDistance())
+            continue;
+
+        GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
+        const SourceBatches& batches = geomDrawable->batches;
+        size_t numGeometries = batches.NumGeometries();
+
+        for (size_t i = 0; i < numGeometries; ++i)
+        {
+            Material* material = batches.GetMaterial(i);
+
+            Batch newBatch;
+            newBatch.geometry = geomDrawable->LodGeometry(i, viewCamera, view->lodBias);
+            newBatch.programBits = 0;
+            newBatch.geomIndex = (unsigned char)i;
+            newBatch.staticIndex = M_MAX_UNSIGNED;
+            newBatch.worldTransform = &drawable->WorldTransform();
+
+            // The pass and geometry distance keys belong to the main view, so the opaque batches are sorted by state only
+            Pass* pass = material->GetPass(PASS_OPAQUE);
+            if (pass)
+            {
+                newBatch.SetPass(pass);
+                view->opaqueBatches.batches.push_back(newBatch);
+            }
+            else
+            {
+                pass = material->GetPass(PASS_ALPHA);
+                if (!pass)
+                    continue;
+                newBatch.SetPass(pass);
+
+                newBatch.distance = distance;
+                view->alphaBatches.batches.push_back(newBatch);
+            }
+        }
+    }
+
+    std::vector<IndirectDrawCommand>* commands = multiDraw ? &view->drawCommands : nullptr;
+    view->opaqueBatches.Sort(view->instanceTransforms, SORT_STATE, hasInstancing, commands);
+    view->alphaBatches.Sort(view->instanceTransforms, SORT_DISTANCE, hasInstancing, commands);
+
+    if (!view->maxLights)
+        return;
+
+    // Pick the closest localized lights
+    view->lights.clear();
+    octree->FindDrawablesMasked(view->lights, view->frustum, DF_LIGHT, view->preparedViewMask);
+
+    std::vector<std::pair<float, LightDrawable*> > viewLights;
+    for (auto it = view->lights.begin(); it != view->lights.end(); ++it)
+    {
+        // Decals are kept with the lights, but secondary views do not apply them
+        if (((*it)->Flags() & DF_DECAL) == DF_DECAL)
+            continue;
+
+        LightDrawable* light = static_cast<LightDrawable*>(*it);
+        if (light->GetLightType() != LIGHT_DIRECTIONAL && !IsBakedLight(light))
+            viewLights.push_back(std::make_pair(viewCamera->Distance(light->WorldPosition()), light));
+    }
+
+    size_t numLights = Min(viewLights.size(), view->maxLights);
+    std::partial_sort(viewLights.begin(), viewLights.begin() + numLights, viewLights.end());
+    view->lightData.resize(numLights);
+
+    for (size_t i = 0; i < numLights; ++i)
+    {
+        LightDrawable* light = viewLights[i].second;
+        float cutoff = 0.0f;
+        if (light->GetLightType() == LIGHT_SPOT)
+            cutoff = (fastMath & FAST_MATH_LIGHTS) ? CosFast(light->Fov() * 0.5f) : cosf(light->Fov() * 0.5f * M_DEGTORAD);
+
+        LightData& data = view->lightData[i];
+        data.position = Vector4(light->WorldPosition(), 1.0f);
+        data.direction = Vector4(-light->WorldDirection(), 0.0f);
+        data.attenuation = Vector4(1.0f / Max(light->Range(), M_EPSILON), cutoff, 1.0f / (1.0f - cutoff), 1.0f);
+        data.color = light->EffectiveColor();
+        data.shadowParameters = Vector4::ONE;
+    }
 }
 
 void Renderer::CollectShadowCastersWork(Task* task, unsigned)
@@ -1104,8 +5003,14 @@ void Renderer::CollectShadowCastersWork(Task* task, unsigned)
             }
         }
 
-        std::vector<Drawable*>& shadowCasters = shadowMap.shadowCasters[shadowViews[0].casterListIdx];
-        octree->FindDrawables(shadowCasters, light->WorldSphere(), DF_GEOMETRY | DF_CAST_SHADOWS);
+        FrameVector<Drawable*>& shadowCasters = shadowMap.shadowCasters[shadowViews[0].casterListIdx];
+        if (staticCasterCaching && light->IsStatic())
+        {
+            AddCachedStaticCasters(light, shadowCasters);
+            octree->FindDynamicDrawables(shadowCasters, light->WorldSphere(), DF_GEOMETRY | DF_CAST_SHADOWS);
+        }
+        else
+            octree->FindDrawables(shadowCasters, light->WorldSphere(), DF_GEOMETRY | DF_CAST_SHADOWS);
     }
     else if (lightType == LIGHT_SPOT)
     {
@@ -1113,9 +5018,78 @@ void Renderer::CollectShadowCastersWork(Task* task, unsigned)
         light->SetupShadowView(0, camera);
         ShadowView& view = shadowViews[0];
 
-        std::vector<Drawable*>& shadowCasters = shadowMap.shadowCasters[view.casterListIdx];
-        octree->FindDrawablesMasked(shadowCasters, view.shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS);
+        FrameVector<Drawable*>& shadowCasters = shadowMap.shadowCasters[view.casterListIdx];
+        if (staticCasterCaching && light->IsStatic())
+        {
+            AddCachedStaticCasters(light, shadowCasters);
+            octree->FindDynamicDrawablesMasked(shadowCasters, view.shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS);
+        }
+        else
+            octree->FindDrawablesMasked(shadowCasters, view.shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS);
+    }
+
+    if (portalCells)
+        CullShadowCastersToCells(light, shadowMap.shadowCasters[shadowViews[0].casterListIdx]);
+}
+
+void Renderer::AddCachedStaticCasters(LightDrawable* light, FrameVector<Drawable*>& shadowCasters)
+{
+    // The cache is valid if it saw the static changes of the previous view preparation, and none of this one touch the light.
+    // Any drawable removal invalidates it, as a removed drawable may have stopped being a static shadowcaster before
+    const BoundingBox& lightBox = light->WorldBoundingBox();
+    bool valid = light->staticCasterSerial && light->staticCasterSerial + 1 == staticChangeSerial &&
+        light->staticCasterRemovalVersion == octree->RemovalVersion() && light->staticCasterBox == lightBox && !HasStaticChanges(lightBox);
+
+    if (!valid)
+    {
+        light->staticCasters.clear();
+        if (light->GetLightType() == LIGHT_POINT)
+            octree->FindDrawables(light->staticCasters, light->WorldSphere(), DF_GEOMETRY | DF_CAST_SHADOWS | DF_STATIC);
+        else
+            octree->FindDrawablesMasked(light->staticCasters, light->ShadowViews()[0].shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS | DF_STATIC);
+
+        light->staticCasterBox = lightBox;
+        light->staticCasterRemovalVersion = octree->RemovalVersion();
+    }
+
+    light->staticCasterSerial = staticChangeSerial;
+
+    // Drawables that have stopped being static shadowcasters without moving are left out; the dynamic query finds them instead
+    for (auto it = light->staticCasters.begin(); it != light->staticCasters.end(); ++it)
+    {
+        Drawable* drawable = *it;
+        if (drawable->TestFlag(DF_STATIC) && drawable->TestFlag(DF_CAST_SHADOWS))
+            shadowCasters.push_back(drawable);
+    }
+}
+
+void Renderer::CullShadowCastersToCells(LightDrawable* light, FrameVector<Drawable*>& shadowCasters)
+{
+    unsigned cell = portalCells->FindCell(light->WorldPosition());
+    if (cell == PORTAL_EXTERIOR)
+        return;
+
+    // The reachable cells depend only on the light, so static shadow maps stay cached as the camera moves
+    std::vector<unsigned> reachableCells;
+    portalCells->FindReachableCells(reachableCells, cell, light->WorldBoundingBox());
+    if (std::find(reachableCells.begin(), reachableCells.end(), PORTAL_EXTERIOR) != reachableCells.end())
+        return;
+
+    size_t numCasters = 0;
+    for (auto it = shadowCasters.begin(); it != shadowCasters.end(); ++it)
+    {
+        const BoundingBox& box = (*it)->WorldBoundingBox();
+        for (auto cIt = reachableCells.begin(); cIt != reachableCells.end(); ++cIt)
+        {
+            if (portalCells->CellBox(*cIt).IsInsideFast(box) != OUTSIDE)
+            {
+                shadowCasters[numCasters++] = *it;
+                break;
+            }
+        }
     }
+
+    shadowCasters.resize(numCasters);
 }
 
 void Renderer::ProcessShadowCastersWork(Task*, unsigned)
@@ -1132,6 +5106,7 @@ void Renderer::ProcessShadowCastersWork(Task*, unsigned)
     }
 
     minZ = Max(minZ, camera->NearClip());
+    DefineClusterSlices();
 
     // Queue shadow batch collection tasks. These will also perform shadow batch sorting tasks when done
     size_t shadowTaskIdx = 0;
@@ -1158,33 +5133,106 @@ void Renderer::ProcessShadowCastersWork(Task*, unsigned)
         }
     }
 
-    if (shadowTaskIdx > 0)
-        workQueue->QueueTasks(shadowTaskIdx, reinterpret_cast<Task**>(&collectShadowBatchesTasks[0]));
-
-    // Clear per-cluster light data from previous frame, update cluster frustums and bounding boxes if camera changed, then queue light culling tasks for the needed scene range
+    if (shadowTaskIdx > 0)
+        workQueue->QueueTasks(shadowTaskIdx, reinterpret_cast<Task**>(&collectShadowBatchesTasks[0]));
+
+    // Copy correct shadow matrices for the localized light data
+    // Note: directional light shadow matrices may still be pending, but they are not included here
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        LightDrawable* light = lights[i];
+
+        if (light->ShadowMap())
+        {
+            lightData[i].shadowParameters = light->ShadowParameters();
+            lightData[i].shadowMatrix = light->ShadowViews()[0].shadowMatrix;
+        }
+    }
+
+    // The compute shader builds the clusters at render time from the light data alone, without decals
+    if (computeClustering)
+    {
+        decals.clear();
+        lightIndices.clear();
+        return;
+    }
+
+    // Finally clear per-cluster light data from previous frame, update cluster frustums and bounding boxes if camera changed, then cull lights for the needed scene range
     DefineClusterFrustums();
-    memset(numClusterLights, 0, sizeof numClusterLights);
-    memset(clusterData, 0, MAX_LIGHTS_CLUSTER * NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z);
-    for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
+    memset(numClusterLights, 0, numClusters * sizeof(unsigned short));
+    memset(numClusterDecals, 0, numClusters * sizeof(unsigned short));
+
+    // The Z-slices are in increasing depth order, so the slices overlapping the geometry depth range are contiguous
+    size_t zStart = clusterSize.z;
+    size_t zEnd = 0;
+    for (size_t z = 0; z < (size_t)clusterSize.z; ++z)
     {
-        size_t idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
+        size_t idx = z * clusterSize.x * clusterSize.y;
         if (minZ > clusterFrustums[idx].vertices[4].z || maxZ < clusterFrustums[idx].vertices[0].z)
             continue;
-        workQueue->QueueTask(cullLightsTasks[z]);
+        zStart = Min(zStart, z);
+        zEnd = z + 1;
     }
 
-    // Finally copy correct shadow matrices for the localized light data
-    // Note: directional light shadow matrices may still be pending, but they are not included here
-    for (size_t i = 0; i < lights.size(); ++i)
+    if (maxFarClusterLights)
     {
-        LightDrawable* light = lights[i];
+        lightViewPositions.resize(lights.size());
+        const Matrix3x4& cameraView = camera->ViewMatrix();
+        for (size_t i = 0; i < lights.size(); ++i)
+            lightViewPositions[i] = cameraView * lights[i]->WorldPosition();
+    }
 
-        if (light->ShadowMap())
+    if (lightHierarchy)
+    {
+        // The directional light is not in the list, so all lights are points or spots
+        lightViewBoxes.resize(lights.size());
+        const Matrix3x4& cameraView = camera->ViewMatrix();
+        for (size_t i = 0; i < lights.size(); ++i)
         {
-            lightData[i].shadowParameters = light->ShadowParameters();
-            lightData[i].shadowMatrix = light->ShadowViews()[0].shadowMatrix;
+            LightDrawable* light = lights[i];
+            if (light->GetLightType() == LIGHT_POINT)
+                lightViewBoxes[i].Define(Sphere(cameraView * light->WorldPosition(), light->Range()));
+            else
+                lightViewBoxes[i].Define(light->WorldFrustum().Transformed(cameraView));
         }
+        lightBvh.Build(lightViewBoxes);
+    }
+    else
+        lightBvh.Clear();
+
+    // Decals are binned by the bounding spheres of their boxes, like point lights
+    decalViewSpheres.resize(decals.size());
+    for (size_t i = 0; i < decals.size(); ++i)
+    {
+        const Matrix3x4& transform = decals[i]->WorldTransform();
+        decalViewSpheres[i].Define(camera->ViewMatrix() * transform.Translation(), 0.5f * transform.Scale().Length());
+    }
+
+    workQueue->ParallelFor(zStart, zEnd, 1, [this](size_t start, size_t end, unsigned)
+    {
+        CullLightsToFrustum(start, end);
+        if (maxFarClusterLights)
+            LimitFarClusterLights(start, end);
+        if (decals.size())
+            CullDecalsToFrustum(start, end);
+    });
+
+    // Pack the per-cluster lights into one variable-length index list, which the clusters refer to by offset and count.
+    // The decals follow the lights of each cluster, with their count in the upper 16 bits
+    clusterRanges.resize(numClusters * 2);
+    lightIndices.clear();
+    for (size_t i = 0; i < numClusters; ++i)
+    {
+        const unsigned short* indices = &clusterLights[i * maxLightsPerCluster];
+        const unsigned short* decalIndices = &clusterDecals[i * maxDecalsPerCluster];
+        clusterRanges[i * 2] = (unsigned)lightIndices.size();
+        clusterRanges[i * 2 + 1] = numClusterLights[i] | ((unsigned)numClusterDecals[i] << 16);
+        lightIndices.insert(lightIndices.end(), indices, indices + numClusterLights[i]);
+        lightIndices.insert(lightIndices.end(), decalIndices, decalIndices + numClusterDecals[i]);
     }
+    // Two indices are stored per texel
+    if (lightIndices.size() & 1)
+        lightIndices.push_back(0);
 }
 
 void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
@@ -1202,12 +5250,21 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
         LightDrawable* light = view.light;
         LightType lightType = light->GetLightType();
 
+        if (lightType == LIGHT_POINT && singlePassPointShadows)
+        {
+            CollectCubeShadowBatches(shadowMap, viewIdx);
+            break;
+        }
+
         float splitMinZ = minZ, splitMaxZ = maxZ;
+        // Static lights cache the static shadowcasters, which requires stable cascades for the directional light
+        bool cachedLight = light->IsStatic() && (lightType != LIGHT_DIRECTIONAL || dirShadowCaching);
+        bool timeSliced = lightType != LIGHT_DIRECTIONAL && shadowUpdateInterval > 1 && LightScreenRadius(light) < maxTimeSlicedPixels;
 
         // Focus directional light shadow camera to the visible geometry combined bounds, and query for shadowcasters late
         if (lightType == LIGHT_DIRECTIONAL)
         {
-            if (!light->SetupShadowView(viewIdx, camera, &geometryBounds))
+            if (!light->SetupShadowView(viewIdx, camera, &geometryBounds, cachedLight))
                 view.viewport = IntRect::ZERO;
             else
             {
@@ -1226,15 +5283,15 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
         if (view.viewport == IntRect::ZERO)
         {
             view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+            view.pendingRenderMode = RENDER_STATIC_LIGHT_CACHED;
             view.lastViewport = IntRect::ZERO;
         }
         else
         {
             const Frustum& shadowFrustum = view.shadowFrustum;
             const Matrix3x4& lightView = view.shadowCamera->ViewMatrix();
-            const std::vector<Drawable*>& initialShadowCasters = shadowMap.shadowCasters[view.casterListIdx];
+            const FrameVector<Drawable*>& initialShadowCasters = shadowMap.shadowCasters[view.casterListIdx];
 
-            bool dynamicOrDirLight = lightType == LIGHT_DIRECTIONAL || !light->IsStatic();
             bool dynamicCastersMoved = false;
             bool staticCastersMoved = false;
 
@@ -1242,9 +5299,9 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
             size_t staticShadowCasters = 0;
 
             Frustum lightViewFrustum = camera->WorldSplitFrustum(splitMinZ, splitMaxZ).Transformed(lightView);
-            BoundingBox lightViewFrustumBox(lightViewFrustum);
+            BoundingBox receiverBox = ReceiverBox(lightView, BoundingBox(lightViewFrustum));
 
-            BatchQueue* destStatic = !dynamicOrDirLight ? &shadowMap.shadowBatches[view.staticQueueIdx] : nullptr;
+            BatchQueue* destStatic = cachedLight ? &shadowMap.shadowBatches[view.staticQueueIdx] : nullptr;
             BatchQueue* destDynamic = &shadowMap.shadowBatches[view.dynamicQueueIdx];
 
             for (auto it = initialShadowCasters.begin(); it != initialShadowCasters.end(); ++it)
@@ -1259,16 +5316,21 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
                 if (lightType == LIGHT_POINT && !shadowFrustum.IsInsideFast(geometryBox))
                     continue;
 
-                // Furthermore, check by bounding box extrusion if out-of-view or directional light shadowcaster actually contributes to visible geometry shadowing or if it can be skipped
+                // Skip casters too small on the main view. Done only when the shadow map is not cached for static casters
+                if (minShadowPixels > 0.0f && (!staticNode || !cachedLight) && IsBelowScreenSize(geometryBox, minShadowPixels))
+                    continue;
+
+                // Furthermore, check by bounding box extrusion if out-of-view or directional light shadowcaster actually contributes to visible geometry shadowing or if it can be skipped.
+                // The extruded box must reach both the split frustum and the visible receivers in it.
                 // This is done only for dynamic objects or dynamic lights' shadows; cached static shadowmap needs to render everything
-                if ((!staticNode || dynamicOrDirLight) && !inView)
+                if ((!staticNode || !cachedLight) && !inView)
                 {
                     BoundingBox lightViewBox = geometryBox.Transformed(lightView);
 
                     if (lightType == LIGHT_DIRECTIONAL)
                     {
-                        lightViewBox.max.z = Max(lightViewBox.max.z, lightViewFrustumBox.max.z);
-                        if (!lightViewFrustum.IsInsideFast(lightViewBox))
+                        lightViewBox.max.z = Max(lightViewBox.max.z, receiverBox.max.z);
+                        if (!receiverBox.IsInsideFast(lightViewBox) || !lightViewFrustum.IsInsideFast(lightViewBox))
                             continue;
                     }
                     else
@@ -1290,7 +5352,7 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
                         BoundingBox extrudedBox(newCenter - newHalfSize, newCenter + newHalfSize);
                         lightViewBox.Merge(extrudedBox);
 
-                        if (!lightViewFrustum.IsInsideFast(lightViewBox))
+                        if (!receiverBox.IsInsideFast(lightViewBox) || !lightViewFrustum.IsInsideFast(lightViewBox))
                             continue;
                     }
                 }
@@ -1317,69 +5379,28 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
                 }
 
                 // If did not allocate a static queue, just put everything to dynamic
-                BatchQueue& dest = destStatic ? (staticNode ? *destStatic : *destDynamic) : *destDynamic;
-                const SourceBatches& batches = static_cast<GeometryDrawable*>(drawable)->batches;
-                size_t numGeometries = batches.NumGeometries();
-
-                Batch newBatch;
-
-                for (size_t j = 0; j < numGeometries; ++j)
-                {
-                    Material* material = batches.GetMaterial(j);
-                    newBatch.pass = material->GetPass(PASS_SHADOW);
-                    if (!newBatch.pass)
-                        continue;
-
-                    newBatch.geometry = batches.GetGeometry(j);
-                    newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
-                    newBatch.geomIndex = (unsigned char)j;
-
-                    if (!newBatch.programBits)
-                        newBatch.worldTransform = &drawable->WorldTransform();
-                    else
-                        newBatch.drawable = static_cast<GeometryDrawable*>(drawable);
-
-                    dest.batches.push_back(newBatch);
-                }
+                AddShadowBatches(drawable, destStatic ? (staticNode ? *destStatic : *destDynamic) : *destDynamic, staticInstanceTable);
             }
 
-            // Now determine which kind of caching can be used for the shadow map
-            // Dynamic or directional lights
-            if (dynamicOrDirLight)
-            {
-                // If light atlas allocation changed, light moved, or amount of objects in view changed, render an optimized shadow map
-                if (view.lastViewport != view.viewport || !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f) || view.lastNumGeometries != totalShadowCasters || dynamicCastersMoved || staticCastersMoved)
-                    view.renderMode = RENDER_DYNAMIC_LIGHT;
-                else
-                    view.renderMode = RENDER_STATIC_LIGHT_CACHED;
-            }
-            // Static lights
-            else
-            {
-                // If light atlas allocation has changed, or the static light changed, render a full shadow map now that can be cached next frame
-                if (view.lastViewport != view.viewport || !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f))
-                    view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
-                else
-                {
-                    view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+            // Static casters may also have been removed or moved out of the light. Render the static casters again only if a change touches this view
+            if (cachedLight && !staticCastersMoved && HasStaticChanges(shadowFrustum))
+                staticCastersMoved = true;
 
-                    // If static shadowcasters updated themselves (e.g. LOD change), render shadow map fully
-                    // If dynamic casters moved, need to restore shadowmap and rerender
-                    if (staticCastersMoved)
-                        view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
-                    else
-                    {
-                        if (dynamicCastersMoved || view.lastNumGeometries != totalShadowCasters)
-                            view.renderMode = staticShadowCasters > 0 ? RENDER_STATIC_LIGHT_RESTORE_STATIC : RENDER_DYNAMIC_LIGHT;
-                    }
-                }
-            }
+            DecideShadowRenderMode(view, cachedLight, timeSliced, view.lastViewport != view.viewport, !view.lastShadowMatrix.Equals(view.shadowMatrix, 0.0001f),
+                totalShadowCasters, staticShadowCasters, staticCastersMoved, dynamicCastersMoved);
 
-            // If no rendering to be done, use the last rendered shadow projection matrix to avoid artifacts when rotating camera
+            // If no rendering to be done, use the last rendered shadow projection matrix to avoid artifacts when rotating camera.
+            // The batches will not be rendered, so skip sorting them
             if (view.renderMode == RENDER_STATIC_LIGHT_CACHED)
+            {
                 view.shadowMatrix = view.lastShadowMatrix;
+                destDynamic->Clear();
+                if (destStatic)
+                    destStatic->Clear();
+            }
             else
             {
+                view.lastRenderFrameNumber = frameNumber;
                 view.lastViewport = view.viewport;
                 view.lastNumGeometries = totalShadowCasters;
                 view.lastShadowMatrix = view.shadowMatrix;
@@ -1402,63 +5423,550 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
         SortShadowBatches(shadowMap);
 }
 
-void Renderer::CullLightsToFrustumWork(Task* task, unsigned)
+bool Renderer::HasStaticChanges(const Frustum& shadowFrustum) const
+{
+    for (auto it = staticChanges.begin(); it != staticChanges.end(); ++it)
+    {
+        if (shadowFrustum.IsInsideFast(*it))
+            return true;
+    }
+
+    return false;
+}
+
+bool Renderer::HasStaticChanges(const BoundingBox& box) const
+{
+    for (auto it = staticChanges.begin(); it != staticChanges.end(); ++it)
+    {
+        if (box.IsInsideFast(*it))
+            return true;
+    }
+
+    return false;
+}
+
+BoundingBox Renderer::ReceiverBox(const Matrix3x4& lightView, const BoundingBox& lightViewFrustumBox) const
+{
+    BoundingBox receiverBox = lightViewFrustumBox;
+
+    // If the visible geometry does not overlap the frustum box, keep the frustum box to stay conservative
+    if (geometryBounds.IsDefined())
+    {
+        BoundingBox lightViewGeometryBox = geometryBounds.Transformed(lightView);
+        if (receiverBox.IsInsideFast(lightViewGeometryBox))
+            receiverBox.Clip(lightViewGeometryBox);
+    }
+
+    return receiverBox;
+}
+
+void Renderer::DecideShadowRenderMode(ShadowView& view, bool cachedLight, bool timeSliced, bool viewportChanged, bool matrixChanged, size_t totalShadowCasters, size_t staticShadowCasters,
+    bool staticCastersMoved, bool dynamicCastersMoved)
+{
+    // Determine which kind of caching can be used for the shadow map
+    // Dynamic lights, or directional lights without caching
+    if (!cachedLight)
+    {
+        // If light atlas allocation changed, light moved, or amount of objects in view changed, render an optimized shadow map
+        if (viewportChanged || matrixChanged || view.lastNumGeometries != totalShadowCasters || dynamicCastersMoved || staticCastersMoved)
+            view.renderMode = RENDER_DYNAMIC_LIGHT;
+        else
+            view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+    }
+    // Static lights
+    else
+    {
+        // If light atlas allocation has changed, or the static light changed, render a full shadow map now that can be cached next frame
+        if (viewportChanged || matrixChanged)
+            view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
+        else
+        {
+            view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+
+            // If static shadowcasters updated themselves (e.g. LOD change), render shadow map fully
+            // If dynamic casters moved, need to restore shadowmap and rerender
+            if (staticCastersMoved)
+                view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
+            else
+            {
+                if (dynamicCastersMoved || view.lastNumGeometries != totalShadowCasters)
+                    view.renderMode = staticShadowCasters > 0 ? RENDER_STATIC_LIGHT_RESTORE_STATIC : RENDER_DYNAMIC_LIGHT;
+            }
+        }
+    }
+
+    // Combine with a render postponed by time slicing, as the changes it was due to may not be detected again. A full static store overrides the rest
+    if (view.pendingRenderMode != RENDER_STATIC_LIGHT_CACHED)
+    {
+        if (view.pendingRenderMode == RENDER_STATIC_LIGHT_STORE_STATIC)
+            view.renderMode = RENDER_STATIC_LIGHT_STORE_STATIC;
+        else if (view.renderMode == RENDER_STATIC_LIGHT_CACHED)
+            view.renderMode = (cachedLight && staticShadowCasters > 0) ? RENDER_STATIC_LIGHT_RESTORE_STATIC : RENDER_DYNAMIC_LIGHT;
+        view.pendingRenderMode = RENDER_STATIC_LIGHT_CACHED;
+    }
+
+    // Postpone the render of a small light while its atlas region still holds the previous render
+    if (timeSliced && view.renderMode != RENDER_STATIC_LIGHT_CACHED && !viewportChanged &&
+        (unsigned short)(frameNumber - view.lastRenderFrameNumber) < shadowUpdateInterval)
+    {
+        view.pendingRenderMode = view.renderMode;
+        view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+    }
+}
+
+void Renderer::CollectCubeShadowBatches(ShadowMap& shadowMap, size_t viewIdx)
+{
+    ShadowView** views = &shadowMap.shadowViews[viewIdx];
+    LightDrawable* light = views[0]->light;
+
+    bool cachedLight = light->IsStatic();
+    bool timeSliced = shadowUpdateInterval > 1 && LightScreenRadius(light) < maxTimeSlicedPixels;
+
+    // The faces not in view were discarded during the shadowcaster query. The first face in view renders all of them
+    ShadowView* renderView = nullptr;
+    unsigned char facesInView = 0;
+    bool viewportChanged = false;
+
+    for (size_t i = 0; i < 6; ++i)
+    {
+        ShadowView& view = *views[i];
+        view.renderMode = RENDER_STATIC_LIGHT_CACHED;
+
+        if (view.viewport == IntRect::ZERO)
+        {
+            view.pendingRenderMode = RENDER_STATIC_LIGHT_CACHED;
+            view.lastViewport = IntRect::ZERO;
+            continue;
+        }
+
+        facesInView |= 1 << i;
+        if (view.lastViewport != view.viewport)
+            viewportChanged = true;
+        if (!renderView)
+            renderView = &view;
+    }
+
+    if (!renderView)
+        return;
+
+    const Matrix3x4& lightView = renderView->shadowCamera->ViewMatrix();
+    const FrameVector<Drawable*>& initialShadowCasters = shadowMap.shadowCasters[renderView->casterListIdx];
+
+    bool dynamicCastersMoved = false;
+    bool staticCastersMoved = false;
+
+    size_t totalShadowCasters = 0;
+    size_t staticShadowCasters = 0;
+    unsigned char facesWithCasters = 0;
+
+    Frustum lightViewFrustum = camera->WorldSplitFrustum(minZ, maxZ).Transformed(lightView);
+    BoundingBox receiverBox = ReceiverBox(lightView, BoundingBox(lightViewFrustum));
+
+    BatchQueue* destStatic = cachedLight ? &shadowMap.shadowBatches[renderView->staticQueueIdx] : nullptr;
+    BatchQueue* destDynamic = &shadowMap.shadowBatches[renderView->dynamicQueueIdx];
+
+    for (auto it = initialShadowCasters.begin(); it != initialShadowCasters.end(); ++it)
+    {
+        Drawable* drawable = *it;
+        const BoundingBox& geometryBox = drawable->WorldBoundingBox();
+
+        bool inView = drawable->InView(frameNumber);
+        bool staticNode = drawable->IsStatic();
+
+        // Test the faces once per caster. The geometry shader culls the triangles of each face in the mask
+        unsigned char casterFaces = 0;
+        for (size_t i = 0; i < 6; ++i)
+        {
+            if ((facesInView & (1 << i)) && views[i]->shadowFrustum.IsInsideFast(geometryBox))
+                casterFaces |= 1 << i;
+        }
+        if (!casterFaces)
+            continue;
+
+        if (minShadowPixels > 0.0f && (!staticNode || !cachedLight) && IsBelowScreenSize(geometryBox, minShadowPixels))
+            continue;
+
+        // Check by bounding box extrusion away from the light whether an out-of-view caster can shadow visible geometry.
+        // The extrusion does not depend on the face, so use the light view of the rendering face
+        if ((!staticNode || !cachedLight) && !inView)
+        {
+            BoundingBox lightViewBox = geometryBox.Transformed(lightView);
+            Vector3 center = lightViewBox.Center();
+            Ray extrusionRay(center, center);
+
+            float extrusionDistance = renderView->shadowCamera->FarClip();
+            float originalDistance = Clamp(center.Length(), M_EPSILON, extrusionDistance);
+            float sizeFactor = extrusionDistance / originalDistance;
+
+            Vector3 newCenter = extrusionDistance * extrusionRay.direction;
+            Vector3 newHalfSize = lightViewBox.Size() * sizeFactor * 0.5f;
+            lightViewBox.Merge(BoundingBox(newCenter - newHalfSize, newCenter + newHalfSize));
+
+            if (!receiverBox.IsInsideFast(lightViewBox) || !lightViewFrustum.IsInsideFast(lightViewBox))
+                continue;
+        }
+
+        if (!inView)
+        {
+            if (!drawable->OnPrepareRender(frameNumber, camera))
+                continue;
+        }
+
+        ++totalShadowCasters;
+        facesWithCasters |= casterFaces;
+
+        if (staticNode)
+        {
+            ++staticShadowCasters;
+            if (drawable->LastUpdateFrameNumber() == frameNumber)
+                staticCastersMoved = true;
+        }
+        else
+        {
+            if (drawable->LastUpdateFrameNumber() == frameNumber)
+                dynamicCastersMoved = true;
+        }
+
+        AddShadowBatches(drawable, destStatic ? (staticNode ? *destStatic : *destDynamic) : *destDynamic, staticInstanceTable);
+    }
+
+    if (cachedLight && !staticCastersMoved)
+    {
+        for (size_t i = 0; i < 6; ++i)
+        {
+            if ((facesInView & (1 << i)) && HasStaticChanges(views[i]->shadowFrustum))
+            {
+                staticCastersMoved = true;
+                break;
+            }
+        }
+    }
+
+    DecideShadowRenderMode(*renderView, cachedLight, timeSliced, viewportChanged, !renderView->lastShadowMatrix.Equals(renderView->shadowMatrix, 0.0001f),
+        totalShadowCasters, staticShadowCasters, staticCastersMoved, dynamicCastersMoved);
+
+    ShadowRenderMode renderMode = renderView->renderMode;
+
+    if (renderMode == RENDER_STATIC_LIGHT_CACHED)
+    {
+        destDynamic->Clear();
+        if (destStatic)
+            destStatic->Clear();
+    }
+    else
+    {
+        renderView->lastNumGeometries = totalShadowCasters;
+        renderView->cubeFaceMask = facesWithCasters;
+
+        if (destStatic && renderMode != RENDER_STATIC_LIGHT_STORE_STATIC)
+            destStatic->Clear();
+    }
+
+    // All faces in view are cleared or restored, and rendered together
+    for (size_t i = 0; i < 6; ++i)
+    {
+        ShadowView& view = *views[i];
+        if (!(facesInView & (1 << i)))
+            continue;
+
+        view.renderMode = renderMode;
+        if (renderMode == RENDER_STATIC_LIGHT_CACHED)
+            view.shadowMatrix = view.lastShadowMatrix;
+        else
+        {
+            view.lastRenderFrameNumber = frameNumber;
+            view.lastViewport = view.viewport;
+            view.lastShadowMatrix = view.shadowMatrix;
+        }
+    }
+}
+
+void Renderer::CullLightsToFrustum(size_t zStart, size_t zEnd)
 {
     ZoneScoped;
 
-    // Cull lights against each cluster frustum on the given Z-level
-    size_t z = static_cast<CullLightsTask*>(task)->z;
+    // Cull lights against the clusters on the given Z-levels. The cluster side planes first reject whole columns and rows,
+    // after which each remaining row is tested eight clusters at a time. Processing the lights in order keeps the per-cluster lists sorted
     const Matrix3x4& cameraView = camera->ViewMatrix();
+    size_t rowSize = clusterSize.x;
+    size_t sliceSize = clusterSize.x * clusterSize.y;
+    unsigned numOverflows = 0;
+
+    // In light hierarchy mode, query only the lights overlapping the depth range of the slices, and sort them to keep the per-cluster lists sorted
+    bool useHierarchy = !lightBvh.IsEmpty();
+    std::vector<unsigned> candidates;
+    if (useHierarchy)
+    {
+        float nearZ = clusterFrustums[zStart * sliceSize].vertices[0].z;
+        float farZ = clusterFrustums[(zEnd - 1) * sliceSize].vertices[4].z;
+        const std::vector<BvhNode>& nodes = lightBvh.Nodes();
+        const std::vector<unsigned>& objectIndices = lightBvh.ObjectIndices();
 
-    for (size_t i = 0; i < lights.size(); ++i)
+        unsigned stack[BVH_STACK_SIZE];
+        size_t stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize)
+        {
+            const BvhNode& node = nodes[stack[--stackSize]];
+            if (node.min.z > farZ || node.max.z < nearZ)
+                continue;
+
+            if (node.IsLeaf())
+            {
+                unsigned start = lightBvh.LeafStart(node.index);
+                for (unsigned j = start; j < start + node.count; ++j)
+                {
+                    unsigned index = objectIndices[j];
+                    if (lightViewBoxes[index].min.z <= farZ && lightViewBoxes[index].max.z >= nearZ)
+                        candidates.push_back(index);
+                }
+            }
+            else
+            {
+                stack[stackSize++] = node.index + 1;
+                stack[stackSize++] = node.index;
+            }
+        }
+
+        std::sort(candidates.begin(), candidates.end());
+    }
+
+    size_t numCandidates = useHierarchy ? candidates.size() : lights.size();
+    for (size_t c = 0; c < numCandidates; ++c)
     {
+        size_t i = useHierarchy ? candidates[c] : c;
         LightDrawable* light = lights[i];
         LightType lightType = light->GetLightType();
+        if (lightType != LIGHT_POINT && lightType != LIGHT_SPOT)
+            continue;
+
+        Sphere sphereBounds;
+        Frustum frustumBounds;
+        BoundingBox boundsBox;
+        Vector3 center;
+        Vector3 edge;
+        float radius = 0.0f;
 
         if (lightType == LIGHT_POINT)
         {
-            Sphere bounds(cameraView * light->WorldPosition(), light->Range());
-            float minViewZ = bounds.center.z - light->Range();
-            float maxViewZ = bounds.center.z + light->Range();
+            sphereBounds.Define(cameraView * light->WorldPosition(), light->Range());
+            boundsBox.Define(sphereBounds);
+            center = sphereBounds.center;
+            radius = sphereBounds.radius;
+        }
+        else
+        {
+            frustumBounds = light->WorldFrustum().Transformed(cameraView);
+            boundsBox.Define(frustumBounds);
+            center = boundsBox.Center();
+            edge = center - boundsBox.min;
+        }
+
+        // Find the contiguous range of columns and rows the light can touch
+        size_t xStart = rowSize;
+        size_t xEnd = 0;
+        for (size_t x = 0; x < rowSize; ++x)
+        {
+            const Plane& left = clusterColumnPlanes[x * 2];
+            const Plane& right = clusterColumnPlanes[x * 2 + 1];
+            float leftExtent = lightType == LIGHT_POINT ? radius : left.absNormal.DotProduct(edge);
+            float rightExtent = lightType == LIGHT_POINT ? radius : right.absNormal.DotProduct(edge);
+            if (left.Distance(center) < -leftExtent || right.Distance(center) < -rightExtent)
+                continue;
+            xStart = Min(xStart, x);
+            xEnd = x + 1;
+        }
+        if (xStart >= xEnd)
+            continue;
+
+        size_t yStart = clusterSize.y;
+        size_t yEnd = 0;
+        for (size_t y = 0; y < (size_t)clusterSize.y; ++y)
+        {
+            const Plane& up = clusterRowPlanes[y * 2];
+            const Plane& down = clusterRowPlanes[y * 2 + 1];
+            float upExtent = lightType == LIGHT_POINT ? radius : up.absNormal.DotProduct(edge);
+            float downExtent = lightType == LIGHT_POINT ? radius : down.absNormal.DotProduct(edge);
+            if (up.Distance(center) < -upExtent || down.Distance(center) < -downExtent)
+                continue;
+            yStart = Min(yStart, y);
+            yEnd = y + 1;
+        }
+        if (yStart >= yEnd)
+            continue;
+
+        size_t packStart = xStart / BOUNDING_BOX_PACK_SIZE;
+        size_t packEnd = (xEnd + BOUNDING_BOX_PACK_SIZE - 1) / BOUNDING_BOX_PACK_SIZE;
 
-            size_t idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-            if (minViewZ > clusterFrustums[idx].vertices[4].z || maxViewZ < clusterFrustums[idx].vertices[0].z || numClusterLights[idx] >= MAX_LIGHTS_CLUSTER)
+        for (size_t z = zStart; z < zEnd; ++z)
+        {
+            const Frustum& sliceFrustum = clusterFrustums[z * sliceSize];
+            if (boundsBox.min.z > sliceFrustum.vertices[4].z || boundsBox.max.z < sliceFrustum.vertices[0].z)
                 continue;
 
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
+            for (size_t y = yStart; y < yEnd; ++y)
             {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
+                const BoundingBoxPack* packs = &clusterBoxPacks[(z * clusterSize.y + y) * clusterPacksPerRow];
+                size_t rowIdx = z * sliceSize + y * rowSize;
+
+                for (size_t p = packStart; p < packEnd; ++p)
                 {
-                    if (bounds.IsInsideFast(clusterBoundingBoxes[idx]) && clusterFrustums[idx].IsInsideFast(bounds))
-                        clusterData[(idx << 4) + numClusterLights[idx]++] = (unsigned char)(i + 1);
+                    size_t packX = p * BOUNDING_BOX_PACK_SIZE;
+                    unsigned mask = lightType == LIGHT_POINT ? sphereBounds.IsInsideFast(packs[p]) : frustumBounds.IsInsideMaskedFast(packs[p]);
 
-                    ++idx;
+                    // Restrict to the column range; this also removes the padding at the end of the row
+                    if (xStart > packX)
+                        mask &= ~((1u << (xStart - packX)) - 1);
+                    if (xEnd < packX + BOUNDING_BOX_PACK_SIZE)
+                        mask &= (1u << (xEnd - packX)) - 1;
+
+                    while (mask)
+                    {
+                        size_t bit = 0;
+                        while (!(mask & (1u << bit)))
+                            ++bit;
+                        mask &= ~(1u << bit);
+
+                        size_t idx = rowIdx + packX + bit;
+                        if (numClusterLights[idx] < maxLightsPerCluster)
+                            clusterLights[idx * maxLightsPerCluster + numClusterLights[idx]++] = (unsigned short)i;
+                        else
+                            ++numOverflows;
+                    }
                 }
             }
         }
-        else if (lightType == LIGHT_SPOT)
+    }
+
+    ThreadStats().clusterLightOverflows += numOverflows;
+}
+
+void Renderer::CullDecalsToFrustum(size_t zStart, size_t zEnd)
+{
+    ZoneScoped;
+
+    // Same as the point light culling: reject whole columns and rows with the side planes, then test the rows eight clusters at a time
+    size_t rowSize = clusterSize.x;
+    size_t sliceSize = clusterSize.x * clusterSize.y;
+    unsigned numOverflows = 0;
+
+    for (size_t i = 0; i < decals.size(); ++i)
+    {
+        const Sphere& sphereBounds = decalViewSpheres[i];
+        const Vector3& center = sphereBounds.center;
+        float radius = sphereBounds.radius;
+
+        size_t xStart = rowSize;
+        size_t xEnd = 0;
+        for (size_t x = 0; x < rowSize; ++x)
+        {
+            if (clusterColumnPlanes[x * 2].Distance(center) < -radius || clusterColumnPlanes[x * 2 + 1].Distance(center) < -radius)
+                continue;
+            xStart = Min(xStart, x);
+            xEnd = x + 1;
+        }
+        if (xStart >= xEnd)
+            continue;
+
+        size_t yStart = clusterSize.y;
+        size_t yEnd = 0;
+        for (size_t y = 0; y < (size_t)clusterSize.y; ++y)
         {
-            Frustum bounds(light->WorldFrustum().Transformed(cameraView));
-            BoundingBox boundsBox(bounds);
-            float minViewZ = boundsBox.min.z;
-            float maxViewZ = boundsBox.max.z;
+            if (clusterRowPlanes[y * 2].Distance(center) < -radius || clusterRowPlanes[y * 2 + 1].Distance(center) < -radius)
+                continue;
+            yStart = Min(yStart, y);
+            yEnd = y + 1;
+        }
+        if (yStart >= yEnd)
+            continue;
 
-            size_t idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-            if (minViewZ > clusterFrustums[idx].vertices[4].z || maxViewZ < clusterFrustums[idx].vertices[0].z || numClusterLights[idx] >= MAX_LIGHTS_CLUSTER)
+        size_t packStart = xStart / BOUNDING_BOX_PACK_SIZE;
+        size_t packEnd = (xEnd + BOUNDING_BOX_PACK_SIZE - 1) / BOUNDING_BOX_PACK_SIZE;
+
+        for (size_t z = zStart; z < zEnd; ++z)
+        {
+            const Frustum& sliceFrustum = clusterFrustums[z * sliceSize];
+            if (center.z - radius > sliceFrustum.vertices[4].z || center.z + radius < sliceFrustum.vertices[0].z)
                 continue;
 
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
+            for (size_t y = yStart; y < yEnd; ++y)
             {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
+                const BoundingBoxPack* packs = &clusterBoxPacks[(z * clusterSize.y + y) * clusterPacksPerRow];
+                size_t rowIdx = z * sliceSize + y * rowSize;
+
+                for (size_t p = packStart; p < packEnd; ++p)
                 {
-                    if (bounds.IsInsideFast(clusterBoundingBoxes[idx]) && clusterFrustums[idx].IsInsideFast(boundsBox))
-                        clusterData[(idx << 4) + numClusterLights[idx]++] = (unsigned char)(i + 1);
+                    size_t packX = p * BOUNDING_BOX_PACK_SIZE;
+                    unsigned mask = sphereBounds.IsInsideFast(packs[p]);
+
+                    if (xStart > packX)
+                        mask &= ~((1u << (xStart - packX)) - 1);
+                    if (xEnd < packX + BOUNDING_BOX_PACK_SIZE)
+                        mask &= (1u << (xEnd - packX)) - 1;
 
-                    ++idx;
+                    while (mask)
+                    {
+                        size_t bit = 0;
+                        while (!(mask & (1u << bit)))
+                            ++bit;
+                        mask &= ~(1u << bit);
+
+                        size_t idx = rowIdx + packX + bit;
+                        if (numClusterDecals[idx] < maxDecalsPerCluster)
+                            clusterDecals[idx * maxDecalsPerCluster + numClusterDecals[idx]++] = (unsigned short)i;
+                        else
+                            ++numOverflows;
+                    }
                 }
             }
         }
     }
+
+    ThreadStats().clusterDecalOverflows += numOverflows;
+}
+
+void Renderer::LimitFarClusterLights(size_t zStart, size_t zEnd)
+{
+    ZoneScoped;
+
+    size_t sliceSize = clusterSize.x * clusterSize.y;
+    std::vector<std::pair<float, unsigned short> > ranked;
+
+    for (size_t z = zStart; z < zEnd; ++z)
+    {
+        if (clusterFrustums[z * sliceSize].vertices[0].z < farClusterLightDistance)
+            continue;
+
+        for (size_t idx = z * sliceSize; idx < (z + 1) * sliceSize; ++idx)
+        {
+            size_t numLights = numClusterLights[idx];
+            if (numLights <= maxFarClusterLights)
+                continue;
+
+            // Rank by the light intensity attenuated to the cluster center, like the attenuation in the shaders
+            const Frustum& frustum = clusterFrustums[idx];
+            Vector3 center = 0.5f * (frustum.vertices[0] + frustum.vertices[6]);
+            unsigned short* indices = &clusterLights[idx * maxLightsPerCluster];
+            ranked.resize(numLights);
+
+            // The contribution is negated to sort the highest first
+            for (size_t i = 0; i < numLights; ++i)
+            {
+                unsigned short index = indices[i];
+                const LightData& data = lightData[index];
+                Vector3 scaledLightVec = (lightViewPositions[index] - center) * data.attenuation.x;
+                ranked[i] = std::make_pair(-data.color.SumRGB() * Max(1.0f - scaledLightVec.LengthSquared(), 0.0f), index);
+            }
+
+            std::partial_sort(ranked.begin(), ranked.begin() + maxFarClusterLights, ranked.end());
+            for (size_t i = 0; i < maxFarClusterLights; ++i)
+                indices[i] = ranked[i].second;
+            // Keep the list sorted like the culling results
+            std::sort(indices, indices + maxFarClusterLights);
+            numClusterLights[idx] = (unsigned short)maxFarClusterLights;
+        }
+    }
 }
 
 void RegisterRendererLibrary()
@@ -1476,8 +5984,13 @@ void RegisterRendererLibrary()
     StaticModel::RegisterObject();
     Bone::RegisterObject();
     AnimatedModel::RegisterObject();
+    ParticleEmitter::RegisterObject();
+    Crowd::RegisterObject();
+    Terrain::RegisterObject();
     Light::RegisterObject();
+    Decal::RegisterObject();
     Material::RegisterObject();
+    VirtualTexture::RegisterObject();
     Model::RegisterObject();
     Animation::RegisterObject();
 
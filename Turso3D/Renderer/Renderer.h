@@ -3,25 +3,41 @@
 #pragma once
 
 #include "../Graphics/GraphicsDefs.h"
+#include "../Graphics/IndirectBuffer.h"
+#include "../Math/Bvh.h"
 #include "../Math/Color.h"
 #include "../Math/Frustum.h"
 #include "../Object/AutoPtr.h"
 #include "../Resource/Image.h"
+#include "../Thread/FrameAllocator.h"
 #include "../Thread/WorkQueue.h"
 #include "Batch.h"
+#include "GpuCulling.h"
+#include "Light.h"
+#include "LightProbeGrid.h"
+#include "OcclusionBuffer.h"
+#include "OcclusionRasterizer.h"
+#include "PortalCells.h"
+#include "RenderCommand.h"
 
 #include <atomic>
 
 class Camera;
+class DecalDrawable;
+class Drawable;
 class FrameBuffer;
 class GeometryDrawable;
 class Graphics;
-class LightDrawable;
+class IndexBuffer;
 class Material;
 class Octree;
+class Readback;
 class RenderBuffer;
+class Resource;
 class Scene;
+class SecondaryView;
 class ShaderProgram;
+class Stream;
 class Texture;
 class UniformBuffer;
 class VertexBuffer;
@@ -29,16 +45,30 @@ struct CollectOctantsTask;
 struct CollectBatchesTask;
 struct CollectShadowBatchesTask;
 struct CollectShadowCastersTask;
-struct CullLightsTask;
+struct CollectSecondaryViewTask;
 struct Octant;
-struct ShadowView;
 
-static const size_t NUM_CLUSTER_X = 16;
-static const size_t NUM_CLUSTER_Y = 8;
-static const size_t NUM_CLUSTER_Z = 8;
-static const size_t MAX_LIGHTS = 255;
-static const size_t MAX_LIGHTS_CLUSTER = 16;
-static const size_t NUM_OCTANT_TASKS = 9;
+static const int DEFAULT_CLUSTER_X = 16;
+static const int DEFAULT_CLUSTER_Y = 8;
+static const int DEFAULT_CLUSTER_Z = 8;
+static const size_t DEFAULT_MAX_LIGHTS = 1024;
+static const size_t DEFAULT_MAX_LIGHTS_CLUSTER = 64;
+static const size_t MAX_LIGHTS = 65535;
+static const size_t DEFAULT_MAX_DECALS = 4096;
+static const size_t DEFAULT_MAX_DECALS_CLUSTER = 32;
+static const size_t MAX_DECALS = 65535;
+static const float DEFAULT_CLUSTER_NEAR_SPLIT = 5.0f;
+static const size_t MAX_FAR_CLUSTER_LIGHTS = 8;
+static const int DEFAULT_MIN_SHADOW_MAP_SIZE = 64;
+static const size_t DEFAULT_STREAMING_BUDGET = 4 * 1024 * 1024;
+static const unsigned DEFAULT_TEXTURE_EVICT_FRAMES = 30;
+static const int LIGHTS_PER_ROW = 256;
+static const int DECALS_PER_ROW = 256;
+static const int LIGHT_INDEX_TEXTURE_WIDTH = 4096;
+static const size_t NUM_OCTANT_TASKS = 10;
+static const int OCCLUSION_BUFFER_WIDTH = 256;
+static const size_t MAX_VISIBILITY_BINS = 256;
+static const int VIRTUAL_FEEDBACK_SCALE = 8;
 
 // Texture units with built-in meanings.
 static const size_t TU_DIRLIGHTSHADOW = 8;
@@ -46,11 +76,127 @@ static const size_t TU_SHADOWATLAS = 9;
 static const size_t TU_FACESELECTION1 = 10;
 static const size_t TU_FACESELECTION2 = 11;
 static const size_t TU_LIGHTCLUSTERDATA = 12;
+static const size_t TU_SKINMATRICES = 13;
+static const size_t TU_LIGHTINDICES = 14;
+static const size_t TU_LIGHTDATA = 15;
+static const size_t TU_STATICTRANSFORMS = 16;
+static const size_t TU_TERRAINHEIGHT = 17;
+// Crowd vertex animation shares the unit with the terrain heights, as both are bound by their drawables before drawing
+static const size_t TU_VERTEXANIMATION = 17;
+static const size_t TU_DECALDATA = 18;
+static const size_t TU_DECALATLAS = 19;
+static const size_t TU_LIGHTPROBES = 20;
+static const size_t TU_MATERIALTABLE = 21;
+static const size_t TU_VIRTUALPAGETABLE = 22;
+
+// Image units with built-in meanings.
+static const size_t IU_VIRTUALFEEDBACK = 7;
+
+static const int SKIN_MATRICES_PER_ROW = 1024;
+static const int STATIC_TRANSFORMS_PER_ROW = 1024;
+static const int MATERIAL_TABLE_ENTRIES_PER_ROW = 1024;
+
+/// Fast approximate math subsystem flags.
+static const unsigned FAST_MATH_ANIMATION = 0x1;
+static const unsigned FAST_MATH_LIGHTS = 0x2;
+static const unsigned FAST_MATH_DISTANCES = 0x4;
+
+/// Rendering statistics of one frame. Counted per thread and merged when the next view is prepared.
+struct RenderStats
+{
+    /// Reset all counts to zero.
+    void Clear() { *this = RenderStats(); }
+
+    /// Add the counts of another.
+    void Merge(const RenderStats& rhs)
+    {
+        drawCalls += rhs.drawCalls;
+        triangles += rhs.triangles;
+        stateCalls += rhs.stateCalls;
+        filteredStateCalls += rhs.filteredStateCalls;
+        instancedBatches += rhs.instancedBatches;
+        nonInstancedBatches += rhs.nonInstancedBatches;
+        sortedBatches += rhs.sortedBatches;
+        shadowViewsRendered += rhs.shadowViewsRendered;
+        shadowViewsCached += rhs.shadowViewsCached;
+        lightsInView += rhs.lightsInView;
+        lightsAccepted += rhs.lightsAccepted;
+        shadowedLights += rhs.shadowedLights;
+        clusterLightOverflows += rhs.clusterLightOverflows;
+        decalsAccepted += rhs.decalsAccepted;
+        clusterDecalOverflows += rhs.clusterDecalOverflows;
+    }
+
+    /// Draw calls, from the last presented frame.
+    unsigned drawCalls;
+    /// Triangles drawn, from the last presented frame.
+    size_t triangles;
+    /// State change calls including filtered, from the last presented frame.
+    unsigned stateCalls;
+    /// Redundant state change calls filtered, from the last presented frame.
+    unsigned filteredStateCalls;
+    /// Instanced or multi-draw batch groups rendered.
+    unsigned instancedBatches;
+    /// Batches rendered without instancing.
+    unsigned nonInstancedBatches;
+    /// Batches sorted in the main view and shadow views.
+    size_t sortedBatches;
+    /// Shadow views rendered.
+    unsigned shadowViewsRendered;
+    /// Shadow views reused from the shadow map cache without rendering.
+    unsigned shadowViewsCached;
+    /// Localized lights in view before clamping to the maximum.
+    unsigned lightsInView;
+    /// Localized lights accepted for rendering.
+    unsigned lightsAccepted;
+    /// Lights, including the directional light, that got a shadow map.
+    unsigned shadowedLights;
+    /// Light to cluster assignments dropped because the cluster was full.
+    unsigned clusterLightOverflows;
+    /// Decals accepted for rendering.
+    unsigned decalsAccepted;
+    /// Decal to cluster assignments dropped because the cluster was full.
+    unsigned clusterDecalOverflows;
+};
+
+/// Occlusion culling modes.
+enum OcclusionMode
+{
+    OCCLUSION_NONE = 0,
+    OCCLUSION_GPU,
+    OCCLUSION_SOFTWARE
+};
+
+/// Depth and blending modes for rendering a batch queue.
+enum BatchDepthMode
+{
+    /// Render as is.
+    DEPTH_NORMAL = 0,
+    /// Render only the depth passes of the materials that have one.
+    DEPTH_PREPASS,
+    /// Render after the depth pre-pass. Materials with a depth pass are rendered with an equal depth test and no depth write.
+    DEPTH_AFTERPREPASS,
+    /// Render only the passes with alpha or premultiplied alpha blending, accumulated for weighted blended order-independent transparency.
+    DEPTH_OIT,
+    /// Render only the passes with other blend modes, whose result does not depend on order.
+    DEPTH_OITEXCLUDED
+};
+
+/// Octant found in view on an earlier frame, reused by temporal coherence.
+struct CachedOctant
+{
+    /// Octant.
+    Octant* octant;
+    /// Plane mask against the expanded frustum. Zero if was fully inside.
+    unsigned char planeMask;
+    /// Cache index just past the octant's subtree, for skipping it.
+    size_t subtreeEnd;
+};
 
 /// Per-thread results for octant collection.
 struct ThreadOctantResult
 {
-    /// Clear for the next frame.
+    /// Clear for the next frame. Release the frame arena memory.
     void Clear();
 
     /// Drawable accumulator. When full, queue the next batch collection task.
@@ -60,17 +206,21 @@ struct ThreadOctantResult
     /// Batch collection task index.
     size_t batchTaskIdx;
     /// Intermediate octant list.
-    std::vector<std::pair<Octant*, unsigned char> > octants;
+    FrameVector<std::pair<Octant*, unsigned char> > octants;
     /// Intermediate light drawable list.
-    std::vector<LightDrawable*> lights;
+    FrameVector<LightDrawable*> lights;
+    /// Intermediate decal drawable list.
+    FrameVector<DecalDrawable*> decals;
     /// Tasks for main view batches collection, queued by the octant collection task when it finishes.
     std::vector<AutoPtr<CollectBatchesTask> > collectBatchesTasks;
+    /// Octants of the subtree in view, kept over frames for temporal coherence.
+    std::vector<CachedOctant> octantCache;
 };
 
 /// Per-thread results for batch collection.
 struct ThreadBatchResult
 {
-    /// Clear for the next frame.
+    /// Clear for the next frame. Release the frame arena memory.
     void Clear();
 
     /// Minimum geometry Z value.
@@ -80,9 +230,32 @@ struct ThreadBatchResult
     /// Combined bounding box of the visible geometries.
     BoundingBox geometryBounds;
     /// Initial opaque batches.
-    std::vector<Batch> opaqueBatches;
+    FrameVector<Batch> opaqueBatches;
     /// Initial alpha batches.
-    std::vector<Batch> alphaBatches;
+    FrameVector<Batch> alphaBatches;
+};
+
+/// Overflow storage for the per-instance uploads of a frame that did not fit the region of a persistently mapped instancing vertex buffer.
+struct InstanceOverflow
+{
+    /// Construct.
+    InstanceOverflow() :
+        numVertices(0),
+        frameVertices(0),
+        frameNumber(0)
+    {
+    }
+
+    /// Dynamic vertex buffer, orphaned on the first overflow of each frame.
+    AutoPtr<VertexBuffer> buffer;
+    /// CPU copy of the frame's overflow data, for uploading it whole when the buffer grows.
+    std::vector<unsigned char> data;
+    /// Number of overflow vertices written this frame.
+    size_t numVertices;
+    /// Number of vertices uploaded this frame in total, for growing the stream buffer on the next frame.
+    size_t frameVertices;
+    /// Graphics frame number of the uploads.
+    unsigned frameNumber;
 };
 
 /// Per-view uniform buffer data.
@@ -96,8 +269,32 @@ struct PerViewUniforms
     Matrix4 viewProjMatrix;
     /// Current camera's depth parameters.
     Vector4 depthParameters;
-    /// Data for the view's global directional light.
-    Vector4 dirLightData[12];
+    /// Light cluster depth slice lookup scale and bias, and whether adaptive slices are in use.
+    Vector4 clusterSliceParameters;
+    /// Light probe grid shader parameters, or zero if not in use.
+    Vector4 lightProbeData[3];
+    /// Virtual texture feedback texel offset within the feedback block, and the block size in pixels, or zero if not in use.
+    Vector4 virtualTextureData;
+    /// Data for the view's global directional light: direction, color, cascade splits, shadow parameters, shadow fade parameters and the cascades' shadow matrices.
+    Vector4 dirLightData[5 + MAX_SHADOW_CASCADES * 4];
+};
+
+/// Point light face uniform buffer data for single-pass shadow rendering.
+struct CubeShadowUniforms
+{
+    /// View and projection matrices of the faces.
+    Matrix4 faceViewProjMatrices[6];
+    /// Bitmask of the faces to render.
+    unsigned faceMask;
+    /// Padding to the std140 block size.
+    unsigned padding[3];
+};
+
+/// Eye uniform buffer data for single-pass stereo rendering.
+struct StereoUniforms
+{
+    /// View and projection matrices of the left and right eye.
+    Matrix4 eyeViewProjMatrices[2];
 };
 
 /// Shadow map data structure. May be shared by several lights.
@@ -121,17 +318,31 @@ struct ShadowMap
     SharedPtr<Texture> texture;
     /// Shadow map framebuffer.
     SharedPtr<FrameBuffer> fbo;
+    /// Cached static object shadow texture.
+    SharedPtr<Texture> staticTexture;
+    /// Moment texture in moment shadow map mode, rendered together with the depth and then blurred.
+    SharedPtr<Texture> momentTexture;
+    /// Cached static object moment texture in moment shadow map mode. Stored unblurred, so that the dynamic objects can be depth tested against the restored static objects.
+    SharedPtr<Texture> staticMomentTexture;
+    /// Framebuffer for blurring into the moment texture.
+    SharedPtr<FrameBuffer> momentFbo;
     /// Shadow views that use this shadow map.
     std::vector<ShadowView*> shadowViews;
     /// Shadow batch queues used by the shadow views.
     std::vector<BatchQueue> shadowBatches;
     /// Intermediate shadowcaster lists for processing.
-    std::vector<std::vector<Drawable*> > shadowCasters;
+    std::vector<FrameVector<Drawable*> > shadowCasters;
     /// Instancing transforms for shadowcasters.
     std::vector<Matrix3x4> instanceTransforms;
+    /// Static transform table indices and material table slots of instanced static shadowcasters.
+    std::vector<Vector2> staticInstances;
+    /// Skin matrix palettes for instanced skinned shadowcasters.
+    std::vector<Matrix3x4> skinMatrices;
+    /// Multi-draw commands for shadowcasters.
+    std::vector<IndirectDrawCommand> drawCommands;
 };
 
-/// Light data for cluster light shader.
+/// Light data for cluster light shader. Stored in a texture, nine texels per light.
 struct LightData
 {
     /// %Light position.
@@ -148,52 +359,517 @@ struct LightData
     Matrix4 shadowMatrix;
 };
 
-/// High-level rendering subsystem. Performs rendering of 3D scenes.
+/// Decal data for cluster decal shader. Stored in a texture, five texels per decal.
+struct DecalData
+{
+    /// Transform from world space to the decal's unit box.
+    Matrix3x4 projection;
+    /// Texture rectangle within the decal atlas as offset and scale.
+    Vector4 textureRect;
+    /// %Decal color.
+    Color color;
+};
+
+/// View parameters captured for rendering a batch queue.
+struct RenderView
+{
+    /// Per-view uniform data.
+    PerViewUniforms perViewData;
+    /// Size of the per-view uniform data to upload.
+    size_t perViewDataSize;
+    /// Reverse culling flag.
+    bool reverseCulling;
+    /// Shader program bits combined with the batches' geometry bits.
+    unsigned char programBits;
+};
+
+/// Shadowed light ranked by the shadow budget.
+struct ShadowBudgetEntry
+{
+    /// %Light.
+    LightDrawable* light;
+    /// Screen-space importance. Higher is more important.
+    float priority;
+    /// Budgeted shadow map face size. Zero if the light will not get a shadow map.
+    int faceSize;
+};
+
+/// Shadow view parameters captured for rendering.
+struct ShadowRenderView : public RenderView
+{
+    /// Viewport within the shadow map.
+    IntRect viewport;
+    /// Shadow render mode to use.
+    ShadowRenderMode renderMode;
+    /// Static object batch queue index.
+    size_t staticQueueIdx;
+    /// Dynamic object batch queue index.
+    size_t dynamicQueueIdx;
+    /// Constant depth bias.
+    float depthBias;
+    /// Slope-scaled depth bias.
+    float slopeScaleBias;
+    /// Index of the point light face data when all faces are rendered in one pass, or negative if not.
+    int cubeShadowIdx;
+};
+
+/// Point light faces captured for single-pass shadow rendering.
+struct CubeShadowView
+{
+    /// Face uniform data.
+    CubeShadowUniforms uniforms;
+    /// Face viewports within the shadow map.
+    IntRect faceViewports[6];
+};
+
+/// Shadow map contents captured for rendering.
+struct PreparedShadowMap
+{
+    /// Shadow views to render.
+    std::vector<ShadowRenderView> views;
+    /// Shadow batch queues used by the views.
+    std::vector<BatchQueue> shadowBatches;
+    /// Instancing transforms for shadowcasters.
+    std::vector<Matrix3x4> instanceTransforms;
+    /// Static transform table indices and material table slots of instanced static shadowcasters.
+    std::vector<Vector2> staticInstances;
+    /// Skin matrix palettes for instanced skinned shadowcasters.
+    std::vector<Matrix3x4> skinMatrices;
+    /// Multi-draw commands for shadowcasters.
+    std::vector<IndirectDrawCommand> drawCommands;
+    /// Snapshot of non-instanced shadowcaster world transforms.
+    std::vector<Matrix3x4> worldTransforms;
+    /// Point light faces of the views rendered in one pass.
+    std::vector<CubeShadowView> cubeShadows;
+};
+
+/// Material bin of visibility buffer mode, whose pixels are shaded with one compute dispatch.
+struct VisibilityBin
+{
+    /// Opaque material pass.
+    Pass* pass;
+    /// Vertex buffer the triangles are fetched from.
+    VertexBuffer* vertexBuffer;
+    /// Index buffer the triangles are fetched from.
+    IndexBuffer* indexBuffer;
+    /// Shader parameters: bin index, and the vertex size, normal offset and texture coordinate offset in floats.
+    Vector4 parameters;
+    /// Whether the material applies its diffuse texture.
+    bool diffuseMap;
+};
+
+/// View preparation results captured for rendering. In pipelined mode this is rendered while the next view is being prepared.
+struct PreparedView
+{
+    /// Default-construct.
+    PreparedView();
+
+    /// Main view parameters.
+    RenderView mainView;
+    /// Opaque batches.
+    BatchQueue opaqueBatches;
+    /// Transparent batches.
+    BatchQueue alphaBatches;
+    /// Instance transforms for opaque and alpha batches.
+    std::vector<Matrix3x4> instanceTransforms;
+    /// Static transform table indices and material table slots of instanced static opaque and alpha batches.
+    std::vector<Vector2> staticInstances;
+    /// Skin matrix palettes for instanced skinned opaque and alpha batches.
+    std::vector<Matrix3x4> skinMatrices;
+    /// Multi-draw commands for opaque and alpha batches.
+    std::vector<IndirectDrawCommand> drawCommands;
+    /// Snapshot of non-instanced opaque and alpha batch world transforms.
+    std::vector<Matrix3x4> worldTransforms;
+    /// Amount of localized lights.
+    size_t numLights;
+    /// Light data.
+    std::vector<LightData> lightData;
+    /// Light index list offset and count of each cluster. The upper 16 bits of the count are the decal count.
+    std::vector<unsigned> clusterRanges;
+    /// Light indices of all clusters, each cluster's decal indices following its lights.
+    std::vector<unsigned short> lightIndices;
+    /// Amount of decals.
+    size_t numDecals;
+    /// Decal data.
+    std::vector<DecalData> decalData;
+    /// Shadow maps.
+    PreparedShadowMap shadowMaps[2];
+    /// Eye matrices of a stereo view.
+    StereoUniforms stereoData;
+    /// Whether is a stereo view rendered to both eyes at once.
+    bool stereo;
+    /// Whether the transparent batches are state sorted for weighted blended order-independent transparency.
+    bool orderIndependent;
+    /// Whether the static geometries managed by GPU culling are culled and drawn on the GPU.
+    bool gpuCulling;
+    /// Multi-draw batches rasterized into the visibility buffer, split from the opaque batches. Their draw commands are appended to the view's, and give each command its own visibility instances.
+    BatchQueue visibilityBatches;
+    /// Material bin index of each visibility batch.
+    std::vector<unsigned char> visibilityBatchBins;
+    /// Material bins of the visibility batches.
+    std::vector<VisibilityBin> visibilityBins;
+    /// Static transform table index and first triangle in the index buffer of each visibility instance.
+    std::vector<float> visibilityInstances;
+    /// Whether is rendered in visibility buffer mode.
+    bool visibilityBuffer;
+};
+
+/// High-level rendering subsystem. Performs rendering of 3D scenes. Several renderers may prepare independent views, but each scene should be prepared by only one, as the drawables' visibility state is not per renderer.
 class Renderer : public Object
 {
     OBJECT(Renderer);
 
 public:
-    /// Construct. Register subsystem and objects. Graphics and WorkQueue subsystems must have been initialized.
+    /// Construct. Register objects, and register as the subsystem if no renderer has been registered yet. Graphics and WorkQueue subsystems must have been initialized.
     Renderer();
     /// Destruct.
     ~Renderer();
 
-    /// Set size and format of shadow maps. First map is used for a directional light, the second as an atlas for others.
-    void SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format);
+    /// Set size and format of shadow maps. First map is used for a directional light, and is sized to hold the given number of cascades two per row. The second is used as an atlas for others.
+    void SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format, int dirLightCascades = 2);
     /// Set global depth bias multipiers for shadow maps.
     void SetShadowDepthBiasMul(float depthBiasMul, float slopeScaleBiasMul);
-    /// Prepare view for rendering. This will utilize worker threads.
+    /// Set temporal coherence. When enabled, the octants in view are cached, and reused while no frustum corner has moved further than the threshold distance from where the cache was built. Only the octants that intersected the frustum are tested again. Additionally, when the camera and the octree have not changed since the last preparation, the prepared view is reused as is. Changes that do not queue octree updates, such as material or light color changes, are noticed only after DiscardPreparedView().
+    void SetTemporalCoherence(bool enable, float threshold = 1.0f);
+    /// Set pipelined mode. When enabled, PrepareView() returns after queuing the preparation tasks, and the render functions submit the previously prepared view while worker threads prepare the next. FinishView() must be called before modifying the scene again.
+    void SetPipelined(bool enable);
+    /// Set multi-draw mode. When enabled and supported, static geometries are always instanced, and instanced batches sharing the pass and buffers are submitted with one multi-draw indirect call. Enabled by default when supported. Discards the prepared view.
+    void SetMultiDraw(bool enable);
+    /// Set meshlet culling mode. When enabled in multi-draw mode, each main view instance of a static geometry with meshlets is drawn with commands for only the meshlets that pass frustum, backface cone and occlusion tests, with adjacent visible meshlets merged to one command. Shadow maps draw the whole geometries.
+    void SetMeshletCulling(bool enable);
+    /// Set depth pre-pass mode. When enabled, the opaque batches of materials with a depth pass are first rendered with it, front to back as sorted, and then shaded with an equal depth test, so that only the visible fragments are lit. Materials without a depth pass skip it.
+    void SetDepthPrePass(bool enable);
+    /// Set deferred shading mode. When enabled, RenderOpaque() writes the material color and view-space normal of the opaque geometry into a G-buffer instead of lighting each fragment, and RenderDeferredLighting() lights it afterward with one fullscreen pass using the same light clusters and shadow maps. Transparent geometry stays forward lit. Applies to the views rendered after the change, so it can be chosen per view. Not supported in stereo, which stays forward lit.
+    void SetDeferredShading(bool enable);
+    /// Set visibility buffer mode. When enabled and supported, the opaque static geometry of plain materials is rendered with RenderVisibility() and RenderVisibilityShading() instead of RenderOpaque(). Discards the prepared view.
+    void SetVisibilityBuffer(bool enable);
+    /// Set weighted blended order-independent transparency mode. When enabled, the transparent batches are sorted by state and instanced like the opaque batches instead of being sorted back to front. RenderAlpha() then accumulates the batches with alpha or premultiplied alpha blending into the currently set framebuffer, which should have an RGBA16F accumulation and an R16F weight color target, along with the depth buffer of the opaque pass for testing, and RenderAlphaComposite() blends the result over the opaque color. Applies to the views prepared after the change. Secondary views stay sorted back to front.
+    void SetOrderIndependentTransparency(bool enable);
+    /// Set bindless texture mode. When enabled and supported, material textures are not bound to texture units, but assigned to the shader programs' samplers as bindless handles along with the other per-material uniforms. Enabled by default when supported.
+    void SetBindlessTextures(bool enable);
+    /// Set light cluster grid size, maximum number of localized lights in view and maximum number of lights per cluster. The lights in view are sorted by distance, and those beyond the maximum are not rendered. At most MAX_LIGHTS lights are supported. Discards the prepared view.
+    void SetLightClusters(const IntVector3& size, size_t maxLights, size_t maxLightsPerCluster);
+    /// Set adaptive light cluster depth slices. When enabled, the depth slices are distributed exponentially over the depth range of the visible geometry on each frame instead of the whole view range. If the near split distance is inside the range, the first slice covers up to it, so that the exponential slices are not crowded near the camera.
+    void SetAdaptiveClusterSlices(bool enable, float nearSplit = DEFAULT_CLUSTER_NEAR_SPLIT);
+    /// Set far light cluster limit. Clusters beginning beyond the view distance keep only up to the given number of their lights, picked by the estimated contribution at the cluster center from the light intensity and distance attenuation, as lighting the small distant geometry with many lights per pixel is mostly wasted. At most MAX_FAR_CLUSTER_LIGHTS. Zero lights disables the limit, which is the default.
+    void SetFarClusterLightLimit(float distance, size_t maxLights);
+    /// Set light hierarchy mode. When enabled, the localized lights beyond the maximum in view are dropped by their importance, estimated from the intensity and projected screen size, instead of their distance, and the worker threads assign the lights to the clusters by querying a bounding volume hierarchy of the lights' view space bounds for each depth slice, instead of testing every light against every slice.
+    void SetLightHierarchy(bool enable);
+    /// Set compute light clustering mode. When enabled and supported, the lights are assigned to the clusters by a compute shader in RenderOpaque() instead of worker threads during view preparation, so that the CPU cost does not depend on the light count. Discards the prepared view.
+    void SetComputeClustering(bool enable);
+    /// Set the decal atlas texture. The decals in view are binned into the light clusters and applied to the material color by the lit shaders in the opaque and deferred G-buffer passes, each sampling its rectangle of the atlas, so that they need no draw calls of their own. Null disables decals, which is the default. Decals are not applied with compute light clustering, or in secondary views.
+    void SetDecalAtlas(Texture* texture);
+    /// Set maximum number of decals in view and maximum number of decals per cluster. The decals in view are sorted by distance, and those beyond the maximum are not rendered. At most MAX_DECALS decals are supported. Discards the prepared view.
+    void SetDecalLimits(size_t maxDecals, size_t maxDecalsPerCluster);
+    /// Set compute skinning mode. When enabled and supported, the vertices of each animated model are skinned to world space by a compute shader once per frame when the view is captured, into output vertex buffers of the model, and all passes draw them as static geometry instead of skinning in each pass' vertex shader. The models switch mode on the frame after the change.
+    void SetComputeSkinning(bool enable);
+    /// Set shadow budget mode. When enabled, shadowed point and spot lights are ranked by their projected screen size, intensity and shadow strength, and the shadow map size of each light is reduced towards its screen coverage, but not below the minimum size, so that the atlas fits the most important lights first. A light keeps its previous shadow map size while the budgeted size is within one step of it, so that static shadow maps stay cached. When disabled, the lights are allocated in distance order at their full shadow map size.
+    void SetShadowBudget(bool enable, int minShadowMapSize = DEFAULT_MIN_SHADOW_MAP_SIZE);
+    /// Set directional light shadow caching. When enabled, the cascades of a static directional light are fitted to the split frustums' bounding spheres and snapped to a coarse grid, so that the static shadowcasters are rendered only when the main camera has moved a grid step, and restored from a cached copy otherwise. Costs some shadow resolution.
+    void SetDirShadowCaching(bool enable);
+    /// Set shadow map time slicing. Point and spot lights whose light volume projects on the main view with a smaller radius than the pixel threshold re-render their shadow maps at most every interval frames, and reuse the previous contents in between. A new atlas allocation is always rendered immediately. Interval 1 or zero threshold disables.
+    void SetShadowTimeSlicing(int interval, float maxPixels);
+    /// Set static instance table mode. When enabled and instancing is supported, the world transforms of static, non-skinned geometries are kept in a texture that is updated only for the drawables that moved since the last frame, and the static batches are instanced with their index in it instead of copied transforms. Discards the prepared view.
+    void SetStaticInstanceTable(bool enable);
+    /// Set static batch caching. When enabled, the opaque batches of the drawables that have only static geometry without LOD levels, impostor or maximum distance are built once per octant and appended as a whole when the octant is fully inside the view, instead of being collected per drawable each frame. The cached drawables are marked in view, but their distance is not updated. The cache of an octant is rebuilt when its drawables are added, removed or moved, or any material pass or drawable geometry or material assignment changes. Not used with occlusion culling or texture streaming, or for octants whose smallest cached drawable could fall below the screen size culling threshold.
+    void SetStaticBatchCaching(bool enable);
+    /// Set GPU culling mode. When enabled and supported, the opaque static models of the octree's static BVH are culled and their LOD levels selected by a compute shader instead of on the CPU. Discards the prepared view.
+    void SetGpuCulling(bool enable);
+    /// Set static shadowcaster caching. When enabled, each static shadowed point or spot light keeps a list of its static shadowcasters, which is queried again only when a static shadowcaster changes within the light's bounds, a drawable is removed from the octree, the light moves, or the light was not processed on the previous view preparation. Each frame only the non-static drawables are queried, which with the octree's static BVH skips the static drawables entirely.
+    void SetStaticCasterCaching(bool enable);
+    /// Set the screen size in pixels below which the octree's HLOD proxies are drawn instead of the static models merged into them. The source drawables are still rendered into shadow maps. Zero disables. Default 0.
+    void SetHlodThreshold(float pixels);
+    /// Set the cells and portals of interior spaces. When the camera is inside a cell, the octants, drawables and lights are culled to the cells visible through the portals, and the shadowcasters of point and spot lights inside a cell to the cells reachable through the portals within the light's range. Not applied to stereo or secondary views. Null (default) disables.
+    void SetPortalCells(PortalCells* cells);
+    /// Set the light probes of the baked lights. While the probes have been baked, the lights marked as baked are left out of the light processing, clusters and shadow maps of all views, and the lit shaders add the probes' irradiance to the ambient light. Null (default) disables.
+    void SetLightProbes(LightProbeGrid* probes);
+    /// Set the late latching angle in degrees. When nonzero, the views are culled with the camera's frustum widened by the angle on each side, so that the camera may be turned by up to that angle in yaw and pitch after preparation and LatchCamera() called before rendering without geometry missing at the screen edges. Directional light shadow cascades are fitted to the unwidened frustum. Zero (default) disables.
+    void SetLateLatching(float degrees);
+    /// Set single-pass point light shadows. When enabled and supported, the casters of a point light are collected once for all its faces in view, and rendered to them in one pass, where a geometry shader replicates each triangle to the faces it touches. Reduces the draw calls of point light shadows up to six times.
+    void SetSinglePassPointShadows(bool enable);
+    /// Set moment shadow map mode. When enabled, the shadow maps also render the exponentially warped depth and its square into a 32-bit float color atlas, which is blurred once within each shadow view rendered that frame, and the lit shaders sample it with a single bilinear fetch and a variance test instead of multiple depth comparison taps. The views of static lights whose shadow maps are cached stay prefiltered. The moment atlases and their static copies take 8 bytes per texel each. Rerenders all shadow maps.
+    void SetMomentShadows(bool enable);
+    /// Set screen size culling thresholds in pixels for the main view and shadow casters. Drawables whose bounding sphere projects on the main view smaller than the threshold, relative to the render height and scaled by the camera's LOD bias, are skipped. Shadow casters of static point and spot lights are not culled, as their shadow maps can be cached. Zero disables.
+    void SetScreenSizeCulling(float viewPixels, float shadowPixels);
+    /// Set texture streaming mode. When enabled, the drawables in view request the mip levels of their streaming textures by projected screen size, and the textures are redefined to the requested detail at the start of view preparation, uploading at most the given bytes per frame.
+    void SetTextureStreaming(bool enable, size_t bytesPerFrame = DEFAULT_STREAMING_BUDGET);
+    /// Set the GPU memory budget of streaming textures. When exceeded, the finer mip levels of the textures that have not been requested for the given number of frames are evicted, least recently requested first, and streamed again when requested. Zero (default) for no limit.
+    void SetTextureMemoryBudget(size_t bytes, unsigned evictFrames = DEFAULT_TEXTURE_EVICT_FRAMES);
+    /// Set virtual texturing mode. When enabled, the opaque pass writes the virtual texture pages its pixels need into a feedback image at 1/VIRTUAL_FEEDBACK_SCALE resolution, one jittered pixel per block each frame, which is read back asynchronously to request the pages. The pages read since the last frame are uploaded at the start of view preparation, at most the given bytes per frame. Requires compute shader and image load/store support.
+    void SetVirtualTexturing(bool enable, size_t bytesPerFrame = DEFAULT_STREAMING_BUDGET);
+    /// Set the subsystems that use fast approximate math, as a combination of the FAST_MATH flags. Animation blends rotations with a corrected normalized lerp instead of slerp, lights compute their spot cone with a polynomial cosine, and screen size and meshlet culling use reciprocal square root estimates for distances. Zero (default) for exact math everywhere.
+    void SetFastMath(unsigned subsystems);
+    /// Prepare view for rendering. This will utilize worker threads. In non-pipelined mode, also finishes the view immediately.
     void PrepareView(Scene* scene, Camera* camera, bool drawShadows);
+    /// Prepare a stereo view for rendering both eyes in one pass, each draw covering the left and right half of the framebuffer. Culling, shadow maps, light clusters and batches are shared, using a camera that encloses both eye frusta. The eye cameras should have the same orientation and symmetric projection, and be offset along their right vector. Requires viewport array support; otherwise prepares only the left eye.
+    void PrepareStereoView(Scene* scene, Camera* leftEye, Camera* rightEye, bool drawShadows);
+    /// Request a secondary view with the reduced-cost profile of the SecondaryView to be prepared along with the next PrepareView() call, on a worker thread in parallel with the main view, from the same scene. Skipped on the frames between the view's update interval. The camera must stay valid until the main view has been finished.
+    void PrepareSecondaryView(SecondaryView* view, Camera* camera);
+    /// Wait for view preparation to complete and capture the results for rendering. Upload skinning data of the drawables in view. No-op if no preparation is in progress.
+    void FinishView();
+    /// Discard the captured view, for example before destroying drawables that it may refer to.
+    void DiscardPreparedView();
     /// Render shadowmaps before rendering the view. Last shadow framebuffer will be left bound.
     void RenderShadowMaps();
-    /// Render opaque objects into the currently set framebuffer and viewport.
-    void RenderOpaque();
-    /// Render transparent objects into the currently set framebuffer and viewport.
+    /// Replace the prepared view's camera matrices with the current ones of the camera, which should be the one the view was prepared with, turned by no more than the late latching angle. Call after input has been sampled again just before RenderOpaque() to reduce latency. Light clusters built on the CPU keep the prepared orientation, so compute clustering should be used for exact lighting. No-op in stereo.
+    void LatchCamera(Camera* camera);
+    /// Render opaque objects into the currently set framebuffer and viewport. With compute light clustering and the depth pre-pass, the depth texture of the framebuffer can be given to clip the clusters to the visible depth range after the pre-pass. It must not be multisampled.
+    void RenderOpaque(Texture* depthTexture = nullptr);
+    /// Light the G-buffer written by RenderOpaque() in deferred shading mode into the currently set framebuffer and viewport, which should not include the G-buffer textures. The albedo and normal textures are the first and second color targets of the opaque pass. Does nothing unless in deferred shading mode.
+    void RenderDeferredLighting(Texture* albedoTexture, Texture* normalTexture, Texture* depthTexture);
+    /// Upload the view's rendering data and rasterize the visibility batches into the currently set framebuffer and viewport, which should have an RG32U color target and the depth buffer. Call before RenderVisibilityShading() and RenderOpaque(), which then does not upload the data again. Compute light clusters are not clipped by depth in this mode. Does nothing unless in visibility buffer mode.
+    void RenderVisibility();
+    /// Shade the visibility buffer written by RenderVisibility() into RGBA8 color and optionally view-space normal textures with compute shaders, leaving the pixels of other geometry untouched. The textures must not be multisampled, and should be cleared beforehand. Does nothing unless in visibility buffer mode.
+    void RenderVisibilityShading(Texture* visibilityTexture, Texture* depthTexture, Texture* colorTexture, Texture* normalTexture = nullptr);
+    /// Render transparent objects into the currently set framebuffer and viewport. In order-independent transparency mode, accumulates the objects with alpha blending into the accumulation and weight targets instead.
     void RenderAlpha();
-    /// Add debug geometry from the objects in frustum into DebugRenderer. Note: does not automatically render, to allow more geometry to be added elsewhere.
+    /// Blend the order-independent transparency accumulated by RenderAlpha() over the currently set framebuffer and viewport, then render the transparent objects with other blend modes, which do not depend on order. The depth buffer of the opaque pass should be bound for them. Does nothing unless the prepared view uses order-independent transparency.
+    void RenderAlphaComposite(Texture* accumTexture, Texture* weightTexture);
+    /// Render the opaque and transparent objects of a secondary view prepared along with the main view into the currently set framebuffer and viewport. Call after RenderShadowMaps() and before RenderOpaque() or RenderVisibility(), which upload the main view's multi-draw commands. Return false without rendering if no newly prepared view is pending, in which case the previous contents should be kept.
+    bool RenderSecondaryView(SecondaryView* view);
+    /// Set occlusion culling mode. In GPU mode, culling uses the downsampled depth of previously rendered frames, and RenderOcclusionDepth() should be called each frame after RenderOpaque() to provide it. In software mode, the occluder drawables are rasterized on the CPU at the start of each view preparation.
+    void SetOcclusionMode(OcclusionMode mode);
+    /// Downsample the depth buffer of the rendered view for occlusion culling on subsequent frames, and take into use the depth downsampled on an earlier call once its asynchronous readback has arrived. Skips downsampling while the readback is still pending. Call after RenderOpaque(). The occlusion framebuffer may be left bound. Does nothing unless in GPU occlusion mode.
+    void RenderOcclusionDepth(Texture* depthTexture);
+    /// Add debug geometry from the objects in frustum into DebugRenderer, from the worker threads. The debug geometry of static drawables with static geometry is cached per octant and covers all of them in the visible octants. Note: does not automatically render, to allow more geometry to be added elsewhere. Does nothing while a pipelined preparation is in progress.
     void RenderDebug();
+    /// Reset the shadow map allocations on the next view preparation, so that all shadow maps are rendered fully instead of reusing cached contents. Call before preparing a view that will be saved as a frame capture.
+    void ResetShadowMaps();
+    /// Save the prepared view as a frame capture: batch queues, shadow views, instancing and light cluster data, with materials and model geometries referenced by resource name. Call after the view has been finished. Batches that render through their drawable, such as non-instanced skinned geometry, or use unnamed resources are left out. Static instance table mode is not supported. Return true on success.
+    bool SaveFrameCapture(Stream& dest) const;
+    /// Load a frame capture as the prepared view, so that the render functions submit it without a scene, for profiling the GPU cost separately from view preparation. Applies the multi-draw, light cluster and shadow map settings of the capture. The model loading settings should match those used when capturing. Return true on success.
+    bool LoadFrameCapture(Stream& source);
 
+    /// Return whether pipelined mode is enabled.
+    bool IsPipelined() const { return pipelined; }
+    /// Return whether the prepared view is a stereo view.
+    bool IsStereo() const { return preparedView.stereo; }
+    /// Return whether multi-draw mode is in use.
+    bool IsMultiDraw() const { return multiDraw; }
+    /// Return whether meshlet culling mode is enabled.
+    bool IsMeshletCulling() const { return meshletCulling; }
+    /// Return whether depth pre-pass mode is enabled.
+    bool IsDepthPrePass() const { return depthPrePass; }
+    /// Return whether deferred shading mode is in use for the prepared view. False in stereo and visibility buffer mode.
+    bool IsDeferredShading() const { return deferredShading && !preparedView.stereo && !preparedView.visibilityBuffer; }
+    /// Return whether visibility buffer mode is in use for the prepared view.
+    bool IsVisibilityBuffer() const { return preparedView.visibilityBuffer; }
+    /// Return whether the prepared view uses weighted blended order-independent transparency.
+    bool IsOrderIndependentTransparency() const { return preparedView.orderIndependent; }
+    /// Return whether adaptive light cluster depth slices are enabled.
+    bool IsAdaptiveClusterSlices() const { return adaptiveClusterSlices; }
+    /// Return the near split distance of adaptive light cluster depth slices.
+    float ClusterNearSplit() const { return clusterNearSplit; }
+    /// Return the view distance beyond which the far light cluster limit applies.
+    float FarClusterLightDistance() const { return farClusterLightDistance; }
+    /// Return the maximum number of lights in far clusters, or zero if not limited.
+    size_t MaxFarClusterLights() const { return maxFarClusterLights; }
+    /// Return whether light hierarchy mode is enabled.
+    bool IsLightHierarchy() const { return lightHierarchy; }
+    /// Return whether compute light clustering mode is in use.
+    bool IsComputeClustering() const { return computeClustering; }
+    /// Return the decal atlas texture.
+    Texture* DecalAtlas() const { return decalAtlas; }
+    /// Return whether compute skinning mode is in use.
+    bool IsComputeSkinning() const { return computeSkinning; }
+    /// Return whether bindless texture mode is in use.
+    bool IsBindlessTextures() const { return bindlessTextures; }
+    /// Return whether shadow budget mode is enabled.
+    bool IsShadowBudget() const { return shadowBudget; }
+    /// Return minimum shadow map face size in shadow budget mode.
+    int MinShadowMapSize() const { return minShadowMapSize; }
+    /// Return whether directional light shadow caching is enabled.
+    bool IsDirShadowCaching() const { return dirShadowCaching; }
+    /// Return shadow map time slicing interval in frames.
+    int ShadowUpdateInterval() const { return shadowUpdateInterval; }
+    /// Return shadow map time slicing pixel threshold.
+    float ShadowTimeSlicingThreshold() const { return maxTimeSlicedPixels; }
+    /// Return whether static instance table mode is in use.
+    bool IsStaticInstanceTable() const { return staticInstanceTable; }
+    /// Return whether static batch caching is enabled.
+    bool IsStaticBatchCaching() const { return staticBatchCaching; }
+    /// Return whether GPU culling is enabled.
+    bool IsGpuCulling() const { return gpuCulling; }
+    /// Return whether static shadowcaster caching is enabled.
+    bool IsStaticCasterCaching() const { return staticCasterCaching; }
+    /// Return the HLOD proxy screen size threshold in pixels.
+    float HlodThreshold() const { return hlodPixels; }
+    /// Return the cells and portals of interior spaces.
+    PortalCells* GetPortalCells() const { return portalCells; }
+    /// Return the light probes of the baked lights.
+    LightProbeGrid* LightProbes() const { return lightProbes; }
+    /// Return the late latching angle in degrees.
+    float LateLatchingAngle() const { return lateLatchAngle; }
+    /// Return whether single-pass point light shadows are in use.
+    bool IsSinglePassPointShadows() const { return singlePassPointShadows; }
+    /// Return whether moment shadow map mode is enabled.
+    bool IsMomentShadows() const { return momentShadows; }
+    /// Return whether temporal coherence is enabled.
+    bool IsTemporalCoherence() const { return temporalCoherence; }
+    /// Return temporal coherence threshold distance.
+    float TemporalCoherenceThreshold() const { return coherenceThreshold; }
+    /// Return main view screen size culling threshold in pixels.
+    float ViewScreenSizeThreshold() const { return minViewPixels; }
+    /// Return shadow caster screen size culling threshold in pixels.
+    float ShadowScreenSizeThreshold() const { return minShadowPixels; }
+    /// Return whether texture streaming is enabled.
+    bool IsTextureStreaming() const { return textureStreaming; }
+    /// Return texture streaming upload budget in bytes per frame.
+    size_t TextureStreamingBudget() const { return textureStreamingBudget; }
+    /// Return GPU memory budget of streaming textures in bytes, or zero if not limited.
+    size_t TextureMemoryBudget() const { return textureMemoryBudget; }
+    /// Return the number of frames a streaming texture must be unrequested before eviction.
+    unsigned TextureEvictFrames() const { return textureEvictFrames; }
+    /// Return whether virtual texturing is enabled.
+    bool IsVirtualTexturing() const { return virtualTexturing; }
+    /// Return virtual texture page upload budget in bytes per frame.
+    size_t VirtualTexturingBudget() const { return virtualTexturingBudget; }
+    /// Return the subsystems that use fast approximate math.
+    unsigned FastMath() const { return fastMath; }
+    /// Return occlusion culling mode.
+    OcclusionMode GetOcclusionMode() const { return occlusionMode; }
+    /// Return light cluster grid size.
+    const IntVector3& ClusterSize() const { return clusterSize; }
+    /// Return maximum number of localized lights in view.
+    size_t MaxLights() const { return maxLights; }
+    /// Return maximum number of lights per cluster.
+    size_t MaxLightsPerCluster() const { return maxLightsPerCluster; }
+    /// Return maximum number of decals in view.
+    size_t MaxDecals() const { return maxDecals; }
+    /// Return maximum number of decals per cluster.
+    size_t MaxDecalsPerCluster() const { return maxDecalsPerCluster; }
     /// Return a shadow map texture by index for debugging.
     Texture* ShadowMapTexture(size_t index) const;
+    /// Return rendering statistics of the last frame.
+    const RenderStats& Stats() const { return stats; }
 
 private:
+    /// Release the intermediate results of the last preparation and reset the frame arenas. Report the arena usage to the profiler.
+    void ResetFrameArenas();
+    /// Merge the per-thread rendering statistics of the last frame and report them to the profiler.
+    void UpdateStats();
+    /// Return the calling thread's rendering statistics.
+    RenderStats& ThreadStats() const { return threadStats[WorkQueue::ThreadIndex()]; }
+    /// Return whether a bounding box projects smaller than the pixel threshold on the main view.
+    bool IsBelowScreenSize(const BoundingBox& box, float minPixels) const;
+    /// Return the projected radius of a bounding box's bounding sphere in pixels.
+    float ScreenSize(const BoundingBox& box) const;
+    /// Redefine streaming textures to their requested detail within the upload budget. Called once per frame.
+    void UpdateTextureStreaming();
+    /// Evict the mip levels of the least recently requested streaming textures until within the memory budget.
+    void EvictTextures();
+    /// Request the virtual texture pages of the latest feedback and upload the pages read within the budget. Called once per frame.
+    void UpdateVirtualTextures();
+    /// Clear and bind the virtual texture feedback image for the opaque pass.
+    void BeginVirtualFeedback();
+    /// Request the readback of the virtual texture feedback image written by the opaque pass.
+    void EndVirtualFeedback();
+    /// Return the projected radius of a light's range on the main view in pixels.
+    float LightScreenRadius(LightDrawable* light) const;
+    /// Return whether a light is baked into the light probes in use, and so left out of the dynamic lights.
+    bool IsBakedLight(LightDrawable* light) const { return light->IsBaked() && lightProbes && lightProbes->IsBaked(); }
     /// Collect octants and lights from the octree recursively. Queue batch collection tasks while ongoing.
     void CollectOctantsAndLights(Octant* octant, ThreadOctantResult& result, bool threaded, bool recursive, unsigned char planeMask = 0x3f);
-    /// Allocate shadow map for a light. Return true on success.
-    bool AllocateShadowMap(LightDrawable* light);
+    /// Collect the leaf octants and lights of the static BVH.
+    void CollectBvhOctantsAndLights(ThreadOctantResult& result, bool threaded);
+    /// Collect octants and lights using the octant cache built on an earlier frame.
+    void CollectCachedOctantsAndLights(ThreadOctantResult& result, bool threaded);
+    /// Collect the lights of a visible octant and store it for batch collection. Queue a batch collection task if enough drawables.
+    void CollectOctant(Octant* octant, ThreadOctantResult& result, bool threaded, unsigned char planeMask);
+    /// Build the octant cache recursively against the expanded frustum.
+    void BuildOctantCache(Octant* octant, std::vector<CachedOctant>& cache, bool recursive, unsigned char planeMask = 0x3f);
+    /// Build the octant cache from the static BVH leaves against the expanded frustum.
+    void BuildBvhOctantCache(std::vector<CachedOctant>& cache);
+    /// Check whether the view can be reused as is, or the octant cache needs to be rebuilt. Called before preparing a view.
+    bool CheckTemporalCoherence(bool drawShadows);
+    /// Rasterize the occluders in view on worker threads and build the occlusion buffer from them.
+    void RasterizeOcclusion();
+    /// Allocate shadow map for a light with the given face size, halving it down to the minimum if there is no room. Return true on success.
+    bool AllocateShadowMap(LightDrawable* light, int faceSize, int minFaceSize);
+    /// Decide the shadow map sizes of the localized lights and allocate them from the atlas, keeping the previous allocations where possible.
+    void AllocateLightShadowMaps();
     /// Sort main opaque and alpha batch queues.
     void SortMainBatches();
     /// Sort all batch queues of a shadowmap.
     void SortShadowBatches(ShadowMap& shadowMap);
-    /// Upload instance transforms before rendering.
-    void UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms);
-    /// Render a batch queue.
-    void RenderBatches(Camera* camera, const BatchQueue& queue);
+    /// Return whether static shadowcasters have changed inside a shadow view frustum since the last view preparation.
+    bool HasStaticChanges(const Frustum& shadowFrustum) const;
+    /// Check whether static shadowcasters have changed within a bounding box.
+    bool HasStaticChanges(const BoundingBox& box) const;
+    /// Validate or rebuild the cached static shadowcasters of a point or spot light and append them to the shadowcaster list.
+    void AddCachedStaticCasters(LightDrawable* light, FrameVector<Drawable*>& shadowCasters);
+    /// Remove the shadowcasters of a point or spot light inside a cell that are outside the cells reachable through the portals within the light's range.
+    void CullShadowCastersToCells(LightDrawable* light, FrameVector<Drawable*>& shadowCasters);
+    /// Return the bounds of the visible receivers in a shadow camera's view space, clipped to the light view space bounds of the main view frustum.
+    BoundingBox ReceiverBox(const Matrix3x4& lightView, const BoundingBox& lightViewFrustumBox) const;
+    /// Decide the render mode of a shadow view from whether it changed and the casters collected for it. Combine with a render postponed by time slicing, or postpone this one.
+    void DecideShadowRenderMode(ShadowView& view, bool cachedLight, bool timeSliced, bool viewportChanged, bool matrixChanged, size_t totalShadowCasters, size_t staticShadowCasters, bool staticCastersMoved, bool dynamicCastersMoved);
+    /// Collect the shadow batches of all faces of a point light in single-pass mode into the queues of its first face in view.
+    void CollectCubeShadowBatches(ShadowMap& shadowMap, size_t viewIdx);
+    /// Set the viewport or the point light face viewports of a shadow view for rendering.
+    void SetShadowViewport(const PreparedShadowMap& prepared, const ShadowRenderView& view);
+    /// Bind the shadow maps and the point light face selection textures for the lit passes.
+    void BindShadowMaps();
+    /// Define or release the moment textures of the shadow maps according to the moment shadow map mode, and their framebuffers.
+    void DefineMomentTextures();
+    /// Blur the moments of the shadow views rendered this frame.
+    void BlurMomentShadowMap(ShadowMap& shadowMap, const PreparedShadowMap& prepared);
+    /// Bind the shadow maps and light cluster textures of the main view for lit rendering.
+    void BindLightingTextures();
+    /// Split the viewport between the eyes and bind the eye matrices before rendering a stereo view, or restore the viewport after. No-op if the prepared view is not stereo.
+    void SetStereoViewports(bool enable);
+    /// Decrement the pending batch task counter. In pipelined mode, sort the main batches if was the last.
+    void FinishBatchTask();
+    /// Copy the preparation results to the prepared view for rendering.
+    void CaptureView();
+    /// Move the opaque batches shaded from the visibility buffer to the visibility batches of the prepared view, and assign their material bins.
+    void SplitVisibilityBatches();
+    /// Queue the preparation tasks of the requested secondary views.
+    void QueueSecondaryViews();
+    /// Copy the preparation results of the secondary views for rendering.
+    void CaptureSecondaryViews();
+    /// Fill per-view uniform data for a camera. The directional light is included only if non-null.
+    void SetupRenderView(RenderView& dest, Camera* camera, LightDrawable* dirLight);
+    /// Update GPU data of skinned or custom batches, and optionally copy static batches' world transforms so that the queue no longer refers to scene data.
+    void PrepareBatchesForRender(BatchQueue& queue, std::vector<Matrix3x4>* worldTransforms);
+    /// Upload instance transforms before rendering. Return the position of the first transform in the instancing vertex buffer.
+    size_t UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms);
+    /// Upload static transform table instances before rendering. Return the position of the first instance in the static instance vertex buffer.
+    size_t UpdateStaticInstances(const std::vector<Vector2>& indices);
+    /// Upload per-instance data to an instancing vertex buffer, appending to the frame's region if persistently mapped, or to the overflow buffer if the region is full. Return the position of the first vertex.
+    size_t UpdateInstanceData(VertexBuffer* buffer, InstanceOverflow& overflow, const std::vector<VertexElement>& elements, const void* data, size_t numVertices);
+    /// Return the vertex buffer holding per-instance data uploaded to an instancing vertex buffer, and make the position relative to it.
+    VertexBuffer* InstanceSource(VertexBuffer* buffer, const InstanceOverflow& overflow, size_t& base) const;
+    /// Upload the changed entries of the octree's static transform table and bind the table texture. Uploads all entries if the octree or the texture size changed.
+    void UpdateStaticTransforms();
+    /// Upload the packed uniforms of all materials by material ID and bind the table texture, if any material uniforms have changed. Read by the material instances drawn from the static transform table.
+    void UpdateMaterialTable();
+    /// Allocate the light cluster data for the current grid size and light limits.
+    void DefineLightClusters();
+    /// Upload skin matrix palettes of instanced skinned batches before rendering and bind the skin matrix texture.
+    void UpdateSkinMatrices(const std::vector<Matrix3x4>& matrices);
+    /// Upload multi-draw commands before rendering.
+    void UpdateDrawCommands(const std::vector<IndirectDrawCommand>& commands);
+    /// Upload the prepared view's instancing, light and decal data, cull the GPU managed geometries, and assign the lights to the clusters unless they will be built with depth bounds later.
+    void UpdateViewData(bool buildClusters);
+    /// Render a batch queue. The instance bases are the positions of the queue's instance transforms and static transform table indices in their instancing vertex buffers. Large queues are recorded into render commands in segments by worker threads, then replayed in order.
+    void RenderBatches(const RenderView& view, const BatchQueue& queue, size_t instanceBase, size_t staticInstanceBase, BatchDepthMode depthMode = DEPTH_NORMAL, bool deferred = false);
+    /// Record render commands from a range of batches. The range must not start inside the consumed batches of an instanced batch. Can be called from worker threads.
+    void RecordCommands(const RenderView& view, const BatchQueue& queue, size_t start, size_t end, BatchDepthMode depthMode, bool deferred, RenderCommandList& dest) const;
+    /// Replay render commands into the graphics API.
+    void ReplayCommands(const RenderCommandList& commands, size_t instanceBase, size_t staticInstanceBase);
+    /// Read the resource references and prepared view of a frame capture after its header. Return true on success.
+    bool ReadFrameCapture(Stream& source);
     /// Define face selection texture for point light shadows.
     void DefineFaceSelectionTextures();
+    /// Calculate the light cluster depth slice parameters for the view.
+    void DefineClusterSlices();
+    /// Return the view depth where a light cluster depth slice starts. The slice count returns the end of the last slice.
+    float ClusterSliceZ(size_t slice) const;
     /// Setup light cluster frustums and bounding boxes if necessary.
     void DefineClusterFrustums();
+    /// Assign the lights to the clusters with compute shaders, optionally clipping the clusters to the maximum depth of each screen tile in the depth texture.
+    void BuildLightClusters(Texture* depthTexture);
     /// Work function to collect octants.
     void CollectOctantsWork(Task* task, unsigned threadIndex);
     /// Process lights collected by octant tasks, and queue shadowcaster query tasks for them as necessary.
@@ -206,8 +882,24 @@ private:
     void ProcessShadowCastersWork(Task* task, unsigned threadIndex);
     /// Work function to collect shadowcaster batches per shadow view.
     void CollectShadowBatchesWork(Task* task, unsigned threadIndex);
-    /// Work function to cull lights against a Z-slice of the frustum grid.
-    void CullLightsToFrustumWork(Task* task, unsigned threadIndex);
+    /// Work function to collect the batches and lights of a secondary view.
+    void CollectSecondaryViewWork(Task* task, unsigned threadIndex);
+    /// Cull lights against a range of Z-slices of the frustum grid.
+    void CullLightsToFrustum(size_t zStart, size_t zEnd);
+    /// Cull decals against a range of Z-slices of the frustum grid.
+    void CullDecalsToFrustum(size_t zStart, size_t zEnd);
+    /// Build the cached static batches of an octant. Called from the batch collection worker threads, each of which handles its own octants.
+    void BuildStaticBatches(Octant* octant);
+    /// Decide which HLOD proxies substitute for their source drawables in the view, and add the batches of the visible ones.
+    void CollectHlodProxies();
+    /// Update the GPU culled static drawables for the view being prepared, and add their bounds within the frustum to the main thread's batch results.
+    void UpdateGpuCulling();
+    /// Invalidate the cached static batches of all octants.
+    void InvalidateStaticBatches();
+    /// Reduce the lights of the far clusters in a range of Z-slices to the highest contributing ones.
+    void LimitFarClusterLights(size_t zStart, size_t zEnd);
+    /// Add the debug geometry of an octant and its visible drawables, rebuilding the octant's cached static debug geometry if necessary. Called from the worker threads.
+    void AddOctantDebug(DebugRenderer* debug, Octant* octant);
 
     /// Current scene.
     Scene* scene;
@@ -217,6 +909,62 @@ private:
     Camera* camera;
     /// Camera frustum.
     Frustum frustum;
+    /// Main view data for meshlet culling.
+    MeshletCullData meshletCullData;
+    /// Frustum the octant cache was built with, expanded by the coherence threshold.
+    Frustum cacheFrustum;
+    /// Unexpanded frustum the octant cache was built with.
+    Frustum cacheReferenceFrustum;
+    /// Root-level octants the octant cache was built with.
+    std::vector<Octant*> cacheRootLevelOctants;
+    /// Octree the octant cache belongs to.
+    Octree* cacheOctree;
+    /// Octree the reusable view belongs to.
+    Octree* coherenceOctree;
+    /// Camera of the reusable view.
+    Camera* coherenceCamera;
+    /// View matrix of the reusable view.
+    Matrix3x4 coherenceView;
+    /// Projection matrix of the reusable view.
+    Matrix4 coherenceProjection;
+    /// Octree structure version the octant cache was built with.
+    unsigned cacheStructureVersion;
+    /// Octree drawable version after the reusable view was prepared.
+    unsigned coherenceDrawableVersion;
+    /// World transform storage version after the reusable view was prepared. The batches point to the matrices.
+    unsigned coherenceTransformVersion;
+    /// Camera view mask of the reusable view.
+    unsigned coherenceViewMask;
+    /// Temporal coherence threshold distance.
+    float coherenceThreshold;
+    /// Main view screen size culling threshold in pixels.
+    float minViewPixels;
+    /// Shadow caster screen size culling threshold in pixels.
+    float minShadowPixels;
+    /// Scale from bounding sphere radius divided by distance to pixels for the current view.
+    float screenSizeScale;
+    /// Shadow map time slicing pixel threshold.
+    float maxTimeSlicedPixels;
+    /// Texture streaming upload budget in bytes per frame.
+    size_t textureStreamingBudget;
+    /// Next streaming texture to update.
+    size_t textureStreamingCursor;
+    /// GPU memory budget of streaming textures in bytes.
+    size_t textureMemoryBudget;
+    /// Frames a streaming texture must be unrequested before eviction.
+    unsigned textureEvictFrames;
+    /// Fast approximate math subsystem flags.
+    unsigned fastMath;
+    /// Streaming textures that may be evicted this frame.
+    std::vector<Texture*> evictCandidates;
+    /// Graphics frame number of the last texture streaming update.
+    unsigned lastStreamingFrame;
+    /// Virtual texture page upload budget in bytes per frame.
+    size_t virtualTexturingBudget;
+    /// Graphics frame number of the last virtual texture update.
+    unsigned lastVirtualTextureFrame;
+    /// Shadow map time slicing interval in frames.
+    int shadowUpdateInterval;
     /// Cached graphics subsystem.
     Graphics* graphics;
     /// Cached work queue subsystem.
@@ -231,8 +979,90 @@ private:
     bool shadowMapsDirty;
     /// Cluster frustums dirty flag.
     bool clusterFrustumsDirty;
+    /// Stereo flag of the view being prepared.
+    bool stereo;
+    /// Stereo requested for the next view preparation flag.
+    bool stereoRequested;
     /// Instancing supported flag.
     bool hasInstancing;
+    /// Pipelined mode flag.
+    bool pipelined;
+    /// Multi-draw mode flag.
+    bool multiDraw;
+    /// Meshlet culling mode flag.
+    bool meshletCulling;
+    /// Bindless texture mode flag.
+    bool bindlessTextures;
+    /// Depth pre-pass mode flag.
+    bool depthPrePass;
+    /// Deferred shading flag.
+    bool deferredShading;
+    /// Visibility buffer mode flag.
+    bool visibilityBuffer;
+    /// Order-independent transparency flag.
+    bool orderIndependentTransparency;
+    /// Order-independent transparency flag of the view being prepared.
+    bool orderIndependent;
+    /// Compute light clustering mode flag.
+    bool computeClustering;
+    /// Compute skinning mode flag.
+    bool computeSkinning;
+    /// Adaptive light cluster depth slices flag.
+    bool adaptiveClusterSlices;
+    /// Light hierarchy mode flag.
+    bool lightHierarchy;
+    /// Shadow budget mode flag.
+    bool shadowBudget;
+    /// Directional light shadow caching flag.
+    bool dirShadowCaching;
+    /// Single-pass point light shadows flag.
+    bool singlePassPointShadows;
+    /// Moment shadow map mode flag.
+    bool momentShadows;
+    /// Texture streaming flag.
+    bool textureStreaming;
+    /// Virtual texturing flag.
+    bool virtualTexturing;
+    /// Static instance table mode flag.
+    bool staticInstanceTable;
+    /// Static batch caching flag.
+    bool staticBatchCaching;
+    /// GPU culling flag.
+    bool gpuCulling;
+    /// Whether the view being prepared uses GPU culling.
+    bool gpuCullingActive;
+    /// HLOD proxy screen size threshold in pixels.
+    float hlodPixels;
+    /// Late latching frustum widening angle in degrees.
+    float lateLatchAngle;
+    /// Version of the cached static batches. Octants built at another version rebuild their cache. Never zero.
+    unsigned staticBatchVersion;
+    /// Material batch version the cached static batches are valid for.
+    unsigned staticBatchMaterialVersion;
+    /// World transform version the cached static batches are valid for.
+    unsigned staticBatchTransformVersion;
+    /// Static shadowcaster caching flag.
+    bool staticCasterCaching;
+    /// Serial number of the static changes collected on view preparation. Never zero.
+    unsigned staticChangeSerial;
+    /// View preparation in progress flag.
+    bool viewPending;
+    /// Temporal coherence flag.
+    bool temporalCoherence;
+    /// Octant cache valid flag.
+    bool octantCacheValid;
+    /// Octant cache rebuild flag for the current preparation.
+    bool rebuildOctantCache;
+    /// Prepared view can be reused flag.
+    bool viewReusable;
+    /// Shadows flag of the reusable view.
+    bool coherenceDrawShadows;
+    /// Occlusion culling mode.
+    OcclusionMode occlusionMode;
+    /// Next occlusion buffer ready flag.
+    bool nextOcclusionBufferReady;
+    /// Occlusion data dirty flag. The occlusion buffer will be reset on the next view preparation.
+    bool occlusionDirty;
     /// Root-level octants, used as a starting point for octant and batch collection. The root octant is included if it also contains drawables.
     std::vector<Octant*> rootLevelOctants;
     /// Counter for batch collection tasks remaining. When zero, main batch sorting can begin while other tasks go on.
@@ -241,8 +1071,16 @@ private:
     std::atomic<int> numPendingShadowViews[2];
     /// Per-worker thread octant collection results.
     std::vector<ThreadOctantResult> octantResults;
+    /// Visible octants gathered for adding debug geometry in parallel.
+    std::vector<Octant*> debugOctants;
     /// Per-worker thread batch collection results.
     std::vector<ThreadBatchResult> batchResults;
+    /// Per-thread rendering statistics of the current frame.
+    mutable std::vector<RenderStats> threadStats;
+    /// Rendering statistics of the last frame.
+    RenderStats stats;
+    /// Per-thread frame arenas for the intermediate results.
+    AutoPtr<FrameArenas> frameArenas;
     /// Minimum Z value for all geometries in frustum.
     float minZ;
     /// Maximum Z value for all geometries in frustum.
@@ -253,18 +1091,38 @@ private:
     LightDrawable* dirLight;
     /// Accepted point and spot lights in frustum.
     std::vector<LightDrawable*> lights;
+    /// Accepted decals in frustum.
+    std::vector<DecalDrawable*> decals;
+    /// Regions where static shadowcasters changed since the last view preparation.
+    std::vector<BoundingBox> staticChanges;
+    /// Shadowed localized lights in allocation order.
+    std::vector<ShadowBudgetEntry> shadowBudgetEntries;
+    /// Minimum shadow map face size in shadow budget mode.
+    int minShadowMapSize;
     /// Shadow maps.
     std::vector<ShadowMap> shadowMaps;
     /// Opaque batches.
     BatchQueue opaqueBatches;
     /// Transparent batches.
     BatchQueue alphaBatches;
+    /// Per-thread opaque batch ranges to sort.
+    std::vector<BatchRange> opaqueBatchRanges;
+    /// Per-thread transparent batch ranges to sort.
+    std::vector<BatchRange> alphaBatchRanges;
     /// Instance transforms for opaque and alpha batches.
     std::vector<Matrix3x4> instanceTransforms;
-    /// Last camera used for rendering.
-    Camera* lastCamera;
-    /// Last material pass used for rendering.
-    Pass* lastPass;
+    /// Static transform table indices and material table slots of instanced static opaque and alpha batches.
+    std::vector<Vector2> staticInstances;
+    /// Skin matrix palettes for instanced skinned opaque and alpha batches.
+    std::vector<Matrix3x4> skinMatrices;
+    /// Multi-draw commands for opaque and alpha batches.
+    std::vector<IndirectDrawCommand> drawCommands;
+    /// View preparation results being rendered.
+    PreparedView preparedView;
+    /// Resources referenced by a loaded frame capture.
+    std::vector<SharedPtr<Resource> > captureResources;
+    /// Last view used for rendering.
+    const RenderView* lastView;
     /// Last material used for rendering.
     Material* lastMaterial;
     /// Last material uniforms assignment number.
@@ -273,6 +1131,10 @@ private:
     float depthBiasMul;
     /// Slope-scaled depth bias multiplier.
     float slopeScaleBiasMul;
+    /// Render command lists for batch queue segments.
+    std::vector<RenderCommandList> renderCommands;
+    /// Batch queue segment start indices for recording render commands.
+    std::vector<size_t> commandSegmentStarts;
     /// Tasks for octant collection.
     AutoPtr<CollectOctantsTask> collectOctantsTasks[NUM_OCTANT_TASKS];
     /// Task for light processing.
@@ -283,40 +1145,174 @@ private:
     AutoPtr<Task> processShadowCastersTask;
     /// Tasks for shadow batch processing.
     std::vector<AutoPtr<CollectShadowBatchesTask> > collectShadowBatchesTasks;
-    /// Tasks for light grid culling.
-    AutoPtr<CullLightsTask> cullLightsTasks[NUM_CLUSTER_Z];
+    /// Tasks for secondary view preparation.
+    std::vector<AutoPtr<CollectSecondaryViewTask> > collectSecondaryViewTasks;
+    /// Secondary views requested for the next view preparation.
+    std::vector<SharedPtr<SecondaryView> > requestedSecondaryViews;
+    /// Secondary views being prepared.
+    std::vector<SharedPtr<SecondaryView> > pendingSecondaryViews;
+    /// Secondary views captured for rendering.
+    std::vector<SharedPtr<SecondaryView> > preparedSecondaryViews;
+    /// Single light cluster of secondary views, which lists all their lights.
+    AutoPtr<Texture> secondaryClusterTexture;
+    /// Light index list texture of secondary views.
+    AutoPtr<Texture> secondaryLightIndexTexture;
+    /// Light data texture of secondary views.
+    AutoPtr<Texture> secondaryLightDataTexture;
     /// Face selection UV indirection texture 1.
     AutoPtr<Texture> faceSelectionTexture1;
     /// Face selection UV indirection texture 2.
     AutoPtr<Texture> faceSelectionTexture2;
-    /// Cluster lookup 3D texture.
+    /// Cluster 3D texture, which contains the light index list offset and count of each cluster.
     AutoPtr<Texture> clusterTexture;
+    /// Light index list texture. Contains two 16-bit indices per texel.
+    AutoPtr<Texture> lightIndexTexture;
+    /// Light data texture.
+    AutoPtr<Texture> lightDataTexture;
+    /// Decal data texture.
+    AutoPtr<Texture> decalDataTexture;
+    /// Decal atlas texture.
+    SharedPtr<Texture> decalAtlas;
+    /// Maximum opaque view depth of each screen tile for compute light clustering.
+    AutoPtr<Texture> clusterBoundsTexture;
     /// Per-view uniform buffer.
     AutoPtr<UniformBuffer> perViewDataBuffer;
-    /// Light data uniform buffer.
-    AutoPtr<UniformBuffer> lightDataBuffer;
-    /// Instancing vertex buffer.
+    /// Point light face uniform buffer for single-pass shadow rendering.
+    AutoPtr<UniformBuffer> cubeShadowDataBuffer;
+    /// Eye uniform buffer for single-pass stereo rendering.
+    AutoPtr<UniformBuffer> stereoDataBuffer;
+    /// Camera enclosing both eyes of a stereo view, used for culling, shadows and light clusters.
+    AutoPtr<Camera> stereoCamera;
+    /// Eye matrices of the stereo view being prepared.
+    StereoUniforms stereoData;
+    /// Viewport to restore after rendering a stereo view.
+    IntRect stereoViewport;
+    /// Instancing vertex buffer. Persistently mapped if supported.
     AutoPtr<VertexBuffer> instanceVertexBuffer;
-    /// Cached static object shadow buffer. Note: only needed for the light atlas, not the directional light shadowmap.
-    AutoPtr<RenderBuffer> staticObjectShadowBuffer;
-    /// Cached static object shadow framebuffer.
-    AutoPtr<FrameBuffer> staticObjectShadowFbo;
+    /// Skin matrix palette texture for instanced skinning. Each row holds the three texels of SKIN_MATRICES_PER_ROW matrices.
+    AutoPtr<Texture> skinMatrixTexture;
+    /// Instancing vertex buffer position of the main view's instance transforms this frame.
+    size_t mainInstanceBase;
+    /// Static instance vertex buffer position of the main view's static transform table indices this frame.
+    size_t mainStaticInstanceBase;
+    /// Static instance vertex buffer, which holds a static transform table index and a material table slot per instance. Persistently mapped if supported.
+    AutoPtr<VertexBuffer> staticInstanceBuffer;
+    /// Visibility instance vertex buffer, which holds a static transform table index and a first triangle per instance. Persistently mapped if supported.
+    AutoPtr<VertexBuffer> visibilityInstanceBuffer;
+    /// Overflow storage of the instancing vertex buffer.
+    InstanceOverflow instanceOverflow;
+    /// Overflow storage of the static instance vertex buffer.
+    InstanceOverflow staticInstanceOverflow;
+    /// Overflow storage of the visibility instance vertex buffer.
+    InstanceOverflow visibilityInstanceOverflow;
+    /// Static transform table texture. Each row holds the three texels of STATIC_TRANSFORMS_PER_ROW matrices.
+    AutoPtr<Texture> staticTransformTexture;
+    /// Octree whose static transform table was last uploaded.
+    Octree* staticTransformOctree;
+    /// Material table texture. Each row holds the packed uniforms of MATERIAL_TABLE_ENTRIES_PER_ROW materials.
+    AutoPtr<Texture> materialTableTexture;
+    /// Material uniform version of the last material table upload.
+    unsigned materialTableVersion;
+    /// Material table scratch data.
+    std::vector<Vector4> materialTableData;
+    /// Multi-draw command buffer.
+    AutoPtr<IndirectBuffer> indirectBuffer;
     /// Vertex elements for the instancing buffer.
     std::vector<VertexElement> instanceVertexElements;
+    /// Vertex elements for the static instance buffer.
+    std::vector<VertexElement> staticInstanceElements;
+    /// Vertex elements for the visibility instance buffer.
+    std::vector<VertexElement> visibilityInstanceElements;
     /// Last projection matrix used to initialize cluster frustums.
     Matrix4 lastClusterFrustumProj;
+    /// Last depth slice parameters used to initialize cluster frustums.
+    Vector4 lastClusterSliceParameters;
+    /// Light cluster depth slice parameters of the view being prepared.
+    Vector4 clusterSliceParameters;
+    /// Near split distance of adaptive light cluster depth slices.
+    float clusterNearSplit;
+    /// View distance beyond which the far light cluster limit applies.
+    float farClusterLightDistance;
+    /// Maximum number of lights in far clusters, or zero if not limited.
+    size_t maxFarClusterLights;
+    /// View space positions of the lights, for ranking the lights of far clusters.
+    std::vector<Vector3> lightViewPositions;
+    /// Lights in view ranked by negated importance in light hierarchy mode.
+    std::vector<std::pair<float, LightDrawable*> > lightImportances;
+    /// View space bounding boxes of the lights in light hierarchy mode.
+    std::vector<BoundingBox> lightViewBoxes;
+    /// Bounding volume hierarchy of the lights' view space bounds in light hierarchy mode.
+    Bvh lightBvh;
+    /// View space bounding spheres of the decals.
+    std::vector<Sphere> decalViewSpheres;
+    /// Shadow map viewports to store or restore from the static shadow textures, collected to copy at once.
+    std::vector<IntRect> shadowCopyRects;
+    /// Light cluster grid size.
+    IntVector3 clusterSize;
+    /// Number of light clusters.
+    size_t numClusters;
+    /// Maximum number of localized lights in view.
+    size_t maxLights;
+    /// Maximum number of lights per cluster.
+    size_t maxLightsPerCluster;
     /// Amount of lights per cluster.
-    unsigned char numClusterLights[NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
+    AutoArrayPtr<unsigned short> numClusterLights;
     /// Cluster frustums for lights.
     AutoArrayPtr<Frustum> clusterFrustums;
-    /// Cluster bounding boxes.
-    AutoArrayPtr<BoundingBox> clusterBoundingBoxes;
-    /// Cluster data CPU copy.
-    AutoArrayPtr<unsigned char> clusterData;
-    /// Light constantbuffer data CPU copy.
+    /// Cluster bounding boxes in packs of 8, each row of clusters padded to whole packs.
+    std::vector<BoundingBoxPack> clusterBoxPacks;
+    /// Left and right planes of each cluster column, shared by all rows and slices.
+    std::vector<Plane> clusterColumnPlanes;
+    /// Up and down planes of each cluster row, shared by all columns and slices.
+    std::vector<Plane> clusterRowPlanes;
+    /// Number of bounding box packs per cluster row.
+    size_t clusterPacksPerRow;
+    /// Per-cluster light indices, with room for the maximum per cluster, written while culling.
+    AutoArrayPtr<unsigned short> clusterLights;
+    /// Light index list offset and count of each cluster, packed from the culling results. The upper 16 bits of the count are the decal count.
+    std::vector<unsigned> clusterRanges;
+    /// Light indices of all clusters, each cluster's decal indices following its lights, packed from the culling results.
+    std::vector<unsigned short> lightIndices;
+    /// Light data CPU copy.
     AutoArrayPtr<LightData> lightData;
-    /// Per-view uniform data CPU copy.
-    PerViewUniforms perViewData;
+    /// Maximum number of decals in view.
+    size_t maxDecals;
+    /// Maximum number of decals per cluster.
+    size_t maxDecalsPerCluster;
+    /// Amount of decals per cluster.
+    AutoArrayPtr<unsigned short> numClusterDecals;
+    /// Per-cluster decal indices, with room for the maximum per cluster, written while culling.
+    AutoArrayPtr<unsigned short> clusterDecals;
+    /// Decal data CPU copy.
+    AutoArrayPtr<DecalData> decalData;
+    /// Occlusion buffer used for culling during view preparation.
+    OcclusionBuffer occlusionBuffer;
+    /// Occlusion buffer built from the latest readback. Taken into use on the next view preparation.
+    OcclusionBuffer nextOcclusionBuffer;
+    /// Cells and portals of interior spaces.
+    SharedPtr<PortalCells> portalCells;
+    /// Light probes of the baked lights.
+    SharedPtr<LightProbeGrid> lightProbes;
+    /// Portal visibility from the camera's cell, used for culling during view preparation.
+    PortalCuller portalCuller;
+    /// GPU culling of the static BVH.
+    GpuCuller gpuCuller;
+    /// Downsampled depth texture for occlusion.
+    AutoPtr<Texture> occlusionTexture;
+    /// Framebuffer for the downsampled depth texture.
+    AutoPtr<FrameBuffer> occlusionFbo;
+    /// View-projection matrix of the pending occlusion depth readback.
+    Matrix4 occlusionViewProj;
+    /// Pending asynchronous readback of the downsampled depth.
+    SharedPtr<Readback> occlusionReadback;
+    /// Software occlusion rasterizer.
+    OcclusionRasterizer occlusionRasterizer;
+    /// Occluder drawables in view.
+    std::vector<Drawable*> occluders;
+    /// Virtual texture feedback image.
+    AutoPtr<Texture> virtualFeedbackTexture;
+    /// Pending asynchronous readback of the virtual texture feedback.
+    SharedPtr<Readback> virtualFeedbackReadback;
 };
 
 /// Task for collecting octants.
@@ -328,7 +1324,7 @@ struct CollectOctantsTask : public MemberFunctionTask<Renderer>
     {
     }
 
-    /// Starting point octant.
+    /// Starting point octant, or null for the static BVH.
     Octant* startOctant;
     /// Result index.
     size_t subtreeIdx;
@@ -344,7 +1340,7 @@ struct CollectBatchesTask : public MemberFunctionTask<Renderer>
     }
 
     /// %Octant list with plane masks.
-    std::vector<std::pair<Octant*, unsigned char > > octants;
+    FrameVector<std::pair<Octant*, unsigned char > > octants;
 };
 
 /// Task for collecting shadowcasters of a specific light.
@@ -375,17 +1371,17 @@ struct CollectShadowBatchesTask : public MemberFunctionTask<Renderer>
     size_t viewIdx;
 };
 
-/// Task for culling lights to a specific Z-slice of the frustum grid.
-struct CullLightsTask : public MemberFunctionTask<Renderer>
+/// Task for collecting the batches and lights of a secondary view.
+struct CollectSecondaryViewTask : public MemberFunctionTask<Renderer>
 {
     /// Construct.
-    CullLightsTask(Renderer* object_, MemberWorkFunctionPtr function_) :
+    CollectSecondaryViewTask(Renderer* object_, MemberWorkFunctionPtr function_) :
         MemberFunctionTask<Renderer>(object_, function_)
     {
     }
 
-    /// Z-slice.
-    size_t z;
+    /// Secondary view.
+    SecondaryView* view;
 };
 
 /// Register Renderer related object factories and attributes.
@@ -0,0 +1,47 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Math.h"
+#include "SecondaryView.h"
+
+SecondaryView::SecondaryView() :
+    viewMask(M_MAX_UNSIGNED),
+    lodBias(0.5f),
+    shadowMode(SECONDARY_SHADOWS_REUSE),
+    maxLights(DEFAULT_SECONDARY_VIEW_LIGHTS),
+    updateInterval(1),
+    framesUntilUpdate(0),
+    camera(nullptr),
+    preparedViewMask(M_MAX_UNSIGNED),
+    renderPending(false)
+{
+}
+
+SecondaryView::~SecondaryView()
+{
+}
+
+void SecondaryView::SetViewMask(unsigned mask)
+{
+    viewMask = mask;
+}
+
+void SecondaryView::SetLodBias(float bias)
+{
+    lodBias = Max(bias, M_EPSILON);
+}
+
+void SecondaryView::SetShadowMode(SecondaryShadowMode mode)
+{
+    shadowMode = mode;
+}
+
+void SecondaryView::SetMaxLights(size_t num)
+{
+    maxLights = Min(num, MAX_LIGHTS);
+}
+
+void SecondaryView::SetUpdateInterval(int frames)
+{
+    updateInterval = Max(frames, 1);
+    framesUntilUpdate = Min(framesUntilUpdate, updateInterval - 1);
+}
@@ -0,0 +1,102 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Renderer.h"
+
+static const size_t DEFAULT_SECONDARY_VIEW_LIGHTS = 4;
+
+/// Shadow modes of a secondary view.
+enum SecondaryShadowMode
+{
+    /// Render without shadows.
+    SECONDARY_SHADOWS_NONE = 0,
+    /// Sample the directional light shadow cascades rendered for the main view. Localized lights stay unshadowed.
+    SECONDARY_SHADOWS_REUSE
+};
+
+/// Reduced-cost culling and shading profile for a secondary view, such as a planar reflection. Prepared by Renderer on a worker thread alongside the main view, without shadow maps or light clusters of its own: the visible geometries are collected with a frustum query, the closest localized lights up to a small maximum are applied to every pixel, and the directional light of the main view is used. Skinned and custom geometries are not drawn. Disabled until requested with Renderer::PrepareSecondaryView().
+class SecondaryView : public RefCounted
+{
+    friend class Renderer;
+
+public:
+    /// Construct.
+    SecondaryView();
+    /// Destruct.
+    ~SecondaryView();
+
+    /// Set view mask, combined with the camera's. Default all layers.
+    void SetViewMask(unsigned mask);
+    /// Set LOD bias, combined with the camera's and the drawables' own. Values below one switch to coarser LOD levels sooner. Default 0.5.
+    void SetLodBias(float bias);
+    /// Set shadow mode. Default reuses the main view's directional light shadows.
+    void SetShadowMode(SecondaryShadowMode mode);
+    /// Set maximum number of localized lights, picked by distance to the camera. With zero only the directional light is used. Default 4.
+    void SetMaxLights(size_t num);
+    /// Set update interval in frames. The view is prepared only on every interval'th request, and the previously rendered contents should be kept in between. Default 1 updates every frame.
+    void SetUpdateInterval(int frames);
+
+    /// Return view mask.
+    unsigned ViewMask() const { return viewMask; }
+    /// Return LOD bias.
+    float LodBias() const { return lodBias; }
+    /// Return shadow mode.
+    SecondaryShadowMode GetShadowMode() const { return shadowMode; }
+    /// Return maximum number of localized lights.
+    size_t MaxLights() const { return maxLights; }
+    /// Return update interval in frames.
+    int UpdateInterval() const { return updateInterval; }
+    /// Return whether a newly prepared view is waiting to be rendered with Renderer::RenderSecondaryView(). When false, the previous contents can be kept.
+    bool IsRenderPending() const { return renderPending; }
+
+private:
+    /// View mask.
+    unsigned viewMask;
+    /// LOD bias.
+    float lodBias;
+    /// Shadow mode.
+    SecondaryShadowMode shadowMode;
+    /// Maximum number of localized lights.
+    size_t maxLights;
+    /// Update interval in frames.
+    int updateInterval;
+    /// Requests left until the next update.
+    int framesUntilUpdate;
+    /// Camera of the view being prepared.
+    Camera* camera;
+    /// Frustum of the view being prepared.
+    Frustum frustum;
+    /// Combined view mask of the view being prepared.
+    unsigned preparedViewMask;
+    /// Geometry query results.
+    std::vector<Drawable*> geometries;
+    /// Light query results.
+    std::vector<Drawable*> lights;
+    /// Opaque batches being prepared.
+    BatchQueue opaqueBatches;
+    /// Transparent batches being prepared.
+    BatchQueue alphaBatches;
+    /// Instance transforms being prepared.
+    std::vector<Matrix3x4> instanceTransforms;
+    /// Multi-draw commands being prepared.
+    std::vector<IndirectDrawCommand> drawCommands;
+    /// Light data being prepared.
+    std::vector<LightData> lightData;
+    /// Captured view parameters.
+    RenderView renderView;
+    /// Captured opaque batches.
+    BatchQueue preparedOpaqueBatches;
+    /// Captured transparent batches.
+    BatchQueue preparedAlphaBatches;
+    /// Captured instance transforms.
+    std::vector<Matrix3x4> preparedInstanceTransforms;
+    /// Captured multi-draw commands.
+    std::vector<IndirectDrawCommand> preparedDrawCommands;
+    /// Captured light data.
+    std::vector<LightData> preparedLightData;
+    /// Snapshot of non-instanced batch world transforms in pipelined mode.
+    std::vector<Matrix3x4> worldTransforms;
+    /// Captured view waiting to be rendered flag.
+    bool renderPending;
+};
@@ -2,8 +2,11 @@
 
 #include "../IO/Log.h"
 #include "../Resource/ResourceCache.h"
+#include "../Scene/Scene.h"
 #include "Camera.h"
+#include "Impostor.h"
 #include "Model.h"
+#include "OcclusionRasterizer.h"
 #include "Octree.h"
 #include "StaticModel.h"
 
@@ -14,8 +17,11 @@ static Vector3 DOT_SCALE(1 / 3.0f, 1 / 3.0f, 1 / 3.0f);
 static Allocator<StaticModelDrawable> drawableAllocator;
 
 StaticModelDrawable::StaticModelDrawable() :
-    lodBias(1.0f)
+    lodBias(1.0f),
+    lodFadeBand(0.0f),
+    impostorDistance(0.0f)
 {
+    drawableType = DT_STATICMODEL;
 }
 
 void StaticModelDrawable::OnWorldBoundingBoxUpdate() const
@@ -29,9 +35,19 @@ void StaticModelDrawable::OnWorldBoundingBoxUpdate() const
         Drawable::OnWorldBoundingBoxUpdate();
 }
 
+const BoundingBox* StaticModelDrawable::LocalBoundingBox() const
+{
+    return model ? &model->LocalBoundingBox() : nullptr;
+}
+
 bool StaticModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
 {
-    distance = camera->Distance(WorldBoundingBox().Center());
+    return PrepareRender(frameNumber, camera, camera->Distance(WorldBoundingBox().Center()));
+}
+
+bool StaticModelDrawable::PrepareRender(unsigned short frameNumber, Camera* camera, float distance_)
+{
+    distance = distance_;
 
     if (maxDistance > 0.0f && distance > maxDistance)
         return false;
@@ -42,11 +58,15 @@ bool StaticModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera* ca
     if (frameNumber - lastUpdateFrameNumber == 0x8000)
         lastUpdateFrameNumber = 0;
 
+    float lodDistance = 0.0f;
+    if ((Flags() & DF_HAS_LOD_LEVELS) || impostor)
+        lodDistance = camera->LodDistance(distance, WorldScale().DotProduct(DOT_SCALE), lodBias);
+
     // Find out the new LOD level if model has LODs
     if (Flags() & DF_HAS_LOD_LEVELS)
     {
-        float lodDistance = camera->LodDistance(distance, WorldScale().DotProduct(DOT_SCALE), lodBias);
         size_t numGeometries = batches.NumGeometries();
+        bool fading = false;
 
         for (size_t i = 0; i < numGeometries; ++i)
         {
@@ -64,13 +84,104 @@ bool StaticModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera* ca
                     batches.SetGeometry(i, lodGeometries[j - 1]);
                     lastUpdateFrameNumber = frameNumber;
                 }
+
+                if (i < lodFades.size())
+                {
+                    // Crossfade from the previous level until the band past the LOD distance has been crossed
+                    LodFadeState& state = lodFades[i];
+                    Geometry* fadeGeometry = nullptr;
+                    float fade = 1.0f;
+
+                    if (lodFadeBand > 0.0f && j > 1)
+                    {
+                        float fadeStart = lodGeometries[j - 1]->lodDistance;
+                        float fadeLength = fadeStart * lodFadeBand;
+                        if (fadeLength > 0.0f && lodDistance < fadeStart + fadeLength)
+                        {
+                            fadeGeometry = lodGeometries[j - 2];
+                            fade = (lodDistance - fadeStart) / fadeLength;
+                            fading = true;
+                        }
+                    }
+
+                    // Cached shadow maps need to be rendered again as the masks change
+                    if (fadeGeometry != state.geometry || fade != state.fade)
+                    {
+                        state.geometry = fadeGeometry;
+                        state.fade = fade;
+                        lastUpdateFrameNumber = frameNumber;
+                    }
+                }
             }
         }
+
+        SetFlag(DF_LOD_FADE, fading);
+    }
+
+    // Switch to the impostor when far enough. The LOD levels are still selected for shadows, but are not crossfaded
+    if (impostor)
+    {
+        bool useImpostor = lodDistance > impostorDistance;
+        SetFlag(DF_IMPOSTOR, useImpostor);
+        if (useImpostor)
+            SetFlag(DF_LOD_FADE, false);
     }
 
     return true;
 }
 
+unsigned StaticModelDrawable::PrepareRender(StaticModelDrawable* const* drawables, const float* distances, size_t count, unsigned short frameNumber, Camera* camera)
+{
+    unsigned result = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (drawables[i]->PrepareRender(frameNumber, camera, distances[i]))
+            result |= 1 << i;
+    }
+
+    return result;
+}
+
+Geometry* StaticModelDrawable::LodFadeGeometry(size_t index, float& fade) const
+{
+    if (index < lodFades.size() && lodFades[index].geometry)
+    {
+        fade = lodFades[index].fade;
+        return lodFades[index].geometry;
+    }
+    else
+    {
+        fade = 0.0f;
+        return nullptr;
+    }
+}
+
+const SourceBatches* StaticModelDrawable::ImpostorBatches() const
+{
+    return impostor ? &impostor->Batches() : nullptr;
+}
+
+Geometry* StaticModelDrawable::LodGeometry(size_t index, Camera* camera, float lodBias_) const
+{
+    if (!(Flags() & DF_HAS_LOD_LEVELS) || !model)
+        return batches.GetGeometry(index);
+
+    const std::vector<SharedPtr<Geometry> >& lodGeometries = model->LodGeometries(index);
+    if (lodGeometries.size() < 2)
+        return batches.GetGeometry(index);
+
+    float lodDistance = camera->LodDistance(camera->Distance(WorldBoundingBox().Center()), WorldScale().DotProduct(DOT_SCALE), lodBias * lodBias_);
+    size_t j;
+    for (j = 1; j < lodGeometries.size(); ++j)
+    {
+        if (lodDistance <= lodGeometries[j]->lodDistance)
+            break;
+    }
+
+    return lodGeometries[j - 1];
+}
+
 void StaticModelDrawable::OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance_)
 {
     if (ray.HitDistance(WorldBoundingBox()) < maxDistance_)
@@ -111,6 +222,12 @@ void StaticModelDrawable::OnRaycast(std::vector<RaycastResult>& dest, const Ray&
     }
 }
 
+void StaticModelDrawable::OnRasterizeOcclusion(OcclusionRasterizer* rasterizer, unsigned threadIndex)
+{
+    if (model)
+        rasterizer->AddOccluder(model->GetOccluderMesh(), WorldTransform(), threadIndex);
+}
+
 StaticModel::StaticModel()
 {
     drawable = drawableAllocator.Allocate();
@@ -137,6 +254,60 @@ void StaticModel::RegisterObject()
     RegisterMixedRefAttribute("model", &StaticModel::ModelAttr, &StaticModel::SetModelAttr, ResourceRef(Model::TypeStatic()));
     CopyBaseAttribute<StaticModel, GeometryNode>("materials");
     RegisterAttribute("lodBias", &StaticModel::LodBias, &StaticModel::SetLodBias, 1.0f);
+    RegisterAttribute("lodFadeBand", &StaticModel::LodFadeBand, &StaticModel::SetLodFadeBand, 0.0f);
+    RegisterAttribute("occluder", &StaticModel::IsOccluder, &StaticModel::SetOccluder, false);
+    RegisterAttribute("impostorDistance", &StaticModel::ImpostorDistance, &StaticModel::SetImpostorDistance, 0.0f);
+}
+
+void StaticModel::CreateInstances(Node* parent, const std::vector<Vector3>& positions, const std::vector<Quaternion>& rotations, const std::vector<Vector3>& scales, Model* model, Material* material, std::vector<StaticModel*>* result)
+{
+    ZoneScoped;
+
+    if (!parent || positions.empty())
+        return;
+
+    size_t count = positions.size();
+    std::vector<Node*> newNodes(count);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        // The nodes are not yet in the scene, so setting the model and material does not touch the octree
+        StaticModel* instance = new StaticModel();
+        instance->position = positions[i];
+        if (rotations.size())
+            instance->rotation = rotations[rotations.size() > 1 ? i : 0];
+        if (scales.size())
+            instance->scale = scales[scales.size() > 1 ? i : 0];
+        // The world transform was already calculated on construction, so mark it dirty after assigning the transform directly
+        instance->SetFlag(NF_WORLD_TRANSFORM_DIRTY, true);
+        instance->drawable->SetFlag(DF_WORLD_TRANSFORM_DIRTY, true);
+        instance->SetModel(model);
+        instance->SetMaterial(material);
+        newNodes[i] = instance;
+    }
+
+    parent->AddChildren(newNodes);
+
+    // Do the work of the scene assignment handler for all nodes at once
+    Scene* scene = parent->ParentScene();
+    Octree* octree = scene ? scene->FindChild<Octree>() : nullptr;
+    std::vector<Drawable*> drawables;
+    drawables.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        StaticModel* instance = static_cast<StaticModel*>(newNodes[i]);
+        instance->octree = octree;
+        drawables.push_back(instance->drawable);
+    }
+    if (octree)
+        octree->QueueInsertions(drawables);
+
+    if (result)
+    {
+        result->reserve(result->size() + count);
+        for (size_t i = 0; i < count; ++i)
+            result->push_back(static_cast<StaticModel*>(newNodes[i]));
+    }
 }
 
 void StaticModel::SetModel(Model* model)
@@ -147,6 +318,8 @@ void StaticModel::SetModel(Model* model)
 
     modelDrawable->model = model;
     modelDrawable->SetFlag(DF_HAS_LOD_LEVELS, false);
+    modelDrawable->SetFlag(DF_LOD_FADE, false);
+    modelDrawable->lodFades.clear();
 
     if (model)
     {
@@ -158,12 +331,24 @@ void StaticModel::SetModel(Model* model)
             if (model->NumLodLevels(i) > 1)
                 modelDrawable->SetFlag(DF_HAS_LOD_LEVELS, true);
         }
+
+        if (modelDrawable->TestFlag(DF_HAS_LOD_LEVELS))
+        {
+            LodFadeState state;
+            state.geometry = nullptr;
+            state.fade = 1.0f;
+            modelDrawable->lodFades.resize(model->NumGeometries(), state);
+        }
+
+        if (IsOccluder())
+            model->PrepareOccluderMesh();
     }
     else
     {
         SetNumGeometries(0);
     }
 
+    UpdateImpostor();
     OnBoundingBoxChanged();
 }
 
@@ -173,6 +358,31 @@ void StaticModel::SetLodBias(float bias)
     modelDrawable->lodBias = Max(bias, M_EPSILON);
 }
 
+void StaticModel::SetLodFadeBand(float band)
+{
+    StaticModelDrawable* modelDrawable = static_cast<StaticModelDrawable*>(drawable);
+    modelDrawable->lodFadeBand = Max(band, 0.0f);
+}
+
+void StaticModel::SetOccluder(bool enable)
+{
+    if (enable != IsOccluder())
+    {
+        drawable->SetFlag(DF_OCCLUDER, enable);
+        if (enable && GetModel())
+            GetModel()->PrepareOccluderMesh();
+        // Reinsert into octree so that the octant's culling data is updated
+        OnBoundingBoxChanged();
+    }
+}
+
+void StaticModel::SetImpostorDistance(float distance)
+{
+    StaticModelDrawable* modelDrawable = static_cast<StaticModelDrawable*>(drawable);
+    modelDrawable->impostorDistance = Max(distance, 0.0f);
+    UpdateImpostor();
+}
+
 Model* StaticModel::GetModel() const
 {
     return static_cast<StaticModelDrawable*>(drawable)->model;
@@ -188,3 +398,22 @@ ResourceRef StaticModel::ModelAttr() const
 {
     return ResourceRef(Model::TypeStatic(), ResourceName(GetModel()));
 }
+
+void StaticModel::UpdateImpostor()
+{
+    StaticModelDrawable* modelDrawable = static_cast<StaticModelDrawable*>(drawable);
+    Model* model = modelDrawable->model;
+
+    modelDrawable->impostor.Reset();
+    modelDrawable->SetFlag(DF_IMPOSTOR, false);
+    if (modelDrawable->GetOctant())
+        modelDrawable->GetOctant()->MarkStaticBatchesDirty();
+
+    if (model && modelDrawable->impostorDistance > 0.0f)
+    {
+        std::vector<Material*> materials(NumGeometries());
+        for (size_t i = 0; i < materials.size(); ++i)
+            materials[i] = GetMaterial(i);
+        modelDrawable->impostor = model->GetImpostor(materials);
+    }
+}
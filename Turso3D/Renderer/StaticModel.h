@@ -4,8 +4,18 @@
 
 #include "GeometryNode.h"
 
+class Impostor;
 class Model;
 
+/// LOD crossfade state of one geometry index.
+struct LodFadeState
+{
+    /// LOD level being faded out, or null if not crossfading.
+    Geometry* geometry;
+    /// Crossfade value of the current LOD level, the portion of pixels it covers.
+    float fade;
+};
+
 /// Static model drawable.
 class StaticModelDrawable : public GeometryDrawable
 {
@@ -17,16 +27,44 @@ public:
 
     /// Recalculate the world space bounding box.
     void OnWorldBoundingBoxUpdate() const override;
+    /// Return the model's bounding box, or null if no model.
+    const BoundingBox* LocalBoundingBox() const override;
     /// Prepare object for rendering. Reset framenumber and calculate distance from camera, and check for LOD level changes. Called by Renderer in worker threads. Return false if should not render.
     bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Prepare object for rendering with the distance from camera already calculated. Not virtual, so subclasses that need their own preparation are not of the DT_STATICMODEL type.
+    bool PrepareRender(unsigned short frameNumber, Camera* camera, float distance);
     /// Perform ray test on self and add possible hit to the result vector.
     void OnRaycast(std::vector<RaycastResult>& dest, const Ray& ray, float maxDistance) override;
+    /// Add the model's occluder mesh for software occlusion.
+    void OnRasterizeOcclusion(OcclusionRasterizer* rasterizer, unsigned threadIndex) override;
+    /// Return the LOD level being faded out at geometry index and write the crossfade value of the current level, or null if not crossfading.
+    Geometry* LodFadeGeometry(size_t index, float& fade) const override;
+    /// Return the impostor's draw call source data, or null if no impostor.
+    const SourceBatches* ImpostorBatches() const override;
+    /// Return the LOD level at geometry index for a camera with an additional LOD bias, without changing the LOD level in use.
+    Geometry* LodGeometry(size_t index, Camera* camera, float lodBias) const override;
+
+    /// Return the model resource.
+    Model* GetModel() const { return model; }
+    /// Return the LOD bias value.
+    float LodBias() const { return lodBias; }
+
+    /// Prepare up to 32 static models for rendering at once without virtual calls, with their distances from camera already calculated, for example from an octant's packed bounding boxes. Return a bitmask of the models that should render. Called by Renderer in worker threads.
+    static unsigned PrepareRender(StaticModelDrawable* const* drawables, const float* distances, size_t count, unsigned short frameNumber, Camera* camera);
 
 protected:
     /// Current model resource.
     SharedPtr<Model> model;
     /// LOD bias value.
     float lodBias;
+    /// LOD crossfade band as a fraction of the LOD distance.
+    float lodFadeBand;
+    /// LOD crossfade state per geometry index, sized when the model has LOD levels.
+    std::vector<LodFadeState> lodFades;
+    /// Impostor in use, or null if disabled.
+    SharedPtr<Impostor> impostor;
+    /// LOD distance beyond which the impostor is drawn.
+    float impostorDistance;
 };
 
 /// %Scene node that renders an unanimated model, which can have LOD levels.
@@ -42,20 +80,38 @@ public:
 
     /// Register factory and attributes.
     static void RegisterObject();
+    /// Create static models as children of a parent node in bulk, sharing a model and material. Rotations and scales may be empty for identity, hold one value for all, or one per instance. The nodes are added to the scene and queued for octree insertion at once, without the per-node handlers. Optionally return the created nodes for further setup.
+    static void CreateInstances(Node* parent, const std::vector<Vector3>& positions, const std::vector<Quaternion>& rotations, const std::vector<Vector3>& scales, Model* model, Material* material, std::vector<StaticModel*>* result = nullptr);
 
     /// Set the model resource.
     void SetModel(Model* model);
     /// Set LOD bias. Values higher than 1 use higher quality LOD (acts if distance is smaller.)
     void SetLodBias(float bias);
+    /// Set the LOD crossfade band as a fraction of each LOD distance. Beyond a LOD distance, the previous level is faded out with a dithered mask until the distance is exceeded by this fraction. 0 switches immediately (default.)
+    void SetLodFadeBand(float band);
+    /// Set whether to act as an occluder in software occlusion culling. Large, solid objects such as walls and terrain make good occluders. Default false.
+    void SetOccluder(bool enable);
+    /// Set the LOD distance beyond which the model is drawn as an impostor quad, which is baked from the model and current materials on first use. Shadows are still cast by the model's geometries. 0 disables (default.)
+    void SetImpostorDistance(float distance);
 
     /// Return the model resource.
     Model* GetModel() const;
     /// Return LOD bias.
     float LodBias() const { return static_cast<StaticModelDrawable*>(drawable)->lodBias; }
+    /// Return LOD crossfade band.
+    float LodFadeBand() const { return static_cast<StaticModelDrawable*>(drawable)->lodFadeBand; }
+    /// Return whether acts as an occluder.
+    bool IsOccluder() const { return drawable->TestFlag(DF_OCCLUDER); }
+    /// Return impostor distance.
+    float ImpostorDistance() const { return static_cast<StaticModelDrawable*>(drawable)->impostorDistance; }
 
 protected:
     /// Set model attribute. Used in serialization.
     void SetModelAttr(const ResourceRef& value);
     /// Return model attribute. Used in serialization.
     ResourceRef ModelAttr() const;
+
+private:
+    /// Bake or release the impostor according to the impostor distance.
+    void UpdateImpostor();
 };
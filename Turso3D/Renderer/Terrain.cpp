@@ -0,0 +1,745 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Graphics.h"
+#include "../Graphics/IndexBuffer.h"
+#include "../Graphics/Shader.h"
+#include "../Graphics/ShaderProgram.h"
+#include "../Graphics/Texture.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/Log.h"
+#include "../Object/Allocator.h"
+#include "../Resource/Image.h"
+#include "../Resource/ResourceCache.h"
+#include "Camera.h"
+#include "Material.h"
+#include "Renderer.h"
+#include "Terrain.h"
+
+#include <tracy/Tracy.hpp>
+
+static const UniformSlot U_TERRAINCAMERA = ShaderProgram::RegisterUniform("terrainCamera");
+static const UniformSlot U_TERRAINSPACING = ShaderProgram::RegisterUniform("terrainSpacing");
+
+/// Start of the morph to the next coarser level as a fraction of the level's own distance band.
+static const float MORPH_START_RATIO = 0.7f;
+
+static Allocator<TerrainPatchDrawable> drawableAllocator;
+
+SharedPtr<Material> Terrain::defaultMaterial;
+
+TerrainPatchDrawable::TerrainPatchDrawable() :
+    localBoundingBox(Vector3::ZERO, Vector3::ZERO),
+    selectPosition(Vector3::ZERO),
+    spacing(Vector3::ONE),
+    lodDistance(DEFAULT_TERRAIN_LOD_DISTANCE),
+    patchSize(DEFAULT_TERRAIN_PATCH_SIZE),
+    gridSize(DEFAULT_TERRAIN_GRID_SIZE),
+    numLevels(1),
+    instancesDirty(false)
+{
+    SetFlag(DF_CUSTOM_GEOMETRY, true);
+}
+
+void TerrainPatchDrawable::OnWorldBoundingBoxUpdate() const
+{
+    worldBoundingBox = localBoundingBox.Transformed(WorldTransform());
+    SetFlag(DF_BOUNDING_BOX_DIRTY, false);
+}
+
+bool TerrainPatchDrawable::OnPrepareRender(unsigned short frameNumber, Camera* camera)
+{
+    if (!geometry || !heightTexture)
+        return false;
+
+    if (!Drawable::OnPrepareRender(frameNumber, camera))
+        return false;
+
+    // If patch was last updated long ago, reset update framenumber to illegal
+    if (frameNumber - lastUpdateFrameNumber == 0x8000)
+        lastUpdateFrameNumber = 0;
+
+    Vector3 cameraPosition = WorldTransform().Inverse() * camera->WorldPosition();
+
+    // The coarsest level has unlimited range, so the root node always covers the patch
+    newInstances.clear();
+    SelectNode(0, 0, numLevels - 1, cameraPosition);
+
+    if (newInstances != instances)
+    {
+        instances.swap(newInstances);
+        instancesDirty = true;
+    }
+
+    // The morph depends on the camera position, so the shape changes whenever the camera moves
+    if (instancesDirty || cameraPosition != selectPosition)
+    {
+        selectPosition = cameraPosition;
+        lastUpdateFrameNumber = frameNumber;
+    }
+
+    return true;
+}
+
+void TerrainPatchDrawable::OnUpdateGPUData()
+{
+    if (instancesDirty && geometry)
+    {
+        geometry->instanceBuffer->SetData(0, instances.size() / 3, &instances[0], true);
+        geometry->instanceCount = instances.size() / 3;
+        instancesDirty = false;
+    }
+}
+
+void TerrainPatchDrawable::OnRender(ShaderProgram* program, size_t)
+{
+    if (!heightTexture)
+        return;
+
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    graphics->SetUniform(program, U_WORLDMATRIX, WorldTransform());
+    graphics->SetUniform(program, U_TERRAINCAMERA, Vector4(selectPosition, 0.0f));
+    graphics->SetUniform(program, U_TERRAINSPACING, Vector4(spacing, (float)(patchSize + 1)));
+    heightTexture->Bind(TU_TERRAINHEIGHT);
+}
+
+bool TerrainPatchDrawable::SelectNode(int x, int z, int level, const Vector3& cameraPosition)
+{
+    BoundingBox box = NodeBoundingBox(x, z, level);
+    if (box.Distance(cameraPosition) > LodRange(level))
+        return false;
+
+    // Nodes beyond the next finer level's range are drawn whole
+    if (!level || box.Distance(cameraPosition) > LodRange(level - 1))
+    {
+        AddNode(x, z, level, level);
+        return true;
+    }
+
+    // Otherwise the children in range select themselves, and the rest are drawn at this level
+    int half = (gridSize << level) / 2;
+    for (int i = 0; i < 4; ++i)
+    {
+        int childX = x + (i & 1) * half;
+        int childZ = z + (i >> 1) * half;
+        if (!SelectNode(childX, childZ, level - 1, cameraPosition))
+            AddNode(childX, childZ, level - 1, level);
+    }
+
+    return true;
+}
+
+void TerrainPatchDrawable::AddNode(int x, int z, int level, int morphLevel)
+{
+    float morphEnd = LodRange(morphLevel);
+    float morphStart = morphLevel ? LodRange(morphLevel - 1) : 0.0f;
+    morphStart += (morphEnd - morphStart) * MORPH_START_RATIO;
+    // The coarsest level does not morph
+    if (morphEnd == M_INFINITY)
+    {
+        morphStart = M_MAX_FLOAT * 0.5f;
+        morphEnd = M_MAX_FLOAT;
+    }
+
+    // Origin and sample step, grid quads per quad of the morph level, and the morph range
+    newInstances.push_back(Vector4((float)x, (float)z, (float)(1 << level), (float)(1 << (morphLevel - level))));
+    newInstances.push_back(Vector4(morphStart, morphEnd, 0.0f, 0.0f));
+    newInstances.push_back(Vector4::ZERO);
+}
+
+BoundingBox TerrainPatchDrawable::NodeBoundingBox(int x, int z, int level) const
+{
+    int size = gridSize << level;
+    int nodesPerSide = patchSize / size;
+    size_t index = (size_t)((z / size) * nodesPerSide + x / size);
+    for (int i = 0; i < level; ++i)
+    {
+        int levelNodes = patchSize / (gridSize << i);
+        index += levelNodes * levelNodes;
+    }
+
+    const Vector2& heights = nodeHeights[index];
+    return BoundingBox(Vector3(x * spacing.x, heights.x * spacing.y, z * spacing.z), Vector3((x + size) * spacing.x, heights.y * spacing.y,
+        (z + size) * spacing.z));
+}
+
+TerrainPatch::TerrainPatch()
+{
+    drawable = drawableAllocator.Allocate();
+    drawable->SetOwner(this);
+}
+
+TerrainPatch::~TerrainPatch()
+{
+    RemoveFromOctree();
+    drawableAllocator.Free(static_cast<TerrainPatchDrawable*>(drawable));
+    drawable = nullptr;
+}
+
+void TerrainPatch::RegisterObject()
+{
+    RegisterFactory<TerrainPatch>();
+    RegisterDerivedType<TerrainPatch, GeometryNode>();
+}
+
+Terrain::Terrain() :
+    numPatches(1, 1),
+    patchSize(DEFAULT_TERRAIN_PATCH_SIZE),
+    gridSize(DEFAULT_TERRAIN_GRID_SIZE),
+    numLevels(1),
+    spacing(1.0f, 50.0f, 1.0f),
+    lodDistance(DEFAULT_TERRAIN_LOD_DISTANCE),
+    loadDistance(500.0f),
+    unloadDistance(600.0f),
+    tileGeneration(0),
+    castShadows(false)
+{
+    CreatePatches();
+}
+
+Terrain::~Terrain()
+{
+}
+
+void Terrain::RegisterObject()
+{
+    RegisterFactory<Terrain>();
+    RegisterDerivedType<Terrain, SpatialNode>();
+    CopyBaseAttributes<Terrain, SpatialNode>();
+    RegisterAttribute("patchSize", &Terrain::PatchSize, &Terrain::SetPatchSize, DEFAULT_TERRAIN_PATCH_SIZE);
+    RegisterAttribute("gridSize", &Terrain::GridSize, &Terrain::SetGridSize, DEFAULT_TERRAIN_GRID_SIZE);
+    RegisterRefAttribute("numPatches", &Terrain::NumPatches, &Terrain::SetNumPatches, IntVector2(1, 1));
+    RegisterRefAttribute("spacing", &Terrain::Spacing, &Terrain::SetSpacing, Vector3(1.0f, 50.0f, 1.0f));
+    RegisterAttribute("lodDistance", &Terrain::LodDistance, &Terrain::SetLodDistance, DEFAULT_TERRAIN_LOD_DISTANCE);
+    RegisterMixedRefAttribute("material", &Terrain::MaterialAttr, &Terrain::SetMaterialAttr, ResourceRef(Material::TypeStatic()));
+    RegisterAttribute("castShadows", &Terrain::CastShadows, &Terrain::SetCastShadows, false);
+    RegisterRefAttribute("heightTilePrefix", &Terrain::HeightTilePrefix, &Terrain::SetHeightTilePrefix, std::string());
+
+    TerrainPatch::RegisterObject();
+}
+
+void Terrain::SetNumPatches(const IntVector2& num)
+{
+    IntVector2 newNum(Max(num.x, 1), Max(num.y, 1));
+    if (newNum == numPatches)
+        return;
+
+    numPatches = newNum;
+    CreatePatches();
+}
+
+void Terrain::SetPatchSize(int quads)
+{
+    int newSize = Max((int)NextPowerOfTwo((unsigned)Max(quads, 1)), gridSize);
+    if (newSize == patchSize)
+        return;
+
+    patchSize = newSize;
+    CreatePatches();
+}
+
+void Terrain::SetGridSize(int quads)
+{
+    // Grid vertices are indexed with 16 bits
+    int newSize = Min((int)NextPowerOfTwo((unsigned)Max(quads, 1)), 128);
+    if (newSize == gridSize)
+        return;
+
+    gridSize = newSize;
+    patchSize = Max(patchSize, gridSize);
+    CreatePatches();
+}
+
+void Terrain::SetSpacing(const Vector3& spacing_)
+{
+    spacing = Vector3(Max(spacing_.x, M_EPSILON), spacing_.y, Max(spacing_.z, M_EPSILON));
+    UpdatePatches();
+}
+
+void Terrain::SetLodDistance(float distance)
+{
+    lodDistance = Max(distance, M_EPSILON);
+    UpdatePatches();
+}
+
+void Terrain::SetHeightTilePrefix(const std::string& prefix)
+{
+    heightTilePrefix = prefix;
+    heightMap.Reset();
+    ++tileGeneration;
+
+    for (size_t i = 0; i < patches.size(); ++i)
+    {
+        SetPatchHeights(i, nullptr);
+        tileStates[i] = TILE_UNLOADED;
+    }
+}
+
+bool Terrain::SetHeightMap(Image* image)
+{
+    if (!image)
+    {
+        heightMap.Reset();
+        for (size_t i = 0; i < patches.size(); ++i)
+            SetPatchHeights(i, nullptr);
+        return true;
+    }
+
+    if (image->Width() < numPatches.x * patchSize + 1 || image->Height() < numPatches.y * patchSize + 1)
+    {
+        LOGERROR("Heightmap is too small for the terrain");
+        return false;
+    }
+
+    std::vector<float> heights((patchSize + 1) * (patchSize + 1));
+    for (int z = 0; z < numPatches.y; ++z)
+    {
+        for (int x = 0; x < numPatches.x; ++x)
+        {
+            if (!ReadHeights(image, x * patchSize, z * patchSize, patchSize + 1, &heights[0]))
+            {
+                LOGERROR("Unsupported heightmap format");
+                return false;
+            }
+
+            size_t index = z * numPatches.x + x;
+            SetPatchHeights(index, &heights[0]);
+            tileStates[index] = TILE_LOADED;
+        }
+    }
+
+    // Loads still in progress would overwrite the heights
+    heightMap = image;
+    ++tileGeneration;
+    return true;
+}
+
+void Terrain::SetStreamDistances(float loadDistance_, float unloadDistance_)
+{
+    loadDistance = Max(loadDistance_, 0.0f);
+    unloadDistance = Max(unloadDistance_, loadDistance);
+}
+
+void Terrain::SetMaterial(Material* material_)
+{
+    material = material_;
+
+    for (auto it = patches.begin(); it != patches.end(); ++it)
+        (*it)->SetMaterial(material ? material.Get() : DefaultMaterial());
+}
+
+void Terrain::SetCastShadows(bool enable)
+{
+    castShadows = enable;
+
+    for (auto it = patches.begin(); it != patches.end(); ++it)
+        (*it)->SetCastShadows(enable);
+}
+
+void Terrain::UpdateStreaming(const Vector3& viewerPosition)
+{
+    ZoneScoped;
+
+    if (heightMap || heightTilePrefix.empty())
+        return;
+
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    Vector3 localPosition = WorldTransform().Inverse() * viewerPosition;
+    WeakPtr<Terrain> self(this);
+    unsigned generation = tileGeneration;
+
+    for (size_t i = 0; i < patches.size(); ++i)
+    {
+        float distance = PatchDistance(i, localPosition);
+
+        if (tileStates[i] == TILE_UNLOADED && distance <= loadDistance)
+        {
+            tileStates[i] = TILE_LOADING;
+            std::string tileName = HeightTileName((int)i % numPatches.x, (int)i / numPatches.x);
+            // A tile that can not be loaded stays flagged loaded without heights, so that it is not retried every frame
+            if (!cache->LoadResourceAsync<Image>(tileName, [self, i, generation](Resource* resource) {
+                if (self)
+                    self->OnTileLoaded(i, generation, static_cast<Image*>(resource));
+            }))
+                tileStates[i] = TILE_LOADED;
+        }
+        else if (tileStates[i] == TILE_LOADED && distance > unloadDistance)
+        {
+            SetPatchHeights(i, nullptr);
+            tileStates[i] = TILE_UNLOADED;
+        }
+    }
+}
+
+TerrainPatch* Terrain::Patch(int x, int z) const
+{
+    if (x < 0 || z < 0 || x >= numPatches.x || z >= numPatches.y)
+        return nullptr;
+
+    return patches[z * numPatches.x + x];
+}
+
+size_t Terrain::NumLoadedPatches() const
+{
+    size_t ret = 0;
+    for (auto it = patches.begin(); it != patches.end(); ++it)
+    {
+        if ((*it)->IsLoaded())
+            ++ret;
+    }
+    return ret;
+}
+
+float Terrain::Height(const Vector3& worldPosition) const
+{
+    Vector3 localPosition = WorldTransform().Inverse() * worldPosition;
+    float sampleX = localPosition.x / spacing.x;
+    float sampleZ = localPosition.z / spacing.z;
+    int patchX = Clamp((int)floorf(sampleX / patchSize), 0, numPatches.x - 1);
+    int patchZ = Clamp((int)floorf(sampleZ / patchSize), 0, numPatches.y - 1);
+
+    const std::vector<float>& heights = patchHeights[patchZ * numPatches.x + patchX];
+    if (heights.empty())
+        return (WorldTransform() * Vector3(localPosition.x, 0.0f, localPosition.z)).y;
+
+    float x = Clamp(sampleX - patchX * patchSize, 0.0f, (float)patchSize);
+    float z = Clamp(sampleZ - patchZ * patchSize, 0.0f, (float)patchSize);
+    int x0 = Min((int)x, patchSize - 1);
+    int z0 = Min((int)z, patchSize - 1);
+    float fracX = x - x0;
+    float fracZ = z - z0;
+    int stride = patchSize + 1;
+
+    float h0 = Lerp(heights[z0 * stride + x0], heights[z0 * stride + x0 + 1], fracX);
+    float h1 = Lerp(heights[(z0 + 1) * stride + x0], heights[(z0 + 1) * stride + x0 + 1], fracX);
+    localPosition.y = Lerp(h0, h1, fracZ) * spacing.y;
+
+    return (WorldTransform() * localPosition).y;
+}
+
+std::string Terrain::HeightTileName(int x, int z) const
+{
+    return heightTilePrefix + std::to_string(x) + "_" + std::to_string(z) + ".png";
+}
+
+Material* Terrain::DefaultMaterial()
+{
+    if (!defaultMaterial)
+    {
+        ResourceCache* cache = Subsystem<ResourceCache>();
+        Shader* shadowShader = cache->LoadResource<Shader>("Shaders/Shadow.glsl");
+
+        defaultMaterial = new Material();
+        defaultMaterial->SetUniform(U_MATDIFFCOLOR, Vector4::ONE);
+
+        Pass* pass = defaultMaterial->CreatePass(PASS_SHADOW);
+        pass->SetShader(shadowShader, "TERRAIN", "");
+        pass->SetRenderState(BLEND_REPLACE, CMP_LESS, false, true);
+
+        pass = defaultMaterial->CreatePass(PASS_OPAQUE);
+        pass->SetShader(cache->LoadResource<Shader>("Shaders/Terrain.glsl"), "", "");
+        pass->SetRenderState(BLEND_REPLACE, CMP_LESS, true, true);
+
+        pass = defaultMaterial->CreatePass(PASS_DEPTH);
+        pass->SetShader(shadowShader, "TERRAIN", "");
+        pass->SetRenderState(BLEND_REPLACE, CMP_LESS, false, true);
+    }
+
+    return defaultMaterial;
+}
+
+void Terrain::SetMaterialAttr(const ResourceRef& value)
+{
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    SetMaterial(value.name.empty() ? nullptr : cache->LoadResource<Material>(value.name));
+}
+
+ResourceRef Terrain::MaterialAttr() const
+{
+    return ResourceRef(Material::TypeStatic(), ResourceName(material));
+}
+
+void Terrain::UpdatePatches()
+{
+    for (size_t i = 0; i < patches.size(); ++i)
+        UpdatePatch(i);
+}
+
+void Terrain::UpdatePatch(size_t index)
+{
+    TerrainPatch* patch = patches[index];
+    TerrainPatchDrawable* patchDrawable = patch->PatchDrawable();
+
+    patchDrawable->spacing = spacing;
+    patchDrawable->lodDistance = lodDistance;
+    patchDrawable->patchSize = patchSize;
+    patchDrawable->gridSize = gridSize;
+    patchDrawable->numLevels = numLevels;
+
+    // The root node's height range is the last
+    float minHeight = 0.0f;
+    float maxHeight = 0.0f;
+    if (!patchDrawable->nodeHeights.empty())
+    {
+        const Vector2& rootHeights = patchDrawable->nodeHeights.back();
+        minHeight = rootHeights.x;
+        maxHeight = rootHeights.y;
+    }
+    patchDrawable->localBoundingBox.Define(Vector3(0.0f, minHeight * spacing.y, 0.0f), Vector3(patchSize * spacing.x, maxHeight * spacing.y,
+        patchSize * spacing.z));
+
+    int x = (int)index % numPatches.x;
+    int z = (int)index / numPatches.x;
+    patch->SetPosition(Vector3(x * patchSize * spacing.x, 0.0f, z * patchSize * spacing.z));
+    patch->UpdateBoundingBox();
+}
+
+void Terrain::CreatePatches()
+{
+    for (auto it = patches.begin(); it != patches.end(); ++it)
+        RemoveChild(*it);
+    patches.clear();
+    patchHeights.clear();
+    tileStates.clear();
+    gridVertexBuffer.Reset();
+    gridIndexBuffer.Reset();
+    ++tileGeneration;
+
+    numLevels = 1;
+    while ((gridSize << numLevels) <= patchSize)
+        ++numLevels;
+
+    size_t numPatchesTotal = numPatches.x * numPatches.y;
+    patches.resize(numPatchesTotal);
+    patchHeights.resize(numPatchesTotal);
+    tileStates.resize(numPatchesTotal, TILE_UNLOADED);
+
+    for (size_t i = 0; i < numPatchesTotal; ++i)
+    {
+        patches[i] = CreateChild<TerrainPatch>();
+        patches[i]->SetTemporary(true);
+        patches[i]->SetCastShadows(castShadows);
+    }
+
+    Graphics* graphics = Subsystem<Graphics>();
+    if (graphics && graphics->IsInitialized() && graphics->HasInstancing())
+    {
+        std::vector<Vector3> vertices;
+        std::vector<unsigned short> indices;
+        int row = gridSize + 1;
+
+        for (int z = 0; z <= gridSize; ++z)
+        {
+            for (int x = 0; x <= gridSize; ++x)
+                vertices.push_back(Vector3((float)x, 0.0f, (float)z));
+        }
+
+        for (int z = 0; z < gridSize; ++z)
+        {
+            for (int x = 0; x < gridSize; ++x)
+            {
+                indices.push_back((unsigned short)((z + 1) * row + x));
+                indices.push_back((unsigned short)(z * row + x + 1));
+                indices.push_back((unsigned short)(z * row + x));
+                indices.push_back((unsigned short)((z + 1) * row + x));
+                indices.push_back((unsigned short)((z + 1) * row + x + 1));
+                indices.push_back((unsigned short)(z * row + x + 1));
+            }
+        }
+
+        std::vector<VertexElement> vertexElements;
+        vertexElements.push_back(VertexElement(ELEM_VECTOR3, SEM_POSITION));
+
+        // Each node is three vectors, matching the layout of instance transforms
+        std::vector<VertexElement> nodeElements;
+        nodeElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 3));
+        nodeElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 4));
+        nodeElements.push_back(VertexElement(ELEM_VECTOR4, SEM_TEXCOORD, 5));
+
+        gridVertexBuffer = new VertexBuffer();
+        gridIndexBuffer = new IndexBuffer();
+        if (gridVertexBuffer->Define(USAGE_DEFAULT, vertices.size(), vertexElements, &vertices[0]) &&
+            gridIndexBuffer->Define(USAGE_DEFAULT, indices.size(), sizeof(unsigned short), &indices[0]))
+        {
+            // At most one node is selected per finest node area
+            size_t maxNodes = (size_t)(patchSize / gridSize) * (patchSize / gridSize);
+
+            for (auto it = patches.begin(); it != patches.end(); ++it)
+            {
+                SharedPtr<Geometry> geometry(new Geometry());
+                geometry->vertexBuffer = gridVertexBuffer;
+                geometry->indexBuffer = gridIndexBuffer;
+                geometry->instanceBuffer = new VertexBuffer();
+                geometry->drawStart = 0;
+                geometry->drawCount = indices.size();
+                if (!geometry->instanceBuffer->Define(USAGE_DYNAMIC, maxNodes, nodeElements))
+                    continue;
+
+                (*it)->PatchDrawable()->geometry = geometry;
+                (*it)->SetNumGeometries(1);
+                (*it)->SetGeometry(0, geometry);
+                (*it)->SetMaterial(material ? material.Get() : DefaultMaterial());
+            }
+        }
+    }
+
+    UpdatePatches();
+
+    // Heights set at once are sliced again for the new layout
+    if (heightMap)
+    {
+        SharedPtr<Image> image(heightMap);
+        SetHeightMap(image);
+    }
+}
+
+void Terrain::SetPatchHeights(size_t index, const float* heights)
+{
+    TerrainPatch* patch = patches[index];
+    TerrainPatchDrawable* patchDrawable = patch->PatchDrawable();
+    int samples = patchSize + 1;
+
+    if (!heights)
+    {
+        patchHeights[index].clear();
+        patchDrawable->heightTexture.Reset();
+        patchDrawable->nodeHeights.clear();
+        patchDrawable->instances.clear();
+        UpdatePatch(index);
+        return;
+    }
+
+    patchHeights[index].assign(heights, heights + samples * samples);
+
+    // Build the height ranges of the finest nodes from the samples, then of each coarser level from the four children
+    std::vector<Vector2>& nodeHeights = patchDrawable->nodeHeights;
+    nodeHeights.clear();
+    int leafNodes = patchSize / gridSize;
+    for (int nz = 0; nz < leafNodes; ++nz)
+    {
+        for (int nx = 0; nx < leafNodes; ++nx)
+        {
+            Vector2 range(M_MAX_FLOAT, -M_MAX_FLOAT);
+            for (int z = nz * gridSize; z <= (nz + 1) * gridSize; ++z)
+            {
+                for (int x = nx * gridSize; x <= (nx + 1) * gridSize; ++x)
+                {
+                    float height = heights[z * samples + x];
+                    range.x = Min(range.x, height);
+                    range.y = Max(range.y, height);
+                }
+            }
+            nodeHeights.push_back(range);
+        }
+    }
+
+    size_t childStart = 0;
+    for (int levelNodes = leafNodes / 2; levelNodes > 0; levelNodes /= 2)
+    {
+        int childNodes = levelNodes * 2;
+        for (int nz = 0; nz < levelNodes; ++nz)
+        {
+            for (int nx = 0; nx < levelNodes; ++nx)
+            {
+                Vector2 range(M_MAX_FLOAT, -M_MAX_FLOAT);
+                for (int i = 0; i < 4; ++i)
+                {
+                    const Vector2& child = nodeHeights[childStart + (nz * 2 + (i >> 1)) * childNodes + nx * 2 + (i & 1)];
+                    range.x = Min(range.x, child.x);
+                    range.y = Max(range.y, child.y);
+                }
+                nodeHeights.push_back(range);
+            }
+        }
+        childStart += childNodes * childNodes;
+    }
+
+    if (patchDrawable->geometry)
+    {
+        SharedPtr<Texture> texture(new Texture());
+        ImageLevel level(IntVector2(samples, samples), FMT_R32F, heights);
+        if (texture->Define(TEX_2D, IntVector2(samples, samples), FMT_R32F, 1, 1, &level) &&
+            texture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP, 1))
+            patchDrawable->heightTexture = texture;
+    }
+
+    UpdatePatch(index);
+}
+
+void Terrain::OnTileLoaded(size_t index, unsigned generation, Image* image)
+{
+    if (generation != tileGeneration || index >= patches.size())
+        return;
+
+    tileStates[index] = TILE_LOADED;
+    if (!image)
+        return;
+
+    std::string tileName = image->Name();
+    std::vector<float> heights((patchSize + 1) * (patchSize + 1));
+    if (image->Width() >= patchSize + 1 && image->Height() >= patchSize + 1 && ReadHeights(image, 0, 0, patchSize + 1, &heights[0]))
+        SetPatchHeights(index, &heights[0]);
+    else
+        LOGERROR("Height tile " + tileName + " is too small or of unsupported format");
+
+    // The heights have been copied, so the image does not need to stay cached
+    Subsystem<ResourceCache>()->UnloadResource(Image::TypeStatic(), tileName);
+}
+
+float Terrain::PatchDistance(size_t index, const Vector3& localPosition) const
+{
+    float patchWidth = patchSize * spacing.x;
+    float patchDepth = patchSize * spacing.z;
+    float minX = (index % numPatches.x) * patchWidth;
+    float minZ = (index / numPatches.x) * patchDepth;
+    float dx = Max(Max(minX - localPosition.x, localPosition.x - (minX + patchWidth)), 0.0f);
+    float dz = Max(Max(minZ - localPosition.z, localPosition.z - (minZ + patchDepth)), 0.0f);
+    return sqrtf(dx * dx + dz * dz);
+}
+
+bool Terrain::ReadHeights(Image* image, int x, int z, int size, float* dest)
+{
+    ImageFormat format = image->Format();
+    size_t pixelSize = image->PixelByteSize();
+    const unsigned char* data = image->Data();
+    if (!data || !pixelSize || image->IsCompressed())
+        return false;
+
+    for (int row = 0; row < size; ++row)
+    {
+        const unsigned char* src = data + ((size_t)(z + row) * image->Width() + x) * pixelSize;
+        for (int column = 0; column < size; ++column)
+        {
+            float height;
+            switch (format)
+            {
+            case FMT_R8:
+            case FMT_A8:
+            case FMT_RG8:
+            case FMT_RGBA8:
+                height = *src / 255.0f;
+                break;
+
+            case FMT_R16:
+            case FMT_RG16:
+            case FMT_RGBA16:
+                height = *reinterpret_cast<const unsigned short*>(src) / 65535.0f;
+                break;
+
+            case FMT_R32F:
+            case FMT_RG32F:
+            case FMT_RGB32F:
+            case FMT_RGBA32F:
+                height = *reinterpret_cast<const float*>(src);
+                break;
+
+            default:
+                return false;
+            }
+
+            *dest++ = height;
+            src += pixelSize;
+        }
+    }
+
+    return true;
+}
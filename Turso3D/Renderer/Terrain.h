@@ -0,0 +1,239 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "GeometryNode.h"
+
+class Image;
+class Material;
+class Texture;
+
+static const int DEFAULT_TERRAIN_PATCH_SIZE = 256;
+static const int DEFAULT_TERRAIN_GRID_SIZE = 32;
+static const float DEFAULT_TERRAIN_LOD_DISTANCE = 100.0f;
+
+/// Terrain patch drawable. Selects the quadtree nodes of its patch by distance to the camera and draws them as instances of the terrain's grid mesh, displaced by the patch's height texture in the vertex shader.
+class TerrainPatchDrawable : public GeometryDrawable
+{
+    friend class Terrain;
+    friend class TerrainPatch;
+
+public:
+    /// Construct.
+    TerrainPatchDrawable();
+
+    /// Recalculate the world space bounding box.
+    void OnWorldBoundingBoxUpdate() const override;
+    /// Return the local space bounding box.
+    const BoundingBox* LocalBoundingBox() const override { return &localBoundingBox; }
+    /// Prepare object for rendering. Select the quadtree nodes by the camera distance. Return false if the heights are not loaded or should not render.
+    bool OnPrepareRender(unsigned short frameNumber, Camera* camera) override;
+    /// Upload the selected nodes to the instance buffer if they have changed. Called by Renderer in the main thread once view preparation has finished.
+    void OnUpdateGPUData() override;
+    /// Set the terrain uniforms and bind the height texture. Called by Renderer when geometry type is not static.
+    void OnRender(ShaderProgram* program, size_t geomIndex) override;
+
+private:
+    /// Select the quadtree node at level and its descendants by the camera position in local space. Return false if the node is out of the level's range, in which case the parent covers it.
+    bool SelectNode(int x, int z, int level, const Vector3& cameraPosition);
+    /// Add a node to the selection. A node standing in for a quarter of its parent snaps its vertices to the parent's grid and morphs with the parent's range.
+    void AddNode(int x, int z, int level, int morphLevel);
+    /// Return the local space bounding box of a quadtree node.
+    BoundingBox NodeBoundingBox(int x, int z, int level) const;
+    /// Return the distance range of a quadtree level.
+    float LodRange(int level) const { return level < numLevels - 1 ? lodDistance * (float)(1 << level) : M_INFINITY; }
+
+    /// %Geometry sharing the terrain's grid mesh, with the selected nodes as its instance data.
+    SharedPtr<Geometry> geometry;
+    /// Height texture, or null if not loaded.
+    SharedPtr<Texture> heightTexture;
+    /// Minimum and maximum normalized height of the quadtree nodes, starting from the finest level.
+    std::vector<Vector2> nodeHeights;
+    /// Selected node instance data.
+    std::vector<Vector4> instances;
+    /// Node instance data being selected.
+    std::vector<Vector4> newInstances;
+    /// Local space bounding box.
+    BoundingBox localBoundingBox;
+    /// Camera position in local space at the last selection.
+    Vector3 selectPosition;
+    /// Sample spacing and height scale, copied from the terrain.
+    Vector3 spacing;
+    /// Distance range of the finest level, copied from the terrain.
+    float lodDistance;
+    /// Quads per patch side, copied from the terrain.
+    int patchSize;
+    /// Quads per grid mesh side, copied from the terrain.
+    int gridSize;
+    /// Quadtree levels, copied from the terrain.
+    int numLevels;
+    /// Selected nodes have changed since the last upload flag.
+    bool instancesDirty;
+};
+
+/// %Scene node for one patch of a terrain. Created by Terrain as a temporary child, so that the octree and shadow caster collection cull the terrain per patch.
+class TerrainPatch : public GeometryNode
+{
+    OBJECT(TerrainPatch);
+
+public:
+    /// Construct.
+    TerrainPatch();
+    /// Destruct.
+    ~TerrainPatch();
+
+    /// Register factory.
+    static void RegisterObject();
+
+    /// Return the patch's drawable for internal use.
+    TerrainPatchDrawable* PatchDrawable() const { return static_cast<TerrainPatchDrawable*>(drawable); }
+    /// Return whether the heights have been loaded.
+    bool IsLoaded() const { return PatchDrawable()->heightTexture.Get() != nullptr; }
+
+    /// Recalculate the bounding box. Called by Terrain when the heights change.
+    void UpdateBoundingBox() { OnBoundingBoxChanged(); }
+};
+
+/// Height tile streaming state of a terrain patch.
+enum TerrainTileState
+{
+    TILE_UNLOADED = 0,
+    TILE_LOADING,
+    TILE_LOADED
+};
+
+/// %Scene node that renders a heightmap terrain with continuous distance-dependent level of detail (CDLOD.) The terrain is divided into square patches, each a temporary child node with its own drawable in the octree, and each patch into a quadtree of nodes down to the size of the grid mesh. Every patch draws its selected nodes with a single instanced call of the shared grid mesh, which samples the patch's height texture in the vertex shader, and morphs the vertices toward the next coarser level over the outer part of each level's distance range to avoid seams and popping. The nodes are selected by the camera the patch is prepared with, so shadow passes use the main view's selection. The heights are either streamed per patch from image tiles through the asynchronous resource loading, or set at once from an image. Requires instancing support.
+class Terrain : public SpatialNode
+{
+    OBJECT(Terrain);
+
+public:
+    /// Construct.
+    Terrain();
+    /// Destruct.
+    ~Terrain();
+
+    /// Register factory and attributes.
+    static void RegisterObject();
+
+    /// Set the number of patches on the X and Z axes. Recreates the patches. Default 1x1.
+    void SetNumPatches(const IntVector2& num);
+    /// Set the number of quads per patch side, which is rounded up to a power of two and to at least the grid size. Each height tile has one more sample per side, shared with the neighbouring patch. Recreates the patches. Default 256.
+    void SetPatchSize(int quads);
+    /// Set the number of quads per side of the grid mesh, which is rounded up to a power of two. Also the size of the finest quadtree nodes in height samples. Recreates the patches. Default 32.
+    void SetGridSize(int quads);
+    /// Set the local space distance between height samples on the X and Z axes, and the height of a sample at full value on the Y axis. Default (1, 50, 1).
+    void SetSpacing(const Vector3& spacing);
+    /// Set the distance range of the finest level in local space. The range doubles per coarser level, and the coarsest level is unlimited. Should be at least twice the size of the finest nodes for seamless morphing. Default 100.
+    void SetLodDistance(float distance);
+    /// Set the resource name prefix of the height tiles. The tile of a patch is named prefix + "X_Z.png" by its patch coordinates. Tiles are loaded by UpdateStreaming(). Unloads the streamed heights.
+    void SetHeightTilePrefix(const std::string& prefix);
+    /// Set the heights of all patches from an image of (patches * patch size + 1) samples per side, replacing streaming. The first channel of 8-bit, 16-bit or float formats is read. Return true on success.
+    bool SetHeightMap(Image* image);
+    /// Set the viewer distances for loading and unloading height tiles. The unload distance is at least the load distance. Default 500 and 600.
+    void SetStreamDistances(float loadDistance, float unloadDistance);
+    /// Set material of all patches. Null uses the default terrain material.
+    void SetMaterial(Material* material);
+    /// Set whether the patches cast shadows. Default false.
+    void SetCastShadows(bool enable);
+    /// Queue the height tiles near the viewer for asynchronous loading and unload the far ones. Call once per frame from the main thread when streaming, along with ResourceCache::UpdateAsyncLoading().
+    void UpdateStreaming(const Vector3& viewerPosition);
+
+    /// Return the number of patches.
+    const IntVector2& NumPatches() const { return numPatches; }
+    /// Return the number of quads per patch side.
+    int PatchSize() const { return patchSize; }
+    /// Return the number of quads per grid mesh side.
+    int GridSize() const { return gridSize; }
+    /// Return the sample spacing and height scale.
+    const Vector3& Spacing() const { return spacing; }
+    /// Return the distance range of the finest level.
+    float LodDistance() const { return lodDistance; }
+    /// Return the height tile name prefix.
+    const std::string& HeightTilePrefix() const { return heightTilePrefix; }
+    /// Return the tile load distance.
+    float LoadDistance() const { return loadDistance; }
+    /// Return the tile unload distance.
+    float UnloadDistance() const { return unloadDistance; }
+    /// Return the material.
+    Material* GetMaterial() const { return material; }
+    /// Return whether the patches cast shadows.
+    bool CastShadows() const { return castShadows; }
+    /// Return number of quadtree levels per patch.
+    int NumLevels() const { return numLevels; }
+    /// Return the patch at patch coordinates, or null if outside.
+    TerrainPatch* Patch(int x, int z) const;
+    /// Return the number of patches whose heights are loaded.
+    size_t NumLoadedPatches() const;
+    /// Return the height in world space at a world position on the terrain, interpolated from the loaded heights, or zero if not loaded.
+    float Height(const Vector3& worldPosition) const;
+    /// Return the shared grid mesh vertex buffer.
+    VertexBuffer* GridVertexBuffer() const { return gridVertexBuffer; }
+    /// Return the shared grid mesh index buffer.
+    IndexBuffer* GridIndexBuffer() const { return gridIndexBuffer; }
+
+    /// Return the height tile resource name of a patch.
+    std::string HeightTileName(int x, int z) const;
+    /// Return the default terrain material.
+    static Material* DefaultMaterial();
+
+private:
+    /// Set material attribute. Used in serialization.
+    void SetMaterialAttr(const ResourceRef& value);
+    /// Return material attribute. Used in serialization.
+    ResourceRef MaterialAttr() const;
+    /// Copy the terrain parameters to all patch drawables and position the patches.
+    void UpdatePatches();
+    /// Copy the terrain parameters to a patch drawable, and position the patch and update its bounding box.
+    void UpdatePatch(size_t index);
+    /// Remove and recreate the patches and the grid mesh.
+    void CreatePatches();
+    /// Set the normalized heights of a patch, or clear them if null. Creates the height texture and the node height ranges.
+    void SetPatchHeights(size_t index, const float* heights);
+    /// Handle a height tile having been loaded.
+    void OnTileLoaded(size_t index, unsigned generation, Image* image);
+    /// Return the distance from a local position to a patch's area on the XZ plane.
+    float PatchDistance(size_t index, const Vector3& localPosition) const;
+    /// Read the first channel of an image region as normalized heights. Return false if the format is not supported.
+    static bool ReadHeights(Image* image, int x, int z, int size, float* dest);
+
+    /// Patch nodes, row by row.
+    std::vector<SharedPtr<TerrainPatch> > patches;
+    /// Height tile streaming states.
+    std::vector<TerrainTileState> tileStates;
+    /// Normalized heights of the loaded patches, for height queries.
+    std::vector<std::vector<float> > patchHeights;
+    /// Shared grid mesh vertices.
+    SharedPtr<VertexBuffer> gridVertexBuffer;
+    /// Shared grid mesh indices.
+    SharedPtr<IndexBuffer> gridIndexBuffer;
+    /// Heightmap of all patches if set at once.
+    SharedPtr<Image> heightMap;
+    /// Material.
+    SharedPtr<Material> material;
+    /// Height tile name prefix.
+    std::string heightTilePrefix;
+    /// Number of patches.
+    IntVector2 numPatches;
+    /// Quads per patch side.
+    int patchSize;
+    /// Quads per grid mesh side.
+    int gridSize;
+    /// Quadtree levels per patch.
+    int numLevels;
+    /// Sample spacing and height scale.
+    Vector3 spacing;
+    /// Distance range of the finest level.
+    float lodDistance;
+    /// Tile load distance.
+    float loadDistance;
+    /// Tile unload distance.
+    float unloadDistance;
+    /// Incremented when the patches or tiles change, so that loads finishing afterward are ignored.
+    unsigned tileGeneration;
+    /// Shadow casting flag.
+    bool castShadows;
+
+    /// Default terrain material.
+    static SharedPtr<Material> defaultMaterial;
+};
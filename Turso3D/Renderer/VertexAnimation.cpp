@@ -0,0 +1,321 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Graphics.h"
+#include "../Graphics/Texture.h"
+#include "../Graphics/VertexBuffer.h"
+#include "../IO/Log.h"
+#include "../Math/PackedVector.h"
+#include "Animation.h"
+#include "Model.h"
+#include "VertexAnimation.h"
+
+#include <tracy/Tracy.hpp>
+
+/// Vertex data of a model vertex buffer read back for skinning on the CPU.
+struct BakeVertexBuffer
+{
+    /// Vertex data.
+    std::vector<unsigned char> data;
+    /// Vertex size.
+    size_t vertexSize;
+    /// Number of vertices.
+    size_t numVertices;
+    /// Position offset.
+    size_t position;
+    /// Normal offset, or M_MAX_UNSIGNED if none.
+    size_t normal;
+    /// Blend weights offset.
+    size_t blendWeights;
+    /// Blend indices offset.
+    size_t blendIndices;
+    /// Whether the normals are packed to 10-10-10-2.
+    bool packedNormals;
+};
+
+VertexAnimation::VertexAnimation() :
+    sampleRate(0.0f),
+    numFrames(0)
+{
+}
+
+VertexAnimation::~VertexAnimation()
+{
+}
+
+bool VertexAnimation::Bake(Model* model_, const std::vector<Animation*>& animations, float sampleRate_)
+{
+    ZoneScoped;
+
+    model.Reset();
+    texture.Reset();
+    clips.clear();
+    buffers.clear();
+    boundingBox.Undefine();
+    numFrames = 0;
+
+    Graphics* graphics = Object::Subsystem<Graphics>();
+    if (!graphics || !graphics->IsInitialized())
+        return false;
+
+    if (!model_ || model_->Bones().empty())
+    {
+        LOGERROR("Vertex animation needs a model with bones");
+        return false;
+    }
+    if (!model_->IsReady())
+    {
+        LOGERROR("Model " + model_->Name() + " has not been uploaded for vertex animation baking");
+        return false;
+    }
+
+    sampleRate = Max(sampleRate_, 1.0f);
+
+    // Read back the vertex buffers of all geometries and LOD levels, which may share buffers
+    std::vector<BakeVertexBuffer> bakeBuffers;
+    for (size_t i = 0; i < model_->NumGeometries(); ++i)
+    {
+        for (size_t j = 0; j < model_->NumLodLevels(i); ++j)
+        {
+            VertexBuffer* vertexBuffer = model_->GetGeometry(i, j)->vertexBuffer;
+            if (!vertexBuffer || TexelOffset(vertexBuffer) != M_MAX_UNSIGNED)
+                continue;
+
+            BakeVertexBuffer bake;
+            bake.vertexSize = vertexBuffer->VertexSize();
+            bake.numVertices = vertexBuffer->NumVertices();
+            bake.position = bake.normal = bake.blendWeights = bake.blendIndices = M_MAX_UNSIGNED;
+            bake.packedNormals = false;
+
+            const std::vector<VertexElement>& elements = vertexBuffer->Elements();
+            for (auto it = elements.begin(); it != elements.end(); ++it)
+            {
+                if (it->semantic == SEM_POSITION && it->type == ELEM_VECTOR3)
+                    bake.position = it->offset;
+                else if (it->semantic == SEM_NORMAL && (it->type == ELEM_VECTOR3 || it->type == ELEM_INT2101010))
+                {
+                    bake.normal = it->offset;
+                    bake.packedNormals = it->type == ELEM_INT2101010;
+                }
+                else if (it->semantic == SEM_BLENDWEIGHTS && it->type == ELEM_VECTOR4)
+                    bake.blendWeights = it->offset;
+                else if (it->semantic == SEM_BLENDINDICES && it->type == ELEM_UBYTE4)
+                    bake.blendIndices = it->offset;
+            }
+
+            if (bake.position == M_MAX_UNSIGNED || bake.blendWeights == M_MAX_UNSIGNED || bake.blendIndices == M_MAX_UNSIGNED)
+            {
+                LOGERROR("Unsupported vertex format in model " + model_->Name() + " for vertex animation baking");
+                buffers.clear();
+                return false;
+            }
+
+            bake.data.resize(bake.numVertices * bake.vertexSize);
+            if (!vertexBuffer->GetData(0, bake.numVertices, &bake.data[0]))
+            {
+                buffers.clear();
+                return false;
+            }
+
+            VertexAnimationBuffer newBuffer;
+            newBuffer.vertexBuffer = vertexBuffer;
+            newBuffer.texelOffset = 0;
+            buffers.push_back(newBuffer);
+            bakeBuffers.push_back(bake);
+        }
+    }
+
+    // Sample each clip evenly including both ends, so that looping clips wrap from the last frame to the first
+    for (auto it = animations.begin(); it != animations.end(); ++it)
+    {
+        Animation* animation = *it;
+        if (!animation || FindClip(animation) != M_MAX_UNSIGNED)
+            continue;
+
+        VertexAnimationClip clip;
+        clip.animation = animation;
+        clip.firstFrame = numFrames;
+        clip.length = animation->Length();
+        clip.numFrames = clip.length > 0.0f ? (unsigned)ceilf(clip.length * sampleRate) + 1 : 1;
+        clips.push_back(clip);
+        numFrames += clip.numFrames;
+    }
+
+    size_t numTexels = 0;
+    for (size_t i = 0; i < buffers.size(); ++i)
+    {
+        buffers[i].texelOffset = (unsigned)numTexels;
+        numTexels += bakeBuffers[i].numVertices * 2 * numFrames;
+    }
+
+    if (!numTexels)
+    {
+        LOGERROR("No clips or vertices to bake into vertex animation");
+        buffers.clear();
+        clips.clear();
+        return false;
+    }
+    if (numTexels > MAX_VERTEX_ANIMATION_TEXELS)
+    {
+        LOGERRORF("Vertex animation of %d texels is too large", (int)numTexels);
+        buffers.clear();
+        clips.clear();
+        return false;
+    }
+
+    const std::vector<ModelBone>& bones = model_->Bones();
+    size_t numBones = bones.size();
+    std::vector<Vector3> positions(numBones);
+    std::vector<Quaternion> rotations(numBones);
+    std::vector<Vector3> scales(numBones);
+    std::vector<Matrix3x4> boneTransforms(numBones);
+    std::vector<Matrix3x4> skinMatrices(numBones);
+    std::vector<bool> transformDone(numBones);
+    std::vector<size_t> keyFrameIndices;
+
+    int numRows = (int)((numTexels + VERTEX_ANIMATION_TEXTURE_WIDTH - 1) / VERTEX_ANIMATION_TEXTURE_WIDTH);
+    std::vector<Vector4> texels((size_t)numRows * VERTEX_ANIMATION_TEXTURE_WIDTH, Vector4::ZERO);
+
+    for (size_t i = 0; i < clips.size(); ++i)
+    {
+        const VertexAnimationClip& clip = clips[i];
+        const std::vector<AnimationTrack>& tracks = clip.animation->Tracks();
+        const std::vector<AnimationBoneBinding>& bindings = clip.animation->BoneBindings(model_);
+        keyFrameIndices.assign(tracks.size(), 0);
+
+        for (unsigned j = 0; j < clip.numFrames; ++j)
+        {
+            float time = clip.numFrames > 1 ? clip.length * (float)j / (float)(clip.numFrames - 1) : 0.0f;
+
+            // Apply the tracks over the bind pose of the bones
+            for (size_t k = 0; k < numBones; ++k)
+            {
+                positions[k] = bones[k].initialPosition;
+                rotations[k] = bones[k].initialRotation;
+                scales[k] = bones[k].initialScale;
+                transformDone[k] = false;
+            }
+
+            for (auto it = bindings.begin(); it != bindings.end(); ++it)
+            {
+                const AnimationTrack& track = tracks[it->trackIndex];
+                if (!track.NumKeyFrames())
+                    continue;
+
+                AnimationKeyFrame keyFrame;
+                AnimationKeyFrame nextKeyFrame;
+                float t;
+                track.Sample(time, clip.length, false, keyFrameIndices[it->trackIndex], keyFrame, nextKeyFrame, t);
+
+                if (track.channelMask & CHANNEL_POSITION)
+                    positions[it->boneIndex] = keyFrame.position.Lerp(nextKeyFrame.position, t);
+                if (track.channelMask & CHANNEL_ROTATION)
+                    rotations[it->boneIndex] = keyFrame.rotation.Slerp(nextKeyFrame.rotation, t);
+                if (track.channelMask & CHANNEL_SCALE)
+                    scales[it->boneIndex] = keyFrame.scale.Lerp(nextKeyFrame.scale, t);
+            }
+
+            // Accumulate the model space transforms by walking up to the nearest finished ancestor
+            for (size_t k = 0; k < numBones; ++k)
+            {
+                size_t index = k;
+                while (!transformDone[index])
+                {
+                    size_t parentIndex = bones[index].parentIndex;
+                    if (parentIndex == index || parentIndex >= numBones)
+                    {
+                        boneTransforms[index] = Matrix3x4(positions[index], rotations[index], scales[index]);
+                        transformDone[index] = true;
+                        index = k;
+                    }
+                    else if (transformDone[parentIndex])
+                    {
+                        boneTransforms[index] = boneTransforms[parentIndex] * Matrix3x4(positions[index], rotations[index], scales[index]);
+                        transformDone[index] = true;
+                        index = k;
+                    }
+                    else
+                        index = parentIndex;
+                }
+
+                skinMatrices[k] = boneTransforms[k] * bones[k].offsetMatrix;
+            }
+
+            for (size_t k = 0; k < buffers.size(); ++k)
+            {
+                const BakeVertexBuffer& bake = bakeBuffers[k];
+                Vector4* dest = &texels[buffers[k].texelOffset + (clip.firstFrame + j) * bake.numVertices * 2];
+
+                for (size_t l = 0; l < bake.numVertices; ++l)
+                {
+                    const unsigned char* vertex = &bake.data[l * bake.vertexSize];
+                    const Vector3& position = *reinterpret_cast<const Vector3*>(vertex + bake.position);
+                    const float* weights = reinterpret_cast<const float*>(vertex + bake.blendWeights);
+                    const unsigned char* indices = vertex + bake.blendIndices;
+
+                    Vector3 normal(Vector3::ZERO);
+                    if (bake.normal != M_MAX_UNSIGNED)
+                    {
+                        if (bake.packedNormals)
+                        {
+                            Vector4 unpacked = UnpackSNorm1010102(*reinterpret_cast<const unsigned*>(vertex + bake.normal));
+                            normal = Vector3(unpacked.x, unpacked.y, unpacked.z);
+                        }
+                        else
+                            normal = *reinterpret_cast<const Vector3*>(vertex + bake.normal);
+                    }
+
+                    Vector3 skinnedPosition(Vector3::ZERO);
+                    Vector3 skinnedNormal(Vector3::ZERO);
+                    for (size_t m = 0; m < 4; ++m)
+                    {
+                        if (weights[m] <= 0.0f || indices[m] >= numBones)
+                            continue;
+                        const Matrix3x4& skinMatrix = skinMatrices[indices[m]];
+                        skinnedPosition += weights[m] * (skinMatrix * position);
+                        skinnedNormal += weights[m] * (skinMatrix * Vector4(normal, 0.0f));
+                    }
+
+                    boundingBox.Merge(skinnedPosition);
+                    dest[l * 2] = Vector4(skinnedPosition, 1.0f);
+                    dest[l * 2 + 1] = Vector4(skinnedNormal.Normalized(), 0.0f);
+                }
+            }
+        }
+    }
+
+    SharedPtr<Texture> newTexture(new Texture());
+    ImageLevel level(IntVector2(VERTEX_ANIMATION_TEXTURE_WIDTH, numRows), FMT_RGBA32F, &texels[0]);
+    if (!newTexture->Define(TEX_2D, IntVector2(VERTEX_ANIMATION_TEXTURE_WIDTH, numRows), FMT_RGBA32F, 1, 1, &level))
+    {
+        buffers.clear();
+        clips.clear();
+        return false;
+    }
+    newTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+    model = model_;
+    texture = newTexture;
+    return true;
+}
+
+size_t VertexAnimation::FindClip(Animation* animation) const
+{
+    for (size_t i = 0; i < clips.size(); ++i)
+    {
+        if (clips[i].animation == animation)
+            return i;
+    }
+
+    return M_MAX_UNSIGNED;
+}
+
+size_t VertexAnimation::TexelOffset(VertexBuffer* vertexBuffer) const
+{
+    for (auto it = buffers.begin(); it != buffers.end(); ++it)
+    {
+        if (it->vertexBuffer == vertexBuffer)
+            return it->texelOffset;
+    }
+
+    return M_MAX_UNSIGNED;
+}
@@ -0,0 +1,88 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/BoundingBox.h"
+#include "../Object/Ptr.h"
+
+#include <vector>
+
+class Animation;
+class Model;
+class Texture;
+class VertexBuffer;
+
+/// Width of the vertex animation texture. Each baked vertex takes two consecutive texels per frame, the position and the normal.
+static const int VERTEX_ANIMATION_TEXTURE_WIDTH = 4096;
+/// Maximum number of texels in the vertex animation texture, so that the texel indices stay exact in floating point.
+static const size_t MAX_VERTEX_ANIMATION_TEXELS = 4096 * 4096;
+
+/// Animation clip baked into a vertex animation.
+struct VertexAnimationClip
+{
+    /// Source animation.
+    SharedPtr<Animation> animation;
+    /// Index of the first frame.
+    unsigned firstFrame;
+    /// Number of frames, evenly spaced from the start to the end of the clip.
+    unsigned numFrames;
+    /// Clip length in seconds.
+    float length;
+};
+
+/// Vertex buffer baked into a vertex animation.
+struct VertexAnimationBuffer
+{
+    /// Source vertex buffer of the model.
+    SharedPtr<VertexBuffer> vertexBuffer;
+    /// Index of the buffer's first texel in the texture.
+    unsigned texelOffset;
+};
+
+/// Skinned vertex positions and normals of a model's animation clips, sampled at a fixed rate into a float texture, so that animated instances can be drawn without bones by fetching their vertices in the vertex shader. The frames of each vertex buffer are stored one after another, with two texels per vertex.
+class VertexAnimation : public RefCounted
+{
+public:
+    /// Construct.
+    VertexAnimation();
+    /// Destruct.
+    ~VertexAnimation();
+
+    /// Skin the vertices of all geometries and LOD levels of a model on the CPU for each animation clip sampled at the rate, and store them into the texture. The model must have been uploaded. Requires the graphics subsystem and should be called in the main thread. Return true on success.
+    bool Bake(Model* model, const std::vector<Animation*>& animations, float sampleRate = 30.0f);
+
+    /// Return the baked model.
+    Model* GetModel() const { return model; }
+    /// Return the vertex animation texture.
+    Texture* GetTexture() const { return texture; }
+    /// Return the sample rate.
+    float SampleRate() const { return sampleRate; }
+    /// Return number of clips.
+    size_t NumClips() const { return clips.size(); }
+    /// Return clip by index.
+    const VertexAnimationClip& Clip(size_t index) const { return clips[index]; }
+    /// Return clip index by animation, or M_MAX_UNSIGNED if not baked.
+    size_t FindClip(Animation* animation) const;
+    /// Return the index of a vertex buffer's first texel, or M_MAX_UNSIGNED if not baked.
+    size_t TexelOffset(VertexBuffer* vertexBuffer) const;
+    /// Return the model space bounding box of all the baked frames.
+    const BoundingBox& AnimatedBoundingBox() const { return boundingBox; }
+    /// Return the total number of frames of all clips.
+    unsigned NumFrames() const { return numFrames; }
+
+private:
+    /// Baked model.
+    SharedPtr<Model> model;
+    /// Vertex animation texture.
+    SharedPtr<Texture> texture;
+    /// Baked clips.
+    std::vector<VertexAnimationClip> clips;
+    /// Baked vertex buffers.
+    std::vector<VertexAnimationBuffer> buffers;
+    /// Bounding box of all the baked frames.
+    BoundingBox boundingBox;
+    /// Sample rate.
+    float sampleRate;
+    /// Total number of frames.
+    unsigned numFrames;
+};
@@ -0,0 +1,726 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Graphics/Texture.h"
+#include "../IO/Compression.h"
+#include "../IO/Log.h"
+#include "../IO/Stream.h"
+#include "../Resource/Compress.h"
+#include "../Resource/Decompress.h"
+#include "../Resource/ResourceCache.h"
+#include "VirtualTexture.h"
+
+#include <algorithm>
+#include <functional>
+#include <tracy/Tracy.hpp>
+
+static const unsigned VT_FILE_VERSION = 1;
+static const unsigned short NO_SLOT = 0xffff;
+static const unsigned short LOADING_SLOT = 0xfffe;
+static const unsigned NO_PAGE = 0xffffffff;
+
+VirtualTexture* VirtualTexture::idTable[256] = { nullptr };
+std::vector<VirtualTexture*> VirtualTexture::allVirtualTextures;
+
+inline bool IsSupportedPageFormat(ImageFormat format)
+{
+    return format == FMT_RGBA8 || format == FMT_DXT1 || format == FMT_DXT5;
+}
+
+VirtualTexture::VirtualTexture() :
+    size(IntVector2::ZERO),
+    pagesX(0),
+    pagesY(0),
+    numLevels(0),
+    pageFormat(FMT_NONE),
+    cacheFormat(FMT_NONE),
+    requestedCacheFormat(FMT_NONE),
+    cachePages(DEFAULT_VT_CACHE_PAGES),
+    maxLoads(DEFAULT_VT_MAX_LOADS),
+    feedbackFrame(0),
+    numResidentPages(0),
+    id(0)
+{
+    for (size_t i = 1; i < 256; ++i)
+    {
+        if (!idTable[i])
+        {
+            id = (unsigned char)i;
+            idTable[i] = this;
+            break;
+        }
+    }
+
+    if (!id)
+        LOGERROR("Out of virtual texture IDs, virtual texture will not receive feedback");
+
+    allVirtualTextures.push_back(this);
+}
+
+VirtualTexture::~VirtualTexture()
+{
+    if (id)
+        idTable[id] = nullptr;
+
+    auto it = std::find(allVirtualTextures.begin(), allVirtualTextures.end(), this);
+    if (it != allVirtualTextures.end())
+        allVirtualTextures.erase(it);
+}
+
+void VirtualTexture::RegisterObject()
+{
+    RegisterFactory<VirtualTexture>();
+}
+
+bool VirtualTexture::BeginLoad(Stream& source)
+{
+    ZoneScoped;
+
+    std::string fileID = source.ReadFileID();
+    if (fileID != "TVTX")
+    {
+        LOGERROR(source.Name() + " is not a valid virtual texture file");
+        return false;
+    }
+
+    unsigned version = source.Read<unsigned>();
+    int width = source.Read<int>();
+    int height = source.Read<int>();
+    int pageSize = source.Read<int>();
+    int pageBorder = source.Read<int>();
+    ImageFormat newPageFormat = (ImageFormat)source.Read<unsigned char>();
+    unsigned newNumLevels = source.Read<unsigned char>();
+
+    if (version != VT_FILE_VERSION || pageSize != VT_PAGE_SIZE || pageBorder != VT_PAGE_BORDER || !IsSupportedPageFormat(newPageFormat))
+    {
+        LOGERROR(source.Name() + " has an unsupported virtual texture version, page size or format");
+        return false;
+    }
+    if (width <= 0 || height <= 0 || width % VT_PAGE_SIZE || height % VT_PAGE_SIZE || width / VT_PAGE_SIZE > VT_MAX_PAGES ||
+        height / VT_PAGE_SIZE > VT_MAX_PAGES || !IsPowerOfTwo(width / VT_PAGE_SIZE) || !IsPowerOfTwo(height / VT_PAGE_SIZE) ||
+        !newNumLevels || (1u << (newNumLevels - 1)) > (unsigned)Min(width, height) / VT_PAGE_SIZE)
+    {
+        LOGERROR(source.Name() + " has invalid virtual texture dimensions");
+        return false;
+    }
+
+    size = IntVector2(width, height);
+    pagesX = width / VT_PAGE_SIZE;
+    pagesY = height / VT_PAGE_SIZE;
+    numLevels = newNumLevels;
+    pageFormat = newPageFormat;
+
+    levelOffsets.resize(numLevels);
+    pageTable.resize(numLevels);
+    dirtyRects.resize(numLevels);
+    unsigned numPages = 0;
+    for (unsigned i = 0; i < numLevels; ++i)
+    {
+        unsigned levelPages = (pagesX >> i) * (pagesY >> i);
+        levelOffsets[i] = numPages;
+        pageTable[i].assign(levelPages, 0);
+        dirtyRects[i] = IntRect::ZERO;
+        numPages += levelPages;
+    }
+
+    pageOffsets.resize(numPages + 1);
+    source.Read(&pageOffsets[0], pageOffsets.size() * sizeof(unsigned long long));
+    pageSlots.assign(numPages, NO_SLOT);
+    pageRequests.assign(numPages, M_MAX_UNSIGNED);
+
+    // Decompress the coarsest mip level now, as it stays resident
+    unsigned firstPinned = levelOffsets[numLevels - 1];
+    size_t pageDataSize = PageDataSize(pageFormat);
+    std::vector<unsigned char> compressed;
+    pinnedPages.resize(numPages - firstPinned);
+    for (unsigned i = firstPinned; i < numPages; ++i)
+    {
+        size_t compressedSize = (size_t)(pageOffsets[i + 1] - pageOffsets[i]);
+        compressed.resize(compressedSize);
+        std::vector<unsigned char>& pageData = pinnedPages[i - firstPinned];
+        pageData.resize(pageDataSize);
+
+        source.Seek((size_t)pageOffsets[i]);
+        if (!compressedSize || source.Read(&compressed[0], compressedSize) != compressedSize ||
+            !DecompressData(&pageData[0], pageDataSize, &compressed[0], compressedSize))
+        {
+            LOGERROR(source.Name() + " has corrupt virtual texture page data");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool VirtualTexture::EndLoad()
+{
+    ZoneScoped;
+
+    // Stop reading the pages of a previous load, if reloaded
+    loads.clear();
+    requests.clear();
+    streamPool.clear();
+
+    std::vector<ImageLevel> initialData(numLevels);
+    for (unsigned i = 0; i < numLevels; ++i)
+        initialData[i] = ImageLevel(IntVector2(pagesX >> i, pagesY >> i), FMT_RGBA8, &pageTable[i][0]);
+
+    pageTableTexture = new Texture();
+    if (!pageTableTexture->Define(TEX_2D, IntVector2(pagesX, pagesY), FMT_RGBA8, 1, numLevels, &initialData[0]) ||
+        !pageTableTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP))
+        return false;
+
+    return DefineCache();
+}
+
+bool VirtualTexture::Cook(Stream& dest, const Image& image, ImageFormat pageFormat, MipFilter filter, bool srgb)
+{
+    ZoneScoped;
+
+    if (image.Format() != FMT_RGBA8 || image.Depth() != 1)
+    {
+        LOGERROR("Virtual textures can only be cooked from 2D RGBA8 images");
+        return false;
+    }
+    if (!IsSupportedPageFormat(pageFormat))
+    {
+        LOGERROR("Unsupported virtual texture page format");
+        return false;
+    }
+
+    int width = image.Width();
+    int height = image.Height();
+    if (width % VT_PAGE_SIZE || height % VT_PAGE_SIZE || width / VT_PAGE_SIZE > VT_MAX_PAGES || height / VT_PAGE_SIZE > VT_MAX_PAGES ||
+        !IsPowerOfTwo(width / VT_PAGE_SIZE) || !IsPowerOfTwo(height / VT_PAGE_SIZE))
+    {
+        LOGERRORF("Virtual texture dimensions must be power of two multiples of %d up to %d pages", VT_PAGE_SIZE, VT_MAX_PAGES);
+        return false;
+    }
+
+    // Mip down until the smaller dimension is one page
+    unsigned levels = 1;
+    while ((1 << levels) <= Min(width, height) / VT_PAGE_SIZE)
+        ++levels;
+
+    std::vector<AutoPtr<Image> > mipImages;
+    const Image* levelImage = &image;
+    for (unsigned i = 1; i < levels; ++i)
+    {
+        AutoPtr<Image> mipImage(new Image());
+        if (!levelImage->GenerateMipImage(*mipImage, filter, srgb))
+            return false;
+        levelImage = mipImage.Get();
+        mipImages.push_back(mipImage);
+    }
+
+    size_t start = dest.Position();
+    dest.WriteFileID("TVTX");
+    dest.Write(VT_FILE_VERSION);
+    dest.Write(width);
+    dest.Write(height);
+    dest.Write(VT_PAGE_SIZE);
+    dest.Write(VT_PAGE_BORDER);
+    dest.Write((unsigned char)pageFormat);
+    dest.Write((unsigned char)levels);
+
+    // Reserve the page offsets, to be filled in after the pages are written
+    size_t numPages = 0;
+    for (unsigned i = 0; i < levels; ++i)
+        numPages += (size_t)((width / VT_PAGE_SIZE) >> i) * ((height / VT_PAGE_SIZE) >> i);
+    std::vector<unsigned long long> offsets(numPages + 1);
+    size_t offsetsPosition = dest.Position();
+    dest.Write(&offsets[0], offsets.size() * sizeof(unsigned long long));
+
+    std::vector<unsigned char> pageTexels(VT_PAGE_STRIDE * VT_PAGE_STRIDE * 4);
+    std::vector<unsigned char> pageData(PageDataSize(pageFormat));
+    std::vector<unsigned char> compressed(CompressBound(pageData.size()));
+    size_t pageIndex = 0;
+
+    for (unsigned i = 0; i < levels; ++i)
+    {
+        levelImage = i ? mipImages[i - 1].Get() : &image;
+        int levelWidth = levelImage->Width();
+        int levelHeight = levelImage->Height();
+        const unsigned* src = (const unsigned*)levelImage->Data();
+
+        for (int y = 0; y < levelHeight / VT_PAGE_SIZE; ++y)
+        {
+            for (int x = 0; x < levelWidth / VT_PAGE_SIZE; ++x)
+            {
+                // Copy the page with its borders, repeating the edge texels at the texture edges
+                unsigned* texels = (unsigned*)&pageTexels[0];
+                for (int py = 0; py < VT_PAGE_STRIDE; ++py)
+                {
+                    int sy = Clamp(y * VT_PAGE_SIZE + py - VT_PAGE_BORDER, 0, levelHeight - 1);
+                    for (int px = 0; px < VT_PAGE_STRIDE; ++px)
+                    {
+                        int sx = Clamp(x * VT_PAGE_SIZE + px - VT_PAGE_BORDER, 0, levelWidth - 1);
+                        *texels++ = src[sy * levelWidth + sx];
+                    }
+                }
+
+                if (pageFormat == FMT_RGBA8)
+                    pageData = pageTexels;
+                else
+                    CompressImageDXT(&pageData[0], &pageTexels[0], VT_PAGE_STRIDE, VT_PAGE_STRIDE, pageFormat);
+
+                size_t compressedSize = CompressData(&compressed[0], compressed.size(), &pageData[0], pageData.size());
+                if (!compressedSize)
+                {
+                    LOGERROR("Failed to compress virtual texture page");
+                    return false;
+                }
+
+                offsets[pageIndex++] = dest.Position() - start;
+                dest.Write(&compressed[0], compressedSize);
+            }
+        }
+    }
+
+    size_t end = dest.Position();
+    offsets[pageIndex] = end - start;
+    dest.Seek(offsetsPosition);
+    dest.Write(&offsets[0], offsets.size() * sizeof(unsigned long long));
+    dest.Seek(end);
+
+    return true;
+}
+
+void VirtualTexture::SetCachePages(int pagesPerSide)
+{
+    pagesPerSide = Clamp(pagesPerSide, 1, MAX_VT_CACHE_PAGES);
+    if (pagesPerSide == cachePages)
+        return;
+
+    cachePages = pagesPerSide;
+    if (pageTableTexture)
+        DefineCache();
+}
+
+void VirtualTexture::SetCacheFormat(ImageFormat format)
+{
+    if (format != FMT_NONE && !IsSupportedPageFormat(format))
+    {
+        LOGERROR("Unsupported virtual texture cache format");
+        return;
+    }
+    if (format == requestedCacheFormat)
+        return;
+
+    requestedCacheFormat = format;
+    if (pageTableTexture)
+        DefineCache();
+}
+
+void VirtualTexture::SetMaxLoads(size_t maxLoads_)
+{
+    maxLoads = Max(maxLoads_, (size_t)1);
+}
+
+void VirtualTexture::RequestPage(unsigned level, unsigned x, unsigned y, unsigned frameNumber)
+{
+    if (level >= numLevels || x >= (pagesX >> level) || y >= (pagesY >> level))
+        return;
+
+    // Coarser pages are needed as the fallback until the page is resident, and must not be evicted before it
+    for (;;)
+    {
+        unsigned page = PageIndex(level, x, y);
+        if (pageRequests[page] == frameNumber)
+            break;
+
+        pageRequests[page] = frameNumber;
+        unsigned short slot = pageSlots[page];
+        if (slot < LOADING_SLOT)
+            slotUses[slot] = frameNumber;
+        else if (slot == NO_SLOT)
+            requests.push_back(page);
+
+        if (++level >= numLevels)
+            break;
+        x >>= 1;
+        y >>= 1;
+    }
+}
+
+size_t VirtualTexture::Update(size_t uploadBudget)
+{
+    ZoneScoped;
+
+    if (!pageTableTexture)
+        return 0;
+
+    size_t pageDataSize = PageDataSize(cacheFormat);
+    size_t uploaded = 0;
+
+    // Upload finished pages. Always upload at least one page to make progress with small budgets
+    for (auto it = loads.begin(); it != loads.end();)
+    {
+        if (!it->second.IsReady())
+        {
+            ++it;
+            continue;
+        }
+        if (uploaded && uploaded + pageDataSize > uploadBudget)
+            break;
+
+        VirtualPageLoad& load = *it->first;
+        bool success = it->second.Get();
+        if (!success)
+            LOGERRORF("Failed to read page %u of virtual texture %s", load.page, Name().c_str());
+
+        // The cache may have been redefined in a different format while reading
+        if (pageSlots[load.page] == LOADING_SLOT)
+        {
+            pageSlots[load.page] = NO_SLOT;
+            if (success && load.cacheFormat == cacheFormat)
+            {
+                unsigned short slot = AllocateSlot();
+                if (slot != NO_SLOT)
+                {
+                    UploadPage(load.page, slot, &load.data[0]);
+                    uploaded += pageDataSize;
+                }
+            }
+        }
+
+        if (load.stream)
+            streamPool.push_back(load.stream);
+        it = loads.erase(it);
+    }
+
+    // Start reading the requested pages, coarsest first. Requests that do not fit are made again by later feedback
+    if (requests.size())
+    {
+        std::sort(requests.begin(), requests.end(), std::greater<unsigned>());
+        ResourceCache* cache = Subsystem<ResourceCache>();
+
+        for (auto it = requests.begin(); it != requests.end() && loads.size() < maxLoads; ++it)
+        {
+            unsigned page = *it;
+            if (pageSlots[page] != NO_SLOT)
+                continue;
+
+            std::shared_ptr<VirtualPageLoad> load = std::make_shared<VirtualPageLoad>();
+            if (streamPool.size())
+            {
+                load->stream = streamPool.back();
+                streamPool.pop_back();
+            }
+            else
+                load->stream = cache->OpenResource(Name());
+            if (!load->stream)
+                break;
+
+            load->page = page;
+            load->offset = (size_t)pageOffsets[page];
+            load->compressedSize = (size_t)(pageOffsets[page + 1] - pageOffsets[page]);
+            load->pageFormat = pageFormat;
+            load->cacheFormat = cacheFormat;
+
+            pageSlots[page] = LOADING_SLOT;
+            loads.push_back(std::make_pair(load, Async([load]() { return ReadPage(*load); }, TASK_LOW)));
+        }
+
+        requests.clear();
+    }
+
+    UpdatePageTable();
+    return uploaded;
+}
+
+void VirtualTexture::EvictPages()
+{
+    for (size_t i = 0; i < slotPages.size(); ++i)
+    {
+        unsigned page = slotPages[i];
+        if (page != NO_PAGE && !IsPinned(page))
+            EvictPage(page);
+    }
+
+    UpdatePageTable();
+}
+
+bool VirtualTexture::IsReady() const
+{
+    return pageTableTexture && cacheTexture && pageTableTexture->IsReady() && cacheTexture->IsReady();
+}
+
+size_t VirtualTexture::CpuMemoryUse() const
+{
+    size_t bytes = levelOffsets.size() * sizeof(unsigned) + pageOffsets.size() * sizeof(unsigned long long) + pageSlots.size() * sizeof(unsigned short) +
+        pageRequests.size() * sizeof(unsigned) + slotPages.size() * sizeof(unsigned) + slotUses.size() * sizeof(unsigned) +
+        freeSlots.size() * sizeof(unsigned short) + uploadBuffer.size();
+    for (auto it = pinnedPages.begin(); it != pinnedPages.end(); ++it)
+        bytes += it->size();
+    for (auto it = pageTable.begin(); it != pageTable.end(); ++it)
+        bytes += it->size() * sizeof(unsigned);
+    return bytes;
+}
+
+size_t VirtualTexture::GpuMemoryUse() const
+{
+    return (cacheTexture ? cacheTexture->GpuMemoryUse() : 0) + (pageTableTexture ? pageTableTexture->GpuMemoryUse() : 0);
+}
+
+void VirtualTexture::ProcessFeedback(const unsigned* texels, size_t numTexels, unsigned frameNumber)
+{
+    ZoneScoped;
+
+    for (auto it = allVirtualTextures.begin(); it != allVirtualTextures.end(); ++it)
+        (*it)->feedbackFrame = frameNumber;
+
+    // Neighbouring texels often need the same page, so skip repeats before the per-page request stamps
+    unsigned lastPosition = 0;
+    unsigned lastLevelId = 0;
+
+    for (size_t i = 0; i < numTexels; ++i)
+    {
+        unsigned position = texels[i * 2];
+        unsigned levelId = texels[i * 2 + 1];
+        if (!levelId || (position == lastPosition && levelId == lastLevelId))
+            continue;
+
+        lastPosition = position;
+        lastLevelId = levelId;
+
+        VirtualTexture* texture = FromId((unsigned char)(levelId >> 8));
+        if (texture && texture->pageTableTexture)
+            texture->RequestPage(levelId & 0xff, position & 0xffff, position >> 16, frameNumber);
+    }
+}
+
+unsigned VirtualTexture::PageLevel(unsigned page) const
+{
+    unsigned level = numLevels - 1;
+    while (level && page < levelOffsets[level])
+        --level;
+    return level;
+}
+
+bool VirtualTexture::DefineCache()
+{
+    ZoneScoped;
+
+    ImageFormat newCacheFormat = requestedCacheFormat != FMT_NONE ? requestedCacheFormat : pageFormat;
+    size_t numSlots = (size_t)cachePages * cachePages;
+    if (numSlots < pinnedPages.size())
+    {
+        LOGERRORF("Virtual texture cache of %d pages per side is too small for the %d coarsest mip level pages", cachePages, (int)pinnedPages.size());
+        return false;
+    }
+
+    // Define with zeroed data, as block compressed textures are not allocated otherwise
+    int textureSize = cachePages * VT_PAGE_STRIDE;
+    ImageLevel initialData;
+    Image::CalculateDataSize(IntVector3(textureSize, textureSize, 1), newCacheFormat, initialData);
+    std::vector<unsigned char> zeroData(initialData.dataSize);
+    initialData.data = &zeroData[0];
+    initialData.size = IntVector3(textureSize, textureSize, 1);
+
+    if (!cacheTexture)
+        cacheTexture = new Texture();
+    if (!cacheTexture->Define(TEX_2D, IntVector2(textureSize, textureSize), newCacheFormat, 1, 1, &initialData) ||
+        !cacheTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP))
+        return false;
+
+    cacheFormat = newCacheFormat;
+
+    // Drop the resident pages, but keep the pages being read marked so that they are not read twice
+    for (auto it = pageSlots.begin(); it != pageSlots.end(); ++it)
+    {
+        if (*it < LOADING_SLOT)
+            *it = NO_SLOT;
+    }
+
+    slotPages.assign(numSlots, NO_PAGE);
+    slotUses.assign(numSlots, 0);
+    freeSlots.resize(numSlots);
+    for (size_t i = 0; i < numSlots; ++i)
+        freeSlots[i] = (unsigned short)(numSlots - 1 - i);
+    numResidentPages = 0;
+
+    unsigned firstPinned = levelOffsets[numLevels - 1];
+    std::vector<unsigned char> pageData;
+    for (size_t i = 0; i < pinnedPages.size(); ++i)
+    {
+        pageData = pinnedPages[i];
+        if (!TranscodePage(pageData, pageFormat, cacheFormat))
+            return false;
+
+        unsigned short slot = freeSlots.back();
+        freeSlots.pop_back();
+        UploadPage(firstPinned + (unsigned)i, slot, &pageData[0]);
+    }
+
+    for (unsigned i = 0; i < numLevels; ++i)
+        dirtyRects[i] = IntRect(0, 0, pagesX >> i, pagesY >> i);
+    UpdatePageTable();
+
+    return true;
+}
+
+unsigned short VirtualTexture::AllocateSlot()
+{
+    if (freeSlots.empty())
+    {
+        // Evict the least recently used page, but not pages needed by the latest feedback
+        size_t oldestSlot = NO_SLOT;
+        unsigned oldestAge = 0;
+
+        for (size_t i = 0; i < slotPages.size(); ++i)
+        {
+            unsigned page = slotPages[i];
+            if (page == NO_PAGE || IsPinned(page))
+                continue;
+
+            unsigned age = feedbackFrame - slotUses[i];
+            if (age > oldestAge)
+            {
+                oldestSlot = i;
+                oldestAge = age;
+            }
+        }
+
+        if (oldestSlot == NO_SLOT)
+            return NO_SLOT;
+
+        EvictPage(slotPages[oldestSlot]);
+    }
+
+    unsigned short slot = freeSlots.back();
+    freeSlots.pop_back();
+    return slot;
+}
+
+void VirtualTexture::UploadPage(unsigned page, unsigned short slot, const unsigned char* data)
+{
+    int slotX = slot % cachePages;
+    int slotY = slot / cachePages;
+
+    ImageLevel pageLevel;
+    Image::CalculateDataSize(IntVector3(VT_PAGE_STRIDE, VT_PAGE_STRIDE, 1), cacheFormat, pageLevel);
+    pageLevel.data = data;
+    pageLevel.size = IntVector3(VT_PAGE_STRIDE, VT_PAGE_STRIDE, 1);
+    cacheTexture->SetData(0, IntRect(slotX * VT_PAGE_STRIDE, slotY * VT_PAGE_STRIDE, (slotX + 1) * VT_PAGE_STRIDE, (slotY + 1) * VT_PAGE_STRIDE), pageLevel);
+
+    pageSlots[page] = slot;
+    slotPages[slot] = page;
+    slotUses[slot] = feedbackFrame;
+    ++numResidentPages;
+    MarkPageTableDirty(page);
+}
+
+void VirtualTexture::EvictPage(unsigned page)
+{
+    unsigned short slot = pageSlots[page];
+    pageSlots[page] = NO_SLOT;
+    slotPages[slot] = NO_PAGE;
+    freeSlots.push_back(slot);
+    --numResidentPages;
+    MarkPageTableDirty(page);
+}
+
+void VirtualTexture::MarkPageTableDirty(unsigned page)
+{
+    unsigned level = PageLevel(page);
+    unsigned levelPagesX = pagesX >> level;
+    int x = (int)((page - levelOffsets[level]) % levelPagesX);
+    int y = (int)((page - levelOffsets[level]) / levelPagesX);
+
+    // The page is the fallback for the finer pages it covers
+    for (unsigned i = 0; i <= level; ++i)
+    {
+        int shift = (int)(level - i);
+        IntRect pageRect(x << shift, y << shift, (x + 1) << shift, (y + 1) << shift);
+        IntRect& dirtyRect = dirtyRects[i];
+
+        if (dirtyRect.Width() == 0)
+            dirtyRect = pageRect;
+        else
+        {
+            dirtyRect.left = Min(dirtyRect.left, pageRect.left);
+            dirtyRect.top = Min(dirtyRect.top, pageRect.top);
+            dirtyRect.right = Max(dirtyRect.right, pageRect.right);
+            dirtyRect.bottom = Max(dirtyRect.bottom, pageRect.bottom);
+        }
+    }
+}
+
+void VirtualTexture::UpdatePageTable()
+{
+    ZoneScoped;
+
+    // Coarsest first, so that non-resident pages can copy the updated entry of the parent page
+    for (unsigned i = numLevels - 1; i < numLevels; --i)
+    {
+        IntRect& rect = dirtyRects[i];
+        if (rect.Width() == 0)
+            continue;
+
+        unsigned levelPagesX = pagesX >> i;
+        uploadBuffer.resize(rect.Width() * rect.Height() * sizeof(unsigned));
+        unsigned* dest = (unsigned*)&uploadBuffer[0];
+
+        for (int y = rect.top; y < rect.bottom; ++y)
+        {
+            for (int x = rect.left; x < rect.right; ++x)
+            {
+                unsigned short slot = pageSlots[PageIndex(i, x, y)];
+                unsigned& entry = pageTable[i][y * levelPagesX + x];
+                if (slot < LOADING_SLOT)
+                    entry = (slot % cachePages) | ((slot / cachePages) << 8) | (i << 16) | ((unsigned)id << 24);
+                else
+                    entry = pageTable[i + 1][(y >> 1) * (levelPagesX >> 1) + (x >> 1)];
+                *dest++ = entry;
+            }
+        }
+
+        pageTableTexture->SetData(i, rect, ImageLevel(IntVector2(rect.Width(), rect.Height()), FMT_RGBA8, &uploadBuffer[0]));
+        rect = IntRect::ZERO;
+    }
+}
+
+size_t VirtualTexture::PageDataSize(ImageFormat format)
+{
+    ImageLevel pageLevel;
+    Image::CalculateDataSize(IntVector3(VT_PAGE_STRIDE, VT_PAGE_STRIDE, 1), format, pageLevel);
+    return pageLevel.dataSize;
+}
+
+bool VirtualTexture::TranscodePage(std::vector<unsigned char>& data, ImageFormat fromFormat, ImageFormat toFormat)
+{
+    if (fromFormat == toFormat)
+        return true;
+    if (!IsSupportedPageFormat(fromFormat) || !IsSupportedPageFormat(toFormat))
+        return false;
+
+    if (fromFormat != FMT_RGBA8)
+    {
+        std::vector<unsigned char> rgba(VT_PAGE_STRIDE * VT_PAGE_STRIDE * 4);
+        DecompressImageDXT(&rgba[0], &data[0], VT_PAGE_STRIDE, VT_PAGE_STRIDE, fromFormat);
+        data.swap(rgba);
+    }
+    if (toFormat != FMT_RGBA8)
+    {
+        std::vector<unsigned char> blocks(PageDataSize(toFormat));
+        CompressImageDXT(&blocks[0], &data[0], VT_PAGE_STRIDE, VT_PAGE_STRIDE, toFormat);
+        data.swap(blocks);
+    }
+
+    return true;
+}
+
+bool VirtualTexture::ReadPage(VirtualPageLoad& load)
+{
+    ZoneScoped;
+
+    std::vector<unsigned char> compressed(load.compressedSize);
+    load.data.resize(PageDataSize(load.pageFormat));
+
+    load.stream->Seek(load.offset);
+    if (!load.compressedSize || load.stream->Read(&compressed[0], load.compressedSize) != load.compressedSize ||
+        !DecompressData(&load.data[0], load.data.size(), &compressed[0], load.compressedSize))
+        return false;
+
+    return TranscodePage(load.data, load.pageFormat, load.cacheFormat);
+}
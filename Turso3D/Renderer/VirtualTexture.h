@@ -0,0 +1,206 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntRect.h"
+#include "../Object/AutoPtr.h"
+#include "../Resource/Image.h"
+#include "../Thread/Future.h"
+
+#include <memory>
+
+class Texture;
+
+/// Page size of virtual textures in texels, excluding the borders.
+static const int VT_PAGE_SIZE = 128;
+/// Texels of border on each side of a virtual texture page, copied from the neighbouring pages so that filtering stays inside the page. A multiple of 4 to keep the pages block aligned.
+static const int VT_PAGE_BORDER = 4;
+/// Page size in the cache including the borders.
+static const int VT_PAGE_STRIDE = VT_PAGE_SIZE + 2 * VT_PAGE_BORDER;
+/// Maximum virtual texture size in pages on each side.
+static const int VT_MAX_PAGES = 1024;
+/// Default size of the physical page cache in pages on each side.
+static const int DEFAULT_VT_CACHE_PAGES = 16;
+/// Maximum size of the physical page cache in pages on each side.
+static const int MAX_VT_CACHE_PAGES = 64;
+/// Default maximum number of pages being read at once.
+static const size_t DEFAULT_VT_MAX_LOADS = 16;
+
+/// Page being read and transcoded in a worker thread.
+struct VirtualPageLoad
+{
+    /// Page index.
+    unsigned page;
+    /// Stream to read from, returned to the virtual texture's stream pool when finished.
+    AutoPtr<Stream> stream;
+    /// Offset of the compressed page data in the stream.
+    size_t offset;
+    /// Size of the compressed page data.
+    size_t compressedSize;
+    /// Stored page format.
+    ImageFormat pageFormat;
+    /// Cache format to transcode to.
+    ImageFormat cacheFormat;
+    /// Page data in the cache format.
+    std::vector<unsigned char> data;
+};
+
+/// Texture of up to VT_MAX_PAGES * VT_PAGE_SIZE texels per side, of which only the pages needed by the view are resident on the GPU. The pages of all mip levels are stored compressed in a cooked file, read through the resource cache so that they can come from a package file, and decompressed or transcoded to the cache format in worker threads. The resident pages live in a physical cache atlas texture, evicting the least recently needed ones, and a page table texture with a mip level per virtual mip level points each page to the finest resident page covering it. The renderer's opaque pass writes the pages needed to a low resolution feedback image, which is read back asynchronously to request the pages. The coarsest mip level is always resident, so sampling falls back to it while finer pages stream in. Assigned to a material texture unit with Material::SetVirtualTexture().
+class VirtualTexture : public Resource
+{
+    OBJECT(VirtualTexture);
+
+public:
+    /// Construct.
+    VirtualTexture();
+    /// Destruct.
+    ~VirtualTexture();
+
+    /// Register object factory.
+    static void RegisterObject();
+
+    /// Load the page layout and the coarsest mip level pages from a stream. Return true on success.
+    bool BeginLoad(Stream& source) override;
+    /// Create the page table and cache textures and upload the coarsest mip level pages. Return true on success.
+    bool EndLoad() override;
+
+    /// Cook an 8-bit RGBA image into the paged format, generating the mip levels. The image dimensions must be power of two multiples of VT_PAGE_SIZE. Pages are stored as RGBA8, DXT1 or DXT5. Return true on success.
+    static bool Cook(Stream& dest, const Image& image, ImageFormat pageFormat = FMT_RGBA8, MipFilter filter = MIP_FILTER_BOX, bool srgb = false);
+
+    /// Set the physical page cache size in pages on each side, up to MAX_VT_CACHE_PAGES. Resident pages other than the coarsest mip level are dropped. Default DEFAULT_VT_CACHE_PAGES.
+    void SetCachePages(int pagesPerSide);
+    /// Set the cache format. Pages stored as RGBA8 can be transcoded to DXT1 or DXT5, and pages stored block compressed to RGBA8, in the worker threads. FMT_NONE (default) to use the stored page format. Resident pages other than the coarsest mip level are dropped.
+    void SetCacheFormat(ImageFormat format);
+    /// Set the maximum number of pages being read at once. Default DEFAULT_VT_MAX_LOADS.
+    void SetMaxLoads(size_t maxLoads);
+    /// Request a page needed by the view. The page's coarser ancestors are marked used as well, and requested if not resident.
+    void RequestPage(unsigned level, unsigned x, unsigned y, unsigned frameNumber);
+    /// Upload the pages read since the last call within the byte budget, start reading the requested pages coarsest first, and update the page table. Call once per frame from the main thread. Return the number of bytes uploaded.
+    size_t Update(size_t uploadBudget);
+    /// Drop all resident pages other than the coarsest mip level.
+    void EvictPages();
+
+    /// Return the cache texture, sampled through the page table.
+    Texture* CacheTexture() const { return cacheTexture; }
+    /// Return the page table texture.
+    Texture* PageTableTexture() const { return pageTableTexture; }
+    /// Return the virtual texture size in texels.
+    const IntVector2& Size() const { return size; }
+    /// Return the number of mip levels.
+    unsigned NumLevels() const { return numLevels; }
+    /// Return the stored page format.
+    ImageFormat PageFormat() const { return pageFormat; }
+    /// Return the cache format.
+    ImageFormat CacheFormat() const { return cacheFormat; }
+    /// Return the cache size in pages on each side.
+    int CachePages() const { return cachePages; }
+    /// Return the maximum number of pages being read at once.
+    size_t MaxLoads() const { return maxLoads; }
+    /// Return the number of pages resident in the cache.
+    size_t NumResidentPages() const { return numResidentPages; }
+    /// Return the number of pages being read.
+    size_t NumLoadingPages() const { return loads.size(); }
+    /// Return the ID written to the feedback, from 1 to 255, or zero if out of IDs.
+    unsigned char Id() const { return id; }
+    /// Return whether the textures have been created and the coarsest mip level uploaded.
+    bool IsReady() const override;
+    /// Return the size of the page layout and the resident page bookkeeping in CPU memory.
+    size_t CpuMemoryUse() const override;
+    /// Return the size of the cache and page table textures in GPU memory.
+    size_t GpuMemoryUse() const override;
+
+    /// Request the pages written to a feedback image read back from the GPU, as RG32U texels. Zero texels are skipped.
+    static void ProcessFeedback(const unsigned* texels, size_t numTexels, unsigned frameNumber);
+    /// Return a virtual texture by feedback ID, or null if none.
+    static VirtualTexture* FromId(unsigned char id) { return id ? idTable[id] : nullptr; }
+    /// Return all virtual textures.
+    static const std::vector<VirtualTexture*>& AllVirtualTextures() { return allVirtualTextures; }
+
+private:
+    /// Return the index of a page.
+    unsigned PageIndex(unsigned level, unsigned x, unsigned y) const { return levelOffsets[level] + y * (pagesX >> level) + x; }
+    /// Return the mip level of a page index.
+    unsigned PageLevel(unsigned page) const;
+    /// Return whether a page belongs to the coarsest mip level, which is never evicted.
+    bool IsPinned(unsigned page) const { return page >= levelOffsets[numLevels - 1]; }
+    /// Define the cache texture and upload the coarsest mip level pages, dropping the other resident pages. Return true on success.
+    bool DefineCache();
+    /// Return a free cache slot, evicting the least recently used page that was not needed by the latest feedback. Return NO_SLOT if none.
+    unsigned short AllocateSlot();
+    /// Upload page data in the cache format to a slot and make the page resident.
+    void UploadPage(unsigned page, unsigned short slot, const unsigned char* data);
+    /// Make a page non-resident and free its slot.
+    void EvictPage(unsigned page);
+    /// Mark the page table entries covered by a page to be updated.
+    void MarkPageTableDirty(unsigned page);
+    /// Recalculate and upload the dirty page table entries, coarsest mip level first.
+    void UpdatePageTable();
+    /// Return the data size of a page in a format.
+    static size_t PageDataSize(ImageFormat format);
+    /// Convert page data from one format to another. Return true on success.
+    static bool TranscodePage(std::vector<unsigned char>& data, ImageFormat fromFormat, ImageFormat toFormat);
+    /// Read, decompress and transcode a page in a worker thread. Return true on success.
+    static bool ReadPage(VirtualPageLoad& load);
+
+    /// Cache texture.
+    SharedPtr<Texture> cacheTexture;
+    /// Page table texture.
+    SharedPtr<Texture> pageTableTexture;
+    /// Virtual texture size in texels.
+    IntVector2 size;
+    /// Number of pages horizontally at the finest mip level.
+    unsigned pagesX;
+    /// Number of pages vertically at the finest mip level.
+    unsigned pagesY;
+    /// Number of mip levels.
+    unsigned numLevels;
+    /// Stored page format.
+    ImageFormat pageFormat;
+    /// Cache format.
+    ImageFormat cacheFormat;
+    /// Requested cache format, or FMT_NONE to use the page format.
+    ImageFormat requestedCacheFormat;
+    /// Cache size in pages on each side.
+    int cachePages;
+    /// Maximum number of pages being read at once.
+    size_t maxLoads;
+    /// Index of the first page of each mip level.
+    std::vector<unsigned> levelOffsets;
+    /// Offsets of the compressed page data in the file, with the end of the last page appended.
+    std::vector<unsigned long long> pageOffsets;
+    /// Cache slot of each page, or NO_SLOT / LOADING_SLOT.
+    std::vector<unsigned short> pageSlots;
+    /// Frame number of the latest request of each page.
+    std::vector<unsigned> pageRequests;
+    /// Page in each cache slot, or NO_PAGE.
+    std::vector<unsigned> slotPages;
+    /// Frame number of the latest use of each cache slot.
+    std::vector<unsigned> slotUses;
+    /// Free cache slots.
+    std::vector<unsigned short> freeSlots;
+    /// Coarsest mip level pages in the stored format, kept for redefining the cache.
+    std::vector<std::vector<unsigned char> > pinnedPages;
+    /// Page table entries by mip level: cache slot X and Y, the resident page's mip level and the ID.
+    std::vector<std::vector<unsigned> > pageTable;
+    /// Page table rectangles to update by mip level.
+    std::vector<IntRect> dirtyRects;
+    /// Pages requested since the last update.
+    std::vector<unsigned> requests;
+    /// Pages being read, with the results of the reads.
+    std::vector<std::pair<std::shared_ptr<VirtualPageLoad>, Future<bool> > > loads;
+    /// Opened streams for reading pages.
+    std::vector<AutoPtr<Stream> > streamPool;
+    /// Scratch buffer for page table and page uploads.
+    std::vector<unsigned char> uploadBuffer;
+    /// Frame number of the latest feedback.
+    unsigned feedbackFrame;
+    /// Number of resident pages.
+    size_t numResidentPages;
+    /// Feedback ID.
+    unsigned char id;
+
+    /// Virtual textures by feedback ID.
+    static VirtualTexture* idTable[256];
+    /// All virtual textures.
+    static std::vector<VirtualTexture*> allVirtualTextures;
+};
@@ -0,0 +1,413 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Math.h"
+#include "Compress.h"
+
+#include <algorithm>
+#include <cstring>
+
+/// BC7 4-bit index interpolation weights out of 64.
+static const unsigned bc7Weights[] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+/// Power iterations for finding the principal axis of a block.
+static const int AXIS_ITERATIONS = 8;
+
+/// Copy a 4x4 block of RGBA pixels, replicating the edge pixels for blocks that extend past the image.
+static void GatherBlock(unsigned char* pixels, const unsigned char* rgba, int width, int height, int x, int y)
+{
+    for (int py = 0; py < 4; ++py)
+    {
+        int sy = Min(y + py, height - 1);
+        for (int px = 0; px < 4; ++px)
+        {
+            int sx = Min(x + px, width - 1);
+            memcpy(pixels + (py * 4 + px) * 4, rgba + (sy * width + sx) * 4, 4);
+        }
+    }
+}
+
+/// Fit line endpoints to the block pixels along their principal axis. Pixels with alpha below 128 are skipped if requested. Return false if no pixels were included.
+static bool FitEndpoints(const unsigned char* pixels, int channels, bool skipTransparent, float* start, float* end)
+{
+    float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    int count = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        if (skipTransparent && pixels[i * 4 + 3] < 128)
+            continue;
+        for (int c = 0; c < channels; ++c)
+            mean[c] += pixels[i * 4 + c];
+        ++count;
+    }
+    if (!count)
+        return false;
+
+    for (int c = 0; c < channels; ++c)
+        mean[c] /= (float)count;
+
+    float covariance[4][4];
+    memset(covariance, 0, sizeof covariance);
+    for (int i = 0; i < 16; ++i)
+    {
+        if (skipTransparent && pixels[i * 4 + 3] < 128)
+            continue;
+        for (int c = 0; c < channels; ++c)
+        {
+            for (int d = 0; d < channels; ++d)
+                covariance[c][d] += (pixels[i * 4 + c] - mean[c]) * (pixels[i * 4 + d] - mean[d]);
+        }
+    }
+
+    float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    for (int i = 0; i < AXIS_ITERATIONS; ++i)
+    {
+        float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        float largest = 0.0f;
+        for (int c = 0; c < channels; ++c)
+        {
+            for (int d = 0; d < channels; ++d)
+                next[c] += covariance[c][d] * axis[d];
+            largest = Max(largest, Abs(next[c]));
+        }
+        // Flat block, endpoints collapse to the mean
+        if (largest < M_EPSILON)
+            break;
+        for (int c = 0; c < channels; ++c)
+            axis[c] = next[c] / largest;
+    }
+
+    float lengthSquared = 0.0f;
+    for (int c = 0; c < channels; ++c)
+        lengthSquared += axis[c] * axis[c];
+    for (int c = 0; c < channels; ++c)
+        axis[c] /= sqrtf(lengthSquared);
+
+    float minT = 0.0f;
+    float maxT = 0.0f;
+    for (int i = 0; i < 16; ++i)
+    {
+        if (skipTransparent && pixels[i * 4 + 3] < 128)
+            continue;
+        float t = 0.0f;
+        for (int c = 0; c < channels; ++c)
+            t += (pixels[i * 4 + c] - mean[c]) * axis[c];
+        minT = Min(minT, t);
+        maxT = Max(maxT, t);
+    }
+
+    for (int c = 0; c < channels; ++c)
+    {
+        start[c] = Clamp(mean[c] + axis[c] * minT, 0.0f, 255.0f);
+        end[c] = Clamp(mean[c] + axis[c] * maxT, 0.0f, 255.0f);
+    }
+
+    return true;
+}
+
+/// Quantize an 8-bit RGB color to 565.
+static unsigned Pack565(const float* color)
+{
+    unsigned red = (unsigned)(color[0] * 31.0f / 255.0f + 0.5f);
+    unsigned green = (unsigned)(color[1] * 63.0f / 255.0f + 0.5f);
+    unsigned blue = (unsigned)(color[2] * 31.0f / 255.0f + 0.5f);
+    return (red << 11) | (green << 5) | blue;
+}
+
+/// Expand a 565 color to 8-bit RGB.
+static void Unpack565(unsigned value, int* color)
+{
+    int red = (value >> 11) & 0x1f;
+    int green = (value >> 5) & 0x3f;
+    int blue = value & 0x1f;
+    color[0] = (red << 3) | (red >> 2);
+    color[1] = (green << 2) | (green >> 4);
+    color[2] = (blue << 3) | (blue >> 2);
+}
+
+/// Encode the color part of a DXT block. Punch-through alpha is only used for DXT1.
+static void EncodeColorBlockDXT(unsigned char* dest, const unsigned char* pixels, bool isDxt1)
+{
+    bool transparent = false;
+    if (isDxt1)
+    {
+        for (int i = 0; i < 16; ++i)
+            transparent |= pixels[i * 4 + 3] < 128;
+    }
+
+    float start[3];
+    float end[3];
+    unsigned color0 = 0;
+    unsigned color1 = 0;
+    if (FitEndpoints(pixels, 3, transparent, start, end))
+    {
+        color0 = Pack565(end);
+        color1 = Pack565(start);
+    }
+
+    // The endpoint order selects between 4 color and 3 color + transparent modes
+    if ((transparent && color0 > color1) || (!transparent && color0 < color1))
+        std::swap(color0, color1);
+
+    int codes[4][3];
+    Unpack565(color0, codes[0]);
+    Unpack565(color1, codes[1]);
+    int numCodes = 4;
+    for (int c = 0; c < 3; ++c)
+    {
+        if (transparent)
+            codes[2][c] = (codes[0][c] + codes[1][c]) / 2;
+        else
+        {
+            codes[2][c] = (2 * codes[0][c] + codes[1][c]) / 3;
+            codes[3][c] = (codes[0][c] + 2 * codes[1][c]) / 3;
+        }
+    }
+    if (transparent)
+        numCodes = 3;
+    else if (color0 == color1)
+        numCodes = 1;
+
+    unsigned indices = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        const unsigned char* pixel = pixels + i * 4;
+        unsigned best = 0;
+
+        if (transparent && pixel[3] < 128)
+            best = 3;
+        else
+        {
+            int bestError = M_MAX_INT;
+            for (int j = 0; j < numCodes; ++j)
+            {
+                int dr = pixel[0] - codes[j][0];
+                int dg = pixel[1] - codes[j][1];
+                int db = pixel[2] - codes[j][2];
+                int error = dr * dr + dg * dg + db * db;
+                if (error < bestError)
+                {
+                    bestError = error;
+                    best = j;
+                }
+            }
+        }
+
+        indices |= best << (i * 2);
+    }
+
+    dest[0] = (unsigned char)(color0 & 0xff);
+    dest[1] = (unsigned char)(color0 >> 8);
+    dest[2] = (unsigned char)(color1 & 0xff);
+    dest[3] = (unsigned char)(color1 >> 8);
+    for (int i = 0; i < 4; ++i)
+        dest[4 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+/// Encode an interpolated DXT5 alpha block.
+static void EncodeAlphaBlockDXT5(unsigned char* dest, const unsigned char* pixels)
+{
+    int alpha0 = 0;
+    int alpha1 = 255;
+    for (int i = 0; i < 16; ++i)
+    {
+        alpha0 = Max(alpha0, (int)pixels[i * 4 + 3]);
+        alpha1 = Min(alpha1, (int)pixels[i * 4 + 3]);
+    }
+
+    // Alpha0 greater than alpha1 selects the 8 value mode
+    int codes[8];
+    codes[0] = alpha0;
+    codes[1] = alpha1;
+    for (int i = 1; i < 7; ++i)
+        codes[1 + i] = ((7 - i) * alpha0 + i * alpha1) / 7;
+    int numCodes = alpha0 > alpha1 ? 8 : 1;
+
+    unsigned long long indices = 0;
+    for (int i = 0; i < 16; ++i)
+    {
+        int alpha = pixels[i * 4 + 3];
+        unsigned long long best = 0;
+        int bestError = M_MAX_INT;
+        for (int j = 0; j < numCodes; ++j)
+        {
+            int error = Abs(alpha - codes[j]);
+            if (error < bestError)
+            {
+                bestError = error;
+                best = j;
+            }
+        }
+
+        indices |= best << (i * 3);
+    }
+
+    dest[0] = (unsigned char)alpha0;
+    dest[1] = (unsigned char)alpha1;
+    for (int i = 0; i < 6; ++i)
+        dest[2 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+/// Encode an explicit DXT3 alpha block.
+static void EncodeAlphaBlockDXT3(unsigned char* dest, const unsigned char* pixels)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        unsigned lo = (pixels[i * 8 + 3] * 15 + 127) / 255;
+        unsigned hi = (pixels[i * 8 + 7] * 15 + 127) / 255;
+        dest[i] = (unsigned char)(lo | (hi << 4));
+    }
+}
+
+/// Quantize an 8-bit RGBA endpoint to 7 bits per channel and a shared p-bit, choosing the p-bit with the smaller error.
+static void QuantizeEndpointBC7(const float* endpoint, unsigned* quantized, unsigned& pBit)
+{
+    float bestError = M_INFINITY;
+    for (unsigned p = 0; p < 2; ++p)
+    {
+        unsigned values[4];
+        float error = 0.0f;
+        for (int c = 0; c < 4; ++c)
+        {
+            values[c] = (unsigned)Clamp((int)((endpoint[c] - (float)p) * 0.5f + 0.5f), 0, 127);
+            float difference = (float)((values[c] << 1) | p) - endpoint[c];
+            error += difference * difference;
+        }
+
+        if (error < bestError)
+        {
+            bestError = error;
+            pBit = p;
+            memcpy(quantized, values, sizeof values);
+        }
+    }
+}
+
+/// Sequential little-endian bit writer for a 128-bit block.
+struct BlockBitWriter
+{
+    /// Construct.
+    BlockBitWriter(unsigned char* dest_) :
+        dest(dest_),
+        position(0)
+    {
+        memset(dest, 0, 16);
+    }
+
+    /// Write the lowest bits of a value.
+    void Write(unsigned value, unsigned numBits)
+    {
+        for (unsigned i = 0; i < numBits; ++i, ++position)
+            dest[position >> 3] |= (unsigned char)(((value >> i) & 1) << (position & 7));
+    }
+
+    /// Destination block.
+    unsigned char* dest;
+    /// Bit position.
+    unsigned position;
+};
+
+/// Encode a BC7 block in mode 6: one subset, 7-bit RGBA endpoints with p-bits and 4-bit indices.
+static void EncodeBlockBC7(unsigned char* dest, const unsigned char* pixels)
+{
+    float start[4];
+    float end[4];
+    FitEndpoints(pixels, 4, false, start, end);
+
+    unsigned endpoints[2][4];
+    unsigned pBits[2] = { 0, 0 };
+    QuantizeEndpointBC7(start, endpoints[0], pBits[0]);
+    QuantizeEndpointBC7(end, endpoints[1], pBits[1]);
+
+    int codes[16][4];
+    for (int c = 0; c < 4; ++c)
+    {
+        int e0 = (int)((endpoints[0][c] << 1) | pBits[0]);
+        int e1 = (int)((endpoints[1][c] << 1) | pBits[1]);
+        for (int i = 0; i < 16; ++i)
+            codes[i][c] = ((64 - bc7Weights[i]) * e0 + bc7Weights[i] * e1 + 32) >> 6;
+    }
+
+    unsigned indices[16];
+    for (int i = 0; i < 16; ++i)
+    {
+        const unsigned char* pixel = pixels + i * 4;
+        int bestError = M_MAX_INT;
+        for (unsigned j = 0; j < 16; ++j)
+        {
+            int error = 0;
+            for (int c = 0; c < 4; ++c)
+                error += (pixel[c] - codes[j][c]) * (pixel[c] - codes[j][c]);
+            if (error < bestError)
+            {
+                bestError = error;
+                indices[i] = j;
+            }
+        }
+    }
+
+    // The first index is stored without its highest bit, so swap the endpoints if it is set
+    if (indices[0] & 8)
+    {
+        for (int c = 0; c < 4; ++c)
+            std::swap(endpoints[0][c], endpoints[1][c]);
+        std::swap(pBits[0], pBits[1]);
+        for (int i = 0; i < 16; ++i)
+            indices[i] = 15 - indices[i];
+    }
+
+    BlockBitWriter writer(dest);
+    writer.Write(1 << 6, 7);
+    for (int c = 0; c < 4; ++c)
+    {
+        writer.Write(endpoints[0][c], 7);
+        writer.Write(endpoints[1][c], 7);
+    }
+    writer.Write(pBits[0], 1);
+    writer.Write(pBits[1], 1);
+    writer.Write(indices[0], 3);
+    for (int i = 1; i < 16; ++i)
+        writer.Write(indices[i], 4);
+}
+
+void CompressImageDXT(unsigned char* dest, const unsigned char* rgba, int width, int height, ImageFormat format)
+{
+    unsigned char pixels[64];
+
+    for (int y = 0; y < height; y += 4)
+    {
+        for (int x = 0; x < width; x += 4)
+        {
+            GatherBlock(pixels, rgba, width, height, x, y);
+
+            if (format == FMT_DXT1)
+            {
+                EncodeColorBlockDXT(dest, pixels, true);
+                dest += 8;
+            }
+            else
+            {
+                if (format == FMT_DXT3)
+                    EncodeAlphaBlockDXT3(dest, pixels);
+                else
+                    EncodeAlphaBlockDXT5(dest, pixels);
+                EncodeColorBlockDXT(dest + 8, pixels, false);
+                dest += 16;
+            }
+        }
+    }
+}
+
+void CompressImageBC7(unsigned char* dest, const unsigned char* rgba, int width, int height)
+{
+    unsigned char pixels[64];
+
+    for (int y = 0; y < height; y += 4)
+    {
+        for (int x = 0; x < width; x += 4)
+        {
+            GatherBlock(pixels, rgba, width, height, x, y);
+            EncodeBlockBC7(dest, pixels);
+            dest += 16;
+        }
+    }
+}
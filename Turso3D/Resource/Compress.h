@@ -0,0 +1,10 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Image.h"
+
+/// Compress 8-bit RGBA image data to DXT1/3/5. DXT1 uses punch-through alpha for pixels with alpha below 128.
+void CompressImageDXT(unsigned char* dest, const unsigned char* rgba, int width, int height, ImageFormat format);
+/// Compress 8-bit RGBA image data to BC7, using the single subset RGBA mode only.
+void CompressImageBC7(unsigned char* dest, const unsigned char* rgba, int width, int height);
@@ -4,7 +4,15 @@
 
 #include <cstring>
 
-// DXT decompression based on the Squish library
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TURSO3D_DECOMPRESS_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TURSO3D_DECOMPRESS_NEON
+#endif
+
+// DXT codebook construction based on the Squish library
 
 /* -----------------------------------------------------------------------------
 
@@ -31,212 +39,177 @@
 
    -------------------------------------------------------------------------- */
 
-static int Unpack565( unsigned char const* packed, unsigned char* colour )
+/// Unpack a 565 color to 8-bit RGBA with full alpha as a little-endian 32-bit value. Return the packed 16-bit value.
+static unsigned Unpack565(const unsigned char* packed, unsigned& color)
 {
-    // build the packed value
-    int value = ( int )packed[0] | ( ( int )packed[1] << 8 );
-
-    // get the components in the stored range
-    unsigned char red = ( unsigned char )( ( value >> 11 ) & 0x1f );
-    unsigned char green = ( unsigned char )( ( value >> 5 ) & 0x3f );
-    unsigned char blue = ( unsigned char )( value & 0x1f );
+    unsigned value = (unsigned)packed[0] | ((unsigned)packed[1] << 8);
 
-    // scale up to 8 bits
-    colour[0] = ( red << 3 ) | ( red >> 2 );
-    colour[1] = ( green << 2 ) | ( green >> 4 );
-    colour[2] = ( blue << 3 ) | ( blue >> 2 );
-    colour[3] = 255;
+    unsigned red = (value >> 11) & 0x1f;
+    unsigned green = (value >> 5) & 0x3f;
+    unsigned blue = value & 0x1f;
 
-    // return the value
+    color = ((red << 3) | (red >> 2)) | (((green << 2) | (green >> 4)) << 8) | (((blue << 3) | (blue >> 2)) << 16) | 0xff000000;
     return value;
 }
 
-static void DecompressColourDXT( unsigned char* rgba, void const* block, bool isDxt1 )
+/// Build the four color codebook of a DXT color block.
+static void DecodeColorCodesDXT(const unsigned char* bytes, bool isDxt1, unsigned* codes)
 {
-    // get the block bytes
-    unsigned char const* bytes = reinterpret_cast< unsigned char const* >( block );
+    unsigned a = Unpack565(bytes, codes[0]);
+    unsigned b = Unpack565(bytes + 2, codes[1]);
+    codes[2] = 0xff000000;
+    codes[3] = (isDxt1 && a <= b) ? 0 : 0xff000000;
 
-    // unpack the endpoints
-    unsigned char codes[16];
-    int a = Unpack565( bytes, codes );
-    int b = Unpack565( bytes + 2, codes + 4 );
-
-    // generate the midpoints
-    for( int i = 0; i < 3; ++i )
+    for (unsigned i = 0; i < 24; i += 8)
     {
-        int c = codes[i];
-        int d = codes[4 + i];
+        unsigned c = (codes[0] >> i) & 0xff;
+        unsigned d = (codes[1] >> i) & 0xff;
 
-        if( isDxt1 && a <= b )
-        {
-            codes[8 + i] = ( unsigned char )( ( c + d )/2 );
-            codes[12 + i] = 0;
-        }
+        if (isDxt1 && a <= b)
+            codes[2] |= ((c + d) / 2) << i;
         else
         {
-            codes[8 + i] = ( unsigned char )( ( 2*c + d )/3 );
-            codes[12 + i] = ( unsigned char )( ( c + 2*d )/3 );
+            codes[2] |= ((2 * c + d) / 3) << i;
+            codes[3] |= ((c + 2 * d) / 3) << i;
         }
     }
-
-    // fill in alpha for the intermediate values
-    codes[8 + 3] = 255;
-    codes[12 + 3] = ( isDxt1 && a <= b ) ? 0 : 255;
-
-    // unpack the indices
-    unsigned char indices[16];
-    for( int i = 0; i < 4; ++i )
-    {
-        unsigned char* ind = indices + 4*i;
-        unsigned char packed = bytes[4 + i];
-
-        ind[0] = packed & 0x3;
-        ind[1] = ( packed >> 2 ) & 0x3;
-        ind[2] = ( packed >> 4 ) & 0x3;
-        ind[3] = ( packed >> 6 ) & 0x3;
-    }
-
-    // store out the colours
-    for( int i = 0; i < 16; ++i )
-    {
-        unsigned char offset = 4*indices[i];
-        for( int j = 0; j < 4; ++j )
-            rgba[4*i + j] = codes[offset + j];
-    }
 }
 
-static void DecompressAlphaDXT3( unsigned char* rgba, void const* block )
+/// Build the alpha values of a DXT5 alpha block, shifted to the alpha byte of a 32-bit pixel.
+static void DecodeAlphaDXT5(const unsigned char* bytes, unsigned* alphas)
 {
-    unsigned char const* bytes = reinterpret_cast< unsigned char const* >( block );
-
-    // unpack the alpha values pairwise
-    for( int i = 0; i < 8; ++i )
-    {
-        // quantise down to 4 bits
-        unsigned char quant = bytes[i];
-
-        // unpack the values
-        unsigned char lo = quant & 0x0f;
-        unsigned char hi = quant & 0xf0;
-
-        // convert back up to bytes
-        rgba[8*i + 3] = lo | ( lo << 4 );
-        rgba[8*i + 7] = hi | ( hi >> 4 );
-    }
-}
-
-static void DecompressAlphaDXT5( unsigned char* rgba, void const* block )
-{
-    // get the two alpha values
-    unsigned char const* bytes = reinterpret_cast< unsigned char const* >( block );
-    int alpha0 = bytes[0];
-    int alpha1 = bytes[1];
-
-    // compare the values to build the codebook
-    unsigned char codes[8];
-    codes[0] = ( unsigned char )alpha0;
-    codes[1] = ( unsigned char )alpha1;
-    if( alpha0 <= alpha1 )
-    {
-        // use 5-alpha codebook
-        for( int i = 1; i < 5; ++i )
-            codes[1 + i] = ( unsigned char )( ( ( 5 - i )*alpha0 + i*alpha1 )/5 );
+    unsigned codes[8];
+    unsigned alpha0 = bytes[0];
+    unsigned alpha1 = bytes[1];
+    codes[0] = alpha0;
+    codes[1] = alpha1;
+    if (alpha0 <= alpha1)
+    {
+        for (unsigned i = 1; i < 5; ++i)
+            codes[1 + i] = ((5 - i) * alpha0 + i * alpha1) / 5;
         codes[6] = 0;
         codes[7] = 255;
     }
     else
     {
-        // use 7-alpha codebook
-        for( int i = 1; i < 7; ++i )
-            codes[1 + i] = ( unsigned char )( ( ( 7 - i )*alpha0 + i*alpha1 )/7 );
+        for (unsigned i = 1; i < 7; ++i)
+            codes[1 + i] = ((7 - i) * alpha0 + i * alpha1) / 7;
     }
 
-    // decode the indices
-    unsigned char indices[16];
-    unsigned char const* src = bytes + 2;
-    unsigned char* dest = indices;
-    for( int i = 0; i < 2; ++i )
-    {
-        // grab 3 bytes
-        int value = 0;
-        for( int j = 0; j < 3; ++j )
-        {
-            int byte = *src++;
-            value |= ( byte << 8*j );
-        }
+    // 16 3-bit indices in 6 bytes
+    unsigned long long bits = 0;
+    for (unsigned i = 0; i < 6; ++i)
+        bits |= (unsigned long long)bytes[2 + i] << (8 * i);
+    for (unsigned i = 0; i < 16; ++i)
+        alphas[i] = codes[(bits >> (3 * i)) & 0x7] << 24;
+}
 
-        // unpack 8 3-bit values from it
-        for( int j = 0; j < 8; ++j )
+/// Decode a DXT block as 32-bit pixels with the given row stride in pixels.
+static void DecodeBlockDXT(unsigned* dest, size_t stride, const unsigned char* block, ImageFormat format)
+{
+    unsigned alphas[16];
+    if (format == FMT_DXT3)
+    {
+        for (unsigned i = 0; i < 8; ++i)
         {
-            int index = ( value >> 3*j ) & 0x7;
-            *dest++ = ( unsigned char )index;
+            unsigned lo = block[i] & 0x0f;
+            unsigned hi = block[i] & 0xf0;
+            alphas[i * 2] = (lo | (lo << 4)) << 24;
+            alphas[i * 2 + 1] = (hi | (hi >> 4)) << 24;
         }
     }
-
-    // write out the indexed codebook values
-    for( int i = 0; i < 16; ++i )
-        rgba[4*i + 3] = codes[indices[i]];
-}
-
-static void DecompressDXT( unsigned char* rgba, const void* block, ImageFormat format)
-{
-    // get the block locations
-    void const* colourBlock = block;
-    void const* alphaBock = block;
-    if( format == FMT_DXT3 || format == FMT_DXT5)
-        colourBlock = reinterpret_cast< unsigned char const* >( block ) + 8;
-
-    // decompress colour
-    DecompressColourDXT( rgba, colourBlock, format == FMT_DXT1 );
-
-    // decompress alpha separately if necessary
-    if( format == FMT_DXT3 )
-        DecompressAlphaDXT3( rgba, alphaBock );
-    else if ( format == FMT_DXT5 )
-        DecompressAlphaDXT5( rgba, alphaBock );
+    else if (format == FMT_DXT5)
+        DecodeAlphaDXT5(block, alphas);
+
+    const unsigned char* colorBlock = format == FMT_DXT1 ? block : block + 8;
+    unsigned codes[4];
+    DecodeColorCodesDXT(colorBlock, format == FMT_DXT1, codes);
+
+    // Alpha of separately stored blocks replaces the codebook alpha
+    if (format != FMT_DXT1)
+    {
+        for (unsigned i = 0; i < 4; ++i)
+            codes[i] &= 0xffffff;
+    }
+
+    #if defined(TURSO3D_DECOMPRESS_SSE)
+    // Select codebook entries by comparing each pixel's 2-bit index in place, avoiding scalar lookups
+    const __m128i laneMask = _mm_setr_epi32(0x3, 0xc, 0x30, 0xc0);
+    const __m128i index1 = _mm_setr_epi32(0x1, 0x4, 0x10, 0x40);
+    const __m128i index2 = _mm_setr_epi32(0x2, 0x8, 0x20, 0x80);
+    __m128i code0 = _mm_set1_epi32((int)codes[0]);
+    __m128i code1 = _mm_set1_epi32((int)codes[1]);
+    __m128i code2 = _mm_set1_epi32((int)codes[2]);
+    __m128i code3 = _mm_set1_epi32((int)codes[3]);
+
+    for (unsigned y = 0; y < 4; ++y)
+    {
+        __m128i indices = _mm_and_si128(_mm_set1_epi32(colorBlock[4 + y]), laneMask);
+        __m128i pixels = _mm_or_si128(
+            _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(indices, _mm_setzero_si128()), code0), _mm_and_si128(_mm_cmpeq_epi32(indices, index1), code1)),
+            _mm_or_si128(_mm_and_si128(_mm_cmpeq_epi32(indices, index2), code2), _mm_and_si128(_mm_cmpeq_epi32(indices, laneMask), code3)));
+        if (format != FMT_DXT1)
+            pixels = _mm_or_si128(pixels, _mm_loadu_si128(reinterpret_cast<const __m128i*>(alphas + y * 4)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + y * stride), pixels);
+    }
+    #elif defined(TURSO3D_DECOMPRESS_NEON)
+    const uint32_t laneMaskValues[4] = { 0x3, 0xc, 0x30, 0xc0 };
+    const uint32_t index1Values[4] = { 0x1, 0x4, 0x10, 0x40 };
+    const uint32_t index2Values[4] = { 0x2, 0x8, 0x20, 0x80 };
+    uint32x4_t laneMask = vld1q_u32(laneMaskValues);
+    uint32x4_t index1 = vld1q_u32(index1Values);
+    uint32x4_t index2 = vld1q_u32(index2Values);
+    uint32x4_t code0 = vdupq_n_u32(codes[0]);
+    uint32x4_t code1 = vdupq_n_u32(codes[1]);
+    uint32x4_t code2 = vdupq_n_u32(codes[2]);
+    uint32x4_t code3 = vdupq_n_u32(codes[3]);
+
+    for (unsigned y = 0; y < 4; ++y)
+    {
+        uint32x4_t indices = vandq_u32(vdupq_n_u32(colorBlock[4 + y]), laneMask);
+        uint32x4_t pixels = vorrq_u32(
+            vorrq_u32(vandq_u32(vceqq_u32(indices, vdupq_n_u32(0)), code0), vandq_u32(vceqq_u32(indices, index1), code1)),
+            vorrq_u32(vandq_u32(vceqq_u32(indices, index2), code2), vandq_u32(vceqq_u32(indices, laneMask), code3)));
+        if (format != FMT_DXT1)
+            pixels = vorrq_u32(pixels, vld1q_u32(alphas + y * 4));
+        vst1q_u32(dest + y * stride, pixels);
+    }
+    #else
+    for (unsigned y = 0; y < 4; ++y)
+    {
+        unsigned packed = colorBlock[4 + y];
+        unsigned* row = dest + y * stride;
+        for (unsigned x = 0; x < 4; ++x)
+            row[x] = codes[(packed >> (2 * x)) & 0x3] | (format != FMT_DXT1 ? alphas[y * 4 + x] : 0);
+    }
+    #endif
 }
 
-void DecompressImageDXT( unsigned char* rgba, const void* blocks, int width, int height, ImageFormat format )
+void DecompressImageDXT(unsigned char* rgba, const void* blocks, int width, int height, ImageFormat format)
 {
-    // initialise the block input
-    unsigned char const* sourceBlock = reinterpret_cast< unsigned char const* >( blocks );
+    const unsigned char* sourceBlock = reinterpret_cast<const unsigned char*>(blocks);
     int bytesPerBlock = format == FMT_DXT1 ? 8 : 16;
+    unsigned* dest = reinterpret_cast<unsigned*>(rgba);
 
-    // loop over blocks
-    for( int y = 0; y < height; y += 4 )
+    for (int y = 0; y < height; y += 4)
     {
-        for( int x = 0; x < width; x += 4 )
+        for (int x = 0; x < width; x += 4)
         {
-            // decompress the block
-            unsigned char targetRgba[4*16];
-            DecompressDXT( targetRgba, sourceBlock, format );
-
-            // write the decompressed pixels to the correct image locations
-            unsigned char const* sourcePixel = targetRgba;
-            for( int py = 0; py < 4; ++py )
+            // Full blocks are written directly, edge blocks through a temporary
+            if (x + 4 <= width && y + 4 <= height)
+                DecodeBlockDXT(dest + y * width + x, width, sourceBlock, format);
+            else
             {
-                for( int px = 0; px < 4; ++px )
-                {
-                    // get the target location
-                    int sx = x + px;
-                    int sy = y + py;
-                    if( sx < width && sy < height )
-                    {
-                        unsigned char* targetPixel = rgba + 4*( width*sy + sx );
+                unsigned pixels[16];
+                DecodeBlockDXT(pixels, 4, sourceBlock, format);
 
-                        // copy the rgba value
-                        for( int i = 0; i < 4; ++i )
-                            *targetPixel++ = *sourcePixel++;
-                    }
-                    else
-                    {
-                        // skip this pixel as its outside the image
-                        sourcePixel += 4;
-                    }
+                for (int py = 0; py < 4 && y + py < height; ++py)
+                {
+                    for (int px = 0; px < 4 && x + px < width; ++px)
+                        dest[(y + py) * width + x + px] = pixels[py * 4 + px];
                 }
             }
 
-            // advance
             sourceBlock += bytesPerBlock;
         }
     }
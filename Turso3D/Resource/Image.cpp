@@ -3,12 +3,23 @@
 #include "../IO/Log.h"
 #include "../IO/Stream.h"
 #include "../Math/Math.h"
+#include "../Thread/WorkQueue.h"
+#include "Compress.h"
 #include "Decompress.h"
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <tracy/Tracy.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TURSO3D_IMAGE_SSE
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TURSO3D_IMAGE_NEON
+#endif
+
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
@@ -25,6 +36,17 @@
 #define FOURCC_DXT4 (MAKEFOURCC('D','X','T','4'))
 #define FOURCC_DXT5 (MAKEFOURCC('D','X','T','5'))
 
+// Minimum amount of block rows per task when decompressing or compressing in parallel
+static const size_t MIN_PARALLEL_BLOCK_ROWS = 16;
+// Minimum amount of destination pixels per task when generating a mip image in parallel
+static const size_t MIN_PARALLEL_MIP_PIXELS = 16384;
+// Size of the linear to sRGB conversion table
+static const int SRGB_TABLE_SIZE = 4096;
+// Taps per axis of the Kaiser mip filter
+static const int KAISER_TAPS = 6;
+// Shape parameter of the Kaiser window
+static const float KAISER_ALPHA = 4.0f;
+
 const int Image::components[] =
 {
     0,      // FMT_NONE
@@ -51,6 +73,7 @@ const int Image::components[] =
     0,      // FMT_DXT1
     0,      // FMT_DXT3
     0,      // FMT_DXT5
+    0,      // FMT_BC7
     0,      // FMT_ETC1
     0,      // FMT_PVRTC_RGB_2BPP
     0,      // FMT_PVRTC_RGBA_2BPP
@@ -84,6 +107,7 @@ const size_t Image::pixelByteSizes[] =
     0,      // FMT_DXT1
     0,      // FMT_DXT3
     0,      // FMT_DXT5
+    0,      // FMT_BC7
     0,      // FMT_ETC1
     0,      // FMT_PVRTC_RGB_2BPP
     0,      // FMT_PVRTC_RGBA_2BPP
@@ -221,6 +245,213 @@ struct DDSurfaceDesc2
 };
 /// \endcond
 
+/// Linear and sRGB conversion tables for filtering 8-bit color channels in linear space.
+struct SrgbTables
+{
+    /// Construct.
+    SrgbTables()
+    {
+        for (int i = 0; i < 256; ++i)
+        {
+            float value = i / 255.0f;
+            toLinear[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+        }
+        for (int i = 0; i < SRGB_TABLE_SIZE; ++i)
+        {
+            float value = (float)i / (SRGB_TABLE_SIZE - 1);
+            value = value <= 0.0031308f ? value * 12.92f : 1.055f * powf(value, 1.0f / 2.4f) - 0.055f;
+            toSrgb[i] = (unsigned char)(value * 255.0f + 0.5f);
+        }
+    }
+
+    /// sRGB to linear.
+    float toLinear[256];
+    /// Linear to sRGB, indexed by quantized linear value.
+    unsigned char toSrgb[SRGB_TABLE_SIZE];
+};
+
+/// Kaiser windowed sinc weights for halving an image.
+struct KaiserKernel
+{
+    /// Construct.
+    KaiserKernel()
+    {
+        float sum = 0.0f;
+        for (int i = 0; i < KAISER_TAPS; ++i)
+        {
+            // Tap distance from the destination pixel center in source pixels, with the sinc cutoff at the destination Nyquist frequency
+            float distance = i - (KAISER_TAPS - 1) * 0.5f;
+            float x = distance * 0.5f * M_PI;
+            float sinc = x != 0.0f ? sinf(x) / x : 1.0f;
+            float t = distance / (KAISER_TAPS * 0.5f);
+            weights[i] = sinc * BesselI0(KAISER_ALPHA * sqrtf(1.0f - t * t)) / BesselI0(KAISER_ALPHA);
+            sum += weights[i];
+        }
+        for (int i = 0; i < KAISER_TAPS; ++i)
+            weights[i] /= sum;
+    }
+
+    /// Evaluate the zeroth order modified Bessel function of the first kind.
+    static float BesselI0(float x)
+    {
+        float sum = 1.0f;
+        float term = 1.0f;
+        for (int k = 1; k < 16; ++k)
+        {
+            term *= (x * 0.5f) / k;
+            sum += term * term;
+        }
+        return sum;
+    }
+
+    /// Normalized weights.
+    float weights[KAISER_TAPS];
+};
+
+/// Return the sRGB conversion tables.
+static const SrgbTables& GetSrgbTables()
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+/// Return the Kaiser filter weights.
+static const float* GetKaiserWeights()
+{
+    static const KaiserKernel kernel;
+    return kernel.weights;
+}
+
+#if defined(TURSO3D_IMAGE_SSE)
+/// Sum horizontally adjacent pixels of 16 bytes to 16-bit values per channel.
+template <int C> static inline __m128i PairSums(__m128i pixels)
+{
+    if (C == 1)
+        return _mm_add_epi16(_mm_and_si128(pixels, _mm_set1_epi16(0xff)), _mm_srli_epi16(pixels, 8));
+
+    __m128i lo = _mm_unpacklo_epi8(pixels, _mm_setzero_si128());
+    __m128i hi = _mm_unpackhi_epi8(pixels, _mm_setzero_si128());
+    if (C == 2)
+    {
+        lo = _mm_shuffle_epi32(_mm_add_epi16(lo, _mm_srli_si128(lo, 4)), _MM_SHUFFLE(3, 1, 2, 0));
+        hi = _mm_shuffle_epi32(_mm_add_epi16(hi, _mm_srli_si128(hi, 4)), _MM_SHUFFLE(3, 1, 2, 0));
+    }
+    else
+    {
+        lo = _mm_add_epi16(lo, _mm_srli_si128(lo, 8));
+        hi = _mm_add_epi16(hi, _mm_srli_si128(hi, 8));
+    }
+    return _mm_unpacklo_epi64(lo, hi);
+}
+#endif
+
+/// Halve a row of 8-bit pixels with a 2x2 box filter.
+template <int C> static void BoxFilterRow(unsigned char* out, const unsigned char* upper, const unsigned char* lower, int srcWidth, int outWidth)
+{
+    // Vectorize the destination pixels that have both source pixels
+    int x = 0;
+    int fullPairs = srcWidth / 2;
+
+    #if defined(TURSO3D_IMAGE_SSE)
+    const __m128i round = _mm_set1_epi16(2);
+    for (; x + 16 / C <= fullPairs; x += 16 / C)
+    {
+        const __m128i* u = reinterpret_cast<const __m128i*>(upper + x * 2 * C);
+        const __m128i* l = reinterpret_cast<const __m128i*>(lower + x * 2 * C);
+        __m128i s0 = _mm_add_epi16(PairSums<C>(_mm_loadu_si128(u)), PairSums<C>(_mm_loadu_si128(l)));
+        __m128i s1 = _mm_add_epi16(PairSums<C>(_mm_loadu_si128(u + 1)), PairSums<C>(_mm_loadu_si128(l + 1)));
+        s0 = _mm_srli_epi16(_mm_add_epi16(s0, round), 2);
+        s1 = _mm_srli_epi16(_mm_add_epi16(s1, round), 2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * C), _mm_packus_epi16(s0, s1));
+    }
+    #elif defined(TURSO3D_IMAGE_NEON)
+    for (; x + 8 <= fullPairs; x += 8)
+    {
+        const unsigned char* u = upper + x * 2 * C;
+        const unsigned char* l = lower + x * 2 * C;
+        if (C == 1)
+            vst1_u8(out + x, vrshrn_n_u16(vaddq_u16(vpaddlq_u8(vld1q_u8(u)), vpaddlq_u8(vld1q_u8(l))), 2));
+        else if (C == 2)
+        {
+            uint8x16x2_t uc = vld2q_u8(u);
+            uint8x16x2_t lc = vld2q_u8(l);
+            uint8x8x2_t result;
+            for (int c = 0; c < 2; ++c)
+                result.val[c] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(uc.val[c]), vpaddlq_u8(lc.val[c])), 2);
+            vst2_u8(out + x * 2, result);
+        }
+        else
+        {
+            uint8x16x4_t uc = vld4q_u8(u);
+            uint8x16x4_t lc = vld4q_u8(l);
+            uint8x8x4_t result;
+            for (int c = 0; c < 4; ++c)
+                result.val[c] = vrshrn_n_u16(vaddq_u16(vpaddlq_u8(uc.val[c]), vpaddlq_u8(lc.val[c])), 2);
+            vst4_u8(out + x * 4, result);
+        }
+    }
+    #endif
+
+    for (; x < outWidth; ++x)
+    {
+        int x0 = x * 2 * C;
+        int x1 = Min(x * 2 + 1, srcWidth - 1) * C;
+        for (int c = 0; c < C; ++c)
+            out[x * C + c] = (unsigned char)(((unsigned)upper[x0 + c] + upper[x1 + c] + lower[x0 + c] + lower[x1 + c] + 2) >> 2);
+    }
+}
+
+/// Convert a row of 8-bit or half float pixels to floats. Converts the color channels of 8-bit RGBA from sRGB to linear if requested.
+static void LoadRow(float* dest, const unsigned char* src, int width, int channels, bool isHalf, bool srgb)
+{
+    size_t count = (size_t)width * channels;
+
+    if (isHalf)
+    {
+        const unsigned short* halfs = reinterpret_cast<const unsigned short*>(src);
+        for (size_t i = 0; i < count; ++i)
+            dest[i] = HalfToFloat(halfs[i]);
+    }
+    else if (srgb)
+    {
+        const SrgbTables& tables = GetSrgbTables();
+        for (size_t i = 0; i < count; ++i)
+            dest[i] = (i & 3) != 3 ? tables.toLinear[src[i]] : src[i] / 255.0f;
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+            dest[i] = src[i] / 255.0f;
+    }
+}
+
+/// Convert a row of floats to 8-bit or half float pixels. Converts the color channels of 8-bit RGBA from linear to sRGB if requested.
+static void StoreRow(unsigned char* dest, const float* src, int width, int channels, bool isHalf, bool srgb)
+{
+    size_t count = (size_t)width * channels;
+
+    if (isHalf)
+    {
+        unsigned short* halfs = reinterpret_cast<unsigned short*>(dest);
+        for (size_t i = 0; i < count; ++i)
+            halfs[i] = FloatToHalf(src[i]);
+    }
+    else if (srgb)
+    {
+        const SrgbTables& tables = GetSrgbTables();
+        for (size_t i = 0; i < count; ++i)
+        {
+            float value = Clamp(src[i], 0.0f, 1.0f);
+            dest[i] = (i & 3) != 3 ? tables.toSrgb[(int)(value * (SRGB_TABLE_SIZE - 1) + 0.5f)] : (unsigned char)(value * 255.0f + 0.5f);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+            dest[i] = (unsigned char)(Clamp(src[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+    }
+}
+
 ImageLevel::ImageLevel(const IntVector2& size_, ImageFormat format_, const void* data_) :
     data((unsigned char*)data_),
     size(IntVector3(size_.x, size_.y, 1)),
@@ -261,7 +492,7 @@ bool Image::BeginLoad(Stream& source)
 {
     ZoneScoped;
 
-    // Check for DDS, KTX or PVR compressed format
+    // Check for DDS, KTX, KTX2 or PVR compressed format
     std::string fileID = source.ReadFileID();
 
     if (fileID == "DDS ")
@@ -295,6 +526,131 @@ bool Image::BeginLoad(Stream& source)
         numLevels = ddsd.dwMipMapCount ? ddsd.dwMipMapCount : 1;
         source.Read(data, dataSize);
     }
+    else if (fileID == "\253KTX" && source.ReadFileID() == " 20\273")
+    {
+        source.Seek(12);
+
+        unsigned vkFormat = source.Read<unsigned>();
+        /* unsigned typeSize = */ source.Read<unsigned>();
+        unsigned imageWidth = source.Read<unsigned>();
+        unsigned imageHeight = source.Read<unsigned>();
+        unsigned depth = source.Read<unsigned>();
+        unsigned layers = source.Read<unsigned>();
+        unsigned faces = source.Read<unsigned>();
+        unsigned mipmaps = source.Read<unsigned>();
+        unsigned supercompression = source.Read<unsigned>();
+        // Data format descriptor, key/value data and supercompression global data locations
+        for (size_t i = 0; i < 4; ++i)
+            source.Read<unsigned>();
+        for (size_t i = 0; i < 2; ++i)
+            source.Read<unsigned long long>();
+
+        if (supercompression == 1 || vkFormat == 0)
+        {
+            LOGERROR("Basis Universal KTX2 files not supported, transcode them to a block compressed format offline");
+            return false;
+        }
+
+        if (supercompression)
+        {
+            LOGERROR("Supercompressed KTX2 files not supported");
+            return false;
+        }
+
+        if (faces > 1 || depth > 1 || layers > 1)
+        {
+            LOGERROR("3D, cube or array KTX2 files not supported");
+            return false;
+        }
+
+        format = FMT_NONE;
+        switch (vkFormat)
+        {
+        case 9:
+            format = FMT_R8;
+            break;
+
+        case 16:
+            format = FMT_RG8;
+            break;
+
+        case 37:
+        case 43:
+            format = FMT_RGBA8;
+            break;
+
+        case 97:
+            format = FMT_RGBA16F;
+            break;
+
+        case 109:
+            format = FMT_RGBA32F;
+            break;
+
+        case 131:
+        case 132:
+        case 133:
+        case 134:
+            format = FMT_DXT1;
+            break;
+
+        case 135:
+        case 136:
+            format = FMT_DXT3;
+            break;
+
+        case 137:
+        case 138:
+            format = FMT_DXT5;
+            break;
+
+        case 145:
+        case 146:
+            format = FMT_BC7;
+            break;
+        }
+
+        if (format == FMT_NONE)
+        {
+            LOGERROR("Unsupported texture format in KTX2 file");
+            return false;
+        }
+
+        // Zero mipmaps means they should be generated. Uncompressed images are loaded without mipmaps, as the texture generates them
+        size = IntVector3(imageWidth, Max((int)imageHeight, 1), 1);
+        std::vector<std::pair<unsigned long long, unsigned long long> > levelRanges(mipmaps ? mipmaps : 1);
+        for (size_t i = 0; i < levelRanges.size(); ++i)
+        {
+            levelRanges[i].first = source.Read<unsigned long long>();
+            levelRanges[i].second = source.Read<unsigned long long>();
+            /* unsigned long long uncompressedLength = */ source.Read<unsigned long long>();
+        }
+        numLevels = IsCompressed() ? levelRanges.size() : 1;
+
+        size_t dataSize = 0;
+        for (size_t i = 0; i < numLevels; ++i)
+        {
+            ImageLevel level;
+            CalculateDataSize(IntVector3(Max(size.x >> i, 1), Max(size.y >> i, 1), 1), format, level);
+            if (level.dataSize != levelRanges[i].second || levelRanges[i].first + levelRanges[i].second > source.Size())
+            {
+                LOGERROR("KTX2 mipmap level data size does not match the image size or exceeds file size");
+                return false;
+            }
+            dataSize += level.dataSize;
+        }
+
+        data = new unsigned char[dataSize];
+
+        // Levels are stored from the smallest up, but are kept in memory from the largest down
+        size_t dataOffset = 0;
+        for (size_t i = 0; i < numLevels; ++i)
+        {
+            source.Seek((size_t)levelRanges[i].first);
+            source.Read(&data[dataOffset], (size_t)levelRanges[i].second);
+            dataOffset += (size_t)levelRanges[i].second;
+        }
+    }
     else if (fileID == "\253KTX")
     {
         source.Seek(12);
@@ -352,6 +708,10 @@ bool Image::BeginLoad(Stream& source)
             format = FMT_DXT5;
             break;
 
+        case 0x8e8c:
+            format = FMT_BC7;
+            break;
+
         case 0x8d64:
             format = FMT_ETC1;
             break;
@@ -482,7 +842,7 @@ bool Image::BeginLoad(Stream& source)
     }
     else
     {
-        // Not DDS, KTX or PVR, use STBImage to load other image formats as uncompressed
+        // Not DDS, KTX, KTX2 or PVR, use STBImage to load other image formats as uncompressed
         source.Seek(0);
         int imageWidth, imageHeight, imageDepth;
         unsigned imageComponents;
@@ -595,6 +955,15 @@ unsigned char* Image::DecodePixelData(Stream& source, int& width, int& height, i
     return stbi_load_from_memory(buffer, (int)dataSize, &width, &height, (int *)&pixelByteSize, 0);
 }
 
+template <class T> void Image::ForRows(size_t numRows, size_t grainSize, const T& function)
+{
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    if (workQueue && workQueue->NumThreads() > 1 && numRows >= 2 * grainSize)
+        workQueue->ParallelFor(0, numRows, grainSize, [&function](size_t start, size_t end, unsigned) { function(start, end); });
+    else
+        function(0, numRows);
+}
+
 void Image::FreePixelData(unsigned char* pixelData)
 {
     if (!pixelData)
@@ -603,74 +972,144 @@ void Image::FreePixelData(unsigned char* pixelData)
     stbi_image_free(pixelData);
 }
 
-bool Image::GenerateMipImage(Image& dest) const
+bool Image::GenerateMipImage(Image& dest, MipFilter filter, bool srgb) const
 {
     ZoneScoped;
 
-    int pixelByteSize = Components();
-    if (pixelByteSize < 1 || pixelByteSize > 4)
+    bool isHalf = format == FMT_RGBA16F;
+    int channels = isHalf ? 4 : Components();
+    if (channels < 1 || channels > 4)
     {
         LOGERROR("Unsupported format for calculating the next mip level");
         return false;
     }
 
+    srgb &= format == FMT_RGBA8;
+
     IntVector3 sizeOut(Max(size.x / 2, 1), Max(size.y / 2, 1), Max(size.z / 2, 1));
     dest.SetSize(sizeOut, format);
 
     const unsigned char* pixelDataIn = data;
     unsigned char* pixelDataOut = dest.data;
+    size_t rowSizeIn = size.x * pixelByteSizes[format];
+    size_t rowSizeOut = sizeOut.x * pixelByteSizes[format];
+    size_t grainSize = Max(MIN_PARALLEL_MIP_PIXELS / sizeOut.x, (size_t)1);
 
     // \todo Actually support 3D images
-    switch (pixelByteSize)
+    if (filter == MIP_FILTER_BOX && !srgb && !isHalf)
     {
-    case 1:
-        for (int y = 0; y < sizeOut.y; ++y)
+        ForRows(sizeOut.y, grainSize, [&](size_t start, size_t end)
         {
-            const unsigned char* inUpper = &pixelDataIn[(y * 2) * size.x];
-            const unsigned char* inLower = &pixelDataIn[(y * 2 + 1) * size.x];
-            unsigned char* out = &pixelDataOut[y * sizeOut.x];
+            for (size_t y = start; y < end; ++y)
+            {
+                const unsigned char* inUpper = pixelDataIn + y * 2 * rowSizeIn;
+                const unsigned char* inLower = pixelDataIn + Min((int)y * 2 + 1, size.y - 1) * rowSizeIn;
+                unsigned char* out = pixelDataOut + y * rowSizeOut;
+
+                switch (channels)
+                {
+                case 1:
+                    BoxFilterRow<1>(out, inUpper, inLower, size.x, sizeOut.x);
+                    break;
+
+                case 2:
+                    BoxFilterRow<2>(out, inUpper, inLower, size.x, sizeOut.x);
+                    break;
+
+                case 4:
+                    BoxFilterRow<4>(out, inUpper, inLower, size.x, sizeOut.x);
+                    break;
+                }
+            }
+        });
+    }
+    else if (filter == MIP_FILTER_BOX)
+    {
+        ForRows(sizeOut.y, grainSize, [&](size_t start, size_t end)
+        {
+            std::vector<float> upper(size.x * channels);
+            std::vector<float> lower(size.x * channels);
+            std::vector<float> out(sizeOut.x * channels);
 
-            for (int x = 0; x < sizeOut.x; ++x)
-                out[x] = ((unsigned)inUpper[x * 2] + inUpper[x * 2 + 1] + inLower[x * 2] + inLower[x * 2 + 1]) >> 2;
-        }
-        break;
+            for (size_t y = start; y < end; ++y)
+            {
+                LoadRow(&upper[0], pixelDataIn + y * 2 * rowSizeIn, size.x, channels, isHalf, srgb);
+                LoadRow(&lower[0], pixelDataIn + Min((int)y * 2 + 1, size.y - 1) * rowSizeIn, size.x, channels, isHalf, srgb);
+
+                for (int x = 0; x < sizeOut.x; ++x)
+                {
+                    int x0 = x * 2 * channels;
+                    int x1 = Min(x * 2 + 1, size.x - 1) * channels;
+                    for (int c = 0; c < channels; ++c)
+                        out[x * channels + c] = (upper[x0 + c] + upper[x1 + c] + lower[x0 + c] + lower[x1 + c]) * 0.25f;
+                }
+
+                StoreRow(pixelDataOut + y * rowSizeOut, &out[0], sizeOut.x, channels, isHalf, srgb);
+            }
+        });
+    }
+    else
+    {
+        // Separable filter: halve the width of all source rows, then halve the height
+        const float* weights = GetKaiserWeights();
+        size_t horizontalRowSize = sizeOut.x * channels;
+        std::vector<float> horizontal(size.y * horizontalRowSize);
 
-    case 2:
-        for (int y = 0; y < sizeOut.y; ++y)
+        ForRows(size.y, grainSize, [&](size_t start, size_t end)
         {
-            const unsigned char* inUpper = &pixelDataIn[(y * 2) * size.x * 2];
-            const unsigned char* inLower = &pixelDataIn[(y * 2 + 1) * size.x * 2];
-            unsigned char* out = &pixelDataOut[y * sizeOut.x * 2];
+            std::vector<float> row(size.x * channels);
 
-            for (int x = 0; x < sizeOut.x * 2; x += 2)
+            for (size_t y = start; y < end; ++y)
             {
-                out[x] = ((unsigned)inUpper[x * 2] + inUpper[x * 2 + 2] + inLower[x * 2] + inLower[x * 2 + 2]) >> 2;
-                out[x + 1] = ((unsigned)inUpper[x * 2 + 1] + inUpper[x * 2 + 3] + inLower[x * 2 + 1] + inLower[x * 2 + 3]) >> 2;
+                LoadRow(&row[0], pixelDataIn + y * rowSizeIn, size.x, channels, isHalf, srgb);
+                float* out = &horizontal[y * horizontalRowSize];
+
+                for (int x = 0; x < sizeOut.x; ++x)
+                {
+                    for (int c = 0; c < channels; ++c)
+                        out[x * channels + c] = 0.0f;
+                    for (int i = 0; i < KAISER_TAPS; ++i)
+                    {
+                        int sx = Clamp(x * 2 + i - KAISER_TAPS / 2 + 1, 0, size.x - 1);
+                        for (int c = 0; c < channels; ++c)
+                            out[x * channels + c] += weights[i] * row[sx * channels + c];
+                    }
+                }
             }
-        }
-        break;
+        });
 
-    case 4:
-        for (int y = 0; y < sizeOut.y; ++y)
+        ForRows(sizeOut.y, grainSize, [&](size_t start, size_t end)
         {
-            const unsigned char* inUpper = &pixelDataIn[(y * 2) * size.x * 4];
-            const unsigned char* inLower = &pixelDataIn[(y * 2 + 1) * size.x * 4];
-            unsigned char* out = &pixelDataOut[y * sizeOut.x * 4];
+            std::vector<float> out(horizontalRowSize);
 
-            for (int x = 0; x < sizeOut.x * 4; x += 4)
+            for (size_t y = start; y < end; ++y)
             {
-                out[x] = ((unsigned)inUpper[x * 2] + inUpper[x * 2 + 4] + inLower[x * 2] + inLower[x * 2 + 4]) >> 2;
-                out[x + 1] = ((unsigned)inUpper[x * 2 + 1] + inUpper[x * 2 + 5] + inLower[x * 2 + 1] + inLower[x * 2 + 5]) >> 2;
-                out[x + 2] = ((unsigned)inUpper[x * 2 + 2] + inUpper[x * 2 + 6] + inLower[x * 2 + 2] + inLower[x * 2 + 6]) >> 2;
-                out[x + 3] = ((unsigned)inUpper[x * 2 + 3] + inUpper[x * 2 + 7] + inLower[x * 2 + 3] + inLower[x * 2 + 7]) >> 2;
+                std::fill(out.begin(), out.end(), 0.0f);
+                for (int i = 0; i < KAISER_TAPS; ++i)
+                {
+                    int sy = Clamp((int)y * 2 + i - KAISER_TAPS / 2 + 1, 0, size.y - 1);
+                    const float* in = &horizontal[sy * horizontalRowSize];
+                    for (size_t j = 0; j < horizontalRowSize; ++j)
+                        out[j] += weights[i] * in[j];
+                }
+
+                StoreRow(pixelDataOut + y * rowSizeOut, &out[0], sizeOut.x, channels, isHalf, srgb);
             }
-        }
-        break;
+        });
     }
 
     return true;
 }
 
+size_t Image::CpuMemoryUse() const
+{
+    if (!data)
+        return 0;
+
+    ImageLevel lastLevel = Level(numLevels - 1);
+    return (lastLevel.data - data.Get()) + lastLevel.dataSize;
+}
+
 ImageLevel Image::Level(size_t index) const
 {
     ImageLevel level;
@@ -712,17 +1151,27 @@ bool Image::DecompressLevel(unsigned char* dest, size_t index) const
     }
 
     ImageLevel level = Level(index);
+    int width = level.size.x;
+    int height = level.size.y;
 
     switch (format)
     {
     case FMT_DXT1:
     case FMT_DXT3:
     case FMT_DXT5:
-        DecompressImageDXT(dest, level.data, level.size.x, level.size.y, format);
-        break;
-
     case FMT_ETC1:
-        DecompressImageETC(dest, level.data, level.size.x, level.size.y);
+        // Blocks are independent, so bands of block rows can be decoded in parallel
+        ForRows(level.rows, MIN_PARALLEL_BLOCK_ROWS, [&](size_t start, size_t end)
+        {
+            unsigned char* bandDest = dest + start * 4 * width * 4;
+            const unsigned char* bandBlocks = level.data + start * level.rowSize;
+            int bandHeight = Min(height - (int)start * 4, (int)(end - start) * 4);
+
+            if (format == FMT_ETC1)
+                DecompressImageETC(bandDest, bandBlocks, width, bandHeight);
+            else
+                DecompressImageDXT(bandDest, bandBlocks, width, bandHeight, format);
+        });
         break;
 
     case FMT_PVRTC_RGB_2BPP:
@@ -740,6 +1189,78 @@ bool Image::DecompressLevel(unsigned char* dest, size_t index) const
     return true;
 }
 
+bool Image::Compress(Image& dest, ImageFormat newFormat, bool generateMips) const
+{
+    ZoneScoped;
+
+    if (format != FMT_RGBA8 || size.z != 1)
+    {
+        LOGERROR("Compressing is supported for 2D 8-bit RGBA images only");
+        return false;
+    }
+    if (newFormat < FMT_DXT1 || newFormat > FMT_BC7)
+    {
+        LOGERROR("Unsupported format for compressing");
+        return false;
+    }
+    if (&dest == this)
+    {
+        LOGERROR("Can not compress an image into itself");
+        return false;
+    }
+
+    std::vector<AutoPtr<Image> > mipImages;
+    size_t newNumLevels = 1;
+    if (generateMips)
+    {
+        const Image* current = this;
+        while (current->size.x > 1 || current->size.y > 1)
+        {
+            Image* mipImage = new Image();
+            current->GenerateMipImage(*mipImage);
+            mipImages.push_back(mipImage);
+            current = mipImage;
+        }
+        newNumLevels += mipImages.size();
+    }
+
+    size_t totalDataSize = 0;
+    for (size_t i = 0; i < newNumLevels; ++i)
+    {
+        ImageLevel level;
+        CalculateDataSize(IntVector3(Max(size.x >> i, 1), Max(size.y >> i, 1), 1), newFormat, level);
+        totalDataSize += level.dataSize;
+    }
+
+    dest.data = new unsigned char[totalDataSize];
+    dest.size = size;
+    dest.format = newFormat;
+    dest.numLevels = newNumLevels;
+
+    for (size_t i = 0; i < newNumLevels; ++i)
+    {
+        const Image* source = i ? mipImages[i - 1].Get() : this;
+        ImageLevel level = dest.Level(i);
+        int width = level.size.x;
+        int height = level.size.y;
+        unsigned char* levelData = const_cast<unsigned char*>(level.data);
+
+        ForRows(level.rows, MIN_PARALLEL_BLOCK_ROWS, [&](size_t start, size_t end)
+        {
+            unsigned char* bandBlocks = levelData + start * level.rowSize;
+            const unsigned char* bandRgba = source->data.Get() + start * 4 * width * 4;
+            int bandHeight = Min(height - (int)start * 4, (int)(end - start) * 4);
+
+            if (newFormat == FMT_BC7)
+                CompressImageBC7(bandBlocks, bandRgba, width, bandHeight);
+            else
+                CompressImageDXT(bandBlocks, bandRgba, width, bandHeight, newFormat);
+        });
+    }
+
+    return true;
+}
+
 void Image::CalculateDataSize(const IntVector3& size, ImageFormat format, ImageLevel& dest)
 {
     if (format < FMT_DXT1)
@@ -34,6 +34,7 @@ enum ImageFormat
     FMT_DXT1,
     FMT_DXT3,
     FMT_DXT5,
+    FMT_BC7,
     FMT_ETC1,
     FMT_PVRTC_RGB_2BPP,
     FMT_PVRTC_RGBA_2BPP,
@@ -41,6 +42,13 @@ enum ImageFormat
     FMT_PVRTC_RGBA_4BPP
 };
 
+/// Mip image downsampling filters.
+enum MipFilter
+{
+    MIP_FILTER_BOX = 0,
+    MIP_FILTER_KAISER
+};
+
 /// Description of image mip level data.
 struct ImageLevel
 {
@@ -122,12 +130,16 @@ public:
     bool IsCompressed() const { return format >= FMT_DXT1; }
     /// Return number of mip levels contained in the image data.
     size_t NumLevels() const { return numLevels; }
-    /// Calculate the next mip image with halved width and height. Supports uncompressed 8 bits per pixel images only. Return true on success.
-    bool GenerateMipImage(Image& dest) const;
+    /// Calculate the next mip image with halved width and height. Supports 8 bits per channel and RGBA16F images. The sRGB option filters the color channels of RGBA8 images in linear space. Large images are processed in parallel rows if the work queue subsystem exists. Return true on success.
+    bool GenerateMipImage(Image& dest, MipFilter filter = MIP_FILTER_BOX, bool srgb = false) const;
     /// Return the data for a mip level. Images loaded from eg. PNG or JPG formats will only have one (index 0) level.
     ImageLevel Level(size_t index) const;
-    /// Decompress a mip level as 8-bit RGBA. Supports compressed images only. Return true on success.
+    /// Decompress a mip level as 8-bit RGBA. Supports compressed images only. DXT and ETC1 levels are decompressed in parallel block row bands if the work queue subsystem exists. Return true on success.
     bool DecompressLevel(unsigned char* dest, size_t levelIndex) const;
+    /// Compress to a DXT or BC7 format, optionally generating a full mip chain. Supports 2D 8-bit RGBA images only. The destination must be a different image. Return true on success.
+    bool Compress(Image& dest, ImageFormat newFormat, bool generateMips = false) const;
+    /// Return the pixel data size of all mip levels.
+    size_t CpuMemoryUse() const override;
 
     /// Calculate the data size of an image level.
     static void CalculateDataSize(const IntVector3& size, ImageFormat format, ImageLevel& dest);
@@ -142,6 +154,8 @@ private:
     static unsigned char* DecodePixelData(Stream& source, int& width, int& height, int& depth, unsigned& components);
     /// Free the decoded pixel data.
     static void FreePixelData(unsigned char* pixelData);
+    /// Call a function with the start and end of row bands, in parallel if the work queue subsystem exists and there are enough rows.
+    template <class T> static void ForRows(size_t numRows, size_t grainSize, const T& function);
 
     /// Image dimensions.
     IntVector3 size;
@@ -1,7 +1,9 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/JSONReader.h"
 #include "../IO/Log.h"
 #include "../IO/Stream.h"
+#include "../IO/StringUtils.h"
 #include "JSONFile.h"
 
 #include <tracy/Tracy.hpp>
@@ -15,21 +17,15 @@ bool JSONFile::BeginLoad(Stream& source)
 {
     ZoneScoped;
     
-    size_t dataSize = source.Size() - source.Position();
-    AutoArrayPtr<char> buffer(new char[dataSize]);
-    if (source.Read(buffer, dataSize) != dataSize)
-        return false;
-    
-    const char* pos = buffer;
-    const char* end = pos + dataSize;
-    
     // Remove any previous content
     root.SetNull();
-    /// \todo If fails, log the line number on which the error occurred
-    bool success = root.Parse(pos, end);
+
+    // Parse in blocks without first reading the whole file into memory
+    JSONReader reader(source);
+    bool success = reader.Next() != JSON_TOKEN_ERROR && reader.ReadValue(root);
     if (!success)
     {
-        LOGERROR("Parsing JSON from " + source.Name() + " failed; data may be partial");
+        LOGERROR("Parsing JSON from " + source.Name() + " failed on line " + ToString((unsigned)reader.Line()) + "; data may be partial");
     }
 
     return success;
@@ -3,6 +3,13 @@
 #include "../IO/Log.h"
 #include "Resource.h"
 
+Resource::Resource() :
+    lastUse(0)
+{
+    // Resources are referenced from async loading and view preparation tasks
+    SetAtomicRefs(true);
+}
+
 bool Resource::BeginLoad(Stream&)
 {
     return false;
@@ -20,6 +27,14 @@ bool Resource::Save(Stream&)
     return false;
 }
 
+void Resource::Dependencies(std::vector<ResourceRef>&) const
+{
+}
+
+void Resource::FileDependencies(std::vector<std::string>&) const
+{
+}
+
 bool Resource::Load(Stream& source)
 {
     bool success = BeginLoad(source);
@@ -14,28 +14,47 @@ class Resource : public Object
     OBJECT(Resource);
 
 public:
+    /// Construct.
+    Resource();
+
     /// Load the resource data from a stream. May be executed outside the main thread, should not access GPU resources. Return true on success.
     virtual bool BeginLoad(Stream& source);
     /// Finish resource loading if necessary. Always called from the main thread, so GPU resources can be accessed here. Return true on success.
     virtual bool EndLoad();
     /// Save the resource to a stream. Return true on success.
     virtual bool Save(Stream& dest);
+    /// Return the resources that EndLoad() will load, so that asynchronous loading can load them in parallel. Called after a successful BeginLoad().
+    virtual void Dependencies(std::vector<ResourceRef>& dest) const;
+    /// Return the names of other files that the resource's data was built from, such as included files, so that it can be reloaded when they change.
+    virtual void FileDependencies(std::vector<std::string>& dest) const;
 
     /// Load the resource synchronously from a binary stream. Return true on success.
     bool Load(Stream& source);
     /// Set name of the resource, usually the same as the file being loaded from.
     void SetName(const std::string& newName);
+    /// Set the last use stamp for the resource cache's eviction. M_MAX_UNSIGNED excludes the resource from eviction.
+    void SetLastUse(unsigned stamp) { lastUse = stamp; }
 
     /// Return name of the resource.
     const std::string& Name() const { return name; }
     /// Return name hash of the resource.
     const StringHash& NameHash() const { return nameHash; }
+    /// Return whether the resource's data has reached the GPU. False while its uploads are queued under the upload budget.
+    virtual bool IsReady() const { return true; }
+    /// Return approximate CPU memory use in bytes.
+    virtual size_t CpuMemoryUse() const { return 0; }
+    /// Return approximate GPU memory use in bytes.
+    virtual size_t GpuMemoryUse() const { return 0; }
+    /// Return the last use stamp for the resource cache's eviction.
+    unsigned LastUse() const { return lastUse; }
 
 private:
     /// Resource name.
     std::string name;
     /// Resource name hash.
     StringHash nameHash;
+    /// Last use stamp.
+    unsigned lastUse;
 };
 
 /// Return name from a resource pointer.
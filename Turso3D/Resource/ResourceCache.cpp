@@ -2,15 +2,29 @@
 
 #include "../IO/File.h"
 #include "../IO/FileSystem.h"
+#include "../IO/FileWatcher.h"
 #include "../IO/Log.h"
+#include "../IO/MappedFile.h"
+#include "../IO/PackageFile.h"
 #include "../IO/StringUtils.h"
+#include "../Math/Math.h"
+#include "../Time/Profiler.h"
+#include "../Time/Timer.h"
 #include "Image.h"
 #include "JSONFile.h"
 #include "ResourceCache.h"
 
+#include <algorithm>
+#include <set>
 #include <tracy/Tracy.hpp>
 
-ResourceCache::ResourceCache()
+// Default size from which resource files are memory mapped
+static const size_t DEFAULT_MAPPED_FILE_THRESHOLD = 64 * 1024;
+
+ResourceCache::ResourceCache() :
+    mappedFileThreshold(DEFAULT_MAPPED_FILE_THRESHOLD),
+    useStamp(1),
+    autoReload(false)
 {
     RegisterSubsystem(this);
     RegisterResourceLibrary();
@@ -18,6 +32,12 @@ ResourceCache::ResourceCache()
 
 ResourceCache::~ResourceCache()
 {
+    // Worker threads may still be reading the pending resources
+    for (auto it = asyncLoads.begin(); it != asyncLoads.end(); ++it)
+        it->second->beginLoad.Wait();
+    asyncLoads.clear();
+    asyncLoadOrder.clear();
+
     UnloadAllResources(true);
     RemoveSubsystem(this);
 }
@@ -37,16 +57,54 @@ bool ResourceCache::AddResourceDir(const std::string& pathName, bool addFirst)
     // Check that the same path does not already exist
     for (size_t i = 0; i < resourceDirs.size(); ++i)
     {
-        if (resourceDirs[i] == fixedPath)
+        if (!resourcePackages[i] && resourceDirs[i] == fixedPath)
             return true;
     }
 
     if (addFirst)
+    {
         resourceDirs.insert(resourceDirs.begin(), fixedPath);
+        resourcePackages.insert(resourcePackages.begin(), SharedPtr<PackageFile>());
+    }
     else
+    {
         resourceDirs.push_back(fixedPath);
+        resourcePackages.push_back(SharedPtr<PackageFile>());
+    }
 
     LOGINFO("Added resource path " + fixedPath);
+    resourceLookup.clear();
+    UpdateFileWatchers();
+    return true;
+}
+
+bool ResourceCache::AddPackageFile(const std::string& fileName, bool addFirst)
+{
+    ZoneScoped;
+
+    for (size_t i = 0; i < resourceDirs.size(); ++i)
+    {
+        if (resourcePackages[i] && resourceDirs[i] == fileName)
+            return true;
+    }
+
+    SharedPtr<PackageFile> package(new PackageFile());
+    if (!package->Open(fileName))
+        return false;
+
+    if (addFirst)
+    {
+        resourceDirs.insert(resourceDirs.begin(), fileName);
+        resourcePackages.insert(resourcePackages.begin(), package);
+    }
+    else
+    {
+        resourceDirs.push_back(fileName);
+        resourcePackages.push_back(package);
+    }
+
+    LOGINFO("Added resource package " + fileName);
+    resourceLookup.clear();
     return true;
 }
 
@@ -64,7 +122,10 @@ bool ResourceCache::AddManualResource(Resource* resource)
         return false;
     }
 
+    // Manual resources can not be reloaded from the resource directories, so exclude them from eviction
+    resource->SetLastUse(M_MAX_UNSIGNED);
     resources[std::make_pair(resource->Type(), StringHash(resource->Name()))] = resource;
+    resourceLookup.clear();
     return true;
 }
 
@@ -75,10 +136,29 @@ void ResourceCache::RemoveResourceDir(const std::string& pathName)
 
     for (size_t i = 0; i < resourceDirs.size(); ++i)
     {
-        if (resourceDirs[i] == fixedPath)
+        if (!resourcePackages[i] && resourceDirs[i] == fixedPath)
         {
             resourceDirs.erase(resourceDirs.begin() + i);
+            resourcePackages.erase(resourcePackages.begin() + i);
             LOGINFO("Removed resource path " + fixedPath);
+            resourceLookup.clear();
+            UpdateFileWatchers();
+            return;
+        }
+    }
+}
+
+void ResourceCache::RemovePackageFile(const std::string& fileName)
+{
+    // Streams opened from the package keep it alive until they are destroyed
+    for (size_t i = 0; i < resourceDirs.size(); ++i)
+    {
+        if (resourcePackages[i] && resourceDirs[i] == fileName)
+        {
+            resourceDirs.erase(resourceDirs.begin() + i);
+            resourcePackages.erase(resourcePackages.begin() + i);
+            LOGINFO("Removed resource package " + fileName);
+            resourceLookup.clear();
             return;
         }
     }
@@ -95,7 +175,10 @@ void ResourceCache::UnloadResource(StringHash type, const std::string& name, boo
 
     Resource* resource = it->second;
     if (resource->Refs() == 1 || force)
+    {
         resources.erase(key);
+        resourceLookup.clear();
+    }
 }
 
 void ResourceCache::UnloadResources(StringHash type, bool force)
@@ -116,6 +199,7 @@ void ResourceCache::UnloadResources(StringHash type, bool force)
                 if (resource->Refs() == 1 || force)
                 {
                     resources.erase(current);
+                    resourceLookup.clear();
                     ++unloaded;
                 }
             }
@@ -144,6 +228,7 @@ void ResourceCache::UnloadResources(StringHash type, const std::string& partialN
                 if (StartsWith(resource->Name(), partialName) && (resource->Refs() == 1 || force))
                 {
                     resources.erase(current);
+                    resourceLookup.clear();
                     ++unloaded;
                 }
             }
@@ -170,6 +255,7 @@ void ResourceCache::UnloadResources(const std::string& partialName, bool force)
             if (StartsWith(resource->Name(), partialName) && (resource->Refs() == 1 || force))
             {
                 resources.erase(current);
+                resourceLookup.clear();
                 ++unloaded;
             }
         }
@@ -195,6 +281,7 @@ void ResourceCache::UnloadAllResources(bool force)
             if (resource->Refs() == 1 || force)
             {
                 resources.erase(current);
+                resourceLookup.clear();
                 ++unloaded;
             }
         }
@@ -207,6 +294,7 @@ void ResourceCache::UnloadAllResources(bool force)
 bool ResourceCache::ReloadResource(Resource* resource)
 {
     ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RESOURCES);
 
     if (!resource)
         return false;
@@ -215,6 +303,166 @@ bool ResourceCache::ReloadResource(Resource* resource)
     return stream ? resource->Load(*stream) : false;
 }
 
+void ResourceCache::SetAutoReload(bool enable)
+{
+    if (enable == autoReload)
+        return;
+
+    autoReload = enable;
+    UpdateFileWatchers();
+}
+
+size_t ResourceCache::UpdateAutoReload()
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RESOURCES);
+
+    std::set<std::string> changedFiles;
+    std::string fileName;
+    for (auto it = fileWatchers.begin(); it != fileWatchers.end(); ++it)
+    {
+        while ((*it)->NextChange(fileName))
+            changedFiles.insert(fileName);
+    }
+
+    if (changedFiles.empty())
+        return 0;
+
+    // Find the resources whose own file or dependency files changed. Resources still being loaded asynchronously will read the new data anyway
+    std::vector<SharedPtr<Resource> > reloads;
+    std::vector<std::string> fileDependencies;
+
+    for (auto it = resources.begin(); it != resources.end(); ++it)
+    {
+        Resource* resource = it->second;
+        if (asyncLoads.find(it->first) != asyncLoads.end())
+            continue;
+
+        bool affected = changedFiles.find(resource->Name()) != changedFiles.end();
+        if (!affected)
+        {
+            fileDependencies.clear();
+            resource->FileDependencies(fileDependencies);
+            for (auto depIt = fileDependencies.begin(); depIt != fileDependencies.end() && !affected; ++depIt)
+                affected = changedFiles.find(*depIt) != changedFiles.end();
+        }
+
+        if (affected)
+            reloads.push_back(SharedPtr<Resource>(resource));
+    }
+
+    if (reloads.empty())
+        return 0;
+
+    // Parse the files in parallel. Objects that hold the reloaded resources, such as materials holding textures, see the new data without further action
+    std::vector<AutoPtr<Stream> > streams(reloads.size());
+    std::vector<Future<bool> > beginLoads(reloads.size());
+
+    for (size_t i = 0; i < reloads.size(); ++i)
+    {
+        streams[i] = OpenResource(reloads[i]->Name());
+        if (streams[i])
+        {
+            Resource* resource = reloads[i];
+            Stream* source = streams[i];
+            beginLoads[i] = Async([resource, source]() { return resource->BeginLoad(*source); }, TASK_HIGH);
+        }
+    }
+
+    for (size_t i = 0; i < reloads.size(); ++i)
+    {
+        if (!streams[i])
+            continue;
+
+        if (beginLoads[i].Get() && reloads[i]->EndLoad())
+            LOGINFO("Reloaded resource " + reloads[i]->Name());
+        else
+            LOGERROR("Failed to reload resource " + reloads[i]->Name());
+    }
+
+    return reloads.size();
+}
+
+void ResourceCache::SetMemoryBudget(StringHash type, size_t bytes)
+{
+    if (bytes)
+        memoryBudgets[type] = bytes;
+    else
+        memoryBudgets.erase(type);
+}
+
+void ResourceCache::EvictResources()
+{
+    ZoneScoped;
+
+    std::map<StringHash, size_t> typeBytes;
+    size_t cpuBytes = 0;
+    size_t gpuBytes = 0;
+
+    // Resources referenced outside the cache are in use
+    for (auto it = resources.begin(); it != resources.end(); ++it)
+    {
+        Resource* resource = it->second;
+        if (resource->Refs() > 1)
+            MarkUsed(resource);
+
+        size_t cpu = resource->CpuMemoryUse();
+        size_t gpu = resource->GpuMemoryUse();
+        cpuBytes += cpu;
+        gpuBytes += gpu;
+        if (memoryBudgets.size())
+            typeBytes[it->first.first] += cpu + gpu;
+    }
+
+    for (auto it = memoryBudgets.begin(); it != memoryBudgets.end(); ++it)
+    {
+        size_t& bytes = typeBytes[it->first];
+        if (bytes <= it->second)
+            continue;
+
+        std::vector<std::pair<unsigned, ResourceMap::iterator> > candidates;
+        for (auto resIt = resources.begin(); resIt != resources.end(); ++resIt)
+        {
+            Resource* resource = resIt->second;
+            if (resIt->first.first == it->first && resource->Refs() == 1 && resource->LastUse() < useStamp)
+                candidates.push_back(std::make_pair(resource->LastUse(), resIt));
+        }
+
+        std::sort(candidates.begin(), candidates.end(), [](const std::pair<unsigned, ResourceMap::iterator>& lhs,
+            const std::pair<unsigned, ResourceMap::iterator>& rhs) { return lhs.first < rhs.first; });
+
+        for (auto candIt = candidates.begin(); candIt != candidates.end() && bytes > it->second; ++candIt)
+        {
+            Resource* resource = candIt->second->second;
+            size_t cpu = resource->CpuMemoryUse();
+            size_t gpu = resource->GpuMemoryUse();
+            bytes -= cpu + gpu;
+            cpuBytes -= cpu;
+            gpuBytes -= gpu;
+
+            LOGDEBUG("Evicting resource " + resource->Name());
+            resources.erase(candIt->second);
+            resourceLookup.clear();
+        }
+    }
+
+    Profiler* profiler = Subsystem<Profiler>();
+    if (profiler)
+    {
+        profiler->SetCounter("ResourceCpuBytes", (long long)cpuBytes);
+        profiler->SetCounter("ResourceGpuBytes", (long long)gpuBytes);
+    }
+
+    // Start the next frame. The manual resources' stamp is never reached
+    if (useStamp < M_MAX_UNSIGNED - 1)
+        ++useStamp;
+}
+
+void ResourceCache::SetMappedFileThreshold(size_t bytes)
+{
+    mappedFileThreshold = bytes;
+}
+
 AutoPtr<Stream> ResourceCache::OpenResource(const std::string& nameIn)
 {
     ZoneScoped;
@@ -224,11 +472,27 @@ AutoPtr<Stream> ResourceCache::OpenResource(const std::string& nameIn)
 
     for (size_t i = 0; i < resourceDirs.size(); ++i)
     {
-        if (FileExists(resourceDirs[i] + name))
+        if (resourcePackages[i])
+        {
+            ret = resourcePackages[i]->OpenFile(name);
+            if (ret)
+                break;
+        }
+        else if (FileExists(resourceDirs[i] + name))
         {
             // Construct the file first with full path, then rename it to not contain the resource path,
             // so that the file's name can be used in further OpenResource() calls (for example over the network)
             ret = new File(resourceDirs[i] + name);
+
+            // Map large files instead, so that parsing them reads from memory
+            if (mappedFileThreshold && ret->Size() >= mappedFileThreshold)
+            {
+                MappedFileStream* mapped = new MappedFileStream(resourceDirs[i] + name);
+                if (mapped->IsReadable())
+                    ret = mapped;
+                else
+                    delete mapped;
+            }
             break;
         }
     }
@@ -249,6 +513,16 @@ AutoPtr<Stream> ResourceCache::OpenResource(const std::string& nameIn)
 Resource* ResourceCache::LoadResource(StringHash type, const std::string& nameIn)
 {
     ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RESOURCES);
+
+    // Names that have been loaded before are found by the hash of the name as given, without sanitation
+    unsigned long long lookupKey = ((unsigned long long)type.Value() << 32) | StringHash(nameIn).Value();
+    auto lookupIt = resourceLookup.find(lookupKey);
+    if (lookupIt != resourceLookup.end())
+    {
+        MarkUsed(lookupIt->second);
+        return lookupIt->second;
+    }
 
     std::string name = SanitateResourceName(nameIn);
 
@@ -260,20 +534,27 @@ Resource* ResourceCache::LoadResource(StringHash type, const std::string& nameIn
     auto key = std::make_pair(type, StringHash(name));
     auto it = resources.find(key);
     if (it != resources.end())
+    {
+        MarkUsed(it->second);
+        resourceLookup[lookupKey] = it->second;
         return it->second;
+    }
 
-    SharedPtr<Object> newObject = Create(type);
-    if (!newObject)
+    // If being loaded asynchronously, finish now
+    if (asyncLoads.find(key) != asyncLoads.end())
     {
-        LOGERROR("Could not load unknown resource type " + ToString(type));
-        return nullptr;
+        FinishAsyncLoad(std::find(asyncLoadOrder.begin(), asyncLoadOrder.end(), key) - asyncLoadOrder.begin(), false);
+        it = resources.find(key);
+        if (it == resources.end())
+            return nullptr;
+
+        resourceLookup[lookupKey] = it->second;
+        return it->second;
     }
-    Resource* newResource = dynamic_cast<Resource*>(newObject.Get());
+
+    SharedPtr<Resource> newResource = CreateResource(type);
     if (!newResource)
-    {
-        LOGERROR(Object::TypeNameFromType(type) + " is not a resource");
         return nullptr;
-    }
 
     // Attempt to load the resource
     AutoPtr<Stream> stream = OpenResource(name);
@@ -281,13 +562,241 @@ Resource* ResourceCache::LoadResource(StringHash type, const std::string& nameIn
         return nullptr;
 
     LOGDEBUG("Loading resource " + name);
+    Profiler* profiler = Subsystem<Profiler>();
+    if (profiler && profiler->IsHitchDetection())
+        profiler->AddEvent("Load resource", name);
     newResource->SetName(name);
     newResource->Load(*stream);
     // Store to cache
+    MarkUsed(newResource);
     resources[key] = newResource;
+    resourceLookup[lookupKey] = newResource;
     return newResource;
 }
 
+bool ResourceCache::LoadResourceAsync(StringHash type, const std::string& nameIn, const ResourceLoadCallback& callback)
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RESOURCES);
+
+    std::string name = SanitateResourceName(nameIn);
+    if (name.empty())
+        return false;
+
+    // A resource that is already cached may still be waiting for its uploads, so check the loads first
+    auto key = std::make_pair(type, StringHash(name));
+    auto loadIt = asyncLoads.find(key);
+    if (loadIt != asyncLoads.end())
+    {
+        if (callback)
+            loadIt->second->callbacks.push_back(callback);
+        return true;
+    }
+
+    auto it = resources.find(key);
+    if (it != resources.end())
+    {
+        MarkUsed(it->second);
+        if (callback)
+            callback(it->second);
+        return true;
+    }
+
+    SharedPtr<Resource> newResource = CreateResource(type);
+    if (!newResource)
+        return false;
+
+    // Open the file in the main thread, so that only the loading itself runs in the worker thread
+    AutoPtr<Stream> stream = OpenResource(name);
+    if (!stream)
+        return false;
+
+    LOGDEBUG("Loading resource " + name + " asynchronously");
+    Profiler* profiler = Subsystem<Profiler>();
+    if (profiler && profiler->IsHitchDetection())
+        profiler->AddEvent("Load resource asynchronously", name);
+    newResource->SetName(name);
+
+    AsyncResourceLoad* load = new AsyncResourceLoad();
+    load->resource = newResource;
+    load->stream = stream;
+    load->dependenciesQueued = false;
+    load->endLoaded = false;
+    load->success = false;
+    if (callback)
+        load->callbacks.push_back(callback);
+
+    // The load entry, and so the resource and stream, are kept alive until BeginLoad() has finished
+    Resource* resource = newResource;
+    Stream* source = load->stream;
+    load->beginLoad = Async([resource, source]() { return resource->BeginLoad(*source); }, TASK_LOW);
+
+    asyncLoads[key] = load;
+    asyncLoadOrder.push_back(key);
+    return true;
+}
+
+void ResourceCache::UpdateAsyncLoading(float maxMilliseconds)
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RESOURCES);
+
+    HiresTimer timer;
+
+    for (size_t i = 0; i < asyncLoadOrder.size();)
+    {
+        auto key = asyncLoadOrder[i];
+        AsyncResourceLoad* load = asyncLoads[key];
+        if (!load->beginLoad.IsReady())
+        {
+            ++i;
+            continue;
+        }
+
+        // Queue the dependencies once known. They are appended to the load order, so they get checked later during this same update
+        if (!load->dependenciesQueued && load->beginLoad.Get())
+        {
+            std::vector<ResourceRef> refs;
+            load->resource->Dependencies(refs);
+            for (auto it = refs.begin(); it != refs.end(); ++it)
+            {
+                std::string depName = SanitateResourceName(it->name);
+                if (LoadResourceAsync(it->type, depName))
+                    load->dependencies.push_back(std::make_pair(it->type, StringHash(depName)));
+            }
+            load->dependenciesQueued = true;
+        }
+
+        bool waiting = false;
+        for (auto it = load->dependencies.begin(); it != load->dependencies.end(); ++it)
+        {
+            if (asyncLoads.find(*it) != asyncLoads.end())
+            {
+                waiting = true;
+                break;
+            }
+        }
+
+        if (waiting)
+        {
+            ++i;
+            continue;
+        }
+
+        bool finished = FinishAsyncLoad(i, true);
+        if ((float)timer.ElapsedUSec() >= maxMilliseconds * 1000.0f)
+            break;
+        if (!finished)
+            i = std::find(asyncLoadOrder.begin(), asyncLoadOrder.end(), key) - asyncLoadOrder.begin() + 1;
+    }
+}
+
+void ResourceCache::CompleteAsyncLoading()
+{
+    ZoneScoped;
+    MEMORY_SCOPE(MEMORY_RESOURCES);
+
+    while (asyncLoadOrder.size())
+    {
+        // Queue dependencies and finish the loads that are ready, then help the worker threads until the next BeginLoad() is done
+        UpdateAsyncLoading(M_INFINITY);
+
+        bool waited = false;
+        for (auto it = asyncLoadOrder.begin(); it != asyncLoadOrder.end(); ++it)
+        {
+            const Future<bool>& beginLoad = asyncLoads[*it]->beginLoad;
+            if (!beginLoad.IsReady())
+            {
+                beginLoad.Wait();
+                waited = true;
+                break;
+            }
+        }
+
+        // The rest are waiting for GPU uploads, which only progress between frames, so finish them without waiting
+        if (!waited)
+        {
+            while (asyncLoadOrder.size())
+                FinishAsyncLoad(0, false);
+        }
+    }
+}
+
+SharedPtr<Resource> ResourceCache::CreateResource(StringHash type)
+{
+    SharedPtr<Object> newObject = Create(type);
+    if (!newObject)
+    {
+        LOGERROR("Could not load unknown resource type " + ToString(type));
+        return SharedPtr<Resource>();
+    }
+    Resource* newResource = dynamic_cast<Resource*>(newObject.Get());
+    if (!newResource)
+    {
+        LOGERROR(Object::TypeNameFromType(type) + " is not a resource");
+        return SharedPtr<Resource>();
+    }
+
+    return SharedPtr<Resource>(newResource);
+}
+
+void ResourceCache::UpdateFileWatchers()
+{
+    fileWatchers.clear();
+    if (!autoReload)
+        return;
+
+    for (size_t i = 0; i < resourceDirs.size(); ++i)
+    {
+        if (resourcePackages[i])
+            continue;
+
+        SharedPtr<FileWatcher> watcher(new FileWatcher());
+        if (watcher->StartWatching(resourceDirs[i], true))
+            fileWatchers.push_back(watcher);
+    }
+}
+
+void ResourceCache::MarkUsed(Resource* resource)
+{
+    if (resource->LastUse() != M_MAX_UNSIGNED)
+        resource->SetLastUse(useStamp);
+}
+
+bool ResourceCache::FinishAsyncLoad(size_t index, bool waitReady)
+{
+    ZoneScoped;
+
+    auto key = asyncLoadOrder[index];
+    AsyncResourceLoad* load = asyncLoads[key];
+
+    if (!load->endLoaded)
+    {
+        // EndLoad() may load the dependencies, which finishes their asynchronous loads as well
+        load->endLoaded = true;
+        load->success = load->beginLoad.Get() && load->resource->EndLoad();
+
+        // Store to cache also on failure, as with synchronous loading
+        MarkUsed(load->resource);
+        resources[key] = load->resource;
+    }
+
+    // Keep the load pending while its GPU uploads are queued, so that the callbacks and the loads depending on it wait
+    if (waitReady && load->success && !load->resource->IsReady())
+        return false;
+
+    asyncLoadOrder.erase(std::find(asyncLoadOrder.begin(), asyncLoadOrder.end(), key));
+    auto loadIt = asyncLoads.find(key);
+    AutoPtr<AsyncResourceLoad> finished(loadIt->second.Detach());
+    asyncLoads.erase(loadIt);
+
+    Resource* resource = finished->success ? finished->resource.Get() : nullptr;
+    for (auto it = finished->callbacks.begin(); it != finished->callbacks.end(); ++it)
+        (*it)(resource);
+
+    return true;
+}
+
 void ResourceCache::ResourcesByType(std::vector<Resource*>& result, StringHash type) const
 {
     result.clear();
@@ -299,13 +808,66 @@ void ResourceCache::ResourcesByType(std::vector<Resource*>& result, StringHash t
     }
 }
 
+size_t ResourceCache::MemoryBudget(StringHash type) const
+{
+    auto it = memoryBudgets.find(type);
+    return it != memoryBudgets.end() ? it->second : 0;
+}
+
+void ResourceCache::MemoryUse(std::vector<ResourceMemoryUse>& dest) const
+{
+    dest.clear();
+
+    std::map<StringHash, ResourceMemoryUse> useByType;
+    for (auto it = resources.begin(); it != resources.end(); ++it)
+    {
+        auto useIt = useByType.find(it->first.first);
+        if (useIt == useByType.end())
+        {
+            ResourceMemoryUse newUse;
+            newUse.type = it->first.first;
+            newUse.count = 0;
+            newUse.cpuBytes = 0;
+            newUse.gpuBytes = 0;
+            newUse.budget = MemoryBudget(newUse.type);
+            useIt = useByType.insert(std::make_pair(newUse.type, newUse)).first;
+        }
+
+        ResourceMemoryUse& use = useIt->second;
+        ++use.count;
+        use.cpuBytes += it->second->CpuMemoryUse();
+        use.gpuBytes += it->second->GpuMemoryUse();
+    }
+
+    for (auto it = useByType.begin(); it != useByType.end(); ++it)
+        dest.push_back(it->second);
+}
+
+std::string ResourceCache::MemoryReport() const
+{
+    std::vector<ResourceMemoryUse> use;
+    MemoryUse(use);
+
+    std::string output("Resource type         Count    CPU (KB)    GPU (KB) Budget (KB)\n\n");
+    char line[256];
+
+    for (auto it = use.begin(); it != use.end(); ++it)
+    {
+        sprintf(line, "%-20s %6u %11u %11u %11u\n", Object::TypeNameFromType(it->type).c_str(), (unsigned)it->count, (unsigned)(it->cpuBytes / 1024),
+            (unsigned)(it->gpuBytes / 1024), (unsigned)(it->budget / 1024));
+        output += std::string(line);
+    }
+
+    return output;
+}
+
 bool ResourceCache::Exists(const std::string& nameIn) const
 {
     std::string name = SanitateResourceName(nameIn);
 
     for (size_t i = 0; i < resourceDirs.size(); ++i)
     {
-        if (FileExists(resourceDirs[i] + name))
+        if (resourcePackages[i] ? resourcePackages[i]->Exists(name) : FileExists(resourceDirs[i] + name))
             return true;
     }
 
@@ -319,7 +881,12 @@ unsigned ResourceCache::LastModifiedTime(const std::string& nameIn) const
 
     for (size_t i = 0; i < resourceDirs.size(); ++i)
     {
-        if (FileExists(resourceDirs[i] + name))
+        if (resourcePackages[i])
+        {
+            if (resourcePackages[i]->Exists(name))
+                return ::LastModifiedTime(resourceDirs[i]);
+        }
+        else if (FileExists(resourceDirs[i] + name))
             return ::LastModifiedTime(resourceDirs[i] + name);
     }
 
@@ -329,9 +896,10 @@ unsigned ResourceCache::LastModifiedTime(const std::string& nameIn) const
 
 std::string ResourceCache::ResourceFileName(const std::string& name) const
 {
+    // Files in packages have no filename of their own
     for (unsigned i = 0; i < resourceDirs.size(); ++i)
     {
-        if (FileExists(resourceDirs[i] + name))
+        if (!resourcePackages[i] && FileExists(resourceDirs[i] + name))
             return resourceDirs[i] + name;
     }
 
@@ -352,6 +920,9 @@ std::string ResourceCache::SanitateResourceName(const std::string& nameIn) const
         std::string exePath = ExecutableDir();
         for (unsigned i = 0; i < resourceDirs.size(); ++i)
         {
+            if (resourcePackages[i])
+                continue;
+
             std::string relativeResourcePath = resourceDirs[i];
             if (StartsWith(relativeResourcePath, exePath))
                 relativeResourcePath = relativeResourcePath.substr(exePath.length());
@@ -2,12 +2,57 @@
 
 #pragma once
 
+#include "../Object/AutoPtr.h"
 #include "../Object/Object.h"
+#include "../Thread/Future.h"
 
+#include <functional>
+#include <unordered_map>
+
+class FileWatcher;
+class PackageFile;
 class Resource;
 class Stream;
 
 typedef std::map<std::pair<StringHash, StringHash>, SharedPtr<Resource> > ResourceMap;
+/// Callback for a finished asynchronous resource load. The resource is null if loading failed.
+typedef std::function<void(Resource*)> ResourceLoadCallback;
+
+/// Resource being loaded asynchronously.
+struct AsyncResourceLoad
+{
+    /// Resource being loaded.
+    SharedPtr<Resource> resource;
+    /// Source stream.
+    AutoPtr<Stream> stream;
+    /// Result of BeginLoad() in a worker thread.
+    Future<bool> beginLoad;
+    /// Callbacks to call when finished.
+    std::vector<ResourceLoadCallback> callbacks;
+    /// Dependencies queued for loading after BeginLoad().
+    std::vector<std::pair<StringHash, StringHash> > dependencies;
+    /// Dependencies queued flag.
+    bool dependenciesQueued;
+    /// EndLoad() called flag.
+    bool endLoaded;
+    /// Load success flag, valid after EndLoad().
+    bool success;
+};
+
+/// Memory use of the cached resources of one type.
+struct ResourceMemoryUse
+{
+    /// Resource type.
+    StringHash type;
+    /// Number of resources.
+    size_t count;
+    /// CPU memory use in bytes.
+    size_t cpuBytes;
+    /// GPU memory use in bytes.
+    size_t gpuBytes;
+    /// Memory budget in bytes, or zero if unlimited.
+    size_t budget;
+};
  
 /// %Resource cache subsystem. Loads resources on demand and stores them for later access.
 class ResourceCache : public Object
@@ -22,14 +67,26 @@ public:
 
     /// Add a resource directory. Return true on success.
     bool AddResourceDir(const std::string& pathName, bool addFirst = false);
+    /// Add a package file, which is searched in the same priority order as the resource directories. Return true on success.
+    bool AddPackageFile(const std::string& fileName, bool addFirst = false);
     /// Add a manually created resource. If returns success, the resource cache takes ownership of it.
     bool AddManualResource(Resource* resource);
     /// Remove a resource directory.
     void RemoveResourceDir(const std::string& pathName);
-    /// Open a resource file stream from the resource directories. Return a pointer to the stream, or null if not found.
+    /// Remove a package file.
+    void RemovePackageFile(const std::string& fileName);
+    /// Set the file size in bytes from which resource files are opened as memory mapped streams. Zero to always use buffered file reads. Default 64 KB.
+    void SetMappedFileThreshold(size_t bytes);
+    /// Open a resource file stream from the resource directories and package files. Return a pointer to the stream, or null if not found.
     AutoPtr<Stream> OpenResource(const std::string& name);
-    /// Load and return a resource.
+    /// Load and return a resource. If the resource is being loaded asynchronously, finish loading it immediately.
     Resource* LoadResource(StringHash type, const std::string& name);
+    /// Queue a resource for asynchronous loading. BeginLoad() runs in a worker thread, after which the dependencies of the resource are queued to load in parallel, and EndLoad() runs in UpdateAsyncLoading() once they have finished. The callback is called from the main thread when the resource is ready, or immediately if already loaded. Return false if the resource can not be loaded. Resource directories should not be changed while loads are in progress.
+    bool LoadResourceAsync(StringHash type, const std::string& name, const ResourceLoadCallback& callback = ResourceLoadCallback());
+    /// Finish asynchronous loads whose BeginLoad() and dependencies have completed, until the time budget in milliseconds is exceeded. At least one load is finished if possible. Call once per frame from the main thread.
+    void UpdateAsyncLoading(float maxMilliseconds);
+    /// Wait for and finish all asynchronous loads, including their dependencies.
+    void CompleteAsyncLoading();
     /// Unload resource. Optionally force removal even if referenced.
     void UnloadResource(StringHash type, const std::string& name, bool force = false);
     /// Unload all resources of type.
@@ -42,18 +99,42 @@ public:
     void UnloadAllResources(bool force = false);
     /// Reload an existing resource. Return true on success.
     bool ReloadResource(Resource* resource);
+    /// Set the combined CPU and GPU memory budget in bytes for resources of type. While over the budget, EvictResources() unloads the least recently used resources of the type that are not referenced outside the cache. Zero disables.
+    void SetMemoryBudget(StringHash type, size_t bytes);
+    /// Set automatic reloading of resources when their files, or other files their data was built from such as shader includes, change in the resource directories. The changes are detected by operating system notifications and applied in UpdateAutoReload().
+    void SetAutoReload(bool enable);
+    /// Reload the resources affected by the files changed since the last call. The files are parsed in parallel in worker threads, while the main thread waits so that the resources are not in use. Call once per frame from the main thread while no view preparation is in progress. Return the number of resources reloaded; if nonzero, a captured view should be discarded, as it may refer to replaced geometries.
+    size_t UpdateAutoReload();
+    /// Update the use of the cached resources and unload the least recently used unreferenced resources of types over their memory budget. Manual resources and resources used during the current frame are never unloaded. Also sets the total memory use counters in the profiler. Call once per frame from the main thread.
+    void EvictResources();
     /// Load and return a resource, template version.
     template <class T> T* LoadResource(const std::string& name) { return static_cast<T*>(LoadResource(T::TypeStatic(), name)); }
     /// Load and return a resource, template version.
     template <class T> T* LoadResource(const char* name) { return static_cast<T*>(LoadResource(T::TypeStatic(), name)); }
+    /// Queue a resource for asynchronous loading, template version.
+    template <class T> bool LoadResourceAsync(const std::string& name, const ResourceLoadCallback& callback = ResourceLoadCallback()) { return LoadResourceAsync(T::TypeStatic(), name, callback); }
+    /// Set the memory budget for resources of type, template version.
+    template <class T> void SetMemoryBudget(size_t bytes) { SetMemoryBudget(T::TypeStatic(), bytes); }
 
     /// Return resources by type.
     void ResourcesByType(std::vector<Resource*>& result, StringHash type) const;
-    /// Return resource directories.
+    /// Return number of asynchronous loads in progress.
+    size_t NumAsyncLoads() const { return asyncLoadOrder.size(); }
+    /// Return the file size from which resource files are memory mapped.
+    size_t MappedFileThreshold() const { return mappedFileThreshold; }
+    /// Return whether automatic reloading is enabled.
+    bool IsAutoReload() const { return autoReload; }
+    /// Return the memory budget for resources of type, or zero if unlimited.
+    size_t MemoryBudget(StringHash type) const;
+    /// Return the memory use of the cached resources by type.
+    void MemoryUse(std::vector<ResourceMemoryUse>& dest) const;
+    /// Return the memory use of the cached resources by type as a printable table.
+    std::string MemoryReport() const;
+    /// Return resource directories and package file names in priority order.
     const std::vector<std::string>& ResourceDirs() const { return resourceDirs; }
-    /// Return whether a file exists in the resource directories.
+    /// Return whether a file exists in the resource directories or package files.
     bool Exists(const std::string& name) const;
-    /// Return last modified time of a file from the resource directories, or 0 if doesn't exist.
+    /// Return last modified time of a file from the resource directories, or 0 if doesn't exist. For files in a package, return the package's modified time.
     unsigned LastModifiedTime(const std::string& name) const;
     /// Return an absolute filename from a resource name.
     std::string ResourceFileName(const std::string& name) const;
@@ -79,8 +160,35 @@ public:
     std::string SanitateResourceDirName(const std::string& name) const;
 
 private:
+    /// Create a resource object of type. Return null and log an error if not a resource type.
+    SharedPtr<Resource> CreateResource(StringHash type);
+    /// Finish an asynchronous load at position in the load order, waiting for its BeginLoad() if necessary. Store to cache and call the callbacks. If waiting for readiness, keep the load pending and return false while the resource is not ready.
+    bool FinishAsyncLoad(size_t index, bool waitReady);
+    /// Mark a resource used during the current frame.
+    void MarkUsed(Resource* resource);
+    /// Recreate the file watchers for the resource directories.
+    void UpdateFileWatchers();
+
     ResourceMap resources;
     std::vector<std::string> resourceDirs;
+    /// Package of each resource directory entry, or null if the entry is a directory.
+    std::vector<SharedPtr<PackageFile> > resourcePackages;
+    /// Asynchronous loads in progress.
+    std::map<std::pair<StringHash, StringHash>, AutoPtr<AsyncResourceLoad> > asyncLoads;
+    /// Keys of the asynchronous loads in queuing order.
+    std::vector<std::pair<StringHash, StringHash> > asyncLoadOrder;
+    /// File size from which resource files are memory mapped.
+    size_t mappedFileThreshold;
+    /// Cached resources by type and hash of the name as given to LoadResource(), so that repeated loads skip name sanitation. Cleared whenever resources are removed or replaced.
+    std::unordered_map<unsigned long long, Resource*> resourceLookup;
+    /// Memory budgets by resource type.
+    std::map<StringHash, size_t> memoryBudgets;
+    /// Current use stamp, advanced on each EvictResources() call.
+    unsigned useStamp;
+    /// File watchers of the resource directories for automatic reloading.
+    std::vector<SharedPtr<FileWatcher> > fileWatchers;
+    /// Automatic reloading flag.
+    bool autoReload;
 };
 
 /// Register Resource related object factories and attributes.
@@ -1,14 +1,19 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/JSONReader.h"
+#include "../IO/JSONValue.h"
+#include "../IO/JSONWriter.h"
 #include "../IO/Log.h"
 #include "../IO/Stream.h"
-#include "../Object/Allocator.h"
 #include "../Object/ObjectResolver.h"
-#include "../Resource/JSONFile.h"
+#include "../Thread/ThreadSafeAllocator.h"
 #include "Scene.h"
 
+/// Maximum number of nodes with the searched name for using the scene-wide index in a subtree search. Each is checked by walking its ancestry, so for a common name the subtree search is cheaper.
+static const size_t MAX_INDEXED_SUBTREE_CANDIDATES = 16;
+
 static std::vector<SharedPtr<Node> > noChildren;
-static Allocator<NodeImpl> nodeImplAllocator;
+static ThreadSafeAllocator<NodeImpl> nodeImplAllocator;
 
 Node::Node() :
     impl(nodeImplAllocator.Allocate()),
@@ -18,6 +23,8 @@ Node::Node() :
 {
     impl->scene = nullptr;
     impl->id = 0;
+    impl->nameIndexPos = 0;
+    impl->typeIndexPos = 0;
 }
 
 Node::~Node()
@@ -39,6 +46,16 @@ void Node::RegisterObject()
     RegisterAttribute("layer", &Node::Layer, &Node::SetLayer, LAYER_DEFAULT);
 }
 
+size_t Node::TrimAllocator()
+{
+    return nodeImplAllocator.Trim();
+}
+
+size_t Node::NumAllocated()
+{
+    return nodeImplAllocator.NumUsed();
+}
+
 void Node::Load(Stream& source, ObjectResolver& resolver)
 {
     // Load child nodes before own attributes to enable e.g. AnimatedModel to set bones at load time
@@ -128,23 +145,196 @@ void Node::SaveJSON(JSONValue& dest)
     Serializable::SaveJSON(dest);
 }
 
+bool Node::LoadJSON(JSONReader& source, ObjectResolver& resolver)
+{
+    if (source.Token() != JSON_TOKEN_BEGIN_OBJECT)
+        return false;
+
+    return LoadJSONMembers(source, resolver);
+}
+
+bool Node::LoadJSONMembers(JSONReader& source, ObjectResolver& resolver)
+{
+    // Collect the attributes so that they are applied in registration order after the children exist
+    JSONValue attributes;
+
+    while (source.Next() == JSON_TOKEN_KEY)
+    {
+        const std::string& key = source.String();
+        if (key == "children")
+        {
+            if (source.Next() != JSON_TOKEN_BEGIN_ARRAY)
+            {
+                if (!source.SkipValue())
+                    return false;
+                continue;
+            }
+
+            while (source.Next() == JSON_TOKEN_BEGIN_OBJECT)
+            {
+                if (!LoadChildJSON(source, resolver) && source.HasError())
+                    return false;
+            }
+            if (source.Token() != JSON_TOKEN_END_ARRAY)
+                return false;
+        }
+        else if (key == "type")
+        {
+            if (source.Next() != JSON_TOKEN_STRING)
+                return false;
+            if (StringHash(source.String()) != Type())
+            {
+                LOGERROR("Mismatching node type " + source.String() + " in JSON data, expected " + TypeName());
+                return false;
+            }
+        }
+        else if (key == "id")
+        {
+            if (source.Next() != JSON_TOKEN_NUMBER)
+                return false;
+            resolver.StoreObject((unsigned)source.Number(), this);
+        }
+        else
+        {
+            JSONValue& value = attributes[key];
+            source.Next();
+            if (!source.ReadValue(value))
+                return false;
+        }
+    }
+
+    if (source.Token() != JSON_TOKEN_END_OBJECT)
+        return false;
+
+    Serializable::LoadJSON(attributes, resolver);
+    return true;
+}
+
+void Node::SaveJSON(JSONWriter& dest)
+{
+    dest.BeginObject();
+    dest.Key("type");
+    dest.Value(TypeName());
+    dest.Key("id");
+    dest.Value(Id());
+
+    // Write the children before the attributes, so that a streaming load applies attributes after the children exist
+    if (NumPersistentChildren())
+    {
+        dest.Key("children");
+        dest.BeginArray();
+        for (auto it = children.begin(); it != children.end(); ++it)
+        {
+            Node* child = *it;
+            if (!child->IsTemporary())
+                child->SaveJSON(dest);
+        }
+        dest.EndArray();
+    }
+
+    Serializable::SaveJSONAttributes(dest);
+    dest.EndObject();
+}
+
 bool Node::SaveJSON(Stream& dest)
 {
-    JSONFile json;
-    SaveJSON(json.Root());
-    return json.Save(dest);
+    JSONWriter writer(dest);
+    SaveJSON(writer);
+    return writer.Flush();
+}
+
+Node* Node::LoadChildJSON(JSONReader& source, ObjectResolver& resolver)
+{
+    std::string typeName;
+    unsigned id = 0;
+    bool hasType = false;
+    bool hasId = false;
+
+    // Type and id are needed to create the child before streaming the rest. They come first when written by JSONWriter
+    while (!hasType || !hasId)
+    {
+        JSONToken token = source.Next();
+        if (token == JSON_TOKEN_END_OBJECT)
+            break;
+        if (token != JSON_TOKEN_KEY)
+            return nullptr;
+
+        if (source.String() == "type")
+        {
+            if (source.Next() != JSON_TOKEN_STRING)
+                return nullptr;
+            typeName = source.String();
+            hasType = true;
+        }
+        else if (source.String() == "id")
+        {
+            if (source.Next() != JSON_TOKEN_NUMBER)
+                return nullptr;
+            id = (unsigned)source.Number();
+            hasId = true;
+        }
+        else
+        {
+            // Other members come first, so read the rest of the child as a value tree
+            JSONValue childJSON;
+            childJSON.SetEmptyObject();
+            do
+            {
+                JSONValue& value = childJSON[source.String()];
+                source.Next();
+                if (!source.ReadValue(value))
+                    return nullptr;
+            }
+            while (source.Next() == JSON_TOKEN_KEY);
+
+            if (source.Token() != JSON_TOKEN_END_OBJECT)
+                return nullptr;
+            if (hasType)
+                childJSON["type"] = typeName;
+            if (hasId)
+                childJSON["id"] = id;
+
+            Node* child = CreateChild(StringHash(childJSON["type"].GetString()));
+            if (child)
+            {
+                resolver.StoreObject((unsigned)childJSON["id"].GetNumber(), child);
+                child->LoadJSON(childJSON, resolver);
+            }
+            return child;
+        }
+    }
+
+    bool ended = source.Token() == JSON_TOKEN_END_OBJECT;
+    Node* child = CreateChild(StringHash(typeName));
+    if (!child)
+    {
+        if (!ended)
+            source.SkipToEnd();
+        return nullptr;
+    }
+
+    resolver.StoreObject(id, child);
+    if (!ended)
+    {
+        // Continue with the child's remaining members
+        if (!child->LoadJSONMembers(source, resolver))
+            return nullptr;
+    }
+    return child;
 }
 
 void Node::SetName(const std::string& newName)
 {
-    impl->name = newName;
-    impl->nameHash = StringHash(newName);
+    SetName(newName.c_str());
 }
 
 void Node::SetName(const char* newName)
 {
-    impl->name = newName;
-    impl->nameHash = StringHash(newName);
+    StringHash oldNameHash = impl->name.Hash();
+    impl->name = InternedString(newName);
+    MarkAttributeDirty(NODE_ATTR_NAME);
+    if (impl->scene && impl->scene->HasNodeIndex())
+        impl->scene->OnNodeRenamed(this, oldNameHash);
 }
 
 void Node::SetLayer(unsigned char newLayer)
@@ -152,6 +342,7 @@ void Node::SetLayer(unsigned char newLayer)
     if (layer < 32)
     {
         layer = newLayer;
+        MarkAttributeDirty(NODE_ATTR_LAYER);
         OnLayerChanged(newLayer);
     }
     else
@@ -163,6 +354,7 @@ void Node::SetEnabled(bool enable)
     if (enable != TestFlag(NF_ENABLED))
     {
         SetFlag(NF_ENABLED, enable);
+        MarkAttributeDirty(NODE_ATTR_ENABLED);
         OnEnabledChanged(enable);
     }
 }
@@ -180,6 +372,7 @@ void Node::SetEnabledRecursive(bool enable)
 void Node::SetTemporary(bool enable)
 {
     SetFlag(NF_TEMPORARY, enable);
+    MarkAttributeDirty(NODE_ATTR_TEMPORARY);
 }
 
 void Node::SetParent(Node* newParent)
@@ -248,6 +441,8 @@ void Node::AddChild(Node* child)
     }
 #endif
 
+    // Keep the child alive when the old parent holds the only reference
+    SharedPtr<Node> childRef(child);
     Node* oldParent = child->parent;
     if (oldParent)
     {
@@ -268,6 +463,25 @@ void Node::AddChild(Node* child)
         impl->scene->AddNode(child);
 }
 
+void Node::AddChildren(const std::vector<Node*>& newChildren)
+{
+    children.reserve(children.size() + newChildren.size());
+
+    bool spatialParent = TestFlag(NF_SPATIAL);
+    for (auto it = newChildren.begin(); it != newChildren.end(); ++it)
+    {
+        Node* child = *it;
+        assert(child && !child->parent && !child->impl->scene && child->children.empty());
+
+        children.push_back(SharedPtr<Node>(child));
+        child->parent = this;
+        child->SetFlag(NF_SPATIAL_PARENT, spatialParent && child->TestFlag(NF_SPATIAL));
+    }
+
+    if (impl->scene)
+        impl->scene->AddNodes(newChildren);
+}
+
 void Node::RemoveChild(Node* child)
 {
     if (!child || child->parent != this)
@@ -349,6 +563,20 @@ Node* Node::FindChild(const std::string& childName, bool recursive) const
 
 Node* Node::FindChild(const char* childName, bool recursive) const
 {
+    // A name that has not been interned can not belong to any node
+    InternedString internedName = InternedString::Find(childName);
+    if (!internedName && childName && *childName)
+        return nullptr;
+
+    return FindChild(internedName, recursive);
+}
+
+Node* Node::FindChild(InternedString childName, bool recursive) const
+{
+    Node* indexedResult;
+    if (recursive && childName && impl->scene && impl->scene->HasNodeIndex() && FindIndexedChild(childName.Hash(), StringHash::ZERO, childName, indexedResult))
+        return indexedResult;
+
     for (auto it = children.begin(); it != children.end(); ++it)
     {
         Node* child = *it;
@@ -367,10 +595,14 @@ Node* Node::FindChild(const char* childName, bool recursive) const
 
 Node* Node::FindChild(StringHash childNameHash, bool recursive) const
 {
+    Node* indexedResult;
+    if (recursive && childNameHash != StringHash::ZERO && impl->scene && impl->scene->HasNodeIndex() && FindIndexedChild(childNameHash, StringHash::ZERO, InternedString(), indexedResult))
+        return indexedResult;
+
     for (auto it = children.begin(); it != children.end(); ++it)
     {
         Node* child = *it;
-        if (child->impl->nameHash == childNameHash)
+        if (child->impl->name.Hash() == childNameHash)
             return child;
         else if (recursive && child->children.size())
         {
@@ -385,6 +617,10 @@ Node* Node::FindChild(StringHash childNameHash, bool recursive) const
 
 Node* Node::FindChildOfType(StringHash childType, bool recursive) const
 {
+    // The type lists are long, so the index is used only when the whole scene is searched
+    if (recursive && impl->scene == this && impl->scene->HasNodeIndex())
+        return impl->scene->FirstNodeByType(childType);
+
     for (auto it = children.begin(); it != children.end(); ++it)
     {
         Node* child = *it;
@@ -392,7 +628,7 @@ Node* Node::FindChildOfType(StringHash childType, bool recursive) const
             return child;
         else if (recursive && child->children.size())
         {
-            Node* childResult = child->FindChild(childType, recursive);
+            Node* childResult = child->FindChildOfType(childType, recursive);
             if (childResult)
                 return childResult;
         }
@@ -408,6 +644,19 @@ Node* Node::FindChildOfType(StringHash childType, const std::string& childName,
 
 Node* Node::FindChildOfType(StringHash childType, const char* childName, bool recursive) const
 {
+    InternedString internedName = InternedString::Find(childName);
+    if (!internedName && childName && *childName)
+        return nullptr;
+
+    return FindChildOfType(childType, internedName, recursive);
+}
+
+Node* Node::FindChildOfType(StringHash childType, InternedString childName, bool recursive) const
+{
+    Node* indexedResult;
+    if (recursive && childName && impl->scene && impl->scene->HasNodeIndex() && FindIndexedChild(childName.Hash(), childType, childName, indexedResult))
+        return indexedResult;
+
     for (auto it = children.begin(); it != children.end(); ++it)
     {
         Node* child = *it;
@@ -426,10 +675,14 @@ Node* Node::FindChildOfType(StringHash childType, const char* childName, bool re
 
 Node* Node::FindChildOfType(StringHash childType, StringHash childNameHash, bool recursive) const
 {
+    Node* indexedResult;
+    if (recursive && childNameHash != StringHash::ZERO && impl->scene && impl->scene->HasNodeIndex() && FindIndexedChild(childNameHash, childType, InternedString(), indexedResult))
+        return indexedResult;
+
     for (auto it = children.begin(); it != children.end(); ++it)
     {
         Node* child = *it;
-        if ((child->Type() == childType || DerivedFrom(child->Type(), childType)) && child->impl->nameHash == childNameHash)
+        if ((child->Type() == childType || DerivedFrom(child->Type(), childType)) && child->impl->name.Hash() == childNameHash)
             return child;
         else if (recursive && child->children.size())
         {
@@ -461,6 +714,12 @@ Node* Node::FindChildByLayer(unsigned layerMask, bool recursive) const
 
 void Node::FindChildren(std::vector<Node*>& result, StringHash childType, bool recursive) const
 {
+    if (recursive && impl->scene == this && impl->scene->HasNodeIndex())
+    {
+        impl->scene->NodesByType(result, childType);
+        return;
+    }
+
     for (auto it = children.begin(); it != children.end(); ++it)
     {
         Node* child = *it;
@@ -483,6 +742,44 @@ void Node::FindChildrenByLayer(std::vector<Node*>& result, unsigned layerMask, b
     }
 }
 
+bool Node::FindIndexedChild(StringHash childNameHash, StringHash childType, InternedString childName, Node*& result) const
+{
+    result = nullptr;
+    const std::vector<Node*>* nodes = impl->scene->NodesByName(childNameHash);
+    if (!nodes)
+        return true;
+
+    // All indexed nodes are descendants of the scene, otherwise the ancestry of each node with the name is checked. For a common name the subtree search is cheaper, so leave it to the caller
+    bool wholeScene = impl->scene == this;
+    if (!wholeScene && nodes->size() > MAX_INDEXED_SUBTREE_CANDIDATES)
+        return false;
+
+    for (auto it = nodes->begin(); it != nodes->end(); ++it)
+    {
+        Node* node = *it;
+        if (childName && node->impl->name != childName)
+            continue;
+        if (childType != StringHash::ZERO && node->Type() != childType && !DerivedFrom(node->Type(), childType))
+            continue;
+        if (wholeScene)
+        {
+            result = node;
+            return true;
+        }
+
+        for (Node* ancestor = node->parent; ancestor; ancestor = ancestor->parent)
+        {
+            if (ancestor == this)
+            {
+                result = node;
+                return true;
+            }
+        }
+    }
+
+    return true;
+}
+
 void Node::SetScene(Scene* newScene)
 {
     Scene* oldScene = impl->scene;
@@ -497,8 +794,7 @@ void Node::SetId(unsigned newId)
 
 void Node::SkipHierarchy(Stream& source)
 {
-    Serializable::Skip(source);
-
+    // The child nodes precede the attributes
     size_t numChildren = source.ReadVLE();
     for (size_t i = 0; i < numChildren; ++i)
     {
@@ -506,6 +802,8 @@ void Node::SkipHierarchy(Stream& source)
         source.Read<unsigned>(); // unsigned childId
         SkipHierarchy(source);
     }
+
+    Serializable::Skip(source);
 }
 
 void Node::OnParentSet(Node*, Node*)
@@ -523,3 +821,9 @@ void Node::OnEnabledChanged(bool)
 void Node::OnLayerChanged(unsigned char)
 {
 }
+
+void Node::OnAttributesDirty()
+{
+    if (impl->scene)
+        impl->scene->QueueChangedNode(this);
+}
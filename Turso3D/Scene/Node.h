@@ -2,9 +2,12 @@
 
 #pragma once
 
+#include "../IO/InternedString.h"
 #include "../Object/Serializable.h"
 #include "../Math/Quaternion.h"
 
+class JSONReader;
+class JSONWriter;
 class Node;
 class Octree;
 class Scene;
@@ -15,6 +18,16 @@ static const unsigned char NF_TEMPORARY = 0x2;
 static const unsigned char NF_SPATIAL = 0x4;
 static const unsigned char NF_SPATIAL_PARENT = 0x8;
 static const unsigned char NF_WORLD_TRANSFORM_DIRTY = 0x10;
+static const unsigned char NF_DELTA_ADDED = 0x20;
+static const unsigned char NF_DELTA_CHANGED = 0x40;
+static const unsigned char NF_SPATIAL_HASH = 0x80;
+
+/// Attribute indices of Node, for marking the attributes changed in the setters.
+static const size_t NODE_ATTR_NAME = 0;
+static const size_t NODE_ATTR_ENABLED = 1;
+static const size_t NODE_ATTR_TEMPORARY = 2;
+static const size_t NODE_ATTR_LAYER = 3;
+static const size_t NUM_NODE_ATTRS = 4;
 
 static const unsigned char LAYER_DEFAULT = 0x0;
 static const unsigned LAYERMASK_ALL = 0xffffffff;
@@ -26,16 +39,20 @@ struct NodeImpl
     Scene* scene;
     /// Id within the scene.
     unsigned id;
-    /// %Node name.
-    std::string name;
-    /// &Node name hash.
-    StringHash nameHash;
+    /// %Node name, interned so that nodes with the same name share it. Also holds the name hash.
+    InternedString name;
+    /// Position in the scene's node index by name, if indexed.
+    unsigned nameIndexPos;
+    /// Position in the scene's node index by type, if indexed.
+    unsigned typeIndexPos;
 };
 
 /// Base class for scene nodes.
 class Node : public Serializable
 {
     OBJECT(Node);
+
+    friend class Scene;
     
 public:
     /// Construct.
@@ -45,6 +62,10 @@ public:
     
     /// Register factory and attributes.
     static void RegisterObject();
+    /// Free the unused memory of the node data allocator, for example after destroying a large scene. Must not be called while worker threads create or destroy nodes. Return the number of bytes freed.
+    static size_t TrimAllocator();
+    /// Return number of allocated node data structures, which is the number of existing nodes.
+    static size_t NumAllocated();
     
     /// Load from binary stream. Store node references to be resolved later.
     void Load(Stream& source, ObjectResolver& resolver) override;
@@ -57,6 +78,10 @@ public:
     /// Return unique id within the scene, or 0 if not in a scene.
     unsigned Id() const override { return impl->id; }
 
+    /// Load from a streaming JSON reader, whose current token begins the node's object. Store node references to be resolved later. Return true on success.
+    bool LoadJSON(JSONReader& source, ObjectResolver& resolver);
+    /// Save to a streaming JSON writer as an object.
+    void SaveJSON(JSONWriter& dest);
     /// Save as JSON text data to a binary stream. Return true on success.
     bool SaveJSON(Stream& dest);
     /// Set name. Is not required to be unique within the scene.
@@ -81,6 +106,8 @@ public:
     Node* CreateChild(StringHash childType, const char* childName);
     /// Add node as a child. Same as calling SetParent for the child node.
     void AddChild(Node* child);
+    /// Add newly created nodes without parent or children as children in bulk. The child vector and scene id map are grown once. The parent and scene assignment handlers are not called, so the caller must do their work. Used for bulk spawning.
+    void AddChildren(const std::vector<Node*>& newChildren);
     /// Remove child node. Will delete it if there are no other strong references to it.
     void RemoveChild(Node* child);
     /// Remove child node by index.
@@ -97,9 +124,11 @@ public:
     template <class T> T* CreateChild(const char* childName) { return static_cast<T*>(CreateChild(T::TypeStatic(), childName)); }
 
     /// Return name.
-    const std::string& Name() const { return impl->name; }
+    const std::string& Name() const { return impl->name.Str(); }
+    /// Return interned name.
+    InternedString InternedName() const { return impl->name; }
     /// Return hash of name.
-    const StringHash& NameHash() const { return impl->nameHash; }
+    const StringHash& NameHash() const { return impl->name.Hash(); }
     /// Return layer.
     unsigned char Layer() const { return layer; }
     /// Return bitmask corresponding to layer.
@@ -126,6 +155,8 @@ public:
     Node* FindChild(const std::string& childName, bool recursive = false) const;
     /// Return first child node that matches name.
     Node* FindChild(const char* childName, bool recursive = false) const;
+    /// Return first child node that matches interned name.
+    Node* FindChild(InternedString childName, bool recursive = false) const;
     /// Return first child node that matches name hash.
     Node* FindChild(StringHash nameHash, bool recursive = false) const;
     /// Return first child node of specified type.
@@ -134,6 +165,8 @@ public:
     Node* FindChildOfType(StringHash childType, const std::string& childName, bool recursive = false) const;
     /// Return first child node that matches type and name.
     Node* FindChildOfType(StringHash childType, const char* childName, bool recursive = false) const;
+    /// Return first child node that matches type and interned name.
+    Node* FindChildOfType(StringHash childType, InternedString childName, bool recursive = false) const;
     /// Return first child node that matches type and name.
     Node* FindChildOfType(StringHash childType, StringHash childNameHash, bool recursive = false) const;
     /// Return first child node that matches layer mask.
@@ -176,8 +209,17 @@ protected:
     virtual void OnEnabledChanged(bool newEnabled);
     /// Handle the layer changing.
     virtual void OnLayerChanged(unsigned char newLayer);
+    /// Handle the first attribute being marked changed. Record the node for the scene's next delta snapshot.
+    void OnAttributesDirty() override;
+    /// Create and load a child node from a streaming JSON reader, whose current token begins the child's object. Return the child, or null if could not be created.
+    Node* LoadChildJSON(JSONReader& source, ObjectResolver& resolver);
+    /// Load the remaining members of the node's object from a streaming JSON reader. Return true on success.
+    bool LoadJSONMembers(JSONReader& source, ObjectResolver& resolver);
 
 private:
+    /// Find a descendant by name hash from the scene's node index, optionally also matching the type and the exact interned name. Return false without searching if a subtree search would be cheaper, in which case the caller searches the children.
+    bool FindIndexedChild(StringHash childNameHash, StringHash childType, InternedString childName, Node*& result) const;
+
     /// Node implementation.
     NodeImpl* impl;
     /// Parent node.
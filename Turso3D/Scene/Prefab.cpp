@@ -0,0 +1,226 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "../Object/ObjectResolver.h"
+#include "Prefab.h"
+#include "Scene.h"
+#include "SpatialNode.h"
+
+#include <cstring>
+#include <tracy/Tracy.hpp>
+
+// Parent index of the prefab root node
+static const size_t PREFAB_ROOT = (size_t)-1;
+
+Prefab::Prefab()
+{
+}
+
+Prefab::~Prefab()
+{
+}
+
+void Prefab::RegisterObject()
+{
+    RegisterFactory<Prefab>();
+}
+
+bool Prefab::BeginLoad(Stream& source)
+{
+    ZoneScoped;
+
+    loadBuffer.SetData(source, source.Size() - source.Position());
+    if (loadBuffer.ReadFileID() != "PRFB")
+    {
+        LOGERROR(source.Name() + " is not a valid prefab file");
+        loadBuffer.Clear();
+        return false;
+    }
+
+    // Parse once to find the resources, so that they can load in parallel before the nodes are created
+    size_t dataStart = loadBuffer.Position();
+    dependencies.clear();
+    Scene::ParseHierarchyResources(loadBuffer, dependencies);
+    loadBuffer.Seek(dataStart);
+
+    return true;
+}
+
+bool Prefab::EndLoad()
+{
+    ZoneScoped;
+
+    StringHash rootType(loadBuffer.Read<StringHash>());
+    unsigned rootId = loadBuffer.Read<unsigned>();
+
+    SharedPtr<Object> newObject(Create(rootType));
+    Node* root = dynamic_cast<Node*>(newObject.Get());
+    if (!root)
+    {
+        LOGERROR("Could not create prefab root node of type " + rootType.ToString());
+        loadBuffer.Clear();
+        return false;
+    }
+
+    ObjectResolver resolver;
+    resolver.StoreObject(rootId, root);
+    root->Load(loadBuffer, resolver);
+    resolver.Resolve();
+    loadBuffer.Clear();
+
+    prototype = root;
+    BuildTemplate();
+    return true;
+}
+
+bool Prefab::Save(Stream& dest)
+{
+    ZoneScoped;
+
+    if (!prototype)
+        return false;
+
+    dest.WriteFileID("PRFB");
+    prototype->Save(dest);
+    return true;
+}
+
+void Prefab::Dependencies(std::vector<ResourceRef>& dest) const
+{
+    for (auto it = dependencies.begin(); it != dependencies.end(); ++it)
+    {
+        if (!it->name.empty())
+            dest.push_back(*it);
+    }
+}
+
+bool Prefab::Define(Node* source)
+{
+    ZoneScoped;
+
+    if (!source)
+        return false;
+
+    VectorBuffer buffer;
+    buffer.WriteFileID("PRFB");
+    source->Save(buffer);
+    buffer.Seek(0);
+    return Load(buffer);
+}
+
+Node* Prefab::Instantiate(Node* parent) const
+{
+    if (!parent)
+        return nullptr;
+
+    SharedPtr<Node> root = Clone();
+    if (root)
+        parent->AddChild(root);
+    return root;
+}
+
+Node* Prefab::Instantiate(Node* parent, const Vector3& position, const Quaternion& rotation) const
+{
+    if (!parent)
+        return nullptr;
+
+    SharedPtr<Node> root = Clone();
+    if (!root)
+        return nullptr;
+
+    // Set the transform before the node is in the scene, so that the octree sees only the final position
+    if (root->TestFlag(NF_SPATIAL))
+        static_cast<SpatialNode*>(root.Get())->SetTransform(position, rotation);
+
+    parent->AddChild(root);
+    return root;
+}
+
+void Prefab::Instantiate(Node* parent, size_t count, std::vector<Node*>& dest) const
+{
+    ZoneScoped;
+
+    if (!parent || nodes.empty())
+        return;
+
+    dest.reserve(dest.size() + count);
+    for (size_t i = 0; i < count; ++i)
+        dest.push_back(Instantiate(parent));
+}
+
+void Prefab::BuildTemplate()
+{
+    nodes.clear();
+    if (prototype)
+        AddTemplateNode(prototype, PREFAB_ROOT);
+}
+
+void Prefab::AddTemplateNode(Node* node, size_t parent)
+{
+    size_t index = nodes.size();
+    nodes.resize(index + 1);
+
+    PrefabNode& templateNode = nodes[index];
+    templateNode.type = node->Type();
+    templateNode.parent = parent;
+    templateNode.prototype = node;
+
+    const std::vector<SharedPtr<Attribute> >* attributes = node->Attributes();
+    if (attributes)
+    {
+        for (auto it = attributes->begin(); it != attributes->end(); ++it)
+        {
+            Attribute* attr = *it;
+            if (attr->MemberOffset() != NO_MEMBER_OFFSET)
+                templateNode.memberAttributes.push_back(std::make_pair(attr->MemberOffset(), Attribute::byteSizes[attr->Type()]));
+            // Default values need not be copied to a new node
+            else if (attr->Type() != ATTR_OBJECTREF && !attr->IsDefault(node))
+                templateNode.copyAttributes.push_back(attr);
+        }
+    }
+
+    const std::vector<SharedPtr<Node> >& children = node->Children();
+    for (auto it = children.begin(); it != children.end(); ++it)
+    {
+        Node* child = *it;
+        if (!child->IsTemporary())
+            AddTemplateNode(child, index);
+    }
+}
+
+SharedPtr<Node> Prefab::Clone() const
+{
+    ZoneScoped;
+
+    if (nodes.empty())
+        return SharedPtr<Node>();
+
+    // The template has been created from the same types, so the creation does not fail
+    std::vector<Node*> created(nodes.size());
+    SharedPtr<Node> root(static_cast<Node*>(Create(nodes[0].type)));
+    created[0] = root;
+    for (size_t i = 1; i < nodes.size(); ++i)
+        created[i] = created[nodes[i].parent]->CreateChild(nodes[i].type);
+
+    // Apply the attributes children first as in Node::Load(). Descendants follow their ancestor in the template
+    for (size_t i = nodes.size() - 1; i < nodes.size(); --i)
+    {
+        const PrefabNode& templateNode = nodes[i];
+        Node* node = created[i];
+        Node* prototypeNode = templateNode.prototype;
+
+        if (templateNode.memberAttributes.size())
+        {
+            unsigned char* dest = reinterpret_cast<unsigned char*>(static_cast<Serializable*>(node));
+            const unsigned char* source = reinterpret_cast<const unsigned char*>(static_cast<Serializable*>(prototypeNode));
+            for (auto it = templateNode.memberAttributes.begin(); it != templateNode.memberAttributes.end(); ++it)
+                memcpy(dest + it->first, source + it->first, it->second);
+            node->OnMemberAttributesSet();
+        }
+
+        for (auto it = templateNode.copyAttributes.begin(); it != templateNode.copyAttributes.end(); ++it)
+            (*it)->Copy(prototypeNode, node);
+    }
+
+    return root;
+}
@@ -0,0 +1,80 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../IO/VectorBuffer.h"
+#include "../Math/Quaternion.h"
+#include "../Resource/Resource.h"
+
+class Attribute;
+class Node;
+
+/// Node of a prefab template.
+struct PrefabNode
+{
+    /// Node type.
+    StringHash type;
+    /// Index of the parent node in the template, or none for the root.
+    size_t parent;
+    /// Node in the prototype hierarchy that holds the values.
+    Node* prototype;
+    /// Attributes with non-default values, copied through their accessors.
+    std::vector<Attribute*> copyAttributes;
+    /// Member attributes as offsets and sizes, copied directly.
+    std::vector<std::pair<size_t, size_t> > memberAttributes;
+};
+
+/// Node hierarchy template resource, parsed once and then cloned without serialization for each instance. Stored as a binary node hierarchy. Resources such as models and materials are shared by reference between the instances until an instance is assigned others. Object reference attributes are not copied.
+class Prefab : public Resource
+{
+    OBJECT(Prefab);
+
+public:
+    /// Construct.
+    Prefab();
+    /// Destruct.
+    ~Prefab();
+
+    /// Register object factory.
+    static void RegisterObject();
+
+    /// Load the binary data and collect the referenced resources. May be executed outside the main thread. Return true on success.
+    bool BeginLoad(Stream& source) override;
+    /// Create the prototype hierarchy and the template. Return true on success.
+    bool EndLoad() override;
+    /// Save the prototype hierarchy. Return true on success.
+    bool Save(Stream& dest) override;
+    /// Return the resources referenced by the node attributes, so that asynchronous loading loads them in parallel.
+    void Dependencies(std::vector<ResourceRef>& dest) const override;
+
+    /// Define from a copy of a node hierarchy. Temporary child nodes are excluded. Return true on success.
+    bool Define(Node* source);
+    /// Instantiate a copy of the hierarchy as a child of a parent node. The nodes are created and their attributes copied before adding to the parent. Return the root node, or null on failure.
+    Node* Instantiate(Node* parent) const;
+    /// Instantiate a copy of the hierarchy as a child of a parent node, with the root node's position and rotation set if it is a spatial node. Return the root node, or null on failure.
+    Node* Instantiate(Node* parent, const Vector3& position, const Quaternion& rotation = Quaternion::IDENTITY) const;
+    /// Instantiate several copies of the hierarchy as children of a parent node. Append the root nodes to a vector.
+    void Instantiate(Node* parent, size_t count, std::vector<Node*>& dest) const;
+
+    /// Return the prototype root node, which is not in a scene. Should not be modified.
+    Node* Prototype() const { return prototype; }
+    /// Return the number of nodes in the hierarchy.
+    size_t NumNodes() const { return nodes.size(); }
+
+private:
+    /// Build the template from the prototype hierarchy.
+    void BuildTemplate();
+    /// Add a prototype node and its persistent children to the template.
+    void AddTemplateNode(Node* node, size_t parent);
+    /// Create a detached copy of the hierarchy and return its root, or null on failure.
+    SharedPtr<Node> Clone() const;
+
+    /// Binary data between BeginLoad() and EndLoad().
+    VectorBuffer loadBuffer;
+    /// Resources referenced by the binary data.
+    std::vector<ResourceRef> dependencies;
+    /// Prototype hierarchy.
+    SharedPtr<Node> prototype;
+    /// Template nodes in depth-first order, so that parents precede their children.
+    std::vector<PrefabNode> nodes;
+};
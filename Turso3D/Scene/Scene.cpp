@@ -1,17 +1,125 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/JSONReader.h"
+#include "../IO/JSONValue.h"
+#include "../IO/JSONWriter.h"
 #include "../IO/Log.h"
-#include "../IO/Stream.h"
+#include "../IO/MemoryBuffer.h"
+#include "../IO/ResourceRef.h"
+#include "../IO/StringUtils.h"
+#include "../IO/VectorBuffer.h"
 #include "../Object/ObjectResolver.h"
-#include "../Resource/JSONFile.h"
+#include "../Resource/ResourceCache.h"
+#include "../Thread/WorkQueue.h"
+#include "Prefab.h"
 #include "Scene.h"
 #include "SpatialNode.h"
 
+#include <set>
 #include <tracy/Tracy.hpp>
 
+// Minimum number of nodes on a hierarchy level to compute the world transforms in worker threads
+static const size_t MIN_THREADED_TRANSFORMS = 256;
+static const size_t MIN_UPDATE_CALLBACKS_PER_TASK = 256;
+// Parent index of the top-level nodes of a parsed subtree
+static const size_t PARSED_NODE_ROOT = (size_t)-1;
+
+/// Node of a binary scene parsed in the first loading phase.
+struct ParsedNode
+{
+    /// Node type.
+    StringHash type;
+    /// Id in the serialized data.
+    unsigned oldId;
+    /// Index of the parent node within the subtree, or PARSED_NODE_ROOT for the subtree root.
+    size_t parent;
+    /// Number of child nodes.
+    size_t numChildren;
+    /// Position of the attributes in the stream.
+    size_t attrOffset;
+};
+
+/// Top-level subtree of a binary scene parsed in the first loading phase.
+struct ParsedSubtree
+{
+    /// Nodes in the order they are created.
+    std::vector<ParsedNode> nodes;
+    /// Node indices in the order their attributes are applied, children before parents.
+    std::vector<size_t> attrOrder;
+    /// Resources referenced by the attributes.
+    std::vector<ResourceRef> resources;
+};
+
+/// Skip the attributes of a node, recording the resource references.
+static void ParseAttributes(Stream& source, std::vector<ResourceRef>& resources)
+{
+    size_t numAttrs = source.ReadVLE();
+    for (size_t i = 0; i < numAttrs; ++i)
+    {
+        AttributeType type = (AttributeType)source.Read<unsigned char>();
+        if (type == ATTR_RESOURCEREF)
+            resources.push_back(source.Read<ResourceRef>());
+        else if (type == ATTR_RESOURCEREFLIST)
+        {
+            ResourceRefList refList = source.Read<ResourceRefList>();
+            for (auto it = refList.names.begin(); it != refList.names.end(); ++it)
+                resources.push_back(ResourceRef(refList.type, *it));
+        }
+        else
+            Attribute::Skip(type, source);
+    }
+}
+
+/// Parse a node hierarchy without creating the nodes. The type and id of the node are read here.
+static void ParseHierarchy(Stream& source, ParsedSubtree& dest, size_t parent)
+{
+    size_t index = dest.nodes.size();
+    dest.nodes.resize(index + 1);
+    dest.nodes[index].type = source.Read<StringHash>();
+    dest.nodes[index].oldId = source.Read<unsigned>();
+    dest.nodes[index].parent = parent;
+
+    // The child nodes precede the attributes
+    size_t numChildren = source.ReadVLE();
+    dest.nodes[index].numChildren = numChildren;
+    for (size_t i = 0; i < numChildren; ++i)
+        ParseHierarchy(source, dest, index);
+
+    dest.nodes[index].attrOffset = source.Position();
+    dest.attrOrder.push_back(index);
+    ParseAttributes(source, dest.resources);
+}
+
+/// Return whether a node and its ancestors are not temporary, so that it would be saved.
+static bool IsPersistent(Node* node)
+{
+    for (; node; node = node->Parent())
+    {
+        if (node->IsTemporary())
+            return false;
+    }
+
+    return true;
+}
+
 Scene::Scene() :
-    nextNodeId(1)
+    numNodes(0),
+    fixedAccumulator(0.0),
+    fixedTimeStep(0.0f),
+    maxFixedSteps(5),
+    requestedNodeId(0),
+    changeTracking(false),
+    nodeIndex(false)
 {
+    NodeSlot reserved;
+    reserved.node = nullptr;
+    reserved.generation = 0;
+    nodeSlots.push_back(reserved);
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    transformQueues.resize(workQueue ? workQueue->NumThreads() : 1);
+    threadChangedNodes.resize(workQueue ? workQueue->NumThreads() : 1);
+
     // Register self to allow finding by ID
     AddNode(this);
 }
@@ -22,7 +130,7 @@ Scene::~Scene()
     // so must tear down the scene tree already here
     RemoveAllChildren();
     RemoveNode(this);
-    assert(nodes.empty());
+    assert(!numNodes);
 }
 
 void Scene::RegisterObject()
@@ -32,24 +140,58 @@ void Scene::RegisterObject()
     CopyBaseAttributes<Scene, Node>();
 }
 
+size_t Scene::ParseHierarchyResources(Stream& source, std::vector<ResourceRef>& resources)
+{
+    ParsedSubtree subtree;
+    ParseHierarchy(source, subtree, PARSED_NODE_ROOT);
+    resources.insert(resources.end(), subtree.resources.begin(), subtree.resources.end());
+    return subtree.nodes.size();
+}
+
 void Scene::Save(Stream& dest)
 {
     ZoneScoped;
     
     LOGINFO("Saving scene to " + dest.Name());
     
-    dest.WriteFileID("SCNE");
-    Node::Save(dest);
+    // Write the top-level subtrees with their sizes, so that loading can parse them in parallel
+    dest.WriteFileID("SCN2");
+    dest.Write(Type());
+    dest.Write(Id());
+    dest.WriteVLE(NumPersistentChildren());
+
+    VectorBuffer subtree;
+    for (auto it = children.begin(); it != children.end(); ++it)
+    {
+        Node* child = *it;
+        if (child->IsTemporary())
+            continue;
+
+        subtree.Clear();
+        child->Save(subtree);
+        dest.Write((unsigned)subtree.Size());
+        dest.Write(subtree.Data(), subtree.Size());
+    }
+
+    Serializable::Save(dest);
 }
 
 bool Scene::Load(Stream& source)
 {
     ZoneScoped;
     
+    // Parse from memory, so that the attribute value reads are inlined
+    if (!source.IsMemoryBacked())
+    {
+        VectorBuffer buffer(source, source.Size() - source.Position());
+        buffer.SetName(source.Name());
+        return Load(buffer);
+    }
+
     LOGINFO("Loading scene from " + source.Name());
     
     std::string fileId = source.ReadFileID();
-    if (fileId != "SCNE")
+    if (fileId != "SCNE" && fileId != "SCN2")
     {
         LOGERROR("File is not a binary scene file");
         return false;
@@ -65,9 +207,112 @@ bool Scene::Load(Stream& source)
 
     Clear();
 
+    // Phase one: parse the top-level subtrees into flat node tables without creating anything. Subtrees with known sizes are parsed in worker threads
+    size_t numChildren = source.ReadVLE();
+    std::vector<ParsedSubtree> subtrees(numChildren);
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+
+    if (fileId == "SCN2")
+    {
+        std::vector<size_t> offsets(numChildren);
+        for (size_t i = 0; i < numChildren; ++i)
+        {
+            unsigned subtreeSize = source.Read<unsigned>();
+            offsets[i] = source.Position();
+            source.Seek(offsets[i] + subtreeSize);
+        }
+
+        const unsigned char* data = source.MemoryData();
+        size_t dataSize = source.Size();
+        auto parseSubtrees = [&](size_t start, size_t end, unsigned)
+        {
+            MemoryBuffer buffer(data, dataSize);
+            for (size_t i = start; i < end; ++i)
+            {
+                buffer.Seek(offsets[i]);
+                ParseHierarchy(buffer, subtrees[i], PARSED_NODE_ROOT);
+            }
+        };
+
+        if (workQueue)
+            workQueue->ParallelFor(0, numChildren, 1, parseSubtrees);
+        else
+            parseSubtrees(0, numChildren, 0);
+    }
+    else
+    {
+        for (size_t i = 0; i < numChildren; ++i)
+            ParseHierarchy(source, subtrees[i], PARSED_NODE_ROOT);
+    }
+
+    size_t ownAttrOffset = source.Position();
+
+    // Load the referenced resources in parallel, so that the attributes find them in the cache
+    ResourceCache* cache = Subsystem<ResourceCache>();
+    if (cache && workQueue)
+    {
+        std::set<std::pair<StringHash, std::string> > requested;
+        for (auto it = subtrees.begin(); it != subtrees.end(); ++it)
+        {
+            for (auto rIt = it->resources.begin(); rIt != it->resources.end(); ++rIt)
+            {
+                if (!rIt->name.empty() && requested.insert(std::make_pair(rIt->type, rIt->name)).second)
+                    cache->LoadResourceAsync(rIt->type, rIt->name);
+            }
+        }
+        cache->CompleteAsyncLoading();
+    }
+
+    // Phase two: create the nodes, then apply the attributes children first as in Node::Load()
+    // Keep the node ids of the saved data where possible, so that deltas saved from the same scene apply
     ObjectResolver resolver;
     resolver.StoreObject(ownId, this);
-    Node::Load(source, resolver);
+    MapSourceId(ownId, this);
+
+    size_t totalNodes = 0;
+    for (auto it = subtrees.begin(); it != subtrees.end(); ++it)
+        totalNodes += it->nodes.size();
+    nodeSlots.reserve(nodeSlots.size() + totalNodes);
+    children.reserve(numChildren);
+
+    MemoryBuffer attrSource(source.MemoryData(), source.Size());
+    std::vector<Node*> created;
+
+    for (auto it = subtrees.begin(); it != subtrees.end(); ++it)
+    {
+        const std::vector<ParsedNode>& nodes = it->nodes;
+        created.resize(nodes.size());
+
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            const ParsedNode& parsed = nodes[i];
+            // The children of a node that could not be created are skipped
+            Node* parentNode = parsed.parent == PARSED_NODE_ROOT ? this : created[parsed.parent];
+            requestedNodeId = parsed.oldId;
+            Node* child = parentNode ? parentNode->CreateChild(parsed.type) : nullptr;
+            requestedNodeId = 0;
+            created[i] = child;
+            if (child)
+            {
+                child->children.reserve(parsed.numChildren);
+                resolver.StoreObject(parsed.oldId, child);
+                MapSourceId(parsed.oldId, child);
+            }
+        }
+
+        for (auto aIt = it->attrOrder.begin(); aIt != it->attrOrder.end(); ++aIt)
+        {
+            Node* node = created[*aIt];
+            if (node)
+            {
+                attrSource.Seek(nodes[*aIt].attrOffset);
+                node->Serializable::Load(attrSource, resolver);
+            }
+        }
+    }
+
+    source.Seek(ownAttrOffset);
+    Serializable::Load(source, resolver);
     resolver.Resolve();
 
     return true;
@@ -101,10 +346,23 @@ bool Scene::LoadJSON(Stream& source)
     ZoneScoped;
 
     LOGINFO("Loading scene from " + source.Name());
-    
-    JSONFile json;
-    bool success = json.Load(source);
-    LoadJSON(json.Root());
+
+    // Stream the nodes directly from the text instead of building a value tree of the whole scene
+    JSONReader reader(source);
+    if (reader.Next() != JSON_TOKEN_BEGIN_OBJECT)
+    {
+        LOGERROR("Scene JSON data from " + source.Name() + " does not begin with an object");
+        return false;
+    }
+
+    Clear();
+
+    ObjectResolver resolver;
+    bool success = Node::LoadJSON(reader, resolver);
+    resolver.Resolve();
+
+    if (!success)
+        LOGERROR("Failed to load scene JSON data from " + source.Name() + " on line " + ToString((unsigned)reader.Line()) + "; data may be partial");
     return success;
 }
 
@@ -113,16 +371,26 @@ bool Scene::SaveJSON(Stream& dest)
     ZoneScoped;
     
     LOGINFO("Saving scene to " + dest.Name());
-    
-    JSONFile json;
-    Node::SaveJSON(json.Root());
-    return json.Save(dest);
+
+    JSONWriter writer(dest);
+    Node::SaveJSON(writer);
+    return writer.Flush();
 }
 
 Node* Scene::Instantiate(Stream& source)
 {
     ZoneScoped;
     
+    // Parse from memory and leave the source positioned after the instantiated data
+    if (!source.IsMemoryBacked())
+    {
+        size_t start = source.Position();
+        VectorBuffer buffer(source, source.Size() - start);
+        Node* child = Instantiate(buffer);
+        source.Seek(start + buffer.Position());
+        return child;
+    }
+
     ObjectResolver resolver;
     StringHash childType(source.Read<StringHash>());
     unsigned childId = source.Read<unsigned>();
@@ -161,47 +429,228 @@ Node* Scene::InstantiateJSON(Stream& source)
 {
     ZoneScoped;
 
-    JSONFile json;
-    json.Load(source);
-    return InstantiateJSON(json.Root());
+    JSONReader reader(source);
+    if (reader.Next() != JSON_TOKEN_BEGIN_OBJECT)
+        return nullptr;
+
+    ObjectResolver resolver;
+    Node* child = LoadChildJSON(reader, resolver);
+    resolver.Resolve();
+    return child;
 }
 
 void Scene::Clear()
 {
     RemoveAllChildren();
-    nextNodeId = 1;
+    sourceIds.clear();
+
+    // Reuse the lowest slots first, so that the ids start again from the beginning. The generations are kept
+    freeSlots.clear();
+    for (size_t i = nodeSlots.size() - 1; i > 0; --i)
+    {
+        if (!nodeSlots[i].node)
+            freeSlots.push_back((unsigned)i);
+    }
+}
+
+void Scene::SetChangeTracking(bool enable)
+{
+    if (enable == changeTracking)
+        return;
+
+    changeTracking = enable;
+    addedNodes.clear();
+    removedNodes.clear();
+    changedNodes.clear();
+
+    for (auto it = nodeSlots.begin(); it != nodeSlots.end(); ++it)
+    {
+        Node* node = it->node;
+        if (node)
+        {
+            node->ClearDirtyAttributes();
+            node->SetFlag(NF_DELTA_ADDED | NF_DELTA_CHANGED, false);
+        }
+    }
 }
 
-Node* Scene::FindNode(unsigned id_) const
+void Scene::SaveDelta(Stream& dest)
 {
-    auto it = nodes.find(id_);
-    return it != nodes.end() ? it->second : nullptr;
+    ZoneScoped;
+
+    dest.WriteFileID("SDLT");
+
+    dest.WriteVLE(removedNodes.size());
+    for (auto it = removedNodes.begin(); it != removedNodes.end(); ++it)
+        dest.Write(*it);
+    removedNodes.clear();
+
+    // Write the added and changed nodes to buffers first, as the ones removed again or temporary are not counted
+    VectorBuffer buffer;
+    size_t count = 0;
+    for (auto it = addedNodes.begin(); it != addedNodes.end(); ++it)
+    {
+        Node* node = FindNode(*it);
+        if (node && node->TestFlag(NF_DELTA_ADDED))
+            SaveAddedNode(buffer, node, count);
+    }
+    addedNodes.clear();
+
+    dest.WriteVLE(count);
+    dest.Write(buffer.Data(), buffer.Size());
+
+    buffer.Clear();
+    count = 0;
+    for (auto it = changedNodes.begin(); it != changedNodes.end(); ++it)
+    {
+        Node* node = FindNode(*it);
+        if (!node || !node->TestFlag(NF_DELTA_CHANGED))
+            continue;
+
+        node->SetFlag(NF_DELTA_CHANGED, false);
+        if (!IsPersistent(node))
+        {
+            node->ClearDirtyAttributes();
+            continue;
+        }
+
+        // The parent is written to also carry reparenting
+        buffer.Write(node->Id());
+        buffer.Write(node->Parent() ? node->Parent()->Id() : 0);
+        node->SaveDirtyAttributes(buffer);
+        ++count;
+    }
+    changedNodes.clear();
+
+    dest.WriteVLE(count);
+    dest.Write(buffer.Data(), buffer.Size());
+}
+
+bool Scene::ApplyDelta(Stream& source)
+{
+    ZoneScoped;
+
+    if (source.ReadFileID() != "SDLT")
+    {
+        LOGERROR("Data is not a scene delta");
+        return false;
+    }
+
+    size_t numRemoved = source.ReadVLE();
+    for (size_t i = 0; i < numRemoved; ++i)
+    {
+        unsigned id = source.Read<unsigned>();
+        Node* node = FindSourceNode(id);
+        if (node && node != this)
+            node->RemoveSelf();
+        if (sourceIds.size())
+            sourceIds.erase(id);
+    }
+
+    // Create the added nodes parents first, then apply their attributes children first as in Node::Load()
+    ObjectResolver resolver;
+    std::vector<std::pair<Node*, size_t> > added;
+    size_t numAdded = source.ReadVLE();
+    for (size_t i = 0; i < numAdded; ++i)
+    {
+        unsigned parentId = source.Read<unsigned>();
+        StringHash type = source.Read<StringHash>();
+        unsigned id = source.Read<unsigned>();
+
+        Node* parentNode = FindSourceNode(parentId);
+        requestedNodeId = id;
+        Node* node = parentNode ? parentNode->CreateChild(type) : nullptr;
+        requestedNodeId = 0;
+        if (node)
+        {
+            MapSourceId(id, node);
+            added.push_back(std::make_pair(node, source.Position()));
+        }
+
+        Serializable::Skip(source);
+    }
+
+    size_t changedOffset = source.Position();
+    for (auto it = added.rbegin(); it != added.rend(); ++it)
+    {
+        source.Seek(it->second);
+        it->first->Serializable::Load(source, resolver);
+    }
+    source.Seek(changedOffset);
+
+    size_t numChanged = source.ReadVLE();
+    for (size_t i = 0; i < numChanged; ++i)
+    {
+        Node* node = FindSourceNode(source.Read<unsigned>());
+        Node* parentNode = FindSourceNode(source.Read<unsigned>());
+        if (!node)
+        {
+            Serializable::SkipDirtyAttributes(source);
+            continue;
+        }
+
+        if (parentNode && node != this && node->Parent() != parentNode)
+            parentNode->AddChild(node);
+        node->LoadDirtyAttributes(source, resolver);
+    }
+
+    // The object refs may point to any node of the scene
+    const std::vector<StoredObjectRef>& refs = resolver.ObjectRefs();
+    for (auto it = refs.begin(); it != refs.end(); ++it)
+        resolver.StoreObject(it->oldId, FindSourceNode(it->oldId));
+    resolver.Resolve();
+
+    return true;
 }
 
 void Scene::AddNode(Node* node)
 {
-    if (!node || node->ParentScene() == this)
+    if (!node)
         return;
 
-    while (nodes.find(nextNodeId) != nodes.end())
+    // Reparenting within the scene is recorded as a change of the node
+    if (node->ParentScene() == this)
     {
-        ++nextNodeId;
-        if (!nextNodeId)
-            ++nextNodeId;
+        QueueChangedNode(node);
+        return;
     }
 
+    unsigned newId = AllocateNodeId(node, requestedNodeId);
+    requestedNodeId = 0;
+    if (!newId)
+        return;
+
     Scene* oldScene = node->ParentScene();
     if (oldScene)
     {
-        unsigned oldId = node->Id();
-        oldScene->nodes.erase(oldId);
+        oldScene->FreeNodeId(node->Id());
+        if (oldScene->nodeIndex)
+            oldScene->RemoveFromNodeIndex(node, node->NameHash());
     }
 
-    nodes[nextNodeId] = node;
     node->SetScene(this);
-    node->SetId(nextNodeId);
+    node->SetId(newId);
+    if (nodeIndex)
+        AddToNodeIndex(node);
+
+    // An added node is written whole to the next delta, so its earlier attribute changes are not needed
+    node->ClearDirtyAttributes();
+    node->SetFlag(NF_DELTA_CHANGED, false);
+    node->SetFlag(NF_DELTA_ADDED, changeTracking);
+    if (changeTracking)
+        addedNodes.push_back(newId);
+
+    if (node->TestFlag(NF_SPATIAL))
+    {
+        SpatialNode* spatialNode = static_cast<SpatialNode*>(node);
+        if (oldScene)
+            oldScene->RemoveFromTransformQueue(spatialNode);
 
-    ++nextNodeId;
+        // Queue the topmost dirty node so that the transforms of the added hierarchy are computed in advance
+        SpatialNode* parentNode = spatialNode->SpatialParent();
+        if (spatialNode->TestFlag(NF_WORLD_TRANSFORM_DIRTY) && (!parentNode || !parentNode->TestFlag(NF_WORLD_TRANSFORM_DIRTY)))
+            QueueTransformUpdate(spatialNode);
+    }
 
     // If node has children, add them to the scene as well
     if (node->NumChildren())
@@ -212,14 +661,61 @@ void Scene::AddNode(Node* node)
     }
 }
 
+void Scene::AddNodes(const std::vector<Node*>& newNodes)
+{
+    size_t count = newNodes.size();
+    if (!count)
+        return;
+
+    nodeSlots.reserve(nodeSlots.size() + (count > freeSlots.size() ? count - freeSlots.size() : 0));
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        Node* node = newNodes[i];
+        unsigned newId = AllocateNodeId(node);
+        // The table is full, so the rest of the nodes can not be added either
+        if (!newId)
+            return;
+
+        node->impl->scene = this;
+        node->impl->id = newId;
+        if (nodeIndex)
+            AddToNodeIndex(node);
+
+        node->ClearDirtyAttributes();
+        node->SetFlag(NF_DELTA_CHANGED, false);
+        node->SetFlag(NF_DELTA_ADDED, changeTracking);
+        if (changeTracking)
+            addedNodes.push_back(newId);
+
+        if (node->TestFlag(NF_SPATIAL))
+        {
+            SpatialNode* spatialNode = static_cast<SpatialNode*>(node);
+            SpatialNode* parentNode = spatialNode->SpatialParent();
+            if (spatialNode->TestFlag(NF_WORLD_TRANSFORM_DIRTY) && (!parentNode || !parentNode->TestFlag(NF_WORLD_TRANSFORM_DIRTY)))
+                QueueTransformUpdate(spatialNode);
+        }
+    }
+}
+
 void Scene::RemoveNode(Node* node)
 {
     if (!node || node->ParentScene() != this)
         return;
 
-    nodes.erase(node->Id());
+    // Nodes added since the previous delta were never seen by its receiver
+    if (changeTracking && !node->TestFlag(NF_DELTA_ADDED) && IsPersistent(node))
+        removedNodes.push_back(node->Id());
+    node->SetFlag(NF_DELTA_ADDED | NF_DELTA_CHANGED, false);
+
+    FreeNodeId(node->Id());
+    if (nodeIndex)
+        RemoveFromNodeIndex(node, node->NameHash());
     node->SetScene(nullptr);
     node->SetId(0);
+    if (node->TestFlag(NF_SPATIAL))
+        RemoveFromTransformQueue(static_cast<SpatialNode*>(node));
+    RemoveUpdateCallbacks(node);
     
     // If node has children, remove them from the scene as well
     if (node->NumChildren())
@@ -230,6 +726,489 @@ void Scene::RemoveNode(Node* node)
     }
 }
 
+void Scene::OnNodeRenamed(Node* node, StringHash oldNameHash)
+{
+    if (!nodeIndex || node == this)
+        return;
+
+    RemoveFromNodeIndex(node, oldNameHash);
+    AddToNodeIndex(node);
+}
+
+void Scene::SetNodeIndex(bool enable)
+{
+    if (enable == nodeIndex)
+        return;
+
+    nodeIndex = enable;
+    nameIndex.clear();
+    typeIndex.clear();
+
+    if (enable)
+    {
+        for (auto it = nodeSlots.begin(); it != nodeSlots.end(); ++it)
+        {
+            if (it->node)
+                AddToNodeIndex(it->node);
+        }
+    }
+}
+
+const std::vector<Node*>* Scene::NodesByName(StringHash nameHash) const
+{
+    auto it = nameIndex.find(nameHash.Value());
+    return it != nameIndex.end() ? &it->second : nullptr;
+}
+
+void Scene::NodesByType(std::vector<Node*>& result, StringHash type) const
+{
+    for (auto it = typeIndex.begin(); it != typeIndex.end(); ++it)
+    {
+        StringHash nodeType(it->first);
+        if (nodeType == type || DerivedFrom(nodeType, type))
+            result.insert(result.end(), it->second.begin(), it->second.end());
+    }
+}
+
+Node* Scene::FirstNodeByType(StringHash type) const
+{
+    auto exact = typeIndex.find(type.Value());
+    if (exact != typeIndex.end())
+        return exact->second.front();
+
+    for (auto it = typeIndex.begin(); it != typeIndex.end(); ++it)
+    {
+        if (DerivedFrom(StringHash(it->first), type))
+            return it->second.front();
+    }
+
+    return nullptr;
+}
+
+void Scene::SetUpdateCallback(Node* node, UpdatePhase phase, UpdateFunction function)
+{
+    if (!node || node->ParentScene() != this)
+        return;
+
+    std::vector<UpdateCallback>& callbacks = updateCallbacks[phase];
+    std::unordered_map<Node*, unsigned>& indices = updateCallbackIndices[phase];
+    auto it = indices.find(node);
+
+    if (function)
+    {
+        if (it != indices.end())
+            callbacks[it->second].function = function;
+        else
+        {
+            UpdateCallback callback;
+            callback.node = node;
+            callback.function = function;
+            indices[node] = (unsigned)callbacks.size();
+            callbacks.push_back(callback);
+        }
+    }
+    else if (it != indices.end())
+    {
+        // Move the last callback in place of the removed one, as the order within a phase is not defined
+        unsigned index = it->second;
+        indices.erase(it);
+        if (index + 1 < callbacks.size())
+        {
+            callbacks[index] = callbacks.back();
+            indices[callbacks[index].node] = index;
+        }
+        callbacks.pop_back();
+    }
+}
+
+void Scene::RemoveUpdateCallbacks(Node* node)
+{
+    for (size_t i = 0; i < NUM_UPDATE_PHASES; ++i)
+    {
+        if (updateCallbackIndices[i].size())
+            SetUpdateCallback(node, (UpdatePhase)i, nullptr);
+    }
+}
+
+void Scene::SetFixedTimeStep(float step)
+{
+    fixedTimeStep = Max(step, 0.0f);
+    fixedAccumulator = 0.0;
+}
+
+void Scene::SetMaxFixedSteps(unsigned steps)
+{
+    maxFixedSteps = steps ? steps : 1;
+}
+
+void Scene::Update(float timeStep)
+{
+    ZoneScoped;
+
+    if (fixedTimeStep > 0.0f)
+    {
+        fixedAccumulator += timeStep;
+
+        unsigned numSteps = 0;
+        while (fixedAccumulator >= fixedTimeStep && numSteps < maxFixedSteps)
+        {
+            RunUpdatePhase(UPDATE_FIXED, fixedTimeStep);
+            fixedAccumulator -= fixedTimeStep;
+            ++numSteps;
+        }
+
+        if (fixedAccumulator >= fixedTimeStep)
+            fixedAccumulator = fmod(fixedAccumulator, (double)fixedTimeStep);
+    }
+    else
+        RunUpdatePhase(UPDATE_FIXED, timeStep);
+
+    RunUpdatePhase(UPDATE_VARIABLE, timeStep);
+    RunUpdatePhase(UPDATE_LATE, timeStep);
+}
+
+void Scene::QueueChangedNode(Node* node)
+{
+    if (!changeTracking || node->TestFlag(NF_DELTA_ADDED | NF_DELTA_CHANGED))
+        return;
+
+    node->SetFlag(NF_DELTA_CHANGED, true);
+
+    // Worker threads may be running update callbacks in parallel, so they record to their own lists
+    unsigned threadIndex = WorkQueue::ThreadIndex();
+    if (!threadIndex)
+        changedNodes.push_back(node->Id());
+    else
+    {
+        assert(threadIndex < threadChangedNodes.size());
+        threadChangedNodes[threadIndex].push_back(node->Id());
+    }
+}
+
+void Scene::QueueTransformUpdate(SpatialNode* node)
+{
+    if (node->transformQueue)
+        return;
+
+    // A worker thread that did not exist when the queues were sized leaves the node to be computed on demand
+    unsigned threadIndex = WorkQueue::ThreadIndex();
+    if (threadIndex >= transformQueues.size())
+        return;
+
+    std::vector<SpatialNode*>& queue = transformQueues[threadIndex];
+    node->transformQueue = &queue;
+    node->transformQueueIndex = (unsigned)queue.size();
+    queue.push_back(node);
+}
+
+void Scene::UpdateTransforms()
+{
+    ZoneScoped;
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+
+    // Gather the dirty hierarchy roots. Skip those whose ancestor is dirty, as they will be reached from it
+    if (transformLevels.empty())
+        transformLevels.resize(1);
+    std::vector<SpatialNode*>& roots = transformLevels[0];
+    roots.clear();
+
+    for (auto it = transformQueues.begin(); it != transformQueues.end(); ++it)
+    {
+        for (auto nIt = it->begin(); nIt != it->end(); ++nIt)
+        {
+            SpatialNode* node = *nIt;
+            if (!node)
+                continue;
+
+            node->transformQueue = nullptr;
+            if (!node->TestFlag(NF_WORLD_TRANSFORM_DIRTY))
+                continue;
+
+            bool dirtyAncestor = false;
+            for (SpatialNode* ancestor = node->SpatialParent(); ancestor; ancestor = ancestor->SpatialParent())
+            {
+                if (ancestor->TestFlag(NF_WORLD_TRANSFORM_DIRTY))
+                {
+                    dirtyAncestor = true;
+                    break;
+                }
+            }
+
+            if (!dirtyAncestor)
+                roots.push_back(node);
+        }
+        it->clear();
+    }
+
+    // Resize the queues now that they are empty, in case the worker threads were created after the scene
+    if (workQueue && transformQueues.size() != workQueue->NumThreads())
+        transformQueues.resize(workQueue->NumThreads());
+
+    // Compute one hierarchy level at a time, so that the parents are always ready, while gathering the dirty children for the next level
+    size_t numLevels = 0;
+    while (transformLevels[numLevels].size())
+    {
+        if (transformLevels.size() <= numLevels + 1)
+            transformLevels.resize(numLevels + 2);
+
+        std::vector<SpatialNode*>& level = transformLevels[numLevels];
+        std::vector<SpatialNode*>& nextLevel = transformLevels[numLevels + 1];
+        nextLevel.clear();
+
+        if (workQueue && level.size() >= MIN_THREADED_TRANSFORMS)
+        {
+            workQueue->ParallelFor(0, level.size(), MIN_THREADED_TRANSFORMS, [&level](size_t start, size_t end, unsigned)
+            {
+                for (size_t i = start; i < end; ++i)
+                    level[i]->UpdateWorldTransform();
+            });
+        }
+        else
+        {
+            for (auto it = level.begin(); it != level.end(); ++it)
+                (*it)->UpdateWorldTransform();
+        }
+
+        for (auto it = level.begin(); it != level.end(); ++it)
+        {
+            const std::vector<SharedPtr<Node> >& nodeChildren = (*it)->Children();
+            for (auto cIt = nodeChildren.begin(); cIt != nodeChildren.end(); ++cIt)
+            {
+                Node* child = *cIt;
+                if (child->TestFlag(NF_SPATIAL) && child->TestFlag(NF_WORLD_TRANSFORM_DIRTY))
+                    nextLevel.push_back(static_cast<SpatialNode*>(child));
+            }
+        }
+
+        ++numLevels;
+    }
+}
+
+void Scene::RunUpdatePhase(UpdatePhase phase, float timeStep)
+{
+    const std::vector<UpdateCallback>& callbacks = updateCallbacks[phase];
+    if (callbacks.empty())
+        return;
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    if (workQueue && callbacks.size() >= MIN_UPDATE_CALLBACKS_PER_TASK * 2)
+    {
+        // Size the per-thread change records now, in case the worker threads were created after the scene
+        if (threadChangedNodes.size() < workQueue->NumThreads())
+            threadChangedNodes.resize(workQueue->NumThreads());
+
+        workQueue->ParallelFor(0, callbacks.size(), MIN_UPDATE_CALLBACKS_PER_TASK, [&callbacks, timeStep](size_t start, size_t end, unsigned)
+        {
+            for (size_t i = start; i < end; ++i)
+                callbacks[i].function(callbacks[i].node, timeStep);
+        });
+
+        for (auto it = threadChangedNodes.begin(); it != threadChangedNodes.end(); ++it)
+        {
+            changedNodes.insert(changedNodes.end(), it->begin(), it->end());
+            it->clear();
+        }
+    }
+    else
+    {
+        for (auto it = callbacks.begin(); it != callbacks.end(); ++it)
+            it->function(it->node, timeStep);
+    }
+}
+
+void Scene::CompactTransforms()
+{
+    ZoneScoped;
+
+    // Depth-first, so that each hierarchy is contiguous with its root
+    std::vector<SpatialNode*> order;
+    std::vector<Node*> stack;
+    stack.push_back(this);
+
+    while (stack.size())
+    {
+        Node* node = stack.back();
+        stack.pop_back();
+        if (node->TestFlag(NF_SPATIAL))
+            order.push_back(static_cast<SpatialNode*>(node));
+
+        const std::vector<SharedPtr<Node> >& nodeChildren = node->Children();
+        for (auto it = nodeChildren.rbegin(); it != nodeChildren.rend(); ++it)
+            stack.push_back(*it);
+    }
+
+    SpatialNode::ReorderWorldTransforms(order);
+}
+
+unsigned Scene::AllocateNodeId(Node* node, unsigned requestedId)
+{
+    unsigned index = 0;
+    unsigned requestedIndex = requestedId & NODE_ID_INDEX_MASK;
+    unsigned requestedGeneration = requestedId >> NODE_ID_INDEX_BITS;
+
+    // Do not take an older generation of a slot, as stale ids of it could then find the node
+    if (requestedIndex && (requestedIndex >= nodeSlots.size() || (!nodeSlots[requestedIndex].node &&
+        nodeSlots[requestedIndex].generation <= requestedGeneration)))
+    {
+        // Grow the table up to the requested slot, leaving the skipped slots free. The requested slot may remain in the free list, where it is skipped when taken
+        while (nodeSlots.size() <= requestedIndex)
+        {
+            if (nodeSlots.size() < requestedIndex)
+                freeSlots.push_back((unsigned)nodeSlots.size());
+            NodeSlot newSlot;
+            newSlot.node = nullptr;
+            newSlot.generation = 0;
+            nodeSlots.push_back(newSlot);
+        }
+
+        index = requestedIndex;
+        nodeSlots[index].generation = requestedGeneration;
+    }
+
+    while (!index && freeSlots.size())
+    {
+        unsigned freeIndex = freeSlots.back();
+        freeSlots.pop_back();
+        if (!nodeSlots[freeIndex].node)
+            index = freeIndex;
+    }
+
+    if (!index)
+    {
+        if (nodeSlots.size() > NODE_ID_INDEX_MASK)
+        {
+            LOGERROR("Scene node table is full, can not add node");
+            return 0;
+        }
+
+        index = (unsigned)nodeSlots.size();
+        NodeSlot newSlot;
+        newSlot.generation = 0;
+        nodeSlots.push_back(newSlot);
+    }
+
+    NodeSlot& slot = nodeSlots[index];
+    slot.node = node;
+    ++numNodes;
+    return (slot.generation << NODE_ID_INDEX_BITS) | index;
+}
+
+void Scene::FreeNodeId(unsigned id)
+{
+    unsigned index = id & NODE_ID_INDEX_MASK;
+    if (!index || index >= nodeSlots.size() || !nodeSlots[index].node)
+        return;
+
+    NodeSlot& slot = nodeSlots[index];
+    slot.node = nullptr;
+    // Wrap the generation to the high bits of the id
+    slot.generation = (slot.generation + 1) & (M_MAX_UNSIGNED >> NODE_ID_INDEX_BITS);
+    freeSlots.push_back(index);
+    --numNodes;
+}
+
+Node* Scene::FindSourceNode(unsigned sourceId) const
+{
+    if (sourceIds.size())
+    {
+        auto it = sourceIds.find(sourceId);
+        if (it != sourceIds.end())
+            return FindNode(it->second);
+    }
+
+    return FindNode(sourceId);
+}
+
+void Scene::MapSourceId(unsigned sourceId, Node* node)
+{
+    if (node->Id() != sourceId)
+        sourceIds[sourceId] = node->Id();
+    else if (sourceIds.size())
+        sourceIds.erase(sourceId);
+}
+
+void Scene::SaveAddedNode(Stream& dest, Node* node, size_t& count)
+{
+    node->SetFlag(NF_DELTA_ADDED | NF_DELTA_CHANGED, false);
+
+    // The receiver must have the parent before the child
+    Node* parentNode = node->Parent();
+    if (parentNode && parentNode->TestFlag(NF_DELTA_ADDED))
+        SaveAddedNode(dest, parentNode, count);
+
+    if (parentNode && IsPersistent(node))
+    {
+        dest.Write(parentNode->Id());
+        dest.Write(node->Type());
+        dest.Write(node->Id());
+        node->Serializable::Save(dest);
+        ++count;
+    }
+
+    node->ClearDirtyAttributes();
+}
+
+void Scene::AddToNodeIndex(Node* node)
+{
+    // The scene is never a child of any node, so it is not indexed
+    if (node == this)
+        return;
+
+    NodeImpl* impl = node->impl;
+    if (impl->name)
+    {
+        std::vector<Node*>& nodes = nameIndex[impl->name.Hash().Value()];
+        impl->nameIndexPos = (unsigned)nodes.size();
+        nodes.push_back(node);
+    }
+
+    std::vector<Node*>& nodes = typeIndex[node->Type().Value()];
+    impl->typeIndexPos = (unsigned)nodes.size();
+    nodes.push_back(node);
+}
+
+void Scene::RemoveFromNodeIndex(Node* node, StringHash nameHash)
+{
+    if (node == this)
+        return;
+
+    // When renamed, the name is already the new one. Unnamed nodes are not indexed, which the stored position does not tell, so check it
+    NodeImpl* impl = node->impl;
+    auto nameIt = nameIndex.find(nameHash.Value());
+    if (nameIt != nameIndex.end() && impl->nameIndexPos < nameIt->second.size() && nameIt->second[impl->nameIndexPos] == node)
+    {
+        // Move the last node in place of the removed one, as the order is not defined
+        std::vector<Node*>& nodes = nameIt->second;
+        nodes[impl->nameIndexPos] = nodes.back();
+        nodes[impl->nameIndexPos]->impl->nameIndexPos = impl->nameIndexPos;
+        nodes.pop_back();
+        if (nodes.empty())
+            nameIndex.erase(nameIt);
+    }
+
+    auto typeIt = typeIndex.find(node->Type().Value());
+    if (typeIt != typeIndex.end())
+    {
+        std::vector<Node*>& nodes = typeIt->second;
+        nodes[impl->typeIndexPos] = nodes.back();
+        nodes[impl->typeIndexPos]->impl->typeIndexPos = impl->typeIndexPos;
+        nodes.pop_back();
+        if (nodes.empty())
+            typeIndex.erase(typeIt);
+    }
+}
+
+void Scene::RemoveFromTransformQueue(SpatialNode* node)
+{
+    if (!node->transformQueue)
+        return;
+
+    assert((*node->transformQueue)[node->transformQueueIndex] == node);
+    (*node->transformQueue)[node->transformQueueIndex] = nullptr;
+    node->transformQueue = nullptr;
+}
+
 void RegisterSceneLibrary()
 {
     static bool registered = false;
@@ -239,6 +1218,7 @@ void RegisterSceneLibrary()
     Node::RegisterObject();
     Scene::RegisterObject();
     SpatialNode::RegisterObject();
+    Prefab::RegisterObject();
 
     registered = true;
 }
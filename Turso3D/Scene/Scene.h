@@ -4,6 +4,49 @@
 
 #include "Node.h"
 
+#include <unordered_map>
+
+class SpatialNode;
+struct ResourceRef;
+
+/// Number of low bits of a node id that index the scene's node table. The high bits hold the generation of the table slot, so that the id of a removed node does not find a node later assigned to the same slot.
+static const unsigned NODE_ID_INDEX_BITS = 24;
+/// Mask of the node table index in a node id.
+static const unsigned NODE_ID_INDEX_MASK = (1u << NODE_ID_INDEX_BITS) - 1;
+
+/// Phases of the scene update, run in this order.
+enum UpdatePhase
+{
+    /// Run once per fixed time step, or once per update with the variable time step if no fixed time step is set.
+    UPDATE_FIXED = 0,
+    /// Run once per update with the variable time step, after the fixed steps. Can blend the states of the last two fixed steps by Scene::FixedInterpolation().
+    UPDATE_VARIABLE,
+    /// Run once per update with the variable time step, after the variable phase.
+    UPDATE_LATE,
+    NUM_UPDATE_PHASES
+};
+
+/// Update callback of a node, called with the node and the time step.
+typedef void (*UpdateFunction)(Node* node, float timeStep);
+
+/// Update callback registered for a phase of the scene update.
+struct UpdateCallback
+{
+    /// Node to update.
+    Node* node;
+    /// Function to call.
+    UpdateFunction function;
+};
+
+/// Slot of the scene's node table.
+struct NodeSlot
+{
+    /// Node in the slot, or null if free.
+    Node* node;
+    /// Generation, incremented when the slot is freed.
+    unsigned generation;
+};
+
 /// %Scene root node, which also represents the whole scene.
 class Scene : public Node
 {
@@ -17,11 +60,13 @@ public:
 
     /// Register factory and attributes.
     static void RegisterObject();
+    /// Parse a binary node hierarchy as written by Node::Save() without creating the nodes, recording the resources referenced by the attributes. Leave the stream after the hierarchy and return the number of nodes. Can be called from worker threads.
+    static size_t ParseHierarchyResources(Stream& source, std::vector<ResourceRef>& resources);
 
-    /// Save scene to binary stream.
+    /// Save scene to binary stream. The sizes of the top-level node hierarchies are written, so that loading can parse them in parallel.
     void Save(Stream& dest) override;
     
-    /// Load scene from a binary stream. Existing nodes will be destroyed. Return true on success.
+    /// Load scene from a binary stream. Existing nodes will be destroyed. The top-level node hierarchies are first parsed in parallel and their resources loaded asynchronously, after which the nodes are created and their attributes applied. Return true on success.
     bool Load(Stream& source);
     /// Load scene from JSON data. Existing nodes will be destroyed. Return true on success.
     bool LoadJSON(const JSONValue& source);
@@ -37,24 +82,138 @@ public:
     Node* InstantiateJSON(Stream& source);
     /// Destroy child nodes recursively, leaving the scene empty.
     void Clear();
+    /// Set whether to record the node additions, removals and attribute changes for delta snapshots. Enabling clears the attribute changed marks of all nodes, so that the first delta is relative to the state at that time. Default false.
+    void SetChangeTracking(bool enable);
+    /// Save the persistent nodes added, removed and changed since change tracking was enabled or the previous delta. Added nodes are written whole, existing nodes only with their changed attributes. Clears the recorded changes.
+    void SaveDelta(Stream& dest);
+    /// Apply a delta saved from a scene whose state this scene matches, for example after loading that scene's binary save. Return true on success.
+    bool ApplyDelta(Stream& source);
+    /// Return whether records the changes for delta snapshots.
+    bool ChangeTracking() const { return changeTracking; }
+
+    /// Set, replace or with a null function remove the update callback of a node in a phase. The callback is removed automatically when the node is removed from the scene. Must not be called during Update().
+    void SetUpdateCallback(Node* node, UpdatePhase phase, UpdateFunction function);
+    /// Remove the update callbacks of a node in all phases.
+    void RemoveUpdateCallbacks(Node* node);
+    /// Set the fixed time step of the fixed update phase in seconds, or 0 to run it once per update with the variable time step. Default 0.
+    void SetFixedTimeStep(float step);
+    /// Set the maximum number of fixed steps per update. Time that could not be caught up with is dropped, so that a slow frame does not lead to ever more steps. Default 5.
+    void SetMaxFixedSteps(unsigned steps);
+    /// Run the update phases in order. The callbacks of one phase are called in parallel chunks over the WorkQueue subsystem, so each callback may only modify its own node. Moving the nodes is allowed, as the world transform and octree reinsertion queues and the change tracking records are per-thread. Call from the main thread before the octree update.
+    void Update(float timeStep);
+    /// Return the fixed time step, or 0 if not used.
+    float FixedTimeStep() const { return fixedTimeStep; }
+    /// Return the maximum number of fixed steps per update.
+    unsigned MaxFixedSteps() const { return maxFixedSteps; }
+    /// Return the fraction of a fixed step that has elapsed since the last fixed step, in the range [0, 1), for interpolating between the last two fixed step states. Zero if no fixed time step is set.
+    float FixedInterpolation() const { return fixedTimeStep > 0.0f ? (float)(fixedAccumulator / fixedTimeStep) : 0.0f; }
+    /// Return number of update callbacks in a phase.
+    size_t NumUpdateCallbacks(UpdatePhase phase) const { return updateCallbacks[phase].size(); }
 
-    /// Find node by id.
-    Node* FindNode(unsigned id) const;
+    /// Find node by id. Constant time.
+    Node* FindNode(unsigned id) const
+    {
+        unsigned index = id & NODE_ID_INDEX_MASK;
+        if (index >= nodeSlots.size())
+            return nullptr;
+        const NodeSlot& slot = nodeSlots[index];
+        return slot.generation == id >> NODE_ID_INDEX_BITS ? slot.node : nullptr;
+    }
+    /// Return number of nodes in the scene, including the scene itself.
+    size_t NumNodes() const { return numNodes; }
+
+    /// Set whether to maintain a scene-wide index of the nodes by name hash and by type, updated incrementally as nodes are added, removed and renamed. Recursive name lookups of any node, and recursive type lookups of the scene itself, then read the index instead of traversing the hierarchy. Which of several matching nodes is returned is not defined. Enabling builds the index from the existing nodes. Default false.
+    void SetNodeIndex(bool enable);
+    /// Return whether maintains the node index.
+    bool HasNodeIndex() const { return nodeIndex; }
+    /// Return the nodes with a name hash from the node index, or null if none or the index is not enabled. Unnamed nodes are not indexed. The order is not defined.
+    const std::vector<Node*>* NodesByName(StringHash nameHash) const;
+    /// Append the nodes of a type or its derived types from the node index, not including the scene itself. Does nothing if the index is not enabled. The order is not defined.
+    void NodesByType(std::vector<Node*>& result, StringHash type) const;
+    /// Return a node of a type or its derived types from the node index, or null if none or the index is not enabled.
+    Node* FirstNodeByType(StringHash type) const;
 
     /// Add node to the scene. This assigns a scene-unique id to it. Called internally.
     void AddNode(Node* node);
+    /// Add new nodes without children to the scene in bulk, growing the node table once. Does not call the scene assignment handler. Called internally.
+    void AddNodes(const std::vector<Node*>& newNodes);
     /// Remove node from the scene. This removes the id mapping but does not destroy the node. Called internally.
     void RemoveNode(Node* node);
+    /// Update the node index after a node has been renamed. Called internally.
+    void OnNodeRenamed(Node* node, StringHash oldNameHash);
+    /// Record a node changed for the next delta snapshot. Called internally.
+    void QueueChangedNode(Node* node);
+    /// Queue the topmost dirty node of a hierarchy for the world transform update. Called internally, also from worker threads.
+    void QueueTransformUpdate(SpatialNode* node);
+    /// Reorder the world transform matrices of the scene's spatial nodes to be contiguous in scene hierarchy order. Call between frames, as the matrices move in memory.
+    void CompactTransforms();
+    /// Compute the world transforms of the queued dirty hierarchies breadth-first, one hierarchy level at a time in parallel, so that later reads need not compute them on demand. Called by the renderer before culling.
+    void UpdateTransforms();
     
     using Node::Load;
     using Node::LoadJSON;
     using Node::SaveJSON;
 
 private:
-    /// Map from id's to nodes.
-    std::map<unsigned, Node*> nodes;
-    /// Next free node id.
-    unsigned nextNodeId;
+    /// Assign a node table slot to a node and return the id, or 0 if the table is full. The requested id is used if its slot is free.
+    unsigned AllocateNodeId(Node* node, unsigned requestedId = 0);
+    /// Free the node table slot of an id.
+    void FreeNodeId(unsigned id);
+    /// Remove a node from the transform update queue if queued.
+    void RemoveFromTransformQueue(SpatialNode* node);
+    /// Call the update callbacks of a phase.
+    void RunUpdatePhase(UpdatePhase phase, float timeStep);
+    /// Return a node by its id in the scene that saved the data, accounting for ids that could not be kept.
+    Node* FindSourceNode(unsigned sourceId) const;
+    /// Remember the id of a node in the scene that saved the data, if it differs.
+    void MapSourceId(unsigned sourceId, Node* node);
+    /// Write an added node for a delta snapshot, after its added ancestors.
+    void SaveAddedNode(Stream& dest, Node* node, size_t& count);
+    /// Add a node to the node index.
+    void AddToNodeIndex(Node* node);
+    /// Remove a node from the node index.
+    void RemoveFromNodeIndex(Node* node, StringHash nameHash);
+
+    /// Node table indexed by the low bits of the node id. Slot 0 is never used, so that id 0 means no node.
+    std::vector<NodeSlot> nodeSlots;
+    /// Free node table slots.
+    std::vector<unsigned> freeSlots;
+    /// Number of nodes in the table.
+    size_t numNodes;
+    /// Per-thread queues of dirty hierarchies for the transform update.
+    std::vector<std::vector<SpatialNode*> > transformQueues;
+    /// Dirty nodes of the transform update by hierarchy level.
+    std::vector<std::vector<SpatialNode*> > transformLevels;
+    /// Ids of nodes added since the previous delta snapshot.
+    std::vector<unsigned> addedNodes;
+    /// Ids of persistent nodes removed since the previous delta snapshot.
+    std::vector<unsigned> removedNodes;
+    /// Ids of nodes changed since the previous delta snapshot.
+    std::vector<unsigned> changedNodes;
+    /// Ids of nodes changed by the worker threads during an update phase, indexed by thread. Merged to the changed nodes after the phase.
+    std::vector<std::vector<unsigned> > threadChangedNodes;
+    /// Ids of the scene that saved the loaded data mapped to own ids, for the nodes that could not keep their id.
+    std::unordered_map<unsigned, unsigned> sourceIds;
+    /// Update callbacks per phase.
+    std::vector<UpdateCallback> updateCallbacks[NUM_UPDATE_PHASES];
+    /// Indices of the nodes' update callbacks per phase.
+    std::unordered_map<Node*, unsigned> updateCallbackIndices[NUM_UPDATE_PHASES];
+    /// Named nodes by name hash. Each node stores its position in the list.
+    std::unordered_map<unsigned, std::vector<Node*> > nameIndex;
+    /// Nodes by exact type. Each node stores its position in the list.
+    std::unordered_map<unsigned, std::vector<Node*> > typeIndex;
+    /// Time accumulated toward the next fixed step.
+    double fixedAccumulator;
+    /// Fixed time step.
+    float fixedTimeStep;
+    /// Maximum number of fixed steps per update.
+    unsigned maxFixedSteps;
+    /// Id requested for the next added node when loading.
+    unsigned requestedNodeId;
+    /// Change tracking flag.
+    bool changeTracking;
+    /// Node index flag.
+    bool nodeIndex;
 };
 
 /// Register Scene related object factories and attributes.
@@ -0,0 +1,352 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Thread/WorkQueue.h"
+#include "SpatialHash.h"
+#include "SpatialNode.h"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+/// Minimum number of queries per task in the batched queries.
+static const size_t MIN_QUERIES_PER_TASK = 64;
+/// Bits per coordinate in the cell key.
+static const unsigned CELL_KEY_BITS = 21;
+/// Mask of a coordinate in the cell key.
+static const unsigned long long CELL_KEY_MASK = (1ULL << CELL_KEY_BITS) - 1;
+
+SpatialHash::SpatialHash() :
+    minCoords(M_MAX_INT, M_MAX_INT, M_MAX_INT),
+    maxCoords(M_MIN_INT, M_MIN_INT, M_MIN_INT),
+    cellSize(10.0f)
+{
+    RegisterSubsystem(this);
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    updateQueues.resize(workQueue ? workQueue->NumThreads() : 1);
+}
+
+SpatialHash::~SpatialHash()
+{
+    RemoveAllNodes();
+    RemoveSubsystem(this);
+}
+
+void SpatialHash::SetCellSize(float size)
+{
+    size = Max(size, M_EPSILON);
+    if (size == cellSize)
+        return;
+
+    cellSize = size;
+    cells.clear();
+    minCoords = IntVector3(M_MAX_INT, M_MAX_INT, M_MAX_INT);
+    maxCoords = IntVector3(M_MIN_INT, M_MIN_INT, M_MIN_INT);
+
+    for (unsigned i = 0; i < entries.size(); ++i)
+        InsertToCell(i);
+}
+
+void SpatialHash::AddNode(SpatialNode* node)
+{
+    if (!node || node->TestFlag(NF_SPATIAL_HASH))
+        return;
+
+    node->SetFlag(NF_SPATIAL_HASH, true);
+
+    unsigned index = (unsigned)entries.size();
+    SpatialHashEntry entry = SpatialHashEntry();
+    entry.position = node->WorldPosition();
+    entry.node = node;
+    entries.push_back(entry);
+    nodeIndices[node] = index;
+    InsertToCell(index);
+}
+
+void SpatialHash::RemoveNode(SpatialNode* node)
+{
+    auto it = nodeIndices.find(node);
+    if (it == nodeIndices.end())
+        return;
+
+    unsigned index = it->second;
+    nodeIndices.erase(it);
+    node->SetFlag(NF_SPATIAL_HASH, false);
+    RemoveFromCell(index);
+
+    // Move the last entry in place of the removed one
+    unsigned last = (unsigned)entries.size() - 1;
+    if (index != last)
+    {
+        entries[index] = entries[last];
+        nodeIndices[entries[index].node] = index;
+        cells[entries[index].cellKey][entries[index].cellIndex] = index;
+    }
+    entries.pop_back();
+}
+
+void SpatialHash::RemoveAllNodes()
+{
+    for (auto it = entries.begin(); it != entries.end(); ++it)
+        it->node->SetFlag(NF_SPATIAL_HASH, false);
+
+    entries.clear();
+    nodeIndices.clear();
+    cells.clear();
+    for (auto it = updateQueues.begin(); it != updateQueues.end(); ++it)
+        it->clear();
+}
+
+void SpatialHash::QueueUpdate(SpatialNode* node)
+{
+    updateQueues[WorkQueue::ThreadIndex()].push_back(node);
+}
+
+void SpatialHash::Update()
+{
+    ZoneScoped;
+
+    // A node may have been queued several times, or removed after queuing. Reading the world position computes the transform if still dirty, so that the node queues itself again on the next change
+    for (auto it = updateQueues.begin(); it != updateQueues.end(); ++it)
+    {
+        for (auto nIt = it->begin(); nIt != it->end(); ++nIt)
+        {
+            auto iIt = nodeIndices.find(*nIt);
+            if (iIt == nodeIndices.end())
+                continue;
+
+            unsigned index = iIt->second;
+            SpatialHashEntry& entry = entries[index];
+            entry.position = entry.node->WorldPosition();
+            IntVector3 coords = CellCoords(entry.position);
+            if (CellKey(coords) != entry.cellKey)
+            {
+                RemoveFromCell(index);
+                InsertToCell(index);
+            }
+        }
+        it->clear();
+    }
+
+    // Resize the queues now that they are empty, in case the worker threads were created after the spatial hash
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    if (workQueue && updateQueues.size() != workQueue->NumThreads())
+        updateQueues.resize(workQueue->NumThreads());
+}
+
+void SpatialHash::FindNodes(std::vector<SpatialNode*>& result, const Vector3& position, float radius) const
+{
+    if (entries.empty() || radius < 0.0f)
+        return;
+
+    IntVector3 start = CellCoords(position - Vector3(radius, radius, radius));
+    IntVector3 end = CellCoords(position + Vector3(radius, radius, radius));
+    start = IntVector3(Max(start.x, minCoords.x), Max(start.y, minCoords.y), Max(start.z, minCoords.z));
+    end = IntVector3(Min(end.x, maxCoords.x), Min(end.y, maxCoords.y), Min(end.z, maxCoords.z));
+    if (start.x > end.x || start.y > end.y || start.z > end.z)
+        return;
+
+    float radiusSquared = radius * radius;
+    double numCovered = (double)(end.x - start.x + 1) * (end.y - start.y + 1) * (end.z - start.z + 1);
+
+    // For a large radius relative to the cells, going through all nodes is cheaper than looking up each covered cell
+    if (numCovered > (double)entries.size())
+    {
+        for (auto it = entries.begin(); it != entries.end(); ++it)
+        {
+            if ((it->position - position).LengthSquared() <= radiusSquared)
+                result.push_back(it->node);
+        }
+        return;
+    }
+
+    for (int z = start.z; z <= end.z; ++z)
+    {
+        for (int y = start.y; y <= end.y; ++y)
+        {
+            for (int x = start.x; x <= end.x; ++x)
+            {
+                auto it = cells.find(CellKey(IntVector3(x, y, z)));
+                if (it == cells.end())
+                    continue;
+
+                const std::vector<unsigned>& cellEntries = it->second;
+                for (auto eIt = cellEntries.begin(); eIt != cellEntries.end(); ++eIt)
+                {
+                    const SpatialHashEntry& entry = entries[*eIt];
+                    if ((entry.position - position).LengthSquared() <= radiusSquared)
+                        result.push_back(entry.node);
+                }
+            }
+        }
+    }
+}
+
+void SpatialHash::FindNearest(std::vector<SpatialNode*>& result, const Vector3& position, size_t count, float maxDistance) const
+{
+    std::vector<std::pair<float, unsigned> > heap;
+    FindNearestEntries(heap, position, count, maxDistance);
+
+    result.resize(heap.size());
+    for (size_t i = 0; i < heap.size(); ++i)
+        result[i] = entries[heap[i].second].node;
+}
+
+void SpatialHash::FindNodesBatch(std::vector<std::vector<SpatialNode*> >& results, const std::vector<Vector3>& positions, float radius) const
+{
+    ZoneScoped;
+
+    results.resize(positions.size());
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    workQueue->ParallelFor(0, positions.size(), MIN_QUERIES_PER_TASK, [&](size_t start, size_t end, unsigned)
+    {
+        for (size_t i = start; i < end; ++i)
+        {
+            results[i].clear();
+            FindNodes(results[i], positions[i], radius);
+        }
+    });
+}
+
+void SpatialHash::FindNearestBatch(std::vector<SpatialNode*>& results, const std::vector<Vector3>& positions, size_t count, float maxDistance) const
+{
+    ZoneScoped;
+
+    results.resize(positions.size() * count);
+    if (results.empty())
+        return;
+
+    WorkQueue* workQueue = Subsystem<WorkQueue>();
+    workQueue->ParallelFor(0, positions.size(), MIN_QUERIES_PER_TASK, [&](size_t start, size_t end, unsigned)
+    {
+        std::vector<std::pair<float, unsigned> > heap;
+        heap.reserve(count);
+
+        for (size_t i = start; i < end; ++i)
+        {
+            FindNearestEntries(heap, positions[i], count, maxDistance);
+
+            SpatialNode** dest = &results[i * count];
+            for (size_t j = 0; j < count; ++j)
+                dest[j] = j < heap.size() ? entries[heap[j].second].node : nullptr;
+        }
+    });
+}
+
+IntVector3 SpatialHash::CellCoords(const Vector3& position) const
+{
+    return IntVector3((int)floorf(position.x / cellSize), (int)floorf(position.y / cellSize), (int)floorf(position.z / cellSize));
+}
+
+unsigned long long SpatialHash::CellKey(const IntVector3& coords)
+{
+    return ((unsigned long long)coords.x & CELL_KEY_MASK) | (((unsigned long long)coords.y & CELL_KEY_MASK) << CELL_KEY_BITS) |
+        (((unsigned long long)coords.z & CELL_KEY_MASK) << (CELL_KEY_BITS * 2));
+}
+
+void SpatialHash::InsertToCell(unsigned index)
+{
+    SpatialHashEntry& entry = entries[index];
+    IntVector3 coords = CellCoords(entry.position);
+
+    minCoords = IntVector3(Min(minCoords.x, coords.x), Min(minCoords.y, coords.y), Min(minCoords.z, coords.z));
+    maxCoords = IntVector3(Max(maxCoords.x, coords.x), Max(maxCoords.y, coords.y), Max(maxCoords.z, coords.z));
+
+    entry.cellKey = CellKey(coords);
+    std::vector<unsigned>& cellEntries = cells[entry.cellKey];
+    entry.cellIndex = (unsigned)cellEntries.size();
+    cellEntries.push_back(index);
+}
+
+void SpatialHash::RemoveFromCell(unsigned index)
+{
+    const SpatialHashEntry& entry = entries[index];
+    std::vector<unsigned>& cellEntries = cells[entry.cellKey];
+
+    // Empty cells are kept, so that nodes moving back and forth do not reallocate them
+    unsigned last = cellEntries.back();
+    cellEntries[entry.cellIndex] = last;
+    entries[last].cellIndex = entry.cellIndex;
+    cellEntries.pop_back();
+}
+
+void SpatialHash::FindNearestEntries(std::vector<std::pair<float, unsigned> >& heap, const Vector3& position, size_t count, float maxDistance) const
+{
+    heap.clear();
+    if (entries.empty() || !count || maxDistance < 0.0f)
+        return;
+
+    float maxDistanceSquared = maxDistance * maxDistance;
+    IntVector3 center = CellCoords(position);
+
+    auto searchCell = [&](int x, int y, int z)
+    {
+        auto it = cells.find(CellKey(IntVector3(x, y, z)));
+        if (it == cells.end())
+            return;
+
+        const std::vector<unsigned>& cellEntries = it->second;
+        for (auto eIt = cellEntries.begin(); eIt != cellEntries.end(); ++eIt)
+        {
+            float distanceSquared = (entries[*eIt].position - position).LengthSquared();
+            if (distanceSquared > maxDistanceSquared)
+                continue;
+
+            if (heap.size() < count)
+            {
+                heap.push_back(std::make_pair(distanceSquared, *eIt));
+                std::push_heap(heap.begin(), heap.end());
+            }
+            else if (distanceSquared < heap.front().first)
+            {
+                std::pop_heap(heap.begin(), heap.end());
+                heap.back() = std::make_pair(distanceSquared, *eIt);
+                std::push_heap(heap.begin(), heap.end());
+            }
+        }
+    };
+
+    // Search shells of cells at increasing distance from the position's cell. The cells of shell n are at least n - 1 cell sizes away from the position, so the search ends once the heap is full and its farthest entry is closer than that
+    for (int shell = 0; ; ++shell)
+    {
+        if (shell > 0)
+        {
+            float shellDistance = (shell - 1) * cellSize;
+            if (shellDistance * shellDistance > maxDistanceSquared || (heap.size() == count && shellDistance * shellDistance > heap.front().first))
+                break;
+
+            // End also once the previous shells have covered all cells that have had nodes
+            int covered = shell - 1;
+            if (center.x - covered <= minCoords.x && center.y - covered <= minCoords.y && center.z - covered <= minCoords.z &&
+                center.x + covered >= maxCoords.x && center.y + covered >= maxCoords.y && center.z + covered >= maxCoords.z)
+                break;
+        }
+
+        IntVector3 start(center.x - shell, center.y - shell, center.z - shell);
+        IntVector3 end(center.x + shell, center.y + shell, center.z + shell);
+        int x0 = Max(start.x, minCoords.x);
+        int x1 = Min(end.x, maxCoords.x);
+
+        for (int z = Max(start.z, minCoords.z); z <= Min(end.z, maxCoords.z); ++z)
+        {
+            for (int y = Max(start.y, minCoords.y); y <= Min(end.y, maxCoords.y); ++y)
+            {
+                // On the Y and Z faces of the shell whole rows belong to it, elsewhere only the cells on the X faces
+                if (z == start.z || z == end.z || y == start.y || y == end.y)
+                {
+                    for (int x = x0; x <= x1; ++x)
+                        searchCell(x, y, z);
+                }
+                else
+                {
+                    if (start.x >= x0)
+                        searchCell(start.x, y, z);
+                    if (end.x <= x1)
+                        searchCell(end.x, y, z);
+                }
+            }
+        }
+    }
+
+    std::sort_heap(heap.begin(), heap.end());
+}
@@ -0,0 +1,93 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntVector3.h"
+#include "../Math/Vector3.h"
+#include "../Object/Object.h"
+
+#include <unordered_map>
+#include <utility>
+
+class SpatialNode;
+
+/// Spatial node tracked by the spatial hash.
+struct SpatialHashEntry
+{
+    /// World position at the last update.
+    Vector3 position;
+    /// Node.
+    SpatialNode* node;
+    /// Key of the cell containing the position.
+    unsigned long long cellKey;
+    /// Index within the cell's entry list.
+    unsigned cellIndex;
+};
+
+/// Uniform grid of hashed cells for gameplay proximity queries of spatial nodes, such as finding the neighbors of AI agents, without going through the octree. Registered nodes queue themselves when their world transform is dirtied, also from worker threads, and Update() moves the queued nodes between cells in one batch. Queries return the nodes by their position at the last update and can be run concurrently from any thread between updates, or batched in parallel over the WorkQueue subsystem.
+class SpatialHash : public Object
+{
+    OBJECT(SpatialHash);
+
+public:
+    /// Construct. Register subsystem. The WorkQueue subsystem must have been initialized if nodes are moved from the worker threads.
+    SpatialHash();
+    /// Destruct. Unregister the nodes.
+    ~SpatialHash();
+
+    /// Set the cell size, which should be close to the typical query radius. Rebuilds the cells. Default 10.
+    void SetCellSize(float size);
+    /// Add a spatial node to be tracked. Its current world position is used immediately.
+    void AddNode(SpatialNode* node);
+    /// Remove a spatial node. Called automatically when the node is destroyed.
+    void RemoveNode(SpatialNode* node);
+    /// Remove all nodes.
+    void RemoveAllNodes();
+    /// Queue a node whose world transform was dirtied for the next update. Called internally, also from worker threads.
+    void QueueUpdate(SpatialNode* node);
+    /// Move the queued nodes to their current world positions. Call from the main thread after moving the nodes and before querying.
+    void Update();
+
+    /// Find the nodes within a radius of a position. Appends to the result.
+    void FindNodes(std::vector<SpatialNode*>& result, const Vector3& position, float radius) const;
+    /// Find up to count nodes nearest to a position within a maximum distance, sorted by increasing distance. Replaces the result. A node at the position itself is included.
+    void FindNearest(std::vector<SpatialNode*>& result, const Vector3& position, size_t count, float maxDistance = M_INFINITY) const;
+    /// Find the nodes within a radius of each position in parallel over the WorkQueue subsystem. Resizes the results to the number of positions.
+    void FindNodesBatch(std::vector<std::vector<SpatialNode*> >& results, const std::vector<Vector3>& positions, float radius) const;
+    /// Find up to count nearest nodes of each position in parallel over the WorkQueue subsystem. The nodes of each position are stored consecutively in count slots, sorted by increasing distance and padded with null.
+    void FindNearestBatch(std::vector<SpatialNode*>& results, const std::vector<Vector3>& positions, size_t count, float maxDistance = M_INFINITY) const;
+
+    /// Return the cell size.
+    float CellSize() const { return cellSize; }
+    /// Return number of nodes.
+    size_t NumNodes() const { return entries.size(); }
+    /// Return number of cells, including cells that have become empty.
+    size_t NumCells() const { return cells.size(); }
+
+private:
+    /// Return the cell coordinates of a position.
+    IntVector3 CellCoords(const Vector3& position) const;
+    /// Return the hash key of cell coordinates.
+    static unsigned long long CellKey(const IntVector3& coords);
+    /// Add an entry to the cell of its position.
+    void InsertToCell(unsigned index);
+    /// Remove an entry from its cell.
+    void RemoveFromCell(unsigned index);
+    /// Find up to count nearest entries into a max-heap of squared distances and entry indices, which is left sorted by increasing distance.
+    void FindNearestEntries(std::vector<std::pair<float, unsigned> >& heap, const Vector3& position, size_t count, float maxDistance) const;
+
+    /// Tracked nodes.
+    std::vector<SpatialHashEntry> entries;
+    /// Entry indices of the nodes.
+    std::unordered_map<SpatialNode*, unsigned> nodeIndices;
+    /// Entry indices of the nodes in each cell by cell key.
+    std::unordered_map<unsigned long long, std::vector<unsigned> > cells;
+    /// Per-thread queues of nodes to update.
+    std::vector<std::vector<SpatialNode*> > updateQueues;
+    /// Smallest cell coordinates that have had nodes.
+    IntVector3 minCoords;
+    /// Largest cell coordinates that have had nodes.
+    IntVector3 maxCoords;
+    /// Cell size.
+    float cellSize;
+};
@@ -1,13 +1,77 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
-#include "../Object/Allocator.h"
+#include "Scene.h"
+#include "SpatialHash.h"
 #include "SpatialNode.h"
 
-static Allocator<Matrix3x4> worldMatrixAllocator;
+#include <tracy/Tracy.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TURSO3D_TRANSFORM_SSE
+#endif
+
+// Number of world transform matrices in a storage chunk. The chunks are never reallocated, so the matrices stay in place until reordered
+static const unsigned WORLD_TRANSFORM_CHUNK_SIZE = 1024;
+
+/// Dense storage of the world transform matrices of all spatial nodes.
+struct WorldTransformStorage
+{
+    /// Destruct. Free the chunks.
+    ~WorldTransformStorage()
+    {
+        for (auto it = chunks.begin(); it != chunks.end(); ++it)
+            delete[] *it;
+    }
+
+    /// Return the matrix in a slot.
+    Matrix3x4* Slot(unsigned index) { return chunks[index / WORLD_TRANSFORM_CHUNK_SIZE] + index % WORLD_TRANSFORM_CHUNK_SIZE; }
+
+    /// Matrix chunks.
+    std::vector<Matrix3x4*> chunks;
+    /// Owner node of each used slot, or null if the slot is free.
+    std::vector<SpatialNode*> owners;
+    /// Free slots below the end.
+    std::vector<unsigned> freeSlots;
+    /// Number of live matrices.
+    size_t numUsed = 0;
+    /// Counter incremented when matrices are moved.
+    unsigned version = 0;
+};
+
+static WorldTransformStorage worldTransformStorage;
+
+/// Multiply two affine transform matrices into a destination that is neither of them.
+static inline void MultiplyTransform(Matrix3x4& dest, const Matrix3x4& lhs, const Matrix3x4& rhs)
+{
+    #ifdef TURSO3D_TRANSFORM_SSE
+    const float* left = lhs.Data();
+    const float* right = rhs.Data();
+    float* out = &dest.m00;
+    __m128 r0 = _mm_loadu_ps(right);
+    __m128 r1 = _mm_loadu_ps(right + 4);
+    __m128 r2 = _mm_loadu_ps(right + 8);
+    // The implicit fourth row of the right matrix adds the left matrix's translation
+    __m128 r3 = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        const float* row = left + i * 4;
+        __m128 sum01 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[0]), r0), _mm_mul_ps(_mm_set1_ps(row[1]), r1));
+        __m128 sum23 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(row[2]), r2), _mm_mul_ps(_mm_set1_ps(row[3]), r3));
+        _mm_storeu_ps(out + i * 4, _mm_add_ps(sum01, sum23));
+    }
+    #else
+    dest = lhs * rhs;
+    #endif
+}
 
 SpatialNode::SpatialNode() :
-    worldTransform(worldMatrixAllocator.Allocate())
+    transformQueue(nullptr),
+    transformQueueIndex(0)
 {
+    AllocateWorldTransform();
+
     position = Vector3::ZERO;
     rotation = Quaternion::IDENTITY;
     scale = Vector3::ONE;
@@ -17,7 +81,33 @@ SpatialNode::SpatialNode() :
 
 SpatialNode::~SpatialNode()
 {
-    worldMatrixAllocator.Free(worldTransform);
+    if (TestFlag(NF_SPATIAL_HASH))
+        Subsystem<SpatialHash>()->RemoveNode(this);
+
+    WorldTransformStorage& storage = worldTransformStorage;
+    storage.owners[worldTransformSlot] = nullptr;
+    --storage.numUsed;
+
+    // Shrink from the end, otherwise leave a hole to be reused
+    if (worldTransformSlot + 1 == storage.owners.size())
+    {
+        while (storage.owners.size() && !storage.owners.back())
+            storage.owners.pop_back();
+        // Drop the free slots that are no longer below the end. They are in no particular order, so filter all
+        if (storage.freeSlots.size())
+        {
+            size_t end = storage.owners.size();
+            size_t j = 0;
+            for (size_t i = 0; i < storage.freeSlots.size(); ++i)
+            {
+                if (storage.freeSlots[i] < end)
+                    storage.freeSlots[j++] = storage.freeSlots[i];
+            }
+            storage.freeSlots.resize(j);
+        }
+    }
+    else
+        storage.freeSlots.push_back(worldTransformSlot);
 }
 
 void SpatialNode::RegisterObject()
@@ -25,26 +115,42 @@ void SpatialNode::RegisterObject()
     RegisterFactory<SpatialNode>();
     RegisterDerivedType<SpatialNode, Node>();
     CopyBaseAttributes<SpatialNode, Node>();
-    RegisterRefAttribute("position", &SpatialNode::Position, &SpatialNode::SetPosition, Vector3::ZERO);
-    RegisterRefAttribute("rotation", &SpatialNode::Rotation, &SpatialNode::SetRotation, Quaternion::IDENTITY);
-    RegisterRefAttribute("scale", &SpatialNode::Scale, &SpatialNode::SetScale, Vector3::ONE);
+    RegisterMemberAttribute("position", &SpatialNode::position, Vector3::ZERO);
+    RegisterMemberAttribute("rotation", &SpatialNode::rotation, Quaternion::IDENTITY);
+    RegisterMemberAttribute("scale", &SpatialNode::scale, Vector3::ONE);
+}
+
+void SpatialNode::OnMemberAttributesSet()
+{
+    // Apply the same zero scale guard as SetScale()
+    if (scale.x == 0.0f)
+        scale.x = M_EPSILON;
+    if (scale.y == 0.0f)
+        scale.y = M_EPSILON;
+    if (scale.z == 0.0f)
+        scale.z = M_EPSILON;
+
+    OnTransformChanged();
 }
 
 void SpatialNode::SetPosition(const Vector3& newPosition)
 {
     position = newPosition;
+    MarkAttributeDirty(SPATIAL_ATTR_POSITION);
     OnTransformChanged();
 }
 
 void SpatialNode::SetRotation(const Quaternion& newRotation)
 {
     rotation = newRotation;
+    MarkAttributeDirty(SPATIAL_ATTR_ROTATION);
     OnTransformChanged();
 }
 
 void SpatialNode::SetDirection(const Vector3& newDirection)
 {
     rotation = Quaternion(Vector3::FORWARD, newDirection);
+    MarkAttributeDirty(SPATIAL_ATTR_ROTATION);
     OnTransformChanged();
 }
 
@@ -60,6 +166,7 @@ void SpatialNode::SetScale(const Vector3& newScale)
     if (scale.z == 0.0f)
         scale.z = M_EPSILON;
 
+    MarkAttributeDirty(SPATIAL_ATTR_SCALE);
     OnTransformChanged();
 }
 
@@ -72,6 +179,8 @@ void SpatialNode::SetTransform(const Vector3& newPosition, const Quaternion& new
 {
     position = newPosition;
     rotation = newRotation;
+    MarkAttributeDirty(SPATIAL_ATTR_POSITION);
+    MarkAttributeDirty(SPATIAL_ATTR_ROTATION);
     OnTransformChanged();
 }
 
@@ -80,6 +189,9 @@ void SpatialNode::SetTransform(const Vector3& newPosition, const Quaternion& new
     position = newPosition;
     rotation = newRotation;
     scale = newScale;
+    MarkAttributeDirty(SPATIAL_ATTR_POSITION);
+    MarkAttributeDirty(SPATIAL_ATTR_ROTATION);
+    MarkAttributeDirty(SPATIAL_ATTR_SCALE);
     OnTransformChanged();
 }
 
@@ -170,6 +282,7 @@ void SpatialNode::Translate(const Vector3& delta, TransformSpace space)
         break;
     }
 
+    MarkAttributeDirty(SPATIAL_ATTR_POSITION);
     OnTransformChanged();
 }
 
@@ -199,6 +312,7 @@ void SpatialNode::Rotate(const Quaternion& delta, TransformSpace space)
     }
 
     rotation.Normalize();
+    MarkAttributeDirty(SPATIAL_ATTR_ROTATION);
     OnTransformChanged();
 }
 
@@ -238,6 +352,8 @@ void SpatialNode::RotateAround(const Vector3& point, const Quaternion& delta, Tr
     Vector3 oldRelativePos = oldRotation.Inverse() * (position - parentSpacePoint);
     rotation.Normalize();
     position = rotation * oldRelativePos + parentSpacePoint;
+    MarkAttributeDirty(SPATIAL_ATTR_POSITION);
+    MarkAttributeDirty(SPATIAL_ATTR_ROTATION);
     OnTransformChanged();
 }
 
@@ -297,9 +413,20 @@ void SpatialNode::ApplyScale(float delta)
 void SpatialNode::ApplyScale(const Vector3& delta)
 {
     scale *= delta;
+    MarkAttributeDirty(SPATIAL_ATTR_SCALE);
     OnTransformChanged();
 }
 
+void SpatialNode::UpdateWorldTransform() const
+{
+    if (TestFlag(NF_SPATIAL_PARENT))
+        MultiplyTransform(*worldTransform, static_cast<SpatialNode*>(Parent())->WorldTransform(), Matrix3x4(position, rotation, scale));
+    else
+        worldTransform->SetTransform(position, rotation, scale);
+
+    SetFlag(NF_WORLD_TRANSFORM_DIRTY, false);
+}
+
 void SpatialNode::OnParentSet(Node* newParent, Node*)
 {
     SetFlag(NF_SPATIAL_PARENT, dynamic_cast<SpatialNode*>(newParent) != nullptr);
@@ -319,7 +446,7 @@ void SpatialNode::OnTransformChanged()
         // and we don't need to reflag them again.
         if (curr->TestFlag(NF_WORLD_TRANSFORM_DIRTY))
             return;
-        curr->SetFlag(NF_WORLD_TRANSFORM_DIRTY, true);
+        curr->SetWorldTransformDirty();
 
         // Tail call optimization: Don't recurse to mark the first child dirty, but instead process it in the context of the current function. 
         // If there are more than one child, then recurse to the excess children.
@@ -342,3 +469,111 @@ void SpatialNode::OnTransformChanged()
             return;
     }
 }
+
+void SpatialNode::SetWorldTransformDirty()
+{
+    if (TestFlag(NF_WORLD_TRANSFORM_DIRTY))
+        return;
+
+    SetFlag(NF_WORLD_TRANSFORM_DIRTY, true);
+
+    if (TestFlag(NF_SPATIAL_HASH))
+        Subsystem<SpatialHash>()->QueueUpdate(this);
+
+    // Only the topmost dirty node is queued, the rest of the hierarchy is updated along with it
+    SpatialNode* parentNode = SpatialParent();
+    Scene* scene = ParentScene();
+    if (scene && !transformQueue && (!parentNode || !parentNode->TestFlag(NF_WORLD_TRANSFORM_DIRTY)))
+        scene->QueueTransformUpdate(this);
+}
+
+void SpatialNode::ReorderWorldTransforms(const std::vector<SpatialNode*>& order)
+{
+    ZoneScoped;
+
+    WorldTransformStorage& storage = worldTransformStorage;
+
+    // Gather the live nodes in the new order: first the ordered nodes, then the rest in their current storage order. A node listed twice keeps its first position
+    std::vector<SpatialNode*> nodes;
+    std::vector<Matrix3x4> matrices;
+    nodes.reserve(storage.numUsed);
+    matrices.reserve(storage.numUsed);
+    std::vector<bool> placed(storage.owners.size(), false);
+
+    for (auto it = order.begin(); it != order.end(); ++it)
+    {
+        SpatialNode* node = *it;
+        if (node && !placed[node->worldTransformSlot])
+        {
+            placed[node->worldTransformSlot] = true;
+            nodes.push_back(node);
+        }
+    }
+    for (size_t i = 0; i < storage.owners.size(); ++i)
+    {
+        if (storage.owners[i] && !placed[i])
+            nodes.push_back(storage.owners[i]);
+    }
+
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+        matrices.push_back(*(*it)->worldTransform);
+
+    storage.owners = nodes;
+    storage.freeSlots.clear();
+    size_t numChunks = (nodes.size() + WORLD_TRANSFORM_CHUNK_SIZE - 1) / WORLD_TRANSFORM_CHUNK_SIZE;
+    for (size_t i = numChunks; i < storage.chunks.size(); ++i)
+        delete[] storage.chunks[i];
+    storage.chunks.resize(numChunks);
+    ++storage.version;
+
+    for (unsigned i = 0; i < nodes.size(); ++i)
+    {
+        SpatialNode* node = nodes[i];
+        node->worldTransformSlot = i;
+        node->worldTransform = storage.Slot(i);
+        *node->worldTransform = matrices[i];
+        node->OnWorldTransformMoved();
+    }
+}
+
+size_t SpatialNode::NumWorldTransforms()
+{
+    return worldTransformStorage.numUsed;
+}
+
+size_t SpatialNode::NumWorldTransformSlots()
+{
+    return worldTransformStorage.owners.size();
+}
+
+unsigned SpatialNode::WorldTransformVersion()
+{
+    return worldTransformStorage.version;
+}
+
+void SpatialNode::OnWorldTransformMoved()
+{
+}
+
+void SpatialNode::AllocateWorldTransform()
+{
+    WorldTransformStorage& storage = worldTransformStorage;
+
+    // Reuse the hole freed last, or append
+    if (storage.freeSlots.size())
+    {
+        worldTransformSlot = storage.freeSlots.back();
+        storage.freeSlots.pop_back();
+    }
+    else
+    {
+        worldTransformSlot = (unsigned)storage.owners.size();
+        storage.owners.push_back(nullptr);
+        if (storage.chunks.size() * WORLD_TRANSFORM_CHUNK_SIZE < storage.owners.size())
+            storage.chunks.push_back(new Matrix3x4[WORLD_TRANSFORM_CHUNK_SIZE]);
+    }
+
+    storage.owners[worldTransformSlot] = this;
+    ++storage.numUsed;
+    worldTransform = storage.Slot(worldTransformSlot);
+}
@@ -13,11 +13,18 @@ enum TransformSpace
     TS_WORLD
 };
 
+/// Attribute indices of SpatialNode, for marking the attributes changed in the setters.
+static const size_t SPATIAL_ATTR_POSITION = NUM_NODE_ATTRS;
+static const size_t SPATIAL_ATTR_ROTATION = NUM_NODE_ATTRS + 1;
+static const size_t SPATIAL_ATTR_SCALE = NUM_NODE_ATTRS + 2;
+
 /// Base class for scene nodes with position in three-dimensional space.
 class SpatialNode : public Node
 {
     OBJECT(SpatialNode);
 
+    friend class Scene;
+
 public:
     /// Construct.
     SpatialNode();
@@ -27,6 +34,9 @@ public:
     /// Register factory and attributes.
     static void RegisterObject();
 
+    /// Handle the transform attributes having been written directly.
+    void OnMemberAttributesSet() override;
+
     /// Set position in parent space.
     void SetPosition(const Vector3& newPosition);
     /// Set rotation in parent space.
@@ -107,28 +117,36 @@ public:
     /// Convert a world space vector (either position or direction) to world space.
     Vector3 WorldToLocal(const Vector4& vector) const { return WorldTransform().Inverse() * vector; }
 
-    /// Return world transform matrix. Update if necessary.
+    /// Return world transform matrix. Update if necessary. The scene's transform update computes the dirty matrices in advance, so that they are normally not computed on demand.
     const Matrix3x4& WorldTransform() const
     {
         if (TestFlag(NF_WORLD_TRANSFORM_DIRTY))
-        {
-            if (TestFlag(NF_SPATIAL_PARENT))
-                *worldTransform = static_cast<SpatialNode*>(Parent())->WorldTransform() * Matrix3x4(position, rotation, scale);
-            else
-            {
-                (*worldTransform).SetTransform(position, rotation, scale);
-            }
-            SetFlag(NF_WORLD_TRANSFORM_DIRTY, false);
-        }
+            UpdateWorldTransform();
 
         return *worldTransform;
     }
 
+    /// Recalculate the world transform matrix and clear the dirty flag. Called by WorldTransform() and by the scene's transform update.
+    void UpdateWorldTransform() const;
+
+    /// Move the world transform matrices of all spatial nodes into contiguous storage, with the given nodes first in order and the rest after them. Invalidates pointers to the matrices, so must not be called while a view is being prepared or rendered.
+    static void ReorderWorldTransforms(const std::vector<SpatialNode*>& order);
+    /// Return number of world transform matrices in use.
+    static size_t NumWorldTransforms();
+    /// Return number of world transform storage slots, including the holes left by destroyed nodes.
+    static size_t NumWorldTransformSlots();
+    /// Return a counter that changes whenever the world transform matrices are moved in memory.
+    static unsigned WorldTransformVersion();
+
 protected:
     /// Handle being assigned to a new parent node.
     void OnParentSet(Node* newParent, Node* oldParent) override;
     /// Handle the transform matrix changing. Dirty the world transform matrices for the node hierarchy.
     virtual void OnTransformChanged();
+    /// Mark the world transform dirty. If the parent is not dirty, queue the node for the scene's transform update.
+    void SetWorldTransformDirty();
+    /// Handle the world transform matrix moving in memory. Default implementation does nothing.
+    virtual void OnWorldTransformMoved();
 
     /// Parent space position.
     Vector3 position;
@@ -136,6 +154,17 @@ protected:
     Quaternion rotation;
     /// Parent space scale.
     Vector3 scale;
-    /// World transform matrix. Allocated from a block allocator to keep the memory footprint of scene nodes and drawables smaller.
+    /// World transform matrix. Points into the contiguous world transform storage, which keeps the memory footprint of scene nodes and drawables smaller.
     mutable Matrix3x4* worldTransform;
+
+private:
+    /// Allocate a world transform storage slot.
+    void AllocateWorldTransform();
+
+    /// Index in the world transform storage.
+    unsigned worldTransformSlot;
+    /// Scene transform update queue the node is in, or null if not queued.
+    std::vector<SpatialNode*>* transformQueue;
+    /// Index in the transform update queue.
+    unsigned transformQueueIndex;
 };
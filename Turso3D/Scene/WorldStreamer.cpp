@@ -0,0 +1,400 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/File.h"
+#include "../IO/FileSystem.h"
+#include "../IO/Log.h"
+#include "../IO/ResourceRef.h"
+#include "../IO/StringUtils.h"
+#include "../IO/VectorBuffer.h"
+#include "../Object/AutoPtr.h"
+#include "../Object/ObjectResolver.h"
+#include "../Resource/ResourceCache.h"
+#include "Scene.h"
+#include "SpatialNode.h"
+#include "WorldStreamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <set>
+#include <tracy/Tracy.hpp>
+
+/// Data of a cell being loaded, shared with the worker thread that reads it.
+struct StreamedCellData
+{
+    /// Chunk stream, opened in the main thread.
+    AutoPtr<Stream> stream;
+    /// Chunk contents.
+    VectorBuffer buffer;
+    /// Positions of the top-level hierarchies in the chunk.
+    std::vector<size_t> offsets;
+    /// Number of nodes in each top-level hierarchy.
+    std::vector<size_t> nodeCounts;
+    /// Resources referenced by the nodes.
+    std::vector<ResourceRef> resources;
+    /// Resolver for the node references within the cell.
+    ObjectResolver resolver;
+    /// Number of resources still loading. Accessed only from the main thread.
+    size_t pendingResources;
+};
+
+/// Read a cell chunk into memory and parse its hierarchies. Called in a worker thread.
+static bool ReadCell(StreamedCellData& data)
+{
+    ZoneScoped;
+
+    Stream& source = *data.stream;
+    size_t dataSize = source.Size() - source.Position();
+    data.buffer.Resize(dataSize);
+    if (dataSize && source.Read(data.buffer.ModifiableData(), dataSize) != dataSize)
+        return false;
+    data.stream.Reset();
+
+    if (data.buffer.ReadFileID() != "WCEL")
+        return false;
+
+    size_t numNodes = data.buffer.ReadVLE();
+    for (size_t i = 0; i < numNodes && !data.buffer.IsEof(); ++i)
+    {
+        data.offsets.push_back(data.buffer.Position());
+        data.nodeCounts.push_back(Scene::ParseHierarchyResources(data.buffer, data.resources));
+    }
+
+    return true;
+}
+
+WorldStreamer::WorldStreamer() :
+    cellSize(0.0f),
+    loadDistance(100.0f),
+    unloadDistance(125.0f),
+    maxNodesPerFrame(500),
+    maxConcurrentLoads(4)
+{
+}
+
+WorldStreamer::~WorldStreamer()
+{
+    Close();
+}
+
+bool WorldStreamer::SaveCells(Scene* scene, const std::string& indexFileName, float cellSize, bool removeSaved)
+{
+    ZoneScoped;
+
+    if (!scene || cellSize <= 0.0f)
+        return false;
+
+    std::map<std::pair<int, int>, std::vector<Node*> > cellNodes;
+    const std::vector<SharedPtr<Node> >& children = scene->Children();
+    for (auto it = children.begin(); it != children.end(); ++it)
+    {
+        Node* node = *it;
+        if (node->IsTemporary() || !node->TestFlag(NF_SPATIAL))
+            continue;
+
+        Vector3 position = static_cast<SpatialNode*>(node)->WorldPosition();
+        cellNodes[std::make_pair((int)floorf(position.x / cellSize), (int)floorf(position.z / cellSize))].push_back(node);
+    }
+
+    File index(indexFileName, FILE_WRITE);
+    if (!index.IsOpen())
+    {
+        LOGERROR("Could not open " + indexFileName + " for writing the world cell index");
+        return false;
+    }
+
+    index.WriteFileID("WCLS");
+    index.Write(cellSize);
+    index.WriteVLE(cellNodes.size());
+
+    for (auto it = cellNodes.begin(); it != cellNodes.end(); ++it)
+    {
+        IntVector2 coords(it->first.first, it->first.second);
+        std::string cellFileName = CellName(indexFileName, coords);
+        File chunk(cellFileName, FILE_WRITE);
+        if (!chunk.IsOpen())
+        {
+            LOGERROR("Could not open " + cellFileName + " for writing a world cell");
+            return false;
+        }
+
+        chunk.WriteFileID("WCEL");
+        chunk.WriteVLE(it->second.size());
+        for (auto nIt = it->second.begin(); nIt != it->second.end(); ++nIt)
+            (*nIt)->Save(chunk);
+
+        index.Write(coords);
+    }
+
+    if (removeSaved)
+    {
+        for (auto it = cellNodes.begin(); it != cellNodes.end(); ++it)
+        {
+            for (auto nIt = it->second.begin(); nIt != it->second.end(); ++nIt)
+                (*nIt)->RemoveSelf();
+        }
+    }
+
+    return true;
+}
+
+bool WorldStreamer::Open(Scene* scene_, const std::string& indexName_)
+{
+    ZoneScoped;
+
+    Close();
+
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    if (!scene_ || !cache || !Object::Subsystem<WorkQueue>())
+    {
+        LOGERROR("Scene, ResourceCache and WorkQueue are needed for world streaming");
+        return false;
+    }
+
+    AutoPtr<Stream> stream = cache->OpenResource(indexName_);
+    if (!stream)
+    {
+        LOGERROR("Could not open world cell index " + indexName_);
+        return false;
+    }
+    if (stream->ReadFileID() != "WCLS")
+    {
+        LOGERROR(indexName_ + " is not a world cell index");
+        return false;
+    }
+
+    cellSize = stream->Read<float>();
+    size_t numCells = stream->ReadVLE();
+    cells.resize(numCells);
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+    {
+        it->coords = stream->Read<IntVector2>();
+        it->state = CELL_UNLOADED;
+        it->nextNode = 0;
+    }
+
+    scene = scene_;
+    indexName = indexName_;
+    return true;
+}
+
+void WorldStreamer::Close()
+{
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+        Unload(*it);
+
+    cells.clear();
+    scene.Reset();
+    indexName.clear();
+}
+
+void WorldStreamer::SetDistances(float loadDistance_, float unloadDistance_)
+{
+    loadDistance = Max(loadDistance_, 0.0f);
+    unloadDistance = Max(unloadDistance_, loadDistance);
+}
+
+void WorldStreamer::SetMaxNodesPerFrame(size_t maxNodes)
+{
+    maxNodesPerFrame = maxNodes;
+}
+
+void WorldStreamer::SetMaxConcurrentLoads(size_t maxLoads)
+{
+    maxConcurrentLoads = maxLoads ? maxLoads : 1;
+}
+
+bool WorldStreamer::Update(const Vector3& viewerPosition)
+{
+    ZoneScoped;
+
+    // If the scene has been destroyed, the nodes of the loaded cells are already gone
+    if (!scene)
+    {
+        cells.clear();
+        return false;
+    }
+
+    bool unloaded = false;
+    size_t numLoading = 0;
+    std::vector<std::pair<float, size_t> > loadCandidates;
+
+    // Unload beyond the unload distance, so that cells between the load and unload distances keep their state
+    for (size_t i = 0; i < cells.size(); ++i)
+    {
+        WorldCell& cell = cells[i];
+        float distance = CellDistance(cell, viewerPosition);
+
+        if (cell.state == CELL_UNLOADED)
+        {
+            if (distance <= loadDistance)
+                loadCandidates.push_back(std::make_pair(distance, i));
+        }
+        else if (distance > unloadDistance)
+        {
+            if (cell.state == CELL_LOADED && cell.root)
+                unloaded = true;
+            Unload(cell);
+        }
+        else if (cell.state == CELL_READING || cell.state == CELL_LOADING_RESOURCES)
+            ++numLoading;
+    }
+
+    // Start loading the nearest cells first
+    std::sort(loadCandidates.begin(), loadCandidates.end());
+    for (auto it = loadCandidates.begin(); it != loadCandidates.end() && numLoading < maxConcurrentLoads; ++it)
+    {
+        BeginLoad(cells[it->second]);
+        if (cells[it->second].state == CELL_READING)
+            ++numLoading;
+    }
+
+    size_t numNodes = 0;
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+    {
+        WorldCell& cell = *it;
+
+        if (cell.state == CELL_READING && cell.read.IsReady())
+        {
+            if (cell.read.Get())
+                LoadResources(cell);
+            else
+            {
+                LOGERROR("Failed to read world cell " + CellName(indexName, cell.coords));
+                // Do not retry until the cell has been out of range
+                cell.data.reset();
+                cell.state = CELL_LOADED;
+            }
+        }
+
+        if (cell.state == CELL_LOADING_RESOURCES && !cell.data->pendingResources)
+        {
+            cell.root = new Node();
+            cell.state = CELL_INSTANTIATING;
+        }
+
+        if (cell.state == CELL_INSTANTIATING)
+            Instantiate(cell, numNodes);
+    }
+
+    return unloaded;
+}
+
+size_t WorldStreamer::NumLoadedCells() const
+{
+    size_t count = 0;
+    for (auto it = cells.begin(); it != cells.end(); ++it)
+    {
+        if (it->state == CELL_LOADED && it->root)
+            ++count;
+    }
+
+    return count;
+}
+
+std::string WorldStreamer::CellName(const std::string& indexName, const IntVector2& coords)
+{
+    return PathAndFileName(indexName) + "_" + ToString(coords.x) + "_" + ToString(coords.y) + ".cell";
+}
+
+void WorldStreamer::BeginLoad(WorldCell& cell)
+{
+    std::string cellName = CellName(indexName, cell.coords);
+    AutoPtr<Stream> stream = Object::Subsystem<ResourceCache>()->OpenResource(cellName);
+    if (!stream)
+    {
+        LOGERROR("Could not open world cell " + cellName);
+        cell.state = CELL_LOADED;
+        return;
+    }
+
+    // The data is shared with the worker thread, so that unloading the cell meanwhile does not free it
+    std::shared_ptr<StreamedCellData> data = std::make_shared<StreamedCellData>();
+    data->stream = stream;
+    data->pendingResources = 0;
+    cell.data = data;
+    cell.read = Async([data]() { return ReadCell(*data); }, TASK_LOW);
+    cell.nextNode = 0;
+    cell.state = CELL_READING;
+}
+
+void WorldStreamer::LoadResources(WorldCell& cell)
+{
+    ZoneScoped;
+
+    std::shared_ptr<StreamedCellData> data = cell.data;
+    std::set<std::pair<StringHash, std::string> > requested;
+    for (auto it = data->resources.begin(); it != data->resources.end(); ++it)
+    {
+        if (!it->name.empty())
+            requested.insert(std::make_pair(it->type, it->name));
+    }
+
+    // The callbacks of already loaded resources are called immediately, so count all first
+    cell.state = CELL_LOADING_RESOURCES;
+    data->pendingResources = requested.size();
+
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    for (auto it = requested.begin(); it != requested.end(); ++it)
+    {
+        if (!cache->LoadResourceAsync(it->first, it->second, [data](Resource*) { --data->pendingResources; }))
+            --data->pendingResources;
+    }
+}
+
+void WorldStreamer::Instantiate(WorldCell& cell, size_t& numNodes)
+{
+    ZoneScoped;
+
+    StreamedCellData& data = *cell.data;
+
+    // Instantiate into the detached cell root, so that the nodes are not yet in the scene or octree
+    while (cell.nextNode < data.offsets.size() && (numNodes < maxNodesPerFrame || !numNodes))
+    {
+        data.buffer.Seek(data.offsets[cell.nextNode]);
+        StringHash childType(data.buffer.Read<StringHash>());
+        unsigned childId = data.buffer.Read<unsigned>();
+
+        Node* child = cell.root->CreateChild(childType);
+        if (child)
+        {
+            data.resolver.StoreObject(childId, child);
+            child->Load(data.buffer, data.resolver);
+        }
+
+        numNodes += data.nodeCounts[cell.nextNode];
+        ++cell.nextNode;
+    }
+
+    if (cell.nextNode >= data.offsets.size())
+    {
+        data.resolver.Resolve();
+        // Attach the whole cell at once, so that its drawables are queued for the same octree update
+        scene->AddChild(cell.root);
+        cell.data.reset();
+        cell.state = CELL_LOADED;
+    }
+}
+
+void WorldStreamer::Unload(WorldCell& cell)
+{
+    if (cell.root)
+    {
+        cell.root->RemoveSelf();
+        cell.root.Reset();
+    }
+
+    cell.data.reset();
+    cell.read = Future<bool>();
+    cell.nextNode = 0;
+    cell.state = CELL_UNLOADED;
+}
+
+float WorldStreamer::CellDistance(const WorldCell& cell, const Vector3& viewerPosition) const
+{
+    float minX = cell.coords.x * cellSize;
+    float minZ = cell.coords.y * cellSize;
+    float dx = viewerPosition.x < minX ? minX - viewerPosition.x : Max(viewerPosition.x - minX - cellSize, 0.0f);
+    float dz = viewerPosition.z < minZ ? minZ - viewerPosition.z : Max(viewerPosition.z - minZ - cellSize, 0.0f);
+    return sqrtf(dx * dx + dz * dz);
+}
@@ -0,0 +1,117 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/IntVector2.h"
+#include "../Math/Vector3.h"
+#include "../Object/Ptr.h"
+#include "../Thread/Future.h"
+
+#include <memory>
+
+class Node;
+class ObjectResolver;
+class Scene;
+struct StreamedCellData;
+
+/// Streaming state of a world cell.
+enum WorldCellState
+{
+    CELL_UNLOADED = 0,
+    CELL_READING,
+    CELL_LOADING_RESOURCES,
+    CELL_INSTANTIATING,
+    CELL_LOADED
+};
+
+/// Cell of a streamed world.
+struct WorldCell
+{
+    /// Cell coordinates on the XZ plane.
+    IntVector2 coords;
+    /// Streaming state.
+    WorldCellState state;
+    /// Data being read and parsed, or null if not loading.
+    std::shared_ptr<StreamedCellData> data;
+    /// Result of the read and parse in a worker thread.
+    Future<bool> read;
+    /// Root node of the instantiated nodes. Detached from the scene until all nodes have been instantiated.
+    SharedPtr<Node> root;
+    /// Index of the next top-level node to instantiate.
+    size_t nextNode;
+};
+
+/// Streams parts of a world in and out of a scene by viewer distance. The top-level spatial nodes of a scene are saved by position into square cells on the XZ plane as separate binary chunks. Cells are read and parsed in worker threads, their resources loaded asynchronously, and their nodes instantiated on the main thread within a per-frame budget. A cell's nodes are attached to the scene at once, so that the octree inserts them in the same update. Node references between cells are not resolved.
+class WorldStreamer
+{
+public:
+    /// Construct.
+    WorldStreamer();
+    /// Destruct. Remove the loaded cells from the scene.
+    ~WorldStreamer();
+
+    /// Save the persistent top-level spatial nodes of a scene into cells, written as an index file and one chunk file per cell beside it. Optionally remove the saved nodes from the scene. Return true on success.
+    static bool SaveCells(Scene* scene, const std::string& indexFileName, float cellSize, bool removeSaved = false);
+
+    /// Open a cell index resource for streaming into a scene. Closes the previous world. Return true on success.
+    bool Open(Scene* scene, const std::string& indexName);
+    /// Remove the loaded cells from the scene and forget the world.
+    void Close();
+    /// Set the viewer distances for loading and unloading cells. The unload distance is at least the load distance, so that cells near the boundary do not load and unload repeatedly. Default 100 and 125.
+    void SetDistances(float loadDistance, float unloadDistance);
+    /// Set the maximum number of nodes to instantiate per frame. At least one top-level hierarchy is instantiated per frame when any cell is ready. Default 500.
+    void SetMaxNodesPerFrame(size_t maxNodes);
+    /// Set the maximum number of cells being read or loading resources at once. Default 4.
+    void SetMaxConcurrentLoads(size_t maxLoads);
+    /// Start loading cells near the viewer, unload far cells and instantiate ready cells within the node budget. Call once per frame from the main thread, and call ResourceCache::UpdateAsyncLoading() as well. Return true if cells were unloaded, in which case views that refer to their drawables should be discarded.
+    bool Update(const Vector3& viewerPosition);
+
+    /// Return the scene being streamed into.
+    Scene* GetScene() const { return scene; }
+    /// Return the cell size.
+    float CellSize() const { return cellSize; }
+    /// Return the load distance.
+    float LoadDistance() const { return loadDistance; }
+    /// Return the unload distance.
+    float UnloadDistance() const { return unloadDistance; }
+    /// Return the maximum number of nodes to instantiate per frame.
+    size_t MaxNodesPerFrame() const { return maxNodesPerFrame; }
+    /// Return the maximum number of cells loading at once.
+    size_t MaxConcurrentLoads() const { return maxConcurrentLoads; }
+    /// Return the cells.
+    const std::vector<WorldCell>& Cells() const { return cells; }
+    /// Return the number of cells whose nodes are in the scene.
+    size_t NumLoadedCells() const;
+
+    /// Return the chunk resource name of a cell.
+    static std::string CellName(const std::string& indexName, const IntVector2& coords);
+
+private:
+    /// Open the chunk of a cell and queue its reading and parsing.
+    void BeginLoad(WorldCell& cell);
+    /// Queue the asynchronous loads of a parsed cell's resources.
+    void LoadResources(WorldCell& cell);
+    /// Instantiate top-level hierarchies of a cell, counting the instantiated nodes. Attach the cell to the scene once all are done.
+    void Instantiate(WorldCell& cell, size_t& numNodes);
+    /// Unload a cell, removing its nodes from the scene if attached.
+    void Unload(WorldCell& cell);
+    /// Return the distance from the viewer to the area of a cell on the XZ plane.
+    float CellDistance(const WorldCell& cell, const Vector3& viewerPosition) const;
+
+    /// Scene being streamed into.
+    WeakPtr<Scene> scene;
+    /// Cell index resource name.
+    std::string indexName;
+    /// Cells of the world.
+    std::vector<WorldCell> cells;
+    /// Cell size.
+    float cellSize;
+    /// Viewer distance for loading.
+    float loadDistance;
+    /// Viewer distance for unloading.
+    float unloadDistance;
+    /// Maximum nodes to instantiate per frame.
+    size_t maxNodesPerFrame;
+    /// Maximum cells loading at once.
+    size_t maxConcurrentLoads;
+};
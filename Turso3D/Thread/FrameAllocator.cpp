@@ -0,0 +1,103 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../Math/Math.h"
+#include "FrameAllocator.h"
+
+FrameArena::FrameArena(size_t initialSize) :
+    position(0),
+    usedBytes(0),
+    peakBytes(0)
+{
+    AddChunk(Max(initialSize, (size_t)64));
+}
+
+FrameArena::~FrameArena()
+{
+    FreeChunks();
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment)
+{
+    std::pair<unsigned char*, size_t>* chunk = &chunks.back();
+    size_t padding = (alignment - ((size_t)(chunk->first + position) & (alignment - 1))) & (alignment - 1);
+
+    if (position + padding + size > chunk->second)
+    {
+        // Grow geometrically so that a growing frame needs few chunks
+        AddChunk(Max(chunk->second * 2, size + alignment));
+        chunk = &chunks.back();
+        padding = (alignment - ((size_t)chunk->first & (alignment - 1))) & (alignment - 1);
+    }
+
+    unsigned char* ret = chunk->first + position + padding;
+    position += padding + size;
+    usedBytes += padding + size;
+    if (usedBytes > peakBytes)
+        peakBytes = usedBytes;
+
+    return ret;
+}
+
+void FrameArena::Reset()
+{
+    if (chunks.size() > 1)
+    {
+        size_t totalSize = CapacityBytes();
+        FreeChunks();
+        AddChunk(totalSize);
+    }
+
+    position = 0;
+    usedBytes = 0;
+}
+
+size_t FrameArena::CapacityBytes() const
+{
+    size_t ret = 0;
+    for (auto it = chunks.begin(); it != chunks.end(); ++it)
+        ret += it->second;
+    return ret;
+}
+
+void FrameArena::AddChunk(size_t size)
+{
+    MEMORY_SCOPE(MEMORY_FRAMEARENA);
+
+    chunks.push_back(std::make_pair(new unsigned char[size], size));
+    position = 0;
+}
+
+void FrameArena::FreeChunks()
+{
+    for (auto it = chunks.begin(); it != chunks.end(); ++it)
+        delete[] it->first;
+    chunks.clear();
+}
+
+FrameArenas::FrameArenas(unsigned numThreads, size_t initialSize)
+{
+    for (unsigned i = 0; i < numThreads; ++i)
+        arenas.push_back(new FrameArena(initialSize));
+}
+
+void FrameArenas::Reset()
+{
+    for (auto it = arenas.begin(); it != arenas.end(); ++it)
+        (*it)->Reset();
+}
+
+size_t FrameArenas::UsedBytes() const
+{
+    size_t ret = 0;
+    for (auto it = arenas.begin(); it != arenas.end(); ++it)
+        ret += (*it)->UsedBytes();
+    return ret;
+}
+
+size_t FrameArenas::PeakBytes() const
+{
+    size_t ret = 0;
+    for (auto it = arenas.begin(); it != arenas.end(); ++it)
+        ret += (*it)->PeakBytes();
+    return ret;
+}
@@ -0,0 +1,127 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "WorkQueue.h"
+
+#include <type_traits>
+#include <vector>
+
+static const size_t DEFAULT_FRAME_ARENA_SIZE = 64 * 1024;
+
+/// Linear memory arena for per-frame scratch data. Allocation bumps a pointer, and all allocations are freed at once on Reset(). Not threadsafe.
+class FrameArena
+{
+public:
+    /// Construct with initial chunk size.
+    FrameArena(size_t initialSize = DEFAULT_FRAME_ARENA_SIZE);
+    /// Destruct. Free all chunks.
+    ~FrameArena();
+
+    /// Allocate memory with alignment. Allocate a new chunk if the current is full.
+    void* Allocate(size_t size, size_t alignment);
+    /// Free all allocations. If several chunks were needed, replace them with one chunk large enough for all of them.
+    void Reset();
+
+    /// Return bytes allocated since the last reset.
+    size_t UsedBytes() const { return usedBytes; }
+    /// Return the most bytes allocated between resets.
+    size_t PeakBytes() const { return peakBytes; }
+    /// Return total size of the chunks.
+    size_t CapacityBytes() const;
+
+private:
+    /// Allocate a new chunk and make it current.
+    void AddChunk(size_t size);
+    /// Free all chunks.
+    void FreeChunks();
+
+    /// Prevent copy construction.
+    FrameArena(const FrameArena& rhs);
+    /// Prevent assignment.
+    FrameArena& operator = (const FrameArena& rhs);
+
+    /// Memory chunks. The last is the current.
+    std::vector<std::pair<unsigned char*, size_t> > chunks;
+    /// Allocation position within the current chunk.
+    size_t position;
+    /// Bytes allocated since the last reset, including alignment padding.
+    size_t usedBytes;
+    /// Most bytes allocated between resets.
+    size_t peakBytes;
+};
+
+/// Per-thread frame arenas. Allocation uses the arena of the calling work queue thread, so that worker threads do not need to lock.
+class FrameArenas
+{
+public:
+    /// Construct with amount of threads, including the main thread.
+    FrameArenas(unsigned numThreads, size_t initialSize = DEFAULT_FRAME_ARENA_SIZE);
+
+    /// Allocate memory from the calling thread's arena.
+    void* Allocate(size_t size, size_t alignment) { return arenas[WorkQueue::ThreadIndex()]->Allocate(size, alignment); }
+    /// Free all allocations in all arenas. Containers using the arenas must have released their memory first. Must not be called while tasks use the arenas.
+    void Reset();
+
+    /// Return bytes allocated since the last reset in all arenas.
+    size_t UsedBytes() const;
+    /// Return sum of the arenas' peak usage.
+    size_t PeakBytes() const;
+
+private:
+    /// Arenas by thread index.
+    std::vector<AutoPtr<FrameArena> > arenas;
+};
+
+/// STL allocator that allocates from per-thread frame arenas. Deallocation is a no-op, memory is reclaimed when the arenas are reset. Without arenas, uses the default heap.
+template <class T> class FrameAllocator
+{
+public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    /// Construct with arenas to use.
+    FrameAllocator(FrameArenas* arenas_ = nullptr) :
+        arenas(arenas_)
+    {
+    }
+
+    /// Construct from an allocator of another type.
+    template <class U> FrameAllocator(const FrameAllocator<U>& rhs) :
+        arenas(rhs.arenas)
+    {
+    }
+
+    /// Allocate memory for objects.
+    T* allocate(size_t count)
+    {
+        return static_cast<T*>(arenas ? arenas->Allocate(count * sizeof(T), alignof(T)) : ::operator new(count * sizeof(T)));
+    }
+
+    /// Free memory for objects.
+    void deallocate(T* ptr, size_t)
+    {
+        if (!arenas)
+            ::operator delete(ptr);
+    }
+
+    /// Arenas.
+    FrameArenas* arenas;
+};
+
+/// Test for allocator equality.
+template <class T, class U> bool operator == (const FrameAllocator<T>& lhs, const FrameAllocator<U>& rhs) { return lhs.arenas == rhs.arenas; }
+/// Test for allocator inequality.
+template <class T, class U> bool operator != (const FrameAllocator<T>& lhs, const FrameAllocator<U>& rhs) { return lhs.arenas != rhs.arenas; }
+
+/// Vector allocated from frame arenas.
+template <class T> using FrameVector = std::vector<T, FrameAllocator<T> >;
+
+/// Release a frame vector's memory before the arenas are reset, keeping the allocator.
+template <class T> void ResetFrameVector(FrameVector<T>& vector)
+{
+    FrameVector<T>(vector.get_allocator()).swap(vector);
+}
@@ -0,0 +1,96 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Future.h"
+
+AsyncStateBase::AsyncStateBase()
+{
+    ready.store(false);
+}
+
+AsyncStateBase::~AsyncStateBase()
+{
+}
+
+void AsyncStateBase::SetReady()
+{
+    std::vector<Task*> tasks;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.store(true);
+        tasks.swap(continuations);
+    }
+
+    if (tasks.size())
+        Object::Subsystem<WorkQueue>()->QueueTasks(tasks.size(), &tasks[0]);
+}
+
+void AsyncStateBase::AddContinuation(Task* task)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ready.load())
+        {
+            continuations.push_back(task);
+            return;
+        }
+    }
+
+    Object::Subsystem<WorkQueue>()->QueueTask(task);
+}
+
+Future<void> WhenComplete(Task* task)
+{
+    std::shared_ptr<AsyncState<void> > dest = std::make_shared<AsyncState<void> >();
+
+    LambdaTask* waitTask = new LambdaTask([dest](unsigned)
+    {
+        dest->SetReady();
+    });
+    waitTask->priority = TASK_HIGH;
+    waitTask->deleteOnComplete = true;
+
+    if (!waitTask->TryAddDependency(task))
+    {
+        delete waitTask;
+        dest->SetReady();
+    }
+
+    return Future<void>(dest);
+}
+
+Future<void> NextFrame()
+{
+    std::shared_ptr<AsyncState<void> > dest = std::make_shared<AsyncState<void> >();
+
+    LambdaTask* frameTask = new LambdaTask([dest](unsigned)
+    {
+        dest->SetReady();
+    });
+    frameTask->priority = TASK_HIGH;
+    frameTask->deleteOnComplete = true;
+    Object::Subsystem<WorkQueue>()->QueueOnEndFrame(frameTask);
+
+    return Future<void>(dest);
+}
+
+Future<void> WhenAll(const std::vector<Future<void> >& futures)
+{
+    std::shared_ptr<AsyncState<void> > dest = std::make_shared<AsyncState<void> >();
+    std::shared_ptr<std::atomic<int> > numPending = std::make_shared<std::atomic<int> >();
+    numPending->store((int)futures.size() + 1);
+
+    for (auto it = futures.begin(); it != futures.end(); ++it)
+    {
+        it->Then([dest, numPending](const Future<void>&)
+        {
+            if (numPending->fetch_add(-1) == 1)
+                dest->SetReady();
+        }, TASK_HIGH);
+    }
+
+    // Release the extra count only now, so that futures which are already ready can not complete the result early
+    if (numPending->fetch_add(-1) == 1)
+        dest->SetReady();
+
+    return Future<void>(dest);
+}
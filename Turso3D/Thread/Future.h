@@ -0,0 +1,138 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "WorkQueue.h"
+
+#include <memory>
+#include <type_traits>
+
+/// Shared state of an asynchronous result. Holds the continuations to queue once ready.
+struct AsyncStateBase
+{
+    /// Construct.
+    AsyncStateBase();
+    /// Destruct.
+    virtual ~AsyncStateBase();
+
+    /// Mark ready and queue the continuations. To be called from the main thread or from work functions.
+    void SetReady();
+    /// Add a continuation task, which is queued immediately if already ready. The task must not have other dependencies.
+    void AddContinuation(Task* task);
+
+    /// Ready flag.
+    std::atomic<bool> ready;
+    /// Mutex for the continuations.
+    std::mutex mutex;
+    /// Tasks to queue once ready.
+    std::vector<Task*> continuations;
+};
+
+/// Shared state with a result value.
+template <class T> struct AsyncState : public AsyncStateBase
+{
+    /// Call a functor and store its return value.
+    template <class F> void Run(const F& functor) { value = functor(); }
+    /// Return the value.
+    T& Value() { return value; }
+
+    /// Result value.
+    T value;
+};
+
+/// Shared state without a result value.
+template <> struct AsyncState<void> : public AsyncStateBase
+{
+    /// Call a functor.
+    template <class F> void Run(const F& functor) { functor(); }
+    /// Return nothing.
+    void Value() {}
+};
+
+/// Handle to the result of asynchronous work executed by the work queue. Continuations can be chained with Then() to avoid blocking.
+template <class T> class Future
+{
+public:
+    /// Construct a null future.
+    Future()
+    {
+    }
+
+    /// Construct from a shared state.
+    Future(const std::shared_ptr<AsyncState<T> >& state_) :
+        state(state_)
+    {
+    }
+
+    /// Queue a functor with signature (const Future<T>&) to be called in a worker thread once this result is ready. Return the future for its result.
+    template <class F> Future<typename std::result_of<F(const Future<T>&)>::type> Then(const F& functor, TaskPriority priority = TASK_NORMAL) const
+    {
+        typedef typename std::result_of<F(const Future<T>&)>::type R;
+
+        assert(state);
+        std::shared_ptr<AsyncState<T> > source = state;
+        std::shared_ptr<AsyncState<R> > dest = std::make_shared<AsyncState<R> >();
+
+        LambdaTask* task = new LambdaTask([source, dest, functor](unsigned)
+        {
+            Future<T> ready(source);
+            dest->Run([&functor, &ready]() { return functor(ready); });
+            dest->SetReady();
+        });
+        task->priority = priority;
+        task->deleteOnComplete = true;
+        source->AddContinuation(task);
+
+        return Future<R>(dest);
+    }
+
+    /// Execute tasks in the calling thread until the result is ready. Do not wait on a frame boundary from the main thread, as it would never arrive.
+    void Wait() const
+    {
+        assert(state);
+        if (!state->ready.load())
+            Object::Subsystem<WorkQueue>()->CompleteUntil(state->ready);
+    }
+
+    /// Wait for and return the result.
+    typename std::add_lvalue_reference<T>::type Get() const
+    {
+        Wait();
+        return state->Value();
+    }
+
+    /// Return whether is ready.
+    bool IsReady() const { return state && state->ready.load(); }
+    /// Return whether refers to a shared state.
+    bool IsValid() const { return (bool)state; }
+
+private:
+    /// Shared state.
+    std::shared_ptr<AsyncState<T> > state;
+};
+
+/// Queue a functor with no arguments for execution in a worker thread. Return the future for its result.
+template <class F> Future<typename std::result_of<F()>::type> Async(const F& functor, TaskPriority priority = TASK_NORMAL)
+{
+    typedef typename std::result_of<F()>::type R;
+
+    std::shared_ptr<AsyncState<R> > dest = std::make_shared<AsyncState<R> >();
+
+    LambdaTask* task = new LambdaTask([dest, functor](unsigned)
+    {
+        dest->Run(functor);
+        dest->SetReady();
+    });
+    task->priority = priority;
+    task->deleteOnComplete = true;
+    Object::Subsystem<WorkQueue>()->QueueTask(task);
+
+    return Future<R>(dest);
+}
+
+/// Return a future that becomes ready when a task completes its current execution. The task may already be queued or running. If it has already completed, the future is ready immediately.
+Future<void> WhenComplete(Task* task);
+/// Return a future that becomes ready at the next WorkQueue::EndFrame() call.
+Future<void> NextFrame();
+/// Return a future that becomes ready when all the given futures are.
+Future<void> WhenAll(const std::vector<Future<void> >& futures);
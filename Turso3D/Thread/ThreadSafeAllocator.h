@@ -0,0 +1,153 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/Allocator.h"
+#include "WorkQueue.h"
+
+#include <mutex>
+
+/// Number of free nodes a thread can cache in a threadsafe allocator.
+static const size_t ALLOCATOR_CACHE_SIZE = 32;
+/// Number of work queue threads that get a cache in a threadsafe allocator. Threads beyond lock on each allocation.
+static const unsigned MAX_ALLOCATOR_CACHES = 32;
+
+/// Free nodes cached by one thread, padded to not share cache lines with other threads.
+struct alignas(64) AllocatorCache
+{
+    /// Free nodes.
+    void* nodes[ALLOCATOR_CACHE_SIZE];
+    /// Number of free nodes.
+    size_t count;
+};
+
+/// Threadsafe fixed-size allocator of objects of a specific class. Work queue threads allocate from and free to their own cache of free nodes, which is exchanged with the shared allocator half at a time under a lock. Other threads than the work queue's must not use it.
+template <class T> class ThreadSafeAllocator
+{
+public:
+    /// Construct.
+    ThreadSafeAllocator() :
+        allocator(nullptr)
+    {
+        for (unsigned i = 0; i < MAX_ALLOCATOR_CACHES; ++i)
+            caches[i].count = 0;
+    }
+
+    /// Destruct. All objects reserved from this allocator should be freed before this is called.
+    ~ThreadSafeAllocator()
+    {
+        AllocatorUninitialize(allocator);
+    }
+
+    /// Allocate and default-construct an object.
+    T* Allocate()
+    {
+        T* newObject = static_cast<T*>(AllocateNode());
+        new(newObject) T();
+        return newObject;
+    }
+
+    /// Destruct and free an object.
+    void Free(T* object)
+    {
+        object->~T();
+
+        unsigned threadIndex = WorkQueue::ThreadIndex();
+        if (threadIndex < MAX_ALLOCATOR_CACHES)
+        {
+            AllocatorCache& cache = caches[threadIndex];
+            if (cache.count == ALLOCATOR_CACHE_SIZE)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (size_t i = 0; i < ALLOCATOR_CACHE_SIZE / 2; ++i)
+                    AllocatorFree(allocator, cache.nodes[--cache.count]);
+            }
+            cache.nodes[cache.count++] = object;
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            AllocatorFree(allocator, object);
+        }
+    }
+
+    /// Destruct and free all objects at once, keeping the memory for reuse. Must not be called while other threads use the allocator.
+    void FreeAll()
+    {
+        FlushCaches();
+        AllocatorFreeAll(allocator, std::is_trivially_destructible<T>::value ? nullptr : &Destruct);
+    }
+
+    /// Return the nodes cached by threads to the shared allocator, then free the memory blocks that have no objects, except the first. Must not be called while other threads use the allocator. Return the number of bytes freed.
+    size_t Trim()
+    {
+        FlushCaches();
+        return AllocatorTrim(allocator);
+    }
+
+    /// Return number of allocated objects. Approximate while other threads use the allocator.
+    size_t NumUsed() const
+    {
+        size_t cached = 0;
+        for (unsigned i = 0; i < MAX_ALLOCATOR_CACHES; ++i)
+            cached += caches[i].count;
+        return allocator ? allocator->used - cached : 0;
+    }
+
+    /// Return number of objects that fit in the memory blocks.
+    size_t Capacity() const { return allocator ? allocator->capacity : 0; }
+
+private:
+    /// Return a free node from the calling thread's cache, refilling it from the shared allocator if empty.
+    void* AllocateNode()
+    {
+        unsigned threadIndex = WorkQueue::ThreadIndex();
+        if (threadIndex < MAX_ALLOCATOR_CACHES)
+        {
+            AllocatorCache& cache = caches[threadIndex];
+            if (!cache.count)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!allocator)
+                    allocator = AllocatorInitialize(sizeof(T));
+                while (cache.count < ALLOCATOR_CACHE_SIZE / 2)
+                    cache.nodes[cache.count++] = AllocatorGet(allocator);
+            }
+            return cache.nodes[--cache.count];
+        }
+        else
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!allocator)
+                allocator = AllocatorInitialize(sizeof(T));
+            return AllocatorGet(allocator);
+        }
+    }
+
+    /// Return the nodes cached by threads to the shared allocator.
+    void FlushCaches()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (unsigned i = 0; i < MAX_ALLOCATOR_CACHES; ++i)
+        {
+            AllocatorCache& cache = caches[i];
+            while (cache.count)
+                AllocatorFree(allocator, cache.nodes[--cache.count]);
+        }
+    }
+
+    /// Destruct an object for FreeAll().
+    static void Destruct(void* object) { static_cast<T*>(object)->~T(); }
+
+    /// Prevent copy construction.
+    ThreadSafeAllocator(const ThreadSafeAllocator<T>& rhs);
+    /// Prevent assignment.
+    ThreadSafeAllocator<T>& operator = (const ThreadSafeAllocator<T>& rhs);
+
+    /// Per-thread caches of free nodes.
+    AllocatorCache caches[MAX_ALLOCATOR_CACHES];
+    /// Shared allocator block.
+    AllocatorBlock* allocator;
+    /// Lock for the shared allocator.
+    std::mutex mutex;
+};
@@ -1,9 +1,52 @@
 #include "ThreadUtils.h"
 
+#include <cstdio>
 #include <thread>
 
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#include <immintrin.h>
+#define HAS_MM_PAUSE
+#endif
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 std::thread::id mainThreadId = std::this_thread::get_id();
 
+#if defined(__linux__)
+static bool ReadSysValue(const char* path, unsigned& value)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+        return false;
+
+    bool success = fscanf(file, "%u", &value) == 1;
+    fclose(file);
+    return success;
+}
+#elif defined(_WIN32)
+static std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> LogicalProcessorInformation()
+{
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> ret;
+    DWORD length = 0;
+
+    GetLogicalProcessorInformation(nullptr, &length);
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER || !length)
+        return ret;
+
+    ret.resize(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!GetLogicalProcessorInformation(&ret[0], &length))
+        ret.clear();
+
+    return ret;
+}
+#endif
+
 bool IsMainThread()
 {
     return std::this_thread::get_id() == mainThreadId;
@@ -12,4 +55,136 @@ bool IsMainThread()
 unsigned CPUCount()
 {
     return std::thread::hardware_concurrency();
-}
\ No newline at end of file
+}
+
+std::vector<unsigned> CPUCacheDomains()
+{
+    unsigned numCpus = CPUCount();
+    std::vector<unsigned> ret(numCpus, 0);
+
+    #if defined(__linux__)
+    char path[256];
+
+    for (unsigned i = 0; i < numCpus; ++i)
+    {
+        // Find the highest cache level, and use its id
+        unsigned bestLevel = 0;
+        for (unsigned j = 0; j < 8; ++j)
+        {
+            unsigned level, id;
+            snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%u/cache/index%u/level", i, j);
+            if (!ReadSysValue(path, level))
+                break;
+            snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%u/cache/index%u/id", i, j);
+            if (level > bestLevel && ReadSysValue(path, id))
+            {
+                bestLevel = level;
+                ret[i] = id;
+            }
+        }
+    }
+    #elif defined(_WIN32)
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info = LogicalProcessorInformation();
+    BYTE bestLevel = 0;
+    unsigned domain = 0;
+
+    for (auto it = info.begin(); it != info.end(); ++it)
+    {
+        if (it->Relationship == RelationCache && it->Cache.Level > bestLevel)
+            bestLevel = it->Cache.Level;
+    }
+
+    for (auto it = info.begin(); it != info.end(); ++it)
+    {
+        if (it->Relationship == RelationCache && it->Cache.Level == bestLevel)
+        {
+            for (unsigned i = 0; i < numCpus && i < sizeof(ULONG_PTR) * 8; ++i)
+            {
+                if (it->ProcessorMask & ((ULONG_PTR)1 << i))
+                    ret[i] = domain;
+            }
+            ++domain;
+        }
+    }
+    #endif
+
+    return ret;
+}
+
+std::vector<unsigned> CPUNumaNodes()
+{
+    unsigned numCpus = CPUCount();
+    std::vector<unsigned> ret(numCpus, 0);
+
+    #if defined(__linux__)
+    char path[256];
+
+    for (unsigned i = 0; i < numCpus; ++i)
+    {
+        // The CPU directory contains a nodeX link for its NUMA node
+        snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%u", i);
+        DIR* dir = opendir(path);
+        if (!dir)
+            continue;
+
+        while (dirent* entry = readdir(dir))
+        {
+            unsigned node;
+            if (sscanf(entry->d_name, "node%u", &node) == 1)
+            {
+                ret[i] = node;
+                break;
+            }
+        }
+
+        closedir(dir);
+    }
+    #elif defined(_WIN32)
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info = LogicalProcessorInformation();
+
+    for (auto it = info.begin(); it != info.end(); ++it)
+    {
+        if (it->Relationship == RelationNumaNode)
+        {
+            for (unsigned i = 0; i < numCpus && i < sizeof(ULONG_PTR) * 8; ++i)
+            {
+                if (it->ProcessorMask & ((ULONG_PTR)1 << i))
+                    ret[i] = it->NumaNode.NodeNumber;
+            }
+        }
+    }
+    #endif
+
+    return ret;
+}
+
+void CPUPause()
+{
+    #if defined(HAS_MM_PAUSE)
+    _mm_pause();
+    #elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+    #endif
+}
+
+bool SetCurrentThreadAffinity(unsigned long long mask)
+{
+    if (!mask)
+        return false;
+
+    #if defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (unsigned i = 0; i < 64; ++i)
+    {
+        if (mask & (1ULL << i))
+            CPU_SET(i, &cpuSet);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof cpuSet, &cpuSet) == 0;
+    #elif defined(_WIN32)
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)mask) != 0;
+    #else
+    // Not supported, e.g. on macOS where only affinity hints exist
+    return false;
+    #endif
+}
@@ -2,7 +2,17 @@
 
 #pragma once
 
+#include <vector>
+
 // Check if is running in the main thread.
 bool IsMainThread();
 // Return hardware CPU count, for determining e.g. amount of worker threads.
 unsigned CPUCount();
+// Return the shared last-level cache (e.g. CCX) domain index of each logical CPU. All zero if unknown.
+std::vector<unsigned> CPUCacheDomains();
+// Return the NUMA node index of each logical CPU. All zero if unknown.
+std::vector<unsigned> CPUNumaNodes();
+// Hint the CPU that the calling thread is busy-waiting.
+void CPUPause();
+// Restrict the calling thread to a mask of logical CPUs. Return true on success.
+bool SetCurrentThreadAffinity(unsigned long long mask);
@@ -1,39 +1,192 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../Math/Math.h"
+#include "../Time/Profiler.h"
+#include "../Time/Timer.h"
+#include "../Time/TraceRecorder.h"
 #include "ThreadUtils.h"
 #include "WorkQueue.h"
 
+#include <algorithm>
 #include <tracy/Tracy.hpp>
 
 thread_local unsigned WorkQueue::threadIndex = 0;
 
-Task::Task()
+Task::Task() :
+    priority(TASK_NORMAL),
+    deleteOnComplete(false),
+    memoryTag(MEMORY_GENERAL),
+    queueTime(0)
 {
     numDependencies.store(0);
+    completed.store(false);
+    dependentsLock.clear();
+    pathStart.store(0);
 }
 
 Task::~Task()
 {
 }
 
-WorkQueue::WorkQueue(unsigned numThreads) :
-    shouldExit(false)
+bool Task::TryAddDependency(Task* task)
 {
-    RegisterSubsystem(this);
+    while (task->dependentsLock.test_and_set(std::memory_order_acquire))
+        CPUPause();
 
-    numQueuedTasks.store(0);
-    numPendingTasks.store(0);
+    bool added = !task->completed.load(std::memory_order_relaxed);
+    if (added)
+    {
+        task->dependentTasks.push_back(this);
+        numDependencies.fetch_add(1);
+        memoryTag = CurrentMemoryTag();
+    }
+
+    task->dependentsLock.clear(std::memory_order_release);
+    return added;
+}
+
+static const long long INITIAL_DEQUE_CAPACITY = 256;
+static const size_t PARALLEL_FOR_RANGES_PER_THREAD = 4;
+
+/// Raise an atomic value to at least the given value.
+static void AtomicMax(std::atomic<long long>& dest, long long value)
+{
+    long long current = dest.load(std::memory_order_relaxed);
+    while (value > current && !dest.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        ;
+}
+
+TaskDequeBuffer::TaskDequeBuffer(long long capacity_) :
+    capacity(capacity_),
+    mask(capacity_ - 1),
+    tasks(new std::atomic<Task*>[(size_t)capacity_])
+{
+    assert(capacity && !(capacity & mask));
+}
+
+TaskDeque::TaskDeque()
+{
+    top.store(0);
+    bottom.store(0);
+    buffers.push_back(new TaskDequeBuffer(INITIAL_DEQUE_CAPACITY));
+    buffer.store(buffers.back().Get());
+}
 
-    if (numThreads == 0)
+void TaskDeque::Push(Task* task)
+{
+    long long b = bottom.load(std::memory_order_relaxed);
+    long long t = top.load(std::memory_order_acquire);
+    TaskDequeBuffer* buf = buffer.load(std::memory_order_relaxed);
+
+    // Grow if full. Copy the live range to a buffer twice the size
+    if (b - t > buf->capacity - 1)
     {
-        numThreads = CPUCount();
-        // Avoid completely excessive core count
-        if (numThreads > 16)
-            numThreads = 16;
+        TaskDequeBuffer* newBuf = new TaskDequeBuffer(buf->capacity * 2);
+        for (long long i = t; i < b; ++i)
+            newBuf->Put(i, buf->Get(i));
+
+        buffers.push_back(newBuf);
+        buffer.store(newBuf, std::memory_order_release);
+        buf = newBuf;
     }
 
-    for (unsigned  i = 0; i < numThreads - 1; ++i)
-        threads.push_back(std::thread(&WorkQueue::WorkerLoop, this, i + 1));
+    buf->Put(b, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+Task* TaskDeque::Pop()
+{
+    long long b = bottom.load(std::memory_order_relaxed) - 1;
+    TaskDequeBuffer* buf = buffer.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long t = top.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // Was empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Task* task = buf->Get(b);
+    if (t == b)
+    {
+        // Last task, race against thieves
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            task = nullptr;
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    return task;
+}
+
+Task* TaskDeque::Steal()
+{
+    long long t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long b = bottom.load(std::memory_order_acquire);
+
+    if (t >= b)
+        return nullptr;
+
+    TaskDequeBuffer* buf = buffer.load(std::memory_order_acquire);
+    Task* task = buf->Get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+
+    return task;
+}
+
+template <class T> bool WorkQueue::SpinWait(const T& predicate)
+{
+    for (unsigned i = 0; i < spinCount; ++i)
+    {
+        if (predicate())
+        {
+            numSpinWaits.fetch_add(1);
+            return true;
+        }
+        CPUPause();
+    }
+
+    for (unsigned i = 0; i < yieldCount; ++i)
+    {
+        if (predicate())
+        {
+            numSpinWaits.fetch_add(1);
+            return true;
+        }
+        std::this_thread::yield();
+    }
+
+    return predicate();
+}
+
+WorkQueueSettings::WorkQueueSettings() :
+    numThreads(0),
+    grouping(GROUP_CACHE),
+    pinThreads(false),
+    spinCount(2000),
+    yieldCount(16)
+{
+}
+
+WorkQueue::WorkQueue(unsigned numThreads) :
+    shouldExit(false),
+    frameStartTime(0)
+{
+    WorkQueueSettings settings;
+    settings.numThreads = numThreads;
+    Initialize(settings);
+}
+
+WorkQueue::WorkQueue(const WorkQueueSettings& settings) :
+    shouldExit(false),
+    frameStartTime(0)
+{
+    Initialize(settings);
 }
 
 WorkQueue::~WorkQueue()
@@ -42,29 +195,130 @@ WorkQueue::~WorkQueue()
         return;
 
     // Signal exit and wait for threads to finish
-    shouldExit = true;
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        shouldExit = true;
+    }
 
     signal.notify_all();
     for (auto it = threads.begin(); it != threads.end(); ++it)
         it->join();
 }
 
+void WorkQueue::Initialize(const WorkQueueSettings& settings)
+{
+    RegisterSubsystem(this);
+
+    numSleepingWorkers.store(0);
+    mainSleeping.store(false);
+    numQueuedTasks.store(0);
+    for (size_t i = 0; i < NUM_TASK_PRIORITIES; ++i)
+        numQueuedTasksByPriority[i].store(0);
+    numPendingTasks.store(0);
+    numInjectedTasks.store(0);
+    spinCount = settings.spinCount;
+    yieldCount = settings.yieldCount;
+    ResetStats();
+    instrumentation.store(false);
+    maxQueueDepth.store(0);
+    totalLatency.store(0);
+    numLatencies.store(0);
+    maxLatency.store(0);
+    criticalPath.store(0);
+
+    unsigned numThreads = settings.numThreads ? settings.numThreads : (unsigned)Max((size_t)CPUCount(), (size_t)1);
+    unsigned numCpus = (unsigned)Max((size_t)CPUCount(), (size_t)1);
+
+    // Find the group of each CPU, and order the CPUs so that each group is filled before the next
+    std::vector<unsigned> cpuGroups;
+    if (settings.grouping == GROUP_CACHE)
+        cpuGroups = CPUCacheDomains();
+    else if (settings.grouping == GROUP_NUMA)
+        cpuGroups = CPUNumaNodes();
+    cpuGroups.resize(numCpus, 0);
+
+    std::vector<std::pair<unsigned, unsigned> > cpuOrder;
+    for (unsigned i = 0; i < numCpus; ++i)
+        cpuOrder.push_back(std::make_pair(cpuGroups[i], i));
+    std::sort(cpuOrder.begin(), cpuOrder.end());
+
+    affinityMasks.resize(numThreads);
+    for (unsigned i = 0; i < numThreads; ++i)
+    {
+        if (i < settings.affinityMasks.size())
+            affinityMasks[i] = settings.affinityMasks[i];
+        else if (settings.pinThreads && i > 0 && numCpus <= 64)
+            affinityMasks[i] = 1ULL << cpuOrder[i % numCpus].second;
+        else
+            affinityMasks[i] = 0;
+    }
+
+    // Group of each thread is that of the lowest CPU in its mask. Unpinned threads have no group
+    std::vector<unsigned> threadGroups(numThreads, M_MAX_UNSIGNED);
+    for (unsigned i = 0; i < numThreads; ++i)
+    {
+        for (unsigned j = 0; j < numCpus && j < 64; ++j)
+        {
+            if (affinityMasks[i] & (1ULL << j))
+            {
+                threadGroups[i] = cpuGroups[j];
+                break;
+            }
+        }
+    }
+
+    // Steal first from siblings in the same group, then from the rest, in round-robin order starting from the next thread
+    stealOrder.resize(numThreads);
+    for (unsigned i = 0; i < numThreads; ++i)
+    {
+        for (unsigned pass = 0; pass < 2; ++pass)
+        {
+            for (unsigned j = 1; j < numThreads; ++j)
+            {
+                unsigned victim = (i + j) % numThreads;
+                bool sameGroup = threadGroups[i] != M_MAX_UNSIGNED && threadGroups[victim] == threadGroups[i];
+                if (sameGroup == (pass == 0))
+                    stealOrder[i].push_back(victim);
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < numThreads * NUM_TASK_PRIORITIES; ++i)
+        deques.push_back(new TaskDeque());
+
+    parallelForTasks.resize(numThreads);
+    parallelForTasksUsed.resize(numThreads);
+    for (unsigned i = 0; i < numThreads; ++i)
+    {
+        WorkQueueThreadStats* stats = new WorkQueueThreadStats();
+        stats->busyTime.store(0);
+        stats->numTasks.store(0);
+        stats->numSteals.store(0);
+        stats->depth = 0;
+        threadStats.push_back(stats);
+    }
+    CollectFrameStats();
+
+    if (affinityMasks[0])
+        SetCurrentThreadAffinity(affinityMasks[0]);
+
+    for (unsigned  i = 0; i < numThreads - 1; ++i)
+        threads.push_back(std::thread(&WorkQueue::WorkerLoop, this, i + 1));
+}
+
 void WorkQueue::QueueTask(Task* task)
 {
     assert(task);
 
+    task->memoryTag = CurrentMemoryTag();
+
     if (threads.size())
     {
         assert(task->numDependencies.load() == 0);
 
-        {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            tasks.push(task);
-            numQueuedTasks.fetch_add(1);
-            numPendingTasks.fetch_add(1);
-        }
-
-        signal.notify_one();
+        numPendingTasks.fetch_add(1);
+        PushTask(task, QueueThreadIndex());
+        SignalWorkers(1);
     }
     else
     {
@@ -79,30 +333,26 @@ void WorkQueue::QueueTasks(size_t count, Task** tasks_)
 
     if (threads.size())
     {
-        {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            for (size_t i = 0; i < count; ++i)
-            {
-                assert(tasks_[i]->numDependencies.load() == 0);
-                tasks.push(tasks_[i]);
-            }
-            numQueuedTasks.fetch_add((int)count);
-            numPendingTasks.fetch_add((int)count);
-        }
+        numPendingTasks.fetch_add((int)count);
+        unsigned thread = QueueThreadIndex();
 
-        if (count >= threads.size())
-            signal.notify_all();
-        else
+        for (size_t i = 0; i < count; ++i)
         {
-            for (size_t i = 0; i < count; ++i)
-                signal.notify_one();
+            assert(tasks_[i]->numDependencies.load() == 0);
+            tasks_[i]->memoryTag = CurrentMemoryTag();
+            PushTask(tasks_[i], thread);
         }
+
+        SignalWorkers(count);
     }
     else
     {
         // If no threads, execute directly
         for (size_t i = 0; i < count; ++i)
+        {
+            tasks_[i]->memoryTag = CurrentMemoryTag();
             CompleteTask(tasks_[i], 0);
+        }
     }
 }
 
@@ -118,24 +368,32 @@ void WorkQueue::Complete()
         if (!numPendingTasks.load())
             break;
 
-        // Avoid locking the queue mutex if do not have tasks in queue, just wait for the workers to finish
-        if (!numQueuedTasks.load())
+        // If have still tasks, execute them in the main thread
+        Task* task = numQueuedTasks.load() ? FindTask(0) : nullptr;
+        if (task)
+        {
+            CompleteTask(task, 0);
             continue;
+        }
 
-        // Otherwise if have still tasks, execute them in the main thread
-        Task* task;
-
+        // Otherwise wait for the workers to finish, or for new tasks. Spin first, then park
+        auto wakeCondition = [this]
         {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            if (!tasks.size())
-                continue;
+            return !numPendingTasks.load() || numQueuedTasks.load() > 0;
+        };
 
-            task = tasks.front();
-            tasks.pop();
-            numQueuedTasks.fetch_add(-1);
-        }
+        if (SpinWait(wakeCondition))
+            continue;
 
-        CompleteTask(task, 0);
+        HiresTimer sleepTimer;
+        {
+            std::unique_lock<std::mutex> lock(queueMutex);
+            mainSleeping.store(true);
+            completeSignal.wait(lock, wakeCondition);
+            mainSleeping.store(false);
+        }
+        numWakeups.fetch_add(1);
+        sleepTime.fetch_add(sleepTimer.ElapsedUSec());
     }
 }
 
@@ -144,67 +402,444 @@ bool WorkQueue::TryComplete()
     if (!threads.size() || !numPendingTasks.load() || !numQueuedTasks.load())
         return false;
 
-    Task* task;
+    Task* task = FindTask(0);
+    if (!task)
+        return false;
 
+    CompleteTask(task, 0);
+
+    return true;
+}
+
+void WorkQueue::CompleteUntil(const std::atomic<bool>& flag)
+{
+    ZoneScoped;
+
+    unsigned thread = threadIndex;
+
+    while (!flag.load())
     {
-        std::lock_guard<std::mutex> lock(queueMutex);
-        if (!tasks.size())
-            return false;
+        Task* task = threads.size() && numQueuedTasks.load() ? FindTask(thread) : nullptr;
+        if (task)
+            CompleteTask(task, thread);
+        else
+            CPUPause();
+    }
+}
 
-        task = tasks.front();
-        tasks.pop();
-        numQueuedTasks.fetch_add(-1);
+void WorkQueue::QueueOnEndFrame(Task* task)
+{
+    std::lock_guard<std::mutex> lock(frameMutex);
+    endFrameTasks.push_back(task);
+}
+
+void WorkQueue::EndFrame()
+{
+    std::vector<Task*> tasks;
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        tasks.swap(endFrameTasks);
     }
 
-    CompleteTask(task, 0);
+    if (tasks.size())
+        QueueTasks(tasks.size(), &tasks[0]);
 
-    return true;
+    if (IsInstrumentation())
+    {
+        CollectFrameStats();
+
+        Profiler* profiler = Subsystem<Profiler>();
+        if (profiler)
+        {
+            long long totalBusyTime = 0;
+            long long totalTasks = 0;
+            long long totalSteals = 0;
+            for (size_t i = 0; i < frameStats.busyTime.size(); ++i)
+            {
+                totalBusyTime += frameStats.busyTime[i];
+                totalTasks += frameStats.numTasks[i];
+                totalSteals += frameStats.numSteals[i];
+            }
+
+            profiler->SetCounter("WorkQueueUtilization", frameStats.frameTime ? totalBusyTime * 100 / (frameStats.frameTime * NumThreads()) : 0);
+            profiler->SetCounter("WorkQueueTasks", totalTasks);
+            profiler->SetCounter("WorkQueueSteals", totalSteals);
+            profiler->SetCounter("WorkQueueMaxDepth", frameStats.maxQueueDepth);
+            profiler->SetCounter("WorkQueueAvgLatency", frameStats.averageLatency);
+            profiler->SetCounter("WorkQueueMaxLatency", frameStats.maxLatency);
+            profiler->SetCounter("WorkQueueCriticalPath", frameStats.criticalPath);
+        }
+
+        TracyPlot("WorkQueueMaxDepth", frameStats.maxQueueDepth);
+        TracyPlot("WorkQueueCriticalPath", frameStats.criticalPath);
+    }
+}
+
+void WorkQueue::CollectFrameStats()
+{
+    long long now = clock.ElapsedUSec();
+    bool enabled = IsInstrumentation();
+
+    frameStats.frameTime = enabled ? now - frameStartTime : 0;
+    frameStartTime = now;
+
+    frameStats.busyTime.resize(threadStats.size());
+    frameStats.numTasks.resize(threadStats.size());
+    frameStats.numSteals.resize(threadStats.size());
+    for (size_t i = 0; i < threadStats.size(); ++i)
+    {
+        WorkQueueThreadStats& stats = *threadStats[i];
+        frameStats.busyTime[i] = stats.busyTime.exchange(0);
+        frameStats.numTasks[i] = stats.numTasks.exchange(0);
+        frameStats.numSteals[i] = stats.numSteals.exchange(0);
+    }
+
+    long long latencies = numLatencies.exchange(0);
+    long long latencySum = totalLatency.exchange(0);
+    frameStats.averageLatency = latencies ? latencySum / latencies : 0;
+    frameStats.maxLatency = maxLatency.exchange(0);
+    frameStats.maxQueueDepth = maxQueueDepth.exchange(0);
+    frameStats.criticalPath = criticalPath.exchange(0);
+}
+
+WorkQueueStats WorkQueue::Stats() const
+{
+    WorkQueueStats ret;
+    ret.numSpinWaits = numSpinWaits.load();
+    ret.numWakeups = numWakeups.load();
+    ret.sleepTime = sleepTime.load();
+    return ret;
+}
+
+void WorkQueue::ResetStats()
+{
+    numSpinWaits.store(0);
+    numWakeups.store(0);
+    sleepTime.store(0);
+}
+
+void WorkQueue::SetInstrumentation(bool enable)
+{
+    if (enable == IsInstrumentation())
+        return;
+
+    instrumentation.store(enable);
+    // Start the first frame from now, discarding partial statistics
+    CollectFrameStats();
+}
+
+void WorkQueue::ParallelForRanges(size_t begin, size_t end, size_t grainSize, ParallelForTask::RangeFunctionPtr function, const void* functor)
+{
+    if (begin >= end)
+        return;
+
+    unsigned thread = threadIndex;
+    size_t count = end - begin;
+
+    // Aim for a few ranges per thread to allow stealing in case some thread is slower, but never go below the requested grain size
+    size_t targetRanges = NumThreads() * PARALLEL_FOR_RANGES_PER_THREAD;
+    grainSize = Max(Max(grainSize, (size_t)1), (count + targetRanges - 1) / targetRanges);
+
+    if (!threads.size() || count <= grainSize)
+    {
+        function(functor, begin, end, thread);
+        return;
+    }
+
+    size_t numRanges = (count + grainSize - 1) / grainSize;
+    std::atomic<int> numPendingRanges;
+    numPendingRanges.store((int)numRanges - 1);
+
+    // Take tasks from the calling thread's pool. Nested loops from tasks executed while waiting take the next ones
+    std::vector<AutoPtr<ParallelForTask> >& pool = parallelForTasks[thread];
+    size_t poolStart = parallelForTasksUsed[thread];
+    while (pool.size() < poolStart + numRanges - 1)
+    {
+        // The calling thread is waiting on the ranges, so execute them before other work
+        pool.push_back(new ParallelForTask());
+        pool.back()->priority = TASK_HIGH;
+    }
+    parallelForTasksUsed[thread] = poolStart + numRanges - 1;
+
+    // Queue all but the first range, which is executed directly
+    numPendingTasks.fetch_add((int)numRanges - 1);
+    for (size_t i = 1; i < numRanges; ++i)
+    {
+        ParallelForTask* task = pool[poolStart + i - 1];
+        task->function = function;
+        task->functor = functor;
+        task->start = begin + i * grainSize;
+        task->end = Min(task->start + grainSize, end);
+        task->numPendingRanges = &numPendingRanges;
+        task->memoryTag = CurrentMemoryTag();
+        PushTask(task, thread);
+    }
+
+    SignalWorkers(numRanges - 1);
+
+    function(functor, begin, begin + grainSize, thread);
+
+    // Help with queued tasks until own ranges are done
+    while (numPendingRanges.load() > 0)
+    {
+        Task* task = FindTask(thread);
+        if (task)
+            CompleteTask(task, thread);
+        else
+            CPUPause();
+    }
+
+    parallelForTasksUsed[thread] = poolStart;
 }
 
 void WorkQueue::WorkerLoop(unsigned threadIndex_)
 {
     WorkQueue::threadIndex = threadIndex_;
 
+    if (affinityMasks[threadIndex_])
+        SetCurrentThreadAffinity(affinityMasks[threadIndex_]);
+
+    auto wakeCondition = [this]
+    {
+        return numQueuedTasks.load() > 0 || shouldExit;
+    };
+
     for (;;)
     {
-        Task* task;
+        Task* task = FindTask(threadIndex_);
 
+        if (!task)
         {
-            std::unique_lock<std::mutex> lock(queueMutex);
-            signal.wait(lock, [this]
+            // Spin and yield first to reduce wakeup latency, then park on the condition variable
+            if (SpinWait(wakeCondition))
             {
-                return !tasks.empty() || shouldExit;
-            });
+                if (shouldExit)
+                    break;
+                else
+                    continue;
+            }
+
+            // Announce sleeping before checking the queued task count, so that a thread queuing tasks either sees this worker or the worker sees the new tasks
+            HiresTimer sleepTimer;
+            {
+                std::unique_lock<std::mutex> lock(queueMutex);
+                numSleepingWorkers.fetch_add(1);
+                signal.wait(lock, wakeCondition);
+                numSleepingWorkers.fetch_add(-1);
+            }
+            numWakeups.fetch_add(1);
+            sleepTime.fetch_add(sleepTimer.ElapsedUSec());
 
             if (shouldExit)
                 break;
-
-            task = tasks.front();
-            tasks.pop();
-            numQueuedTasks.fetch_add(-1);
+            else
+                continue;
         }
 
         CompleteTask(task, threadIndex_);
     }
 }
 
+unsigned WorkQueue::QueueThreadIndex()
+{
+    // The thread index defaults to zero, so tell the main thread apart from the threads that do not own a deque
+    return threadIndex || IsMainThread() ? threadIndex : NO_QUEUE_THREAD;
+}
+
+void WorkQueue::PushTask(Task* task, unsigned threadIndex_)
+{
+    task->completed.store(false, std::memory_order_relaxed);
+
+    // Increment the count first so that it never underflows when a thief takes the task immediately
+    long long depth = numQueuedTasks.fetch_add(1) + 1;
+    if (IsInstrumentation())
+    {
+        // Zero means not measured, so never store it
+        long long now = clock.ElapsedUSec();
+        task->queueTime = now ? now : 1;
+        AtomicMax(maxQueueDepth, depth);
+    }
+    numQueuedTasksByPriority[task->priority].fetch_add(1, std::memory_order_relaxed);
+
+    // The deques are single-owner, so other threads queue through the mutex
+    if (threadIndex_ == NO_QUEUE_THREAD)
+    {
+        std::lock_guard<std::mutex> lock(injectionMutex);
+        injectedTasks[task->priority].push_back(task);
+        numInjectedTasks.fetch_add(1);
+    }
+    else
+        deques[threadIndex_ * NUM_TASK_PRIORITIES + task->priority]->Push(task);
+}
+
+void WorkQueue::SignalWorkers(size_t count)
+{
+    // Skip the mutex entirely when no thread is parked; spinning and busy threads will find the tasks by stealing
+    int sleeping = numSleepingWorkers.load();
+    bool mainWaiting = mainSleeping.load();
+    if (!sleeping && !mainWaiting)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+    }
+
+    // The main thread may help with the tasks while waiting for completion
+    if (mainWaiting)
+        completeSignal.notify_one();
+    if (!sleeping)
+        return;
+
+    if (count >= (size_t)sleeping)
+        signal.notify_all();
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+            signal.notify_one();
+    }
+}
+
+Task* WorkQueue::FindTask(unsigned threadIndex_)
+{
+    const std::vector<unsigned>& victims = stealOrder[threadIndex_];
+
+    for (size_t i = 0; i < NUM_TASK_PRIORITIES; ++i)
+    {
+        if (!numQueuedTasksByPriority[i].load(std::memory_order_relaxed))
+            continue;
+
+        // Own deque first for cache locality, then steal from the other threads, siblings in the same CPU group first
+        Task* task = deques[threadIndex_ * NUM_TASK_PRIORITIES + i]->Pop();
+
+        if (!task)
+        {
+            for (auto it = victims.begin(); it != victims.end() && !task; ++it)
+                task = deques[*it * NUM_TASK_PRIORITIES + i]->Steal();
+            if (task && IsInstrumentation())
+                threadStats[threadIndex_]->numSteals.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        if (!task && numInjectedTasks.load())
+        {
+            std::lock_guard<std::mutex> lock(injectionMutex);
+            if (!injectedTasks[i].empty())
+            {
+                task = injectedTasks[i].front();
+                injectedTasks[i].pop_front();
+                numInjectedTasks.fetch_add(-1);
+            }
+        }
+
+        if (task)
+        {
+            numQueuedTasksByPriority[i].fetch_add(-1, std::memory_order_relaxed);
+            numQueuedTasks.fetch_add(-1);
+            return task;
+        }
+    }
+
+    return nullptr;
+}
+
 void WorkQueue::CompleteTask(Task* task, unsigned threadIndex_)
 {
-    task->Complete(threadIndex_);
+    // Check instrumentation once, so that enabling it during the task does not unbalance the nesting depth
+    bool instrument = IsInstrumentation();
+    long long beginTime = 0;
+    if (instrument)
+    {
+        beginTime = clock.ElapsedUSec();
+        if (task->queueTime)
+        {
+            long long latency = beginTime > task->queueTime ? beginTime - task->queueTime : 0;
+            totalLatency.fetch_add(latency, std::memory_order_relaxed);
+            numLatencies.fetch_add(1, std::memory_order_relaxed);
+            AtomicMax(maxLatency, latency);
+        }
+        ++threadStats[threadIndex_]->depth;
+    }
+    task->queueTime = 0;
+
+    {
+        MEMORY_SCOPE(task->memoryTag);
+
+        TraceRecorder* traceRecorder = Subsystem<TraceRecorder>();
+        if (traceRecorder && traceRecorder->IsEnabled())
+        {
+            long long begin = traceRecorder->Now();
+            task->Complete(threadIndex_);
+            traceRecorder->AddEvent("Task", traceRecorder->Now() - begin);
+        }
+        else
+            task->Complete(threadIndex_);
+    }
+
+    // The path start is reset for the next execution before marking completed, as the task may be queued again right after
+    long long pathEnd = 0;
+    if (instrument)
+    {
+        long long duration = clock.ElapsedUSec() - beginTime;
+        WorkQueueThreadStats& stats = *threadStats[threadIndex_];
+        if (!--stats.depth)
+            stats.busyTime.fetch_add(duration, std::memory_order_relaxed);
+        stats.numTasks.fetch_add(1, std::memory_order_relaxed);
+
+        pathEnd = task->pathStart.exchange(0, std::memory_order_relaxed) + duration;
+        AtomicMax(criticalPath, pathEnd);
+    }
+
+    // Mark completed under the lock, so that dependencies being added concurrently are either released below or refused
+    while (task->dependentsLock.test_and_set(std::memory_order_acquire))
+        CPUPause();
+    task->completed.store(true, std::memory_order_relaxed);
 
     if (task->dependentTasks.size())
     {
-        // Queue dependent tasks now if no more dependencies left
+        // Queue dependent tasks now if no more dependencies left. Push them to the completing thread's own deque to keep cache locality
+        // If no threads, execute them directly, but only after releasing the lock
+        size_t numReleased = 0;
+        std::vector<Task*> releasedTasks;
+
         for (auto it = task->dependentTasks.begin(); it != task->dependentTasks.end(); ++it)
         {
             Task* dependentTask = *it;
+            if (pathEnd)
+                AtomicMax(dependentTask->pathStart, pathEnd);
             if (dependentTask->numDependencies.fetch_add(-1) == 1)
-                QueueTask(dependentTask);
+            {
+                if (threads.size())
+                {
+                    numPendingTasks.fetch_add(1);
+                    PushTask(dependentTask, threadIndex_);
+                    ++numReleased;
+                }
+                else
+                    releasedTasks.push_back(dependentTask);
+            }
         }
 
         task->dependentTasks.clear();
+        task->dependentsLock.clear(std::memory_order_release);
+
+        if (numReleased)
+            SignalWorkers(numReleased);
+        for (auto it = releasedTasks.begin(); it != releasedTasks.end(); ++it)
+            CompleteTask(*it, threadIndex_);
     }
+    else
+        task->dependentsLock.clear(std::memory_order_release);
+
+    if (task->deleteOnComplete)
+        delete task;
+    else
+        task->Finish();
 
     // Decrement pending task counter last, so that WorkQueue::Complete() will also wait for the potentially added dependent tasks
-    numPendingTasks.fetch_add(-1);
+    if (numPendingTasks.fetch_add(-1) == 1 && mainSleeping.load())
+    {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+        }
+        completeSignal.notify_one();
+    }
 }
@@ -2,14 +2,30 @@
 
 #pragma once
 
+#include "../Object/AutoPtr.h"
+#include "../Object/MemoryTracker.h"
 #include "../Object/Object.h"
+#include "../Time/Timer.h"
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
-#include <queue>
 #include <thread>
 
+/// Thread index of threads that are neither the main thread nor a worker, which queue through the injection queue.
+static const unsigned NO_QUEUE_THREAD = 0xffffffff;
+
+/// Task execution priority. Queued tasks of a higher priority are always taken first.
+enum TaskPriority
+{
+    TASK_HIGH = 0,
+    TASK_NORMAL,
+    TASK_LOW,
+    NUM_TASK_PRIORITIES
+};
+
 /// Task for execution by worker threads.
 struct Task
 {
@@ -20,18 +36,38 @@ struct Task
 
     /// Call the work function. Thread index 0 is the main thread.
     virtual void Complete(unsigned threadIndex) = 0;
+    /// Called after completion when the work queue no longer accesses the task, so that it may be queued again or destroyed. Not called for tasks deleted on completion.
+    virtual void Finish() {}
 
     /// Add a task depended on. These need to be added for each execution. Adding dependencies is not threadsafe, so should be done before queuing.
     void AddDependency(Task* task)
     {
         task->dependentTasks.push_back(this);
         numDependencies.fetch_add(1);
+        memoryTag = CurrentMemoryTag();
     }
 
+    /// Add a task depended on while it may already be queued, running or completed. This task must not be queued yet. Return false without adding if the depended task has already completed its current execution.
+    bool TryAddDependency(Task* task);
+
     /// Dependent tasks.
     std::vector<Task*> dependentTasks;
     /// Dependency counter. Once zero, this task will be automatically queue itself.
     std::atomic<int> numDependencies;
+    /// Completed flag. Cleared when queued.
+    std::atomic<bool> completed;
+    /// Lock for modifying the dependent tasks while queued.
+    std::atomic_flag dependentsLock;
+    /// Execution priority. Default normal. Should not be changed while queued.
+    TaskPriority priority;
+    /// Delete after completion flag, for fire-and-forget tasks allocated with new. Default false.
+    bool deleteOnComplete;
+    /// Memory tag of the allocations during execution. Taken from the thread that queues the task or adds its dependencies.
+    MemoryTag memoryTag;
+    /// Time when pushed to a deque, for measuring the latency to execution. Zero if not measured. Used by scheduler instrumentation.
+    long long queueTime;
+    /// Longest chain of dependency execution times leading to this task. Used by scheduler instrumentation.
+    std::atomic<long long> pathStart;
 };
 
 /// Free function task.
@@ -79,6 +115,173 @@ template<class T> struct MemberFunctionTask : public Task
     MemberWorkFunctionPtr function;
 };
 
+/// Task that calls a std::function. Used for asynchronous work and continuations.
+struct LambdaTask : public Task
+{
+    /// Construct.
+    LambdaTask(const std::function<void(unsigned)>& function_) :
+        function(function_)
+    {
+    }
+
+    /// Call the work function. Thread index 0 is the main thread.
+    void Complete(unsigned threadIndex) override
+    {
+        function(threadIndex);
+    }
+
+    /// Work function.
+    std::function<void(unsigned)> function;
+};
+
+/// Task for executing a subrange of a parallel for loop. Pooled by the work queue.
+struct ParallelForTask : public Task
+{
+    typedef void (*RangeFunctionPtr)(const void*, size_t, size_t, unsigned);
+
+    /// Call the range function. Thread index 0 is the main thread.
+    void Complete(unsigned threadIndex) override
+    {
+        function(functor, start, end, threadIndex);
+    }
+
+    /// Signal the range done. Done only now, as the calling thread reuses the pooled task once all ranges are done.
+    void Finish() override
+    {
+        numPendingRanges->fetch_add(-1);
+    }
+
+    /// Type-erased range function.
+    RangeFunctionPtr function;
+    /// Functor object.
+    const void* functor;
+    /// Range start.
+    size_t start;
+    /// Range end.
+    size_t end;
+    /// Counter of ranges remaining in the loop, decremented when done.
+    std::atomic<int>* numPendingRanges;
+};
+
+/// Growable ring buffer for a task deque.
+struct TaskDequeBuffer
+{
+    /// Construct with capacity, which must be a power of two.
+    TaskDequeBuffer(long long capacity);
+
+    /// Return task at position.
+    Task* Get(long long index) const { return tasks[index & mask].load(std::memory_order_relaxed); }
+    /// Store task at position.
+    void Put(long long index, Task* task) { tasks[index & mask].store(task, std::memory_order_relaxed); }
+
+    /// Capacity.
+    long long capacity;
+    /// Index mask.
+    long long mask;
+    /// Task pointers.
+    AutoArrayPtr<std::atomic<Task*> > tasks;
+};
+
+/// Lock-free work-stealing task deque (Chase-Lev.) The owner thread pushes and pops at the bottom, other threads steal from the top.
+struct TaskDeque
+{
+    /// Construct.
+    TaskDeque();
+
+    /// Push a task to the bottom. To be called only from the owner thread.
+    void Push(Task* task);
+    /// Pop a task from the bottom. To be called only from the owner thread. Return null if empty.
+    Task* Pop();
+    /// Steal a task from the top. Can be called from any thread. Return null if empty or lost a race to another thread.
+    Task* Steal();
+
+    /// Top (steal) index.
+    std::atomic<long long> top;
+    /// Padding to keep the top and bottom indices on separate cache lines. Explicit padding instead of alignment, as C++11 new does not honour extended alignment.
+    char topPadding[64 - sizeof(std::atomic<long long>)];
+    /// Bottom (owner) index.
+    std::atomic<long long> bottom;
+    /// Padding to keep the bottom index and the buffer pointer on separate cache lines.
+    char bottomPadding[64 - sizeof(std::atomic<long long>)];
+    /// Current buffer.
+    std::atomic<TaskDequeBuffer*> buffer;
+    /// All buffers allocated so far. Old buffers are kept alive until destruction, as thieves may still be reading them.
+    std::vector<AutoPtr<TaskDequeBuffer> > buffers;
+};
+
+/// Grouping of CPU cores for worker thread placement and work stealing order.
+enum ThreadGrouping
+{
+    GROUP_NONE = 0,
+    GROUP_CACHE,
+    GROUP_NUMA
+};
+
+/// Work queue thread configuration.
+struct WorkQueueSettings
+{
+    /// Construct with defaults: one thread per CPU core, grouped by shared cache, not pinned.
+    WorkQueueSettings();
+
+    /// Amount of threads including the main thread. 0 to use the CPU core count.
+    unsigned numThreads;
+    /// Grouping of CPU cores. Threads prefer stealing from other threads pinned to the same group.
+    ThreadGrouping grouping;
+    /// Pin worker threads to single CPU cores, filling each group before the next. The main thread is not pinned.
+    bool pinThreads;
+    /// Explicit CPU affinity masks by thread index, including the main thread at index 0. A zero mask leaves the thread unpinned. Overrides automatic pinning.
+    std::vector<unsigned long long> affinityMasks;
+    /// Amount of busy-wait iterations with a CPU pause when a thread has nothing to do. Lower to save power, raise to reduce wakeup latency.
+    unsigned spinCount;
+    /// Amount of timeslice yields after spinning, before the thread is parked to sleep.
+    unsigned yieldCount;
+};
+
+/// Idle wait statistics of the work queue.
+struct WorkQueueStats
+{
+    /// Amount of idle waits that ended during spinning or yielding, without parking.
+    long long numSpinWaits;
+    /// Amount of wakeups after parking.
+    long long numWakeups;
+    /// Total time spent parked by all threads, in microseconds.
+    long long sleepTime;
+};
+
+/// Scheduler statistics of one thread in the current frame, updated when instrumentation is enabled.
+struct WorkQueueThreadStats
+{
+    /// Time spent executing tasks in microseconds.
+    std::atomic<long long> busyTime;
+    /// Tasks executed.
+    std::atomic<long long> numTasks;
+    /// Tasks stolen from other threads' deques.
+    std::atomic<long long> numSteals;
+    /// Nesting depth of task execution. Only the outermost task counts as busy time.
+    unsigned depth;
+};
+
+/// Scheduler statistics of one frame, collected when instrumentation is enabled.
+struct WorkQueueFrameStats
+{
+    /// Wall clock time of the frame in microseconds.
+    long long frameTime;
+    /// Time spent executing tasks by thread index, in microseconds. The idle time is the frame time minus the busy time.
+    std::vector<long long> busyTime;
+    /// Tasks executed by thread index.
+    std::vector<long long> numTasks;
+    /// Tasks stolen from other threads by thread index.
+    std::vector<long long> numSteals;
+    /// Maximum number of tasks in the deques.
+    long long maxQueueDepth;
+    /// Average time from queuing to execution start in microseconds.
+    long long averageLatency;
+    /// Maximum time from queuing to execution start in microseconds.
+    long long maxLatency;
+    /// Longest chain of dependent task execution times in microseconds. Bounds how fast the frame's task graphs could complete with unlimited threads.
+    long long criticalPath;
+};
+
 /// Worker thread subsystem for dividing tasks between CPU cores.
 class WorkQueue : public Object
 {
@@ -87,18 +290,42 @@ class WorkQueue : public Object
 public:
     /// Create with specified amount of threads including the main thread. 1 to use just the main thread. 0 to guess a suitable amount of threads from CPU core count.
     WorkQueue(unsigned numThreads);
+    /// Create with thread count and placement settings.
+    WorkQueue(const WorkQueueSettings& settings);
     /// Destruct. Stop worker threads.
     ~WorkQueue();
 
-    /// Queue a task for execution. If no threads, completes immediately in the main thread. Do not queue tasks with dependencies, they will instead queue themselves.
+    /// Queue a task for execution. If no threads, completes immediately in the calling thread. Do not queue tasks with dependencies, they will instead queue themselves. The main thread and the workers push to their own lock-free deques; other threads, such as the log writer or a user thread, go through a mutex-protected injection queue.
     void QueueTask(Task* task);
-    /// Queue several tasks execution. If no threads, completes immediately in the main thread. Do not queue tasks with dependencies, they will instead queue themselves.
+    /// Queue several tasks execution. If no threads, completes immediately in the calling thread. Do not queue tasks with dependencies, they will instead queue themselves. Can be called from any thread like QueueTask().
     void QueueTasks(size_t count, Task** tasks);
     /// Complete all currently queued tasks. To be called only from the main thread.
     void Complete();
     /// Execute a task from the queue if available, then return. To be called only from the main thread. Return true if a task was executed.
     bool TryComplete();
+    /// Execute queued tasks in the calling thread until the flag is set. Can be called from the main thread or from work functions.
+    void CompleteUntil(const std::atomic<bool>& flag);
+    /// Queue a task when EndFrame() is next called. Threadsafe.
+    void QueueOnEndFrame(Task* task);
+    /// Signal a frame boundary and queue the tasks waiting for it. To be called only from the main thread, once per frame.
+    void EndFrame();
+
+    /// Call a functor with signature (size_t start, size_t end, unsigned threadIndex) on subranges of [begin, end) in parallel, and return when all are done. The grain size is the minimum subrange size, and is increased as necessary to produce a few subranges per thread. The calling thread participates. Can be called from the main thread or from work functions.
+    template <class T> void ParallelFor(size_t begin, size_t end, size_t grainSize, const T& functor)
+    {
+        ParallelForRanges(begin, end, grainSize, &CallRangeFunctor<T>, &functor);
+    }
 
+    /// Return idle wait statistics accumulated since creation or the last reset.
+    WorkQueueStats Stats() const;
+    /// Reset idle wait statistics.
+    void ResetStats();
+    /// Enable or disable scheduler instrumentation: busy time, task counts and steals per thread, queue depth, queue-to-start latency and the critical path of task dependency chains. The results are collected per frame in EndFrame() and set as profiler counters. Default false. To be called only from the main thread.
+    void SetInstrumentation(bool enable);
+    /// Return whether scheduler instrumentation is enabled.
+    bool IsInstrumentation() const { return instrumentation.load(std::memory_order_relaxed); }
+    /// Return the scheduler statistics of the last frame ended with EndFrame(). Zero if instrumentation is disabled.
+    const WorkQueueFrameStats& FrameStats() const { return frameStats; }
     /// Return number of execution threads including the main thread.
     unsigned NumThreads() const { return (unsigned)threads.size() + 1; }
 
@@ -106,25 +333,103 @@ public:
     static unsigned ThreadIndex() { return threadIndex; }
 
 private:
+    /// Create deques and worker threads.
+    void Initialize(const WorkQueueSettings& settings);
+    /// Call a typed range functor.
+    template <class T> static void CallRangeFunctor(const void* functor, size_t start, size_t end, unsigned threadIndex)
+    {
+        (*static_cast<const T*>(functor))(start, end, threadIndex);
+    }
+
+    /// Split a range into pooled tasks, execute them and wait for completion.
+    void ParallelForRanges(size_t begin, size_t end, size_t grainSize, ParallelForTask::RangeFunctionPtr function, const void* functor);
     /// Worker thread function.
     void WorkerLoop(unsigned threadIndex);
+    /// Return the deque index of the calling thread for queuing, or NO_QUEUE_THREAD if it is neither the main thread nor a worker.
+    static unsigned QueueThreadIndex();
+    /// Push a task to a thread's deque, or to the injection queue if NO_QUEUE_THREAD, without waking up workers.
+    void PushTask(Task* task, unsigned threadIndex);
+    /// Wake up sleeping workers after tasks have been pushed.
+    void SignalWorkers(size_t count);
+    /// Take a task from the thread's own deque, or steal from the other threads. Return null if none found.
+    Task* FindTask(unsigned threadIndex);
+    /// Busy-wait and then yield until the predicate is true or the iterations run out. Return the final predicate value.
+    template <class T> bool SpinWait(const T& predicate);
     /// Complete a task by calling its work function and signal dependents.
     void CompleteTask(Task*, unsigned threadIndex);
+    /// Collect the frame's scheduler statistics, reset them for the next frame and set the profiler counters.
+    void CollectFrameStats();
 
-    /// Mutex for the work queue.
+    /// Mutex for sleeping threads.
     std::mutex queueMutex;
     /// Condition variable to wake up workers.
     std::condition_variable signal;
+    /// Condition variable to wake up the main thread waiting in Complete().
+    std::condition_variable completeSignal;
     /// Exit flag.
     volatile bool shouldExit;
-    /// Task queue.
-    std::queue<Task*> tasks;
+    /// Task deques per thread and priority, including the main thread. Indexed by thread index * NUM_TASK_PRIORITIES + priority.
+    std::vector<AutoPtr<TaskDeque> > deques;
     /// Worker threads.
     std::vector<std::thread> threads;
-    /// Amount of tasks in queue.
+    /// CPU affinity masks by thread index. Zero if not pinned.
+    std::vector<unsigned long long> affinityMasks;
+    /// Order of threads to steal from by thread index. Threads in the same CPU group come first.
+    std::vector<std::vector<unsigned> > stealOrder;
+    /// Amount of workers sleeping or about to sleep on the condition variable.
+    std::atomic<int> numSleepingWorkers;
+    /// Main thread sleeping or about to sleep in Complete() flag.
+    std::atomic<bool> mainSleeping;
+    /// Busy-wait iterations before yielding.
+    unsigned spinCount;
+    /// Yield iterations before parking.
+    unsigned yieldCount;
+    /// Idle waits ended without parking.
+    std::atomic<long long> numSpinWaits;
+    /// Wakeups after parking.
+    std::atomic<long long> numWakeups;
+    /// Time spent parked in microseconds.
+    std::atomic<long long> sleepTime;
+    /// Amount of tasks in the deques.
     std::atomic<int> numQueuedTasks;
+    /// Amount of tasks in the deques per priority. Used to skip empty priority levels when looking for tasks.
+    std::atomic<int> numQueuedTasksByPriority[NUM_TASK_PRIORITIES];
     /// Amount of queued tasks. Used to check for completion.
     std::atomic<int> numPendingTasks;
+    /// Mutex for the injection queue.
+    std::mutex injectionMutex;
+    /// Tasks queued from threads other than the main thread and the workers, per priority. These threads do not own a deque.
+    std::deque<Task*> injectedTasks[NUM_TASK_PRIORITIES];
+    /// Amount of tasks in the injection queue.
+    std::atomic<int> numInjectedTasks;
+    /// Per-thread pooled parallel for tasks.
+    std::vector<std::vector<AutoPtr<ParallelForTask> > > parallelForTasks;
+    /// Per-thread amount of pooled parallel for tasks in use. Nested loops on the same thread use the pool in stack order.
+    std::vector<size_t> parallelForTasksUsed;
+    /// Mutex for the frame boundary tasks.
+    std::mutex frameMutex;
+    /// Tasks to queue on the next frame boundary.
+    std::vector<Task*> endFrameTasks;
+    /// Scheduler instrumentation enabled flag.
+    std::atomic<bool> instrumentation;
+    /// Clock for scheduler instrumentation.
+    HiresTimer clock;
+    /// Start time of the current frame for scheduler instrumentation.
+    long long frameStartTime;
+    /// Per-thread scheduler statistics of the current frame.
+    std::vector<AutoPtr<WorkQueueThreadStats> > threadStats;
+    /// Maximum number of tasks in the deques in the current frame.
+    std::atomic<long long> maxQueueDepth;
+    /// Accumulated queue-to-start latency in the current frame.
+    std::atomic<long long> totalLatency;
+    /// Number of latency measurements in the current frame.
+    std::atomic<long long> numLatencies;
+    /// Maximum queue-to-start latency in the current frame.
+    std::atomic<long long> maxLatency;
+    /// Longest dependency chain completed in the current frame.
+    std::atomic<long long> criticalPath;
+    /// Scheduler statistics of the last frame.
+    WorkQueueFrameStats frameStats;
 
     /// Thread index for queries outside the work functions.
     static thread_local unsigned threadIndex;
@@ -1,14 +1,40 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/Log.h"
 #include "../Thread/ThreadUtils.h"
+#include "../Thread/WorkQueue.h"
 #include "Profiler.h"
+#include "TraceRecorder.h"
 
 #include <cstdio>
 #include <cstring>
+#include <tracy/Tracy.hpp>
 
 static const int LINE_MAX_LENGTH = 256;
 static const int NAME_MAX_LENGTH = 30;
 
+static const char* memoryBytesCounters[] =
+{
+    "MemoryGeneralBytes",
+    "MemoryOctreeBytes",
+    "MemoryRendererBytes",
+    "MemoryAnimationBytes",
+    "MemoryResourcesBytes",
+    "MemoryAllocatorBytes",
+    "MemoryFrameArenaBytes"
+};
+
+static const char* memoryAllocsCounters[] =
+{
+    "MemoryGeneralAllocs",
+    "MemoryOctreeAllocs",
+    "MemoryRendererAllocs",
+    "MemoryAnimationAllocs",
+    "MemoryResourcesAllocs",
+    "MemoryAllocatorAllocs",
+    "MemoryFrameArenaAllocs"
+};
+
 ProfilerBlock::ProfilerBlock(ProfilerBlock* parent_, const char* name_) :
     name(name_),
     parent(parent_),
@@ -34,33 +60,32 @@ ProfilerBlock::~ProfilerBlock()
 void ProfilerBlock::Begin()
 {
     timer.Reset();
-    ++count;
+    count.fetch_add(1, std::memory_order_relaxed);
 }
 
-void ProfilerBlock::End()
+long long ProfilerBlock::End()
 {
     long long currentTime = timer.ElapsedUSec();
-    if (currentTime > maxTime)
-        maxTime = currentTime;
-    time += currentTime;
+    long long currentMaxTime = maxTime.load(std::memory_order_relaxed);
+    while (currentTime > currentMaxTime && !maxTime.compare_exchange_weak(currentMaxTime, currentTime, std::memory_order_relaxed))
+        ;
+    time.fetch_add(currentTime, std::memory_order_relaxed);
+    return currentTime;
 }
 
 void ProfilerBlock::EndFrame()
 {
-    frameTime = time;
-    frameMaxTime = maxTime;
-    frameCount = count;
-    intervalTime += time;
-    if (maxTime > intervalMaxTime)
-        intervalMaxTime = maxTime;
-    intervalCount += count;
-    totalTime += time;
-    if (maxTime > totalMaxTime)
-        totalMaxTime = maxTime;
-    totalCount += count;
-    time = 0;
-    maxTime = 0;
-    count = 0;
+    frameTime = time.exchange(0, std::memory_order_relaxed);
+    frameMaxTime = maxTime.exchange(0, std::memory_order_relaxed);
+    frameCount = count.exchange(0, std::memory_order_relaxed);
+    intervalTime += frameTime;
+    if (frameMaxTime > intervalMaxTime)
+        intervalMaxTime = frameMaxTime;
+    intervalCount += frameCount;
+    totalTime += frameTime;
+    if (frameMaxTime > totalMaxTime)
+        totalMaxTime = frameMaxTime;
+    totalCount += frameCount;
 
     for (auto it = children.begin(); it != children.end(); ++it)
         (*it)->EndFrame();
@@ -76,7 +101,22 @@ void ProfilerBlock::BeginInterval()
         (*it)->BeginInterval();
 }
 
-ProfilerBlock* ProfilerBlock::FindOrCreateChild(const char* name_)
+void ProfilerBlock::Merge(const ProfilerBlock* block)
+{
+    time.fetch_add(block->frameTime, std::memory_order_relaxed);
+    if (block->frameMaxTime > maxTime.load(std::memory_order_relaxed))
+        maxTime.store(block->frameMaxTime, std::memory_order_relaxed);
+    count.fetch_add(block->frameCount, std::memory_order_relaxed);
+
+    for (auto it = block->children.begin(); it != block->children.end(); ++it)
+    {
+        // Skip blocks that have never been entered, so that they do not show up in the merged results as unused
+        if ((*it)->totalCount)
+            FindOrCreateChild((*it)->name)->Merge(*it);
+    }
+}
+
+ProfilerBlock* ProfilerBlock::FindChild(const char* name_) const
 {
     // First check using string pointers only, then resort to actual strcmp
     for (auto it = children.begin(); it != children.end(); ++it)
@@ -91,6 +131,15 @@ ProfilerBlock* ProfilerBlock::FindOrCreateChild(const char* name_)
             return *it;
     }
 
+    return nullptr;
+}
+
+ProfilerBlock* ProfilerBlock::FindOrCreateChild(const char* name_)
+{
+    ProfilerBlock* existing = FindChild(name_);
+    if (existing)
+        return existing;
+
     ProfilerBlock* newBlock = new ProfilerBlock(this, name_);
     children.push_back(newBlock);
 
@@ -99,10 +148,23 @@ ProfilerBlock* ProfilerBlock::FindOrCreateChild(const char* name_)
 
 Profiler::Profiler() :
     intervalFrames(0),
-    totalFrames(0)
+    totalFrames(0),
+    hitchHistoryPos(0),
+    numHitches(0),
+    hitchThreshold(0)
 {
     root = new ProfilerBlock(nullptr, "Root");
     current = root;
+    workerRoot = new ProfilerBlock(nullptr, "Workers");
+    gpuRoot = new ProfilerBlock(nullptr, "GPU");
+    for (unsigned i = 1; i < MAX_PROFILER_THREADS; ++i)
+    {
+        threads[i].root = new ProfilerBlock(nullptr, "Root");
+        threads[i].current = threads[i].root;
+    }
+    for (size_t i = 0; i < MAX_MEMORY_TAGS; ++i)
+        lastMemoryAllocations[i] = GetMemoryStats((MemoryTag)i).allocations;
+
     RegisterSubsystem(this);
 }
 
@@ -113,23 +175,63 @@ Profiler::~Profiler()
 
 void Profiler::BeginBlock(const char* name)
 {
-    // Currently profiling is a no-op if attempted from outside main thread
-    if (!IsMainThread())
-        return;
-    
-    current = current->FindOrCreateChild(name);
-    current->Begin();
+    unsigned threadIndex = WorkQueue::ThreadIndex();
+    if (!threadIndex)
+    {
+        // Threads outside the work queue are not profiled
+        if (!IsMainThread())
+            return;
+
+        current = current->FindOrCreateChild(name);
+        current->Begin();
+    }
+    else if (threadIndex < MAX_PROFILER_THREADS)
+    {
+        ProfilerThread& thread = threads[threadIndex];
+        ProfilerBlock* block = thread.current->FindChild(name);
+        if (!block)
+        {
+            std::lock_guard<std::mutex> lock(thread.mutex);
+            block = thread.current->FindOrCreateChild(name);
+        }
+
+        thread.current = block;
+        block->Begin();
+    }
 }
 
 void Profiler::EndBlock()
 {
-    if (!IsMainThread())
-        return;
-    
-    if (current != root)
+    ProfilerBlock* block = nullptr;
+
+    unsigned threadIndex = WorkQueue::ThreadIndex();
+    if (!threadIndex)
+    {
+        if (!IsMainThread())
+            return;
+
+        if (current != root)
+        {
+            block = current;
+            current = current->parent;
+        }
+    }
+    else if (threadIndex < MAX_PROFILER_THREADS)
     {
-        current->End();
-        current = current->parent;
+        ProfilerThread& thread = threads[threadIndex];
+        if (thread.current != thread.root)
+        {
+            block = thread.current;
+            thread.current = thread.current->parent;
+        }
+    }
+
+    if (block)
+    {
+        long long elapsed = block->End();
+        TraceRecorder* traceRecorder = Subsystem<TraceRecorder>();
+        if (traceRecorder)
+            traceRecorder->AddEvent(block->name, elapsed);
     }
 }
 
@@ -150,16 +252,269 @@ void Profiler::EndFrame()
         ++totalFrames;
         root->EndFrame();
         current = root;
+
+        // Collect the worker threads' frames. Blocks still running on them are counted in the next frame
+        for (unsigned i = 1; i < MAX_PROFILER_THREADS; ++i)
+        {
+            ProfilerThread& thread = threads[i];
+            std::lock_guard<std::mutex> lock(thread.mutex);
+            thread.root->EndFrame();
+            workerRoot->Merge(thread.root);
+        }
+
+        workerRoot->EndFrame();
+        gpuRoot->EndFrame();
+
+        if (IsMemoryTracking())
+            UpdateMemoryCounters();
+        if (IsHitchDetection())
+            RecordFrame();
     }
 }
 
 void Profiler::BeginInterval()
 {
     root->BeginInterval();
+    workerRoot->BeginInterval();
+    gpuRoot->BeginInterval();
+    for (unsigned i = 1; i < MAX_PROFILER_THREADS; ++i)
+    {
+        std::lock_guard<std::mutex> lock(threads[i].mutex);
+        threads[i].root->BeginInterval();
+    }
     intervalFrames = 0;
+
+    for (auto it = counters.begin(); it != counters.end(); ++it)
+        it->intervalMax = it->value;
+}
+
+void Profiler::UpdateMemoryCounters()
+{
+    long long frameAllocations = 0;
+
+    for (size_t i = 0; i < MAX_MEMORY_TAGS; ++i)
+    {
+        MemoryStats stats = GetMemoryStats((MemoryTag)i);
+        long long allocations = stats.allocations - lastMemoryAllocations[i];
+        lastMemoryAllocations[i] = stats.allocations;
+        frameAllocations += allocations;
+
+        SetCounter(memoryBytesCounters[i], stats.bytes);
+        SetCounter(memoryAllocsCounters[i], allocations);
+    }
+
+    SetCounter("FrameAllocations", frameAllocations);
+    TracyPlot("FrameAllocations", frameAllocations);
+}
+
+void Profiler::SetHitchDetection(float thresholdMs, size_t historyFrames)
+{
+    if (thresholdMs <= 0.0f)
+    {
+        hitchThreshold.store(0, std::memory_order_relaxed);
+        hitchHistory.clear();
+        std::lock_guard<std::mutex> lock(eventMutex);
+        events.clear();
+        return;
+    }
+
+    hitchThreshold.store((long long)(thresholdMs * 1000.0f), std::memory_order_relaxed);
+    hitchHistory.resize(Max(historyFrames, (size_t)1));
+    for (auto it = hitchHistory.begin(); it != hitchHistory.end(); ++it)
+    {
+        it->frameNumber = 0;
+        it->frameTime = 0;
+        it->blocks.clear();
+        it->counters.clear();
+        it->events.clear();
+    }
+    hitchHistoryPos = 0;
+}
+
+void Profiler::AddEvent(const char* type, const std::string& name)
+{
+    if (!IsHitchDetection())
+        return;
+
+    std::lock_guard<std::mutex> lock(eventMutex);
+    events.push_back(std::string(type) + ": " + name);
+}
+
+/// Append a block and its children that were entered during the last frame.
+static void RecordBlocks(std::vector<ProfilerFrameBlock>& dest, const ProfilerBlock* block, size_t depth)
+{
+    ProfilerFrameBlock entry;
+    entry.name = block->name;
+    entry.depth = depth;
+    entry.time = block->frameTime;
+    entry.maxTime = block->frameMaxTime;
+    entry.count = block->frameCount;
+    dest.push_back(entry);
+
+    for (auto it = block->children.begin(); it != block->children.end(); ++it)
+    {
+        if ((*it)->frameCount)
+            RecordBlocks(dest, *it, depth + 1);
+    }
 }
 
-std::string Profiler::OutputResults(bool showUnused, bool showTotal, size_t maxDepth) const
+void Profiler::RecordFrame()
+{
+    ProfilerFrame& frame = hitchHistory[hitchHistoryPos];
+    hitchHistoryPos = (hitchHistoryPos + 1) % hitchHistory.size();
+
+    frame.frameNumber = totalFrames;
+    frame.frameTime = 0;
+    for (auto it = root->children.begin(); it != root->children.end(); ++it)
+        frame.frameTime += (*it)->frameTime;
+
+    // Reuse the vectors of the oldest frame to not allocate each frame
+    frame.blocks.clear();
+    RecordBlocks(frame.blocks, root, 0);
+    if (workerRoot->children.size())
+        RecordBlocks(frame.blocks, workerRoot, 0);
+    if (gpuRoot->children.size())
+        RecordBlocks(frame.blocks, gpuRoot, 0);
+
+    frame.counters.clear();
+    for (auto it = counters.begin(); it != counters.end(); ++it)
+        frame.counters.push_back(std::make_pair(it->name, it->value));
+
+    frame.events.clear();
+    {
+        std::lock_guard<std::mutex> lock(eventMutex);
+        frame.events.swap(events);
+    }
+
+    if (frame.frameTime > hitchThreshold.load(std::memory_order_relaxed))
+    {
+        ++numHitches;
+        LOGWARNING(OutputHitch(frame));
+    }
+}
+
+std::string Profiler::OutputHitch(const ProfilerFrame& frame) const
+{
+    char line[LINE_MAX_LENGTH];
+    char indentedName[LINE_MAX_LENGTH];
+
+    sprintf(line, "Hitch in frame %u: %.3f ms, threshold %.3f ms\n", (unsigned)frame.frameNumber, frame.frameTime / 1000.0f, HitchThreshold());
+    std::string output(line);
+
+    if (frame.events.size())
+    {
+        output += std::string("\nEvents\n\n");
+        for (auto it = frame.events.begin(); it != frame.events.end(); ++it)
+            output += " " + *it + "\n";
+    }
+
+    for (auto it = frame.blocks.begin(); it != frame.blocks.end(); ++it)
+    {
+        // The tree roots do not collect any data, so print them as headers
+        if (!it->depth)
+        {
+            sprintf(line, "\n%-30s   Cnt     Avg      Max     Total\n\n", it == frame.blocks.begin() ? "Main thread" : it->name);
+            output += std::string(line);
+            continue;
+        }
+
+        memset(indentedName, ' ', NAME_MAX_LENGTH);
+        indentedName[it->depth - 1] = 0;
+        strcat(indentedName, it->name);
+        indentedName[strlen(indentedName)] = ' ';
+        indentedName[NAME_MAX_LENGTH] = 0;
+
+        float avg = (it->count ? it->time / it->count : 0.0f) / 1000.0f;
+        sprintf(line, "%s %5d %8.3f %8.3f %9.3f\n", indentedName, Min(it->count, 99999), avg, it->maxTime / 1000.0f, it->time / 1000.0f);
+        output += std::string(line);
+    }
+
+    if (frame.counters.size())
+    {
+        output += std::string("\nCounter                               Value\n\n");
+        for (auto it = frame.counters.begin(); it != frame.counters.end(); ++it)
+        {
+            sprintf(line, "%-30s %11lld\n", it->first, it->second);
+            output += std::string(line);
+        }
+    }
+
+    // Previous frames from oldest to newest, excluding the hitch frame which is the newest
+    bool previousHeader = false;
+    for (size_t i = 0; i < hitchHistory.size() - 1; ++i)
+    {
+        const ProfilerFrame& previous = hitchHistory[(hitchHistoryPos + i) % hitchHistory.size()];
+        if (!previous.frameNumber)
+            continue;
+
+        if (!previousHeader)
+        {
+            output += std::string("\nPrevious frames\n\n");
+            previousHeader = true;
+        }
+
+        sprintf(line, "%10u %9.3f ms\n", (unsigned)previous.frameNumber, previous.frameTime / 1000.0f);
+        output += std::string(line);
+        for (auto it = previous.events.begin(); it != previous.events.end(); ++it)
+            output += "            " + *it + "\n";
+    }
+
+    return output;
+}
+
+void Profiler::SetCounter(const char* name, long long value)
+{
+    if (!IsMainThread())
+        return;
+
+    ProfilerCounter* counter = nullptr;
+    for (auto it = counters.begin(); it != counters.end(); ++it)
+    {
+        if (it->name == name || !strcmp(it->name, name))
+        {
+            counter = &(*it);
+            break;
+        }
+    }
+
+    if (!counter)
+    {
+        ProfilerCounter newCounter;
+        newCounter.name = name;
+        newCounter.intervalMax = value;
+        newCounter.totalMax = value;
+        counters.push_back(newCounter);
+        counter = &counters.back();
+    }
+
+    counter->value = value;
+    if (value > counter->intervalMax)
+        counter->intervalMax = value;
+    if (value > counter->totalMax)
+        counter->totalMax = value;
+}
+
+void Profiler::AddGpuTime(const char* name, size_t depth, long long time)
+{
+    if (!IsMainThread())
+        return;
+
+    // The parent is the latest block added at the previous depth
+    if (depth > gpuBlocks.size())
+        depth = gpuBlocks.size();
+    ProfilerBlock* parent = depth ? gpuBlocks[depth - 1] : gpuRoot.Get();
+
+    ProfilerBlock* block = parent->FindOrCreateChild(name);
+    block->count.fetch_add(1, std::memory_order_relaxed);
+    block->time.fetch_add(time, std::memory_order_relaxed);
+    if (time > block->maxTime.load(std::memory_order_relaxed))
+        block->maxTime.store(time, std::memory_order_relaxed);
+
+    gpuBlocks.resize(depth + 1);
+    gpuBlocks[depth] = block;
+}
+
+std::string Profiler::OutputResults(bool showUnused, bool showTotal, size_t maxDepth, bool showThreads) const
 {
     std::string output;
 
@@ -176,6 +531,47 @@ std::string Profiler::OutputResults(bool showUnused, bool showTotal, size_t maxD
 
     OutputResults(root, output, 0, maxDepth, showUnused, showTotal);
 
+    if (workerRoot->children.size())
+    {
+        output += std::string("\nWorker threads\n\n");
+        OutputResults(workerRoot, output, 0, maxDepth, showUnused, showTotal);
+
+        if (showThreads)
+        {
+            char line[LINE_MAX_LENGTH];
+
+            for (unsigned i = 1; i < MAX_PROFILER_THREADS; ++i)
+            {
+                const ProfilerThread& thread = threads[i];
+                std::lock_guard<std::mutex> lock(thread.mutex);
+                if (thread.root->children.empty())
+                    continue;
+
+                sprintf(line, "\nWorker thread %u\n\n", i);
+                output += std::string(line);
+                OutputResults(thread.root, output, 0, maxDepth, showUnused, showTotal);
+            }
+        }
+    }
+
+    if (gpuRoot->children.size())
+    {
+        output += std::string("\nGPU\n\n");
+        OutputResults(gpuRoot, output, 0, maxDepth, showUnused, showTotal);
+    }
+
+    if (counters.size())
+    {
+        char line[LINE_MAX_LENGTH];
+        output += std::string("\nCounter                               Last        Max\n\n");
+
+        for (auto it = counters.begin(); it != counters.end(); ++it)
+        {
+            sprintf(line, "%-30s %11lld %10lld\n", it->name, it->value, showTotal ? it->totalMax : it->intervalMax);
+            output += std::string(line);
+        }
+    }
+
     return output;
 }
 
@@ -191,8 +587,8 @@ void Profiler::OutputResults(ProfilerBlock* block, std::string& output, size_t d
     if (depth >= maxDepth)
         return;
 
-    // Do not print the root block as it does not collect any actual data
-    if (block != root)
+    // Do not print the root blocks as they do not collect any actual data
+    if (block->parent)
     {
         if (showUnused || block->intervalCount || (showTotal && block->totalCount))
         {
@@ -3,14 +3,21 @@
 #pragma once
 
 #include "../Math/Math.h"
+#include "../Object/MemoryTracker.h"
 #include "../Object/Object.h"
 #include "Timer.h"
 
+#include <atomic>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #define USE_PROFILER
 
-/// Profiling data for one block in the profiling tree.
+/// Number of work queue threads that record into their own profiling tree, including the main thread. Threads beyond are not profiled.
+static const unsigned MAX_PROFILER_THREADS = 32;
+
+/// Profiling data for one block in the profiling tree. The current frame's values are atomic so that the main thread can collect them while a worker thread records.
 class ProfilerBlock
 {
 public:
@@ -21,12 +28,16 @@ public:
 
     /// Start time measurement and increment call count.
     void Begin();
-    /// End time measurement.
-    void End();
+    /// End time measurement. Return the elapsed microseconds.
+    long long End();
     /// Process stats at the end of frame.
     void EndFrame();
     /// Begin an interval lasting several frames.
     void BeginInterval();
+    /// Add another block's previous frame stats to the current frame, then recurse to children, creating as necessary.
+    void Merge(const ProfilerBlock* block);
+    /// Return a child block, or null if not found.
+    ProfilerBlock* FindChild(const char* name) const;
     /// Return a child block; create if necessary.
     ProfilerBlock* FindOrCreateChild(const char* name);
 
@@ -39,11 +50,11 @@ public:
     /// Child blocks.
     std::vector<AutoPtr<ProfilerBlock > > children;
     /// Current frame's accumulated time.
-    long long time;
+    std::atomic<long long> time;
     /// Current frame's longest call.
-    long long maxTime;
+    std::atomic<long long> maxTime;
     /// Current frame's call count.
-    int count;
+    std::atomic<int> count;
     /// Previous frame's accumulated time.
     long long frameTime;
     /// Previous frame's longest call.
@@ -64,7 +75,61 @@ public:
     long long totalCount;
 };
 
-/// Hierarchical performance profiler subsystem.
+/// Value counter for non-timing statistics, such as memory use.
+struct ProfilerCounter
+{
+    /// Counter name.
+    const char* name;
+    /// Last value.
+    long long value;
+    /// Current interval's maximum value.
+    long long intervalMax;
+    /// Maximum value since start.
+    long long totalMax;
+};
+
+/// Stats of one profiling block in a recorded frame.
+struct ProfilerFrameBlock
+{
+    /// Block name.
+    const char* name;
+    /// Depth in the tree. The roots of the main thread, worker thread and GPU trees are at depth zero.
+    size_t depth;
+    /// Accumulated time.
+    long long time;
+    /// Longest call.
+    long long maxTime;
+    /// Call count.
+    int count;
+};
+
+/// Profiling data of one frame, recorded for hitch detection.
+struct ProfilerFrame
+{
+    /// Frame number since start.
+    size_t frameNumber;
+    /// Frame time in microseconds.
+    long long frameTime;
+    /// Blocks entered during the frame in depth-first order.
+    std::vector<ProfilerFrameBlock> blocks;
+    /// Counter values at the end of the frame.
+    std::vector<std::pair<const char*, long long> > counters;
+    /// Events during the frame.
+    std::vector<std::string> events;
+};
+
+/// Profiling tree of one thread.
+struct ProfilerThread
+{
+    /// Root block.
+    AutoPtr<ProfilerBlock> root;
+    /// Current block.
+    ProfilerBlock* current;
+    /// Lock for adding child blocks, so that the tree can be traversed from the main thread.
+    mutable std::mutex mutex;
+};
+
+/// Hierarchical performance profiler subsystem. Work queue threads record into their own trees without locking, except when a block is entered for the first time. The worker trees are collected and merged into an aggregate tree at the end of each frame.
 class Profiler : public Object
 {
     OBJECT(Profiler);
@@ -75,9 +140,9 @@ public:
     /// Destruct.
     ~Profiler();
 
-    /// Begin a profiling block. The name must be persistent; string literals are recommended.
+    /// Begin a profiling block. The name must be persistent; string literals are recommended. Can be called from the main thread or work queue threads.
     void BeginBlock(const char* name);
-    /// End the current profiling block.
+    /// End the current profiling block. Can be called from the main thread or work queue threads.
     void EndBlock();
     /// Begin the next profiling frame.
     void BeginFrame();
@@ -85,26 +150,80 @@ public:
     void EndFrame();
     /// Begin a profiler interval.
     void BeginInterval();
+    /// Set the value of a counter. The name must be persistent; string literals are recommended.
+    void SetCounter(const char* name, long long value);
+    /// Set the frame time in milliseconds that counts as a hitch, and the number of frames to keep in history. A frame exceeding the threshold has its block tree, counters and events written to the log, along with the times and events of the previous frames. Zero threshold (default) disables.
+    void SetHitchDetection(float thresholdMs, size_t historyFrames = 8);
+    /// Record an event, such as a shader compile or a resource load, to report if the current frame turns out to be a hitch. No-op when hitch detection is disabled. Can be called from any thread.
+    void AddEvent(const char* type, const std::string& name);
+    /// Add a GPU time measurement in microseconds to the GPU block tree. Blocks are added in begin order, with the depth telling the nesting. The name must be persistent. Called by Graphics when GPU timer results become available.
+    void AddGpuTime(const char* name, size_t depth, long long time);
 
-    /// Output results into a string.
-    std::string OutputResults(bool showUnused = false, bool showTotal = false, size_t maxDepth = M_MAX_UNSIGNED) const;
+    /// Output results into a string. The main thread is followed by the aggregate of worker threads, optionally each worker thread separately, and the GPU timer results if any.
+    std::string OutputResults(bool showUnused = false, bool showTotal = false, size_t maxDepth = M_MAX_UNSIGNED, bool showThreads = false) const;
     /// Return the current profiling block.
     const ProfilerBlock* CurrentBlock() const { return current; }
     /// Return the root profiling block.
     const ProfilerBlock* RootBlock() const { return root; }
+    /// Return the root block of the GPU timer results.
+    const ProfilerBlock* GpuRootBlock() const { return gpuRoot; }
+    /// Return the root block of the worker threads' merged results.
+    const ProfilerBlock* WorkerRootBlock() const { return workerRoot; }
+    /// Return the root block of a worker thread by work queue thread index. Must not be traversed while the thread records, except from the main thread between frames.
+    const ProfilerBlock* ThreadRootBlock(unsigned index) const { return (index && index < MAX_PROFILER_THREADS) ? threads[index].root.Get() : nullptr; }
+    /// Return the counters.
+    const std::vector<ProfilerCounter>& Counters() const { return counters; }
+    /// Return whether hitch detection is enabled.
+    bool IsHitchDetection() const { return hitchThreshold.load(std::memory_order_relaxed) > 0; }
+    /// Return the hitch threshold in milliseconds.
+    float HitchThreshold() const { return hitchThreshold.load(std::memory_order_relaxed) / 1000.0f; }
+    /// Return the number of hitches detected.
+    size_t NumHitches() const { return numHitches; }
+    /// Return the recorded frames as a ring buffer. Empty when hitch detection is disabled.
+    const std::vector<ProfilerFrame>& HitchHistory() const { return hitchHistory; }
 
 private:
     /// Output results recursively.
     void OutputResults(ProfilerBlock* block, std::string& output, size_t depth, size_t maxDepth, bool showUnused, bool showTotal) const;
+    /// Set the heap usage counters of each memory tag, and the allocation counts since the last frame.
+    void UpdateMemoryCounters();
+    /// Record the frame that just ended into the hitch history, and write it to the log if it exceeds the threshold.
+    void RecordFrame();
+    /// Output a recorded hitch frame and the previous frames into a string.
+    std::string OutputHitch(const ProfilerFrame& frame) const;
 
     /// Current profiling block.
     ProfilerBlock* current;
     /// Root profiling block.
     AutoPtr<ProfilerBlock> root;
+    /// Root block of the merged worker thread results.
+    AutoPtr<ProfilerBlock> workerRoot;
+    /// Root block of the GPU timer results.
+    AutoPtr<ProfilerBlock> gpuRoot;
+    /// Current GPU blocks by depth while adding GPU times.
+    std::vector<ProfilerBlock*> gpuBlocks;
+    /// Profiling trees of work queue threads. The main thread uses the root and current block instead.
+    ProfilerThread threads[MAX_PROFILER_THREADS];
+    /// Value counters.
+    std::vector<ProfilerCounter> counters;
     /// Frames in the current interval.
     size_t intervalFrames;
     /// Total frames since start.
     size_t totalFrames;
+    /// Allocation counts of the memory tags at the end of the last frame.
+    long long lastMemoryAllocations[MAX_MEMORY_TAGS];
+    /// Recorded frames for hitch detection.
+    std::vector<ProfilerFrame> hitchHistory;
+    /// Position of the next frame to record in the hitch history.
+    size_t hitchHistoryPos;
+    /// Number of hitches detected.
+    size_t numHitches;
+    /// Hitch threshold in microseconds, or zero if disabled.
+    std::atomic<long long> hitchThreshold;
+    /// Events of the current frame.
+    std::vector<std::string> events;
+    /// Lock for adding events.
+    std::mutex eventMutex;
 };
 
 /// Helper class for automatically beginning and ending a profiling block
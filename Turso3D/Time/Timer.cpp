@@ -67,6 +67,15 @@ void Timer::Reset()
     #endif
 }
 
+void Timer::Sleep(unsigned msec)
+{
+    #ifdef _WIN32
+    ::Sleep(msec);
+    #else
+    usleep(msec * 1000);
+    #endif
+}
+
 HiresTimer::HiresTimer()
 {
     Reset();
@@ -14,6 +14,9 @@ public:
     /// Reset the timer.
     void Reset();
 
+    /// Suspend the calling thread for milliseconds.
+    static void Sleep(unsigned msec);
+
 private:
     /// Starting clock value in milliseconds.
     unsigned startTime;
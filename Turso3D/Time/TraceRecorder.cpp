@@ -0,0 +1,156 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/JSONWriter.h"
+#include "../IO/Stream.h"
+#include "../Math/Math.h"
+#include "../Thread/ThreadUtils.h"
+#include "../Thread/WorkQueue.h"
+#include "TraceRecorder.h"
+
+#include <cstdio>
+
+/// Thread id of the GPU track in the written trace.
+static const unsigned GPU_TRACE_THREAD = 1000;
+
+TraceRecorder::TraceRecorder() :
+    enabled(false)
+{
+    for (unsigned i = 0; i <= MAX_TRACE_THREADS; ++i)
+        buffers[i].numWritten.store(0, std::memory_order_relaxed);
+
+    RegisterSubsystem(this);
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    RemoveSubsystem(this);
+}
+
+void TraceRecorder::SetEnabled(bool enable, size_t eventsPerThread)
+{
+    if (enable == IsEnabled())
+        return;
+
+    if (enable)
+    {
+        eventsPerThread = Max(eventsPerThread, (size_t)1);
+        for (unsigned i = 0; i <= MAX_TRACE_THREADS; ++i)
+        {
+            buffers[i].events.resize(eventsPerThread);
+            buffers[i].numWritten.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    enabled.store(enable, std::memory_order_release);
+}
+
+void TraceRecorder::AddEvent(const char* name, long long duration)
+{
+    if (!IsEnabled())
+        return;
+
+    unsigned threadIndex = WorkQueue::ThreadIndex();
+    // Threads outside the work queue are not recorded
+    if ((!threadIndex && !IsMainThread()) || threadIndex >= MAX_TRACE_THREADS)
+        return;
+
+    long long end = Now();
+    Write(buffers[threadIndex], name, end - duration, duration);
+}
+
+void TraceRecorder::AddGpuEvent(const char* name, long long begin, long long end)
+{
+    if (!IsEnabled())
+        return;
+
+    Write(buffers[MAX_TRACE_THREADS], name, begin, end > begin ? end - begin : 0);
+}
+
+void TraceRecorder::Write(TraceBuffer& buffer, const char* name, long long begin, long long duration)
+{
+    // Only the owning thread writes, so the count can be updated without a read-modify-write
+    size_t index = buffer.numWritten.load(std::memory_order_relaxed);
+    TraceEvent& event = buffer.events[index % buffer.events.size()];
+    event.name = name;
+    event.begin = begin;
+    event.duration = duration;
+    buffer.numWritten.store(index + 1, std::memory_order_release);
+}
+
+bool TraceRecorder::SaveChromeTrace(Stream& dest) const
+{
+    char threadName[64];
+
+    JSONWriter writer(dest, 0);
+    writer.BeginObject();
+    writer.Key("displayTimeUnit");
+    writer.Value("ms");
+    writer.Key("traceEvents");
+    writer.BeginArray();
+
+    for (unsigned i = 0; i <= MAX_TRACE_THREADS; ++i)
+    {
+        const TraceBuffer& buffer = buffers[i];
+        size_t numWritten = buffer.numWritten.load(std::memory_order_acquire);
+        if (!numWritten || buffer.events.empty())
+            continue;
+
+        unsigned tid = i < MAX_TRACE_THREADS ? i : GPU_TRACE_THREAD;
+        if (i == MAX_TRACE_THREADS)
+            sprintf(threadName, "GPU");
+        else if (!i)
+            sprintf(threadName, "Main thread");
+        else
+            sprintf(threadName, "Worker thread %u", i);
+
+        writer.BeginObject();
+        writer.Key("name");
+        writer.Value("thread_name");
+        writer.Key("ph");
+        writer.Value("M");
+        writer.Key("pid");
+        writer.Value(1);
+        writer.Key("tid");
+        writer.Value(tid);
+        writer.Key("args");
+        writer.BeginObject();
+        writer.Key("name");
+        writer.Value(threadName);
+        writer.EndObject();
+        writer.EndObject();
+
+        // Write from the oldest event still in the ring buffer
+        size_t size = buffer.events.size();
+        size_t first = numWritten > size ? numWritten - size : 0;
+        for (size_t j = first; j < numWritten; ++j)
+        {
+            const TraceEvent& event = buffer.events[j % size];
+            writer.BeginObject();
+            writer.Key("name");
+            writer.Value(event.name);
+            writer.Key("ph");
+            writer.Value("X");
+            writer.Key("pid");
+            writer.Value(1);
+            writer.Key("tid");
+            writer.Value(tid);
+            writer.Key("ts");
+            writer.Value((double)event.begin);
+            writer.Key("dur");
+            writer.Value((double)event.duration);
+            writer.EndObject();
+        }
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+    return writer.Flush();
+}
+
+size_t TraceRecorder::NumEvents() const
+{
+    size_t count = 0;
+    for (unsigned i = 0; i <= MAX_TRACE_THREADS; ++i)
+        count += Min(buffers[i].numWritten.load(std::memory_order_relaxed), buffers[i].events.size());
+    return count;
+}
@@ -0,0 +1,77 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/Object.h"
+#include "Timer.h"
+
+#include <atomic>
+#include <vector>
+
+class Stream;
+
+/// Number of work queue threads that record trace events, including the main thread. Threads beyond are not recorded.
+static const unsigned MAX_TRACE_THREADS = 32;
+/// Default number of events kept per thread.
+static const size_t DEFAULT_TRACE_EVENTS = 65536;
+
+/// Recorded trace event.
+struct TraceEvent
+{
+    /// Event name. Must be persistent.
+    const char* name;
+    /// Begin time in microseconds since the recorder was created.
+    long long begin;
+    /// Duration in microseconds.
+    long long duration;
+};
+
+/// Ring buffer of trace events written by one thread, padded to not share cache lines with other threads.
+struct TraceBuffer
+{
+    /// Events.
+    std::vector<TraceEvent> events;
+    /// Number of events written since enabling. The oldest are overwritten when it exceeds the buffer size.
+    std::atomic<size_t> numWritten;
+    /// Padding to a cache line, so that the write counts of adjacent buffers are a cache line apart. Explicit padding instead of alignment, as C++11 new does not honour extended alignment.
+    char padding[64 - sizeof(std::vector<TraceEvent>) - sizeof(std::atomic<size_t>)];
+};
+
+/// Trace recorder subsystem. Records the profiling blocks, work queue tasks and GPU timers into per-thread ring buffers without locking, and writes them on demand in the Chrome trace event format, viewable in chrome://tracing and the Perfetto UI. Disabled by default; can be toggled at runtime in any build.
+class TraceRecorder : public Object
+{
+    OBJECT(TraceRecorder);
+
+public:
+    /// Construct.
+    TraceRecorder();
+    /// Destruct.
+    ~TraceRecorder();
+
+    /// Enable or disable recording. Enabling clears previous events and sizes the ring buffers to the given number of events per thread. Should be called from the main thread between frames.
+    void SetEnabled(bool enable, size_t eventsPerThread = DEFAULT_TRACE_EVENTS);
+    /// Record an event ending now with the given duration in microseconds. The name must be persistent. Can be called from the main thread or work queue threads.
+    void AddEvent(const char* name, long long duration);
+    /// Record a GPU event with begin and end times in the recorder's microseconds. The name must be persistent. Called by Graphics from the main thread.
+    void AddGpuEvent(const char* name, long long begin, long long end);
+    /// Write the recorded events as Chrome trace event JSON. Recording should be disabled, or no work queue tasks running, while saving. Return true on success.
+    bool SaveChromeTrace(Stream& dest) const;
+
+    /// Return whether recording is enabled.
+    bool IsEnabled() const { return enabled.load(std::memory_order_acquire); }
+    /// Return the current time in microseconds since the recorder was created.
+    long long Now() const { return timer.ElapsedUSec(); }
+    /// Return the number of events held in the ring buffers.
+    size_t NumEvents() const;
+
+private:
+    /// Write an event to a ring buffer.
+    void Write(TraceBuffer& buffer, const char* name, long long begin, long long duration);
+
+    /// Timer for the event timestamps.
+    mutable HiresTimer timer;
+    /// Ring buffers of the work queue threads, followed by the GPU.
+    TraceBuffer buffers[MAX_TRACE_THREADS + 1];
+    /// Enabled flag.
+    std::atomic<bool> enabled;
+};
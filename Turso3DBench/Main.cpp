@@ -0,0 +1,1338 @@
+#include "Graphics/FrameBuffer.h"
+#include "Graphics/Graphics.h"
+#include "Graphics/Texture.h"
+#include "Input/Input.h"
+#include "IO/Arguments.h"
+#include "IO/File.h"
+#include "IO/FileSystem.h"
+#include "IO/JSONWriter.h"
+#include "IO/Log.h"
+#include "IO/StringUtils.h"
+#include "Math/Math.h"
+#include "Math/Random.h"
+#include "Object/EventQueue.h"
+#include "Renderer/AmbientOcclusion.h"
+#include "Renderer/AnimatedModel.h"
+#include "Renderer/Animation.h"
+#include "Renderer/AnimationState.h"
+#include "Renderer/Camera.h"
+#include "Renderer/Crowd.h"
+#include "Renderer/DebugRenderer.h"
+#include "Renderer/Decal.h"
+#include "Renderer/FrameGraph.h"
+#include "Renderer/Light.h"
+#include "Renderer/Material.h"
+#include "Renderer/Model.h"
+#include "Renderer/Octree.h"
+#include "Renderer/ParticleEmitter.h"
+#include "Renderer/RenderJobQueue.h"
+#include "Renderer/Renderer.h"
+#include "Renderer/SecondaryView.h"
+#include "Renderer/StaticModel.h"
+#include "Renderer/Terrain.h"
+#include "Renderer/VertexAnimation.h"
+#include "Renderer/VirtualTexture.h"
+#include "Resource/Image.h"
+#include "Resource/ResourceCache.h"
+#include "Scene/Scene.h"
+#include "Time/Profiler.h"
+#include "Time/Timer.h"
+#include "Time/TraceRecorder.h"
+#include "Thread/WorkQueue.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+/// Benchmark scene description.
+struct BenchScene
+{
+    /// Name in the results.
+    const char* name;
+    /// Camera orbit radius.
+    float radius;
+    /// Camera height.
+    float height;
+    /// Camera orbit speed in degrees per second.
+    float speed;
+};
+
+/// Scenes in the order of their presets: the renderer test presets followed by the stress scenes.
+static const BenchScene scenes[] =
+{
+    { "Mushrooms", 150.0f, 20.0f, 6.0f },
+    { "RotatingBoxes", 50.0f, 15.0f, 12.0f },
+    { "AnimatedModels", 40.0f, 12.0f, 12.0f },
+    { "Statics100k", 120.0f, 25.0f, 6.0f },
+    { "Lights2k", 150.0f, 20.0f, 6.0f },
+    { "Skinned2k", 60.0f, 15.0f, 12.0f }
+};
+
+static const int NUM_SCENES = sizeof(scenes) / sizeof(scenes[0]);
+
+/// Deepest profiler block level recorded.
+static const size_t MAX_BLOCK_DEPTH = 3;
+
+std::vector<StaticModel*> rotatingObjects;
+std::vector<AnimatedModel*> animatingObjects;
+Quaternion objectRotation = Quaternion::IDENTITY;
+std::vector<ParticleEmitter*> particleEmitters;
+std::vector<Crowd*> crowds;
+WeakPtr<VertexAnimation> crowdAnimation;
+Terrain* terrain = nullptr;
+bool useTerrain = false;
+SharedPtr<Material> virtualTerrainMaterial;
+bool useBakedLights = false;
+int numTints = 0;
+
+/// Per-frame time samples in milliseconds, keyed by profiler block path.
+typedef std::map<std::string, std::vector<float> > SampleMap;
+
+void CreateFloor(Scene* scene, int extent)
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    std::vector<Vector3> positions;
+    for (int y = -extent; y <= extent; ++y)
+    {
+        for (int x = -extent; x <= extent; ++x)
+            positions.push_back(Vector3(10.5f * x, -0.05f, 10.5f * y));
+    }
+
+    std::vector<StaticModel*> objects;
+    StaticModel::CreateInstances(scene, positions, std::vector<Quaternion>(), std::vector<Vector3>(1, Vector3(10.0f, 0.1f, 10.0f)),
+        cache->LoadResource<Model>("Box.mdl"), cache->LoadResource<Material>("Stone.json"), &objects);
+    for (auto it = objects.begin(); it != objects.end(); ++it)
+        (*it)->SetStatic(true);
+}
+
+/// Divide the scene around the origin into a grid of rooms with a doorway portal in the middle of each shared wall. The outer walls have no openings.
+void CreatePortalCells(PortalCells* cells, const BenchScene& scene)
+{
+    const int gridSize = 16;
+    float cellSize = scene.radius * 0.5f;
+    float doorHalfWidth = cellSize * 0.125f;
+    float doorHeight = scene.height;
+    float start = -0.5f * gridSize * cellSize;
+
+    cells->Clear();
+    for (int y = 0; y < gridSize; ++y)
+    {
+        for (int x = 0; x < gridSize; ++x)
+        {
+            Vector3 cellMin(start + x * cellSize, -scene.height, start + y * cellSize);
+            cells->AddCell(BoundingBox(cellMin, cellMin + Vector3(cellSize, 3.0f * scene.height, cellSize)));
+        }
+    }
+
+    for (int y = 0; y < gridSize; ++y)
+    {
+        for (int x = 0; x < gridSize; ++x)
+        {
+            unsigned cell = y * gridSize + x;
+            float wallX = start + (x + 1) * cellSize;
+            float wallZ = start + (y + 1) * cellSize;
+            float centerX = wallX - 0.5f * cellSize;
+            float centerZ = wallZ - 0.5f * cellSize;
+
+            if (x + 1 < gridSize)
+            {
+                cells->AddPortal(cell, cell + 1, Vector3(wallX, 0.0f, centerZ - doorHalfWidth), Vector3(wallX, doorHeight, centerZ - doorHalfWidth),
+                    Vector3(wallX, doorHeight, centerZ + doorHalfWidth), Vector3(wallX, 0.0f, centerZ + doorHalfWidth));
+            }
+            if (y + 1 < gridSize)
+            {
+                cells->AddPortal(cell, cell + gridSize, Vector3(centerX - doorHalfWidth, 0.0f, wallZ), Vector3(centerX - doorHalfWidth, doorHeight, wallZ),
+                    Vector3(centerX + doorHalfWidth, doorHeight, wallZ), Vector3(centerX + doorHalfWidth, 0.0f, wallZ));
+            }
+        }
+    }
+}
+
+/// Return the procedural terrain height at a heightmap sample position, from 0 to 1.
+float TerrainHeight(float x, float z)
+{
+    return 0.5f + 0.3f * sinf(x * 0.021f) * cosf(z * 0.017f) + 0.15f * sinf((x + 2 * z) * 0.053f);
+}
+
+/// Cook a procedural color map of the terrain into a virtual texture next to the executable, and create a terrain material that samples it. Return null on failure.
+Material* CreateVirtualTerrainMaterial(int heightMapSize)
+{
+    const int size = 2048;
+
+    // Grass on the low ground and rock on the high ground, with a fine checker pattern that shows which mip level is resident
+    std::vector<unsigned> colors(size * size);
+    float scale = (float)heightMapSize / size;
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            float height = TerrainHeight(x * scale, y * scale);
+            float rock = Clamp((height - 0.55f) * 4.0f, 0.0f, 1.0f);
+            float shade = ((x ^ y) & 4) ? 1.0f : 0.85f;
+            Color color = Color(0.25f, 0.45f, 0.15f).Lerp(Color(0.5f, 0.45f, 0.4f), rock) * shade;
+            color.a = 1.0f;
+            colors[y * size + x] = color.ToUInt();
+        }
+    }
+
+    SharedPtr<Image> image(new Image());
+    image->SetSize(IntVector2(size, size), FMT_RGBA8);
+    image->SetData(reinterpret_cast<unsigned char*>(&colors[0]));
+
+    {
+        File file(ExecutableDir() + "Data/VirtualTerrain.vtex", FILE_WRITE);
+        if (!file.IsWritable() || !VirtualTexture::Cook(file, *image.Get(), FMT_DXT1))
+            return nullptr;
+    }
+
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    VirtualTexture* virtualTexture = cache->LoadResource<VirtualTexture>("VirtualTerrain.vtex");
+    if (!virtualTexture)
+        return nullptr;
+
+    // Copy the default terrain material's passes, as the shader programs are compiled with the virtual texture define
+    Material* defaultMaterial = Terrain::DefaultMaterial();
+    virtualTerrainMaterial = new Material();
+    virtualTerrainMaterial->SetUniform(U_MATDIFFCOLOR, Vector4::ONE);
+    for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+    {
+        Pass* source = defaultMaterial->GetPass((PassType)i);
+        if (!source)
+            continue;
+        Pass* pass = virtualTerrainMaterial->CreatePass((PassType)i);
+        pass->SetShader(source->GetShader(), source->VSDefines(), source->FSDefines());
+        pass->SetRenderState(source->GetBlendMode(), source->GetDepthTest(), source->GetColorWrite(), source->GetDepthWrite());
+    }
+    virtualTerrainMaterial->SetVirtualTexture(0, virtualTexture);
+
+    return virtualTerrainMaterial;
+}
+
+/// Create a terrain of rolling hills covering the area of the floor boxes. The heights are procedural, as no heightmap ships with the test data.
+void CreateTerrain(Scene* scene)
+{
+    const int numPatches = 5;
+    const int patchSize = 256;
+    const int size = numPatches * patchSize + 1;
+
+    std::vector<float> heights(size * size);
+    for (int z = 0; z < size; ++z)
+    {
+        for (int x = 0; x < size; ++x)
+            heights[z * size + x] = TerrainHeight((float)x, (float)z);
+    }
+
+    SharedPtr<Image> heightMap(new Image());
+    heightMap->SetSize(IntVector2(size, size), FMT_R32F);
+    heightMap->SetData(reinterpret_cast<unsigned char*>(&heights[0]));
+
+    terrain = scene->CreateChild<Terrain>();
+    terrain->SetNumPatches(IntVector2(numPatches, numPatches));
+    terrain->SetPatchSize(patchSize);
+    terrain->SetSpacing(Vector3(1.0f, 8.0f, 1.0f));
+    terrain->SetPosition(Vector3(-0.5f * numPatches * patchSize, -4.0f, -0.5f * numPatches * patchSize));
+    terrain->SetHeightMap(heightMap);
+    if (virtualTerrainMaterial)
+        terrain->SetMaterial(virtualTerrainMaterial);
+}
+
+void CreateMushrooms(Scene* scene, unsigned count, float area)
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    std::vector<Vector3> positions;
+    for (unsigned i = 0; i < count; ++i)
+    {
+        float x = Random() * area - area * 0.5f;
+        float z = Random() * area - area * 0.5f;
+        positions.push_back(Vector3(x, terrain ? terrain->Height(Vector3(x, 0.0f, z)) : 0.0f, z));
+    }
+
+    Material* material = cache->LoadResource<Material>("Mushroom.json");
+    std::vector<StaticModel*> objects;
+    StaticModel::CreateInstances(scene, positions, std::vector<Quaternion>(), std::vector<Vector3>(1, Vector3(1.5f, 1.5f, 1.5f)),
+        cache->LoadResource<Model>("Mushroom.mdl"), material, &objects);
+
+    // Tinted material instances, which are instanced together from the static transform table
+    std::vector<SharedPtr<Material> > tints;
+    for (int i = 0; i < numTints; ++i)
+    {
+        SharedPtr<Material> tint = material->CreateInstance();
+        tint->SetUniform(U_MATDIFFCOLOR, Vector4(0.5f + 0.5f * Random(), 0.5f + 0.5f * Random(), 0.5f + 0.5f * Random(), 1.0f));
+        tints.push_back(tint);
+    }
+
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        StaticModel* object = objects[i];
+        object->SetStatic(true);
+        object->SetCastShadows(true);
+        object->SetLodBias(2.0f);
+        object->SetMaxDistance(600.0f);
+        if (tints.size())
+            object->SetMaterial(tints[i % tints.size()]);
+    }
+}
+
+void CreatePointLights(Scene* scene, unsigned count, float area, bool castShadows)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        Light* light = scene->CreateChild<Light>();
+        light->SetStatic(true);
+        light->SetLightType(LIGHT_POINT);
+        light->SetCastShadows(castShadows);
+        light->SetBaked(useBakedLights && castShadows);
+        Vector3 colorVec = 2.0f * Vector3(Random(), Random(), Random()).Normalized();
+        light->SetColor(Color(colorVec.x, colorVec.y, colorVec.z));
+        light->SetRange(40.0f);
+        light->SetPosition(Vector3(Random() * area - area * 0.5f, 7.0f, Random() * area - area * 0.5f));
+        light->SetShadowMapSize(256);
+        light->SetShadowMaxDistance(200.0f);
+        light->SetMaxDistance(900.0f);
+    }
+}
+
+void CreateDirectionalLight(Scene* scene, bool castShadows, int shadowMapSize)
+{
+    Light* light = scene->CreateChild<Light>();
+    light->SetLightType(LIGHT_DIRECTIONAL);
+    light->SetCastShadows(castShadows);
+    light->SetColor(Color(1.0f, 1.0f, 1.0f, 0.5f));
+    light->SetRotation(Quaternion(45.0f, 45.0f, 0.0f));
+    light->SetShadowMapSize(shadowMapSize);
+    light->SetShadowMaxDistance(100.0f);
+}
+
+void CreateWalkers(Scene* scene, unsigned count, float area)
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    {
+        StaticModel* object = scene->CreateChild<StaticModel>();
+        object->SetStatic(true);
+        object->SetPosition(Vector3(0, -0.05f, 0));
+        object->SetScale(Vector3(area + 10.0f, 0.1f, area + 10.0f));
+        object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+        object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+    }
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        AnimatedModel* object = scene->CreateChild<AnimatedModel>();
+        object->SetStatic(true);
+        object->SetPosition(Vector3(Random() * area - area * 0.5f, 0.0f, Random() * area - area * 0.5f));
+        object->SetRotation(Quaternion(Random(360.0f), Vector3::UP));
+        object->SetModel(cache->LoadResource<Model>("Jack.mdl"));
+        object->SetCastShadows(true);
+        object->SetMaxDistance(600.0f);
+        AnimationState* state = object->AddAnimationState(cache->LoadResource<Animation>("Jack_Walk.ani"));
+        state->SetWeight(1.0f);
+        state->SetLooped(true);
+        animatingObjects.push_back(object);
+    }
+}
+
+/// Create four particle fountains around the origin sharing the particle count.
+void CreateParticleFountains(Scene* scene, unsigned count)
+{
+    for (int i = 0; i < 4; ++i)
+    {
+        ParticleEmitter* emitter = scene->CreateChild<ParticleEmitter>();
+        emitter->SetPosition(Vector3((i & 1) ? 10.0f : -10.0f, 0.0f, (i & 2) ? 10.0f : -10.0f));
+        emitter->SetMaxParticles(count / 4);
+        emitter->SetLifetime(2.0f);
+        emitter->SetVelocity(Vector3(0.0f, 10.0f, 0.0f));
+        emitter->SetVelocitySpread(2.0f);
+        emitter->SetAcceleration(Vector3(0.0f, -9.81f, 0.0f));
+        emitter->SetParticleSize(Vector2(0.1f, 0.05f));
+        particleEmitters.push_back(emitter);
+    }
+}
+
+/// Create a vertex animated crowd of walking instances around the origin, which the animated models of the scene switch to in the distance.
+void CreateCrowd(Scene* scene, unsigned count, float area)
+{
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+    Model* model = cache->LoadResource<Model>("Jack.mdl");
+    // Keep only a weak reference in between, so that the vertex animation does not outlive the graphics subsystem
+    SharedPtr<VertexAnimation> vertexAnimation(crowdAnimation.Get());
+    if (!vertexAnimation || vertexAnimation->GetModel() != model)
+    {
+        vertexAnimation = new VertexAnimation();
+        vertexAnimation->Bake(model, std::vector<Animation*>(1, cache->LoadResource<Animation>("Jack_Walk.ani")));
+        crowdAnimation = vertexAnimation;
+    }
+
+    Crowd* crowd = scene->CreateChild<Crowd>();
+    crowd->SetVertexAnimation(vertexAnimation);
+    crowd->SetCastShadows(true);
+    for (unsigned i = 0; i < count; ++i)
+    {
+        float x = Random() * area - area * 0.5f;
+        float z = Random() * area - area * 0.5f;
+        crowd->AddInstance(Vector3(x, terrain ? terrain->Height(Vector3(x, 0.0f, z)) : 0.0f, z), Quaternion(Random(360.0f), Vector3::UP), 1.0f, 0, Random(),
+            Random(0.8f, 1.2f));
+    }
+    crowds.push_back(crowd);
+
+    for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
+        (*it)->SetCrowdLod(crowd, 40.0f);
+}
+
+/// Create decals projected from the mushroom texture onto the ground around the origin.
+void CreateDecals(Scene* scene, unsigned count, float area)
+{
+    for (unsigned i = 0; i < count; ++i)
+    {
+        float x = Random() * area - area * 0.5f;
+        float z = Random() * area - area * 0.5f;
+        Decal* decal = scene->CreateChild<Decal>();
+        decal->SetStatic(true);
+        decal->SetPosition(Vector3(x, terrain ? terrain->Height(Vector3(x, 0.0f, z)) : 0.0f, z));
+        decal->SetRotation(Quaternion(Random(360.0f), Vector3::UP));
+        decal->SetScale(Vector3(4.0f, 2.0f, 4.0f));
+    }
+}
+
+void CreateScene(Scene* scene, int preset)
+{
+    rotatingObjects.clear();
+    animatingObjects.clear();
+    particleEmitters.clear();
+    crowds.clear();
+    terrain = nullptr;
+
+    ResourceCache* cache = Object::Subsystem<ResourceCache>();
+
+    scene->Clear();
+    Octree* octree = scene->CreateChild<Octree>();
+    octree->SetStaticBvh(true);
+
+    SetRandomSeed(1);
+
+    if (preset == 0)
+    {
+        if (useTerrain)
+            CreateTerrain(scene);
+        else
+            CreateFloor(scene, 55);
+        CreateMushrooms(scene, 10000, 1000.0f);
+        CreatePointLights(scene, 100, 1000.0f, true);
+    }
+    else if (preset == 1)
+    {
+        for (int y = -125; y <= 125; ++y)
+        {
+            for (int x = -125; x <= 125; ++x)
+            {
+                StaticModel* object = scene->CreateChild<StaticModel>();
+                object->SetPosition(Vector3(x * 0.3f, 0.0f, y * 0.3f));
+                object->SetScale(0.25f);
+                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+                rotatingObjects.push_back(object);
+            }
+        }
+
+        CreateDirectionalLight(scene, false, 1024);
+    }
+    else if (preset == 2)
+    {
+        CreateWalkers(scene, 500, 90.0f);
+        CreateDirectionalLight(scene, true, 2048);
+    }
+    else if (preset == 3)
+    {
+        // 100k static boxes of varying size, with shadows from a directional light
+        std::vector<Vector3> positions;
+        std::vector<Vector3> scales;
+        for (int y = -158; y < 158; ++y)
+        {
+            for (int x = -158; x < 158; ++x)
+            {
+                float size = 0.5f + Random() * 1.5f;
+                positions.push_back(Vector3(x * 3.0f, size * 0.5f, y * 3.0f));
+                scales.push_back(Vector3(size, size, size));
+            }
+        }
+
+        std::vector<StaticModel*> objects;
+        StaticModel::CreateInstances(scene, positions, std::vector<Quaternion>(), scales, cache->LoadResource<Model>("Box.mdl"),
+            cache->LoadResource<Material>("Stone.json"), &objects);
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+        {
+            (*it)->SetStatic(true);
+            (*it)->SetCastShadows(true);
+            (*it)->SetMaxDistance(600.0f);
+        }
+
+        CreateDirectionalLight(scene, true, 2048);
+    }
+    else if (preset == 4)
+    {
+        // 2k unshadowed point lights over the mushroom field to stress light culling and clustering
+        if (useTerrain)
+            CreateTerrain(scene);
+        else
+            CreateFloor(scene, 55);
+        CreateMushrooms(scene, 10000, 1000.0f);
+        CreatePointLights(scene, 2000, 1000.0f, false);
+    }
+    else if (preset == 5)
+    {
+        CreateWalkers(scene, 2000, 180.0f);
+        CreateDirectionalLight(scene, true, 2048);
+    }
+}
+
+/// Rotate a box of the rotating scene to the current rotation.
+void RotateObject(Node* node, float)
+{
+    static_cast<StaticModel*>(node)->SetRotation(objectRotation);
+}
+
+/// Advance the animation of a walker and move it forward, turning near the edges of the area.
+void AnimateObject(Node* node, float dt)
+{
+    AnimatedModel* object = static_cast<AnimatedModel*>(node);
+    AnimationState* state = object->AnimationStates()[0];
+    state->AddTime(dt);
+    object->Translate(Vector3::FORWARD * 2.0f * dt);
+
+    // Rotate to avoid going outside the plane
+    Vector3 pos = object->Position();
+    float limit = animatingObjects.size() > 500 ? 90.0f : 45.0f;
+    if (pos.x < -limit || pos.x > limit || pos.z < -limit || pos.z > limit)
+        object->Yaw(45.0f * dt);
+}
+
+/// Register the boxes and walkers for the scene update, which runs them in parallel with a fixed timestep.
+void SetupSceneUpdate(Scene* scene, float timeStep)
+{
+    scene->SetFixedTimeStep(timeStep);
+    for (auto it = rotatingObjects.begin(); it != rotatingObjects.end(); ++it)
+        scene->SetUpdateCallback(*it, UPDATE_FIXED, RotateObject);
+    for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
+        scene->SetUpdateCallback(*it, UPDATE_FIXED, AnimateObject);
+}
+
+/// Advance the scene animation by a fixed timestep. With the scene update, the boxes and walkers are updated by their callbacks.
+void AnimateScene(Scene* scene, bool sceneUpdate, float time, float dt)
+{
+    objectRotation = Quaternion(100.0f * time, Vector3::ONE);
+
+    if (sceneUpdate)
+        scene->Update(dt);
+    else
+    {
+        for (auto it = rotatingObjects.begin(); it != rotatingObjects.end(); ++it)
+            RotateObject(*it, dt);
+        for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
+            AnimateObject(*it, dt);
+    }
+
+    for (auto it = particleEmitters.begin(); it != particleEmitters.end(); ++it)
+        (*it)->Update(dt);
+
+    // Crowds follow the bounds of the animated models handed over to them, so update after moving the models
+    for (auto it = crowds.begin(); it != crowds.end(); ++it)
+        (*it)->Update(dt);
+}
+
+/// Move the camera along the scene's scripted path: an orbit around the origin that bobs in height and looks slightly past the center.
+void MoveCamera(Camera* camera, const BenchScene& scene, float time)
+{
+    float angle = scene.speed * time;
+    Vector3 position(scene.radius * Sin(angle), scene.height + 0.25f * scene.height * Sin(angle * 3.0f), -scene.radius * Cos(angle));
+    Vector3 target(0.25f * scene.radius * Sin(angle + 90.0f), 0.0f, 0.0f);
+
+    camera->SetPosition(position);
+    camera->LookAt(target);
+}
+
+/// Return the last value of a profiler counter, or zero if it has not been set.
+long long CounterValue(const Profiler* profiler, const char* name)
+{
+    const std::vector<ProfilerCounter>& counters = profiler->Counters();
+    for (auto it = counters.begin(); it != counters.end(); ++it)
+    {
+        if (!strcmp(it->name, name))
+            return it->value;
+    }
+    return 0;
+}
+
+/// Record the previous frame's time of a profiler block and its children into the sample map.
+void CollectSamples(SampleMap& samples, const ProfilerBlock* block, const std::string& prefix, size_t depth, size_t frame)
+{
+    for (auto it = block->children.begin(); it != block->children.end(); ++it)
+    {
+        const ProfilerBlock* child = *it;
+        std::string path = prefix + child->name;
+
+        // A block seen the first time did not run in the earlier frames
+        std::vector<float>& values = samples[path];
+        values.resize(frame + 1);
+        values[frame] = child->frameTime * 0.001f;
+
+        if (depth + 1 < MAX_BLOCK_DEPTH)
+            CollectSamples(samples, child, path + "/", depth + 1, frame);
+    }
+}
+
+/// Write mean, percentiles and maximum of samples as a JSON object.
+void WriteStatistics(JSONWriter& writer, std::vector<float> values, size_t numFrames)
+{
+    values.resize(numFrames);
+    std::sort(values.begin(), values.end());
+
+    double sum = 0.0;
+    for (auto it = values.begin(); it != values.end(); ++it)
+        sum += *it;
+
+    // Nearest-rank percentiles
+    auto percentile = [&](float p) -> double
+    {
+        if (values.empty())
+            return 0.0;
+        size_t rank = Max((size_t)ceilf(p * values.size()), (size_t)1);
+        return values[Min(rank, values.size()) - 1];
+    };
+
+    writer.BeginObject();
+    writer.Key("mean");
+    writer.Value(values.size() ? sum / values.size() : 0.0);
+    writer.Key("p50");
+    writer.Value(percentile(0.50f));
+    writer.Key("p95");
+    writer.Value(percentile(0.95f));
+    writer.Key("p99");
+    writer.Value(percentile(0.99f));
+    writer.Key("max");
+    writer.Value(values.size() ? (double)values.back() : 0.0);
+    writer.EndObject();
+}
+
+/// Write a group of profiler block statistics as a JSON object keyed by block path.
+void WriteGroup(JSONWriter& writer, const char* key, const SampleMap& samples, size_t numFrames)
+{
+    writer.Key(key);
+    writer.BeginObject();
+    for (auto it = samples.begin(); it != samples.end(); ++it)
+    {
+        writer.Key(it->first);
+        WriteStatistics(writer, it->second, numFrames);
+    }
+    writer.EndObject();
+}
+
+int main(int argc, char** argv)
+{
+    const std::vector<std::string>& arguments = ParseArguments(argc, argv);
+    // An output name starting with '-' is an option given without the output name, such as -h or --help
+    bool showHelp = arguments.size() >= 2 && (arguments[1] == "-h" || arguments[1] == "--help");
+    if (arguments.size() < 2 || arguments[1].empty() || arguments[1][0] == '-')
+    {
+        if (arguments.size() >= 2 && !showHelp)
+            fprintf(stderr, "Output JSON name missing before option %s\n", arguments[1].c_str());
+
+        printf("Usage: Turso3DBench <output JSON> [options]\n"
+            "Renders each scene along a scripted camera path with a fixed timestep and writes frame time statistics.\n"
+            "Options:\n"
+            "-frames <n>    Number of measured frames per scene, default 600\n"
+            "-warmup <n>    Number of unmeasured frames before measuring, default 60\n"
+            "-scene <n>     Run only the scene with this index, 0-%d\n"
+            "-capture <f>   Save the first measured frame of the scene given with -scene as a frame capture\n"
+            "-replay <f>    Render a frame capture repeatedly instead of the scenes\n"
+            "-hitch <ms>    Log the profiling data of frames longer than this\n"
+            "-framelimit <fps> Limit the frame rate in Present(), and report the present-to-present jitter\n"
+            "-trace <f>     Record a trace of the run and save it as Chrome trace JSON\n"
+            "-threads <n>   Number of threads including the main thread, default CPU core count\n"
+            "-schedstats    Record work queue scheduler statistics\n"
+            "-asynclog      Write log messages from a background thread\n"
+            "-sceneupdate   Move the rotating boxes and walkers in parallel through the scene update\n"
+            "-ssao          Render ambient occlusion\n"
+            "-temporalssao  Render ambient occlusion with temporal accumulation\n"
+            "-reflection    Render a half resolution planar reflection of the ground as a secondary view\n"
+            "-stereo        Render the scenes as a side-by-side stereo view in a single pass\n"
+            "-occlusion     Cull with the downsampled depth of earlier frames, read back asynchronously\n"
+            "-deferred      Render opaque geometry with clustered deferred shading\n"
+            "-visbuffer     Rasterize the static opaque geometry into a visibility buffer and shade it with compute shaders\n"
+            "-oit           Render transparent geometry with weighted blended order-independent transparency\n"
+            "-debuggeometry Add and render the debug geometry of the visible objects\n"
+            "-latelatch     Cull with a frustum widened by 5 degrees and latch the camera before rendering the opaque geometry\n"
+            "-farlights     Limit the clusters beyond 50 units to their 4 highest contributing lights\n"
+            "-staticbatches Cache the batches of static geometry per octant\n"
+            "-hlod          Merge the static models per octree cell into simplified proxies for distant cells\n"
+            "-lighthierarchy Select lights by importance and cluster them through a light BVH\n"
+            "-staticcasters Cache the static shadowcaster lists of static lights\n"
+            "-portals       Divide each scene into a grid of rooms connected by doorway portals and cull through them\n"
+            "-bakedlights   Bake the shadowed point lights of the mushroom scene into light probes after the first frame\n"
+            "-gpuculling    Cull the static models of the static BVH with a compute shader and draw them indirectly\n"
+            "-particles <n> Add four GPU simulated particle fountains with n particles in total to each scene\n"
+            "-decals <n>    Add n clustered decals on the ground around the origin of each scene\n"
+            "-tints <n>     Tint the mushrooms with n material instances, drawn from the static transform table\n"
+            "-crowd <n>     Add a vertex animated crowd of n instances to each scene, with the animated models switching to it beyond 40 units\n"
+            "-terrain       Replace the floor boxes of the mushroom scenes with a CDLOD heightmap terrain\n"
+            "-virtualtexture Color the terrain with a virtual texture streamed by GPU feedback, implies -terrain\n"
+            "-momentshadows Use exponential variance shadow maps instead of PCF\n"
+            "-uploadthread  Upload the loaded textures and buffers on a thread with a shared OpenGL context\n"
+            "-headless      Render without a visible window, on the offscreen video driver if available\n"
+            "-renderjobs <n> Render n 256x256 images of each scene as offscreen jobs into RenderJobs next to the executable\n"
+            "-nothreads     Disable worker threads\n"
+            "-nogputimers   Disable GPU timer queries\n", NUM_SCENES - 1);
+        return showHelp ? 0 : 1;
+    }
+
+    int numFrames = 600;
+    int numWarmupFrames = 60;
+    int onlyScene = -1;
+    bool useThreads = true;
+    int numThreads = 0;
+    bool useSchedulerStats = false;
+    bool useAsyncLog = false;
+    bool useSceneUpdate = false;
+    bool useSSAO = false;
+    bool useTemporalSSAO = false;
+    bool useStereo = false;
+    bool useReflection = false;
+    bool useOcclusion = false;
+    bool useDeferred = false;
+    bool useVisibilityBuffer = false;
+    bool useOIT = false;
+    bool useLateLatch = false;
+    bool useDebugGeometry = false;
+    bool useFarLightLimit = false;
+    bool useStaticBatches = false;
+    bool useHlod = false;
+    bool useLightHierarchy = false;
+    bool useStaticCasters = false;
+    bool usePortals = false;
+    bool useGpuCulling = false;
+    int numParticles = 0;
+    int numDecals = 0;
+    int numCrowdInstances = 0;
+    bool useVirtualTexture = false;
+    bool useMomentShadows = false;
+    bool useUploadThread = false;
+    bool useHeadless = false;
+    int numRenderJobs = 0;
+    bool useGpuTimers = true;
+    float hitchThreshold = 0.0f;
+    float frameLimit = 0.0f;
+    std::string captureFileName;
+    std::string traceFileName;
+    std::string replayFileName;
+    const float timeStep = 1.0f / 60.0f;
+
+    for (size_t i = 2; i < arguments.size(); ++i)
+    {
+        if (arguments[i] == "-frames" && i + 1 < arguments.size())
+            numFrames = Max(ParseInt(arguments[++i]), 1);
+        else if (arguments[i] == "-warmup" && i + 1 < arguments.size())
+            numWarmupFrames = Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-scene" && i + 1 < arguments.size())
+            onlyScene = Clamp(ParseInt(arguments[++i]), 0, NUM_SCENES - 1);
+        else if (arguments[i] == "-capture" && i + 1 < arguments.size())
+            captureFileName = arguments[++i];
+        else if (arguments[i] == "-replay" && i + 1 < arguments.size())
+            replayFileName = arguments[++i];
+        else if (arguments[i] == "-trace" && i + 1 < arguments.size())
+            traceFileName = arguments[++i];
+        else if (arguments[i] == "-hitch" && i + 1 < arguments.size())
+            hitchThreshold = ParseFloat(arguments[++i]);
+        else if (arguments[i] == "-framelimit" && i + 1 < arguments.size())
+            frameLimit = ParseFloat(arguments[++i]);
+        else if (arguments[i] == "-threads" && i + 1 < arguments.size())
+            numThreads = Max(ParseInt(arguments[++i]), 1);
+        else if (arguments[i] == "-schedstats")
+            useSchedulerStats = true;
+        else if (arguments[i] == "-asynclog")
+            useAsyncLog = true;
+        else if (arguments[i] == "-sceneupdate")
+            useSceneUpdate = true;
+        else if (arguments[i] == "-ssao")
+            useSSAO = true;
+        else if (arguments[i] == "-temporalssao")
+            useSSAO = useTemporalSSAO = true;
+        else if (arguments[i] == "-stereo")
+            useStereo = true;
+        else if (arguments[i] == "-reflection")
+            useReflection = true;
+        else if (arguments[i] == "-occlusion")
+            useOcclusion = true;
+        else if (arguments[i] == "-deferred")
+            useDeferred = true;
+        else if (arguments[i] == "-visbuffer")
+            useVisibilityBuffer = true;
+        else if (arguments[i] == "-oit")
+            useOIT = true;
+        else if (arguments[i] == "-latelatch")
+            useLateLatch = true;
+        else if (arguments[i] == "-debuggeometry")
+            useDebugGeometry = true;
+        else if (arguments[i] == "-farlights")
+            useFarLightLimit = true;
+        else if (arguments[i] == "-staticbatches")
+            useStaticBatches = true;
+        else if (arguments[i] == "-hlod")
+            useHlod = true;
+        else if (arguments[i] == "-lighthierarchy")
+            useLightHierarchy = true;
+        else if (arguments[i] == "-staticcasters")
+            useStaticCasters = true;
+        else if (arguments[i] == "-portals")
+            usePortals = true;
+        else if (arguments[i] == "-bakedlights")
+            useBakedLights = true;
+        else if (arguments[i] == "-gpuculling")
+            useGpuCulling = true;
+        else if (arguments[i] == "-particles" && i + 1 < arguments.size())
+            numParticles = Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-decals" && i + 1 < arguments.size())
+            numDecals = Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-tints" && i + 1 < arguments.size())
+            numTints = Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-crowd" && i + 1 < arguments.size())
+            numCrowdInstances = Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-terrain")
+            useTerrain = true;
+        else if (arguments[i] == "-virtualtexture")
+            useTerrain = useVirtualTexture = true;
+        else if (arguments[i] == "-momentshadows")
+            useMomentShadows = true;
+        else if (arguments[i] == "-uploadthread")
+            useUploadThread = true;
+        else if (arguments[i] == "-headless")
+            useHeadless = true;
+        else if (arguments[i] == "-renderjobs" && i + 1 < arguments.size())
+            numRenderJobs = Max(ParseInt(arguments[++i]), 0);
+        else if (arguments[i] == "-nothreads")
+            useThreads = false;
+        else if (arguments[i] == "-nogputimers")
+            useGpuTimers = false;
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", arguments[i].c_str());
+            return 1;
+        }
+    }
+
+    if (captureFileName.length() && onlyScene < 0)
+    {
+        fprintf(stderr, "Capturing requires selecting a scene with -scene\n");
+        return 1;
+    }
+
+    AutoPtr<WorkQueue> workQueue = new WorkQueue(useThreads ? numThreads : 1);
+    workQueue->SetInstrumentation(useSchedulerStats);
+    AutoPtr<Profiler> profiler = new Profiler();
+    profiler->SetHitchDetection(hitchThreshold);
+    AutoPtr<TraceRecorder> traceRecorder = new TraceRecorder();
+    traceRecorder->SetEnabled(traceFileName.length() > 0);
+    AutoPtr<Log> log = new Log();
+    log->SetAsync(useAsyncLog);
+    AutoPtr<EventQueue> eventQueue = new EventQueue();
+    AutoPtr<ResourceCache> cache = new ResourceCache();
+    cache->AddResourceDir(ExecutableDir() + "Data");
+    if (FileExists(ExecutableDir() + "Data.pak"))
+        cache->AddPackageFile(ExecutableDir() + "Data.pak", true);
+
+    AutoPtr<Graphics> graphics = new Graphics("Turso3D benchmark", IntVector2(1920, 1080), useHeadless);
+    if (!graphics->Initialize())
+        return 1;
+    graphics->SetVSync(false);
+    graphics->SetFrameRateLimit(frameLimit);
+    if (useGpuTimers && graphics->HasTimerQuery())
+        graphics->SetGpuTimers(true);
+    if (useUploadThread)
+        graphics->SetUploadThread(true);
+
+    AutoPtr<Input> input = new Input(graphics->Window());
+    AutoPtr<Renderer> renderer = new Renderer();
+    AutoPtr<DebugRenderer> debugRenderer = new DebugRenderer();
+    renderer->SetupShadowMaps(1024, 2048, FMT_D16);
+    renderer->SetScreenSizeCulling(1.0f, 2.0f);
+    renderer->SetShadowTimeSlicing(4, 32.0f);
+    renderer->SetMomentShadows(useMomentShadows);
+    if (useOcclusion)
+        renderer->SetOcclusionMode(OCCLUSION_GPU);
+    renderer->SetDeferredShading(useDeferred);
+    renderer->SetVisibilityBuffer(useVisibilityBuffer);
+    renderer->SetOrderIndependentTransparency(useOIT);
+    renderer->SetLateLatching(useLateLatch ? 5.0f : 0.0f);
+    if (useFarLightLimit)
+        renderer->SetFarClusterLightLimit(50.0f, 4);
+    renderer->SetStaticBatchCaching(useStaticBatches);
+    if (useHlod)
+        renderer->SetHlodThreshold(48.0f);
+    renderer->SetLightHierarchy(useLightHierarchy);
+    renderer->SetStaticCasterCaching(useStaticCasters);
+    // GPU culling, the visibility buffer and the tinted material instances draw from the static transform table
+    if (useGpuCulling || useVisibilityBuffer || numTints)
+        renderer->SetStaticInstanceTable(true);
+    if (useGpuCulling)
+        renderer->SetGpuCulling(true);
+    if (numDecals)
+        renderer->SetDecalAtlas(cache->LoadResource<Texture>("Mushroom.dds"));
+    if (useVirtualTexture)
+    {
+        if (CreateVirtualTerrainMaterial(5 * DEFAULT_TERRAIN_PATCH_SIZE + 1))
+            renderer->SetVirtualTexturing(true);
+        else
+            fprintf(stderr, "Could not create the virtual terrain texture\n");
+    }
+
+    AutoPtr<FrameBuffer> viewFbo = new FrameBuffer();
+    AutoPtr<Texture> colorBuffer = new Texture();
+    AutoPtr<Texture> depthStencilBuffer = new Texture();
+    AutoPtr<FrameGraph> frameGraph = new FrameGraph();
+    AutoPtr<AmbientOcclusion> ambientOcclusion = new AmbientOcclusion();
+    AutoPtr<RenderJobQueue> renderJobQueue = new RenderJobQueue();
+    ambientOcclusion->SetTemporalAccumulation(useTemporalSSAO);
+    AutoPtr<Scene> scene = new Scene();
+    AutoPtr<Camera> camera = new Camera();
+    AutoPtr<Camera> leftEye = new Camera();
+    AutoPtr<Camera> rightEye = new Camera();
+    AutoPtr<Camera> reflectionCamera = new Camera();
+    reflectionCamera->SetUseReflection(true);
+    reflectionCamera->SetReflectionPlane(Plane(Vector3::UP, Vector3::ZERO));
+    SharedPtr<SecondaryView> reflectionView(new SecondaryView());
+    SharedPtr<PortalCells> portalCells(new PortalCells());
+    SharedPtr<LightProbeGrid> lightProbes(new LightProbeGrid());
+
+    File dest(arguments[1], FILE_WRITE);
+    if (!dest.IsWritable())
+    {
+        fprintf(stderr, "Could not write %s\n", arguments[1].c_str());
+        return 1;
+    }
+
+    JSONWriter writer(dest);
+    writer.BeginObject();
+    writer.Key("frames");
+    writer.Value(numFrames);
+    writer.Key("warmupFrames");
+    writer.Value(numWarmupFrames);
+    writer.Key("timeStep");
+    writer.Value((double)timeStep);
+    writer.Key("threads");
+    writer.Value(workQueue->NumThreads());
+    writer.Key("gpuTimers");
+    writer.Value(graphics->GpuTimers());
+    writer.Key("scenes");
+    writer.BeginArray();
+
+    // A replayed capture is measured as one scene without view preparation
+    bool replay = replayFileName.length() > 0;
+
+    for (int i = 0; i < (replay ? 1 : NUM_SCENES); ++i)
+    {
+        if (!replay && onlyScene >= 0 && i != onlyScene)
+            continue;
+
+        const BenchScene& benchScene = scenes[i];
+        std::string name = replay ? FileNameAndExtension(replayFileName) : std::string(benchScene.name);
+        printf("Running %s\n", name.c_str());
+
+        if (replay)
+        {
+            File source(replayFileName);
+            if (!renderer->LoadFrameCapture(source))
+            {
+                fprintf(stderr, "Could not load frame capture %s\n", replayFileName.c_str());
+                return 1;
+            }
+        }
+        else
+        {
+            CreateScene(scene, i);
+            if (numParticles)
+                CreateParticleFountains(scene, (unsigned)numParticles);
+            if (numDecals)
+                CreateDecals(scene, (unsigned)numDecals, 200.0f);
+            if (numCrowdInstances)
+                CreateCrowd(scene, (unsigned)numCrowdInstances, 200.0f);
+            if (useSceneUpdate)
+                SetupSceneUpdate(scene, timeStep);
+            if (usePortals)
+            {
+                CreatePortalCells(portalCells, benchScene);
+                renderer->SetPortalCells(portalCells);
+            }
+            if (useBakedLights)
+                renderer->SetLightProbes(nullptr);
+            // HLOD proxies are built from the octree hierarchy after the first frame has inserted the drawables
+            if (useHlod)
+                scene->FindChild<Octree>()->SetStaticBvh(false);
+            renderer->DiscardPreparedView();
+        }
+
+        std::vector<float> frameTimes;
+        std::vector<float> drawCalls;
+        std::vector<float> triangles;
+        std::vector<float> frameAllocations;
+        std::vector<float> presentJitter;
+        std::vector<float> utilization;
+        std::vector<float> criticalPath;
+        std::vector<float> taskLatency;
+        std::vector<float> steals;
+        SampleMap cpuSamples;
+        SampleMap workerSamples;
+        SampleMap gpuSamples;
+        HiresTimer frameTimer;
+        size_t hitchesBefore = 0;
+
+        for (int frame = 0; frame < numWarmupFrames + numFrames && !input->ShouldExit(); ++frame)
+        {
+            frameTimer.Reset();
+            // Count the hitches of the measured frames only
+            if (frame == numWarmupFrames)
+                hitchesBefore = profiler->NumHitches();
+            profiler->BeginFrame();
+            input->Update();
+
+            if (useHlod && !replay && frame == 1)
+            {
+                Octree* octree = scene->FindChild<Octree>();
+                octree->BuildHlod(octree->Root()->level - 3);
+            }
+            // The light probes are likewise baked after the first frame, raycasting the inserted drawables
+            if (useBakedLights && !replay && frame == 1)
+            {
+                lightProbes->Bake(scene->FindChild<Octree>(), BoundingBox(Vector3(-512.0f, 0.5f, -512.0f), Vector3(512.0f, 12.5f, 512.0f)), IntVector3(256, 4, 256));
+                renderer->SetLightProbes(lightProbes);
+            }
+
+            float time = frame * timeStep;
+            if (!replay)
+            {
+                PROFILE(MoveObjects);
+                AnimateScene(scene, useSceneUpdate, time, timeStep);
+            }
+
+            int width = graphics->RenderWidth();
+            int height = graphics->RenderHeight();
+            if (colorBuffer->Width() != width || colorBuffer->Height() != height)
+            {
+                colorBuffer->Define(TEX_2D, IntVector2(width, height), FMT_RGBA8);
+                colorBuffer->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+                depthStencilBuffer->Define(TEX_2D, IntVector2(width, height), FMT_D32);
+                depthStencilBuffer->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+                viewFbo->Define(colorBuffer, depthStencilBuffer);
+            }
+
+            if (!replay)
+            {
+                camera->SetAspectRatio((float)width / (float)height);
+                MoveCamera(camera, benchScene, time);
+
+                // Render all shadow maps fully on the captured frame, as cached contents are not saved
+                bool capture = captureFileName.length() && frame == numWarmupFrames;
+                if (capture)
+                    renderer->ResetShadowMaps();
+
+                {
+                    PROFILE(PrepareView);
+                    if (useReflection)
+                    {
+                        reflectionCamera->SetTransform(camera->WorldPosition(), camera->WorldRotation());
+                        reflectionCamera->SetAspectRatio(camera->AspectRatio());
+                        renderer->PrepareSecondaryView(reflectionView, reflectionCamera);
+                    }
+                    if (useStereo)
+                    {
+                        Vector3 eyeOffset = camera->WorldRotation() * Vector3(0.0325f, 0.0f, 0.0f);
+                        leftEye->SetTransform(camera->WorldPosition() - eyeOffset, camera->WorldRotation());
+                        rightEye->SetTransform(camera->WorldPosition() + eyeOffset, camera->WorldRotation());
+                        leftEye->SetAspectRatio(0.5f * (float)width / (float)height);
+                        rightEye->SetAspectRatio(0.5f * (float)width / (float)height);
+                        renderer->PrepareStereoView(scene, leftEye, rightEye, true);
+                    }
+                    else
+                        renderer->PrepareView(scene, camera, true);
+                }
+
+                if (capture)
+                {
+                    File captureFile(captureFileName, FILE_WRITE);
+                    if (!captureFile.IsWritable() || !renderer->SaveFrameCapture(captureFile))
+                        fprintf(stderr, "Could not save frame capture %s\n", captureFileName.c_str());
+                }
+            }
+
+            {
+                PROFILE(RenderView);
+
+                frameGraph->Reset();
+                unsigned color = frameGraph->ImportTexture("Color", colorBuffer);
+                unsigned depth = frameGraph->ImportTexture("Depth", depthStencilBuffer);
+                frameGraph->SetOutput(color);
+
+                unsigned shadowPass = frameGraph->AddPass("Shadows", [&]() { renderer->RenderShadowMaps(); });
+                frameGraph->SetSideEffects(shadowPass);
+                if (useReflection)
+                {
+                    unsigned reflectionColor = frameGraph->AddTexture("ReflectionColor", colorBuffer->Size2D() / 2, FMT_RGBA8);
+                    unsigned reflectionDepth = frameGraph->AddTexture("ReflectionDepth", colorBuffer->Size2D() / 2, FMT_D32);
+                    unsigned reflectionPass = frameGraph->AddPass("Reflection", [&]() { renderer->RenderSecondaryView(reflectionView); });
+                    frameGraph->SetRenderTargets(reflectionPass, std::vector<unsigned>(1, reflectionColor), reflectionDepth, LOAD_CLEAR, Color::BLACK);
+                    frameGraph->SetSideEffects(reflectionPass);
+                }
+                std::vector<unsigned> opaqueTargets(1, color);
+                unsigned normal = FRAMEGRAPH_NONE;
+                unsigned albedo = FRAMEGRAPH_NONE;
+                bool renderSSAO = useSSAO && !renderer->IsStereo();
+                bool renderDeferred = renderer->IsDeferredShading();
+                if (renderDeferred)
+                {
+                    albedo = frameGraph->AddTexture("Albedo", colorBuffer->Size2D(), FMT_RGBA8);
+                    opaqueTargets[0] = albedo;
+                }
+                if (renderSSAO || renderDeferred)
+                {
+                    normal = frameGraph->AddTexture("Normal", colorBuffer->Size2D(), FMT_RGBA8);
+                    opaqueTargets.push_back(normal);
+                }
+                auto renderDebug = [&]()
+                {
+                    if (!useDebugGeometry)
+                        return;
+                    debugRenderer->SetView(camera);
+                    renderer->RenderDebug();
+                    debugRenderer->Render();
+                };
+                // The visibility buffer is shaded into the opaque targets, and the rest of the opaque geometry is rendered on top
+                bool renderVisibility = renderer->IsVisibilityBuffer();
+                if (renderVisibility)
+                {
+                    unsigned visibility = frameGraph->AddTexture("Visibility", colorBuffer->Size2D(), FMT_RG32U);
+                    unsigned visibilityPass = frameGraph->AddPass("Visibility", [&]()
+                    {
+                        if (useLateLatch)
+                            renderer->LatchCamera(camera);
+                        renderer->RenderVisibility();
+                    });
+                    frameGraph->SetRenderTargets(visibilityPass, std::vector<unsigned>(1, visibility), depth, LOAD_CLEAR, Color::BLACK);
+                    unsigned shadingPass = frameGraph->AddPass("VisibilityShading", [&, visibility, depth, normal]()
+                    {
+                        renderer->RenderVisibilityShading(frameGraph->GetTexture(visibility), frameGraph->GetTexture(depth), frameGraph->GetTexture(color),
+                            normal != FRAMEGRAPH_NONE ? frameGraph->GetTexture(normal) : nullptr);
+                    });
+                    frameGraph->Read(shadingPass, visibility);
+                    frameGraph->Read(shadingPass, depth);
+                    frameGraph->SetRenderTargets(shadingPass, opaqueTargets, FRAMEGRAPH_NONE, LOAD_CLEAR, Color::BLACK);
+                }
+                unsigned opaquePass = frameGraph->AddPass("Opaque", [&]()
+                {
+                    // The camera path has no input to sample, so the latch only measures the cost of the widened culling
+                    if (useLateLatch && !renderVisibility)
+                        renderer->LatchCamera(camera);
+                    renderer->RenderOpaque(depthStencilBuffer);
+                    if (useOcclusion)
+                        renderer->RenderOcclusionDepth(depthStencilBuffer);
+                });
+                frameGraph->SetRenderTargets(opaquePass, opaqueTargets, depth, renderVisibility ? LOAD_PRESERVE : LOAD_CLEAR, Color::BLACK);
+                if (renderDeferred)
+                {
+                    unsigned lightingPass = frameGraph->AddPass("Lighting", [&, albedo, normal, depth]()
+                    {
+                        renderer->RenderDeferredLighting(frameGraph->GetTexture(albedo), frameGraph->GetTexture(normal), frameGraph->GetTexture(depth));
+                    });
+                    frameGraph->Read(lightingPass, albedo);
+                    frameGraph->Read(lightingPass, normal);
+                    frameGraph->Read(lightingPass, depth);
+                    frameGraph->SetRenderTargets(lightingPass, std::vector<unsigned>(1, color), FRAMEGRAPH_NONE, LOAD_CLEAR, Color::BLACK);
+                }
+                if (renderSSAO)
+                    ambientOcclusion->AddPasses(frameGraph, camera, color, depth, normal);
+                if (renderer->IsOrderIndependentTransparency())
+                {
+                    std::vector<unsigned> oitTargets;
+                    unsigned accum = frameGraph->AddTexture("OITAccum", colorBuffer->Size2D(), FMT_RGBA16F);
+                    unsigned weight = frameGraph->AddTexture("OITWeight", colorBuffer->Size2D(), FMT_R16F);
+                    oitTargets.push_back(accum);
+                    oitTargets.push_back(weight);
+                    unsigned accumulatePass = frameGraph->AddPass("AlphaAccumulate", [&]() { renderer->RenderAlpha(); });
+                    frameGraph->SetRenderTargets(accumulatePass, oitTargets, depth, LOAD_PRESERVE, Color(0.0f, 0.0f, 0.0f, 1.0f));
+                    unsigned alphaPass = frameGraph->AddPass("Alpha", [&, accum, weight]()
+                    {
+                        renderer->RenderAlphaComposite(frameGraph->GetTexture(accum), frameGraph->GetTexture(weight));
+                        renderDebug();
+                    });
+                    frameGraph->Read(alphaPass, accum);
+                    frameGraph->Read(alphaPass, weight);
+                    frameGraph->SetRenderTargets(alphaPass, std::vector<unsigned>(1, color), depth);
+                }
+                else
+                {
+                    unsigned alphaPass = frameGraph->AddPass("Alpha", [&]()
+                    {
+                        renderer->RenderAlpha();
+                        renderDebug();
+                    });
+                    frameGraph->SetRenderTargets(alphaPass, std::vector<unsigned>(1, color), depth);
+                }
+
+                frameGraph->Compile();
+                frameGraph->Execute();
+
+                graphics->Blit(nullptr, IntRect(0, 0, width, height), viewFbo, IntRect(0, 0, width, height), true, false, FILTER_POINT);
+            }
+
+            {
+                PROFILE(Present);
+                graphics->Present();
+            }
+
+            eventQueue->Dispatch();
+            profiler->EndFrame();
+            workQueue->EndFrame();
+
+            if (frame >= numWarmupFrames)
+            {
+                size_t index = frame - numWarmupFrames;
+                frameTimes.push_back(frameTimer.ElapsedUSec() * 0.001f);
+                drawCalls.push_back((float)graphics->DrawCalls());
+                triangles.push_back((float)graphics->Triangles());
+                frameAllocations.push_back((float)CounterValue(profiler, "FrameAllocations"));
+                presentJitter.push_back(graphics->PresentJitter() * 1000.0f);
+                if (useSchedulerStats)
+                {
+                    // Work queue EndFrame() has collected the statistics of the frame
+                    const WorkQueueFrameStats& stats = workQueue->FrameStats();
+                    long long busyTime = 0;
+                    long long numSteals = 0;
+                    for (size_t j = 0; j < stats.busyTime.size(); ++j)
+                    {
+                        busyTime += stats.busyTime[j];
+                        numSteals += stats.numSteals[j];
+                    }
+                    utilization.push_back(stats.frameTime ? 100.0f * busyTime / (stats.frameTime * workQueue->NumThreads()) : 0.0f);
+                    criticalPath.push_back(stats.criticalPath * 0.001f);
+                    taskLatency.push_back(stats.averageLatency * 0.001f);
+                    steals.push_back((float)numSteals);
+                }
+                CollectSamples(cpuSamples, profiler->RootBlock(), "", 0, index);
+                CollectSamples(workerSamples, profiler->WorkerRootBlock(), "", 0, index);
+                CollectSamples(gpuSamples, profiler->GpuRootBlock(), "", 0, index);
+            }
+        }
+
+        // Render the offscreen jobs from cameras around the scene, and measure until all images have been written
+        size_t completedJobs = 0;
+        float renderJobTime = 0.0f;
+        if (numRenderJobs && !replay && !renderer->IsDeferredShading() && !input->ShouldExit())
+        {
+            std::string jobDir = ExecutableDir() + "RenderJobs/";
+            CreateDir(jobDir);
+
+            std::vector<AutoPtr<Camera> > jobCameras;
+            size_t completedBefore = renderJobQueue->NumCompleted();
+            HiresTimer jobTimer;
+
+            for (int j = 0; j < numRenderJobs; ++j)
+            {
+                jobCameras.push_back(new Camera());
+                MoveCamera(jobCameras.back(), benchScene, 360.0f * j / (numRenderJobs * benchScene.speed));
+                renderJobQueue->AddJob(scene, jobCameras.back(), IntVector2(256, 256), jobDir + name + "_" + std::to_string(j) + ".png");
+            }
+
+            while (renderJobQueue->NumPendingJobs())
+            {
+                renderJobQueue->Update();
+                graphics->Present();
+            }
+            renderJobQueue->Finish();
+
+            completedJobs = renderJobQueue->NumCompleted() - completedBefore;
+            renderJobTime = jobTimer.ElapsedUSec() * 0.000001f;
+        }
+
+        size_t measured = frameTimes.size();
+
+        writer.BeginObject();
+        writer.Key("name");
+        writer.Value(name);
+        writer.Key("measuredFrames");
+        writer.Value((unsigned)measured);
+        writer.Key("frameTime");
+        WriteStatistics(writer, frameTimes, measured);
+        writer.Key("drawCalls");
+        WriteStatistics(writer, drawCalls, measured);
+        writer.Key("triangles");
+        WriteStatistics(writer, triangles, measured);
+        if (numRenderJobs)
+        {
+            writer.Key("renderJobs");
+            writer.BeginObject();
+            writer.Key("images");
+            writer.Value((unsigned)completedJobs);
+            writer.Key("seconds");
+            writer.Value((double)renderJobTime);
+            writer.Key("imagesPerSecond");
+            writer.Value(renderJobTime > 0.0f ? (double)completedJobs / renderJobTime : 0.0);
+            writer.EndObject();
+        }
+        if (useSchedulerStats)
+        {
+            writer.Key("threadUtilization");
+            WriteStatistics(writer, utilization, measured);
+            writer.Key("criticalPath");
+            WriteStatistics(writer, criticalPath, measured);
+            writer.Key("taskLatency");
+            WriteStatistics(writer, taskLatency, measured);
+            writer.Key("steals");
+            WriteStatistics(writer, steals, measured);
+        }
+        if (profiler->IsHitchDetection())
+        {
+            writer.Key("hitches");
+            writer.Value((unsigned)(profiler->NumHitches() - hitchesBefore));
+        }
+        if (frameLimit > 0.0f)
+        {
+            writer.Key("presentJitter");
+            WriteStatistics(writer, presentJitter, measured);
+        }
+        if (IsMemoryTracking())
+        {
+            writer.Key("frameAllocations");
+            WriteStatistics(writer, frameAllocations, measured);
+            writer.Key("heapBytes");
+            writer.BeginObject();
+            for (size_t j = 0; j < MAX_MEMORY_TAGS; ++j)
+            {
+                writer.Key(MemoryTagName((MemoryTag)j));
+                writer.Value((double)GetMemoryStats((MemoryTag)j).bytes);
+            }
+            writer.EndObject();
+        }
+        WriteGroup(writer, "cpu", cpuSamples, measured);
+        WriteGroup(writer, "workers", workerSamples, measured);
+        WriteGroup(writer, "gpu", gpuSamples, measured);
+        writer.EndObject();
+
+        if (input->ShouldExit())
+            break;
+    }
+
+    writer.EndArray();
+    writer.EndObject();
+    // The material refers to GPU resources, so release it before the subsystems
+    virtualTerrainMaterial.Reset();
+
+    if (traceFileName.length())
+    {
+        traceRecorder->SetEnabled(false);
+        File traceFile(traceFileName, FILE_WRITE);
+        if (!traceFile.IsWritable() || !traceRecorder->SaveChromeTrace(traceFile))
+        {
+            fprintf(stderr, "Could not write trace %s\n", traceFileName.c_str());
+            return 1;
+        }
+    }
+
+    return 0;
+}
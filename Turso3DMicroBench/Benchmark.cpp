@@ -0,0 +1,102 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Benchmark.h"
+#include "IO/File.h"
+#include "IO/JSONWriter.h"
+#include "Math/Math.h"
+
+#include <cstdio>
+
+/// Iterations are not increased beyond this.
+static const size_t MAX_ITERATIONS = 1000000000;
+
+BenchmarkRegistrar::BenchmarkRegistrar(const char* name, BenchmarkFunction function)
+{
+    BenchmarkEntry entry;
+    entry.name = name;
+    entry.function = function;
+    RegisteredBenchmarks().push_back(entry);
+}
+
+std::vector<BenchmarkEntry>& RegisteredBenchmarks()
+{
+    static std::vector<BenchmarkEntry> benchmarks;
+    return benchmarks;
+}
+
+std::vector<BenchmarkResult> RunBenchmarks(const std::string& filter, float minTime)
+{
+    std::vector<BenchmarkResult> results;
+    long long minTimeUSec = (long long)(minTime * 1000000.0f);
+
+    printf("%-40s %14s %14s %16s\n", "Benchmark", "Time (ns)", "Iterations", "Items/s");
+
+    for (auto it = RegisteredBenchmarks().begin(); it != RegisteredBenchmarks().end(); ++it)
+    {
+        if (filter.length() && std::string(it->name).find(filter) == std::string::npos)
+            continue;
+
+        size_t iterations = 1;
+        long long elapsed;
+        long long items;
+
+        for (;;)
+        {
+            BenchmarkState state(iterations);
+            it->function(state);
+            elapsed = state.Elapsed();
+            items = state.ItemsProcessed();
+
+            if (elapsed >= minTimeUSec || iterations >= MAX_ITERATIONS)
+                break;
+
+            // Predict the iterations needed from the run so far with some margin, but grow at most tenfold at once
+            size_t predicted = elapsed > 0 ? (size_t)(iterations * 1.4 * minTimeUSec / elapsed) : iterations * 10;
+            iterations = Min(Min(Max(predicted, iterations + 1), iterations * 10), MAX_ITERATIONS);
+        }
+
+        BenchmarkResult result;
+        result.name = it->name;
+        result.iterations = iterations;
+        result.timePerIteration = elapsed * 1000.0 / iterations;
+        result.itemsPerSecond = (items && elapsed) ? items * 1000000.0 / elapsed : 0.0;
+        results.push_back(result);
+
+        if (result.itemsPerSecond > 0.0)
+            printf("%-40s %14.1f %14u %16.0f\n", result.name, result.timePerIteration, (unsigned)result.iterations, result.itemsPerSecond);
+        else
+            printf("%-40s %14.1f %14u %16s\n", result.name, result.timePerIteration, (unsigned)result.iterations, "");
+        fflush(stdout);
+    }
+
+    return results;
+}
+
+bool WriteBenchmarkResults(const std::string& fileName, const std::vector<BenchmarkResult>& results)
+{
+    File dest(fileName, FILE_WRITE);
+    if (!dest.IsWritable())
+        return false;
+
+    JSONWriter writer(dest);
+    writer.BeginObject();
+    writer.Key("benchmarks");
+    writer.BeginArray();
+    for (auto it = results.begin(); it != results.end(); ++it)
+    {
+        writer.BeginObject();
+        writer.Key("name");
+        writer.Value(it->name);
+        writer.Key("iterations");
+        writer.Value((double)it->iterations);
+        writer.Key("timeNs");
+        writer.Value(it->timePerIteration);
+        writer.Key("itemsPerSecond");
+        writer.Value(it->itemsPerSecond);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    return true;
+}
@@ -0,0 +1,141 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "Time/Timer.h"
+
+#include <string>
+#include <vector>
+
+/// Timing state of one benchmark run. The benchmark function does its setup, then loops while KeepRunning() returns true.
+class BenchmarkState
+{
+public:
+    /// Construct with the number of iterations to run.
+    BenchmarkState(size_t iterations) :
+        remaining(iterations),
+        elapsed(0),
+        itemsProcessed(0),
+        started(false),
+        paused(false)
+    {
+    }
+
+    /// Start timing on the first call, and return whether should run another iteration. Stop timing after the last.
+    bool KeepRunning()
+    {
+        if (!started)
+        {
+            started = true;
+            timer.Reset();
+        }
+
+        if (remaining)
+        {
+            --remaining;
+            return true;
+        }
+
+        if (!paused)
+            elapsed += timer.ElapsedUSec();
+        return false;
+    }
+
+    /// Stop timing, for example to reset data between iterations.
+    void PauseTiming()
+    {
+        if (!paused)
+        {
+            elapsed += timer.ElapsedUSec();
+            paused = true;
+        }
+    }
+
+    /// Resume timing after a pause.
+    void ResumeTiming()
+    {
+        if (paused)
+        {
+            timer.Reset();
+            paused = false;
+        }
+    }
+
+    /// Set the number of items processed in all iterations, for reporting throughput.
+    void SetItemsProcessed(long long items) { itemsProcessed = items; }
+
+    /// Return the timed microseconds.
+    long long Elapsed() const { return elapsed; }
+    /// Return the number of items processed.
+    long long ItemsProcessed() const { return itemsProcessed; }
+
+private:
+    /// Timer.
+    HiresTimer timer;
+    /// Iterations remaining.
+    size_t remaining;
+    /// Timed microseconds.
+    long long elapsed;
+    /// Items processed.
+    long long itemsProcessed;
+    /// Started flag.
+    bool started;
+    /// Paused flag.
+    bool paused;
+};
+
+/// Benchmark function.
+typedef void (*BenchmarkFunction)(BenchmarkState& state);
+
+/// Registered benchmark.
+struct BenchmarkEntry
+{
+    /// Name.
+    const char* name;
+    /// Function.
+    BenchmarkFunction function;
+};
+
+/// Result of a benchmark after calibrating the iteration count.
+struct BenchmarkResult
+{
+    /// Name.
+    const char* name;
+    /// Iterations in the final run.
+    size_t iterations;
+    /// Nanoseconds per iteration.
+    double timePerIteration;
+    /// Items processed per second, or zero if not reported.
+    double itemsPerSecond;
+};
+
+/// Register a benchmark. Used through the BENCHMARK macro.
+struct BenchmarkRegistrar
+{
+    /// Construct and register.
+    BenchmarkRegistrar(const char* name, BenchmarkFunction function);
+};
+
+/// Return the registered benchmarks.
+std::vector<BenchmarkEntry>& RegisteredBenchmarks();
+/// Run the benchmarks whose names contain the filter string, increasing the iterations until a run lasts at least the minimum time. Print a line per benchmark and return the results.
+std::vector<BenchmarkResult> RunBenchmarks(const std::string& filter, float minTime);
+/// Write benchmark results to a JSON file. Return true on success.
+bool WriteBenchmarkResults(const std::string& fileName, const std::vector<BenchmarkResult>& results);
+
+/// Prevent the compiler from optimizing away a value's computation.
+template <class T> inline void DoNotOptimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static volatile const void* sink;
+    sink = &value;
+#endif
+}
+
+/// Define and register a benchmark function.
+#define BENCHMARK(name) \
+    static void name(BenchmarkState& state); \
+    static BenchmarkRegistrar name##Registrar(#name, name); \
+    static void name(BenchmarkState& state)
@@ -0,0 +1,859 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Benchmark.h"
+#include "Graphics/Graphics.h"
+#include "IO/Arguments.h"
+#include "IO/FileSystem.h"
+#include "IO/JSONValue.h"
+#include "IO/Log.h"
+#include "IO/StringUtils.h"
+#include "Math/Frustum.h"
+#include "Math/Random.h"
+#include "Math/Ray.h"
+#include "Renderer/AnimatedModel.h"
+#include "Renderer/Animation.h"
+#include "Renderer/AnimationState.h"
+#include "Renderer/Batch.h"
+#include "Renderer/GeometryNode.h"
+#include "Renderer/Material.h"
+#include "Renderer/Model.h"
+#include "Renderer/Octree.h"
+#include "Renderer/Renderer.h"
+#include "Renderer/StaticModel.h"
+#include "Resource/Image.h"
+#include "Resource/ResourceCache.h"
+#include "Scene/Scene.h"
+#include "Scene/SpatialHash.h"
+#include "Thread/WorkQueue.h"
+
+#include <cstdio>
+
+/// Number of boxes tested per culling iteration.
+static const size_t NUM_CULL_BOXES = 4096;
+/// Number of batches sorted per iteration.
+static const size_t NUM_SORT_BATCHES = 20000;
+/// Number of drawables in the octree benchmarks.
+static const size_t NUM_OCTREE_DRAWABLES = 50000;
+/// Number of agents in the spatial hash benchmarks.
+static const size_t NUM_SPATIAL_HASH_AGENTS = 10000;
+/// Number of nearest neighbors queried per agent.
+static const size_t NUM_NEAREST_NEIGHBORS = 8;
+/// Number of groups and nodes per group in the name lookup scene.
+static const size_t NUM_NAMED_GROUPS = 1000;
+static const size_t NUM_NAMED_GROUP_NODES = 100;
+/// Number of recursive name lookups per iteration.
+static const size_t NUM_NAME_LOOKUPS = 64;
+/// Number of animated models updated per iteration.
+static const size_t NUM_ANIMATED_MODELS = 100;
+/// Number of bones in the benchmark skeleton.
+static const size_t NUM_BENCHMARK_BONES = 64;
+/// Number of empty tasks queued per iteration.
+static const size_t NUM_EMPTY_TASKS = 1024;
+/// Length of the task dependency chain.
+static const size_t TASK_CHAIN_LENGTH = 64;
+
+/// Return random bounding boxes scattered around the origin.
+static std::vector<BoundingBox> RandomBoxes(size_t count, float area)
+{
+    std::vector<BoundingBox> boxes;
+    for (size_t i = 0; i < count; ++i)
+    {
+        Vector3 center(Random() * area - area * 0.5f, Random() * area * 0.1f, Random() * area - area * 0.5f);
+        Vector3 halfSize(0.5f + Random() * 2.0f, 0.5f + Random() * 2.0f, 0.5f + Random() * 2.0f);
+        boxes.push_back(BoundingBox(center - halfSize, center + halfSize));
+    }
+    return boxes;
+}
+
+/// Return a perspective frustum looking along the positive Z axis from the edge of the benchmark area.
+static Frustum BenchmarkFrustum()
+{
+    Frustum frustum;
+    frustum.Define(60.0f, 16.0f / 9.0f, 1.0f, 0.1f, 500.0f, Matrix3x4(Vector3(0.0f, 10.0f, -200.0f), Quaternion(10.0f, 0.0f, 0.0f), 1.0f));
+    return frustum;
+}
+
+/// Return a model without vertex data, which can be used for culling and animation without a graphics context.
+static SharedPtr<Model> BoxModel()
+{
+    SharedPtr<Model> model(new Model());
+    model->SetNumGeometries(1);
+    model->SetLocalBoundingBox(BoundingBox(-0.5f, 0.5f));
+    return model;
+}
+
+/// Return a model with a skeleton of bone chains without vertex data.
+static SharedPtr<Model> SkeletonModel()
+{
+    SharedPtr<Model> model = BoxModel();
+
+    std::vector<ModelBone> bones(NUM_BENCHMARK_BONES);
+    for (size_t i = 0; i < bones.size(); ++i)
+    {
+        ModelBone& bone = bones[i];
+        bone.name = "Bone" + std::to_string(i);
+        bone.nameHash = StringHash(bone.name);
+        // Eight chains of eight bones starting from the root
+        bone.parentIndex = (i % 8) ? i - 1 : 0;
+        bone.initialPosition = i ? Vector3(0.0f, 0.25f, 0.0f) : Vector3::ZERO;
+        bone.radius = 0.2f;
+        bone.boundingBox = BoundingBox(-0.1f, 0.1f);
+    }
+
+    model->SetBones(bones);
+    return model;
+}
+
+/// Return an animation that bends all bones of the benchmark skeleton.
+static SharedPtr<Animation> SkeletonAnimation(bool compressed)
+{
+    SharedPtr<Animation> animation(new Animation());
+    animation->SetLength(2.0f);
+
+    for (size_t i = 0; i < NUM_BENCHMARK_BONES; ++i)
+    {
+        AnimationTrack* track = animation->CreateTrack("Bone" + std::to_string(i));
+        track->channelMask = CHANNEL_POSITION | CHANNEL_ROTATION;
+
+        for (size_t j = 0; j <= 60; ++j)
+        {
+            AnimationKeyFrame keyFrame;
+            keyFrame.time = j * (2.0f / 60.0f);
+            keyFrame.position = i ? Vector3(0.0f, 0.25f, 0.0f) : Vector3::ZERO;
+            keyFrame.rotation = Quaternion(20.0f * Sin(j * 6.0f + i * 10.0f), Vector3::FORWARD);
+            track->keyFrames.push_back(keyFrame);
+        }
+    }
+
+    if (compressed)
+        animation->Compress();
+
+    return animation;
+}
+
+/// Create static models with random placement into a scene.
+static void CreateDrawables(Scene* scene, Model* model, size_t count, std::vector<StaticModel*>* result = nullptr)
+{
+    SetRandomSeed(1);
+
+    std::vector<Vector3> positions;
+    for (size_t i = 0; i < count; ++i)
+        positions.push_back(Vector3(Random() * 500.0f - 250.0f, Random() * 20.0f, Random() * 500.0f - 250.0f));
+
+    StaticModel::CreateInstances(scene, positions, std::vector<Quaternion>(), std::vector<Vector3>(1, Vector3(2.0f, 2.0f, 2.0f)), model, nullptr, result);
+}
+
+BENCHMARK(Frustum_IsInside)
+{
+    std::vector<BoundingBox> boxes = RandomBoxes(NUM_CULL_BOXES, 500.0f);
+    Frustum frustum = BenchmarkFrustum();
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        unsigned inside = 0;
+        for (size_t i = 0; i < boxes.size(); ++i)
+            inside += frustum.IsInside(boxes[i]);
+        DoNotOptimize(inside);
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * boxes.size());
+}
+
+BENCHMARK(Frustum_IsInsideFast)
+{
+    std::vector<BoundingBox> boxes = RandomBoxes(NUM_CULL_BOXES, 500.0f);
+    Frustum frustum = BenchmarkFrustum();
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        unsigned inside = 0;
+        for (size_t i = 0; i < boxes.size(); ++i)
+            inside += frustum.IsInsideFast(boxes[i]);
+        DoNotOptimize(inside);
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * boxes.size());
+}
+
+BENCHMARK(Frustum_IsInsideMaskedFast)
+{
+    std::vector<BoundingBox> boxes = RandomBoxes(NUM_CULL_BOXES, 500.0f);
+    Frustum frustum = BenchmarkFrustum();
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        unsigned inside = 0;
+        for (size_t i = 0; i < boxes.size(); ++i)
+            inside += frustum.IsInsideMaskedFast(boxes[i]);
+        DoNotOptimize(inside);
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * boxes.size());
+}
+
+BENCHMARK(Frustum_IsInsideMaskedFastPack)
+{
+    std::vector<BoundingBox> boxes = RandomBoxes(NUM_CULL_BOXES, 500.0f);
+    std::vector<BoundingBoxPack> packs(boxes.size() / BOUNDING_BOX_PACK_SIZE);
+    for (size_t i = 0; i < boxes.size(); ++i)
+        packs[i / BOUNDING_BOX_PACK_SIZE].Set(i % BOUNDING_BOX_PACK_SIZE, boxes[i]);
+
+    Frustum frustum = BenchmarkFrustum();
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        unsigned inside = 0;
+        for (size_t i = 0; i < packs.size(); ++i)
+            inside += frustum.IsInsideMaskedFast(packs[i]);
+        DoNotOptimize(inside);
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * boxes.size());
+}
+
+/// Sort batches with a mix of passes and geometries, optionally converting to instanced.
+static void SortBatches(BenchmarkState& state, BatchSortMode sortMode, bool convertToInstanced, bool threaded)
+{
+    SetRandomSeed(1);
+
+    std::vector<SharedPtr<Material> > materials;
+    std::vector<SharedPtr<Geometry> > geometries;
+    for (size_t i = 0; i < 32; ++i)
+    {
+        materials.push_back(SharedPtr<Material>(new Material()));
+        materials.back()->CreatePass(PASS_OPAQUE);
+    }
+    for (size_t i = 0; i < 64; ++i)
+        geometries.push_back(SharedPtr<Geometry>(new Geometry()));
+
+    std::vector<Matrix3x4> transforms(NUM_SORT_BATCHES, Matrix3x4::IDENTITY);
+    std::vector<Batch> batches(NUM_SORT_BATCHES);
+    for (size_t i = 0; i < batches.size(); ++i)
+    {
+        Batch& batch = batches[i];
+        batch.distance = Random() * 500.0f;
+        batch.staticIndex = M_MAX_UNSIGNED;
+        batch.SetPass(materials[Rand() % materials.size()]->GetPass(PASS_OPAQUE));
+        batch.geometry = geometries[Rand() % geometries.size()];
+        batch.programBits = 0;
+        batch.geomIndex = 0;
+        batch.lodFade = 0.0f;
+        batch.worldTransform = &transforms[i];
+    }
+
+    std::vector<BatchRange> ranges(1);
+    ranges[0].batches = &batches[0];
+    ranges[0].count = batches.size();
+
+    BatchQueue queue;
+    std::vector<Matrix3x4> instanceTransforms;
+    WorkQueue* workQueue = threaded ? Object::Subsystem<WorkQueue>() : nullptr;
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        instanceTransforms.clear();
+        queue.SortRanges(ranges, instanceTransforms, sortMode, convertToInstanced, nullptr, workQueue);
+        DoNotOptimize(queue.batches[0]);
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * batches.size());
+}
+
+BENCHMARK(BatchQueue_SortState)
+{
+    SortBatches(state, SORT_STATE, false, false);
+}
+
+BENCHMARK(BatchQueue_SortStateInstanced)
+{
+    SortBatches(state, SORT_STATE, true, false);
+}
+
+BENCHMARK(BatchQueue_SortDistance)
+{
+    SortBatches(state, SORT_DISTANCE, false, false);
+}
+
+BENCHMARK(BatchQueue_SortStateThreaded)
+{
+    SortBatches(state, SORT_STATE, true, true);
+}
+
+BENCHMARK(Octree_UpdateReinsert)
+{
+    Scene scene;
+    Octree* octree = scene.CreateChild<Octree>();
+    SharedPtr<Model> model = BoxModel();
+    std::vector<StaticModel*> objects;
+    CreateDrawables(&scene, model, NUM_OCTREE_DRAWABLES, &objects);
+    octree->Update(0);
+
+    std::vector<Vector3> velocities;
+    for (size_t i = 0; i < objects.size(); ++i)
+        velocities.push_back(Vector3(Random() * 2.0f - 1.0f, 0.0f, Random() * 2.0f - 1.0f));
+
+    unsigned short frameNumber = 1;
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        // Moving the objects queues their reinsertion. Reverse direction every other frame to stay within the octree
+        state.PauseTiming();
+        float sign = (frameNumber & 1) ? 1.0f : -1.0f;
+        for (size_t i = 0; i < objects.size(); ++i)
+            objects[i]->Translate(sign * velocities[i], TS_WORLD);
+        state.ResumeTiming();
+
+        octree->Update(frameNumber++);
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * objects.size());
+}
+
+BENCHMARK(Octree_FindDrawablesFrustum)
+{
+    Scene scene;
+    Octree* octree = scene.CreateChild<Octree>();
+    SharedPtr<Model> model = BoxModel();
+    CreateDrawables(&scene, model, NUM_OCTREE_DRAWABLES);
+    octree->Update(0);
+
+    Frustum frustum = BenchmarkFrustum();
+    std::vector<Drawable*> result;
+
+    while (state.KeepRunning())
+    {
+        result.clear();
+        octree->FindDrawablesMasked(result, frustum, DF_GEOMETRY);
+        DoNotOptimize(result.size());
+    }
+}
+
+BENCHMARK(Octree_FindDrawablesStaticBvh)
+{
+    Scene scene;
+    Octree* octree = scene.CreateChild<Octree>();
+    octree->SetStaticBvh(true);
+    SharedPtr<Model> model = BoxModel();
+    std::vector<StaticModel*> objects;
+    CreateDrawables(&scene, model, NUM_OCTREE_DRAWABLES, &objects);
+    for (auto it = objects.begin(); it != objects.end(); ++it)
+        (*it)->SetStatic(true);
+    octree->Update(0);
+
+    Frustum frustum = BenchmarkFrustum();
+    std::vector<Drawable*> result;
+
+    while (state.KeepRunning())
+    {
+        result.clear();
+        octree->FindDrawablesMasked(result, frustum, DF_GEOMETRY);
+        DoNotOptimize(result.size());
+    }
+}
+
+BENCHMARK(Octree_RaycastSingle)
+{
+    Scene scene;
+    Octree* octree = scene.CreateChild<Octree>();
+    SharedPtr<Model> model = BoxModel();
+    CreateDrawables(&scene, model, NUM_OCTREE_DRAWABLES);
+    octree->Update(0);
+
+    std::vector<Ray> rays;
+    for (size_t i = 0; i < 256; ++i)
+        rays.push_back(Ray(Vector3(0.0f, 30.0f, 0.0f), Vector3(Random() * 2.0f - 1.0f, -Random(), Random() * 2.0f - 1.0f).Normalized()));
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        for (auto it = rays.begin(); it != rays.end(); ++it)
+        {
+            RaycastResult result = octree->RaycastSingle(*it, DF_GEOMETRY);
+            DoNotOptimize(result.distance);
+        }
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * rays.size());
+}
+
+BENCHMARK(Octree_Raycast)
+{
+    Scene scene;
+    Octree* octree = scene.CreateChild<Octree>();
+    SharedPtr<Model> model = BoxModel();
+    CreateDrawables(&scene, model, NUM_OCTREE_DRAWABLES);
+    octree->Update(0);
+
+    std::vector<Ray> rays;
+    for (size_t i = 0; i < 256; ++i)
+        rays.push_back(Ray(Vector3(0.0f, 30.0f, 0.0f), Vector3(Random() * 2.0f - 1.0f, -Random(), Random() * 2.0f - 1.0f).Normalized()));
+    std::vector<RaycastResult> result;
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        for (auto it = rays.begin(); it != rays.end(); ++it)
+        {
+            octree->Raycast(result, *it, DF_GEOMETRY);
+            DoNotOptimize(result.size());
+        }
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * rays.size());
+}
+
+/// Apply animation and update skinning of animated models, which update regardless of visibility.
+static void UpdateAnimation(BenchmarkState& state, bool compressed)
+{
+    Scene scene;
+    SharedPtr<Model> model = SkeletonModel();
+    SharedPtr<Animation> animation = SkeletonAnimation(compressed);
+
+    std::vector<AnimatedModel*> objects;
+    for (size_t i = 0; i < NUM_ANIMATED_MODELS; ++i)
+    {
+        AnimatedModel* object = scene.CreateChild<AnimatedModel>();
+        object->SetModel(model);
+        object->SetUpdateInvisible(true);
+        AnimationState* animState = object->AddAnimationState(animation);
+        animState->SetWeight(1.0f);
+        animState->SetLooped(true);
+        animState->SetTime(i * 0.01f);
+        objects.push_back(object);
+    }
+
+    unsigned short frameNumber = 1;
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+        {
+            AnimatedModel* object = *it;
+            object->AnimationStates()[0]->AddTime(1.0f / 60.0f);
+            object->GetDrawable()->OnOctreeUpdate(frameNumber);
+        }
+        ++frameNumber;
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * objects.size());
+}
+
+BENCHMARK(Animation_ApplyAndSkin)
+{
+    UpdateAnimation(state, false);
+}
+
+BENCHMARK(Animation_ApplyAndSkinCompressed)
+{
+    UpdateAnimation(state, true);
+}
+
+/// Empty task function.
+static void EmptyWork(Task*, unsigned)
+{
+}
+
+BENCHMARK(WorkQueue_EmptyTasks)
+{
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    std::vector<AutoPtr<FunctionTask> > tasks;
+    std::vector<Task*> taskPtrs;
+    for (size_t i = 0; i < NUM_EMPTY_TASKS; ++i)
+    {
+        tasks.push_back(new FunctionTask(EmptyWork));
+        taskPtrs.push_back(tasks.back());
+    }
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        workQueue->QueueTasks(taskPtrs.size(), &taskPtrs[0]);
+        workQueue->Complete();
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * tasks.size());
+}
+
+BENCHMARK(WorkQueue_SingleTaskLatency)
+{
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    FunctionTask task(EmptyWork);
+
+    while (state.KeepRunning())
+    {
+        workQueue->QueueTask(&task);
+        workQueue->Complete();
+    }
+}
+
+BENCHMARK(WorkQueue_DependencyChain)
+{
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    std::vector<AutoPtr<FunctionTask> > tasks;
+    for (size_t i = 0; i < TASK_CHAIN_LENGTH; ++i)
+        tasks.push_back(new FunctionTask(EmptyWork));
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        // Dependencies are consumed by each execution
+        for (size_t i = 1; i < tasks.size(); ++i)
+            tasks[i]->AddDependency(tasks[i - 1]);
+
+        workQueue->QueueTask(tasks[0]);
+        workQueue->Complete();
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * tasks.size());
+}
+
+BENCHMARK(WorkQueue_ParallelFor)
+{
+    WorkQueue* workQueue = Object::Subsystem<WorkQueue>();
+    std::vector<float> values(1024 * 1024, 1.0f);
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        workQueue->ParallelFor(0, values.size(), 16384, [&](size_t start, size_t end, unsigned)
+        {
+            for (size_t i = start; i < end; ++i)
+                values[i] = values[i] * 0.5f + 0.5f;
+        });
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * values.size());
+}
+
+/// Create agents scattered on the XZ plane into a scene and the spatial hash.
+static void CreateAgents(Scene* scene, SpatialHash* spatialHash, std::vector<SpatialNode*>& agents)
+{
+    SetRandomSeed(1);
+
+    for (size_t i = 0; i < NUM_SPATIAL_HASH_AGENTS; ++i)
+    {
+        SpatialNode* agent = scene->CreateChild<SpatialNode>();
+        agent->SetPosition(Vector3(Random() * 500.0f - 250.0f, 0.0f, Random() * 500.0f - 250.0f));
+        spatialHash->AddNode(agent);
+        agents.push_back(agent);
+    }
+}
+
+BENCHMARK(SpatialHash_Update)
+{
+    Scene scene;
+    SpatialHash spatialHash;
+    std::vector<SpatialNode*> agents;
+    CreateAgents(&scene, &spatialHash, agents);
+
+    std::vector<Vector3> velocities;
+    for (size_t i = 0; i < agents.size(); ++i)
+        velocities.push_back(Vector3(Random() * 2.0f - 1.0f, 0.0f, Random() * 2.0f - 1.0f));
+
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        // Reverse direction every other iteration to stay within the area
+        state.PauseTiming();
+        float sign = (iterations & 1) ? -1.0f : 1.0f;
+        for (size_t i = 0; i < agents.size(); ++i)
+            agents[i]->Translate(sign * velocities[i], TS_WORLD);
+        state.ResumeTiming();
+
+        spatialHash.Update();
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * agents.size());
+}
+
+BENCHMARK(SpatialHash_FindNearestBatch)
+{
+    Scene scene;
+    SpatialHash spatialHash;
+    std::vector<SpatialNode*> agents;
+    CreateAgents(&scene, &spatialHash, agents);
+
+    std::vector<Vector3> positions;
+    for (auto it = agents.begin(); it != agents.end(); ++it)
+        positions.push_back((*it)->WorldPosition());
+    std::vector<SpatialNode*> results;
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        spatialHash.FindNearestBatch(results, positions, NUM_NEAREST_NEIGHBORS);
+        DoNotOptimize(results.back());
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * positions.size());
+}
+
+BENCHMARK(SpatialHash_FindNodesBatch)
+{
+    Scene scene;
+    SpatialHash spatialHash;
+    std::vector<SpatialNode*> agents;
+    CreateAgents(&scene, &spatialHash, agents);
+
+    std::vector<Vector3> positions;
+    for (auto it = agents.begin(); it != agents.end(); ++it)
+        positions.push_back((*it)->WorldPosition());
+    std::vector<std::vector<SpatialNode*> > results;
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        spatialHash.FindNodesBatch(results, positions, 10.0f);
+        DoNotOptimize(results.back().size());
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * positions.size());
+}
+
+/// Create groups of named spatial nodes, and pick random names to look up.
+static void CreateNamedNodes(Scene* scene, std::vector<std::string>& lookupNames)
+{
+    SetRandomSeed(1);
+
+    for (size_t i = 0; i < NUM_NAMED_GROUPS; ++i)
+    {
+        Node* group = scene->CreateChild<Node>("Group" + std::to_string(i));
+        for (size_t j = 0; j < NUM_NAMED_GROUP_NODES; ++j)
+            group->CreateChild<SpatialNode>("Node" + std::to_string(i * NUM_NAMED_GROUP_NODES + j));
+    }
+
+    for (size_t i = 0; i < NUM_NAME_LOOKUPS; ++i)
+        lookupNames.push_back("Node" + std::to_string(Random((int)(NUM_NAMED_GROUPS * NUM_NAMED_GROUP_NODES))));
+}
+
+static void FindNodesByName(BenchmarkState& state, bool useIndex)
+{
+    Scene scene;
+    std::vector<std::string> lookupNames;
+    CreateNamedNodes(&scene, lookupNames);
+    scene.SetNodeIndex(useIndex);
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        for (auto it = lookupNames.begin(); it != lookupNames.end(); ++it)
+            DoNotOptimize(scene.FindChild(*it, true));
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * lookupNames.size());
+}
+
+BENCHMARK(Scene_FindChildByName)
+{
+    FindNodesByName(state, false);
+}
+
+BENCHMARK(Scene_FindChildByNameIndexed)
+{
+    FindNodesByName(state, true);
+}
+
+BENCHMARK(Scene_FindChildrenByTypeIndexed)
+{
+    Scene scene;
+    std::vector<std::string> lookupNames;
+    CreateNamedNodes(&scene, lookupNames);
+    scene.SetNodeIndex(true);
+    std::vector<SpatialNode*> results;
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        results.clear();
+        scene.FindChildren(results, true);
+        DoNotOptimize(results.back());
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * results.size());
+}
+
+/// Return an RGBA image with random noise over smooth gradients.
+static void RandomImage(Image& image, int size)
+{
+    SetRandomSeed(1);
+
+    std::vector<unsigned char> data(size * size * 4);
+    for (int y = 0; y < size; ++y)
+    {
+        for (int x = 0; x < size; ++x)
+        {
+            unsigned char* pixel = &data[(y * size + x) * 4];
+            pixel[0] = (unsigned char)(x * 255 / size);
+            pixel[1] = (unsigned char)(y * 255 / size);
+            pixel[2] = (unsigned char)(Rand() & 0xff);
+            pixel[3] = 255;
+        }
+    }
+
+    image.SetSize(IntVector2(size, size), FMT_RGBA8);
+    image.SetData(&data[0]);
+}
+
+BENCHMARK(Image_GenerateMipImageBox)
+{
+    Image image;
+    RandomImage(image, 1024);
+    Image mip;
+
+    while (state.KeepRunning())
+        image.GenerateMipImage(mip);
+}
+
+BENCHMARK(Image_GenerateMipImageKaiser)
+{
+    Image image;
+    RandomImage(image, 1024);
+    Image mip;
+
+    while (state.KeepRunning())
+        image.GenerateMipImage(mip, MIP_FILTER_KAISER);
+}
+
+/// Decompress a DXT compressed random image.
+static void DecompressImage(BenchmarkState& state, ImageFormat format)
+{
+    Image image;
+    RandomImage(image, 1024);
+    Image compressed;
+    if (!image.Compress(compressed, format))
+        return;
+
+    std::vector<unsigned char> dest(1024 * 1024 * 4);
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        compressed.DecompressLevel(&dest[0], 0);
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * 1024 * 1024);
+}
+
+BENCHMARK(Image_DecompressDXT1)
+{
+    DecompressImage(state, FMT_DXT1);
+}
+
+BENCHMARK(Image_DecompressDXT5)
+{
+    DecompressImage(state, FMT_DXT5);
+}
+
+BENCHMARK(JSON_Parse)
+{
+    SetRandomSeed(1);
+
+    // Scene-like document of nested objects with numbers, strings and arrays
+    JSONValue root;
+    root.SetEmptyArray();
+    for (size_t i = 0; i < 5000; ++i)
+    {
+        JSONValue node;
+        node["type"] = "StaticModel";
+        node["name"] = "Node" + std::to_string(i);
+        node["position"] = Vector3(Random(), Random(), Random()).ToString();
+        node["castShadows"] = (i & 1) != 0;
+        node["lodBias"] = Random();
+        JSONValue children;
+        children.SetEmptyArray();
+        for (size_t j = 0; j < 4; ++j)
+            children.Push((int)(i * 4 + j));
+        node["children"] = children;
+        root.Push(node);
+    }
+
+    std::string text = root.ToString();
+    JSONValue parsed;
+    size_t iterations = 0;
+
+    while (state.KeepRunning())
+    {
+        parsed.FromString(text);
+        ++iterations;
+    }
+
+    state.SetItemsProcessed(iterations * text.length());
+}
+
+int main(int argc, char** argv)
+{
+    const std::vector<std::string>& arguments = ParseArguments(argc, argv);
+
+    std::string filter;
+    std::string outputFile;
+    float minTime = 0.5f;
+    bool useThreads = true;
+
+    for (size_t i = 1; i < arguments.size(); ++i)
+    {
+        if (arguments[i] == "-filter" && i + 1 < arguments.size())
+            filter = arguments[++i];
+        else if (arguments[i] == "-json" && i + 1 < arguments.size())
+            outputFile = arguments[++i];
+        else if (arguments[i] == "-mintime" && i + 1 < arguments.size())
+            minTime = Max(ParseFloat(arguments[++i]), 0.0f);
+        else if (arguments[i] == "-nothreads")
+            useThreads = false;
+        else
+        {
+            printf("Usage: Turso3DMicroBench [options]\n"
+                "Runs the core kernel benchmarks without a graphics context.\n"
+                "Options:\n"
+                "-filter <name>   Run only benchmarks whose name contains the string\n"
+                "-json <file>     Write results to a JSON file\n"
+                "-mintime <sec>   Minimum timed duration per benchmark, default 0.5\n"
+                "-nothreads       Disable worker threads\n");
+            return 1;
+        }
+    }
+
+    AutoPtr<WorkQueue> workQueue = new WorkQueue(useThreads ? 0 : 1);
+    AutoPtr<Log> log = new Log();
+    log->SetLevel(LOG_WARNING);
+    // The default material loads its shaders' source, which needs no graphics context
+    AutoPtr<ResourceCache> cache = new ResourceCache();
+    cache->AddResourceDir(ExecutableDir() + "Data");
+    RegisterGraphicsLibrary();
+    RegisterRendererLibrary();
+
+    std::vector<BenchmarkResult> results = RunBenchmarks(filter, minTime);
+
+    if (outputFile.length() && !WriteBenchmarkResults(outputFile, results))
+    {
+        fprintf(stderr, "Could not write %s\n", outputFile.c_str());
+        return 1;
+    }
+
+    return 0;
+}
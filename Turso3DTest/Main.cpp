@@ -1,28 +1,43 @@
 #include "Graphics/FrameBuffer.h"
 #include "Graphics/Graphics.h"
+#include "Graphics/Sampler.h"
+#include "Graphics/ShaderProgram.h"
 #include "Graphics/Texture.h"
 #include "Input/Input.h"
 #include "IO/Arguments.h"
+#include "IO/File.h"
 #include "IO/FileSystem.h"
 #include "IO/Log.h"
 #include "IO/StringUtils.h"
 #include "Math/Math.h"
 #include "Math/Random.h"
+#include "Object/EventQueue.h"
+#include "Renderer/AmbientOcclusion.h"
 #include "Renderer/AnimatedModel.h"
 #include "Renderer/Animation.h"
 #include "Renderer/AnimationState.h"
 #include "Renderer/Camera.h"
+#include "Renderer/Crowd.h"
 #include "Renderer/DebugRenderer.h"
+#include "Renderer/Decal.h"
+#include "Renderer/DynamicResolution.h"
+#include "Renderer/FrameGraph.h"
 #include "Renderer/Light.h"
 #include "Renderer/Material.h"
 #include "Renderer/Model.h"
 #include "Renderer/Octree.h"
+#include "Renderer/ParticleEmitter.h"
 #include "Renderer/Renderer.h"
+#include "Resource/Image.h"
 #include "Resource/ResourceCache.h"
 #include "Renderer/StaticModel.h"
+#include "Renderer/Terrain.h"
+#include "Renderer/VertexAnimation.h"
 #include "Scene/Scene.h"
+#include "Scene/WorldStreamer.h"
 #include "Time/Timer.h"
 #include "Time/Profiler.h"
+#include "Time/TraceRecorder.h"
 #include "Thread/ThreadUtils.h"
 
 #include <SDL.h>
@@ -30,44 +45,118 @@
 
 std::vector<StaticModel*> rotatingObjects;
 std::vector<AnimatedModel*> animatingObjects;
+std::vector<ParticleEmitter*> particleEmitters;
+std::vector<Crowd*> crowds;
+WeakPtr<VertexAnimation> crowdAnimation;
+unsigned numParticles = 0;
+bool useTerrain = false;
+bool useDecals = false;
+bool useCrowd = false;
+float lodFadeBand = 0.0f;
+float impostorDistance = 0.0f;
+Quaternion objectRotation = Quaternion::IDENTITY;
+
+const UniformSlot U_WORLDVIEWPROJMATRIX = ShaderProgram::RegisterUniform("worldViewProjMatrix");
+
+/// Rotate a box of the first preset to the current rotation. Called in parallel by the scene update.
+void RotateObject(Node* node, float)
+{
+    static_cast<StaticModel*>(node)->SetRotation(objectRotation);
+}
+
+/// Advance the animation of a walker and move it forward, turning near the edges of the plane. Called in parallel by the scene update.
+void AnimateObject(Node* node, float dt)
+{
+    AnimatedModel* object = static_cast<AnimatedModel*>(node);
+    AnimationState* state = object->AnimationStates()[0];
+    state->AddTime(dt);
+    object->Translate(Vector3::FORWARD * 2.0f * dt);
+
+    // Rotate to avoid going outside the plane
+    Vector3 pos = object->Position();
+    if (pos.x < -45.0f || pos.x > 45.0f || pos.z < -45.0f || pos.z > 45.0f)
+        object->Yaw(45.0f * dt);
+}
 
 void CreateScene(Scene* scene, int preset)
 {
     rotatingObjects.clear();
     animatingObjects.clear();
+    particleEmitters.clear();
+    crowds.clear();
 
     ResourceCache* cache = Object::Subsystem<ResourceCache>();
 
     scene->Clear();
-    scene->CreateChild<Octree>();
+    Octree* octree = scene->CreateChild<Octree>();
+    octree->SetStaticBvh(true);
 
     SetRandomSeed(1);
 
     if (preset == 0)
     {
-        for (int y = -55; y <= 55; ++y)
+        // Spawn the floor and mushrooms in bulk
+        std::vector<Vector3> positions;
+        std::vector<StaticModel*> objects;
+        Terrain* terrain = nullptr;
+        if (useTerrain)
         {
-            for (int x = -55; x <= 55; ++x)
+            // Procedural rolling hills in place of the floor, as no heightmap ships with the test data
+            const int numPatches = 5;
+            const int patchSize = 256;
+            const int size = numPatches * patchSize + 1;
+
+            std::vector<float> heights(size * size);
+            for (int z = 0; z < size; ++z)
             {
-                StaticModel* object = scene->CreateChild<StaticModel>();
-                object->SetStatic(true);
-                object->SetPosition(Vector3(10.5f * x, -0.05f, 10.5f * y));
-                object->SetScale(Vector3(10.0f, 0.1f, 10.0f));
-                object->SetModel(cache->LoadResource<Model>("Box.mdl"));
-                object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
+                for (int x = 0; x < size; ++x)
+                    heights[z * size + x] = 0.5f + 0.3f * sinf(x * 0.021f) * cosf(z * 0.017f) + 0.15f * sinf((x + 2 * z) * 0.053f);
+            }
+
+            SharedPtr<Image> heightMap(new Image());
+            heightMap->SetSize(IntVector2(size, size), FMT_R32F);
+            heightMap->SetData(reinterpret_cast<unsigned char*>(&heights[0]));
+
+            terrain = scene->CreateChild<Terrain>();
+            terrain->SetNumPatches(IntVector2(numPatches, numPatches));
+            terrain->SetPatchSize(patchSize);
+            terrain->SetSpacing(Vector3(1.0f, 8.0f, 1.0f));
+            terrain->SetPosition(Vector3(-0.5f * numPatches * patchSize, -4.0f, -0.5f * numPatches * patchSize));
+            terrain->SetHeightMap(heightMap);
+        }
+        else
+        {
+            for (int y = -55; y <= 55; ++y)
+            {
+                for (int x = -55; x <= 55; ++x)
+                    positions.push_back(Vector3(10.5f * x, -0.05f, 10.5f * y));
             }
+
+            StaticModel::CreateInstances(scene, positions, std::vector<Quaternion>(), std::vector<Vector3>(1, Vector3(10.0f, 0.1f, 10.0f)),
+                cache->LoadResource<Model>("Box.mdl"), cache->LoadResource<Material>("Stone.json"), &objects);
+            for (auto it = objects.begin(); it != objects.end(); ++it)
+                (*it)->SetStatic(true);
         }
 
+        positions.clear();
+        objects.clear();
         for (unsigned i = 0; i < 10000; ++i)
         {
-            StaticModel* object = scene->CreateChild<StaticModel>();
+            float x = Random() * 1000.0f - 500.0f;
+            float z = Random() * 1000.0f - 500.0f;
+            positions.push_back(Vector3(x, terrain ? terrain->Height(Vector3(x, 0.0f, z)) : 0.0f, z));
+        }
+
+        StaticModel::CreateInstances(scene, positions, std::vector<Quaternion>(), std::vector<Vector3>(1, Vector3(1.5f, 1.5f, 1.5f)),
+            cache->LoadResource<Model>("Mushroom.mdl"), cache->LoadResource<Material>("Mushroom.json"), &objects);
+        for (auto it = objects.begin(); it != objects.end(); ++it)
+        {
+            StaticModel* object = *it;
             object->SetStatic(true);
-            object->SetPosition(Vector3(Random() * 1000.0f - 500.0f, 0.0f, Random() * 1000.0f - 500.0f));
-            object->SetScale(1.5f);
-            object->SetModel(cache->LoadResource<Model>("Mushroom.mdl"));
-            object->SetMaterial(cache->LoadResource<Material>("Mushroom.json"));
             object->SetCastShadows(true);
             object->SetLodBias(2.0f);
+            object->SetLodFadeBand(lodFadeBand);
+            object->SetImpostorDistance(impostorDistance);
             object->SetMaxDistance(600.0f);
         }
 
@@ -80,11 +169,26 @@ void CreateScene(Scene* scene, int preset)
             Vector3 colorVec = 2.0f * Vector3(Random(), Random(), Random()).Normalized();
             light->SetColor(Color(colorVec.x, colorVec.y, colorVec.z));
             light->SetRange(40.0f);
-            light->SetPosition(Vector3(Random() * 1000.0f - 500.0f, 7.0f, Random() * 1000.0f - 500.0f));
+            float x = Random() * 1000.0f - 500.0f;
+            float z = Random() * 1000.0f - 500.0f;
+            light->SetPosition(Vector3(x, (terrain ? terrain->Height(Vector3(x, 0.0f, z)) : 0.0f) + 7.0f, z));
             light->SetShadowMapSize(256);
             light->SetShadowMaxDistance(200.0f);
             light->SetMaxDistance(900.0f);
         }
+
+        // Decals projected from the mushroom texture onto the floor, applied through the light clusters
+        for (unsigned i = 0; useDecals && i < 2000; ++i)
+        {
+            float x = Random() * 1000.0f - 500.0f;
+            float z = Random() * 1000.0f - 500.0f;
+            Decal* decal = scene->CreateChild<Decal>();
+            decal->SetStatic(true);
+            decal->SetPosition(Vector3(x, terrain ? terrain->Height(Vector3(x, 0.0f, z)) : 0.0f, z));
+            decal->SetRotation(Quaternion(Random(360.0f), Vector3::UP));
+            decal->SetScale(Vector3(4.0f, 2.0f, 4.0f));
+            decal->SetMaxDistance(300.0f);
+        }
     }
     else if (preset == 1)
     {
@@ -97,6 +201,7 @@ void CreateScene(Scene* scene, int preset)
                 object->SetPosition(Vector3(x * 0.3f, 0.0f, y * 0.3f));
                 object->SetScale(0.25f);
                 object->SetModel(cache->LoadResource<Model>("Box.mdl"));
+                scene->SetUpdateCallback(object, UPDATE_VARIABLE, RotateObject);
                 rotatingObjects.push_back(object);
             }
         }
@@ -132,9 +237,39 @@ void CreateScene(Scene* scene, int preset)
             AnimationState* state = object->AddAnimationState(cache->LoadResource<Animation>("Jack_Walk.ani"));
             state->SetWeight(1.0f);
             state->SetLooped(true);
+            scene->SetUpdateCallback(object, UPDATE_VARIABLE, AnimateObject);
             animatingObjects.push_back(object);
         }
 
+        // Vertex animated crowd surrounding the plane, which the animated models also switch to in the distance
+        if (useCrowd)
+        {
+            Model* jackModel = cache->LoadResource<Model>("Jack.mdl");
+            Animation* walkAnimation = cache->LoadResource<Animation>("Jack_Walk.ani");
+            // Keep only a weak reference in between, so that the vertex animation does not outlive the graphics subsystem
+            SharedPtr<VertexAnimation> vertexAnimation(crowdAnimation.Get());
+            if (!vertexAnimation || vertexAnimation->GetModel() != jackModel)
+            {
+                vertexAnimation = new VertexAnimation();
+                vertexAnimation->Bake(jackModel, std::vector<Animation*>(1, walkAnimation));
+                crowdAnimation = vertexAnimation;
+            }
+
+            for (int i = 0; i < 4; ++i)
+            {
+                Crowd* crowd = scene->CreateChild<Crowd>();
+                crowd->SetPosition(Vector3((i & 1) ? 100.0f : -100.0f, 0.0f, (i & 2) ? 100.0f : -100.0f));
+                crowd->SetVertexAnimation(vertexAnimation);
+                crowd->SetCastShadows(true);
+                for (int j = 0; j < 10000; ++j)
+                    crowd->AddInstance(Vector3(Random() * 90.0f - 45.0f, 0.0f, Random() * 90.0f - 45.0f), Quaternion(Random(360.0f), Vector3::UP), 1.0f, 0, Random(), Random(0.8f, 1.2f));
+                crowds.push_back(crowd);
+            }
+
+            for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
+                (*it)->SetCrowdLod(crowds[0], 40.0f);
+        }
+
         Light* light = scene->CreateChild<Light>();
         light->SetLightType(LIGHT_DIRECTIONAL);
         light->SetCastShadows(true);
@@ -143,26 +278,195 @@ void CreateScene(Scene* scene, int preset)
         light->SetShadowMapSize(2048);
         light->SetShadowMaxDistance(100.0f);
     }
+
+    // Particle fountains around the origin, simulated on the GPU
+    for (unsigned i = 0; numParticles && i < 4; ++i)
+    {
+        ParticleEmitter* emitter = scene->CreateChild<ParticleEmitter>();
+        emitter->SetPosition(Vector3((i & 1) ? 10.0f : -10.0f, 0.0f, (i & 2) ? 10.0f : -10.0f));
+        emitter->SetMaxParticles(numParticles / 4);
+        emitter->SetVelocity(Vector3(0.0f, 10.0f, 0.0f));
+        emitter->SetVelocitySpread(2.0f);
+        emitter->SetAcceleration(Vector3(0.0f, -9.81f, 0.0f));
+        emitter->SetParticleSize(Vector2(0.1f, 0.05f));
+        particleEmitters.push_back(emitter);
+    }
 }
 
 int ApplicationMain(const std::vector<std::string>& arguments)
 {
     bool useThreads = true;
+    bool usePipelining = false;
+    bool useAsyncLoading = false;
+    bool useUploadBudget = false;
+    bool useUploadThread = false;
+    bool useTextureStreaming = false;
+    bool useTextureBudget = false;
+    bool useResourceBudget = false;
+    bool useAutoReload = false;
+    bool useProgramCache = false;
+    bool usePrecompile = false;
+    bool useCompactTransforms = false;
+    bool useWorldStreaming = false;
+    bool useFastMath = false;
+    bool useGpuTimers = false;
+    bool useHitchDetection = false;
+    bool useSchedulerStats = false;
+    bool useAsyncLog = false;
+    bool useTemporalSSAO = false;
+    bool useDynamicResolution = false;
+    bool useStereo = false;
+    bool useDeferred = false;
+    bool useOIT = false;
+    bool useLateLatch = false;
+    bool useAdaptiveVSync = false;
+    bool useFrameLimit = false;
+    bool useSmoothTime = false;
+    bool useJitterReporting = false;
+    bool useFarLightLimit = false;
+    bool useStaticBatches = false;
+    bool useHlod = false;
+    bool useLightHierarchy = false;
+    bool useStaticCasters = false;
 
     if (arguments.size() > 1 && arguments[1].find("nothreads") != std::string::npos)
         useThreads = false;
+    if (arguments.size() > 1 && arguments[1].find("pipeline") != std::string::npos)
+        usePipelining = true;
+    if (arguments.size() > 1 && arguments[1].find("asyncload") != std::string::npos)
+        useAsyncLoading = true;
+    if (arguments.size() > 1 && arguments[1].find("uploadbudget") != std::string::npos)
+        useUploadBudget = true;
+    if (arguments.size() > 1 && arguments[1].find("uploadthread") != std::string::npos)
+        useUploadThread = true;
+    if (arguments.size() > 1 && arguments[1].find("texturestreaming") != std::string::npos)
+    {
+        useTextureStreaming = true;
+        Texture::SetDefaultMipStreaming(true);
+    }
+    if (arguments.size() > 1 && arguments[1].find("texturebudget") != std::string::npos)
+        useTextureBudget = true;
+    if (arguments.size() > 1 && arguments[1].find("kaisermips") != std::string::npos)
+        Texture::SetDefaultMipFilter(MIP_FILTER_KAISER, true);
+    if (arguments.size() > 1 && arguments[1].find("autoreload") != std::string::npos)
+        useAutoReload = true;
+    if (arguments.size() > 1 && arguments[1].find("programcache") != std::string::npos)
+        useProgramCache = true;
+    if (arguments.size() > 1 && arguments[1].find("precompileshaders") != std::string::npos)
+    {
+        usePrecompile = true;
+        Material::SetAsyncShaderCompile(true);
+    }
+    if (arguments.size() > 1 && arguments[1].find("resourcebudget") != std::string::npos)
+        useResourceBudget = true;
+    if (arguments.size() > 1 && arguments[1].find("compressvertices") != std::string::npos)
+        Model::SetDefaultVertexCompression(true);
+    if (arguments.size() > 1 && arguments[1].find("positionstreams") != std::string::npos)
+        Model::SetDefaultPositionStreams(true);
+    if (arguments.size() > 1 && arguments[1].find("meshlets") != std::string::npos)
+        Model::SetDefaultMeshletGeneration(true);
+    if (arguments.size() > 1 && arguments[1].find("lodgeneration") != std::string::npos)
+        Model::SetDefaultLodGeneration(4);
+    if (arguments.size() > 1 && arguments[1].find("optimizemeshes") != std::string::npos)
+        Model::SetDefaultMeshOptimization(true, true);
+    if (arguments.size() > 1 && arguments[1].find("lodfade") != std::string::npos)
+        lodFadeBand = 0.25f;
+    if (arguments.size() > 1 && arguments[1].find("impostors") != std::string::npos)
+        impostorDistance = 150.0f;
+    if (arguments.size() > 1 && arguments[1].find("compacttransforms") != std::string::npos)
+        useCompactTransforms = true;
+    if (arguments.size() > 1 && arguments[1].find("worldstreaming") != std::string::npos)
+        useWorldStreaming = true;
+    if (arguments.size() > 1 && arguments[1].find("fastmath") != std::string::npos)
+        useFastMath = true;
+    if (arguments.size() > 1 && arguments[1].find("gputimers") != std::string::npos)
+        useGpuTimers = true;
+    if (arguments.size() > 1 && arguments[1].find("hitch") != std::string::npos)
+        useHitchDetection = true;
+    if (arguments.size() > 1 && arguments[1].find("schedstats") != std::string::npos)
+        useSchedulerStats = true;
+    if (arguments.size() > 1 && arguments[1].find("asynclog") != std::string::npos)
+        useAsyncLog = true;
+    if (arguments.size() > 1 && arguments[1].find("temporalssao") != std::string::npos)
+        useTemporalSSAO = true;
+    if (arguments.size() > 1 && arguments[1].find("dynres") != std::string::npos)
+        useDynamicResolution = useGpuTimers = true;
+    if (arguments.size() > 1 && arguments[1].find("stereo") != std::string::npos)
+        useStereo = true;
+    if (arguments.size() > 1 && arguments[1].find("deferred") != std::string::npos)
+        useDeferred = true;
+    if (arguments.size() > 1 && arguments[1].find("oit") != std::string::npos)
+        useOIT = true;
+    if (arguments.size() > 1 && arguments[1].find("latelatch") != std::string::npos)
+        useLateLatch = true;
+    if (arguments.size() > 1 && arguments[1].find("adaptivevsync") != std::string::npos)
+        useAdaptiveVSync = true;
+    if (arguments.size() > 1 && arguments[1].find("framelimit") != std::string::npos)
+        useFrameLimit = true;
+    if (arguments.size() > 1 && arguments[1].find("smoothdt") != std::string::npos)
+        useSmoothTime = true;
+    if (arguments.size() > 1 && arguments[1].find("jitter") != std::string::npos)
+        useJitterReporting = true;
+    if (arguments.size() > 1 && arguments[1].find("farlights") != std::string::npos)
+        useFarLightLimit = true;
+    if (arguments.size() > 1 && arguments[1].find("staticbatches") != std::string::npos)
+        useStaticBatches = true;
+    if (arguments.size() > 1 && arguments[1].find("hlod") != std::string::npos)
+        useHlod = true;
+    if (arguments.size() > 1 && arguments[1].find("lighthierarchy") != std::string::npos)
+        useLightHierarchy = true;
+    if (arguments.size() > 1 && arguments[1].find("staticcasters") != std::string::npos)
+        useStaticCasters = true;
+    if (arguments.size() > 1 && arguments[1].find("particles") != std::string::npos)
+        numParticles = 1000000;
+    if (arguments.size() > 1 && arguments[1].find("terrain") != std::string::npos)
+        useTerrain = true;
+    if (arguments.size() > 1 && arguments[1].find("decals") != std::string::npos)
+        useDecals = true;
+    if (arguments.size() > 1 && arguments[1].find("crowd") != std::string::npos)
+        useCrowd = true;
 
     // Create subsystems that don't depend on the application window / OpenGL context
     AutoPtr<WorkQueue> workQueue = new WorkQueue(useThreads ? 0 : 1);
+    workQueue->SetInstrumentation(useSchedulerStats);
     AutoPtr<Profiler> profiler = new Profiler();
+    AutoPtr<TraceRecorder> traceRecorder = new TraceRecorder();
+    if (useHitchDetection)
+        profiler->SetHitchDetection(50.0f);
     AutoPtr<Log> log = new Log();
+    log->SetAsync(useAsyncLog);
+    AutoPtr<EventQueue> eventQueue = new EventQueue();
     AutoPtr<ResourceCache> cache = new ResourceCache();
     cache->AddResourceDir(ExecutableDir() + "Data");
+    // Prefer packaged data if it has been built with PackageTool
+    if (FileExists(ExecutableDir() + "Data.pak"))
+        cache->AddPackageFile(ExecutableDir() + "Data.pak", true);
+    cache->SetAutoReload(useAutoReload);
+    if (useResourceBudget)
+    {
+        cache->SetMemoryBudget<Texture>(256 * 1024 * 1024);
+        cache->SetMemoryBudget<Model>(128 * 1024 * 1024);
+    }
 
     // Create the Graphics subsystem to open the application window and initialize OpenGL
     AutoPtr<Graphics> graphics = new Graphics("Turso3D renderer test", IntVector2(1920, 1080));
     if (!graphics->Initialize())
         return 1;
+    if (useUploadBudget)
+        graphics->SetUploadBudget(8 * 1024 * 1024);
+    if (useUploadThread)
+        graphics->SetUploadThread(true);
+    if (useProgramCache)
+        graphics->SetProgramCacheDir(ExecutableDir() + "ProgramCache");
+    if (useGpuTimers && graphics->HasTimerQuery())
+        graphics->SetGpuTimers(true);
+    if (useAdaptiveVSync)
+        graphics->SetPresentMode(PRESENT_ADAPTIVE_VSYNC);
+    if (useFrameLimit)
+        graphics->SetFrameRateLimit(144.0f);
+    if (useSmoothTime)
+        graphics->SetFrameTimeSmoothing(8);
+    graphics->SetJitterReporting(useJitterReporting);
 
     // Create subsystems that depend on the application window / OpenGL
     AutoPtr<Input> input = new Input(graphics->Window());
@@ -170,42 +474,84 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     AutoPtr<DebugRenderer> debugRenderer = new DebugRenderer();
 
     renderer->SetupShadowMaps(1024, 2048, FMT_D16);
+    renderer->SetPipelined(usePipelining);
+    renderer->SetScreenSizeCulling(1.0f, 2.0f);
+    renderer->SetShadowTimeSlicing(4, 32.0f);
+    renderer->SetTextureStreaming(useTextureStreaming);
+    renderer->SetDeferredShading(useDeferred);
+    renderer->SetOrderIndependentTransparency(useOIT);
+    renderer->SetLateLatching(useLateLatch ? 5.0f : 0.0f);
+    if (useFarLightLimit)
+        renderer->SetFarClusterLightLimit(50.0f, 4);
+    renderer->SetStaticBatchCaching(useStaticBatches);
+    if (useHlod)
+        renderer->SetHlodThreshold(48.0f);
+    renderer->SetLightHierarchy(useLightHierarchy);
+    renderer->SetStaticCasterCaching(useStaticCasters);
+    if (useTextureBudget)
+        renderer->SetTextureMemoryBudget(64 * 1024 * 1024);
+    if (useFastMath)
+        renderer->SetFastMath(FAST_MATH_ANIMATION | FAST_MATH_LIGHTS | FAST_MATH_DISTANCES);
+    if (useDecals)
+        renderer->SetDecalAtlas(cache->LoadResource<Texture>("Mushroom.dds"));
     
     // Rendertarget textures
     AutoPtr<FrameBuffer> viewFbo = new FrameBuffer();
-    AutoPtr<FrameBuffer> viewMRTFbo = new FrameBuffer();
-    AutoPtr<FrameBuffer> ssaoFbo = new FrameBuffer();
     AutoPtr<Texture> colorBuffer = new Texture();
-    AutoPtr<Texture> normalBuffer = new Texture();
     AutoPtr<Texture> depthStencilBuffer = new Texture();
-    AutoPtr<Texture> ssaoTexture = new Texture();
+    AutoPtr<FrameGraph> frameGraph = new FrameGraph();
+    AutoPtr<DynamicResolution> dynamicResolution = new DynamicResolution();
+    dynamicResolution->SetEnabled(useDynamicResolution && graphics->GpuTimers());
 
-    // Random noise texture for SSAO
-    unsigned char noiseData[4 * 4 * 4];
-    for (int i = 0; i < 4 * 4; ++i)
-    {
-        Vector3 noiseVec(Random() * 2.0f - 1.0f, Random() * 2.0f - 1.0f, Random() * 2.0f - 1.0f);
-        noiseVec.Normalize();
+    AutoPtr<AmbientOcclusion> ambientOcclusion = new AmbientOcclusion();
+    ambientOcclusion->SetTemporalAccumulation(useTemporalSSAO);
 
-        noiseData[i * 4 + 0] = (unsigned char)(noiseVec.x * 127.0f + 128.0f);
-        noiseData[i * 4 + 1] = (unsigned char)(noiseVec.y * 127.0f + 128.0f);
-        noiseData[i * 4 + 2] = (unsigned char)(noiseVec.z * 127.0f + 128.0f);
-        noiseData[i * 4 + 3] = 0;
+    // Load the resources of all scenes in parallel, so that creating the scenes does not block on them
+    if (useAsyncLoading)
+    {
+        cache->LoadResourceAsync<Model>("Box.mdl");
+        cache->LoadResourceAsync<Model>("Mushroom.mdl");
+        cache->LoadResourceAsync<Model>("Jack.mdl");
+        cache->LoadResourceAsync<Material>("Stone.json");
+        cache->LoadResourceAsync<Material>("Mushroom.json");
+        cache->LoadResourceAsync<Animation>("Jack_Walk.ani");
+        cache->CompleteAsyncLoading();
     }
 
-    ImageLevel noiseDataLevel(IntVector2(4, 4), FMT_RGBA8, &noiseData[0]);
-    AutoPtr<Texture> noiseTexture = new Texture();
-    noiseTexture->Define(TEX_2D, IntVector2(4, 4), FMT_RGBA8, 1, 1, &noiseDataLevel);
-    noiseTexture->DefineSampler(FILTER_POINT);
-
     // Create the scene and camera. Camera is created outside scene so it's not disturbed by scene clears
     AutoPtr<Scene> scene = new Scene();
     CreateScene(scene, 0);
+    // HLOD proxies are built from the octree hierarchy, after the drawables have been inserted on the first frame
+    int hlodCountdown = 0;
+    if (useHlod)
+    {
+        scene->FindChild<Octree>()->SetStaticBvh(false);
+        hlodCountdown = 2;
+    }
+
+    // Save the spatial nodes of the first scene into cells and stream them back in by camera distance
+    WorldStreamer streamer;
+    if (useWorldStreaming && WorldStreamer::SaveCells(scene, ExecutableDir() + "Data/StreamedWorld.cells", 50.0f, true))
+    {
+        streamer.Open(scene, "StreamedWorld.cells");
+        streamer.SetDistances(250.0f, 300.0f);
+    }
+    if (useCompactTransforms)
+        scene->CompactTransforms();
+    if (usePrecompile)
+        Material::PrecompileAllShaderPrograms(renderer->IsSinglePassPointShadows(), lodFadeBand > 0.0f);
 
     AutoPtr<Camera> camera = new Camera();
     camera->SetPosition(Vector3(0.0f, 20.0f, -75.0f));
+    // Eye cameras for stereo rendering, placed each frame to either side of the main camera
+    AutoPtr<Camera> leftEye = new Camera();
+    AutoPtr<Camera> rightEye = new Camera();
 
     float yaw = 0.0f, pitch = 20.0f;
+    // Camera angles of the view being rendered, which in pipelined mode was prepared on the previous frame
+    float prepareYaw = yaw, preparePitch = pitch, renderYaw = yaw, renderPitch = pitch;
+    // Late latching frame pacing: the refresh interval is estimated as the shortest frame, and each frame sleeps at the start so that its work finishes a safety margin before the refresh
+    int refreshUSec = 0, workUSec = 0, sleepUSec = 0, presentUSec = 0;
     HiresTimer frameTimer;
     Timer profilerTimer;
     float dt = 0.0f;
@@ -213,8 +559,11 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     int shadowMode = 1;
     bool drawSSAO = false;
     bool animate = true;
+    bool animationLod = false;
+    bool animationSharing = false;
     bool drawDebug = false;
     bool drawShadowDebug = false;
+    int occlusionMode = OCCLUSION_NONE;
 
     std::string profilerOutput;
 
@@ -224,6 +573,12 @@ int ApplicationMain(const std::vector<std::string>& arguments)
         ZoneScoped;
         frameTimer.Reset();
 
+        if (useLateLatch && sleepUSec >= 1000)
+        {
+            PROFILE(FramePacing);
+            Timer::Sleep((unsigned)(sleepUSec / 1000));
+        }
+
         if (profilerTimer.ElapsedMSec() >= 1000)
         {
             profilerOutput = profiler->OutputResults();
@@ -236,12 +591,36 @@ int ApplicationMain(const std::vector<std::string>& arguments)
         // Check for input and scene switch / debug render options
         input->Update();
 
+        if (hlodCountdown && !--hlodCountdown)
+        {
+            Octree* octree = scene->FindChild<Octree>();
+            octree->BuildHlod(octree->Root()->level - 3);
+        }
+
+        int newPreset = -1;
         if (input->KeyPressed(SDLK_F1))
-            CreateScene(scene, 0);
+            newPreset = 0;
         if (input->KeyPressed(SDLK_F2))
-            CreateScene(scene, 1);
+            newPreset = 1;
         if (input->KeyPressed(SDLK_F3))
-            CreateScene(scene, 2);
+            newPreset = 2;
+
+        // The captured view may refer to drawables of the old scene, which would otherwise be rendered after destruction in pipelined mode
+        if (newPreset >= 0)
+        {
+            renderer->DiscardPreparedView();
+            streamer.Close();
+            CreateScene(scene, newPreset);
+            if (useHlod)
+            {
+                scene->FindChild<Octree>()->SetStaticBvh(false);
+                hlodCountdown = 2;
+            }
+            if (useCompactTransforms)
+                scene->CompactTransforms();
+            if (usePrecompile)
+                Material::PrecompileAllShaderPrograms(renderer->IsSinglePassPointShadows(), lodFadeBand > 0.0f);
+        }
 
         if (input->KeyPressed(SDLK_1))
         {
@@ -260,12 +639,87 @@ int ApplicationMain(const std::vector<std::string>& arguments)
             drawShadowDebug = !drawShadowDebug;
         if (input->KeyPressed(SDLK_4))
             drawDebug = !drawDebug;
+        if (input->KeyPressed(SDLK_5))
+        {
+            occlusionMode = (occlusionMode + 1) % (OCCLUSION_SOFTWARE + 1);
+            renderer->SetOcclusionMode((OcclusionMode)occlusionMode);
+        }
+        if (input->KeyPressed(SDLK_6))
+            renderer->SetTemporalCoherence(!renderer->IsTemporalCoherence());
+        if (input->KeyPressed(SDLK_7))
+            renderer->SetDepthPrePass(!renderer->IsDepthPrePass());
+        if (input->KeyPressed(SDLK_8))
+            renderer->SetComputeClustering(!renderer->IsComputeClustering());
+        if (input->KeyPressed(SDLK_9))
+            renderer->SetAdaptiveClusterSlices(!renderer->IsAdaptiveClusterSlices());
+        if (input->KeyPressed(SDLK_0))
+            renderer->SetShadowBudget(!renderer->IsShadowBudget());
+        if (input->KeyPressed(SDLK_c))
+            renderer->SetDirShadowCaching(!renderer->IsDirShadowCaching());
+        if (input->KeyPressed(SDLK_p))
+            renderer->SetSinglePassPointShadows(!renderer->IsSinglePassPointShadows());
+        if (input->KeyPressed(SDLK_v))
+            renderer->SetMomentShadows(!renderer->IsMomentShadows());
+        if (input->KeyPressed(SDLK_k))
+            renderer->SetComputeSkinning(!renderer->IsComputeSkinning());
+        if (input->KeyPressed(SDLK_m))
+            renderer->SetMeshletCulling(!renderer->IsMeshletCulling());
+        if (input->KeyPressed(SDLK_i))
+            renderer->SetStaticInstanceTable(!renderer->IsStaticInstanceTable());
+        if (input->KeyPressed(SDLK_e))
+            renderer->SetDeferredShading(!renderer->IsDeferredShading());
+        if (input->KeyPressed(SDLK_n))
+            Sampler::SetAnisotropyLimit(Sampler::AnisotropyLimit() > 1 ? 1 : 16);
+        // Moving the world transforms invalidates the matrix pointers of a captured view
+        if (input->KeyPressed(SDLK_o))
+        {
+            renderer->DiscardPreparedView();
+            scene->FindChild<Octree>()->SortTransforms();
+        }
         if (input->KeyPressed(SDLK_SPACE))
             animate = !animate;
+        if (input->KeyPressed(SDLK_l))
+            animationLod = !animationLod;
+        if (input->KeyPressed(SDLK_l) || newPreset >= 0)
+        {
+            for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
+                (*it)->SetAnimationLodDistance(animationLod ? 25.0f : 0.0f);
+        }
+        if (input->KeyPressed(SDLK_h))
+            animationSharing = !animationSharing;
+        if (input->KeyPressed(SDLK_h) || newPreset >= 0)
+        {
+            for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
+                (*it)->SetAnimationSharingStep(animationSharing ? 1.0f / 30.0f : 0.0f);
+        }
 
         if (input->KeyPressed(SDLK_f))
             graphics->SetFullscreen(!graphics->IsFullscreen());
 
+        // Toggle trace recording, saving the trace when stopped
+        if (input->KeyPressed(SDLK_t))
+        {
+            bool recording = !traceRecorder->IsEnabled();
+            traceRecorder->SetEnabled(recording);
+            if (!recording)
+            {
+                File traceFile(ExecutableDir() + "Trace.json", FILE_WRITE);
+                if (traceFile.IsWritable())
+                    traceRecorder->SaveChromeTrace(traceFile);
+            }
+        }
+
+        // Save the view prepared on this frame as a frame capture, with all shadow maps rendered fully
+        bool captureFrame = input->KeyPressed(SDLK_g);
+        if (captureFrame)
+            renderer->ResetShadowMaps();
+        auto saveCapture = [&]()
+        {
+            File captureFile(ExecutableDir() + "Capture.tcap", FILE_WRITE);
+            if (captureFile.IsWritable())
+                renderer->SaveFrameCapture(captureFile);
+        };
+
         // Camera movement
         IntVector2 mouseMove = input->MouseMove();
         yaw += mouseMove.x * 0.1f;
@@ -284,6 +738,10 @@ int ApplicationMain(const std::vector<std::string>& arguments)
         if (input->KeyDown(SDLK_d))
             camera->Translate(Vector3::RIGHT * dt * moveSpeed);
 
+        // The unloaded cells may be referred to by a captured view
+        if (streamer.GetScene() && streamer.Update(camera->Position()))
+            renderer->DiscardPreparedView();
+
         // Scene animation
         if (animate)
         {
@@ -291,33 +749,22 @@ int ApplicationMain(const std::vector<std::string>& arguments)
 
             PROFILE(MoveObjects);
         
-            if (rotatingObjects.size())
-            {
-                angle += 100.0f * dt;
-                Quaternion rotQuat(angle, Vector3::ONE);
-                for (auto it = rotatingObjects.begin(); it != rotatingObjects.end(); ++it)
-                    (*it)->SetRotation(rotQuat);
-            }
-            else if (animatingObjects.size())
-            {
-                for (auto it = animatingObjects.begin(); it != animatingObjects.end(); ++it)
-                {
-                    AnimatedModel* object = *it;
-                    AnimationState* state = object->AnimationStates()[0];
-                    state->AddTime(dt);
-                    object->Translate(Vector3::FORWARD * 2.0f * dt);
-
-                    // Rotate to avoid going outside the plane
-                    Vector3 pos = object->Position();
-                    if (pos.x < -45.0f || pos.x > 45.0f || pos.z < -45.0f || pos.z > 45.0f)
-                        object->Yaw(45.0f * dt);
-                }
-            }
+            // The boxes and walkers are updated in parallel by their callbacks
+            angle += 100.0f * dt;
+            objectRotation = Quaternion(angle, Vector3::ONE);
+            scene->Update(dt);
+
+            for (auto it = particleEmitters.begin(); it != particleEmitters.end(); ++it)
+                (*it)->Update(dt);
+            for (auto it = crowds.begin(); it != crowds.end(); ++it)
+                (*it)->Update(dt);
         }
 
-        // Recreate rendertarget textures if window resolution changed
-        int width = graphics->RenderWidth();
-        int height = graphics->RenderHeight();
+        // Recreate rendertarget textures if window resolution or the dynamic resolution scale changed
+        IntVector2 nativeSize = graphics->RenderSize();
+        IntVector2 renderSize = dynamicResolution->RenderSize(nativeSize);
+        int width = renderSize.x;
+        int height = renderSize.y;
 
         if (colorBuffer->Width() != width || colorBuffer->Height() != height)
         {
@@ -325,34 +772,13 @@ int ApplicationMain(const std::vector<std::string>& arguments)
             colorBuffer->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
             depthStencilBuffer->Define(TEX_2D, IntVector2(width, height), FMT_D32);
             depthStencilBuffer->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
-            normalBuffer->Define(TEX_2D, IntVector2(width, height), FMT_RGBA8);
-            normalBuffer->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
             viewFbo->Define(colorBuffer, depthStencilBuffer);
-
-            std::vector<Texture*> mrt;
-            mrt.push_back(colorBuffer.Get());
-            mrt.push_back(normalBuffer.Get());
-            viewMRTFbo->Define(mrt, depthStencilBuffer);
         }
 
-        // Similarly recreate SSAO texture if needed
-        if (drawSSAO && (ssaoTexture->Width() != colorBuffer->Width() / 2 || ssaoTexture->Height() != colorBuffer->Height() / 2))
-        {
-            ssaoTexture->Define(TEX_2D, IntVector2(colorBuffer->Width() / 2, colorBuffer->Height() / 2), FMT_R32F, 1, 1);
-            ssaoTexture->DefineSampler(FILTER_BILINEAR, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
-            ssaoFbo->Define(ssaoTexture, nullptr);
-        }
+        camera->SetAspectRatio((float)nativeSize.x / (float)nativeSize.y);
 
-        camera->SetAspectRatio((float)width / (float)height);
-
-        // Collect geometries and lights in frustum. Also set debug renderer to use the correct camera view
-        {
-            PROFILE(PrepareView);
-            renderer->PrepareView(scene, camera, shadowMode > 0);
-            debugRenderer->SetView(camera);
-        }
-        
         // Raycast into the scene using the camera forward vector. If has a hit, draw a small debug sphere at the hit location
+        auto raycast = [&]()
         {
             PROFILE(Raycast);
 
@@ -360,112 +786,251 @@ int ApplicationMain(const std::vector<std::string>& arguments)
             RaycastResult res = scene->FindChild<Octree>()->RaycastSingle(cameraRay, DF_GEOMETRY);
             if (res.drawable)
                 debugRenderer->AddSphere(Sphere(res.position, 0.05f), Color::WHITE, true);
+        };
+
+        // Sample the mouse again just before rendering and turn the camera, within the late latching angle of the view being rendered
+        auto latchCamera = [&]()
+        {
+            PROFILE(LatchCamera);
+
+            input->Update();
+            IntVector2 mouseMove = input->MouseMove();
+            yaw += mouseMove.x * 0.1f;
+            pitch += mouseMove.y * 0.1f;
+            pitch = Clamp(pitch, -90.0f, 90.0f);
+
+            float latchAngle = renderer->LateLatchingAngle();
+            camera->SetRotation(Quaternion(Clamp(pitch, renderPitch - latchAngle, renderPitch + latchAngle), Clamp(yaw, renderYaw - latchAngle, renderYaw + latchAngle), 0.0f));
+            renderer->LatchCamera(camera);
+            debugRenderer->SetView(camera);
+        };
+
+        // Collect geometries and lights in frustum. Also set debug renderer to use the correct camera view
+        // In pipelined mode this only starts the preparation, and the previous frame's view is rendered below
+        {
+            PROFILE(PrepareView);
+            if (useStereo)
+            {
+                const float eyeSeparation = 0.065f;
+                Vector3 eyeOffset = camera->WorldRotation() * Vector3(0.5f * eyeSeparation, 0.0f, 0.0f);
+                leftEye->SetTransform(camera->WorldPosition() - eyeOffset, camera->WorldRotation());
+                rightEye->SetTransform(camera->WorldPosition() + eyeOffset, camera->WorldRotation());
+                leftEye->SetAspectRatio(0.5f * (float)nativeSize.x / (float)nativeSize.y);
+                rightEye->SetAspectRatio(0.5f * (float)nativeSize.x / (float)nativeSize.y);
+                renderer->PrepareStereoView(scene, leftEye, rightEye, shadowMode > 0);
+            }
+            else
+                renderer->PrepareView(scene, camera, shadowMode > 0);
+            debugRenderer->SetView(camera);
+
+            prepareYaw = yaw;
+            preparePitch = pitch;
+            if (!usePipelining)
+            {
+                renderYaw = prepareYaw;
+                renderPitch = preparePitch;
+            }
         }
 
-        // Now render the scene, starting with shadowmaps and opaque geometries
+        // The octree must not be accessed while a pipelined preparation is in progress
+        if (!usePipelining)
+        {
+            raycast();
+            if (captureFrame)
+                saveCapture();
+        }
+
+        // Now render the scene through the frame graph, starting with shadowmaps and opaque geometries
         {
             PROFILE(RenderView);
 
-            renderer->RenderShadowMaps();
+            frameGraph->Reset();
+
+            unsigned color = frameGraph->ImportTexture("Color", colorBuffer);
+            unsigned depth = frameGraph->ImportTexture("Depth", depthStencilBuffer);
+            frameGraph->SetOutput(color);
+
+            // The renderer binds its own framebuffers for the shadowmaps
+            unsigned shadowPass = frameGraph->AddPass("Shadows", [&]() { renderer->RenderShadowMaps(); });
+            frameGraph->SetSideEffects(shadowPass);
 
             // The default opaque shaders can write both color (first RT) and view-space normals (second RT).
-            // If going to render SSAO, bind both rendertargets, else just the color RT
-            if (drawSSAO)
-                graphics->SetFrameBuffer(viewMRTFbo);
-            else
-                graphics->SetFrameBuffer(viewFbo);
+            // If going to render SSAO, bind both rendertargets, else just the color RT. The normals are needed only until SSAO has been rendered
+            // In deferred shading the first RT receives the unlit albedo instead, and the normals are always needed for the lighting pass
+            std::vector<unsigned> opaqueTargets(1, color);
+            unsigned normal = FRAMEGRAPH_NONE;
+            unsigned albedo = FRAMEGRAPH_NONE;
+            // The AO stage assumes a single view, so it is skipped in stereo
+            bool renderSSAO = drawSSAO && !renderer->IsStereo();
+            bool renderDeferred = renderer->IsDeferredShading();
+            if (renderDeferred)
+            {
+                albedo = frameGraph->AddTexture("Albedo", IntVector2(width, height), FMT_RGBA8);
+                opaqueTargets[0] = albedo;
+            }
+            if (renderSSAO || renderDeferred)
+            {
+                normal = frameGraph->AddTexture("Normal", IntVector2(width, height), FMT_RGBA8);
+                opaqueTargets.push_back(normal);
+            }
 
-            graphics->SetViewport(IntRect(0, 0, width, height));
-            graphics->Clear(true, true, IntRect::ZERO, Color::BLACK);
+            unsigned opaquePass = frameGraph->AddPass("Opaque", [&]()
+            {
+                if (useLateLatch && !renderer->IsStereo())
+                    latchCamera();
+                renderer->RenderOpaque(depthStencilBuffer);
+
+                // Downsample the opaque depth for occlusion culling of the following frames
+                if (occlusionMode == OCCLUSION_GPU)
+                    renderer->RenderOcclusionDepth(depthStencilBuffer);
+            });
+            frameGraph->SetRenderTargets(opaquePass, opaqueTargets, depth, LOAD_CLEAR, Color::BLACK);
+
+            // Light the G-buffer into the color rendertarget. The depth buffer is sampled, so it can not stay bound
+            if (renderDeferred)
+            {
+                unsigned lightingPass = frameGraph->AddPass("Lighting", [&, albedo, normal, depth]()
+                {
+                    renderer->RenderDeferredLighting(frameGraph->GetTexture(albedo), frameGraph->GetTexture(normal), frameGraph->GetTexture(depth));
+                });
+                frameGraph->Read(lightingPass, albedo);
+                frameGraph->Read(lightingPass, normal);
+                frameGraph->Read(lightingPass, depth);
+                frameGraph->SetRenderTargets(lightingPass, std::vector<unsigned>(1, color), FRAMEGRAPH_NONE, LOAD_CLEAR, Color::BLACK);
+            }
 
-            renderer->RenderOpaque();
+            // Optional SSAO effect. Samples the normals and depth buffer, then subtracts a blurred SSAO result that darkens the opaque geometry
+            if (renderSSAO)
+                ambientOcclusion->AddPasses(frameGraph, camera, color, depth, normal);
 
-            // Optional SSAO effect. First sample the normals and depth buffer, then apply a blurred SSAO result that darkens the opaque geometry
-            if (drawSSAO)
+            // With order-independent transparency, accumulate the alpha geometry into the accumulation and weight rendertargets, tested
+            // against the opaque depth. The transient targets are cleared on first use, with the revealage in the alpha starting from 1
+            unsigned accum = FRAMEGRAPH_NONE;
+            unsigned weight = FRAMEGRAPH_NONE;
+            if (renderer->IsOrderIndependentTransparency())
             {
-                float farClip = camera->FarClip();
-                float nearClip = camera->NearClip();
-                Vector3 nearVec, farVec;
-                camera->FrustumSize(nearVec, farVec);
-
-                ShaderProgram* program = graphics->SetProgram("Shaders/SSAO.glsl");
-                graphics->SetFrameBuffer(ssaoFbo);
-                graphics->SetViewport(IntRect(0, 0, ssaoTexture->Width(), ssaoTexture->Height()));
-                graphics->SetUniform(program, "noiseInvSize", Vector2(ssaoTexture->Width() / 4.0f, ssaoTexture->Height() / 4.0f));
-                graphics->SetUniform(program, "screenInvSize", Vector2(1.0f / colorBuffer->Width(), 1.0f / colorBuffer->Height()));
-                graphics->SetUniform(program, "frustumSize", Vector4(farVec, (float)height / (float)width));
-                graphics->SetUniform(program, "aoParameters", Vector4(0.15f, 1.0f, 0.015f, 0.15f));
-                graphics->SetUniform(program, "depthReconstruct", Vector2(farClip / (farClip - nearClip), -nearClip / (farClip - nearClip)));
-                graphics->SetTexture(0, depthStencilBuffer);
-                graphics->SetTexture(1, normalBuffer);
-                graphics->SetTexture(2, noiseTexture);
-                graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
-                graphics->DrawQuad();
-                graphics->SetTexture(1, nullptr);
-                graphics->SetTexture(2, nullptr);
-
-                program = graphics->SetProgram("Shaders/SSAOBlur.glsl");
-                graphics->SetFrameBuffer(viewFbo);
-                graphics->SetViewport(IntRect(0, 0, width, height));
-                graphics->SetUniform(program, "blurInvSize", Vector2(1.0f / ssaoTexture->Width(), 1.0f / ssaoTexture->Height()));
-                graphics->SetTexture(0, ssaoTexture);
-                graphics->SetRenderState(BLEND_SUBTRACT, CULL_NONE, CMP_ALWAYS, true, false);
-                graphics->DrawQuad();
-                graphics->SetTexture(0, nullptr);
+                std::vector<unsigned> oitTargets;
+                accum = frameGraph->AddTexture("OITAccum", IntVector2(width, height), FMT_RGBA16F);
+                weight = frameGraph->AddTexture("OITWeight", IntVector2(width, height), FMT_R16F);
+                oitTargets.push_back(accum);
+                oitTargets.push_back(weight);
+                unsigned accumulatePass = frameGraph->AddPass("AlphaAccumulate", [&]() { renderer->RenderAlpha(); });
+                frameGraph->SetRenderTargets(accumulatePass, oitTargets, depth, LOAD_PRESERVE, Color(0.0f, 0.0f, 0.0f, 1.0f));
             }
 
-            // Render alpha geometry. Now only the color rendertarget is needed
-            graphics->SetFrameBuffer(viewFbo);
-            graphics->SetViewport(IntRect(0, 0, width, height));
-            renderer->RenderAlpha();
+            // Render alpha geometry, or composite the accumulated alpha geometry. Now only the color rendertarget is needed
+            unsigned alphaPass = frameGraph->AddPass("Alpha", [&, accum, weight]()
+            {
+                if (accum != FRAMEGRAPH_NONE)
+                    renderer->RenderAlphaComposite(frameGraph->GetTexture(accum), frameGraph->GetTexture(weight));
+                else
+                    renderer->RenderAlpha();
 
-            // Optional render of debug geometry
-            if (drawDebug)
-                renderer->RenderDebug();
+                // Optional render of debug geometry
+                if (drawDebug && !usePipelining)
+                    renderer->RenderDebug();
 
-            debugRenderer->Render();
+                debugRenderer->Render();
 
-            // Optional debug render of shadowmap. Draw both dir light cascades and the shadow atlas
-            if (drawShadowDebug)
+                // Optional debug render of shadowmap. Draw both dir light cascades and the shadow atlas
+                if (drawShadowDebug)
+                {
+                    Matrix4 quadMatrix = Matrix4::IDENTITY;
+                    quadMatrix.m00 = 0.33f * 2.0f * (9.0f / 16.0f);
+                    quadMatrix.m11 = 0.33f;
+                    quadMatrix.m03 = -1.0f + quadMatrix.m00;
+                    quadMatrix.m13 = -1.0f + quadMatrix.m11;
+
+                    ShaderProgram* program = graphics->SetProgram("Shaders/DebugQuad.glsl");
+                    graphics->SetUniform(program, U_WORLDVIEWPROJMATRIX, quadMatrix);
+                    graphics->SetTexture(0, renderer->ShadowMapTexture(0));
+                    graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+                    graphics->DrawQuad();
+
+                    quadMatrix.m03 += 1.5f * quadMatrix.m00;
+                    quadMatrix.m00 = 0.33f * (9.0f / 16.0f);
+
+                    graphics->SetUniform(program, U_WORLDVIEWPROJMATRIX, quadMatrix);
+                    graphics->SetTexture(0, renderer->ShadowMapTexture(1));
+                    graphics->DrawQuad();
+
+                    graphics->SetTexture(0, nullptr);
+                }
+            });
+            if (accum != FRAMEGRAPH_NONE)
             {
-                Matrix4 quadMatrix = Matrix4::IDENTITY;
-                quadMatrix.m00 = 0.33f * 2.0f * (9.0f / 16.0f);
-                quadMatrix.m11 = 0.33f;
-                quadMatrix.m03 = -1.0f + quadMatrix.m00;
-                quadMatrix.m13 = -1.0f + quadMatrix.m11;
-
-                ShaderProgram* program = graphics->SetProgram("Shaders/DebugQuad.glsl");
-                graphics->SetUniform(program, "worldViewProjMatrix", quadMatrix);
-                graphics->SetTexture(0, renderer->ShadowMapTexture(0));
-                graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
-                graphics->DrawQuad();
-
-                quadMatrix.m03 += 1.5f * quadMatrix.m00;
-                quadMatrix.m00 = 0.33f * (9.0f / 16.0f);
-
-                graphics->SetUniform(program, "worldViewProjMatrix", quadMatrix);
-                graphics->SetTexture(0, renderer->ShadowMapTexture(1));
-                graphics->DrawQuad();
-
-                graphics->SetTexture(0, nullptr);
+                frameGraph->Read(alphaPass, accum);
+                frameGraph->Read(alphaPass, weight);
             }
+            frameGraph->SetRenderTargets(alphaPass, std::vector<unsigned>(1, color), depth);
 
-            // Blit rendered contents to backbuffer now before presenting
-            graphics->Blit(nullptr, IntRect(0, 0, width, height), viewFbo, IntRect(0, 0, width, height), true, false, FILTER_POINT);
+            frameGraph->Compile();
+            frameGraph->Execute();
+
+            // Blit rendered contents to backbuffer now before presenting, or upscale if rendered at reduced resolution
+            if (renderSize == nativeSize)
+                graphics->Blit(nullptr, IntRect(0, 0, width, height), viewFbo, IntRect(0, 0, width, height), true, false, FILTER_POINT);
+            else
+                dynamicResolution->Upscale(colorBuffer, nativeSize);
         }
 
         {
             PROFILE(Present);
+            HiresTimer presentTimer;
             graphics->Present();
+            presentUSec = (int)presentTimer.ElapsedUSec();
         }
 
+        dynamicResolution->Update();
+
+        // Wait for the pipelined preparation before the scene is modified again. Debug geometry is rendered along with the captured view next frame
+        if (usePipelining)
+        {
+            {
+                PROFILE(FinishView);
+                renderer->FinishView();
+            }
+
+            raycast();
+            if (captureFrame)
+                saveCapture();
+            if (drawDebug)
+                renderer->RenderDebug();
+        }
+
+        cache->UpdateAsyncLoading(2.0f);
+        if (cache->UpdateAutoReload())
+            renderer->DiscardPreparedView();
+        cache->EvictResources();
+        eventQueue->Dispatch();
         profiler->EndFrame();
-        dt = frameTimer.ElapsedUSec() * 0.000001f;
+        workQueue->EndFrame();
+        int frameUSec = (int)frameTimer.ElapsedUSec();
+        // Advance by the averaged present-to-present interval when smoothing, so that the simulation does not stutter with single frame spikes
+        dt = useSmoothTime && graphics->FrameTime() > 0.0f ? graphics->FrameTime() : frameUSec * 0.000001f;
+
+        if (usePipelining)
+        {
+            renderYaw = prepareYaw;
+            renderPitch = preparePitch;
+        }
+
+        // The work estimate rises at once and falls slowly, so that a single slow frame does not miss the refresh repeatedly
+        if (useLateLatch && graphics->VSync())
+        {
+            const int safetyUSec = 2000;
+            int frameWorkUSec = Max(frameUSec - sleepUSec - presentUSec, 0);
+            if (!refreshUSec || frameUSec < refreshUSec)
+                refreshUSec = frameUSec;
+            workUSec = Max(frameWorkUSec, (workUSec * 7 + frameWorkUSec) / 8);
+            sleepUSec = Max(refreshUSec - workUSec - safetyUSec, 0);
+        }
 
         FrameMark;
     }
 
     printf("%s", profilerOutput.c_str());
+    printf("\n%s", cache->MemoryReport().c_str());
 
     return 0;
 }